@@ -0,0 +1,134 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+{-
+    Copyright  : Copyright (C) 2014-2024 Synchrotron SOLEIL
+                                         L'Orme des Merisiers Saint-Aubin
+                                         BP 48 91192 GIF-sur-YVETTE CEDEX
+    License    : GPL3+
+
+    Maintainer : Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+    Stability  : Experimental
+    Portability: GHC only (not tested)
+-}
+
+-- | the Haskell side of the qcustom projection on a synthetic scan
+-- of the default detector, saved in a temporary directory: the
+-- chunks, the frames read by framesP, their projection, the
+-- accumulation of the spaces into a cube and its saving.
+module Main (main) where
+
+import           Control.DeepSeq                   (NFData (..))
+import           Control.Monad.IO.Class            (liftIO)
+import           Criterion.Main                    (bench, bgroup, defaultMain,
+                                                    env, nf, whnfIO)
+import           Data.Vector.Storable              (Storable, generate,
+                                                    unsafeToForeignPtr0)
+import           Data.Word                         (Word16)
+import           Numeric.Units.Dimensional.Prelude (degree, meter, radian,
+                                                    (*~))
+import           Pipes                             (each, runEffect, (>->))
+import           Pipes.Prelude                     (mapM_, toListM)
+import           Pipes.Safe                        (runSafeT)
+import           System.Directory                  (getTemporaryDirectory)
+import           System.FilePath                   ((</>))
+
+import           Hkl.Binoculars
+import           Hkl.Binoculars.Projections.QCustom
+import           Hkl.C.Binoculars
+import           Hkl.DataSource
+import           Hkl.Detector
+import           Hkl.H5
+import           Hkl.Image                         (imagePool,
+                                                    imagePoolRelease)
+import           Hkl.Repa
+
+import           Prelude                           hiding (mapM_)
+
+-- Synthetic scan
+
+nFrames :: Int
+nFrames = 20
+
+-- | the attenuations are read two frames after the images
+attenuationOffset :: Int
+attenuationOffset = 2
+
+newtype Scan = Scan Hdf5
+
+instance ToHdf5 Scan where
+  toHdf5 (Scan h) = h
+
+array :: (Shape sh, Storable e) => sh -> (Int -> e) -> Array F sh e
+array sh f = fromForeignPtr sh (fst . unsafeToForeignPtr0 $ generate (size sh) f)
+
+-- | the layout of the default datapath of the qcustom projection
+scan :: Scan
+scan = Scan $ hdf5 $ group "scan"
+       [ group "scan_data"
+         [ dataset "xpad_image" (array (ix3 nFrames height width) image)
+         , dataset "attenuation" (array (Z :. nFrames + attenuationOffset) (const (0 :: Float)))
+         , dataset "UHV_MU" (position 0.1)
+         , dataset "UHV_OMEGA" (position 10)
+         , dataset "UHV_DELTA" (position 0.5)
+         , dataset "UHV_GAMMA" (position 20)
+         , dataset "epoch" (position 1)
+         ]
+       , group "SIXS" [ group "Monochromator" [ dataset "wavelength" (array (Z :. 1) (const (1.54 :: Double))) ] ]
+       ]
+  where
+    (Z :. height :. width) = shape defaultDetector
+
+    image :: Int -> Word16
+    image i = toEnum (i `mod` 7)
+
+    position :: Double -> Array F DIM1 Double
+    position step = array (Z :. nFrames) (\i -> step * fromIntegral i)
+
+scanPath :: DataSourcePath DataFrameQCustom
+scanPath = default'DataSourcePath'DataFrameQCustom
+
+-- | everything set up once for the benchmarks
+data Env = Env FilePath (Array F DIM3 Double) (Space DIM3) DataFrameQCustom (DataFrameSpace DIM3) (Cube DIM3)
+
+-- | the foreign pointers are already evaluated
+instance NFData Env where
+  rnf e = e `seq` ()
+
+setup :: IO Env
+setup = do
+  tmp <- getTemporaryDirectory
+  let fn = tmp </> "binoculars-bench-scan.h5"
+  saveHdf5 fn scan
+  pixels <- getPixelsCoordinates defaultDetector (280, 120) (1 *~ meter) (0 *~ degree) NoNormalisation
+  space <- newSpace defaultDetector 3
+  (frame : _) <- runSafeT $ toListM $ each [(fn, [0])] >-> framesP scanPath
+  df <- project' pixels space frame
+  cube <- addSpace df EmptyCube
+  pure $ Env fn pixels space frame df cube
+
+project' :: Array F DIM3 Double -> Space DIM3 -> DataFrameQCustom -> IO (DataFrameSpace DIM3)
+project' pixels = spaceQCustom defaultDetector pixels
+                  (Resolutions3 0.01 0.01 0.01) Nothing
+                  HklBinocularsSurfaceOrientationEnum'Vertical Nothing
+                  HklBinocularsQCustomSubProjectionEnum'QxQyQz
+                  (0 *~ radian) (0 *~ radian) (0 *~ radian)
+                  Nothing False
+
+-- | read all the frames of the scan and give back their images
+readFrames :: FilePath -> IO ()
+readFrames fn = runSafeT $ runEffect $
+  each [(fn, [0 .. nFrames - 1])]
+  >-> framesP scanPath
+  >-> mapM_ (\(DataFrameQCustom _ _ img _) -> liftIO $ imagePoolRelease imagePool img)
+
+main :: IO ()
+main = defaultMain
+  [ bench "chunk" $ nf (length . chunk 100) [Chunk (show i) 0 (999 :: Int) | i <- [0 .. 99 :: Int]]
+  , env setup $ \ ~(Env fn pixels space frame df cube) ->
+      bgroup "qcustom"
+      [ bench "framesP" $ whnfIO (readFrames fn)
+      , bench "spaceQCustom" $ whnfIO (project' pixels space frame)
+      , bench "addSpace" $ whnfIO (addSpace df cube)
+      , bench "saveCube" $ whnfIO (saveCube (fn ++ ".cube.h5") "" [cube])
+      ]
+  ]
@@ -21,6 +21,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <argp.h>
 #include <assert.h>
 #include <stdbool.h>
@@ -360,8 +361,10 @@ parse_global(int key, char* arg, struct argp_state* state)
                 argp_error(state, "%s is not a valid command", arg);
 		break;
 	case ARGP_KEY_END:
-		hkl_binoculars_cmd_args_fprintf(stdout, global);
-		fprintf(stdout, "\n");
+		if(global->verbosity > 1){
+			hkl_binoculars_cmd_args_fprintf(stdout, global);
+			fprintf(stdout, "\n");
+		}
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
@@ -383,7 +386,7 @@ static char doc_global[] =
 
 static struct argp argp_global = { opt_global, parse_global, "[<cmd> [CMD-OPTIONS]]...", doc_global };
 
-void cmd_global(int argc, char**argv)
+int cmd_global(int argc, char**argv)
 {
 	HklBinocularsCmdArgs global = {
 		.verbosity=1, /* default verbosity */
@@ -393,15 +396,19 @@ void cmd_global(int argc, char**argv)
 		   argc, argv[0]);
 
 	argp_parse(&argp_global, argc, argv, ARGP_IN_ORDER, NULL, &global);
+
+	/* the default option is an empty process */
+	ifLet(global.option, Process, filepath, input_ranges){
+		if(NULL != *filepath)
+			return hkl_binoculars_process(*filepath, *input_ranges, global.verbosity);
+	}
+
+	return 0;
 }
 
 
 
 int main(int argc, char *argv[])
 {
-	cmd_global(argc, argv);
-
-	/* hkl_binoculars_config(); */
-
-	exit(0);
+	exit(0 == cmd_global(argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -12,18 +12,70 @@ G_BEGIN_DECLS
 datatype(
         HklBinocularsNpyDataType,
         (HklBinocularsNpyBool),
-        (HklBinocularsNpyDouble)
+        (HklBinocularsNpyDouble),
+        (HklBinocularsNpyUInt32),
+        (HklBinocularsNpyInt64)
         );
 
 extern void *npy_load(const char *filename,
                       HklBinocularsNpyDataType type,
                       const darray_int *shape);
 
+/* read-only mapping of the file, NULL if it can not be mapped;
+ * release it with npy_munmap */
+extern void *npy_mmap(const char *filename,
+                      HklBinocularsNpyDataType type,
+                      const darray_int *shape);
+
+extern void npy_munmap(void *arr);
+
 extern void npy_save(const char *fname,
                      const void *arr,
                      HklBinocularsNpyDataType type,
                      const darray_int *shape);
 
+/* streaming writer: the header is written with the final shape, then
+ * the elements are appended in the C order. The missing elements are
+ * written as zeros by npy_writer_close which returns -1 on error. */
+struct npy_writer_t;
+
+extern struct npy_writer_t *npy_writer_new(const char *fname,
+                                           HklBinocularsNpyDataType type,
+                                           const darray_int *shape);
+
+extern int npy_writer_append(struct npy_writer_t *self,
+                             const void *arr, size_t n_elems);
+
+extern int npy_writer_close(struct npy_writer_t *self);
+
+/* npz archive of npy members, deflated if compress and zlib is
+ * available. The members are written one at a time: npz_array_new
+ * returns the writer of the <name>.npy member, closed with
+ * npy_writer_close. The members are limited to 4GiB. */
+struct npz_t;
+
+extern struct npz_t *npz_open(const char *fname, int compress);
+
+extern struct npy_writer_t *npz_array_new(struct npz_t *self,
+                                          const char *name,
+                                          HklBinocularsNpyDataType type,
+                                          const darray_int *shape);
+
+extern int npz_save(struct npz_t *self,
+                    const char *name,
+                    const void *arr,
+                    HklBinocularsNpyDataType type,
+                    const darray_int *shape);
+
+extern int npz_close(struct npz_t *self);
+
+/* read-only mapping of the <name>.npy member of a npz, NULL if it is
+ * compressed or can not be mapped; release it with npy_munmap */
+extern void *npz_mmap(const char *fname,
+                      const char *name,
+                      HklBinocularsNpyDataType type,
+                      const darray_int *shape);
+
 G_END_DECLS
 
 #endif
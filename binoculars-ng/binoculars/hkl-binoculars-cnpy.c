@@ -2,9 +2,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <regex.h>
 #include <string.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "hkl-binoculars-cnpy-private.h"
 #include "hkl/ccan/array_size/array_size.h"
@@ -67,33 +72,44 @@ static char *extract_as_string(const char *header, regmatch_t match)
         return buffer;
 }
 
-static struct descr_t parse_descr(const char *header, regmatch_t match)
+/* only the little endian (or without endianness) types read by
+ * binoculars, their type and size must match. */
+static int parse_descr(const char *header, regmatch_t match,
+                       struct descr_t *descr)
 {
+        int res = TRUE;
         char *description = extract_as_string(header, match);
 
-        struct descr_t descr;
-
         /* endianness */
         switch(description[0]){
         case '|':
         case '<':
-                descr.endianess = LittleEndian();
+                descr->endianess = LittleEndian();
                 break;
-        };
-
-        /* elem_type */
-        switch(description[1]){
-        case 'b':
-                descr.elem_type = HklBinocularsNpyBool();
+        default:
+                res = FALSE;
                 break;
         };
 
-        /* elem_size */
-        descr.elem_size = atoi(&description[2]);
+        /* elem_type and elem_size */
+        if(!strcmp(&description[1], "b1")){
+                descr->elem_type = HklBinocularsNpyBool();
+                descr->elem_size = 1;
+        }else if(!strcmp(&description[1], "f8")){
+                descr->elem_type = HklBinocularsNpyDouble();
+                descr->elem_size = sizeof(double);
+        }else if(!strcmp(&description[1], "u4")){
+                descr->elem_type = HklBinocularsNpyUInt32();
+                descr->elem_size = sizeof(uint32_t);
+        }else if(!strcmp(&description[1], "i8")){
+                descr->elem_type = HklBinocularsNpyInt64();
+                descr->elem_size = sizeof(int64_t);
+        }else
+                res = FALSE;
 
         free(description);
 
-        return descr;
+        return res;
 }
 
 static int parse_fortran_order(const char *header, regmatch_t match)
@@ -157,9 +173,9 @@ static int shape_size(const darray_int *shape)
         return nb_elem;
 }
 
-static struct npy_t *parse_npy(FILE* fp,
-                               HklBinocularsNpyDataType type,
-                               const darray_int *shape)
+static struct npy_t *parse_npy_header(FILE* fp,
+                                      HklBinocularsNpyDataType type,
+                                      const darray_int *shape)
 {
         struct npy_t *npy = g_new0(struct npy_t, 1);
         size_t res;
@@ -203,9 +219,10 @@ static struct npy_t *parse_npy(FILE* fp,
 
         /* read the header */
 
-        npy->header = malloc(npy->header_len * sizeof(char));
+        npy->header = malloc((npy->header_len + 1) * sizeof(char));
         res = fread(npy->header, 1, npy->header_len, fp);
         assert(res == npy->header_len);
+        npy->header[npy->header_len] = '\0'; /* for regexec */
 
 
         /* parse the header */
@@ -230,7 +247,8 @@ static struct npy_t *parse_npy(FILE* fp,
 
         regfree(&preg);
 
-        npy->descr = parse_descr(npy->header, matches[1]);
+        if(!parse_descr(npy->header, matches[1], &npy->descr))
+                goto fail;
         npy->fortran_order = parse_fortran_order(npy->header, matches[2]);
         parse_shape(npy->header, matches[3], &npy->shape);
 
@@ -240,6 +258,25 @@ static struct npy_t *parse_npy(FILE* fp,
         if(0 != shape_cmp(shape, &npy->shape))
                 goto fail;
 
+        return npy;
+fail:
+        free(npy->header);
+fail_no_header:
+        free(npy);
+
+        return NULL;
+}
+
+static struct npy_t *parse_npy(FILE* fp,
+                               HklBinocularsNpyDataType type,
+                               const darray_int *shape)
+{
+        size_t res;
+        struct npy_t *npy = parse_npy_header(fp, type, shape);
+
+        if (NULL == npy)
+                return NULL;
+
         /* read the array */
         int nbytes = shape_size(&npy->shape) * npy->descr.elem_size;
         npy->arr = malloc( nbytes );
@@ -251,9 +288,7 @@ static struct npy_t *parse_npy(FILE* fp,
 
         return npy;
 fail:
-        free(npy->header);
-fail_no_header:
-        free(npy);
+        npy_free_but_array(npy);
 
         return NULL;
 }
@@ -277,6 +312,92 @@ void *npy_load(const char *fname,
         return arr;
 }
 
+/* mmap */
+
+/* the mapped arrays are registered with their mapping, so that they
+ * can be released from the array pointer only. */
+
+struct npy_mapping_t {
+        void *addr;
+        size_t length;
+};
+
+static GMutex npy_mappings_mutex;
+static GHashTable *npy_mappings = NULL;
+
+/* map the array of the npy header at the current position of fp */
+static void *npy_mmap_fp(FILE *fp,
+                         HklBinocularsNpyDataType type,
+                         const darray_int *shape)
+{
+        uint8_t *arr = NULL;
+        struct npy_t *npy = parse_npy_header(fp, type, shape);
+
+        if (NULL != npy) {
+                struct stat st;
+                long offset = ftell(fp);
+                size_t nbytes = shape_size(&npy->shape) * npy->descr.elem_size;
+
+                if (offset > 0
+                    && 0 == fstat(fileno(fp), &st)
+                    && (size_t)st.st_size >= offset + nbytes){
+                        struct npy_mapping_t *mapping = g_new0(struct npy_mapping_t, 1);
+
+                        mapping->length = offset + nbytes;
+                        mapping->addr = mmap(NULL, mapping->length,
+                                             PROT_READ, MAP_SHARED,
+                                             fileno(fp), 0);
+                        if (MAP_FAILED != mapping->addr){
+                                arr = (uint8_t *)mapping->addr + offset;
+
+                                g_mutex_lock(&npy_mappings_mutex);
+                                if (NULL == npy_mappings)
+                                        npy_mappings = g_hash_table_new_full(NULL, NULL,
+                                                                             NULL, g_free);
+                                g_hash_table_insert(npy_mappings, arr, mapping);
+                                g_mutex_unlock(&npy_mappings_mutex);
+                        } else {
+                                g_free(mapping);
+                        }
+                }
+                npy_free_but_array(npy);
+        }
+
+        return arr;
+}
+
+void *npy_mmap(const char *fname,
+               HklBinocularsNpyDataType type,
+               const darray_int *shape)
+{
+        uint8_t *arr = NULL;
+        FILE* fp = fopen(fname, "rb");
+
+        if (NULL != fp){
+                arr = npy_mmap_fp(fp, type, shape);
+                fclose(fp);
+        }
+        return arr;
+}
+
+void npy_munmap(void *arr)
+{
+        struct npy_mapping_t *mapping = NULL;
+
+        if (NULL == arr)
+                return;
+
+        g_mutex_lock(&npy_mappings_mutex);
+        if (NULL != npy_mappings){
+                mapping = g_hash_table_lookup(npy_mappings, arr);
+                if (NULL != mapping){
+                        munmap(mapping->addr, mapping->length);
+                        g_hash_table_remove(npy_mappings, arr);
+                }
+        }
+        g_mutex_unlock(&npy_mappings_mutex);
+}
+
 static inline char bigendian(void)
 {
         int x = 1;
@@ -290,6 +411,8 @@ static inline char map_type(HklBinocularsNpyDataType type)
         match(type){
                 of(HklBinocularsNpyBool)   res = 'b';
                 of(HklBinocularsNpyDouble) res = 'f';
+                of(HklBinocularsNpyUInt32) res = 'u';
+                of(HklBinocularsNpyInt64)  res = 'i';
         }
 
 	/* if(t == typeid(float) ) return 'f'; */
@@ -325,6 +448,8 @@ static inline int map_size(HklBinocularsNpyDataType type)
         match(type){
                 of(HklBinocularsNpyBool)   res = 1;
                 of(HklBinocularsNpyDouble) res = 8;
+                of(HklBinocularsNpyUInt32) res = 4;
+                of(HklBinocularsNpyInt64)  res = 8;
         }
 
         return res;
@@ -349,15 +474,17 @@ static inline char *create_npy_header(HklBinocularsNpyDataType type,
         fprintf(stream, "'descr': '%c%c%d'",
                 bigendian(), map_type(type), map_size(type));
         fprintf(stream, ", ");
-        fprintf(stream, "'fortran_order' : False");
+        fprintf(stream, "'fortran_order': False");
         fprintf(stream, ", ");
         fprintf(stream, "'shape': (");
         fprintf(stream, "%d", darray_item(*shape, 0));
         for(i=1; i<darray_size(*shape); ++i){
                 fprintf(stream, ", %d", darray_item(*shape, i));
         }
+        if(1 == darray_size(*shape))
+                fprintf(stream, ","); /* (n,) is a tuple for python */
         fprintf(stream, ")");
-        fprintf(stream, ",");
+        fprintf(stream, ", ");
         fprintf(stream, "}");
 
         fflush(stream);
@@ -393,27 +520,559 @@ fail:
         return NULL;
 }
 
+/* Streaming writer */
+
+/* the zip archive of a npz, the members are limited to 4GiB (no
+ * zip64), save the larger arrays in npy files. */
+
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_DOS_DATE 0x21 /* 1980-01-01 */
+#define ZIP_ALIGN_EXTRA_ID 0xd935 /* the padding of the zipalign tool */
+#define NPZ_BUFFER_SIZE (64 * 1024)
+
+struct npz_entry_t {
+        char *name;
+        uint16_t method;
+        uint32_t crc;
+        uint64_t csize; /* compressed */
+        uint64_t usize; /* uncompressed */
+        uint64_t offset; /* of the local header */
+};
+
+typedef darray(struct npz_entry_t) darray_npz_entry;
+
+struct npz_t {
+        FILE *fp;
+        int compress;
+        darray_npz_entry entries;
+        struct npy_writer_t *current; /* the member being written */
+#ifdef HAVE_ZLIB
+        z_stream zs;
+#endif
+        int error;
+};
+
+struct npy_writer_t {
+        FILE *fp;
+        size_t elem_size;
+        size_t n_elems; /* of the shape */
+        size_t n_written;
+        struct npz_t *npz; /* the archive of the member, NULL for a npy */
+        int error;
+};
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+        p[0] = v & 0xff;
+        p[1] = (v >> 8) & 0xff;
+}
+
+static inline void put32(uint8_t *p, uint32_t v)
+{
+        put16(p, v & 0xffff);
+        put16(p + 2, v >> 16);
+}
+
+static inline uint16_t get16(const uint8_t *p)
+{
+        return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+        return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+#ifndef HAVE_ZLIB
+static uint32_t crc32_table[256];
+
+static gpointer crc32_table_init(gpointer data)
+{
+        uint32_t i;
+
+        for(i=0; i<256; ++i){
+                int k;
+                uint32_t c = i;
+
+                for(k=0; k<8; ++k)
+                        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                crc32_table[i] = c;
+        }
+
+        return NULL;
+}
+#endif
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t n)
+{
+#ifdef HAVE_ZLIB
+        while(n > 0){
+                uInt len = MIN(n, (size_t)1 << 30);
+
+                crc = crc32(crc, buf, len);
+                buf += len;
+                n -= len;
+        }
+#else
+        static GOnce once = G_ONCE_INIT;
+
+        g_once(&once, crc32_table_init, NULL);
+
+        crc = ~crc;
+        while(n-- > 0)
+                crc = crc32_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        crc = ~crc;
+#endif
+        return crc;
+}
+
+static inline struct npz_entry_t *npz_current_entry(struct npz_t *npz)
+{
+        return &darray_item(npz->entries, darray_size(npz->entries) - 1);
+}
+
+/* add the bytes of the current member, finish flushes the deflate
+ * stream */
+static int npz_member_write(struct npz_t *npz, const void *buf, size_t n, int finish)
+{
+        struct npz_entry_t *entry = npz_current_entry(npz);
+
+        entry->crc = crc32_update(entry->crc, buf, n);
+        entry->usize += n;
+
+#ifdef HAVE_ZLIB
+        if(ZIP_DEFLATED == entry->method){
+                const uint8_t *in = buf;
+
+                do{
+                        uInt len = MIN(n, (size_t)1 << 30);
+
+                        n -= len;
+                        npz->zs.next_in = (Bytef *)in;
+                        npz->zs.avail_in = len;
+                        in += len;
+                        do{
+                                uint8_t out[NPZ_BUFFER_SIZE];
+                                size_t have;
+
+                                npz->zs.next_out = out;
+                                npz->zs.avail_out = sizeof(out);
+                                if(Z_STREAM_ERROR == deflate(&npz->zs,
+                                                             finish && 0 == n ? Z_FINISH : Z_NO_FLUSH))
+                                        return -1;
+                                have = sizeof(out) - npz->zs.avail_out;
+                                if(have != fwrite(out, 1, have, npz->fp))
+                                        return -1;
+                                entry->csize += have;
+                        }while(0 == npz->zs.avail_out);
+                }while(n > 0);
+
+                return 0;
+        }
+#endif
+        if(n != fwrite(buf, 1, n, npz->fp))
+                return -1;
+        entry->csize += n;
+
+        return 0;
+}
+
+static void npy_writer_write(struct npy_writer_t *self, const void *buf, size_t n)
+{
+        if(NULL != self->npz){
+                if(0 != npz_member_write(self->npz, buf, n, FALSE))
+                        self->error = TRUE;
+        }else if(n != fwrite(buf, 1, n, self->fp))
+                self->error = TRUE;
+}
+
+static struct npy_writer_t *npy_writer_init(FILE *fp, struct npz_t *npz,
+                                            HklBinocularsNpyDataType type,
+                                            const darray_int *shape)
+{
+        char *header;
+        size_t header_size;
+        struct npy_writer_t *self;
+
+        header = create_npy_header(type, shape, &header_size);
+        if (NULL == header) return NULL;
+
+        self = g_new0(struct npy_writer_t, 1);
+        self->fp = fp;
+        self->npz = npz;
+        self->elem_size = map_size(type);
+        self->n_elems = shape_size(shape);
+        npy_writer_write(self, header, header_size);
+
+        free(header);
+
+        return self;
+}
+
+struct npy_writer_t *npy_writer_new(const char *fname,
+                                    HklBinocularsNpyDataType type,
+                                    const darray_int *shape)
+{
+        struct npy_writer_t *self;
+        FILE *fp = fopen(fname, "wb");
+
+        if (NULL == fp) return NULL;
+
+        self = npy_writer_init(fp, NULL, type, shape);
+        if (NULL == self)
+                fclose(fp);
+
+        return self;
+}
+
+int npy_writer_append(struct npy_writer_t *self, const void *arr, size_t n_elems)
+{
+        if(self->n_written + n_elems > self->n_elems){
+                self->error = TRUE;
+                return -1;
+        }
+
+        npy_writer_write(self, arr, n_elems * self->elem_size);
+        self->n_written += n_elems;
+
+        return self->error ? -1 : 0;
+}
+
+/* the end of a npz member, write its sizes and crc in its local
+ * header */
+static int npz_member_end(struct npz_t *npz)
+{
+        int error = FALSE;
+        uint8_t buf[12];
+        off_t end;
+        struct npz_entry_t *entry = npz_current_entry(npz);
+
+#ifdef HAVE_ZLIB
+        if(ZIP_DEFLATED == entry->method){
+                error |= 0 != npz_member_write(npz, NULL, 0, TRUE);
+                deflateEnd(&npz->zs);
+        }
+#endif
+        if(entry->csize > UINT32_MAX || entry->usize > UINT32_MAX){
+                fprintf(stderr, "the npz member %s is larger than 4GiB, use a npy file\n", entry->name);
+                error = TRUE;
+        }
+
+        put32(&buf[0], entry->crc);
+        put32(&buf[4], entry->csize);
+        put32(&buf[8], entry->usize);
+
+        end = ftello(npz->fp);
+        error |= 0 != fseeko(npz->fp, entry->offset + 14, SEEK_SET);
+        error |= ARRAY_SIZE(buf) != fwrite(buf, 1, ARRAY_SIZE(buf), npz->fp);
+        error |= 0 != fseeko(npz->fp, end, SEEK_SET);
+
+        npz->current = NULL;
+
+        return error;
+}
+
+int npy_writer_close(struct npy_writer_t *self)
+{
+        int res;
+
+        /* the missing elements are zeros so the file stays readable */
+        if(self->n_written < self->n_elems){
+                uint8_t zeros[4096] = {0};
+                size_t n = (self->n_elems - self->n_written) * self->elem_size;
+
+                self->error = TRUE;
+                while(n > 0){
+                        size_t len = MIN(n, sizeof(zeros));
+
+                        npy_writer_write(self, zeros, len);
+                        n -= len;
+                }
+        }
+
+        if(NULL != self->npz){
+                if(npz_member_end(self->npz))
+                        self->error = TRUE;
+                self->npz->error |= self->error;
+        }else if(0 != fclose(self->fp))
+                self->error = TRUE;
+
+        res = self->error ? -1 : 0;
+        g_free(self);
+
+        return res;
+}
+
+struct npz_t *npz_open(const char *fname, int compress)
+{
+        struct npz_t *self;
+        FILE *fp = fopen(fname, "wb");
+
+        if (NULL == fp) return NULL;
+
+#ifndef HAVE_ZLIB
+        if (compress){
+                fprintf(stderr, "zlib is not available, the npz members are stored\n");
+                compress = FALSE;
+        }
+#endif
+
+        self = g_new0(struct npz_t, 1);
+        self->fp = fp;
+        self->compress = compress;
+        darray_init(self->entries);
+
+        return self;
+}
+
+struct npy_writer_t *npz_array_new(struct npz_t *self,
+                                   const char *name,
+                                   HklBinocularsNpyDataType type,
+                                   const darray_int *shape)
+{
+        struct npz_entry_t entry = {0};
+        uint8_t header[ZIP_LOCAL_HEADER_SIZE] = {0};
+        uint8_t extra[4 + 64] = {0};
+        size_t extra_len = 0;
+        off_t offset;
+
+        /* one member at a time */
+        if(NULL != self->current || self->error)
+                return NULL;
+
+        offset = ftello(self->fp);
+        if(offset < 0 || darray_size(self->entries) >= UINT16_MAX)
+                return NULL;
+
+        entry.name = g_strdup_printf("%s.npy", name);
+        entry.method = self->compress ? ZIP_DEFLATED : ZIP_STORED;
+        entry.offset = offset;
+
+        /* the data of a stored member start on a 64 bytes boundary,
+         * like the array after the npy header, so npz_mmap returns
+         * an aligned array */
+        if(ZIP_STORED == entry.method){
+                size_t start = offset + ZIP_LOCAL_HEADER_SIZE + strlen(entry.name) + 4;
+
+                extra_len = 4 + (64 - start % 64) % 64;
+                put16(&extra[0], ZIP_ALIGN_EXTRA_ID);
+                put16(&extra[2], extra_len - 4);
+        }
+
+        put32(&header[0], 0x04034b50);
+        put16(&header[4], 20); /* version needed */
+        put16(&header[8], entry.method);
+        put16(&header[12], ZIP_DOS_DATE);
+        /* the crc and the sizes are written by npz_member_end */
+        put16(&header[26], strlen(entry.name));
+        put16(&header[28], extra_len);
+
+        if(ARRAY_SIZE(header) != fwrite(header, 1, ARRAY_SIZE(header), self->fp)
+           || strlen(entry.name) != fwrite(entry.name, 1, strlen(entry.name), self->fp)
+           || extra_len != fwrite(extra, 1, extra_len, self->fp)){
+                g_free(entry.name);
+                self->error = TRUE;
+                return NULL;
+        }
+
+#ifdef HAVE_ZLIB
+        if(ZIP_DEFLATED == entry.method){
+                memset(&self->zs, 0, sizeof(self->zs));
+                if(Z_OK != deflateInit2(&self->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                        -MAX_WBITS, 8, Z_DEFAULT_STRATEGY)){
+                        g_free(entry.name);
+                        self->error = TRUE;
+                        return NULL;
+                }
+        }
+#endif
+
+        darray_append(self->entries, entry);
+
+        self->current = npy_writer_init(self->fp, self, type, shape);
+        if(NULL == self->current){
+                npz_member_end(self);
+                self->error = TRUE;
+        }
+
+        return self->current;
+}
+
+int npz_save(struct npz_t *self,
+             const char *name,
+             const void *arr,
+             HklBinocularsNpyDataType type,
+             const darray_int *shape)
+{
+        struct npy_writer_t *writer = npz_array_new(self, name, type, shape);
+
+        if(NULL == writer)
+                return -1;
+
+        npy_writer_append(writer, arr, shape_size(shape));
+
+        return npy_writer_close(writer);
+}
+
+int npz_close(struct npz_t *self)
+{
+        int res;
+        off_t cd_offset;
+        off_t cd_end;
+        uint8_t end[ZIP_END_SIZE] = {0};
+        struct npz_entry_t *entry;
+
+        if(NULL != self->current)
+                npy_writer_close(self->current);
+
+        /* the central directory */
+        cd_offset = ftello(self->fp);
+        darray_foreach(entry, self->entries){
+                uint8_t header[ZIP_CENTRAL_HEADER_SIZE] = {0};
+
+                put32(&header[0], 0x02014b50);
+                put16(&header[4], 20); /* version made by */
+                put16(&header[6], 20); /* version needed */
+                put16(&header[10], entry->method);
+                put16(&header[14], ZIP_DOS_DATE);
+                put32(&header[16], entry->crc);
+                put32(&header[20], entry->csize);
+                put32(&header[24], entry->usize);
+                put16(&header[28], strlen(entry->name));
+                put32(&header[42], entry->offset);
+
+                if(ARRAY_SIZE(header) != fwrite(header, 1, ARRAY_SIZE(header), self->fp)
+                   || strlen(entry->name) != fwrite(entry->name, 1, strlen(entry->name), self->fp))
+                        self->error = TRUE;
+        }
+        cd_end = ftello(self->fp);
+        if(cd_offset < 0 || cd_end > UINT32_MAX)
+                self->error = TRUE;
+
+        put32(&end[0], 0x06054b50);
+        put16(&end[8], darray_size(self->entries));
+        put16(&end[10], darray_size(self->entries));
+        put32(&end[12], cd_end - cd_offset);
+        put32(&end[16], cd_offset);
+        if(ARRAY_SIZE(end) != fwrite(end, 1, ARRAY_SIZE(end), self->fp))
+                self->error = TRUE;
+
+        if(0 != fclose(self->fp))
+                self->error = TRUE;
+
+        darray_foreach(entry, self->entries){
+                g_free(entry->name);
+        }
+        darray_free(self->entries);
+
+        res = self->error ? -1 : 0;
+        g_free(self);
+
+        return res;
+}
+
 void npy_save(const char *fname,
               const void *arr,
               HklBinocularsNpyDataType type,
               const darray_int *shape)
 {
-        FILE *f;
-        char *header;
-        size_t header_size;
+        struct npy_writer_t *writer = npy_writer_new(fname, type, shape);
 
-        header = create_npy_header(type, shape, &header_size);
-        if (NULL == header) return;
+        if (NULL == writer) return;
 
-        f = fopen(fname, "wb");
-        if (NULL == f) return;
+        npy_writer_append(writer, arr, shape_size(shape));
+        npy_writer_close(writer);
+}
 
-        fseek(f,0,SEEK_SET);
-        fwrite(&header[0], 1, header_size, f);
-        /* fprintf(stdout, "%s\n", header); */
-        fseek(f,0,SEEK_END);
-        fwrite(arr, map_size(type), shape_size(shape), f);
-        fclose(f);
+/* the offset of the npy header of a stored member, -1 if there is no
+ * such member or if it is compressed */
+static off_t npz_member_offset(FILE *fp, const char *name)
+{
+        off_t res = -1;
+        off_t size;
+        size_t i;
+        size_t n_tail;
+        size_t n_entries;
+        size_t cd_size;
+        off_t cd_offset;
+        uint8_t *tail = NULL;
+        uint8_t *cd = NULL;
+        const uint8_t *p;
+        char *member = g_strdup_printf("%s.npy", name);
+
+        /* the end of central directory record, before the comment */
+        if(0 != fseeko(fp, 0, SEEK_END) || (size = ftello(fp)) < ZIP_END_SIZE)
+                goto out;
+        n_tail = MIN(size, ZIP_END_SIZE + UINT16_MAX);
+        tail = g_new(uint8_t, n_tail);
+        if(0 != fseeko(fp, size - n_tail, SEEK_SET)
+           || n_tail != fread(tail, 1, n_tail, fp))
+                goto out;
+        for(i=n_tail - ZIP_END_SIZE + 1; i-- > 0;)
+                if(0x06054b50 == get32(&tail[i]))
+                        break;
+        if(i == (size_t)-1)
+                goto out;
+        n_entries = get16(&tail[i + 10]);
+        cd_size = get32(&tail[i + 12]);
+        cd_offset = get32(&tail[i + 16]);
+
+        /* the central directory */
+        cd = g_new(uint8_t, cd_size > 0 ? cd_size : 1);
+        if(0 != fseeko(fp, cd_offset, SEEK_SET)
+           || cd_size != fread(cd, 1, cd_size, fp))
+                goto out;
+        for(i=0, p=cd; i<n_entries; ++i){
+                size_t name_len;
+
+                if(p + ZIP_CENTRAL_HEADER_SIZE > cd + cd_size
+                   || 0x02014b50 != get32(p))
+                        goto out;
+                name_len = get16(&p[28]);
+                if(p + ZIP_CENTRAL_HEADER_SIZE + name_len > cd + cd_size)
+                        goto out;
+                if(name_len == strlen(member)
+                   && !strncmp((const char *)&p[ZIP_CENTRAL_HEADER_SIZE], member, name_len)){
+                        uint8_t local[ZIP_LOCAL_HEADER_SIZE];
+                        off_t offset = get32(&p[42]);
+
+                        if(ZIP_STORED != get16(&p[10]))
+                                goto out;
+                        if(0 != fseeko(fp, offset, SEEK_SET)
+                           || ZIP_LOCAL_HEADER_SIZE != fread(local, 1, ZIP_LOCAL_HEADER_SIZE, fp)
+                           || 0x04034b50 != get32(local))
+                                goto out;
+                        res = offset + ZIP_LOCAL_HEADER_SIZE + get16(&local[26]) + get16(&local[28]);
+                        goto out;
+                }
+                p += ZIP_CENTRAL_HEADER_SIZE + name_len + get16(&p[30]) + get16(&p[32]);
+        }
+out:
+        g_free(cd);
+        g_free(tail);
+        g_free(member);
 
-        free(header);
+        return res;
+}
+
+void *npz_mmap(const char *fname,
+               const char *name,
+               HklBinocularsNpyDataType type,
+               const darray_int *shape)
+{
+        uint8_t *arr = NULL;
+        FILE* fp = fopen(fname, "rb");
+
+        if (NULL != fp){
+                off_t offset = npz_member_offset(fp, name);
+
+                if (offset >= 0 && 0 == fseeko(fp, offset, SEEK_SET))
+                        arr = npy_mmap_fp(fp, type, shape);
+                fclose(fp);
+        }
+        return arr;
 }
@@ -25,6 +25,7 @@
 
 #include "datatype99.h"
 #include "hkl.h"
+#include "hkl-binoculars.h"
 
 datatype(
 	InputRange,
@@ -58,4 +59,89 @@ typedef darray(InputRange) darray_input_range;
 
 			   void projection_type_fprintf(FILE *, const ProjectionType*);
 
-			   HKLAPI int hkl_binoculars_config();
+/**********/
+/* Config */
+/**********/
+
+/* an axis of the geometry and the dataset of its positions (degree),
+ * one per frame or a scalar for all the frames */
+typedef struct _HklBinocularsConfigAxis HklBinocularsConfigAxis;
+struct _HklBinocularsConfigAxis
+{
+	char *name;
+	char *path;
+};
+
+typedef darray(HklBinocularsConfigAxis) darray_config_axis;
+
+/* a projection section, every section whose name starts with
+ * projection (projection, projection.fine, ...) is projected from
+ * the same frames into its own cube */
+typedef struct _HklBinocularsConfigProjection HklBinocularsConfigProjection;
+struct _HklBinocularsConfigProjection
+{
+	char *section;
+	HklBinocularsQCustomSubProjectionEnum subprojection;
+	double resolutions[3];
+	size_t n_resolutions;
+	char *sample_axis;
+	HklBinocularsExpression *expressions[3]; /* expression_<i> of the expressions subprojection */
+	size_t n_expressions;
+};
+
+typedef darray(HklBinocularsConfigProjection) darray_config_projection;
+
+/* the subset of the binoculars-ng configuration understood by
+ * binoculars-hkl, only the qcustom projection of uint32 images. The
+ * geometry, image_path and axes keys of the input section replace the
+ * input type which select them in binoculars-ng. */
+typedef struct _HklBinocularsConfig HklBinocularsConfig;
+struct _HklBinocularsConfig
+{
+	char *content; /* the config file, saved with the cube */
+
+	/* dispatcher */
+	int ncores;
+	char *destination_tmpl;
+	int overwrite;
+
+	/* input */
+	char *nexus_dir;
+	char *input_tmpl;
+	darray_input_range input_ranges;
+	HklBinocularsDetectorEnum detector;
+	int central_pixel[2];
+	double sdd; /* meter */
+	double detrot; /* degree */
+	char *coordinates_cache; /* the directory of the calibrated coordinates or NULL */
+	char *mask_location;
+	int hot_pixels_frames; /* of the hot pixels statistic, 0 to disable it */
+	double hot_pixels_threshold; /* in deviations of the detector */
+	double wavelength; /* angstrom */
+	int skip_first_points;
+	int skip_last_points;
+	int polarization_correction;
+	HklBinocularsSurfaceOrientationEnum surface_orientation;
+	char *geometry; /* the name of the diffractometer */
+	char *image_path;
+	int module; /* of the strip detectors images, module * width strips from the first one */
+	int read_ahead; /* frames claimed and read at once by a worker */
+	int chunk_cache; /* MiB of the hdf5 chunk cache of the images, 0 for automatic */
+	darray_config_axis axes;
+
+	/* projections, in the order of the sections */
+	darray_config_projection projections;
+};
+
+const char *subprojection_as_string(HklBinocularsQCustomSubProjectionEnum subprojection);
+
+HKLAPI HklBinocularsConfig *hkl_binoculars_config_new(const char *filename);
+
+HKLAPI void hkl_binoculars_config_free(HklBinocularsConfig *self);
+
+/* project the frames of the config into cubes with ncores threads,
+ * then merge and save them. ranges (when not NULL) replace the
+ * inputrange of the config. Return 0 on success. */
+HKLAPI int hkl_binoculars_process(const char *filename,
+				  const darray_input_range *ranges,
+				  int verbosity);
@@ -23,7 +23,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <hdf5.h>
 #include <ini.h>
 
 #include "datatype99.h"
@@ -34,15 +33,6 @@
 #define SUCCESS 0
 #define FAILED -1
 
-/* #define FILENAME "/home/picca/test-data/translation/Pt2Ag20S2_75_a2scan_deltaeiz_00912.nxs" */
-#define FILENAME "/nfs/ruche-sixs/sixs-soleil/com-sixs/2021/Run3/20201559_andreazza/Pt2Ag20S2_75/Pt2Ag20S2_75_a2scan_deltaeiz_00912.nxs"
-#define INI "../contrib/haskell/data/test/config_sixs_ruche_qcustom2_3.ini"
-
-#define IMAGEPATH "com/scan_data/eiger_image"
-#define DIM0 920
-#define DIM1 1065
-#define DIM2 1030
-
 typedef enum _HklBinocularsInputTypeEnum
 {
 	HKL_BINOCULARS_INPUT_TYPE_CRISTAL_K6C = 0,
@@ -105,9 +95,51 @@ static inline const char* input_type_as_string(HklBinocularsInputTypeEnum type)
 	return "sixs:flyuhv";
 }
 
+/* the input ranges like binoculars-ng, "1-10, 12 15" */
 darray_input_range *parse_input_ranges(const char* arg)
 {
-	/* TODO */
+	darray_input_range *ranges;
+	const char *p = arg;
+
+	if(NULL == arg)
+		return NULL;
+
+	ranges = g_new0(darray_input_range, 1);
+	darray_init(*ranges);
+
+	for(;;){
+		char *end;
+		long from;
+		long to;
+
+		while(*p == ',' || g_ascii_isspace(*p))
+			++p;
+		if(*p == '\0')
+			break;
+
+		from = strtol(p, &end, 10);
+		if(end == p)
+			goto fail;
+		p = end;
+		if(*p == '-'){
+			++p;
+			to = strtol(p, &end, 10);
+			if(end == p || to < from)
+				goto fail;
+			p = end;
+			darray_append(*ranges, InputRange_FromTo(from, to));
+		}else
+			darray_append(*ranges, InputRange_At(from));
+	}
+
+	if(0 == darray_size(*ranges))
+		goto fail;
+
+	return ranges;
+fail:
+	fprintf(stderr, "Can not parse the input range: \"%s\"\n", arg);
+	darray_free(*ranges);
+	g_free(ranges);
 	return NULL;
 }
 
@@ -207,291 +239,415 @@ fail:
 	return FAILED;
 }
 
-int main_1()
+/*****************/
+/* Config Common */
+/*****************/
+
+/* the value without its comment, binoculars-ng allows a # after the
+ * values */
+static char *uncomment(const char *value)
 {
-	size_t i;
-	const char *fn = FILENAME;
-	const char *images_path = IMAGEPATH;
-	herr_t err;
-	hsize_t dims[] = {DIM0, DIM1, DIM2};
-	hsize_t start[] = {0, 0, 0};
-	hsize_t stride[] = {1, 1, 1};
-	hsize_t count[3] = {1, DIM1, DIM2};
-	hsize_t block[3] = {1, 1, 1};;
-	uint32_t *arr;
-
-	hid_t file_id;
-	hid_t dataset_id;
-	hid_t file_space_id;
-	hid_t mem_space_id;
-
-	arr = malloc(dims[1] * dims[2] * sizeof(*arr));
-	if(arr == NULL){
-		fprintf(stdout, "Can not allocate array\n");
-		goto exit;
+	char *res = g_strdup(value);
+	char *comment = strchr(res, '#');
+
+	if(NULL != comment)
+		*comment = '\0';
+
+	return g_strstrip(res);
+}
+
+static int parse_int(const char *value, int *res)
+{
+	char *end;
+	long v = strtol(value, &end, 10);
+
+	if(end == value || *end != '\0')
+		return FALSE;
+	*res = v;
+	return TRUE;
+}
+
+static int parse_double(const char *value, double *res)
+{
+	char *end;
+	double v = g_ascii_strtod(value, &end);
+
+	if(end == value || *end != '\0')
+		return FALSE;
+	*res = v;
+	return TRUE;
+}
+
+static int parse_bool(const char *value, int *res)
+{
+	if(0 == g_ascii_strcasecmp(value, "true")){
+		*res = TRUE;
+		return TRUE;
 	}
-	file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
-	if(file_id < 0){
-		fprintf(stdout, "Can not open file\n");
-		goto release_arr;
+	if(0 == g_ascii_strcasecmp(value, "false")){
+		*res = FALSE;
+		return TRUE;
 	}
-	dataset_id = H5Dopen(file_id, images_path, H5P_DEFAULT);
-	if(dataset_id < 0){
-		fprintf(stdout, "can not open dataset\n");
-		goto close_file;
+	return FALSE;
+}
+
+/* "v1, v2, ..." up to n values, return the number of values or -1 */
+static int parse_doubles(const char *value, double *res, size_t n)
+{
+	int ok = TRUE;
+	size_t i;
+	char **values = g_strsplit_set(value, ", ", -1);
+	size_t n_values = 0;
+
+	for(i=0; ok && NULL != values[i]; ++i){
+		if(values[i][0] == '\0')
+			continue;
+		ok = n_values < n && parse_double(values[i], &res[n_values]);
+		n_values++;
 	}
+	g_strfreev(values);
+
+	return ok ? (int)n_values : -1;
+}
+
+static int parse_detector(const char *value, HklBinocularsDetectorEnum *res)
+{
+	int i;
 
-	mem_space_id = H5Screate_simple(2, &dims[1], &dims[1]);
-	if(mem_space_id < 0){
-		fprintf(stdout, "Can not create memory dataspace\n");
-		goto close_dataset;
+	for(i=0; i<hkl_binoculars_detector_2d_number_of_detectors(); ++i)
+		if(0 == strcmp(value, hkl_binoculars_detector_2d_name_get(i))){
+			*res = i;
+			return TRUE;
+		}
+	return FALSE;
+}
+
+static int parse_surface_orientation(const char *value,
+				     HklBinocularsSurfaceOrientationEnum *res)
+{
+	if(0 == g_ascii_strcasecmp(value, "vertical")){
+		*res = HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL;
+		return TRUE;
+	}
+	if(0 == g_ascii_strcasecmp(value, "horizontal")){
+		*res = HKL_BINOCULARS_SURFACE_ORIENTATION_HORIZONTAL;
+		return TRUE;
 	}
+	return FALSE;
+}
 
-	file_space_id = H5Dget_space(dataset_id);
-	if(file_space_id<0){
-		fprintf(stdout, "can not get dataset dataspace\n");
-		goto close_mem_space;
+/* in the order of HklBinocularsQCustomSubProjectionEnum */
+static const char *subprojections[] = {
+	"qx_qy_qz",
+	"q_tth_timestamp",
+	"q_timestamp",
+	"qpar_qper_timestamp",
+	"qpar_qper",
+	"q_phi_qx",
+	"q_phi_qy",
+	"q_phi_qz",
+	"q_stereo",
+	"deltalab_gammalab_sampleaxis",
+	"x_y_z",
+	"y_z_timestamp",
+	"q_qpar_qper",
+	"qpars_qper_timestamp",
+	"qpar_qper_sampleaxis",
+	"q_sampleaxis_tth",
+	"q_sampleaxis_timestamp",
+	"qx_qy_timestamp",
+	"qx_qz_timestamp",
+	"qy_qz_timestamp",
+	"tth_azimuth",
+	"q",
+	"tth",
+	"expressions",
+};
+
+const char *subprojection_as_string(HklBinocularsQCustomSubProjectionEnum subprojection)
+{
+	if(subprojection < ARRAY_SIZE(subprojections))
+		return subprojections[subprojection];
+	return subprojections[0];
+}
+
+static int parse_subprojection(const char *value,
+			       HklBinocularsQCustomSubProjectionEnum *res)
+{
+	size_t i;
+
+	/* the deprecated names */
+	if(0 == g_ascii_strcasecmp(value, "q_index")){
+		*res = HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TIMESTAMP;
+		return TRUE;
+	}
+	if(0 == g_ascii_strcasecmp(value, "angle_zaxis_omega")
+	   || 0 == g_ascii_strcasecmp(value, "angle_zaxis_mu")){
+		*res = HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_DELTALAB_GAMMALAB_SAMPLEAXIS;
+		return TRUE;
 	}
 
-	for(i=0; i<dims[0]; ++i){
-		start[0] = i;
-		err = H5Sselect_hyperslab (file_space_id, H5S_SELECT_SET, start, stride, count, block);
-		if(err<0){
-			fprintf(stdout, "can not select hyperslab\n");
-			goto close_mem_space;
+	for(i=0; i<ARRAY_SIZE(subprojections); ++i)
+		if(0 == g_ascii_strcasecmp(value, subprojections[i])){
+			*res = i;
+			return TRUE;
 		}
+	return FALSE;
+}
 
-		err = H5Dread(dataset_id, H5T_NATIVE_UINT32, mem_space_id, file_space_id, H5P_DEFAULT, arr);
-		if(err<0){
-			fprintf(stdout, "Can not read dataset content\n");
-			goto close_mem_space;
+/* "name:path, name:path, ..." */
+static int parse_axes(const char *value, darray_config_axis *axes)
+{
+	int ok = TRUE;
+	size_t i;
+	char **values = g_strsplit_set(value, ", ", -1);
+
+	for(i=0; ok && NULL != values[i]; ++i){
+		char *sep;
+		HklBinocularsConfigAxis axis;
+
+		if(values[i][0] == '\0')
+			continue;
+		sep = strchr(values[i], ':');
+		ok = NULL != sep && sep != values[i] && sep[1] != '\0';
+		if(ok){
+			axis.name = g_strndup(values[i], sep - values[i]);
+			axis.path = g_strdup(sep + 1);
+			darray_append(*axes, axis);
 		}
 	}
+	g_strfreev(values);
 
-	H5Sclose(file_space_id);
-
-close_mem_space:
-	H5Sclose(mem_space_id);
-close_dataset:
-	H5Dclose(dataset_id);
-close_file:
-	H5Fclose(file_id);
-release_arr:
-	free(arr);
-exit:
-	return 0;
+	return ok;
 }
 
+static void config_axes_free(darray_config_axis *axes)
+{
+	HklBinocularsConfigAxis *axis;
 
-typedef struct _HklBinocularsPreConfig
+	darray_foreach(axis, *axes){
+		g_free(axis->name);
+		g_free(axis->path);
+	}
+	darray_free(*axes);
+}
+
+/* the projection of the section, added at its first key */
+static HklBinocularsConfigProjection *config_projection_get(HklBinocularsConfig *config,
+							    const char *section)
 {
-	HklBinocularsInputTypeEnum input_type;
-} HklBinocularsPreConfig;
+	HklBinocularsConfigProjection *projection;
+	HklBinocularsConfigProjection tmp = {
+		.section = g_strdup(section),
+		.subprojection = HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+	};
+
+	darray_foreach(projection, config->projections){
+		if(0 == strcmp(projection->section, section))
+			return projection;
+	}
+	darray_append(config->projections, tmp);
 
-static int handler_preconfig(void* user,
-			     const char* section,
-			     const char* name,
-			     const char* value)
+	return &darray_item(config->projections, darray_size(config->projections) - 1);
+}
+
+static void config_projections_free(darray_config_projection *projections)
 {
-	HklBinocularsPreConfig* pconfig = user;
+	HklBinocularsConfigProjection *projection;
 
-	fprintf(stdout, "s: '%s', n: '%s', v: '%s'\n", section, name, value);
+	darray_foreach(projection, *projections){
+		size_t i;
 
-#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-	if (MATCH("input", "type")) {
-		return !input_type_from_string(value, &pconfig->input_type);
-	} else {
-		return 0;  /* unknown section/name, error */
+		g_free(projection->section);
+		g_free(projection->sample_axis);
+		for(i=0; i<ARRAY_SIZE(projection->expressions); ++i)
+			if(NULL != projection->expressions[i])
+				hkl_binoculars_expression_free(projection->expressions[i]);
 	}
-	return 1;
+	darray_free(*projections);
 }
 
-/*****************/
-/* Config Common */
-/*****************/
+/* expression_<index> = "name: source", compiled when the config is
+ * read */
+static int handler_expression(HklBinocularsConfigProjection *projection,
+			      const char *index, const char *value)
+{
+	char *end;
+	char *name;
+	char *error = NULL;
+	const char *sep = strchr(value, ':');
+	long i = strtol(index, &end, 10);
+	HklBinocularsExpression *expression;
+
+	if(end == index || '\0' != *end
+	   || i < 0 || i >= (long)ARRAY_SIZE(projection->expressions)
+	   || NULL == sep || sep == value)
+		return FALSE;
+
+	name = g_strstrip(g_strndup(value, sep - value));
+	expression = hkl_binoculars_expression_new(name, sep + 1, &error);
+	g_free(name);
+	if(NULL == expression){
+		fprintf(stderr, "Can not compile the expression_%ld of the %s section: %s\n",
+			i, projection->section, error);
+		g_free(error);
+		return FALSE;
+	}
+
+	if(NULL != projection->expressions[i])
+		hkl_binoculars_expression_free(projection->expressions[i]);
+	projection->expressions[i] = expression;
 
-typedef int ncores_t;
-typedef const char *destination_tmpl_t;
-typedef const char *nexus_dir_t;
-typedef const char *input_tmpl_t;
+	return TRUE;
+}
 
-typedef struct _central_pixel_t
+/* the expressions are expression_0, expression_1, ... without hole,
+ * return FALSE otherwise */
+static int config_projection_expressions_count(HklBinocularsConfigProjection *projection)
 {
-	int x;
-	int y;
-} central_pixel_t;
+	size_t i;
 
+	for(i=0; i<ARRAY_SIZE(projection->expressions); ++i)
+		if(NULL == projection->expressions[i])
+			break;
+	projection->n_expressions = i;
+	for(; i<ARRAY_SIZE(projection->expressions); ++i)
+		if(NULL != projection->expressions[i])
+			return FALSE;
 
-typedef double meter_t;
-typedef double degree_t;
-typedef double *attenuation_coefficient_t;
-typedef double *attenuation_max_t;
-typedef int *attenuation_shift_t;
-typedef const char *mask_location_t;
+	return TRUE;
+}
 
-typedef struct _HklBinocularsConfigCommon
+static int handler_projection(HklBinocularsConfigProjection *projection,
+			      const char *name, const char *value)
 {
-	ncores_t ncores;
-	destination_tmpl_t destination_tmpl;
-	bool overwrite;
-	HklBinocularsInputTypeEnum input_type;
-	nexus_dir_t nexus_dir;
-	input_tmpl_t input_tmpl;
-	darray_input_range input_ranges;
-	HklBinocularsDetectorEnum detector;
-	central_pixel_t central_pixel;
-	meter_t sdd;
-	degree_t detrot;
-	attenuation_coefficient_t attenuation_coefficient;
-	attenuation_max_t attenuation_max;
-	attenuation_shift_t attenuation_shift;
-	mask_location_t mask_location;
-	double *wavelength;
-	double *image_sum_max;
-	int *skip_first_points;
-	int *skip_last_points;
-	bool polarization_correction;
-} HklBinocularsConfigCommon;
-
-#define DEFAULT_BINOCULARS_CONFIG_COMMON				\
-	.ncores = 4,							\
-		.destination_tmpl = "{projection}_{first}-{last}_{limits}.h5", \
-		.overwrite = false,					\
-		.input_type = HKL_BINOCULARS_INPUT_TYPE_SIXS_FLY_UHV,	\
-		.config_range = InputRange_Singleton(1),		\
-		.detector = HKL_BINOCULARS_DETECTOR_DEFAULT,		\
-		.central_pixel = {0, 0},				\
-		.sdd = 1.0,						\
-		.detrot = 0.0,						\
-		.polarization_correction = false,
-
-static int handler_config_common(void* user,
-				 const char* section,
-				 const char* name,
-				 const char* value)
-{
-	HklBinocularsConfigCommon* config = user;
+	int res = TRUE;
+
+	if (0 == strcmp(name, "type")){
+		res = 0 == g_ascii_strncasecmp(value, "qcustom", strlen("qcustom"));
+	} else if (0 == strcmp(name, "subprojection")){
+		res = parse_subprojection(value, &projection->subprojection);
+	} else if (0 == strcmp(name, "resolution")){
+		int n = parse_doubles(value, projection->resolutions,
+				      ARRAY_SIZE(projection->resolutions));
+
+		res = n > 0;
+		if(res){
+			size_t i;
+
+			/* one resolution for all the axes */
+			for(i=n; i<ARRAY_SIZE(projection->resolutions); ++i)
+				projection->resolutions[i] = projection->resolutions[i - 1];
+			projection->n_resolutions = i;
+		}
+	} else if (0 == strcmp(name, "sample_axis")){
+		g_free(projection->sample_axis);
+		projection->sample_axis = g_strdup(value);
+	} else if (g_str_has_prefix(name, "expression_")){
+		res = handler_expression(projection, name + strlen("expression_"), value);
+	}
+	/* the other keys are only used by binoculars-ng */
 
-	fprintf(stdout, "s: '%s', n: '%s', v: '%s'\n", section, name, value);
+	return res;
+}
+
+static int handler_config(void* user,
+			  const char* section,
+			  const char* name,
+			  const char* raw)
+{
+	HklBinocularsConfig* config = user;
+	char *value = uncomment(raw);
+	int res = TRUE;
 
 #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-	if (MATCH("input", "detector")) {
-		/* TODO */
-	} else if (MATCH("dispatcher", "ncores")){
-		/* TODO */
+#define REPLACE(field) do{ g_free(config->field); config->field = g_strdup(value); }while(0)
+	if (MATCH("dispatcher", "ncores")){
+		res = parse_int(value, &config->ncores) && config->ncores > 0;
 	} else if (MATCH("dispatcher", "destination")){
-		/* TODO */
+		REPLACE(destination_tmpl);
 	} else if (MATCH("dispatcher", "overwrite")){
-		/* TODO */
+		res = parse_bool(value, &config->overwrite);
+	} else if (MATCH("input", "type")){
+		HklBinocularsInputTypeEnum type;
+
+		res = SUCCESS == input_type_from_string(value, &type);
 	} else if (MATCH("input", "nexusdir")){
-		/* TODO */
+		REPLACE(nexus_dir);
 	} else if (MATCH("input", "inputtmpl")){
-		/* TODO */
+		REPLACE(input_tmpl);
 	} else if (MATCH("input", "inputrange")){
-		/* TODO */
+		darray_input_range *ranges = parse_input_ranges(value);
+
+		res = NULL != ranges;
+		if(res){
+			darray_free(config->input_ranges);
+			config->input_ranges = *ranges;
+			g_free(ranges);
+		}
+	} else if (MATCH("input", "detector")){
+		res = parse_detector(value, &config->detector);
 	} else if (MATCH("input", "centralpixel")){
-		/* TODO */
+		double pixel[2];
+
+		res = 2 == parse_doubles(value, pixel, ARRAY_SIZE(pixel));
+		if(res){
+			config->central_pixel[0] = pixel[0];
+			config->central_pixel[1] = pixel[1];
+		}
 	} else if (MATCH("input", "sdd")){
-		/* TODO */
+		res = parse_double(value, &config->sdd);
 	} else if (MATCH("input", "detrot")){
-		/* TODO */
-	} else if (MATCH("input", "attenuation_coefficient")){
-		/* TODO */
-	} else if (MATCH("input", "attenuation_max")){
-		/* TODO */
-	} else if (MATCH("input", "attenuation_shift")){
-		/* TODO */
+		res = parse_double(value, &config->detrot);
+	} else if (MATCH("input", "coordinates_cache")){
+		REPLACE(coordinates_cache);
 	} else if (MATCH("input", "maskmatrix")){
-		/* TODO */
+		REPLACE(mask_location);
+	} else if (MATCH("input", "hot_pixels_frames")){
+		res = parse_int(value, &config->hot_pixels_frames) && config->hot_pixels_frames >= 0;
+	} else if (MATCH("input", "hot_pixels_threshold")){
+		res = parse_double(value, &config->hot_pixels_threshold) && config->hot_pixels_threshold > 0;
 	} else if (MATCH("input", "wavelength")){
-		/* TODO */
-	} else if (MATCH("input", "image_sum_max")){
-		/* TODO */
+		res = parse_double(value, &config->wavelength);
 	} else if (MATCH("input", "skip_first_points")){
-		/* TODO */
+		res = parse_int(value, &config->skip_first_points) && config->skip_first_points >= 0;
 	} else if (MATCH("input", "skip_last_points")){
-		/* TODO */
+		res = parse_int(value, &config->skip_last_points) && config->skip_last_points >= 0;
 	} else if (MATCH("input", "polarization_correction")){
-		/* TODO */
-	} else {
-		return 0;  /* unknown section/name, error */
+		res = parse_bool(value, &config->polarization_correction);
+	} else if (MATCH("input", "surface_orientation")){
+		res = parse_surface_orientation(value, &config->surface_orientation);
+	} else if (MATCH("input", "geometry")){
+		REPLACE(geometry);
+	} else if (MATCH("input", "image_path")){
+		REPLACE(image_path);
+	} else if (MATCH("input", "module")){
+		res = parse_int(value, &config->module) && config->module >= 0;
+	} else if (MATCH("input", "read_ahead")){
+		res = parse_int(value, &config->read_ahead) && config->read_ahead > 0;
+	} else if (MATCH("input", "chunk_cache")){
+		res = parse_int(value, &config->chunk_cache) && config->chunk_cache >= 0;
+	} else if (MATCH("input", "axes")){
+		res = parse_axes(value, &config->axes);
+	} else if (MATCH("input", "attenuation_coefficient")
+		   || MATCH("input", "attenuation_max")
+		   || MATCH("input", "attenuation_shift")
+		   || MATCH("input", "image_sum_max")){
+		fprintf(stderr, "[%s] %s is not supported by binoculars-hkl, ignored\n", section, name);
+	} else if (g_str_has_prefix(section, "projection")){
+		res = handler_projection(config_projection_get(config, section), name, value);
 	}
-	return 1;
+	/* the other keys are only used by binoculars-ng */
+#undef REPLACE
+#undef MATCH
 
-/* parse'BinocularsConfig'Common :: Text -> Maybe ConfigRange -> Capabilities -> Either String BinocularsConfig'Common */
-/* parse'BinocularsConfig'Common cfg mr (Capabilities ncapmax ncoresmax) */
-/*   = do */
-/*   let minputtypedeprecated = eitherF (const Nothing) (parse' cfg "input" "type") id */
-/*   inputtype <- case minputtypedeprecated of */
-/*                 Nothing -> parseFDef cfg "input" "type" (binocularsConfig'Common'InputType default'BinocularsConfig'Common) */
-/*                 Just deprecated -> Right $ case deprecated of */
-/*                                             SixsFlyMedVEiger          -> SixsFlyMedV */
-/*                                             SixsFlyMedVS70            -> SixsFlyMedV */
-/*                                             SixsFlyScanUhvGisaxsEiger -> SixsFlyUhvGisaxs */
-/*                                             SixsFlyScanUhvUfxc        -> SixsFlyUhv */
-/*   detector <- parseFDef cfg "input" "detector" (case minputtypedeprecated of */
-/*                                                  Nothing -> case inputtype of */
-/*                                                              CristalK6C -> mkDetector HklBinocularsDetectorEnum'XpadFlatCorrected */
-/*                                                              MarsFlyscan -> mkDetector HklBinocularsDetectorEnum'MerlinMedipix3rxQuad */
-/*                                                              MarsSbs -> mkDetector HklBinocularsDetectorEnum'MerlinMedipix3rxQuad */
-/*                                                              SixsFlyMedH -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsFlyMedHGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsFlyMedV -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsFlyMedVGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsFlyUhv -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsFlyUhvGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsMedH -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsMedHGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsMedV -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsMedVGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsUhv -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                              SixsSbsUhvGisaxs -> binocularsConfig'Common'Detector default'BinocularsConfig'Common */
-/*                                                  Just deprecated -> case deprecated of */
-/*                                                                      SixsFlyMedVEiger -> mkDetector HklBinocularsDetectorEnum'DectrisEiger1M */
-/*                                                                      SixsFlyMedVS70 -> mkDetector HklBinocularsDetectorEnum'ImxpadS70 */
-/*                                                                      SixsFlyScanUhvGisaxsEiger -> mkDetector HklBinocularsDetectorEnum'DectrisEiger1M */
-/*                                                                      SixsFlyScanUhvUfxc -> mkDetector HklBinocularsDetectorEnum'Ufxc */
-/*                                               ) */
-
-/*   BinocularsConfig'Common */
-/*     <$> eitherF error (parse' cfg "dispatcher" "ncores") */
-/*     (\mb -> do */
-/*         let ns = case mb of */
-/*                    Nothing -> [ncapmax, ncoresmax - 1] */
-/*                    Just b  -> [b, ncapmax, ncoresmax -1] */
-/*         pure $ NCores (minimum ns)) */
-/*     <*> parseFDef cfg "dispatcher" "destination" (binocularsConfig'Common'Destination default'BinocularsConfig'Common) */
-/*     <*> parseFDef cfg "dispatcher" "overwrite" (binocularsConfig'Common'Overwrite default'BinocularsConfig'Common) */
-/*     <*> pure inputtype */
-/*     <*> parseMb cfg "input" "nexusdir" */
-/*     <*> parseMb cfg "input" "inputtmpl" */
-/*     <*> eitherF error (parse' cfg "input" "inputrange") */
-/*     (\mb -> do */
-/*         case mr <|> mb of */
-/*           Nothing -> error "please provide an input range either in the config file with the \"inputrange\" key under the \"input\" section, or on the command line" */
-/*           Just r -> pure r) */
-/*     <*> pure detector */
-/*     <*> eitherF error (parse' cfg "input" "centralpixel") */
-/*     (\mc -> do */
-/*         case mc of */
-/*           Nothing -> pure (binocularsConfig'Common'Centralpixel default'BinocularsConfig'Common) */
-/*           Just c -> if c `inDetector` detector */
-/*                    then pure c */
-/*                    else error $ "The central pixel " <> show c <> " is not compatible with the detector") */
-/*     <*> parseFDef cfg "input" "sdd" (binocularsConfig'Common'Sdd default'BinocularsConfig'Common) */
-/*     <*> parseFDef cfg "input" "detrot" (binocularsConfig'Common'Detrot default'BinocularsConfig'Common) */
-/*     <*> parseMb cfg "input" "attenuation_coefficient" */
-/*     <*> parseMb cfg "input" "attenuation_max" */
-/*     <*> parseMb cfg "input" "attenuation_shift" */
-/*     <*> parseMb cfg "input" "maskmatrix" */
-/*     <*> parseMb cfg "input" "wavelength" */
-/*     <*> parseMb cfg "input" "image_sum_max" */
-/*     <*> parseMb cfg "input" "skip_first_points" */
-/*     <*> parseMb cfg "input" "skip_last_points" */
-/*     <*> parseFDef cfg "input" "polarization_correction" (binocularsConfig'Common'PolarizationCorrection default'BinocularsConfig'Common) */
+	if(!res)
+		fprintf(stderr, "Can not parse [%s] %s = %s\n", section, name, value);
 
-}
+	g_free(value);
 
+	return res;
+}
 /*****************/
 /* Sample Config */
 /*****************/
@@ -501,12 +657,12 @@ typedef struct _HklBinocularsConfigSample
         double *maybe_a;
         double *maybe_b;
         double *maybe_c;
-        degree_t *maybe_alpha;
-        degree_t *maybe_beta;
-        degree_t *maybe_gamma;
-        degree_t *maybe_ux;
-        degree_t *maybe_uy;
-        degree_t *maybe_uz;
+        double *maybe_alpha;
+        double *maybe_beta;
+        double *maybe_gamma;
+        double *maybe_ux;
+        double *maybe_uy;
+        double *maybe_uz;
 
 } HklBinocularsConfigSample;
 
@@ -548,33 +704,86 @@ static int handler_config_sample(void* user,
 /* Parse the full config */
 /*************************/
 
-int hkl_binoculars_config()
+HklBinocularsConfig *hkl_binoculars_config_new(const char *filename)
 {
-	HklBinocularsPreConfig pre_config;
-	HklBinocularsConfigCommon *config_common;
+	int line;
+	HklBinocularsConfigProjection *projection;
+	HklBinocularsConfig *self = g_new0(HklBinocularsConfig, 1);
+
+	/* the binoculars-ng defaults */
+	self->ncores = 4;
+	self->destination_tmpl = g_strdup("{projection}_{first}-{last}_{limits}.h5");
+	self->overwrite = FALSE;
+	self->input_tmpl = g_strdup("%05d");
+	darray_init(self->input_ranges);
+	self->detector = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+	self->sdd = 1.0;
+	self->detrot = 0.0;
+	self->wavelength = 1.0;
+	self->hot_pixels_threshold = 10.0;
+	self->read_ahead = 1;
+	self->surface_orientation = HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL;
+	darray_init(self->axes);
+	darray_init(self->projections);
+
+	if(!g_file_get_contents(filename, &self->content, NULL, NULL)){
+		fprintf(stderr, "Can not read the binoculars configuration file %s\n", filename);
+		goto fail;
+	}
 
-	/* first pass */
-	if (ini_parse(INI, handler_preconfig, &pre_config) < 0) {
-		printf("Can't load 'binoculars pre-config file'\n");
-		return FAILED;
+	line = ini_parse_string(self->content, handler_config, self);
+	if(0 != line){
+		fprintf(stderr, "Can not load the binoculars configuration file %s (line %d)\n",
+			filename, line);
+		goto fail;
 	}
 
-	/* second pass */
-	config_common = g_new0(HklBinocularsConfigCommon, 1);
-	/* TODO first add the default values, then surcharge with the
-	 * values from the file. beware, some value should not be
-	 * replace by with deprecated input_type whcih also fix the
-	 * detector */
-	if(ini_parse(INI, handler_config_common, &config_common) < 0) {
-		printf("Can not load binoculars configuration file\n");
-		return FAILED;
+	if(NULL == self->geometry || NULL == self->image_path){
+		fprintf(stderr, "binoculars-hkl needs the geometry and the image_path of the input section\n");
+		goto fail;
 	}
 
-	fprintf(stdout,
-		"Config loaded from 'test.ini': inputtype=%s\n",
-		input_type_as_string(pre_config.input_type));
+	if(0 == darray_size(self->projections)){
+		fprintf(stderr, "binoculars-hkl needs a projection section\n");
+		goto fail;
+	}
+	darray_foreach(projection, self->projections){
+		if(0 == projection->n_resolutions){
+			fprintf(stderr, "binoculars-hkl needs the resolution of the %s section\n",
+				projection->section);
+			goto fail;
+		}
+		if(!config_projection_expressions_count(projection)){
+			fprintf(stderr, "the expressions of the %s section must start at expression_0 without hole\n",
+				projection->section);
+			goto fail;
+		}
+		if(HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS == projection->subprojection
+		   && 0 == projection->n_expressions){
+			fprintf(stderr, "binoculars-hkl needs the expression_0 of the %s section\n",
+				projection->section);
+			goto fail;
+		}
+	}
 
-        /* overload with the command line */
+	return self;
+fail:
+	hkl_binoculars_config_free(self);
+	return NULL;
+}
 
-	return SUCCESS;
+void hkl_binoculars_config_free(HklBinocularsConfig *self)
+{
+	g_free(self->content);
+	g_free(self->destination_tmpl);
+	g_free(self->nexus_dir);
+	g_free(self->input_tmpl);
+	darray_free(self->input_ranges);
+	g_free(self->coordinates_cache);
+	g_free(self->mask_location);
+	g_free(self->geometry);
+	g_free(self->image_path);
+	config_axes_free(&self->axes);
+	config_projections_free(&self->projections);
+	g_free(self);
 }
@@ -19,8 +19,12 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
 
 #include "datatype99.h"
 
@@ -120,6 +124,25 @@ struct tilling_t {
                         .fill_gap=fill_gap_,                            \
                         }
 
+/* a row of strips of pitch width along y and length height along z */
+struct strip_t {
+        double pitch;
+        double length;
+};
+
+#define STRIP(pitch_, length_) (struct strip_t)        \
+        {.pitch=pitch_, .length=length_}
+
+/* the strips are bent on a cylinder of axis z, the sample sits on the
+ * axis at radius from the strips */
+struct curved_strip_t {
+        struct strip_t strip;
+        double radius;
+};
+
+#define CURVED_STRIP(pitch_, length_, radius_) (struct curved_strip_t) \
+        {.strip=STRIP(pitch_, length_), .radius=radius_}
+
 datatype(
         DetectorType,
         (ImXpadS70, struct imxpad_t),
@@ -129,7 +152,9 @@ datatype(
         (Ufxc, struct square_t),
         (Merlin, struct square_t),
         (MerlinMedipix3RXQuad, struct tilling_t),
-        (MerlinMedipix3RXQuad512, struct tilling_t)
+        (MerlinMedipix3RXQuad512, struct tilling_t),
+        (Mythen, struct strip_t),
+        (CirPad, struct curved_strip_t)
         );
 
 struct detector_t {
@@ -160,6 +185,12 @@ static inline struct detector_t get_detector(HklBinocularsDetectorEnum n)
                          SHAPE(515, 515), TILLING(256, 256, 3, 3, 55e-6, true)),
                 DETECTOR(MerlinMedipix3RXQuad512,
                          SHAPE(512, 512), TILLING(256, 256, 3, 3, 55e-6, false)),
+                DETECTOR(Mythen,
+                         SHAPE(1280, 1), STRIP(50e-6, 8e-3)),
+                /* the 20 modules of 560 pixels, 6.74 degrees apart,
+                 * unrolled on their circle */
+                DETECTOR(CirPad,
+                         SHAPE(11200, 120), CURVED_STRIP(75.48e-3 / 560, 130e-6, 0.64164)),
         };
 
         if (n > ARRAY_SIZE(detectors))
@@ -302,6 +333,30 @@ static inline double *coordinates_get_imxpad(const struct shape_t *shape,
         return arr;
 }
 
+/* the strips along the circle of curvature centered on (-radius, 0,
+ * 0), the first strip on the x=0 plan. */
+static inline double *coordinates_get_curved_strip(const struct shape_t *shape,
+                                                   const struct curved_strip_t *curved)
+{
+        int i;
+        double *arr = coordinates_rectangle(shape,
+                                            curved->strip.pitch,
+                                            curved->strip.length);
+        double *x = x_coordinates(arr, *shape);
+        double *y = y_coordinates(arr, *shape);
+
+        for(i=0; i<shape->width; ++i){
+                double a = (0.5 + i) * curved->strip.pitch / curved->radius;
+
+                x[i] = curved->radius * (cos(a) - 1);
+                y[i] = - curved->radius * sin(a);
+        }
+        replicate_row(x, *shape, shape->height);
+        replicate_row(y, *shape, shape->height);
+
+        return arr;
+}
+
 static inline void flip_z(const struct shape_t *shape, double *arr)
 {
         int i;
@@ -479,11 +534,29 @@ void hkl_binoculars_detector_2d_sixs_calibration(HklBinocularsDetectorEnum n,
                                                  int ix0, int iy0, double sdd,
                                                  double detrot, int normalize_flag)
 {
+        const struct detector_t detector = get_detector(n);
         struct shape_t shape = SHAPE(width, height);
+        double *x = x_coordinates(arr, shape);
         double *y = y_coordinates(arr, shape);
         double *z = z_coordinates(arr, shape);
 
-        double dx = sdd;
+        /* a curved detector first rolls on its circle until the
+         * (ix0, iy0) pixel faces the sample */
+        match(detector.type){
+                of(CirPad, curved){
+                        double r = curved->radius;
+                        double a = atan2(-y[flat_index(shape, ix0, iy0)],
+                                         x[flat_index(shape, ix0, iy0)] + r);
+
+                        translate_coordinates(arr, shape, r, 0, 0);
+                        rotate_coordinates(arr, shape, a, 0, 0, 1);
+                        translate_coordinates(arr, shape, -r, 0, 0);
+                }
+                otherwise {
+                }
+        }
+
+        double dx = sdd - x[flat_index(shape, ix0, iy0)];
         double dy = -y[flat_index(shape, ix0, iy0)];
         double dz = -z[flat_index(shape, ix0, iy0)];
 
@@ -493,6 +566,91 @@ void hkl_binoculars_detector_2d_sixs_calibration(HklBinocularsDetectorEnum n,
                 normalize_coordinates(arr, shape);
 }
 
+/*********/
+/* Cache */
+/*********/
+
+/* the calibrated coordinates computed by the process, by
+ * (detector, central pixel, sdd, detrot, normalisation) */
+static GMutex coordinates_cache_mutex;
+static GHashTable *coordinates_cache = NULL;
+static char *coordinates_cache_dir = NULL;
+
+static char *coordinates_cache_fname(const char *key)
+{
+        char *fname = NULL;
+
+        if(NULL != coordinates_cache_dir){
+                char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key, -1);
+                char *base = g_strdup_printf("coordinates_%s.npy", hash);
+
+                fname = g_build_filename(coordinates_cache_dir, base, NULL);
+                g_free(base);
+                g_free(hash);
+        }
+
+        return fname;
+}
+
+static double *coordinates_cache_load(const struct detector_t *detector, const char *key)
+{
+        double *arr = NULL;
+        char *fname = coordinates_cache_fname(key);
+
+        if(NULL != fname){
+                darray_int shape = darray_new();
+
+                darray_append(shape, 3);
+                darray_append(shape, detector->shape.height);
+                darray_append(shape, detector->shape.width);
+
+                if(g_file_test(fname, G_FILE_TEST_EXISTS))
+                        arr = npy_load(fname, HklBinocularsNpyDouble(), &shape);
+
+                darray_free(shape);
+                g_free(fname);
+        }
+
+        return arr;
+}
+
+/* written in a temporary file then renamed, so the other processes
+ * read complete files only */
+static void coordinates_cache_save(const struct detector_t *detector, const char *key,
+                                   const double *arr)
+{
+        char *fname = coordinates_cache_fname(key);
+
+        if(NULL != fname){
+                char *tmp = g_strdup_printf("%s.%d.tmp", fname, getpid());
+                darray_int shape = darray_new();
+                struct npy_writer_t *writer;
+
+                darray_append(shape, 3);
+                darray_append(shape, detector->shape.height);
+                darray_append(shape, detector->shape.width);
+
+                writer = npy_writer_new(tmp, HklBinocularsNpyDouble(), &shape);
+                if(NULL != writer){
+                        npy_writer_append(writer, arr, 3 * shape_size(detector->shape));
+                        if(0 != npy_writer_close(writer) || 0 != g_rename(tmp, fname))
+                                g_unlink(tmp);
+                }
+
+                darray_free(shape);
+                g_free(tmp);
+                g_free(fname);
+        }
+}
+
+void hkl_binoculars_detector_2d_coordinates_cache_dir_set(const char *dirname)
+{
+        g_mutex_lock(&coordinates_cache_mutex);
+        g_free(coordinates_cache_dir);
+        coordinates_cache_dir = g_strdup(dirname);
+        g_mutex_unlock(&coordinates_cache_mutex);
+}
+
 /*****************************/
 /* public API implementation */
 /*****************************/
@@ -557,10 +715,66 @@ double *hkl_binoculars_detector_2d_coordinates_get(HklBinocularsDetectorEnum n)
                         arr = coordinates_get_tilling(&detector.shape,
                                                       tilling);
                 }
+                of(Mythen, strip){
+                        arr = coordinates_rectangle(&detector.shape,
+                                                    strip->pitch,
+                                                    strip->length);
+                }
+                of(CirPad, curved){
+                        arr = coordinates_get_curved_strip(&detector.shape,
+                                                           curved);
+                }
         }
         return arr;
 }
 
+double *hkl_binoculars_detector_2d_calibrated_coordinates_get(HklBinocularsDetectorEnum n,
+                                                              int ix0, int iy0,
+                                                              double sdd, double detrot,
+                                                              int normalize_flag)
+{
+        const struct detector_t detector = get_detector(n);
+        size_t nbytes = 3 * shape_size(detector.shape) * sizeof(double);
+        char *key = g_strdup_printf("%s_%d_%d_%a_%a_%d", detector.name,
+                                    ix0, iy0, sdd, detrot, 0 != normalize_flag);
+        double *cached;
+        double *arr = NULL;
+
+        g_mutex_lock(&coordinates_cache_mutex);
+        if(NULL == coordinates_cache)
+                coordinates_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                          g_free, free);
+
+        cached = g_hash_table_lookup(coordinates_cache, key);
+        if(NULL == cached){
+                cached = coordinates_cache_load(&detector, key);
+                if(NULL == cached){
+                        cached = hkl_binoculars_detector_2d_coordinates_get(n);
+                        if(NULL != cached){
+                                hkl_binoculars_detector_2d_sixs_calibration(n, cached,
+                                                                            detector.shape.width,
+                                                                            detector.shape.height,
+                                                                            ix0, iy0, sdd,
+                                                                            detrot, normalize_flag);
+                                coordinates_cache_save(&detector, key, cached);
+                        }
+                }
+                if(NULL != cached){
+                        g_hash_table_insert(coordinates_cache, key, cached);
+                        key = NULL; /* owned by the cache */
+                }
+        }
+        if(NULL != cached){
+                arr = malloc(nbytes);
+                memcpy(arr, cached, nbytes);
+        }
+        g_mutex_unlock(&coordinates_cache_mutex);
+
+        g_free(key);
+
+        return arr;
+}
+
 void hkl_binoculars_detector_2d_coordinates_save(HklBinocularsDetectorEnum n,
                                                  const char *fname)
 {
@@ -641,6 +855,132 @@ uint8_t *hkl_binoculars_detector_2d_mask_load(HklBinocularsDetectorEnum n,
         return arr;
 };
 
+uint32_t *hkl_binoculars_detector_2d_mask_indexes_get(const uint8_t *masked,
+                                                      size_t n_pixels,
+                                                      size_t *n_indexes)
+{
+        size_t i;
+        size_t n = 0;
+        uint32_t *arr = malloc(n_pixels * sizeof(*arr));
+
+        assert(n_pixels <= UINT32_MAX);
+
+        for(i=0; i<n_pixels; ++i){
+                arr[n] = i;
+                n += NULL == masked || 0 == masked[i];
+        }
+
+        *n_indexes = n;
+
+        return arr;
+}
+
+int hkl_binoculars_detector_2d_mask_roi_get(const uint8_t *masked,
+                                            int width, int height,
+                                            size_t *row0, size_t *row1,
+                                            size_t *col0, size_t *col1)
+{
+        size_t i, j;
+        size_t w = width;
+        size_t h = height;
+
+        *row0 = h;
+        *row1 = 0;
+        *col0 = w;
+        *col1 = 0;
+
+        for(j=0; j<h; ++j)
+                for(i=0; i<w; ++i)
+                        if(NULL == masked || 0 == masked[j * w + i]){
+                                *row0 = MIN(*row0, j);
+                                *row1 = MAX(*row1, j + 1);
+                                *col0 = MIN(*col0, i);
+                                *col1 = MAX(*col1, i + 1);
+                        }
+
+        return *row0 < *row1;
+}
+
+uint8_t *hkl_binoculars_detector_2d_mask_mmap(HklBinocularsDetectorEnum n,
+                                              const char *fname)
+{
+        uint8_t *arr = NULL;
+        const struct detector_t detector = get_detector(n);
+        darray_int shape = darray_new();
+
+        darray_append(shape, detector.shape.height);
+        darray_append(shape, detector.shape.width);
+
+        arr = npy_mmap(fname, HklBinocularsNpyBool(), &shape);
+
+        darray_free(shape);
+
+        return arr;
+};
+
+void hkl_binoculars_detector_2d_mask_munmap(uint8_t *arr)
+{
+        npy_munmap(arr);
+}
+
+/* a correction array, mapped or loaded, NULL if fname is NULL */
+static double *correction_open(const char *fname, const darray_int *shape,
+                               int *mapped, int *error)
+{
+        double *arr = NULL;
+
+        *mapped = FALSE;
+        if (NULL != fname){
+                arr = npy_mmap(fname, HklBinocularsNpyDouble(), shape);
+                if (NULL != arr)
+                        *mapped = TRUE;
+                else
+                        arr = npy_load(fname, HklBinocularsNpyDouble(), shape);
+                if (NULL == arr)
+                        *error = TRUE;
+        }
+
+        return arr;
+}
+
+static void correction_close(double *arr, int mapped)
+{
+        if (TRUE == mapped)
+                npy_munmap(arr);
+        else
+                free(arr);
+}
+
+int hkl_binoculars_detector_2d_corrections_load(HklBinocularsDetectorEnum n,
+                                                const char *dark,
+                                                const char *flatfield,
+                                                const char *solid_angle)
+{
+        int error = FALSE;
+        int mapped[3];
+        double *arr[3];
+        const struct detector_t detector = get_detector(n);
+        size_t n_pixels = detector.shape.width * detector.shape.height;
+        darray_int shape = darray_new();
+
+        darray_append(shape, detector.shape.height);
+        darray_append(shape, detector.shape.width);
+
+        arr[0] = correction_open(dark, &shape, &mapped[0], &error);
+        arr[1] = correction_open(flatfield, &shape, &mapped[1], &error);
+        arr[2] = correction_open(solid_angle, &shape, &mapped[2], &error);
+
+        if (FALSE == error)
+                hkl_binoculars_corrections_set(n_pixels, arr[0], arr[1], arr[2]);
+
+        correction_close(arr[2], mapped[2]);
+        correction_close(arr[1], mapped[1]);
+        correction_close(arr[0], mapped[0]);
+        darray_free(shape);
+
+        return FALSE == error;
+}
+
 void hkl_binoculars_detector_2d_mask_save(HklBinocularsDetectorEnum n,
                                           const char *fname)
 {
@@ -658,6 +998,131 @@ void hkl_binoculars_detector_2d_mask_save(HklBinocularsDetectorEnum n,
         free(arr);
 }
 
+/**************/
+/* Hot pixels */
+/**************/
+
+/* the counts of the frames saturate at UINT16_MAX, still hot, but it
+ * halves the state of the large detectors. They are stored by pixel
+ * so the median of a pixel reads a contiguous row. */
+struct _HklBinocularsHotPixels
+{
+        size_t n_pixels;
+        size_t n_frames;
+        size_t n_added;
+        uint16_t *counts; /* n_pixels x n_frames */
+};
+
+HklBinocularsHotPixels *hkl_binoculars_detector_2d_hot_pixels_new(size_t n_pixels,
+                                                                  size_t n_frames)
+{
+        HklBinocularsHotPixels *self = g_new0(HklBinocularsHotPixels, 1);
+
+        self->n_pixels = n_pixels;
+        self->n_frames = MAX(n_frames, 1);
+        self->counts = g_new(uint16_t, self->n_pixels * self->n_frames);
+
+        return self;
+}
+
+void hkl_binoculars_detector_2d_hot_pixels_free(HklBinocularsHotPixels *self)
+{
+        g_free(self->counts);
+        g_free(self);
+}
+
+int hkl_binoculars_detector_2d_hot_pixels_add_frame_uint32(HklBinocularsHotPixels *self,
+                                                           const uint32_t *image)
+{
+        size_t i;
+
+        if(self->n_added == self->n_frames)
+                return FALSE;
+
+        for(i=0; i<self->n_pixels; ++i)
+                self->counts[i * self->n_frames + self->n_added] = MIN(image[i], UINT16_MAX);
+        self->n_added++;
+
+        return TRUE;
+}
+
+static int float_cmp(const void *a, const void *b)
+{
+        float fa = *(const float *)a;
+        float fb = *(const float *)b;
+
+        return (fa > fb) - (fa < fb);
+}
+
+/* the few counts of a pixel, sorted in place */
+static inline float counts_median(uint16_t *counts, size_t n)
+{
+        size_t i, j;
+
+        for(i=1; i<n; ++i){
+                uint16_t v = counts[i];
+
+                for(j=i; j>0 && counts[j - 1] > v; --j)
+                        counts[j] = counts[j - 1];
+                counts[j] = v;
+        }
+
+        return n % 2 ? counts[n / 2] : 0.5f * (counts[n / 2 - 1] + counts[n / 2]);
+}
+
+static inline float values_median(float *values, size_t n)
+{
+        qsort(values, n, sizeof(*values), float_cmp);
+
+        return n % 2 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+}
+
+size_t hkl_binoculars_detector_2d_hot_pixels_mask(HklBinocularsHotPixels *self,
+                                                  uint8_t *masked,
+                                                  double threshold)
+{
+        size_t i;
+        size_t n = 0;
+        size_t n_hot = 0;
+        float median;
+        float deviation;
+        float *medians;
+        float *values;
+
+        if(0 == self->n_added)
+                return 0;
+
+        medians = g_new(float, self->n_pixels);
+        values = g_new(float, self->n_pixels);
+        for(i=0; i<self->n_pixels; ++i){
+                medians[i] = counts_median(&self->counts[i * self->n_frames], self->n_added);
+                if(0 == masked[i])
+                        values[n++] = medians[i];
+        }
+
+        if(n > 0){
+                median = values_median(values, n);
+                for(i=0; i<n; ++i)
+                        values[i] = fabsf(values[i] - median);
+
+                /* the MAD of a gaussian, at least the poisson noise
+                 * of the median */
+                deviation = 1.4826f * values_median(values, n);
+                deviation = MAX(deviation, sqrtf(MAX(median, 1.0f)));
+
+                for(i=0; i<self->n_pixels; ++i)
+                        if(0 == masked[i] && medians[i] > median + threshold * deviation){
+                                masked[i] = 1;
+                                n_hot++;
+                        }
+        }
+
+        g_free(values);
+        g_free(medians);
+
+        return n_hot;
+}
+
 
 uint32_t *hkl_binoculars_detector_2d_fake_image_uint32(HklBinocularsDetectorEnum n,
                                                        size_t *n_pixels)
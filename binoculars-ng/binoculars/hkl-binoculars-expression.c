@@ -0,0 +1,645 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#include "hkl/ccan/array_size/array_size.h"
+#include "hkl/ccan/darray/darray.h"
+#include "hkl-binoculars-private.h"
+
+/* The expression is compiled by a recursive descent parser into the
+ * bytecode of a stack machine. Each instruction is applied to a
+ * whole block of pixels before the next one, so the cost of the
+ * dispatch is shared by the pixels of the block and the loop of each
+ * instruction is vectorised by the compiler. The constants are
+ * folded while compiling and the arithmetic operations with a
+ * constant operand have their own instructions, so the constants are
+ * seldom pushed on the stack. */
+
+/* the pixels evaluated at once, the stack stays in the L2 cache */
+#define EXPRESSION_BLOCK_SIZE 256
+
+/* the deepest stack of an expression */
+#define EXPRESSION_MAX_DEPTH 16
+
+typedef enum _OpCode
+{
+        OP_CONST = 0, /* push the constant */
+        OP_VAR, /* push the variable */
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_POW,
+        OP_ADD_K, /* a op constant */
+        OP_SUB_K,
+        OP_MUL_K,
+        OP_DIV_K,
+        OP_POW_K,
+        OP_K_SUB, /* constant op a */
+        OP_K_DIV,
+        OP_NEG,
+        OP_SQRT,
+        OP_ABS,
+        OP_EXP,
+        OP_LOG,
+        OP_SIN,
+        OP_COS,
+        OP_TAN,
+        OP_ASIN,
+        OP_ACOS,
+        OP_ATAN,
+        OP_ATAN2,
+} OpCode;
+
+typedef struct _Instruction Instruction;
+struct _Instruction
+{
+        OpCode op;
+        double k; /* the constant of OP_CONST and OP_*_K */
+        size_t var; /* the variable of OP_VAR */
+};
+
+typedef darray(Instruction) darray_instruction;
+
+struct _HklBinocularsExpression
+{
+        char *name;
+        darray_instruction code;
+        size_t depth; /* of the stack */
+        unsigned int variables; /* one bit per used variable */
+};
+
+/* in the order of HklBinocularsExpressionVariableEnum */
+static const char *variables_names[] = {
+        "qx",
+        "qy",
+        "qz",
+        "q",
+        "qpar",
+        "qper",
+        "tth",
+        "azimuth",
+        "kfx",
+        "kfy",
+        "kfz",
+        "timestamp",
+        "sampleaxis",
+};
+
+typedef struct _Function Function;
+struct _Function
+{
+        const char *name;
+        size_t n_args;
+        OpCode op;
+};
+
+static const Function functions[] = {
+        {"sqrt", 1, OP_SQRT},
+        {"abs", 1, OP_ABS},
+        {"exp", 1, OP_EXP},
+        {"log", 1, OP_LOG},
+        {"sin", 1, OP_SIN},
+        {"cos", 1, OP_COS},
+        {"tan", 1, OP_TAN},
+        {"asin", 1, OP_ASIN},
+        {"acos", 1, OP_ACOS},
+        {"atan", 1, OP_ATAN},
+        {"atan2", 2, OP_ATAN2},
+};
+
+/***********/
+/* Compile */
+/***********/
+
+typedef struct _Parser Parser;
+struct _Parser
+{
+        const char *source;
+        const char *p;
+        HklBinocularsExpression *expression;
+        size_t depth; /* of the stack after the emitted code */
+        char *error;
+};
+
+static int parser_error(Parser *self, const char *msg)
+{
+        if(NULL == self->error)
+                self->error = g_strdup_printf("%s at column %d of \"%s\"",
+                                              msg, (int)(self->p - self->source) + 1,
+                                              self->source);
+        return FALSE;
+}
+
+static void parser_skip_spaces(Parser *self)
+{
+        while(isspace((unsigned char)*self->p))
+                self->p++;
+}
+
+static int parser_accept(Parser *self, char c)
+{
+        parser_skip_spaces(self);
+        if(*self->p == c){
+                self->p++;
+                return TRUE;
+        }
+        return FALSE;
+}
+
+static Instruction *code_last(HklBinocularsExpression *self, size_t i)
+{
+        size_t n = darray_size(self->code);
+
+        return i < n ? &darray_item(self->code, n - 1 - i) : NULL;
+}
+
+static int emit(Parser *self, Instruction instruction)
+{
+        darray_append(self->expression->code, instruction);
+
+        switch(instruction.op){
+        case OP_CONST:
+        case OP_VAR:
+                self->depth++;
+                break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_POW:
+        case OP_ATAN2:
+                self->depth--;
+                break;
+        default:
+                break;
+        }
+
+        if(self->depth > EXPRESSION_MAX_DEPTH)
+                return parser_error(self, "too deep expression");
+        if(self->depth > self->expression->depth)
+                self->expression->depth = self->depth;
+
+        return TRUE;
+}
+
+static double unary_value(OpCode op, double a)
+{
+        switch(op){
+        case OP_NEG: return -a;
+        case OP_SQRT: return sqrt(a);
+        case OP_ABS: return fabs(a);
+        case OP_EXP: return exp(a);
+        case OP_LOG: return log(a);
+        case OP_SIN: return sin(a);
+        case OP_COS: return cos(a);
+        case OP_TAN: return tan(a);
+        case OP_ASIN: return asin(a);
+        case OP_ACOS: return acos(a);
+        case OP_ATAN: return atan(a);
+        default: return NAN;
+        }
+}
+
+static double binary_value(OpCode op, double a, double b)
+{
+        switch(op){
+        case OP_ADD: return a + b;
+        case OP_SUB: return a - b;
+        case OP_MUL: return a * b;
+        case OP_DIV: return a / b;
+        case OP_POW: return pow(a, b);
+        case OP_ATAN2: return atan2(a, b);
+        default: return NAN;
+        }
+}
+
+static int emit_unary(Parser *self, OpCode op)
+{
+        Instruction *a = code_last(self->expression, 0);
+
+        if(NULL != a && OP_CONST == a->op){
+                a->k = unary_value(op, a->k);
+                return TRUE;
+        }
+
+        return emit(self, (Instruction){.op=op});
+}
+
+/* the operands of a binary operation are the code from lhs to rhs
+ * and from rhs to the end. Fold the constants or use the instruction
+ * with a constant operand. */
+static int emit_binary(Parser *self, OpCode op, size_t lhs, size_t rhs)
+{
+        darray_instruction *code = &self->expression->code;
+        size_t n = darray_size(*code);
+        int lhs_k = rhs == lhs + 1 && OP_CONST == darray_item(*code, lhs).op;
+        int rhs_k = n == rhs + 1 && OP_CONST == darray_item(*code, rhs).op;
+
+        if(lhs_k && rhs_k){
+                Instruction *a = &darray_item(*code, lhs);
+
+                a->k = binary_value(op, a->k, darray_item(*code, rhs).k);
+                darray_size(*code)--;
+                self->depth--;
+                return TRUE;
+        }
+
+        if(rhs_k){
+                Instruction *b = &darray_item(*code, rhs);
+
+                switch(op){
+                case OP_ADD: b->op = OP_ADD_K; break;
+                case OP_SUB: b->op = OP_SUB_K; break;
+                case OP_MUL: b->op = OP_MUL_K; break;
+                case OP_DIV: b->op = OP_DIV_K; break;
+                case OP_POW: b->op = OP_POW_K; break;
+                default: return emit(self, (Instruction){.op=op});
+                }
+                self->depth--;
+                return TRUE;
+        }
+
+        if(lhs_k){
+                OpCode op_k;
+                double k = darray_item(*code, lhs).k;
+
+                switch(op){
+                case OP_ADD: op_k = OP_ADD_K; break;
+                case OP_SUB: op_k = OP_K_SUB; break;
+                case OP_MUL: op_k = OP_MUL_K; break;
+                case OP_DIV: op_k = OP_K_DIV; break;
+                default: return emit(self, (Instruction){.op=op});
+                }
+                memmove(&darray_item(*code, lhs), &darray_item(*code, rhs),
+                        (n - rhs) * sizeof(Instruction));
+                darray_size(*code)--;
+                self->depth--;
+                return emit(self, (Instruction){.op=op_k, .k=k});
+        }
+
+        return emit(self, (Instruction){.op=op});
+}
+
+static int parse_expr(Parser *self);
+
+static int parse_number(Parser *self)
+{
+        char *end;
+        double k = g_ascii_strtod(self->p, &end);
+
+        if(end == self->p)
+                return parser_error(self, "number expected");
+        self->p = end;
+
+        return emit(self, (Instruction){.op=OP_CONST, .k=k});
+}
+
+/* name(args), deg and rad are a multiplication */
+static int parse_call(Parser *self, const char *name, size_t len)
+{
+        size_t i;
+        size_t n_args = 0;
+        size_t starts[2];
+        const Function *function = NULL;
+        int deg = 3 == len && 0 == strncmp(name, "deg", len);
+        int rad = 3 == len && 0 == strncmp(name, "rad", len);
+
+        for(i=0; i<ARRAY_SIZE(functions); ++i)
+                if(strlen(functions[i].name) == len
+                   && 0 == strncmp(functions[i].name, name, len))
+                        function = &functions[i];
+
+        if(NULL == function && !deg && !rad){
+                self->p = name;
+                return parser_error(self, "unknown function");
+        }
+
+        do{
+                if(n_args < ARRAY_SIZE(starts))
+                        starts[n_args] = darray_size(self->expression->code);
+                if(!parse_expr(self))
+                        return FALSE;
+                n_args++;
+        }while(parser_accept(self, ','));
+
+        if(!parser_accept(self, ')'))
+                return parser_error(self, "')' expected");
+
+        if(n_args != (NULL == function ? 1 : function->n_args))
+                return parser_error(self, "wrong number of arguments");
+
+        if(deg || rad){
+                size_t rhs = darray_size(self->expression->code);
+
+                if(!emit(self, (Instruction){.op=OP_CONST, .k=deg ? 180 / M_PI : M_PI / 180}))
+                        return FALSE;
+                return emit_binary(self, OP_MUL, starts[0], rhs);
+        }
+
+        return 1 == n_args
+                ? emit_unary(self, function->op)
+                : emit_binary(self, function->op, starts[0], starts[1]);
+}
+
+static int parse_primary(Parser *self)
+{
+        parser_skip_spaces(self);
+
+        if(isdigit((unsigned char)*self->p) || '.' == *self->p)
+                return parse_number(self);
+
+        if(isalpha((unsigned char)*self->p) || '_' == *self->p){
+                size_t i;
+                size_t len;
+                const char *name = self->p;
+
+                while(isalnum((unsigned char)*self->p) || '_' == *self->p)
+                        self->p++;
+                len = self->p - name;
+
+                if(parser_accept(self, '('))
+                        return parse_call(self, name, len);
+
+                if(2 == len && 0 == strncmp(name, "pi", len))
+                        return emit(self, (Instruction){.op=OP_CONST, .k=M_PI});
+
+                for(i=0; i<ARRAY_SIZE(variables_names); ++i)
+                        if(strlen(variables_names[i]) == len
+                           && 0 == strncmp(variables_names[i], name, len)){
+                                self->expression->variables |= 1u << i;
+                                return emit(self, (Instruction){.op=OP_VAR, .var=i});
+                        }
+
+                self->p = name;
+                return parser_error(self, "unknown variable");
+        }
+
+        if(parser_accept(self, '(')){
+                if(!parse_expr(self))
+                        return FALSE;
+                if(!parser_accept(self, ')'))
+                        return parser_error(self, "')' expected");
+                return TRUE;
+        }
+
+        return parser_error(self, "number, variable or '(' expected");
+}
+
+static int parse_unary(Parser *self);
+
+/* primary ^ unary, right associative and before the sign */
+static int parse_power(Parser *self)
+{
+        size_t lhs = darray_size(self->expression->code);
+
+        if(!parse_primary(self))
+                return FALSE;
+
+        if(parser_accept(self, '^')){
+                size_t rhs = darray_size(self->expression->code);
+
+                if(!parse_unary(self))
+                        return FALSE;
+                return emit_binary(self, OP_POW, lhs, rhs);
+        }
+
+        return TRUE;
+}
+
+static int parse_unary(Parser *self)
+{
+        if(parser_accept(self, '-')){
+                if(!parse_unary(self))
+                        return FALSE;
+                return emit_unary(self, OP_NEG);
+        }
+        if(parser_accept(self, '+'))
+                return parse_unary(self);
+
+        return parse_power(self);
+}
+
+static int parse_term(Parser *self)
+{
+        size_t lhs = darray_size(self->expression->code);
+
+        if(!parse_unary(self))
+                return FALSE;
+
+        for(;;){
+                OpCode op;
+                size_t rhs = darray_size(self->expression->code);
+
+                if(parser_accept(self, '*'))
+                        op = OP_MUL;
+                else if(parser_accept(self, '/'))
+                        op = OP_DIV;
+                else
+                        return TRUE;
+
+                if(!parse_unary(self) || !emit_binary(self, op, lhs, rhs))
+                        return FALSE;
+        }
+}
+
+static int parse_expr(Parser *self)
+{
+        size_t lhs = darray_size(self->expression->code);
+
+        if(!parse_term(self))
+                return FALSE;
+
+        for(;;){
+                OpCode op;
+                size_t rhs = darray_size(self->expression->code);
+
+                if(parser_accept(self, '+'))
+                        op = OP_ADD;
+                else if(parser_accept(self, '-'))
+                        op = OP_SUB;
+                else
+                        return TRUE;
+
+                if(!parse_term(self) || !emit_binary(self, op, lhs, rhs))
+                        return FALSE;
+        }
+}
+
+HklBinocularsExpression *hkl_binoculars_expression_new(const char *name,
+                                                       const char *source,
+                                                       char **error)
+{
+        HklBinocularsExpression *self = g_new0(HklBinocularsExpression, 1);
+        Parser parser = {
+                .source = source,
+                .p = source,
+                .expression = self,
+        };
+
+        self->name = g_strdup(name);
+        darray_init(self->code);
+
+        if(parse_expr(&parser)){
+                parser_skip_spaces(&parser);
+                if('\0' != *parser.p)
+                        parser_error(&parser, "end of the expression expected");
+        }
+
+        if(NULL != parser.error){
+                if(NULL != error)
+                        *error = parser.error;
+                else
+                        g_free(parser.error);
+                hkl_binoculars_expression_free(self);
+                return NULL;
+        }
+
+        return self;
+}
+
+void hkl_binoculars_expression_free(HklBinocularsExpression *self)
+{
+        darray_free(self->code);
+        g_free(self->name);
+        g_free(self);
+}
+
+const char *hkl_binoculars_expression_name_get(const HklBinocularsExpression *self)
+{
+        return self->name;
+}
+
+unsigned int hkl_binoculars_expression_variables_get(const HklBinocularsExpression *self)
+{
+        return self->variables;
+}
+
+/************/
+/* Evaluate */
+/************/
+
+#define UNARY(f) for(j=0; j<n; ++j) out[j] = f(a[j])
+#define BINARY(expr) for(j=0; j<n; ++j) out[j] = expr
+
+/* the slot i of the stack points to a variable or to the register
+ * i, the result of an instruction is always written in the register
+ * of its slot. */
+static void expression_eval_block(const HklBinocularsExpression *self,
+                                  const double *const *variables,
+                                  size_t n, double *values)
+{
+        size_t j;
+        size_t sp = 0;
+        const Instruction *instruction;
+        const double *stack[EXPRESSION_MAX_DEPTH];
+        double registers[self->depth][EXPRESSION_BLOCK_SIZE];
+
+        darray_foreach(instruction, self->code){
+                const double k = instruction->k;
+                const double *a = sp > 0 ? stack[sp - 1] : NULL;
+                const double *b = a;
+                double *out;
+
+                switch(instruction->op){
+                case OP_CONST:
+                        out = registers[sp];
+                        for(j=0; j<n; ++j)
+                                out[j] = k;
+                        stack[sp++] = out;
+                        continue;
+                case OP_VAR:
+                        stack[sp++] = variables[instruction->var];
+                        continue;
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_DIV:
+                case OP_POW:
+                case OP_ATAN2:
+                        a = stack[sp - 2];
+                        sp--;
+                        break;
+                default:
+                        break;
+                }
+
+                out = registers[sp - 1];
+                switch(instruction->op){
+                case OP_ADD: BINARY(a[j] + b[j]); break;
+                case OP_SUB: BINARY(a[j] - b[j]); break;
+                case OP_MUL: BINARY(a[j] * b[j]); break;
+                case OP_DIV: BINARY(a[j] / b[j]); break;
+                case OP_POW: BINARY(pow(a[j], b[j])); break;
+                case OP_ATAN2: BINARY(atan2(a[j], b[j])); break;
+                case OP_ADD_K: BINARY(a[j] + k); break;
+                case OP_SUB_K: BINARY(a[j] - k); break;
+                case OP_MUL_K: BINARY(a[j] * k); break;
+                case OP_DIV_K: BINARY(a[j] / k); break;
+                case OP_POW_K:
+                        if(2 == k)
+                                BINARY(a[j] * a[j]);
+                        else
+                                BINARY(pow(a[j], k));
+                        break;
+                case OP_K_SUB: BINARY(k - a[j]); break;
+                case OP_K_DIV: BINARY(k / a[j]); break;
+                case OP_NEG: UNARY(-); break;
+                case OP_SQRT: UNARY(sqrt); break;
+                case OP_ABS: UNARY(fabs); break;
+                case OP_EXP: UNARY(exp); break;
+                case OP_LOG: UNARY(log); break;
+                case OP_SIN: UNARY(sin); break;
+                case OP_COS: UNARY(cos); break;
+                case OP_TAN: UNARY(tan); break;
+                case OP_ASIN: UNARY(asin); break;
+                case OP_ACOS: UNARY(acos); break;
+                case OP_ATAN: UNARY(atan); break;
+                case OP_CONST:
+                case OP_VAR:
+                        break;
+                }
+                stack[sp - 1] = out;
+        }
+
+        memcpy(values, stack[0], n * sizeof(*values));
+}
+
+void hkl_binoculars_expression_eval(const HklBinocularsExpression *self,
+                                    const double *const *variables,
+                                    size_t n, double *values)
+{
+        size_t i, v;
+
+        for(i=0; i<n; i+=EXPRESSION_BLOCK_SIZE){
+                size_t m = n - i < EXPRESSION_BLOCK_SIZE ? n - i : EXPRESSION_BLOCK_SIZE;
+                const double *block[HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES] = {NULL};
+
+                for(v=0; v<HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES; ++v)
+                        if(self->variables & (1u << v))
+                                block[v] = &variables[v][i];
+
+                expression_eval_block(self, block, m, &values[i]);
+        }
+}
@@ -25,6 +25,8 @@
 #include <cglm/version.h>
 
 #include "hkl-binoculars-private.h"
+#include "hkl-matrix-private.h"
+#include "hkl-quaternion-private.h"
 
 mat4s hkl_binoculars_parameter_transformation_get(const HklParameter *self)
 {
@@ -70,14 +72,38 @@ mat4s hkl_binoculars_parameter_transformation_get(const HklParameter *self)
 mat4s hkl_binoculars_holder_transformation_get(const HklHolder *self)
 {
         CGLM_ALIGN_MAT mat4s r = GLMS_MAT4_IDENTITY_INIT;
-        size_t i;
+        HklMatrix m;
+        size_t i, j;
 
-	/* for each axis from the end apply the transformation to the vector */
-	for(i=0;i<self->config->len;i++){
-		HklParameter *p = darray_item(self->geometry->axes, self->config->idx[i]);
+        /* the transformation compiled by the last geometry update */
+        hkl_quaternion_to_matrix(&self->q, &m);
+        for(i=0; i<3; ++i){
+                for(j=0; j<3; ++j)
+                        r.raw[j][i] = m.data[i][j];
+                r.raw[3][i] = self->t.data[i];
+        }
 
-                r = glms_mat4_mul(r, hkl_binoculars_parameter_transformation_get(p));
-	}
+	return r;
+}
+
+mat4s hkl_binoculars_holder_inverse_transformation_get(const HklHolder *self)
+{
+        CGLM_ALIGN_MAT mat4s r = GLMS_MAT4_IDENTITY_INIT;
+        HklMatrix m;
+        size_t i, j;
+
+        /* x -> q x + t is a rigid transformation, its inverse is
+         * x -> q^T x - q^T t, no general inversion needed */
+        hkl_quaternion_to_matrix(&self->q, &m);
+        for(i=0; i<3; ++i){
+                double t = 0;
+
+                for(j=0; j<3; ++j){
+                        r.raw[j][i] = m.data[j][i];
+                        t -= m.data[j][i] * self->t.data[j];
+                }
+                r.raw[3][i] = t;
+        }
 
 	return r;
 }
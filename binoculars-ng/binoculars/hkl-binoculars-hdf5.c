@@ -19,7 +19,15 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <glib/gstdio.h>
 #include <hdf5.h>
+#include <math.h>
+#ifdef HAVE_LZ4
+# include <lz4.h>
+#endif
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "hkl/ccan/array_size/array_size.h"
 #include "hkl/hkl-macros-private.h"
@@ -57,7 +65,7 @@ static herr_t save_string(hid_t group_id, const char *name, const char* config)
 
 
         dataspace_id = H5Screate_simple(1, dims, NULL);
-        dataset_id = H5Dcreate (group_id, "config",
+        dataset_id = H5Dcreate (group_id, name,
                                 filetype, dataspace_id,
                                 H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
         status = H5Dwrite (dataset_id, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, config);
@@ -70,32 +78,178 @@ static herr_t save_string(hid_t group_id, const char *name, const char* config)
         return status;
 }
 
-void hkl_binoculars_cube_save_hdf5(const char *fn,
-                                   const char *config,
-                                   const HklBinocularsCube *self)
+static char *config_hash(const char *config)
 {
-        double axis_idx = 0;
-        hid_t file_id;
-        hid_t groupe_id;
-        hid_t groupe_axes_id;
+        return g_compute_checksum_for_string(G_CHECKSUM_SHA256, config, -1);
+}
+
+/* the config and its hash, used to check that a cube can be reused */
+static herr_t save_config(hid_t group_id, const char *config)
+{
+        herr_t status;
+        char *hash = config_hash(config);
+
+        status = save_string(group_id, "config", config);
+        status |= save_string(group_id, "config_hash", hash);
+
+        g_free(hash);
+
+        return status;
+}
+
+static char *load_string(hid_t group_id, const char *name)
+{
+        char *res = NULL;
         hid_t dataset_id;
-        hid_t dataspace_id;
+        hid_t filetype;
+        hid_t memtype;
+        size_t size;
+
+        if(H5Lexists(group_id, name, H5P_DEFAULT) <= 0)
+                return NULL;
+
+        dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        filetype = H5Dget_type(dataset_id);
+        size = H5Tget_size(filetype);
+        memtype = H5Tcopy(H5T_C_S1);
+        H5Tset_size(memtype, size);
+
+        res = g_malloc0(size + 1);
+        if(H5Dread(dataset_id, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, res) < 0){
+                g_free(res);
+                res = NULL;
+        }
+
+        H5Tclose(memtype);
+        H5Tclose(filetype);
+        H5Dclose(dataset_id);
+
+        return res;
+}
+
+static herr_t save_array(hid_t group_id, const char *name, hid_t type,
+                         int rank, const hsize_t *dims, const void *data)
+{
         herr_t status;
-        HklBinocularsAxis *axis;
+        hid_t dataspace_id = H5Screate_simple(rank, dims, NULL);
+        hid_t dataset_id = H5Dcreate(group_id, name, type, dataspace_id,
+                                     H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 
-        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        status = H5Dwrite(dataset_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+        status |= H5Dclose(dataset_id);
+        status |= H5Sclose(dataspace_id);
 
-        groupe_id = H5Gcreate(file_id, "binoculars",
-                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        return status;
+}
 
-        // config
-        status = save_string(groupe_id, "config", config);
+/* read a dataset of rank 1 or 2 with n_columns columns, return the
+ * number of rows or -1 if the dataset does not exist or has another
+ * shape. The data must be released with free. */
+static hssize_t load_array(hid_t group_id, const char *name, hid_t type,
+                           hsize_t n_columns, void **data)
+{
+        hssize_t n_rows = -1;
+        hid_t dataset_id;
+        hid_t dataspace_id;
+        hsize_t dims[2] = {0, 1};
+        int rank;
 
-        // axes
-        groupe_axes_id = H5Gcreate(groupe_id, "axes",
+        *data = NULL;
+        if(H5Lexists(group_id, name, H5P_DEFAULT) <= 0)
+                return -1;
+
+        dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        dataspace_id = H5Dget_space(dataset_id);
+        rank = H5Sget_simple_extent_ndims(dataspace_id);
+        if((1 == rank || 2 == rank) && H5Sget_simple_extent_dims(dataspace_id, dims, NULL) >= 0
+           && dims[1] == n_columns){
+                *data = malloc(H5Tget_size(type) * (dims[0] * dims[1] + 1));
+                if(H5Dread(dataset_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, *data) >= 0)
+                        n_rows = dims[0];
+                else{
+                        free(*data);
+                        *data = NULL;
+                }
+        }
+
+        H5Sclose(dataspace_id);
+        H5Dclose(dataset_id);
+
+        return n_rows;
+}
+
+/* binoculars/frames: the projected frames of each file and all the
+ * axes of the cube, even the ones of size 1 which are not part of
+ * the axes group. */
+static herr_t save_frames(hid_t group_id, const darray_axis *axes,
+                          const HklBinocularsFramesRange *ranges, size_t n_ranges)
+{
+        size_t i;
+        herr_t status = 0;
+        hid_t groupe_frames_id;
+        size_t n_axes = darray_size(*axes);
+        hid_t strtype = H5Tcopy(H5T_C_S1);
+        const char **filenames = g_new(const char *, n_ranges + 1);
+        int64_t *frames = g_new(int64_t, 2 * n_ranges + 1);
+        const char **names = g_new(const char *, n_axes + 1);
+        double *arr = g_new(double, 6 * n_axes + 1);
+
+        status |= H5Tset_size(strtype, H5T_VARIABLE);
+
+        for(i=0; i<n_ranges; ++i){
+                filenames[i] = ranges[i].filename;
+                frames[2 * i] = ranges[i].first;
+                frames[2 * i + 1] = ranges[i].last;
+        }
+
+        for(i=0; i<n_axes; ++i){
+                const HklBinocularsAxis *axis = &darray_item(*axes, i);
+                double *v = hkl_binoculars_axis_array(axis);
+
+                names[i] = axis->name;
+                memcpy(&arr[6 * i], v, 6 * sizeof(*v));
+                free(v);
+        }
+
+        groupe_frames_id = H5Gcreate(group_id, "frames",
+                                     H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        {
+                hsize_t dims[] = {n_ranges, 2};
+
+                status |= save_array(groupe_frames_id, "filenames", strtype, 1, dims, filenames);
+                status |= save_array(groupe_frames_id, "ranges", H5T_NATIVE_INT64, 2, dims, frames);
+        }
+
+        {
+                hsize_t dims[] = {n_axes, 6};
+
+                status |= save_array(groupe_frames_id, "axes_names", strtype, 1, dims, names);
+                status |= save_array(groupe_frames_id, "axes", H5T_NATIVE_DOUBLE, 2, dims, arr);
+        }
+
+        status |= H5Gclose(groupe_frames_id);
+        status |= H5Tclose(strtype);
+
+        g_free(arr);
+        g_free(names);
+        g_free(frames);
+        g_free(filenames);
+
+        return status;
+}
+
+static herr_t save_axes(hid_t group_id, const darray_axis *axes)
+{
+        double axis_idx = 0;
+        hid_t groupe_axes_id;
+        herr_t status;
+        HklBinocularsAxis *axis;
+
+        groupe_axes_id = H5Gcreate(group_id, "axes",
                                    H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 
-        darray_foreach(axis, self->axes){
+        darray_foreach(axis, *axes){
                 double *arr;
                 hid_t dataspace_id;
                 hid_t dataset_id;
@@ -125,31 +279,2467 @@ void hkl_binoculars_cube_save_hdf5(const char *fn,
 
         status = H5Gclose(groupe_axes_id);
 
-        // create count dataset
-        dataspace_id = create_dataspace_from_axes(&self->axes);
-        dataset_id = H5Dcreate(groupe_id, "counts",
-                               H5T_NATIVE_UINT32, dataspace_id,
-                               H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-        status = H5Dwrite(dataset_id, H5T_NATIVE_UINT32,
-                          H5S_ALL, H5S_ALL,
-                          H5P_DEFAULT, self->photons);
-        status = H5Dclose(dataset_id);
-        status = H5Sclose(dataspace_id);
+        return status;
+}
+
+/* the chunks contain about 1MiB of uint32 */
+#define HKL_BINOCULARS_HDF5_CHUNK_SIZE (256 * 1024)
+
+/* the filters of the hdf5 plugins */
+#define HKL_BINOCULARS_HDF5_FILTER_LZ4_ID 32004
+#define HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_ID 32008
+
+/* compute chunk dimensions of about HKL_BINOCULARS_HDF5_CHUNK_SIZE
+ * elements, keeping the fastest dimensions complete. */
+static void chunk_dims_get(int rank, const hsize_t *dims, hsize_t *chunk)
+{
+        int i;
+        hsize_t n = 1;
+
+        for(i=0; i<rank; ++i){
+                chunk[i] = dims[i];
+                n *= dims[i];
+        }
+
+        for(i=0; i<rank && n > HKL_BINOCULARS_HDF5_CHUNK_SIZE; ++i){
+                hsize_t others = n / chunk[i];
+
+                chunk[i] = others < HKL_BINOCULARS_HDF5_CHUNK_SIZE ? HKL_BINOCULARS_HDF5_CHUNK_SIZE / others : 1;
+                n = others * chunk[i];
+        }
+}
+
+static hid_t create_dcpl(hid_t dataspace_id,
+                         HklBinocularsHdf5FilterEnum filter,
+                         unsigned int level)
+{
+        herr_t status = 0;
+        hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+        int rank = H5Sget_simple_extent_ndims(dataspace_id);
+
+        if(HKL_BINOCULARS_HDF5_FILTER_NONE == filter || rank <= 0)
+                return dcpl;
+
+        hsize_t dims[rank];
+        hsize_t chunk[rank];
+
+        H5Sget_simple_extent_dims(dataspace_id, dims, NULL);
+        for(int i=0; i<rank; ++i)
+                if(0 == dims[i])
+                        return dcpl; /* empty datasets can not be chunked */
+        chunk_dims_get(rank, dims, chunk);
+        status = H5Pset_chunk(dcpl, rank, chunk);
+
+        switch(filter){
+        case HKL_BINOCULARS_HDF5_FILTER_LZ4:
+                if(H5Zfilter_avail(HKL_BINOCULARS_HDF5_FILTER_LZ4_ID) > 0){
+                        status = H5Pset_filter(dcpl, HKL_BINOCULARS_HDF5_FILTER_LZ4_ID,
+                                               H5Z_FLAG_MANDATORY, 0, NULL);
+                        break;
+                }
+                fprintf(stderr, "the lz4 hdf5 plugin is not available, use deflate\n");
+                goto deflate;
+        case HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_LZ4:
+                if(H5Zfilter_avail(HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_ID) > 0){
+                        /* the first three values are set by the plugin,
+                           then block size (0 = auto) and lz4 (2) */
+                        const unsigned int cd_values[] = {0, 0, 0, 0, 2};
+
+                        status = H5Pset_filter(dcpl, HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_ID,
+                                               H5Z_FLAG_MANDATORY,
+                                               ARRAY_SIZE(cd_values), cd_values);
+                        break;
+                }
+                fprintf(stderr, "the bitshuffle hdf5 plugin is not available, use deflate\n");
+                goto deflate;
+        case HKL_BINOCULARS_HDF5_FILTER_DEFLATE:
+        case HKL_BINOCULARS_HDF5_FILTER_NONE:
+        case HKL_BINOCULARS_HDF5_FILTER_NUM_FILTERS:
+        deflate:
+                status = H5Pset_shuffle(dcpl);
+                status = H5Pset_deflate(dcpl, level);
+                break;
+        }
+
+        hkl_assert(status >= 0);
+
+        return dcpl;
+}
+
+typedef struct _HklBinocularsHdf5Dataset HklBinocularsHdf5Dataset;
+struct _HklBinocularsHdf5Dataset
+{
+        hid_t group_id;
+        const char *name;
+        hid_t dataspace_id;
+        hid_t dcpl;
+        hid_t type;
+        const void *data;
+        herr_t status;
+};
+
+static void write_dataset(HklBinocularsHdf5Dataset *self)
+{
+        hid_t dataset_id;
+
+        dataset_id = H5Dcreate(self->group_id, self->name,
+                               self->type, self->dataspace_id,
+                               H5P_DEFAULT, self->dcpl, H5P_DEFAULT);
+        self->status = H5Dwrite(dataset_id, self->type,
+                                H5S_ALL, H5S_ALL,
+                                H5P_DEFAULT, self->data);
+        self->status |= H5Dclose(dataset_id);
+}
+
+/* the number of 2x coarser levels saved with the cubes */
+static gint pyramid_levels = 0;
+
+void hkl_binoculars_hdf5_pyramid_set(int n_levels)
+{
+        g_atomic_int_set(&pyramid_levels, MAX(0, n_levels));
+}
+
+/* binoculars/pyramid/level_<l>: the axes, the counts and the
+ * contributions of the cube 2^l times coarser along each axis. The
+ * first level is given, each next one is the previous one 2x
+ * coarser. Stop when all the axes have only one bin. */
+static herr_t save_pyramid(hid_t group_id, const HklBinocularsCube *first,
+                           size_t n_levels,
+                           HklBinocularsHdf5FilterEnum filter, unsigned int level)
+{
+        size_t l;
+        size_t i;
+        herr_t status = 0;
+        hid_t groupe_pyramid_id;
+        const HklBinocularsCube *cube = first;
+        size_t factors[darray_size(first->axes) > 0 ? darray_size(first->axes) : 1];
+
+        for(i=0; i<darray_size(first->axes); ++i)
+                factors[i] = 2;
+
+        groupe_pyramid_id = H5Gcreate(group_id, "pyramid",
+                                      H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        for(l=1; l<=n_levels && 0 != darray_size(cube->axes); ++l){
+                int done = TRUE;
+                char name[32];
+                hid_t groupe_level_id;
+                hid_t dataspace_id;
+                hid_t dcpl;
+                HklBinocularsAxis *axis;
+
+                snprintf(name, ARRAY_SIZE(name), "level_%zu", l);
+                groupe_level_id = H5Gcreate(groupe_pyramid_id, name,
+                                            H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+                status |= save_axes(groupe_level_id, &cube->axes);
+
+                dataspace_id = create_dataspace_from_axes(&cube->axes);
+                dcpl = create_dcpl(dataspace_id, filter, level);
+
+                HklBinocularsHdf5Dataset datasets[] = {
+                        {groupe_level_id, "counts", dataspace_id, dcpl, H5T_NATIVE_UINT32, cube->photons, 0},
+                        {groupe_level_id, "contributions", dataspace_id, dcpl, H5T_NATIVE_UINT32, cube->contributions, 0},
+                };
+
+                write_dataset(&datasets[0]);
+                write_dataset(&datasets[1]);
+                status |= datasets[0].status | datasets[1].status;
+
+                status |= H5Pclose(dcpl);
+                status |= H5Sclose(dataspace_id);
+                status |= H5Gclose(groupe_level_id);
+
+                darray_foreach(axis, cube->axes){
+                        done &= 1 == axis_size(axis);
+                }
+                if(done)
+                        break;
+
+                if(l < n_levels){
+                        HklBinocularsCube *next = hkl_binoculars_cube_new_rebin(cube, factors);
+
+                        if(cube != first)
+                                hkl_binoculars_cube_free((HklBinocularsCube *)cube);
+                        cube = next;
+                }
+        }
+
+        if(cube != first)
+                hkl_binoculars_cube_free((HklBinocularsCube *)cube);
+
+        status |= H5Gclose(groupe_pyramid_id);
+
+        return status;
+}
+
+static int cube_save_hdf5(const char *fn,
+                          const char *config,
+                          const HklBinocularsCube *self,
+                          HklBinocularsHdf5FilterEnum filter,
+                          unsigned int level,
+                          int crop,
+                          const HklBinocularsFramesRange *ranges,
+                          size_t n_ranges)
+{
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t dataspace_id;
+        hid_t dcpl;
+        herr_t status;
+        size_t n_levels = g_atomic_int_get(&pyramid_levels);
+        HklBinocularsCube *compact = NULL;
 
-        // create contributions dataset
+        hkl_binoculars_cube_planar(self);
+
+        /* the arrays are saved with the axes dimensions */
+        if(crop)
+                self = compact = hkl_binoculars_cube_new_crop(self);
+        else if(!cube_is_compact(self))
+                self = compact = hkl_binoculars_cube_new_copy(self);
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if(file_id < 0){
+                if(NULL != compact)
+                        hkl_binoculars_cube_free(compact);
+                return FALSE;
+        }
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        // config
+        status = save_config(groupe_id, config);
+
+        // axes
+        status |= save_axes(groupe_id, &self->axes);
+
+        // counts and contributions datasets
         dataspace_id = create_dataspace_from_axes(&self->axes);
-        dataset_id = H5Dcreate(groupe_id, "contributions",
-                               H5T_NATIVE_UINT32, dataspace_id,
-                               H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-        status = H5Dwrite(dataset_id, H5T_NATIVE_UINT32,
-                          H5S_ALL, H5S_ALL,
-                          H5P_DEFAULT, self->contributions);
-        status = H5Dclose(dataset_id);
-        status = H5Sclose(dataspace_id);
+        dcpl = create_dcpl(dataspace_id, filter, level);
+
+        HklBinocularsHdf5Dataset datasets[] = {
+                {groupe_id, "counts", dataspace_id, dcpl, H5T_NATIVE_UINT32, self->photons, 0},
+                {groupe_id, "contributions", dataspace_id, dcpl, H5T_NATIVE_UINT32, self->contributions, 0},
+                {groupe_id, "intensities", dataspace_id, dcpl, H5T_NATIVE_DOUBLE, self->intensities, 0},
+                {groupe_id, "variances", dataspace_id, dcpl, H5T_NATIVE_DOUBLE, self->variances, 0},
+        };
+
+        write_dataset(&datasets[0]);
+        write_dataset(&datasets[1]);
+        status |= datasets[0].status | datasets[1].status;
+
+        /* the double accumulators of a weighted cube */
+        if(self->weighted){
+                write_dataset(&datasets[2]);
+                write_dataset(&datasets[3]);
+                status |= datasets[2].status | datasets[3].status;
+        }
+
+        status |= H5Pclose(dcpl);
+        status |= H5Sclose(dataspace_id);
+
+        // pyramid
+        if(n_levels > 0 && 0 != darray_size(self->axes)){
+                size_t i;
+                size_t factors[darray_size(self->axes)];
+                HklBinocularsCube *first;
+
+                for(i=0; i<darray_size(self->axes); ++i)
+                        factors[i] = 2;
+                first = hkl_binoculars_cube_new_rebin(self, factors);
+                status |= save_pyramid(groupe_id, first, n_levels, filter, level);
+                hkl_binoculars_cube_free(first);
+        }
+
+        // frames
+        if(NULL != ranges)
+                status |= save_frames(groupe_id, &self->axes, ranges, n_ranges);
 
         // terminate access and free identifiers
-        status = H5Gclose(groupe_id);
-        status = H5Fclose(file_id);
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
 
-        hkl_assert(status >= 0);
+        if(NULL != compact)
+                hkl_binoculars_cube_free(compact);
+
+        return status >= 0;
+}
+
+int hkl_binoculars_cube_save_hdf5_with_options(const char *fn,
+                                               const char *config,
+                                               const HklBinocularsCube *self,
+                                               HklBinocularsHdf5FilterEnum filter,
+                                               unsigned int level,
+                                               int crop,
+                                               const HklBinocularsFramesRange *ranges,
+                                               size_t n_ranges)
+{
+        return cube_save_hdf5(fn, config, self, filter, level, crop, ranges, n_ranges);
+}
+
+void hkl_binoculars_cube_save_hdf5(const char *fn,
+                                   const char *config,
+                                   const HklBinocularsCube *self)
+{
+        int res;
+
+        res = cube_save_hdf5(fn, config, self,
+                             HKL_BINOCULARS_HDF5_FILTER_NONE, 0, FALSE,
+                             NULL, 0);
+        hkl_assert(res);
+}
+
+void hkl_binoculars_cube_save_hdf5_with_frames(const char *fn,
+                                               const char *config,
+                                               const HklBinocularsCube *self,
+                                               const HklBinocularsFramesRange *ranges,
+                                               size_t n_ranges)
+{
+        int res;
+        static const HklBinocularsFramesRange no_ranges[1];
+
+        res = cube_save_hdf5(fn, config, self,
+                             HKL_BINOCULARS_HDF5_FILTER_NONE, 0, FALSE,
+                             NULL == ranges ? no_ranges : ranges, n_ranges);
+        hkl_assert(res);
+}
+
+/* Merge and save */
+
+typedef struct _HklBinocularsMergeSave HklBinocularsMergeSave;
+struct _HklBinocularsMergeSave
+{
+        HklBinocularsCube *self;
+        const HklBinocularsCube *const *cubes;
+        size_t n_cubes;
+        size_t n_rows; /* of the slowest axis */
+        size_t slab; /* the rows of a slab */
+        size_t n_slabs;
+        gint next; /* the next slab to merge */
+        GMutex mutex;
+        GCond cond;
+        gboolean *merged;
+};
+
+static gpointer merge_save_job(gpointer data)
+{
+        HklBinocularsMergeSave *self = data;
+
+        for(;;){
+                size_t k = g_atomic_int_add(&self->next, 1);
+                size_t start = k * self->slab;
+
+                if(k >= self->n_slabs)
+                        break;
+
+                hkl_binoculars_cube_merge_slab(self->self, self->cubes, self->n_cubes,
+                                               start, MIN(start + self->slab, self->n_rows));
+
+                g_mutex_lock(&self->mutex);
+                self->merged[k] = TRUE;
+                g_cond_broadcast(&self->cond);
+                g_mutex_unlock(&self->mutex);
+        }
+
+        return NULL;
+}
+
+typedef struct _HklBinocularsHdf5Slab HklBinocularsHdf5Slab;
+struct _HklBinocularsHdf5Slab
+{
+        hid_t dataset_id;
+        hid_t type;
+        hid_t memspace_id;
+        hid_t filespace_id;
+        const void *data;
+        herr_t status;
+};
+
+static void write_slab(HklBinocularsHdf5Slab *self)
+{
+        self->status = H5Dwrite(self->dataset_id, self->type,
+                                self->memspace_id, self->filespace_id,
+                                H5P_DEFAULT, self->data);
+}
+
+int hkl_binoculars_cubes_save_hdf5_with_frames(const char *fn,
+                                               const char *config,
+                                               size_t n_cubes,
+                                               const HklBinocularsCube *const *cubes,
+                                               size_t n_threads,
+                                               const HklBinocularsFramesRange *ranges,
+                                               size_t n_ranges)
+{
+        size_t i, k;
+        size_t n_datasets;
+        size_t row;
+        int rank;
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t dataspace_id;
+        hid_t dcpl;
+        herr_t status = 0;
+        size_t n_levels = g_atomic_int_get(&pyramid_levels);
+        HklBinocularsCube *pyramid = NULL;
+        HklBinocularsMergeSave merge;
+
+        merge.self = hkl_binoculars_cube_new_merge_axes(n_cubes, cubes);
+        if(0 == darray_size(merge.self->axes)){
+                int res = cube_save_hdf5(fn, config, merge.self,
+                                         HKL_BINOCULARS_HDF5_FILTER_NONE, 0, FALSE,
+                                         ranges, n_ranges);
+                hkl_binoculars_cube_free(merge.self);
+                return res;
+        }
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if(file_id < 0){
+                hkl_binoculars_cube_free(merge.self);
+                return FALSE;
+        }
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        status |= save_config(groupe_id, config);
+        status |= save_axes(groupe_id, &merge.self->axes);
+
+        dataspace_id = create_dataspace_from_axes(&merge.self->axes);
+        dcpl = create_dcpl(dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+        rank = H5Sget_simple_extent_ndims(dataspace_id);
+
+        hsize_t dims[rank > 0 ? rank : 1];
+        hsize_t chunk[rank > 0 ? rank : 1];
+
+        H5Sget_simple_extent_dims(dataspace_id, dims, NULL);
+
+        /* the slabs are made of complete chunks of the slowest axis,
+           so each chunk is compressed and written only once. The
+           squeezed axes of size 1 are not in the dataspace. */
+        merge.cubes = cubes;
+        merge.n_cubes = n_cubes;
+        merge.n_rows = axis_size(&darray_item(merge.self->axes, 0));
+        if(merge.n_rows > 1 && rank > 0){
+                if(H5D_CHUNKED == H5Pget_layout(dcpl)
+                   && H5Pget_chunk(dcpl, rank, chunk) == rank)
+                        merge.slab = chunk[0];
+                else
+                        merge.slab = MAX(1, merge.n_rows / 64);
+        }else
+                merge.slab = merge.n_rows;
+        merge.n_slabs = (merge.n_rows + merge.slab - 1) / merge.slab;
+        merge.next = 0;
+        merge.merged = g_new0(gboolean, merge.n_slabs);
+        g_mutex_init(&merge.mutex);
+        g_cond_init(&merge.cond);
+
+        /* merge the next slabs while the previous ones are written */
+        if(0 == n_threads)
+                n_threads = g_get_num_processors();
+        n_threads = MIN(n_threads, merge.n_slabs);
+
+        GThread *threads[n_threads > 0 ? n_threads : 1];
+
+        for(i=0; i<n_threads; ++i)
+                threads[i] = g_thread_new("cube-merge-save", merge_save_job, &merge);
+
+        HklBinocularsHdf5Slab slabs[] = {
+                {0, H5T_NATIVE_UINT32, 0, 0, merge.self->photons, 0},
+                {0, H5T_NATIVE_UINT32, 0, 0, merge.self->contributions, 0},
+                {0, H5T_NATIVE_DOUBLE, 0, 0, merge.self->intensities, 0},
+                {0, H5T_NATIVE_DOUBLE, 0, 0, merge.self->variances, 0},
+        };
+        const char *names[] = {"counts", "contributions", "intensities", "variances"};
+
+        /* the double accumulators of a weighted cube */
+        n_datasets = merge.self->weighted ? ARRAY_SIZE(slabs) : 2;
+        for(i=0; i<n_datasets; ++i)
+                slabs[i].dataset_id = H5Dcreate(groupe_id, names[i],
+                                                slabs[i].type, dataspace_id,
+                                                H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+        /* the bins of one row of the slowest axis */
+        row = 1;
+        for(i=1; i<darray_size(merge.self->axes); ++i)
+                row *= axis_size(&darray_item(merge.self->axes, i));
+
+        /* the first level of the pyramid is summed from each written
+           slab, while the next slabs are merged */
+        size_t factors[darray_size(merge.self->axes)];
+
+        for(i=0; i<darray_size(merge.self->axes); ++i)
+                factors[i] = 2;
+        if(n_levels > 0)
+                pyramid = hkl_binoculars_cube_new_rebin_axes(merge.self, factors);
+
+        for(k=0; k<merge.n_slabs; ++k){
+                size_t start = k * merge.slab;
+                size_t end = MIN(start + merge.slab, merge.n_rows);
+                hid_t memspace_id;
+
+                g_mutex_lock(&merge.mutex);
+                while(!merge.merged[k])
+                        g_cond_wait(&merge.cond, &merge.mutex);
+                g_mutex_unlock(&merge.mutex);
+
+                if(merge.n_rows > 1 && rank > 0){
+                        hsize_t offset[rank];
+                        hsize_t count[rank];
+
+                        for(i=0; i<(size_t)rank; ++i){
+                                offset[i] = 0;
+                                count[i] = dims[i];
+                        }
+                        offset[0] = start;
+                        count[0] = end - start;
+                        status |= H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET,
+                                                      offset, NULL, count, NULL);
+                        memspace_id = H5Screate_simple(rank, count, NULL);
+                }else{
+                        status |= H5Sselect_all(dataspace_id);
+                        memspace_id = H5Scopy(dataspace_id);
+                }
+
+                for(i=0; i<n_datasets; ++i){
+                        slabs[i].memspace_id = memspace_id;
+                        slabs[i].filespace_id = dataspace_id;
+                }
+                slabs[0].data = merge.self->photons + start * row;
+                slabs[1].data = merge.self->contributions + start * row;
+                if(merge.self->weighted){
+                        slabs[2].data = merge.self->intensities + start * row;
+                        slabs[3].data = merge.self->variances + start * row;
+                }
+
+                /* libhdf5 serialises its calls, the datasets are
+                   written one after the other */
+                for(i=0; i<n_datasets; ++i){
+                        write_slab(&slabs[i]);
+                        status |= slabs[i].status;
+                }
+
+                status |= H5Sclose(memspace_id);
+
+                if(NULL != pyramid)
+                        hkl_binoculars_cube_rebin_slab(pyramid, merge.self, factors, start, end);
+        }
+
+        for(i=0; i<n_threads; ++i)
+                g_thread_join(threads[i]);
+        g_cond_clear(&merge.cond);
+        g_mutex_clear(&merge.mutex);
+        g_free(merge.merged);
+
+        for(i=0; i<n_datasets; ++i)
+                status |= H5Dclose(slabs[i].dataset_id);
+        status |= H5Pclose(dcpl);
+        status |= H5Sclose(dataspace_id);
+
+        // pyramid
+        if(NULL != pyramid){
+                status |= save_pyramid(groupe_id, pyramid, n_levels,
+                                       HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+                hkl_binoculars_cube_free(pyramid);
+        }
+
+        // frames
+        if(NULL != ranges)
+                status |= save_frames(groupe_id, &merge.self->axes, ranges, n_ranges);
+
+        // terminate access and free identifiers
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
+
+        hkl_binoculars_cube_free(merge.self);
+
+        return status >= 0;
+}
+
+/* Normalised difference */
+
+typedef struct _HklBinocularsDifferenceSave HklBinocularsDifferenceSave;
+struct _HklBinocularsDifferenceSave
+{
+        const darray_axis *axes;
+        const HklBinocularsCube *sample;
+        const HklBinocularsCube *background;
+        double scale;
+        size_t n_rows; /* of the slowest axis */
+        size_t row; /* the bins of one row */
+        size_t slab; /* the rows of a slab */
+        size_t n_slabs;
+        int rank;
+        const hsize_t *dims;
+        gint next; /* the next slab to compute */
+        GMutex mutex; /* the hdf5 writes and the selection of the dataspace */
+        hid_t dataspace_id;
+        hid_t values_id;
+        hid_t variances_id;
+        herr_t status;
+};
+
+static gpointer difference_save_job(gpointer data)
+{
+        HklBinocularsDifferenceSave *self = data;
+        double *values = g_new(double, self->slab * self->row);
+        double *variances = g_new(double, self->slab * self->row);
+
+        for(;;){
+                size_t i;
+                size_t k = g_atomic_int_add(&self->next, 1);
+                size_t start = k * self->slab;
+                size_t end;
+                herr_t status = 0;
+                hid_t memspace_id;
+
+                if(k >= self->n_slabs)
+                        break;
+                end = MIN(start + self->slab, self->n_rows);
+
+                hkl_binoculars_cube_normalised_difference_slab(self->axes,
+                                                               self->sample, self->background,
+                                                               self->scale,
+                                                               start, end,
+                                                               values, variances);
+
+                g_mutex_lock(&self->mutex);
+                if(self->n_rows > 1 && self->rank > 0){
+                        hsize_t offset[self->rank];
+                        hsize_t count[self->rank];
+
+                        for(i=0; i<(size_t)self->rank; ++i){
+                                offset[i] = 0;
+                                count[i] = self->dims[i];
+                        }
+                        offset[0] = start;
+                        count[0] = end - start;
+                        status |= H5Sselect_hyperslab(self->dataspace_id, H5S_SELECT_SET,
+                                                      offset, NULL, count, NULL);
+                        memspace_id = H5Screate_simple(self->rank, count, NULL);
+                }else{
+                        status |= H5Sselect_all(self->dataspace_id);
+                        memspace_id = H5Scopy(self->dataspace_id);
+                }
+                status |= H5Dwrite(self->values_id, H5T_NATIVE_DOUBLE,
+                                   memspace_id, self->dataspace_id, H5P_DEFAULT, values);
+                status |= H5Dwrite(self->variances_id, H5T_NATIVE_DOUBLE,
+                                   memspace_id, self->dataspace_id, H5P_DEFAULT, variances);
+                status |= H5Sclose(memspace_id);
+                self->status |= status;
+                g_mutex_unlock(&self->mutex);
+        }
+
+        g_free(variances);
+        g_free(values);
+
+        return NULL;
+}
+
+void hkl_binoculars_cube_normalised_difference_save_hdf5(const char *fn,
+                                                         const char *config,
+                                                         const HklBinocularsCube *sample,
+                                                         const HklBinocularsCube *background,
+                                                         double scale,
+                                                         size_t n_threads)
+{
+        size_t i;
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t dcpl;
+        herr_t status = 0;
+        darray_axis axes = darray_new();
+        const HklBinocularsCube *cubes[] = {sample, background};
+        HklBinocularsDifferenceSave diff;
+
+        hkl_binoculars_cubes_merge_axes(ARRAY_SIZE(cubes), cubes, &axes);
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        status |= save_config(groupe_id, config);
+        status |= save_axes(groupe_id, &axes);
+
+        diff.dataspace_id = create_dataspace_from_axes(&axes);
+        dcpl = create_dcpl(diff.dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+        diff.values_id = H5Dcreate(groupe_id, "difference", H5T_NATIVE_DOUBLE,
+                                   diff.dataspace_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+        diff.variances_id = H5Dcreate(groupe_id, "variances", H5T_NATIVE_DOUBLE,
+                                      diff.dataspace_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+        if(0 != darray_size(axes)){
+                diff.rank = H5Sget_simple_extent_ndims(diff.dataspace_id);
+
+                hsize_t dims[diff.rank > 0 ? diff.rank : 1];
+                hsize_t chunk[diff.rank > 0 ? diff.rank : 1];
+
+                H5Sget_simple_extent_dims(diff.dataspace_id, dims, NULL);
+
+                diff.axes = &axes;
+                diff.sample = sample;
+                diff.background = background;
+                diff.scale = scale;
+                diff.dims = dims;
+                diff.n_rows = axis_size(&darray_item(axes, 0));
+                diff.row = 1;
+                for(i=1; i<darray_size(axes); ++i)
+                        diff.row *= axis_size(&darray_item(axes, i));
+
+                /* like the merge, the slabs are made of complete
+                   chunks so each chunk is compressed and written only
+                   once. */
+                if(diff.n_rows > 1 && diff.rank > 0){
+                        if(H5D_CHUNKED == H5Pget_layout(dcpl)
+                           && H5Pget_chunk(dcpl, diff.rank, chunk) == diff.rank)
+                                diff.slab = chunk[0];
+                        else
+                                diff.slab = MAX(1, diff.n_rows / 64);
+                }else
+                        diff.slab = diff.n_rows;
+                diff.n_slabs = (diff.n_rows + diff.slab - 1) / diff.slab;
+                diff.next = 0;
+                diff.status = 0;
+                g_mutex_init(&diff.mutex);
+
+                /* each thread computes its slabs in its own buffers */
+                if(0 == n_threads)
+                        n_threads = g_get_num_processors();
+                n_threads = MAX(1, MIN(n_threads, diff.n_slabs));
+
+                GThread *threads[n_threads];
+
+                for(i=0; i<n_threads; ++i)
+                        threads[i] = g_thread_new("cube-difference", difference_save_job, &diff);
+                for(i=0; i<n_threads; ++i)
+                        g_thread_join(threads[i]);
+
+                g_mutex_clear(&diff.mutex);
+                status |= diff.status;
+        }
+
+        status |= H5Dclose(diff.variances_id);
+        status |= H5Dclose(diff.values_id);
+        status |= H5Pclose(dcpl);
+        status |= H5Sclose(diff.dataspace_id);
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
+
+        darray_free(axes);
+
+        hkl_assert(status >= 0);
+}
+
+void hkl_binoculars_frames_ranges_free(HklBinocularsFramesRange *ranges,
+                                       size_t n_ranges)
+{
+        size_t i;
+
+        for(i=0; i<n_ranges; ++i)
+                g_free(ranges[i].filename);
+        g_free(ranges);
+}
+
+int hkl_binoculars_cube_inputs_hash_save_hdf5(const char *fn, const char *inputs)
+{
+        herr_t status = -1;
+        hid_t file_id;
+        hid_t groupe_id;
+        char *hash = config_hash(inputs);
+
+        H5E_BEGIN_TRY {
+                file_id = H5Fopen(fn, H5F_ACC_RDWR, H5P_DEFAULT);
+        } H5E_END_TRY;
+        if(file_id < 0)
+                goto out;
+
+        if(H5Lexists(file_id, "binoculars", H5P_DEFAULT) > 0){
+                groupe_id = H5Gopen(file_id, "binoculars", H5P_DEFAULT);
+                status = 0;
+                if(H5Lexists(groupe_id, "inputs_hash", H5P_DEFAULT) > 0)
+                        status = H5Ldelete(groupe_id, "inputs_hash", H5P_DEFAULT);
+                if(status >= 0)
+                        status = save_string(groupe_id, "inputs_hash", hash);
+                H5Gclose(groupe_id);
+        }
+
+        H5Fclose(file_id);
+out:
+        g_free(hash);
+
+        return status >= 0;
+}
+
+int hkl_binoculars_cube_inputs_hash_check_hdf5(const char *fn, const char *inputs)
+{
+        int res = FALSE;
+        hid_t file_id;
+        hid_t groupe_id;
+        char *hash;
+        char *expected;
+
+        if(!g_file_test(fn, G_FILE_TEST_IS_REGULAR))
+                return FALSE;
+
+        H5E_BEGIN_TRY {
+                file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+        } H5E_END_TRY;
+        if(file_id < 0)
+                return FALSE;
+
+        if(H5Lexists(file_id, "binoculars", H5P_DEFAULT) > 0){
+                groupe_id = H5Gopen(file_id, "binoculars", H5P_DEFAULT);
+                hash = load_string(groupe_id, "inputs_hash");
+                expected = config_hash(inputs);
+                res = NULL != hash && 0 == strcmp(hash, expected);
+                g_free(expected);
+                g_free(hash);
+                H5Gclose(groupe_id);
+        }
+
+        H5Fclose(file_id);
+
+        return res;
+}
+
+/* read the counts, contributions, intensities or variances of a
+ * compact cube */
+static int load_cube_dataset(hid_t group_id, const char *name,
+                             const HklBinocularsCube *cube, hid_t type, void *data)
+{
+        int res = FALSE;
+        hsize_t n = 1;
+        hid_t dataset_id;
+        hid_t dataspace_id;
+        HklBinocularsAxis *axis;
+
+        if(H5Lexists(group_id, name, H5P_DEFAULT) <= 0)
+                return FALSE;
+
+        darray_foreach(axis, cube->axes){
+                n *= axis_size(axis);
+        }
+
+        dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        dataspace_id = H5Dget_space(dataset_id);
+        if((hsize_t)H5Sget_simple_extent_npoints(dataspace_id) == n)
+                res = H5Dread(dataset_id, type,
+                              H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0;
+        H5Sclose(dataspace_id);
+        H5Dclose(dataset_id);
+
+        return res;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_from_hdf5(const char *fn,
+                                                    const char *config,
+                                                    HklBinocularsFramesRange **ranges,
+                                                    size_t *n_ranges)
+{
+        hssize_t i;
+        hid_t file_id;
+        hid_t groupe_id = -1;
+        hid_t groupe_frames_id = -1;
+        hid_t strtype = -1;
+        char *hash = NULL;
+        char *expected = config_hash(config);
+        char **filenames = NULL;
+        char **names = NULL;
+        int64_t *frames = NULL;
+        double *arr = NULL;
+        hssize_t n_files = 0;
+        hssize_t n_axes = 0;
+        darray_axis axes = darray_new();
+        HklBinocularsCube *self = NULL;
+
+        *ranges = NULL;
+        *n_ranges = 0;
+
+        H5E_BEGIN_TRY {
+                file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+        } H5E_END_TRY;
+        if(file_id < 0)
+                goto out;
+
+        if(H5Lexists(file_id, "binoculars", H5P_DEFAULT) <= 0)
+                goto out;
+        groupe_id = H5Gopen(file_id, "binoculars", H5P_DEFAULT);
+
+        hash = load_string(groupe_id, "config_hash");
+        if(NULL == hash || 0 != strcmp(hash, expected))
+                goto out;
+
+        if(H5Lexists(groupe_id, "frames", H5P_DEFAULT) <= 0)
+                goto out;
+        groupe_frames_id = H5Gopen(groupe_id, "frames", H5P_DEFAULT);
+
+        strtype = H5Tcopy(H5T_C_S1);
+        H5Tset_size(strtype, H5T_VARIABLE);
+
+        // axes
+        n_axes = load_array(groupe_frames_id, "axes", H5T_NATIVE_DOUBLE, 6, (void **)&arr);
+        if(n_axes < 0 || n_axes != load_array(groupe_frames_id, "axes_names", strtype, 1, (void **)&names))
+                goto out;
+
+        for(i=0; i<n_axes; ++i){
+                HklBinocularsAxis axis;
+
+                /* the cube axes names are never released */
+                axis.name = g_intern_string(names[i]);
+                axis.index = arr[6 * i];
+                axis.resolution = arr[6 * i + 3];
+                axis.imin = arr[6 * i + 4];
+                axis.imax = arr[6 * i + 5];
+                darray_append(axes, axis);
+        }
+
+        self = hkl_binoculars_cube_new_from_axes(&axes);
+        if(0 != n_axes
+           && (FALSE == load_cube_dataset(groupe_id, "counts", self, H5T_NATIVE_UINT32, self->photons)
+               || FALSE == load_cube_dataset(groupe_id, "contributions", self, H5T_NATIVE_UINT32, self->contributions)
+               || (self->weighted
+                   && (FALSE == load_cube_dataset(groupe_id, "intensities", self, H5T_NATIVE_DOUBLE, self->intensities)
+                       || FALSE == load_cube_dataset(groupe_id, "variances", self, H5T_NATIVE_DOUBLE, self->variances))))){
+                hkl_binoculars_cube_free(self);
+                self = NULL;
+                goto out;
+        }
+
+        // frames
+        n_files = load_array(groupe_frames_id, "ranges", H5T_NATIVE_INT64, 2, (void **)&frames);
+        if(n_files < 0 || n_files != load_array(groupe_frames_id, "filenames", strtype, 1, (void **)&filenames)){
+                hkl_binoculars_cube_free(self);
+                self = NULL;
+                goto out;
+        }
+
+        *n_ranges = n_files;
+        *ranges = g_new0(HklBinocularsFramesRange, n_files + 1);
+        for(i=0; i<n_files; ++i){
+                (*ranges)[i].filename = g_strdup(filenames[i]);
+                (*ranges)[i].first = frames[2 * i];
+                (*ranges)[i].last = frames[2 * i + 1];
+        }
+
+out:
+        if(NULL != filenames){
+                for(i=0; i<n_files; ++i)
+                        H5free_memory(filenames[i]);
+                free(filenames);
+        }
+        if(NULL != names){
+                for(i=0; i<n_axes; ++i)
+                        H5free_memory(names[i]);
+                free(names);
+        }
+        free(frames);
+        free(arr);
+        darray_free(axes);
+        if(strtype >= 0)
+                H5Tclose(strtype);
+        if(groupe_frames_id >= 0)
+                H5Gclose(groupe_frames_id);
+        if(groupe_id >= 0)
+                H5Gclose(groupe_id);
+        if(file_id >= 0)
+                H5Fclose(file_id);
+        g_free(hash);
+        g_free(expected);
+
+        return self;
+}
+
+/* the axes of the saved datasets from the axes group, ordered by
+ * their arr[0] index like the dimensions of the datasets. */
+static int load_axes(hid_t group_id, darray_axis *axes)
+{
+        int res = FALSE;
+        hsize_t k;
+        hid_t groupe_axes_id;
+        H5G_info_t info;
+
+        if(H5Lexists(group_id, "axes", H5P_DEFAULT) <= 0)
+                return FALSE;
+        groupe_axes_id = H5Gopen(group_id, "axes", H5P_DEFAULT);
+        if(H5Gget_info(groupe_axes_id, &info) < 0)
+                goto out;
+
+        darray_resize0(*axes, info.nlinks);
+        for(k=0; k<info.nlinks; ++k){
+                char *name;
+                double *arr = NULL;
+                ssize_t size;
+                size_t idx;
+
+                size = H5Lget_name_by_idx(groupe_axes_id, ".", H5_INDEX_NAME, H5_ITER_INC,
+                                          k, NULL, 0, H5P_DEFAULT);
+                if(size < 0)
+                        goto out;
+                name = g_malloc0(size + 1);
+                H5Lget_name_by_idx(groupe_axes_id, ".", H5_INDEX_NAME, H5_ITER_INC,
+                                   k, name, size + 1, H5P_DEFAULT);
+
+                if(6 != load_array(groupe_axes_id, name, H5T_NATIVE_DOUBLE, 1, (void **)&arr)
+                   || arr[0] < 0 || (idx = arr[0]) >= info.nlinks
+                   || NULL != darray_item(*axes, idx).name){
+                        free(arr);
+                        g_free(name);
+                        goto out;
+                }
+
+                /* the cube axes names are never released */
+                darray_item(*axes, idx).name = g_intern_string(name);
+                darray_item(*axes, idx).index = idx;
+                darray_item(*axes, idx).resolution = arr[3];
+                darray_item(*axes, idx).imin = arr[4];
+                darray_item(*axes, idx).imax = arr[5];
+
+                free(arr);
+                g_free(name);
+        }
+        res = TRUE;
+
+out:
+        H5Gclose(groupe_axes_id);
+
+        return res;
+}
+
+/* open the binoculars group of a saved cube with its axes, return the
+ * file id or -1. */
+static hid_t open_saved_cube(const char *fn, hid_t *groupe_id,
+                             darray_axis *axes, int *weighted)
+{
+        hid_t file_id;
+
+        H5E_BEGIN_TRY {
+                file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+        } H5E_END_TRY;
+        if(file_id < 0)
+                return -1;
+
+        if(H5Lexists(file_id, "binoculars", H5P_DEFAULT) <= 0){
+                H5Fclose(file_id);
+                return -1;
+        }
+        *groupe_id = H5Gopen(file_id, "binoculars", H5P_DEFAULT);
+
+        if(FALSE == load_axes(*groupe_id, axes)){
+                H5Gclose(*groupe_id);
+                H5Fclose(file_id);
+                return -1;
+        }
+        *weighted = H5Lexists(*groupe_id, "intensities", H5P_DEFAULT) > 0;
+
+        return file_id;
+}
+
+/* read the hyperslab of the compact cube bins from a dataset with the
+ * saved axes */
+static int load_cube_dataset_slab(hid_t group_id, const char *name,
+                                  const darray_axis *saved,
+                                  const HklBinocularsCube *cube,
+                                  hid_t type, void *data)
+{
+        size_t i;
+        int res = FALSE;
+        int rank = darray_size(*saved);
+        hsize_t dims[rank];
+        hsize_t start[rank];
+        hsize_t count[rank];
+        hid_t dataset_id;
+        hid_t dataspace_id;
+        hid_t memspace_id;
+
+        if(H5Lexists(group_id, name, H5P_DEFAULT) <= 0)
+                return FALSE;
+
+        for(i=0; i<darray_size(*saved); ++i){
+                start[i] = darray_item(cube->axes, i).imin - darray_item(*saved, i).imin;
+                count[i] = axis_size(&darray_item(cube->axes, i));
+        }
+
+        dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        dataspace_id = H5Dget_space(dataset_id);
+        if(rank == H5Sget_simple_extent_ndims(dataspace_id)
+           && H5Sget_simple_extent_dims(dataspace_id, dims, NULL) >= 0){
+                res = TRUE;
+                for(i=0; i<darray_size(*saved); ++i)
+                        res &= dims[i] == axis_size(&darray_item(*saved, i));
+        }
+        if(res){
+                memspace_id = H5Screate_simple(rank, count, NULL);
+                res = H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET,
+                                          start, NULL, count, NULL) >= 0
+                        && H5Dread(dataset_id, type, memspace_id, dataspace_id,
+                                   H5P_DEFAULT, data) >= 0;
+                H5Sclose(memspace_id);
+        }
+        H5Sclose(dataspace_id);
+        H5Dclose(dataset_id);
+
+        return res;
+}
+
+static HklBinocularsCube *load_cube_slice(hid_t groupe_id,
+                                          const darray_axis *saved,
+                                          const darray_axis *axes,
+                                          int weighted)
+{
+        HklBinocularsCube *self = hkl_binoculars_cube_new_from_axes_weighted(axes, weighted);
+
+        if(FALSE == load_cube_dataset_slab(groupe_id, "counts", saved, self, H5T_NATIVE_UINT32, self->photons)
+           || FALSE == load_cube_dataset_slab(groupe_id, "contributions", saved, self, H5T_NATIVE_UINT32, self->contributions)
+           || (weighted
+               && (FALSE == load_cube_dataset_slab(groupe_id, "intensities", saved, self, H5T_NATIVE_DOUBLE, self->intensities)
+                   || FALSE == load_cube_dataset_slab(groupe_id, "variances", saved, self, H5T_NATIVE_DOUBLE, self->variances)))){
+                hkl_binoculars_cube_free(self);
+                self = NULL;
+        }
+
+        return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_slice_from_hdf5(const char *fn,
+                                                          size_t n_axes,
+                                                          const ptrdiff_t *imin,
+                                                          const ptrdiff_t *imax)
+{
+        int weighted;
+        hid_t file_id;
+        hid_t groupe_id;
+        HklBinocularsAxis *axis;
+        darray_axis saved = darray_new();
+        darray_axis axes = darray_new();
+        HklBinocularsCube *self = NULL;
+
+        file_id = open_saved_cube(fn, &groupe_id, &saved, &weighted);
+        if(file_id < 0)
+                goto out;
+
+        if(0 != n_axes && n_axes == darray_size(saved)){
+                darray_foreach(axis, saved){
+                        darray_append(axes, *axis);
+                }
+                if(axes_slice(&axes, imin, imax)){
+                        self = load_cube_slice(groupe_id, &saved, &axes, weighted);
+                }else{
+                        self = hkl_binoculars_cube_new_empty();
+                        self->weighted = weighted;
+                }
+        }
+
+        H5Gclose(groupe_id);
+        H5Fclose(file_id);
+out:
+        darray_free(axes);
+        darray_free(saved);
+
+        return self;
+}
+
+int hkl_binoculars_cube_roi_sums_from_hdf5(const char *fn,
+                                           size_t n_axes,
+                                           const ptrdiff_t *imin,
+                                           const ptrdiff_t *imax,
+                                           HklBinocularsCubeSums *sums)
+{
+        HklBinocularsCube *slice;
+
+        memset(sums, 0, sizeof(*sums));
+
+        slice = hkl_binoculars_cube_new_slice_from_hdf5(fn, n_axes, imin, imax);
+        if(NULL == slice)
+                return FALSE;
+
+        hkl_binoculars_cube_roi_sums(slice, imin, imax, sums);
+        hkl_binoculars_cube_free(slice);
+
+        return TRUE;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_rebin_from_hdf5(const char *fn,
+                                                          size_t n_axes,
+                                                          const size_t *factors)
+{
+        size_t i;
+        int weighted;
+        hid_t file_id;
+        hid_t groupe_id;
+        HklBinocularsAxis *axis;
+        darray_axis saved = darray_new();
+        darray_axis axes = darray_new();
+        darray_axis coarse = darray_new();
+        HklBinocularsCube *self = NULL;
+
+        file_id = open_saved_cube(fn, &groupe_id, &saved, &weighted);
+        if(file_id < 0)
+                goto out;
+
+        if(0 != n_axes && n_axes == darray_size(saved)){
+                size_t n = 1;
+                ptrdiff_t f = factors[0] > 1 ? factors[0] : 1;
+                ptrdiff_t j;
+                const HklBinocularsAxis *slowest = &darray_item(saved, 0);
+
+                i = 0;
+                darray_foreach(axis, saved){
+                        darray_append(axes, *axis);
+                        darray_append(coarse, axis_rebin(axis, factors[i]));
+                        if(i > 0)
+                                n *= axis_size(&darray_item(coarse, i));
+                        i++;
+                }
+                self = hkl_binoculars_cube_new_from_axes_weighted(&coarse, weighted);
+
+                /* each coarse slab of the slowest axis is the rebin
+                 * of the f fine slabs which it contains */
+                for(j=darray_item(coarse, 0).imin; j<=darray_item(coarse, 0).imax; ++j){
+                        size_t offset = (j - darray_item(coarse, 0).imin) * n;
+                        HklBinocularsCube *slab;
+                        HklBinocularsCube *rebin;
+
+                        darray_item(axes, 0).imin = MAX(slowest->imin, j * f - f / 2);
+                        darray_item(axes, 0).imax = MIN(slowest->imax, j * f - f / 2 + f - 1);
+
+                        slab = load_cube_slice(groupe_id, &saved, &axes, weighted);
+                        if(NULL == slab){
+                                hkl_binoculars_cube_free(self);
+                                self = NULL;
+                                break;
+                        }
+                        rebin = hkl_binoculars_cube_new_rebin(slab, factors);
+
+                        memcpy(&self->photons[offset], rebin->photons, n * sizeof(*self->photons));
+                        memcpy(&self->contributions[offset], rebin->contributions, n * sizeof(*self->contributions));
+                        if(weighted){
+                                memcpy(&self->intensities[offset], rebin->intensities, n * sizeof(*self->intensities));
+                                memcpy(&self->variances[offset], rebin->variances, n * sizeof(*self->variances));
+                        }
+
+                        hkl_binoculars_cube_free(rebin);
+                        hkl_binoculars_cube_free(slab);
+                }
+        }
+
+        H5Gclose(groupe_id);
+        H5Fclose(file_id);
+out:
+        darray_free(coarse);
+        darray_free(axes);
+        darray_free(saved);
+
+        return self;
+}
+
+/* Out-of-core merge */
+
+typedef struct _HklBinocularsMergeFile HklBinocularsMergeFile;
+struct _HklBinocularsMergeFile
+{
+        const char *fn;
+        darray_axis axes; /* the saved ones, none for an empty cube */
+        int weighted;
+};
+
+typedef struct _HklBinocularsMergeFiles HklBinocularsMergeFiles;
+struct _HklBinocularsMergeFiles
+{
+        const HklBinocularsMergeFile *files;
+        size_t n_files;
+        const darray_axis *axes;
+        int weighted;
+        size_t n_rows; /* of the slowest axis */
+        size_t slab; /* the rows of a slab */
+        size_t n_slabs;
+        int rank;
+        const hsize_t *dims;
+        gint next; /* the next slab to merge */
+        GMutex mutex; /* the hdf5 calls and the selection of the dataspace */
+        hid_t dataspace_id;
+        hid_t datasets[4];
+        size_t n_datasets;
+        int res;
+        herr_t status;
+};
+
+/* read the rows of the slab from a saved cube, NULL if they do not
+ * overlap or on error (then *res is FALSE) */
+static HklBinocularsCube *merge_file_slice(HklBinocularsMergeFiles *self,
+                                           const HklBinocularsMergeFile *file,
+                                           const darray_axis *slab,
+                                           int *res)
+{
+        hid_t file_id;
+        hid_t groupe_id;
+        HklBinocularsAxis *axis;
+        HklBinocularsAxis *row;
+        darray_axis axes = darray_new();
+        HklBinocularsCube *slice = NULL;
+
+        if(0 == darray_size(file->axes))
+                return NULL;
+
+        darray_foreach(axis, file->axes){
+                darray_append(axes, *axis);
+        }
+        row = &darray_item(axes, 0);
+        row->imin = MAX(row->imin, darray_item(*slab, 0).imin);
+        row->imax = MIN(row->imax, darray_item(*slab, 0).imax);
+
+        if(row->imin <= row->imax){
+                g_mutex_lock(&self->mutex);
+                H5E_BEGIN_TRY {
+                        file_id = H5Fopen(file->fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+                } H5E_END_TRY;
+                if(file_id >= 0){
+                        groupe_id = H5Gopen(file_id, "binoculars", H5P_DEFAULT);
+                        slice = load_cube_slice(groupe_id, &file->axes, &axes, file->weighted);
+                        H5Gclose(groupe_id);
+                        H5Fclose(file_id);
+                }
+                g_mutex_unlock(&self->mutex);
+
+                if(NULL == slice)
+                        *res = FALSE;
+        }
+
+        darray_free(axes);
+
+        return slice;
+}
+
+static gpointer merge_files_job(gpointer data)
+{
+        HklBinocularsMergeFiles *self = data;
+        darray_axis slab = darray_new();
+        HklBinocularsAxis *axis;
+
+        darray_foreach(axis, *self->axes){
+                darray_append(slab, *axis);
+        }
+
+        for(;;){
+                size_t i;
+                size_t k = g_atomic_int_add(&self->next, 1);
+                size_t start = k * self->slab;
+                size_t end;
+                int res = TRUE;
+                herr_t status = 0;
+                hid_t memspace_id;
+                HklBinocularsCube *cube;
+
+                if(k >= self->n_slabs)
+                        break;
+                end = MIN(start + self->slab, self->n_rows);
+
+                darray_item(slab, 0).imin = darray_item(*self->axes, 0).imin + start;
+                darray_item(slab, 0).imax = darray_item(*self->axes, 0).imin + end - 1;
+                cube = hkl_binoculars_cube_new_from_axes_weighted(&slab, self->weighted);
+
+                /* only one slice of a file is kept at a time */
+                for(i=0; i<self->n_files && res; ++i){
+                        HklBinocularsCube *slice = merge_file_slice(self, &self->files[i],
+                                                                    &slab, &res);
+
+                        if(NULL != slice){
+                                hkl_binoculars_cube_merge_slab(cube,
+                                                               (const HklBinocularsCube *const *)&slice, 1,
+                                                               0, end - start);
+                                hkl_binoculars_cube_free(slice);
+                        }
+                }
+
+                g_mutex_lock(&self->mutex);
+                if(res){
+                        const void *arrays[] = {cube->photons, cube->contributions,
+                                                cube->intensities, cube->variances};
+                        const hid_t types[] = {H5T_NATIVE_UINT32, H5T_NATIVE_UINT32,
+                                               H5T_NATIVE_DOUBLE, H5T_NATIVE_DOUBLE};
+
+                        if(self->n_rows > 1 && self->rank > 0){
+                                hsize_t offset[self->rank];
+                                hsize_t count[self->rank];
+
+                                for(i=0; i<(size_t)self->rank; ++i){
+                                        offset[i] = 0;
+                                        count[i] = self->dims[i];
+                                }
+                                offset[0] = start;
+                                count[0] = end - start;
+                                status |= H5Sselect_hyperslab(self->dataspace_id, H5S_SELECT_SET,
+                                                              offset, NULL, count, NULL);
+                                memspace_id = H5Screate_simple(self->rank, count, NULL);
+                        }else{
+                                status |= H5Sselect_all(self->dataspace_id);
+                                memspace_id = H5Scopy(self->dataspace_id);
+                        }
+                        for(i=0; i<self->n_datasets; ++i)
+                                status |= H5Dwrite(self->datasets[i], types[i],
+                                                   memspace_id, self->dataspace_id,
+                                                   H5P_DEFAULT, arrays[i]);
+                        status |= H5Sclose(memspace_id);
+                        self->status |= status;
+                }else
+                        self->res = FALSE;
+                g_mutex_unlock(&self->mutex);
+
+                hkl_binoculars_cube_free(cube);
+        }
+
+        darray_free(slab);
+
+        return NULL;
+}
+
+/* the axes of the files must have the same names and resolutions */
+static int merge_files_axes(const HklBinocularsMergeFile *files, size_t n_files,
+                            darray_axis *axes)
+{
+        size_t i, j;
+        HklBinocularsAxis *axis;
+
+        darray_resize(*axes, 0);
+        for(i=0; i<n_files; ++i){
+                const darray_axis *saved = &files[i].axes;
+
+                if(0 == darray_size(*saved))
+                        continue;
+
+                if(0 == darray_size(*axes)){
+                        darray_foreach(axis, *saved){
+                                darray_append(*axes, *axis);
+                        }
+                        continue;
+                }
+
+                if(darray_size(*axes) != darray_size(*saved))
+                        return FALSE;
+                for(j=0; j<darray_size(*axes); ++j){
+                        const HklBinocularsAxis *other = &darray_item(*saved, j);
+
+                        axis = &darray_item(*axes, j);
+                        /* the saved names are interned */
+                        if(axis->name != other->name
+                           || fabs(axis->resolution - other->resolution) > 1e-12 * fabs(axis->resolution))
+                                return FALSE;
+                        axis->imin = MIN(axis->imin, other->imin);
+                        axis->imax = MAX(axis->imax, other->imax);
+                }
+        }
+
+        return TRUE;
+}
+
+int hkl_binoculars_cubes_merge_hdf5(const char *fn,
+                                    size_t n_fns,
+                                    const char *const *fns,
+                                    size_t n_threads)
+{
+        size_t i;
+        int res = TRUE;
+        int weighted = FALSE;
+        char *config = NULL;
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t dcpl;
+        herr_t status = 0;
+        darray_axis axes = darray_new();
+        HklBinocularsMergeFile files[n_fns > 0 ? n_fns : 1];
+        HklBinocularsMergeFiles merge;
+
+        /* only the axes of the inputs are read first */
+        for(i=0; i<n_fns; ++i){
+                files[i].fn = fns[i];
+                darray_init(files[i].axes);
+                files[i].weighted = FALSE;
+        }
+        for(i=0; i<n_fns && res; ++i){
+                file_id = open_saved_cube(fns[i], &groupe_id, &files[i].axes, &files[i].weighted);
+                if(file_id < 0){
+                        res = FALSE;
+                        break;
+                }
+                if(0 == i)
+                        config = load_string(groupe_id, "config");
+                weighted |= files[i].weighted;
+                H5Gclose(groupe_id);
+                H5Fclose(file_id);
+        }
+        if(!res || NULL == config || !merge_files_axes(files, n_fns, &axes)){
+                res = FALSE;
+                goto out;
+        }
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        status |= save_config(groupe_id, config);
+        status |= save_axes(groupe_id, &axes);
+
+        merge.dataspace_id = create_dataspace_from_axes(&axes);
+        dcpl = create_dcpl(merge.dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+
+        const char *names[] = {"counts", "contributions", "intensities", "variances"};
+        const hid_t types[] = {H5T_NATIVE_UINT32, H5T_NATIVE_UINT32,
+                               H5T_NATIVE_DOUBLE, H5T_NATIVE_DOUBLE};
+
+        merge.n_datasets = weighted ? ARRAY_SIZE(names) : 2;
+        for(i=0; i<merge.n_datasets; ++i)
+                merge.datasets[i] = H5Dcreate(groupe_id, names[i], types[i],
+                                              merge.dataspace_id,
+                                              H5P_DEFAULT, dcpl, H5P_DEFAULT);
+
+        if(0 != darray_size(axes)){
+                merge.rank = H5Sget_simple_extent_ndims(merge.dataspace_id);
+
+                hsize_t dims[merge.rank > 0 ? merge.rank : 1];
+                hsize_t chunk[merge.rank > 0 ? merge.rank : 1];
+
+                H5Sget_simple_extent_dims(merge.dataspace_id, dims, NULL);
+
+                merge.files = files;
+                merge.n_files = n_fns;
+                merge.axes = &axes;
+                merge.weighted = weighted;
+                merge.dims = dims;
+                merge.n_rows = axis_size(&darray_item(axes, 0));
+
+                /* like the merge of the cubes, the slabs are made of
+                   complete chunks so each chunk is compressed and
+                   written only once. */
+                if(merge.n_rows > 1 && merge.rank > 0){
+                        if(H5D_CHUNKED == H5Pget_layout(dcpl)
+                           && H5Pget_chunk(dcpl, merge.rank, chunk) == merge.rank)
+                                merge.slab = chunk[0];
+                        else
+                                merge.slab = MAX(1, merge.n_rows / 64);
+                }else
+                        merge.slab = merge.n_rows;
+                merge.n_slabs = (merge.n_rows + merge.slab - 1) / merge.slab;
+                merge.next = 0;
+                merge.res = TRUE;
+                merge.status = 0;
+                g_mutex_init(&merge.mutex);
+
+                /* each thread holds one slab and one slice of a file */
+                if(0 == n_threads)
+                        n_threads = g_get_num_processors();
+                n_threads = MAX(1, MIN(n_threads, merge.n_slabs));
+
+                GThread *threads[n_threads];
+
+                for(i=0; i<n_threads; ++i)
+                        threads[i] = g_thread_new("cube-merge-files", merge_files_job, &merge);
+                for(i=0; i<n_threads; ++i)
+                        g_thread_join(threads[i]);
+
+                g_mutex_clear(&merge.mutex);
+                status |= merge.status;
+                res = merge.res;
+        }
+
+        for(i=0; i<merge.n_datasets; ++i)
+                status |= H5Dclose(merge.datasets[i]);
+        status |= H5Pclose(dcpl);
+        status |= H5Sclose(merge.dataspace_id);
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
+
+        /* a file changed while it was merged */
+        if(!res)
+                g_unlink(fn);
+
+        hkl_assert(status >= 0);
+
+out:
+        for(i=0; i<n_fns; ++i)
+                darray_free(files[i].axes);
+        darray_free(axes);
+        g_free(config);
+
+        return res;
+}
+
+void hkl_binoculars_sparse_cube_save_hdf5(const char *fn,
+                                          const char *config,
+                                          HklBinocularsSparseCube *self)
+{
+        size_t i;
+        size_t n_columns;
+        int64_t *indexes;
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t groupe_sparse_id;
+        hid_t dataspace_id;
+        hid_t dcpl;
+        herr_t status;
+        size_t n_bins = hkl_binoculars_sparse_cube_n_bins(self);
+        uint32_t *counts = malloc(n_bins * sizeof(*counts));
+        uint32_t *contributions = malloc(n_bins * sizeof(*contributions));
+
+        for(i=0; i<n_bins; ++i){
+                counts[i] = darray_item(self->bins, i).photons;
+                contributions[i] = darray_item(self->bins, i).contributions;
+        }
+        n_columns = hkl_binoculars_sparse_cube_dense_indexes(self, &indexes);
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        // config
+        status = save_config(groupe_id, config);
+
+        // axes
+        status = save_axes(groupe_id, &self->axes);
+
+        // sparse COO datasets
+        groupe_sparse_id = H5Gcreate(groupe_id, "sparse",
+                                     H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        {
+                hsize_t dims[] = {n_bins, n_columns};
+                hid_t dataset_id;
+
+                dataspace_id = H5Screate_simple(ARRAY_SIZE(dims), dims, NULL);
+                dcpl = create_dcpl(dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+                dataset_id = H5Dcreate(groupe_sparse_id, "indexes",
+                                       H5T_NATIVE_INT64, dataspace_id,
+                                       H5P_DEFAULT, dcpl, H5P_DEFAULT);
+                status = H5Dwrite(dataset_id, H5T_NATIVE_INT64,
+                                  H5S_ALL, H5S_ALL,
+                                  H5P_DEFAULT, indexes);
+                status |= H5Dclose(dataset_id);
+                status |= H5Pclose(dcpl);
+                status |= H5Sclose(dataspace_id);
+        }
+
+        {
+                hsize_t dims[] = {n_bins};
+
+                dataspace_id = H5Screate_simple(ARRAY_SIZE(dims), dims, NULL);
+                dcpl = create_dcpl(dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+
+                HklBinocularsHdf5Dataset datasets[] = {
+                        {groupe_sparse_id, "counts", dataspace_id, dcpl, H5T_NATIVE_UINT32, counts, 0},
+                        {groupe_sparse_id, "contributions", dataspace_id, dcpl, H5T_NATIVE_UINT32, contributions, 0},
+                };
+
+                write_dataset(&datasets[0]);
+                write_dataset(&datasets[1]);
+                status |= datasets[0].status | datasets[1].status;
+
+                status |= H5Pclose(dcpl);
+                status |= H5Sclose(dataspace_id);
+        }
+
+        // terminate access and free identifiers
+        status |= H5Gclose(groupe_sparse_id);
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
+
+        free(indexes);
+        free(contributions);
+        free(counts);
+
+        hkl_assert(status >= 0);
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_hdf5(const char *fn)
+{
+        int weighted;
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t groupe_sparse_id;
+        hssize_t n_bins;
+        int64_t *indexes = NULL;
+        uint32_t *counts = NULL;
+        uint32_t *contributions = NULL;
+        darray_axis axes = darray_new();
+        HklBinocularsCube *self = NULL;
+
+        /* the axes of size 1 are not saved, like their indexes column */
+        file_id = open_saved_cube(fn, &groupe_id, &axes, &weighted);
+        if(file_id < 0)
+                goto out;
+
+        if(H5Lexists(groupe_id, "sparse", H5P_DEFAULT) > 0){
+                groupe_sparse_id = H5Gopen(groupe_id, "sparse", H5P_DEFAULT);
+
+                n_bins = load_array(groupe_sparse_id, "indexes", H5T_NATIVE_INT64,
+                                    darray_size(axes), (void **)&indexes);
+                if(n_bins >= 0
+                   && n_bins == load_array(groupe_sparse_id, "counts", H5T_NATIVE_UINT32,
+                                           1, (void **)&counts)
+                   && n_bins == load_array(groupe_sparse_id, "contributions", H5T_NATIVE_UINT32,
+                                           1, (void **)&contributions))
+                        self = hkl_binoculars_cube_new_from_sparse_arrays(&axes, n_bins,
+                                                                          darray_size(axes),
+                                                                          indexes, counts,
+                                                                          contributions);
+
+                H5Gclose(groupe_sparse_id);
+        }
+
+        H5Gclose(groupe_id);
+        H5Fclose(file_id);
+out:
+        free(contributions);
+        free(counts);
+        free(indexes);
+        darray_free(axes);
+
+        return self;
+}
+
+/***************/
+/* Cube Window */
+/***************/
+
+struct _HklBinocularsCubeWindow
+{
+        char *fn;
+        size_t slab_bins; /* the timestamp bins of a slab */
+        size_t n_open; /* the slabs kept in memory */
+        int started;
+        ptrdiff_t newest; /* the newest slab seen */
+        ptrdiff_t *slabs; /* the slab of each cube of the ring */
+        HklBinocularsCube **cubes; /* the ring of the open slabs, NULL if free */
+        size_t n_saved; /* the slabs groups already written */
+        herr_t status;
+};
+
+/* floor(i / n) for the negative bins too */
+static inline ptrdiff_t window_slab_index(ptrdiff_t i, size_t n)
+{
+        ptrdiff_t d = n;
+
+        return i >= 0 ? i / d : -((d - 1 - i) / d);
+}
+
+static inline size_t window_slot(const HklBinocularsCubeWindow *self, ptrdiff_t slab)
+{
+        ptrdiff_t n = self->n_open;
+
+        return ((slab % n) + n) % n;
+}
+
+/* binoculars/slabs/slab_<n>: the axes, the counts and the
+ * contributions of a closed slab, n is the order of the writes. The
+ * file is reopened for each slab so it is complete between two
+ * writes. */
+static herr_t window_slab_save(HklBinocularsCubeWindow *self,
+                               const HklBinocularsCube *cube)
+{
+        char name[64];
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t dataspace_id;
+        hid_t dcpl;
+        herr_t status = 0;
+        HklBinocularsCube *compact = NULL;
+
+        if(0 == darray_size(cube->axes))
+                return status;
+
+        hkl_binoculars_cube_planar(cube);
+        if(!cube_is_compact(cube))
+                cube = compact = hkl_binoculars_cube_new_copy(cube);
+
+        file_id = H5Fopen(self->fn, H5F_ACC_RDWR, H5P_DEFAULT);
+        if(file_id < 0){
+                status = -1;
+                goto out;
+        }
+
+        snprintf(name, ARRAY_SIZE(name), "binoculars/slabs/slab_%zu", self->n_saved++);
+        groupe_id = H5Gcreate(file_id, name,
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+        status |= save_axes(groupe_id, &cube->axes);
+
+        dataspace_id = create_dataspace_from_axes(&cube->axes);
+        dcpl = create_dcpl(dataspace_id, HKL_BINOCULARS_HDF5_FILTER_DEFLATE, 1);
+
+        HklBinocularsHdf5Dataset datasets[] = {
+                {groupe_id, "counts", dataspace_id, dcpl, H5T_NATIVE_UINT32, cube->photons, 0},
+                {groupe_id, "contributions", dataspace_id, dcpl, H5T_NATIVE_UINT32, cube->contributions, 0},
+                {groupe_id, "intensities", dataspace_id, dcpl, H5T_NATIVE_DOUBLE, cube->intensities, 0},
+                {groupe_id, "variances", dataspace_id, dcpl, H5T_NATIVE_DOUBLE, cube->variances, 0},
+        };
+
+        write_dataset(&datasets[0]);
+        write_dataset(&datasets[1]);
+        status |= datasets[0].status | datasets[1].status;
+        if(cube->weighted){
+                write_dataset(&datasets[2]);
+                write_dataset(&datasets[3]);
+                status |= datasets[2].status | datasets[3].status;
+        }
+
+        status |= H5Pclose(dcpl);
+        status |= H5Sclose(dataspace_id);
+        status |= H5Gclose(groupe_id);
+        status |= H5Fclose(file_id);
+out:
+        if(NULL != compact)
+                hkl_binoculars_cube_free(compact);
+
+        return status;
+}
+
+static void window_slab_close(HklBinocularsCubeWindow *self, ptrdiff_t slab)
+{
+        size_t i = window_slot(self, slab);
+
+        if(NULL != self->cubes[i] && slab == self->slabs[i]){
+                self->status |= window_slab_save(self, self->cubes[i]);
+                hkl_binoculars_cube_free(self->cubes[i]);
+                self->cubes[i] = NULL;
+        }
+}
+
+HklBinocularsCubeWindow *hkl_binoculars_cube_window_new(const char *fn,
+                                                        const char *config,
+                                                        size_t slab_bins,
+                                                        size_t n_open)
+{
+        hid_t file_id;
+        hid_t groupe_id;
+        hid_t groupe_slabs_id;
+        HklBinocularsCubeWindow *self;
+
+        file_id = H5Fcreate(fn, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if(file_id < 0)
+                return NULL;
+
+        self = g_new0(HklBinocularsCubeWindow, 1);
+        self->fn = g_strdup(fn);
+        self->slab_bins = MAX(1, slab_bins);
+        self->n_open = MAX(1, n_open);
+        self->slabs = g_new0(ptrdiff_t, self->n_open);
+        self->cubes = g_new0(HklBinocularsCube *, self->n_open);
+
+        groupe_id = H5Gcreate(file_id, "binoculars",
+                              H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        self->status = save_config(groupe_id, config);
+        groupe_slabs_id = H5Gcreate(groupe_id, "slabs",
+                                    H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        self->status |= H5Gclose(groupe_slabs_id);
+        self->status |= H5Gclose(groupe_id);
+        self->status |= H5Fclose(file_id);
+
+        return self;
+}
+
+/* a copy of the space with only the items in the bins [imin, imax]
+ * of the axis */
+static HklBinocularsSpace *space_new_time_slab(const HklBinocularsSpace *space,
+                                               size_t axis,
+                                               ptrdiff_t imin, ptrdiff_t imax)
+{
+        size_t i;
+        HklBinocularsSpacePackedItem *item;
+        HklBinocularsSpace *self = hkl_binoculars_space_new(0, darray_size(space->axes));
+
+        for(i=0; i<darray_size(space->axes); ++i)
+                darray_item(self->axes, i) = darray_item(space->axes, i);
+        memcpy(self->origin, space->origin, sizeof(self->origin));
+        self->n_frames = space->n_frames;
+        self->frame_sum = space->frame_sum;
+        self->frame_max = space->frame_max;
+        self->frame_n_in_limits = space->frame_n_in_limits;
+
+        darray_foreach(item, space->items){
+                ptrdiff_t idx = space->origin[axis] + item->indexes[axis];
+
+                if(idx >= imin && idx <= imax)
+                        darray_append(self->items, *item);
+        }
+
+        darray_item(self->axes, axis).imin = MAX(imin, darray_item(self->axes, axis).imin);
+        darray_item(self->axes, axis).imax = MIN(imax, darray_item(self->axes, axis).imax);
+
+        return self;
+}
+
+static void window_add_slab(HklBinocularsCubeWindow *self,
+                            ptrdiff_t slab,
+                            const HklBinocularsSpace *space)
+{
+        size_t i;
+
+        if(0 == darray_size(space->items))
+                return;
+
+        /* a newer slab closes, from the oldest, the ones which leave
+         * the window */
+        if(!self->started || slab > self->newest){
+                if(self->started){
+                        ptrdiff_t k;
+                        ptrdiff_t last = MIN(self->newest, slab - (ptrdiff_t)self->n_open);
+
+                        for(k=self->newest - (ptrdiff_t)self->n_open + 1; k<=last; ++k)
+                                window_slab_close(self, k);
+                }
+                self->newest = slab;
+                self->started = TRUE;
+        }
+
+        /* the items of an already closed slab are written on their own */
+        if(slab <= self->newest - (ptrdiff_t)self->n_open){
+                HklBinocularsCube *cube = hkl_binoculars_cube_new_from_space(space);
+
+                self->status |= window_slab_save(self, cube);
+                hkl_binoculars_cube_free(cube);
+                return;
+        }
+
+        i = window_slot(self, slab);
+        if(NULL == self->cubes[i]){
+                self->cubes[i] = hkl_binoculars_cube_new_empty();
+                self->slabs[i] = slab;
+        }
+        hkl_binoculars_cube_add_space(self->cubes[i], space);
+}
+
+void hkl_binoculars_cube_window_add_space(HklBinocularsCubeWindow *self,
+                                          const HklBinocularsSpace *space)
+{
+        size_t axis;
+        ptrdiff_t first;
+        ptrdiff_t last;
+        ptrdiff_t slab;
+
+        if(0 == darray_size(space->items))
+                return;
+
+        for(axis=0; axis<darray_size(space->axes); ++axis)
+                if(!strcmp("timestamp", darray_item(space->axes, axis).name))
+                        break;
+
+        /* without timestamp there is only one slab */
+        if(axis == darray_size(space->axes)){
+                window_add_slab(self, 0, space);
+                return;
+        }
+
+        first = window_slab_index(darray_item(space->axes, axis).imin, self->slab_bins);
+        last = window_slab_index(darray_item(space->axes, axis).imax, self->slab_bins);
+
+        if(first == last)
+                window_add_slab(self, first, space);
+        else
+                for(slab=first; slab<=last; ++slab){
+                        HklBinocularsSpace *part = space_new_time_slab(space, axis,
+                                                                       slab * self->slab_bins,
+                                                                       (slab + 1) * self->slab_bins - 1);
+
+                        window_add_slab(self, slab, part);
+                        hkl_binoculars_space_free(part);
+                }
+}
+
+size_t hkl_binoculars_cube_window_n_saved(const HklBinocularsCubeWindow *self)
+{
+        return self->n_saved;
+}
+
+void hkl_binoculars_cube_window_free(HklBinocularsCubeWindow *self)
+{
+        ptrdiff_t slab;
+
+        /* the open slabs from the oldest to the newest */
+        if(self->started)
+                for(slab=self->newest - (ptrdiff_t)self->n_open + 1; slab<=self->newest; ++slab)
+                        window_slab_close(self, slab);
+
+        hkl_assert(self->status >= 0);
+
+        g_free(self->cubes);
+        g_free(self->slabs);
+        g_free(self->fn);
+        g_free(self);
+}
+
+/**********/
+/* Frames */
+/**********/
+
+static int direct_chunk_read = FALSE;
+
+void hkl_binoculars_hdf5_direct_chunk_read_set(int enable)
+{
+        direct_chunk_read = enable;
+}
+
+/* the roi of the frames, set once before the projection */
+static size_t frame_roi[4] = {0, 0, 0, 0};
+G_LOCK_DEFINE_STATIC(frame_roi);
+
+void hkl_binoculars_hdf5_frame_roi_set(size_t row0, size_t row1,
+                                       size_t col0, size_t col1)
+{
+        G_LOCK(frame_roi);
+        frame_roi[0] = row0;
+        frame_roi[1] = row1;
+        frame_roi[2] = col0;
+        frame_roi[3] = col1;
+        G_UNLOCK(frame_roi);
+}
+
+int hkl_binoculars_hdf5_read_frame_roi(int64_t dataset_id, size_t i,
+                                       void *buffer, size_t n_bytes)
+{
+        int res = -1;
+        hid_t dataset = dataset_id;
+        hid_t dcpl;
+        hid_t dataspace;
+        hid_t datatype;
+        hid_t memtype;
+        hid_t memspace;
+        hsize_t dims[3];
+        hsize_t chunk[3];
+        size_t roi[4];
+
+        G_LOCK(frame_roi);
+        memcpy(roi, frame_roi, sizeof(roi));
+        G_UNLOCK(frame_roi);
+
+        if(roi[0] >= roi[1] || roi[2] >= roi[3])
+                return -1;
+
+        dcpl = H5Dget_create_plist(dataset);
+        dataspace = H5Dget_space(dataset);
+        datatype = H5Dget_type(dataset);
+        memtype = H5Tget_native_type(datatype, H5T_DIR_ASCEND);
+
+        if(3 != H5Sget_simple_extent_ndims(dataspace))
+                goto out;
+        H5Sget_simple_extent_dims(dataspace, dims, NULL);
+        if(i >= dims[0] || roi[1] > dims[1] || roi[3] > dims[2]
+           || dims[1] * dims[2] * H5Tget_size(memtype) != n_bytes)
+                goto out;
+
+        /* a frame in a single chunk is read and decompressed completely */
+        if(H5D_CHUNKED == H5Pget_layout(dcpl)){
+                if(3 != H5Pget_chunk(dcpl, 3, chunk)
+                   || (chunk[1] >= dims[1] && chunk[2] >= dims[2]))
+                        goto out;
+        }
+
+        {
+                hsize_t offset[3] = {i, roi[0], roi[2]};
+                hsize_t count[3] = {1, roi[1] - roi[0], roi[3] - roi[2]};
+                hsize_t mdims[2] = {dims[1], dims[2]};
+
+                memset(buffer, 0, n_bytes);
+
+                memspace = H5Screate_simple(2, mdims, NULL);
+                if(H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, offset, NULL, count, NULL) >= 0
+                   && H5Sselect_hyperslab(memspace, H5S_SELECT_SET, &offset[1], NULL, &count[1], NULL) >= 0
+                   && H5Dread(dataset, memtype, memspace, dataspace, H5P_DEFAULT, buffer) >= 0)
+                        res = 0;
+                H5Sclose(memspace);
+        }
+
+out:
+        H5Tclose(memtype);
+        H5Tclose(datatype);
+        H5Sclose(dataspace);
+        H5Pclose(dcpl);
+
+        return res;
+}
+
+/* the time spent by all the threads in the direct reads, in µs */
+static gsize direct_read_us = 0;
+static gsize direct_decode_us = 0;
+static gsize direct_n_frames = 0;
+
+void hkl_binoculars_hdf5_read_frame_direct_times_get(uint64_t *read_us,
+                                                     uint64_t *decode_us,
+                                                     uint64_t *n_frames)
+{
+        *read_us = g_atomic_pointer_get(&direct_read_us);
+        *decode_us = g_atomic_pointer_get(&direct_decode_us);
+        *n_frames = g_atomic_pointer_get(&direct_n_frames);
+}
+
+typedef enum _HklBinocularsHdf5Codec
+{
+        HKL_BINOCULARS_HDF5_CODEC_RAW = 0,
+        HKL_BINOCULARS_HDF5_CODEC_DEFLATE,
+        HKL_BINOCULARS_HDF5_CODEC_SHUFFLE_DEFLATE,
+        HKL_BINOCULARS_HDF5_CODEC_LZ4,
+        HKL_BINOCULARS_HDF5_CODEC_BITSHUFFLE_LZ4,
+        HKL_BINOCULARS_HDF5_CODEC_UNSUPPORTED,
+} HklBinocularsHdf5Codec;
+
+/* the bitshuffle filter compresses with lz4 when cd_values[4] == 2 */
+#define HKL_BINOCULARS_HDF5_BITSHUFFLE_LZ4 2
+
+static HklBinocularsHdf5Codec codec_get(hid_t dcpl)
+{
+        int i;
+        int n_filters = H5Pget_nfilters(dcpl);
+        H5Z_filter_t filters[2];
+        unsigned int bitshuffle_compression G_GNUC_UNUSED = 0;
+
+        if(n_filters < 0 || n_filters > 2)
+                return HKL_BINOCULARS_HDF5_CODEC_UNSUPPORTED;
+
+        for(i=0; i<n_filters; ++i){
+                unsigned int flags;
+                unsigned int cd_values[8];
+                size_t n_cd_values = ARRAY_SIZE(cd_values);
+                unsigned int filter_config;
+
+                filters[i] = H5Pget_filter2(dcpl, i, &flags, &n_cd_values, cd_values,
+                                            0, NULL, &filter_config);
+                if(HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_ID == filters[i] && n_cd_values > 4)
+                        bitshuffle_compression = cd_values[4];
+        }
+
+        if(0 == n_filters)
+                return HKL_BINOCULARS_HDF5_CODEC_RAW;
+#ifdef HAVE_ZLIB
+        if(1 == n_filters && H5Z_FILTER_DEFLATE == filters[0])
+                return HKL_BINOCULARS_HDF5_CODEC_DEFLATE;
+        if(2 == n_filters && H5Z_FILTER_SHUFFLE == filters[0] && H5Z_FILTER_DEFLATE == filters[1])
+                return HKL_BINOCULARS_HDF5_CODEC_SHUFFLE_DEFLATE;
+#endif
+#ifdef HAVE_LZ4
+        if(1 == n_filters && HKL_BINOCULARS_HDF5_FILTER_LZ4_ID == filters[0])
+                return HKL_BINOCULARS_HDF5_CODEC_LZ4;
+        if(1 == n_filters && HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_ID == filters[0]
+           && HKL_BINOCULARS_HDF5_BITSHUFFLE_LZ4 == bitshuffle_compression)
+                return HKL_BINOCULARS_HDF5_CODEC_BITSHUFFLE_LZ4;
+#endif
+
+        return HKL_BINOCULARS_HDF5_CODEC_UNSUPPORTED;
+}
+
+/* the raw chunk and the decompressed block of the calling thread,
+ * kept between the frames */
+typedef struct _HklBinocularsChunkBuffers HklBinocularsChunkBuffers;
+struct _HklBinocularsChunkBuffers
+{
+        uint8_t *raw;
+        size_t raw_size;
+        uint8_t *block;
+        size_t block_size;
+};
+
+static void chunk_buffers_free(gpointer data)
+{
+        HklBinocularsChunkBuffers *self = data;
+
+        free(self->block);
+        free(self->raw);
+        free(self);
+}
+
+static GPrivate chunk_buffers = G_PRIVATE_INIT(chunk_buffers_free);
+
+static uint8_t *chunk_buffer_get(uint8_t **buffer, size_t *size, size_t n)
+{
+        if(*size < n){
+                free(*buffer);
+                *buffer = malloc(n);
+                *size = NULL != *buffer ? n : 0;
+        }
+        return *buffer;
+}
+
+static HklBinocularsChunkBuffers *chunk_buffers_get(void)
+{
+        HklBinocularsChunkBuffers *self = g_private_get(&chunk_buffers);
+
+        if(NULL == self){
+                self = g_new0(HklBinocularsChunkBuffers, 1);
+                g_private_set(&chunk_buffers, self);
+        }
+
+        return self;
+}
+
+static inline uint64_t read_uint64_be(const uint8_t *p)
+{
+        uint64_t v = 0;
+        int i;
+
+        for(i=0; i<8; ++i)
+                v = (v << 8) | p[i];
+        return v;
+}
+
+static inline uint32_t read_uint32_be(const uint8_t *p)
+{
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* the inverse of the hdf5 shuffle filter, the byte j of the element
+ * i is stored at j * n + i */
+static void unshuffle(const uint8_t *in, uint8_t *out, size_t n, size_t elem_size)
+{
+        size_t i, j;
+
+        for(j=0; j<elem_size; ++j)
+                for(i=0; i<n; ++i)
+                        out[i * elem_size + j] = in[j * n + i];
+}
+
+/* the inverse of the bitshuffle transposition of n elements (a
+ * multiple of 8). The bit k of the byte j of all the elements is
+ * stored in the row j * 8 + k of n / 8 bytes, the element i at the
+ * bit i % 8 of the byte i / 8 of the row. */
+static void bitunshuffle(const uint8_t *in, uint8_t *out, size_t n, size_t elem_size)
+{
+        size_t j, k, m, b;
+        size_t row_size = n / 8;
+
+        memset(out, 0, n * elem_size);
+        for(j=0; j<elem_size; ++j)
+                for(k=0; k<8; ++k){
+                        const uint8_t *row = &in[(j * 8 + k) * row_size];
+
+                        for(m=0; m<row_size; ++m){
+                                uint8_t bits = row[m];
+
+                                if(0 == bits)
+                                        continue;
+                                for(b=0; b<8; ++b)
+                                        out[(8 * m + b) * elem_size + j] |= ((bits >> b) & 1) << k;
+                        }
+                }
+}
+
+#ifdef HAVE_LZ4
+/* hdf5 lz4 filter: the uncompressed size (be64), the block size
+ * (be32) then each block, its compressed size (be32) and the lz4
+ * data, stored as is when it is not smaller. */
+static int decompress_lz4(const uint8_t *in, size_t in_size, uint8_t *out, size_t n_bytes)
+{
+        const uint8_t *end = in + in_size;
+        uint64_t total;
+        uint32_t block_size;
+        size_t done = 0;
+
+        if(in_size < 12)
+                return -1;
+        total = read_uint64_be(in);
+        block_size = read_uint32_be(in + 8);
+        if(total != n_bytes || 0 == block_size)
+                return -1;
+        in += 12;
+
+        while(done < n_bytes){
+                size_t size = MIN(block_size, n_bytes - done);
+                uint32_t compressed;
+
+                if(in + 4 > end)
+                        return -1;
+                compressed = read_uint32_be(in);
+                in += 4;
+                if(in + compressed > end)
+                        return -1;
+                if(compressed == size)
+                        memcpy(out + done, in, size);
+                else if(LZ4_decompress_safe((const char *)in, (char *)out + done,
+                                            compressed, size) != (int)size)
+                        return -1;
+                in += compressed;
+                done += size;
+        }
+
+        return 0;
+}
+
+/* bitshuffle lz4 filter: the uncompressed size (be64), the block
+ * size in bytes (be32), then each block, its compressed size (be32)
+ * and the lz4 data of the bitshuffled elements. The last block is
+ * rounded down to a multiple of 8 elements, the remaining elements
+ * are copied as is at the end. */
+static int decompress_bitshuffle_lz4(const uint8_t *in, size_t in_size,
+                                     uint8_t *out, size_t n_bytes, size_t elem_size,
+                                     HklBinocularsChunkBuffers *buffers)
+{
+        const uint8_t *end = in + in_size;
+        uint64_t total;
+        size_t block_size;
+        size_t n = n_bytes / elem_size;
+        size_t done = 0;
+        uint8_t *block;
+
+        if(in_size < 12)
+                return -1;
+        total = read_uint64_be(in);
+        block_size = read_uint32_be(in + 8) / elem_size;
+        if(total != n_bytes || 0 == block_size || 0 != block_size % 8)
+                return -1;
+        in += 12;
+
+        block = chunk_buffer_get(&buffers->block, &buffers->block_size, block_size * elem_size);
+        if(NULL == block)
+                return -1;
+
+        while(n - done >= 8){
+                size_t size = MIN(block_size, n - done);
+                uint32_t compressed;
+
+                size -= size % 8;
+                if(in + 4 > end)
+                        return -1;
+                compressed = read_uint32_be(in);
+                in += 4;
+                if(in + compressed > end)
+                        return -1;
+                if(LZ4_decompress_safe((const char *)in, (char *)block,
+                                       compressed, size * elem_size) != (int)(size * elem_size))
+                        return -1;
+                bitunshuffle(block, out + done * elem_size, size, elem_size);
+                in += compressed;
+                done += size;
+        }
+
+        if(in + (n - done) * elem_size > end)
+                return -1;
+        memcpy(out + done * elem_size, in, (n - done) * elem_size);
+
+        return 0;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+static int decompress_deflate(const uint8_t *in, size_t in_size, uint8_t *out, size_t n_bytes)
+{
+        uLongf size = n_bytes;
+
+        if(Z_OK != uncompress(out, &size, in, in_size) || size != n_bytes)
+                return -1;
+
+        return 0;
+}
+#endif
+
+int hkl_binoculars_hdf5_read_frame_direct(int64_t dataset_id, size_t i,
+                                          void *buffer, size_t n_bytes)
+{
+#if H5_VERSION_GE(1, 10, 3)
+        int res = -1;
+        hid_t dataset = dataset_id;
+        hid_t dcpl;
+        hid_t dataspace;
+        hid_t datatype;
+        hsize_t dims[3];
+        hsize_t chunk[3];
+        hsize_t offset[3] = {i, 0, 0};
+        hsize_t raw_size;
+        uint32_t filter_mask = 0;
+        size_t elem_size;
+        HklBinocularsHdf5Codec codec;
+        HklBinocularsChunkBuffers *buffers;
+        uint8_t *raw;
+
+        gint64 t0, t1 = 0;
+
+        if(FALSE == direct_chunk_read)
+                return -1;
+
+        t0 = g_get_monotonic_time();
+
+        dcpl = H5Dget_create_plist(dataset);
+        dataspace = H5Dget_space(dataset);
+        datatype = H5Dget_type(dataset);
+        elem_size = H5Tget_size(datatype);
+
+        /* one frame per chunk */
+        if(H5D_CHUNKED != H5Pget_layout(dcpl)
+           || 3 != H5Sget_simple_extent_ndims(dataspace)
+           || 3 != H5Pget_chunk(dcpl, 3, chunk))
+                goto out;
+        H5Sget_simple_extent_dims(dataspace, dims, NULL);
+        if(i >= dims[0] || 1 != chunk[0] || dims[1] != chunk[1] || dims[2] != chunk[2]
+           || dims[1] * dims[2] * elem_size != n_bytes)
+                goto out;
+
+        codec = codec_get(dcpl);
+        if(HKL_BINOCULARS_HDF5_CODEC_UNSUPPORTED == codec)
+                goto out;
+
+        if(H5Dget_chunk_storage_size(dataset, offset, &raw_size) < 0 || 0 == raw_size)
+                goto out;
+
+        buffers = chunk_buffers_get();
+        raw = chunk_buffer_get(&buffers->raw, &buffers->raw_size, raw_size);
+        if(NULL == raw)
+                goto out;
+
+        if(H5Dread_chunk(dataset, H5P_DEFAULT, offset, &filter_mask, raw) < 0)
+                goto out;
+
+        t1 = g_get_monotonic_time();
+
+        /* a chunk stored without its filters */
+        if(0 != filter_mask)
+                codec = HKL_BINOCULARS_HDF5_CODEC_RAW;
+
+        /* the hdf5 lock is released, decompress */
+        switch(codec){
+        case HKL_BINOCULARS_HDF5_CODEC_RAW:
+                if(raw_size == n_bytes){
+                        memcpy(buffer, raw, n_bytes);
+                        res = 0;
+                }
+                break;
+#ifdef HAVE_ZLIB
+        case HKL_BINOCULARS_HDF5_CODEC_DEFLATE:
+                res = decompress_deflate(raw, raw_size, buffer, n_bytes);
+                break;
+        case HKL_BINOCULARS_HDF5_CODEC_SHUFFLE_DEFLATE:
+        {
+                uint8_t *block = chunk_buffer_get(&buffers->block, &buffers->block_size, n_bytes);
+
+                if(NULL != block){
+                        res = decompress_deflate(raw, raw_size, block, n_bytes);
+                        if(0 == res)
+                                unshuffle(block, buffer, n_bytes / elem_size, elem_size);
+                }
+                break;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case HKL_BINOCULARS_HDF5_CODEC_LZ4:
+                res = decompress_lz4(raw, raw_size, buffer, n_bytes);
+                break;
+        case HKL_BINOCULARS_HDF5_CODEC_BITSHUFFLE_LZ4:
+                res = decompress_bitshuffle_lz4(raw, raw_size, buffer, n_bytes,
+                                                elem_size, buffers);
+                break;
+#endif
+        default:
+                break;
+        }
+
+        if(0 == res){
+                g_atomic_pointer_add(&direct_read_us, t1 - t0);
+                g_atomic_pointer_add(&direct_decode_us, g_get_monotonic_time() - t1);
+                g_atomic_pointer_add(&direct_n_frames, 1);
+        }
+
+out:
+        H5Tclose(datatype);
+        H5Sclose(dataspace);
+        H5Pclose(dcpl);
+
+        return res;
+#else
+        return -1;
+#endif
 }
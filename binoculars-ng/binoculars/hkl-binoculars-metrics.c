@@ -0,0 +1,274 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ccan/array_size/array_size.h"
+#include "hkl-binoculars-private.h"
+
+/* the upper bounds of the buckets of the stages durations in s */
+static const double stage_buckets[] = {
+        1e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1, 5, 10,
+};
+
+static const char *stage_names[] = {
+        [HKL_BINOCULARS_METRICS_STAGE_READ] = "read",
+        [HKL_BINOCULARS_METRICS_STAGE_GEOMETRY] = "geometry",
+        [HKL_BINOCULARS_METRICS_STAGE_PROJECT] = "project",
+        [HKL_BINOCULARS_METRICS_STAGE_ACCUMULATE] = "accumulate",
+        [HKL_BINOCULARS_METRICS_STAGE_MERGE] = "merge",
+        [HKL_BINOCULARS_METRICS_STAGE_SAVE] = "save",
+};
+
+typedef struct _HklBinocularsMetricsHistogram HklBinocularsMetricsHistogram;
+struct _HklBinocularsMetricsHistogram
+{
+        uint64_t buckets[ARRAY_SIZE(stage_buckets)]; /* not cumulative */
+        uint64_t count;
+        double sum;
+};
+
+typedef struct _HklBinocularsMetrics HklBinocularsMetrics;
+struct _HklBinocularsMetrics
+{
+        GMutex mutex;
+        HklBinocularsMetricsHistogram stages[HKL_BINOCULARS_METRICS_STAGE_NUM_STAGES];
+        size_t queue_depth;
+        size_t cube_bytes;
+
+        /* the exporter */
+        int fd;
+        int port;
+        gint stop;
+        GThread *thread;
+};
+
+static HklBinocularsMetrics metrics = {.fd = -1};
+
+void hkl_binoculars_metrics_stage_observe(HklBinocularsMetricsStageEnum stage,
+                                          double seconds)
+{
+        size_t i;
+        HklBinocularsMetricsHistogram *h;
+
+        if(stage >= HKL_BINOCULARS_METRICS_STAGE_NUM_STAGES)
+                return;
+
+        for(i=0; i<ARRAY_SIZE(stage_buckets) && seconds > stage_buckets[i]; ++i);
+
+        g_mutex_lock(&metrics.mutex);
+        h = &metrics.stages[stage];
+        if(i < ARRAY_SIZE(stage_buckets))
+                h->buckets[i]++;
+        h->count++;
+        h->sum += seconds;
+        g_mutex_unlock(&metrics.mutex);
+}
+
+void hkl_binoculars_metrics_queue_depth_set(size_t depth)
+{
+        g_mutex_lock(&metrics.mutex);
+        metrics.queue_depth = depth;
+        g_mutex_unlock(&metrics.mutex);
+}
+
+void hkl_binoculars_metrics_cube_set(const HklBinocularsCube *cube)
+{
+        size_t n = NULL == cube ? 0 : hkl_binoculars_cube_bytes(cube);
+
+        g_mutex_lock(&metrics.mutex);
+        metrics.cube_bytes = n;
+        g_mutex_unlock(&metrics.mutex);
+}
+
+/* the OpenMetrics text exposition of the metrics */
+static GString *metrics_body(void)
+{
+        size_t i, j;
+        GString *body = g_string_new(NULL);
+
+        g_mutex_lock(&metrics.mutex);
+
+        g_string_append(body, "# TYPE binoculars_frames counter\n");
+        g_string_append(body, "# HELP binoculars_frames The frames projected.\n");
+        g_string_append_printf(body, "binoculars_frames_total %" G_GUINT64_FORMAT "\n",
+                               metrics.stages[HKL_BINOCULARS_METRICS_STAGE_PROJECT].count);
+
+        g_string_append(body, "# TYPE binoculars_queue_depth gauge\n");
+        g_string_append(body, "# HELP binoculars_queue_depth The frames read and not yet projected.\n");
+        g_string_append_printf(body, "binoculars_queue_depth %zu\n", metrics.queue_depth);
+
+        g_string_append(body, "# TYPE binoculars_cube_bytes gauge\n");
+        g_string_append(body, "# UNIT binoculars_cube_bytes bytes\n");
+        g_string_append(body, "# HELP binoculars_cube_bytes The memory of the cube.\n");
+        g_string_append_printf(body, "binoculars_cube_bytes %zu\n", metrics.cube_bytes);
+
+        g_string_append(body, "# TYPE binoculars_stage_seconds histogram\n");
+        g_string_append(body, "# UNIT binoculars_stage_seconds seconds\n");
+        g_string_append(body, "# HELP binoculars_stage_seconds The durations of the stages of the projection.\n");
+        for(i=0; i<HKL_BINOCULARS_METRICS_STAGE_NUM_STAGES; ++i){
+                const HklBinocularsMetricsHistogram *h = &metrics.stages[i];
+                uint64_t cumulative = 0;
+
+                for(j=0; j<ARRAY_SIZE(stage_buckets); ++j){
+                        cumulative += h->buckets[j];
+                        g_string_append_printf(body, "binoculars_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %" G_GUINT64_FORMAT "\n",
+                                               stage_names[i], stage_buckets[j], cumulative);
+                }
+                g_string_append_printf(body, "binoculars_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+                                       stage_names[i], h->count);
+                g_string_append_printf(body, "binoculars_stage_seconds_count{stage=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                                       stage_names[i], h->count);
+                g_string_append_printf(body, "binoculars_stage_seconds_sum{stage=\"%s\"} %.9g\n",
+                                       stage_names[i], h->sum);
+        }
+
+        g_mutex_unlock(&metrics.mutex);
+
+        g_string_append(body, "# EOF\n");
+
+        return body;
+}
+
+static void write_all(int fd, const char *data, size_t n)
+{
+        while(n > 0){
+                ssize_t w = write(fd, data, n);
+
+                if(w <= 0)
+                        return;
+                data += w;
+                n -= w;
+        }
+}
+
+/* answer one request, the metrics on GET /metrics */
+static void metrics_answer(int fd)
+{
+        char request[1024];
+        ssize_t n;
+        struct timeval timeout = {1, 0};
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        n = read(fd, request, sizeof(request) - 1);
+        if(n <= 0)
+                return;
+        request[n] = '\0';
+
+        if(g_str_has_prefix(request, "GET /metrics ")
+           || g_str_has_prefix(request, "GET /metrics?")){
+                GString *body = metrics_body();
+                char *header = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                                               "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                               "Content-Length: %zu\r\n"
+                                               "Connection: close\r\n\r\n",
+                                               body->len);
+
+                write_all(fd, header, strlen(header));
+                write_all(fd, body->str, body->len);
+
+                g_free(header);
+                g_string_free(body, TRUE);
+        }else{
+                const char *not_found = "HTTP/1.1 404 Not Found\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n\r\n";
+
+                write_all(fd, not_found, strlen(not_found));
+        }
+}
+
+static gpointer metrics_serve_job(gpointer data)
+{
+        struct pollfd pfd = {metrics.fd, POLLIN, 0};
+
+        /* wake up regularly to check the stop request */
+        while(!g_atomic_int_get(&metrics.stop)){
+                if(poll(&pfd, 1, 200) > 0 && (pfd.revents & POLLIN)){
+                        int fd = accept(metrics.fd, NULL, NULL);
+
+                        if(fd >= 0){
+                                metrics_answer(fd);
+                                close(fd);
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+int hkl_binoculars_metrics_serve(const char *address, int port)
+{
+        int one = 1;
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+
+        if(NULL != metrics.thread)
+                return metrics.port;
+
+        metrics.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(metrics.fd < 0){
+                fprintf(stderr, "Can not create the socket of the metrics\n");
+                return FALSE;
+        }
+        setsockopt(metrics.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        /* the metrics are not authenticated, only the local
+         * scrapers unless asked otherwise */
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if((NULL != address && 1 != inet_pton(AF_INET, address, &addr.sin_addr))
+           || bind(metrics.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+           || listen(metrics.fd, 8) < 0
+           || getsockname(metrics.fd, (struct sockaddr *)&addr, &addr_len) < 0){
+                fprintf(stderr, "Can not serve the metrics on %s:%d\n",
+                        NULL == address ? "127.0.0.1" : address, port);
+                close(metrics.fd);
+                metrics.fd = -1;
+                return 0;
+        }
+        metrics.port = ntohs(addr.sin_port);
+
+        g_atomic_int_set(&metrics.stop, FALSE);
+        metrics.thread = g_thread_new("metrics", metrics_serve_job, NULL);
+
+        return metrics.port;
+}
+
+void hkl_binoculars_metrics_stop(void)
+{
+        if(NULL == metrics.thread)
+                return;
+
+        g_atomic_int_set(&metrics.stop, TRUE);
+        g_thread_join(metrics.thread);
+        metrics.thread = NULL;
+        close(metrics.fd);
+        metrics.fd = -1;
+}
@@ -53,30 +53,85 @@ typedef darray(HklBinocularsAxis) darray_axis;
 				  struct _HklBinocularsSpaceItem
 				  {
 					  ptrdiff_t indexes_0[3]; /* for now hardcode the max number of axes */
-					  uint32_t intensity;
+					  float intensity; /* the corrected counts */
+					  float weight; /* the correction applied to the counts */
 				  };
 
 
-typedef darray(HklBinocularsSpaceItem) darray_HklBinocularsSpaceItem;
+/* the item stored in a space, the indexes are packed relatively to
+ * the origin of the space. */
+typedef struct _HklBinocularsSpacePackedItem HklBinocularsSpacePackedItem;
+struct _HklBinocularsSpacePackedItem
+{
+        int32_t indexes[3];
+        float intensity;
+        float weight;
+};
+
+typedef darray(HklBinocularsSpacePackedItem) darray_HklBinocularsSpacePackedItem;
 
 
 				       struct _HklBinocularsSpace
 				       {
 					       darray_axis axes;
 					       size_t max_items;
-					       darray_HklBinocularsSpaceItem items;
+					       ptrdiff_t origin[3]; /* the indexes of the first item of the frame */
+					       uint32_t n_frames; /* the number of frames summed into the projected image */
+					       darray_HklBinocularsSpacePackedItem items;
+					       double frame_sum; /* of the not masked pixels of the frame */
+					       double frame_max;
+					       size_t frame_n_in_limits; /* the not masked pixels projected in the limits */
 				       };
 
 /********/
 /* Cube */
 /********/
 
+typedef struct _HklBinocularsCubeStripes HklBinocularsCubeStripes;
+
+/* the photons and the contributions of a bin side by side */
+typedef struct _HklBinocularsCubeBin HklBinocularsCubeBin;
+struct _HklBinocularsCubeBin
+{
+        uint32_t photons;
+        uint32_t contributions;
+};
+
+/* the narrow counters of an accumulating cube, the bins are split
+ * in tiles of HKL_BINOCULARS_CUBE_NARROW_TILE uint16_t counters. A
+ * tile is promoted to uint32_t when one of its counters would
+ * overflow, its uint16_t counters are not used anymore. */
+#define HKL_BINOCULARS_CUBE_NARROW_TILE 4096
+
+typedef struct _HklBinocularsCubeCounters HklBinocularsCubeCounters;
+struct _HklBinocularsCubeCounters
+{
+        uint16_t *small;
+        uint32_t **wide; /* the promoted tiles or NULL */
+};
+
+typedef struct _HklBinocularsCubeNarrow HklBinocularsCubeNarrow;
+struct _HklBinocularsCubeNarrow
+{
+        size_t n_tiles;
+        HklBinocularsCubeCounters photons;
+        HklBinocularsCubeCounters contributions;
+};
+
 struct _HklBinocularsCube
 {
-        darray_axis axes;
+        darray_axis axes; /* the bounds of the data */
+        darray_axis storage; /* the bounds of the allocated arrays, contains the axes */
         ptrdiff_t offset0;
 	unsigned int *photons;
 	unsigned int *contributions;
+        int weighted; /* the intensities and variances are accumulated */
+        double *intensities; /* the sum of the corrected counts */
+        double *variances; /* the sum of the squared corrections times the counts */
+        size_t mapped; /* the number of bins of the mapped arrays, 0 if malloced */
+        HklBinocularsCubeStripes *stripes; /* the locks of a shared cube or NULL */
+        HklBinocularsCubeBin *bins; /* replace photons and contributions while interleaved, or NULL */
+        HklBinocularsCubeNarrow *narrow; /* replace photons and contributions while narrow, or NULL */
 };
 
 static inline size_t axis_size(const HklBinocularsAxis *self)
@@ -84,6 +139,187 @@ static inline size_t axis_size(const HklBinocularsAxis *self)
 	return self->imax - self->imin + 1;
 }
 
+/* the bin of the axis factor times coarser which contains the bin
+ * i, floor((i + factor / 2) / factor) */
+static inline ptrdiff_t axis_rebin_index(ptrdiff_t i, size_t factor)
+{
+        ptrdiff_t f = factor > 1 ? factor : 1;
+        ptrdiff_t n = i + f / 2;
+
+        return n >= 0 ? n / f : -((f - 1 - n) / f);
+}
+
+static inline HklBinocularsAxis axis_rebin(const HklBinocularsAxis *self, size_t factor)
+{
+        HklBinocularsAxis axis = *self;
+
+        if(factor > 1){
+                axis.resolution = self->resolution * factor;
+                axis.imin = axis_rebin_index(self->imin, factor);
+                axis.imax = axis_rebin_index(self->imax, factor);
+        }
+
+        return axis;
+}
+
+/* restrict the axes to the bins [imin[i], imax[i]], return FALSE if
+ * they do not overlap */
+static inline int axes_slice(darray_axis *axes,
+                             const ptrdiff_t *imin, const ptrdiff_t *imax)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(*axes); ++i){
+                HklBinocularsAxis *axis = &darray_item(*axes, i);
+
+                if(imin[i] > axis->imin)
+                        axis->imin = imin[i];
+                if(imax[i] < axis->imax)
+                        axis->imax = imax[i];
+                if(axis->imin > axis->imax)
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* check if the storage of the cube is exactly its axes */
+static inline int cube_is_compact(const HklBinocularsCube *self)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(self->axes); ++i){
+                const HklBinocularsAxis *axis = &darray_item(self->axes, i);
+                const HklBinocularsAxis *storage = &darray_item(self->storage, i);
+
+                if (axis->imin != storage->imin || axis->imax != storage->imax)
+                        return 0;
+        }
+
+        return 1;
+}
+
+/* a zeroed compact cube with these axes */
+extern HklBinocularsCube *hkl_binoculars_cube_new_from_axes(const darray_axis *axes);
+
+/* the same with or without the intensities and the variances */
+extern HklBinocularsCube *hkl_binoculars_cube_new_from_axes_weighted(const darray_axis *axes,
+                                                                     int weighted);
+
+/* a zeroed compact cube with the union of the axes of the non empty
+ * cubes, ready to be filled with hkl_binoculars_cube_merge_slab */
+extern HklBinocularsCube *hkl_binoculars_cube_new_merge_axes(size_t n_cubes,
+                                                             const HklBinocularsCube *const *cubes);
+
+/* the union of the axes of the non empty cubes, no axis if there is
+ * none */
+extern void hkl_binoculars_cubes_merge_axes(size_t n_cubes,
+                                            const HklBinocularsCube *const *cubes,
+                                            darray_axis *axes);
+
+/* compute the normalised difference of the slab [start, end) of the
+ * slowest of the axes, see
+ * hkl_binoculars_cube_normalised_difference_save_hdf5. values and
+ * variances have room for all the bins of the slab. */
+extern void hkl_binoculars_cube_normalised_difference_slab(const darray_axis *axes,
+                                                           const HklBinocularsCube *sample,
+                                                           const HklBinocularsCube *background,
+                                                           double scale,
+                                                           size_t start, size_t end,
+                                                           double *values,
+                                                           double *variances);
+
+/* a zeroed compact cube with the axes of src rebinned by factors */
+extern HklBinocularsCube *hkl_binoculars_cube_new_rebin_axes(const HklBinocularsCube *src,
+                                                             const size_t *factors);
+
+/* add the bins of the slab [start, end) of the slowest axis of src
+ * into self, a cube made by hkl_binoculars_cube_new_rebin_axes */
+extern void hkl_binoculars_cube_rebin_slab(HklBinocularsCube *self,
+                                           const HklBinocularsCube *src,
+                                           const size_t *factors,
+                                           size_t start, size_t end);
+
+/* add the slab [start, end) of the slowest axis of the cubes into
+ * self, the slabs can be merged by different threads. */
+extern void hkl_binoculars_cube_merge_slab(HklBinocularsCube *self,
+                                           const HklBinocularsCube *const *cubes,
+                                           size_t n_cubes,
+                                           size_t start, size_t end);
+
+/***************/
+/* Sparse Cube */
+/***************/
+
+typedef struct _HklBinocularsSparseBin HklBinocularsSparseBin;
+struct _HklBinocularsSparseBin
+{
+        ptrdiff_t indexes[3]; /* absolute indexes, like HklBinocularsSpaceItem */
+        uint32_t photons;
+        uint32_t contributions;
+};
+
+typedef darray(HklBinocularsSparseBin) darray_HklBinocularsSparseBin;
+
+struct _HklBinocularsSparseCube
+{
+        darray_axis axes; /* the bounds of the data */
+        darray_HklBinocularsSparseBin bins; /* sorted and unique */
+        darray_HklBinocularsSparseBin pending; /* added since the last sort */
+};
+
+/* sort the pending bins and merge them into the bins */
+extern void hkl_binoculars_sparse_cube_compact(HklBinocularsSparseCube *self);
+
+/* the indexes of the bins in the dense counts array (the axes of size
+ * 1 are squeezed). Return the number of columns. */
+extern size_t hkl_binoculars_sparse_cube_dense_indexes(HklBinocularsSparseCube *self,
+                                                       int64_t **indexes);
+
+/* the dense cube of the axes from the n_bins rows of indexes written
+ * by hkl_binoculars_sparse_cube_dense_indexes and their counts and
+ * contributions. Return NULL if the columns or an index do not match
+ * the axes. */
+extern HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_arrays(const darray_axis *axes,
+                                                                     size_t n_bins,
+                                                                     size_t n_columns,
+                                                                     const int64_t *indexes,
+                                                                     const uint32_t *counts,
+                                                                     const uint32_t *contributions);
+
+/***************/
+/* Expressions */
+/***************/
+
+/* the variables of a pixel available to the expressions */
+typedef enum _HklBinocularsExpressionVariableEnum
+{
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_QX = 0,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_QY,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_QZ,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_Q,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_QPAR,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_QPER,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_TTH,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_AZIMUTH,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_KFX,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_KFY,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_KFZ,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_TIMESTAMP,
+        HKL_BINOCULARS_EXPRESSION_VARIABLE_SAMPLEAXIS,
+        HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES,
+} HklBinocularsExpressionVariableEnum;
+
+/* the variables read by the expression, one bit per variable */
+extern unsigned int hkl_binoculars_expression_variables_get(const HklBinocularsExpression *self);
+
+/* compute the values of the expression for n pixels, variables[v]
+ * are the n values of the variable v, only the ones read by the
+ * expression are used. */
+extern void hkl_binoculars_expression_eval(const HklBinocularsExpression *self,
+                                           const double *const *variables,
+                                           size_t n, double *values);
+
 /************/
 /* Geometry */
 /************/
@@ -92,5 +328,8 @@ extern mat4s hkl_binoculars_parameter_transformation_get(const HklParameter *sel
 
 extern mat4s hkl_binoculars_holder_transformation_get(const HklHolder *self);
 
+/* the inverse of hkl_binoculars_holder_transformation_get */
+extern mat4s hkl_binoculars_holder_inverse_transformation_get(const HklHolder *self);
+
 
 #endif
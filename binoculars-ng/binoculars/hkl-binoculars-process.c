@@ -0,0 +1,1010 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hdf5.h>
+
+#include "datatype99.h"
+#include "hkl/ccan/array_size/array_size.h"
+#include "hkl-binoculars.h"
+#include "hkl-binoculars-config-private.h"
+
+#define SUCCESS 0
+#define FAILED -1
+
+/* the hdf5 library is not thread safe, all the workers read their
+ * frames under this lock */
+static GMutex hdf5_lock;
+
+/*********/
+/* Input */
+/*********/
+
+/* a data file with its images dataset and the positions of all the
+ * axes of the geometry for each frame, read once before the
+ * projection */
+typedef struct _HklBinocularsInput HklBinocularsInput;
+struct _HklBinocularsInput
+{
+	char *filename;
+	hid_t file_id;
+	hid_t dataset_id;
+	size_t n_frames;
+	size_t first; /* the projected frames are [first, last) */
+	size_t last;
+	size_t n_axes;
+	double *positions; /* n_frames x n_axes in degree */
+	int rank; /* 3 for the images, 2 for the modules of strip detectors */
+	hsize_t offset; /* of the module in the strips */
+	/* for the read-ahead hints */
+	int fd; /* of the file, -1 if unknown */
+	haddr_t address; /* of the contiguous images, HADDR_UNDEF otherwise */
+	hsize_t frame_bytes; /* of a stored frame */
+	hsize_t frames_per_chunk; /* of the chunks holding whole frames, 0 otherwise */
+};
+
+typedef darray(HklBinocularsInput) darray_input;
+
+static int is_hdf5(const char *filename)
+{
+	return g_str_has_suffix(filename, ".h5")
+		|| g_str_has_suffix(filename, ".hdf5")
+		|| g_str_has_suffix(filename, ".nxs");
+}
+
+/* like binoculars-ng, a file is selected when the number of one of
+ * the ranges formatted with the input template is part of its name */
+static int is_in_input_ranges(const char *basename, const char *tmpl,
+			      const darray_input_range *ranges)
+{
+	InputRange *range;
+
+	darray_foreach(range, *ranges){
+		int from = 0;
+		int to = -1;
+		int n;
+
+		match(*range){
+			of(InputRange_FromTo, f, t){
+				from = *f;
+				to = *t;
+			}
+			of(InputRange_At, at){
+				from = *at;
+				to = *at;
+			}
+		}
+
+		for(n=from; n<=to; ++n){
+			char *needle = g_strdup_printf(tmpl, n);
+			int found = NULL != strstr(basename, needle);
+
+			g_free(needle);
+			if(found)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void files_walk(const char *dirname, const HklBinocularsConfig *config,
+		       GPtrArray *files)
+{
+	const char *name;
+	GDir *dir = g_dir_open(dirname, 0, NULL);
+
+	if(NULL == dir)
+		return;
+
+	while(NULL != (name = g_dir_read_name(dir))){
+		char *path = g_build_filename(dirname, name, NULL);
+
+		if(g_file_test(path, G_FILE_TEST_IS_DIR))
+			files_walk(path, config, files);
+		else if(is_hdf5(name)
+			&& is_in_input_ranges(name, config->input_tmpl, &config->input_ranges)){
+			g_ptr_array_add(files, path);
+			continue;
+		}
+		g_free(path);
+	}
+
+	g_dir_close(dir);
+}
+
+static gint files_cmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* read the positions of the axis (one per frame or a scalar) into
+ * the column i of the positions of the input */
+static int input_axis_read(HklBinocularsInput *self,
+			   const HklBinocularsConfigAxis *axis, size_t i)
+{
+	int res = FALSE;
+	hid_t dataset_id;
+	hid_t space_id;
+	hssize_t n;
+	double *values;
+	size_t j;
+
+	dataset_id = H5Dopen(self->file_id, axis->path, H5P_DEFAULT);
+	if(dataset_id < 0)
+		goto out;
+
+	space_id = H5Dget_space(dataset_id);
+	if(space_id < 0)
+		goto close_dataset;
+
+	n = H5Sget_simple_extent_npoints(space_id);
+	if(n != 1 && n < (hssize_t)self->n_frames)
+		goto close_space;
+
+	values = g_new(double, n);
+	if(H5Dread(dataset_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values) >= 0){
+		for(j=0; j<self->n_frames; ++j)
+			self->positions[j * self->n_axes + i] = values[1 == n ? 0 : j];
+		res = TRUE;
+	}
+	g_free(values);
+
+close_space:
+	H5Sclose(space_id);
+close_dataset:
+	H5Dclose(dataset_id);
+out:
+	if(!res)
+		fprintf(stderr, "Can not read the %s positions from %s in %s\n",
+			axis->name, axis->path, self->filename);
+	return res;
+}
+
+static void input_close(HklBinocularsInput *self)
+{
+	if(self->dataset_id >= 0)
+		H5Dclose(self->dataset_id);
+	if(self->file_id >= 0)
+		H5Fclose(self->file_id);
+	g_free(self->positions);
+	g_free(self->filename);
+}
+
+/* the chunk cache of the images holds the chunks of a frame for each
+ * core, so the chunks spanning several frames are decompressed once
+ * whatever the order of the frames claimed by the workers. Return 0
+ * for the default cache. */
+static size_t input_chunk_cache_get(const HklBinocularsInput *self,
+				    const HklBinocularsConfig *config,
+				    size_t *n_slots)
+{
+	size_t res = 0;
+	hid_t dcpl = H5Dget_create_plist(self->dataset_id);
+	hid_t space_id = H5Dget_space(self->dataset_id);
+	hid_t type_id = H5Dget_type(self->dataset_id);
+	hsize_t dims[3];
+	hsize_t chunk[3];
+
+	if(H5D_CHUNKED == H5Pget_layout(dcpl)
+	   && self->rank == H5Pget_chunk(dcpl, self->rank, chunk)
+	   && H5Sget_simple_extent_dims(space_id, dims, NULL) >= 0){
+		size_t chunk_bytes = H5Tget_size(type_id) * chunk[0];
+		size_t n_chunks = 1;
+		int i;
+
+		for(i=1; i<self->rank; ++i){
+			chunk_bytes *= chunk[i];
+			n_chunks *= (dims[i] + chunk[i] - 1) / chunk[i];
+		}
+		res = config->chunk_cache > 0
+			? (size_t)config->chunk_cache << 20
+			: chunk_bytes * n_chunks * MAX(1, config->ncores);
+		/* about ten slots per cached chunk */
+		*n_slots = MAX(521, 10 * res / MAX(1, chunk_bytes));
+	}
+
+	H5Tclose(type_id);
+	H5Sclose(space_id);
+	H5Pclose(dcpl);
+
+	return res > (1 << 20) ? res : 0;
+}
+
+/* where the frames are stored in the file, used to hint the kernel
+ * about the frames read next */
+static void input_layout_get(HklBinocularsInput *self, const hsize_t *dims)
+{
+	hid_t dcpl = H5Dget_create_plist(self->dataset_id);
+	hid_t type_id = H5Dget_type(self->dataset_id);
+	hsize_t chunk[3];
+	int *fd;
+
+	self->fd = -1;
+	self->address = HADDR_UNDEF;
+	self->frames_per_chunk = 0;
+	self->frame_bytes = H5Tget_size(type_id) * dims[1] * (3 == self->rank ? dims[2] : 1);
+
+	/* the sec2 driver gives its file descriptor */
+	if(H5Fget_vfd_handle(self->file_id, H5P_DEFAULT, (void **)&fd) >= 0 && NULL != fd){
+		self->fd = *fd;
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	switch(H5Pget_layout(dcpl)){
+	case H5D_CONTIGUOUS:
+		self->address = H5Dget_offset(self->dataset_id);
+		break;
+	case H5D_CHUNKED:
+		if(self->rank == H5Pget_chunk(dcpl, self->rank, chunk)
+		   && chunk[1] == dims[1]
+		   && (2 == self->rank || chunk[2] == dims[2]))
+			self->frames_per_chunk = chunk[0];
+		break;
+	default:
+		break;
+	}
+
+	H5Tclose(type_id);
+	H5Pclose(dcpl);
+}
+
+/* ask the kernel to read the n frames from index in the background,
+ * must be called with the hdf5 lock */
+static void input_frames_advise(const HklBinocularsInput *self, size_t index, size_t n)
+{
+#ifdef POSIX_FADV_WILLNEED
+	n = MIN(n, self->n_frames - MIN(index, self->n_frames));
+	if(self->fd < 0 || 0 == n)
+		return;
+
+	if(HADDR_UNDEF != self->address)
+		posix_fadvise(self->fd, self->address + index * self->frame_bytes,
+			      n * self->frame_bytes, POSIX_FADV_WILLNEED);
+#if H5_VERSION_GE(1, 10, 5)
+	else if(self->frames_per_chunk > 0){
+		hsize_t c;
+
+		for(c=index / self->frames_per_chunk;
+		    c<=(index + n - 1) / self->frames_per_chunk;
+		    ++c){
+			hsize_t offset[3] = {c * self->frames_per_chunk, 0, 0};
+			unsigned int filter_mask;
+			haddr_t address;
+			hsize_t size;
+
+			if(H5Dget_chunk_info_by_coord(self->dataset_id, offset, &filter_mask,
+						      &address, &size) >= 0
+			   && HADDR_UNDEF != address)
+				posix_fadvise(self->fd, address, size, POSIX_FADV_WILLNEED);
+		}
+	}
+#endif
+#endif
+}
+
+static int input_open(HklBinocularsInput *self, const char *filename,
+		      const HklBinocularsConfig *config,
+		      const darray_string *axes_names,
+		      int width, int height)
+{
+	hid_t space_id;
+	hsize_t dims[3];
+	int valid;
+	const HklBinocularsConfigAxis *axis;
+	size_t skip;
+	size_t cache;
+	size_t n_slots;
+
+	*self = (HklBinocularsInput){
+		.filename = g_strdup(filename),
+		.file_id = -1,
+		.dataset_id = -1,
+		.n_axes = darray_size(*axes_names),
+	};
+
+	self->file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+	if(self->file_id < 0){
+		fprintf(stderr, "Can not open the file %s\n", filename);
+		goto fail;
+	}
+
+	self->dataset_id = H5Dopen(self->file_id, config->image_path, H5P_DEFAULT);
+	if(self->dataset_id < 0){
+		fprintf(stderr, "Can not open the images %s of %s\n", config->image_path, filename);
+		goto fail;
+	}
+
+	/* the strip detectors save all their modules side by side in
+	 * (frames, strips) datasets, the config module select one */
+	space_id = H5Dget_space(self->dataset_id);
+	if(space_id >= 0){
+		self->rank = H5Sget_simple_extent_ndims(space_id);
+		self->offset = (hsize_t)config->module * width;
+	}
+	valid = space_id >= 0
+		&& self->rank >= 2 && self->rank <= 3
+		&& H5Sget_simple_extent_dims(space_id, dims, NULL) >= 0;
+	if(valid && 3 == self->rank)
+		valid = dims[1] == (hsize_t)height && dims[2] == (hsize_t)width;
+	if(valid && 2 == self->rank)
+		valid = 1 == height && dims[1] >= self->offset + width;
+	if(!valid){
+		fprintf(stderr, "The images %s of %s do not match the %dx%d detector (module %d)\n",
+			config->image_path, filename, width, height, config->module);
+		if(space_id >= 0)
+			H5Sclose(space_id);
+		goto fail;
+	}
+	H5Sclose(space_id);
+
+	/* reopen the images with a chunk cache for the frames of all
+	 * the cores */
+	cache = input_chunk_cache_get(self, config, &n_slots);
+	if(cache > 0){
+		hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+
+		H5Pset_chunk_cache(dapl, n_slots, cache, H5D_CHUNK_CACHE_W0_DEFAULT);
+		H5Dclose(self->dataset_id);
+		self->dataset_id = H5Dopen(self->file_id, config->image_path, dapl);
+		H5Pclose(dapl);
+		if(self->dataset_id < 0){
+			fprintf(stderr, "Can not open the images %s of %s\n", config->image_path, filename);
+			goto fail;
+		}
+	}
+	input_layout_get(self, dims);
+
+	self->n_frames = dims[0];
+	skip = config->skip_first_points + config->skip_last_points;
+	self->first = config->skip_first_points;
+	self->last = skip < self->n_frames ? self->n_frames - config->skip_last_points : self->first;
+
+	/* the axes without dataset stay at zero */
+	self->positions = g_new0(double, self->n_frames * self->n_axes);
+	darray_foreach(axis, config->axes){
+		size_t i;
+
+		for(i=0; i<self->n_axes; ++i)
+			if(0 == strcmp(axis->name, darray_item(*axes_names, i)))
+				break;
+		if(i == self->n_axes){
+			fprintf(stderr, "The %s geometry has no %s axis\n", config->geometry, axis->name);
+			goto fail;
+		}
+		if(!input_axis_read(self, axis, i))
+			goto fail;
+	}
+
+	return TRUE;
+fail:
+	input_close(self);
+	return FALSE;
+}
+
+/* the memory of n frames, read one after the other */
+static hid_t frames_mem_space_new(size_t n, int width, int height)
+{
+	hid_t res;
+	hsize_t dims[1] = {n * width * height};
+
+	g_mutex_lock(&hdf5_lock);
+	res = H5Screate_simple(ARRAY_SIZE(dims), dims, NULL);
+	g_mutex_unlock(&hdf5_lock);
+
+	return res;
+}
+
+/* read the n frames from index of the images with one hyperslab
+ * into the first n images of the memory space */
+static int input_frames_read(const HklBinocularsInput *self, size_t index, size_t n,
+			     hid_t mem_space_id, int width, int height,
+			     uint32_t *images)
+{
+	herr_t err = -1;
+	hid_t file_space_id;
+	hsize_t start[3] = {index, 0, 0};
+	hsize_t count[3] = {n, height, width};
+	hsize_t mem_start[1] = {0};
+	hsize_t mem_count[1] = {n * width * height};
+
+	/* the module of the strips */
+	if(2 == self->rank){
+		start[1] = self->offset;
+		count[1] = width;
+	}
+
+	g_mutex_lock(&hdf5_lock);
+	file_space_id = H5Dget_space(self->dataset_id);
+	if(file_space_id >= 0){
+		err = H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET, start, NULL, count, NULL);
+		if(err >= 0)
+			err = H5Sselect_hyperslab(mem_space_id, H5S_SELECT_SET,
+						  mem_start, NULL, mem_count, NULL);
+		if(err >= 0)
+			err = H5Dread(self->dataset_id, H5T_NATIVE_UINT32,
+				      mem_space_id, file_space_id, H5P_DEFAULT, images);
+		H5Sclose(file_space_id);
+	}
+	g_mutex_unlock(&hdf5_lock);
+
+	if(err < 0)
+		fprintf(stderr, "Can not read the frames [%zu, %zu) of %s\n",
+			index, index + n, self->filename);
+
+	return err >= 0;
+}
+
+/***********/
+/* Process */
+/***********/
+
+/* a frame of an input */
+typedef struct _HklBinocularsFrame HklBinocularsFrame;
+struct _HklBinocularsFrame
+{
+	size_t input;
+	size_t index;
+};
+
+/* everything shared by the workers, read only except next and
+ * failed */
+typedef struct _HklBinocularsProcess HklBinocularsProcess;
+struct _HklBinocularsProcess
+{
+	const HklBinocularsConfig *config;
+	darray_input inputs;
+	HklBinocularsFrame *frames;
+	gint n_frames;
+	gint next; /* the next frame to project */
+	gint failed;
+	HklGeometry *geometry;
+	int width;
+	int height;
+	double *pixels_coordinates;
+	size_t pixels_coordinates_dims[3];
+	uint8_t *masked;
+};
+
+/* the number of consecutive frames of the same input from i, at most
+ * last - i */
+static gint frames_run_get(const HklBinocularsProcess *self, gint i, gint last)
+{
+	gint n = 1;
+
+	while(i + n < last && self->frames[i + n].input == self->frames[i].input)
+		++n;
+
+	return n;
+}
+
+/* hint the kernel about the frames [i, last) */
+static void process_frames_advise(const HklBinocularsProcess *self, gint i, gint last)
+{
+	last = MIN(last, self->n_frames);
+
+	g_mutex_lock(&hdf5_lock);
+	while(i < last){
+		const HklBinocularsFrame *frame = &self->frames[i];
+		gint n = frames_run_get(self, i, last);
+
+		input_frames_advise(&darray_item(self->inputs, frame->input), frame->index, n);
+		i += n;
+	}
+	g_mutex_unlock(&hdf5_lock);
+}
+
+/* each worker projects the frames it claims with its own geometry
+ * and, for each projection of the config, its own plan and space
+ * into its own cube. A frame is read once for all the projections
+ * and the plans share the kf of the pixels computed by the first
+ * one (the kf table of the thread). */
+typedef struct _HklBinocularsWorker HklBinocularsWorker;
+struct _HklBinocularsWorker
+{
+	HklBinocularsProcess *process;
+	size_t n_projections;
+	HklBinocularsQCustomPlan **plans;
+	HklGeometry *geometry;
+	HklBinocularsSpace **spaces;
+	HklBinocularsCube **cubes;
+	uint32_t *image;
+	size_t n_frames; /* projected by the worker */
+};
+
+static void worker_init(HklBinocularsWorker *self, HklBinocularsProcess *process)
+{
+	const HklBinocularsConfig *config = process->config;
+	size_t i;
+
+	self->process = process;
+	self->n_projections = darray_size(config->projections);
+	self->plans = g_new(HklBinocularsQCustomPlan *, self->n_projections);
+	self->spaces = g_new(HklBinocularsSpace *, self->n_projections);
+	self->cubes = g_new(HklBinocularsCube *, self->n_projections);
+	for(i=0; i<self->n_projections; ++i){
+		const HklBinocularsConfigProjection *projection = &darray_item(config->projections, i);
+
+		self->plans[i] = hkl_binoculars_qcustom_plan_new(process->pixels_coordinates,
+								 ARRAY_SIZE(process->pixels_coordinates_dims),
+								 process->pixels_coordinates_dims,
+								 projection->resolutions,
+								 projection->n_resolutions,
+								 process->masked,
+								 config->surface_orientation,
+								 NULL, 0,
+								 projection->subprojection,
+								 0, 0, 0,
+								 projection->sample_axis,
+								 config->polarization_correction);
+		hkl_binoculars_qcustom_plan_expressions_set(self->plans[i],
+							    (const HklBinocularsExpression *const *)projection->expressions,
+							    projection->n_expressions);
+		self->spaces[i] = hkl_binoculars_space_new(process->width * process->height,
+							   hkl_binoculars_qcustom_plan_n_axes(self->plans[i]));
+		self->cubes[i] = hkl_binoculars_cube_new_empty();
+	}
+	self->geometry = hkl_geometry_new_copy(process->geometry);
+	self->image = g_new(uint32_t, (size_t)config->read_ahead * process->width * process->height);
+	self->n_frames = 0;
+}
+
+static void worker_release(HklBinocularsWorker *self)
+{
+	size_t i;
+
+	g_free(self->image);
+	hkl_geometry_free(self->geometry);
+	for(i=0; i<self->n_projections; ++i){
+		hkl_binoculars_cube_free(self->cubes[i]);
+		hkl_binoculars_space_free(self->spaces[i]);
+		hkl_binoculars_qcustom_plan_free(self->plans[i]);
+	}
+	g_free(self->cubes);
+	g_free(self->spaces);
+	g_free(self->plans);
+}
+
+/* project the frame index of the input from its image */
+static int worker_project(HklBinocularsWorker *self, const HklBinocularsInput *input,
+			  size_t index, const uint32_t *image)
+{
+	size_t j;
+
+	if(!hkl_geometry_axis_values_set(self->geometry,
+					 &input->positions[index * input->n_axes],
+					 input->n_axes, HKL_UNIT_USER, NULL))
+		return FALSE;
+
+	for(j=0; j<self->n_projections; ++j){
+		hkl_binoculars_space_qcustom_plan_uint32_t(self->spaces[j], self->plans[j],
+							   self->geometry, image,
+							   1.0, index);
+		hkl_binoculars_cube_add_space(self->cubes[j], self->spaces[j]);
+	}
+	self->n_frames++;
+
+	return TRUE;
+}
+
+static gpointer worker_run(gpointer data)
+{
+	HklBinocularsWorker *self = data;
+	HklBinocularsProcess *process = self->process;
+	gint n_ahead = process->config->read_ahead;
+	size_t n_pixels = process->width * process->height;
+	hid_t mem_space_id;
+
+	mem_space_id = frames_mem_space_new(n_ahead, process->width, process->height);
+	if(mem_space_id < 0){
+		g_atomic_int_set(&process->failed, TRUE);
+		return NULL;
+	}
+
+	/* the workers claim n_ahead frames at a time and read the
+	 * consecutive frames of an input with one hyperslab */
+	while(!g_atomic_int_get(&process->failed)){
+		gint i = g_atomic_int_add(&process->next, n_ahead);
+		gint last;
+
+		if(i >= process->n_frames)
+			break;
+		last = MIN(i + n_ahead, process->n_frames);
+
+		/* the next claimed frames are read by the kernel while
+		 * these ones are projected */
+		if(n_ahead > 1)
+			process_frames_advise(process, last, last + n_ahead);
+
+		while(i < last){
+			const HklBinocularsFrame *frame = &process->frames[i];
+			const HklBinocularsInput *input = &darray_item(process->inputs, frame->input);
+			gint n = frames_run_get(process, i, last);
+			gint k;
+
+			if(!input_frames_read(input, frame->index, n, mem_space_id,
+					      process->width, process->height, self->image))
+				goto fail;
+			for(k=0; k<n; ++k)
+				if(!worker_project(self, input, frame->index + k,
+						   &self->image[k * n_pixels]))
+					goto fail;
+			i += n;
+		}
+	}
+	goto out;
+
+fail:
+	g_atomic_int_set(&process->failed, TRUE);
+out:
+	g_mutex_lock(&hdf5_lock);
+	H5Sclose(mem_space_id);
+	g_mutex_unlock(&hdf5_lock);
+
+	return NULL;
+}
+
+static char *replace(char *str, const char *old, const char *new)
+{
+	char **parts = g_strsplit(str, old, -1);
+	char *res = g_strjoinv(new, parts);
+
+	g_strfreev(parts);
+	g_free(str);
+
+	return res;
+}
+
+/* the destination template like binoculars-ng, without overwrite
+ * the first free name_<nn>.ext is used. The {projection} of the
+ * sections other than [projection] is followed by the rest of their
+ * name, qx_qy_qz_fine for [projection.fine] */
+static char *destination_get(const HklBinocularsConfig *config,
+			     const HklBinocularsConfigProjection *projection)
+{
+	const char *suffix = projection->section + strlen("projection");
+	InputRange *range;
+	int first = G_MAXINT;
+	int last = G_MININT;
+	char *destination;
+	char *tmp;
+	int i;
+
+	darray_foreach(range, config->input_ranges){
+		match(*range){
+			of(InputRange_FromTo, from, to){
+				first = MIN(first, *from);
+				last = MAX(last, *to);
+			}
+			of(InputRange_At, at){
+				first = MIN(first, *at);
+				last = MAX(last, *at);
+			}
+		}
+	}
+
+	destination = g_strdup(config->destination_tmpl);
+	tmp = g_strdup_printf("%d", last);
+	destination = replace(destination, "{last}", tmp);
+	g_free(tmp);
+	tmp = g_strdup_printf("%d", first);
+	destination = replace(destination, "{first}", tmp);
+	g_free(tmp);
+	destination = replace(destination, "{limits}", "nolimits");
+	suffix += strspn(suffix, "._-: ");
+	tmp = '\0' == suffix[0]
+		? g_strdup(subprojection_as_string(projection->subprojection))
+		: g_strdup_printf("%s_%s", subprojection_as_string(projection->subprojection), suffix);
+	destination = replace(destination, "{projection}", tmp);
+	g_free(tmp);
+
+	if(config->overwrite || !g_file_test(destination, G_FILE_TEST_EXISTS))
+		return destination;
+
+	for(i=1; ; ++i){
+		char *basename = strrchr(destination, G_DIR_SEPARATOR);
+		char *ext = strchr(NULL == basename ? destination : basename, '.');
+		size_t n = NULL == ext ? strlen(destination) : (size_t)(ext - destination);
+		char *fn = g_strdup_printf("%.*s_%02d%s", (int)n, destination, i,
+					   NULL == ext ? "" : ext);
+
+		if(!g_file_test(fn, G_FILE_TEST_EXISTS)){
+			g_free(destination);
+			return fn;
+		}
+		g_free(fn);
+	}
+}
+
+/* mask the hot pixels of the first frames before the workers build
+ * their plans from the mask */
+static int process_hot_pixels(HklBinocularsProcess *self, int verbosity)
+{
+	int res = FAILED;
+	size_t n_pixels = self->width * self->height;
+	size_t n = MIN((size_t)self->config->hot_pixels_frames, (size_t)self->n_frames);
+	hid_t mem_space_id;
+	uint32_t *image;
+	HklBinocularsHotPixels *hot;
+	size_t i;
+
+	mem_space_id = frames_mem_space_new(1, self->width, self->height);
+	if(mem_space_id < 0)
+		return FAILED;
+
+	image = g_new(uint32_t, n_pixels);
+	hot = hkl_binoculars_detector_2d_hot_pixels_new(n_pixels, n);
+	for(i=0; i<n; ++i){
+		const HklBinocularsFrame *frame = &self->frames[i];
+
+		if(!input_frames_read(&darray_item(self->inputs, frame->input), frame->index, 1,
+				      mem_space_id, self->width, self->height, image))
+			goto out;
+		hkl_binoculars_detector_2d_hot_pixels_add_frame_uint32(hot, image);
+	}
+
+	if(NULL == self->masked)
+		self->masked = g_new0(uint8_t, n_pixels);
+	n = hkl_binoculars_detector_2d_hot_pixels_mask(hot, self->masked,
+						       self->config->hot_pixels_threshold);
+	if(verbosity > 0)
+		fprintf(stdout, "hot pixels: %zu\n", n);
+	res = SUCCESS;
+out:
+	hkl_binoculars_detector_2d_hot_pixels_free(hot);
+	g_free(image);
+	g_mutex_lock(&hdf5_lock);
+	H5Sclose(mem_space_id);
+	g_mutex_unlock(&hdf5_lock);
+
+	return res;
+}
+
+static int process_init(HklBinocularsProcess *self, const HklBinocularsConfig *config,
+			int verbosity)
+{
+	const HklFactory *factory;
+	GPtrArray *files;
+	HklBinocularsInput *input;
+	size_t i;
+	size_t j;
+	size_t n;
+
+	*self = (HklBinocularsProcess){
+		.config = config,
+	};
+	darray_init(self->inputs);
+
+	factory = hkl_factory_get_by_name(config->geometry, NULL);
+	if(NULL == factory){
+		fprintf(stderr, "Unknown geometry %s\n", config->geometry);
+		return FAILED;
+	}
+	self->geometry = hkl_factory_create_new_geometry(factory);
+	if(!hkl_geometry_wavelength_set(self->geometry, config->wavelength, HKL_UNIT_USER, NULL)){
+		fprintf(stderr, "Can not set the wavelength %f\n", config->wavelength);
+		return FAILED;
+	}
+
+	hkl_binoculars_detector_2d_shape_get(config->detector, &self->width, &self->height);
+	self->pixels_coordinates_dims[0] = 3;
+	self->pixels_coordinates_dims[1] = self->height;
+	self->pixels_coordinates_dims[2] = self->width;
+	if(NULL != config->coordinates_cache)
+		hkl_binoculars_detector_2d_coordinates_cache_dir_set(config->coordinates_cache);
+	self->pixels_coordinates = hkl_binoculars_detector_2d_calibrated_coordinates_get(config->detector,
+											 config->central_pixel[0],
+											 config->central_pixel[1],
+											 config->sdd,
+											 config->detrot * HKL_DEGTORAD,
+											 0);
+
+	if(NULL != config->mask_location){
+		if(0 == strcmp(config->mask_location, "default"))
+			self->masked = hkl_binoculars_detector_2d_mask_get(config->detector);
+		else
+			self->masked = hkl_binoculars_detector_2d_mask_load(config->detector,
+									    config->mask_location);
+		if(NULL == self->masked){
+			fprintf(stderr, "Can not load the mask %s\n", config->mask_location);
+			return FAILED;
+		}
+	}
+
+	/* the inputs, sorted by name like binoculars-ng */
+	files = g_ptr_array_new_with_free_func(g_free);
+	files_walk(NULL == config->nexus_dir ? "." : config->nexus_dir, config, files);
+	g_ptr_array_sort(files, files_cmp);
+	if(0 == files->len){
+		fprintf(stderr, "No data files under %s\n",
+			NULL == config->nexus_dir ? "." : config->nexus_dir);
+		g_ptr_array_free(files, TRUE);
+		return FAILED;
+	}
+
+	for(i=0; i<files->len; ++i){
+		HklBinocularsInput tmp;
+
+		if(!input_open(&tmp, g_ptr_array_index(files, i), config,
+			       hkl_geometry_axis_names_get(self->geometry),
+			       self->width, self->height)){
+			g_ptr_array_free(files, TRUE);
+			return FAILED;
+		}
+		darray_append(self->inputs, tmp);
+		if(verbosity > 1)
+			fprintf(stdout, "%s: frames [%zu, %zu)\n", tmp.filename, tmp.first, tmp.last);
+	}
+	g_ptr_array_free(files, TRUE);
+
+	/* the frames claimed by the workers */
+	n = 0;
+	darray_foreach(input, self->inputs)
+		n += input->last - input->first;
+	if(0 == n || n > G_MAXINT){
+		fprintf(stderr, "Can not project %zu frames\n", n);
+		return FAILED;
+	}
+	self->frames = g_new(HklBinocularsFrame, n);
+	self->n_frames = n;
+	n = 0;
+	for(i=0; i<darray_size(self->inputs); ++i){
+		input = &darray_item(self->inputs, i);
+		for(j=input->first; j<input->last; ++j){
+			self->frames[n].input = i;
+			self->frames[n].index = j;
+			n++;
+		}
+	}
+
+	if(config->hot_pixels_frames > 0)
+		return process_hot_pixels(self, verbosity);
+
+	return SUCCESS;
+}
+
+static void process_release(HklBinocularsProcess *self)
+{
+	HklBinocularsInput *input;
+
+	darray_foreach(input, self->inputs){
+		input_close(input);
+	}
+	darray_free(self->inputs);
+	g_free(self->frames);
+	free(self->masked);
+	free(self->pixels_coordinates);
+	if(NULL != self->geometry)
+		hkl_geometry_free(self->geometry);
+}
+
+int hkl_binoculars_process(const char *filename,
+			   const darray_input_range *ranges,
+			   int verbosity)
+{
+	int res = FAILED;
+	size_t i;
+	size_t n_workers;
+	HklBinocularsConfig *config;
+	HklBinocularsProcess process;
+	HklBinocularsWorker *workers;
+	GThread **threads;
+	gint64 t0;
+
+	config = hkl_binoculars_config_new(filename);
+	if(NULL == config)
+		goto out;
+
+	/* the command line ranges replace the ones of the config */
+	if(NULL != ranges && darray_size(*ranges) > 0){
+		darray_free(config->input_ranges);
+		darray_init(config->input_ranges);
+		darray_append_items(config->input_ranges, ranges->item, darray_size(*ranges));
+	}
+	if(0 == darray_size(config->input_ranges)){
+		fprintf(stderr, "please provide an input range either in the config file with the \"inputrange\" key under the \"input\" section, or on the command line\n");
+		goto free_config;
+	}
+
+	t0 = g_get_monotonic_time();
+
+	if(SUCCESS != process_init(&process, config, verbosity))
+		goto release_process;
+
+	n_workers = MIN(config->ncores, g_get_num_processors());
+	n_workers = MAX(1, MIN(n_workers, (size_t)process.n_frames));
+	workers = g_new(HklBinocularsWorker, n_workers);
+	threads = g_new(GThread *, n_workers);
+
+	for(i=0; i<n_workers; ++i)
+		worker_init(&workers[i], &process);
+	for(i=0; i<n_workers; ++i)
+		threads[i] = g_thread_new("binoculars-worker", worker_run, &workers[i]);
+	for(i=0; i<n_workers; ++i)
+		g_thread_join(threads[i]);
+
+	if(!g_atomic_int_get(&process.failed)){
+		size_t j;
+		int saved = TRUE;
+		HklBinocularsFramesRange *frames = g_new(HklBinocularsFramesRange, darray_size(process.inputs));
+		HklBinocularsCube **cubes = g_new(HklBinocularsCube *, n_workers);
+
+		for(i=0; i<darray_size(process.inputs); ++i){
+			const HklBinocularsInput *input = &darray_item(process.inputs, i);
+
+			frames[i].filename = input->filename;
+			frames[i].first = input->first;
+			frames[i].last = (int64_t)input->last - 1;
+		}
+		if(verbosity > 0){
+			fprintf(stdout, "%d frames of %zu files projected by %zu workers in %.3f s\n",
+				process.n_frames, darray_size(process.inputs), n_workers,
+				(g_get_monotonic_time() - t0) / 1e6);
+			for(i=0; i<n_workers; ++i)
+				fprintf(stdout, "  worker %zu: %zu frames\n", i, workers[i].n_frames);
+		}
+
+		/* one destination per projection */
+		for(j=0; j<darray_size(config->projections); ++j){
+			char *destination = destination_get(config, &darray_item(config->projections, j));
+
+			for(i=0; i<n_workers; ++i)
+				cubes[i] = workers[i].cubes[j];
+
+			if(hkl_binoculars_cubes_save_hdf5_with_frames(destination, config->content,
+								      n_workers,
+								      (const HklBinocularsCube *const *)cubes,
+								      n_workers,
+								      frames, darray_size(process.inputs))){
+				if(verbosity > 0)
+					fprintf(stdout, "[%s] saved into %s\n",
+						darray_item(config->projections, j).section, destination);
+			}else{
+				fprintf(stderr, "Can not save [%s] into %s\n",
+					darray_item(config->projections, j).section, destination);
+				saved = FALSE;
+			}
+			g_free(destination);
+		}
+
+		g_free(cubes);
+		g_free(frames);
+		if(saved)
+			res = SUCCESS;
+	}
+
+	for(i=0; i<n_workers; ++i)
+		worker_release(&workers[i]);
+	g_free(threads);
+	g_free(workers);
+release_process:
+	process_release(&process);
+free_config:
+	hkl_binoculars_config_free(config);
+out:
+	return res;
+}
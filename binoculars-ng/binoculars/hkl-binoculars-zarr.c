@@ -0,0 +1,485 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2023 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "hkl/ccan/array_size/array_size.h"
+#include "hkl-binoculars-private.h"
+
+/* the chunks contain about 1MiB of uint32, like the hdf5 ones */
+#define HKL_BINOCULARS_ZARR_CHUNK_SIZE (256 * 1024)
+
+/* the level of the gzip codec, like the deflate of the hdf5 files */
+#define HKL_BINOCULARS_ZARR_GZIP_LEVEL 1
+
+typedef struct _HklBinocularsZarrArray HklBinocularsZarrArray;
+struct _HklBinocularsZarrArray
+{
+        const char *name;
+        const char *data_type;
+        const char *fill_value;
+        size_t size; /* of an element */
+};
+
+/* the arrays of the weighted cubes, the others only have the first two */
+static const HklBinocularsZarrArray zarr_arrays[] = {
+        {"counts", "uint32", "0", sizeof(uint32_t)},
+        {"contributions", "uint32", "0", sizeof(uint32_t)},
+        {"intensities", "float64", "0.0", sizeof(double)},
+        {"variances", "float64", "0.0", sizeof(double)},
+};
+
+static inline size_t zarr_n_arrays(int weighted)
+{
+        return weighted ? ARRAY_SIZE(zarr_arrays) : 2;
+}
+
+static inline const void *zarr_array_data(const HklBinocularsCube *cube, size_t i)
+{
+        switch(i){
+        case 0: return cube->photons;
+        case 1: return cube->contributions;
+        case 2: return cube->intensities;
+        default: return cube->variances;
+        }
+}
+
+/* compute chunk dimensions of about HKL_BINOCULARS_ZARR_CHUNK_SIZE
+ * elements, keeping the fastest dimensions complete. */
+static void chunk_dims_get(size_t rank, const size_t *dims, size_t *chunk)
+{
+        size_t i;
+        size_t n = 1;
+
+        for(i=0; i<rank; ++i){
+                chunk[i] = dims[i];
+                n *= dims[i];
+        }
+
+        for(i=0; i<rank && n > HKL_BINOCULARS_ZARR_CHUNK_SIZE; ++i){
+                size_t others = n / chunk[i];
+
+                chunk[i] = others < HKL_BINOCULARS_ZARR_CHUNK_SIZE ? HKL_BINOCULARS_ZARR_CHUNK_SIZE / others : 1;
+                n = others * chunk[i];
+        }
+}
+
+static void json_append_string(GString *json, const char *s)
+{
+        g_string_append_c(json, '"');
+        for(; *s; ++s){
+                switch(*s){
+                case '"': g_string_append(json, "\\\""); break;
+                case '\\': g_string_append(json, "\\\\"); break;
+                case '\n': g_string_append(json, "\\n"); break;
+                case '\r': g_string_append(json, "\\r"); break;
+                case '\t': g_string_append(json, "\\t"); break;
+                default:
+                        if((unsigned char)*s < 0x20)
+                                g_string_append_printf(json, "\\u%04x", *s);
+                        else
+                                g_string_append_c(json, *s);
+                }
+        }
+        g_string_append_c(json, '"');
+}
+
+static int zarr_write_file(const char *fn, const void *data, size_t n)
+{
+        GError *error = NULL;
+
+        if(!g_file_set_contents(fn, data, n, &error)){
+                fprintf(stderr, "Can not write the zarr file %s: %s\n", fn, error->message);
+                g_error_free(error);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static int zarr_mkdir(const char *dn)
+{
+        if(0 != g_mkdir_with_parents(dn, 0755)){
+                fprintf(stderr, "Can not create the zarr directory %s\n", dn);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* the group with the config and the axes in its attributes, and the
+ * metadata of its arrays */
+static int zarr_write_metadata(const char *dn, const char *config,
+                               const darray_axis *axes, const size_t *chunk,
+                               int weighted)
+{
+        size_t i;
+        int res;
+        char *fn;
+        HklBinocularsAxis *axis;
+        GString *json = g_string_new("{\n  \"zarr_format\": 3,\n  \"node_type\": \"group\",\n");
+
+        g_string_append(json, "  \"attributes\": {\n    \"config\": ");
+        json_append_string(json, config);
+        g_string_append(json, ",\n    \"axes\": [");
+        darray_foreach(axis, *axes){
+                g_string_append(json, axis == &darray_item(*axes, 0) ? "\n      " : ",\n      ");
+                g_string_append(json, "{\"name\": ");
+                json_append_string(json, axis->name);
+                g_string_append_printf(json, ", \"resolution\": %.17g, \"imin\": %td, \"imax\": %td}",
+                                       axis->resolution, axis->imin, axis->imax);
+        }
+        g_string_append(json, "]\n  }\n}\n");
+
+        res = zarr_mkdir(dn);
+        fn = g_build_filename(dn, "zarr.json", NULL);
+        res = res && zarr_write_file(fn, json->str, json->len);
+        g_free(fn);
+
+        for(i=0; res && 0 != darray_size(*axes) && i<zarr_n_arrays(weighted); ++i){
+                const HklBinocularsZarrArray *array = &zarr_arrays[i];
+                char *adn = g_build_filename(dn, array->name, NULL);
+                size_t k;
+
+                g_string_assign(json, "{\n  \"zarr_format\": 3,\n  \"node_type\": \"array\",\n  \"shape\": [");
+                for(k=0; k<darray_size(*axes); ++k)
+                        g_string_append_printf(json, k ? ", %zu" : "%zu", axis_size(&darray_item(*axes, k)));
+                g_string_append_printf(json, "],\n  \"data_type\": \"%s\",\n", array->data_type);
+                g_string_append(json, "  \"chunk_grid\": {\"name\": \"regular\", \"configuration\": {\"chunk_shape\": [");
+                for(k=0; k<darray_size(*axes); ++k)
+                        g_string_append_printf(json, k ? ", %zu" : "%zu", chunk[k]);
+                g_string_append(json, "]}},\n");
+                g_string_append(json, "  \"chunk_key_encoding\": {\"name\": \"default\", \"configuration\": {\"separator\": \"/\"}},\n");
+                g_string_append_printf(json, "  \"fill_value\": %s,\n", array->fill_value);
+                g_string_append(json, "  \"codecs\": [{\"name\": \"bytes\", \"configuration\": {\"endian\": \"little\"}}");
+#ifdef HAVE_ZLIB
+                g_string_append_printf(json, ", {\"name\": \"gzip\", \"configuration\": {\"level\": %d}}",
+                                       HKL_BINOCULARS_ZARR_GZIP_LEVEL);
+#endif
+                g_string_append(json, "],\n  \"dimension_names\": [");
+                darray_foreach(axis, *axes){
+                        if(axis != &darray_item(*axes, 0))
+                                g_string_append(json, ", ");
+                        json_append_string(json, axis->name);
+                }
+                g_string_append(json, "]\n}\n");
+
+                fn = g_build_filename(adn, "zarr.json", NULL);
+                res = zarr_mkdir(adn) && zarr_write_file(fn, json->str, json->len);
+                g_free(fn);
+                g_free(adn);
+        }
+
+        g_string_free(json, TRUE);
+
+        return res;
+}
+
+/* Chunks */
+
+typedef struct _HklBinocularsZarrSave HklBinocularsZarrSave;
+struct _HklBinocularsZarrSave
+{
+        const char *dn;
+        const darray_axis *axes;
+        const size_t *chunk;
+        int weighted;
+        const HklBinocularsCube *const *cubes;
+        size_t n_cubes;
+        size_t n_rows; /* of chunks of the slowest axis */
+        gint next; /* the next row of chunks to save */
+        gint failed;
+};
+
+/* copy the bins of the chunk of the compact slab cube into buffer,
+ * the bins of the edge chunks outside the cube stay zero */
+static void zarr_chunk_gather(const HklBinocularsCube *slab,
+                              const size_t *chunk,
+                              const size_t *first,
+                              size_t size,
+                              const void *data,
+                              void *buffer)
+{
+        size_t i;
+        size_t n_axes = darray_size(slab->axes);
+        size_t dims[n_axes];
+        size_t extents[n_axes];
+        size_t counter[n_axes];
+        size_t n_chunk = 1;
+
+        for(i=0; i<n_axes; ++i){
+                dims[i] = axis_size(&darray_item(slab->axes, i));
+                extents[i] = MIN(chunk[i], dims[i] - first[i]);
+                counter[i] = 0;
+                n_chunk *= chunk[i];
+        }
+        memset(buffer, 0, n_chunk * size);
+
+        /* copy the rows of the fastest axis */
+        for(;;){
+                size_t src = 0;
+                size_t dst = 0;
+
+                for(i=0; i<n_axes; ++i){
+                        src = src * dims[i] + first[i] + counter[i];
+                        dst = dst * chunk[i] + counter[i];
+                }
+                memcpy((char *)buffer + dst * size, (const char *)data + src * size,
+                       extents[n_axes - 1] * size);
+
+                i = n_axes - 1;
+                while(i-- > 0){
+                        if(++counter[i] < extents[i])
+                                break;
+                        counter[i] = 0;
+                }
+                if(i == (size_t)-1)
+                        break;
+        }
+}
+
+/* the little endian bytes of the chunk, gzipped when zlib is
+ * available, then written into its own file */
+static int zarr_chunk_write(const char *fn, void *buffer, size_t n, size_t size)
+{
+        int res;
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+        size_t i;
+
+        for(i=0; i<n; ++i){
+                if(sizeof(uint32_t) == size){
+                        uint32_t *v = (uint32_t *)buffer + i;
+
+                        *v = GUINT32_TO_LE(*v);
+                }else{
+                        uint64_t *v = (uint64_t *)buffer + i;
+
+                        *v = GUINT64_TO_LE(*v);
+                }
+        }
+#endif
+
+#ifdef HAVE_ZLIB
+        z_stream zs = {0};
+        unsigned char *out;
+        size_t n_out;
+
+        /* 16 + MAX_WBITS writes a gzip stream */
+        if(Z_OK != deflateInit2(&zs, HKL_BINOCULARS_ZARR_GZIP_LEVEL, Z_DEFLATED,
+                                16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY)){
+                fprintf(stderr, "Can not compress the zarr chunk %s\n", fn);
+                return FALSE;
+        }
+        n_out = deflateBound(&zs, n * size);
+        out = g_malloc(n_out);
+        zs.next_in = buffer;
+        zs.avail_in = n * size;
+        zs.next_out = out;
+        zs.avail_out = n_out;
+        if(Z_STREAM_END != deflate(&zs, Z_FINISH)){
+                fprintf(stderr, "Can not compress the zarr chunk %s\n", fn);
+                res = FALSE;
+        }else
+                res = zarr_write_file(fn, out, zs.total_out);
+        deflateEnd(&zs);
+        g_free(out);
+#else
+        res = zarr_write_file(fn, buffer, n * size);
+#endif
+
+        return res;
+}
+
+/* merge the row of chunks of the cubes and save its chunks */
+static int zarr_save_row(HklBinocularsZarrSave *self, size_t row)
+{
+        size_t i, k;
+        int res = TRUE;
+        size_t n_axes = darray_size(*self->axes);
+        size_t n_chunk = 1;
+        size_t grid[n_axes];
+        size_t first[n_axes];
+        size_t indexes[n_axes];
+        HklBinocularsAxis *axis;
+        HklBinocularsCube *slab;
+        darray_axis axes = darray_new();
+        void *buffer;
+
+        darray_foreach(axis, *self->axes){
+                darray_append(axes, *axis);
+        }
+        darray_item(axes, 0).imin = darray_item(*self->axes, 0).imin + row * self->chunk[0];
+        darray_item(axes, 0).imax = MIN(darray_item(axes, 0).imin + (ptrdiff_t)self->chunk[0] - 1,
+                                        darray_item(*self->axes, 0).imax);
+
+        slab = hkl_binoculars_cube_new_from_axes_weighted(&axes, self->weighted);
+        hkl_binoculars_cube_merge_slab(slab, self->cubes, self->n_cubes,
+                                       0, axis_size(&darray_item(axes, 0)));
+
+        for(i=0; i<n_axes; ++i){
+                size_t dim = axis_size(&darray_item(axes, i));
+
+                grid[i] = (dim + self->chunk[i] - 1) / self->chunk[i];
+                indexes[i] = 0;
+                n_chunk *= self->chunk[i];
+        }
+        first[0] = 0;
+        buffer = g_malloc(n_chunk * sizeof(double));
+
+        /* all the chunks of the row, the key of the chunk starts with
+         * the row */
+        do{
+                GString *key = g_string_new(NULL);
+
+                g_string_printf(key, "%zu", row);
+                for(i=1; i<n_axes; ++i){
+                        first[i] = indexes[i] * self->chunk[i];
+                        g_string_append_printf(key, "/%zu", indexes[i]);
+                }
+
+                for(k=0; res && k<zarr_n_arrays(self->weighted); ++k){
+                        char *fn = g_strdup_printf("%s/%s/c/%s", self->dn,
+                                                   zarr_arrays[k].name, key->str);
+                        char *cdn = g_path_get_dirname(fn);
+
+                        zarr_chunk_gather(slab, self->chunk, first, zarr_arrays[k].size,
+                                          zarr_array_data(slab, k), buffer);
+                        res = zarr_mkdir(cdn)
+                                && zarr_chunk_write(fn, buffer, n_chunk, zarr_arrays[k].size);
+
+                        g_free(cdn);
+                        g_free(fn);
+                }
+                g_string_free(key, TRUE);
+
+                /* the next chunk of the row */
+                i = n_axes;
+                while(i-- > 1){
+                        if(++indexes[i] < grid[i])
+                                break;
+                        indexes[i] = 0;
+                }
+                if(0 == i)
+                        break;
+        }while(res);
+
+        g_free(buffer);
+        hkl_binoculars_cube_free(slab);
+        darray_free(axes);
+
+        return res;
+}
+
+static gpointer zarr_save_job(gpointer data)
+{
+        HklBinocularsZarrSave *self = data;
+
+        for(;;){
+                size_t row = g_atomic_int_add(&self->next, 1);
+
+                if(row >= self->n_rows || g_atomic_int_get(&self->failed))
+                        break;
+
+                if(!zarr_save_row(self, row))
+                        g_atomic_int_set(&self->failed, TRUE);
+        }
+
+        return NULL;
+}
+
+int hkl_binoculars_cubes_save_zarr(const char *dn,
+                                   const char *config,
+                                   size_t n_cubes,
+                                   const HklBinocularsCube *const *cubes,
+                                   size_t n_threads,
+                                   size_t part,
+                                   size_t n_parts)
+{
+        size_t i;
+        size_t n_rows;
+        int res = TRUE;
+        int weighted = FALSE;
+        darray_axis axes = darray_new();
+        HklBinocularsZarrSave save;
+
+        if(0 == n_parts || part >= n_parts){
+                fprintf(stderr, "The part %zu of %zu of the zarr output %s does not exist\n",
+                        part, n_parts, dn);
+                return FALSE;
+        }
+
+        hkl_binoculars_cubes_merge_axes(n_cubes, cubes, &axes);
+        for(i=0; i<n_cubes; ++i)
+                if(NULL != cubes[i])
+                        weighted |= cubes[i]->weighted;
+
+        size_t n_axes = darray_size(axes);
+        size_t dims[n_axes > 0 ? n_axes : 1];
+        size_t chunk[n_axes > 0 ? n_axes : 1];
+
+        for(i=0; i<n_axes; ++i)
+                dims[i] = axis_size(&darray_item(axes, i));
+        chunk_dims_get(n_axes, dims, chunk);
+
+        /* only the small metadata is written by the first part */
+        if(0 == part)
+                res = zarr_write_metadata(dn, config, &axes, chunk, weighted);
+
+        if(res && n_axes > 0){
+                n_rows = (dims[0] + chunk[0] - 1) / chunk[0];
+
+                save.dn = dn;
+                save.axes = &axes;
+                save.chunk = chunk;
+                save.weighted = weighted;
+                save.cubes = cubes;
+                save.n_cubes = n_cubes;
+                save.n_rows = (part + 1) * n_rows / n_parts;
+                save.next = part * n_rows / n_parts;
+                save.failed = FALSE;
+
+                if(0 == n_threads)
+                        n_threads = g_get_num_processors();
+                n_threads = MIN(n_threads, save.n_rows - save.next);
+
+                if(n_threads <= 1){
+                        zarr_save_job(&save);
+                }else{
+                        GThread *threads[n_threads];
+
+                        for(i=0; i<n_threads; ++i)
+                                threads[i] = g_thread_new("cube-save-zarr", zarr_save_job, &save);
+                        for(i=0; i<n_threads; ++i)
+                                g_thread_join(threads[i]);
+                }
+                res = !save.failed;
+        }
+
+        darray_free(axes);
+
+        return res;
+}
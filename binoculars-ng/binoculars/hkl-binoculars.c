@@ -25,12 +25,22 @@
 #ifdef DEBUG
 # define CGLM_DEFINE_PRINTS
 # define CGLM_PRINT_PRECISION 7
+# define debug_mat4_print(m) glms_mat4_print((m), stdout)
+#else
+# define debug_mat4_print(m)
 #endif
 
 #include <stdio.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <linux/mempolicy.h>
+# include <sys/syscall.h>
+#endif
 
 #include "ccan/array_size/array_size.h"
+#include "hkl-binoculars-cnpy-private.h"
 #include "hkl-binoculars-private.h"
 #include "hkl-matrix-private.h"
 #include "hkl-quaternion-private.h"
@@ -207,8 +217,8 @@ static inline int does_not_include(const darray_axis *axes,
 
 static inline void hkl_binoculars_space_item_fprintf(FILE *f, const HklBinocularsSpaceItem *self)
 {
-        fprintf(f, "item->indexes(%p) v: %ld %ld %ld, intensity: %d", &self->indexes_0[0],
-                self->indexes_0[0], self->indexes_0[1], self->indexes_0[2], self->intensity);
+        fprintf(f, "item->indexes(%p) v: %ld %ld %ld, intensity: %f, weight: %f", &self->indexes_0[0],
+                self->indexes_0[0], self->indexes_0[1], self->indexes_0[2], self->intensity, self->weight);
 }
 
 static inline int space_is_empty(const HklBinocularsSpace *space)
@@ -216,15 +226,40 @@ static inline int space_is_empty(const HklBinocularsSpace *space)
         return 0 == darray_size(space->items);
 }
 
+/* store an item in the space. The first item of the frame gives the
+ * origin of the space, the others are stored relatively to it with
+ * 32 bits indexes, so an item takes 20 bytes instead of 32. */
+static inline void space_add_item(HklBinocularsSpace *space,
+                                  const HklBinocularsSpaceItem *item)
+{
+        size_t i;
+        HklBinocularsSpacePackedItem packed;
+
+        if (space_is_empty(space))
+                for(i=0; i<ARRAY_SIZE(space->origin); ++i)
+                        space->origin[i] = item->indexes_0[i];
+
+        for(i=0; i<ARRAY_SIZE(packed.indexes); ++i){
+                ptrdiff_t offset = item->indexes_0[i] - space->origin[i];
+
+                assert(offset >= INT32_MIN && offset <= INT32_MAX);
+                packed.indexes[i] = offset;
+        }
+        packed.intensity = item->intensity;
+        packed.weight = item->weight;
+
+        darray_append(space->items, packed);
+}
+
 static inline void space_update_axes(HklBinocularsSpace *space,
                                      const char *names[],
                                      size_t n_pixels,
                                      const double resolutions[])
 {
         size_t i;
-        HklBinocularsSpaceItem *item;
-        HklBinocularsSpaceItem minimum;
-        HklBinocularsSpaceItem maximum;
+        HklBinocularsSpacePackedItem *item;
+        HklBinocularsSpacePackedItem minimum;
+        HklBinocularsSpacePackedItem maximum;
 
         if (space_is_empty(space))
                 return;
@@ -233,15 +268,16 @@ static inline void space_update_axes(HklBinocularsSpace *space,
 
         for(i=0; i<darray_size(space->axes); ++i){
                 darray_foreach(item, space->items){
-                        minimum.indexes_0[i] = min(minimum.indexes_0[i], item->indexes_0[i]);
-                        maximum.indexes_0[i] = max(maximum.indexes_0[i], item->indexes_0[i]);
+                        minimum.indexes[i] = min(minimum.indexes[i], item->indexes[i]);
+                        maximum.indexes[i] = max(maximum.indexes[i], item->indexes[i]);
                 }
         }
 
         for(i=0; i<darray_size(space->axes); ++i){
                 HklBinocularsAxis *axis = &darray_item(space->axes, i);
                 hkl_binoculars_axis_init(axis, names[i], i,
-                                         minimum.indexes_0[i], maximum.indexes_0[i],
+                                         space->origin[i] + minimum.indexes[i],
+                                         space->origin[i] + maximum.indexes[i],
                                          resolutions[i]);
         }
 }
@@ -279,11 +315,105 @@ static inline int item_in_the_limits(const HklBinocularsSpaceItem *item,
         return res;
 }
 
+/* the limits resolved once per frame for the kernels, without limit
+ * the bound is the extreme value of ptrdiff_t */
+typedef struct _HklBinocularsLimitsBox HklBinocularsLimitsBox;
+
+struct _HklBinocularsLimitsBox
+{
+        size_t n;
+        ptrdiff_t imin[3];
+        ptrdiff_t imax[3];
+};
+
+static inline void limits_box_init(HklBinocularsLimitsBox *self,
+                                   const HklBinocularsAxisLimits **limits,
+                                   size_t n_limits)
+{
+        self->n = NULL == limits ? 0 : n_limits;
+        assert(self->n <= ARRAY_SIZE(self->imin));
+
+        for(size_t i=0; i<self->n; ++i){
+                self->imin[i] = PTRDIFF_MIN;
+                self->imax[i] = PTRDIFF_MAX;
+
+                match(limits[i]->imin){
+                        of(NoLimit){
+                        }
+                        of(Limit, imin){
+                                self->imin[i] = *imin;
+                                break;
+                        }
+                }
+
+                match(limits[i]->imax){
+                        of(NoLimit){
+                        }
+                        of(Limit, imax){
+                                self->imax[i] = *imax;
+                                break;
+                        }
+                }
+        }
+}
+
+static inline int item_in_the_box(const HklBinocularsSpaceItem *item,
+                                  const HklBinocularsLimitsBox *box)
+{
+        int res = TRUE;
+
+        for(size_t i=0; i<box->n; ++i)
+                res &= (item->indexes_0[i] >= box->imin[i]) & (item->indexes_0[i] <= box->imax[i]);
+
+        return res;
+}
+
+/* The pixels kernels are generated for each combination of the limits
+ * and of the polarisation correction. KERNEL(limits_, polarisation_,
+ * box, ...) receives both as constants, so its pixel loop keeps no
+ * branch on them, and the combination is selected once per frame (or
+ * range of pixels). The not masked pixels are already resolved in the
+ * indexes of the jobs. */
+#define KERNEL_IN_THE_LIMITS(limits_, item, box)                        \
+        (!(limits_) || item_in_the_box(&(item), (box)))
+
+#define KERNEL_DISPATCH(KERNEL, job, ...) do {                          \
+                HklBinocularsLimitsBox box_;                            \
+                                                                        \
+                limits_box_init(&box_, (job)->limits, (job)->n_limits); \
+                if(0 != box_.n){                                        \
+                        if((job)->do_polarisation_correction)           \
+                                KERNEL(1, 1, &box_, __VA_ARGS__);       \
+                        else                                            \
+                                KERNEL(1, 0, &box_, __VA_ARGS__);       \
+                }else{                                                  \
+                        if((job)->do_polarisation_correction)           \
+                                KERNEL(0, 1, &box_, __VA_ARGS__);       \
+                        else                                            \
+                                KERNEL(0, 0, &box_, __VA_ARGS__);       \
+                }                                                       \
+        } while(0)
+
+/* the same for the kernels without polarisation correction */
+#define KERNEL_DISPATCH_LIMITS(KERNEL, job, ...) do {                   \
+                HklBinocularsLimitsBox box_;                            \
+                                                                        \
+                limits_box_init(&box_, (job)->limits, (job)->n_limits); \
+                if(0 != box_.n)                                         \
+                        KERNEL(1, 0, &box_, __VA_ARGS__);               \
+                else                                                    \
+                        KERNEL(0, 0, &box_, __VA_ARGS__);               \
+        } while(0)
+
 HklBinocularsSpace *hkl_binoculars_space_new(size_t max_items, size_t n_axes)
 {
 	HklBinocularsSpace *self = g_new(HklBinocularsSpace, 1);
 
         self->max_items = max_items;
+        self->n_frames = 1;
+        self->frame_sum = 0;
+        self->frame_max = 0;
+        self->frame_n_in_limits = 0;
         darray_init(self->items);
         darray_resize(self->items, max_items);
         darray_init(self->axes);
@@ -299,6 +429,23 @@ void hkl_binoculars_space_free(HklBinocularsSpace *self)
 	free(self);
 }
 
+void hkl_binoculars_space_n_frames_set(HklBinocularsSpace *self, size_t n_frames)
+{
+        assert(n_frames > 0 && n_frames <= UINT32_MAX);
+
+        self->n_frames = n_frames;
+}
+
+void hkl_binoculars_space_frame_stats_get(const HklBinocularsSpace *self,
+                                          double *sum,
+                                          double *max,
+                                          size_t *n_in_limits)
+{
+        *sum = self->frame_sum;
+        *max = self->frame_max;
+        *n_in_limits = self->frame_n_in_limits;
+}
+
 void hkl_binoculars_space_fprintf(FILE *f, const HklBinocularsSpace *self)
 {
         size_t masked;
@@ -320,192 +467,1004 @@ void hkl_binoculars_space_fprintf(FILE *f, const HklBinocularsSpace *self)
         }
 }
 
-/* angles */
-
-#define HKL_BINOCULARS_SPACE_ANGLES_IMPL(image_t)                       \
-        HKL_BINOCULARS_SPACE_ANGLES_DECL(image_t)                       \
-        {                                                               \
-                size_t i, j;                                            \
-                const char * names[] = {"delta_lab", "gamma_lab", "tth"}; \
-                double delta0, gamma0, tth;                             \
-                                                                        \
-                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
-                assert(ARRAY_SIZE(names) == n_resolutions);             \
-                assert(n_pixels == space->max_items);                   \
-                                                                        \
-                darray_size(space->items) = 0;                          \
-                                                                        \
-                const double *p_x = &pixels_coordinates[0 * n_pixels];  \
-                const double *p_y = &pixels_coordinates[1 * n_pixels];  \
-                const double *p_z = &pixels_coordinates[2 * n_pixels];  \
-                                                                        \
-                HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D); \
-                const HklQuaternion q = hkl_geometry_detector_rotation_get(geometry, detector); \
-                                                                        \
-                for(i=0;i<n_pixels;++i){                                \
-                        if(NULL == masked || 0 == masked[i]){           \
-                                HklBinocularsSpaceItem item;            \
-                                HklVector v = {{p_x[i], p_y[i], p_z[i]}}; \
-                                                                        \
-                                hkl_vector_rotated_quaternion(&v, &q);  \
-                                delta0 = atan2(v.data[2], v.data[0]);   \
-                                gamma0 = M_PI_2 - atan2(sqrt(v.data[2] * v.data[2] + v.data[0] * v.data[0]), v.data[1]); \
-                                tth = acos(v.data[0]);                  \
-                                                                        \
-                                v.data[0] = delta0 / M_PI * 180.0;      \
-                                v.data[1] = gamma0 / M_PI * 180.0;      \
-                                v.data[2] = tth / M_PI * 180.0;         \
-                                                                        \
-                                for(j=0; j<ARRAY_SIZE(names); ++j){     \
-                                        item.indexes_0[j] = rint(v.data[j] / resolutions[j]); \
-                                }                                       \
-                                item.intensity = rint((double)image[i] * weight); \
-                                                                        \
-                                                                        \
-                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                        darray_append(space->items, item); \
-                        }                                               \
-                }                                                       \
-                                                                        \
-                space_update_axes(space, names, n_pixels, resolutions); \
-                                                                        \
-                hkl_detector_free(detector);                            \
-        }
-
-HKL_BINOCULARS_SPACE_ANGLES_IMPL(int32_t);
-HKL_BINOCULARS_SPACE_ANGLES_IMPL(uint16_t);
-HKL_BINOCULARS_SPACE_ANGLES_IMPL(uint32_t);
+/* Projection context */
 
-/* qcustom */
+/* the precision of the kf and q of the pixels.
+ *
+ * The float path doubles the number of SIMD lanes of the pixels
+ * kernels. The float rounding is 2^-24 (6e-8) relative per operation
+ * and a component of kf or q goes through about ten of them, plus
+ * the float matrices of the holders, so its absolute error stays
+ * below 1e-6 k. For k = 8 Å⁻¹ (λ = 0.8 Å) this is 1e-5 Å⁻¹, a
+ * thousand times smaller than a 1e-2 Å⁻¹ bin: only the pixels this
+ * close to a bin edge may end in the neighbour bin.
+ *
+ * configure --enable-binoculars-double computes the kernels in double
+ * (the matrices and the subprojections stay in float) in order to
+ * check this bound on real data. */
+#ifdef HKL_BINOCULARS_DOUBLE
+typedef double HklBinocularsReal;
+# define HKL_BINOCULARS_SQRT sqrt
+#else
+typedef float HklBinocularsReal;
+# define HKL_BINOCULARS_SQRT sqrtf
+#endif
 
-struct _HklBinocularsProjectionAxis
+/* kf of all the pixels of a detector, for a given position of the
+ * detector and a given wavelength. The first, the middle and the last
+ * pixels coordinates are part of the key in order to detect a new
+ * coordinates array allocated at the same address. */
+typedef struct _HklBinocularsKfTable HklBinocularsKfTable;
+struct _HklBinocularsKfTable
 {
-        const char *name;
-        const char *description;
+        /* key */
+        int valid;
+        mat4s m_holder_d;
+        float k;
+        const double *pixels_coordinates;
+        size_t n_pixels;
+        double samples[9];
+        /* values */
+        size_t capacity;
+        HklBinocularsReal *x;
+        HklBinocularsReal *y;
+        HklBinocularsReal *z;
+        float *polarisation; /* the polarisation correction denominator */
 };
 
-typedef struct _HklBinocularsProjectionAxis HklBinocularsProjectionAxis;
-
-static const HklBinocularsProjectionAxis azimuth =
+/* the not masked pixels of a mask, the copy of the mask is part of
+ * the key in order to detect a new mask allocated at the same
+ * address. */
+typedef struct _HklBinocularsMaskIndexes HklBinocularsMaskIndexes;
+struct _HklBinocularsMaskIndexes
 {
-        .name = "azimuth",
-        .description = "The azimuthal angle in the yz plan of the kf vector",
+        /* key */
+        int valid;
+        const uint8_t *masked;
+        size_t n_pixels;
+        uint8_t *copy;
+        /* values */
+        uint32_t *indexes;
+        size_t n_indexes;
+        size_t generation; /* incremented at each new list */
 };
-static const HklBinocularsProjectionAxis deltalab =
+
+/* the coordinates of the sub-pixels of a detector split in factor x
+ * factor sub-pixels, and the indexes of the sub-pixels of the not
+ * masked pixels. The sub-pixels of the pixel i are [i * factor^2,
+ * (i + 1) * factor^2). */
+typedef struct _HklBinocularsSubPixels HklBinocularsSubPixels;
+struct _HklBinocularsSubPixels
 {
-        .name = "deltalab",
-        .description = "The delta horizontal deviation in the lab basis",
+        /* key */
+        int valid;
+        size_t factor;
+        const double *pixels_coordinates;
+        size_t width;
+        size_t height;
+        double samples[9];
+        size_t mask_generation;
+        /* values */
+        double *coordinates;
+        uint32_t *indexes;
+        size_t n_indexes;
 };
-static const HklBinocularsProjectionAxis gammalab =
+
+/* the per-pixel corrections of the detector, combined once when they
+ * are set so that the kernels apply them with one subtraction and one
+ * multiplication per pixel. */
+typedef struct _HklBinocularsCorrections HklBinocularsCorrections;
+struct _HklBinocularsCorrections
 {
-        .name = "gammalab",
-        .description = "The gamma elevation in the lab basis",
+        size_t n_pixels;
+        double *dark; /* subtracted from the counts, or NULL */
+        double *gain; /* 1 / (flatfield * solid_angle), or NULL */
 };
-static const HklBinocularsProjectionAxis q =
+
+/* the maximum number of chunks of a frame projected in parallel */
+#define HKL_BINOCULARS_FRAME_CHUNKS_MAX 64
+
+/* The objects needed by the projections which do not depend on the
+ * frame. They are created once per thread (worker) and reused for
+ * all its frames. */
+typedef struct _HklBinocularsProjectionContext HklBinocularsProjectionContext;
+struct _HklBinocularsProjectionContext
 {
-        .name = "q",
-        .description = "The norm of the q vector",
+        HklSample *sample;
+        HklDetector *detector;
+        HklBinocularsKfTable kf;
+        HklBinocularsMaskIndexes mask;
+        HklBinocularsSubPixels sub;
+        HklBinocularsSpace *chunks[HKL_BINOCULARS_FRAME_CHUNKS_MAX]; /* the spaces of the chunks of a frame */
+        int ub_valid;
+        HklMatrix ub; /* the UB of the last sample projected */
+        CGLM_ALIGN_MAT mat4s ub_inv; /* its inverse */
 };
-static const HklBinocularsProjectionAxis qpar =
+
+static void projection_context_free(gpointer data)
 {
-        .name = "qpar",
-        .description = "The norm of the q vector projected onto the plan parallel to the surface."
-};
-static const HklBinocularsProjectionAxis qpars =
+        size_t i;
+        HklBinocularsProjectionContext *self = data;
+
+        for(i=0; i<ARRAY_SIZE(self->chunks); ++i)
+                if(NULL != self->chunks[i])
+                        hkl_binoculars_space_free(self->chunks[i]);
+
+        free(self->sub.indexes);
+        free(self->sub.coordinates);
+        free(self->mask.indexes);
+        free(self->mask.copy);
+        free(self->kf.polarisation);
+        free(self->kf.z);
+        free(self->kf.y);
+        free(self->kf.x);
+        hkl_detector_free(self->detector);
+        hkl_sample_free(self->sample);
+        free(self);
+}
+
+static GPrivate projection_context = G_PRIVATE_INIT(projection_context_free);
+
+/* UB^-1, inverted only when the sample changes */
+static mat4s ub_inverse_get(HklBinocularsProjectionContext *ctx, const HklMatrix *UB)
 {
-        .name = "qpars",
-        .description = "The signed norm of the q vector projected onto the plan parallel to the surface."
-};
-static const HklBinocularsProjectionAxis qper =
+        if(FALSE == ctx->ub_valid || 0 != memcmp(&ctx->ub, UB, sizeof(ctx->ub))){
+                HklMatrix inv;
+
+                if(0 == hkl_matrix_inv(UB, &inv)){
+                        CGLM_ALIGN_MAT mat4s m = {{{inv.data[0][0], inv.data[1][0], inv.data[2][0], 0},
+                                                   {inv.data[0][1], inv.data[1][1], inv.data[2][1], 0},
+                                                   {inv.data[0][2], inv.data[1][2], inv.data[2][2], 0},
+                                                   {0, 0, 0, 1}}};
+                        ctx->ub_inv = m;
+                }else{
+                        /* nearly singular, let cglm try */
+                        CGLM_ALIGN_MAT mat4s m = {{{UB->data[0][0], UB->data[1][0], UB->data[2][0], 0},
+                                                   {UB->data[0][1], UB->data[1][1], UB->data[2][1], 0},
+                                                   {UB->data[0][2], UB->data[1][2], UB->data[2][2], 0},
+                                                   {0, 0, 0, 1}}};
+                        ctx->ub_inv = glms_mat4_inv(m);
+                }
+                ctx->ub = *UB;
+                ctx->ub_valid = TRUE;
+        }
+
+        return ctx->ub_inv;
+}
+
+static inline HklBinocularsProjectionContext *projection_context_get(void)
 {
-        .name = "qper",
-        .description = "The norm of the q vector projected onto the surface vector (perpendicular to the surface)."
-};
-static const HklBinocularsProjectionAxis qx =
+        HklBinocularsProjectionContext *self = g_private_get(&projection_context);
+
+        if(NULL == self){
+                self = g_new0(HklBinocularsProjectionContext, 1);
+                self->sample = hkl_sample_new("test");
+                self->detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+                g_private_set(&projection_context, self);
+        }
+
+        return self;
+}
+
+/* return the not masked pixels, the list is built only when the mask
+ * changed since the previous frame of this thread. */
+static const HklBinocularsMaskIndexes *mask_indexes_get(HklBinocularsProjectionContext *ctx,
+                                                        const uint8_t *masked,
+                                                        size_t n_pixels)
 {
-        .name = "qx",
-        .description = "The x coordinate of the Q vector in the sample basis."
-};
-static const HklBinocularsProjectionAxis qy =
+        HklBinocularsMaskIndexes *self = &ctx->mask;
+
+        if (TRUE == self->valid
+            && self->masked == masked
+            && self->n_pixels == n_pixels
+            && (NULL == masked || 0 == memcmp(self->copy, masked, n_pixels)))
+                return self;
+
+        free(self->indexes);
+        self->indexes = hkl_binoculars_detector_2d_mask_indexes_get(masked, n_pixels,
+                                                                    &self->n_indexes);
+
+        free(self->copy);
+        self->copy = NULL;
+        if (NULL != masked){
+                self->copy = malloc(n_pixels * sizeof(*self->copy));
+                memcpy(self->copy, masked, n_pixels * sizeof(*self->copy));
+        }
+
+        self->valid = TRUE;
+        self->masked = masked;
+        self->n_pixels = n_pixels;
+        self->generation++;
+
+        return self;
+}
+
+static inline void kf_table_samples(const double *pixels_coordinates,
+                                    size_t n_pixels,
+                                    double samples[9])
 {
-        .name = "qy",
-        .description = "The y coordinate of the Q vector in the sample basis."
-};
-static const HklBinocularsProjectionAxis qz =
+        size_t i;
+        const size_t idx[] = {0, n_pixels / 2, n_pixels - 1};
+
+        for(i=0; i<ARRAY_SIZE(idx); ++i){
+                samples[3 * i + 0] = pixels_coordinates[0 * n_pixels + idx[i]];
+                samples[3 * i + 1] = pixels_coordinates[1 * n_pixels + idx[i]];
+                samples[3 * i + 2] = pixels_coordinates[2 * n_pixels + idx[i]];
+        }
+}
+
+/* Pixel splitting */
+
+/* Each pixel is split in factor x factor sub-pixels, projected like
+ * pixels with the counts of their pixel. Their positions are
+ * interpolated from the neighbour pixels, so the detector is covered
+ * without any gap or overlap. The photons and the contributions of
+ * the bins are counted per sub-pixel, their ratio is then the mean of
+ * the pixels weighted by the area of each pixel in the bin, which
+ * removes the moiré of the fine resolutions. */
+#define HKL_BINOCULARS_PIXEL_SPLITTING_MAX 8
+
+static gint pixel_splitting = 1;
+
+void hkl_binoculars_pixel_splitting_set(size_t factor)
 {
-        .name = "qz",
-        .description = "The z coordinate of the Q vector in the sample basis."
-};
-static const HklBinocularsProjectionAxis phi =
+        g_atomic_int_set(&pixel_splitting,
+                         max(1, min(factor, HKL_BINOCULARS_PIXEL_SPLITTING_MAX)));
+}
+
+static void subpixels_coordinates_compute(double *sub,
+                                          const double *coordinates,
+                                          size_t width, size_t height,
+                                          size_t factor)
 {
-        .name = "phi",
-        .description = "The azimuthal angle in the yz plan of the q vector",
-};
-static const HklBinocularsProjectionAxis sampleaxis =
+        size_t a, b, c, r, d;
+        size_t n_pixels = width * height;
+        size_t n_subpixels = factor * factor;
+        double offsets[factor];
+
+        /* the centres of the sub-pixels in pixel units */
+        for(a=0; a<factor; ++a)
+                offsets[a] = (a + 0.5) / factor - 0.5;
+
+        for(r=0; r<height; ++r){
+                size_t r0 = r > 0 ? r - 1 : r;
+                size_t r1 = r + 1 < height ? r + 1 : r;
+
+                for(c=0; c<width; ++c){
+                        size_t i = r * width + c;
+                        size_t c0 = c > 0 ? c - 1 : c;
+                        size_t c1 = c + 1 < width ? c + 1 : c;
+                        double du[3]; /* one column step */
+                        double dv[3]; /* one row step */
+
+                        for(d=0; d<3; ++d){
+                                const double *x = &coordinates[d * n_pixels];
+
+                                du[d] = c1 == c0 ? 0 : (x[r * width + c1] - x[r * width + c0]) / (c1 - c0);
+                                dv[d] = r1 == r0 ? 0 : (x[r1 * width + c] - x[r0 * width + c]) / (r1 - r0);
+                        }
+
+                        for(a=0; a<factor; ++a)
+                                for(b=0; b<factor; ++b){
+                                        size_t s = i * n_subpixels + a * factor + b;
+
+                                        for(d=0; d<3; ++d)
+                                                sub[d * n_pixels * n_subpixels + s] = coordinates[d * n_pixels + i]
+                                                        + offsets[a] * dv[d]
+                                                        + offsets[b] * du[d];
+                                }
+                }
+        }
+}
+
+/* return the sub-pixels of the not masked pixels, they are computed
+ * only when the detector or the mask changed since the previous frame
+ * of this thread. */
+static const HklBinocularsSubPixels *subpixels_get(HklBinocularsProjectionContext *ctx,
+                                                   const double *pixels_coordinates,
+                                                   size_t width, size_t height,
+                                                   size_t factor,
+                                                   const HklBinocularsMaskIndexes *mask)
 {
-        .name = "sampleaxis",
-        .description = "The name of a sample axis",
-};
-static const HklBinocularsProjectionAxis timestamp =
+        size_t i, j;
+        double samples[9];
+        size_t n_pixels = width * height;
+        size_t n_subpixels = factor * factor;
+        HklBinocularsSubPixels *self = &ctx->sub;
+
+        kf_table_samples(pixels_coordinates, n_pixels, samples);
+
+        if (TRUE == self->valid
+            && self->factor == factor
+            && self->pixels_coordinates == pixels_coordinates
+            && self->width == width
+            && self->height == height
+            && self->mask_generation == mask->generation
+            && 0 == memcmp(self->samples, samples, sizeof(samples)))
+                return self;
+
+        assert(n_pixels * n_subpixels <= UINT32_MAX);
+
+        free(self->coordinates);
+        self->coordinates = malloc(3 * n_pixels * n_subpixels * sizeof(*self->coordinates));
+        subpixels_coordinates_compute(self->coordinates, pixels_coordinates,
+                                      width, height, factor);
+
+        free(self->indexes);
+        self->indexes = malloc(mask->n_indexes * n_subpixels * sizeof(*self->indexes));
+        for(i=0; i<mask->n_indexes; ++i)
+                for(j=0; j<n_subpixels; ++j)
+                        self->indexes[i * n_subpixels + j] = mask->indexes[i] * n_subpixels + j;
+        self->n_indexes = mask->n_indexes * n_subpixels;
+
+        self->valid = TRUE;
+        self->factor = factor;
+        self->pixels_coordinates = pixels_coordinates;
+        self->width = width;
+        self->height = height;
+        self->mask_generation = mask->generation;
+        memcpy(self->samples, samples, sizeof(samples));
+
+        return self;
+}
+
+/* Frame parallelism */
+
+/* The pixels of a single frame can be split into chunks projected by
+ * a small pool of threads. Each chunk fills its own space, and these
+ * spaces are appended in the pixels order, so the result does not
+ * depend on the number of threads. The calling thread projects the
+ * first chunk directly into the space of the frame. */
+
+/* below this number of pixels per chunk, the threads cost more than
+ * they save */
+#define HKL_BINOCULARS_FRAME_CHUNK_MIN (64 * 1024)
+
+typedef struct _HklBinocularsFrameJob HklBinocularsFrameJob;
+
+/* project the not masked pixels [first, last) of the frame into the
+ * space, these are positions in the indexes of the job */
+typedef void (* HklBinocularsFrameRange) (const HklBinocularsFrameJob *job,
+                                          HklBinocularsSpace *space,
+                                          size_t first, size_t last);
+
+/* the parameters of a frame projection and its transformations,
+ * computed once per frame by the calling thread, then shared
+ * read-only by all the chunks */
+struct _HklBinocularsFrameJob
 {
-        .name = "timestamp",
-        .description = "The timestamp of each image",
+        HklBinocularsFrameRange range;
+        const void *image;
+        size_t n_pixels;
+        double weight;
+        const double *pixels_coordinates;
+        const double *resolutions;
+        const uint8_t *masked;
+        const uint32_t *indexes; /* the not masked pixels */
+        size_t n_indexes;
+        const HklBinocularsAxisLimits **limits;
+        size_t n_limits;
+        double timestamp;
+        HklBinocularsQCustomSubProjectionEnum subprojection;
+        int do_polarisation_correction;
+        mat4s m_holder_d;
+        mat4s m_holder_s;
+        vec3s ki;
+        float k;
+        ptrdiff_t axis; /* the bin of the sample axis */
+        HklQuaternion q; /* the detector rotation */
+        int fast; /* use the trigonometry approximations */
+        const HklBinocularsKfTable *kfs;
+        const HklBinocularsCorrections *corrections;
+        size_t width; /* of the detector */
+        size_t height;
+        size_t n_subpixels; /* per pixel, 1 without pixel splitting */
+        int frame_stats; /* the ranges also compute the frame statistics */
+        const HklBinocularsExpression *const *expressions; /* the axes of the expressions subprojection */
+        size_t n_expressions;
+        unsigned int variables; /* read by the expressions */
+        double sample_axis_value; /* user unit */
 };
-static const HklBinocularsProjectionAxis tth =
+
+/* the pixel of the sub-pixel i */
+static inline size_t job_pixel(const HklBinocularsFrameJob *job, size_t i)
 {
-        .name = "tth",
-        .description = "The 2 * theta angle.",
-};
-static const HklBinocularsProjectionAxis xp =
+        return 1 == job->n_subpixels ? i : i / job->n_subpixels;
+}
+
+static HklBinocularsCorrections *corrections = NULL;
+
+static inline double *corrections_copy(const double *arr, size_t n_pixels)
 {
-        .name = "xp",
-        .description = "The x coordinate of pixels projected in the yz plan",
-};
-static const HklBinocularsProjectionAxis yp =
+        double *copy = NULL;
+
+        if(NULL != arr){
+                copy = malloc(n_pixels * sizeof(*copy));
+                memcpy(copy, arr, n_pixels * sizeof(*copy));
+        }
+
+        return copy;
+}
+
+void hkl_binoculars_corrections_set(size_t n_pixels,
+                                    const double *dark,
+                                    const double *flatfield,
+                                    const double *solid_angle)
 {
-        .name="yp",
-        .description = "The y coordinate of pixels projected in the yz plan",
-};
-static const HklBinocularsProjectionAxis x =
+        HklBinocularsCorrections *self = NULL;
+        HklBinocularsCorrections *old = g_atomic_pointer_get(&corrections);
+
+        if(NULL != dark || NULL != flatfield || NULL != solid_angle){
+                size_t i;
+
+                self = g_new0(HklBinocularsCorrections, 1);
+                self->n_pixels = n_pixels;
+                self->dark = corrections_copy(dark, n_pixels);
+                if(NULL != flatfield || NULL != solid_angle){
+                        self->gain = malloc(n_pixels * sizeof(*self->gain));
+                        for(i=0; i<n_pixels; ++i){
+                                double d = 1.0;
+
+                                if(NULL != flatfield)
+                                        d *= flatfield[i];
+                                if(NULL != solid_angle)
+                                        d *= solid_angle[i];
+                                /* the dead pixels of a flatfield do not count */
+                                self->gain[i] = 0.0 == d ? 0.0 : 1.0 / d;
+                        }
+                }
+        }
+
+        g_atomic_pointer_set(&corrections, self);
+
+        if(NULL != old){
+                free(old->gain);
+                free(old->dark);
+                free(old);
+        }
+}
+
+/* the corrections of the frames of n_pixels */
+static inline const HklBinocularsCorrections *corrections_get(size_t n_pixels)
 {
-        .name="x",
-        .description = "The x coordinate of pixels",
-};
-static const HklBinocularsProjectionAxis y =
+        const HklBinocularsCorrections *self = g_atomic_pointer_get(&corrections);
+
+        assert(NULL == self || n_pixels == self->n_pixels);
+
+        return self;
+}
+
+/* the corrected intensity of the pixel i, correction is the weight
+ * and the polarisation correction of the pixel. */
+static inline void item_intensity_set(HklBinocularsSpaceItem *item,
+                                      const HklBinocularsFrameJob *job,
+                                      size_t i, double value, double correction)
 {
-        .name="y",
-        .description = "The y coordinate of pixels",
+        const HklBinocularsCorrections *c = job->corrections;
+
+        if(NULL != c){
+                if(NULL != c->dark)
+                        value -= c->dark[i];
+                if(NULL != c->gain)
+                        correction *= c->gain[i];
+        }
+
+        item->intensity = value * correction;
+        item->weight = correction;
+}
+
+/* the same from the (sub-)pixel i of the image */
+#define ITEM_INTENSITY_SET(item, job, image, i, correction) do {        \
+                size_t pixel_ = job_pixel((job), (i));                  \
+                item_intensity_set(&(item), (job), pixel_, (image)[pixel_], (correction)); \
+        } while(0)
+
+typedef struct _HklBinocularsFrameSync HklBinocularsFrameSync;
+struct _HklBinocularsFrameSync
+{
+        GMutex mutex;
+        GCond cond;
+        size_t pending;
 };
-static const HklBinocularsProjectionAxis z =
+
+typedef struct _HklBinocularsFrameChunk HklBinocularsFrameChunk;
+struct _HklBinocularsFrameChunk
 {
-        .name="z",
-        .description = "The z coordinate of pixels",
+        const HklBinocularsFrameJob *job;
+        HklBinocularsSpace *space;
+        size_t first;
+        size_t last;
+        HklBinocularsFrameSync *sync;
 };
 
+static gint frame_n_threads = 1;
 
-#define PROJECTION(...) do {                                            \
-                int i;                                                  \
-                int n;                                                  \
-                static const HklBinocularsProjectionAxis axes[] = {__VA_ARGS__}; \
-                static const char *axes_names[ARRAY_SIZE(axes)];        \
-                                                                        \
-                n = ARRAY_SIZE(axes);                                   \
-                assert(n <= darray_size(space->axes));                  \
-                assert(n <= n_resolutions);                             \
-                                                                        \
-                for(i=0; i<n; ++i)                                      \
+static gint frame_stats = FALSE;
+
+void hkl_binoculars_frame_stats_set(int enable)
+{
+        g_atomic_int_set(&frame_stats, enable);
+}
+
+static inline void frame_stats_reset(HklBinocularsSpace *space)
+{
+        space->frame_sum = 0;
+        space->frame_max = -INFINITY;
+        space->frame_n_in_limits = 0;
+}
+
+/* the sub-pixels count the counts of their pixel once */
+static inline void frame_stats_done(const HklBinocularsFrameJob *job,
+                                    HklBinocularsSpace *space)
+{
+        if(job->frame_stats){
+                space->frame_sum /= job->n_subpixels;
+                space->frame_n_in_limits = darray_size(space->items) / job->n_subpixels;
+        }
+        if(isinf(space->frame_max))
+                space->frame_max = 0;
+}
+
+/* the pixels of the range were just read by the projection, so they
+ * are still in the cache */
+#define FRAME_STATS_RANGE(image, job, space, first, last) do {          \
+                size_t p_;                                              \
+                double sum_ = 0;                                        \
+                double max_ = (space)->frame_max;                       \
+                                                                        \
+                for(p_=(first); p_<(last); ++p_){                       \
+                        double v_ = (image)[job_pixel((job), (job)->indexes[p_])]; \
+                                                                        \
+                        sum_ += v_;                                     \
+                        max_ = v_ > max_ ? v_ : max_;                   \
+                }                                                       \
+                (space)->frame_sum += sum_;                             \
+                (space)->frame_max = max_;                              \
+        } while(0)
+
+void hkl_binoculars_frame_n_threads_set(size_t n_threads)
+{
+        if(0 == n_threads)
+                n_threads = g_get_num_processors();
+
+        g_atomic_int_set(&frame_n_threads,
+                         min(n_threads, HKL_BINOCULARS_FRAME_CHUNKS_MAX));
+}
+
+static void frame_chunk_run(gpointer data, gpointer user_data)
+{
+        HklBinocularsFrameChunk *chunk = data;
+
+        darray_size(chunk->space->items) = 0;
+        chunk->job->range(chunk->job, chunk->space, chunk->first, chunk->last);
+
+        g_mutex_lock(&chunk->sync->mutex);
+        if(0 == --chunk->sync->pending)
+                g_cond_signal(&chunk->sync->cond);
+        g_mutex_unlock(&chunk->sync->mutex);
+}
+
+/* the pool is shared by all the threads projecting frames, its
+ * threads are created on demand. */
+static GThreadPool *frame_pool_get(void)
+{
+        static gsize initialized = 0;
+        static GThreadPool *pool = NULL;
+
+        if(g_once_init_enter(&initialized)){
+                pool = g_thread_pool_new(frame_chunk_run, NULL, -1, FALSE, NULL);
+                g_once_init_leave(&initialized, 1);
+        }
+
+        return pool;
+}
+
+/* append the items of other to the space, relatively to the origin
+ * of the space */
+static inline void space_append_space(HklBinocularsSpace *space,
+                                      const HklBinocularsSpace *other)
+{
+        size_t i;
+        ptrdiff_t delta[ARRAY_SIZE(space->origin)];
+        HklBinocularsSpacePackedItem *item;
+
+        if (space_is_empty(other))
+                return;
+
+        if (space_is_empty(space))
+                for(i=0; i<ARRAY_SIZE(space->origin); ++i)
+                        space->origin[i] = other->origin[i];
+
+        for(i=0; i<ARRAY_SIZE(delta); ++i)
+                delta[i] = other->origin[i] - space->origin[i];
+
+        darray_foreach(item, other->items){
+                HklBinocularsSpacePackedItem packed = *item;
+
+                for(i=0; i<ARRAY_SIZE(packed.indexes); ++i){
+                        ptrdiff_t offset = item->indexes[i] + delta[i];
+
+                        assert(offset >= INT32_MIN && offset <= INT32_MAX);
+                        packed.indexes[i] = offset;
+                }
+
+                darray_append(space->items, packed);
+        }
+}
+
+/* the kernels iterate only over the not masked pixels, without any
+ * branch on the mask. With the pixel splitting, the job iterates over
+ * the sub-pixels, their coordinates replace the pixels ones. */
+static inline void frame_job_indexes_init(HklBinocularsFrameJob *job)
+{
+        size_t factor;
+        HklBinocularsProjectionContext *ctx = projection_context_get();
+        const HklBinocularsMaskIndexes *mask;
+
+        if(NULL != job->indexes)
+                return;
+
+        mask = mask_indexes_get(ctx, job->masked, job->n_pixels);
+        job->indexes = mask->indexes;
+        job->n_indexes = mask->n_indexes;
+        job->n_subpixels = 1;
+
+        factor = g_atomic_int_get(&pixel_splitting);
+        if(factor > 1){
+                const HklBinocularsSubPixels *sub;
+
+                assert(job->width * job->height == job->n_pixels);
+
+                sub = subpixels_get(ctx, job->pixels_coordinates,
+                                    job->width, job->height, factor, mask);
+                job->pixels_coordinates = sub->coordinates;
+                job->n_pixels *= factor * factor;
+                job->indexes = sub->indexes;
+                job->n_indexes = sub->n_indexes;
+                job->n_subpixels = factor * factor;
+        }
+}
+
+/* project all the not masked pixels of the frame into the space */
+static void frame_run(HklBinocularsFrameJob *job, HklBinocularsSpace *space)
+{
+        size_t i;
+        size_t n_chunks;
+
+        frame_job_indexes_init(job);
+        job->frame_stats = g_atomic_int_get(&frame_stats);
+
+        n_chunks = min(g_atomic_int_get(&frame_n_threads),
+                       (job->n_indexes + HKL_BINOCULARS_FRAME_CHUNK_MIN - 1) / HKL_BINOCULARS_FRAME_CHUNK_MIN);
+
+        darray_size(space->items) = 0;
+        frame_stats_reset(space);
+
+        if(n_chunks <= 1){
+                job->range(job, space, 0, job->n_indexes);
+                frame_stats_done(job, space);
+                return;
+        }
+
+        size_t len = (job->n_indexes + n_chunks - 1) / n_chunks;
+        HklBinocularsProjectionContext *ctx = projection_context_get();
+        HklBinocularsFrameChunk chunks[n_chunks];
+        HklBinocularsFrameSync sync;
+
+        g_mutex_init(&sync.mutex);
+        g_cond_init(&sync.cond);
+        sync.pending = n_chunks - 1;
+
+        for(i=0; i<n_chunks; ++i){
+                chunks[i].job = job;
+                chunks[i].space = space;
+                chunks[i].first = min(i * len, job->n_indexes);
+                chunks[i].last = min((i + 1) * len, job->n_indexes);
+                chunks[i].sync = &sync;
+        }
+
+        for(i=1; i<n_chunks; ++i){
+                if(NULL == ctx->chunks[i])
+                        ctx->chunks[i] = hkl_binoculars_space_new(len, darray_size(space->axes));
+                chunks[i].space = ctx->chunks[i];
+                frame_stats_reset(chunks[i].space);
+                g_thread_pool_push(frame_pool_get(), &chunks[i], NULL);
+        }
+
+        job->range(job, space, chunks[0].first, chunks[0].last);
+
+        g_mutex_lock(&sync.mutex);
+        while(0 != sync.pending)
+                g_cond_wait(&sync.cond, &sync.mutex);
+        g_mutex_unlock(&sync.mutex);
+
+        for(i=1; i<n_chunks; ++i){
+                space_append_space(space, chunks[i].space);
+                space->frame_sum += chunks[i].space->frame_sum;
+                space->frame_max = max(space->frame_max, chunks[i].space->frame_max);
+        }
+        frame_stats_done(job, space);
+
+        g_cond_clear(&sync.cond);
+        g_mutex_clear(&sync.mutex);
+}
+
+/* trigonometry */
+
+/* atan2 approximated by an odd polynomial of degree 11 on [0, 1] and
+ * the octant symmetries, written without branch so that the compiler
+ * can inline and vectorise it. asin and acos go through atan2 and a
+ * sqrt. For float inputs the maximum error is 2e-6 rad (1.2e-4°),
+ * eighty times smaller than a 1e-2° bin: only the pixels this close
+ * to a bin edge may end in the neighbour bin. Close to ±1 the float
+ * rounding of the asin and acos arguments dominates, this is the
+ * direct beam for the tth of the angles projection. */
+static gint fast_trigonometry = FALSE;
+
+void hkl_binoculars_fast_trigonometry_set(int enable)
+{
+        g_atomic_int_set(&fast_trigonometry, enable);
+}
+
+static inline float fast_atan2f(float y, float x)
+{
+        float ax = fabsf(x);
+        float ay = fabsf(y);
+        float mx = ax > ay ? ax : ay;
+        float mn = ax > ay ? ay : ax;
+        float a = mx == 0 ? 0 : mn / mx;
+        float s = a * a;
+        float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+
+        r = ay > ax ? (float)M_PI_2 - r : r;
+        r = x < 0 ? (float)M_PI - r : r;
+
+        return copysignf(r, y);
+}
+
+static inline double trigo_atan2(double y, double x, int fast)
+{
+        return fast ? fast_atan2f(y, x) : atan2(y, x);
+}
+
+static inline double trigo_asin(double x, int fast)
+{
+        float xf = x;
+
+        return fast ? fast_atan2f(xf, sqrtf(fmaxf(0, (1 - xf) * (1 + xf)))) : asin(x);
+}
+
+static inline double trigo_acos(double x, int fast)
+{
+        float xf = x;
+
+        return fast ? fast_atan2f(sqrtf(fmaxf(0, (1 - xf) * (1 + xf))), xf) : acos(x);
+}
+
+/* angles */
+
+#define ANGLES_KERNEL(limits_, polarisation_, box, image, job, space, first, last) do { \
+                size_t p, j;                                            \
+                double delta0, gamma0, tth;                             \
+                                                                        \
+                const double *p_x = &(job)->pixels_coordinates[0 * (job)->n_pixels]; \
+                const double *p_y = &(job)->pixels_coordinates[1 * (job)->n_pixels]; \
+                const double *p_z = &(job)->pixels_coordinates[2 * (job)->n_pixels]; \
+                                                                        \
+                for(p=(first);p<(last);++p){                            \
+                        size_t i = (job)->indexes[p];                   \
+                        HklBinocularsSpaceItem item;                    \
+                        HklVector v = {{p_x[i], p_y[i], p_z[i]}};       \
+                                                                        \
+                        hkl_vector_rotated_quaternion(&v, &(job)->q);   \
+                        delta0 = trigo_atan2(v.data[2], v.data[0], (job)->fast); \
+                        gamma0 = M_PI_2 - trigo_atan2(sqrt(v.data[2] * v.data[2] + v.data[0] * v.data[0]), v.data[1], (job)->fast); \
+                        tth = trigo_acos(v.data[0], (job)->fast);       \
+                                                                        \
+                        v.data[0] = delta0 / M_PI * 180.0;              \
+                        v.data[1] = gamma0 / M_PI * 180.0;              \
+                        v.data[2] = tth / M_PI * 180.0;                 \
+                                                                        \
+                        for(j=0; j<ARRAY_SIZE(v.data); ++j){            \
+                                item.indexes_0[j] = rint(v.data[j] / (job)->resolutions[j]); \
+                        }                                               \
+                        ITEM_INTENSITY_SET(item, (job), image, i, (job)->weight); \
+                                                                        \
+                        if(KERNEL_IN_THE_LIMITS(limits_, item, box))    \
+                                space_add_item(space, &item);           \
+                }                                                       \
+        } while(0)
+
+#define HKL_BINOCULARS_ANGLES_RANGE_IMPL(image_t)                      \
+        static void angles_range_ ## image_t (const HklBinocularsFrameJob *job, \
+                                              HklBinocularsSpace *space, \
+                                              size_t first, size_t last) \
+        {                                                               \
+                const image_t *image = job->image;                      \
+                                                                        \
+                KERNEL_DISPATCH_LIMITS(ANGLES_KERNEL, job, image, job, space, first, last); \
+        }
+
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(int32_t);
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(uint16_t);
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(uint32_t);
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(uint8_t);
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(int16_t);
+HKL_BINOCULARS_ANGLES_RANGE_IMPL(float);
+
+#define HKL_BINOCULARS_SPACE_ANGLES_IMPL(image_t)                       \
+        HKL_BINOCULARS_SPACE_ANGLES_DECL(image_t)                       \
+        {                                                               \
+                const char * names[] = {"delta_lab", "gamma_lab", "tth"}; \
+                const HklBinocularsProjectionContext *ctx = projection_context_get(); \
+                HklBinocularsFrameJob job = {                           \
+                        .range = angles_range_ ## image_t,              \
+                        .image = image,                                 \
+                        .n_pixels = n_pixels,                           \
+                        .weight = weight,                               \
+                        .pixels_coordinates = pixels_coordinates,       \
+                        .resolutions = resolutions,                     \
+                        .masked = masked,                               \
+                        .limits = limits,                               \
+                        .n_limits = n_limits,                           \
+                        .q = hkl_geometry_detector_rotation_get(geometry, ctx->detector), \
+                        .fast = g_atomic_int_get(&fast_trigonometry),   \
+                        .corrections = corrections_get(n_pixels),       \
+                        .width = pixels_coordinates_dims[pixels_coordinates_ndim - 1], \
+                        .height = pixels_coordinates_dims[pixels_coordinates_ndim - 2], \
+                };                                                      \
+                                                                        \
+                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
+                assert(ARRAY_SIZE(names) == n_resolutions);             \
+                assert(n_pixels == space->max_items);                   \
+                                                                        \
+                frame_run(&job, space);                                 \
+                                                                        \
+                space_update_axes(space, names, n_pixels, resolutions); \
+        }
+
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(int32_t);
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(uint16_t);
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(uint32_t);
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(uint8_t);
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(int16_t);
+HKL_BINOCULARS_SPACE_ANGLES_IMPL(float);
+
+/* qcustom */
+
+struct _HklBinocularsProjectionAxis
+{
+        const char *name;
+        const char *description;
+};
+
+typedef struct _HklBinocularsProjectionAxis HklBinocularsProjectionAxis;
+
+static const HklBinocularsProjectionAxis azimuth =
+{
+        .name = "azimuth",
+        .description = "The azimuthal angle in the yz plan of the kf vector",
+};
+static const HklBinocularsProjectionAxis deltalab =
+{
+        .name = "deltalab",
+        .description = "The delta horizontal deviation in the lab basis",
+};
+static const HklBinocularsProjectionAxis gammalab =
+{
+        .name = "gammalab",
+        .description = "The gamma elevation in the lab basis",
+};
+static const HklBinocularsProjectionAxis q =
+{
+        .name = "q",
+        .description = "The norm of the q vector",
+};
+static const HklBinocularsProjectionAxis qpar =
+{
+        .name = "qpar",
+        .description = "The norm of the q vector projected onto the plan parallel to the surface."
+};
+static const HklBinocularsProjectionAxis qpars =
+{
+        .name = "qpars",
+        .description = "The signed norm of the q vector projected onto the plan parallel to the surface."
+};
+static const HklBinocularsProjectionAxis qper =
+{
+        .name = "qper",
+        .description = "The norm of the q vector projected onto the surface vector (perpendicular to the surface)."
+};
+static const HklBinocularsProjectionAxis qx =
+{
+        .name = "qx",
+        .description = "The x coordinate of the Q vector in the sample basis."
+};
+static const HklBinocularsProjectionAxis qy =
+{
+        .name = "qy",
+        .description = "The y coordinate of the Q vector in the sample basis."
+};
+static const HklBinocularsProjectionAxis qz =
+{
+        .name = "qz",
+        .description = "The z coordinate of the Q vector in the sample basis."
+};
+static const HklBinocularsProjectionAxis phi =
+{
+        .name = "phi",
+        .description = "The azimuthal angle in the yz plan of the q vector",
+};
+static const HklBinocularsProjectionAxis sampleaxis =
+{
+        .name = "sampleaxis",
+        .description = "The name of a sample axis",
+};
+static const HklBinocularsProjectionAxis timestamp =
+{
+        .name = "timestamp",
+        .description = "The timestamp of each image",
+};
+static const HklBinocularsProjectionAxis tth =
+{
+        .name = "tth",
+        .description = "The 2 * theta angle.",
+};
+static const HklBinocularsProjectionAxis xp =
+{
+        .name = "xp",
+        .description = "The x coordinate of pixels projected in the yz plan",
+};
+static const HklBinocularsProjectionAxis yp =
+{
+        .name="yp",
+        .description = "The y coordinate of pixels projected in the yz plan",
+};
+static const HklBinocularsProjectionAxis x =
+{
+        .name="x",
+        .description = "The x coordinate of pixels",
+};
+static const HklBinocularsProjectionAxis y =
+{
+        .name="y",
+        .description = "The y coordinate of pixels",
+};
+static const HklBinocularsProjectionAxis z =
+{
+        .name="z",
+        .description = "The z coordinate of pixels",
+};
+
+
+#define PROJECTION(...) do {                                            \
+                int i;                                                  \
+                int n;                                                  \
+                static const HklBinocularsProjectionAxis axes[] = {__VA_ARGS__}; \
+                /* the names of the unused axes of the spaces are NULL */ \
+                static const char *axes_names[3];                       \
+                                                                        \
+                n = ARRAY_SIZE(axes);                                   \
+                assert(NULL == space || n <= darray_size(space->axes)); \
+                assert(n <= n_resolutions);                             \
+                                                                        \
+                for(i=0; i<n; ++i)                                      \
                         axes_names[i] = axes[i].name;                   \
                 names = axes_names;                                     \
+                if(NULL != n_axes)                                      \
+                        *n_axes = n;                                    \
         }while(0)
 
 static const char **axis_name_from_subprojection(HklBinocularsQCustomSubProjectionEnum subprojection,
                                                  HklBinocularsSpace *space,
-                                                 int n_resolutions)
+                                                 int n_resolutions,
+                                                 size_t *n_axes)
 {
         const char **names;
 
         switch(subprojection){
         case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS: /* replaced by the names of the expressions */
         case HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS:
         {
                 PROJECTION(qx, qy, qz);
@@ -611,6 +1570,16 @@ static const char **axis_name_from_subprojection(HklBinocularsQCustomSubProjecti
                 PROJECTION(tth, azimuth);
                 break;
         }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q:
+        {
+                PROJECTION(q);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH:
+        {
+                PROJECTION(tth);
+                break;
+        }
         default:
         {
                 PROJECTION(qx, qy, qz);
@@ -681,1189 +1650,4583 @@ static inline double compute_qper(vec3s q)
         return compute_qz(q);
 }
 
-static inline double compute_tth(float q, float k)
+static inline double compute_tth(float q, float k, int fast)
 {
-        return asin(q / 2 / k) * 2 / M_PI * 180;
+        return trigo_asin(q / 2 / k, fast) * 2 / M_PI * 180;
 }
 
-static inline double compute_azimuth(vec3s kf)
+static inline double compute_azimuth(vec3s kf, int fast)
 {
-        return (atan2(kf.raw[2], kf.raw[1])) / M_PI * 180;
+        return (trigo_atan2(kf.raw[2], kf.raw[1], fast)) / M_PI * 180;
 }
 
-#define HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(image_t)			\
-        HKL_BINOCULARS_SPACE_QCUSTOM_DECL(image_t)			\
-        {                                                               \
-		size_t i;						\
-                HklBinocularsSpaceItem item;                            \
-                double correction;                                      \
-		const char **names = axis_name_from_subprojection(subprojection, space, n_resolutions); \
-		assert(n_pixels == space->max_items);			\
-                                                                        \
-		const double *q_x = &pixels_coordinates[0 * n_pixels];	\
-		const double *q_y = &pixels_coordinates[1 * n_pixels];	\
-		const double *q_z = &pixels_coordinates[2 * n_pixels];	\
-                                                                        \
-		HklSample *sample = hkl_sample_new("test");		\
-		HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D); \
-		HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, detector); \
-                CGLM_ALIGN_MAT mat4s m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
-		const HklVector ki_v = hkl_geometry_ki_get(geometry);	\
-                CGLM_ALIGN_MAT vec3s ki = {{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
-	        float k = glms_vec3_norm(ki);                           \
-		HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry,sample); \
-                CGLM_ALIGN_MAT mat4s m_holder_s = hkl_binoculars_holder_transformation_get(holder_s); \
-                                                                        \
-		switch(surf){						\
-		case HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL:	\
-		{							\
-                        CGLM_ALIGN_MAT vec3s axis = GLMS_XUP;           \
-			CGLM_ALIGN_MAT mat4s m_q_ub = glms_rotate_make(-M_PI_2, axis); \
-                                                                        \
-                        m_holder_s = glms_mat4_mul(m_holder_s, m_q_ub); \
-			break;						\
-		}							\
-		case HKL_BINOCULARS_SURFACE_ORIENTATION_HORIZONTAL:	\
-		case HKL_BINOCULARS_SURFACE_ORIENTATION_NUM_ORIENTATION: \
-			break;						\
-		}							\
+/* Vectorised pixels kernel */
+
+/* Runtime selection of the instruction set. The kernel is compiled
+ * once per target and the dynamic loader pick the best one for the
+ * running cpu, so the same binary runs on all the nodes. On aarch64
+ * NEON is always available, so the default build is already
+ * vectorised. */
+#if defined(__x86_64__) && defined(__has_attribute)
+# if __has_attribute(target_clones)
+#  define HKL_BINOCULARS_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+# endif
+#endif
+#ifndef HKL_BINOCULARS_TARGET_CLONES
+# define HKL_BINOCULARS_TARGET_CLONES
+#endif
+
+/* configure --enable-binoculars-offload runs the kf kernel of the
+ * whole detector on the default OpenMP device (a GPU when the
+ * compiler was built with offloading). The kf table is computed for
+ * all the pixels each time the detector moves, so this is the full
+ * frame work of the detector scans. Without device the kernel runs
+ * on the host. The cloned host kernels can not be offloaded. */
+#ifdef HKL_BINOCULARS_OFFLOAD
+# define HKL_BINOCULARS_KF_TARGET_CLONES
+#else
+# define HKL_BINOCULARS_KF_TARGET_CLONES HKL_BINOCULARS_TARGET_CLONES
+#endif
+
+/* number of pixels projected at once, the block stays in the L1 cache */
+#define HKL_BINOCULARS_BLOCK_SIZE 256
+
+typedef struct _HklBinocularsPixelsBlock HklBinocularsPixelsBlock;
+struct _HklBinocularsPixelsBlock
+{
+        HklBinocularsReal q_x[HKL_BINOCULARS_BLOCK_SIZE]; /* q in the sample basis */
+        HklBinocularsReal q_y[HKL_BINOCULARS_BLOCK_SIZE];
+        HklBinocularsReal q_z[HKL_BINOCULARS_BLOCK_SIZE];
+};
+
+/* compute kf in the lab basis for n pixels of the SoA pixels
+ * coordinates. This is the glms_mat4_mulv3 / glms_vec3_scale_as
+ * chain written without branch so that the compiler can vectorise
+ * it. The float operations are the same and in the same order for
+ * all the targets (no fma contraction, see Makefile.am), so every
+ * clone produces the same bins. */
+HKL_BINOCULARS_KF_TARGET_CLONES
+static void pixels_kf_compute(HklBinocularsReal *restrict kf_x,
+                              HklBinocularsReal *restrict kf_y,
+                              HklBinocularsReal *restrict kf_z,
+                              const double *restrict x,
+                              const double *restrict y,
+                              const double *restrict z,
+                              size_t n,
+                              const mat4s *m_holder_d,
+                              float k)
+{
+        size_t j;
+        const mat4s d = *m_holder_d;
+
+#ifdef HKL_BINOCULARS_OFFLOAD
+#pragma omp target teams distribute parallel for                        \
+        map(to: x[0:n], y[0:n], z[0:n], d)                              \
+        map(from: kf_x[0:n], kf_y[0:n], kf_z[0:n])
+#endif
+        for(j=0; j<n; ++j){
+                HklBinocularsReal vx = x[j];
+                HklBinocularsReal vy = y[j];
+                HklBinocularsReal vz = z[j];
+
+                /* pixel position in the lab basis */
+                HklBinocularsReal lx = d.raw[0][0] * vx + d.raw[1][0] * vy + d.raw[2][0] * vz + d.raw[3][0];
+                HklBinocularsReal ly = d.raw[0][1] * vx + d.raw[1][1] * vy + d.raw[2][1] * vz + d.raw[3][1];
+                HklBinocularsReal lz = d.raw[0][2] * vx + d.raw[1][2] * vy + d.raw[2][2] * vz + d.raw[3][2];
+
+                /* kf */
+                HklBinocularsReal norm = HKL_BINOCULARS_SQRT(lx * lx + ly * ly + lz * lz);
+                HklBinocularsReal scale = k / norm;
+
+                scale = norm == 0 ? 0 : scale; /* like glms_vec3_scale_as */
+                kf_x[j] = lx * scale;
+                kf_y[j] = ly * scale;
+                kf_z[j] = lz * scale;
+        }
+}
+
+/* compute q in the sample basis from kf for the n pixels of indexes,
+ * this is the glms_vec3_sub / glms_mat4_mulv3 chain. */
+HKL_BINOCULARS_TARGET_CLONES
+static void pixels_q_compute(HklBinocularsPixelsBlock *block,
+                             const HklBinocularsReal *restrict kf_x,
+                             const HklBinocularsReal *restrict kf_y,
+                             const HklBinocularsReal *restrict kf_z,
+                             const uint32_t *restrict indexes,
+                             size_t n,
+                             const mat4s *m_holder_s,
+                             const vec3s *ki)
+{
+        size_t j;
+        const mat4s s = *m_holder_s;
+        const vec3s k_i = *ki;
+
+        for(j=0; j<n; ++j){
+                HklBinocularsReal qx = kf_x[indexes[j]] - k_i.raw[0];
+                HklBinocularsReal qy = kf_y[indexes[j]] - k_i.raw[1];
+                HklBinocularsReal qz = kf_z[indexes[j]] - k_i.raw[2];
+
+                block->q_x[j] = s.raw[0][0] * qx + s.raw[1][0] * qy + s.raw[2][0] * qz;
+                block->q_y[j] = s.raw[0][1] * qx + s.raw[1][1] * qy + s.raw[2][1] * qz;
+                block->q_z[j] = s.raw[0][2] * qx + s.raw[1][2] * qy + s.raw[2][2] * qz;
+        }
+}
+
+/* return the kf table of the pixels, it is computed only when the
+ * detector moved or the wavelength changed since the previous frame
+ * of this thread (sample only scans, ...). */
+static const HklBinocularsKfTable *kf_table_get(HklBinocularsProjectionContext *ctx,
+                                                const double *pixels_coordinates,
+                                                size_t n_pixels,
+                                                const mat4s *m_holder_d,
+                                                float k)
+{
+        size_t i;
+        double samples[9];
+        HklBinocularsKfTable *self = &ctx->kf;
+
+        kf_table_samples(pixels_coordinates, n_pixels, samples);
+
+        if (TRUE == self->valid
+            && self->pixels_coordinates == pixels_coordinates
+            && self->n_pixels == n_pixels
+            && self->k == k
+            && 0 == memcmp(&self->m_holder_d, m_holder_d, sizeof(*m_holder_d))
+            && 0 == memcmp(self->samples, samples, sizeof(samples)))
+                return self;
+
+        if (self->capacity < n_pixels){
+                self->x = realloc(self->x, n_pixels * sizeof(*self->x));
+                self->y = realloc(self->y, n_pixels * sizeof(*self->y));
+                self->z = realloc(self->z, n_pixels * sizeof(*self->z));
+                self->polarisation = realloc(self->polarisation, n_pixels * sizeof(*self->polarisation));
+                self->capacity = n_pixels;
+        }
+
+        pixels_kf_compute(self->x, self->y, self->z,
+                          &pixels_coordinates[0 * n_pixels],
+                          &pixels_coordinates[1 * n_pixels],
+                          &pixels_coordinates[2 * n_pixels],
+                          n_pixels, m_holder_d, k);
+
+        /* same computation than polarisation() without the weight */
+        for(i=0; i<n_pixels; ++i){
+                CGLM_ALIGN_MAT vec3s epsilon = {{0, 1, 0}};
+                CGLM_ALIGN_MAT vec3s kf = {{self->x[i], self->y[i], self->z[i]}};
+                float p = glms_vec3_dot(epsilon, kf) / glms_vec3_norm2(kf);
+
+                self->polarisation[i] = 1 - p*p;
+        }
+
+        self->valid = TRUE;
+        self->m_holder_d = *m_holder_d;
+        self->k = k;
+        self->pixels_coordinates = pixels_coordinates;
+        self->n_pixels = n_pixels;
+        memcpy(self->samples, samples, sizeof(samples));
+
+        return self;
+}
+
+/* the sample axis of the geometry. With a cache, the index of the
+ * axis is resolved by name only once, the geometries of a projection
+ * having all the same axes. */
+static inline const HklParameter *sample_axis_get(const HklGeometry *geometry,
+                                                  const char *sample_axis,
+                                                  gint *cache)
+{
+        gint idx;
+
+        if(NULL == cache)
+                return hkl_geometry_axis_get(geometry, sample_axis, NULL);
+
+        idx = g_atomic_int_get(cache);
+        if(idx < 0){
+                idx = hkl_geometry_axis_idx_get(geometry, sample_axis);
+                if(idx < 0)
+                        return NULL;
+                g_atomic_int_set(cache, idx);
+        }
+
+        return hkl_geometry_axis_get_by_idx(geometry, idx, NULL);
+}
+
+/* return FALSE if the subprojection needs a sample axis which is not
+ * part of the geometry, otherwise compute its bin index. */
+static inline int sample_axis_index_get(const HklGeometry *geometry,
+                                        const char *sample_axis,
+                                        gint *cache,
+                                        HklBinocularsQCustomSubProjectionEnum subprojection,
+                                        const double *resolutions,
+                                        ptrdiff_t *index)
+{
+        size_t idx;
+        const HklParameter *p;
+
+        switch(subprojection){
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_SAMPLEAXIS:
+                idx = 2;
+                break;
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TTH:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TIMESTAMP:
+                idx = 1;
+                break;
+        default:
+                return TRUE;
+        }
+
+        p = sample_axis_get(geometry, sample_axis, cache);
+        if (NULL == p)
+                return FALSE;
+
+        *index = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / resolutions[idx]);
+
+        return TRUE;
+}
+
+/* compute the bins of one pixel from its q vector (sample basis) and
+ * its kf vector (lab basis) */
+static inline void qcustom_item_indexes(HklBinocularsSpaceItem *item,
+                                        HklBinocularsQCustomSubProjectionEnum subprojection,
+                                        vec3s v, vec3s kf, float k,
+                                        double timestamp, ptrdiff_t axis,
+                                        const double *resolutions, int fast)
+{
+        switch(subprojection){
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TTH_TIMESTAMP:
+        {
+                float q = compute_q(v);
+                float tth = compute_tth(q, k, fast);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint(tth / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TIMESTAMP:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint(timestamp / resolutions[1]);
+                item->indexes_0[2] = REMOVED;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_TIMESTAMP:
+        {
+                float qpar = compute_qpar(v);
+                float qper = compute_qper(v);
+                item->indexes_0[0] = rint(qpar / resolutions[0]);
+                item->indexes_0[1] = rint(qper / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER:
+        {
+                float qpar = compute_qpar(v);
+                float qper = compute_qper(v);
+                item->indexes_0[0] = rint(qpar / resolutions[0]);
+                item->indexes_0[1] = rint(qper / resolutions[1]);
+                item->indexes_0[2] = REMOVED;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QX:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint((trigo_atan2(v.raw[2], -v.raw[1], fast)) / M_PI * 180 / resolutions[1]);
+                item->indexes_0[2] = rint(v.raw[0] / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QY:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint((trigo_atan2(v.raw[2], v.raw[0], fast)) / M_PI * 180 / resolutions[1]);
+                item->indexes_0[2] = rint(v.raw[1] / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QZ:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint((trigo_atan2(v.raw[0], v.raw[1], fast)) / M_PI * 180 / resolutions[1]);
+                item->indexes_0[2] = rint(v.raw[2] / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_STEREO:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                double ratio = v.raw[2] + item->indexes_0[0];
+                item->indexes_0[1] = rint(v.raw[0] / ratio / resolutions[1]);
+                item->indexes_0[2] = rint(v.raw[1] / ratio / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_QPAR_QPER:
+        {
+                float q = compute_q(v);
+                float qpar = compute_qpar(v);
+                float qper = compute_qper(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = rint(qpar / resolutions[1]);
+                item->indexes_0[2] = rint(qper / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPARS_QPER_TIMESTAMP:
+        {
+                float qpars = compute_qpar_signed(v);
+                float qper = compute_qper(v);
+                item->indexes_0[0] = rint(qpars / resolutions[0]);
+                item->indexes_0[1] = rint(qper / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_SAMPLEAXIS:
+        {
+                float qpar = compute_qpar(v);
+                float qper = compute_qper(v);
+                item->indexes_0[0] = rint(qpar / resolutions[0]);
+                item->indexes_0[1] = rint(qper / resolutions[1]);
+                item->indexes_0[2] = axis;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TTH:
+        {
+                float q = compute_q(v);
+                double tth = compute_tth(q, k, fast);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = axis;
+                item->indexes_0[2] = rint(tth / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TIMESTAMP:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = axis;
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_TIMESTAMP:
+        {
+                item->indexes_0[0] = rint(v.raw[0] / resolutions[0]);
+                item->indexes_0[1] = rint(v.raw[1] / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QZ_TIMESTAMP:
+        {
+                item->indexes_0[0] = rint(v.raw[0] / resolutions[0]);
+                item->indexes_0[1] = rint(v.raw[2] / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QY_QZ_TIMESTAMP:
+        {
+                item->indexes_0[0] = rint(v.raw[1] / resolutions[0]);
+                item->indexes_0[1] = rint(v.raw[2] / resolutions[1]);
+                item->indexes_0[2] = rint(timestamp / resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH_AZIMUTH:
+        {
+                float q = compute_q(v);
+                double tth = compute_tth(q, k, fast);
+                double azimuth = compute_azimuth(kf, fast);
+                item->indexes_0[0] = rint(tth / resolutions[0]);
+                item->indexes_0[1] = rint(azimuth / resolutions[1]);
+                item->indexes_0[2] = REMOVED;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q:
+        {
+                float q = compute_q(v);
+                item->indexes_0[0] = rint(q / resolutions[0]);
+                item->indexes_0[1] = REMOVED;
+                item->indexes_0[2] = REMOVED;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH:
+        {
+                float q = compute_q(v);
+                double tth = compute_tth(q, k, fast);
+                item->indexes_0[0] = rint(tth / resolutions[0]);
+                item->indexes_0[1] = REMOVED;
+                item->indexes_0[2] = REMOVED;
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ:
+        case HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS:
+        default:
+        {
+                item->indexes_0[0] = rint(v.raw[0] / resolutions[0]);
+                item->indexes_0[1] = rint(v.raw[1] / resolutions[1]);
+                item->indexes_0[2] = rint(v.raw[2] / resolutions[2]);
+                break;
+        }
+        }
+}
+
+/* the part of the sample transformation which does not depend on the
+ * geometry: the surface orientation and the uqx, uqy, uqz rotation */
+static inline mat4s qcustom_m_sample_get(HklBinocularsSurfaceOrientationEnum surf,
+                                         double uqx, double uqy, double uqz)
+{
+        CGLM_ALIGN_MAT vec3s euler_xyz = {{uqx, uqy, uqz}};
+        CGLM_ALIGN_MAT mat4s m = GLMS_MAT4_IDENTITY_INIT;
+
+        switch(surf){
+        case HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL:
+        {
+                CGLM_ALIGN_MAT vec3s axis = GLMS_XUP;
+
+                m = glms_rotate_make(-M_PI_2, axis);
+                break;
+        }
+        case HKL_BINOCULARS_SURFACE_ORIENTATION_HORIZONTAL:
+        case HKL_BINOCULARS_SURFACE_ORIENTATION_NUM_ORIENTATION:
+                break;
+        }
+
+        return glms_mat4_mul(m, glms_euler_xyz(euler_xyz));
+}
+
+/* compute the transformations used by the qcustom projection.
+ * m_holder_s transforms a vector from the lab basis into the sample
+ * basis (m_sample included). */
+static inline void qcustom_transformations_get(const HklGeometry *geometry,
+                                               const mat4s *m_sample,
+                                               mat4s *m_holder_d,
+                                               mat4s *m_holder_s,
+                                               vec3s *ki,
+                                               float *k)
+{
+        const HklBinocularsProjectionContext *ctx = projection_context_get();
+        HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, ctx->detector);
+        HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry, ctx->sample);
+        const HklVector ki_v = hkl_geometry_ki_get(geometry);
+
+        *m_holder_d = hkl_binoculars_holder_transformation_get(holder_d);
+        *ki = (vec3s){{ki_v.data[0], ki_v.data[1], ki_v.data[2]}};
+        *k = glms_vec3_norm(*ki);
+        /* m_sample is a rotation, its inverse is its transpose */
+        *m_holder_s = glms_mat4_mul(glms_mat4_transpose(*m_sample),
+                                    hkl_binoculars_holder_inverse_transformation_get(holder_s));
+
+        debug_mat4_print(*m_holder_s);
+        debug_mat4_print(*m_holder_d);
+}
+
+/* prepare the job of a qcustom frame, return FALSE if there is
+ * nothing to project (the sample axis is missing) */
+static inline int qcustom_job_init(HklBinocularsFrameJob *job,
+                                   const HklGeometry *geometry,
+                                   const mat4s *m_sample,
+                                   const char *sample_axis,
+                                   gint *sample_axis_idx)
+{
+        /* the kf table is computed from the sub-pixels */
+        frame_job_indexes_init(job);
+
+        qcustom_transformations_get(geometry, m_sample,
+                                    &job->m_holder_d, &job->m_holder_s,
+                                    &job->ki, &job->k);
+        job->axis = 0;
+        job->kfs = NULL;
+
+        /* without expression, the expressions subprojection is qx_qy_qz */
+        if(HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS == job->subprojection
+           && 0 == job->n_expressions)
+                job->subprojection = HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ;
+
+        switch(job->subprojection){
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_DELTALAB_GAMMALAB_SAMPLEAXIS:
+        {
+                const HklParameter *p = sample_axis_get(geometry, sample_axis, sample_axis_idx);
+                if (NULL == p)
+                        return FALSE;
+                job->axis = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / job->resolutions[2]);
+                break;
+        }
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_X_Y_Z:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Y_Z_TIMESTAMP:
+                break;
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS:
+        {
+                size_t e;
+
+                job->variables = 0;
+                for(e=0; e<job->n_expressions; ++e)
+                        job->variables |= hkl_binoculars_expression_variables_get(job->expressions[e]);
+
+                if(job->variables & (1u << HKL_BINOCULARS_EXPRESSION_VARIABLE_SAMPLEAXIS)){
+                        const HklParameter *p = sample_axis_get(geometry, sample_axis, sample_axis_idx);
+                        if (NULL == p)
+                                return FALSE;
+                        job->sample_axis_value = hkl_parameter_value_get(p, HKL_UNIT_USER);
+                }
+
+                job->kfs = kf_table_get(projection_context_get(),
+                                        job->pixels_coordinates, job->n_pixels,
+                                        &job->m_holder_d, job->k);
+                break;
+        }
+        default:
+                if(FALSE == sample_axis_index_get(geometry, sample_axis,
+                                                  sample_axis_idx,
+                                                  job->subprojection,
+                                                  job->resolutions, &job->axis))
+                        return FALSE;
+
+                job->kfs = kf_table_get(projection_context_get(),
+                                        job->pixels_coordinates, job->n_pixels,
+                                        &job->m_holder_d, job->k);
+                break;
+        }
+
+        return TRUE;
+}
+
+/* the variables and the axes of the expressions subprojection for a
+ * block of pixels, only the variables read by the expressions are
+ * computed */
+typedef struct _HklBinocularsExpressionsBlock HklBinocularsExpressionsBlock;
+struct _HklBinocularsExpressionsBlock
+{
+        double values[HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES][HKL_BINOCULARS_BLOCK_SIZE];
+        const double *variables[HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES];
+        double axes[3][HKL_BINOCULARS_BLOCK_SIZE];
+};
+
+static inline void expressions_block_compute(HklBinocularsExpressionsBlock *self,
+                                             const HklBinocularsFrameJob *job,
+                                             const HklBinocularsPixelsBlock *block,
+                                             const uint32_t *indexes, size_t n)
+{
+        size_t e, j, v;
+        const HklBinocularsKfTable *kfs = job->kfs;
+
+        for(v=0; v<HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES; ++v){
+                double *values = self->values[v];
+
+                self->variables[v] = values;
+                if(0 == (job->variables & (1u << v)))
+                        continue;
+
+                for(j=0; j<n; ++j){
+                        size_t i = indexes[j];
+                        CGLM_ALIGN_MAT vec3s q = {{block->q_x[j], block->q_y[j], block->q_z[j]}};
+
+                        switch(v){
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_QX: values[j] = compute_qx(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_QY: values[j] = compute_qy(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_QZ: values[j] = compute_qz(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_Q: values[j] = compute_q(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_QPAR: values[j] = compute_qpar(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_QPER: values[j] = compute_qper(q); break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_TTH:
+                                values[j] = compute_tth(compute_q(q), job->k, job->fast);
+                                break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_AZIMUTH:
+                        {
+                                CGLM_ALIGN_MAT vec3s kf = {{kfs->x[i], kfs->y[i], kfs->z[i]}};
+
+                                values[j] = compute_azimuth(kf, job->fast);
+                                break;
+                        }
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_KFX: values[j] = kfs->x[i]; break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_KFY: values[j] = kfs->y[i]; break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_KFZ: values[j] = kfs->z[i]; break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_TIMESTAMP: values[j] = job->timestamp; break;
+                        case HKL_BINOCULARS_EXPRESSION_VARIABLE_SAMPLEAXIS: values[j] = job->sample_axis_value; break;
+                        }
+                }
+        }
+
+        for(e=0; e<job->n_expressions; ++e)
+                hkl_binoculars_expression_eval(job->expressions[e], self->variables,
+                                               n, self->axes[e]);
+}
+
+#define QCUSTOM_FRAME_JOB(range_)                                       \
+        {                                                               \
+                .range = range_,                                        \
+                .image = image,                                         \
+                .n_pixels = n_pixels,                                   \
+                .weight = weight,                                       \
+                .pixels_coordinates = pixels_coordinates,               \
+                .resolutions = resolutions,                             \
+                .masked = masked,                                       \
+                .limits = limits,                                       \
+                .n_limits = n_limits,                                   \
+                .timestamp = timestamp,                                 \
+                .subprojection = subprojection,                         \
+                .do_polarisation_correction = do_polarisation_correction, \
+                .fast = g_atomic_int_get(&fast_trigonometry),           \
+                .corrections = corrections_get(n_pixels),               \
+                .width = pixels_coordinates_dims[pixels_coordinates_ndim - 1], \
+                .height = pixels_coordinates_dims[pixels_coordinates_ndim - 2], \
+        }
+
+/* project the not masked pixels [first, last) of an image and give
+ * each item in the limits to EMIT(item). This is the body shared by
+ * the qcustom projection into a space and the direct accumulation
+ * into a cube. */
+#define QCUSTOM_PIXELS_KERNEL(limits_, polarisation_, box, EMIT, image, job, first, last) do { \
+                size_t p;                                               \
+                HklBinocularsSpaceItem item;                            \
+                double correction;                                      \
+                const uint32_t *indexes = (job)->indexes;               \
                                                                         \
-                CGLM_ALIGN_MAT vec3s euler_xyz = {{uqx, uqy, uqz}};     \
-                m_holder_s = glms_mat4_mul(m_holder_s, glms_euler_xyz(euler_xyz)); \
+		const double *q_x = &(job)->pixels_coordinates[0 * (job)->n_pixels]; \
+		const double *q_y = &(job)->pixels_coordinates[1 * (job)->n_pixels]; \
+		const double *q_z = &(job)->pixels_coordinates[2 * (job)->n_pixels]; \
                                                                         \
-		m_holder_s = glms_mat4_inv(m_holder_s);                 \
+                switch((job)->subprojection){                           \
+                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_DELTALAB_GAMMALAB_SAMPLEAXIS: \
+                {                                                       \
+                        for(p=(first);p<(last);++p){                    \
+                                size_t i = indexes[p];                  \
+                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
                                                                         \
-		darray_size(space->items) = 0;				\
+                                v = glms_mat4_mulv3((job)->m_holder_d, v, 1); \
+                                correction = polarisation(v, (job)->weight, (polarisation_)); \
                                                                         \
-                glms_mat4_print(m_holder_s, stdout);                    \
-                glms_mat4_print(m_holder_d, stdout);                    \
+                                item.indexes_0[0] = rint(trigo_atan2(v.raw[2], sqrt(v.raw[0] * v.raw[0] + v.raw[1] * v.raw[1]), (job)->fast) / M_PI * 180 / (job)->resolutions[0]); \
+                                item.indexes_0[1] = rint(trigo_atan2(v.raw[1], v.raw[0], (job)->fast) / M_PI * 180 / (job)->resolutions[1]); \
+                                item.indexes_0[2] = (job)->axis;        \
+                                ITEM_INTENSITY_SET(item, (job), image, i, correction); \
                                                                         \
-                switch(subprojection){                                  \
-                case HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS:         \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ:    \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v, ki);       \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-                                        item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
-                                        item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TTH_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-                                        float tth = compute_tth(q, k);  \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint(tth / resolutions[1]); \
-					item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint(timestamp / resolutions[1]); \
-					item.indexes_0[2] = REMOVED;	\
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float qpar = compute_qpar(v);   \
-                                        float qper = compute_qper(v);   \
-					item.indexes_0[0] = rint(qpar / resolutions[0]); \
-                                        item.indexes_0[1] = rint(qper / resolutions[1]); \
-					item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER:   \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float qpar = compute_qpar(v);   \
-                                        float qper = compute_qper(v);   \
-					item.indexes_0[0] = rint(qpar / resolutions[0]); \
-                                        item.indexes_0[1] = rint(qper / resolutions[1]); \
-					item.indexes_0[2] = REMOVED;	\
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QX:    \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint((atan2(v.raw[2], -v.raw[1])) / M_PI * 180 / resolutions[1]); \
-					item.indexes_0[2] = rint(v.raw[0] / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
+                                if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                        EMIT(item);                     \
                         }                                               \
                         break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QY:    \
+                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_X_Y_Z:       \
                 {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint((atan2(v.raw[2], v.raw[0])) / M_PI * 180 / resolutions[1]); \
-					item.indexes_0[2] = rint(v.raw[1] / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
+                        for(p=(first);p<(last);++p){                    \
+                                size_t i = indexes[p];                  \
+                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
+                                                                        \
+                                v = glms_mat4_mulv3((job)->m_holder_d, v, 1); \
+                                correction = polarisation(v, (job)->weight, (polarisation_)); \
+                                                                        \
+				item.indexes_0[0] = rint(v.raw[0] / (job)->resolutions[0]); \
+				item.indexes_0[1] = rint(v.raw[1] / (job)->resolutions[1]); \
+				item.indexes_0[2] = rint(v.raw[2] / (job)->resolutions[2]); \
+                                ITEM_INTENSITY_SET(item, (job), image, i, correction); \
+                                                                        \
+                                if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                        EMIT(item);                     \
                         }                                               \
                         break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QZ:    \
+                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Y_Z_TIMESTAMP: \
                 {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint((atan2(v.raw[0], v.raw[1])) / M_PI * 180 / resolutions[1]); \
-					item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
+                        for(p=(first);p<(last);++p){                    \
+                                size_t i = indexes[p];                  \
+                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
+                                                                        \
+                                v = glms_mat4_mulv3((job)->m_holder_d, v, 1); \
+                                correction = polarisation(v, (job)->weight, (polarisation_)); \
+                                                                        \
+				item.indexes_0[0] = rint(v.raw[1] / (job)->resolutions[0]); \
+				item.indexes_0[1] = rint(v.raw[2] / (job)->resolutions[1]); \
+				item.indexes_0[2] = rint((job)->timestamp / (job)->resolutions[2]); \
+                                ITEM_INTENSITY_SET(item, (job), image, i, correction); \
+                                                                        \
+                                if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                        EMIT(item);                     \
                         }                                               \
                         break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_STEREO:    \
+                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS: \
                 {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					double ratio = v.raw[2] + item.indexes_0[0]; \
-					item.indexes_0[1] = rint(v.raw[0] / ratio / resolutions[1]); \
-					item.indexes_0[2] = rint(v.raw[1] / ratio / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
+                        HklBinocularsPixelsBlock block;                 \
+                        HklBinocularsExpressionsBlock exprs;            \
+                        const HklBinocularsKfTable *kfs = (job)->kfs;   \
+                                                                        \
+                        for(p=(first); p<(last); p+=HKL_BINOCULARS_BLOCK_SIZE){ \
+                                size_t e, j;                            \
+                                size_t n = (last) - p;                  \
+                                                                        \
+                                if (n > HKL_BINOCULARS_BLOCK_SIZE)      \
+                                        n = HKL_BINOCULARS_BLOCK_SIZE;  \
+                                                                        \
+                                pixels_q_compute(&block,                \
+                                                 kfs->x, kfs->y, kfs->z, \
+                                                 &indexes[p], n,        \
+                                                 &(job)->m_holder_s, &(job)->ki); \
+                                expressions_block_compute(&exprs, (job), &block, &indexes[p], n); \
+                                                                        \
+                                for(j=0; j<n; ++j){                     \
+                                        size_t i = indexes[p + j];      \
+                                                                        \
+                                        /* drop the pixels without value (log of a negative, ...) */ \
+                                        for(e=0; e<(job)->n_expressions; ++e) \
+                                                if(!isfinite(exprs.axes[e][j])) \
+                                                        break;          \
+                                        if(e < (job)->n_expressions)    \
+                                                continue;               \
+                                                                        \
+                                        correction = (polarisation_) ? (job)->weight / kfs->polarisation[i] : (job)->weight; \
+                                        for(e=0; e<ARRAY_SIZE(item.indexes_0); ++e) \
+                                                item.indexes_0[e] = e < (job)->n_expressions \
+                                                        ? rint(exprs.axes[e][j] / (job)->resolutions[e]) \
+                                                        : REMOVED;      \
+                                        ITEM_INTENSITY_SET(item, (job), image, i, correction); \
+                                                                        \
+                                        if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                                EMIT(item);             \
                                 }                                       \
                         }                                               \
                         break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_DELTALAB_GAMMALAB_SAMPLEAXIS: \
+                default:                                                \
                 {                                                       \
-                        const HklParameter *p = hkl_geometry_axis_get(geometry, sample_axis, NULL); \
-                        if (NULL != p){                                 \
-                                int axis = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / resolutions[2]); \
+                        HklBinocularsPixelsBlock block;                 \
+                        const HklBinocularsKfTable *kfs = (job)->kfs;   \
+                                                                        \
+                        for(p=(first); p<(last); p+=HKL_BINOCULARS_BLOCK_SIZE){ \
+                                size_t j;                               \
+                                size_t n = (last) - p;                  \
+                                                                        \
+                                if (n > HKL_BINOCULARS_BLOCK_SIZE)      \
+                                        n = HKL_BINOCULARS_BLOCK_SIZE;  \
                                                                         \
-                                for(i=0;i<n_pixels;++i){                \
-                                        if(not_masked(masked, i)){      \
-                                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
+                                pixels_q_compute(&block,                \
+                                                 kfs->x, kfs->y, kfs->z, \
+                                                 &indexes[p], n,        \
+                                                 &(job)->m_holder_s, &(job)->ki); \
                                                                         \
-                                                v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                                correction = polarisation(v, weight, do_polarisation_correction); \
+                                for(j=0; j<n; ++j){                     \
+                                        size_t i = indexes[p + j];      \
+                                        CGLM_ALIGN_MAT vec3s kf = {{kfs->x[i], kfs->y[i], kfs->z[i]}}; \
+                                        CGLM_ALIGN_MAT vec3s v = {{block.q_x[j], block.q_y[j], block.q_z[j]}}; \
                                                                         \
-                                                item.indexes_0[0] = rint(atan2(v.raw[2], sqrt(v.raw[0] * v.raw[0] + v.raw[1] * v.raw[1])) / M_PI * 180 / resolutions[0]); \
-                                                item.indexes_0[1] = rint(atan2(v.raw[1], v.raw[0]) / M_PI * 180 / resolutions[1]); \
-                                                item.indexes_0[2] = axis; \
-                                                item.intensity = rint((double)image[i] * correction); \
+                                        correction = (polarisation_) ? (job)->weight / kfs->polarisation[i] : (job)->weight; \
+                                        qcustom_item_indexes(&item, (job)->subprojection, \
+                                                             v, kf, (job)->k, \
+                                                             (job)->timestamp, (job)->axis, \
+                                                             (job)->resolutions, (job)->fast); \
+                                        ITEM_INTENSITY_SET(item, (job), image, i, correction); \
                                                                         \
-                                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                        darray_append(space->items, item); \
-                                        }                               \
+                                        if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                                EMIT(item);             \
                                 }                                       \
                         }                                               \
                         break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_X_Y_Z:       \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        glms_vec3_print(v, stdout);     \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        glms_mat4_print(m_holder_d, stdout); \
-                                        glms_vec3_print(v, stdout);     \
-                                                                        \
-					item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-					item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
-					item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Y_Z_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
+        } while(0)
+
+#define QCUSTOM_PIXELS_LOOP(EMIT, image, job, first, last)              \
+        KERNEL_DISPATCH(QCUSTOM_PIXELS_KERNEL, (job), EMIT, image, (job), (first), (last))
+
+#define SPACE_EMIT(item) space_add_item(space, &(item))
+
+#define HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(image_t)                     \
+        static void qcustom_range_ ## image_t (const HklBinocularsFrameJob *job, \
+                                               HklBinocularsSpace *space, \
+                                               size_t first, size_t last) \
+        {                                                               \
+                const image_t *image = job->image;                      \
                                                                         \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
+                QCUSTOM_PIXELS_LOOP(SPACE_EMIT, image, job, first, last); \
+                if(job->frame_stats)                                    \
+                        FRAME_STATS_RANGE(image, job, space, first, last); \
+        }
+
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(int32_t);
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(uint16_t);
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(uint32_t);
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(uint8_t);
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(int16_t);
+HKL_BINOCULARS_QCUSTOM_RANGE_IMPL(float);
+
+#define HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(image_t)			\
+        HKL_BINOCULARS_SPACE_QCUSTOM_DECL(image_t)			\
+        {                                                               \
+		const char **names = axis_name_from_subprojection(subprojection, space, n_resolutions, NULL); \
+                HklBinocularsFrameJob job = QCUSTOM_FRAME_JOB(qcustom_range_ ## image_t); \
+                CGLM_ALIGN_MAT mat4s m_sample = qcustom_m_sample_get(surf, uqx, uqy, uqz); \
                                                                         \
-					item.indexes_0[0] = rint(v.raw[1] / resolutions[0]); \
-					item.indexes_0[1] = rint(v.raw[2] / resolutions[1]); \
-					item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
+		assert(n_pixels == space->max_items);			\
                                                                         \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_QPAR_QPER:	\
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-                                        float qpar = compute_qpar(v); \
-                                        float qper = compute_qper(v);   \
-					item.indexes_0[0] = rint(q / resolutions[0]); \
-					item.indexes_0[1] = rint(qpar / resolutions[1]); \
-					item.indexes_0[2] = rint(qper / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPARS_QPER_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float qpars = compute_qpar_signed(v); \
-                                        float qper = compute_qper(v);   \
-					item.indexes_0[0] = rint(qpars / resolutions[0]); \
-                                        item.indexes_0[1] = rint(qper / resolutions[1]); \
-					item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_SAMPLEAXIS: \
-                {                                                       \
-                        const HklParameter *p = hkl_geometry_axis_get(geometry, sample_axis, NULL); \
-                        if (NULL != p){                                 \
-                                int axis = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / resolutions[2]); \
-                                                                        \
-                                for(i=0;i<n_pixels;++i){                \
-                                        if(not_masked(masked, i)){      \
-                                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                                v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                                v = glms_vec3_scale_as(v, k); \
-                                                correction = polarisation(v, weight, do_polarisation_correction); \
-                                                v = glms_vec3_sub(v , ki); \
-                                                v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                                float qpar = compute_qpar(v); \
-                                                float qper = compute_qper(v); \
-                                                item.indexes_0[0] = rint(qpar / resolutions[0]); \
-                                                item.indexes_0[1] = rint(qper / resolutions[1]); \
-                                                item.indexes_0[2] = axis; \
-                                                item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                        darray_append(space->items, item); \
-                                        }                               \
-                                }                                       \
-                                break;                                  \
-                        }                                               \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TTH: \
-                {                                                       \
-                        const HklParameter *p = hkl_geometry_axis_get(geometry, sample_axis, NULL); \
-                        if (NULL != p){                                 \
-                                int axis = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / resolutions[1]); \
-                                                                        \
-                                for(i=0;i<n_pixels;++i){                \
-                                        if(not_masked(masked, i)){      \
-                                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                                v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                                v = glms_vec3_scale_as(v, k); \
-                                                correction = polarisation(v, weight, do_polarisation_correction); \
-                                                v = glms_vec3_sub(v , ki); \
-                                                v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                                float q = compute_q(v); \
-                                                double tth = compute_tth(q, k); \
-                                                item.indexes_0[0] = rint(q / resolutions[0]); \
-                                                item.indexes_0[1] = axis; \
-                                                item.indexes_0[2] = rint(tth / resolutions[2]); \
-                                                item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                        darray_append(space->items, item); \
-                                        }                               \
-                                }                                       \
-                                break;                                  \
-                        }                                               \
-                }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TIMESTAMP: \
-                {                                                       \
-                        const HklParameter *p = hkl_geometry_axis_get(geometry, sample_axis, NULL); \
-                        if (NULL != p){                                 \
-                                int axis = rint(hkl_parameter_value_get(p, HKL_UNIT_USER) / resolutions[1]); \
-                                                                        \
-                                for(i=0;i<n_pixels;++i){                \
-                                        if(not_masked(masked, i)){      \
-                                                CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                                v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                                v = glms_vec3_scale_as(v, k); \
-                                                correction = polarisation(v, weight, do_polarisation_correction); \
-                                                v = glms_vec3_sub(v , ki); \
-                                                v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                                float q = compute_q(v); \
-                                                item.indexes_0[0] = rint(q / resolutions[0]); \
-                                                item.indexes_0[1] = axis; \
-                                                item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                                item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                        darray_append(space->items, item); \
-                                        }                               \
-                                }                                       \
-                                break;                                  \
-                        }                                               \
+		darray_size(space->items) = 0;				\
+                                                                        \
+                if(TRUE == qcustom_job_init(&job, geometry, &m_sample, sample_axis, NULL)) \
+                        frame_run(&job, space);                         \
+                                                                        \
+		space_update_axes(space, names, n_pixels, resolutions);	\
+        }
+
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(int32_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(uint16_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(uint32_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(uint8_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(int16_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(float);
+
+/* qcustom plan */
+
+/* everything of a qcustom projection which depends only on the
+ * configuration, computed once instead of at each frame. */
+struct _HklBinocularsQCustomPlan
+{
+        HklBinocularsQCustomSubProjectionEnum subprojection;
+        const char **names;
+        size_t n_axes;
+        size_t n_pixels; /* of the detector */
+        size_t width;
+        size_t height;
+        const double *pixels; /* the borrowed pixels coordinates */
+        const double *pixels_coordinates; /* of the pixels or sub-pixels */
+        size_t n_coordinates;
+        double *subpixels; /* the owned sub-pixels coordinates or NULL */
+        size_t n_subpixels; /* per pixel */
+        uint32_t *indexes; /* the not masked pixels or sub-pixels */
+        size_t n_indexes;
+        double *resolutions;
+        size_t n_resolutions;
+        const HklBinocularsAxisLimits **limits;
+        size_t n_limits;
+        float m_sample[4][4]; /* copied into an aligned mat4s when used */
+        char *sample_axis;
+        gint *sample_axis_idx; /* resolved with the first geometry */
+        int do_polarisation_correction;
+        const HklBinocularsExpression **expressions; /* the borrowed axes of the expressions subprojection */
+        size_t n_expressions;
+        const char *expressions_names[3];
+};
+
+HklBinocularsQCustomPlan *hkl_binoculars_qcustom_plan_new(const double *pixels_coordinates,
+                                                          size_t pixels_coordinates_ndim,
+                                                          const size_t *pixels_coordinates_dims,
+                                                          const double *resolutions,
+                                                          size_t n_resolutions,
+                                                          const uint8_t *masked,
+                                                          HklBinocularsSurfaceOrientationEnum surf,
+                                                          const HklBinocularsAxisLimits **limits,
+                                                          size_t n_limits,
+                                                          HklBinocularsQCustomSubProjectionEnum subprojection,
+                                                          double uqx, double uqy, double uqz,
+                                                          const char *sample_axis,
+                                                          int do_polarisation_correction)
+{
+        size_t i, j;
+        size_t factor = g_atomic_int_get(&pixel_splitting);
+        uint32_t *mask_indexes;
+        size_t n_mask_indexes;
+        CGLM_ALIGN_MAT mat4s m_sample = qcustom_m_sample_get(surf, uqx, uqy, uqz);
+        HklBinocularsQCustomPlan *self = g_new0(HklBinocularsQCustomPlan, 1);
+
+        self->subprojection = subprojection;
+        self->names = axis_name_from_subprojection(subprojection, NULL, n_resolutions,
+                                                   &self->n_axes);
+        self->width = pixels_coordinates_dims[pixels_coordinates_ndim - 1];
+        self->height = pixels_coordinates_dims[pixels_coordinates_ndim - 2];
+        self->n_pixels = self->width * self->height;
+        self->pixels = pixels_coordinates;
+        self->resolutions = g_new(double, n_resolutions);
+        memcpy(self->resolutions, resolutions, n_resolutions * sizeof(*resolutions));
+        self->n_resolutions = n_resolutions;
+        if(n_limits > 0){
+                self->limits = g_new(const HklBinocularsAxisLimits *, n_limits);
+                memcpy(self->limits, limits, n_limits * sizeof(*limits));
+        }
+        self->n_limits = n_limits;
+        memcpy(self->m_sample, m_sample.raw, sizeof(self->m_sample));
+        self->sample_axis = g_strdup(sample_axis);
+        self->sample_axis_idx = g_new(gint, 1);
+        *self->sample_axis_idx = -1;
+        self->do_polarisation_correction = do_polarisation_correction;
+
+        mask_indexes = hkl_binoculars_detector_2d_mask_indexes_get(masked, self->n_pixels,
+                                                                   &n_mask_indexes);
+        if(factor > 1){
+                size_t n_subpixels = factor * factor;
+
+                assert(self->n_pixels * n_subpixels <= UINT32_MAX);
+
+                self->subpixels = malloc(3 * self->n_pixels * n_subpixels * sizeof(*self->subpixels));
+                subpixels_coordinates_compute(self->subpixels, pixels_coordinates,
+                                              self->width, self->height, factor);
+                self->pixels_coordinates = self->subpixels;
+                self->n_coordinates = self->n_pixels * n_subpixels;
+                self->n_subpixels = n_subpixels;
+
+                self->indexes = malloc(n_mask_indexes * n_subpixels * sizeof(*self->indexes));
+                for(i=0; i<n_mask_indexes; ++i)
+                        for(j=0; j<n_subpixels; ++j)
+                                self->indexes[i * n_subpixels + j] = mask_indexes[i] * n_subpixels + j;
+                self->n_indexes = n_mask_indexes * n_subpixels;
+                free(mask_indexes);
+        }else{
+                self->pixels_coordinates = pixels_coordinates;
+                self->n_coordinates = self->n_pixels;
+                self->n_subpixels = 1;
+                self->indexes = mask_indexes;
+                self->n_indexes = n_mask_indexes;
+        }
+
+        return self;
+}
+
+void hkl_binoculars_qcustom_plan_expressions_set(HklBinocularsQCustomPlan *self,
+                                                 const HklBinocularsExpression *const *expressions,
+                                                 size_t n_expressions)
+{
+        size_t i;
+
+        assert(n_expressions <= ARRAY_SIZE(self->expressions_names));
+        assert(n_expressions <= self->n_resolutions);
+
+        g_free(self->expressions);
+        self->expressions = NULL;
+        self->n_expressions = 0;
+        if(HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS != self->subprojection
+           || 0 == n_expressions)
+                return;
+
+        self->expressions = g_new(const HklBinocularsExpression *, n_expressions);
+        memset(self->expressions_names, 0, sizeof(self->expressions_names));
+        for(i=0; i<n_expressions; ++i){
+                self->expressions[i] = expressions[i];
+                self->expressions_names[i] = hkl_binoculars_expression_name_get(expressions[i]);
+        }
+        self->n_expressions = n_expressions;
+        self->names = self->expressions_names;
+        self->n_axes = n_expressions;
+}
+
+void hkl_binoculars_qcustom_plan_free(HklBinocularsQCustomPlan *self)
+{
+        g_free(self->expressions);
+        free(self->indexes);
+        free(self->subpixels);
+        g_free(self->sample_axis);
+        g_free(self->sample_axis_idx);
+        g_free(self->limits);
+        g_free(self->resolutions);
+        g_free(self);
+}
+
+size_t hkl_binoculars_qcustom_plan_n_axes(const HklBinocularsQCustomPlan *self)
+{
+        return self->n_axes;
+}
+
+/* the job of a frame, the mask and the sub-pixels come from the plan */
+#define QCUSTOM_PLAN_FRAME_JOB(range_)                                  \
+        {                                                               \
+                .range = range_,                                        \
+                .image = image,                                         \
+                .n_pixels = plan->n_coordinates,                        \
+                .weight = weight,                                       \
+                .pixels_coordinates = plan->pixels_coordinates,         \
+                .resolutions = plan->resolutions,                       \
+                .indexes = plan->indexes,                               \
+                .n_indexes = plan->n_indexes,                           \
+                .limits = plan->limits,                                 \
+                .n_limits = plan->n_limits,                             \
+                .timestamp = timestamp,                                 \
+                .subprojection = plan->subprojection,                   \
+                .expressions = plan->expressions,                       \
+                .n_expressions = plan->n_expressions,                   \
+                .do_polarisation_correction = plan->do_polarisation_correction, \
+                .fast = g_atomic_int_get(&fast_trigonometry),           \
+                .corrections = corrections_get(plan->n_pixels),         \
+                .width = plan->width,                                   \
+                .height = plan->height,                                 \
+                .n_subpixels = plan->n_subpixels,                       \
+        }
+
+#define HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(image_t)                 \
+        HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(image_t)                 \
+        {                                                               \
+                HklBinocularsFrameJob job = QCUSTOM_PLAN_FRAME_JOB(qcustom_range_ ## image_t); \
+                CGLM_ALIGN_MAT mat4s m_sample;                          \
+                                                                        \
+                assert(plan->n_pixels == space->max_items);             \
+                assert(plan->n_resolutions <= darray_size(space->axes)); \
+                                                                        \
+                memcpy(m_sample.raw, plan->m_sample, sizeof(plan->m_sample)); \
+                darray_size(space->items) = 0;                          \
+                                                                        \
+                if(TRUE == qcustom_job_init(&job, geometry, &m_sample, plan->sample_axis, plan->sample_axis_idx)) \
+                        frame_run(&job, space);                         \
+                                                                        \
+                space_update_axes(space, plan->names, plan->n_pixels, plan->resolutions); \
+        }
+
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(int32_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(uint16_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(uint32_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(uint8_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(int16_t);
+HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_IMPL(float);
+
+/* hkl */
+
+#define HKL_KERNEL(limits_, polarisation_, box, image, job, space, first, last) do { \
+                size_t p;                                               \
+                double correction;                                      \
+                HklBinocularsSpaceItem item;                            \
+                                                                        \
+                const double *h = &(job)->pixels_coordinates[0 * (job)->n_pixels]; \
+                const double *k = &(job)->pixels_coordinates[1 * (job)->n_pixels]; \
+                const double *l = &(job)->pixels_coordinates[2 * (job)->n_pixels]; \
+                                                                        \
+                for(p=(first);p<(last);++p){                            \
+                        size_t i = (job)->indexes[p];                   \
+                        CGLM_ALIGN_MAT vec3s v = {{h[i], k[i], l[i]}};  \
+                                                                        \
+                        v = glms_mat4_mulv3((job)->m_holder_d, v, 1);   \
+                        v = glms_vec3_scale_as(v, (job)->k);            \
+                        correction = polarisation(v, (job)->weight, (polarisation_)); \
+                        v = glms_vec3_sub(v, (job)->ki);                \
+                        v = glms_mat4_mulv3((job)->m_holder_s, v, 0);   \
+                                                                        \
+                        item.indexes_0[0] = rint(v.raw[0] / (job)->resolutions[0]); \
+                        item.indexes_0[1] = rint(v.raw[1] / (job)->resolutions[1]); \
+                        item.indexes_0[2] = rint(v.raw[2] / (job)->resolutions[2]); \
+                        ITEM_INTENSITY_SET(item, (job), image, i, correction); \
+                                                                        \
+                        if(KERNEL_IN_THE_LIMITS(limits_, item, (box)))  \
+                                space_add_item(space, &item);           \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v, ki);       \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-                                        item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
-                                        item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
+        } while(0)
+
+#define HKL_BINOCULARS_HKL_RANGE_IMPL(image_t)                         \
+        static void hkl_range_ ## image_t (const HklBinocularsFrameJob *job, \
+                                           HklBinocularsSpace *space,   \
+                                           size_t first, size_t last)   \
+        {                                                               \
+                const image_t *image = job->image;                      \
+                                                                        \
+                KERNEL_DISPATCH(HKL_KERNEL, job, image, job, space, first, last); \
+        }
+
+HKL_BINOCULARS_HKL_RANGE_IMPL(int32_t);
+HKL_BINOCULARS_HKL_RANGE_IMPL(uint16_t);
+HKL_BINOCULARS_HKL_RANGE_IMPL(uint32_t);
+HKL_BINOCULARS_HKL_RANGE_IMPL(uint8_t);
+HKL_BINOCULARS_HKL_RANGE_IMPL(int16_t);
+HKL_BINOCULARS_HKL_RANGE_IMPL(float);
+
+#define HKL_BINOCULARS_SPACE_HKL_IMPL(image_t)                          \
+        HKL_BINOCULARS_SPACE_HKL_DECL(image_t)                          \
+        {                                                               \
+                const char * names[] = {"H", "K", "L"};                 \
+                HklBinocularsFrameJob job = {                           \
+                        .range = hkl_range_ ## image_t,                 \
+                        .image = image,                                 \
+                        .n_pixels = n_pixels,                           \
+                        .weight = weight,                               \
+                        .pixels_coordinates = pixels_coordinates,       \
+                        .resolutions = resolutions,                     \
+                        .masked = masked,                               \
+                        .limits = limits,                               \
+                        .n_limits = n_limits,                           \
+                        .do_polarisation_correction = do_polarisation_correction, \
+                        .corrections = corrections_get(n_pixels),       \
+                        .width = pixels_coordinates_dims[pixels_coordinates_ndim - 1], \
+                        .height = pixels_coordinates_dims[pixels_coordinates_ndim - 2], \
+                };                                                      \
+                                                                        \
+                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
+                assert(ARRAY_SIZE(names) == n_resolutions);             \
+                assert(n_pixels == space->max_items);                   \
+                                                                        \
+                HklBinocularsProjectionContext *ctx = projection_context_get(); \
+                HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, ctx->detector); \
+                const HklVector ki_v = hkl_geometry_ki_get(geometry);	\
+                HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry,sample); \
+                                                                        \
+                job.m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
+                job.ki = (vec3s){{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
+                job.k = glms_vec3_norm(job.ki);                         \
+                                                                        \
+                /* (holder UB)^-1 = UB^-1 holder^-1 */                  \
+                job.m_holder_s = glms_mat4_mul(ub_inverse_get(ctx, hkl_sample_UB_get(sample)), \
+                                               hkl_binoculars_holder_inverse_transformation_get(holder_s)); \
+                                                                        \
+                debug_mat4_print(job.m_holder_s);                       \
+                debug_mat4_print(job.m_holder_d);                       \
+                                                                        \
+                frame_run(&job, space);                                 \
+                                                                        \
+                space_update_axes(space, names, n_pixels, resolutions); \
+        }
+
+HKL_BINOCULARS_SPACE_HKL_IMPL(int32_t);
+HKL_BINOCULARS_SPACE_HKL_IMPL(uint16_t);
+HKL_BINOCULARS_SPACE_HKL_IMPL(uint32_t);
+HKL_BINOCULARS_SPACE_HKL_IMPL(uint8_t);
+HKL_BINOCULARS_SPACE_HKL_IMPL(int16_t);
+HKL_BINOCULARS_SPACE_HKL_IMPL(float);
+
+#define SPACES_HKL_KERNEL(limits_, polarisation_, box, image, job, spaces, n_samples, m_holders_s) do { \
+                size_t p, s;                                            \
+                double correction;                                      \
+                HklBinocularsSpaceItem item;                            \
+                                                                        \
+                const double *h = &(job)->pixels_coordinates[0 * (job)->n_pixels]; \
+                const double *k = &(job)->pixels_coordinates[1 * (job)->n_pixels]; \
+                const double *l = &(job)->pixels_coordinates[2 * (job)->n_pixels]; \
+                                                                        \
+                for(p=0; p<(job)->n_indexes; ++p){                      \
+                        size_t i = (job)->indexes[p];                   \
+                        CGLM_ALIGN_MAT vec3s v = {{h[i], k[i], l[i]}};  \
+                                                                        \
+                        v = glms_mat4_mulv3((job)->m_holder_d, v, 1);   \
+                        v = glms_vec3_scale_as(v, (job)->k);            \
+                        correction = polarisation(v, (job)->weight, (polarisation_)); \
+                        v = glms_vec3_sub(v, (job)->ki);                \
+                        ITEM_INTENSITY_SET(item, (job), image, i, correction); \
+                                                                        \
+                        for(s=0; s<(n_samples); ++s){                   \
+                                CGLM_ALIGN_MAT vec3s q = glms_mat4_mulv3((m_holders_s)[s], v, 0); \
+                                                                        \
+                                item.indexes_0[0] = rint(q.raw[0] / (job)->resolutions[0]); \
+                                item.indexes_0[1] = rint(q.raw[1] / (job)->resolutions[1]); \
+                                item.indexes_0[2] = rint(q.raw[2] / (job)->resolutions[2]); \
+                                                                        \
+                                if(KERNEL_IN_THE_LIMITS(limits_, item, (box))) \
+                                        space_add_item((spaces)[s], &item); \
                         }                                               \
-                        break;                                          \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QZ_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v, ki);       \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-                                        item.indexes_0[1] = rint(v.raw[2] / resolutions[1]); \
-                                        item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
+        } while(0)
+
+/* the kf - ki of a pixel does not depend on the domain, only its
+ * projection in the reciprocal space of each domain does. The frame
+ * is projected by the calling thread, the domains already multiply
+ * the work of each pixel. */
+#define HKL_BINOCULARS_SPACES_HKL_IMPL(image_t)                         \
+        HKL_BINOCULARS_SPACES_HKL_DECL(image_t)                         \
+        {                                                               \
+                size_t s;                                               \
+                const char * names[] = {"H", "K", "L"};                 \
+                HklBinocularsFrameJob job = {                           \
+                        .image = image,                                 \
+                        .n_pixels = n_pixels,                           \
+                        .weight = weight,                               \
+                        .pixels_coordinates = pixels_coordinates,       \
+                        .resolutions = resolutions,                     \
+                        .masked = masked,                               \
+                        .limits = limits,                               \
+                        .n_limits = n_limits,                           \
+                        .do_polarisation_correction = do_polarisation_correction, \
+                        .corrections = corrections_get(n_pixels),       \
+                        .width = pixels_coordinates_dims[pixels_coordinates_ndim - 1], \
+                        .height = pixels_coordinates_dims[pixels_coordinates_ndim - 2], \
+                };                                                      \
+                CGLM_ALIGN_MAT mat4s m_holders_s[n_samples];            \
+                                                                        \
+                assert(ARRAY_SIZE(names) == n_resolutions);             \
+                                                                        \
+                HklBinocularsProjectionContext *ctx = projection_context_get(); \
+                HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, ctx->detector); \
+                const HklVector ki_v = hkl_geometry_ki_get(geometry);   \
+                                                                        \
+                job.m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
+                job.ki = (vec3s){{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
+                job.k = glms_vec3_norm(job.ki);                         \
+                                                                        \
+                for(s=0; s<n_samples; ++s){                             \
+                        HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry, samples[s]); \
+                                                                        \
+                        assert(ARRAY_SIZE(names) == darray_size(spaces[s]->axes)); \
+                        assert(n_pixels == spaces[s]->max_items);       \
+                                                                        \
+                        /* (holder UB)^-1 = UB^-1 holder^-1 */          \
+                        m_holders_s[s] = glms_mat4_mul(ub_inverse_get(ctx, hkl_sample_UB_get(samples[s])), \
+                                                       hkl_binoculars_holder_inverse_transformation_get(holder_s)); \
+                        darray_size(spaces[s]->items) = 0;              \
+                        frame_stats_reset(spaces[s]);                   \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QY_QZ_TIMESTAMP: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v, ki);       \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        item.indexes_0[0] = rint(v.raw[1] / resolutions[0]); \
-                                        item.indexes_0[1] = rint(v.raw[2] / resolutions[1]); \
-                                        item.indexes_0[2] = rint(timestamp / resolutions[2]); \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
-                        }                                               \
-                        break;                                          \
+                                                                        \
+                frame_job_indexes_init(&job);                           \
+                                                                        \
+                KERNEL_DISPATCH(SPACES_HKL_KERNEL, &job, image, &job, spaces, n_samples, m_holders_s); \
+                                                                        \
+                for(s=0; s<n_samples; ++s){                             \
+                        frame_stats_done(&job, spaces[s]);              \
+                        space_update_axes(spaces[s], names, n_pixels, resolutions); \
                 }                                                       \
-                case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH_AZIMUTH: \
-                {                                                       \
-                        for(i=0;i<n_pixels;++i){                        \
-                                if(not_masked(masked, i)){              \
-                                        CGLM_ALIGN_MAT vec3s v = {{q_x[i], q_y[i], q_z[i]}}; \
-                                                                        \
-                                        v = glms_mat4_mulv3(m_holder_d, v, 1); \
-                                        double azimuth = compute_azimuth(v); \
-                                        v = glms_vec3_scale_as(v, k);   \
-                                        correction = polarisation(v, weight, do_polarisation_correction); \
-                                        v = glms_vec3_sub(v , ki);      \
-                                        v = glms_mat4_mulv3(m_holder_s, v, 0); \
-                                                                        \
-                                        float q = compute_q(v);         \
-                                        double tth = compute_tth(q, k); \
-					item.indexes_0[0] = rint(tth / resolutions[0]); \
-					item.indexes_0[1] = rint(azimuth / resolutions[1]); \
-					item.indexes_0[2] = REMOVED;    \
-                                        item.intensity = rint((double)image[i] * correction); \
-                                                                        \
-                                        if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                                darray_append(space->items, item); \
-                                }                                       \
+        }
+
+HKL_BINOCULARS_SPACES_HKL_IMPL(int32_t);
+HKL_BINOCULARS_SPACES_HKL_IMPL(uint16_t);
+HKL_BINOCULARS_SPACES_HKL_IMPL(uint32_t);
+HKL_BINOCULARS_SPACES_HKL_IMPL(uint8_t);
+HKL_BINOCULARS_SPACES_HKL_IMPL(int16_t);
+HKL_BINOCULARS_SPACES_HKL_IMPL(float);
+
+/* test */
+
+#define HKL_BINOCULARS_SPACE_TEST_IMPL(image_t)                         \
+        HKL_BINOCULARS_SPACE_TEST_DECL(image_t)                         \
+        {                                                               \
+                size_t i;                                               \
+                const char * names[] = {"H", "K", "L"};                 \
+                double correction;                                      \
+                HklBinocularsSpaceItem item;                            \
+                                                                        \
+                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
+                assert(ARRAY_SIZE(names) == n_resolutions);             \
+                assert(n_pixels == space->max_items);                   \
+                                                                        \
+                const double *h = &pixels_coordinates[0 * n_pixels];    \
+                const double *k = &pixels_coordinates[1 * n_pixels];    \
+                const double *l = &pixels_coordinates[2 * n_pixels];    \
+                                                                        \
+                HklBinocularsProjectionContext *ctx = projection_context_get(); \
+                HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, ctx->detector); \
+                CGLM_ALIGN_MAT mat4s m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
+                const HklVector ki_v = hkl_geometry_ki_get(geometry);	\
+                CGLM_ALIGN_MAT vec3s ki = {{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
+                float K = glms_vec3_norm(ki);                           \
+                HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry,sample); \
+                CGLM_ALIGN_MAT mat4s m_holder_s = glms_mat4_mul(ub_inverse_get(ctx, hkl_sample_UB_get(sample)), \
+                                                                hkl_binoculars_holder_inverse_transformation_get(holder_s)); \
+                                                                        \
+                darray_size(space->items) = 0;                          \
+                                                                        \
+                debug_mat4_print(m_holder_s);                           \
+                debug_mat4_print(m_holder_d);                           \
+                                                                        \
+                for(i=0;i<n_pixels;++i){                                \
+                        if(not_masked(masked, i)){                      \
+                                CGLM_ALIGN_MAT vec3s v = {{h[i], k[i], l[i]}}; \
+                                                                        \
+                                v = glms_mat4_mulv3(m_holder_d, v, 1);  \
+                                v = glms_vec3_scale_as(v, K);           \
+                                correction = polarisation(v, weight, do_polarisation_correction); \
+                                v = glms_vec3_sub(v, ki);               \
+                                v = glms_mat4_mulv3(m_holder_s, v, 0);  \
+                                                                        \
+                                item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
+                                item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
+                                item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
+                                item.intensity = (double)image[i] * correction; \
+                                item.weight = correction;               \
+                                                                        \
+                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
+                                        space_add_item(space, &item); \
                         }                                               \
-                        break;                                          \
-                }                                                       \
                 }                                                       \
-		space_update_axes(space, names, n_pixels, resolutions);	\
-		hkl_detector_free(detector);				\
-		hkl_sample_free(sample);				\
+                                                                        \
+                space_update_axes(space, names, n_pixels, resolutions); \
+        }
+
+HKL_BINOCULARS_SPACE_TEST_IMPL(int32_t);
+HKL_BINOCULARS_SPACE_TEST_IMPL(uint16_t);
+HKL_BINOCULARS_SPACE_TEST_IMPL(uint32_t);
+HKL_BINOCULARS_SPACE_TEST_IMPL(uint8_t);
+HKL_BINOCULARS_SPACE_TEST_IMPL(int16_t);
+HKL_BINOCULARS_SPACE_TEST_IMPL(float);
+
+
+/* Cube */
+
+/* this method compute the linear coordinates of the first element in
+ * the absolute coordinates of the bin */
+static inline ptrdiff_t compute_offset0(const darray_axis *axes)
+{
+	size_t i;
+	ptrdiff_t len = 1;
+	ptrdiff_t offset = 0;
+        size_t n_axes = darray_size(*axes);
+
+	for(i=0; i<n_axes; ++i){
+		const HklBinocularsAxis *axis = &darray_item(*axes, n_axes-1-i);
+		offset += len * axis->imin;
+		len *= axis_size(axis);
+	}
+	return offset;
+}
+
+/* the new cubes accumulate the intensities and the variances in
+ * double in addition to the rounded photons */
+static gint cube_weighted = FALSE;
+
+void hkl_binoculars_cube_weighted_set(int enable)
+{
+        g_atomic_int_set(&cube_weighted, enable);
+}
+
+static inline HklBinocularsCube *empty_cube_from_axes(const darray_axis *axes)
+{
+        HklBinocularsCube *self = NULL;
+
+        if (0 != darray_size(*axes)){
+                HklBinocularsAxis *axis;
+
+                self = g_new0(HklBinocularsCube, 1);
+                darray_foreach(axis, *axes){
+                        darray_append(self->axes, *axis);
+                        darray_append(self->storage, *axis);
+                }
+                self->offset0 = compute_offset0(&self->storage);
+                self->photons = NULL;
+                self->contributions = NULL;
+                self->weighted = g_atomic_int_get(&cube_weighted);
+                self->intensities = NULL;
+                self->variances = NULL;
+        }
+
+        return self;
+}
+
+/* set the storage of the cube to its axes */
+static inline void cube_storage_from_axes(HklBinocularsCube *self)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(self->axes); ++i)
+                darray_item(self->storage, i) = darray_item(self->axes, i);
+        self->offset0 = compute_offset0(&self->storage);
+}
+
+/* the number of allocated bins */
+static inline size_t cube_size(const HklBinocularsCube *self)
+{
+        size_t n = 1;
+        HklBinocularsAxis *axis;
+
+        darray_foreach(axis, self->storage){
+                n *= axis_size(axis);
+        }
+
+	return n;
+}
+
+size_t hkl_binoculars_cube_bytes(const HklBinocularsCube *self)
+{
+        size_t per_bin = sizeof(*self->photons) + sizeof(*self->contributions);
+
+        if(0 == darray_size(self->storage))
+                return 0;
+        if(self->weighted)
+                per_bin += sizeof(*self->intensities) + sizeof(*self->variances);
+        if(NULL != self->narrow){
+                size_t t;
+                size_t n_wide = 0;
+
+                per_bin -= sizeof(*self->photons) + sizeof(*self->contributions);
+                per_bin += sizeof(*self->narrow->photons.small) + sizeof(*self->narrow->contributions.small);
+                for(t=0; t<self->narrow->n_tiles; ++t)
+                        n_wide += (NULL != self->narrow->photons.wide[t])
+                                + (NULL != self->narrow->contributions.wide[t]);
+
+                return cube_size(self) * per_bin
+                        + n_wide * HKL_BINOCULARS_CUBE_NARROW_TILE * sizeof(uint32_t);
+        }
+
+        return cube_size(self) * per_bin;
+}
+
+/* the arrays allocation policy of the new cubes */
+static gint cube_alloc = HKL_BINOCULARS_CUBE_ALLOC_DEFAULT;
+
+void hkl_binoculars_cube_alloc_set(HklBinocularsCubeAllocEnum alloc)
+{
+        g_atomic_int_set(&cube_alloc, alloc);
+}
+
+/* the cubes filled by hkl_binoculars_cube_add_space keep their
+ * photons and contributions interleaved */
+static gint cube_interleaved = FALSE;
+
+void hkl_binoculars_cube_interleaved_set(int enable)
+{
+        g_atomic_int_set(&cube_interleaved, enable);
+}
+
+/* the cubes filled by hkl_binoculars_cube_add_space keep their
+ * photons and contributions in narrow counters */
+static gint cube_narrow_counters = FALSE;
+
+void hkl_binoculars_cube_narrow_counters_set(int enable)
+{
+        g_atomic_int_set(&cube_narrow_counters, enable);
+}
+
+/* the mapped arrays are rounded to the huge pages, smaller arrays
+ * are always malloced */
+#define CUBE_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static inline size_t cube_mapped_length(size_t n, size_t size)
+{
+        return (n * size + CUBE_HUGE_PAGE_SIZE - 1) & ~(CUBE_HUGE_PAGE_SIZE - 1);
+}
+
+/* interleave the pages of the mapping on the nodes allowed to the
+ * process, without depending on libnuma */
+static inline void cube_array_interleave(void *arr, size_t length)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+        unsigned long nodes[16] = {0};
+        unsigned long maxnode = 8 * sizeof(nodes);
+
+        if (0 == syscall(SYS_get_mempolicy, NULL, nodes, maxnode, NULL, MPOL_F_MEMS_ALLOWED))
+                syscall(SYS_mbind, arr, length, MPOL_INTERLEAVE, nodes, maxnode, 0);
+#endif
+}
+
+/* a shared mapping of an unlinked temporary file truncated to the
+ * length, so it reads zeros. The kernel writes its dirty pages back
+ * to the file instead of keeping them all in memory. */
+static void *cube_array_mmap_file(size_t length)
+{
+        void *arr = MAP_FAILED;
+        char *fn = NULL;
+        int fd = g_file_open_tmp("hkl-binoculars-cube-XXXXXX", &fn, NULL);
+
+        if (fd >= 0){
+                unlink(fn);
+                if (0 == ftruncate(fd, length))
+                        arr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd, 0);
+                close(fd);
+        }
+        g_free(fn);
+
+        return arr;
+}
+
+/* an untouched, so zeroed, anonymous mapping placed with the alloc
+ * policy. The policies are only hints, the mapping is kept when they
+ * are not supported. */
+static void *cube_array_mmap(size_t length, HklBinocularsCubeAllocEnum alloc)
+{
+        void *arr = MAP_FAILED;
+
+        if (HKL_BINOCULARS_CUBE_ALLOC_SPILL == alloc)
+                arr = cube_array_mmap_file(length);
+        if (MAP_FAILED != arr)
+                return arr;
+
+#ifdef MAP_HUGETLB
+        if (HKL_BINOCULARS_CUBE_ALLOC_HUGETLB == alloc)
+                arr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (MAP_FAILED != arr)
+                return arr;
+
+        /* no reserved huge pages, fall back on the transparent ones */
+        arr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == arr)
+                return NULL;
+
+        switch(alloc){
+        case HKL_BINOCULARS_CUBE_ALLOC_INTERLEAVE:
+                cube_array_interleave(arr, length);
+                break;
+        case HKL_BINOCULARS_CUBE_ALLOC_HUGEPAGE:
+        case HKL_BINOCULARS_CUBE_ALLOC_HUGETLB:
+#ifdef MADV_HUGEPAGE
+                madvise(arr, length, MADV_HUGEPAGE);
+#endif
+                break;
+        case HKL_BINOCULARS_CUBE_ALLOC_DEFAULT:
+        case HKL_BINOCULARS_CUBE_ALLOC_FIRST_TOUCH:
+        case HKL_BINOCULARS_CUBE_ALLOC_SPILL:
+        case HKL_BINOCULARS_CUBE_ALLOC_NUM_ALLOCS:
+                break;
+        }
+
+        return arr;
+}
+
+static inline void cube_array_munmap(void *arr, size_t n, size_t size)
+{
+        if (NULL != arr)
+                munmap(arr, cube_mapped_length(n, size));
+}
+
+/* Narrow counters */
+
+/* the last tile is complete, so a tile is always copied at once */
+static inline void counters_init(HklBinocularsCubeCounters *self, size_t n_tiles)
+{
+        self->small = calloc(n_tiles * HKL_BINOCULARS_CUBE_NARROW_TILE, sizeof(*self->small));
+        self->wide = calloc(n_tiles, sizeof(*self->wide));
+}
+
+static inline void counters_free(HklBinocularsCubeCounters *self, size_t n_tiles)
+{
+        size_t t;
+
+        if(NULL != self->wide)
+                for(t=0; t<n_tiles; ++t)
+                        free(self->wide[t]);
+        free(self->wide);
+        free(self->small);
+}
+
+static inline uint32_t *counters_promote(HklBinocularsCubeCounters *self, size_t t)
+{
+        size_t i;
+        uint32_t *wide = malloc(HKL_BINOCULARS_CUBE_NARROW_TILE * sizeof(*wide));
+        const uint16_t *small = &self->small[t * HKL_BINOCULARS_CUBE_NARROW_TILE];
+
+        for(i=0; i<HKL_BINOCULARS_CUBE_NARROW_TILE; ++i)
+                wide[i] = small[i];
+        self->wide[t] = wide;
+
+        return wide;
+}
+
+static inline void counters_add(HklBinocularsCubeCounters *self, size_t w, uint32_t value)
+{
+        size_t t = w / HKL_BINOCULARS_CUBE_NARROW_TILE;
+        uint32_t *wide = self->wide[t];
+        uint32_t sum;
+
+        if(NULL == wide){
+                sum = self->small[w] + value;
+                if(sum <= UINT16_MAX){
+                        self->small[w] = sum;
+                        return;
+                }
+                wide = counters_promote(self, t);
+        }
+        wide[w % HKL_BINOCULARS_CUBE_NARROW_TILE] += value;
+}
+
+static inline uint32_t counters_get(const HklBinocularsCubeCounters *self, size_t w)
+{
+        const uint32_t *wide = self->wide[w / HKL_BINOCULARS_CUBE_NARROW_TILE];
+
+        return NULL != wide ? wide[w % HKL_BINOCULARS_CUBE_NARROW_TILE] : self->small[w];
+}
+
+static inline void cube_narrow_free(HklBinocularsCubeNarrow *self)
+{
+        if(NULL == self)
+                return;
+
+        counters_free(&self->photons, self->n_tiles);
+        counters_free(&self->contributions, self->n_tiles);
+        free(self);
+}
+
+static inline void cube_arrays_free(HklBinocularsCube *self)
+{
+        if(self->mapped){
+                cube_array_munmap(self->variances, self->mapped, sizeof(*self->variances));
+                cube_array_munmap(self->intensities, self->mapped, sizeof(*self->intensities));
+                cube_array_munmap(self->contributions, self->mapped, sizeof(*self->contributions));
+                cube_array_munmap(self->photons, self->mapped, sizeof(*self->photons));
+        }else{
+                free(self->variances);
+                free(self->intensities);
+                free(self->contributions);
+                free(self->photons);
+        }
+        free(self->bins);
+        self->bins = NULL;
+        cube_narrow_free(self->narrow);
+        self->narrow = NULL;
+        self->photons = NULL;
+        self->contributions = NULL;
+        self->intensities = NULL;
+        self->variances = NULL;
+        self->mapped = 0;
+}
+
+/* map the arrays of a big cube with the alloc policy, the mappings
+ * are already zeroed. Return FALSE if the cube must be malloced. */
+static inline int mmap_cube(HklBinocularsCube *self, size_t n)
+{
+        HklBinocularsCubeAllocEnum alloc = g_atomic_int_get(&cube_alloc);
+
+        if (HKL_BINOCULARS_CUBE_ALLOC_DEFAULT == alloc
+            || n * sizeof(*self->photons) < CUBE_HUGE_PAGE_SIZE)
+                return FALSE;
+
+        self->mapped = n;
+        self->photons = cube_array_mmap(cube_mapped_length(n, sizeof(*self->photons)), alloc);
+        self->contributions = cube_array_mmap(cube_mapped_length(n, sizeof(*self->contributions)), alloc);
+        if(self->weighted){
+                self->intensities = cube_array_mmap(cube_mapped_length(n, sizeof(*self->intensities)), alloc);
+                self->variances = cube_array_mmap(cube_mapped_length(n, sizeof(*self->variances)), alloc);
+        }
+
+        if (NULL == self->photons
+            || NULL == self->contributions
+            || (self->weighted && (NULL == self->intensities || NULL == self->variances))){
+                cube_arrays_free(self);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static inline size_t malloc_cube(HklBinocularsCube *self)
+{
+        size_t n = cube_size(self);
+
+        if(mmap_cube(self, n))
+                return n;
+
+        self->photons = malloc(n * sizeof(*self->photons));
+        self->contributions = malloc(n * sizeof(*self->contributions));
+        if(self->weighted){
+                self->intensities = malloc(n * sizeof(*self->intensities));
+                self->variances = malloc(n * sizeof(*self->variances));
+        }
+
+        return n;
+}
+
+static inline size_t calloc_cube(HklBinocularsCube *self)
+{
+        size_t n = cube_size(self);
+
+        if(mmap_cube(self, n))
+                return n;
+
+        self->photons = calloc(n, sizeof(*self->photons));
+        self->contributions = calloc(n, sizeof(*self->contributions));
+        if(self->weighted){
+                self->intensities = calloc(n, sizeof(*self->intensities));
+                self->variances = calloc(n, sizeof(*self->variances));
+        }
+
+        return n;
+}
+
+/* Interleaved bins */
+
+/* the photons and the contributions of an accumulating cube are
+ * moved into the interleaved bins, the intensities and the variances
+ * stay in place. The mapped cubes keep their layout. */
+static inline void cube_interleave(HklBinocularsCube *self)
+{
+        size_t i;
+        size_t n;
+
+        if(NULL != self->bins || NULL != self->narrow
+           || NULL == self->photons || self->mapped)
+                return;
+
+        n = cube_size(self);
+        self->bins = malloc(n * sizeof(*self->bins));
+        for(i=0; i<n; ++i){
+                self->bins[i].photons = self->photons[i];
+                self->bins[i].contributions = self->contributions[i];
+        }
+
+        free(self->contributions);
+        free(self->photons);
+        self->photons = NULL;
+        self->contributions = NULL;
+}
+
+/* the photons and the contributions of an accumulating cube are
+ * moved into narrow counters, a tile is promoted at once if one of
+ * its bins does not fit in an uint16_t. The intensities and the
+ * variances stay in place and the mapped cubes keep their layout. */
+static inline void cube_narrow(HklBinocularsCube *self)
+{
+        size_t i;
+        size_t n;
+        HklBinocularsCubeNarrow *narrow;
+
+        if(NULL != self->narrow || NULL != self->bins
+           || NULL == self->photons || self->mapped)
+                return;
+
+        n = cube_size(self);
+        narrow = malloc(sizeof(*narrow));
+        narrow->n_tiles = (n + HKL_BINOCULARS_CUBE_NARROW_TILE - 1) / HKL_BINOCULARS_CUBE_NARROW_TILE;
+        counters_init(&narrow->photons, narrow->n_tiles);
+        counters_init(&narrow->contributions, narrow->n_tiles);
+        for(i=0; i<n; ++i){
+                counters_add(&narrow->photons, i, self->photons[i]);
+                counters_add(&narrow->contributions, i, self->contributions[i]);
+        }
+
+        free(self->contributions);
+        free(self->photons);
+        self->photons = NULL;
+        self->contributions = NULL;
+        self->narrow = narrow;
+}
+
+void hkl_binoculars_cube_planar(const HklBinocularsCube *cube)
+{
+        size_t i;
+        size_t n;
+        /* the layout of the arrays is not part of the value of the
+         * cube */
+        HklBinocularsCube *self = (HklBinocularsCube *)cube;
+
+        if(NULL == self->bins && NULL == self->narrow)
+                return;
+
+        n = cube_size(self);
+        self->photons = malloc(n * sizeof(*self->photons));
+        self->contributions = malloc(n * sizeof(*self->contributions));
+        if(NULL != self->bins){
+                for(i=0; i<n; ++i){
+                        self->photons[i] = self->bins[i].photons;
+                        self->contributions[i] = self->bins[i].contributions;
+                }
+                free(self->bins);
+                self->bins = NULL;
+        }else{
+                for(i=0; i<n; ++i){
+                        self->photons[i] = counters_get(&self->narrow->photons, i);
+                        self->contributions[i] = counters_get(&self->narrow->contributions, i);
+                }
+                cube_narrow_free(self->narrow);
+                self->narrow = NULL;
+        }
+}
+
+/* add to a bin of a planar, an interleaved or a narrow cube */
+static inline void cube_bin_add(HklBinocularsCube *cube, ptrdiff_t w,
+                                uint32_t photons, uint32_t contributions)
+{
+        if(NULL != cube->bins){
+                cube->bins[w].photons += photons;
+                cube->bins[w].contributions += contributions;
+        }else if(NULL != cube->narrow){
+                counters_add(&cube->narrow->photons, w, photons);
+                counters_add(&cube->narrow->contributions, w, contributions);
+        }else{
+                cube->photons[w] += photons;
+                cube->contributions[w] += contributions;
+        }
+}
+
+/* compute the lens of each axis of the cube storage, starting from
+ * the fastest one (the last axis) */
+static inline void cube_lens(const HklBinocularsCube *cube, ptrdiff_t *lens)
+{
+        size_t i;
+        size_t n_axes = darray_size(cube->storage);
+
+        lens[0] = 1;
+
+        for(i=1; i<n_axes; ++i){
+                lens[i] = lens[i - 1] * axis_size(&darray_item(cube->storage, n_axes - i));
+        }
+}
+
+/* the items of a space are scattered in the order of their bins
+ * instead of the pixels order (FALSE by default) */
+static gint cube_sorted_scatter = FALSE;
+
+void hkl_binoculars_cube_sorted_scatter_set(int enable)
+{
+        g_atomic_int_set(&cube_sorted_scatter, enable);
+}
+
+/* below this number of items, the scatter is not sorted */
+#define SORTED_SCATTER_MIN_ITEMS 1024
+
+typedef struct _ScatterKey ScatterKey;
+struct _ScatterKey
+{
+        size_t w; /* the linear index of the bin */
+        size_t item; /* in the items of the space */
+};
+
+/* sort the keys by bins with a LSD radix sort of the bytes of the
+ * linear indexes smaller than n_bins, return the sorted keys which
+ * are either keys or tmp */
+static inline ScatterKey *scatter_keys_sort(ScatterKey *keys, ScatterKey *tmp,
+                                            size_t n_keys, size_t n_bins)
+{
+        size_t shift;
+
+        for(shift=0; shift < 8 * sizeof(size_t) && (n_bins - 1) >> shift; shift += 8){
+                size_t i;
+                size_t counts[257] = {0};
+                ScatterKey *swap;
+
+                for(i=0; i<n_keys; ++i)
+                        counts[((keys[i].w >> shift) & 0xff) + 1]++;
+                for(i=0; i<256; ++i)
+                        counts[i + 1] += counts[i];
+                for(i=0; i<n_keys; ++i)
+                        tmp[counts[(keys[i].w >> shift) & 0xff]++] = keys[i];
+
+                swap = keys;
+                keys = tmp;
+                tmp = swap;
+        }
+
+        return keys;
+}
+
+/* the items are sorted by bins and the items of a same bin are summed
+ * before being added, so the writes stream through the cube and each
+ * bin is touched once per space. */
+static inline void add_non_empty_space_sorted(HklBinocularsCube *cube,
+                                              const HklBinocularsSpace *space,
+                                              ptrdiff_t w0, const ptrdiff_t *lens)
+{
+        size_t i, p;
+        size_t n_axes = darray_size(cube->axes);
+        size_t n_items = darray_size(space->items);
+        ScatterKey *keys = malloc(2 * n_items * sizeof(*keys));
+        ScatterKey *sorted;
+
+        for(p=0; p<n_items; ++p){
+                const HklBinocularsSpacePackedItem *item = &darray_item(space->items, p);
+                ptrdiff_t w = w0;
+
+                for(i=0; i<n_axes; ++i)
+                        w += lens[i] * item->indexes[n_axes - 1 - i];
+
+                keys[p].w = w;
+                keys[p].item = p;
+        }
+
+        sorted = scatter_keys_sort(keys, &keys[n_items], n_items, cube_size(cube));
+
+        for(p=0; p<n_items;){
+                size_t w = sorted[p].w;
+                uint32_t photons = 0;
+                uint32_t contributions = 0;
+                double intensities = 0;
+                double variances = 0;
+
+                for(; p<n_items && sorted[p].w == w; ++p){
+                        const HklBinocularsSpacePackedItem *item = &darray_item(space->items, sorted[p].item);
+
+                        photons += rint(item->intensity);
+                        contributions += space->n_frames;
+                        intensities += item->intensity;
+                        variances += (double)item->weight * item->intensity;
+                }
+
+                cube_bin_add(cube, w, photons, contributions);
+                if(cube->weighted){
+                        cube->intensities[w] += intensities;
+                        cube->variances[w] += variances;
+                }
+        }
+
+        free(keys);
+}
+
+/* Using this method the Cube has already the right dimensions, we
+ * just add the Space data into it. */
+static inline void add_non_empty_space(HklBinocularsCube *cube,
+                                       const HklBinocularsSpace *space)
+{
+        size_t i;
+        size_t n_axes = darray_size(cube->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t w0 = -cube->offset0;
+        HklBinocularsSpacePackedItem *item;
+
+        assert(n_axes == darray_size(space->axes));
+
+        /* compute the lens */
+        cube_lens(cube, lens);
+
+        /* the linear index of the origin of the space */
+        for(i=0; i<n_axes; ++i)
+                w0 += lens[i] * space->origin[n_axes - 1 - i];
+
+        if(g_atomic_int_get(&cube_sorted_scatter)
+           && darray_size(space->items) >= SORTED_SCATTER_MIN_ITEMS){
+                add_non_empty_space_sorted(cube, space, w0, lens);
+                return;
+        }
+
+        darray_foreach(item, space->items){
+                ptrdiff_t w = w0;
+
+                for(i=0; i<n_axes; ++i){
+                        w += lens[i] * item->indexes[n_axes - 1 - i];
+                }
+
+                /* fprintf(stdout, " w: %ld %ld\n", w, cube_size(cube)); */
+                cube_bin_add(cube, w, rint(item->intensity), space->n_frames);
+                if(cube->weighted){
+                        cube->intensities[w] += item->intensity;
+                        cube->variances[w] += (double)item->weight * item->intensity;
+                }
+        }
+}
+
+static inline int cube_is_empty(const HklBinocularsCube *self)
+{
+        return 0 == darray_size(self->axes);
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_empty(void)
+{
+        HklBinocularsCube *self = g_new(HklBinocularsCube, 1);
+
+        darray_init(self->axes);
+        darray_init(self->storage);
+        self->offset0 = 0;
+        self->photons = NULL;
+        self->contributions = NULL;
+        self->weighted = g_atomic_int_get(&cube_weighted);
+        self->intensities = NULL;
+        self->variances = NULL;
+        self->mapped = 0;
+        self->stripes = NULL;
+        self->bins = NULL;
+        self->narrow = NULL;
+
+        return self;
+}
+
+void hkl_binoculars_cube_free(HklBinocularsCube *self)
+{
+        hkl_binoculars_cube_shared_set(self, FALSE);
+        cube_arrays_free(self);
+        darray_free(self->storage);
+        darray_free(self->axes);
+        free(self);
+}
+
+unsigned int hkl_binoculars_cube_cmp(const HklBinocularsCube *self, const HklBinocularsCube *other)
+{
+        int i;
+        unsigned int res = 0;
+
+        /* the storage and the offset0 are not compared, only the
+         * bounds of the data */
+        res |= darray_size(self->axes) != darray_size(other->axes);
+        for(i=0; i<darray_size(self->axes); ++i){
+                res |= hkl_binoculars_axis_cmp(&darray_item(self->axes, i),
+                                               &darray_item(other->axes, i));
+        }
+
+        /* for(i=0; i<cube_size(self); ++i){ */
+        /*         res |= self->photons[i] != other->photons[i]; */
+        /*         res |= self->contributions[i] != other->contributions[i]; */
+        /*         if(res){ */
+        /*                 fprintf(stdout, "\nphotons: %d %u %u ", i, self->photons[i], other->photons[i]); */
+        /*                 fprintf(stdout, "\ncontributions: %d %u %u", i, self->contributions[i], other->contributions[i]); */
+        /*                 break; */
+        /*         } */
+        /* } */
+
+        if(res){
+                fprintf(stdout, "cube: self\n");
+                hkl_binoculars_cube_fprintf(stdout, self);
+                fprintf(stdout, "cube: other\n");
+                hkl_binoculars_cube_fprintf(stdout, other);
+        }
+
+        return res;
+}
+
+void hkl_binoculars_cube_fprintf(FILE *f, const HklBinocularsCube *self)
+{
+        HklBinocularsAxis *axis;
+
+	fprintf(f, "HklBinocularsCube: %p", self);
+
+        fprintf(f, "\nn_axes: %ld", darray_size(self->axes));
+        darray_foreach(axis, self->axes){
+                fprintf(f, "\n");
+                hkl_binoculars_axis_fprintf(f, axis);
+        }
+        fprintf(f, "\nphotons: %p", self->photons);
+        fprintf(f, "\ncontributions: %p", self->contributions);
+        fprintf(f, "\nintensities: %p", self->intensities);
+        fprintf(f, "\nvariances: %p", self->variances);
+}
+
+void hkl_binoculars_cube_dims(const HklBinocularsCube *self, size_t ndims, size_t *dims)
+{
+        HklBinocularsAxis *axis;
+
+        assert(ndims == darray_size(self->axes));
+
+        darray_foreach(axis, self->axes){
+                *(dims++) = axis_size(axis);
+        }
+}
+
+static inline size_t find_first_non_empty_space_index(size_t n_spaces,
+                                                      const HklBinocularsSpace *const *spaces)
+{
+        size_t i;
+
+        for(i=0; i<n_spaces; ++i)
+                if(!space_is_empty(spaces[i]))
+                        return i;
+
+        return n_spaces;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new(size_t n_spaces,
+                                           const HklBinocularsSpace *const *spaces)
+{
+        size_t i, i0;
+        HklBinocularsCube *self = NULL;
+
+        i0 = find_first_non_empty_space_index(n_spaces, spaces);
+
+        if(i0 < n_spaces){
+                self = empty_cube_from_axes(&spaces[i0]->axes);
+
+                if(NULL != self){
+                        /* compute the final cube dimensions and the index offset */
+                        for(i=i0; i<n_spaces; ++i){
+                                const HklBinocularsSpace *space = spaces[i];
+
+                                if(space_is_empty(space))
+                                        continue;
+
+                                merge_axes(&self->axes, &space->axes);
+                        }
+                        cube_storage_from_axes(self);
+
+                        /* allocated the final cube photons and contributions */
+                        calloc_cube(self);
+
+                        /* add all the spaces */
+                        for(i=i0; i<n_spaces; ++i){
+                                const HklBinocularsSpace *space = spaces[i];
+
+                                if(space_is_empty(space))
+                                        continue;
+
+                                add_non_empty_space(self, space);
+                        }
+                }
+        }
+
+	return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_from_axes(const darray_axis *axes)
+{
+	HklBinocularsCube *self = empty_cube_from_axes(axes);
+
+        if(NULL == self)
+                return hkl_binoculars_cube_new_empty();
+
+        calloc_cube(self);
+
+        return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_from_axes_weighted(const darray_axis *axes,
+                                                              int weighted)
+{
+	HklBinocularsCube *self = empty_cube_from_axes(axes);
+
+        if(NULL == self){
+                self = hkl_binoculars_cube_new_empty();
+                self->weighted = weighted;
+        }else{
+                self->weighted = weighted;
+                calloc_cube(self);
+        }
+
+        return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_empty_from_cube(const HklBinocularsCube *cube)
+{
+	HklBinocularsCube *self = empty_cube_from_axes(&cube->axes);
+        if(NULL != self){
+                self->weighted = cube->weighted;
+                calloc_cube(self);
+        }else{
+                self = hkl_binoculars_cube_new_empty();
+                self->weighted = cube->weighted;
+        }
+
+
+	return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_from_space(const HklBinocularsSpace *space)
+{
+	HklBinocularsCube *self = NULL;
+
+        if(space_is_empty(space)){
+                self =  hkl_binoculars_cube_new_empty();
+        } else {
+                self = empty_cube_from_axes(&space->axes);
+                if(NULL != self){
+                        calloc_cube(self);
+
+                        add_non_empty_space(self, space);
+                }
+        }
+
+        return self;
+}
+
+static inline void cube_add_cube(HklBinocularsCube *self,
+                                 const HklBinocularsCube *other);
+
+/* the copy is always compact */
+HklBinocularsCube *hkl_binoculars_cube_new_copy(const HklBinocularsCube *src)
+{
+        size_t n;
+	HklBinocularsCube *self = empty_cube_from_axes(&src->axes);
+
+        hkl_binoculars_cube_planar(src);
+        if(NULL != self){
+                self->weighted = src->weighted;
+                if(cube_is_compact(src)){
+                        /* allocate the final cube */
+                        n = malloc_cube(self);
+
+                        /* copy the data */
+                        if(self->photons)
+                                memcpy(self->photons, src->photons, n * sizeof(*self->photons));
+                        if(self->contributions)
+                                memcpy(self->contributions, src->contributions, n * sizeof(*self->contributions));
+                        if(self->intensities)
+                                memcpy(self->intensities, src->intensities, n * sizeof(*self->intensities));
+                        if(self->variances)
+                                memcpy(self->variances, src->variances, n * sizeof(*self->variances));
+                }else{
+                        calloc_cube(self);
+                        cube_add_cube(self, src);
+                }
+        }
+
+        return self;
+}
+
+/* linear index in the storage of a bin given by its absolute indexes */
+static inline ptrdiff_t cube_bin_index(const HklBinocularsCube *self,
+                                       const ptrdiff_t *lens,
+                                       const ptrdiff_t *indexes)
+{
+        size_t i;
+        size_t n_axes = darray_size(self->storage);
+        ptrdiff_t w = -self->offset0;
+
+        for(i=0; i<n_axes; ++i)
+                w += lens[i] * indexes[n_axes - 1 - i];
+
+        return w;
+}
+
+/* move the absolute indexes to the next bin of the axes, return FALSE
+ * after the last one */
+static inline int axes_next_bin(const darray_axis *axes, ptrdiff_t *indexes)
+{
+        size_t i = darray_size(*axes);
+
+        while(i-- > 0){
+                if (indexes[i] < darray_item(*axes, i).imax){
+                        indexes[i]++;
+                        return TRUE;
+                }
+                indexes[i] = darray_item(*axes, i).imin;
+        }
+
+        return FALSE;
+}
+
+static inline void axes_first_bin(const darray_axis *axes, ptrdiff_t *indexes)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(*axes); ++i)
+                indexes[i] = darray_item(*axes, i).imin;
+}
+
+/* copy the bins of src into the compact cube, its axes are contained
+ * in the src ones */
+static inline void cube_copy_bins(HklBinocularsCube *self,
+                                  const HklBinocularsCube *src)
+{
+        size_t n_axes = darray_size(src->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t indexes[n_axes];
+        ptrdiff_t w = 0;
+
+        cube_lens(src, lens);
+
+        /* the bins of the compact cube are in the storage order */
+        axes_first_bin(&self->axes, indexes);
+        do{
+                ptrdiff_t w1 = cube_bin_index(src, lens, indexes);
+
+                self->photons[w] = src->photons[w1];
+                self->contributions[w] = src->contributions[w1];
+                if(self->weighted){
+                        self->intensities[w] = src->intensities[w1];
+                        self->variances[w] = src->variances[w1];
+                }
+                w++;
+        }while(axes_next_bin(&self->axes, indexes));
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_crop(const HklBinocularsCube *self)
+{
+        size_t i;
+        int empty = TRUE;
+        HklBinocularsCube *cube;
+
+        if(cube_is_empty(self))
+                return hkl_binoculars_cube_new_empty();
+
+        hkl_binoculars_cube_planar(self);
+
+        size_t n_axes = darray_size(self->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t indexes[n_axes];
+        ptrdiff_t imin[n_axes];
+        ptrdiff_t imax[n_axes];
+
+        cube_lens(self, lens);
+
+        /* the bounding box of the bins with contributions */
+        axes_first_bin(&self->axes, indexes);
+        do{
+                if(0 != self->contributions[cube_bin_index(self, lens, indexes)]){
+                        for(i=0; i<n_axes; ++i){
+                                if(empty){
+                                        imin[i] = imax[i] = indexes[i];
+                                }else{
+                                        imin[i] = min(imin[i], indexes[i]);
+                                        imax[i] = max(imax[i], indexes[i]);
+                                }
+                        }
+                        empty = FALSE;
+                }
+        }while(axes_next_bin(&self->axes, indexes));
+
+        if(empty)
+                return hkl_binoculars_cube_new_copy(self);
+
+        cube = empty_cube_from_axes(&self->axes);
+        cube->weighted = self->weighted;
+        for(i=0; i<n_axes; ++i){
+                darray_item(cube->axes, i).imin = imin[i];
+                darray_item(cube->axes, i).imax = imax[i];
+        }
+        cube_storage_from_axes(cube);
+        malloc_cube(cube);
+        cube_copy_bins(cube, self);
+
+        return cube;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_slice(const HklBinocularsCube *self,
+                                                 const ptrdiff_t *imin,
+                                                 const ptrdiff_t *imax)
+{
+        HklBinocularsCube *cube = empty_cube_from_axes(&self->axes);
+
+        if(NULL == cube || FALSE == axes_slice(&cube->axes, imin, imax)){
+                if(NULL != cube)
+                        hkl_binoculars_cube_free(cube);
+                cube = hkl_binoculars_cube_new_empty();
+                cube->weighted = self->weighted;
+                return cube;
+        }
+
+        hkl_binoculars_cube_planar(self);
+        cube->weighted = self->weighted;
+        cube_storage_from_axes(cube);
+        malloc_cube(cube);
+        cube_copy_bins(cube, self);
+
+        return cube;
+}
+
+void hkl_binoculars_cube_roi_sums(const HklBinocularsCube *self,
+                                  const ptrdiff_t *imin,
+                                  const ptrdiff_t *imax,
+                                  HklBinocularsCubeSums *sums)
+{
+        HklBinocularsAxis *axis;
+        darray_axis axes = darray_new();
+
+        memset(sums, 0, sizeof(*sums));
+
+        if(cube_is_empty(self))
+                return;
+
+        hkl_binoculars_cube_planar(self);
+
+        size_t n_axes = darray_size(self->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t indexes[n_axes];
+
+        darray_foreach(axis, self->axes){
+                darray_append(axes, *axis);
+        }
+
+        if(axes_slice(&axes, imin, imax)){
+                cube_lens(self, lens);
+                axes_first_bin(&axes, indexes);
+                do{
+                        ptrdiff_t w = cube_bin_index(self, lens, indexes);
+
+                        sums->photons += self->photons[w];
+                        sums->contributions += self->contributions[w];
+                        if(self->weighted){
+                                sums->intensities += self->intensities[w];
+                                sums->variances += self->variances[w];
+                        }
+                }while(axes_next_bin(&axes, indexes));
+        }
+
+        darray_free(axes);
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_rebin_axes(const HklBinocularsCube *src,
+                                                      const size_t *factors)
+{
+        size_t i;
+        HklBinocularsCube *self = empty_cube_from_axes(&src->axes);
+
+        if(NULL == self){
+                self = hkl_binoculars_cube_new_empty();
+                self->weighted = src->weighted;
+                return self;
+        }
+
+        hkl_binoculars_cube_planar(src);
+        self->weighted = src->weighted;
+        for(i=0; i<darray_size(self->axes); ++i)
+                darray_item(self->axes, i) = axis_rebin(&darray_item(src->axes, i),
+                                                        factors[i]);
+        cube_storage_from_axes(self);
+        calloc_cube(self);
+
+        return self;
+}
+
+void hkl_binoculars_cube_rebin_slab(HklBinocularsCube *self,
+                                    const HklBinocularsCube *src,
+                                    const size_t *factors,
+                                    size_t start, size_t end)
+{
+        size_t i;
+        HklBinocularsAxis *axis;
+        darray_axis axes = darray_new();
+
+        if(cube_is_empty(src) || start >= end)
+                return;
+
+        size_t n_axes = darray_size(src->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t coarse_lens[n_axes];
+        ptrdiff_t indexes[n_axes];
+        ptrdiff_t coarse[n_axes];
+
+        darray_foreach(axis, src->axes){
+                darray_append(axes, *axis);
+        }
+        darray_item(axes, 0).imin = darray_item(src->axes, 0).imin + start;
+        darray_item(axes, 0).imax = darray_item(src->axes, 0).imin + end - 1;
+
+        cube_lens(src, lens);
+        cube_lens(self, coarse_lens);
+
+        axes_first_bin(&axes, indexes);
+        do{
+                ptrdiff_t w1 = cube_bin_index(src, lens, indexes);
+                ptrdiff_t w;
+
+                for(i=0; i<n_axes; ++i)
+                        coarse[i] = axis_rebin_index(indexes[i], factors[i]);
+                w = cube_bin_index(self, coarse_lens, coarse);
+
+                self->photons[w] += src->photons[w1];
+                self->contributions[w] += src->contributions[w1];
+                if(self->weighted){
+                        self->intensities[w] += src->intensities[w1];
+                        self->variances[w] += src->variances[w1];
+                }
+        }while(axes_next_bin(&axes, indexes));
+
+        darray_free(axes);
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_rebin(const HklBinocularsCube *self,
+                                                 const size_t *factors)
+{
+        HklBinocularsCube *cube = hkl_binoculars_cube_new_rebin_axes(self, factors);
+
+        if(!cube_is_empty(self))
+                hkl_binoculars_cube_rebin_slab(cube, self, factors,
+                                               0, axis_size(&darray_item(self->axes, 0)));
+
+        return cube;
+}
+
+/* Peaks */
+
+/* the label of the bins below the threshold */
+#define PEAK_NONE SIZE_MAX
+
+typedef struct _HklBinocularsCubePeaksJob HklBinocularsCubePeaksJob;
+struct _HklBinocularsCubePeaksJob
+{
+        const HklBinocularsCube *self;
+        double threshold;
+        size_t *labels; /* one per bin of the axes, in their order */
+        HklBinocularsCubePeak *peaks; /* the part of the peaks in the slab */
+        size_t n_peaks;
+        size_t start;
+        size_t end;
+};
+
+/* the value of a bin, FALSE if it has no contributions */
+static inline int cube_peak_value(const HklBinocularsCube *self,
+                                  ptrdiff_t w, double *value)
+{
+        if(0 == self->contributions[w])
+                return FALSE;
+
+        if(self->weighted)
+                *value = self->intensities[w] / self->contributions[w];
+        else
+                *value = (double)self->photons[w] / self->contributions[w];
+
+        return TRUE;
+}
+
+/* the strides of the bins of the axes, without the storage margins */
+static inline void cube_peaks_lens(const HklBinocularsCube *self, size_t *lens)
+{
+        size_t i = darray_size(self->axes) - 1;
+
+        lens[i] = 1;
+        while(i-- > 0)
+                lens[i] = lens[i + 1] * axis_size(&darray_item(self->axes, i + 1));
+}
+
+/* the label of a bin always points to a smaller bin of its peak, the
+ * root is the first bin of the peak */
+static inline size_t peaks_find(size_t *labels, size_t i)
+{
+        while(labels[i] != i){
+                labels[i] = labels[labels[i]];
+                i = labels[i];
+        }
+
+        return i;
+}
+
+static inline void peaks_union(size_t *labels, size_t i, size_t j)
+{
+        i = peaks_find(labels, i);
+        j = peaks_find(labels, j);
+
+        if(i < j)
+                labels[j] = i;
+        else
+                labels[i] = j;
+}
+
+static inline void cube_peaks_slab(const HklBinocularsCube *self,
+                                   size_t start, size_t end,
+                                   darray_axis *slab)
+{
+        HklBinocularsAxis *axis;
+
+        darray_foreach(axis, self->axes){
+                darray_append(*slab, *axis);
+        }
+        darray_item(*slab, 0).imin = darray_item(self->axes, 0).imin + start;
+        darray_item(*slab, 0).imax = darray_item(self->axes, 0).imin + end - 1;
+}
+
+/* label the bins of the slab, only with their neighbours in the slab
+ * so each thread writes only its own labels */
+static gpointer cube_peaks_label_job(gpointer data)
+{
+        size_t i;
+        HklBinocularsCubePeaksJob *job = data;
+        const HklBinocularsCube *self = job->self;
+        darray_axis slab = darray_new();
+        size_t n_axes = darray_size(self->axes);
+        ptrdiff_t lens[n_axes];
+        size_t strides[n_axes];
+        ptrdiff_t indexes[n_axes];
+        size_t c;
+
+        cube_lens(self, lens);
+        cube_peaks_lens(self, strides);
+        cube_peaks_slab(self, job->start, job->end, &slab);
+
+        c = job->start * strides[0];
+        axes_first_bin(&slab, indexes);
+        do{
+                double value;
+
+                job->labels[c] = PEAK_NONE;
+                if(cube_peak_value(self, cube_bin_index(self, lens, indexes), &value)
+                   && value >= job->threshold){
+                        job->labels[c] = c;
+                        for(i=0; i<n_axes; ++i)
+                                if(indexes[i] > darray_item(slab, i).imin
+                                   && PEAK_NONE != job->labels[c - strides[i]])
+                                        peaks_union(job->labels, c, c - strides[i]);
+                }
+                c++;
+        }while(axes_next_bin(&slab, indexes));
+
+        darray_free(slab);
+
+        return NULL;
+}
+
+static inline void cube_peak_add_bin(HklBinocularsCubePeak *peak,
+                                     const HklBinocularsCube *self,
+                                     ptrdiff_t w, const ptrdiff_t *indexes,
+                                     double value)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(self->axes); ++i){
+                if(0 == peak->n_bins){
+                        peak->imin[i] = peak->imax[i] = indexes[i];
+                }else{
+                        peak->imin[i] = min(peak->imin[i], indexes[i]);
+                        peak->imax[i] = max(peak->imax[i], indexes[i]);
+                }
+                peak->centroid[i] += value * indexes[i];
+        }
+        peak->n_bins++;
+        peak->intensity += value;
+        peak->sums.photons += self->photons[w];
+        peak->sums.contributions += self->contributions[w];
+        if(self->weighted){
+                peak->sums.intensities += self->intensities[w];
+                peak->sums.variances += self->variances[w];
+        }
+}
+
+static inline void cube_peak_merge(HklBinocularsCubePeak *self,
+                                   const HklBinocularsCubePeak *other,
+                                   size_t n_axes)
+{
+        size_t i;
+
+        if(0 == other->n_bins)
+                return;
+
+        if(0 == self->n_bins){
+                *self = *other;
+                return;
+        }
+
+        for(i=0; i<n_axes; ++i){
+                self->imin[i] = min(self->imin[i], other->imin[i]);
+                self->imax[i] = max(self->imax[i], other->imax[i]);
+                self->centroid[i] += other->centroid[i];
+        }
+        self->n_bins += other->n_bins;
+        self->intensity += other->intensity;
+        self->sums.photons += other->sums.photons;
+        self->sums.contributions += other->sums.contributions;
+        self->sums.intensities += other->sums.intensities;
+        self->sums.variances += other->sums.variances;
+}
+
+/* sum the bins of the slab into its own table of peaks */
+static gpointer cube_peaks_sum_job(gpointer data)
+{
+        HklBinocularsCubePeaksJob *job = data;
+        const HklBinocularsCube *self = job->self;
+        darray_axis slab = darray_new();
+        size_t n_axes = darray_size(self->axes);
+        ptrdiff_t lens[n_axes];
+        size_t strides[n_axes];
+        ptrdiff_t indexes[n_axes];
+        size_t c;
+
+        job->peaks = calloc(job->n_peaks, sizeof(*job->peaks));
+
+        cube_lens(self, lens);
+        cube_peaks_lens(self, strides);
+        cube_peaks_slab(self, job->start, job->end, &slab);
+
+        c = job->start * strides[0];
+        axes_first_bin(&slab, indexes);
+        do{
+                if(PEAK_NONE != job->labels[c]){
+                        double value;
+                        ptrdiff_t w = cube_bin_index(self, lens, indexes);
+
+                        cube_peak_value(self, w, &value);
+                        cube_peak_add_bin(&job->peaks[job->labels[c]],
+                                          self, w, indexes, value);
+                }
+                c++;
+        }while(axes_next_bin(&slab, indexes));
+
+        darray_free(slab);
+
+        return NULL;
+}
+
+static void cube_peaks_run(HklBinocularsCubePeaksJob *jobs, size_t n_jobs,
+                           GThreadFunc func)
+{
+        size_t i;
+
+        if(1 == n_jobs){
+                func(&jobs[0]);
+        }else{
+                GThread *threads[n_jobs];
+
+                for(i=0; i<n_jobs; ++i)
+                        threads[i] = g_thread_new("cube-peaks", func, &jobs[i]);
+                for(i=0; i<n_jobs; ++i)
+                        g_thread_join(threads[i]);
+        }
+}
+
+HklBinocularsCubePeak *hkl_binoculars_cube_peaks(const HklBinocularsCube *self,
+                                                 double threshold,
+                                                 size_t n_threads,
+                                                 size_t *n_peaks)
+{
+        size_t i;
+        size_t c;
+        size_t n;
+        size_t n_slabs;
+        size_t *labels;
+        HklBinocularsCubePeak *peaks = NULL;
+
+        *n_peaks = 0;
+
+        if(cube_is_empty(self))
+                return NULL;
+
+        size_t n_axes = darray_size(self->axes);
+        if(n_axes > HKL_BINOCULARS_CUBE_PEAK_MAX_AXES){
+                fprintf(stderr, "The peaks of a cube with %zu axes are not supported\n",
+                        n_axes);
+                return NULL;
+        }
+
+        hkl_binoculars_cube_planar(self);
+
+        size_t strides[n_axes];
+
+        cube_peaks_lens(self, strides);
+        n_slabs = axis_size(&darray_item(self->axes, 0));
+        n = n_slabs * strides[0];
+        if(0 == n_threads)
+                n_threads = g_get_num_processors();
+        n_threads = MIN(n_threads, n_slabs);
+
+        HklBinocularsCubePeaksJob jobs[n_threads];
+
+        labels = malloc(n * sizeof(*labels));
+        for(i=0; i<n_threads; ++i){
+                jobs[i].self = self;
+                jobs[i].threshold = threshold;
+                jobs[i].labels = labels;
+                jobs[i].peaks = NULL;
+                jobs[i].n_peaks = 0;
+                jobs[i].start = i * n_slabs / n_threads;
+                jobs[i].end = (i + 1) * n_slabs / n_threads;
+        }
+
+        /* connected components of each slab in parallel, then join
+         * them through the first plane of each slab */
+        cube_peaks_run(jobs, n_threads, cube_peaks_label_job);
+        for(i=1; i<n_threads; ++i){
+                size_t first = jobs[i].start * strides[0];
+
+                for(c=first; c<first + strides[0]; ++c)
+                        if(PEAK_NONE != labels[c] && PEAK_NONE != labels[c - strides[0]])
+                                peaks_union(labels, c, c - strides[0]);
+        }
+
+        /* number the peaks by their first bin, the label of a bin
+         * points to an already numbered one */
+        for(c=0; c<n; ++c)
+                if(PEAK_NONE != labels[c])
+                        labels[c] = labels[c] == c ? (*n_peaks)++ : labels[labels[c]];
+
+        if(*n_peaks > 0){
+                for(i=0; i<n_threads; ++i)
+                        jobs[i].n_peaks = *n_peaks;
+                cube_peaks_run(jobs, n_threads, cube_peaks_sum_job);
+
+                peaks = jobs[0].peaks;
+                for(i=1; i<n_threads; ++i){
+                        for(c=0; c<*n_peaks; ++c)
+                                cube_peak_merge(&peaks[c], &jobs[i].peaks[c], n_axes);
+                        free(jobs[i].peaks);
+                }
+
+                /* the centre of the bounding box for a null intensity */
+                for(c=0; c<*n_peaks; ++c)
+                        for(i=0; i<n_axes; ++i){
+                                const HklBinocularsAxis *axis = &darray_item(self->axes, i);
+
+                                if(0 != peaks[c].intensity)
+                                        peaks[c].centroid[i] /= peaks[c].intensity;
+                                else
+                                        peaks[c].centroid[i] = 0.5 * (peaks[c].imin[i] + peaks[c].imax[i]);
+                                peaks[c].centroid[i] *= axis->resolution;
+                        }
+        }
+
+        free(labels);
+
+        return peaks;
+}
+
+/* compute the part [kmin, kmax) of the slowest axis of other which
+ * overlap the slab [start, end) of the slowest axis of the self
+ * storage. Return FALSE if there is no overlap. */
+static inline int cube_slab_overlap(const HklBinocularsCube *self,
+                                    const HklBinocularsCube *other,
+                                    size_t start, size_t end,
+                                    size_t *k_offset, size_t *kmin, size_t *kmax)
+{
+        size_t k_size = axis_size(&darray_item(other->axes, 0));
+
+        *k_offset = darray_item(other->axes, 0).imin - darray_item(self->storage, 0).imin;
+        *kmin = start > *k_offset ? start - *k_offset : 0;
+        *kmax = end > *k_offset ? MIN(end - *k_offset, k_size) : 0;
+
+        return *kmin < *kmax;
+}
+
+/* the offset of the first bin of the data of other in the storage of
+ * self along the axis i */
+static inline size_t cube_axis_offset(const HklBinocularsCube *self,
+                                      const HklBinocularsCube *other,
+                                      size_t i)
+{
+        return darray_item(other->axes, i).imin - darray_item(self->storage, i).imin;
+}
+
+/* an unweighted bin counts with a unit weight */
+static inline void cube_add_weighted_bin(HklBinocularsCube *self, size_t w,
+                                         const HklBinocularsCube *other, size_t w1)
+{
+        if(other->weighted){
+                self->intensities[w] += other->intensities[w1];
+                self->variances[w] += other->variances[w1];
+        }else{
+                self->intensities[w] += other->photons[w1];
+                self->variances[w] += other->photons[w1];
+        }
+}
+
+static inline void cube_add_cube_2(HklBinocularsCube *self,
+                                   const HklBinocularsCube *other,
+                                   size_t start, size_t end)
+{
+        size_t i, j;
+        size_t i_offset, j_offset;
+        size_t i_offset_other, j_offset_other;
+        size_t jmin, jmax;
+
+        size_t stride_i = 1;
+        size_t stride_j = stride_i * axis_size(&darray_item(self->storage, 1));
+
+        /* fill the values of other */
+        size_t stride_i_other = 1;
+        size_t stride_j_other = stride_i_other * axis_size(&darray_item(other->storage, 1));
+
+        if (FALSE == cube_slab_overlap(self, other, start, end, &j_offset, &jmin, &jmax))
+                return;
+
+        i_offset = cube_axis_offset(self, other, 1);
+        i_offset_other = cube_axis_offset(other, other, 1);
+        j_offset_other = cube_axis_offset(other, other, 0);
+
+        for(j=jmin; j<jmax; ++j){
+                for(i=0; i<axis_size(&darray_item(other->axes, 1)); ++i){
+                        size_t w = (i + i_offset) * stride_i + (j + j_offset) * stride_j;
+                        size_t w1 = (i + i_offset_other) * stride_i_other + (j + j_offset_other) * stride_j_other;
+
+                        self->photons[w] += other->photons[w1];
+                        self->contributions[w] += other->contributions[w1];
+                        if(self->weighted)
+                                cube_add_weighted_bin(self, w, other, w1);
+                }
+        }
+}
+
+static inline void cube_add_cube_3(HklBinocularsCube *self,
+                                   const HklBinocularsCube *other,
+                                   size_t start, size_t end)
+{
+        size_t i, j, k;
+        size_t i_offset, j_offset, k_offset;
+        size_t i_offset_other, j_offset_other, k_offset_other;
+        size_t kmin, kmax;
+
+        size_t stride_i = 1;
+        size_t stride_j = stride_i * axis_size(&darray_item(self->storage, 2));
+        size_t stride_k = stride_j * axis_size(&darray_item(self->storage, 1));
+
+        /* fill the values of other */
+        size_t stride_i_other = 1;
+        size_t stride_j_other = stride_i_other * axis_size(&darray_item(other->storage, 2));
+        size_t stride_k_other = stride_j_other * axis_size(&darray_item(other->storage, 1));
+
+        if (FALSE == cube_slab_overlap(self, other, start, end, &k_offset, &kmin, &kmax))
+                return;
+
+        i_offset = cube_axis_offset(self, other, 2);
+        j_offset = cube_axis_offset(self, other, 1);
+        i_offset_other = cube_axis_offset(other, other, 2);
+        j_offset_other = cube_axis_offset(other, other, 1);
+        k_offset_other = cube_axis_offset(other, other, 0);
+
+        for(k=kmin; k<kmax; ++k){
+                for(j=0; j<axis_size(&darray_item(other->axes, 1)); ++j){
+                        for(i=0; i<axis_size(&darray_item(other->axes, 2)); ++i){
+                                size_t w = (i + i_offset) * stride_i + (j + j_offset) * stride_j + (k + k_offset) * stride_k;
+                                size_t w1 = (i + i_offset_other) * stride_i_other + (j + j_offset_other) * stride_j_other + (k + k_offset_other) * stride_k_other;
+
+                                self->photons[w] += other->photons[w1];
+                                self->contributions[w] += other->contributions[w1];
+                                if(self->weighted)
+                                        cube_add_weighted_bin(self, w, other, w1);
+                        }
+                }
+        }
+}
+
+/* add the part of other which is in the slab [start, end) of the
+ * slowest axis of the self storage. */
+static inline void cube_add_cube_slab(HklBinocularsCube *self,
+                                      const HklBinocularsCube *other,
+                                      size_t start, size_t end)
+{
+        assert(darray_size(self->axes) == darray_size(other->axes));
+
+        switch(darray_size(self->axes)){
+        case 2: cube_add_cube_2(self, other, start, end);
+                break;
+        case 3: cube_add_cube_3(self, other, start, end);
+                break;
+        default: assert(0);
+        }
+}
+
+static inline void cube_add_cube(HklBinocularsCube *self,
+                                 const HklBinocularsCube *other)
+{
+        cube_add_cube_slab(self, other,
+                           0, axis_size(&darray_item(self->storage, 0)));
+}
+
+/* Merge */
+
+typedef struct _HklBinocularsCubeMergeJob HklBinocularsCubeMergeJob;
+struct _HklBinocularsCubeMergeJob
+{
+        HklBinocularsCube *self;
+        const HklBinocularsCube *const *cubes;
+        size_t n_cubes;
+        size_t start;
+        size_t end;
+};
+
+static gpointer cube_merge_job(gpointer data)
+{
+        HklBinocularsCubeMergeJob *job = data;
+
+        hkl_binoculars_cube_merge_slab(job->self, job->cubes, job->n_cubes,
+                                       job->start, job->end);
+
+        return NULL;
+}
+
+/* keep only the non empty cubes */
+static size_t cubes_non_empty(size_t n_cubes,
+                              const HklBinocularsCube *const *cubes,
+                              const HklBinocularsCube **non_empty)
+{
+        size_t i;
+        size_t n = 0;
+
+        /* the merges read the planar arrays */
+        for(i=0; i<n_cubes; ++i)
+                if(NULL != cubes[i] && !cube_is_empty(cubes[i])){
+                        hkl_binoculars_cube_planar(cubes[i]);
+                        non_empty[n++] = cubes[i];
+                }
+
+        return n;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_merge_axes(size_t n_cubes,
+                                                      const HklBinocularsCube *const *cubes)
+{
+        size_t i;
+        size_t n;
+        const HklBinocularsCube *non_empty[n_cubes > 0 ? n_cubes : 1];
+        HklBinocularsCube *self;
+
+        n = cubes_non_empty(n_cubes, cubes, non_empty);
+        if(0 == n)
+                return hkl_binoculars_cube_new_empty();
+
+        /* compute the union of all the axes only once */
+        self = empty_cube_from_axes(&non_empty[0]->axes);
+        self->weighted = FALSE;
+        for(i=0; i<n; ++i){
+                if(i > 0)
+                        merge_axes(&self->axes, &non_empty[i]->axes);
+                self->weighted |= non_empty[i]->weighted;
+        }
+        cube_storage_from_axes(self);
+        calloc_cube(self);
+
+        return self;
+}
+
+void hkl_binoculars_cube_merge_slab(HklBinocularsCube *self,
+                                    const HklBinocularsCube *const *cubes,
+                                    size_t n_cubes,
+                                    size_t start, size_t end)
+{
+        size_t i;
+
+        for(i=0; i<n_cubes; ++i)
+                if(NULL != cubes[i] && !cube_is_empty(cubes[i]))
+                        cube_add_cube_slab(self, cubes[i], start, end);
+}
+
+void hkl_binoculars_cubes_merge_axes(size_t n_cubes,
+                                     const HklBinocularsCube *const *cubes,
+                                     darray_axis *axes)
+{
+        size_t i;
+        size_t n;
+        HklBinocularsAxis *axis;
+        const HklBinocularsCube *non_empty[n_cubes > 0 ? n_cubes : 1];
+
+        darray_resize(*axes, 0);
+
+        n = cubes_non_empty(n_cubes, cubes, non_empty);
+        if(0 == n)
+                return;
+
+        darray_foreach(axis, non_empty[0]->axes){
+                darray_append(*axes, *axis);
+        }
+        for(i=1; i<n; ++i)
+                merge_axes(axes, &non_empty[i]->axes);
+}
+
+void hkl_binoculars_cube_normalised_difference_slab(const darray_axis *axes,
+                                                    const HklBinocularsCube *sample,
+                                                    const HklBinocularsCube *background,
+                                                    double scale,
+                                                    size_t start, size_t end,
+                                                    double *values,
+                                                    double *variances)
+{
+        size_t i;
+        size_t n;
+        HklBinocularsAxis *axis;
+        darray_axis slab = darray_new();
+        HklBinocularsCube *s, *b;
+        int with_background = NULL != background && !cube_is_empty(background);
+
+        darray_foreach(axis, *axes){
+                darray_append(slab, *axis);
+        }
+        darray_item(slab, 0).imin = darray_item(*axes, 0).imin + start;
+        darray_item(slab, 0).imax = darray_item(*axes, 0).imin + end - 1;
+
+        /* align the two cubes on the slab with the merge code, the
+           double accumulators take the unweighted cubes with a unit
+           weight */
+        s = hkl_binoculars_cube_new_from_axes_weighted(&slab, TRUE);
+        b = hkl_binoculars_cube_new_from_axes_weighted(&slab, TRUE);
+        if(NULL != sample && !cube_is_empty(sample))
+                cube_add_cube_slab(s, sample, 0, end - start);
+        if(with_background)
+                cube_add_cube_slab(b, background, 0, end - start);
+
+        n = cube_size(s);
+        for(i=0; i<n; ++i){
+                double cs = s->contributions[i];
+                double cb = b->contributions[i];
+
+                if(0 == s->contributions[i]
+                   || (with_background && 0 == b->contributions[i])){
+                        values[i] = NAN;
+                        variances[i] = NAN;
+                        continue;
+                }
+
+                values[i] = s->intensities[i] / cs;
+                variances[i] = s->variances[i] / (cs * cs);
+                if(with_background){
+                        values[i] -= scale * b->intensities[i] / cb;
+                        variances[i] += scale * scale * b->variances[i] / (cb * cb);
+                }
+        }
+
+        hkl_binoculars_cube_free(b);
+        hkl_binoculars_cube_free(s);
+        darray_free(slab);
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_merge_n(size_t n_cubes,
+                                                   const HklBinocularsCube *const *cubes,
+                                                   size_t n_threads)
+{
+        size_t i;
+        size_t n;
+        size_t n_slabs;
+        const HklBinocularsCube *non_empty[n_cubes > 0 ? n_cubes : 1];
+        HklBinocularsCube *self;
+
+        n = cubes_non_empty(n_cubes, cubes, non_empty);
+        self = hkl_binoculars_cube_new_merge_axes(n, non_empty);
+        if(cube_is_empty(self))
+                return self;
+
+        /* each thread sum all the cubes in its own slab of the
+         * slowest axis, so there is no need for locks. */
+        n_slabs = axis_size(&darray_item(self->axes, 0));
+        if(0 == n_threads)
+                n_threads = g_get_num_processors();
+        n_threads = MIN(n_threads, n_slabs);
+
+        if(n_threads <= 1){
+                for(i=0; i<n; ++i)
+                        cube_add_cube(self, non_empty[i]);
+        }else{
+                GThread *threads[n_threads];
+                HklBinocularsCubeMergeJob jobs[n_threads];
+
+                for(i=0; i<n_threads; ++i){
+                        jobs[i].self = self;
+                        jobs[i].cubes = non_empty;
+                        jobs[i].n_cubes = n;
+                        jobs[i].start = i * n_slabs / n_threads;
+                        jobs[i].end = (i + 1) * n_slabs / n_threads;
+                        threads[i] = g_thread_new("cube-merge", cube_merge_job, &jobs[i]);
+                }
+                for(i=0; i<n_threads; ++i)
+                        g_thread_join(threads[i]);
+        }
+
+        return self;
+}
+
+HklBinocularsCube *hkl_binoculars_cube_new_merge(const HklBinocularsCube *cube1,
+                                                 const HklBinocularsCube *cube2)
+{
+        const HklBinocularsCube *cubes[] = {cube1, cube2};
+
+        return hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(cubes), cubes, 1);
+}
+
+static inline void switch_content(HklBinocularsCube *self,
+                                  HklBinocularsCube *other)
+{
+        unsigned int *ptr;
+        double *dptr;
+        darray_axis tmp;
+        ptrdiff_t offset0;
+        int weighted;
+        size_t mapped;
+        HklBinocularsCubeBin *bins;
+        HklBinocularsCubeNarrow *narrow;
+
+        tmp = self->axes;
+        self->axes = other->axes;
+        other->axes = tmp;
+
+        tmp = self->storage;
+        self->storage = other->storage;
+        other->storage = tmp;
+
+        offset0 = self->offset0;
+        self->offset0 = other->offset0;
+        other->offset0 = offset0;
+
+        ptr = self->photons;
+        self->photons = other->photons;
+        other->photons = ptr;
+
+        ptr = self->contributions;
+        self->contributions = other->contributions;
+        other->contributions = ptr;
+
+        weighted = self->weighted;
+        self->weighted = other->weighted;
+        other->weighted = weighted;
+
+        dptr = self->intensities;
+        self->intensities = other->intensities;
+        other->intensities = dptr;
+
+        dptr = self->variances;
+        self->variances = other->variances;
+        other->variances = dptr;
+
+        mapped = self->mapped;
+        self->mapped = other->mapped;
+        other->mapped = mapped;
+
+        bins = self->bins;
+        self->bins = other->bins;
+        other->bins = bins;
+        narrow = self->narrow;
+        self->narrow = other->narrow;
+        other->narrow = narrow;
+}
+
+/* compute the new storage of a growing cube. Each bound of the
+ * storage which does not contain the new axes is pushed further than
+ * needed by half the size of the axis, so a cube which grows
+ * steadily (timestamp, sample axis sweep...) is reallocated only
+ * O(log n) times. */
+static inline void grow_storage(darray_axis *storage,
+                                const darray_axis *old_storage,
+                                const darray_axis *axes)
+{
+        size_t i;
+
+        for(i=0; i<darray_size(*storage); ++i){
+                HklBinocularsAxis *s = &darray_item(*storage, i);
+                const HklBinocularsAxis *axis = &darray_item(*axes, i);
+                ptrdiff_t headroom = axis_size(axis) / 2;
+
+                *s = darray_item(*old_storage, i);
+                if (axis->imin < s->imin)
+                        s->imin = axis->imin - headroom;
+                if (axis->imax > s->imax)
+                        s->imax = axis->imax + headroom;
+        }
+}
+
+void hkl_binoculars_cube_add_space(HklBinocularsCube *self,
+                                   const HklBinocularsSpace *space)
+{
+#ifdef DEBUG
+        fprintf(stdout, "\nENTERING hkl_binoculars_cube_add_space:\n");
+        hkl_binoculars_cube_fprintf(stdout, self);
+        hkl_binoculars_space_fprintf(stdout, space);
+#endif
+        /* check the compatibility of the cube and the space. */
+        if (1 != space_is_empty(space)){
+                if (does_not_include(&self->axes, &space->axes)){
+#ifdef DEBUG
+                        fprintf(stdout, "\nthe Cube does not contain the space, so extend the cube.");
+#endif
+                        if(0 != darray_size(self->axes)){ /* self cube is not empty */
+                                if (does_not_include(&self->storage, &space->axes)){
+                                        HklBinocularsCube *cube = empty_cube_from_axes(&self->axes);
+                                        if(NULL != cube){
+                                                hkl_binoculars_cube_planar(self);
+                                                cube->weighted = self->weighted;
+                                                merge_axes(&cube->axes, &space->axes); /* circonscript */
+                                                grow_storage(&cube->storage, &self->storage, &cube->axes);
+                                                cube->offset0 = compute_offset0(&cube->storage);
+                                                calloc_cube(cube);
+                                                cube_add_cube(cube, self);
+                                                switch_content(self, cube);
+                                                hkl_binoculars_cube_free(cube);
+                                        }
+                                } else { /* there is enough room in the storage */
+                                        merge_axes(&self->axes, &space->axes);
+                                }
+                        } else { /* self cube is empty */
+                                HklBinocularsCube *cube =  empty_cube_from_axes(&space->axes);
+                                if(NULL != cube){
+                                        cube->weighted = self->weighted;
+                                        calloc_cube(cube);
+                                        switch_content(self, cube);
+                                        hkl_binoculars_cube_free(cube);
+                                }
+                        }
+                }
+                if(g_atomic_int_get(&cube_narrow_counters))
+                        cube_narrow(self);
+                else if(g_atomic_int_get(&cube_interleaved))
+                        cube_interleave(self);
+                add_non_empty_space(self, space);
+        }
+
+#ifdef DEBUG
+        fprintf(stdout, "\n");
+        hkl_binoculars_cube_fprintf(stdout, self);
+        fprintf(stdout, "\nLEAVING hkl_binoculars_cube_add_space:\n");
+#endif
+}
+
+/* Shared cube */
+
+/* the bins of a shared cube are split in stripes of
+ * HKL_BINOCULARS_CUBE_STRIPE_LEN consecutive bins, each one protected
+ * by one of the HKL_BINOCULARS_CUBE_STRIPES locks. The items of a
+ * thread are first written in a small buffer, then flushed stripe by
+ * stripe, so a lock is taken once per stripe and per flush instead of
+ * once per pixel. */
+#define HKL_BINOCULARS_CUBE_STRIPES 64
+#define HKL_BINOCULARS_CUBE_STRIPE_LEN 4096
+#define HKL_BINOCULARS_CUBE_BUFFER_LEN 1024
+
+struct _HklBinocularsCubeStripes
+{
+        GMutex locks[HKL_BINOCULARS_CUBE_STRIPES];
+};
+
+typedef struct _HklBinocularsCubeBufferItem HklBinocularsCubeBufferItem;
+struct _HklBinocularsCubeBufferItem
+{
+        ptrdiff_t w;
+        float intensity;
+        float weight;
+        uint32_t contributions;
+};
+
+typedef struct _HklBinocularsCubeBuffer HklBinocularsCubeBuffer;
+struct _HklBinocularsCubeBuffer
+{
+        size_t n;
+        HklBinocularsCubeBufferItem items[HKL_BINOCULARS_CUBE_BUFFER_LEN];
+};
+
+void hkl_binoculars_cube_shared_set(HklBinocularsCube *self, int shared)
+{
+        size_t i;
+
+        if(shared && NULL == self->stripes){
+                self->stripes = g_new(HklBinocularsCubeStripes, 1);
+                for(i=0; i<HKL_BINOCULARS_CUBE_STRIPES; ++i)
+                        g_mutex_init(&self->stripes->locks[i]);
+        }else if(!shared && NULL != self->stripes){
+                for(i=0; i<HKL_BINOCULARS_CUBE_STRIPES; ++i)
+                        g_mutex_clear(&self->stripes->locks[i]);
+                g_free(self->stripes);
+                self->stripes = NULL;
+        }
+}
+
+static inline size_t cube_stripe(ptrdiff_t w)
+{
+        return (w / HKL_BINOCULARS_CUBE_STRIPE_LEN) % HKL_BINOCULARS_CUBE_STRIPES;
+}
+
+static inline void cube_add_at(HklBinocularsCube *cube, ptrdiff_t w,
+                               float intensity, float weight,
+                               uint32_t contributions)
+{
+        cube_bin_add(cube, w, rint(intensity), contributions);
+        if(cube->weighted){
+                cube->intensities[w] += intensity;
+                cube->variances[w] += (double)weight * intensity;
+        }
+}
+
+/* add the buffered items stripe by stripe */
+static void cube_buffer_flush(HklBinocularsCube *cube,
+                              HklBinocularsCubeBuffer *buffer)
+{
+        size_t i;
+        size_t s;
+        size_t starts[HKL_BINOCULARS_CUBE_STRIPES + 1] = {0};
+        uint16_t order[HKL_BINOCULARS_CUBE_BUFFER_LEN];
+
+        /* counting sort of the items by stripe */
+        for(i=0; i<buffer->n; ++i)
+                starts[cube_stripe(buffer->items[i].w) + 1]++;
+        for(s=0; s<HKL_BINOCULARS_CUBE_STRIPES; ++s)
+                starts[s + 1] += starts[s];
+        {
+                size_t next[HKL_BINOCULARS_CUBE_STRIPES];
+
+                memcpy(next, starts, sizeof(next));
+                for(i=0; i<buffer->n; ++i)
+                        order[next[cube_stripe(buffer->items[i].w)]++] = i;
+        }
+
+        for(s=0; s<HKL_BINOCULARS_CUBE_STRIPES; ++s){
+                if(starts[s] == starts[s + 1])
+                        continue;
+
+                g_mutex_lock(&cube->stripes->locks[s]);
+                for(i=starts[s]; i<starts[s + 1]; ++i){
+                        const HklBinocularsCubeBufferItem *item = &buffer->items[order[i]];
+
+                        cube_add_at(cube, item->w, item->intensity, item->weight,
+                                    item->contributions);
+                }
+                g_mutex_unlock(&cube->stripes->locks[s]);
+        }
+
+        buffer->n = 0;
+}
+
+/* Direct accumulation */
+
+/* the linear index of the bin of an item in a cube which already has
+ * its final dimensions. Return FALSE if the item is outside of the
+ * cube. */
+static inline int cube_item_w(const HklBinocularsCube *cube,
+                              const ptrdiff_t *lens,
+                              const HklBinocularsSpaceItem *item,
+                              ptrdiff_t *w)
+{
+        size_t i;
+        size_t n_axes = darray_size(cube->axes);
+
+        for(i=0; i<n_axes; ++i){
+                const HklBinocularsAxis *axis = &darray_item(cube->axes, i);
+                ptrdiff_t v = item->indexes_0[i];
+
+                if (v < axis->imin || v > axis->imax)
+                        return FALSE;
+        }
+
+        *w = -cube->offset0;
+        for(i=0; i<n_axes; ++i)
+                *w += lens[i] * item->indexes_0[n_axes - 1 - i];
+
+        return TRUE;
+}
+
+/* add one item into a cube which already has its final dimensions,
+ * through the buffer for a shared cube. Return FALSE if the item is
+ * outside of the cube. */
+static inline int cube_add_item(HklBinocularsCube *cube,
+                                const ptrdiff_t *lens,
+                                const HklBinocularsSpaceItem *item,
+                                HklBinocularsCubeBuffer *buffer)
+{
+        ptrdiff_t w;
+
+        if (FALSE == cube_item_w(cube, lens, item, &w))
+                return FALSE;
+
+        if(NULL == cube->stripes)
+                cube_add_at(cube, w, item->intensity, item->weight, 1);
+        else{
+                buffer->items[buffer->n++] = (HklBinocularsCubeBufferItem){
+                        .w = w,
+                        .intensity = item->intensity,
+                        .weight = item->weight,
+                        .contributions = 1,
+                };
+                if(HKL_BINOCULARS_CUBE_BUFFER_LEN == buffer->n)
+                        cube_buffer_flush(cube, buffer);
+        }
+
+        return TRUE;
+}
+
+void hkl_binoculars_cube_add_space_shared(HklBinocularsCube *self,
+                                          HklBinocularsCube *overflow,
+                                          const HklBinocularsSpace *space)
+{
+        size_t i;
+        size_t n_axes = darray_size(self->axes);
+        ptrdiff_t w0 = -self->offset0;
+        HklBinocularsSpacePackedItem *item;
+        HklBinocularsCubeBuffer buffer = {0};
+
+        if (1 == space_is_empty(space))
+                return;
+
+        /* the shared cube is never extended */
+        if (0 == n_axes || does_not_include(&self->axes, &space->axes)){
+                hkl_binoculars_cube_add_space(overflow, space);
+                return;
         }
 
-HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(int32_t);
-HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(uint16_t);
-HKL_BINOCULARS_SPACE_QCUSTOM_IMPL(uint32_t);
+        if (NULL == self->stripes){
+                add_non_empty_space(self, space);
+                return;
+        }
 
-/* hkl */
+        ptrdiff_t lens[n_axes];
 
-#define HKL_BINOCULARS_SPACE_HKL_IMPL(image_t)                          \
-        HKL_BINOCULARS_SPACE_HKL_DECL(image_t)                          \
+        cube_lens(self, lens);
+        for(i=0; i<n_axes; ++i)
+                w0 += lens[i] * space->origin[n_axes - 1 - i];
+
+        darray_foreach(item, space->items){
+                ptrdiff_t w = w0;
+
+                for(i=0; i<n_axes; ++i)
+                        w += lens[i] * item->indexes[n_axes - 1 - i];
+
+                buffer.items[buffer.n++] = (HklBinocularsCubeBufferItem){
+                        .w = w,
+                        .intensity = item->intensity,
+                        .weight = item->weight,
+                        .contributions = space->n_frames,
+                };
+                if(HKL_BINOCULARS_CUBE_BUFFER_LEN == buffer.n)
+                        cube_buffer_flush(self, &buffer);
+        }
+        if (0 != buffer.n)
+                cube_buffer_flush(self, &buffer);
+}
+
+#define CUBE_EMIT(item) do {                                            \
+                if (FALSE == cube_add_item(cube, lens, &(item), &buffer)) \
+                        n_outside++;                                    \
+        } while(0)
+
+/* the bins of the cube are shared, so the pixels of the frame are
+ * accumulated by the calling thread only, many threads can accumulate
+ * frames into a shared cube */
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(image_t)            \
+        HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(image_t)            \
         {                                                               \
-                size_t i;                                               \
-                double correction;                                      \
-                const char * names[] = {"H", "K", "L"};                 \
-                HklBinocularsSpaceItem item;                            \
-                                                                        \
-                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
-                assert(ARRAY_SIZE(names) == n_resolutions);             \
-                assert(n_pixels == space->max_items);                   \
-                                                                        \
-                const double *h = &pixels_coordinates[0 * n_pixels];    \
-                const double *k = &pixels_coordinates[1 * n_pixels];    \
-                const double *l = &pixels_coordinates[2 * n_pixels];    \
-                                                                        \
-                HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D); \
-                HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, detector); \
-                CGLM_ALIGN_MAT mat4s m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
-                const HklVector ki_v = hkl_geometry_ki_get(geometry);	\
-                CGLM_ALIGN_MAT vec3s ki = {{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
-                float K = glms_vec3_norm(ki);                           \
-                HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry,sample); \
-                CGLM_ALIGN_MAT mat4s m_holder_s = hkl_binoculars_holder_transformation_get(holder_s); \
-                                                                        \
-                const HklMatrix *UB = hkl_sample_UB_get(sample);        \
-                CGLM_ALIGN_MAT mat4s ub = {{{UB->data[0][0], UB->data[1][0], UB->data[2][0], 0}, \
-                                            {UB->data[0][1], UB->data[1][1], UB->data[2][1], 0}, \
-                                            {UB->data[0][2], UB->data[1][2], UB->data[2][2], 0}, \
-                                            {0, 0, 0, 1}}};             \
-                glms_mat4_print(ub, stdout);                            \
-                m_holder_s = glms_mat4_mul(m_holder_s, ub);             \
-                glms_mat4_print(m_holder_s, stdout);                    \
-                m_holder_s = glms_mat4_inv(m_holder_s);                 \
-                                                                        \
-                darray_size(space->items) = 0;                          \
-                                                                        \
-                glms_mat4_print(m_holder_s, stdout);                    \
-                glms_mat4_print(m_holder_d, stdout);                    \
+                size_t n_outside = 0;                                   \
+                HklBinocularsCubeBuffer buffer = {0};                   \
+                HklBinocularsFrameJob job = QCUSTOM_FRAME_JOB(NULL);    \
+                CGLM_ALIGN_MAT mat4s m_sample = qcustom_m_sample_get(surf, uqx, uqy, uqz); \
                                                                         \
-                for(i=0;i<n_pixels;++i){                                \
-                        if(not_masked(masked, i)){                      \
-                                CGLM_ALIGN_MAT vec3s v = {{h[i], k[i], l[i]}}; \
+                if (cube_is_empty(cube))                                \
+                        return n_pixels;                                \
                                                                         \
-                                v = glms_mat4_mulv3(m_holder_d, v, 1);  \
-                                v = glms_vec3_scale_as(v, K);           \
-                                correction = polarisation(v, weight, do_polarisation_correction); \
-                                v = glms_vec3_sub(v, ki);               \
-                                v = glms_mat4_mulv3(m_holder_s, v, 0);  \
+                ptrdiff_t lens[darray_size(cube->axes)];                \
                                                                         \
-                                item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-                                item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
-                                item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
-                                item.intensity = rint((double)image[i] * correction); \
+                cube_lens(cube, lens);                                  \
                                                                         \
-                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                        darray_append(space->items, item); \
-                        }                                               \
+                if(TRUE == qcustom_job_init(&job, geometry, &m_sample, sample_axis, NULL)){ \
+                        frame_job_indexes_init(&job);                   \
+                        QCUSTOM_PIXELS_LOOP(CUBE_EMIT, image, (&job), 0, job.n_indexes); \
                 }                                                       \
+                if (0 != buffer.n)                                      \
+                        cube_buffer_flush(cube, &buffer);               \
                                                                         \
-                space_update_axes(space, names, n_pixels, resolutions); \
-                                                                        \
-                hkl_detector_free(detector);                            \
+                return n_outside;                                       \
         }
 
-HKL_BINOCULARS_SPACE_HKL_IMPL(int32_t);
-HKL_BINOCULARS_SPACE_HKL_IMPL(uint16_t);
-HKL_BINOCULARS_SPACE_HKL_IMPL(uint32_t);
-
-/* test */
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(int32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(uint16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(uint32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(uint8_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(int16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_IMPL(float);
 
-#define HKL_BINOCULARS_SPACE_TEST_IMPL(image_t)                         \
-        HKL_BINOCULARS_SPACE_TEST_DECL(image_t)                         \
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(image_t)       \
+        HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(image_t)       \
         {                                                               \
-                size_t i;                                               \
-                const char * names[] = {"H", "K", "L"};                 \
-                double correction;                                      \
-                HklBinocularsSpaceItem item;                            \
+                size_t n_outside = 0;                                   \
+                HklBinocularsCubeBuffer buffer = {0};                   \
+                HklBinocularsFrameJob job = QCUSTOM_PLAN_FRAME_JOB(NULL); \
+                CGLM_ALIGN_MAT mat4s m_sample;                          \
                                                                         \
-                assert(ARRAY_SIZE(names) == darray_size(space->axes));  \
-                assert(ARRAY_SIZE(names) == n_resolutions);             \
-                assert(n_pixels == space->max_items);                   \
-                                                                        \
-                const double *h = &pixels_coordinates[0 * n_pixels];    \
-                const double *k = &pixels_coordinates[1 * n_pixels];    \
-                const double *l = &pixels_coordinates[2 * n_pixels];    \
-                                                                        \
-                HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D); \
-                HklHolder *holder_d = hkl_geometry_detector_holder_get(geometry, detector); \
-                CGLM_ALIGN_MAT mat4s m_holder_d = hkl_binoculars_holder_transformation_get(holder_d); \
-                const HklVector ki_v = hkl_geometry_ki_get(geometry);	\
-                CGLM_ALIGN_MAT vec3s ki = {{ki_v.data[0], ki_v.data[1], ki_v.data[2]}}; \
-                float K = glms_vec3_norm(ki);                           \
-                HklHolder *holder_s = hkl_geometry_sample_holder_get(geometry,sample); \
-                CGLM_ALIGN_MAT mat4s m_holder_s = hkl_binoculars_holder_transformation_get(holder_s); \
-                                                                        \
-                const HklMatrix *UB = hkl_sample_UB_get(sample);        \
-                CGLM_ALIGN_MAT mat4s ub = {{{UB->data[0][0], UB->data[1][0], UB->data[2][0], 0}, \
-                                            {UB->data[0][1], UB->data[1][1], UB->data[2][1], 0}, \
-                                            {UB->data[0][2], UB->data[1][2], UB->data[2][2], 0}, \
-                                            {0, 0, 0, 1}}};             \
-                glms_mat4_print(ub, stdout);                            \
-                m_holder_s = glms_mat4_mul(m_holder_s, ub);             \
-                glms_mat4_print(m_holder_s, stdout);                    \
-                m_holder_s = glms_mat4_inv(m_holder_s);                 \
-                                                                        \
-                darray_size(space->items) = 0;                          \
-                                                                        \
-                glms_mat4_print(m_holder_s, stdout);                    \
-                glms_mat4_print(m_holder_d, stdout);                    \
+                if (cube_is_empty(cube))                                \
+                        return plan->n_pixels;                          \
                                                                         \
-                for(i=0;i<n_pixels;++i){                                \
-                        if(not_masked(masked, i)){                      \
-                                CGLM_ALIGN_MAT vec3s v = {{h[i], k[i], l[i]}}; \
-                                                                        \
-                                v = glms_mat4_mulv3(m_holder_d, v, 1);  \
-                                v = glms_vec3_scale_as(v, K);           \
-                                correction = polarisation(v, weight, do_polarisation_correction); \
-                                v = glms_vec3_sub(v, ki);               \
-                                v = glms_mat4_mulv3(m_holder_s, v, 0);  \
-                                                                        \
-                                item.indexes_0[0] = rint(v.raw[0] / resolutions[0]); \
-                                item.indexes_0[1] = rint(v.raw[1] / resolutions[1]); \
-                                item.indexes_0[2] = rint(v.raw[2] / resolutions[2]); \
-                                item.intensity = rint((double)image[i] * correction); \
+                ptrdiff_t lens[darray_size(cube->axes)];                \
                                                                         \
-                                if(TRUE == item_in_the_limits(&item, limits, n_limits)) \
-                                        darray_append(space->items, item); \
-                        }                                               \
-                }                                                       \
+                cube_lens(cube, lens);                                  \
+                memcpy(m_sample.raw, plan->m_sample, sizeof(plan->m_sample)); \
                                                                         \
-                space_update_axes(space, names, n_pixels, resolutions); \
+                if(TRUE == qcustom_job_init(&job, geometry, &m_sample, plan->sample_axis, plan->sample_axis_idx)) \
+                        QCUSTOM_PIXELS_LOOP(CUBE_EMIT, image, (&job), 0, job.n_indexes); \
+                if (0 != buffer.n)                                      \
+                        cube_buffer_flush(cube, &buffer);               \
                                                                         \
-                hkl_detector_free(detector);                            \
+                return n_outside;                                       \
         }
 
-HKL_BINOCULARS_SPACE_TEST_IMPL(int32_t);
-HKL_BINOCULARS_SPACE_TEST_IMPL(uint16_t);
-HKL_BINOCULARS_SPACE_TEST_IMPL(uint32_t);
-
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(int32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(uint16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(uint32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(uint8_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(int16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_IMPL(float);
 
-/* Cube */
+/* QCustom lut */
 
-/* this method compute the linear coordinates of the first element in
- * the absolute coordinates of the bin */
-static inline ptrdiff_t compute_offset0(const darray_axis *axes)
+struct _HklBinocularsQCustomLut
 {
-	size_t i;
-	ptrdiff_t len = 1;
-	ptrdiff_t offset = 0;
-        size_t n_axes = darray_size(*axes);
+        const HklBinocularsQCustomPlan *plan;
+        float m_holder_d[4][4]; /* the transformations of the geometry */
+        float m_holder_s[4][4];
+        float ki[3];
+        int timestamp_axis; /* the axis of the timestamp or -1 */
+        size_t n_items; /* the projected (sub-)pixels */
+        size_t n_rows;
+        ptrdiff_t *bins; /* the 3 indexes of the bin of each row */
+        uint32_t *contributions; /* the number of (sub-)pixels of each row */
+        double *darks; /* the dark of each row, times the gains */
+        double *darks2; /* the same for the variances */
+        size_t *rows; /* the first entry of each row, n_rows + 1 */
+        uint32_t *pixels; /* the pixel of each entry */
+        float *gains; /* the sum of the corrections of the sub-pixels */
+        float *gains2; /* the sum of the squared corrections */
+};
 
-	for(i=0; i<n_axes; ++i){
-		const HklBinocularsAxis *axis = &darray_item(*axes, n_axes-1-i);
-		offset += len * axis->imin;
-		len *= axis_size(axis);
-	}
-	return offset;
+/* the axis of the timestamp, its bin is the only one which changes
+ * between the frames of a static geometry */
+static inline int qcustom_timestamp_axis(HklBinocularsQCustomSubProjectionEnum subprojection)
+{
+        switch(subprojection){
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TIMESTAMP:
+                return 1;
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TTH_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Y_Z_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPARS_QPER_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_SAMPLEAXIS_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QZ_TIMESTAMP:
+        case HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QY_QZ_TIMESTAMP:
+                return 2;
+        default:
+                return -1;
+        }
 }
 
-static inline HklBinocularsCube *empty_cube_from_axes(const darray_axis *axes)
+typedef struct _HklBinocularsQCustomLutItem HklBinocularsQCustomLutItem;
+struct _HklBinocularsQCustomLutItem
 {
-        HklBinocularsCube *self = NULL;
+        ptrdiff_t indexes[3];
+        uint32_t pixel;
+        float gain;
+};
 
-        if (0 != darray_size(*axes)){
-                HklBinocularsAxis *axis;
+typedef darray(HklBinocularsQCustomLutItem) darray_lut_item;
 
-                self = g_new0(HklBinocularsCube, 1);
-                darray_foreach(axis, *axes){
-                        darray_append(self->axes, *axis);
-                }
-                self->offset0 = compute_offset0(&self->axes);
-                self->photons = NULL;
-                self->contributions = NULL;
-        }
+static int lut_item_cmp(const void *a, const void *b)
+{
+        const HklBinocularsQCustomLutItem *ia = a;
+        const HklBinocularsQCustomLutItem *ib = b;
+        size_t i;
 
-        return self;
+        for(i=0; i<ARRAY_SIZE(ia->indexes); ++i)
+                if(ia->indexes[i] != ib->indexes[i])
+                        return ia->indexes[i] < ib->indexes[i] ? -1 : 1;
+
+        return (ia->pixel > ib->pixel) - (ia->pixel < ib->pixel);
 }
 
-static inline size_t cube_size(const HklBinocularsCube *self)
+static inline int lut_item_same_bin(const HklBinocularsQCustomLutItem *a,
+                                    const HklBinocularsQCustomLutItem *b)
 {
-        size_t n = 1;
-        HklBinocularsAxis *axis;
-
-        darray_foreach(axis, self->axes){
-                n *= axis_size(axis);
-        }
-
-	return n;
+        return 0 == memcmp(a->indexes, b->indexes, sizeof(a->indexes));
 }
 
-static inline size_t malloc_cube(HklBinocularsCube *self)
+/* the items of the sub-pixel i of the loop, the weight of the item
+ * is the correction of the pixel */
+#define LUT_EMIT(item) do {                                             \
+                HklBinocularsQCustomLutItem lut_item_ = {               \
+                        .pixel = job_pixel(&job, i),                    \
+                        .gain = (item).weight,                          \
+                };                                                      \
+                memcpy(lut_item_.indexes, (item).indexes_0, sizeof(lut_item_.indexes)); \
+                darray_append(items, lut_item_);                        \
+        } while(0)
+
+HklBinocularsQCustomLut *hkl_binoculars_qcustom_lut_new(const HklBinocularsQCustomPlan *plan,
+                                                        const HklGeometry *geometry)
 {
-        size_t n = cube_size(self);
+        size_t i, e, r;
+        darray_lut_item items = darray_new();
+        HklBinocularsQCustomLut *self;
+        /* the projection of a frame of zeros, only the corrections of
+         * the items are kept, without weight, limits and timestamp */
+        float *image = calloc(plan->n_pixels, sizeof(*image));
+        double weight = 1.0;
+        double timestamp = 0.0;
+        HklBinocularsFrameJob job = QCUSTOM_PLAN_FRAME_JOB(NULL);
+        CGLM_ALIGN_MAT mat4s m_sample;
+        const double *dark = NULL == job.corrections ? NULL : job.corrections->dark;
+
+        job.limits = NULL;
+        job.n_limits = 0;
+        memcpy(m_sample.raw, plan->m_sample, sizeof(plan->m_sample));
+
+        /* only the timestamp axis of the subprojections is added
+         * when the frames are accumulated */
+        if(FALSE == qcustom_job_init(&job, geometry, &m_sample, plan->sample_axis, plan->sample_axis_idx)
+           || (job.variables & (1u << HKL_BINOCULARS_EXPRESSION_VARIABLE_TIMESTAMP))){
+                free(image);
+                return NULL;
+        }
 
-        self->photons = malloc(n * sizeof(*self->photons));
-        self->contributions = malloc(n * sizeof(*self->contributions));
+        QCUSTOM_PIXELS_LOOP(LUT_EMIT, image, (&job), 0, job.n_indexes);
+        free(image);
+
+        self = g_new0(HklBinocularsQCustomLut, 1);
+        self->plan = plan;
+        memcpy(self->m_holder_d, job.m_holder_d.raw, sizeof(self->m_holder_d));
+        memcpy(self->m_holder_s, job.m_holder_s.raw, sizeof(self->m_holder_s));
+        memcpy(self->ki, job.ki.raw, sizeof(self->ki));
+        self->timestamp_axis = qcustom_timestamp_axis(plan->subprojection);
+        self->n_items = darray_size(items);
+
+        /* the sub-pixels of a pixel in the same bin are one entry */
+        qsort(items.item, darray_size(items), sizeof(*items.item), lut_item_cmp);
+
+        self->rows = malloc((darray_size(items) + 1) * sizeof(*self->rows));
+        self->bins = malloc(3 * darray_size(items) * sizeof(*self->bins));
+        self->contributions = malloc(darray_size(items) * sizeof(*self->contributions));
+        self->darks = malloc(darray_size(items) * sizeof(*self->darks));
+        self->darks2 = malloc(darray_size(items) * sizeof(*self->darks2));
+        self->pixels = malloc(darray_size(items) * sizeof(*self->pixels));
+        self->gains = malloc(darray_size(items) * sizeof(*self->gains));
+        self->gains2 = malloc(darray_size(items) * sizeof(*self->gains2));
+
+        for(i=0, e=0, r=0; i<darray_size(items); ++i){
+                const HklBinocularsQCustomLutItem *item = &darray_item(items, i);
+                double d = NULL == dark ? 0 : dark[item->pixel];
+
+                if(0 == i || !lut_item_same_bin(item, item - 1)){
+                        self->rows[r] = e;
+                        memcpy(&self->bins[3 * r], item->indexes, sizeof(item->indexes));
+                        self->contributions[r] = 0;
+                        self->darks[r] = 0;
+                        self->darks2[r] = 0;
+                        r++;
+                }
+                if(0 == i || !lut_item_same_bin(item, item - 1) || item->pixel != (item - 1)->pixel){
+                        self->pixels[e] = item->pixel;
+                        self->gains[e] = 0;
+                        self->gains2[e] = 0;
+                        e++;
+                }
+                self->gains[e - 1] += item->gain;
+                self->gains2[e - 1] += item->gain * item->gain;
+                self->contributions[r - 1]++;
+                self->darks[r - 1] += item->gain * d;
+                self->darks2[r - 1] += item->gain * item->gain * d;
+        }
+        self->rows[r] = e;
+        self->n_rows = r;
 
-        return n;
+        darray_free(items);
+
+        return self;
 }
 
-static inline size_t calloc_cube(HklBinocularsCube *self)
+void hkl_binoculars_qcustom_lut_free(HklBinocularsQCustomLut *self)
 {
-        size_t n = cube_size(self);
-
-        self->photons = calloc(n, sizeof(*self->photons));
-        self->contributions = calloc(n, sizeof(*self->contributions));
+        free(self->gains2);
+        free(self->gains);
+        free(self->pixels);
+        free(self->darks2);
+        free(self->darks);
+        free(self->contributions);
+        free(self->bins);
+        free(self->rows);
+        g_free(self);
+}
 
-        return n;
+int hkl_binoculars_qcustom_lut_match(const HklBinocularsQCustomLut *self,
+                                     const HklGeometry *geometry)
+{
+        CGLM_ALIGN_MAT mat4s m_sample;
+        CGLM_ALIGN_MAT mat4s m_holder_d;
+        CGLM_ALIGN_MAT mat4s m_holder_s;
+        CGLM_ALIGN_MAT vec3s ki;
+        float k;
+
+        memcpy(m_sample.raw, self->plan->m_sample, sizeof(self->plan->m_sample));
+        qcustom_transformations_get(geometry, &m_sample, &m_holder_d, &m_holder_s, &ki, &k);
+
+        return 0 == memcmp(self->m_holder_d, m_holder_d.raw, sizeof(self->m_holder_d))
+                && 0 == memcmp(self->m_holder_s, m_holder_s.raw, sizeof(self->m_holder_s))
+                && 0 == memcmp(self->ki, ki.raw, sizeof(self->ki));
 }
 
-/* Using this method the Cube has already the right dimensions, we
- * just add the Space data into it. */
-static inline void add_non_empty_space(HklBinocularsCube *cube,
-                                       const HklBinocularsSpace *space)
+/* add the sums of a lut row into its bin */
+static inline void cube_add_row(HklBinocularsCube *cube, ptrdiff_t w,
+                                double intensity, double variance,
+                                uint32_t contributions)
 {
-        size_t i;
-        size_t n_axes = darray_size(cube->axes);
-        ptrdiff_t lens[n_axes];
-        HklBinocularsSpaceItem *item;
+        GMutex *lock = NULL == cube->stripes ? NULL : &cube->stripes->locks[cube_stripe(w)];
+
+        if(NULL != lock)
+                g_mutex_lock(lock);
+        cube_bin_add(cube, w, rint(intensity), contributions);
+        if(cube->weighted){
+                cube->intensities[w] += intensity;
+                cube->variances[w] += variance;
+        }
+        if(NULL != lock)
+                g_mutex_unlock(lock);
+}
 
-        assert(n_axes == darray_size(space->axes));
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(image_t)        \
+        HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(image_t)        \
+        {                                                               \
+                size_t r;                                               \
+                size_t n_outside = 0;                                   \
+                const HklBinocularsQCustomPlan *plan = lut->plan;       \
+                const size_t *restrict rows = lut->rows;                \
+                const uint32_t *restrict pixels = lut->pixels;          \
+                const float *restrict gains = lut->gains;               \
+                const float *restrict gains2 = lut->gains2;             \
+                ptrdiff_t t = 0;                                        \
+                                                                        \
+                if (cube_is_empty(cube))                                \
+                        return lut->n_items;                            \
+                                                                        \
+                ptrdiff_t lens[darray_size(cube->axes)];                \
+                                                                        \
+                cube_lens(cube, lens);                                  \
+                if(lut->timestamp_axis >= 0)                            \
+                        t = rint(timestamp / plan->resolutions[lut->timestamp_axis]); \
+                                                                        \
+                for(r=0; r<lut->n_rows; ++r){                           \
+                        size_t e;                                       \
+                        ptrdiff_t w;                                    \
+                        double sum = 0;                                 \
+                        double sum2 = 0;                                \
+                        HklBinocularsSpaceItem item;                    \
+                                                                        \
+                        memcpy(item.indexes_0, &lut->bins[3 * r], sizeof(item.indexes_0)); \
+                        if(lut->timestamp_axis >= 0)                    \
+                                item.indexes_0[lut->timestamp_axis] = t; \
+                        if(FALSE == item_in_the_limits(&item, plan->limits, plan->n_limits)) \
+                                continue;                               \
+                        if(FALSE == cube_item_w(cube, lens, &item, &w)){ \
+                                n_outside += lut->contributions[r];     \
+                                continue;                               \
+                        }                                               \
+                                                                        \
+                        for(e=rows[r]; e<rows[r + 1]; ++e){             \
+                                double v = image[pixels[e]];            \
+                                                                        \
+                                sum += gains[e] * v;                    \
+                                sum2 += gains2[e] * v;                  \
+                        }                                               \
+                                                                        \
+                        cube_add_row(cube, w,                           \
+                                     weight * (sum - lut->darks[r]),    \
+                                     weight * weight * (sum2 - lut->darks2[r]), \
+                                     lut->contributions[r]);            \
+                }                                                       \
+                                                                        \
+                return n_outside;                                       \
+        }
 
-        /* compute the lens */
-        lens[0] = 1;
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(int32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(uint16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(uint32_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(uint8_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(int16_t);
+HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_IMPL(float);
 
-        for(i=1; i<n_axes; ++i){
-                lens[i] = lens[i - 1] * axis_size(&darray_item(cube->axes, n_axes - i));
-        }
+/* Bounds */
 
-        darray_foreach(item, space->items){
-                ptrdiff_t w = -cube->offset0;
+/* The bounds of the cube are estimated from a grid of pixels, the
+ * borders of the detector included, instead of projecting all the
+ * pixels of the frames. Between two neighbour nodes of the grid the
+ * bins move at most by the difference of their bins (the projection
+ * is smooth at the scale of the grid), so the bounds are widened by
+ * the largest difference between neighbours. */
 
-                for(i=0; i<n_axes; ++i){
-                        w += lens[i] * item->indexes_0[n_axes - 1 - i];
-                        /* fprintf(stdout, " %ld %ld", lens[i], item->indexes_0[n_axes - 1 - i]); */
-                }
+/* the maximum number of nodes along each direction of the detector */
+#define HKL_BINOCULARS_BOUNDS_SAMPLES 64
 
-                /* fprintf(stdout, " w: %ld %ld\n", w, cube_size(cube)); */
-                cube->photons[w] += item->intensity;
-                cube->contributions[w] += 1;
-        }
-}
+struct _HklBinocularsBounds
+{
+        const HklBinocularsQCustomPlan *plan;
+        size_t nx; /* the nodes of the grid */
+        size_t ny;
+        double *coordinates; /* of the nodes */
+        uint32_t *indexes; /* the not masked nodes */
+        size_t n_indexes;
+        uint8_t *image; /* a dummy image of the nodes */
+        HklBinocularsSpaceItem *items; /* of the last frame */
+        uint8_t *emitted; /* the nodes of the last frame in the limits */
+        int empty;
+        ptrdiff_t imin[3];
+        ptrdiff_t imax[3];
+};
 
-static inline int cube_is_empty(const HklBinocularsCube *self)
+static inline size_t bounds_node(size_t k, size_t n_nodes, size_t n)
 {
-        return 0 == darray_size(self->axes);
+        return 1 == n_nodes ? 0 : k * (n - 1) / (n_nodes - 1);
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new_empty(void)
+HklBinocularsBounds *hkl_binoculars_bounds_new_qcustom(const HklBinocularsQCustomPlan *plan)
 {
-        HklBinocularsCube *self = g_new(HklBinocularsCube, 1);
+        size_t i, a, b;
+        size_t n_nodes;
+        uint8_t *not_masked;
+        HklBinocularsBounds *self = g_new0(HklBinocularsBounds, 1);
+
+        self->plan = plan;
+        self->nx = min(plan->width, HKL_BINOCULARS_BOUNDS_SAMPLES);
+        self->ny = min(plan->height, HKL_BINOCULARS_BOUNDS_SAMPLES);
+        self->empty = TRUE;
+        n_nodes = self->nx * self->ny;
+
+        /* the pixels which are not masked */
+        not_masked = g_new0(uint8_t, plan->n_pixels);
+        for(i=0; i<plan->n_indexes; ++i)
+                not_masked[plan->indexes[i] / plan->n_subpixels] = TRUE;
+
+        self->coordinates = g_new(double, 3 * n_nodes);
+        self->indexes = g_new(uint32_t, n_nodes);
+        for(b=0; b<self->ny; ++b)
+                for(a=0; a<self->nx; ++a){
+                        size_t node = b * self->nx + a;
+                        size_t pixel = bounds_node(b, self->ny, plan->height) * plan->width
+                                + bounds_node(a, self->nx, plan->width);
+
+                        for(i=0; i<3; ++i)
+                                self->coordinates[i * n_nodes + node] = plan->pixels[i * plan->n_pixels + pixel];
+                        if(not_masked[pixel])
+                                self->indexes[self->n_indexes++] = node;
+                }
+        g_free(not_masked);
 
-        darray_init(self->axes);
-        self->offset0 = 0;
-        self->photons = NULL;
-        self->contributions = NULL;
+        self->image = g_new0(uint8_t, n_nodes);
+        self->items = g_new(HklBinocularsSpaceItem, n_nodes);
+        self->emitted = g_new(uint8_t, n_nodes);
 
         return self;
 }
 
-void hkl_binoculars_cube_free(HklBinocularsCube *self)
+void hkl_binoculars_bounds_free(HklBinocularsBounds *self)
 {
-        free(self->contributions);
-        free(self->photons);
-        darray_free(self->axes);
-        free(self);
+        g_free(self->emitted);
+        g_free(self->items);
+        g_free(self->image);
+        g_free(self->indexes);
+        g_free(self->coordinates);
+        g_free(self);
 }
 
-unsigned int hkl_binoculars_cube_cmp(const HklBinocularsCube *self, const HklBinocularsCube *other)
+/* the items of the nodes are kept in order to compare the neighbours */
+#define BOUNDS_EMIT(item) do {                                          \
+                self->items[i] = (item);                                \
+                self->emitted[i] = TRUE;                                \
+        } while(0)
+
+static inline void bounds_widen(ptrdiff_t *margin, const HklBinocularsSpaceItem *items,
+                                size_t n_axes, size_t node1, size_t node2)
 {
-        int i;
-        unsigned int res = 0;
+        size_t k;
 
-        res |= darray_size(self->axes) != darray_size(other->axes);
-        res |= self->offset0 != other->offset0;
-        for(i=0; i<darray_size(self->axes); ++i){
-                res |= hkl_binoculars_axis_cmp(&darray_item(self->axes, i),
-                                               &darray_item(other->axes, i));
+        for(k=0; k<n_axes; ++k){
+                ptrdiff_t d = items[node1].indexes_0[k] - items[node2].indexes_0[k];
+
+                margin[k] = max(margin[k], d < 0 ? -d : d);
         }
+}
 
-        /* for(i=0; i<cube_size(self); ++i){ */
-        /*         res |= self->photons[i] != other->photons[i]; */
-        /*         res |= self->contributions[i] != other->contributions[i]; */
-        /*         if(res){ */
-        /*                 fprintf(stdout, "\nphotons: %d %u %u ", i, self->photons[i], other->photons[i]); */
-        /*                 fprintf(stdout, "\ncontributions: %d %u %u", i, self->contributions[i], other->contributions[i]); */
-        /*                 break; */
-        /*         } */
-        /* } */
+void hkl_binoculars_bounds_add_qcustom(HklBinocularsBounds *self,
+                                       const HklGeometry *geometry,
+                                       double timestamp)
+{
+        size_t a, b, k;
+        size_t n_nodes = self->nx * self->ny;
+        const HklBinocularsQCustomPlan *plan = self->plan;
+        size_t n_axes = min(plan->n_resolutions, ARRAY_SIZE(self->imin));
+        ptrdiff_t margin[3] = {0};
+        const uint8_t *image = self->image;
+        CGLM_ALIGN_MAT mat4s m_sample;
+        HklBinocularsFrameJob job = {
+                .image = image,
+                .n_pixels = n_nodes,
+                .weight = 1.0,
+                .pixels_coordinates = self->coordinates,
+                .resolutions = plan->resolutions,
+                .indexes = self->indexes,
+                .n_indexes = self->n_indexes,
+                .limits = plan->limits,
+                .n_limits = plan->n_limits,
+                .timestamp = timestamp,
+                .subprojection = plan->subprojection,
+                .expressions = plan->expressions,
+                .n_expressions = plan->n_expressions,
+                .do_polarisation_correction = FALSE,
+                .fast = g_atomic_int_get(&fast_trigonometry),
+                .corrections = NULL,
+                .width = self->nx,
+                .height = self->ny,
+                .n_subpixels = 1,
+        };
+
+        memcpy(m_sample.raw, plan->m_sample, sizeof(plan->m_sample));
+        memset(self->emitted, 0, n_nodes * sizeof(*self->emitted));
+
+        if(FALSE == qcustom_job_init(&job, geometry, &m_sample, plan->sample_axis, plan->sample_axis_idx))
+                return;
 
-        if(res){
-                fprintf(stdout, "cube: self\n");
-                hkl_binoculars_cube_fprintf(stdout, self);
-                fprintf(stdout, "cube: other\n");
-                hkl_binoculars_cube_fprintf(stdout, other);
+        QCUSTOM_PIXELS_LOOP(BOUNDS_EMIT, image, (&job), 0, job.n_indexes);
+
+        /* the largest bins difference between neighbour nodes */
+        for(b=0; b<self->ny; ++b)
+                for(a=0; a<self->nx; ++a){
+                        size_t node = b * self->nx + a;
+
+                        if(!self->emitted[node])
+                                continue;
+                        if(a + 1 < self->nx && self->emitted[node + 1])
+                                bounds_widen(margin, self->items, n_axes, node, node + 1);
+                        if(b + 1 < self->ny && self->emitted[node + self->nx])
+                                bounds_widen(margin, self->items, n_axes, node, node + self->nx);
+                }
+
+        for(a=0; a<n_nodes; ++a){
+                if(!self->emitted[a])
+                        continue;
+                for(k=0; k<n_axes; ++k){
+                        ptrdiff_t v = self->items[a].indexes_0[k];
+
+                        if(self->empty){
+                                self->imin[k] = v - margin[k];
+                                self->imax[k] = v + margin[k];
+                        }else{
+                                self->imin[k] = min(self->imin[k], v - margin[k]);
+                                self->imax[k] = max(self->imax[k], v + margin[k]);
+                        }
+                }
+                self->empty = FALSE;
         }
 
-        return res;
+        /* the widened bounds stay in the limits */
+        for(k=0; k<n_axes && k<plan->n_limits; ++k){
+                match(plan->limits[k]->imin){
+                        of(NoLimit){
+                        }
+                        of(Limit, imin){
+                                self->imin[k] = max(self->imin[k], *imin);
+                                break;
+                        }
+                }
+                match(plan->limits[k]->imax){
+                        of(NoLimit){
+                        }
+                        of(Limit, imax){
+                                self->imax[k] = min(self->imax[k], *imax);
+                                break;
+                        }
+                }
+        }
 }
 
-void hkl_binoculars_cube_fprintf(FILE *f, const HklBinocularsCube *self)
+HklBinocularsCube *hkl_binoculars_cube_new_from_bounds(const HklBinocularsBounds *self)
 {
-        HklBinocularsAxis *axis;
+        size_t k;
+        size_t n_axes = min(self->plan->n_resolutions, ARRAY_SIZE(self->imin));
+        darray_axis axes;
+        HklBinocularsCube *cube;
+
+        if(self->empty)
+                return hkl_binoculars_cube_new_empty();
+
+        darray_init(axes);
+        darray_resize(axes, n_axes);
+        for(k=0; k<n_axes; ++k)
+                hkl_binoculars_axis_init(&darray_item(axes, k),
+                                         self->plan->names[k], k,
+                                         self->imin[k], self->imax[k],
+                                         self->plan->resolutions[k]);
+
+        /* only the axes are needed to size the final cubes */
+        cube = empty_cube_from_axes(&axes);
+        darray_free(axes);
+
+        return cube;
+}
 
-	fprintf(f, "HklBinocularsCube: %p", self);
+/* Footprint */
 
-        fprintf(f, "\nn_axes: %ld", darray_size(self->axes));
-        darray_foreach(axis, self->axes){
-                fprintf(f, "\n");
-                hkl_binoculars_axis_fprintf(f, axis);
-        }
-        fprintf(f, "\nphotons: %p", self->photons);
-        fprintf(f, "\ncontributions: %p", self->contributions);
-}
+/* The footprint of the pixels is measured on a grid of samples of the
+ * detector, each one is a pixel and its two neighbours along the rows
+ * and the columns. The samples are projected with a tiny resolution,
+ * so the indexes of the items are the coordinates of the projected
+ * pixels on each axis. */
 
-void hkl_binoculars_cube_dims(const HklBinocularsCube *self, size_t ndims, size_t *dims)
-{
-        HklBinocularsAxis *axis;
+/* the maximum number of samples along each direction of the detector */
+#define HKL_BINOCULARS_FOOTPRINT_SAMPLES 32
 
-        assert(ndims == darray_size(self->axes));
+#define HKL_BINOCULARS_FOOTPRINT_RESOLUTION 1e-7
 
-        darray_foreach(axis, self->axes){
-                *(dims++) = axis_size(axis);
+/* the suggested resolution is larger than the footprint of this
+ * fraction of the pixels */
+#define HKL_BINOCULARS_FOOTPRINT_QUANTILE 0.9
+
+typedef darray(double) darray_double;
+
+struct _HklBinocularsFootprint
+{
+        const HklBinocularsQCustomPlan *plan;
+        size_t n_samples;
+        double *coordinates; /* of the 3 pixels of each sample */
+        uint32_t *indexes; /* the pixels of the not masked samples */
+        size_t n_indexes;
+        uint8_t *image; /* a dummy image of the pixels */
+        double resolutions[3];
+        HklBinocularsSpaceItem *items; /* of the last frame */
+        uint8_t *emitted;
+        darray_double footprints[3]; /* of all the samples of all the frames */
+        int empty;
+        double vmin[3];
+        double vmax[3];
+};
+
+HklBinocularsFootprint *hkl_binoculars_footprint_new_qcustom(const HklBinocularsQCustomPlan *plan)
+{
+        size_t i, j, a, b;
+        size_t nx = min(plan->width - 1, HKL_BINOCULARS_FOOTPRINT_SAMPLES);
+        size_t ny = min(plan->height - 1, HKL_BINOCULARS_FOOTPRINT_SAMPLES);
+        size_t n_pixels;
+        uint8_t *not_masked;
+        HklBinocularsFootprint *self = g_new0(HklBinocularsFootprint, 1);
+
+        self->plan = plan;
+        self->n_samples = plan->width > 1 && plan->height > 1 ? nx * ny : 0;
+        self->empty = TRUE;
+        for(i=0; i<ARRAY_SIZE(self->resolutions); ++i){
+                self->resolutions[i] = HKL_BINOCULARS_FOOTPRINT_RESOLUTION;
+                darray_init(self->footprints[i]);
         }
+        n_pixels = 3 * self->n_samples;
+
+        /* the pixels which are not masked */
+        not_masked = g_new0(uint8_t, plan->n_pixels);
+        for(i=0; i<plan->n_indexes; ++i)
+                not_masked[plan->indexes[i] / plan->n_subpixels] = TRUE;
+
+        self->coordinates = g_new(double, 3 * n_pixels);
+        self->indexes = g_new(uint32_t, n_pixels);
+        for(b=0; b<ny && self->n_samples; ++b)
+                for(a=0; a<nx; ++a){
+                        size_t sample = b * nx + a;
+                        size_t pixel = bounds_node(b, ny, plan->height - 1) * plan->width
+                                + bounds_node(a, nx, plan->width - 1);
+                        size_t pixels[3] = {pixel, pixel + 1, pixel + plan->width};
+
+                        for(j=0; j<3; ++j)
+                                for(i=0; i<3; ++i)
+                                        self->coordinates[i * n_pixels + 3 * sample + j] = plan->pixels[i * plan->n_pixels + pixels[j]];
+                        if(not_masked[pixels[0]] && not_masked[pixels[1]] && not_masked[pixels[2]])
+                                for(j=0; j<3; ++j)
+                                        self->indexes[self->n_indexes++] = 3 * sample + j;
+                }
+        g_free(not_masked);
+
+        self->image = g_new0(uint8_t, n_pixels);
+        self->items = g_new(HklBinocularsSpaceItem, n_pixels);
+        self->emitted = g_new(uint8_t, n_pixels);
+
+        return self;
 }
 
-static inline size_t find_first_non_empty_space_index(size_t n_spaces,
-                                                      const HklBinocularsSpace *const *spaces)
+void hkl_binoculars_footprint_free(HklBinocularsFootprint *self)
 {
         size_t i;
 
-        for(i=0; i<n_spaces; ++i)
-                if(!space_is_empty(spaces[i]))
-                        return i;
-
-        return n_spaces;
+        for(i=0; i<ARRAY_SIZE(self->footprints); ++i)
+                darray_free(self->footprints[i]);
+        g_free(self->emitted);
+        g_free(self->items);
+        g_free(self->image);
+        g_free(self->indexes);
+        g_free(self->coordinates);
+        g_free(self);
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new(size_t n_spaces,
-                                           const HklBinocularsSpace *const *spaces)
+void hkl_binoculars_footprint_add_qcustom(HklBinocularsFootprint *self,
+                                          const HklGeometry *geometry,
+                                          double timestamp)
 {
-        size_t i, i0;
-        HklBinocularsCube *self = NULL;
+        size_t i, j, k;
+        size_t n_pixels = 3 * self->n_samples;
+        const HklBinocularsQCustomPlan *plan = self->plan;
+        size_t n_axes = min(plan->n_resolutions, ARRAY_SIZE(self->resolutions));
+        const uint8_t *image = self->image;
+        CGLM_ALIGN_MAT mat4s m_sample;
+        HklBinocularsFrameJob job = {
+                .image = image,
+                .n_pixels = n_pixels,
+                .weight = 1.0,
+                .pixels_coordinates = self->coordinates,
+                .resolutions = self->resolutions,
+                .indexes = self->indexes,
+                .n_indexes = self->n_indexes,
+                .limits = NULL,
+                .n_limits = 0,
+                .timestamp = timestamp,
+                .subprojection = plan->subprojection,
+                .expressions = plan->expressions,
+                .n_expressions = plan->n_expressions,
+                .do_polarisation_correction = FALSE,
+                .fast = g_atomic_int_get(&fast_trigonometry),
+                .corrections = NULL,
+                .width = 3,
+                .height = self->n_samples,
+                .n_subpixels = 1,
+        };
+
+        memcpy(m_sample.raw, plan->m_sample, sizeof(plan->m_sample));
+        memset(self->emitted, 0, n_pixels * sizeof(*self->emitted));
+
+        if(FALSE == qcustom_job_init(&job, geometry, &m_sample, plan->sample_axis, plan->sample_axis_idx))
+                return;
 
-        i0 = find_first_non_empty_space_index(n_spaces, spaces);
+        QCUSTOM_PIXELS_LOOP(BOUNDS_EMIT, image, (&job), 0, job.n_indexes);
 
-        if(i0 < n_spaces){
-                self = empty_cube_from_axes(&spaces[i0]->axes);
+        for(i=0; i<self->n_samples; ++i){
+                const HklBinocularsSpaceItem *items = &self->items[3 * i];
 
-                if(NULL != self){
-                        /* compute the final cube dimensions and the index offset */
-                        for(i=i0; i<n_spaces; ++i){
-                                const HklBinocularsSpace *space = spaces[i];
+                if(!self->emitted[3 * i] || !self->emitted[3 * i + 1] || !self->emitted[3 * i + 2])
+                        continue;
 
-                                if(space_is_empty(space))
-                                        continue;
+                for(k=0; k<n_axes; ++k){
+                        ptrdiff_t dx = items[1].indexes_0[k] - items[0].indexes_0[k];
+                        ptrdiff_t dy = items[2].indexes_0[k] - items[0].indexes_0[k];
+                        ptrdiff_t d = max(dx < 0 ? -dx : dx, dy < 0 ? -dy : dy);
 
-                                merge_axes(&self->axes, &space->axes);
+                        darray_append(self->footprints[k], d * HKL_BINOCULARS_FOOTPRINT_RESOLUTION);
+                        for(j=0; j<3; ++j){
+                                double v = items[j].indexes_0[k] * HKL_BINOCULARS_FOOTPRINT_RESOLUTION;
+
+                                if(self->empty && 0 == j){
+                                        self->vmin[k] = self->vmax[k] = v;
+                                }else{
+                                        self->vmin[k] = MIN(self->vmin[k], v);
+                                        self->vmax[k] = MAX(self->vmax[k], v);
+                                }
                         }
-                        self->offset0 = compute_offset0(&self->axes);
+                }
+                self->empty = FALSE;
+        }
+}
 
-                        /* allocated the final cube photons and contributions */
-                        calloc_cube(self);
+static int cmp_double(const void *a, const void *b)
+{
+        double da = *(const double *)a;
+        double db = *(const double *)b;
 
-                        /* add all the spaces */
-                        for(i=i0; i<n_spaces; ++i){
-                                const HklBinocularsSpace *space = spaces[i];
+        return (da > db) - (da < db);
+}
 
-                                if(space_is_empty(space))
-                                        continue;
+/* round up to 1, 2 or 5 times a power of ten */
+static inline double footprint_round(double x)
+{
+        double p = pow(10, floor(log10(x)));
+        double m = x / p;
 
-                                add_non_empty_space(self, space);
-                        }
+        return (m <= 1 ? 1 : m <= 2 ? 2 : m <= 5 ? 5 : 10) * p;
+}
+
+int hkl_binoculars_footprint_suggest(const HklBinocularsFootprint *self,
+                                     double *resolutions, size_t n_resolutions,
+                                     uint64_t *n_bins, uint64_t *n_bytes)
+{
+        size_t k;
+        size_t n_axes = min(self->plan->n_resolutions, ARRAY_SIZE(self->resolutions));
+
+        *n_bins = 0;
+        *n_bytes = 0;
+        if(self->empty)
+                return FALSE;
+
+        *n_bins = 1;
+        for(k=0; k<n_resolutions; ++k){
+                double resolution = k < self->plan->n_resolutions ? self->plan->resolutions[k] : 0;
+
+                if(k < n_axes){
+                        size_t n = darray_size(self->footprints[k]);
+                        double *sorted = g_new(double, n);
+                        double footprint;
+
+                        memcpy(sorted, &darray_item(self->footprints[k], 0), n * sizeof(double));
+                        qsort(sorted, n, sizeof(*sorted), cmp_double);
+                        footprint = sorted[(size_t)(HKL_BINOCULARS_FOOTPRINT_QUANTILE * (n - 1))];
+                        g_free(sorted);
+
+                        /* the axes which do not move with the pixels
+                         * (timestamp, sample axis) keep their
+                         * resolution */
+                        if(footprint > 0)
+                                resolution = footprint_round(footprint);
+                        if(resolution > 0)
+                                *n_bins *= (uint64_t)floor((self->vmax[k] - self->vmin[k]) / resolution) + 2;
                 }
+                resolutions[k] = resolution;
         }
 
-	return self;
+        *n_bytes = *n_bins * (sizeof(uint32_t) + sizeof(uint32_t)
+                              + (g_atomic_int_get(&cube_weighted) ? 2 * sizeof(double) : 0));
+
+        return TRUE;
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new_empty_from_cube(const HklBinocularsCube *cube)
+/* Sparse Cube */
+
+/* the pending bins are sorted and merged when they are more
+ * numerous than this or twice the sorted bins, so the sort cost is
+ * amortized. */
+#define HKL_BINOCULARS_SPARSE_CUBE_PENDING_MIN (1 << 16)
+
+static int sparse_bin_cmp(const void *a, const void *b)
 {
-	HklBinocularsCube *self = empty_cube_from_axes(&cube->axes);
-        if(NULL != self)
-                calloc_cube(self);
-        else{
-                self = hkl_binoculars_cube_new_empty();
-        }
+        size_t i;
+        const HklBinocularsSparseBin *bin_a = a;
+        const HklBinocularsSparseBin *bin_b = b;
 
+        for(i=0; i<ARRAY_SIZE(bin_a->indexes); ++i){
+                if (bin_a->indexes[i] < bin_b->indexes[i]) return -1;
+                if (bin_a->indexes[i] > bin_b->indexes[i]) return 1;
+        }
 
-	return self;
+        return 0;
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new_from_space(const HklBinocularsSpace *space)
+static inline void sparse_bins_append(darray_HklBinocularsSparseBin *bins,
+                                      const HklBinocularsSparseBin *bin)
 {
-	HklBinocularsCube *self = NULL;
+        if (0 != darray_size(*bins)){
+                HklBinocularsSparseBin *last = &darray_item(*bins, darray_size(*bins) - 1);
 
-        if(space_is_empty(space)){
-                self =  hkl_binoculars_cube_new_empty();
-        } else {
-                self = empty_cube_from_axes(&space->axes);
-                if(NULL != self){
-                        calloc_cube(self);
-
-                        add_non_empty_space(self, space);
+                if (0 == sparse_bin_cmp(last, bin)){
+                        last->photons += bin->photons;
+                        last->contributions += bin->contributions;
+                        return;
                 }
         }
-
-        return self;
+        darray_append(*bins, *bin);
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new_copy(const HklBinocularsCube *src)
+HklBinocularsSparseCube *hkl_binoculars_sparse_cube_new_empty(void)
 {
-        size_t n;
-	HklBinocularsCube *self = empty_cube_from_axes(&src->axes);
-
-        if(NULL != self){
-                /* allocate the final cube */
-                n = malloc_cube(self);
+        HklBinocularsSparseCube *self = g_new(HklBinocularsSparseCube, 1);
 
-                /* copy the data */
-                if(self->photons)
-                        memcpy(self->photons, src->photons, n * sizeof(*self->photons));
-                if(self->contributions)
-                        memcpy(self->contributions, src->contributions, n * sizeof(*self->contributions));
-        }
+        darray_init(self->axes);
+        darray_init(self->bins);
+        darray_init(self->pending);
 
         return self;
 }
 
-static inline void cube_add_cube_2(HklBinocularsCube *self,
-                                   const HklBinocularsCube *other)
+HklBinocularsSparseCube *hkl_binoculars_sparse_cube_new_from_cube(const HklBinocularsCube *cube)
 {
-        size_t i, j;
-        size_t i_offset, j_offset;
+        HklBinocularsAxis *axis;
+        HklBinocularsSparseCube *self = hkl_binoculars_sparse_cube_new_empty();
 
-        size_t stride_i = 1;
-        size_t stride_j = stride_i * axis_size(&darray_item(self->axes, 1));
+        if(cube_is_empty(cube))
+                return self;
 
-        /* fill the values of other */
-        size_t stride_i_other = 1;
-        size_t stride_j_other = stride_i_other * axis_size(&darray_item(other->axes, 1));
+        hkl_binoculars_cube_planar(cube);
 
-        i_offset = darray_item(other->axes, 1).imin - darray_item(self->axes, 1).imin;
-        j_offset = darray_item(other->axes, 0).imin - darray_item(self->axes, 0).imin;
+        size_t n_axes = darray_size(cube->axes);
+        ptrdiff_t lens[n_axes];
+        ptrdiff_t indexes[n_axes];
 
-        for(j=0; j<axis_size(&darray_item(other->axes, 0)); ++j){
-                for(i=0; i<axis_size(&darray_item(other->axes, 1)); ++i){
-                        size_t w = (i + i_offset) * stride_i + (j + j_offset) * stride_j;
-                        size_t w1 = i * stride_i_other + j * stride_j_other;
+        darray_foreach(axis, cube->axes){
+                darray_append(self->axes, *axis);
+        }
 
-                        self->photons[w] += other->photons[w1];
-                        self->contributions[w] += other->contributions[w1];
+        /* the odometer order is the sorted order of the bins */
+        cube_lens(cube, lens);
+        axes_first_bin(&cube->axes, indexes);
+        do{
+                ptrdiff_t w = cube_bin_index(cube, lens, indexes);
+
+                if(0 != cube->contributions[w]){
+                        size_t i;
+                        HklBinocularsSparseBin bin = {{0}};
+
+                        for(i=0; i<n_axes; ++i)
+                                bin.indexes[i] = indexes[i];
+                        bin.photons = cube->photons[w];
+                        bin.contributions = cube->contributions[w];
+
+                        darray_append(self->bins, bin);
                 }
-        }
+        }while(axes_next_bin(&cube->axes, indexes));
+
+        return self;
 }
 
-static inline void cube_add_cube_3(HklBinocularsCube *self,
-                                   const HklBinocularsCube *other)
+void hkl_binoculars_sparse_cube_free(HklBinocularsSparseCube *self)
 {
-        size_t i, j, k;
-        size_t i_offset, j_offset, k_offset;
+        darray_free(self->pending);
+        darray_free(self->bins);
+        darray_free(self->axes);
+        free(self);
+}
 
-        size_t stride_i = 1;
-        size_t stride_j = stride_i * axis_size(&darray_item(self->axes, 2));
-        size_t stride_k = stride_j * axis_size(&darray_item(self->axes, 1));
+void hkl_binoculars_sparse_cube_compact(HklBinocularsSparseCube *self)
+{
+        size_t i = 0;
+        size_t j = 0;
+        darray_HklBinocularsSparseBin bins = darray_new();
 
-        /* fill the values of other */
-        size_t stride_i_other = 1;
-        size_t stride_j_other = stride_i_other * axis_size(&darray_item(other->axes, 2));
-        size_t stride_k_other = stride_j_other * axis_size(&darray_item(other->axes, 1));
+        if (0 == darray_size(self->pending))
+                return;
 
-        i_offset = darray_item(other->axes, 2).imin - darray_item(self->axes, 2).imin;
-        j_offset = darray_item(other->axes, 1).imin - darray_item(self->axes, 1).imin;
-        k_offset = darray_item(other->axes, 0).imin - darray_item(self->axes, 0).imin;
+        qsort(&darray_item(self->pending, 0), darray_size(self->pending),
+              sizeof(HklBinocularsSparseBin), sparse_bin_cmp);
+
+        /* merge the two sorted arrays */
+        darray_growalloc(bins, darray_size(self->bins) + darray_size(self->pending));
+        while(i < darray_size(self->bins) || j < darray_size(self->pending)){
+                const HklBinocularsSparseBin *bin;
+
+                if (j == darray_size(self->pending))
+                        bin = &darray_item(self->bins, i++);
+                else if (i == darray_size(self->bins))
+                        bin = &darray_item(self->pending, j++);
+                else if (sparse_bin_cmp(&darray_item(self->bins, i),
+                                        &darray_item(self->pending, j)) <= 0)
+                        bin = &darray_item(self->bins, i++);
+                else
+                        bin = &darray_item(self->pending, j++);
+
+                sparse_bins_append(&bins, bin);
+        }
 
-        for(k=0; k<axis_size(&darray_item(other->axes, 0)); ++k){
-                for(j=0; j<axis_size(&darray_item(other->axes, 1)); ++j){
-                        for(i=0; i<axis_size(&darray_item(other->axes, 2)); ++i){
-                                size_t w = (i + i_offset) * stride_i + (j + j_offset) * stride_j + (k + k_offset) * stride_k;
-                                size_t w1 = i * stride_i_other + j * stride_j_other + k * stride_k_other;
+        darray_free(self->bins);
+        self->bins = bins;
+        darray_size(self->pending) = 0;
+}
 
-                                self->photons[w] += other->photons[w1];
-                                self->contributions[w] += other->contributions[w1];
-                        }
+void hkl_binoculars_sparse_cube_add_space(HklBinocularsSparseCube *self,
+                                          const HklBinocularsSpace *space)
+{
+        HklBinocularsAxis *axis;
+        HklBinocularsSpacePackedItem *item;
+
+        if (space_is_empty(space))
+                return;
+
+        if (0 == darray_size(self->axes)){
+                darray_foreach(axis, space->axes){
+                        darray_append(self->axes, *axis);
                 }
+        } else {
+                assert(darray_size(self->axes) == darray_size(space->axes));
+                merge_axes(&self->axes, &space->axes);
         }
-}
 
-static inline void cube_add_cube(HklBinocularsCube *self,
-                                 const HklBinocularsCube *other)
-{
-        assert(darray_size(self->axes) == darray_size(other->axes));
+        darray_foreach(item, space->items){
+                size_t i;
+                HklBinocularsSparseBin bin = {{0}};
 
-        switch(darray_size(self->axes)){
-        case 2: cube_add_cube_2(self, other);
-                break;
-        case 3: cube_add_cube_3(self, other);
-                break;
-        default: assert(0);
+                for(i=0; i<darray_size(space->axes); ++i)
+                        bin.indexes[i] = space->origin[i] + item->indexes[i];
+                bin.photons = rint(item->intensity);
+                bin.contributions = space->n_frames;
+
+                darray_append(self->pending, bin);
         }
+
+        if (darray_size(self->pending) > max(HKL_BINOCULARS_SPARSE_CUBE_PENDING_MIN,
+                                             2 * darray_size(self->bins)))
+                hkl_binoculars_sparse_cube_compact(self);
 }
 
-static inline void compute_strides(const darray_axis *axes, size_t strides[], size_t n_strides)
+size_t hkl_binoculars_sparse_cube_n_bins(HklBinocularsSparseCube *self)
 {
-        size_t i;
+        hkl_binoculars_sparse_cube_compact(self);
 
-        strides[0] = 1;
-        for(i=1; i<n_strides; ++i)
-                strides[i] = strides[i-1] * axis_size(&darray_item(*axes, n_strides - i + 1));
+        return darray_size(self->bins);
 }
 
-HklBinocularsCube *hkl_binoculars_cube_new_merge(const HklBinocularsCube *cube1,
-                                                 const HklBinocularsCube *cube2)
+HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_cube(HklBinocularsSparseCube *sparse)
 {
-        HklBinocularsCube *self = empty_cube_from_axes(&cube1->axes);
-        if(NULL != self){
-                merge_axes(&self->axes, &cube2->axes);
-                calloc_cube(self);
+        HklBinocularsSparseBin *bin;
+	HklBinocularsCube *self = empty_cube_from_axes(&sparse->axes);
+
+        if(NULL == self)
+                return hkl_binoculars_cube_new_empty();
+
+        ptrdiff_t lens[darray_size(self->axes)];
+
+        /* the sparse bins keep only the photons */
+        self->weighted = FALSE;
+        hkl_binoculars_sparse_cube_compact(sparse);
 
-                cube_add_cube(self, cube1);
-                cube_add_cube(self, cube2);
+        calloc_cube(self);
+        cube_lens(self, lens);
+        darray_foreach(bin, sparse->bins){
+                ptrdiff_t w = cube_bin_index(self, lens, bin->indexes);
+
+                self->photons[w] = bin->photons;
+                self->contributions[w] = bin->contributions;
         }
+
         return self;
 }
 
-static inline void switch_content(HklBinocularsCube *self,
-                                  HklBinocularsCube *other)
+size_t hkl_binoculars_sparse_cube_dense_indexes(HklBinocularsSparseCube *self,
+                                                int64_t **indexes)
 {
-        unsigned int *ptr;
-        darray_axis tmp;
-        ptrdiff_t offset0;
+        size_t i, j;
+        size_t n = 0;
+        size_t n_axes = darray_size(self->axes);
+        size_t columns[ARRAY_SIZE(((HklBinocularsSparseBin *)NULL)->indexes)];
 
-        tmp = self->axes;
-        self->axes = other->axes;
-        other->axes = tmp;
+        hkl_binoculars_sparse_cube_compact(self);
 
-        offset0 = self->offset0;
-        self->offset0 = other->offset0;
-        other->offset0 = offset0;
+        /* like the dense dataspace, skip the axes of size 1 */
+        for(i=0; i<n_axes; ++i)
+                if(axis_size(&darray_item(self->axes, i)) > 1)
+                        columns[n++] = i;
 
-        ptr = self->photons;
-        self->photons = other->photons;
-        other->photons = ptr;
+        *indexes = malloc(darray_size(self->bins) * n * sizeof(**indexes));
+        for(i=0; i<darray_size(self->bins); ++i){
+                const HklBinocularsSparseBin *bin = &darray_item(self->bins, i);
 
-        ptr = self->contributions;
-        self->contributions = other->contributions;
-        other->contributions = ptr;
+                for(j=0; j<n; ++j)
+                        (*indexes)[i * n + j] = bin->indexes[columns[j]] - darray_item(self->axes, columns[j]).imin;
+        }
+
+        return n;
 }
 
-void hkl_binoculars_cube_add_space(HklBinocularsCube *self,
-                                   const HklBinocularsSpace *space)
+HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_arrays(const darray_axis *axes,
+                                                              size_t n_bins,
+                                                              size_t n_columns,
+                                                              const int64_t *indexes,
+                                                              const uint32_t *counts,
+                                                              const uint32_t *contributions)
 {
-#ifdef DEBUG
-        fprintf(stdout, "\nENTERING hkl_binoculars_cube_add_space:\n");
-        hkl_binoculars_cube_fprintf(stdout, self);
-        hkl_binoculars_space_fprintf(stdout, space);
-#endif
-        /* check the compatibility of the cube and the space. */
-        if (1 != space_is_empty(space)){
-                if (does_not_include(&self->axes, &space->axes)){
-#ifdef DEBUG
-                        fprintf(stdout, "\nthe Cube does not contain the space, so create a new cube.");
-#endif
-                        if(0 != darray_size(self->axes)){ /* self cube is not empty */
-                                HklBinocularsCube *cube = empty_cube_from_axes(&self->axes);
-                                if(NULL != cube){
-                                        merge_axes(&cube->axes, &space->axes); /* circonscript */
-                                        cube->offset0 = compute_offset0(&cube->axes);
-                                        calloc_cube(cube);
-                                        cube_add_cube(cube, self);
-                                        switch_content(self, cube);
-                                        hkl_binoculars_cube_free(cube);
-                                }
-                        } else { /* self cube is empty */
-                                HklBinocularsCube *cube =  empty_cube_from_axes(&space->axes);
-                                if(NULL != cube){
-                                        cube->offset0 = compute_offset0(&cube->axes);
-                                        calloc_cube(cube);
-                                        switch_content(self, cube);
-                                        hkl_binoculars_cube_free(cube);
+        size_t i, j;
+        size_t n = 0;
+        HklBinocularsAxis *axis;
+        HklBinocularsCube *self;
+
+        darray_foreach(axis, *axes){
+                if(axis_size(axis) > 1)
+                        n++;
+        }
+        if(n != n_columns)
+                return NULL;
+
+        self = hkl_binoculars_cube_new_from_axes_weighted(axes, FALSE);
+        for(i=0; i<n_bins; ++i){
+                const int64_t *index = &indexes[i * n_columns];
+                size_t w = 0;
+
+                /* the axes of size 1 have no column */
+                j = 0;
+                darray_foreach(axis, *axes){
+                        size_t len = axis_size(axis);
+
+                        if(len > 1){
+                                if(index[j] < 0 || (size_t)index[j] >= len){
+                                        hkl_binoculars_cube_free(self);
+                                        return NULL;
                                 }
+                                w = w * len + index[j++];
                         }
                 }
-                add_non_empty_space(self, space);
+                self->photons[w] = counts[i];
+                self->contributions[w] = contributions[i];
         }
 
-#ifdef DEBUG
-        fprintf(stdout, "\n");
-        hkl_binoculars_cube_fprintf(stdout, self);
-        fprintf(stdout, "\nLEAVING hkl_binoculars_cube_add_space:\n");
-#endif
+        return self;
+}
+
+/* stream the photons or the contributions of the bins in small
+ * chunks, so the arrays are never copied at once */
+static void sparse_bins_append(struct npy_writer_t *writer,
+                               const darray_HklBinocularsSparseBin *bins,
+                               int contributions)
+{
+        size_t i;
+        uint32_t chunk[1024];
+        size_t n = 0;
+
+        for(i=0; i<darray_size(*bins); ++i){
+                const HklBinocularsSparseBin *bin = &darray_item(*bins, i);
+
+                chunk[n++] = contributions ? bin->contributions : bin->photons;
+                if(ARRAY_SIZE(chunk) == n){
+                        npy_writer_append(writer, chunk, n);
+                        n = 0;
+                }
+        }
+        npy_writer_append(writer, chunk, n);
+        npy_writer_close(writer);
+}
+
+void hkl_binoculars_sparse_cube_save_npy(const char *prefix,
+                                         HklBinocularsSparseCube *self)
+{
+        size_t n_columns;
+        int64_t *indexes;
+        char *fname;
+        struct npy_writer_t *writer;
+        darray_int shape = darray_new();
+        size_t n_bins = hkl_binoculars_sparse_cube_n_bins(self);
+
+        n_columns = hkl_binoculars_sparse_cube_dense_indexes(self, &indexes);
+
+        darray_append(shape, n_bins);
+        darray_append(shape, n_columns);
+        fname = g_strdup_printf("%s_indexes.npy", prefix);
+        npy_save(fname, indexes, HklBinocularsNpyInt64(), &shape);
+        g_free(fname);
+
+        darray_size(shape) = 1;
+        fname = g_strdup_printf("%s_counts.npy", prefix);
+        writer = npy_writer_new(fname, HklBinocularsNpyUInt32(), &shape);
+        if(NULL != writer)
+                sparse_bins_append(writer, &self->bins, FALSE);
+        g_free(fname);
+
+        fname = g_strdup_printf("%s_contributions.npy", prefix);
+        writer = npy_writer_new(fname, HklBinocularsNpyUInt32(), &shape);
+        if(NULL != writer)
+                sparse_bins_append(writer, &self->bins, TRUE);
+        g_free(fname);
+
+        darray_free(shape);
+        free(indexes);
+}
+
+void hkl_binoculars_sparse_cube_save_npz(const char *fname,
+                                         HklBinocularsSparseCube *self,
+                                         int compress)
+{
+        size_t n_columns;
+        int64_t *indexes;
+        struct npz_t *npz;
+        struct npy_writer_t *writer;
+        darray_int shape = darray_new();
+        size_t n_bins = hkl_binoculars_sparse_cube_n_bins(self);
+
+        npz = npz_open(fname, compress);
+        if(NULL == npz)
+                goto out;
+
+        n_columns = hkl_binoculars_sparse_cube_dense_indexes(self, &indexes);
+
+        darray_append(shape, n_bins);
+        darray_append(shape, n_columns);
+        npz_save(npz, "indexes", indexes, HklBinocularsNpyInt64(), &shape);
+
+        darray_size(shape) = 1;
+        writer = npz_array_new(npz, "counts", HklBinocularsNpyUInt32(), &shape);
+        if(NULL != writer)
+                sparse_bins_append(writer, &self->bins, FALSE);
+
+        writer = npz_array_new(npz, "contributions", HklBinocularsNpyUInt32(), &shape);
+        if(NULL != writer)
+                sparse_bins_append(writer, &self->bins, TRUE);
+
+        npz_close(npz);
+        free(indexes);
+out:
+        darray_free(shape);
 }
@@ -41,6 +41,8 @@ typedef enum _HklBinocularsDetectorEnum
         HKL_BINOCULARS_DETECTOR_MERLIN,
         HKL_BINOCULARS_DETECTOR_MERLIN_MEDIPIX_3RX_QUAD,
         HKL_BINOCULARS_DETECTOR_MERLIN_MEDIPIX_3RX_QUAD_512,
+        HKL_BINOCULARS_DETECTOR_MYTHEN,
+        HKL_BINOCULARS_DETECTOR_CIRPAD,
         /* Add new your detectors here */
         HKL_BINOCULARS_DETECTOR_NUM_DETECTORS,
 } HklBinocularsDetectorEnum;
@@ -62,15 +64,79 @@ HKLAPI extern uint8_t *hkl_binoculars_detector_2d_mask_get(HklBinocularsDetector
 HKLAPI extern uint8_t *hkl_binoculars_detector_2d_mask_load(HklBinocularsDetectorEnum n,
                                                             const char *filename);
 
+/* the indexes of the not masked pixels (all the pixels if masked is
+ * NULL), so that the projections iterate only over the valid pixels */
+HKLAPI extern uint32_t *hkl_binoculars_detector_2d_mask_indexes_get(const uint8_t *masked,
+                                                                    size_t n_pixels,
+                                                                    size_t *n_indexes);
+
+/* the bounding box [row0, row1) x [col0, col1) of the not masked
+ * pixels, return FALSE if all the pixels are masked */
+HKLAPI extern int hkl_binoculars_detector_2d_mask_roi_get(const uint8_t *masked,
+                                                          int width, int height,
+                                                          size_t *row0, size_t *row1,
+                                                          size_t *col0, size_t *col1);
+
+/* read-only mask mapped from the file, the page cache keeps only one
+ * copy for all the workers and processes which map it. */
+HKLAPI extern uint8_t *hkl_binoculars_detector_2d_mask_mmap(HklBinocularsDetectorEnum n,
+                                                            const char *filename);
+
+HKLAPI extern void hkl_binoculars_detector_2d_mask_munmap(uint8_t *arr);
+
+/* set the corrections of the projections from float64 .npy files
+ * (NULL for none) with the shape of the detector, mapped when
+ * possible. Return FALSE, without changing the corrections, if one of
+ * the files can not be read. */
+HKLAPI extern int hkl_binoculars_detector_2d_corrections_load(HklBinocularsDetectorEnum n,
+                                                              const char *dark,
+                                                              const char *flatfield,
+                                                              const char *solid_angle);
+
 HKLAPI extern void hkl_binoculars_detector_2d_mask_save(HklBinocularsDetectorEnum n,
                                                         const char *fname);
 
+/* the per pixel median of the first frames of a scan. The pixels
+ * whose median is more than threshold deviations (the median absolute
+ * deviation of the medians) above the one of the detector are hot. A
+ * zinger hits only one frame, so it does not move the medians. */
+typedef struct _HklBinocularsHotPixels HklBinocularsHotPixels;
+
+HKLAPI extern HklBinocularsHotPixels *hkl_binoculars_detector_2d_hot_pixels_new(size_t n_pixels,
+                                                                                size_t n_frames);
+
+HKLAPI extern void hkl_binoculars_detector_2d_hot_pixels_free(HklBinocularsHotPixels *self);
+
+/* return FALSE once the n_frames frames were added */
+HKLAPI extern int hkl_binoculars_detector_2d_hot_pixels_add_frame_uint32(HklBinocularsHotPixels *self,
+                                                                         const uint32_t *image);
+
+/* mask the hot pixels among the not masked ones of the n_pixels
+ * masked array, return their number */
+HKLAPI extern size_t hkl_binoculars_detector_2d_hot_pixels_mask(HklBinocularsHotPixels *self,
+                                                                uint8_t *masked,
+                                                                double threshold);
+
 HKLAPI extern void hkl_binoculars_detector_2d_sixs_calibration(HklBinocularsDetectorEnum n,
                                                                double *arr,
                                                                int width, int height,
                                                                int ix0, int iy0, double sdd,
                                                                double detrot, int normalize_flag);
 
+/* the coordinates of hkl_binoculars_detector_2d_coordinates_get
+ * calibrated with hkl_binoculars_detector_2d_sixs_calibration. They
+ * are computed once per process for each set of parameters and the
+ * cache returns a copy, released with free. */
+HKLAPI extern double *hkl_binoculars_detector_2d_calibrated_coordinates_get(HklBinocularsDetectorEnum n,
+                                                                            int ix0, int iy0,
+                                                                            double sdd, double detrot,
+                                                                            int normalize_flag);
+
+/* also keep the calibrated coordinates in the npy files of this
+ * directory, shared by the next runs and the other processes (NULL,
+ * the default, only caches them in memory). */
+HKLAPI extern void hkl_binoculars_detector_2d_coordinates_cache_dir_set(const char *dirname);
+
 HKLAPI extern uint32_t *hkl_binoculars_detector_2d_fake_image_uint32(HklBinocularsDetectorEnum n,
                                                                      size_t *n_pixels);
 
@@ -113,14 +179,135 @@ HKLAPI extern HklBinocularsSpace *hkl_binoculars_space_new(size_t n_indexes_0,
 
 HKLAPI extern void hkl_binoculars_space_free(HklBinocularsSpace *self);
 
+/* the number of frames summed into the image of the next projections
+ * (1 by default), each pixel counts for as many contributions. */
+HKLAPI extern void hkl_binoculars_space_n_frames_set(HklBinocularsSpace *self,
+                                                     size_t n_frames);
+
+/* the qcustom projections also compute the sum and the maximum of
+ * the not masked pixels of the frame and the number of them projected
+ * in the limits, in the loop over the pixels (FALSE by default). They
+ * are zero when disabled and for the other projections. */
+HKLAPI extern void hkl_binoculars_frame_stats_set(int enable);
+
+HKLAPI extern void hkl_binoculars_space_frame_stats_get(const HklBinocularsSpace *self,
+                                                        double *sum,
+                                                        double *max,
+                                                        size_t *n_in_limits);
+
+/* split the pixels of a single frame between n_threads threads in the
+ * angles, qcustom and hkl projections (0 means the number of
+ * processors). The default is 1, each frame is projected by its
+ * calling thread. */
+HKLAPI extern void hkl_binoculars_frame_n_threads_set(size_t n_threads);
+
+/* compute the angles of the pixels with polynomial approximations of
+ * atan2, asin and acos instead of libm in the angles projection and
+ * the angles subprojections of qcustom (FALSE by default). The
+ * maximum error is 1.2e-4°. */
+HKLAPI extern void hkl_binoculars_fast_trigonometry_set(int enable);
+
+/* split each pixel in factor x factor sub-pixels in the angles,
+ * qcustom and hkl projections (1 by default, at most 8). The
+ * sub-pixels positions are interpolated between the neighbour pixels
+ * and each of them counts the counts of its pixel as one
+ * contribution, so the normalised intensities are the mean of the
+ * pixels weighted by their area in each bin. */
+HKLAPI extern void hkl_binoculars_pixel_splitting_set(size_t factor);
+
+/* per-pixel corrections of the detector applied by the angles,
+ * qcustom and hkl projections in their pixels loop: the counts of a
+ * pixel become (counts - dark) / (flatfield * solid_angle). Each
+ * array of n_pixels values is optional (NULL), they are copied so the
+ * caller can release them after this call. All NULL removes the
+ * corrections. Not to be called during a projection. */
+HKLAPI extern void hkl_binoculars_corrections_set(size_t n_pixels,
+                                                  const double *dark,
+                                                  const double *flatfield,
+                                                  const double *solid_angle);
+
 /********/
 /* Cube */
 /********/
 
 typedef  struct _HklBinocularsCube HklBinocularsCube;
 
+/* the cubes created after this call also accumulate, in double, the
+ * corrected intensities and the variances (the sum of the squared
+ * corrections times the counts) of their bins, next to the photons
+ * rounded to integers (FALSE by default). They are saved in the
+ * binoculars/intensities and binoculars/variances datasets. The
+ * sparse cubes keep only the photons. */
+HKLAPI extern void hkl_binoculars_cube_weighted_set(int enable);
+
+typedef enum _HklBinocularsCubeAllocEnum
+{
+        HKL_BINOCULARS_CUBE_ALLOC_DEFAULT = 0, /* malloc/calloc */
+        HKL_BINOCULARS_CUBE_ALLOC_FIRST_TOUCH, /* pages on the node of the first writer */
+        HKL_BINOCULARS_CUBE_ALLOC_INTERLEAVE, /* pages interleaved on the allowed nodes */
+        HKL_BINOCULARS_CUBE_ALLOC_HUGEPAGE, /* transparent huge pages */
+        HKL_BINOCULARS_CUBE_ALLOC_HUGETLB, /* reserved huge pages or transparent ones */
+        HKL_BINOCULARS_CUBE_ALLOC_SPILL, /* pages of a temporary file, spilled to the disk */
+        /* Add new your policies here */
+        HKL_BINOCULARS_CUBE_ALLOC_NUM_ALLOCS,
+} HklBinocularsCubeAllocEnum;
+
+/* the arrays of the cubes created after this call, bigger than a huge
+ * page, are anonymous mappings placed with this policy instead of
+ * malloced (HKL_BINOCULARS_CUBE_ALLOC_DEFAULT by default). The
+ * mappings are never touched at the allocation, so with
+ * HKL_BINOCULARS_CUBE_ALLOC_FIRST_TOUCH the bins of a cube or of a
+ * merge slab are local to the thread which fills them. */
+HKLAPI extern void hkl_binoculars_cube_alloc_set(HklBinocularsCubeAllocEnum alloc);
+
+/* the items of each space added to a cube are sorted by bins and the
+ * items of a same bin are summed before being scattered into the
+ * cube, instead of being added in the pixels order (FALSE by
+ * default). The writes stream through the big cubes where the
+ * neighbour pixels are far apart. */
+HKLAPI extern void hkl_binoculars_cube_sorted_scatter_set(int enable);
+
+/* the cubes filled by hkl_binoculars_cube_add_space after this call
+ * keep the photons and the contributions of each bin side by side
+ * while accumulating (FALSE by default), so each scattered pixel
+ * touches one cache line instead of two. The mapped cubes keep their
+ * layout. The merges, the saves and the other readers convert the
+ * cubes back to the planar layout, an accumulator can also be
+ * converted when it is done with hkl_binoculars_cube_planar. */
+HKLAPI extern void hkl_binoculars_cube_interleaved_set(int enable);
+
+/* the cubes filled by hkl_binoculars_cube_add_space after this call
+ * count the photons and the contributions of their bins in uint16_t
+ * while accumulating (FALSE by default), a tile of bins is promoted
+ * to uint32_t when one of its counters would overflow. It halves the
+ * memory of these arrays when most bins get few counts. Like the
+ * interleaved bins, the narrow cubes are converted back to the
+ * planar layout by their readers or by hkl_binoculars_cube_planar,
+ * so the saved files do not change. It takes precedence over the
+ * interleaved bins. */
+HKLAPI extern void hkl_binoculars_cube_narrow_counters_set(int enable);
+
+HKLAPI extern void hkl_binoculars_cube_planar(const HklBinocularsCube *self);
+
 HKLAPI extern void hkl_binoculars_cube_free(HklBinocularsCube *self);
 
+/* a shared cube can be filled concurrently by many threads with the
+ * hkl_binoculars_cube_accumulate_* functions, so there is only one
+ * cube whatever the number of threads. The cube must already have
+ * its final dimensions, its other functions are not thread safe. */
+HKLAPI extern void hkl_binoculars_cube_shared_set(HklBinocularsCube *self, int shared);
+
+/* add the space into the shared cube self when it contains the
+ * space, into the private overflow cube of the calling thread
+ * otherwise, so the shared cube keeps its dimensions. The merge of
+ * the shared cube and of the overflows is the whole projection. */
+HKLAPI extern void hkl_binoculars_cube_add_space_shared(HklBinocularsCube *self,
+                                                        HklBinocularsCube *overflow,
+                                                        const HklBinocularsSpace *space);
+
+/* the memory of the bins of the cube in bytes */
+HKLAPI extern size_t hkl_binoculars_cube_bytes(const HklBinocularsCube *self);
+
 HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new(size_t n_spaces,
                                                          const HklBinocularsSpace *const *spaces);
 
@@ -135,18 +322,389 @@ HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_from_space(const HklBin
 HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_merge(const HklBinocularsCube *cube1,
                                                                const HklBinocularsCube *cube2);
 
+/* merge n cubes at once. n_threads threads sum the cubes, each one
+ * in its own slab of the slowest axis. 0 means one thread per
+ * processor. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_merge_n(size_t n_cubes,
+                                                                 const HklBinocularsCube *const *cubes,
+                                                                 size_t n_threads);
+
 HKLAPI extern unsigned int hkl_binoculars_cube_cmp(const HklBinocularsCube *self,
                                                    const HklBinocularsCube *other);
 
 HKLAPI extern void hkl_binoculars_cube_add_space(HklBinocularsCube *self,
                                                  const HklBinocularsSpace *space);
 
+/* a compact copy of the cube restricted to the bounding box of the
+ * bins with contributions */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_crop(const HklBinocularsCube *self);
+
+/* a compact copy of the bins [imin[i], imax[i]] of each axis of the
+ * cube, the absolute bin indexes are clamped to the axes. An axis
+ * with imin[i] == imax[i] gives a slice of the cube. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_slice(const HklBinocularsCube *self,
+                                                               const ptrdiff_t *imin,
+                                                               const ptrdiff_t *imax);
+
+/* the sums of the bins of a region of interest */
+typedef struct _HklBinocularsCubeSums HklBinocularsCubeSums;
+struct _HklBinocularsCubeSums
+{
+        uint64_t photons;
+        uint64_t contributions;
+        double intensities; /* 0 if the cube is not weighted */
+        double variances; /* 0 if the cube is not weighted */
+};
+
+/* sum the bins [imin[i], imax[i]] of each axis of the cube */
+HKLAPI extern void hkl_binoculars_cube_roi_sums(const HklBinocularsCube *self,
+                                                const ptrdiff_t *imin,
+                                                const ptrdiff_t *imax,
+                                                HklBinocularsCubeSums *sums);
+
+/* a cube factors[i] times coarser along each axis (0 or 1 keeps the
+ * axis). The coarse bins stay centred on the multiples of their
+ * resolution, the coarse bin j sums the bins i with
+ * floor((i + factor / 2) / factor) == j. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_rebin(const HklBinocularsCube *self,
+                                                               const size_t *factors);
+
+#define HKL_BINOCULARS_CUBE_PEAK_MAX_AXES 3
+
+/* a peak of a cube, the bins sharing a face whose value is above the
+ * threshold */
+typedef struct _HklBinocularsCubePeak HklBinocularsCubePeak;
+struct _HklBinocularsCubePeak
+{
+        size_t n_bins;
+        HklBinocularsCubeSums sums;
+        double intensity; /* the sum of the values of the bins */
+        double centroid[HKL_BINOCULARS_CUBE_PEAK_MAX_AXES]; /* weighted by the values, in the axes unit */
+        ptrdiff_t imin[HKL_BINOCULARS_CUBE_PEAK_MAX_AXES]; /* the bounding box of the bins */
+        ptrdiff_t imax[HKL_BINOCULARS_CUBE_PEAK_MAX_AXES];
+};
+
+/* the peaks of the cube, the value of a bin is photons / contributions
+ * (intensities / contributions for a weighted cube) and the bins
+ * without contributions are never part of a peak. The peaks are
+ * ordered by their first bin, n_threads threads label the slabs of
+ * the slowest axis (0 means one thread per processor). Return the
+ * table to free with free, NULL if there is no peak or if the cube
+ * has more than HKL_BINOCULARS_CUBE_PEAK_MAX_AXES axes. */
+HKLAPI extern HklBinocularsCubePeak *hkl_binoculars_cube_peaks(const HklBinocularsCube *self,
+                                                               double threshold,
+                                                               size_t n_threads,
+                                                               size_t *n_peaks);
+
+typedef enum _HklBinocularsHdf5FilterEnum
+{
+        HKL_BINOCULARS_HDF5_FILTER_NONE = 0, /* contiguous datasets */
+        HKL_BINOCULARS_HDF5_FILTER_DEFLATE, /* shuffle + deflate */
+        HKL_BINOCULARS_HDF5_FILTER_LZ4, /* needs the lz4 hdf5 plugin */
+        HKL_BINOCULARS_HDF5_FILTER_BITSHUFFLE_LZ4, /* needs the bitshuffle hdf5 plugin */
+        /* Add new your filters here */
+        HKL_BINOCULARS_HDF5_FILTER_NUM_FILTERS,
+} HklBinocularsHdf5FilterEnum;
+
+/* save with contiguous uncompressed datasets */
 HKLAPI extern void hkl_binoculars_cube_save_hdf5(const char *fn,
                                                  const char *config,
                                                  const HklBinocularsCube *self);
 
+/* the frames [first, last] of a data file projected into a cube */
+typedef struct _HklBinocularsFramesRange HklBinocularsFramesRange;
+struct _HklBinocularsFramesRange
+{
+        char *filename;
+        int64_t first;
+        int64_t last;
+};
+
+/* save the cube with the frames projected into it, so a later run
+ * can reload it and project only the new frames of the growing
+ * files. */
+HKLAPI extern void hkl_binoculars_cube_save_hdf5_with_frames(const char *fn,
+                                                             const char *config,
+                                                             const HklBinocularsCube *self,
+                                                             const HklBinocularsFramesRange *ranges,
+                                                             size_t n_ranges);
+
+/* save with chunked datasets compressed by the filter, which is
+ * replaced by deflate if its plugin is not available, level is the
+ * deflate level and crop saves only the bounding box of the bins with
+ * contributions. HKL_BINOCULARS_HDF5_FILTER_NONE keeps the contiguous
+ * layout. The frames are saved unless ranges is NULL. Return FALSE
+ * if the file could not be written. */
+HKLAPI extern int hkl_binoculars_cube_save_hdf5_with_options(const char *fn,
+                                                             const char *config,
+                                                             const HklBinocularsCube *self,
+                                                             HklBinocularsHdf5FilterEnum filter,
+                                                             unsigned int level,
+                                                             int crop,
+                                                             const HklBinocularsFramesRange *ranges,
+                                                             size_t n_ranges);
+
+/* merge the cubes and save the result like
+ * hkl_binoculars_cube_save_hdf5_with_frames, without frames when
+ * ranges is NULL. n_threads threads merge the slabs of the slowest
+ * axis while the previous ones are compressed and written, so the
+ * merge and the save overlap. 0 means one thread per processor.
+ * Return FALSE if the file could not be written. */
+HKLAPI extern int hkl_binoculars_cubes_save_hdf5_with_frames(const char *fn,
+                                                             const char *config,
+                                                             size_t n_cubes,
+                                                             const HklBinocularsCube *const *cubes,
+                                                             size_t n_threads,
+                                                             const HklBinocularsFramesRange *ranges,
+                                                             size_t n_ranges);
+
+/* merge the cubes saved in the n_fns files into fn without loading
+ * them. The axes of fn are the union of the saved ones, n_threads
+ * threads each sum one chunk aligned slab of its slowest axis from
+ * all the files at a time. The empty saved cubes are skipped and the
+ * config is the one of the first file. Return FALSE, without writing
+ * fn, if a file is not a saved cube or if its axes differ from the
+ * axes of the others. 0 means one thread per processor. */
+HKLAPI extern int hkl_binoculars_cubes_merge_hdf5(const char *fn,
+                                                 size_t n_fns,
+                                                 const char *const *fns,
+                                                 size_t n_threads);
+
+/* also save n_levels levels of a pyramid with the cubes, the level l
+ * is the cube 2^l times coarser along each axis with its counts and
+ * contributions summed, in the binoculars/pyramid/level_<l> group
+ * with its own axes group. 0 (the default) disables the pyramid. */
+HKLAPI extern void hkl_binoculars_hdf5_pyramid_set(int n_levels);
+
+/* save the normalised difference of two cubes,
+ * (counts / contributions)_sample - scale * (counts / contributions)_background
+ * with the intensities instead of the counts for the weighted cubes,
+ * in the difference dataset and its variances in the variances
+ * dataset. The cubes are aligned on the union of their axes and the
+ * bins without contributions in one of them are NaN, a NULL
+ * background only normalises the sample. n_threads threads compute
+ * the slabs of the slowest axis in their own buffers, so the full
+ * cubes are never expanded. 0 means one thread per processor. */
+HKLAPI extern void hkl_binoculars_cube_normalised_difference_save_hdf5(const char *fn,
+                                                                       const char *config,
+                                                                       const HklBinocularsCube *sample,
+                                                                       const HklBinocularsCube *background,
+                                                                       double scale,
+                                                                       size_t n_threads);
+
+/* save the merge of the cubes as a zarr v3 group in the directory dn,
+ * with the config and the axes in its attributes and the counts and
+ * contributions arrays (plus the intensities and the variances of the
+ * weighted cubes). The rows of chunks of the slowest axis are split
+ * in n_parts parts, the rows of the part part (from 0) are merged and
+ * written by n_threads threads, each chunk is gzipped into its own
+ * file so there is no single writer. The nodes of a cluster write
+ * their own part of the same output from the same cubes, only the
+ * part 0 writes the metadata. Return FALSE if a file can not be
+ * written. */
+HKLAPI extern int hkl_binoculars_cubes_save_zarr(const char *dn,
+                                                 const char *config,
+                                                 size_t n_cubes,
+                                                 const HklBinocularsCube *const *cubes,
+                                                 size_t n_threads,
+                                                 size_t part,
+                                                 size_t n_parts);
+
+/* metrics */
+
+typedef enum _HklBinocularsMetricsStageEnum
+{
+        HKL_BINOCULARS_METRICS_STAGE_READ = 0,
+        HKL_BINOCULARS_METRICS_STAGE_GEOMETRY,
+        HKL_BINOCULARS_METRICS_STAGE_PROJECT,
+        HKL_BINOCULARS_METRICS_STAGE_ACCUMULATE,
+        HKL_BINOCULARS_METRICS_STAGE_MERGE,
+        HKL_BINOCULARS_METRICS_STAGE_SAVE,
+        /* Add new your stages here */
+        HKL_BINOCULARS_METRICS_STAGE_NUM_STAGES,
+} HklBinocularsMetricsStageEnum;
+
+/* serve the metrics in the OpenMetrics text format on GET /metrics
+ * of the address and the port from a thread of its own. The address
+ * is the loopback when NULL, the port is picked by the system when 0.
+ * Return the port served or 0 if it can not be bound. */
+HKLAPI extern int hkl_binoculars_metrics_serve(const char *address, int port);
+
+/* stop serving the metrics, the counters are kept. */
+HKLAPI extern void hkl_binoculars_metrics_stop(void);
+
+/* add a duration of a stage to its histogram, the project stage is
+ * observed once per frame. */
+HKLAPI extern void hkl_binoculars_metrics_stage_observe(HklBinocularsMetricsStageEnum stage,
+                                                        double seconds);
+
+/* the frames read and not yet projected. */
+HKLAPI extern void hkl_binoculars_metrics_queue_depth_set(size_t depth);
+
+/* the memory of the bins of the cube, NULL for none. */
+HKLAPI extern void hkl_binoculars_metrics_cube_set(const HklBinocularsCube *cube);
+
+/* reload a cube saved with its frames. Return NULL if the file does
+ * not exist, was saved without the frames or with another config
+ * (the sha256 of the configs differ). The ranges must be released
+ * with hkl_binoculars_frames_ranges_free. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_from_hdf5(const char *fn,
+                                                                  const char *config,
+                                                                  HklBinocularsFramesRange **ranges,
+                                                                  size_t *n_ranges);
+
+HKLAPI extern void hkl_binoculars_frames_ranges_free(HklBinocularsFramesRange *ranges,
+                                                     size_t n_ranges);
+
+/* the inputs of a saved cube, its config followed by the identity of
+ * its files (path, size and modification time), are kept as their
+ * sha256 so an identical run can return the saved cube at once.
+ * Return FALSE if the file is not a saved cube, or for check if the
+ * cube was saved from other inputs. */
+HKLAPI extern int hkl_binoculars_cube_inputs_hash_save_hdf5(const char *fn,
+                                                            const char *inputs);
+
+HKLAPI extern int hkl_binoculars_cube_inputs_hash_check_hdf5(const char *fn,
+                                                             const char *inputs);
+
+/* the same functions on a saved cube, only the needed hyperslabs of
+ * the datasets are read. The n_axes axes are the ones of the saved
+ * datasets, in their order, so without the axes of size 1. Return
+ * NULL (FALSE) if the file is not a saved cube with n_axes axes. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_slice_from_hdf5(const char *fn,
+                                                                        size_t n_axes,
+                                                                        const ptrdiff_t *imin,
+                                                                        const ptrdiff_t *imax);
+
+HKLAPI extern int hkl_binoculars_cube_roi_sums_from_hdf5(const char *fn,
+                                                         size_t n_axes,
+                                                         const ptrdiff_t *imin,
+                                                         const ptrdiff_t *imax,
+                                                         HklBinocularsCubeSums *sums);
+
+/* the saved cube is read one coarse slab of its slowest axis at a
+ * time */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_rebin_from_hdf5(const char *fn,
+                                                                        size_t n_axes,
+                                                                        const size_t *factors);
+
 HKLAPI extern void hkl_binoculars_cube_fprintf(FILE *f, const HklBinocularsCube *self);
 
+/***************/
+/* Sparse Cube */
+/***************/
+
+/* only the bins with contributions are stored. The functions which
+ * read the bins first sort the bins added since the last read, this
+ * is why they do not take a const sparse cube. */
+
+typedef struct _HklBinocularsSparseCube HklBinocularsSparseCube;
+
+HKLAPI extern HklBinocularsSparseCube *hkl_binoculars_sparse_cube_new_empty(void);
+
+HKLAPI extern HklBinocularsSparseCube *hkl_binoculars_sparse_cube_new_from_cube(const HklBinocularsCube *cube);
+
+HKLAPI extern void hkl_binoculars_sparse_cube_free(HklBinocularsSparseCube *self);
+
+HKLAPI extern void hkl_binoculars_sparse_cube_add_space(HklBinocularsSparseCube *self,
+                                                        const HklBinocularsSpace *space);
+
+HKLAPI extern size_t hkl_binoculars_sparse_cube_n_bins(HklBinocularsSparseCube *self);
+
+/* the dense cube expected by the binoculars gui */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_cube(HklBinocularsSparseCube *sparse);
+
+/* binoculars/sparse/{indexes,counts,contributions} COO datasets, the
+ * indexes are the positions in the dense counts array */
+HKLAPI extern void hkl_binoculars_sparse_cube_save_hdf5(const char *fn,
+                                                        const char *config,
+                                                        HklBinocularsSparseCube *self);
+
+/* the dense cube of a sparse cube saved with
+ * hkl_binoculars_sparse_cube_save_hdf5, NULL if fn is not one. */
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_from_sparse_hdf5(const char *fn);
+
+/* <prefix>_indexes.npy, <prefix>_counts.npy and
+ * <prefix>_contributions.npy with the same content than the hdf5
+ * sparse datasets */
+HKLAPI extern void hkl_binoculars_sparse_cube_save_npy(const char *prefix,
+                                                       HklBinocularsSparseCube *self);
+
+/* the same arrays in the indexes, counts and contributions members of
+ * a npz, deflated if compress */
+HKLAPI extern void hkl_binoculars_sparse_cube_save_npz(const char *fname,
+                                                       HklBinocularsSparseCube *self,
+                                                       int compress);
+
+/***************/
+/* Cube Window */
+/***************/
+
+/* a time-resolved cube of a timestamp subprojection cut in slabs of
+ * slab_bins bins of the timestamp axis. Only the n_open newest slabs
+ * are kept in memory, when a space reaches a newer slab the oldest
+ * ones are closed: they are appended to the file in the
+ * binoculars/slabs/slab_<n> groups, with their own axes, counts and
+ * contributions, then freed. n is the order of the writes, the items
+ * of an already closed slab are written in a new group. A space
+ * without timestamp axis goes in a single slab. */
+
+typedef struct _HklBinocularsCubeWindow HklBinocularsCubeWindow;
+
+/* create the file, NULL if it can not be created */
+HKLAPI extern HklBinocularsCubeWindow *hkl_binoculars_cube_window_new(const char *fn,
+                                                                      const char *config,
+                                                                      size_t slab_bins,
+                                                                      size_t n_open);
+
+HKLAPI extern void hkl_binoculars_cube_window_add_space(HklBinocularsCubeWindow *self,
+                                                        const HklBinocularsSpace *space);
+
+/* the number of slabs groups already written */
+HKLAPI extern size_t hkl_binoculars_cube_window_n_saved(const HklBinocularsCubeWindow *self);
+
+/* write the open slabs and release the window */
+HKLAPI extern void hkl_binoculars_cube_window_free(HklBinocularsCubeWindow *self);
+
+/**********/
+/* Frames */
+/**********/
+
+/* read the frames with H5Dread_chunk, disabled by default */
+HKLAPI extern void hkl_binoculars_hdf5_direct_chunk_read_set(int enable);
+
+/* read the frame i of a [n, height, width] dataset stored one frame
+ * per chunk into buffer of n_bytes, directly from the raw chunk. Only
+ * the hdf5 library lock is held while reading the raw chunk, it is
+ * decompressed on the calling thread so concurrent readers decompress
+ * in parallel. Return a negative value if the direct read is disabled
+ * or if the layout or the filters of the dataset are not supported,
+ * the frame must then be read with H5Dread. */
+HKLAPI extern int hkl_binoculars_hdf5_read_frame_direct(int64_t dataset_id, size_t i,
+                                                        void *buffer, size_t n_bytes);
+
+/* the region of the frames read by hkl_binoculars_hdf5_read_frame_roi,
+ * the rows [row0, row1) and the columns [col0, col1). An empty region
+ * disables the roi reads. */
+HKLAPI extern void hkl_binoculars_hdf5_frame_roi_set(size_t row0, size_t row1,
+                                                     size_t col0, size_t col1);
+
+/* read only the roi of the frame i of a [n, height, width] dataset
+ * into buffer of n_bytes with H5Dread, so only the chunks overlapping
+ * the roi are read and decompressed. The pixels out of the roi are
+ * set to zero. Return a negative value if there is no roi or if a
+ * frame is stored in a single chunk (the whole frame would be
+ * decompressed anyway), the frame must then be read completely. */
+HKLAPI extern int hkl_binoculars_hdf5_read_frame_roi(int64_t dataset_id, size_t i,
+                                                     void *buffer, size_t n_bytes);
+
+/* the time spent by all the threads reading the raw chunks and
+ * decompressing them since the start of the process, in µs, and the
+ * number of frames read directly. */
+HKLAPI extern void hkl_binoculars_hdf5_read_frame_direct_times_get(uint64_t *read_us,
+                                                                   uint64_t *decode_us,
+                                                                   uint64_t *n_frames);
+
 /***************/
 /* Projections */
 /***************/
@@ -180,6 +738,9 @@ HKLAPI extern void hkl_binoculars_cube_fprintf(FILE *f, const HklBinocularsCube
 HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(int32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(uint16_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_ANGLES_DECL(float);
 
 /* qcustom */
 
@@ -206,6 +767,9 @@ typedef enum _HklBinocularsQCustomSubProjectionEnum
         HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QZ_TIMESTAMP,
         HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QY_QZ_TIMESTAMP,
         HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH_AZIMUTH,
+        HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q,
+        HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH,
+        HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS, /* the axes of hkl_binoculars_qcustom_plan_expressions_set */
         /* Add new your subprojection in the same order than the haskell order here */
         HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS,
 } HklBinocularsQCustomSubProjectionEnum;
@@ -238,6 +802,212 @@ typedef enum _HklBinocularsQCustomSubProjectionEnum
 HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(int32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(uint16_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(float);
+
+/* qcustom directly accumulated into a cube which has already its
+ * final dimensions (the guessed cube). This avoid the intermediate
+ * HklBinocularsSpace. The pixels outside of the cube are dropped and
+ * their number is returned. */
+
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(image_t)            \
+        size_t hkl_binoculars_cube_accumulate_qcustom_ ## image_t (HklBinocularsCube *cube, \
+                                                                   const HklGeometry *geometry, \
+                                                                   const image_t *image, \
+                                                                   size_t n_pixels, \
+                                                                   double weight, \
+                                                                   const double *pixels_coordinates, \
+                                                                   size_t pixels_coordinates_ndim, \
+                                                                   const size_t *pixels_coordinates_dims, \
+                                                                   const double *resolutions, \
+                                                                   size_t n_resolutions, \
+                                                                   const uint8_t *masked, \
+                                                                   HklBinocularsSurfaceOrientationEnum surf, \
+                                                                   const HklBinocularsAxisLimits **limits, \
+                                                                   size_t n_limits, \
+                                                                   double timestamp, \
+                                                                   const HklBinocularsQCustomSubProjectionEnum subprojection, \
+                                                                   double uqx, \
+                                                                   double uqy, \
+                                                                   double uqz, \
+                                                                   const char *sample_axis, \
+                                                                   int do_polarisation_correction \
+                )
+
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(int32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(uint16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_DECL(float);
+
+/* expressions */
+
+/* a user defined axis of the qcustom expressions subprojection. The
+ * source is an arithmetic expression (+ - * / ^ and parenthesis) of
+ * numbers, pi and the variables of a pixel: qx, qy, qz, q, qpar, qper
+ * (sample basis), kfx, kfy, kfz (lab basis), tth, azimuth (degree),
+ * timestamp and sampleaxis, with the functions sqrt, abs, exp, log,
+ * sin, cos, tan, asin, acos, atan, atan2 (radian), deg and rad.
+ * It is compiled once, when the configuration is read, then
+ * evaluated on blocks of pixels. Return NULL and set error (to free
+ * with g_free) if the source is not valid. */
+typedef struct _HklBinocularsExpression HklBinocularsExpression;
+
+HKLAPI extern HklBinocularsExpression *hkl_binoculars_expression_new(const char *name,
+                                                                     const char *source,
+                                                                     char **error);
+
+HKLAPI extern void hkl_binoculars_expression_free(HklBinocularsExpression *self);
+
+HKLAPI extern const char *hkl_binoculars_expression_name_get(const HklBinocularsExpression *self);
+
+/* a qcustom projection plan holds everything which depends only on
+ * the configuration: the axes names, the surface orientation and the
+ * uqx, uqy, uqz rotation, the not masked pixels and the sub-pixels
+ * (with the pixel splitting factor set when the plan is created).
+ * The frames are then projected from the plan, the geometry and the
+ * image only. The pixels coordinates and the limits are borrowed,
+ * they must outlive the plan. */
+
+typedef struct _HklBinocularsQCustomPlan HklBinocularsQCustomPlan;
+
+HKLAPI extern HklBinocularsQCustomPlan *hkl_binoculars_qcustom_plan_new(const double *pixels_coordinates,
+                                                                        size_t pixels_coordinates_ndim,
+                                                                        const size_t *pixels_coordinates_dims,
+                                                                        const double *resolutions,
+                                                                        size_t n_resolutions,
+                                                                        const uint8_t *masked,
+                                                                        HklBinocularsSurfaceOrientationEnum surf,
+                                                                        const HklBinocularsAxisLimits **limits,
+                                                                        size_t n_limits,
+                                                                        HklBinocularsQCustomSubProjectionEnum subprojection,
+                                                                        double uqx,
+                                                                        double uqy,
+                                                                        double uqz,
+                                                                        const char *sample_axis,
+                                                                        int do_polarisation_correction);
+
+HKLAPI extern void hkl_binoculars_qcustom_plan_free(HklBinocularsQCustomPlan *self);
+
+/* the axes of the expressions subprojection, at most 3 and not more
+ * than the resolutions. The expressions are borrowed like the limits.
+ * Without expression this subprojection is qx_qy_qz. */
+HKLAPI extern void hkl_binoculars_qcustom_plan_expressions_set(HklBinocularsQCustomPlan *self,
+                                                               const HklBinocularsExpression *const *expressions,
+                                                               size_t n_expressions);
+
+/* the number of axes of the spaces projected with the plan */
+HKLAPI extern size_t hkl_binoculars_qcustom_plan_n_axes(const HklBinocularsQCustomPlan *self);
+
+#define HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(image_t)                 \
+        void hkl_binoculars_space_qcustom_plan_ ## image_t (HklBinocularsSpace *space, \
+                                                            const HklBinocularsQCustomPlan *plan, \
+                                                            const HklGeometry *geometry, \
+                                                            const image_t *image, \
+                                                            double weight, \
+                                                            double timestamp)
+
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(int32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(uint16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_PLAN_DECL(float);
+
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(image_t)       \
+        size_t hkl_binoculars_cube_accumulate_qcustom_plan_ ## image_t (HklBinocularsCube *cube, \
+                                                                        const HklBinocularsQCustomPlan *plan, \
+                                                                        const HklGeometry *geometry, \
+                                                                        const image_t *image, \
+                                                                        double weight, \
+                                                                        double timestamp)
+
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(int32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(uint16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_PLAN_DECL(float);
+
+/* the qcustom projection of a static geometry as a sparse matrix
+ * (CSR) from the detector pixels to the bins, computed once like the
+ * pyFAI look up tables. Each row is a bin with the pixels which fall
+ * into it and the sum of the corrections of their sub-pixels, the
+ * timestamp axis is added when the frames are accumulated. The
+ * corrections (polarisation, dark, flatfield, solid angle) are the
+ * ones set when the lut is created. The plan is borrowed, it must
+ * outlive the lut, the lut is read-only and can be shared by the
+ * threads accumulating frames into a shared cube. Return NULL if the
+ * sample axis of the subprojection is not part of the geometry, or
+ * if an expression of the subprojection reads the timestamp. */
+
+typedef struct _HklBinocularsQCustomLut HklBinocularsQCustomLut;
+
+HKLAPI extern HklBinocularsQCustomLut *hkl_binoculars_qcustom_lut_new(const HklBinocularsQCustomPlan *plan,
+                                                                      const HklGeometry *geometry);
+
+HKLAPI extern void hkl_binoculars_qcustom_lut_free(HklBinocularsQCustomLut *self);
+
+/* TRUE if the geometry projects the pixels like the one of the lut */
+HKLAPI extern int hkl_binoculars_qcustom_lut_match(const HklBinocularsQCustomLut *self,
+                                                   const HklGeometry *geometry);
+
+/* accumulate a frame, each row is a sparse dot product with the
+ * image. The photons are rounded per bin instead of per pixel.
+ * Return the number of (sub-)pixels outside of the cube. */
+#define HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(image_t)        \
+        size_t hkl_binoculars_cube_accumulate_qcustom_lut_ ## image_t (HklBinocularsCube *cube, \
+                                                                       const HklBinocularsQCustomLut *lut, \
+                                                                       const image_t *image, \
+                                                                       double weight, \
+                                                                       double timestamp)
+
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(int32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(uint16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_CUBE_ACCUMULATE_QCUSTOM_LUT_DECL(float);
+
+/* the bounds of the cube of a qcustom projection, estimated from a
+ * grid of the detector pixels for each added geometry instead of
+ * projecting all the pixels. The cube created from the bounds has
+ * only its axes, it is meant to size the final cubes with
+ * hkl_binoculars_cube_new_empty_from_cube. */
+
+typedef struct _HklBinocularsBounds HklBinocularsBounds;
+
+HKLAPI extern HklBinocularsBounds *hkl_binoculars_bounds_new_qcustom(const HklBinocularsQCustomPlan *plan);
+
+HKLAPI extern void hkl_binoculars_bounds_free(HklBinocularsBounds *self);
+
+HKLAPI extern void hkl_binoculars_bounds_add_qcustom(HklBinocularsBounds *self,
+                                                     const HklGeometry *geometry,
+                                                     double timestamp);
+
+HKLAPI extern HklBinocularsCube *hkl_binoculars_cube_new_from_bounds(const HklBinocularsBounds *self);
+
+/* the footprint of the pixels of a qcustom projection, measured
+ * between neighbour pixels of a grid of the detector for each added
+ * geometry. It suggests the resolutions of the axes, the ones which
+ * do not depend on the pixels keep the resolution of the plan, and
+ * the number of bins and the memory of the cube. */
+
+typedef struct _HklBinocularsFootprint HklBinocularsFootprint;
+
+HKLAPI extern HklBinocularsFootprint *hkl_binoculars_footprint_new_qcustom(const HklBinocularsQCustomPlan *plan);
+
+HKLAPI extern void hkl_binoculars_footprint_free(HklBinocularsFootprint *self);
+
+HKLAPI extern void hkl_binoculars_footprint_add_qcustom(HklBinocularsFootprint *self,
+                                                        const HklGeometry *geometry,
+                                                        double timestamp);
+
+HKLAPI extern int hkl_binoculars_footprint_suggest(const HklBinocularsFootprint *self,
+                                                   double *resolutions, size_t n_resolutions,
+                                                   uint64_t *n_bins, uint64_t *n_bytes);
 
 /* hkl */
 
@@ -262,6 +1032,38 @@ HKLAPI extern HKL_BINOCULARS_SPACE_QCUSTOM_DECL(uint32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(int32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(uint16_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(float);
+
+/* the hkl projection of the n_samples domains (twins, grains) of a
+ * sample, the spaces[i] of samples[i] are filled in the same pixel
+ * loop, which computes the detector side only once per pixel. */
+#define HKL_BINOCULARS_SPACES_HKL_DECL(image_t)                         \
+        void hkl_binoculars_spaces_hkl_ ## image_t (HklBinocularsSpace **spaces, \
+                                                    const HklGeometry *geometry, \
+                                                    const HklSample **samples, \
+                                                    size_t n_samples,   \
+                                                    const image_t *image, \
+                                                    size_t n_pixels,    \
+                                                    double weight,      \
+                                                    const double *pixels_coordinates, \
+                                                    size_t pixels_coordinates_ndim, \
+                                                    const size_t *pixels_coordinates_dims, \
+                                                    const double *resolutions, \
+                                                    size_t n_resolutions, \
+                                                    const uint8_t *masked, \
+                                                    const HklBinocularsAxisLimits **limits, \
+                                                    size_t n_limits,    \
+                                                    int do_polarisation_correction \
+                )
+
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(int32_t);
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(uint16_t);
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACES_HKL_DECL(float);
 
 /* test */
 
@@ -287,6 +1089,9 @@ HKLAPI extern HKL_BINOCULARS_SPACE_HKL_DECL(uint32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(int32_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(uint16_t);
 HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(uint32_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(uint8_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(int16_t);
+HKLAPI extern HKL_BINOCULARS_SPACE_TEST_DECL(float);
 
 
 G_END_DECLS
@@ -13,45 +13,62 @@
     Portability: GHC only (not tested)
 -}
 module Hkl.Binoculars.Command
-  ( new
+  ( merge
+  , new
   , process
+  , suggest
   , update
   ) where
 
+import           Control.Monad                      (unless)
 import           Control.Monad.Catch                (MonadThrow)
 import           Control.Monad.IO.Class             (MonadIO, liftIO)
 import           Control.Monad.Logger               (LoggingT, MonadLogger,
-                                                     logDebugN)
+                                                     logDebugN, logErrorN)
 import           Path.IO                            (getCurrentDir)
 import           Path.Posix                         (parseAbsDir)
 
 import           Hkl.Binoculars.Config
+import           Hkl.Binoculars.Pipes               (Checkpoint (..), Live,
+                                                     Shard)
+import           Hkl.Binoculars.Projections         (mergeCubeFiles)
 import           Hkl.Binoculars.Projections.Angles
 import           Hkl.Binoculars.Projections.Hkl
 import           Hkl.Binoculars.Projections.QCustom
 import           Hkl.Binoculars.Projections.Test
 import           Hkl.Utils
 
-{-# SPECIALIZE process :: Maybe FilePath -> Maybe ConfigRange ->LoggingT IO () #-}
+{-# SPECIALIZE process :: Maybe FilePath -> Maybe ConfigRange -> Maybe Live -> Maybe Shard -> Checkpoint -> LoggingT IO () #-}
 process :: (MonadLogger m, MonadThrow m, MonadIO m)
-        => Maybe FilePath -> Maybe ConfigRange -> m ()
-process mf mr = do
+        => Maybe FilePath -> Maybe ConfigRange -> Maybe Live -> Maybe Shard -> Checkpoint -> m ()
+process mf mr ml ms ck = do
   epreconf <- liftIO $ getPreConfig mf
   logDebugN "pre-config red from the config file"
   logDebugNSH epreconf
   case epreconf of
     Left e        -> logErrorNSH e
     Right preconf -> case _binocularsPreConfigProjectionType preconf of
-                      AnglesProjection    -> processAngles mf mr
-                      Angles2Projection   -> processAngles mf mr
-                      HklProjection       -> processHkl mf mr
-                      QCustomProjection   -> processQCustom mf mr
-                      TestProjection      -> processTest mf mr
-                      QIndexProjection    -> processQCustom mf mr
-                      QparQperProjection  -> processQCustom mf mr
-                      QxQyQzProjection    -> processQCustom mf mr
-                      RealSpaceProjection -> processQCustom mf mr
-                      PixelsProjection    -> processQCustom mf mr
+                      AnglesProjection    -> offline $ processAngles mf mr
+                      Angles2Projection   -> offline $ processAngles mf mr
+                      HklProjection       -> offline $ processHkl mf mr
+                      QCustomProjection   -> processQCustom mf mr ml ms ck
+                      TestProjection      -> offline $ processTest mf mr
+                      QIndexProjection    -> processQCustom mf mr ml ms ck
+                      QparQperProjection  -> processQCustom mf mr ml ms ck
+                      QxQyQzProjection    -> processQCustom mf mr ml ms ck
+                      RealSpaceProjection -> processQCustom mf mr ml ms ck
+                      PixelsProjection    -> processQCustom mf mr ml ms ck
+  where
+    offline action = case (ml, ms, ck) of
+                       (Nothing, Nothing, Checkpoint Nothing False) -> action
+                       (Just _, _, _) -> logErrorN "the live mode is only available for the qcustom projections"
+                       (_, Just _, _) -> logErrorN "the shards are only available for the qcustom projections"
+                       _              -> logErrorN "the checkpoints are only available for the qcustom projections"
+
+merge :: (MonadIO m, MonadLogger m) => FilePath -> [FilePath] -> m ()
+merge o is = do
+  res <- liftIO $ mergeCubeFiles o is
+  unless res $ logErrorN "the inputs are not saved cubes with the same axes, nothing was merged"
 
 new :: (MonadIO m, MonadLogger m, MonadThrow m)
     => ProjectionType -> Maybe FilePath -> m ()
@@ -89,3 +106,24 @@ update f mr = do
                       QxQyQzProjection    -> updateQCustom (Just f) mr
                       RealSpaceProjection -> updateQCustom (Just f) mr
                       PixelsProjection    -> updateQCustom (Just f) mr
+
+suggest :: (MonadIO m, MonadLogger m, MonadThrow m) => FilePath -> Maybe ConfigRange -> m ()
+suggest f mr = do
+  epreconf <- liftIO $ getPreConfig (Just f)
+  logDebugN "pre-config red from the config file"
+  logDebugNSH epreconf
+  case epreconf of
+    Left e        -> logErrorNSH e
+    Right preconf -> case _binocularsPreConfigProjectionType preconf of
+                      AnglesProjection    -> unavailable
+                      Angles2Projection   -> unavailable
+                      HklProjection       -> unavailable
+                      QCustomProjection   -> suggestQCustom (Just f) mr
+                      TestProjection      -> unavailable
+                      QIndexProjection    -> suggestQCustom (Just f) mr
+                      QparQperProjection  -> suggestQCustom (Just f) mr
+                      QxQyQzProjection    -> suggestQCustom (Just f) mr
+                      RealSpaceProjection -> suggestQCustom (Just f) mr
+                      PixelsProjection    -> suggestQCustom (Just f) mr
+  where
+    unavailable = logErrorN "the suggestion of the resolutions is only available for the qcustom projections"
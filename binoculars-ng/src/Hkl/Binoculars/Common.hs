@@ -17,18 +17,32 @@ module Hkl.Binoculars.Common
   , DataFrameSpace(..)
   , InputFn(..)
   , addSpace
+  , addSpaceShared
   , chunk
   , cclip
   , clength
+  , cshard
+  , cubeBytes
+  , filterSumSpace
+  , cslice
+  , mergeFramesRanges
   , mkCube'
+  , resumeChunks
   , toList
   , withCubeAccumulator
+  , withSharedCube
+  , workSlices
   ) where
 
-import           Control.Exception          (bracket)
+import           Control.Exception          (bracket, finally)
 import           Data.IORef                 (IORef, newIORef, readIORef)
+import           Data.List                  (nub, sortOn)
+import           Data.Maybe                 (catMaybes)
+import           Foreign.C.Types            (CDouble (..))
 import           Foreign.ForeignPtr         (withForeignPtr)
+import           Foreign.Marshal.Alloc      (alloca)
 import           Foreign.Marshal.Array      (withArrayLen)
+import           Foreign.Storable           (peek)
 import           Path                       (Abs, File, Path, fromAbsFile)
 import           Text.Printf                (printf)
 
@@ -52,6 +66,63 @@ clength :: Num n => Chunk n a -> n
 clength (Chunk _ l h) = h - l + 1
 {-# SPECIALIZE clength :: Chunk Int FilePath -> Int  #-}
 
+-- | remove the already projected frames from the chunks. A file which
+-- does not start at the same frame or which shrank can not be
+-- resumed, so Nothing.
+resumeChunks :: [FramesRange] -> [Chunk Int FilePath] -> Maybe [Chunk Int FilePath]
+resumeChunks done = fmap catMaybes . mapM resume
+  where
+    resume c@(Chunk fn l h) =
+      case [(l', h') | (fn', l', h') <- done, fn' == fn] of
+        [] -> Just (Just c)
+        ((l', h') : _)
+          | l' /= l || h' > h -> Nothing
+          | h' == h -> Just Nothing
+          | otherwise -> Just (Just (Chunk fn (h' + 1) h))
+
+-- | the frames of the shard i (from 1) of n, the frames are split
+-- into n contiguous ranges of about the same length.
+cshard :: Int -> Int -> [Chunk Int a] -> [Chunk Int a]
+cshard i n cs = go 0 cs
+  where
+    ntot = sum (fmap clength cs)
+    lo = quot ((i - 1) * ntot) n
+    hi = quot (i * ntot) n
+    go _ [] = []
+    go o (c@(Chunk a l _) : xs)
+      | o >= hi = []
+      | o + clength c <= lo = go (o + clength c) xs
+      | otherwise = Chunk a (l + max 0 (lo - o)) (l + min (clength c) (hi - o) - 1) : go (o + clength c) xs
+
+-- | merge the contiguous ranges of frames of the same file, a file
+-- split between shards must be resumed from all its frames.
+mergeFramesRanges :: [FramesRange] -> [FramesRange]
+mergeFramesRanges frs = concatMap merge fns
+  where
+    fns = nub [fn | (fn, _, _) <- frs]
+    merge fn = foldr join' [] (sortOn (\(_, l, _) -> l) [r | r@(fn', _, _) <- frs, fn' == fn])
+    join' r [] = [r]
+    join' r@(fn, l, h) acc@((_, l', h') : xs)
+      | l' <= h + 1 = (fn, l, max h h') : xs
+      | otherwise = r : acc
+
+-- | split the chunks into ranges of at most n frames
+cslice :: Int -> [Chunk Int a] -> [Chunk Int a]
+cslice n = concatMap go
+  where
+    go c@(Chunk a l h)
+      | clength c <= n = [c]
+      | otherwise = Chunk a l (l + n - 1) : go (Chunk a (l + n) h)
+
+-- | the ranges of frames pulled by the workers from a shared queue,
+-- about eight per worker so that the ones which finish early take
+-- the remaining work. Each range opens its file again, so do not go
+-- below ten frames.
+workSlices :: Int -> [Chunk Int a] -> [Chunk Int a]
+workSlices n cs = cslice (max 10 (quot ntot (8 * n))) cs
+  where
+    ntot = sum (fmap clength cs)
+
 cweight :: Num n => Chunk n a -> n
 cweight (Chunk _ l h) = h - l
 
@@ -89,6 +160,20 @@ toList (InputFn'List fs)        = map fromAbsFile fs
 data DataFrameSpace sh = DataFrameSpace Image (Space sh) Attenuation
   deriving Show
 
+-- | like filterSumImage, with the sum of the not masked pixels
+-- computed by the projection of the frame, see
+-- c'hkl_binoculars_frame_stats_set.
+filterSumSpace :: Maybe Double -> DataFrameSpace sh -> IO Bool
+filterSumSpace Nothing _ = pure True
+filterSumSpace (Just m) (DataFrameSpace _ (Space fSpace) _) =
+  withForeignPtr fSpace $ \pSpace ->
+  alloca $ \pSum ->
+  alloca $ \pMax ->
+  alloca $ \pN -> do
+    c'hkl_binoculars_space_frame_stats_get pSpace pSum pMax pN
+    (CDouble s) <- peek pSum
+    pure (s < m)
+
 --  Create the Cube
 
 {-# INLINE mkCube' #-}
@@ -108,6 +193,23 @@ addSpace (DataFrameSpace _ (Space fs) _) (Cube fp) =
   {-# SCC "hkl_binoculars_cube_add_space" #-} c'hkl_binoculars_cube_add_space cPtr spacePtr
   return $ Cube fp
 
+-- | add a space into a shared cube, or into the private overflow
+-- cube of the worker when the shared cube does not contain it.
+addSpaceShared :: Shape sh => Cube sh -> DataFrameSpace sh -> Cube sh -> IO (Cube sh)
+addSpaceShared EmptyCube df overflow = addSpace df overflow
+addSpaceShared shared df EmptyCube = addSpaceShared shared df =<< newCube =<< c'hkl_binoculars_cube_new_empty
+addSpaceShared (Cube fp) (DataFrameSpace _ (Space fs) _) overflow@(Cube fo) =
+  withForeignPtr fp $ \sharedPtr ->
+  withForeignPtr fo $ \overflowPtr ->
+  withForeignPtr fs $ \spacePtr -> do
+  c'hkl_binoculars_cube_add_space_shared sharedPtr overflowPtr spacePtr
+  pure overflow
+
+-- | the memory of the bins of a cube in bytes
+cubeBytes :: Cube sh -> IO Int
+cubeBytes EmptyCube = pure 0
+cubeBytes (Cube fp) = fromEnum <$> withForeignPtr fp c'hkl_binoculars_cube_bytes
+
 type Template = String
 
 data InputFn = InputFn FilePath
@@ -124,6 +226,30 @@ withCubeAccumulator c f = bracket
                             )
   )
   pure
-  (\r -> f r >> readIORef r)
+  (\r -> do
+      f r
+      -- the interleaved accumulators are converted by their own
+      -- thread, before the merge
+      acc <- readIORef r
+      case acc of
+        EmptyCube -> pure ()
+        (Cube fp) -> withForeignPtr fp c'hkl_binoculars_cube_planar
+      pure acc)
+
+-- | a cube with the dimensions of the given one shared by the
+-- workers, it comes first in their cubes.
+withSharedCube :: Shape sh => Cube sh -> (Cube sh -> IO ([Cube sh], a)) -> IO ([Cube sh], a)
+withSharedCube c f = do
+  shared <- newCube =<< (case c of
+                           EmptyCube -> c'hkl_binoculars_cube_new_empty
+                           (Cube fp) -> withForeignPtr fp $ \p ->
+                             c'hkl_binoculars_cube_new_empty_from_cube p
+                        )
+  let share b = case shared of
+                  EmptyCube -> pure ()
+                  (Cube fp) -> withForeignPtr fp $ \p -> c'hkl_binoculars_cube_shared_set p b
+  share 1
+  (cs, a) <- f shared `finally` share 0
+  pure (shared : cs, a)
 
 -- Projections
@@ -32,6 +32,7 @@ module Hkl.Binoculars.Config
     , Config
     , ConfigContent(..)
     , ConfigRange(..)
+    , CorrectionLocation(..)
     , DataPath
     , Degree(..)
     , DestinationTmpl(..)
@@ -48,6 +49,7 @@ module Hkl.Binoculars.Config
     , MaskLocation(..)
     , Meter(..)
     , NCores(..)
+    , ProfileLocation(..)
     , ProjectionType(..)
     , Resolutions(..)
     , RLimits(..)
@@ -335,6 +337,20 @@ instance FieldParsable ConfigRange where
 instance HasFieldValue ConfigRange where
   fieldvalue = parsable
 
+-- CorrectionLocation
+
+newtype CorrectionLocation = CorrectionLocation { unCorrectionLocation :: Text }
+    deriving (Eq, Show, IsString)
+
+instance Arbitrary CorrectionLocation where
+  arbitrary = pure $ CorrectionLocation "correction.npy"
+
+instance HasFieldValue CorrectionLocation where
+  fieldvalue = FieldValue
+    { fvParse = mapRight CorrectionLocation . fvParse text
+    , fvEmit = \(CorrectionLocation m) -> fvEmit text m
+    }
+
 -- DestinationTmpl
 
 newtype DestinationTmpl =
@@ -374,6 +390,8 @@ instance FieldEmitter HklBinocularsQCustomSubProjectionEnum where
   fieldEmitter HklBinocularsQCustomSubProjectionEnum'QxQzTimestamp        = "qx_qz_timestamp"
   fieldEmitter HklBinocularsQCustomSubProjectionEnum'QyQzTimestamp        = "qy_qz_timestamp"
   fieldEmitter HklBinocularsQCustomSubProjectionEnum'TthAzimuth        = "tth_azimuth"
+  fieldEmitter HklBinocularsQCustomSubProjectionEnum'Q                 = "q"
+  fieldEmitter HklBinocularsQCustomSubProjectionEnum'Tth               = "tth"
 
 instance FieldParsable HklBinocularsQCustomSubProjectionEnum where
   fieldParser = go . strip . uncomment . toLower =<< takeText
@@ -404,6 +422,28 @@ instance HasFieldComment HklBinocularsQCustomSubProjectionEnum where
                    ]
                    <> [" - " <> fvEmit fieldvalue v | v <- [minBound..maxBound :: HklBinocularsQCustomSubProjectionEnum]]
 
+-- HklBinocularsCubeAllocEnum
+
+instance HasFieldValue HklBinocularsCubeAllocEnum where
+  fieldvalue = FieldValue { fvParse = parse . strip . uncomment, fvEmit = emit }
+    where
+      err t = "Unsupported "
+              ++ show (typeRep (Proxy :: Proxy HklBinocularsCubeAllocEnum))
+              ++ " :" ++ unpack t
+              ++ " Supported ones are: "
+              ++ unpack (unwords $ Prelude.map emit [minBound..maxBound])
+
+      parse :: Text -> Either String HklBinocularsCubeAllocEnum
+      parse t = parseEnum (err t) t
+
+      emit :: HklBinocularsCubeAllocEnum -> Text
+      emit HklBinocularsCubeAllocEnum'Default    = "default"
+      emit HklBinocularsCubeAllocEnum'FirstTouch = "first_touch"
+      emit HklBinocularsCubeAllocEnum'Interleave = "interleave"
+      emit HklBinocularsCubeAllocEnum'Hugepage   = "hugepage"
+      emit HklBinocularsCubeAllocEnum'Hugetlb    = "hugetlb"
+      emit HklBinocularsCubeAllocEnum'Spill      = "spill"
+
 -- HklBinocularsSurfaceOrientationEnum
 
 instance HasFieldValue HklBinocularsSurfaceOrientationEnum where
@@ -620,6 +660,20 @@ instance HasFieldValue NCores where
     , fvEmit = \(NCores m) -> pack . show $ m
     }
 
+-- ProfileLocation
+
+newtype ProfileLocation = ProfileLocation { unProfileLocation :: Text }
+    deriving (Eq, Show, IsString)
+
+instance Arbitrary ProfileLocation where
+  arbitrary = pure $ ProfileLocation "profile.json"
+
+instance HasFieldValue ProfileLocation where
+  fieldvalue = FieldValue
+    { fvParse = mapRight ProfileLocation . fvParse text
+    , fvEmit = \(ProfileLocation m) -> fvEmit text m
+    }
+
 -- ProjectionType
 
 data ProjectionType = AnglesProjection
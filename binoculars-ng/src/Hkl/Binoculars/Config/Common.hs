@@ -35,9 +35,12 @@ module Hkl.Binoculars.Config.Common
     , parseFDef
     , parseMb
     , parseMbDef
+    , setCorrections
     ) where
 
 import           Control.Applicative               ((<|>))
+import           Control.Monad.Catch               (MonadThrow)
+import           Control.Monad.IO.Class            (MonadIO, liftIO)
 import           Data.HashMap.Lazy                 (fromList)
 import           Data.Ini                          (Ini (..))
 import           Data.Ini.Config                   (fieldMbOf, parseIniFile,
@@ -50,7 +53,7 @@ import           GHC.Generics                      (Generic)
 import           Generic.Random                    (genericArbitraryU)
 import           Numeric.Interval                  (singleton)
 import           Numeric.Units.Dimensional.Prelude (degree, meter, (*~))
-import           Path                              (Abs, Dir, Path)
+import           Path                              (Abs, Dir, Path, toFilePath)
 import           Test.QuickCheck                   (Arbitrary (..))
 
 import           Hkl.Binoculars.Config
@@ -64,6 +67,13 @@ data BinocularsConfig'Common
     { binocularsConfig'Common'NCores                 :: NCores
     , binocularsConfig'Common'Destination            :: DestinationTmpl
     , binocularsConfig'Common'Overwrite              :: Bool
+    , binocularsConfig'Common'Weighted               :: Bool
+    , binocularsConfig'Common'CubeAlloc              :: HklBinocularsCubeAllocEnum
+    , binocularsConfig'Common'PyramidLevels          :: Int
+    , binocularsConfig'Common'SortedScatter          :: Bool
+    , binocularsConfig'Common'InterleavedBins        :: Bool
+    , binocularsConfig'Common'NarrowCounters         :: Bool
+    , binocularsConfig'Common'MemoryBudget           :: Maybe Int
     , binocularsConfig'Common'InputType              :: InputType
     , binocularsConfig'Common'Nexusdir               :: Maybe (Path Abs Dir)
     , binocularsConfig'Common'Tmpl                   :: Maybe InputTmpl
@@ -72,15 +82,24 @@ data BinocularsConfig'Common
     , binocularsConfig'Common'Centralpixel           :: (Int, Int)
     , binocularsConfig'Common'Sdd                    :: Meter
     , binocularsConfig'Common'Detrot                 :: Degree
+    , binocularsConfig'Common'CoordinatesCache       :: Maybe (Path Abs Dir)
     , binocularsConfig'Common'AttenuationCoefficient :: Maybe Double
     , binocularsConfig'Common'AttenuationMax         :: Maybe Float
     , binocularsConfig'Common'AttenuationShift       :: Maybe Int
     , binocularsConfig'Common'Maskmatrix             :: Maybe MaskLocation
+    , binocularsConfig'Common'Dark                   :: Maybe CorrectionLocation
+    , binocularsConfig'Common'Flatfield              :: Maybe CorrectionLocation
+    , binocularsConfig'Common'SolidAngle             :: Maybe CorrectionLocation
     , binocularsConfig'Common'Wavelength             :: Maybe Double
     , binocularsConfig'Common'ImageSumMax            :: Maybe Double
     , binocularsConfig'Common'SkipFirstPoints        :: Maybe Int
     , binocularsConfig'Common'SkipLastPoints         :: Maybe Int
     , binocularsConfig'Common'PolarizationCorrection :: Bool
+    , binocularsConfig'Common'DirectChunkRead        :: Bool
+    , binocularsConfig'Common'FastTrigonometry       :: Bool
+    , binocularsConfig'Common'PixelSplitting         :: Int
+    , binocularsConfig'Common'Profile                :: Maybe ProfileLocation
+    , binocularsConfig'Common'ProfileTrace           :: Maybe ProfileLocation
     } deriving (Eq, Show, Generic)
 
 default'BinocularsConfig'Common :: BinocularsConfig'Common
@@ -89,6 +108,13 @@ default'BinocularsConfig'Common
     { binocularsConfig'Common'NCores = NCores 4
     , binocularsConfig'Common'Destination = DestinationTmpl "{projection}_{first}-{last}_{limits}.h5"
     , binocularsConfig'Common'Overwrite = False
+    , binocularsConfig'Common'Weighted = False
+    , binocularsConfig'Common'CubeAlloc = HklBinocularsCubeAllocEnum'Default
+    , binocularsConfig'Common'PyramidLevels = 0
+    , binocularsConfig'Common'SortedScatter = False
+    , binocularsConfig'Common'InterleavedBins = False
+    , binocularsConfig'Common'NarrowCounters = False
+    , binocularsConfig'Common'MemoryBudget = Nothing
     , binocularsConfig'Common'InputType = SixsFlyUhv
     , binocularsConfig'Common'Nexusdir = Nothing
     , binocularsConfig'Common'Tmpl = Nothing
@@ -97,15 +123,24 @@ default'BinocularsConfig'Common
     , binocularsConfig'Common'Centralpixel = (0, 0)
     , binocularsConfig'Common'Sdd = Meter (1 *~ meter)
     , binocularsConfig'Common'Detrot = Degree (0 *~ degree)
+    , binocularsConfig'Common'CoordinatesCache = Nothing
     , binocularsConfig'Common'AttenuationCoefficient = Nothing
     , binocularsConfig'Common'AttenuationMax = Nothing
     , binocularsConfig'Common'AttenuationShift = Nothing
     , binocularsConfig'Common'Maskmatrix = Nothing
+    , binocularsConfig'Common'Dark = Nothing
+    , binocularsConfig'Common'Flatfield = Nothing
+    , binocularsConfig'Common'SolidAngle = Nothing
     , binocularsConfig'Common'Wavelength = Nothing
     , binocularsConfig'Common'ImageSumMax = Nothing
     , binocularsConfig'Common'SkipFirstPoints = Nothing
     , binocularsConfig'Common'SkipLastPoints = Nothing
     , binocularsConfig'Common'PolarizationCorrection = False
+    , binocularsConfig'Common'DirectChunkRead = False
+    , binocularsConfig'Common'FastTrigonometry = False
+    , binocularsConfig'Common'PixelSplitting = 1
+    , binocularsConfig'Common'Profile = Nothing
+    , binocularsConfig'Common'ProfileTrace = Nothing
     }
 
 instance Arbitrary BinocularsConfig'Common where
@@ -138,6 +173,73 @@ instance ToIni  BinocularsConfig'Common where
                                                           , " `false` - the output is modifier and `_<number>` is added to the filename in order"
                                                           , " to avoid overwriting them."
                                                           ]
+                                                          <> elemFDef "weighted" binocularsConfig'Common'Weighted c default'BinocularsConfig'Common
+                                                          [ " `true` - also save the corrected intensities and their variances, summed in double,"
+                                                          , "          in the `intensities` and `variances` datasets next to the rounded `counts`."
+                                                          , "          the normalised cube is `intensities / contributions`."
+                                                          , " `false` - only save the rounded `counts`."
+                                                          ]
+                                                          <> elemFDef "cube_alloc" binocularsConfig'Common'CubeAlloc c default'BinocularsConfig'Common
+                                                          [ "the placement of the memory of the big cubes (bigger than a huge page)."
+                                                          , ""
+                                                          , " `default` - malloc, the pages are zeroed by the allocating thread."
+                                                          , " `first_touch` - the pages are on the NUMA node of the thread which fills them first."
+                                                          , " `interleave` - the pages are spread on all the NUMA nodes, for the merged cubes."
+                                                          , " `hugepage` - transparent huge pages, less TLB misses when accumulating."
+                                                          , " `hugetlb` - the huge pages reserved by the administrator, `hugepage` if none."
+                                                          , " `spill` - the pages of a temporary file, written back to the disk when the memory is short."
+                                                          ]
+                                                          <> elemFDef "pyramid_levels" binocularsConfig'Common'PyramidLevels c default'BinocularsConfig'Common
+                                                          [ "the number of levels of the pyramid saved next to the cube, for the viewers."
+                                                          , ""
+                                                          , "the level `l` is the cube `2^l` times coarser along each axis, its `counts`"
+                                                          , "and `contributions` are in the `binoculars/pyramid/level_<l>` group with its `axes`."
+                                                          , " `0` - no pyramid."
+                                                          ]
+                                                          <> elemFDef "sorted_scatter" binocularsConfig'Common'SortedScatter c default'BinocularsConfig'Common
+                                                          [ " `true` - sort the pixels of each frame by bins and sum the ones of a same bin"
+                                                          , "          before adding them into the cube, the writes stream through the big cubes."
+                                                          , " `false` - add the pixels into the cube in the order of the detector."
+                                                          ]
+                                                          <> elemFDef "interleaved_bins" binocularsConfig'Common'InterleavedBins c default'BinocularsConfig'Common
+                                                          [ " `true` - keep the counts and the contributions of each bin side by side while"
+                                                          , "          accumulating, each pixel touches one cache line instead of two."
+                                                          , "          the cubes are converted back before the merge and the save."
+                                                          , " `false` - keep the counts and the contributions in two arrays."
+                                                          ]
+                                                          <> elemFDef "narrow_counters" binocularsConfig'Common'NarrowCounters c default'BinocularsConfig'Common
+                                                          [ " `true` - count the counts and the contributions of each bin in 16 bits while"
+                                                          , "          accumulating, a block of bins switches to 32 bits when one of them"
+                                                          , "          overflows. it halves the memory of these arrays for the big cubes."
+                                                          , "          the saved files are the same. it takes precedence over `interleaved_bins`."
+                                                          , " `false` - count them in 32 bits."
+                                                          ]
+                                                          <> elemFMbDef "memory_budget" binocularsConfig'Common'MemoryBudget c default'BinocularsConfig'Common
+                                                          [ "the memory in MiB the cubes of a qcustom projection may use, the accumulation"
+                                                          , "is chosen from the size of the guessed cube:"
+                                                          , ""
+                                                          , " - one private cube per core when they all fit."
+                                                          , " - else one cube shared by all the cores."
+                                                          , " - else one shared cube spilled to a temporary file (see `cube_alloc`)."
+                                                          , ""
+                                                          , " `<not set>` - one private cube per core."
+                                                          ]
+                                                          <> elemFMbDef "profile" binocularsConfig'Common'Profile c default'BinocularsConfig'Common
+                                                          [ "time each stage of the projection on each thread and write a json summary."
+                                                          , ""
+                                                          , "the stages are: read, geometry, project (geometry included), accumulate,"
+                                                          , "merge and save. The time spent reading and decompressing the raw chunks"
+                                                          , "is also given when `direct_chunk_read` is `true`."
+                                                          , ""
+                                                          , " `<not set>` - no profiling."
+                                                          , " `a path`    - write the summary into this file."
+                                                          ]
+                                                          <> elemFMbDef "profile_trace" binocularsConfig'Common'ProfileTrace c default'BinocularsConfig'Common
+                                                          [ "write all the timed stages in the chrome trace format (chrome://tracing or perfetto)."
+                                                          , ""
+                                                          , " `<not set>` - no trace."
+                                                          , " `a path`    - write the trace into this file."
+                                                          ]
                                            )
                                          ,  ("input", elemFDef "type" binocularsConfig'Common'InputType c default'BinocularsConfig'Common
                                                       ([ "Define the experimental setup and the type of scan used to acquire the data"
@@ -215,6 +317,13 @@ instance ToIni  BinocularsConfig'Common where
                                                       , "detector position on the detector's arm when all motors"
                                                       , "are set equal to `0`."
                                                       ]
+                                                      <> elemFMbDef "coordinates_cache" binocularsConfig'Common'CoordinatesCache c default'BinocularsConfig'Common
+                                                      [ "a directory where the pixels coordinates calibrated with `centralpixel`, `sdd`"
+                                                      , "and `detrot` are kept, so the next runs and the other workers read them"
+                                                      , "instead of computing them again."
+                                                      , ""
+                                                      , " `<not set>` - the coordinates are only cached in memory by each process."
+                                                      ]
                                                       <> elemFMbDef "attenuation_coefficient" binocularsConfig'Common'AttenuationCoefficient c default'BinocularsConfig'Common
                                                       ["the attenuation coefficient used to correct the detector's data."
                                                       , ""
@@ -273,6 +382,27 @@ instance ToIni  BinocularsConfig'Common where
                                                       , ""
                                                       , "Most of the time a mask file was generated during ther experiment."
                                                       ]
+                                                      <> elemFMbDef "dark" binocularsConfig'Common'Dark c default'BinocularsConfig'Common
+                                                      [ "name of the .npy file (float64, shape of the detector) of the dark current"
+                                                      , "subtracted from the counts of each pixel."
+                                                      , ""
+                                                      , " `<not set>` - no dark current subtraction."
+                                                      ]
+                                                      <> elemFMbDef "flatfield" binocularsConfig'Common'Flatfield c default'BinocularsConfig'Common
+                                                      [ "name of the .npy file (float64, shape of the detector) of the flatfield."
+                                                      , "the counts of each pixel are divided by its value, the pixels at 0 do not count."
+                                                      , ""
+                                                      , " `<not set>` - no flatfield correction."
+                                                      ]
+                                                      <> elemFMbDef "solid_angle" binocularsConfig'Common'SolidAngle c default'BinocularsConfig'Common
+                                                      [ "name of the .npy file (float64, shape of the detector) of the solid angle"
+                                                      , "(or efficiency) of the pixels, the counts of each pixel are divided by its value."
+                                                      , ""
+                                                      , "These three corrections are applied by the projection itself, in the same"
+                                                      , "pass over the pixels."
+                                                      , ""
+                                                      , " `<not set>` - no solid angle correction."
+                                                      ]
                                                       <> elemFMbDef "wavelength" binocularsConfig'Common'Wavelength c default'BinocularsConfig'Common
                                                       [ "overwrite the wavelength from the data file with the one provided."
                                                       , ""
@@ -302,6 +432,28 @@ instance ToIni  BinocularsConfig'Common where
                                                       , " `false` - do not apply the polarization correction."
                                                       , " to avoid overwriting them."
                                                       ]
+                                                      <> elemFDef "direct_chunk_read" binocularsConfig'Common'DirectChunkRead c default'BinocularsConfig'Common
+                                                      [ " `true` - read the raw chunks of the images and decompress them on the readers threads."
+                                                      , "          only for one image per chunk, raw, deflate, lz4 or bitshuffle/lz4 chunks,"
+                                                      , "          the others are still read by the hdf5 library."
+                                                      , " `false` - the hdf5 library reads and decompresses the images."
+                                                      ]
+                                                      <> elemFDef "fast_trigonometry" binocularsConfig'Common'FastTrigonometry c default'BinocularsConfig'Common
+                                                      [ " `true` - compute the angles of the pixels with polynomial approximations"
+                                                      , "          of atan2, asin and acos (angles projection and the angles subprojections"
+                                                      , "          of qcustom). The maximum error is 1.2e-4 degree, so only the pixels"
+                                                      , "          this close to a bin edge may end in the neighbour bin."
+                                                      , " `false` - use the exact libm functions."
+                                                      ]
+                                                      <> elemFDef "pixel_splitting" binocularsConfig'Common'PixelSplitting c default'BinocularsConfig'Common
+                                                      [ "split each pixel in `n` x `n` sub-pixels (angles, qcustom and hkl projections)."
+                                                      , ""
+                                                      , " `1` - each pixel goes into the bin of its centre."
+                                                      , " `n` - each sub-pixel goes into the bin of its centre with the counts of its"
+                                                      , "       pixel, so the intensities are the mean of the pixels weighted by their area"
+                                                      , "       in the bin. This removes the moiré of the fine resolutions, for `n` x `n`"
+                                                      , "       times the projection time. At most 8."
+                                                      ]
                                             )
                                          ]
 
@@ -352,6 +504,13 @@ parse'BinocularsConfig'Common cfg mr (Capabilities ncapmax ncoresmax)
         pure $ NCores (minimum ns))
     <*> parseFDef cfg "dispatcher" "destination" (binocularsConfig'Common'Destination default'BinocularsConfig'Common)
     <*> parseFDef cfg "dispatcher" "overwrite" (binocularsConfig'Common'Overwrite default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "weighted" (binocularsConfig'Common'Weighted default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "cube_alloc" (binocularsConfig'Common'CubeAlloc default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "pyramid_levels" (binocularsConfig'Common'PyramidLevels default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "sorted_scatter" (binocularsConfig'Common'SortedScatter default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "interleaved_bins" (binocularsConfig'Common'InterleavedBins default'BinocularsConfig'Common)
+    <*> parseFDef cfg "dispatcher" "narrow_counters" (binocularsConfig'Common'NarrowCounters default'BinocularsConfig'Common)
+    <*> parseMb cfg "dispatcher" "memory_budget"
     <*> pure inputtype
     <*> parseMb cfg "input" "nexusdir"
     <*> parseMb cfg "input" "inputtmpl"
@@ -370,15 +529,35 @@ parse'BinocularsConfig'Common cfg mr (Capabilities ncapmax ncoresmax)
                    else error $ "The central pixel " <> show c <> " is not compatible with the detector")
     <*> parseFDef cfg "input" "sdd" (binocularsConfig'Common'Sdd default'BinocularsConfig'Common)
     <*> parseFDef cfg "input" "detrot" (binocularsConfig'Common'Detrot default'BinocularsConfig'Common)
+    <*> parseMb cfg "input" "coordinates_cache"
     <*> parseMb cfg "input" "attenuation_coefficient"
     <*> parseMb cfg "input" "attenuation_max"
     <*> parseMb cfg "input" "attenuation_shift"
     <*> parseMb cfg "input" "maskmatrix"
+    <*> parseMb cfg "input" "dark"
+    <*> parseMb cfg "input" "flatfield"
+    <*> parseMb cfg "input" "solid_angle"
     <*> parseMb cfg "input" "wavelength"
     <*> parseMb cfg "input" "image_sum_max"
     <*> parseMb cfg "input" "skip_first_points"
     <*> parseMb cfg "input" "skip_last_points"
     <*> parseFDef cfg "input" "polarization_correction" (binocularsConfig'Common'PolarizationCorrection default'BinocularsConfig'Common)
+    <*> parseFDef cfg "input" "direct_chunk_read" (binocularsConfig'Common'DirectChunkRead default'BinocularsConfig'Common)
+    <*> parseFDef cfg "input" "fast_trigonometry" (binocularsConfig'Common'FastTrigonometry default'BinocularsConfig'Common)
+    <*> parseFDef cfg "input" "pixel_splitting" (binocularsConfig'Common'PixelSplitting default'BinocularsConfig'Common)
+    <*> parseMb cfg "dispatcher" "profile"
+    <*> parseMb cfg "dispatcher" "profile_trace"
+
+-- | the per-pixel corrections applied by the projections kernels and
+-- the cache of the calibrated pixels coordinates
+setCorrections :: (MonadIO m, MonadThrow m) => BinocularsConfig'Common -> m ()
+setCorrections common = do
+  liftIO $ setPixelsCoordinatesCache (toFilePath <$> binocularsConfig'Common'CoordinatesCache common)
+  setDetectorCorrections
+    (binocularsConfig'Common'Detector common)
+    (unCorrectionLocation <$> binocularsConfig'Common'Dark common)
+    (unCorrectionLocation <$> binocularsConfig'Common'Flatfield common)
+    (unCorrectionLocation <$> binocularsConfig'Common'SolidAngle common)
 
 parse' :: HasFieldValue b => Text -> Text -> Text -> Either String (Maybe b)
 parse' c s f = parseIniFile c $ section s (fieldMbOf f auto')
@@ -17,27 +17,60 @@
 -}
 
 module Hkl.Binoculars.Pipes
-  ( Chunk(..)
+  ( Accumulation(..)
+  , Checkpoint(..)
+  , Chunk(..)
   , ChunkP(..)
   , FramesP(..)
+  , Live(..)
+  , QueueStats(..)
+  , Shard(..)
   , accumulateP
+  , accumulateSharedP
+  , indexedChunks
+  , liveP
+  , planAccumulation
   , progress
+  , progressFrames
   , project
   , skipMalformed
   , tryYield
+  , withFramesQueue
+  , withNFrames
   , withProgressBar
   , withSpace
+  , withWorkQueue
+  , workQueueP
   ) where
 
-import           Control.Monad              (forever)
-import           Control.Monad.Catch        (tryJust)
+import           Control.Concurrent         (threadDelay)
+import           Control.Concurrent.Async   (concurrently,
+                                             replicateConcurrently)
+import           Control.Concurrent.STM     (atomically, isEmptyTBQueue,
+                                             isFullTBQueue, lengthTBQueue,
+                                             newTBQueueIO, readTBQueue,
+                                             writeTBQueue)
+import           Control.Monad              (forM_, forever, replicateM_,
+                                             when)
+import           Control.Monad.Catch        (catchAll, tryJust)
 import           Control.Monad.IO.Class     (MonadIO (liftIO))
-import           Data.IORef                 (IORef, readIORef)
-import           Pipes                      (Consumer, Pipe, Proxy, await,
-                                             yield)
-import           Pipes.Prelude              (mapM)
-import           Pipes.Safe                 (MonadSafe, SomeException, bracket,
-                                             catchP, displayException)
+import           Data.Aeson                 (decodeFileStrict', encodeFile)
+import           Data.IORef                 (IORef, atomicModifyIORef',
+                                             newIORef, readIORef, writeIORef)
+import qualified Data.Map.Strict            as Map
+import           Data.Maybe                 (fromMaybe, isNothing)
+import           Foreign.ForeignPtr         (withForeignPtr)
+import           Pipes                      (Consumer, Pipe, Producer, Proxy,
+                                             await, each, runEffect, yield,
+                                             (>->))
+import           Pipes.Prelude              (chain, map, mapM, toListM)
+import           Pipes.Safe                 (MonadSafe, SafeT, SomeException,
+                                             bracket, catchP, displayException,
+                                             runSafeT)
+import           System.Directory           (doesFileExist,
+                                             getModificationTime, renameFile)
+import           System.FilePath            (takeDirectory, takeFileName,
+                                             (</>))
 import           System.ProgressBar         (Progress (..), ProgressBar,
                                              Style (..), defStyle, elapsedTime,
                                              incProgress, newProgressBar,
@@ -46,10 +79,12 @@ import           System.ProgressBar         (Progress (..), ProgressBar,
 import           Prelude                    hiding (filter)
 
 import           Hkl.Binoculars.Common
+import           Hkl.Binoculars.Profile
 import           Hkl.Binoculars.Projections
 import           Hkl.C.Binoculars
 import           Hkl.DataSource
 import           Hkl.Detector
+import           Hkl.Image                  (imagePool, imagePoolRelease)
 import           Hkl.Repa
 
 -- class ChunkP
@@ -73,8 +108,23 @@ project :: (MonadSafe m, Shape sh)
         -> Int
         -> (Space sh -> b -> IO (DataFrameSpace sh))
         -> Pipe b (DataFrameSpace sh) m ()
-project d n f = withSpace d n $ \s -> Pipes.Prelude.mapM (liftIO . f s)
+project d n f = withSpace d n $ \s -> Pipes.Prelude.mapM (liftIO . release s)
+  where
+    -- the image buffer goes back to the pool once projected, only
+    -- the space is used downstream.
+    release s b = do
+      r@(DataFrameSpace img _ _) <- timed Stage'Project (f s b)
+      imagePoolRelease imagePool img
+      pure r
+
 
+-- | project an image which is the sum of n frames, each of its
+-- pixels counts for n contributions.
+withNFrames :: (Space sh -> b -> IO (DataFrameSpace sh))
+            -> Space sh -> (Int, b) -> IO (DataFrameSpace sh)
+withNFrames f s@(Space fSpace) (n, b) = do
+  withForeignPtr fSpace $ \p -> c'hkl_binoculars_space_n_frames_set p (toEnum n)
+  f s b
 
 skipMalformed :: MonadSafe m
               => Proxy a' a b' b m r
@@ -87,11 +137,160 @@ skipMalformed p = loop
 
 -- ProgressBar
 
-withProgressBar :: Int -> (ProgressBar () -> IO ()) -> IO ()
+withProgressBar :: Int -> (ProgressBar () -> IO r) -> IO r
 withProgressBar ntot f = do
   pb <- newProgressBar defStyle{ stylePostfix=elapsedTime renderDuration } 10 (Progress 0 ntot ())
-  f pb
+  r <- f pb
   updateProgress pb $ \p@(Progress _ t _) -> p{progressDone=t}
+  pure r
+
+-- Frames queue
+
+-- | the backpressure of the frames queue
+data QueueStats = QueueStats
+  { queueStats'ReaderWaits :: !Int -- ^ the readers found the queue full
+  , queueStats'WorkerWaits :: !Int -- ^ the workers found the queue empty
+  , queueStats'MaxDepth    :: !Int -- ^ the maximum number of queued frames
+  } deriving Show
+
+-- Work queue
+
+-- | pull the work from a queue shared between the workers
+workQueueP :: MonadIO m => IORef [a] -> Producer a m ()
+workQueueP ref = loop
+  where
+    loop = do
+      mx <- liftIO $ atomicModifyIORef' ref pop
+      case mx of
+        Nothing  -> pure ()
+        (Just x) -> yield x >> loop
+
+    pop []       = ([], Nothing)
+    pop (x : xs) = (xs, Just x)
+
+-- | n workers sharing the work, instead of static jobs
+withWorkQueue :: Int -> [a] -> (Producer a (SafeT IO) () -> IO r) -> IO [r]
+withWorkQueue n xs worker = do
+  ref <- newIORef xs
+  replicateConcurrently n (worker (workQueueP ref))
+
+-- | the index of the chunks of the files of a directory, the
+-- modification time of each file, the key of the datapaths and
+-- skipped points and its chunk.
+type ChunksIndex = Map.Map FilePath (String, String, Int, Int)
+
+chunksIndexFile :: FilePath -> FilePath
+chunksIndexFile d = d </> ".binoculars-chunks.json"
+
+readChunksIndex :: FilePath -> IO ChunksIndex
+readChunksIndex d = do
+  let f = chunksIndexFile d
+  exist <- doesFileExist f
+  if exist
+    then (fromMaybe Map.empty <$> decodeFileStrict' f) `catchAll` const (pure Map.empty)
+    else pure Map.empty
+
+-- | the data directories may be read only, the index is then not saved
+writeChunksIndex :: FilePath -> ChunksIndex -> IO ()
+writeChunksIndex d idx = do
+  let f = chunksIndexFile d
+  let tmp = f ++ ".tmp"
+  (encodeFile tmp idx >> renameFile tmp f) `catchAll` const (pure ())
+
+-- | the chunks of the files, in their order. The files are read by n
+-- threads, and their chunks are indexed in each directory, so the
+-- files not modified since a previous run with the same datapaths
+-- are not read again.
+indexedChunks :: (ChunkP a, Show a)
+              => Int -> Maybe Int -> Maybe Int -> a -> [FilePath]
+              -> IO [Chunk Int FilePath]
+indexedChunks n mSkipFirst mSkipLast a fns = do
+  let key = show (mSkipFirst, mSkipLast, a)
+  let dirs = Map.fromListWith (++) [(takeDirectory fn, [fn]) | fn <- fns]
+  indexes <- Map.traverseWithKey (\d _ -> readChunksIndex d) dirs
+
+  mtimes <- Map.fromList <$> Prelude.mapM (\fn -> (,) fn . show <$> getModificationTime fn) fns
+
+  let cached fn = do
+        idx <- Map.lookup (takeDirectory fn) indexes
+        (t, k, from, to) <- Map.lookup (takeFileName fn) idx
+        if Just t == Map.lookup fn mtimes && k == key
+          then Just (Chunk fn from to)
+          else Nothing
+  let missing = [fn | fn <- fns, isNothing (cached fn)]
+
+  rs <- withWorkQueue (max 1 (min n (length missing))) missing
+        (\p -> runSafeT $ toListM $ p >-> chunkP mSkipFirst mSkipLast a)
+  let read' = Map.fromList [(fn, c) | c@(Chunk fn _ _) <- concat rs]
+
+  -- update the indexes of the directories with new chunks
+  forM_ (Map.toList dirs) $ \(d, fs) -> do
+    let new = Map.fromList [ (takeFileName fn, (t, key, from, to))
+                           | fn <- fs
+                           , (Just (Chunk _ from to)) <- [Map.lookup fn read']
+                           , (Just t) <- [Map.lookup fn mtimes]
+                           ]
+    if Map.null new
+      then pure ()
+      else writeChunksIndex d (Map.union new (Map.findWithDefault Map.empty d indexes))
+
+  pure [c | fn <- fns, (Just c) <- [maybe (Map.lookup fn read') Just (cached fn)]]
+
+-- | n readers pulling the chunks from a work queue read the frames
+-- into a bounded queue consumed by m workers, so the reading and the
+-- projection overlap. Each frame owns its image buffer from the
+-- image pool, so it can be queued as is.
+withFramesQueue :: Int -- ^ depth of the queue
+                -> Int -- ^ number of readers
+                -> Int -- ^ number of workers
+                -> [Chunk Int FilePath] -- ^ the work of the readers
+                -> Pipe (FilePath, [Int]) a (SafeT IO) () -- ^ the reader
+                -> (Producer a (SafeT IO) () -> IO r) -- ^ the worker
+                -> IO ([r], QueueStats)
+withFramesQueue depth n m work reader worker = do
+  q <- newTBQueueIO (toEnum depth)
+  readerWaits <- newIORef 0
+  workerWaits <- newIORef 0
+  maxDepth <- newIORef 0
+
+  let incr ref = atomicModifyIORef' ref (\w -> (w + 1, ()))
+
+  let push x = do
+        full <- atomically $ isFullTBQueue q
+        when full $ incr readerWaits
+        d <- atomically $ writeTBQueue q x >> lengthTBQueue q
+        atomicModifyIORef' maxDepth (\m -> (max m (fromEnum d), ()))
+        metricsQueueDepth (fromEnum d)
+
+  let pop = do
+        empty <- atomically $ isEmptyTBQueue q
+        when empty $ incr workerWaits
+        (x, d) <- atomically $ (,) <$> readTBQueue q <*> lengthTBQueue q
+        metricsQueueDepth (fromEnum d)
+        pure x
+
+  let fromQueue = do
+        mx <- liftIO pop
+        case mx of
+          Nothing  -> pure ()
+          (Just x) -> yield x >> fromQueue
+
+  (_, rs) <- concurrently
+             (do _ <- withWorkQueue n work (\chunks -> runSafeT $ runEffect $
+                                                    chunks
+                                                    >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f..t]))
+                                                    >-> reader
+                                                    >-> forever (await >>= liftIO . push . Just)
+                                           )
+                 -- one end of stream per worker
+                 replicateM_ m (push Nothing))
+             (replicateConcurrently m (worker fromQueue))
+
+  stats <- QueueStats
+           <$> readIORef readerWaits
+           <*> readIORef workerWaits
+           <*> readIORef maxDepth
+  pure (rs, stats)
 
 --  Create the Cube
 
@@ -99,20 +298,119 @@ accumulateP :: (MonadIO m, Shape sh)
             => IORef (Cube sh) -> Consumer (DataFrameSpace sh) m ()
 accumulateP ref =
     forever $ do s <- await
-                 liftIO $ addSpace s =<< readIORef ref
+                 liftIO $ timed Stage'Accumulate (addSpace s =<< readIORef ref)
+
+-- | the workers share one cube, the spaces outside of it go into
+-- their own overflow cube
+accumulateSharedP :: (MonadIO m, Shape sh)
+                  => Cube sh -> IORef (Cube sh) -> Consumer (DataFrameSpace sh) m ()
+accumulateSharedP shared ref =
+    forever $ do s <- await
+                 liftIO $ timed Stage'Accumulate (writeIORef ref =<< addSpaceShared shared s =<< readIORef ref)
+
+-- Accumulation planner
+
+-- | how the workers accumulate their frames
+data Accumulation = Accumulation'Private -- ^ one private cube per worker
+                  | Accumulation'Shared -- ^ one cube shared by the workers
+                  | Accumulation'Spill -- ^ one shared cube spilled to a temporary file
+  deriving (Eq, Show)
+
+-- | the accumulation of n workers within the memory budget in bytes,
+-- from the size of the guessed cube. Besides the accumulators, the
+-- guessed cube and the merged one are also in memory.
+planAccumulation :: Int -> Maybe Int -> Int -> Accumulation
+planAccumulation _ Nothing _ = Accumulation'Private
+planAccumulation n (Just budget) bytes
+  | (n + 2) * bytes <= budget = Accumulation'Private
+  | 3 * bytes <= budget = Accumulation'Shared
+  | otherwise = Accumulation'Spill
 
 progress :: MonadIO m => ProgressBar s -> Consumer a m ()
 progress p = forever $ do
   _ <- await
   liftIO $ p `incProgress` 1
 
+-- | count the n frames of each summed image
+progressFrames :: MonadIO m => ProgressBar s -> Pipe (Int, a) (Int, a) m r
+progressFrames p = chain $ \(n, _) -> liftIO $ p `incProgress` n
+
 tryYield :: MonadSafe m
          => IO r -> Proxy x' x () r m ()
 tryYield io = do
-  edf <- liftIO $ tryJust selectHklBinocularsException io
+  edf <- liftIO $ tryJust selectHklBinocularsException (timed Stage'Read io)
   case edf of
     Left _   -> return ()
     Right df -> yield df
   where
     selectHklBinocularsException :: HklBinocularsException -> Maybe HklBinocularsException
     selectHklBinocularsException = Just
+
+-- Live
+
+-- the frames are projected while they are written into the files.
+data Live = Live
+            Int -- save a snapshot of the cube every n frames
+            Int -- stop after this number of seconds without new frame
+            (Maybe Int) -- serve the OpenMetrics on this port
+            (Maybe String) -- of this address, the loopback by default
+  deriving Show
+
+-- | the partial cube of a long projection and its projected frames
+-- are saved regularly, so a run which did not finish can be resumed.
+data Checkpoint = Checkpoint
+                  (Maybe Int) -- save a checkpoint every n frames
+                  Bool -- resume from the checkpoint of a previous run
+  deriving Show
+
+-- | the projection split between the nodes of a cluster. Each shard
+-- saves its own cube with its projected frames, so a failed shard is
+-- run again alone and resumes from its own cube.
+data Shard = Shard
+             Int -- project the shard i (from 1)
+             Int -- of n shards
+           | ShardsMerge
+             Int -- merge the cubes of the n shards into the output
+             (Int, Int) -- only the part j (from 1) of m of a zarr output
+  deriving Show
+
+-- poll the files, project their new frames into an in-memory cube and
+-- publish a snapshot of the partial cube every n frames. The files
+-- are listed again at each poll, in order to follow the new scans.
+-- The snapshot is written next to the output and renamed, so a
+-- reader never sees a partially written file. The metrics of the
+-- projection can be scraped during the run.
+liveP :: Shape sh
+      => Live
+      -> FilePath
+      -> String
+      -> IO [FilePath]
+      -> Pipe FilePath (Chunk Int FilePath) (SafeT IO) ()
+      -> Pipe (FilePath, [Int]) (DataFrameSpace sh) (SafeT IO) ()
+      -> IO ()
+liveP (Live every timeout mPort mAddress) output conf getFiles chunksP spacesP = withMetrics mAddress mPort $ do
+  c <- withCubeAccumulator EmptyCube $ \ref -> loop ref Map.empty 0 0
+  saveCube output conf [c]
+  where
+    loop ref dones n idle = do
+      fns <- getFiles `catchAll` const (pure [])
+      chunks <- runSafeT $ toListM $ each fns >-> chunksP
+      let todo = [ (fn, [next..t])
+                 | (Chunk fn f t) <- chunks
+                 , let next = max f (Map.findWithDefault f fn dones)
+                 , next <= t
+                 ]
+      let n' = n + sum (Prelude.map (length . snd) todo)
+      runSafeT $ runEffect $ each todo >-> spacesP >-> accumulateP ref
+      metricsCube =<< readIORef ref
+      when (quot n' (max 1 every) > quot n (max 1 every)) $ do
+        let tmp = output ++ ".part"
+        saveCube tmp conf . pure =<< readIORef ref
+        saved <- doesFileExist tmp
+        when saved $ renameFile tmp output
+      let dones' = foldr (\(Chunk fn _ t) -> Map.insert fn (t + 1)) dones chunks
+      if n' /= n
+        then loop ref dones' n' 0
+        else when (idle < timeout) $ do
+               threadDelay 1000000
+               loop ref dones' n' (idle + 1)
@@ -0,0 +1,251 @@
+{-# LANGUAGE OverloadedStrings #-}
+
+{-
+    Copyright  : Copyright (C) 2014-2024 Synchrotron SOLEIL
+                                         L'Orme des Merisiers Saint-Aubin
+                                         BP 48 91192 GIF-sur-YVETTE CEDEX
+    License    : GPL3+
+
+    Maintainer : Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+    Stability  : Experimental
+    Portability: GHC only (not tested)
+-}
+
+module Hkl.Binoculars.Profile
+    ( Stage(..)
+    , metricsCube
+    , metricsQueueDepth
+    , profileStart
+    , profileStop
+    , timed
+    , timedWith
+    , withMetrics
+    ) where
+
+import           Control.Concurrent    (myThreadId)
+import           Control.Exception     (bracket_)
+import           Control.Monad         (forM_, when)
+import           Data.Aeson            (Value, encodeFile, object, (.=))
+import           Data.IORef            (IORef, atomicModifyIORef', newIORef,
+                                        readIORef, writeIORef)
+import qualified Data.Map.Strict       as Map
+import           Data.Text             (Text)
+import           Data.Word             (Word64)
+import           Foreign.C.String      (withCString)
+import           Foreign.ForeignPtr    (withForeignPtr)
+import           Foreign.Marshal.Alloc (alloca)
+import           Foreign.Ptr           (nullPtr)
+import           Foreign.Marshal.Utils (maybeWith)
+import           Foreign.Storable      (peek)
+import           GHC.Clock             (getMonotonicTimeNSec)
+import           System.IO.Unsafe      (unsafePerformIO)
+
+import           Hkl.C.Binoculars
+
+-- | the timed stages of the projections
+data Stage = Stage'Read       -- ^ read a frame (attenuation, geometry, image, ...)
+           | Stage'Geometry   -- ^ create the C geometry of a frame
+           | Stage'Project    -- ^ project a frame into a space, geometry included
+           | Stage'Accumulate -- ^ add a space into the cube of a worker
+           | Stage'Merge      -- ^ merge the cubes of the workers
+           | Stage'Save       -- ^ save the final cube
+  deriving (Bounded, Enum, Eq, Ord, Show)
+
+stageName :: Stage -> Text
+stageName Stage'Read       = "read"
+stageName Stage'Geometry   = "geometry"
+stageName Stage'Project    = "project"
+stageName Stage'Accumulate = "accumulate"
+stageName Stage'Merge      = "merge"
+stageName Stage'Save       = "save"
+
+-- | count, total and maximum duration in ns
+data Stats = Stats !Int !Word64 !Word64
+
+instance Semigroup Stats where
+  (Stats n t m) <> (Stats n' t' m') = Stats (n + n') (t + t') (max m m')
+
+-- | stage, thread, start and duration in ns
+data Event = Event !Stage !Int !Word64 !Word64
+
+data Profile
+  = Profile { profile'Enabled :: IORef Bool
+            , profile'Metrics :: IORef Bool -- ^ the OpenMetrics exporter is serving
+            , profile'Outputs :: IORef (Maybe FilePath, Maybe FilePath) -- ^ summary and trace
+            , profile'Start   :: IORef (Word64, (Word64, Word64, Word64)) -- ^ start and direct reads
+            , profile'Stats   :: IORef (Map.Map (Stage, Int) Stats)
+            , profile'Events  :: IORef [Event]
+            }
+
+-- | the profile of the process, shared by all the threads
+profile :: Profile
+profile = unsafePerformIO $ Profile
+          <$> newIORef False
+          <*> newIORef False
+          <*> newIORef (Nothing, Nothing)
+          <*> newIORef (0, (0, 0, 0))
+          <*> newIORef Map.empty
+          <*> newIORef []
+{-# NOINLINE profile #-}
+
+directTimes :: IO (Word64, Word64, Word64)
+directTimes =
+  alloca $ \pr ->
+  alloca $ \pd ->
+  alloca $ \pn -> do
+    c'hkl_binoculars_hdf5_read_frame_direct_times_get pr pd pn
+    (,,) <$> peek pr <*> peek pd <*> peek pn
+
+-- | start the profiling if a summary or a trace is expected
+profileStart :: Maybe FilePath -> Maybe FilePath -> IO ()
+profileStart Nothing Nothing = pure ()
+profileStart mSummary mTrace = do
+  t0 <- getMonotonicTimeNSec
+  ds <- directTimes
+  writeIORef (profile'Outputs profile) (mSummary, mTrace)
+  writeIORef (profile'Start profile) (t0, ds)
+  writeIORef (profile'Stats profile) Map.empty
+  writeIORef (profile'Events profile) []
+  writeIORef (profile'Enabled profile) True
+
+threadNumber :: IO Int
+threadNumber = read . last . words . show <$> myThreadId
+
+-- | the profiling and the metrics are enabled
+measuring :: IO (Bool, Bool)
+measuring = (,)
+            <$> readIORef (profile'Enabled profile)
+            <*> readIORef (profile'Metrics profile)
+
+record :: (Bool, Bool) -> Stage -> Word64 -> Word64 -> IO ()
+record (enabled, metrics) s t0 t1 = do
+  let d = t1 - t0
+  when metrics $
+    c'hkl_binoculars_metrics_stage_observe (toEnum . fromEnum $ s) (realToFrac (seconds d))
+  when enabled $ do
+    tid <- threadNumber
+    atomicModifyIORef' (profile'Stats profile) $ \m -> (Map.insertWith (<>) (s, tid) (Stats 1 d d) m, ())
+    (_, mTrace) <- readIORef (profile'Outputs profile)
+    forM_ mTrace $ \_ ->
+      atomicModifyIORef' (profile'Events profile) $ \es -> (Event s tid t0 d : es, ())
+
+-- | time an action when the profiling or the metrics are enabled
+timed :: Stage -> IO a -> IO a
+timed s io = do
+  m <- measuring
+  if m /= (False, False)
+    then do
+      t0 <- getMonotonicTimeNSec
+      r <- io
+      t1 <- getMonotonicTimeNSec
+      record m s t0 t1
+      pure r
+    else io
+
+-- | time the setup of a with function, until its continuation starts
+timedWith :: Stage -> ((a -> IO r) -> IO r) -> (a -> IO r) -> IO r
+timedWith s w f = do
+  m <- measuring
+  if m /= (False, False)
+    then do
+      t0 <- getMonotonicTimeNSec
+      w $ \a -> do
+        t1 <- getMonotonicTimeNSec
+        record m s t0 t1
+        f a
+    else w f
+
+-- | serve the OpenMetrics of the stages, the frames queue and the
+-- cube on the address (the loopback by default) and the port while
+-- the action runs
+withMetrics :: Maybe String -> Maybe Int -> IO a -> IO a
+withMetrics _ Nothing io = io
+withMetrics mAddress (Just port) io = do
+  served <- maybeWith withCString mAddress $ \address ->
+    c'hkl_binoculars_metrics_serve address (toEnum port)
+  if served == 0
+    then io
+    else bracket_
+         (writeIORef (profile'Metrics profile) True)
+         (writeIORef (profile'Metrics profile) False >> c'hkl_binoculars_metrics_stop)
+         io
+
+-- | the number of queued frames, when the metrics are served
+metricsQueueDepth :: Int -> IO ()
+metricsQueueDepth d = do
+  metrics <- readIORef (profile'Metrics profile)
+  when metrics $ c'hkl_binoculars_metrics_queue_depth_set (toEnum d)
+
+-- | the memory of the cube, when the metrics are served
+metricsCube :: Cube sh -> IO ()
+metricsCube c = do
+  metrics <- readIORef (profile'Metrics profile)
+  when metrics $ case c of
+    (Cube fp) -> withForeignPtr fp c'hkl_binoculars_metrics_cube_set
+    EmptyCube -> c'hkl_binoculars_metrics_cube_set nullPtr
+
+seconds :: Word64 -> Double
+seconds ns = fromIntegral ns / 1e9
+
+summary :: Word64 -> (Word64, Word64, Word64) -> Map.Map (Stage, Int) Stats -> Value
+summary wall (readUs, decodeUs, nFrames) stats =
+  object [ "wall_s" .= seconds wall
+         , "stages" .= [ stage s | s <- [minBound .. maxBound] ]
+         , "threads" .= [ thread tid | tid <- Map.keys threads ]
+         , "direct_chunk_read" .= object [ "frames" .= nFrames
+                                         , "read_s" .= seconds (readUs * 1000)
+                                         , "decode_s" .= seconds (decodeUs * 1000)
+                                         ]
+         ]
+  where
+    threads = Map.fromListWith (<>) [ (tid, [(s, st)]) | ((s, tid), st) <- Map.toList stats ]
+
+    stage s = let sts = [ st | ((s', _), st) <- Map.toList stats, s' == s ]
+                  (Stats n t m) = foldr (<>) (Stats 0 0 0) sts
+              in object [ "stage" .= stageName s
+                         , "count" .= n
+                         , "total_s" .= seconds t
+                         , "mean_s" .= (if n == 0 then 0 else seconds t / fromIntegral n)
+                         , "max_s" .= seconds m
+                         , "threads" .= length sts
+                         ]
+
+    thread tid = object [ "thread" .= tid
+                        , "stages" .= [ object [ "stage" .= stageName s
+                                               , "count" .= n
+                                               , "total_s" .= seconds t
+                                               ]
+                                      | (s, Stats n t _) <- Map.findWithDefault [] tid threads
+                                      ]
+                        ]
+
+-- | the chrome trace format, in µs
+trace :: Word64 -> [Event] -> Value
+trace t0 es =
+  object [ "displayTimeUnit" .= ("ms" :: Text)
+         , "traceEvents" .= [ object [ "name" .= stageName s
+                                     , "cat" .= ("binoculars" :: Text)
+                                     , "ph" .= ("X" :: Text)
+                                     , "ts" .= (fromIntegral (t - t0) / 1000 :: Double)
+                                     , "dur" .= (fromIntegral d / 1000 :: Double)
+                                     , "pid" .= (1 :: Int)
+                                     , "tid" .= tid
+                                     ]
+                            | (Event s tid t d) <- reverse es
+                            ]
+         ]
+
+-- | stop the profiling and write the summary and the trace
+profileStop :: IO ()
+profileStop = do
+  enabled <- readIORef (profile'Enabled profile)
+  when enabled $ do
+    writeIORef (profile'Enabled profile) False
+    t1 <- getMonotonicTimeNSec
+    (r1, d1, n1) <- directTimes
+    (t0, (r0, d0, n0)) <- readIORef (profile'Start profile)
+    (mSummary, mTrace) <- readIORef (profile'Outputs profile)
+    stats <- readIORef (profile'Stats profile)
+    es <- readIORef (profile'Events profile)
+    forM_ mSummary $ \f -> encodeFile f (summary (t1 - t0) (r1 - r0, d1 - d0, n1 - n0) stats)
+    forM_ mTrace $ \f -> encodeFile f (trace t0 es)
@@ -13,10 +13,20 @@
     Portability: GHC only (not tested)
 -}
 module Hkl.Binoculars.Projections
-  ( Space(..)
+  ( FramesRange
+  , Space(..)
   , cmd
+  , inputsIdentity
+  , isZarr
+  , loadCube
+  , mergeCubeFiles
   , newSpace
+  , sameInputs
   , saveCube
+  , saveCubeWithFrames
+  , saveCubesZarr
+  , saveInputs
+  , setFramesRoi
   , withMaybeLimits
   , withMaybeMask
   , withMaybeSampleAxis
@@ -26,26 +36,33 @@ module Hkl.Binoculars.Projections
   , withSampleAxis
   ) where
 
-import           Control.Monad              (zipWithM)
+import           Control.Concurrent         (getNumCapabilities)
+import           Control.Monad              (forM, void, zipWithM)
 import           Control.Monad.Catch        (MonadThrow)
 import           Control.Monad.IO.Class     (MonadIO (liftIO))
 import           Control.Monad.Logger       (MonadLogger, logDebugN)
 import           Control.Monad.Trans.Reader (ReaderT, runReaderT)
 import           Data.ByteString            (useAsCString)
 import           Data.Text.Encoding         (encodeUtf8)
-import           Foreign.C.String           (CString, withCString)
+import           Foreign.C.String           (CString, peekCString,
+                                             withCString)
 import           Foreign.C.Types            (CBool, CSize (..))
 import           Foreign.ForeignPtr         (ForeignPtr, newForeignPtr,
                                              withForeignPtr)
 import           Foreign.Marshal.Alloc      (alloca)
-import           Foreign.Marshal.Array      (withArrayLen)
+import           Foreign.Marshal.Array      (peekArray, withArrayLen)
 import           Foreign.Ptr                (Ptr, nullPtr)
-import           Foreign.Storable           (poke)
+import           Foreign.Storable           (peek, poke)
 import           GHC.Exts                   (IsList (..))
 
+import           System.Directory           (getFileSize,
+                                             getModificationTime)
+import           System.FilePath            (takeExtension)
+
 import           Prelude                    hiding (drop)
 
 import           Hkl.Binoculars.Config
+import           Hkl.Binoculars.Profile
 import           Hkl.C
 import           Hkl.Detector
 import           Hkl.Orphan                 ()
@@ -76,16 +93,121 @@ withNPixels d f = f (toEnum . size . shape $ d)
 withPixelsDims :: Array F DIM3 Double -> (Int -> Ptr CSize -> IO r) -> IO r
 withPixelsDims p = withArrayLen (map toEnum $ listOfShape . extent $ p)
 
+-- | merge the cubes and save the result, the merge of the slabs of
+-- the cube overlaps the write of the previous ones. An output with
+-- the .zarr extension is saved as a zarr directory.
 saveCube :: Shape sh => FilePath -> String -> [Cube sh] -> IO ()
-saveCube o conf rs = do
-  let c = mconcat rs
-  case c of
-    (Cube fp) ->
-      withCString o $ \fn ->
+saveCube o conf rs = saveCubes o conf Nothing rs
+
+saveCubes :: Shape sh => FilePath -> String -> Maybe [FramesRange] -> [Cube sh] -> IO ()
+saveCubes o conf _ rs | isZarr o = saveCubesZarr o conf (0, 1) rs
+saveCubes o conf mfrs rs = case [fp | Cube fp <- rs] of
+  []  -> return ()
+  fps -> do
+    n <- getNumCapabilities
+    withCString o $ \fn ->
       withCString conf $ \config ->
-      withForeignPtr fp $ \p ->
-            c'hkl_binoculars_cube_save_hdf5 fn config p
-    EmptyCube -> return ()
+      withForeignPtrs fps $ \ps ->
+      withArrayLen ps $ \n' ps' ->
+      case mfrs of
+        Nothing -> void $ timed Stage'Save (c'hkl_binoculars_cubes_save_hdf5_with_frames fn config (toEnum n') ps' (toEnum n) nullPtr 0)
+        (Just frs) -> withFramesRanges frs $ \nfrs frs' ->
+          void $ timed Stage'Save (c'hkl_binoculars_cubes_save_hdf5_with_frames fn config (toEnum n') ps' (toEnum n) frs' (toEnum nfrs))
+
+-- | the frames of a file already projected into a cube, first and
+-- last included.
+type FramesRange = (FilePath, Int, Int)
+
+withFramesRanges :: [FramesRange] -> (Int -> Ptr C'HklBinocularsFramesRange -> IO r) -> IO r
+withFramesRanges frs f = go frs []
+  where
+    go [] acc = withArrayLen (reverse acc) f
+    go ((fn, l, h) : xs) acc = withCString fn $ \fn' ->
+      go xs (C'HklBinocularsFramesRange fn' (toEnum l) (toEnum h) : acc)
+
+saveCubeWithFrames :: Shape sh => FilePath -> String -> [FramesRange] -> [Cube sh] -> IO ()
+saveCubeWithFrames o conf frs = saveCubes o conf (Just frs)
+
+-- | merge the cubes saved in the input files into the output, only
+-- one slab of the output and one slice of an input are in memory per
+-- thread. False if an input is not a saved cube or if the axes of the
+-- inputs differ.
+mergeCubeFiles :: FilePath -> [FilePath] -> IO Bool
+mergeCubeFiles o is = do
+  n <- getNumCapabilities
+  withCString o $ \fn ->
+    withCStrings is $ \n' fns ->
+    (/= 0) <$> c'hkl_binoculars_cubes_merge_hdf5 fn (toEnum n') fns (toEnum n)
+  where
+    withCStrings :: [FilePath] -> (Int -> Ptr CString -> IO r) -> IO r
+    withCStrings fns f = go fns []
+      where
+        go [] acc       = withArrayLen (reverse acc) f
+        go (x : xs) acc = withCString x $ \x' -> go xs (x' : acc)
+
+-- | the outputs saved as zarr directories
+isZarr :: FilePath -> Bool
+isZarr o = takeExtension o == ".zarr"
+
+-- | merge the cubes and write the part j (from 0) of m of a zarr
+-- output, each chunk in its own file, so the nodes of a cluster write
+-- their parts of the same output. Only the part 0 writes the
+-- metadata. The frames are not saved, a zarr output is not resumed.
+saveCubesZarr :: Shape sh => FilePath -> String -> (Int, Int) -> [Cube sh] -> IO ()
+saveCubesZarr o conf (j, m) rs = do
+  n <- getNumCapabilities
+  withCString o $ \fn ->
+    withCString conf $ \config ->
+    withForeignPtrs [fp | Cube fp <- rs] $ \ps ->
+    withArrayLen ps $ \n' ps' ->
+    void $ timed Stage'Save (c'hkl_binoculars_cubes_save_zarr fn config (toEnum n') ps' (toEnum n) (toEnum j) (toEnum m))
+
+-- | the cube and its projected frames, only if it was produced with
+-- the same config.
+loadCube :: Shape sh => FilePath -> String -> IO (Maybe (Cube sh, [FramesRange]))
+loadCube o conf =
+  withCString o $ \fn ->
+  withCString conf $ \config ->
+  alloca $ \pranges ->
+  alloca $ \pn -> do
+    p <- c'hkl_binoculars_cube_new_from_hdf5 fn config pranges pn
+    if p == nullPtr
+      then pure Nothing
+      else do
+        c <- newCube p
+        n <- peek pn
+        ranges <- peek pranges
+        frs' <- peekArray (fromEnum n) ranges
+        frs'' <- forM frs' $ \(C'HklBinocularsFramesRange fn' l h) -> do
+          fn'' <- peekCString fn'
+          pure (fn'', fromEnum l, fromEnum h)
+        c'hkl_binoculars_frames_ranges_free ranges n
+        pure $ Just (c, frs'')
+
+-- | the serialised config followed by the path, size and
+-- modification time of each input file. Two runs with the same
+-- identity produce the same cube.
+inputsIdentity :: String -> [FilePath] -> IO String
+inputsIdentity conf fns = do
+  fs <- forM fns $ \fn -> do
+    s <- getFileSize fn
+    t <- getModificationTime fn
+    pure $ unwords [fn, show s, show t]
+  pure $ unlines (conf : fs)
+
+-- | True when the output was saved from these inputs
+sameInputs :: FilePath -> String -> IO Bool
+sameInputs o inputs =
+  withCString o $ \fn ->
+  withCString inputs $ \inputs' ->
+    (/= 0) <$> c'hkl_binoculars_cube_inputs_hash_check_hdf5 fn inputs'
+
+-- | remember the inputs of a saved output
+saveInputs :: FilePath -> String -> IO ()
+saveInputs o inputs =
+  withCString o $ \fn ->
+  withCString inputs $ \inputs' ->
+    void $ c'hkl_binoculars_cube_inputs_hash_save_hdf5 fn inputs'
 
 newLimits :: Limits -> Double -> IO (ForeignPtr C'HklBinocularsAxisLimits)
 newLimits (Limits mmin mmax) res =
@@ -121,6 +243,24 @@ withMaybeMask mm f = case mm of
                        Nothing  -> f nullPtr
                        (Just m) -> withForeignPtr (toForeignPtr m) $ \ptr -> f ptr
 
+-- | read only the bounding box of the not masked pixels of the
+-- frames, when their chunks are smaller than a frame.
+setFramesRoi :: Maybe Mask -> IO ()
+setFramesRoi Nothing = c'hkl_binoculars_hdf5_frame_roi_set 0 0 0 0
+setFramesRoi (Just m) = do
+  let (Z :. h :. w) = extent m
+  withForeignPtr (toForeignPtr m) $ \ptr ->
+    alloca $ \r0 -> alloca $ \r1 -> alloca $ \c0 -> alloca $ \c1 -> do
+    res <- c'hkl_binoculars_detector_2d_mask_roi_get ptr (toEnum w) (toEnum h) r0 r1 c0 c1
+    if res == 0
+      then c'hkl_binoculars_hdf5_frame_roi_set 0 0 0 0
+      else do
+      r0' <- peek r0
+      r1' <- peek r1
+      c0' <- peek c0
+      c1' <- peek c1
+      c'hkl_binoculars_hdf5_frame_roi_set r0' r1' c0' c1'
+
 withMaybeSampleAxis :: Maybe SampleAxis -> (CString -> IO r) -> IO r
 withMaybeSampleAxis Nothing f  = f nullPtr
 withMaybeSampleAxis (Just a) f = withSampleAxis a f
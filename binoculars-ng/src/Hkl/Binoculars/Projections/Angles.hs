@@ -24,7 +24,6 @@ module Hkl.Binoculars.Projections.Angles
     , updateAngles
     ) where
 
-import           Control.Concurrent.Async           (mapConcurrently)
 import           Control.Monad.Catch                (MonadThrow)
 import           Control.Monad.IO.Class             (MonadIO (liftIO), liftIO)
 import           Control.Monad.Logger               (MonadLogger, logDebugN,
@@ -37,9 +36,10 @@ import           Data.Text.IO                       (putStr)
 import           Data.Vector.Storable.Mutable       (unsafeWith)
 import           Foreign.C.Types                    (CDouble (..))
 import           Foreign.ForeignPtr                 (withForeignPtr)
+import           GHC.Conc                           (setNumCapabilities)
 import           Path                               (Abs, Dir, Path)
 import           Pipes                              (each, runEffect, (>->))
-import           Pipes.Prelude                      (filter, map, tee, toListM)
+import           Pipes.Prelude                      (filter, map, tee)
 import           Pipes.Safe                         (runSafeT)
 import           Text.Printf                        (printf)
 
@@ -47,12 +47,14 @@ import           Hkl.Binoculars.Common
 import           Hkl.Binoculars.Config
 import           Hkl.Binoculars.Config.Common
 import           Hkl.Binoculars.Pipes
+import           Hkl.Binoculars.Profile
 import           Hkl.Binoculars.Projections
 import           Hkl.Binoculars.Projections.QCustom
 import           Hkl.C.Binoculars
 import           Hkl.Detector
 import           Hkl.Geometry
 import           Hkl.Image
+import           Hkl.Pipes                          (fileCacheStart, fileCacheStop)
 import           Hkl.Repa
 import           Hkl.Utils
 
@@ -135,7 +137,7 @@ instance ToIni (Config 'AnglesProjection) where
 spaceAngles :: Detector a DIM2 -> Array F DIM3 Double -> Resolutions DIM3 -> Maybe Mask -> Maybe (RLimits DIM3) -> SampleAxis -> Space DIM2 -> DataFrameQCustom -> IO (DataFrameSpace DIM2)
 spaceAngles det pixels rs mmask' mlimits sAxis space@(Space fSpace) (DataFrameQCustom att g img _) =
   withNPixels det $ \nPixels ->
-  withGeometry g $ \geometry ->
+  timedWith Stage'Geometry (withGeometry g) $ \geometry ->
   withForeignPtr (toForeignPtr pixels) $ \pix ->
   withResolutions rs $ \nr r ->
   withPixelsDims pixels $ \ndim dims ->
@@ -150,6 +152,12 @@ spaceAngles det pixels rs mmask' mlimits sAxis space@(Space fSpace) (DataFrameQC
       {-# SCC "hkl_binoculars_space_angles_uint16_t" #-} c'hkl_binoculars_space_angles_uint16_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) sampleAxis
     (ImageWord32 arr) -> unsafeWith arr $ \i -> do
       {-# SCC "hkl_binoculars_space_angles_uint32_t" #-} c'hkl_binoculars_space_angles_uint32_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) sampleAxis
+    (ImageWord8 arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_angles_uint8_t" #-} c'hkl_binoculars_space_angles_uint8_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) sampleAxis
+    (ImageInt16 arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_angles_int16_t" #-} c'hkl_binoculars_space_angles_int16_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) sampleAxis
+    (ImageFloat arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_angles_float" #-} c'hkl_binoculars_space_angles_float pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) sampleAxis
 
   return (DataFrameSpace img space att)
 
@@ -164,10 +172,22 @@ processAnglesP = do
 
   -- directly from the common config
   let common = binocularsConfig'Angles'Common conf
+  liftIO $ c'hkl_binoculars_hdf5_direct_chunk_read_set (toEnum . fromEnum $ binocularsConfig'Common'DirectChunkRead common)
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ binocularsConfig'Common'CubeAlloc common)
+  liftIO $ c'hkl_binoculars_hdf5_pyramid_set (toEnum $ binocularsConfig'Common'PyramidLevels common)
+  liftIO $ c'hkl_binoculars_cube_sorted_scatter_set (toEnum . fromEnum $ binocularsConfig'Common'SortedScatter common)
+  liftIO $ c'hkl_binoculars_cube_interleaved_set (toEnum . fromEnum $ binocularsConfig'Common'InterleavedBins common)
+  liftIO $ c'hkl_binoculars_cube_narrow_counters_set (toEnum . fromEnum $ binocularsConfig'Common'NarrowCounters common)
+  setCorrections common
+  liftIO $ c'hkl_binoculars_pixel_splitting_set (toEnum $ binocularsConfig'Common'PixelSplitting common)
+  liftIO $ c'hkl_binoculars_fast_trigonometry_set (toEnum . fromEnum $ binocularsConfig'Common'FastTrigonometry common)
 
   let overwrite = binocularsConfig'Common'Overwrite common
   let det = binocularsConfig'Common'Detector common
   let (NCores cap) =  binocularsConfig'Common'NCores common
+  -- the runtime starts on all the cores, keep only the ones of the config
+  liftIO $ setNumCapabilities cap
   let destination = binocularsConfig'Common'Destination common
   let centralPixel' = binocularsConfig'Common'Centralpixel common
   let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
@@ -191,11 +211,13 @@ processAnglesP = do
   output' <- liftIO $ destination' projectionType Nothing inputRange mlimits destination overwrite
   filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
   mask' <- getMask maskMatrix det
+  liftIO $ setFramesRoi mask'
   pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot Normalisation
   let fns = concatMap (replicate 1) (toList filenames)
-  chunks <- liftIO $ runSafeT $ toListM $ each fns >-> chunkP mSkipFirstPoints mSkipLastPoints datapaths
+  liftIO fileCacheStart
+  chunks <- liftIO $ indexedChunks cap mSkipFirstPoints mSkipLastPoints datapaths fns
   let ntot = sum (Prelude.map clength chunks)
-  let jobs = chunk (quot ntot cap) chunks
+  let work = workSlices cap chunks
 
   -- log parameters
 
@@ -220,18 +242,23 @@ processAnglesP = do
 
   logInfoN (pack $ printf "let's do a Angles projection of %d %s image(s) on %d core(s)" ntot (show det) cap)
 
+  -- time the stages of the final projection
+  liftIO $ profileStart (unpack . unProfileLocation <$> binocularsConfig'Common'Profile common) (unpack . unProfileLocation <$> binocularsConfig'Common'ProfileTrace common)
+
   liftIO $ withProgressBar ntot $ \pb -> do
-    r' <- mapConcurrently (\job -> withCubeAccumulator guessed $ \c ->
+    r' <- withWorkQueue cap work (\job -> withCubeAccumulator guessed $ \c ->
                              runSafeT $ runEffect $
-                             each job
+                             job
                              >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f..t]))
                              >-> framesP datapaths
                              >-> Pipes.Prelude.filter (\(DataFrameQCustom _ _ img _) -> filterSumImage mImageSumMax img)
                              >-> project det 3 (spaceAngles det pixels res mask' mlimits sampleAxis)
                              >-> tee (accumulateP c)
                              >-> progress pb
-                         ) jobs
+                         )
     saveCube output' (unpack . serializeConfig $ conf) r'
+    profileStop
+    fileCacheStop
 
 ---------
 -- Cmd --
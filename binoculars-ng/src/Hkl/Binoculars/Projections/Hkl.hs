@@ -31,7 +31,6 @@ module Hkl.Binoculars.Projections.Hkl
     ) where
 
 
-import           Control.Concurrent.Async           (mapConcurrently)
 import           Control.Monad.Catch                (MonadThrow)
 import           Control.Monad.IO.Class             (MonadIO (liftIO))
 import           Control.Monad.Logger               (MonadLogger, logDebugN,
@@ -51,11 +50,12 @@ import           Data.Text.IO                       (putStr)
 import           Data.Vector.Storable.Mutable       (unsafeWith)
 import           Foreign.C.Types                    (CDouble (..))
 import           Foreign.ForeignPtr                 (withForeignPtr)
+import           GHC.Conc                           (setNumCapabilities)
 import           GHC.Generics                       (Generic)
 import           Path                               (Abs, Dir, Path)
 import           Pipes                              (await, each, runEffect,
                                                      (>->))
-import           Pipes.Prelude                      (filter, map, tee, toListM)
+import           Pipes.Prelude                      (filter, map, tee)
 import           Pipes.Safe                         (runSafeP, runSafeT)
 import           Text.Printf                        (printf)
 
@@ -64,6 +64,7 @@ import           Hkl.Binoculars.Config
 import           Hkl.Binoculars.Config.Common
 import           Hkl.Binoculars.Config.Sample
 import           Hkl.Binoculars.Pipes
+import           Hkl.Binoculars.Profile
 import           Hkl.Binoculars.Projections
 import           Hkl.Binoculars.Projections.QCustom
 import           Hkl.C.Binoculars
@@ -192,7 +193,7 @@ instance ToIni (Config 'HklProjection) where
 spaceHkl :: Detector b DIM2 -> Array F DIM3 Double -> Resolutions DIM3 -> Maybe Mask -> Maybe (RLimits DIM3) -> Bool -> Space DIM3 -> DataFrameHkl' Identity -> IO (DataFrameSpace DIM3)
 spaceHkl det pixels rs mmask' mlimits doPolarizationCorrection space@(Space fSpace) (DataFrameHkl (DataFrameQCustom att g img _) samplePath) = do
   withNPixels det $ \nPixels ->
-    withGeometry g $ \geometry ->
+    timedWith Stage'Geometry (withGeometry g) $ \geometry ->
     withSample samplePath $ \sample ->
     withForeignPtr (toForeignPtr pixels) $ \pix ->
     withResolutions rs $ \nr r ->
@@ -207,6 +208,12 @@ spaceHkl det pixels rs mmask' mlimits doPolarizationCorrection space@(Space fSpa
         {-# SCC "hkl_binoculars_space_hkl_uint16_t" #-} c'hkl_binoculars_space_hkl_uint16_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
       (ImageWord32 arr) -> unsafeWith arr $ \i -> do
         {-# SCC "hkl_binoculars_space_hkl_uint32_t" #-} c'hkl_binoculars_space_hkl_uint32_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageWord8 arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "hkl_binoculars_space_hkl_uint8_t" #-} c'hkl_binoculars_space_hkl_uint8_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageInt16 arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "hkl_binoculars_space_hkl_int16_t" #-} c'hkl_binoculars_space_hkl_int16_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageFloat arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "hkl_binoculars_space_hkl_float" #-} c'hkl_binoculars_space_hkl_float pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
     return (DataFrameSpace img space att)
 
 ----------
@@ -220,10 +227,21 @@ processHklP = do
 
   -- directly from the common config
   let common = binocularsConfig'Hkl'Common conf
+  liftIO $ c'hkl_binoculars_hdf5_direct_chunk_read_set (toEnum . fromEnum $ binocularsConfig'Common'DirectChunkRead common)
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ binocularsConfig'Common'CubeAlloc common)
+  liftIO $ c'hkl_binoculars_hdf5_pyramid_set (toEnum $ binocularsConfig'Common'PyramidLevels common)
+  liftIO $ c'hkl_binoculars_cube_sorted_scatter_set (toEnum . fromEnum $ binocularsConfig'Common'SortedScatter common)
+  liftIO $ c'hkl_binoculars_cube_interleaved_set (toEnum . fromEnum $ binocularsConfig'Common'InterleavedBins common)
+  liftIO $ c'hkl_binoculars_cube_narrow_counters_set (toEnum . fromEnum $ binocularsConfig'Common'NarrowCounters common)
+  setCorrections common
+  liftIO $ c'hkl_binoculars_pixel_splitting_set (toEnum $ binocularsConfig'Common'PixelSplitting common)
 
   let overwrite = binocularsConfig'Common'Overwrite common
   let det = binocularsConfig'Common'Detector common
   let (NCores cap) =  binocularsConfig'Common'NCores common
+  -- the runtime starts on all the cores, keep only the ones of the config
+  liftIO $ setNumCapabilities cap
   let destination = binocularsConfig'Common'Destination common
   let centralPixel' = binocularsConfig'Common'Centralpixel common
   let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
@@ -248,12 +266,14 @@ processHklP = do
   output' <- liftIO $ destination' projectionType Nothing inputRange mlimits destination overwrite
   filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
   mask' <- getMask maskMatrix det
+  liftIO $ setFramesRoi mask'
   pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot NoNormalisation
 
   let fns = concatMap (replicate 1) (toList filenames)
-  chunks <- liftIO $ runSafeT $ toListM $ each fns >-> chunkP mSkipFirstPoints mSkipLastPoints datapaths
+  liftIO fileCacheStart
+  chunks <- liftIO $ indexedChunks cap mSkipFirstPoints mSkipLastPoints datapaths fns
   let ntot = sum (Prelude.map clength chunks)
-  let jobs = chunk (quot ntot cap) chunks
+  let work = workSlices cap chunks
 
   -- log parameters
 
@@ -276,10 +296,13 @@ processHklP = do
 
   logInfoN (pack $ printf "let's do an Hkl projection of %d %s image(s) on %d core(s)" ntot (show det) cap)
 
+  -- time the stages of the final projection
+  liftIO $ profileStart (unpack . unProfileLocation <$> binocularsConfig'Common'Profile common) (unpack . unProfileLocation <$> binocularsConfig'Common'ProfileTrace common)
+
   liftIO $ withProgressBar ntot $ \pb -> do
-    r' <- mapConcurrently (\job -> withCubeAccumulator guessed $ \c ->
+    r' <- withWorkQueue cap work (\job -> withCubeAccumulator guessed $ \c ->
                              runEffect $ runSafeP $
-                             each job
+                             job
                              >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f..t]))
                              -- >-> tee Pipes.Prelude.print
                              >-> framesP datapaths
@@ -287,8 +310,10 @@ processHklP = do
                              >-> project det 3 (spaceHkl det pixels res mask' mlimits doPolarizationCorrection)
                              >-> tee (accumulateP c)
                              >-> progress pb
-                         ) jobs
+                         )
     saveCube output' (unpack . serializeConfig $ conf) r'
+    profileStop
+    fileCacheStop
 
 -- FramesHklP
 
@@ -298,7 +323,7 @@ instance ChunkP (DataFrameHkl' DataSourcePath) where
 instance FramesP (DataFrameHkl' DataSourcePath) (DataFrameHkl' Identity) where
   framesP (DataFrameHkl qcustom sample) = skipMalformed $ forever $ do
     (fp, js) <- await
-    withFileP (openFile' fp) $ \f ->
+    withCachedFileP fp $ \f ->
       withDataSourceP f qcustom $ \qcustomAcq ->
       withDataSourceP f sample $ \sampleAcq ->
       forM_ js (\j -> tryYield ( DataFrameHkl
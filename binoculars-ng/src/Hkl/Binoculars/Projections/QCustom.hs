@@ -34,44 +34,63 @@ module Hkl.Binoculars.Projections.QCustom
     , newQCustom
     , overload'DataSourcePath'DataFrameQCustom
     , processQCustom
+    , spaceQCustom
+    , suggestQCustom
     , updateQCustom
     ) where
 
 import           Control.Applicative               ((<|>))
-import           Control.Concurrent.Async          (mapConcurrently)
+import           Control.Exception                 (bracket)
 import           Control.Monad.Catch               (MonadThrow)
 import           Control.Monad.IO.Class            (MonadIO (liftIO))
 import           Control.Monad.Logger              (MonadLogger, logDebugN,
-                                                    logInfoN)
-import           Control.Monad.Reader              (MonadReader, ask, forM_,
-                                                    forever)
+                                                    logErrorN, logInfoN)
+import           Control.Monad.Reader              (MonadReader, ask, foldM,
+                                                    forM_, forever, when)
 import           Data.Aeson                        (FromJSON, ToJSON,
                                                     eitherDecode', encode)
 import           Data.ByteString.Lazy              (fromStrict, toStrict)
 import           Data.HashMap.Lazy                 (fromList)
 import           Data.Ini                          (Ini (..))
 import           Data.Ini.Config.Bidir             (FieldValue (..))
-import           Data.Maybe                        (fromJust, fromMaybe)
+import           Data.List                         (intercalate)
+import           Data.Maybe                        (catMaybes, fromJust,
+                                                    fromMaybe, isJust,
+                                                    isNothing)
 import           Data.Text                         (pack, unpack)
 import           Data.Text.Encoding                (decodeUtf8, encodeUtf8)
 import           Data.Text.IO                      (putStr)
+import qualified Data.Vector.Storable              as V
 import           Data.Vector.Storable.Mutable      (unsafeWith)
+import           Data.Word                         (Word64)
 import           Foreign.C.Types                   (CDouble (..))
 import           Foreign.ForeignPtr                (withForeignPtr)
+import           Foreign.Marshal.Alloc             (alloca)
+import           Foreign.Marshal.Array             (allocaArray, peekArray)
+import           Foreign.Storable                  (peek)
+import           GHC.Conc                          (setNumCapabilities)
 import           GHC.Generics                      (Generic)
 import           Numeric.Units.Dimensional.Prelude (Angle, degree, radian, (*~),
                                                     (/~))
 import           Path                              (Abs, Dir, Path)
-import           Pipes                             (await, each, runEffect,
+import           Pipes                             (Producer, await, each,
+                                                    lift, next, runEffect,
                                                     yield, (>->))
-import           Pipes.Prelude                     (filter, map, tee, toListM)
-import           Pipes.Safe                        (runSafeT)
+import           Pipes.Prelude                     (filter, filterM, map,
+                                                    mapM_)
+import           Pipes.Safe                        (SafeT, runSafeT)
+import           System.Directory                  (doesFileExist, removeFile,
+                                                    renameFile)
+import           System.FilePath                   (dropExtension,
+                                                    replaceExtension,
+                                                    takeExtension, (<.>))
 import           Text.Printf                       (printf)
 
 import           Hkl.Binoculars.Common
 import           Hkl.Binoculars.Config
 import           Hkl.Binoculars.Config.Common
 import           Hkl.Binoculars.Pipes
+import           Hkl.Binoculars.Profile
 import           Hkl.Binoculars.Projections
 import           Hkl.C.Binoculars
 import           Hkl.DataSource
@@ -93,10 +112,10 @@ import           Hkl.Utils
 
 data DataFrameQCustom
     = DataFrameQCustom
-      Attenuation -- attenuation
-      Geometry -- geometry
-      Image -- image
-      Timestamp -- timestamp in double
+      {-# UNPACK #-} !Attenuation -- attenuation
+      !Geometry -- geometry
+      !Image -- image
+      {-# UNPACK #-} !Timestamp -- timestamp in double
     deriving Show
 
 instance DataSource DataFrameQCustom where
@@ -182,6 +201,7 @@ data instance Config 'QCustomProjection
     , binocularsConfig'QCustom'Uqy                    :: Degree
     , binocularsConfig'QCustom'Uqz                    :: Degree
     , binocularsConfig'QCustom'SampleAxis             :: Maybe SampleAxis
+    , binocularsConfig'QCustom'SumStaticFrames        :: Maybe Double
     } deriving (Show, Generic)
 
 newtype instance Args 'QCustomProjection = Args'QCustomProjection (Maybe ConfigRange)
@@ -200,6 +220,7 @@ default'BinocularsConfig'QCustom
     , binocularsConfig'QCustom'Uqy = Degree (0.0 *~ degree)
     , binocularsConfig'QCustom'Uqz = Degree (0.0 *~ degree)
     , binocularsConfig'QCustom'SampleAxis = Nothing
+    , binocularsConfig'QCustom'SumStaticFrames = Nothing
     }
 
 
@@ -246,6 +267,8 @@ instance HasIniConfig 'QCustomProjection where
                                                 HklBinocularsQCustomSubProjectionEnum'QxQzTimestamp -> Nothing
                                                 HklBinocularsQCustomSubProjectionEnum'QyQzTimestamp -> Nothing
                                                 HklBinocularsQCustomSubProjectionEnum'TthAzimuth -> Nothing
+                                                HklBinocularsQCustomSubProjectionEnum'Q -> Nothing
+                                                HklBinocularsQCustomSubProjectionEnum'Tth -> Nothing
 
 
     BinocularsConfig'QCustom
@@ -267,6 +290,7 @@ instance HasIniConfig 'QCustomProjection where
                     Nothing -> errorMissingSampleAxis
                     Just d  -> Just d
                 ))
+      <*> parseMb cfg "input" "sum_static_frames"
 
 instance ToIni (Config 'QCustomProjection) where
 
@@ -274,6 +298,19 @@ instance ToIni (Config 'QCustomProjection) where
             `mergeIni`
             Ini { iniSections = fromList [ ("input",    elemFDef' "surface_orientation" binocularsConfig'QCustom'HklBinocularsSurfaceOrientationEnum c default'BinocularsConfig'QCustom
                                                      <> elemFDef' "datapath" binocularsConfig'QCustom'DataPath c default'BinocularsConfig'QCustom
+                                                     <> elemFMbDef "sum_static_frames" binocularsConfig'QCustom'SumStaticFrames c default'BinocularsConfig'QCustom
+                                                     [ "sum the consecutive frames with the same geometry before the projection."
+                                                     , ""
+                                                     , "the frames are summed when all their axes are within `epsilon`,"
+                                                     , "with the same wavelength and the same attenuation. The sum is"
+                                                     , "projected once and each pixel counts for the number of summed frames."
+                                                     , "Without any correction of the intensities (attenuation, polarization)"
+                                                     , "the cube is the same, otherwise the intensities are rounded once per sum."
+                                                     , "not used by the subprojections with a timestamp axis, nor in live mode."
+                                                     , ""
+                                                     , " `<not set>` - project each frame."
+                                                     , " `epsilon`   - sum the frames within `epsilon` (`0` for the same axes values)."
+                                                     ]
                                            )
                                          , ("projection",    elemFDef' "type" binocularsConfig'QCustom'ProjectionType c default'BinocularsConfig'QCustom
                                                           <> elemFDef' "resolution" binocularsConfig'QCustom'ProjectionResolution c default'BinocularsConfig'QCustom
@@ -370,6 +407,8 @@ mkDetector'Sixs'Fly det@(Detector2D d _ _)
       HklBinocularsDetectorEnum'Merlin -> undefined
       HklBinocularsDetectorEnum'MerlinMedipix3rxQuad -> undefined
       HklBinocularsDetectorEnum'MerlinMedipix3rxQuad512 -> undefined
+      HklBinocularsDetectorEnum'Mythen -> undefined
+      HklBinocularsDetectorEnum'Cirpad -> undefined
 
 mkDetector'Sixs'Sbs :: Detector Hkl DIM2 -> DataSourcePath Image
 mkDetector'Sixs'Sbs det@(Detector2D d _ _)
@@ -393,6 +432,8 @@ mkDetector'Sixs'Sbs det@(Detector2D d _ _)
       HklBinocularsDetectorEnum'Merlin -> undefined
       HklBinocularsDetectorEnum'MerlinMedipix3rxQuad -> undefined
       HklBinocularsDetectorEnum'MerlinMedipix3rxQuad512 -> undefined
+      HklBinocularsDetectorEnum'Mythen -> undefined
+      HklBinocularsDetectorEnum'Cirpad -> undefined
 
 overloadAttenuationPath :: Maybe Double -> Maybe Float -> DataSourcePath Attenuation -> DataSourcePath Attenuation
 overloadAttenuationPath ma m' (DataSourcePath'Attenuation p o a m)
@@ -426,6 +467,8 @@ overloadTimestampPath msub idx =
                    HklBinocularsQCustomSubProjectionEnum'QxQzTimestamp -> idx
                    HklBinocularsQCustomSubProjectionEnum'QyQzTimestamp -> idx
                    HklBinocularsQCustomSubProjectionEnum'TthAzimuth -> DataSourcePath'Timestamp'NoTimestamp
+                   HklBinocularsQCustomSubProjectionEnum'Q -> DataSourcePath'Timestamp'NoTimestamp
+                   HklBinocularsQCustomSubProjectionEnum'Tth -> DataSourcePath'Timestamp'NoTimestamp
 
 overloadWaveLength :: Maybe Double -> DataSourcePath Double -> DataSourcePath Double
 overloadWaveLength ma wp = maybe wp DataSourcePath'Double'Const ma
@@ -805,7 +848,7 @@ spaceQCustom :: Detector a DIM2
              -> IO (DataFrameSpace DIM3)
 spaceQCustom det pixels rs mmask' surf mlimits subprojection uqx uqy uqz mSampleAxis doPolarizationCorrection space@(Space fSpace) (DataFrameQCustom att g img index) =
   withNPixels det $ \nPixels ->
-  withGeometry g $ \geometry ->
+  timedWith Stage'Geometry (withGeometry g) $ \geometry ->
   withForeignPtr (toForeignPtr pixels) $ \pix ->
   withResolutions rs $ \nr r ->
   withPixelsDims pixels $ \ndim dims ->
@@ -820,23 +863,177 @@ spaceQCustom det pixels rs mmask' surf mlimits subprojection uqx uqy uqz mSample
       {-# SCC "hkl_binoculars_space_qcustom_uint16_t" #-} c'hkl_binoculars_space_qcustom_uint16_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (CDouble . unTimestamp $ index) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis (toEnum . fromEnum $ doPolarizationCorrection)
     (ImageWord32 arr) -> unsafeWith arr $ \i -> do
       {-# SCC "hkl_binoculars_space_qcustom_uint32_t" #-} c'hkl_binoculars_space_qcustom_uint32_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (CDouble . unTimestamp $ index) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis (toEnum . fromEnum $ doPolarizationCorrection)
+    (ImageWord8 arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_qcustom_uint8_t" #-} c'hkl_binoculars_space_qcustom_uint8_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (CDouble . unTimestamp $ index) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis (toEnum . fromEnum $ doPolarizationCorrection)
+    (ImageInt16 arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_qcustom_int16_t" #-} c'hkl_binoculars_space_qcustom_int16_t pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (CDouble . unTimestamp $ index) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis (toEnum . fromEnum $ doPolarizationCorrection)
+    (ImageFloat arr) -> unsafeWith arr $ \i -> do
+      {-# SCC "hkl_binoculars_space_qcustom_float" #-} c'hkl_binoculars_space_qcustom_float pSpace geometry i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (CDouble . unTimestamp $ index) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis (toEnum . fromEnum $ doPolarizationCorrection)
 
   return (DataFrameSpace img space att)
 
+-- | the cube sized from the bounds of the frames, only a grid of the
+-- detector pixels is projected, whatever the images.
+boundsQCustom :: Array F DIM3 Double
+              -> Resolutions DIM3
+              -> Maybe Mask
+              -> HklBinocularsSurfaceOrientationEnum
+              -> Maybe (RLimits DIM3)
+              -> HklBinocularsQCustomSubProjectionEnum
+              -> Angle Double -> Angle Double -> Angle Double
+              -> Maybe SampleAxis
+              -> Producer DataFrameQCustom (SafeT IO) ()
+              -> IO (Cube DIM3)
+boundsQCustom pixels rs mmask' surf mlimits subprojection uqx uqy uqz mSampleAxis frames =
+  withForeignPtr (toForeignPtr pixels) $ \pix ->
+  withResolutions rs $ \nr r ->
+  withPixelsDims pixels $ \ndim dims ->
+  withMaybeMask mmask' $ \ mask'' ->
+  withMaybeLimits mlimits rs $ \nlimits limits ->
+  withMaybeSampleAxis mSampleAxis $ \sampleAxis ->
+  bracket (c'hkl_binoculars_qcustom_plan_new pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis 0) c'hkl_binoculars_qcustom_plan_free $ \plan ->
+  bracket (c'hkl_binoculars_bounds_new_qcustom plan) c'hkl_binoculars_bounds_free $ \bounds -> do
+    runSafeT $ runEffect $
+      frames
+      >-> Pipes.Prelude.mapM_ (\(DataFrameQCustom _ g _ index) ->
+                                  liftIO $ withGeometry g $ \geometry ->
+                                  c'hkl_binoculars_bounds_add_qcustom bounds geometry (CDouble . unTimestamp $ index))
+    newCube =<< c'hkl_binoculars_cube_new_from_bounds bounds
+
+-- | the resolutions suggested by the footprint of the pixels of the
+-- frames, with the number of bins and the bytes of the cube. Only a
+-- grid of the detector pixels is projected, whatever the images.
+footprintQCustom :: Array F DIM3 Double
+                 -> Resolutions DIM3
+                 -> Maybe Mask
+                 -> HklBinocularsSurfaceOrientationEnum
+                 -> HklBinocularsQCustomSubProjectionEnum
+                 -> Angle Double -> Angle Double -> Angle Double
+                 -> Maybe SampleAxis
+                 -> Producer DataFrameQCustom (SafeT IO) ()
+                 -> IO (Maybe ([Double], Word64, Word64))
+footprintQCustom pixels rs mmask' surf subprojection uqx uqy uqz mSampleAxis frames =
+  withForeignPtr (toForeignPtr pixels) $ \pix ->
+  withResolutions rs $ \nr r ->
+  withPixelsDims pixels $ \ndim dims ->
+  withMaybeMask mmask' $ \ mask'' ->
+  withMaybeLimits Nothing rs $ \nlimits limits ->
+  withMaybeSampleAxis mSampleAxis $ \sampleAxis ->
+  bracket (c'hkl_binoculars_qcustom_plan_new pix (toEnum ndim) dims r (toEnum nr) mask'' (toEnum $ fromEnum surf) limits (toEnum nlimits) (toEnum . fromEnum $ subprojection) (CDouble (uqx /~ radian)) (CDouble (uqy /~ radian)) (CDouble (uqz /~ radian)) sampleAxis 0) c'hkl_binoculars_qcustom_plan_free $ \plan ->
+  bracket (c'hkl_binoculars_footprint_new_qcustom plan) c'hkl_binoculars_footprint_free $ \footprint -> do
+    runSafeT $ runEffect $
+      frames
+      >-> Pipes.Prelude.mapM_ (\(DataFrameQCustom _ g _ index) ->
+                                  liftIO $ withGeometry g $ \geometry ->
+                                  c'hkl_binoculars_footprint_add_qcustom footprint geometry (CDouble . unTimestamp $ index))
+    allocaArray nr $ \suggested ->
+      alloca $ \nBins ->
+      alloca $ \nBytes -> do
+      ok <- c'hkl_binoculars_footprint_suggest footprint suggested (toEnum nr) nBins nBytes
+      if ok == 0
+        then pure Nothing
+        else do
+        suggested' <- peekArray nr suggested
+        bins <- peek nBins
+        bytes <- peek nBytes
+        pure $ Just (Prelude.map (\(CDouble d) -> d) suggested', bins, bytes)
+
+-- | the cube of the shard i of n, next to the output. It is always
+-- an hdf5 file, which keeps the frames needed to resume and merge it.
+shardOutput :: Int -> Int -> FilePath -> FilePath
+shardOutput i n o = dropExtension o ++ printf "_shard%dof%d" i n <.> ext
+  where
+    ext = if isZarr o then "h5" else takeExtension o
+
+-----------------------
+-- Sum static frames --
+-----------------------
+
+-- | the subprojections with a timestamp axis, each frame has its own
+-- bin so they can not be summed.
+withTimestampAxis :: HklBinocularsQCustomSubProjectionEnum -> Bool
+withTimestampAxis sub = case sub of
+                          HklBinocularsQCustomSubProjectionEnum'QxQyQz -> False
+                          HklBinocularsQCustomSubProjectionEnum'QTthTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QparQperTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QparQper -> False
+                          HklBinocularsQCustomSubProjectionEnum'QPhiQx -> False
+                          HklBinocularsQCustomSubProjectionEnum'QPhiQy -> False
+                          HklBinocularsQCustomSubProjectionEnum'QPhiQz -> False
+                          HklBinocularsQCustomSubProjectionEnum'QStereo -> False
+                          HklBinocularsQCustomSubProjectionEnum'DeltalabGammalabSampleaxis -> False
+                          HklBinocularsQCustomSubProjectionEnum'XYZ -> False
+                          HklBinocularsQCustomSubProjectionEnum'YZTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QQparQper -> False
+                          HklBinocularsQCustomSubProjectionEnum'QparsQperTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QparQperSampleaxis -> False
+                          HklBinocularsQCustomSubProjectionEnum'QSampleaxisTth -> False
+                          HklBinocularsQCustomSubProjectionEnum'QSampleaxisTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QxQyTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QxQzTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'QyQzTimestamp -> True
+                          HklBinocularsQCustomSubProjectionEnum'TthAzimuth -> False
+                          HklBinocularsQCustomSubProjectionEnum'Q -> False
+                          HklBinocularsQCustomSubProjectionEnum'Tth -> False
+
+-- | two frames can be projected at once if they have the same
+-- attenuation, the same wavelength and all their axes within eps.
+staticFrames :: Double -> DataFrameQCustom -> DataFrameQCustom -> Bool
+staticFrames eps (DataFrameQCustom att g _ _) (DataFrameQCustom att' g' _ _) =
+  att == att' && case (geometryState g, geometryState g') of
+                   (Just (GeometryState w vs), Just (GeometryState w' vs')) ->
+                     w == w'
+                     && V.length vs == V.length vs'
+                     && and (Prelude.zipWith (\a b -> realToFrac (abs (a - b)) <= eps) (V.toList vs) (V.toList vs'))
+                   _ -> False
+  where
+    geometryState (Geometry'Custom _ ms)  = ms
+    geometryState (Geometry'Factory _ ms) = ms
+
+-- | sum the consecutive static frames, compared with the first frame
+-- of each sum, and yield the sums with their number of frames.
+sumStaticFrames :: MonadIO m
+                => Maybe Double
+                -> Producer DataFrameQCustom m r
+                -> Producer (Int, DataFrameQCustom) m r
+sumStaticFrames Nothing p0 = p0 >-> Pipes.Prelude.map (\df -> (1, df))
+sumStaticFrames (Just eps) p0 = start p0
+  where
+    start p = lift (next p) >>= \case
+      Left r         -> pure r
+      Right (df, p') -> go 1 df p'
+
+    go n acc@(DataFrameQCustom att g img idx) p = lift (next p) >>= \case
+      Left r -> yield (n, acc) >> pure r
+      Right (df@(DataFrameQCustom _ _ img' _), p')
+        | staticFrames eps acc df -> do
+            img'' <- liftIO $ imageAdd imagePool img img'
+            go (n + 1) (DataFrameQCustom att g img'' idx) p'
+        | otherwise -> yield (n, acc) >> go 1 df p'
+
 ----------
 -- Pipe --
 ----------
 
 processQCustomP :: (MonadIO m, MonadLogger m, MonadReader (Config 'QCustomProjection) m, MonadThrow m)
-                => m ()
-processQCustomP = do
+                => Maybe Live -> Maybe Shard -> Checkpoint -> m ()
+processQCustomP (Just live@(Live every timeout _ _)) _ _ = do
   (conf :: Config 'QCustomProjection) <- ask
 
-  -- directly from the common config
   let common = binocularsConfig'QCustom'Common conf
+  liftIO $ c'hkl_binoculars_hdf5_direct_chunk_read_set (toEnum . fromEnum $ binocularsConfig'Common'DirectChunkRead common)
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ binocularsConfig'Common'CubeAlloc common)
+  liftIO $ c'hkl_binoculars_hdf5_pyramid_set (toEnum $ binocularsConfig'Common'PyramidLevels common)
+  liftIO $ c'hkl_binoculars_cube_sorted_scatter_set (toEnum . fromEnum $ binocularsConfig'Common'SortedScatter common)
+  liftIO $ c'hkl_binoculars_cube_interleaved_set (toEnum . fromEnum $ binocularsConfig'Common'InterleavedBins common)
+  liftIO $ c'hkl_binoculars_cube_narrow_counters_set (toEnum . fromEnum $ binocularsConfig'Common'NarrowCounters common)
+  setCorrections common
+  liftIO $ c'hkl_binoculars_pixel_splitting_set (toEnum $ binocularsConfig'Common'PixelSplitting common)
+  liftIO $ c'hkl_binoculars_fast_trigonometry_set (toEnum . fromEnum $ binocularsConfig'Common'FastTrigonometry common)
   let overwrite = binocularsConfig'Common'Overwrite common
   let det = binocularsConfig'Common'Detector common
-  let (NCores cap) =  binocularsConfig'Common'NCores common
   let destination = binocularsConfig'Common'Destination common
   let centralPixel' = binocularsConfig'Common'Centralpixel common
   let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
@@ -850,7 +1047,6 @@ processQCustomP = do
   let mSkipLastPoints = binocularsConfig'Common'SkipLastPoints common
   let doPolarizationCorrection = binocularsConfig'Common'PolarizationCorrection common
 
-  -- directly from the specific config
   let mlimits = binocularsConfig'QCustom'ProjectionLimits conf
   let res = binocularsConfig'QCustom'ProjectionResolution conf
   let surfaceOrientation = binocularsConfig'QCustom'HklBinocularsSurfaceOrientationEnum conf
@@ -862,63 +1058,274 @@ processQCustomP = do
   let (Degree uqz) = binocularsConfig'QCustom'Uqz conf
   let mSampleAxis = binocularsConfig'QCustom'SampleAxis conf
 
-  -- built from the config
+  -- the files are listed at each poll, they may not exist yet
   output' <- liftIO $ destination' projectionType (Just subprojection) inputRange mlimits destination overwrite
-  filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
+  let filenames = toList . InputFn'List <$> files nexusDir (Just inputRange) tmpl
   mask' <- getMask maskMatrix det
+  liftIO $ setFramesRoi mask'
   pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot NoNormalisation
 
-  -- compute the jobs
+  logDebugNSH datapaths
+  logInfoN $ pack $ printf "let's do a live QCustom projection of %s image(s), a snapshot every %d image(s), stop after %d s without new image" (show det) every timeout
 
-  let fns = concatMap (replicate 1) (toList filenames)
-  chunks <- liftIO $ runSafeT $ toListM $ each fns >-> chunkP mSkipFirstPoints mSkipLastPoints datapaths
-  let ntot = sum (Prelude.map clength chunks)
-  let jobs = chunk (quot ntot cap) chunks
+  liftIO $ liveP live output' (unpack . serializeConfig $ conf) filenames
+    (chunkP mSkipFirstPoints mSkipLastPoints datapaths)
+    (framesP datapaths
+     >-> Pipes.Prelude.filter (\(DataFrameQCustom _ _ img _) -> filterSumImage mImageSumMax img)
+     >-> project det 3 (spaceQCustom det pixels res mask' surfaceOrientation mlimits subprojection uqx uqy uqz mSampleAxis doPolarizationCorrection))
 
-  -- log parameters
+processQCustomP Nothing (Just (ShardsMerge n part)) _ = do
+  (conf :: Config 'QCustomProjection) <- ask
 
-  logDebugNSH filenames
-  logDebugNSH datapaths
-  logDebugNSH chunks
-  logDebugNSH ntot
-  logDebugNSH jobs
-  logDebugN "start gessing final cube size"
+  let common = binocularsConfig'QCustom'Common conf
+  let destination = binocularsConfig'Common'Destination common
+  let inputRange = binocularsConfig'Common'InputRange common
+  let mlimits = binocularsConfig'QCustom'ProjectionLimits conf
+  let subprojection = fromJust (binocularsConfig'QCustom'SubProjection conf) -- should not be Maybe
+  let projectionType = binocularsConfig'QCustom'ProjectionType conf
+  let config = unpack . serializeConfig $ conf
+
+  output' <- liftIO $ destination' projectionType (Just subprojection) inputRange mlimits destination True
+  let shards = [shardOutput i n output' | i <- [1..n]]
+  (cubes :: [Maybe (Cube DIM3, [FramesRange])]) <- liftIO $ Prelude.mapM (`loadCube` config) shards
+
+  -- all the shards are needed, the missing ones are run again
+  let missing = [f | (f, Nothing) <- zip shards cubes]
+  if null missing
+    then do
+      let rs = catMaybes cubes
+      case part of
+        (1, 1) -> do
+          logInfoN $ pack $ printf "merge the cubes of the %d shards into %s" n output'
+          liftIO $ saveCubeWithFrames output' config (mergeFramesRanges (concatMap snd rs)) (Prelude.map fst rs)
+        (j, m) | isZarr output' -> do
+          logInfoN $ pack $ printf "merge the part %d of %d of the cubes of the %d shards into %s" j m n output'
+          liftIO $ saveCubesZarr output' config (j - 1, m) (Prelude.map fst rs)
+        _ -> logErrorN $ pack $ printf "the parts of a merge are only available for the zarr outputs, not %s" output'
+    else forM_ missing $ \f ->
+      logErrorN $ pack $ printf "the cube of the shard %s is missing or was projected with another config, run this shard again" f
+
+processQCustomP Nothing mShard (Checkpoint mCheckpoint resume) = do
+  (conf :: Config 'QCustomProjection) <- ask
 
-  -- guess the final cube dimensions (To optimize, do not create the cube, just extract the shape)
+  -- directly from the common config
+  let common = binocularsConfig'QCustom'Common conf
+  liftIO $ c'hkl_binoculars_hdf5_direct_chunk_read_set (toEnum . fromEnum $ binocularsConfig'Common'DirectChunkRead common)
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ binocularsConfig'Common'CubeAlloc common)
+  liftIO $ c'hkl_binoculars_hdf5_pyramid_set (toEnum $ binocularsConfig'Common'PyramidLevels common)
+  liftIO $ c'hkl_binoculars_cube_sorted_scatter_set (toEnum . fromEnum $ binocularsConfig'Common'SortedScatter common)
+  liftIO $ c'hkl_binoculars_cube_interleaved_set (toEnum . fromEnum $ binocularsConfig'Common'InterleavedBins common)
+  liftIO $ c'hkl_binoculars_cube_narrow_counters_set (toEnum . fromEnum $ binocularsConfig'Common'NarrowCounters common)
+  setCorrections common
+  liftIO $ c'hkl_binoculars_pixel_splitting_set (toEnum $ binocularsConfig'Common'PixelSplitting common)
+  liftIO $ c'hkl_binoculars_fast_trigonometry_set (toEnum . fromEnum $ binocularsConfig'Common'FastTrigonometry common)
+  let overwrite = binocularsConfig'Common'Overwrite common
+  let det = binocularsConfig'Common'Detector common
+  let (NCores cap) =  binocularsConfig'Common'NCores common
+  -- the runtime starts on all the cores, keep only the ones of the config
+  liftIO $ setNumCapabilities cap
+  let destination = binocularsConfig'Common'Destination common
+  let centralPixel' = binocularsConfig'Common'Centralpixel common
+  let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
+  let (Degree detrot) = binocularsConfig'Common'Detrot common
+  let mImageSumMax = binocularsConfig'Common'ImageSumMax common
+  let inputRange = binocularsConfig'Common'InputRange common
+  let nexusDir = binocularsConfig'Common'Nexusdir common
+  let tmpl = binocularsConfig'Common'Tmpl common
+  let maskMatrix = binocularsConfig'Common'Maskmatrix common
+  let mSkipFirstPoints = binocularsConfig'Common'SkipFirstPoints common
+  let mSkipLastPoints = binocularsConfig'Common'SkipLastPoints common
+  let doPolarizationCorrection = binocularsConfig'Common'PolarizationCorrection common
 
-  guessed <- liftIO $ withCubeAccumulator EmptyCube $ \c ->
-    runSafeT $ runEffect $
-    each chunks
-    >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f, quot (f + t) 4, quot (f + t) 4 * 2, quot (f + t) 4 * 3, t]))
-    >-> framesP datapaths
-    >-> project det 3 (spaceQCustom det pixels res mask' surfaceOrientation mlimits subprojection uqx uqy uqz mSampleAxis doPolarizationCorrection)
-    >-> accumulateP c
+  -- directly from the specific config
+  let mlimits = binocularsConfig'QCustom'ProjectionLimits conf
+  let res = binocularsConfig'QCustom'ProjectionResolution conf
+  let surfaceOrientation = binocularsConfig'QCustom'HklBinocularsSurfaceOrientationEnum conf
+  let datapaths = binocularsConfig'QCustom'DataPath conf
+  let subprojection = fromJust (binocularsConfig'QCustom'SubProjection conf) -- should not be Maybe
+  let projectionType = binocularsConfig'QCustom'ProjectionType conf
+  let (Degree uqx) = binocularsConfig'QCustom'Uqx conf
+  let (Degree uqy) = binocularsConfig'QCustom'Uqy conf
+  let (Degree uqz) = binocularsConfig'QCustom'Uqz conf
+  let mSampleAxis = binocularsConfig'QCustom'SampleAxis conf
+  let mSumStaticFrames = binocularsConfig'QCustom'SumStaticFrames conf
+
+  -- a shard always projects into its own cube, so it can be resumed
+  let (shardFrames, shardCube) = case mShard of
+        (Just (Shard i n)) -> (cshard i n, shardOutput i n)
+        _                  -> (id, id)
 
-  logDebugN "stop gessing final cube size"
+  -- built from the config
+  output' <- liftIO $ case mShard of
+    (Just (Shard _ _)) -> shardCube <$> destination' projectionType (Just subprojection) inputRange mlimits destination True
+    _                  -> destination' projectionType (Just subprojection) inputRange mlimits destination overwrite
+  filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
+  mask' <- getMask maskMatrix det
+  liftIO $ setFramesRoi mask'
+  pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot NoNormalisation
 
-  -- do the final projection
+  -- compute the jobs
 
-  logInfoN $ pack $ printf "let's do a QCustom projection of %d %s image(s) on %d core(s)" ntot (show det) cap
+  -- the input files stay open until the end of the projection
+  liftIO fileCacheStart
 
-  liftIO $ withProgressBar ntot $ \pb -> do
-    r' <- mapConcurrently (\job -> withCubeAccumulator guessed $ \c ->
-                             runSafeT $ runEffect $
-                             each job
-                             >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f..t]))
-                             >-> framesP datapaths
-                             >-> Pipes.Prelude.filter (\(DataFrameQCustom _ _ img _) -> filterSumImage mImageSumMax img)
-                             >-> project det 3 (spaceQCustom det pixels res mask' surfaceOrientation mlimits subprojection uqx uqy uqz mSampleAxis doPolarizationCorrection)
-                             >-> tee (accumulateP c)
-                             >-> progress pb
-                         ) jobs
-    saveCube output' (unpack . serializeConfig $ conf) r'
+  let fns = concatMap (replicate 1) (toList filenames)
 
+  -- a previous cube computed from the same config and the same input
+  -- files is the result, whatever the overwrite option.
+
+  let config = unpack . serializeConfig $ conf
+  previousOutput <- liftIO $ shardCube <$> destination' projectionType (Just subprojection) inputRange mlimits destination True
+  identity <- liftIO $ inputsIdentity config fns
+  unchanged <- liftIO $ sameInputs previousOutput identity
+  when unchanged $ logInfoN $ pack $ printf "the config and the input files of %s did not change, keep it" previousOutput
+
+  chunks' <- if unchanged
+            then pure []
+            else shardFrames <$> liftIO (indexedChunks cap mSkipFirstPoints mSkipLastPoints datapaths fns)
+
+  -- resume from a previous cube computed with the same config
+
+  -- the checkpoint of a run which did not finish replaces the
+  -- previous cube
+  let checkpointOutput = replaceExtension previousOutput "checkpoint.h5"
+  previous <- liftIO $ if unchanged
+                       then pure Nothing
+                       else if resume
+                            then (<|>) <$> loadCube checkpointOutput config <*> loadCube previousOutput config
+                            else loadCube previousOutput config
+  (output'', previousCube, done, chunks) <- case previous of
+    Nothing -> pure (if unchanged then previousOutput else output', EmptyCube, [], chunks')
+    (Just (c, frs)) -> case resumeChunks frs chunks' of
+      Nothing -> do
+        logInfoN $ pack $ printf "the frames of %s do not match the input files, project all the frames" previousOutput
+        pure (output', EmptyCube, [], chunks')
+      (Just cs) -> do
+        logInfoN $ pack $ printf "resume the projection into %s" previousOutput
+        pure (previousOutput, c, frs, cs)
+
+  -- all the frames of the input files and the previous ones of the
+  -- files which are not part of the input anymore.
+  let fns' = [fn | Chunk fn _ _ <- chunks']
+  let ranges = [(fn, l, h) | Chunk fn l h <- chunks'] ++ [d | d@(fn, _, _) <- done, fn `notElem` fns']
+
+  if null chunks
+  then logInfoN $ pack $ printf "no new image to project into %s" output''
+  else do
+    let ntot = sum (Prelude.map clength chunks)
+    let work = workSlices cap chunks
+
+    -- log parameters
+
+    logDebugNSH filenames
+    logDebugNSH datapaths
+    logDebugNSH chunks
+    logDebugNSH ntot
+    logDebugNSH work
+    logDebugN "start gessing final cube size"
+
+    -- guess the final cube dimensions (To optimize, do not create the cube, just extract the shape)
+
+    guessed <- liftIO $ boundsQCustom pixels res mask' surfaceOrientation mlimits subprojection uqx uqy uqz mSampleAxis
+              (each chunks
+               >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f, quot (f + t) 4, quot (f + t) 4 * 2, quot (f + t) 4 * 3, t]))
+               >-> framesP datapaths)
+
+    logDebugN "stop gessing final cube size"
+
+    -- the accumulation which fits in the memory budget
+
+    bytes <- liftIO $ cubeBytes guessed
+    let accumulation = planAccumulation cap ((* (1024 * 1024)) <$> binocularsConfig'Common'MemoryBudget common) bytes
+    logInfoN $ pack $ printf "the guessed cube needs %d MiB, accumulate into %s" (quot bytes (1024 * 1024)) $
+      case accumulation of
+        Accumulation'Private -> printf "one private cube per core (%d)" cap :: String
+        Accumulation'Shared  -> "one cube shared by the cores"
+        Accumulation'Spill   -> "one cube shared by the cores, spilled to a temporary file"
+    when (accumulation == Accumulation'Spill) $
+      liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ HklBinocularsCubeAllocEnum'Spill)
+
+    -- do the final projection
+
+    logInfoN $ pack $ printf "let's do a QCustom projection of %d %s image(s) on %d core(s)" ntot (show det) cap
+
+    -- the static frames of each worker are summed before the
+    -- projection, except when each frame has its own timestamp bin.
+    mSum <- case mSumStaticFrames of
+      (Just _) | withTimestampAxis subprojection -> do
+                   logInfoN "the subprojection has a timestamp axis, the static frames are not summed"
+                   pure Nothing
+      _ -> pure mSumStaticFrames
+
+    -- without the sum of the static frames, the projection computes
+    -- the sum of each image in its loop, so the images are not
+    -- summed before.
+    let sumInProjection = isNothing mSum
+    liftIO $ c'hkl_binoculars_frame_stats_set (toEnum . fromEnum $ sumInProjection && isJust mImageSumMax)
+
+    -- time the stages of the final projection
+    liftIO $ profileStart (unpack . unProfileLocation <$> binocularsConfig'Common'Profile common) (unpack . unProfileLocation <$> binocularsConfig'Common'ProfileTrace common)
+
+    -- cap readers share the work and fill a queue of frames
+    -- projected by cap workers, into their own cube or into a shared
+    -- one with their own overflow cube.
+    stats <- liftIO $ withProgressBar ntot $ \pb -> do
+      let worker mShared frames = withCubeAccumulator (maybe guessed (const EmptyCube) mShared) $ \c ->
+                                runSafeT $ runEffect $
+                                sumStaticFrames mSum (frames
+                                                      >-> Pipes.Prelude.filter (\(DataFrameQCustom _ _ img _) -> sumInProjection || filterSumImage mImageSumMax img))
+                                >-> progressFrames pb
+                                >-> project det 3 (withNFrames (spaceQCustom det pixels res mask' surfaceOrientation mlimits subprojection uqx uqy uqz mSampleAxis doPolarizationCorrection))
+                                >-> Pipes.Prelude.filterM (\s -> if sumInProjection then liftIO (filterSumSpace mImageSumMax s) else pure True)
+                                >-> maybe (accumulateP c) (`accumulateSharedP` c) mShared
+      let projectFrames w = case accumulation of
+            Accumulation'Private -> withFramesQueue (2 * cap) cap cap w (framesP datapaths) (worker Nothing)
+            _ -> withSharedCube guessed $ \shared ->
+              withFramesQueue (2 * cap) cap cap w (framesP datapaths) (worker (Just shared))
+      stats <- case mCheckpoint of
+        Nothing -> do
+          (r', stats) <- projectFrames work
+          saveCubeWithFrames output'' config ranges (previousCube : r')
+          saveInputs output'' identity
+          pure stats
+        (Just every) -> do
+          -- the frames are projected by segments of about every
+          -- frames, the cube and its frames are saved after each
+          -- segment, so a run which did not finish can be resumed.
+          let k = max 1 (quot (ntot + every - 1) every)
+          let segment (acc, frs, stats) seg = do
+                (r', stats') <- projectFrames (workSlices cap seg)
+                acc' <- mergeCubes cap (acc : r')
+                let frs' = mergeFramesRanges (frs ++ [(fn, l, h) | Chunk fn l h <- seg])
+                let tmp = checkpointOutput ++ ".part"
+                saveCubeWithFrames tmp config frs' [acc']
+                saved <- doesFileExist tmp
+                when saved $ renameFile tmp checkpointOutput
+                pure (acc', frs', QueueStats
+                                  (queueStats'ReaderWaits stats + queueStats'ReaderWaits stats')
+                                  (queueStats'WorkerWaits stats + queueStats'WorkerWaits stats')
+                                  (max (queueStats'MaxDepth stats) (queueStats'MaxDepth stats')))
+          (c, _, stats) <- foldM segment (previousCube, done, QueueStats 0 0 0) [cshard i k chunks | i <- [1..k]]
+          saveCubeWithFrames output'' config ranges [c]
+          saveInputs output'' identity
+          exist <- doesFileExist checkpointOutput
+          when exist $ removeFile checkpointOutput
+          pure stats
+      profileStop
+      pure stats
+
+    logDebugNSH stats
+    logInfoN $ pack $ printf "frames queue: the readers waited %d time(s), the workers waited %d time(s), at most %d queued frame(s)"
+      (queueStats'ReaderWaits stats) (queueStats'WorkerWaits stats) (queueStats'MaxDepth stats)
+
+  liftIO fileCacheStop
 
 instance ChunkP (DataSourcePath DataFrameQCustom) where
     chunkP mSkipFirst mSkipLast (DataSourcePath'DataFrameQCustom ma _ (DataSourcePath'Image i _) _) =
       skipMalformed $ forever $ do
       fp <- await
-      withFileP (openFile' fp) $ \f ->
+      withCachedFileP fp $ \f ->
         withHdf5PathP f i $ \i' -> do
         (_, ss) <- liftIO $ datasetShape i'
         case head ss of
@@ -933,7 +1340,7 @@ instance FramesP (DataSourcePath DataFrameQCustom) DataFrameQCustom where
     framesP p =
         skipMalformed $ forever $ do
           (fn, js) <- await
-          withFileP (openFile' fn) $ \f ->
+          withCachedFileP fn $ \f ->
             withDataSourceP f p $ \ g ->
             forM_ js (tryYield . extract1DStreamValue g)
 
@@ -941,8 +1348,57 @@ instance FramesP (DataSourcePath DataFrameQCustom) DataFrameQCustom where
 -- Cmd --
 ---------
 
-processQCustom :: (MonadLogger m, MonadThrow m, MonadIO m) => Maybe FilePath -> Maybe ConfigRange -> m ()
-processQCustom mf mr = cmd processQCustomP mf (Args'QCustomProjection mr)
+processQCustom :: (MonadLogger m, MonadThrow m, MonadIO m) => Maybe FilePath -> Maybe ConfigRange -> Maybe Live -> Maybe Shard -> Checkpoint -> m ()
+processQCustom mf mr ml ms ck = cmd (processQCustomP ml ms ck) mf (Args'QCustomProjection mr)
+
+suggestQCustomP :: (MonadIO m, MonadLogger m, MonadReader (Config 'QCustomProjection) m, MonadThrow m)
+                => m ()
+suggestQCustomP = do
+  (conf :: Config 'QCustomProjection) <- ask
+
+  let common = binocularsConfig'QCustom'Common conf
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_fast_trigonometry_set (toEnum . fromEnum $ binocularsConfig'Common'FastTrigonometry common)
+  let det = binocularsConfig'Common'Detector common
+  let (NCores cap) =  binocularsConfig'Common'NCores common
+  let centralPixel' = binocularsConfig'Common'Centralpixel common
+  let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
+  let (Degree detrot) = binocularsConfig'Common'Detrot common
+  let inputRange = binocularsConfig'Common'InputRange common
+  let nexusDir = binocularsConfig'Common'Nexusdir common
+  let tmpl = binocularsConfig'Common'Tmpl common
+  let maskMatrix = binocularsConfig'Common'Maskmatrix common
+  let mSkipFirstPoints = binocularsConfig'Common'SkipFirstPoints common
+  let mSkipLastPoints = binocularsConfig'Common'SkipLastPoints common
+
+  let res = binocularsConfig'QCustom'ProjectionResolution conf
+  let surfaceOrientation = binocularsConfig'QCustom'HklBinocularsSurfaceOrientationEnum conf
+  let datapaths = binocularsConfig'QCustom'DataPath conf
+  let subprojection = fromJust (binocularsConfig'QCustom'SubProjection conf) -- should not be Maybe
+  let (Degree uqx) = binocularsConfig'QCustom'Uqx conf
+  let (Degree uqy) = binocularsConfig'QCustom'Uqy conf
+  let (Degree uqz) = binocularsConfig'QCustom'Uqz conf
+  let mSampleAxis = binocularsConfig'QCustom'SampleAxis conf
+
+  filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
+  mask' <- getMask maskMatrix det
+  pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot NoNormalisation
+  chunks <- liftIO $ indexedChunks cap mSkipFirstPoints mSkipLastPoints datapaths (toList filenames)
+
+  -- only the first, middle and last frames of each chunk are projected
+  suggested <- liftIO $ footprintQCustom pixels res mask' surfaceOrientation subprojection uqx uqy uqz mSampleAxis
+              (each chunks
+               >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f, quot (f + t) 2, t]))
+               >-> framesP datapaths)
+
+  case suggested of
+    Nothing -> logErrorN "no frame to measure the footprint of the pixels"
+    (Just (rs, bins, bytes)) -> do
+      logInfoN $ pack $ printf "resolution = %s" (intercalate "," (Prelude.map (printf "%g") rs :: [String]))
+      logInfoN $ pack $ printf "the cube would have %d bins and use %.1f MiB" bins (fromIntegral bytes / 1048576 :: Double)
+
+suggestQCustom :: (MonadLogger m, MonadThrow m, MonadIO m) => Maybe FilePath -> Maybe ConfigRange -> m ()
+suggestQCustom mf mr = cmd suggestQCustomP mf (Args'QCustomProjection mr)
 
 newQCustom :: (MonadIO m, MonadLogger m, MonadThrow m)
            => Path Abs Dir -> m ()
@@ -28,7 +28,6 @@ module Hkl.Binoculars.Projections.Test
     , updateTest
     ) where
 
-import           Control.Concurrent.Async           (mapConcurrently)
 import           Control.Monad.Catch                (MonadThrow)
 import           Control.Monad.IO.Class             (MonadIO (liftIO))
 import           Control.Monad.Logger               (MonadLogger, logDebugN,
@@ -48,11 +47,12 @@ import           Data.Text.IO                       (putStr)
 import           Data.Vector.Storable.Mutable       (unsafeWith)
 import           Foreign.C.Types                    (CDouble (..))
 import           Foreign.ForeignPtr                 (withForeignPtr)
+import           GHC.Conc                           (setNumCapabilities)
 import           GHC.Generics                       (Generic)
 import           Path                               (Abs, Dir, Path)
 import           Pipes                              (await, each, runEffect,
                                                      (>->))
-import           Pipes.Prelude                      (filter, map, tee, toListM)
+import           Pipes.Prelude                      (filter, map, tee)
 import           Pipes.Safe                         (runSafeP, runSafeT)
 import           Text.Printf                        (printf)
 
@@ -61,6 +61,7 @@ import           Hkl.Binoculars.Config
 import           Hkl.Binoculars.Config.Common
 import           Hkl.Binoculars.Config.Sample
 import           Hkl.Binoculars.Pipes
+import           Hkl.Binoculars.Profile
 import           Hkl.Binoculars.Projections
 import           Hkl.Binoculars.Projections.QCustom
 import           Hkl.C.Binoculars
@@ -187,7 +188,7 @@ instance ToIni (Config 'TestProjection) where
 spaceTest :: Detector b DIM2 -> Array F DIM3 Double -> Resolutions DIM3 -> Maybe Mask -> Maybe (RLimits DIM3) -> Bool -> Space DIM3 -> DataFrameTest' Identity -> IO (DataFrameSpace DIM3)
 spaceTest det pixels rs mmask' mlimits doPolarizationCorrection space@(Space fSpace) (DataFrameTest (DataFrameQCustom att g img _) samplePath) = do
   withNPixels det $ \nPixels ->
-    withGeometry g $ \geometry ->
+    timedWith Stage'Geometry (withGeometry g) $ \geometry ->
     withSample samplePath $ \sample ->
     withForeignPtr (toForeignPtr pixels) $ \pix ->
     withResolutions rs $ \nr r ->
@@ -202,6 +203,12 @@ spaceTest det pixels rs mmask' mlimits doPolarizationCorrection space@(Space fSp
         {-# SCC "test_binoculars_space_test_uint16_t" #-} c'hkl_binoculars_space_test_uint16_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
       (ImageWord32 arr) -> unsafeWith arr $ \i -> do
         {-# SCC "test_binoculars_space_test_uint32_t" #-} c'hkl_binoculars_space_test_uint32_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageWord8 arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "test_binoculars_space_test_uint8_t" #-} c'hkl_binoculars_space_test_uint8_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageInt16 arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "test_binoculars_space_test_int16_t" #-} c'hkl_binoculars_space_test_int16_t pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
+      (ImageFloat arr) -> unsafeWith arr $ \i -> do
+        {-# SCC "test_binoculars_space_test_float" #-} c'hkl_binoculars_space_test_float pSpace geometry sample i nPixels (CDouble . unAttenuation $ att) pix (toEnum ndim) dims r (toEnum nr) mask'' limits (toEnum nlimits) (toEnum . fromEnum $ doPolarizationCorrection)
     return (DataFrameSpace img space att)
 
 ----------
@@ -215,10 +222,19 @@ processTestP = do
 
   -- directly from the common config
   let common = binocularsConfig'Test'Common conf
+  liftIO $ c'hkl_binoculars_hdf5_direct_chunk_read_set (toEnum . fromEnum $ binocularsConfig'Common'DirectChunkRead common)
+  liftIO $ c'hkl_binoculars_cube_weighted_set (toEnum . fromEnum $ binocularsConfig'Common'Weighted common)
+  liftIO $ c'hkl_binoculars_cube_alloc_set (toEnum . fromEnum $ binocularsConfig'Common'CubeAlloc common)
+  liftIO $ c'hkl_binoculars_hdf5_pyramid_set (toEnum $ binocularsConfig'Common'PyramidLevels common)
+  liftIO $ c'hkl_binoculars_cube_sorted_scatter_set (toEnum . fromEnum $ binocularsConfig'Common'SortedScatter common)
+  liftIO $ c'hkl_binoculars_cube_interleaved_set (toEnum . fromEnum $ binocularsConfig'Common'InterleavedBins common)
+  liftIO $ c'hkl_binoculars_cube_narrow_counters_set (toEnum . fromEnum $ binocularsConfig'Common'NarrowCounters common)
 
   let overwrite = binocularsConfig'Common'Overwrite common
   let det = binocularsConfig'Common'Detector common
   let (NCores cap) =  binocularsConfig'Common'NCores common
+  -- the runtime starts on all the cores, keep only the ones of the config
+  liftIO $ setNumCapabilities cap
   let destination = binocularsConfig'Common'Destination common
   let centralPixel' = binocularsConfig'Common'Centralpixel common
   let (Meter sampleDetectorDistance) = binocularsConfig'Common'Sdd common
@@ -243,12 +259,14 @@ processTestP = do
   output' <- liftIO $ destination' projectionType Nothing inputRange mlimits destination overwrite
   filenames <- InputFn'List <$> files nexusDir (Just inputRange) tmpl
   mask' <- getMask maskMatrix det
+  liftIO $ setFramesRoi mask'
   pixels <- liftIO $ getPixelsCoordinates det centralPixel' sampleDetectorDistance detrot NoNormalisation
 
   let fns = concatMap (replicate 1) (toList filenames)
-  chunks <- liftIO $ runSafeT $ toListM $ each fns >-> chunkP mSkipFirstPoints mSkipLastPoints datapaths
+  liftIO fileCacheStart
+  chunks <- liftIO $ indexedChunks cap mSkipFirstPoints mSkipLastPoints datapaths fns
   let ntot = sum (Prelude.map clength chunks)
-  let jobs = chunk (quot ntot cap) chunks
+  let work = workSlices cap chunks
 
   -- log parameters
 
@@ -271,10 +289,13 @@ processTestP = do
 
   logInfoN (pack $ printf "let's do a Test projection of %d %s image(s) on %d core(s)" ntot (show det) cap)
 
+  -- time the stages of the final projection
+  liftIO $ profileStart (unpack . unProfileLocation <$> binocularsConfig'Common'Profile common) (unpack . unProfileLocation <$> binocularsConfig'Common'ProfileTrace common)
+
   liftIO $ withProgressBar ntot $ \pb -> do
-    r' <- mapConcurrently (\job -> withCubeAccumulator guessed $ \c ->
+    r' <- withWorkQueue cap work (\job -> withCubeAccumulator guessed $ \c ->
                              runEffect $ runSafeP $
-                             each job
+                             job
                              >-> Pipes.Prelude.map (\(Chunk fn f t) -> (fn, [f..t]))
                              -- >-> tee Pipes.Prelude.print
                              >-> framesP datapaths
@@ -282,8 +303,10 @@ processTestP = do
                              >-> project det 3 (spaceTest det pixels res mask' mlimits doPolarizationCorrection)
                              >-> tee (accumulateP c)
                              >-> progress pb
-                         ) jobs
+                         )
     saveCube output' (unpack . serializeConfig $ conf) r'
+    profileStop
+    fileCacheStop
 
 -- FramesTestP
 
@@ -293,7 +316,7 @@ instance ChunkP (DataFrameTest' DataSourcePath) where
 instance FramesP (DataFrameTest' DataSourcePath) (DataFrameTest' Identity) where
   framesP (DataFrameTest qcustom sample) = skipMalformed $ forever $ do
     (fp, js) <- await
-    withFileP (openFile' fp) $ \f ->
+    withCachedFileP fp $ \f ->
       withDataSourceP f qcustom $ \qcustomAcq ->
       withDataSourceP f sample $ \sampleAcq ->
       forM_ js (\j -> tryYield ( DataFrameTest
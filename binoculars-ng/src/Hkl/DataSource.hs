@@ -31,23 +31,27 @@ module Hkl.DataSource
   , Is1DStreamable(..)
   ) where
 
-import           Bindings.HDF5.Core                (Location)
+import           Bindings.HDF5.Core                (Location, hid)
 import           Bindings.HDF5.Dataset             (getDatasetSpace,
                                                     getDatasetType)
 import           Bindings.HDF5.Dataspace           (getSimpleDataspaceExtentNPoints)
-import           Bindings.HDF5.Datatype            (getTypeSize, nativeTypeOf,
+import           Bindings.HDF5.Datatype            (nativeTypeOf,
                                                     typeIDsEqual)
+import           Bindings.HDF5.Datatype.Internal   (NativeType)
+import           Bindings.HDF5.Raw                 (HId_t (HId_t))
 import           Control.Exception                 (throwIO)
 import           Control.Monad.Extra               (ifM)
 import           Control.Monad.IO.Class            (MonadIO (liftIO))
 import           Control.Monad.Trans.Cont          (cont, runCont)
 import           Data.Aeson                        (FromJSON (..), ToJSON (..))
-import           Data.Int                          (Int32)
+import           Data.Int                          (Int16, Int32)
 import           Data.Kind                         (Type)
-import           Data.Vector.Storable              (Vector, fromList)
-import           Data.Vector.Storable.Mutable      (IOVector, unsafeNew)
-import           Data.Word                         (Word16, Word32)
+import           Data.Vector.Storable              (Vector, fromList, (!?))
+import           Data.Vector.Storable.Mutable      (IOVector, unsafeWith)
+import           Data.Word                         (Word16, Word32, Word8)
 import           Foreign.C.Types                   (CDouble (..))
+import           Foreign.Ptr                       (castPtr)
+import           Foreign.Storable                  (sizeOf)
 import           GHC.Base                          (returnIO)
 import           GHC.Float                         (float2Double)
 import           GHC.Generics                      (Generic)
@@ -58,6 +62,7 @@ import           Prelude                           hiding (filter)
 
 import           Hkl.Binoculars.Config
 import           Hkl.Binoculars.Config.Common
+import           Hkl.C.Binoculars                  (c'hkl_binoculars_hdf5_read_frame_direct)
 import           Hkl.Detector
 import           Hkl.Exception
 import           Hkl.Geometry
@@ -120,19 +125,36 @@ class Is1DStreamable a e where
 badAttenuation :: Float
 badAttenuation = -100
 
+-- | the weights of all the frames of a scan, coef ** v, or -1 when the
+-- attenuation v is wrong. The frames check the sign of their weight.
+attenuationWeights :: Double -> Maybe Float -> Vector Float -> Vector Double
+attenuationWeights coef mmax = Data.Vector.Storable.map weight
+  where
+    weight :: Float -> Double
+    weight v
+      | v == badAttenuation = -1
+      | maybe False (v >) mmax = -1
+      | otherwise = coef ** float2Double v
+
+wrongAttenuation :: Maybe Float -> Int -> Float -> HklBinocularsException
+wrongAttenuation mmax j v
+  | v == badAttenuation = WrongAttenuation "attenuation is wrong" j (float2Double v)
+  | maybe False (v >) mmax = WrongAttenuation "max inserted filters exceeded" j (float2Double v)
+  | otherwise = WrongAttenuation "attenuation is not a number" j (float2Double v)
+
 instance Is1DStreamable (DataSourceAcq Attenuation) Attenuation where
-    extract1DStreamValue (DataSourceAcq'Attenuation ds offset coef mmax) i =
-        Attenuation <$> do
-          v <-  extract1DStreamValue ds (i + offset)
-          if v == badAttenuation
-          then throwIO (WrongAttenuation "attenuation is wrong" (i + offset) (float2Double v))
-          else case mmax of
-                 Just m -> if v > m
-                          then throwIO (WrongAttenuation "max inserted filters exceeded" (i + offset) (float2Double v))
-                          else return (coef ** float2Double v)
-                 Nothing -> return (coef ** float2Double v)
-
-    extract1DStreamValue (DataSourceAcq'ApplyedAttenuationFactor ds) i = extract1DStreamValue ds i
+    extract1DStreamValue (DataSourceAcq'Attenuation vs ws offset mmax) i =
+        let j = i + offset
+        in case (vs !? j, ws !? j) of
+             (Just v, Just w) -> if w >= 0
+                                then returnIO (Attenuation w)
+                                else throwIO (wrongAttenuation mmax j v)
+             _ -> throwIO (WrongAttenuation "no attenuation for the frame" j 0)
+
+    extract1DStreamValue (DataSourceAcq'ApplyedAttenuationFactor ws) i =
+        case ws !? i of
+          Just w  -> returnIO (Attenuation w)
+          Nothing -> throwIO (WrongAttenuation "no attenuation factor for the frame" i 0)
 
     extract1DStreamValue DataSourceAcq'NoAttenuation _ = returnIO $ Attenuation 1
 
@@ -169,12 +191,42 @@ instance  Is1DStreamable (DataSourceAcq Geometry) Geometry where
                      (Geometry'Factory factory _) -> Geometry'Factory factory (Just state)
 
 instance Is1DStreamable (DataSourceAcq Image) Image where
-  extract1DStreamValue (DataSourceAcq'Image'Int32 ds det buf) i = ImageInt32 <$> getArrayInBuffer buf det ds i
-  extract1DStreamValue (DataSourceAcq'Image'Word16 ds det buf) i = ImageWord16 <$> getArrayInBuffer buf det ds i
-  extract1DStreamValue (DataSourceAcq'Image'Word32 ds det buf) i = ImageWord32 <$> getArrayInBuffer buf det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Int16 ds det) i = ImageInt16 <$> getImageInPool det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Int32 ds det) i = ImageInt32 <$> getImageInPool det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Word8 ds det) i = ImageWord8 <$> getImageInPool det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Word16 ds det) i = ImageWord16 <$> getImageInPool det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Word32 ds det) i = ImageWord32 <$> getImageInPool det ds i
+  extract1DStreamValue (DataSourceAcq'Image'Float ds det) i = ImageFloat <$> getImageInPool det ds i
+
+-- | the frame is read in its native type directly into a buffer of
+-- the image pool, given back once projected. The raw chunk is read
+-- and decompressed by the binoculars library when the direct chunk
+-- read is enabled and supported, otherwise only the roi of the mask
+-- is read when the chunks are smaller than a frame, otherwise the
+-- whole frame is read by H5Dread.
+getImageInPool :: NativeType t => Detector Hkl DIM2 -> Dataset -> Int -> IO (IOVector t)
+getImageInPool det ds i = do
+  let n = size . shape $ det
+  buf <- imagePoolTake imagePool n
+  let (HId_t ds') = hid ds
+  let nbytes = toEnum $ n * sizeOf (elemOf buf)
+  r <- unsafeWith buf $ \p -> do
+    r' <- c'hkl_binoculars_hdf5_read_frame_direct ds' (toEnum i) (castPtr p) nbytes
+    if r' == 0
+      then pure r'
+      else c'hkl_binoculars_hdf5_read_frame_roi ds' (toEnum i) (castPtr p) nbytes
+  if r == 0
+    then pure buf
+    else getArrayInBuffer buf det ds i
+  where
+    elemOf :: IOVector t -> t
+    elemOf _ = undefined
 
 instance Is1DStreamable (DataSourceAcq Timestamp) Timestamp where
-  extract1DStreamValue (DataSourceAcq'Timestamp ds) i = Timestamp <$> extract1DStreamValue ds i
+  extract1DStreamValue (DataSourceAcq'Timestamp ts) i =
+    case ts !? i of
+      Just t  -> if isNaN t then throwIO ContainNanValue else returnIO (Timestamp t)
+      Nothing -> throwIO ContainNanValue
   extract1DStreamValue DataSourceAcq'Timestamp'NoTimestamp _ = returnIO $ Timestamp 0
 
 ----------------
@@ -211,17 +263,25 @@ instance DataSource Attenuation where
     | DataSourcePath'NoAttenuation
     deriving (Generic, Show, FromJSON, ToJSON)
 
+  -- the attenuations of the scan are read in one go when the file is
+  -- opened and the weights of its frames computed once.
   data DataSourceAcq Attenuation =
-    DataSourceAcq'Attenuation { attenuationAcqPath        :: DataSourceAcq Float
-                              , attenuationAcqOffset      :: Int
-                              , attenuationAcqCoefficient :: Double
-                              , attenuationAcqMax         :: Maybe Float
+    DataSourceAcq'Attenuation { attenuationAcqValues  :: Vector Float
+                              , attenuationAcqWeights :: Vector Double
+                              , attenuationAcqOffset  :: Int
+                              , attenuationAcqMax     :: Maybe Float
                               }
-    | DataSourceAcq'ApplyedAttenuationFactor { attenuationAcqPath :: DataSourceAcq Float }
+    | DataSourceAcq'ApplyedAttenuationFactor { attenuationAcqWeights :: Vector Double }
     | DataSourceAcq'NoAttenuation
 
-  withDataSourceP f (DataSourcePath'Attenuation p o c m) g = withDataSourceP f p $ \ds -> g (DataSourceAcq'Attenuation ds o c m)
-  withDataSourceP f (DataSourcePath'ApplyedAttenuationFactor p) g = withDataSourceP f p $ \ds -> g (DataSourceAcq'ApplyedAttenuationFactor ds)
+  withDataSourceP f (DataSourcePath'Attenuation p o c m) g =
+    withDataSourceP f p $ \(DataSourceAcq'Float ds) -> do
+      vs <- liftIO $ getPositions ds
+      g (DataSourceAcq'Attenuation vs (attenuationWeights c m vs) o m)
+  withDataSourceP f (DataSourcePath'ApplyedAttenuationFactor p) g =
+    withDataSourceP f p $ \(DataSourceAcq'Float ds) -> do
+      vs <- liftIO $ getPositions ds
+      g (DataSourceAcq'ApplyedAttenuationFactor (Data.Vector.Storable.map float2Double vs))
   withDataSourceP _ DataSourcePath'NoAttenuation g = g DataSourceAcq'NoAttenuation
 
 -- Degree
@@ -334,23 +394,27 @@ instance DataSource Image where
     = DataSourcePath'Image (Hdf5Path DIM3 Int32) (Detector Hkl DIM2) -- TODO Int32 is wrong
     deriving (Generic, Show, FromJSON, ToJSON)
 
-  data instance DataSourceAcq Image = DataSourceAcq'Image'Int32 Dataset (Detector Hkl DIM2) (IOVector Int32)
-                                    | DataSourceAcq'Image'Word16 Dataset (Detector Hkl DIM2) (IOVector Word16)
-                                    | DataSourceAcq'Image'Word32 Dataset (Detector Hkl DIM2) (IOVector Word32)
+  data instance DataSourceAcq Image = DataSourceAcq'Image'Int16 Dataset (Detector Hkl DIM2)
+                                    | DataSourceAcq'Image'Int32 Dataset (Detector Hkl DIM2)
+                                    | DataSourceAcq'Image'Word8 Dataset (Detector Hkl DIM2)
+                                    | DataSourceAcq'Image'Word16 Dataset (Detector Hkl DIM2)
+                                    | DataSourceAcq'Image'Word32 Dataset (Detector Hkl DIM2)
+                                    | DataSourceAcq'Image'Float Dataset (Detector Hkl DIM2)
 
   withDataSourceP f (DataSourcePath'Image p det) g = withHdf5PathP f p $ \ds -> do
     t <- liftIO $ getDatasetType ds
-    s <- liftIO $ getTypeSize t
-    let n = (size . shape $ det) * fromEnum s
-    condM [ (liftIO $ typeIDsEqual t (nativeTypeOf (undefined ::  Int32)), do
-                arr <- liftIO $ unsafeNew n
-                g (DataSourceAcq'Image'Int32 ds det arr))
-          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined :: Word16)), do
-                arr <- liftIO $ unsafeNew n
-                g (DataSourceAcq'Image'Word16 ds det arr))
-          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined :: Word32)), do
-                arr <- liftIO $ unsafeNew n
-                g (DataSourceAcq'Image'Word32 ds det arr))
+    condM [ (liftIO $ typeIDsEqual t (nativeTypeOf (undefined ::  Int16)),
+             g (DataSourceAcq'Image'Int16 ds det))
+          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined ::  Int32)),
+             g (DataSourceAcq'Image'Int32 ds det))
+          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined ::  Word8)),
+             g (DataSourceAcq'Image'Word8 ds det))
+          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined :: Word16)),
+             g (DataSourceAcq'Image'Word16 ds det))
+          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined :: Word32)),
+             g (DataSourceAcq'Image'Word32 ds det))
+          , (liftIO $ typeIDsEqual t (nativeTypeOf (undefined ::  Float)),
+             g (DataSourceAcq'Image'Float ds det))
           ]
 
 -- Int
@@ -374,8 +438,11 @@ instance DataSource Timestamp where
     | DataSourcePath'Timestamp'NoTimestamp
     deriving (Eq, Generic, Show, FromJSON, ToJSON)
 
-  data DataSourceAcq Timestamp = DataSourceAcq'Timestamp Dataset
+  -- the timestamps of the scan, read in one go
+  data DataSourceAcq Timestamp = DataSourceAcq'Timestamp (Vector Double)
                                | DataSourceAcq'Timestamp'NoTimestamp
 
-  withDataSourceP f (DataSourcePath'Timestamp p) g = withHdf5PathP f p $ \ds -> g (DataSourceAcq'Timestamp ds)
+  withDataSourceP f (DataSourcePath'Timestamp p) g = withHdf5PathP f p $ \ds -> do
+    ts <- liftIO $ getPositions ds
+    g (DataSourceAcq'Timestamp ts)
   withDataSourceP _ DataSourcePath'Timestamp'NoTimestamp g = g DataSourceAcq'Timestamp'NoTimestamp
@@ -19,6 +19,8 @@ module Hkl.Detector
        , getDetectorMask
        , getDetectorDefaultMask
        , getPixelsCoordinates
+       , setDetectorCorrections
+       , setPixelsCoordinatesCache
        , inDetector
        , mkDetector
        , newDetector
@@ -28,15 +30,16 @@ module Hkl.Detector
        ) where
 
 
-import           Control.Monad                     ((<=<))
 import           Control.Monad.Catch               (MonadThrow, throwM)
 import           Control.Monad.IO.Class            (MonadIO, liftIO)
 import           Data.Aeson                        (FromJSON (..), ToJSON (..),
                                                     object, pairs, withObject,
                                                     (.:), (.=))
 import           Data.List                         (find, sort)
+import           Data.Maybe                        (catMaybes)
 import           Data.Text                         (Text, pack, unpack, unwords)
-import           Foreign.C.String                  (peekCString, withCString)
+import           Foreign.C.String                  (CString, peekCString,
+                                                    withCString)
 import           Foreign.C.Types                   (CBool, CDouble (..))
 import           Foreign.ForeignPtr                (ForeignPtr, castForeignPtr,
                                                     newForeignPtr,
@@ -153,9 +156,8 @@ data Normalisation = NoNormalisation | Normalisation
 getPixelsCoordinates :: Detector Hkl DIM2 -> (Int, Int) -> Length Double -> Angle Double -> Normalisation -> IO (Array F DIM3 Double)
 getPixelsCoordinates (Detector2D d _ sh) (ix0, iy0) sdd detrot norm = do
   let n = toEnum . fromEnum $ d
-  parr <- c'hkl_binoculars_detector_2d_coordinates_get n
+  parr <- c'hkl_binoculars_detector_2d_calibrated_coordinates_get n (toEnum ix0) (toEnum iy0) (CDouble (sdd /~ meter)) (CDouble (detrot /~ radian)) (toEnum . fromEnum $ norm)
   let Z :. height :. width = sh
-  c'hkl_binoculars_detector_2d_sixs_calibration n parr (toEnum width) (toEnum height) (toEnum ix0) (toEnum iy0) (CDouble (sdd /~ meter)) (CDouble (detrot /~ radian)) (toEnum . fromEnum $ norm)
   arr <- newForeignPtr finalizerFree parr
   return $ fromForeignPtr (ix3 3 height width) (castForeignPtr arr)
 
@@ -176,8 +178,39 @@ getDetectorMask :: (MonadThrow m, MonadIO m) => Detector Hkl DIM2 -> Text -> m M
 getDetectorMask (Detector2D d name sh)  mask = do
   let  err = MaskShapeNotcompatible (Data.Text.unwords [pack name, ": ", mask])
   let n = toEnum . fromEnum $ d
-  liftIO $ withCString (unpack mask) $
-         fromPtr sh err <=< c'hkl_binoculars_detector_2d_mask_load n
+  liftIO $ withCString (unpack mask) $ \fname -> do
+    -- the mapped mask is shared with the other processes, fall back
+    -- on the private copy if the file can not be mapped.
+    ptr <- c'hkl_binoculars_detector_2d_mask_mmap n fname
+    if ptr == nullPtr
+    then fromPtr sh err =<< c'hkl_binoculars_detector_2d_mask_load n fname
+    else do
+      arr <- newForeignPtr p'hkl_binoculars_detector_2d_mask_munmap ptr
+      return $ fromForeignPtr sh (castForeignPtr arr)
+
+-- | the directory of the calibrated coordinates shared by the runs,
+-- Nothing keeps them only in the memory of the process.
+setPixelsCoordinatesCache :: Maybe FilePath -> IO ()
+setPixelsCoordinatesCache Nothing = c'hkl_binoculars_detector_2d_coordinates_cache_dir_set nullPtr
+setPixelsCoordinatesCache (Just d) = withCString d c'hkl_binoculars_detector_2d_coordinates_cache_dir_set
+
+-- | the dark, flatfield and solid angle .npy files of the detector
+-- applied by the projections kernels to all the following frames.
+setDetectorCorrections :: (MonadThrow m, MonadIO m)
+                       => Detector Hkl DIM2 -> Maybe Text -> Maybe Text -> Maybe Text -> m ()
+setDetectorCorrections (Detector2D d name _) mdark mflat msolid = do
+  let n = toEnum . fromEnum $ d
+  let err = CorrectionsNotCompatible (Data.Text.unwords (pack name : ": " : catMaybes [mdark, mflat, msolid]))
+  ok <- liftIO $
+       withMaybeCString mdark $ \dark ->
+       withMaybeCString mflat $ \flat ->
+       withMaybeCString msolid $ \solid ->
+       c'hkl_binoculars_detector_2d_corrections_load n dark flat solid
+  if ok == 0 then throwM err else pure ()
+    where
+      withMaybeCString :: Maybe Text -> (CString -> IO a) -> IO a
+      withMaybeCString Nothing f  = f nullPtr
+      withMaybeCString (Just t) f = withCString (unpack t) f
 
 inDetector :: (Int, Int) -> Detector Hkl DIM2 -> Bool
 inDetector (x, y) det = inShape (shape det) (ix2 y x)
@@ -18,6 +18,7 @@ import           Hkl.Types
 
 data HklDetectorException = MaskShapeNotcompatible Text
                           | NoDefaultMask
+                          | CorrectionsNotCompatible Text
     deriving (Show, Typeable)
 instance Exception HklDetectorException
 
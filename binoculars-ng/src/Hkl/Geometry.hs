@@ -16,20 +16,24 @@ module Hkl.Geometry
        , withGeometry
        ) where
 
-import           Data.Aeson            (FromJSON (..), ToJSON (..))
-import           Data.Tree             (Tree (..), foldTree)
-import qualified Data.Vector.Storable  as V
-import           Foreign               (ForeignPtr, Ptr, newForeignPtr, nullPtr,
-                                        withForeignPtr)
-import           Foreign.C             (CDouble (..), newCString, withCString)
-import           GHC.Generics          (Generic)
-import           Numeric.LinearAlgebra (Vector)
-
-import           Prelude               hiding (max, min)
+import           Control.Concurrent.MVar (MVar, newMVar)
+import           Data.Aeson              (FromJSON (..), ToJSON (..))
+import qualified Data.Map.Strict         as Map
+import           Data.Tree               (Tree (..), foldTree)
+import qualified Data.Vector.Storable    as V
+import           Foreign                 (ForeignPtr, Ptr, newForeignPtr, nullPtr,
+                                          withForeignPtr)
+import           Foreign.C               (CDouble (..), newCString, withCString)
+import           GHC.Generics            (Generic)
+import           Numeric.LinearAlgebra   (Vector)
+import           System.IO.Unsafe        (unsafePerformIO)
+
+import           Prelude                 hiding (max, min)
 
 import           Hkl.C.Hkl
 import           Hkl.Lattice
-import           Hkl.Orphan            ()
+import           Hkl.Orphan              ()
+import           Hkl.Utils               (withPooled)
 
 -------------
 -- Factory --
@@ -76,12 +80,12 @@ data Axis
   deriving (Generic, FromJSON, Show, ToJSON)
 
 data GeometryState
-    = GeometryState Double (Vector CDouble)
+    = GeometryState {-# UNPACK #-} !Double !(Vector CDouble)
       deriving (Generic, FromJSON, Show, ToJSON)
 
 data Geometry
-  = Geometry'Custom (Tree Axis) (Maybe GeometryState)
-  | Geometry'Factory Factory (Maybe GeometryState)
+  = Geometry'Custom (Tree Axis) !(Maybe GeometryState)
+  | Geometry'Factory !Factory !(Maybe GeometryState)
     deriving (Generic, FromJSON, Show, ToJSON)
 
 fixed :: Geometry
@@ -178,7 +182,23 @@ newGeometry (Geometry'Factory f ms)
            (Just s) -> pokeGeometry fptr s
          return fptr
 
+-- | the geometries already built, by structure. Building a geometry
+-- allocates all its holders and axes (and the factory one looks up
+-- the factory by name), so the frames reuse a pooled one and only
+-- set its wavelength and axes values.
+geometryPool :: MVar (Map.Map String [ForeignPtr C'HklGeometry])
+geometryPool = unsafePerformIO $ newMVar Map.empty
+{-# NOINLINE geometryPool #-}
+
 withGeometry :: Geometry -> (Ptr C'HklGeometry -> IO r) -> IO r
+withGeometry (Geometry'Custom t (Just s)) f = withPooledGeometry (Geometry'Custom t Nothing) s f
+withGeometry (Geometry'Factory t (Just s)) f = withPooledGeometry (Geometry'Factory t Nothing) s f
 withGeometry g f
     = do fptr <- newGeometry g
          withForeignPtr fptr f
+
+withPooledGeometry :: Geometry -> GeometryState -> (Ptr C'HklGeometry -> IO r) -> IO r
+withPooledGeometry g s f
+    = withPooled geometryPool (show g) (newGeometry g) $ \fptr -> do
+        pokeGeometry fptr s
+        withForeignPtr fptr f
@@ -32,6 +32,7 @@ module Hkl.H5
     , getArrayInBuffer
     , getPosition
     , getPositionNew
+    , getPositions
     , getUB
     , lenH5Dataspace
     , datasetShape
@@ -200,6 +201,11 @@ getPosition dataset' n = do
     then throwIO $ ContainNanValue
     else return v'
 
+-- | all the values of a dataset in one read, for the per frame
+-- values of a scan read once per file.
+getPositions :: NativeType t => Dataset -> IO (Vector t)
+getPositions dataset' = readDataset dataset' Nothing Nothing
+
 getUB :: Dataset -> IO (Matrix Double)
 getUB dataset' = do
   v <- readDataset dataset' Nothing Nothing
@@ -3,23 +3,152 @@
 
 module Hkl.Image
     ( Image(..)
-    , filterSumImage )
+    , ImagePool
+    , filterSumImage
+    , imageAdd
+    , imagePool
+    , imagePoolRelease
+    , imagePoolTake )
     where
 
-import           Data.Int                     (Int32)
+import           Control.Monad                (forM_)
+import           Data.Int                     (Int16, Int32)
+import           Data.IORef                   (IORef, atomicModifyIORef',
+                                               newIORef)
 import           Data.Vector.Storable.Mutable (IOVector, Storable, length,
-                                               unsafeRead)
-import           Data.Word                    (Word16, Word32)
+                                               unsafeFromForeignPtr0,
+                                               unsafeRead, unsafeToForeignPtr0,
+                                               unsafeWrite)
+import           Data.Word                    (Word16, Word32, Word8)
+import           Foreign.ForeignPtr           (ForeignPtr, castForeignPtr)
+import           Foreign.Storable             (sizeOf)
+import           GHC.ForeignPtr               (mallocPlainForeignPtrAlignedBytes)
 import           System.IO.Unsafe             (unsafePerformIO)
 
-data Image = ImageInt32 (IOVector Int32)
+data Image = ImageInt16 (IOVector Int16)
+           | ImageInt32 (IOVector Int32)
+           | ImageWord8 (IOVector Word8)
            | ImageWord16 (IOVector Word16)
            | ImageWord32 (IOVector Word32)
+           | ImageFloat (IOVector Float)
 
 instance Show Image where
+  show (ImageInt16 _)  = "ImageInt16"
   show (ImageInt32 _)  = "ImageInt32"
+  show (ImageWord8 _)  = "ImageWord8"
   show (ImageWord16 _) = "ImageWord16"
   show (ImageWord32 _) = "ImageWord32"
+  show (ImageFloat _)  = "ImageFloat"
+
+-- | the released image buffers, pinned and aligned for the C kernels,
+-- with their size in bytes.
+newtype ImagePool = ImagePool (IORef [(Int, ForeignPtr Word8)])
+
+-- | the pool shared by all the readers of the process
+imagePool :: ImagePool
+imagePool = unsafePerformIO $ ImagePool <$> newIORef []
+{-# NOINLINE imagePool #-}
+
+-- | keep at most this number of released buffers
+imagePoolMax :: Int
+imagePoolMax = 64
+
+-- | a buffer for an image of n pixels, a released one if possible
+-- otherwise a new one.
+imagePoolTake :: Storable t => ImagePool -> Int -> IO (IOVector t)
+imagePoolTake (ImagePool ref) n = go undefined
+  where
+    go :: Storable t => t -> IO (IOVector t)
+    go t = do
+      let bytes = n * sizeOf t
+      mfp <- atomicModifyIORef' ref (pick bytes)
+      fp <- case mfp of
+             Nothing   -> mallocPlainForeignPtrAlignedBytes bytes 64
+             (Just fp) -> pure fp
+      pure $ unsafeFromForeignPtr0 (castForeignPtr fp) n
+
+    pick _ [] = ([], Nothing)
+    pick bytes (b@(bytes', fp) : bs)
+      | bytes' == bytes = (bs, Just fp)
+      | otherwise = let (bs', mfp) = pick bytes bs in (b : bs', mfp)
+
+-- | give back the buffer of an image which is not used anymore
+imagePoolRelease :: ImagePool -> Image -> IO ()
+imagePoolRelease (ImagePool ref) img = atomicModifyIORef' ref push
+  where
+    push bs
+      | Prelude.length bs >= imagePoolMax = (bs, ())
+      | otherwise = (buffer img : bs, ())
+
+    buffer (ImageInt16 v)  = bytes v
+    buffer (ImageInt32 v)  = bytes v
+    buffer (ImageWord8 v)  = bytes v
+    buffer (ImageWord16 v) = bytes v
+    buffer (ImageWord32 v) = bytes v
+    buffer (ImageFloat v)  = bytes v
+
+    bytes :: Storable t => IOVector t -> (Int, ForeignPtr Word8)
+    bytes v = let (fp, n) = unsafeToForeignPtr0 v
+              in (n * sizeOf (elemOf fp), castForeignPtr fp)
+
+    elemOf :: ForeignPtr t -> t
+    elemOf _ = undefined
+
+-- | add the second image to the first one and give back its buffer
+-- to the pool. The uint8 and uint16 images are summed into a new
+-- uint32 one and the int16 images into a new int32 one in order to
+-- avoid the overflows.
+imageAdd :: ImagePool -> Image -> Image -> IO Image
+imageAdd pool (ImageInt32 a) img@(ImageInt32 b) = do
+  addInto fromIntegral a b
+  imagePoolRelease pool img
+  pure (ImageInt32 a)
+imageAdd pool (ImageInt32 a) img@(ImageInt16 b) = do
+  addInto fromIntegral a b
+  imagePoolRelease pool img
+  pure (ImageInt32 a)
+imageAdd pool (ImageWord32 a) img@(ImageWord32 b) = do
+  addInto fromIntegral a b
+  imagePoolRelease pool img
+  pure (ImageWord32 a)
+imageAdd pool (ImageWord32 a) img@(ImageWord16 b) = do
+  addInto fromIntegral a b
+  imagePoolRelease pool img
+  pure (ImageWord32 a)
+imageAdd pool (ImageWord32 a) img@(ImageWord8 b) = do
+  addInto fromIntegral a b
+  imagePoolRelease pool img
+  pure (ImageWord32 a)
+imageAdd pool (ImageFloat a) img@(ImageFloat b) = do
+  addInto id a b
+  imagePoolRelease pool img
+  pure (ImageFloat a)
+imageAdd pool acc@(ImageInt16 a) img@(ImageInt16 b) = ImageInt32 <$> addWiden pool acc img a b
+imageAdd pool acc@(ImageWord8 a) img@(ImageWord8 b) = ImageWord32 <$> addWiden pool acc img a b
+imageAdd pool acc@(ImageWord16 a) img@(ImageWord16 b) = ImageWord32 <$> addWiden pool acc img a b
+imageAdd _ a b = error $ "can not sum a " <> show b <> " image into a " <> show a <> " image"
+
+addInto :: (Storable a, Storable b, Num a) => (b -> a) -> IOVector a -> IOVector b -> IO ()
+{-# INLINE addInto #-}
+addInto f a b = forM_ [0 .. Data.Vector.Storable.Mutable.length a - 1] $ \i -> do
+  x <- unsafeRead a i
+  y <- unsafeRead b i
+  unsafeWrite a i (x + f y)
+
+-- | sum two images into a new one of a wider type and give back the
+-- two buffers to the pool.
+addWiden :: (Storable a, Integral a, Storable c, Num c)
+         => ImagePool -> Image -> Image -> IOVector a -> IOVector a -> IO (IOVector c)
+{-# INLINE addWiden #-}
+addWiden pool acc img a b = do
+  c <- imagePoolTake pool (Data.Vector.Storable.Mutable.length a)
+  forM_ [0 .. Data.Vector.Storable.Mutable.length a - 1] $ \i -> do
+    x <- unsafeRead a i
+    y <- unsafeRead b i
+    unsafeWrite c i (fromIntegral x + fromIntegral y)
+  imagePoolRelease pool acc
+  imagePoolRelease pool img
+  pure c
 
 -- -- | /O(n)/ Monadic fold with strict accumulator (action applied to each element and its index).
 -- --
@@ -70,13 +199,16 @@ foldl' :: Storable a => (b -> a -> b) -> b -> IOVector a -> IO b
 {-# INLINE foldl' #-}
 foldl' f = ifoldl' (\b _ -> f b)
 
-sum' :: (Integral a, Storable a) => IOVector a -> Double
-sum' v = unsafePerformIO $ foldl' (\b a -> b + fromIntegral a) 0.0 v
+sum' :: Storable a => (a -> Double) -> IOVector a -> Double
+sum' f v = unsafePerformIO $ foldl' (\b a -> b + f a) 0.0 v
 
 sumImage :: Image -> Double
-sumImage (ImageInt32 i)  = sum' i
-sumImage (ImageWord16 i) = sum' i
-sumImage (ImageWord32 i) = sum' i
+sumImage (ImageInt16 i)  = sum' fromIntegral i
+sumImage (ImageInt32 i)  = sum' fromIntegral i
+sumImage (ImageWord8 i)  = sum' fromIntegral i
+sumImage (ImageWord16 i) = sum' fromIntegral i
+sumImage (ImageWord32 i) = sum' fromIntegral i
+sumImage (ImageFloat i)  = sum' realToFrac i
 
 
 filterSumImage :: Maybe Double -> Image -> Bool
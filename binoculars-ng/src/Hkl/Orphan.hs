@@ -27,6 +27,9 @@ import           Hkl.Repa
 instance Arbitrary (Path Abs Dir) where
   arbitrary = pure $(mkAbsDir "/toto")
 
+instance Arbitrary HklBinocularsCubeAllocEnum where
+  arbitrary = elements ([minBound .. maxBound] :: [HklBinocularsCubeAllocEnum])
+
 instance Arbitrary HklBinocularsSurfaceOrientationEnum where
   arbitrary = elements ([minBound .. maxBound] :: [HklBinocularsSurfaceOrientationEnum])
 
@@ -2,7 +2,10 @@
 {-# LANGUAGE ScopedTypeVariables #-}
 
 module Hkl.Pipes
-    ( withBytes
+    ( fileCacheStart
+    , fileCacheStop
+    , withBytes
+    , withCachedFileP
     , withFileP
     , withDatasetP
     , withDataspaceP
@@ -13,10 +16,16 @@ module Hkl.Pipes
 import           Bindings.HDF5.Core      (Location)
 import           Bindings.HDF5.Dataspace (Dataspace, closeDataspace)
 import           Bindings.HDF5.Group     (Group, closeGroup)
+import           Control.Concurrent.MVar (MVar, modifyMVar, modifyMVar_,
+                                          newMVar, readMVar)
+import           Control.Monad           (forM_)
 import           Control.Monad.IO.Class  (MonadIO (liftIO))
+import qualified Data.Map.Strict         as Map
+import           Data.Maybe              (fromMaybe)
 import           Foreign.ForeignPtr      (ForeignPtr, mallocForeignPtrBytes,
                                           touchForeignPtr)
 import           Pipes.Safe              (MonadSafe, bracket, catch, throwM)
+import           System.IO.Unsafe        (unsafePerformIO)
 
 import           Hkl.Exception
 import           Hkl.H5
@@ -32,6 +41,47 @@ withBytes n = bracket' touchForeignPtr (mallocForeignPtrBytes n)
 withFileP :: MonadSafe m => IO File -> (File -> m r) -> m r
 withFileP = bracket' closeFile
 
+-- | the files kept open between fileCacheStart and fileCacheStop,
+-- shared by all the threads. Opening a file and reading its metadata
+-- is slow on the parallel filesystems, and a file is read by the
+-- chunks, the guess of the cube and each job touching it.
+fileCache :: MVar (Maybe (Map.Map FilePath File))
+fileCache = unsafePerformIO $ newMVar Nothing
+{-# NOINLINE fileCache #-}
+
+-- | keep the files opened with withCachedFileP until fileCacheStop
+fileCacheStart :: IO ()
+fileCacheStart = modifyMVar_ fileCache $ pure . Just . fromMaybe Map.empty
+
+-- | close all the cached files
+fileCacheStop :: IO ()
+fileCacheStop = modifyMVar_ fileCache $ \mc -> do
+  forM_ mc (mapM_ closeFile . Map.elems)
+  pure Nothing
+
+-- | like withFileP (openFile' fp), but the file stays open when the
+-- cache is started
+withCachedFileP :: MonadSafe m => FilePath -> (File -> m r) -> m r
+withCachedFileP fp f = do
+  mc <- liftIO $ readMVar fileCache
+  case mc of
+    Nothing -> withFileP (openFile' fp) f
+    (Just c) -> case Map.lookup fp c of
+                  (Just h) -> f h
+                  Nothing -> do
+                    -- opened out of the lock, so the threads open
+                    -- their files in parallel
+                    h <- liftIO $ openFile' fp
+                    eh <- liftIO $ modifyMVar fileCache $ \mc' ->
+                      case mc' of
+                        Nothing -> pure (mc', Left h)
+                        (Just c') -> case Map.lookup fp c' of
+                                       (Just h') -> closeFile h >> pure (mc', Right h')
+                                       Nothing   -> pure (Just (Map.insert fp h c'), Right h)
+                    case eh of
+                      (Left h')  -> withFileP (pure h') f
+                      (Right h') -> f h'
+
 withGroupP :: MonadSafe m => IO Group -> (Group -> m r) -> m r
 withGroupP = bracket' closeGroup
 
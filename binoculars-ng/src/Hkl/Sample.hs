@@ -8,17 +8,21 @@ module Hkl.Sample
        , withSample
        ) where
 
-import           Control.Monad (void)
-import           Data.Aeson    (FromJSON, ToJSON)
-import           Foreign       (ForeignPtr, Ptr, newForeignPtr, nullPtr,
-                                withForeignPtr)
-import           Foreign.C     (withCString)
-import           GHC.Generics  (Generic)
+import           Control.Concurrent.MVar (MVar, newMVar)
+import           Control.Monad           (void)
+import           Data.Aeson              (FromJSON, ToJSON)
+import qualified Data.Map.Strict         as Map
+import           Foreign                 (ForeignPtr, Ptr, newForeignPtr,
+                                          nullPtr, withForeignPtr)
+import           Foreign.C               (withCString)
+import           GHC.Generics            (Generic)
+import           System.IO.Unsafe        (unsafePerformIO)
 
 import           Hkl.C.Hkl
 import           Hkl.Lattice
 import           Hkl.Parameter
 import           Hkl.Types
+import           Hkl.Utils               (withPooled)
 
 
 
@@ -34,9 +38,15 @@ data Sample
   deriving (Eq, FromJSON, Generic, Show, ToJSON)
 
 
+-- | the samples already built. The projections use the same sample
+-- for all the frames, so there is no need to set its lattice and
+-- orientation again.
+samplePool :: MVar (Map.Map String [ForeignPtr C'HklSample])
+samplePool = unsafePerformIO $ newMVar Map.empty
+{-# NOINLINE samplePool #-}
+
 withSample :: Sample -> (Ptr C'HklSample -> IO r) -> IO r
-withSample s fun = do
-  fptr <- newSample s
+withSample s fun = withPooled samplePool (show s) (newSample s) $ \fptr ->
   withForeignPtr fptr fun
 
 newSample :: Sample -> IO (ForeignPtr C'HklSample)
@@ -6,20 +6,23 @@ module Hkl.Utils
     , logDebugNSH
     , logErrorNSH
     , withCString
+    , withPooled
     ) where
 
-import           Control.Monad.Logger  (LoggingT, MonadLogger, logDebugN,
-                                        logErrorN)
-import           Data.Text             (Text, length, pack)
-import           Data.Text.Foreign     (unsafeCopyToPtr)
-import           Data.Text.IO          (writeFile)
-import           Data.Word             (Word8)
-import           Foreign.C.String      (CString)
-import           Foreign.Marshal.Alloc (allocaBytes)
-import           Foreign.Storable      (pokeByteOff)
-import           GHC.Ptr               (castPtr)
-import           System.Directory      (createDirectoryIfMissing)
-import           System.FilePath       (takeDirectory)
+import           Control.Concurrent.MVar (MVar, modifyMVar, modifyMVar_)
+import           Control.Monad.Logger    (LoggingT, MonadLogger, logDebugN,
+                                          logErrorN)
+import qualified Data.Map.Strict         as Map
+import           Data.Text               (Text, length, pack)
+import           Data.Text.Foreign       (unsafeCopyToPtr)
+import           Data.Text.IO            (writeFile)
+import           Data.Word               (Word8)
+import           Foreign.C.String        (CString)
+import           Foreign.Marshal.Alloc   (allocaBytes)
+import           Foreign.Storable        (pokeByteOff)
+import           GHC.Ptr                 (castPtr)
+import           System.Directory        (createDirectoryIfMissing)
+import           System.FilePath         (takeDirectory)
 
 hasContent ∷ FilePath → Text → IO ()
 hasContent f c = do
@@ -44,3 +47,19 @@ withCString t action = do
     unsafeCopyToPtr t buf
     pokeByteOff buf len (0 :: Word8)
     action (castPtr buf)
+
+-- | run the action with an object taken from the pool under the given
+-- key, or a new one when the pool is empty. The object is given back
+-- to the pool once the action returns, so the workers reuse a few
+-- objects instead of allocating one per frame. An object is dropped
+-- when the action throws, since it may be left in a bad state.
+withPooled :: MVar (Map.Map String [a]) -> String -> IO a -> (a -> IO r) -> IO r
+withPooled pool k new f = do
+  ma <- modifyMVar pool $ \m ->
+    pure $ case Map.lookup k m of
+             (Just (a : as)) -> (Map.insert k as m, Just a)
+             _               -> (m, Nothing)
+  a <- maybe new pure ma
+  r <- f a
+  modifyMVar_ pool $ pure . Map.insertWith (++) k [a]
+  pure r
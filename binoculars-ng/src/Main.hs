@@ -11,6 +11,7 @@
 -}
 module Main where
 
+import           Control.Applicative       (some, (<|>))
 import           Control.Monad.Catch       (MonadThrow)
 import           Control.Monad.IO.Class    (MonadIO)
 import           Control.Monad.Logger      (LogLevel (LevelDebug), LoggingT,
@@ -18,12 +19,13 @@ import           Control.Monad.Logger      (LogLevel (LevelDebug), LoggingT,
                                             runStdoutLoggingT)
 import           Data.Attoparsec.Text      (parseOnly)
 import           Data.Text                 (pack)
-import           Options.Applicative       (CommandFields, Mod, argument,
+import           Options.Applicative       (CommandFields, Mod, argument, auto,
                                             command, eitherReader, execParser,
-                                            fullDesc, header, help, helper,
-                                            hsubparser, info, long, metavar,
-                                            optional, progDesc, short, str,
-                                            switch, (<**>))
+                                            flag', fullDesc, header, help,
+                                            helper, hsubparser, info, long,
+                                            metavar, option, optional,
+                                            progDesc, short, showDefault, str,
+                                            strOption, switch, value, (<**>))
 import           Options.Applicative.Types (Parser)
 
 
@@ -33,9 +35,11 @@ import           Hkl.Binoculars
 data FullOptions = FullOptions Bool Options
   deriving Show
 
-data Options = Process (Maybe FilePath) (Maybe ConfigRange)
+data Options = Process (Maybe FilePath) (Maybe ConfigRange) (Maybe Live) (Maybe Shard) Checkpoint
              | CfgNew ProjectionType (Maybe FilePath)
              | CfgUpdate FilePath (Maybe ConfigRange)
+             | Suggest FilePath (Maybe ConfigRange)
+             | Merge FilePath [FilePath]
   deriving Show
 
 debug :: Parser Bool
@@ -44,10 +48,50 @@ debug = switch ( long "debug" <> short 'd' <> help "Print debug informations" )
 config :: Parser FilePath
 config = argument str (metavar "CONFIG")
 
+live :: Parser Live
+live = flag' () ( long "live" <> help "Project the frames while they are written into the data files" )
+       *> (Live
+           <$> option auto ( long "snapshot" <> metavar "N" <> value 100 <> showDefault
+                             <> help "Save the partial cube every N frames" )
+           <*> option auto ( long "timeout" <> metavar "SECONDS" <> value 30 <> showDefault
+                             <> help "Stop after SECONDS without new frame" )
+           <*> optional (option auto ( long "metrics" <> metavar "PORT"
+                                       <> help "Serve the OpenMetrics of the projection on http://127.0.0.1:PORT/metrics" ))
+           <*> optional (strOption ( long "metrics-bind" <> metavar "ADDR"
+                                     <> help "Serve the OpenMetrics on this address instead of the loopback" )))
+
+shard :: Parser Shard
+shard = option (eitherReader readShard)
+        ( long "shard" <> metavar "I/N"
+          <> help "Project only the shard I of N into its own cube, for the nodes of a cluster" )
+        <|> (ShardsMerge
+             <$> option auto ( long "merge-shards" <> metavar "N"
+                               <> help "Merge the cubes of the N shards into the output" )
+             <*> option (eitherReader readPart)
+                 ( long "merge-part" <> metavar "J/M" <> value (1, 1)
+                   <> help "Write only the part J of M of a zarr output, for the nodes of a cluster" ))
+  where
+    readPart s' = case break (== '/') s' of
+                    (i, '/' : n) | [(i', "")] <- reads i
+                                 , [(n', "")] <- reads n
+                                 , 1 <= i', i' <= n' -> Right (i', n')
+                    _ -> Left "expected I/N with 1 <= I <= N"
+
+    readShard s' = uncurry Shard <$> readPart s'
+
+checkpoint :: Parser Checkpoint
+checkpoint = Checkpoint
+             <$> optional (option auto ( long "checkpoint" <> metavar "N"
+                                         <> help "Save the partial cube and its frames every N frames" ))
+             <*> switch ( long "resume" <> help "Resume from the checkpoint of a run which did not finish" )
+
 processOptions :: Parser Options
 processOptions = Process
                  <$> optional config
                  <*> optional (argument (eitherReader (parseOnly fieldParser . pack)) (metavar "RANGE"))
+                 <*> optional live
+                 <*> optional shard
+                 <*> checkpoint
 
 processCommand :: Mod CommandFields Options
 processCommand = command "process" (info processOptions (progDesc "process data's"))
@@ -68,15 +112,33 @@ cfgUpdateOption = CfgUpdate
 cfgUpdateCommand :: Mod CommandFields Options
 cfgUpdateCommand = command "cfg-update" (info cfgUpdateOption (progDesc "update config files"))
 
+suggestOption :: Parser Options
+suggestOption = Suggest
+                <$> config
+                <*> optional (argument (eitherReader (parseOnly fieldParser. pack)) (metavar "RANGE"))
+
+suggestCommand :: Mod CommandFields Options
+suggestCommand = command "suggest" (info suggestOption (progDesc "suggest the resolutions from the pixels footprint"))
+
+mergeOptions :: Parser Options
+mergeOptions = Merge
+               <$> argument str (metavar "OUTPUT")
+               <*> some (argument str (metavar "INPUTS..."))
+
+mergeCommand :: Mod CommandFields Options
+mergeCommand = command "merge" (info mergeOptions (progDesc "merge the saved cubes, one slab at a time"))
+
 options :: Parser FullOptions
 options = FullOptions
           <$> debug
-          <*> hsubparser (processCommand <> cfgNewCommand <> cfgUpdateCommand)
+          <*> hsubparser (processCommand <> cfgNewCommand <> cfgUpdateCommand <> suggestCommand <> mergeCommand)
 
 run :: (MonadIO m, MonadLogger m, MonadThrow m) => Options -> m ()
-run (Process mf mr)  = process mf mr
-run (CfgNew p mf)    = new p mf
-run (CfgUpdate f mr) = update f mr
+run (Process mf mr ml ms ck) = process mf mr ml ms ck
+run (CfgNew p mf)            = new p mf
+run (CfgUpdate f mr)         = update f mr
+run (Suggest f mr)           = suggest f mr
+run (Merge o is)             = merge o is
 
 
 main :: IO ()
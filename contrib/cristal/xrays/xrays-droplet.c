@@ -25,11 +25,39 @@
 #include <math.h>
 #include <string.h>
 
+#include <glib.h>
 #include <hdf5.h>
 
 #include "xrays/xrays-droplet.h"
 #include "xrays/xrays-macros.h"
 
+/*
+ * The images are split between the threads, each of them with its
+ * own scratch buffers. The first worker uses the buffers of the
+ * droplet, the photons and the histogram of the others are added to
+ * the droplet ones once all the images are processed. The random
+ * generator is seeded with the index of the image, so the photons do
+ * not depend on the number of threads.
+ */
+struct _XRaysDropletWorker
+{
+        XRaysImage *gtt;
+        XRaysImage *indic;
+        XRaysImage *img;
+        XRaysImage *histogram;
+        GRand *rand;
+        /* the statistics of the last image */
+        unsigned int nb_gouttes;
+        float I_max;
+        float I_tot;
+        int I_traitement;
+        /* the images [first, last) of data */
+        XRaysDroplet const *droplet;
+        unsigned short int const *data;
+        size_t first;
+        size_t last;
+};
+
 /*
  * Allocate the memory for the Droplet structure.
  */
@@ -68,17 +96,89 @@ XRaysDroplet *xrays_droplet_new(XRaysImage const *dark, double trigger,
         droplet->contour = contour;
         droplet->histogram = xrays_image_new(XRAYS_IMAGE_LONG, 10000,
                                              1, 1);
+        droplet->nb_images = 0;
+        droplet->nb_pixels = dark->width * dark->height;
+        droplet->n_threads = g_get_num_processors();
+        droplet->workers = NULL;
 
         return droplet;
 failed:
         return NULL;
 }
 
+static void workers_free(XRaysDroplet *droplet)
+{
+        size_t i;
+
+        if (NULL == droplet->workers)
+                return;
+
+        /* the first worker borrows the droplet buffers */
+        for(i=0; i<droplet->n_threads; ++i){
+                XRaysDropletWorker *w = &droplet->workers[i];
+
+                if (i > 0) {
+                        xrays_image_free(w->gtt);
+                        xrays_image_free(w->indic);
+                        xrays_image_free(w->img);
+                        xrays_image_free(w->histogram);
+                }
+                g_rand_free(w->rand);
+        }
+        free(droplet->workers);
+        droplet->workers = NULL;
+}
+
+static void workers_init(XRaysDroplet *droplet)
+{
+        size_t i;
+
+        if (NULL != droplet->workers)
+                return;
+
+        droplet->workers = calloc(droplet->n_threads, sizeof(*droplet->workers));
+        for(i=0; i<droplet->n_threads; ++i){
+                XRaysDropletWorker *w = &droplet->workers[i];
+
+                if (0 == i) {
+                        w->gtt = droplet->gtt;
+                        w->indic = droplet->indic;
+                        w->img = droplet->img;
+                        w->histogram = droplet->histogram;
+                } else {
+                        w->gtt = xrays_image_new(droplet->gtt->type, droplet->gtt->width,
+                                                 droplet->gtt->height, droplet->gtt->len);
+                        w->indic = xrays_image_new(droplet->indic->type, droplet->indic->width,
+                                                   droplet->indic->height, droplet->indic->len);
+                        w->img = xrays_image_new(droplet->img->type, droplet->img->width,
+                                                 droplet->img->height, droplet->img->len);
+                        w->histogram = xrays_image_new(droplet->histogram->type, droplet->histogram->width,
+                                                       droplet->histogram->height, droplet->histogram->len);
+                        xrays_image_clear(w->img);
+                        xrays_image_clear(w->histogram);
+                }
+                w->rand = g_rand_new();
+                w->droplet = droplet;
+        }
+}
+
+void xrays_droplet_n_threads_set(XRaysDroplet *droplet, size_t n_threads)
+{
+        if (0 == n_threads)
+                n_threads = g_get_num_processors();
+
+        if (n_threads != droplet->n_threads){
+                workers_free(droplet);
+                droplet->n_threads = n_threads;
+        }
+}
+
 /*
  * destroy the XRaysDroplet structure
  */
 void xrays_droplet_free(XRaysDroplet *droplet)
 {
+        workers_free(droplet);
         xrays_image_free(droplet->gtt);
         xrays_image_free(droplet->img);
         xrays_image_free(droplet->indic);
@@ -89,7 +189,7 @@ void xrays_droplet_free(XRaysDroplet *droplet)
 /*
  * This method compute the center of mass of a droplet.
  */
-static void droplet_intensity_and_coordinates(XRaysDroplet *droplet,
+static void droplet_intensity_and_coordinates(XRaysDropletWorker *w,
                                               unsigned short int const *imgs,
                                               int **gtt, int **contour, float *intensity, unsigned int *x, unsigned int *y)
 {
@@ -101,9 +201,10 @@ static void droplet_intensity_and_coordinates(XRaysDroplet *droplet,
         int *pcont;
         int I_pixel;
         unsigned int ratio;
+        XRaysDroplet const *droplet = w->droplet;
 
         dark = droplet->dark->data;
-        indic = droplet->indic->data;
+        indic = w->indic->data;
         width = droplet->dark->width;
         pgtt = *gtt;
         pcont = *contour;
@@ -139,9 +240,9 @@ static void droplet_intensity_and_coordinates(XRaysDroplet *droplet,
                         }
                 } while (*pcont >= 0);
         }
-        droplet->I_tot += *intensity;
-        if (*intensity > droplet->I_max)
-                droplet->I_max = *intensity;
+        w->I_tot += *intensity;
+        if (*intensity > w->I_max)
+                w->I_max = *intensity;
 
         *gtt = pgtt;
         *contour = pcont;
@@ -156,7 +257,7 @@ static void droplet_intensity_and_coordinates(XRaysDroplet *droplet,
  * La fonction retourne le pourcentage de l'energie restitu par le
  * traitement des gouttes
  */
-static void droplet_treatment(XRaysDroplet *droplet, unsigned short int const *data)
+static void droplet_treatment(XRaysDropletWorker *w, unsigned short int const *data)
 {
         int *pgtt1;
         int *pgtt2;
@@ -177,54 +278,49 @@ static void droplet_treatment(XRaysDroplet *droplet, unsigned short int const *d
         float reste;
         float I_gtt;
         size_t width;
+        XRaysDroplet const *droplet = w->droplet;
 
         imgs = data;
         dark = droplet->dark->data;
-        indic = droplet->indic->data;
+        indic = w->indic->data;
         width = droplet->dark->width;
-        image_traite = droplet->img->data;
-        histogram = droplet->histogram->data;
-        droplet->I_traitement = 0;
-        droplet->I_tot = 0;
-        droplet->I_max = 0;
-        droplet->I_traitement = 0;
+        image_traite = w->img->data;
+        histogram = w->histogram->data;
+        w->I_traitement = 0;
+        w->I_tot = 0;
+        w->I_max = 0;
         // on traite les gouttes pour remplir l'image finale
-        pgtt1 = pgtt2 = droplet->gtt->data;
+        pgtt1 = pgtt2 = w->gtt->data;
         pgtt1--;
         pgtt2--;
-        pcont1 = pcont2 = droplet->gtt->data;
-        pcont1 += droplet->gtt->len;
-        pcont2 += droplet->gtt->len;
+        pcont1 = pcont2 = w->gtt->data;
+        pcont1 += w->gtt->len;
+        pcont2 += w->gtt->len;
 
-        fprintf(stderr, " nb: %d", droplet->nb_gouttes);
-        for(i=0; i<droplet->nb_gouttes; ++i) {
+        for(i=0; i<w->nb_gouttes; ++i) {
                 x = y = I_gtt = 0;
 
                 pgtt2 = pgtt1;
                 pcont2 = pcont1;
                 // on calcule le centre de masse
                 // ici le centre de la goutte
-                droplet_intensity_and_coordinates(droplet, data, &pgtt1, &pcont1, &I_gtt, &x, &y);
+                droplet_intensity_and_coordinates(w, data, &pgtt1, &pcont1, &I_gtt, &x, &y);
 
                 // On range dans l'histogramme les ADU
-                if(I_gtt < droplet->histogram->width){
+                if(I_gtt < w->histogram->width)
                         histogram[(unsigned int)I_gtt] += 1;
-                        fprintf(stderr, " %f %d", I_gtt, histogram[(unsigned int)I_gtt]);
-                }
 
 
                 // on vrifie que la goutte n'est pas un cosmic
-                if (droplet->cosmic && I_gtt > droplet->cosmic && I_gtt < 10*droplet->cosmic) {
-                        printf("cosmic: %f\n", I_gtt);
+                if (droplet->cosmic && I_gtt > droplet->cosmic && I_gtt < 10*droplet->cosmic)
                         continue;
-                }
 
                 // on convertit les gouttes en photons X
                 if (I_gtt > droplet->seuil) {
                         if (I_gtt <= 1.5 * droplet->ADU_per_photon) {
                                 indice = floor(0.5+(double)x / I_gtt) + width * floor(0.5+(double)y / I_gtt);
                                 image_traite[indice] += 1;
-                                droplet->I_traitement += 1;
+                                w->I_traitement += 1;
                         } else {
                                 // centre de la goutte
                                 do {
@@ -234,9 +330,9 @@ static void droplet_treatment(XRaysDroplet *droplet, unsigned short int const *d
                                         I_pixel = imgs[indice] - dark[indice];
                                         nb_photons = I_pixel / droplet->ADU_per_photon;
                                         reste = (float)(I_pixel % droplet->ADU_per_photon) / droplet->ADU_per_photon;
-                                        if (rand() / (RAND_MAX + 1.) < reste) nb_photons += 1;
+                                        if (g_rand_double(w->rand) < reste) nb_photons += 1;
                                         image_traite[indice] += nb_photons;
-                                        droplet->I_traitement += nb_photons;
+                                        w->I_traitement += nb_photons;
                                 } while(*pgtt2 >= 0);
                                 // contour
                                 if(droplet->contour) {
@@ -247,18 +343,18 @@ static void droplet_treatment(XRaysDroplet *droplet, unsigned short int const *d
                                                 I_pixel = imgs[indice] -dark[indice];
                                                 ratio = abs(indic[indice]);
                                                 reste = (float)I_pixel / ratio / droplet->ADU_per_photon;
-                                                if (rand() / (RAND_MAX + 1.) < reste)
+                                                if (g_rand_double(w->rand) < reste)
                                                         nb_photons = 1;
                                                 else
                                                         nb_photons = 0;
                                                 image_traite[indice] += nb_photons;
-                                                droplet->I_traitement += nb_photons;
+                                                w->I_traitement += nb_photons;
                                         } while(*pcont2 >= 0);
                                 }
                         }
                 }
         }
-        droplet->I_traitement *= droplet->ADU_per_photon;
+        w->I_traitement *= droplet->ADU_per_photon;
 }
 
 /*
@@ -274,7 +370,7 @@ static void droplet_treatment(XRaysDroplet *droplet, unsigned short int const *d
  * un pixel appartient dj  une goutte, ou s'il s'agit d'un contour,  combien
  * de gouttes voisines il appartient.
  */
-static void find_droplets(XRaysDroplet *droplet, unsigned short int const *data, size_t size)
+static gpointer find_droplets(gpointer data)
 {
         int i;
         size_t j;
@@ -287,17 +383,20 @@ static void find_droplets(XRaysDroplet *droplet, unsigned short int const *data,
         int *indic;
         unsigned short int const *imgs;
         unsigned short int const *dark;
+        XRaysDropletWorker *w = data;
+        XRaysDroplet const *droplet = w->droplet;
 
-        indic = droplet->indic->data;
+        indic = w->indic->data;
         dark = droplet->dark->data;
-        imgs = data;
         nb_pixels = droplet->dark->width * droplet->dark->height;
+        imgs = w->data + w->first * nb_pixels;
 
-        for(j=0; j<size; ++j) {
-                xrays_image_clear(droplet->indic);
-                droplet->nb_gouttes = 0;
-                pgtt1_i32 = pgtt2_i32 = pcont = droplet->gtt->data;
-                pcont += droplet->gtt->len;
+        for(j=w->first; j<w->last; ++j) {
+                xrays_image_clear(w->indic);
+                w->nb_gouttes = 0;
+                g_rand_set_seed(w->rand, droplet->nb_images + j);
+                pgtt1_i32 = pgtt2_i32 = pcont = w->gtt->data;
+                pcont += w->gtt->len;
 
                 for(i=0; i<nb_pixels; ++i) {
                         // on vrifie que ce pixel n'a pas t dj compt.
@@ -309,9 +408,9 @@ static void find_droplets(XRaysDroplet *droplet, unsigned short int const *data,
 
                         // si oui on met l'indice_ui32 du pixel dans le tableau gtt
                         *pgtt1_i32 = i + 1;
-                        droplet->nb_gouttes += 1;
+                        w->nb_gouttes += 1;
                         // on marque le pixel comme appartenant  la goutte.
-                        indic[i] = droplet->nb_gouttes;
+                        indic[i] = w->nb_gouttes;
 
                         // on explore les environs du pixel: attention on
                         // inverse l'axe des y et on stock dans gtt les indice_ui32s numrot
@@ -330,7 +429,7 @@ static void find_droplets(XRaysDroplet *droplet, unsigned short int const *data,
                                 } else {
                                         pgtt2_i32 += 1;
                                         *pgtt2_i32 = indice_ui32 + 1;
-                                        indic[indice_ui32] = droplet->nb_gouttes;
+                                        indic[indice_ui32] = w->nb_gouttes;
                                 }
 _pixel_2:
                                 //x+1,y
@@ -345,7 +444,7 @@ _pixel_2:
                                 } else {
                                         pgtt2_i32 += 1;
                                         *pgtt2_i32 = indice_ui32 + 1;
-                                        indic[indice_ui32] = droplet->nb_gouttes;
+                                        indic[indice_ui32] = w->nb_gouttes;
                                 }
 _pixel_3:
                                 //x,y-1
@@ -360,7 +459,7 @@ _pixel_3:
                                 } else {
                                         pgtt2_i32 += 1;
                                         *pgtt2_i32 = indice_ui32 + 1;
-                                        indic[indice_ui32] = droplet->nb_gouttes;
+                                        indic[indice_ui32] = w->nb_gouttes;
                                 }
 _pixel_4:
                                 //x-1,y
@@ -375,7 +474,7 @@ _pixel_4:
                                 } else {
                                         pgtt2_i32 += 1;
                                         *pgtt2_i32 = indice_ui32 + 1;
-                                        indic[indice_ui32] = droplet->nb_gouttes;
+                                        indic[indice_ui32] = w->nb_gouttes;
                                 }
 _last:
                                 pgtt1_i32 += 1;
@@ -388,24 +487,74 @@ _last:
                         *pgtt2_i32 *= -1;
                         *pcont *= -1;
                 }
-                droplet_treatment(droplet, imgs);
+                droplet_treatment(w, imgs);
                 //droplet_treatment_fast(droplet, data);
                 imgs += nb_pixels;
         }
+
+        return NULL;
+}
+
+/* add the partial photons and histogram of a worker to the droplet
+ * ones, the integer sums do not depend on the order */
+static void worker_merge(XRaysDroplet *droplet, XRaysDropletWorker *w)
+{
+        size_t i;
+        size_t n;
+        unsigned int *img = droplet->img->data;
+        unsigned int const *w_img = w->img->data;
+        int *histogram = droplet->histogram->data;
+        int const *w_histogram = w->histogram->data;
+
+        n = droplet->img->width * droplet->img->height * droplet->img->len;
+        for(i=0; i<n; ++i)
+                img[i] += w_img[i];
+        for(i=0; i<droplet->histogram->width; ++i)
+                histogram[i] += w_histogram[i];
+
+        xrays_image_clear(w->img);
+        xrays_image_clear(w->histogram);
 }
 
 int xrays_droplet_add_images(XRaysDroplet *droplet, XRaysImage const *imgs)
 {
-        int res;
+        size_t i;
+        size_t n_workers;
+        GThread *threads[droplet->n_threads];
 
         if (imgs->type != XRAYS_IMAGE_USHORT)
-                res = -1;
-        else {
-                find_droplets(droplet, imgs->data, imgs->len);
-                res = 0;
+                return -1;
+
+        if (0 == imgs->len)
+                return 0;
+
+        workers_init(droplet);
+
+        n_workers = MIN(droplet->n_threads, imgs->len);
+        for(i=0; i<n_workers; ++i){
+                XRaysDropletWorker *w = &droplet->workers[i];
+
+                w->data = imgs->data;
+                w->first = i * imgs->len / n_workers;
+                w->last = (i + 1) * imgs->len / n_workers;
         }
 
-        return res;
+        for(i=1; i<n_workers; ++i)
+                threads[i] = g_thread_new("droplet", find_droplets, &droplet->workers[i]);
+        find_droplets(&droplet->workers[0]);
+        for(i=1; i<n_workers; ++i){
+                g_thread_join(threads[i]);
+                worker_merge(droplet, &droplet->workers[i]);
+        }
+
+        /* the statistics of the last image */
+        droplet->nb_gouttes = droplet->workers[n_workers - 1].nb_gouttes;
+        droplet->I_max = droplet->workers[n_workers - 1].I_max;
+        droplet->I_tot = droplet->workers[n_workers - 1].I_tot;
+        droplet->I_traitement = droplet->workers[n_workers - 1].I_traitement;
+        droplet->nb_images += imgs->len;
+
+        return 0;
 }
 
 
@@ -27,6 +27,7 @@
 XRAYS_BEGIN_DECLS
 
 typedef struct _XRaysDroplet XRaysDroplet;
+typedef struct _XRaysDropletWorker XRaysDropletWorker;
 
 struct _XRaysDroplet
 {
@@ -48,6 +49,8 @@ struct _XRaysDroplet
 	int nb_images;
 	int nb_pixels;
 	XRaysImage *histogram;
+	size_t n_threads;
+	XRaysDropletWorker *workers; /* the scratch buffers of the threads */
 };
 
 /*
@@ -60,6 +63,13 @@ extern XRaysDroplet* xrays_droplet_new(XRaysImage const *dark, double trigger, d
  */
 extern void xrays_droplet_free(XRaysDroplet *droplet);
 
+/*
+ * split the images of xrays_droplet_add_images between n_threads
+ * threads (0 means the number of processors, the default). The
+ * result does not depend on the number of threads.
+ */
+extern void xrays_droplet_n_threads_set(XRaysDroplet *droplet, size_t n_threads);
+
 /*
  * Cette fonction rempli le tableau gtt pour un niveau de trigger donn. Le
  * principe est simplement de remplir par le bas le tableau avec les
@@ -20,18 +20,19 @@
  * Authors: Picca Frdric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "xrays-image-spe.h"
 
-XRaysImage* xrays_image_spe_read(FILE *file)
+static XRaysImageType spe_type(WINXHEAD const *header)
 {
-	WINXHEAD header;
-	XRaysImage *img;
 	XRaysImageType type;
 
-	rewind(file);
-	fread(&header, sizeof(header), 1, file);
-
-	switch (header.datatype){
+	switch (header->datatype){
 		case 0:
 			type = XRAYS_IMAGE_FLOAT;
 			break;
@@ -50,6 +51,20 @@ XRaysImage* xrays_image_spe_read(FILE *file)
 			break;
 	}
 
+	return type;
+}
+
+XRaysImage* xrays_image_spe_read(FILE *file)
+{
+	WINXHEAD header;
+	XRaysImage *img;
+	XRaysImageType type;
+
+	rewind(file);
+	fread(&header, sizeof(header), 1, file);
+
+	type = spe_type(&header);
+
 	img = xrays_image_new(type, header.xdim, header.ydim, header.NumFrames);
 	if (img)
 		fread(img->data, img->elem_size, header.xdim * header.ydim * header.NumFrames, file);
@@ -57,5 +72,100 @@ XRaysImage* xrays_image_spe_read(FILE *file)
 	return img;
 }
 
+/* advise the kernel to read [start, start + len) ahead */
+static void spe_prefetch(XRaysImageSpeMap *map, char const *start, size_t len)
+{
+	char const *end = (char const *)map->addr + map->length;
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t aligned = (uintptr_t)start & ~(page - 1);
+
+	if (start >= end)
+		return;
+	if (start + len > end)
+		len = end - start;
+	madvise((void *)aligned, (uintptr_t)start + len - aligned, MADV_WILLNEED);
+}
+
+/*
+ * map the whole file instead of reading it, the frames are paged in
+ * on demand. The mapping is private so the frames can be modified in
+ * place without touching the file.
+ */
+XRaysImageSpeMap* xrays_image_spe_map(char const *filename)
+{
+	int fd;
+	struct stat st;
+	WINXHEAD const *header;
+	XRaysImageType type;
+	XRaysImageSpeMap *map;
+	size_t n;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(WINXHEAD))
+		goto close_fd;
+
+	map = calloc(1, sizeof(*map));
+	if (!map)
+		die("Can not allocate memory");
+
+	map->length = st.st_size;
+	map->addr = mmap(NULL, map->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map->addr)
+		goto free_map;
+	madvise(map->addr, map->length, MADV_SEQUENTIAL);
+
+	header = map->addr;
+	type = spe_type(header);
+	map->img = xrays_image_attach(type, header->xdim, header->ydim, header->NumFrames,
+				      (char *)map->addr + sizeof(WINXHEAD));
+
+	/* check that the file contains all the frames */
+	n = map->img->width * map->img->height * map->img->len * map->img->elem_size;
+	if (map->length - sizeof(WINXHEAD) < n)
+		goto detach;
+
+	map->frame = *map->img;
+	map->frame.len = 1;
+	map->next = 0;
+
+	close(fd);
+
+	return map;
+
+detach:
+	xrays_image_detach(map->img);
+	munmap(map->addr, map->length);
+free_map:
+	free(map);
+close_fd:
+	close(fd);
+	return NULL;
+}
+
+XRaysImage const* xrays_image_spe_map_next(XRaysImageSpeMap *map)
+{
+	size_t size;
+
+	if (map->next >= map->img->len)
+		return NULL;
+
+	size = map->img->width * map->img->height * map->img->elem_size;
+	map->frame.data = (char *)map->img->data + map->next * size;
+	map->next++;
+	spe_prefetch(map, (char const *)map->frame.data + size, size);
+
+	return &map->frame;
+}
+
+void xrays_image_spe_unmap(XRaysImageSpeMap *map)
+{
+	xrays_image_detach(map->img);
+	munmap(map->addr, map->length);
+	free(map);
+}
+
 void xrays_image_spe_write(XRaysImage *img, FILE *file)
 {}
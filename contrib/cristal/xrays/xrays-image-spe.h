@@ -217,8 +217,28 @@ typedef struct {
 
 #pragma pack()
 
+/* an SPE file mapped in memory, the frames are exposed in place */
+typedef struct _XRaysImageSpeMap XRaysImageSpeMap;
+
+struct _XRaysImageSpeMap
+{
+	void *addr;
+	size_t length;
+	XRaysImage *img; /* all the frames */
+	XRaysImage frame; /* the current frame of the iterator */
+	size_t next;
+};
+
 XRaysImage* xrays_image_spe_read(FILE *file);
 
+XRaysImageSpeMap* xrays_image_spe_map(char const *filename);
+
+/* return the next frame or NULL once all the frames were visited,
+ * the following frame is prefetched while the current one is used */
+XRaysImage const* xrays_image_spe_map_next(XRaysImageSpeMap *map);
+
+void xrays_image_spe_unmap(XRaysImageSpeMap *map);
+
 void xrays_image_spe_write(XRaysImage *img, FILE *file);
 
 XRAYS_END_DECLS
@@ -20,8 +20,11 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 
-#include <stdio.h>
+#include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "xrays-macros.h"
@@ -77,6 +80,75 @@ static int same_dims(XRaysImage const *img1, XRaysImage const *img2)
 		&& img1->len == img2->len;
 }
 
+static size_t nb_elements(XRaysImage const *img)
+{
+	return img->width * img->height * img->len;
+}
+
+/*
+ * The kernels are written as plain loops over contiguous arrays with
+ * size_t indexes and without function calls, so that the compiler
+ * can vectorise them. The type tests are compile time constants, only
+ * the relevant branch remains once the macros are expanded.
+ */
+
+#define XRAYS_IS_INTEGRAL(type) ((type)0.5 == 0)
+
+/* store v into the integral dst with saturation */
+#define XRAYS_SATURATE(dst, v, lo, hi)		\
+	do{					\
+		if ((v) <= (lo))		\
+			(dst) = (lo);		\
+		else if ((v) >= (hi))		\
+			(dst) = (hi);		\
+		else				\
+			(dst) = (v);		\
+	} while(0)
+
+/* expand KERNEL(type) for the type of the image */
+#define XRAYS_DISPATCH(KERNEL, img)					\
+	switch((img)->type) {						\
+	case XRAYS_IMAGE_SHORT: KERNEL(short int); break;		\
+	case XRAYS_IMAGE_USHORT: KERNEL(unsigned short int); break;	\
+	case XRAYS_IMAGE_UINT: KERNEL(unsigned int); break;		\
+	case XRAYS_IMAGE_INT: KERNEL(int); break;			\
+	case XRAYS_IMAGE_FLOAT: KERNEL(float); break;			\
+	case XRAYS_IMAGE_LONG: KERNEL(long); break;			\
+	}
+
+/* expand KERNEL(a, lo, hi, b) for all the dst x src types */
+#define XRAYS_DISPATCH_SRC(KERNEL, a, lo, hi, src)			\
+	switch((src)->type) {						\
+	case XRAYS_IMAGE_SHORT: KERNEL(a, lo, hi, short int); break;	\
+	case XRAYS_IMAGE_USHORT: KERNEL(a, lo, hi, unsigned short int); break; \
+	case XRAYS_IMAGE_UINT: KERNEL(a, lo, hi, unsigned int); break;	\
+	case XRAYS_IMAGE_INT: KERNEL(a, lo, hi, int); break;		\
+	case XRAYS_IMAGE_FLOAT: KERNEL(a, lo, hi, float); break;	\
+	case XRAYS_IMAGE_LONG: KERNEL(a, lo, hi, long); break;		\
+	}
+
+#define XRAYS_DISPATCH2(KERNEL, dst, src)				\
+	switch((dst)->type) {						\
+	case XRAYS_IMAGE_SHORT:						\
+		XRAYS_DISPATCH_SRC(KERNEL, short int, SHRT_MIN, SHRT_MAX, src); \
+		break;							\
+	case XRAYS_IMAGE_USHORT:					\
+		XRAYS_DISPATCH_SRC(KERNEL, unsigned short int, 0, USHRT_MAX, src); \
+		break;							\
+	case XRAYS_IMAGE_UINT:						\
+		XRAYS_DISPATCH_SRC(KERNEL, unsigned int, 0, UINT_MAX, src); \
+		break;							\
+	case XRAYS_IMAGE_INT:						\
+		XRAYS_DISPATCH_SRC(KERNEL, int, INT_MIN, INT_MAX, src);	\
+		break;							\
+	case XRAYS_IMAGE_FLOAT:						\
+		XRAYS_DISPATCH_SRC(KERNEL, float, -FLT_MAX, FLT_MAX, src); \
+		break;							\
+	case XRAYS_IMAGE_LONG:						\
+		XRAYS_DISPATCH_SRC(KERNEL, long, LONG_MIN, LONG_MAX, src); \
+		break;							\
+	}
+
 /* public */
 
 XRaysImage* xrays_image_new(XRaysImageType type,
@@ -214,40 +286,34 @@ double xrays_image_rms(XRaysImage const *img)
 {
 	double rms = 0;
 
+	/* four independent accumulators, one per vector lane */
 #define XRAYS_RMS(type)\
 	do{\
-		int i;\
+		size_t i;\
+		size_t k;\
 		double mean = 0;\
-		int nb_elements = img->width * img->height * img->len;\
-		type *data = img->data;\
-		for(i=0;i<nb_elements;++i){\
-			mean += data[i];\
-			rms += data[i] * data[i];\
+		double sum[4] = {0};\
+		double sum2[4] = {0};\
+		size_t n = nb_elements(img);\
+		type const *data = img->data;\
+		for(i=0;i+4<=n;i+=4)\
+			for(k=0;k<4;++k){\
+				double v = data[i+k];\
+				sum[k] += v;\
+				sum2[k] += v * v;\
+			}\
+		for(;i<n;++i){\
+			double v = data[i];\
+			sum[0] += v;\
+			sum2[0] += v * v;\
 		}\
-		mean *= mean / nb_elements;\
-		rms = sqrt((rms - mean) / (nb_elements-1));\
-	} while(0);
+		mean = sum[0] + sum[1] + sum[2] + sum[3];\
+		rms = sum2[0] + sum2[1] + sum2[2] + sum2[3];\
+		mean *= mean / n;\
+		rms = sqrt((rms - mean) / (n-1));\
+	} while(0)
 
-	switch(img->type) {
-		case XRAYS_IMAGE_SHORT:
-			XRAYS_RMS(short int);
-			break;
-		case XRAYS_IMAGE_USHORT:
-			XRAYS_RMS(unsigned short int);
-			break;
-		case XRAYS_IMAGE_INT:
-			XRAYS_RMS(int);
-			break;
-		case XRAYS_IMAGE_UINT:
-			XRAYS_RMS(unsigned int);
-			break;
-		case XRAYS_IMAGE_LONG:
-			XRAYS_RMS(long);
-			break;
-		case XRAYS_IMAGE_FLOAT:
-			XRAYS_RMS(float);
-			break;
-	}
+	XRAYS_DISPATCH(XRAYS_RMS, img);
 
 	return rms;
 #undef XRAYS_RMS
@@ -255,163 +321,76 @@ double xrays_image_rms(XRaysImage const *img)
 
 void xrays_image_min_max(XRaysImage const *img, double *min, double *max)
 {
+	*min = *max = 0;
+	if (0 == nb_elements(img))
+		return;
+
+	/* keep the extrema in the image type in the loop */
 #define XRAYS_MIN_MAX(type)\
 	do{\
-		int i;\
-		int nb_elements = img->width * img->height * img->len;\
-		type *data = img->data;\
-		*min = *max = data[0];\
-		for(i=1;i<nb_elements;++i){\
-			*min = data[i] < *min ? data[i] : *min;\
-			*max = data[i] > *max ? data[i] : *max;\
+		size_t i;\
+		size_t n = nb_elements(img);\
+		type const *data = img->data;\
+		type lmin = data[0];\
+		type lmax = data[0];\
+		for(i=1;i<n;++i){\
+			lmin = data[i] < lmin ? data[i] : lmin;\
+			lmax = data[i] > lmax ? data[i] : lmax;\
 		}\
-	} while(0);
+		*min = lmin;\
+		*max = lmax;\
+	} while(0)
+
+	XRAYS_DISPATCH(XRAYS_MIN_MAX, img);
 
-	switch(img->type) {
-		case XRAYS_IMAGE_SHORT:
-			XRAYS_MIN_MAX(short int);
-			break;
-		case XRAYS_IMAGE_USHORT:
-			XRAYS_MIN_MAX(unsigned short int);
-			break;
-		case XRAYS_IMAGE_INT:
-			XRAYS_MIN_MAX(int);
-			break;
-		case XRAYS_IMAGE_UINT:
-			XRAYS_MIN_MAX(unsigned int);
-			break;
-		case XRAYS_IMAGE_LONG:
-			XRAYS_MIN_MAX(long);
-			break;
-		case XRAYS_IMAGE_FLOAT:
-			XRAYS_MIN_MAX(float);
-			break;
-	}
 #undef XRAYS_MIN_MAX
 }
 
+/*
+ * img1 += img2 for all the types, the integral images saturate
+ * instead of wrapping around and the floating point values are
+ * rounded to the nearest integer.
+ */
 void xrays_image_add(XRaysImage *img1, XRaysImage const *img2)
 {
-#define XRAYS_ADD(a, b)\
+#define XRAYS_ADD(a, lo, hi, b)\
 	do{\
-		int i;\
-		int nb_elements = img1->width * img1->height * img1->len;\
+		size_t i;\
+		size_t n = nb_elements(img1);\
 		a *data1 = img1->data;\
-		b *data2 = img2->data;\
-		for(i=0;i<nb_elements;++i){\
-			data1[i] += data2[i];\
+		b const *data2 = img2->data;\
+		if (!XRAYS_IS_INTEGRAL(a)){\
+			for(i=0;i<n;++i)\
+				data1[i] += data2[i];\
+		} else if (!XRAYS_IS_INTEGRAL(b)){\
+			for(i=0;i<n;++i){\
+				double v = rint((double)data1[i] + data2[i]);\
+				XRAYS_SATURATE(data1[i], v, lo, hi);\
+			}\
+		} else if (sizeof(a) < sizeof(int64_t) && sizeof(b) < sizeof(int64_t)){\
+			for(i=0;i<n;++i){\
+				int64_t v = (int64_t)data1[i] + (int64_t)data2[i];\
+				XRAYS_SATURATE(data1[i], v, lo, hi);\
+			}\
+		} else {\
+			for(i=0;i<n;++i){\
+				long x = data1[i];\
+				long y = data2[i];\
+				if (y > 0 && x > LONG_MAX - y)\
+					x = LONG_MAX;\
+				else if (y < 0 && x < LONG_MIN - y)\
+					x = LONG_MIN;\
+				else\
+					x += y;\
+				XRAYS_SATURATE(data1[i], x, lo, hi);\
+			}\
 		}\
-	} while(0);
+	} while(0)
 
 	/* check that dimension are equals */
 	if (same_dims(img1, img2))
-		switch(img1->type) {
-			case XRAYS_IMAGE_USHORT:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(unsigned short int, unsigned short int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-					case XRAYS_IMAGE_UINT:
-					case XRAYS_IMAGE_INT:
-					case XRAYS_IMAGE_LONG:
-					case XRAYS_IMAGE_FLOAT:
-						break;
-				}
-				break;
-			case XRAYS_IMAGE_SHORT:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(short int, unsigned short int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-						XRAYS_ADD(short int, short int);
-						break;
-					case XRAYS_IMAGE_UINT:
-					case XRAYS_IMAGE_INT:
-					case XRAYS_IMAGE_LONG:
-					case XRAYS_IMAGE_FLOAT:
-						break;
-				}
-				break;
-			case XRAYS_IMAGE_UINT:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(unsigned int, unsigned short int);
-						break;
-					case XRAYS_IMAGE_UINT:
-						XRAYS_ADD(unsigned int, unsigned int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-					case XRAYS_IMAGE_INT:
-					case XRAYS_IMAGE_LONG:
-					case XRAYS_IMAGE_FLOAT:
-						break;
-				}
-				break;
-			case XRAYS_IMAGE_INT:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(int, unsigned short int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-						XRAYS_ADD(int, short int);
-						break;
-					case XRAYS_IMAGE_UINT:
-						XRAYS_ADD(int, unsigned int);
-						break;
-					case XRAYS_IMAGE_INT:
-						XRAYS_ADD(int, int);
-						break;
-					case XRAYS_IMAGE_LONG:
-					case XRAYS_IMAGE_FLOAT:
-						break;
-				}
-				break;
-			case XRAYS_IMAGE_LONG:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(long, unsigned short int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-						XRAYS_ADD(long, short int);
-						break;
-					case XRAYS_IMAGE_UINT:
-						XRAYS_ADD(long, unsigned int);
-						break;
-					case XRAYS_IMAGE_INT:
-						XRAYS_ADD(long, int);
-						break;
-					case XRAYS_IMAGE_LONG:
-						XRAYS_ADD(long, long);
-						break;
-					case XRAYS_IMAGE_FLOAT:
-						break;
-				}
-				break;
-			case XRAYS_IMAGE_FLOAT:
-				switch(img2->type) {
-					case XRAYS_IMAGE_USHORT:
-						XRAYS_ADD(float, unsigned short int);
-						break;
-					case XRAYS_IMAGE_SHORT:
-						XRAYS_ADD(float, short int);
-						break;
-					case XRAYS_IMAGE_UINT:
-						XRAYS_ADD(float, unsigned int);
-						break;
-					case XRAYS_IMAGE_INT:
-						XRAYS_ADD(float, int);
-						break;
-					case XRAYS_IMAGE_LONG:
-						XRAYS_ADD(float, long);
-						break;
-					case XRAYS_IMAGE_FLOAT:
-						XRAYS_ADD(float, float);
-						break;
-				}
-				break;
-		}
+		XRAYS_DISPATCH2(XRAYS_ADD, img1, img2);
+
 #undef XRAYS_ADD
 }
 
@@ -419,72 +398,47 @@ void xrays_image_div(XRaysImage *img, double d)
 {
 #define XRAYS_DIV(type)\
 	do{\
-		int i;\
-		int nb_elements = img->width * img->height * img->len;\
+		size_t i;\
+		size_t n = nb_elements(img);\
 		type *data = img->data;\
-		for(i=0;i<nb_elements;++i){\
+		for(i=0;i<n;++i){\
 			data[i] /= d;\
 		}\
-	} while(0);
+	} while(0)
+
+	XRAYS_DISPATCH(XRAYS_DIV, img);
 
-	switch(img->type) {
-		case XRAYS_IMAGE_SHORT:
-			XRAYS_DIV(short int);
-			break;
-		case XRAYS_IMAGE_USHORT:
-			XRAYS_DIV(unsigned short int);
-			break;
-		case XRAYS_IMAGE_INT:
-			XRAYS_DIV(int);
-			break;
-		case XRAYS_IMAGE_UINT:
-			XRAYS_DIV(unsigned int);
-			break;
-		case XRAYS_IMAGE_LONG:
-			XRAYS_DIV(long);
-			break;
-		case XRAYS_IMAGE_FLOAT:
-			XRAYS_DIV(float);
-			break;
-	}
 #undef XRAYS_DIV
 }
 
+/*
+ * dst = src for all the types, the values out of the range of an
+ * integral dst are saturated and the floating point values are
+ * rounded to the nearest integer.
+ */
 void xrays_image_convert(XRaysImage *dst, XRaysImage const *src)
 {
-#define XRAYS_CONVERT(a, b)\
+#define XRAYS_CONVERT(a, lo, hi, b)\
 	do{\
-		int i;\
-		int nb_elements = dst->width * dst->height * dst->len;\
+		size_t i;\
+		size_t n = nb_elements(dst);\
 		a *data1 = dst->data;\
-		b *data2 = src->data;\
-		for(i=0;i<nb_elements;++i){\
-			data1[i] = data2[i];\
-		}\
-	} while(0);
-
-#define XRAYS_CONVERT_INTEGRAL(a, b)                                    \
-	do{                                                             \
-		int i;                                                  \
-		int nb_elements = dst->width * dst->height * dst->len;  \
-		a *data1 = dst->data;                                   \
-		b *data2 = src->data;                                   \
-		for(i=0;i<nb_elements;++i){                             \
-			data1[i] = rint(data2[i]);                      \
-		}                                                       \
-	} while(0);
-
-
-#define XRAYS_CONVERT_MIN_MAX(a, b, c, d)       \
-	do{\
-		double min;\
-		double max;\
-		xrays_image_min_max(src, &min, &max);\
-		printf("min : %f max : %f\n", min, max);\
-		if (min >= c && max <= d){\
-			XRAYS_CONVERT(a, b);\
+		b const *data2 = src->data;\
+		if (!XRAYS_IS_INTEGRAL(a)){\
+			for(i=0;i<n;++i)\
+				data1[i] = data2[i];\
+		} else if (!XRAYS_IS_INTEGRAL(b)){\
+			for(i=0;i<n;++i){\
+				double v = rint(data2[i]);\
+				XRAYS_SATURATE(data1[i], v, lo, hi);\
+			}\
+		} else {\
+			for(i=0;i<n;++i){\
+				int64_t v = data2[i];\
+				XRAYS_SATURATE(data1[i], v, lo, hi);\
+			}\
 		}\
-	} while(0);
+	} while(0)
 
 	/* same type */
 	if (dst->type == src->type) {
@@ -496,101 +450,7 @@ void xrays_image_convert(XRaysImage *dst, XRaysImage const *src)
 	if (!same_dims(dst, src))
 		return;
 
-	switch(dst->type) {
-		case XRAYS_IMAGE_USHORT:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-				case XRAYS_IMAGE_SHORT:
-				case XRAYS_IMAGE_UINT:
-					XRAYS_CONVERT_MIN_MAX(unsigned short int, unsigned int, 0, 65535);
-					break;
-				case XRAYS_IMAGE_INT:
-				case XRAYS_IMAGE_LONG:
-				case XRAYS_IMAGE_FLOAT:
-                                        XRAYS_CONVERT_INTEGRAL(unsigned short int, float);
-					break;
-			}
-			break;
-		case XRAYS_IMAGE_SHORT:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-				case XRAYS_IMAGE_SHORT:
-				case XRAYS_IMAGE_UINT:
-				case XRAYS_IMAGE_INT:
-				case XRAYS_IMAGE_LONG:
-				case XRAYS_IMAGE_FLOAT:
-					break;
-			}
-			break;
-		case XRAYS_IMAGE_UINT:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-					XRAYS_CONVERT(unsigned int, unsigned short int);
-					break;
-				case XRAYS_IMAGE_SHORT:
-				case XRAYS_IMAGE_UINT:
-				case XRAYS_IMAGE_INT:
-				case XRAYS_IMAGE_LONG:
-				case XRAYS_IMAGE_FLOAT:
-					break;
-			}
-			break;
-		case XRAYS_IMAGE_INT:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-					XRAYS_CONVERT(int, unsigned short int);
-					break;
-				case XRAYS_IMAGE_SHORT:
-					XRAYS_CONVERT(int, short int);
-					break;
-				case XRAYS_IMAGE_UINT:
-				case XRAYS_IMAGE_INT:
-				case XRAYS_IMAGE_LONG:
-				case XRAYS_IMAGE_FLOAT:
-					break;
-			}
-			break;
-		case XRAYS_IMAGE_LONG:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-					XRAYS_CONVERT(long, unsigned short int);
-					break;
-				case XRAYS_IMAGE_SHORT:
-					XRAYS_CONVERT(long, short int);
-					break;
-				case XRAYS_IMAGE_UINT:
-					XRAYS_CONVERT(long, unsigned int);
-					break;
-				case XRAYS_IMAGE_INT:
-					XRAYS_CONVERT(long, int);
-					break;
-				case XRAYS_IMAGE_LONG:
-				case XRAYS_IMAGE_FLOAT:
-					break;
-			}
-			break;
-		case XRAYS_IMAGE_FLOAT:
-			switch(src->type) {
-				case XRAYS_IMAGE_USHORT:
-					XRAYS_CONVERT(float, unsigned short int);
-					break;
-				case XRAYS_IMAGE_SHORT:
-					XRAYS_CONVERT(float, short int);
-					break;
-				case XRAYS_IMAGE_UINT:
-					XRAYS_CONVERT(float, unsigned int);
-					break;
-				case XRAYS_IMAGE_INT:
-					XRAYS_CONVERT(float, int);
-					break;
-				case XRAYS_IMAGE_LONG:
-					XRAYS_CONVERT(float, long);
-					break;
-				case XRAYS_IMAGE_FLOAT:
-					break;
-			}
-			break;
-	}
-#undef XRAYS_CONVERT_MIN_MAX
+	XRAYS_DISPATCH2(XRAYS_CONVERT, dst, src);
+
 #undef XRAYS_CONVERT
 }
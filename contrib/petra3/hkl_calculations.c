@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "hkl.h"
 #include <gsl/gsl_vector.h>
@@ -111,7 +113,7 @@ HklSample *new_hkl_sample(void)
     return sample;
 }
 
-HklEngine *new_hkl_engine(char *diffr_type,
+HklEngine *new_hkl_engine(char *diffr_type, HklEngineList **engines_out,
                           HklGeometry *geometry, HklDetector *detector, HklSample *sample)
 {
     const HklFactory *factory;
@@ -120,6 +122,7 @@ HklEngine *new_hkl_engine(char *diffr_type,
 
     factory = hkl_factory_get_by_name(diffr_type, NULL);
     engines = hkl_factory_create_new_engine_list(factory);
+    *engines_out = engines;
     hkl_engine_list_init(engines, geometry, detector, sample);
     engine = hkl_engine_list_engine_get_by_name(engines, engine_type, NULL);
 
@@ -217,38 +220,16 @@ void calculate_M_matrix(const HklGeometry *geometry, HklDetector *detector, gsl_
 }
 
 
-void compute_transf_matrix(double *refl_hkl, double trans_matrix[3][3])
+/* the transformation matrix M.R.UB of a solved geometry */
+void compute_transf_matrix(const HklGeometry *geom, HklDetector *detector,
+                           HklSample *sample, double trans_matrix[3][3])
 {
-    HklSample *sample;
-    HklGeometry *geometry;
-    const HklGeometry *geom;
-    HklDetector *detector;
-    HklEngine *engine;
-    HklGeometryList *geometries;
-
     HklQuaternion R_quat;
     HklMatrix *R_hkl;
     const HklMatrix *UB_hkl;
     gsl_matrix *UB, *M, *R, *T, *MRUB;
 
     int i, j;
-    double angles[6];
-    int n_angles = 6;
-
-    sample = new_hkl_sample();
-    geometry = new_hkl_geometry(diffr_type, wavelength);
-    detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
-    engine = new_hkl_engine(diffr_type, geometry, detector, sample);
-    geometries = hkl_engine_pseudo_axis_values_set(engine, refl_hkl, 3, HKL_UNIT_USER, NULL);
-    geom = hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries));
-
-    /* The values of the angles (4S + 2D) can be obtained with */
-    hkl_geometry_axis_values_get(geom, angles, n_angles, HKL_UNIT_USER);
-    for (i = 0; i < n_angles; ++i){
-        printf(" %8.5f ", angles[i]);
-    }
-    printf("\n");
-
 
     /* Matrix transformation from lab to BG reference frame */
     M = gsl_matrix_alloc(3, 3);
@@ -274,31 +255,241 @@ void compute_transf_matrix(double *refl_hkl, double trans_matrix[3][3])
         }
     }
 
-    hkl_sample_free(sample);
-    hkl_detector_free(detector);
-    hkl_geometry_free(geometry);
+    gsl_matrix_free(MRUB);
+    gsl_matrix_free(T);
+    gsl_matrix_free(UB);
+    gsl_matrix_free(R);
+    gsl_matrix_free(M);
+    hkl_matrix_free(R_hkl);
 }
 
-int main(void)
+/* Targets: one "h k l" per line, separated by spaces, tabs or commas.
+ * The empty lines and the lines starting with # are skipped. */
+double *read_targets_csv(FILE *f, size_t *n_targets)
 {
-    int i, j, k;
-    double refl_hkl[] = {0.5, 6.5, 0.43};
+    char line[1024];
+    GArray *targets = g_array_new(FALSE, FALSE, sizeof(double));
+
+    while(fgets(line, sizeof(line), f)){
+        char *p = line;
+        char *end;
+        double hkl[3];
+        int i;
+
+        p += strspn(p, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        for(i = 0; i < 3; ++i){
+            p += strspn(p, " \t,");
+            hkl[i] = strtod(p, &end);
+            if (end == p){
+                printf("\n>>> There is a problem with the target line: %s", line);
+                exit(EXIT_FAILURE);
+            }
+            p = end;
+        }
+        g_array_append_vals(targets, hkl, 3);
+    }
+
+    *n_targets = targets->len / 3;
+    return (double *)g_array_free(targets, FALSE);
+}
+
+/* Targets: a (n, 3) little endian float64 C ordered npy array. */
+double *read_targets_npy(FILE *f, size_t *n_targets)
+{
+    unsigned char preamble[10];
+    size_t header_len;
+    char *header;
+    char *shape;
+    double *targets = NULL;
+    size_t n, m;
+
+    if (fread(preamble, 1, 10, f) != 10 || memcmp(preamble, "\x93NUMPY", 6))
+        goto fail;
+    header_len = preamble[8] | (preamble[9] << 8);
+    if (preamble[6] >= 2){
+        unsigned char ext[2];
+
+        /* version 2 and 3 use a 4 bytes header length */
+        if (fread(ext, 1, 2, f) != 2)
+            goto fail;
+        header_len |= (ext[0] << 16) | ((size_t)ext[1] << 24);
+    }
+
+    header = g_malloc0(header_len + 1);
+    if (fread(header, 1, header_len, f) != header_len
+        || !strstr(header, "'descr': '<f8'")
+        || !strstr(header, "'fortran_order': False")
+        || !(shape = strstr(header, "'shape': ("))
+        || sscanf(shape, "'shape': (%zu, %zu)", &n, &m) != 2
+        || m != 3){
+        g_free(header);
+        goto fail;
+    }
+    g_free(header);
+
+    targets = g_new(double, n * 3);
+    if (fread(targets, sizeof(double), n * 3, f) != n * 3){
+        g_free(targets);
+        goto fail;
+    }
+
+    *n_targets = n;
+    return targets;
+
+fail:
+    printf("\n>>> There is a problem with the npy targets, a (n, 3) float64 array is expected.\n");
+    exit(EXIT_FAILURE);
+}
+
+double *read_targets(const char *filename, size_t *n_targets)
+{
+    FILE *f;
+    double *targets;
+    size_t len = strlen(filename);
+
+    if (!strcmp(filename, "-"))
+        return read_targets_csv(stdin, n_targets);
+
+    f = fopen(filename, "rb");
+    if (NULL == f){
+        printf("\n>>> Can not open the targets file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (len > 4 && !strcmp(filename + len - 4, ".npy"))
+        targets = read_targets_npy(f, n_targets);
+    else
+        targets = read_targets_csv(f, n_targets);
+    fclose(f);
+
+    return targets;
+}
+
+void usage(const char *name)
+{
+    printf("usage: %s [-j n_threads] [-o output] [targets]\n"
+           "\n"
+           "  Solve all the (h, k, l) targets of a csv, text or npy (n, 3)\n"
+           "  file, or of the standard input with '-', in one run. Each\n"
+           "  output line contains the target, a solved flag, the axes\n"
+           "  values and the transformation matrix.\n"
+           "  Without targets, the built-in reflections are solved.\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    size_t j, k;
+    unsigned int n_threads = 0;
+    const char *output = NULL;
+    const char *targets_filename = NULL;
+    FILE *out = stdout;
+    double *targets;
+    size_t n_targets;
+    double *axes;
+    int *valid;
     double MRUB_matrix[3][3];
+    const char **name;
+    GError *error = NULL;
 
-    for(i = 0; i < n_refl; ++i){
-        refl_hkl[1] = i + 6.5;
-        printf("\nReflection %5.3f, %5.3f, %5.3f :\n", refl_hkl[0], refl_hkl[1], refl_hkl[2]);
+    HklSample *sample;
+    HklGeometry *geometry;
+    HklDetector *detector;
+    HklEngineList *engines;
+    HklEngine *engine;
 
-        compute_transf_matrix(refl_hkl, MRUB_matrix);
-        printf("The transformation matrix:\n");
-        for(j = 0; j < 3; ++j){
-            for(k = 0; k < 3; ++k){
-                printf(" %10.6f ", MRUB_matrix[j][k]);
+    for(i = 1; i < argc; ++i){
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            n_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")){
+            usage(argv[0]);
+            return 0;
+        } else
+            targets_filename = argv[i];
+    }
+
+    if (targets_filename)
+        targets = read_targets(targets_filename, &n_targets);
+    else {
+        /* the built-in reflections */
+        n_targets = n_refl;
+        targets = g_new(double, n_targets * 3);
+        for(j = 0; j < n_targets; ++j){
+            targets[3 * j] = 0.5;
+            targets[3 * j + 1] = j + 6.5;
+            targets[3 * j + 2] = 0.43;
+        }
+    }
+
+    if (output){
+        out = fopen(output, "w");
+        if (NULL == out){
+            printf("\n>>> Can not open the output file %s.\n", output);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* the diffractometer is set up once for all the targets */
+    sample = new_hkl_sample();
+    geometry = new_hkl_geometry(diffr_type, wavelength);
+    detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+    engine = new_hkl_engine(diffr_type, &engines, geometry, detector, sample);
+
+    /* Solve all the targets at once, each point starting from the
+     * solution of the previous one (continuation) */
+    axes = g_new0(double, n_targets * n_angles);
+    valid = g_new0(int, n_targets);
+    if (TRUE != hkl_engine_pseudo_axis_values_set_trajectory(engine, targets, n_targets, 3,
+                                                             HKL_UNIT_USER,
+                                                             axes, n_angles,
+                                                             valid, n_threads,
+                                                             &error)){
+        fprintf(stderr, ">>> Not all the targets were solved: %s\n",
+                error ? error->message : "unknown error");
+        g_clear_error(&error);
+    }
+
+    fprintf(out, "# h k l solved");
+    darray_foreach(name, *hkl_geometry_axis_names_get(geometry)){
+        fprintf(out, " %s", *name);
+    }
+    fprintf(out, " T00 T01 T02 T10 T11 T12 T20 T21 T22\n");
+
+    for(j = 0; j < n_targets; ++j){
+        fprintf(out, "%5.3f %5.3f %5.3f %d",
+                targets[3 * j], targets[3 * j + 1], targets[3 * j + 2], valid[j]);
+        for(k = 0; k < n_angles; ++k){
+            fprintf(out, " %8.5f", axes[j * n_angles + k]);
+        }
+        if (valid[j]){
+            if(TRUE != hkl_geometry_axis_values_set(geometry, &axes[j * n_angles], n_angles,
+                                                    HKL_UNIT_USER, NULL)){
+                printf("\n>>> There is a problem with the angles of the target %zu.\n", j);
+                exit(EXIT_FAILURE);
             }
-            printf("\n");
+            compute_transf_matrix(geometry, detector, sample, MRUB_matrix);
+        } else
+            memset(MRUB_matrix, 0, sizeof(MRUB_matrix));
+        for(k = 0; k < 9; ++k){
+            fprintf(out, " %10.6f", MRUB_matrix[k / 3][k % 3]);
         }
-        printf("\n");
+        fprintf(out, "\n");
     }
 
+    if (out != stdout)
+        fclose(out);
+    g_free(valid);
+    g_free(axes);
+    g_free(targets);
+    hkl_engine_list_free(engines);
+    hkl_sample_free(sample);
+    hkl_detector_free(detector);
+    hkl_geometry_free(geometry);
+
     return 0;
 }
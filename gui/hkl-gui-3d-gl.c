@@ -26,6 +26,7 @@
 
 #include <glib.h>
 
+#define GL_GLEXT_PROTOTYPES /* the vertex buffer objects of OpenGL 1.5 */
 #include <GL/gl.h>
 #include <GL/glu.h>
 
@@ -41,8 +42,37 @@ struct _G3DGLRenderState {
 	gint32 gl_dlist, gl_dlist_shadow;
 	G3DMaterial *prev_material;
 	guint32 prev_texid;
+	/* retained mode */
+	GPtrArray *meshes; /* G3DGLMesh */
+	GArray *batches; /* G3DGLBatch sorted by material */
 };
 
+/* the faces of a G3DObject packed into one vertex buffer */
+typedef struct _G3DGLMesh G3DGLMesh;
+
+struct _G3DGLMesh {
+	G3DObject *object;
+	G3DGLMesh *parent; /* the mesh of the parent object or NULL */
+	GLuint vbo;
+};
+
+/* the consecutive vertices of a mesh with the same material */
+typedef struct {
+	G3DGLMesh *mesh;
+	G3DMaterial *material;
+	guint32 texid;
+	GLenum mode; /* GL_TRIANGLES or GL_LINES */
+	GLint first;
+	GLsizei count;
+} G3DGLBatch;
+
+/* the interleaved vertex of the vertex buffers */
+typedef struct {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat texcoord[2];
+} G3DGLVertex;
+
 #if DEBUG > 0
 #define TIMING
 #endif
@@ -317,13 +347,34 @@ static inline void gl_may_begin(gint32 ftype)
 		glBegin(ftype);
 }
 
+/* compute the flat normals of a face without normals */
+static inline void gl_face_normals(G3DObject *object, G3DFace *face)
+{
+	G3DVector nx, ny, nz;
+	gint32 j;
+
+	if(face->flags & G3D_FLAG_FAC_NORMALS)
+		return;
+
+	face->normals = g_new0(G3DVector, face->vertex_count * 3);
+
+	g3d_face_get_normal(face, object, &nx, &ny, &nz);
+	g3d_vector_unify(&nx, &ny, &nz);
+
+	for(j = 0; j < face->vertex_count; j ++) {
+		face->normals[j * 3 + 0] = nx;
+		face->normals[j * 3 + 1] = ny;
+		face->normals[j * 3 + 2] = nz;
+	}
+	face->flags |= G3D_FLAG_FAC_NORMALS;
+}
+
 static inline void gl_draw_face_list(G3DGLRenderOptions *options,
 				     G3DObject *object, gfloat min_a, gfloat max_a,
 				     gboolean *init, gboolean is_shadow)
 {
 	GSList *fitem;
 	G3DFace *face;
-	G3DVector nx, ny, nz;
 	gint32 prev_ftype = -1;
 	gint32 index, j, ftype;
 
@@ -383,19 +434,7 @@ static inline void gl_draw_face_list(G3DGLRenderOptions *options,
 			prev_ftype = ftype;
 		}
 
-		if(!(face->flags & G3D_FLAG_FAC_NORMALS)) {
-			face->normals = g_new0(G3DVector, face->vertex_count * 3);
-
-			g3d_face_get_normal(face, object, &nx, &ny, &nz);
-			g3d_vector_unify(&nx, &ny, &nz);
-
-			for(j = 0; j < face->vertex_count; j ++) {
-				face->normals[j * 3 + 0] = nx;
-				face->normals[j * 3 + 1] = ny;
-				face->normals[j * 3 + 2] = nz;
-			}
-			face->flags |= G3D_FLAG_FAC_NORMALS;
-		}
+		gl_face_normals(object, face);
 
 		for(j = 0; j < face->vertex_count; j ++) {
 			index = face->vertex_indices[j];
@@ -493,6 +532,284 @@ static inline void gl_draw_objects(G3DGLRenderOptions *options,
 	} /* while olist != NULL */
 }
 
+/*****************/
+/* retained mode */
+/*****************/
+
+/* the key of the faces drawn together */
+typedef struct {
+	G3DMaterial *material;
+	guint32 texid;
+	GLenum mode;
+	GArray *vertices; /* G3DGLVertex */
+} G3DGLMeshPart;
+
+static void gl_vertex_init(G3DGLVertex *vertex, G3DObject *object,
+			   G3DFace *face, gint32 j)
+{
+	gint32 index = face->vertex_indices[j];
+	gint32 k;
+
+	for(k = 0; k < 3; k ++) {
+		vertex->position[k] = object->vertex_data[index * 3 + k];
+		vertex->normal[k] = face->normals[j * 3 + k];
+	}
+	if((face->flags & G3D_FLAG_FAC_TEXMAP) && face->tex_image) {
+		vertex->texcoord[0] = face->tex_vertex_data[j * 2 + 0];
+		vertex->texcoord[1] = face->tex_vertex_data[j * 2 + 1];
+	} else {
+		vertex->texcoord[0] = 0.0;
+		vertex->texcoord[1] = 0.0;
+	}
+}
+
+static G3DGLMeshPart *gl_mesh_part_get(GPtrArray *parts, G3DFace *face, GLenum mode)
+{
+	G3DGLMeshPart *part;
+	guint32 texid = 0;
+	guint i;
+
+	if((face->flags & G3D_FLAG_FAC_TEXMAP) && face->tex_image)
+		texid = face->tex_image->tex_id;
+
+	for(i = 0; i < parts->len; i ++) {
+		part = g_ptr_array_index(parts, i);
+		if(part->material == face->material && part->texid == texid
+		   && part->mode == mode)
+			return part;
+	}
+
+	part = g_new(G3DGLMeshPart, 1);
+	part->material = face->material;
+	part->texid = texid;
+	part->mode = mode;
+	part->vertices = g_array_new(FALSE, FALSE, sizeof(G3DGLVertex));
+	g_ptr_array_add(parts, part);
+
+	return part;
+}
+
+/* pack the faces of an object, grouped by material, into one vertex
+ * buffer. The quads and polygons are split into triangles fans. */
+static void gl_mesh_new(G3DGLRenderState *state, G3DObject *object, G3DGLMesh *parent)
+{
+	GSList *item;
+	GPtrArray *parts = g_ptr_array_new();
+	GArray *vertices = g_array_new(FALSE, FALSE, sizeof(G3DGLVertex));
+	G3DGLMesh *mesh = g_new(G3DGLMesh, 1);
+	guint i;
+
+	mesh->object = object;
+	mesh->parent = parent;
+	mesh->vbo = 0;
+	g_ptr_array_add(state->meshes, mesh);
+
+	for(item = object->faces; item != NULL; item = item->next) {
+		G3DFace *face = item->data;
+		G3DGLVertex vertex;
+		gint32 j;
+
+		if(face->vertex_count < 2)
+			continue;
+
+		gl_face_normals(object, face);
+		if(face->vertex_count == 2) {
+			G3DGLMeshPart *part = gl_mesh_part_get(parts, face, GL_LINES);
+
+			for(j = 0; j < 2; j ++) {
+				gl_vertex_init(&vertex, object, face, j);
+				g_array_append_val(part->vertices, vertex);
+			}
+		} else {
+			G3DGLMeshPart *part = gl_mesh_part_get(parts, face, GL_TRIANGLES);
+
+			for(j = 1; j < face->vertex_count - 1; j ++) {
+				gl_vertex_init(&vertex, object, face, 0);
+				g_array_append_val(part->vertices, vertex);
+				gl_vertex_init(&vertex, object, face, j);
+				g_array_append_val(part->vertices, vertex);
+				gl_vertex_init(&vertex, object, face, j + 1);
+				g_array_append_val(part->vertices, vertex);
+			}
+		}
+	}
+
+	for(i = 0; i < parts->len; i ++) {
+		G3DGLMeshPart *part = g_ptr_array_index(parts, i);
+		G3DGLBatch batch;
+
+		batch.mesh = mesh;
+		batch.material = part->material;
+		batch.texid = part->texid;
+		batch.mode = part->mode;
+		batch.first = vertices->len;
+		batch.count = part->vertices->len;
+		g_array_append_vals(vertices, part->vertices->data, part->vertices->len);
+		g_array_append_val(state->batches, batch);
+
+		g_array_free(part->vertices, TRUE);
+		g_free(part);
+	}
+	g_ptr_array_free(parts, TRUE);
+
+	if(vertices->len > 0) {
+		glGenBuffers(1, &mesh->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices->len * sizeof(G3DGLVertex),
+			     vertices->data, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	g_array_free(vertices, TRUE);
+
+	/* handle sub-objects */
+	for(item = object->objects; item != NULL; item = item->next)
+		gl_mesh_new(state, item->data, mesh);
+}
+
+static gint gl_batch_cmp(gconstpointer a, gconstpointer b)
+{
+	const G3DGLBatch *batch_a = a;
+	const G3DGLBatch *batch_b = b;
+
+	if(batch_a->material != batch_b->material)
+		return batch_a->material < batch_b->material ? -1 : 1;
+	if(batch_a->texid != batch_b->texid)
+		return batch_a->texid < batch_b->texid ? -1 : 1;
+	if(batch_a->mesh != batch_b->mesh)
+		return batch_a->mesh < batch_b->mesh ? -1 : 1;
+	return 0;
+}
+
+static void gl_meshes_new(G3DGLRenderState *state, GSList *objects)
+{
+	GSList *item;
+
+	state->meshes = g_ptr_array_new();
+	state->batches = g_array_new(FALSE, FALSE, sizeof(G3DGLBatch));
+
+	for(item = objects; item != NULL; item = item->next)
+		gl_mesh_new(state, item->data, NULL);
+
+	g_array_sort(state->batches, gl_batch_cmp);
+}
+
+static void gl_meshes_free(G3DGLRenderState *state)
+{
+	guint i;
+
+	if(!state->meshes)
+		return;
+
+	for(i = 0; i < state->meshes->len; i ++) {
+		G3DGLMesh *mesh = g_ptr_array_index(state->meshes, i);
+
+		if(mesh->vbo)
+			glDeleteBuffers(1, &mesh->vbo);
+		g_free(mesh);
+	}
+	g_ptr_array_free(state->meshes, TRUE);
+	g_array_free(state->batches, TRUE);
+	state->meshes = NULL;
+	state->batches = NULL;
+}
+
+static gboolean gl_mesh_is_hidden(const G3DGLMesh *mesh)
+{
+	for(; mesh != NULL; mesh = mesh->parent)
+		if(mesh->object->hide)
+			return TRUE;
+	return FALSE;
+}
+
+/* the current transformations of the object and of its parents */
+static void gl_mesh_mult_matrix(const G3DGLMesh *mesh)
+{
+	if(mesh == NULL)
+		return;
+
+	gl_mesh_mult_matrix(mesh->parent);
+	if(mesh->object->transformation)
+		glMultMatrixf(mesh->object->transformation->matrix);
+}
+
+/* draw the batches with min_a <= alpha < max_a. The meshes are never
+ * sent again, only the model matrix of each object and the material
+ * when it changes. */
+static void gl_draw_meshes(G3DGLRenderOptions *options,
+			   gfloat min_a, gfloat max_a, gboolean is_shadow)
+{
+	G3DGLRenderState *state = options->state;
+	G3DMaterial *prev_material = NULL;
+	guint32 prev_texid = 0;
+	gboolean textures = !is_shadow && (options->glflags & G3D_FLAG_GL_TEXTURES);
+	guint i;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	if(textures)
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	for(i = 0; i < state->batches->len; i ++) {
+		const G3DGLBatch *batch = &g_array_index(state->batches, G3DGLBatch, i);
+
+		if(!batch->mesh->vbo || gl_mesh_is_hidden(batch->mesh))
+			continue;
+
+		if(!is_shadow) {
+			if((batch->material->a < min_a) || (batch->material->a >= max_a))
+				continue;
+
+			if(batch->material != prev_material) {
+				gl_update_material(options, batch->material);
+				prev_material = batch->material;
+			}
+			if(textures && batch->texid != prev_texid) {
+				glBindTexture(GL_TEXTURE_2D, batch->texid);
+				prev_texid = batch->texid;
+			}
+		}
+
+		glPushMatrix();
+		gl_mesh_mult_matrix(batch->mesh);
+
+		glBindBuffer(GL_ARRAY_BUFFER, batch->mesh->vbo);
+		glVertexPointer(3, GL_FLOAT, sizeof(G3DGLVertex),
+				(const GLvoid *)G_STRUCT_OFFSET(G3DGLVertex, position));
+		glNormalPointer(GL_FLOAT, sizeof(G3DGLVertex),
+				(const GLvoid *)G_STRUCT_OFFSET(G3DGLVertex, normal));
+		if(textures)
+			glTexCoordPointer(2, GL_FLOAT, sizeof(G3DGLVertex),
+					  (const GLvoid *)G_STRUCT_OFFSET(G3DGLVertex, texcoord));
+		glDrawArrays(batch->mode, batch->first, batch->count);
+
+		glPopMatrix();
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* draw the model, the transparent objects after the opaque ones */
+static void gl_draw_model(G3DGLRenderOptions *options)
+{
+	if(options->state->meshes) {
+		gl_draw_meshes(options, 1.0, 2.0, FALSE);
+		gl_draw_meshes(options, 0.0, 1.0, FALSE);
+	} else
+		glCallList(options->state->gl_dlist);
+}
+
+static void gl_draw_shadow(G3DGLRenderOptions *options)
+{
+	if(options->state->meshes)
+		gl_draw_meshes(options, 0.0, 1.0, TRUE);
+	else
+		glCallList(options->state->gl_dlist_shadow);
+}
+
 static inline void matrix_g3d_to_gl(G3DMatrix *g3dm, GLfloat glm[4][4])
 {
 	guint32 i, j;
@@ -660,7 +977,7 @@ static void gl_setup_shadow_stencil(G3DGLRenderOptions *options)
 	glStencilOp(GL_REPLACE, GL_REPLACE, GL_REPLACE);
 	glStencilFunc(GL_ALWAYS, 1, 0xffffffff);
 
-	glCallList(options->state->gl_dlist_shadow);
+	gl_draw_shadow(options);
 
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	glDepthMask(GL_TRUE);
@@ -715,26 +1032,34 @@ void gl_draw(G3DGLRenderOptions *options, G3DModel *model)
 
 		/* update render state */
 		if(options->state) {
+			gl_meshes_free(options->state);
 			glDeleteLists(options->state->gl_dlist, 1);
 			glDeleteLists(options->state->gl_dlist_shadow, 1);
 			g_free(options->state);
 		}
 		options->state = g_new0(G3DGLRenderState, 1);
 
-		/* create and execute display list */
-		options->state->gl_dlist = glGenLists(1);
-		options->state->gl_dlist_shadow = glGenLists(1);
-
-		glNewList(options->state->gl_dlist, GL_COMPILE);
-		/* draw all objects */
-		for(f = 1.0; f >= 0.0; f -= 0.2)
-			gl_draw_objects(options, model->objects, f, f + 0.2, FALSE);
-		glEndList();
-
-		if(options->glflags & G3D_FLAG_GL_SHADOW) {
-			glNewList(options->state->gl_dlist_shadow, GL_COMPILE);
-			gl_draw_objects(options, model->objects, 0.0, 1.0, TRUE);
+		if((options->glflags & G3D_FLAG_GL_RETAINED)
+		   && !(options->glflags & G3D_FLAG_GL_POINTS)) {
+			/* pack the objects once, only their matrices
+			 * change between the frames */
+			gl_meshes_new(options->state, model->objects);
+		} else {
+			/* create and execute display list */
+			options->state->gl_dlist = glGenLists(1);
+			options->state->gl_dlist_shadow = glGenLists(1);
+
+			glNewList(options->state->gl_dlist, GL_COMPILE);
+			/* draw all objects */
+			for(f = 1.0; f >= 0.0; f -= 0.2)
+				gl_draw_objects(options, model->objects, f, f + 0.2, FALSE);
 			glEndList();
+
+			if(options->glflags & G3D_FLAG_GL_SHADOW) {
+				glNewList(options->state->gl_dlist_shadow, GL_COMPILE);
+				gl_draw_objects(options, model->objects, 0.0, 1.0, TRUE);
+				glEndList();
+			}
 		}
 	}
 
@@ -750,7 +1075,7 @@ void gl_draw(G3DGLRenderOptions *options, G3DModel *model)
 		gl_setup_floor_stencil(options);
 		glTranslatef(0.0, (options->min_y * 2), 0.0);
 		glScalef(1.0, -1.0, 1.0);
-		glCallList(options->state->gl_dlist);
+		gl_draw_model(options);
 		glPopMatrix();
 
 		/* plane */
@@ -780,7 +1105,7 @@ void gl_draw(G3DGLRenderOptions *options, G3DModel *model)
 	}
 
 	/* execute display list */
-	glCallList(options->state->gl_dlist);
+	gl_draw_model(options);
 
 #ifdef TIMING /* get time to draw one frame to compare algorithms */
 	g_timer_stop(timer);
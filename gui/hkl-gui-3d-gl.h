@@ -34,6 +34,7 @@
 #define G3D_FLAG_GL_COORD_AXES      (1L << 6)
 #define G3D_FLAG_GL_SHADOW          (1L << 7)
 #define G3D_FLAG_GL_ISOMETRIC       (1L << 8)
+#define G3D_FLAG_GL_RETAINED        (1L << 9)
 
 typedef struct _G3DGLRenderState G3DGLRenderState;
 
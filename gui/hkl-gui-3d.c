@@ -82,6 +82,15 @@ struct _HklGui3DPrivate {
 
 	Hkl3D *hkl3d;
 
+	/* the coalesced updates, the collisions are checked in a
+	 * worker thread with its own world */
+	guint tick_id;
+	GMutex lock; /* held by the check, the objects are not deleted meanwhile */
+	Hkl3DWorld *world;
+	gboolean world_stale;
+	gboolean checking;
+	gboolean pending;
+
 	/* opengl connected to the drawingarea1 */
 	G3DGLRenderOptions renderoptions;
 	struct {
@@ -237,7 +246,10 @@ finalize (GObject* object)
 
 	g_object_unref(priv->builder);
 
+	if(priv->world)
+		hkl3d_world_free(priv->world);
 	hkl3d_free(priv->hkl3d);
+	g_mutex_clear(&priv->lock);
 
 	G_OBJECT_CLASS (hkl_gui_3d_parent_class)->finalize (object);
 }
@@ -258,12 +270,130 @@ GtkFrame *hkl_gui_3d_frame_get(HklGui3D *self)
 	return priv->frame1;
 }
 
-void hkl_gui_3d_is_colliding(HklGui3D *self)
+/* the objects are only read by the worker thread, the world is rebuilt
+ * once the running check is over when they are hidden or removed */
+static void hkl_gui_3d_world_invalidate(HklGui3D *self)
+{
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
+
+	if(priv->checking)
+		priv->world_stale = TRUE;
+	else if(priv->world){
+		hkl3d_world_free(priv->world);
+		priv->world = NULL;
+	}
+}
+
+static void check_collisions_thread(GTask *task, gpointer source_object,
+				    gpointer task_data, GCancellable *cancellable)
+{
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(source_object);
+	const HklGeometry *geometry = task_data;
+	GPtrArray *objects = g_ptr_array_new();
+
+	g_mutex_lock(&priv->lock);
+	if(hkl3d_world_is_colliding(priv->world, geometry)){
+		size_t n = hkl3d_world_colliding_objects_get(priv->world, NULL, 0);
+
+		g_ptr_array_set_size(objects, n);
+		hkl3d_world_colliding_objects_get(priv->world,
+						  (Hkl3DObject **)objects->pdata, n);
+	}
+	g_mutex_unlock(&priv->lock);
+
+	g_task_return_pointer(task, objects, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void check_collisions(HklGui3D *self);
+
+static void check_collisions_ready_cb(GObject *source_object,
+				      GAsyncResult *res, gpointer user_data)
+{
+	HklGui3D *self = HKL_GUI_3D(source_object);
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
+	GPtrArray *objects = g_task_propagate_pointer(G_TASK(res), NULL);
+
+	priv->checking = FALSE;
+
+	if(priv->world_stale){
+		/* the objects changed during the check, the result is
+		 * dropped and the geometry checked again */
+		hkl3d_world_free(priv->world);
+		priv->world = NULL;
+		priv->world_stale = FALSE;
+		priv->pending = TRUE;
+	}else if(objects){
+		for(size_t i=0; i<priv->hkl3d->config->len; ++i)
+			for(size_t j=0; j<priv->hkl3d->config->models[i]->len; ++j)
+				priv->hkl3d->config->models[i]->objects[j]->is_colliding = FALSE;
+		for(guint i=0; i<objects->len; ++i)
+			((Hkl3DObject *)g_ptr_array_index(objects, i))->is_colliding = TRUE;
+
+		hkl_gui_3d_redraw(self);
+	}
+
+	if(objects)
+		g_ptr_array_unref(objects);
+
+	if(priv->pending){
+		priv->pending = FALSE;
+		check_collisions(self);
+	}
+}
+
+/* only one check at a time, the ones requested meanwhile are replaced
+ * by a single check of the latest geometry */
+static void check_collisions(HklGui3D *self)
+{
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
+	GTask *task;
+
+	if(!priv->hkl3d)
+		return;
+
+	if(priv->checking){
+		priv->pending = TRUE;
+		return;
+	}
+
+	if(!priv->world)
+		priv->world = hkl3d_world_new(priv->hkl3d);
+
+	priv->checking = TRUE;
+	task = g_task_new(self, NULL, check_collisions_ready_cb, NULL);
+	g_task_set_task_data(task, hkl_geometry_new_copy(priv->geometry),
+			     (GDestroyNotify)hkl_geometry_free);
+	g_task_run_in_thread(task, check_collisions_thread);
+	g_object_unref(task);
+}
+
+static gboolean update_tick_cb(GtkWidget *widget, GdkFrameClock *frame_clock,
+			       gpointer user_data)
 {
+	HklGui3D *self = HKL_GUI_3D(user_data);
 	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
 
-	if(priv->hkl3d)
-		hkl3d_is_colliding(priv->hkl3d);
+	priv->tick_id = 0;
+
+	if(priv->hkl3d){
+		hkl3d_apply_transformations(priv->hkl3d);
+		hkl_gui_3d_redraw(self);
+		check_collisions(self);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* the geometry changed, the objects are moved at most once per frame
+ * with the latest geometry */
+void hkl_gui_3d_update(HklGui3D *self)
+{
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
+
+	if(!priv->tick_id)
+		priv->tick_id = gtk_widget_add_tick_callback(GTK_WIDGET(priv->gl_area),
+							     update_tick_cb,
+							     self, NULL);
 }
 
 void hkl_gui_3d_invalidate(HklGui3D *self)
@@ -276,6 +406,19 @@ void hkl_gui_3d_invalidate(HklGui3D *self)
 	gtk_widget_queue_draw (GTK_WIDGET(priv->gl_area));
 }
 
+/* redraw after the objects moved or were hidden, the meshes are only
+ * packed again for the display lists of the immediate mode */
+void hkl_gui_3d_redraw(HklGui3D *self)
+{
+	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(self);
+
+	if(!(priv->renderoptions.glflags & G3D_FLAG_GL_RETAINED)
+	   || (priv->renderoptions.glflags & G3D_FLAG_GL_POINTS))
+		priv->renderoptions.updated = TRUE;
+
+	gtk_widget_queue_draw (GTK_WIDGET(priv->gl_area));
+}
+
 /************/
 /* Callback */
 /************/
@@ -305,8 +448,8 @@ void hkl_gui_3d_cellrenderertext2_toggled_cb(GtkCellRendererToggle* renderer,
 				    &iter,
 				    HKL_GUI_3D_COL_HIDE, hide,
 				    -1);
-		hkl_gui_3d_is_colliding(self);
-		hkl_gui_3d_invalidate(self);
+		hkl_gui_3d_world_invalidate(self);
+		hkl_gui_3d_update(self);
 	}else{
 		Hkl3DModel *model;
 
@@ -336,8 +479,8 @@ void hkl_gui_3d_cellrenderertext2_toggled_cb(GtkCellRendererToggle* renderer,
 
 				valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(priv->treestore1), &children);
 			}
-			hkl_gui_3d_is_colliding(self);
-			hkl_gui_3d_invalidate(self);
+			hkl_gui_3d_world_invalidate(self);
+			hkl_gui_3d_update(self);
 		}
 	}
 }
@@ -371,7 +514,7 @@ void hkl_gui_3d_treeview1_cursor_changed_cb(GtkTreeView *tree_view,
 	if(object)
 		object->selected = TRUE;
 
-	hkl_gui_3d_invalidate(self);
+	hkl_gui_3d_redraw(self);
 }
 
 void hkl_gui_3d_toolbutton1_clicked_cb(GtkToolButton *toolbutton,
@@ -402,7 +545,10 @@ void hkl_gui_3d_toolbutton2_clicked_cb(GtkToolButton *toolbutton,
 			    HKL_GUI_3D_COL_OBJECT, &object,
 			    -1);
 	if(object){
+		hkl_gui_3d_world_invalidate(self);
+		g_mutex_lock(&priv->lock);
 		hkl3d_remove_object(priv->hkl3d, object);
+		g_mutex_unlock(&priv->lock);
 		hkl_gui_3d_update_hkl3d_objects_TreeStore(self);
 		hkl_gui_3d_invalidate(self);
 	}
@@ -425,7 +571,8 @@ reset_3d(G3DGLRenderOptions *renderoptions)
 		G3D_FLAG_GL_SHININESS |
 		G3D_FLAG_GL_TEXTURES |
 		G3D_FLAG_GL_COLORS|
-		G3D_FLAG_GL_COORD_AXES;
+		G3D_FLAG_GL_COORD_AXES |
+		G3D_FLAG_GL_RETAINED;
 
         g3d_quat_trackball(renderoptions->quat, 0.0, 0.0, 0.0, 0.0, 0.8);
 
@@ -456,7 +603,7 @@ void hkl_gui_3d_toolbutton4_toggled_cb(GtkToggleToolButton *toggle_tool_button,
 	HklGui3DPrivate *priv = hkl_gui_3d_get_instance_private(user_data);
 
 	priv->aabb = gtk_toggle_tool_button_get_active(toggle_tool_button);
-	hkl_gui_3d_invalidate(self);
+	hkl_gui_3d_redraw(self);
 }
 
 void hkl_gui_3d_button1_clicked_cb(GtkButton *button,
@@ -485,6 +632,7 @@ void hkl_gui_3d_button1_clicked_cb(GtkButton *button,
 		filename = g_slist_next(filename);
 	};
 
+	hkl_gui_3d_world_invalidate(self);
 	hkl_gui_3d_update_hkl3d_objects_TreeStore(self);
 	gtk_widget_hide(GTK_WIDGET(priv->filechooserdialog1));
 	g_slist_free(filenames);
@@ -1019,6 +1167,8 @@ static void hkl_gui_3d_init (HklGui3D * self)
 	priv->filename = NULL;
 	priv->geometry = NULL;
 
+	g_mutex_init(&priv->lock);
+
 	priv->builder = builder = gtk_builder_new ();
 
 	get_ui(builder, "3d.ui");
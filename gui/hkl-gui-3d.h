@@ -32,10 +32,12 @@ G_DECLARE_FINAL_TYPE (HklGui3D, hkl_gui_3d, HKL_GUI, 3D, GObject)
 
 	HklGui3D *hkl_gui_3d_new (const char *filename, HklGeometry *geometry);
 
-void hkl_gui_3d_is_colliding(HklGui3D *self);
+void hkl_gui_3d_update(HklGui3D *self);
 
 void hkl_gui_3d_invalidate(HklGui3D *self);
 
+void hkl_gui_3d_redraw(HklGui3D *self);
+
 GtkFrame *hkl_gui_3d_frame_get(HklGui3D *self);
 
 #endif // __HKL_GUI_3D_H__
@@ -182,6 +182,86 @@ diffractometer_pseudo_axis_values_set(struct diffractometer_t *self,
 	return diffractometer_set_solutions(self, solutions);
 }
 
+/* a solve of a diffractometer running on its own copy, so the main
+ * loop can still read the diffractometer meanwhile */
+struct solve_t {
+	struct diffractometer_t *diffractometer; /* unowned */
+	HklEngineList *engines;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngine *engine;
+	gdouble *values;
+	guint n_values;
+};
+
+static void
+solve_free(gpointer data)
+{
+	struct solve_t *self = data;
+
+	hkl_engine_list_free(self->engines);
+	hkl_geometry_free(self->geometry);
+	hkl_detector_free(self->detector);
+	hkl_sample_free(self->sample);
+	g_free(self->values);
+	g_free(self);
+}
+
+static struct solve_t *
+solve_new(struct diffractometer_t *diffractometer, HklSample *sample,
+	  HklEngine *engine, gdouble values[], guint n_values)
+{
+	struct solve_t *self;
+	HklEngineList *engines;
+
+	engines = hkl_engine_list_new_copy(diffractometer->engines);
+	if(NULL == engines)
+		return NULL;
+
+	self = g_new(struct solve_t, 1);
+	self->diffractometer = diffractometer;
+	self->engines = engines;
+	self->geometry = hkl_geometry_new_copy(diffractometer->geometry);
+	self->detector = hkl_detector_new_copy(diffractometer->detector);
+	self->sample = hkl_sample_new_copy(sample);
+	self->values = g_memdup(values, n_values * sizeof(*values));
+	self->n_values = n_values;
+
+	hkl_engine_list_init(self->engines, self->geometry, self->detector, self->sample);
+	self->engine = hkl_engine_list_engine_get_by_name(self->engines,
+							  hkl_engine_name_get(engine),
+							  NULL);
+	if(NULL == self->engine){
+		solve_free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+static void
+solve_thread(GTask *task, gpointer source_object,
+	     gpointer task_data, GCancellable *cancellable)
+{
+	struct solve_t *self = task_data;
+	HklGeometryList *solutions;
+	GError *error = NULL;
+
+	/* a newer target was already requested */
+	if(g_task_return_error_if_cancelled(task))
+		return;
+
+	solutions = hkl_engine_pseudo_axis_values_set(self->engine,
+						      self->values, self->n_values,
+						      HKL_UNIT_USER, &error);
+	if(solutions)
+		g_task_return_pointer(task, solutions,
+				      (GDestroyNotify)hkl_geometry_list_free);
+	else
+		g_task_return_error(task, error);
+}
+
 static void
 diffractometer_set_solution(struct diffractometer_t *self,
 			    const HklGeometryListItem *item)
@@ -293,6 +373,7 @@ struct _HklGuiWindowPrivate {
 	struct diffractometer_t *diffractometer; /* unowned */
 	HklSample *sample; /* unowned */
 	HklLattice *reciprocal;
+	GCancellable *solve; /* the running solve or NULL */
 };
 
 
@@ -339,6 +420,11 @@ finalize (GObject* object)
 {
 	HklGuiWindowPrivate *priv =  hkl_gui_window_get_instance_private(HKL_GUI_WINDOW(object));
 
+	if(priv->solve){
+		g_cancellable_cancel(priv->solve);
+		g_object_unref(priv->solve);
+	}
+
 	g_object_unref(priv->builder);
 
 	darray_free(priv->pseudo_frames);
@@ -518,21 +604,27 @@ _update_axis (GtkTreeModel *model, GtkTreePath *path,
 	const char *name;
 	const HklParameter *axis;
 	gdouble value, min, max;
+	gdouble old_value, old_min, old_max;
 
 	gtk_tree_model_get (model, iter,
 			    AXIS_COL_NAME, &name,
+			    AXIS_COL_READ, &old_value,
+			    AXIS_COL_MIN, &old_min,
+			    AXIS_COL_MAX, &old_max,
 			    -1);
 
 	axis = hkl_geometry_axis_get(priv->diffractometer->geometry, name, NULL);
 	hkl_parameter_min_max_get(axis, &min, &max, HKL_UNIT_USER);
 	value = hkl_parameter_value_get(axis, HKL_UNIT_USER);
 
-	gtk_list_store_set(GTK_LIST_STORE(model), iter,
-			   AXIS_COL_READ, value,
-			   AXIS_COL_WRITE, value,
-			   AXIS_COL_MIN, min,
-			   AXIS_COL_MAX, max,
-			   -1);
+	/* only the rows which changed are redrawn */
+	if(value != old_value || min != old_min || max != old_max)
+		gtk_list_store_set(GTK_LIST_STORE(model), iter,
+				   AXIS_COL_READ, value,
+				   AXIS_COL_WRITE, value,
+				   AXIS_COL_MIN, min,
+				   AXIS_COL_MAX, max,
+				   -1);
 	return FALSE;
 }
 
@@ -555,21 +647,22 @@ _update_pseudo_axes (GtkTreeModel *model, GtkTreePath *path,
 	const char *name;
 	const HklEngine *engine;
 	const HklParameter *pseudo_axis;
-	gdouble value, min, max;
+	gdouble value, old_value;
 
 	gtk_tree_model_get (model, iter,
 			    PSEUDO_AXIS_COL_ENGINE, &engine,
 			    PSEUDO_AXIS_COL_NAME, &name,
+			    PSEUDO_AXIS_COL_READ, &old_value,
 			    -1);
 
 	pseudo_axis = hkl_engine_pseudo_axis_get(engine, name, NULL);
-	hkl_parameter_min_max_get(pseudo_axis, &min, &max, HKL_UNIT_USER);
 	value = hkl_parameter_value_get(pseudo_axis, HKL_UNIT_USER);
 
-	gtk_list_store_set(GTK_LIST_STORE(model), iter,
-			   PSEUDO_AXIS_COL_READ, value,
-			   PSEUDO_AXIS_COL_WRITE, value,
-			   -1);
+	if(value != old_value)
+		gtk_list_store_set(GTK_LIST_STORE(model), iter,
+				   PSEUDO_AXIS_COL_READ, value,
+				   PSEUDO_AXIS_COL_WRITE, value,
+				   -1);
 	return FALSE;
 }
 
@@ -595,7 +688,7 @@ update_solutions (HklGuiWindow* self)
 	g_return_if_fail (priv->diffractometer->solutions != NULL);
 
 	const HklGeometryListItem *item;
-	gtk_list_store_clear(priv->liststore_solutions);
+	gboolean valid;
 
 	gint n_values = gtk_tree_model_get_n_columns (GTK_TREE_MODEL(priv->liststore_solutions));
 	GValue *values = g_new0(GValue, n_values);
@@ -608,6 +701,9 @@ update_solutions (HklGuiWindow* self)
 	for(i=SOLUTION_COL_N_COLUMNS; i<n_values; ++i)
 		g_value_init(&values[i], G_TYPE_DOUBLE);
 
+	/* the existing rows are reused, only the missing ones are
+	 * added and the extra ones removed */
+	valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(priv->liststore_solutions), &iter);
 	i=0;
 	HKL_GEOMETRY_LIST_FOREACH(item, priv->diffractometer->solutions){
 		const HklGeometry *geometry = hkl_geometry_list_item_geometry_get(item);
@@ -625,11 +721,18 @@ update_solutions (HklGuiWindow* self)
 			g_value_set_double(&values[SOLUTION_COL_N_COLUMNS + j], v[j]);
 			columns[SOLUTION_COL_N_COLUMNS + j] = SOLUTION_COL_N_COLUMNS + j;
 		}
-		gtk_list_store_insert_with_valuesv(priv->liststore_solutions,
-						   &iter, i,
-						   columns, values, n_values);
+		if(valid){
+			gtk_list_store_set_valuesv(priv->liststore_solutions,
+						   &iter, columns, values, n_values);
+			valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(priv->liststore_solutions), &iter);
+		}else
+			gtk_list_store_insert_with_valuesv(priv->liststore_solutions,
+							   NULL, i,
+							   columns, values, n_values);
 		i++;
 	}
+	while(valid)
+		valid = gtk_list_store_remove(priv->liststore_solutions, &iter);
 	g_free(columns);
 	g_free(values);
 }
@@ -650,34 +753,66 @@ static void
 update_reflections (HklGuiWindow *self)
 {
 	HklGuiWindowPrivate *priv = hkl_gui_window_get_instance_private(self);
+	GtkTreeIter iter = {0};
+	gboolean valid;
 
-	gtk_list_store_clear (priv->liststore_reflections);
+	/* the existing rows are reused, only the rows which changed
+	 * are set */
+	valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(priv->liststore_reflections), &iter);
 
 	if(priv->sample){
 		HklSampleReflection* reflection;
 		guint index = 0;
 
 		HKL_SAMPLE_REFLECTIONS_FOREACH(reflection, priv->sample){
-			GtkTreeIter iter = {0};
 			gdouble h, k, l;
 			gboolean flag;
 
 			hkl_sample_reflection_hkl_get(reflection, &h, &k, &l);
 			flag = hkl_sample_reflection_flag_get(reflection);
 
-			gtk_list_store_append (priv->liststore_reflections, &iter);
-
-			gtk_list_store_set (priv->liststore_reflections,
-					    &iter,
-					    REFLECTION_COL_INDEX, index++,
-					    REFLECTION_COL_H, h,
-					    REFLECTION_COL_K, k,
-					    REFLECTION_COL_L, l,
-					    REFLECTION_COL_FLAG, flag,
-					    REFLECTION_COL_REFLECTION, reflection,
-					    -1);
+			if(valid){
+				HklSampleReflection *old_reflection;
+				guint old_index;
+				gdouble old_h, old_k, old_l;
+				gboolean old_flag;
+
+				gtk_tree_model_get (GTK_TREE_MODEL(priv->liststore_reflections), &iter,
+						    REFLECTION_COL_INDEX, &old_index,
+						    REFLECTION_COL_H, &old_h,
+						    REFLECTION_COL_K, &old_k,
+						    REFLECTION_COL_L, &old_l,
+						    REFLECTION_COL_FLAG, &old_flag,
+						    REFLECTION_COL_REFLECTION, &old_reflection,
+						    -1);
+				if(reflection != old_reflection || index != old_index
+				   || h != old_h || k != old_k || l != old_l
+				   || flag != old_flag)
+					gtk_list_store_set (priv->liststore_reflections,
+							    &iter,
+							    REFLECTION_COL_INDEX, index,
+							    REFLECTION_COL_H, h,
+							    REFLECTION_COL_K, k,
+							    REFLECTION_COL_L, l,
+							    REFLECTION_COL_FLAG, flag,
+							    REFLECTION_COL_REFLECTION, reflection,
+							    -1);
+				valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(priv->liststore_reflections), &iter);
+			}else
+				gtk_list_store_insert_with_values (priv->liststore_reflections,
+								   NULL, -1,
+								   REFLECTION_COL_INDEX, index,
+								   REFLECTION_COL_H, h,
+								   REFLECTION_COL_K, k,
+								   REFLECTION_COL_L, l,
+								   REFLECTION_COL_FLAG, flag,
+								   REFLECTION_COL_REFLECTION, reflection,
+								   -1);
+			index++;
 		}
 	}
+	while(valid)
+		valid = gtk_list_store_remove(priv->liststore_reflections, &iter);
 }
 
 static void
@@ -686,23 +821,83 @@ update_3d(HklGuiWindow *self)
 #ifdef HKL3D
 	HklGuiWindowPrivate *priv = hkl_gui_window_get_instance_private(self);
 
-	if(priv->frame3d){
-		hkl_gui_3d_is_colliding(priv->frame3d);
-		hkl_gui_3d_invalidate(priv->frame3d);
-	}
+	if(priv->frame3d)
+		hkl_gui_3d_update(priv->frame3d);
 #endif
 }
 
 static void
-pseudo_axes_frame_changed_cb (HklGuiEngine *gui_engine, HklGuiWindow *self)
+solve_ready_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
 {
+	HklGuiWindow *self = HKL_GUI_WINDOW(source_object);
 	HklGuiWindowPrivate *priv = hkl_gui_window_get_instance_private(self);
+	struct solve_t *solve = g_task_get_task_data(G_TASK(result));
+	HklGeometryList *solutions;
+	GError *error = NULL;
+
+	solutions = g_task_propagate_pointer(G_TASK(result), &error);
+
+	/* a newer target or another diffractometer replaced this one */
+	if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)){
+		g_clear_error(&error);
+		return;
+	}
+
+	if(diffractometer_set_solutions(solve->diffractometer, solutions)){
+		if(solve->diffractometer == priv->diffractometer){
+			update_solutions (self);
+			update_3d(self);
+		}
+	}else
+		raise_error(self, &error);
+}
+
+/* compute the solutions on a worker thread, the previous solve is
+ * cancelled as only the latest target matters */
+static void
+solve_pseudo_axis_values(HklGuiWindow *self,
+			 HklEngine *engine, gdouble values[], guint n_values)
+{
+	HklGuiWindowPrivate *priv = hkl_gui_window_get_instance_private(self);
+	struct solve_t *solve;
+	GTask *task;
+
+	if(priv->solve){
+		g_cancellable_cancel(priv->solve);
+		g_clear_object(&priv->solve);
+	}
+
+	solve = solve_new(priv->diffractometer, priv->sample, engine, values, n_values);
+	if(NULL == solve){
+		GError *error = NULL;
+
+		/* not created by a factory, solve in place */
+		if(diffractometer_pseudo_axis_values_set(priv->diffractometer, engine,
+							 values, n_values, &error)){
+			update_solutions (self);
+			update_3d(self);
+		}else
+			raise_error(self, &error);
+		return;
+	}
+
+	priv->solve = g_cancellable_new();
+	task = g_task_new(self, priv->solve, solve_ready_cb, NULL);
+	g_task_set_task_data(task, solve, solve_free);
+	/* a cancelled solve completes at once, its thread result is dropped */
+	g_task_set_return_on_cancel(task, TRUE);
+	g_task_run_in_thread(task, solve_thread);
+	g_object_unref(task);
+}
+
+static void
+pseudo_axes_frame_changed_cb (HklGuiEngine *gui_engine, HklGuiWindow *self)
+{
 	HklEngine *engine;
 	GtkListStore *liststore;
 	guint n_values;
 	GtkTreeIter iter = {0};
 	gboolean valid;
-	GError *error = NULL;
 
 	g_object_get(gui_engine,
 		     "engine", &engine,
@@ -728,15 +923,7 @@ pseudo_axes_frame_changed_cb (HklGuiEngine *gui_engine, HklGuiWindow *self)
 		valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(liststore), &iter);
 	}
 
-	if(diffractometer_pseudo_axis_values_set(priv->diffractometer, engine,
-						 values, n_values, &error)){
-		update_axes (self);
-		update_pseudo_axes (self);
-		update_pseudo_axes_frames (self);
-		update_solutions (self);
-		update_3d(self);
-	}else
-		raise_error(self, &error);
+	solve_pseudo_axis_values(self, engine, values, n_values);
 
 	g_object_unref(liststore);
 }
@@ -991,6 +1178,11 @@ hkl_gui_window_combobox1_changed_cb(GtkComboBox *combobox, gpointer *user_data)
 		}
 	}
 	if(NULL != dif && dif != priv->diffractometer){
+		/* the solutions of the previous diffractometer are useless */
+		if(priv->solve){
+			g_cancellable_cancel(priv->solve);
+			g_clear_object(&priv->solve);
+		}
 		priv->diffractometer = dif;
 
 		diffractometer_set_sample(dif, priv->sample);
@@ -1191,7 +1383,6 @@ hkl_gui_window_cellrenderertext5_edited_cb(GtkCellRendererText *renderer,
 	gboolean valid;
 	GtkTreeIter it = {0};
 	guint n_values;
-	GError *error = NULL;
 
 	gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL(priv->liststore_pseudo_axes),
 					     &iter,
@@ -1229,20 +1420,12 @@ hkl_gui_window_cellrenderertext5_edited_cb(GtkCellRendererText *renderer,
 	value = atof(new_text); /* TODO need to check for the right conversion */
 	values[idx] = value;
 
-	if(diffractometer_pseudo_axis_values_set(priv->diffractometer, engine,
-						 values, n_values, &error)){
-		gtk_list_store_set (priv->liststore_pseudo_axes,
-				    &iter,
-				    PSEUDO_AXIS_COL_WRITE, value,
-				    -1);
+	gtk_list_store_set (priv->liststore_pseudo_axes,
+			    &iter,
+			    PSEUDO_AXIS_COL_WRITE, value,
+			    -1);
 
-		update_axes (self);
-		update_pseudo_axes (self);
-		update_pseudo_axes_frames (self);
-		update_solutions (self);
-		update_3d(self);
-	}else
-		raise_error(self, &error);
+	solve_pseudo_axis_values(self, engine, values, n_values);
 }
 
 
@@ -2306,6 +2489,7 @@ static void hkl_gui_window_init (HklGuiWindow * self)
 
 	priv->diffractometer = NULL;
 	priv->sample = NULL;
+	priv->solve = NULL;
 
 	darray_init(priv->pseudo_frames);
 
@@ -220,6 +220,14 @@ HKLAPI void hkl_parameter_min_max_get(const HklParameter *self, double *min, dou
 HKLAPI int hkl_parameter_min_max_set(HklParameter *self, double min, double max,
 				     HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI void hkl_parameter_motion_get(const HklParameter *self,
+				     double *velocity, double *acceleration,
+				     HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2, 3);
+
+HKLAPI void hkl_parameter_motion_set(HklParameter *self,
+				     double velocity, double acceleration,
+				     HklUnitEnum unit_type) HKL_ARG_NONNULL(1);
+
 HKLAPI int hkl_parameter_fit_get(const HklParameter *self) HKL_ARG_NONNULL(1);
 
 HKLAPI void hkl_parameter_fit_set(HklParameter *self, int fit) HKL_ARG_NONNULL(1);
@@ -280,6 +288,16 @@ HKLAPI int hkl_geometry_axis_set(HklGeometry *self, const char *name,
 				 const HklParameter *axis,
 				 GError **error) HKL_ARG_NONNULL(1, 2, 3) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI int hkl_geometry_axis_idx_get(const HklGeometry *self,
+				     const char *name) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI const HklParameter *hkl_geometry_axis_get_by_idx(const HklGeometry *self, size_t idx,
+							GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_geometry_axis_set_by_idx(HklGeometry *self, size_t idx,
+					const HklParameter *axis,
+					GError **error) HKL_ARG_NONNULL(1, 3) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI void hkl_geometry_axis_values_get(const HklGeometry *self,
 					 double values[], size_t n_values,
 					 HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2);
@@ -322,14 +340,49 @@ HKLAPI HklVector hkl_geometry_kf_abc_get(const HklGeometry *self,
                                          const HklDetector *detector,
                                          const HklSample *sample) HKL_ARG_NONNULL(1, 2, 3);
 
+HKLAPI void hkl_geometry_kf_array_get(const HklGeometry *self,
+				      const HklDetector *detector,
+				      const double pixels[], size_t n_pixels,
+				      double kf[], size_t n_kf) HKL_ARG_NONNULL(1, 2, 3, 5);
+
+HKLAPI void hkl_geometry_q_array_get(const HklGeometry *self,
+				     const HklDetector *detector,
+				     const double pixels[], size_t n_pixels,
+				     double q[], size_t n_q) HKL_ARG_NONNULL(1, 2, 3, 5);
+
+HKLAPI void hkl_geometry_qper_qpar_array_get(const HklGeometry *self,
+					     const HklDetector *detector,
+					     const HklSample *sample,
+					     const HklVector *surface,
+					     const double pixels[], size_t n_pixels,
+					     double qper[], double qpar[], size_t n) HKL_ARG_NONNULL(1, 2, 3, 4, 5, 7, 8);
+
 HKLAPI void hkl_geometry_fprintf(FILE *file, const HklGeometry *self) HKL_ARG_NONNULL(1, 2);
 
+typedef enum _HklGeometryDistance
+{
+	HKL_GEOMETRY_DISTANCE_SUM, /* the sum of the axes motions */
+	HKL_GEOMETRY_DISTANCE_MAX, /* the longest axis motion */
+} HklGeometryDistance;
+
+HKLAPI size_t hkl_geometry_closest_get(const HklGeometry *self,
+				       const double positions[], size_t n_positions,
+				       size_t n_axes, HklUnitEnum unit_type,
+				       const double weights[], size_t n_weights,
+				       HklGeometryDistance distance, int orthodromic,
+				       double distances[], size_t n_distances) HKL_ARG_NONNULL(1, 2);
+
+/* TRUE for the geometries to reject */
+typedef int (* HklGeometryPredicate)(const HklGeometry *self, void *data);
+
 /* HklGeometryList */
 
 #define HKL_GEOMETRY_LIST_FOREACH(item, list) for((item)=hkl_geometry_list_items_first_get((list)); \
 						  (item);		\
 						  (item)=hkl_geometry_list_items_next_get((list), (item)))
 
+HKLAPI HklGeometryList *hkl_geometry_list_new(void) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI void hkl_geometry_list_free(HklGeometryList *self) HKL_ARG_NONNULL(1);
 
 HKLAPI size_t hkl_geometry_list_n_items_get(const HklGeometryList *self) HKL_ARG_NONNULL(1);
@@ -339,8 +392,17 @@ HKLAPI const HklGeometryListItem *hkl_geometry_list_items_first_get(const HklGeo
 HKLAPI const HklGeometryListItem *hkl_geometry_list_items_next_get(const HklGeometryList *self,
 								   const HklGeometryListItem *item) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI size_t hkl_geometry_list_axis_values_get(const HklGeometryList *self,
+						double values[], size_t n_values,
+						HklUnitEnum unit_type) HKL_ARG_NONNULL(1);
+
 /* HklGeometryListItem */
 
+HKLAPI const HklGeometryListItem *hkl_geometry_list_closest_get(const HklGeometryList *self,
+								const HklGeometry *ref,
+								const double weights[], size_t n_weights,
+								HklGeometryDistance distance) HKL_ARG_NONNULL(1, 2);
+
 HKLAPI const HklGeometry *hkl_geometry_list_item_geometry_get(const HklGeometryListItem *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
 /**********/
@@ -482,6 +544,26 @@ HKLAPI double hkl_sample_get_reflection_theoretical_angle(const HklSample *self,
 
 HKLAPI int hkl_sample_affine(HklSample *self, GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI int hkl_sample_affine_levenberg_marquardt(HklSample *self,
+						 double covariance[], size_t n_covariance,
+						 GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_sample_affine_ransac(HklSample *self,
+				    double threshold, size_t n_iterations,
+				    size_t *n_outliers, GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_sample_index(HklSample *self, unsigned int hkl_max, double tolerance,
+			    size_t *n_indexed, GError **error) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+/* a, b, c, alpha, beta, gamma, U row by row and the residuals */
+#define HKL_SAMPLE_AFFINE_SERIES_COLUMNS 16
+
+HKLAPI int hkl_sample_affine_series(HklSample *samples[], size_t n_samples,
+				    double table[], size_t n_table,
+				    int valid[],
+				    unsigned int n_threads,
+				    GError **error) HKL_ARG_NONNULL(1, 3, 5) HKL_WARN_UNUSED_RESULT;
+
 /* HklSampleReflection */
 
 HKLAPI HklSampleReflection *hkl_sample_reflection_new(const HklGeometry *geometry,
@@ -530,6 +612,66 @@ HKLAPI HklGeometryList *hkl_engine_pseudo_axis_values_set(HklEngine *self,
 							  double values[], size_t n_values,
 							  HklUnitEnum unit_type, GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI int hkl_engine_pseudo_axis_values_set_into(HklEngine *self,
+						  double values[], size_t n_values,
+						  HklUnitEnum unit_type,
+						  HklGeometryList *solutions,
+						  GError **error) HKL_ARG_NONNULL(1, 2, 5) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pseudo_axis_values_set_batch(HklEngine *self,
+						   const double targets[], size_t n_targets,
+						   size_t n_values,
+						   HklUnitEnum unit_type,
+						   double axes[], size_t n_axes,
+						   int valid[],
+						   unsigned int n_threads,
+						   GError **error) HKL_ARG_NONNULL(1, 2, 6, 8) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pseudo_axis_values_set_trajectory(HklEngine *self,
+							const double targets[], size_t n_targets,
+							size_t n_values,
+							HklUnitEnum unit_type,
+							double axes[], size_t n_axes,
+							int valid[],
+							unsigned int n_threads,
+							GError **error) HKL_ARG_NONNULL(1, 2, 6, 8) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pseudo_axis_values_set_pvt(HklEngine *self,
+						 const double targets[], size_t n_targets,
+						 size_t n_values,
+						 const double velocity[],
+						 HklUnitEnum unit_type,
+						 double axes[], double velocities[],
+						 double times[],
+						 size_t n_axes,
+						 int valid[],
+						 unsigned int n_threads,
+						 GError **error) HKL_ARG_NONNULL(1, 2, 5, 7, 8, 9, 11) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_psi_values_set_trajectory(HklEngine *self,
+						const double psi[], size_t n_psi,
+						HklUnitEnum unit_type,
+						double axes[], size_t n_axes,
+						int valid[],
+						GError **error) HKL_ARG_NONNULL(1, 2, 5, 7) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_wavelength_values_set_trajectory(HklEngine *self,
+						       const double values[], size_t n_values,
+						       const double wavelengths[], size_t n_wavelengths,
+						       HklUnitEnum unit_type,
+						       double axes[], size_t n_axes,
+						       int valid[],
+						       GError **error) HKL_ARG_NONNULL(1, 2, 4, 7, 9) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI int hkl_engine_pseudo_axis_values_get_batch(HklEngine *self,
+						   const double positions[], size_t n_positions,
+						   size_t n_axes,
+						   HklUnitEnum unit_type,
+						   double values[], size_t n_values,
+						   int valid[],
+						   unsigned int n_threads,
+						   GError **error) HKL_ARG_NONNULL(1, 2, 6, 8) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI const HklParameter *hkl_engine_pseudo_axis_get(const HklEngine *self,
 						      const char *name,
 						      GError **error) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
@@ -550,6 +692,94 @@ HKLAPI int hkl_engine_initialized_set(HklEngine *self, int initialized,
 
 HKLAPI void hkl_engine_fprintf(FILE *f, const HklEngine *self) HKL_ARG_NONNULL(1, 2);
 
+HKLAPI void hkl_engine_continuation_set(HklEngine *self, unsigned int order) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_neighbours_set(HklEngine *self, size_t n_max) HKL_ARG_NONNULL(1);
+
+typedef enum _HklEngineMultistart
+{
+	HKL_ENGINE_MULTISTART_SOBOL,
+	HKL_ENGINE_MULTISTART_GRID,
+	HKL_ENGINE_MULTISTART_RANDOM,
+} HklEngineMultistart;
+
+HKLAPI void hkl_engine_multistart_set(HklEngine *self, HklEngineMultistart multistart,
+				      unsigned int n_starts, unsigned int seed) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_sectors_threads_set(HklEngine *self, unsigned int n_threads) HKL_ARG_NONNULL(1);
+
+typedef enum _HklEngineSolutions
+{
+	HKL_ENGINE_SOLUTIONS_ALL,
+	HKL_ENGINE_SOLUTIONS_CLOSEST,
+} HklEngineSolutions;
+
+HKLAPI void hkl_engine_solutions_set(HklEngine *self, HklEngineSolutions solutions) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_range_set(HklEngine *self, size_t n_max, double max_distance) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_branch_tracking_set(HklEngine *self, double max_jump, int forced) HKL_ARG_NONNULL(1);
+
+typedef enum _HklEngineSort
+{
+	HKL_ENGINE_SORT_DISTANCE,
+	HKL_ENGINE_SORT_TIME,
+} HklEngineSort;
+
+HKLAPI void hkl_engine_sort_set(HklEngine *self, HklEngineSort sort) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_cache_set(HklEngine *self, size_t n_max) HKL_ARG_NONNULL(1);
+
+HKLAPI void hkl_engine_cache_clear(HklEngine *self) HKL_ARG_NONNULL(1);
+
+typedef struct _HklEngineStats HklEngineStats;
+
+struct _HklEngineStats
+{
+	unsigned long solves;           /* pseudo axes values set */
+	unsigned long failures;         /* solves without any solution */
+	unsigned long closed_form;      /* functions solved in closed form */
+	unsigned long evaluations;      /* mode function evaluations */
+	unsigned long iterations;       /* numerical solver iterations */
+	unsigned long restarts;         /* numerical solver restarts */
+	unsigned long sectors_tested;   /* solution candidates tested */
+	unsigned long sectors_accepted; /* solution candidates accepted */
+	unsigned long discontinuities;  /* solves leaving the tracked branch */
+	unsigned long collisions;       /* solution candidates colliding */
+	unsigned long cache_hits;       /* solves answered by the cache */
+	unsigned long neighbour_starts; /* solves started from a solved neighbour */
+	double time;                    /* time spent solving in s */
+};
+
+HKLAPI void hkl_engine_stats_get(const HklEngine *self, HklEngineStats *stats) HKL_ARG_NONNULL(1, 2);
+
+HKLAPI void hkl_engine_stats_reset(HklEngine *self) HKL_ARG_NONNULL(1);
+
+/* trace */
+
+#define HKL_TRACE_TARGETS_MAX 6
+
+typedef struct _HklTraceRecord HklTraceRecord;
+
+struct _HklTraceRecord
+{
+	gint64 start;                           /* monotonic time in µs */
+	gint64 duration;                        /* in µs */
+	const char *engine;
+	const char *mode;
+	double targets[HKL_TRACE_TARGETS_MAX];  /* pseudo axes values */
+	unsigned int n_targets;
+	unsigned int iterations;                /* numerical solver iterations */
+	unsigned int n_solutions;
+	int status;                             /* TRUE if solved */
+};
+
+HKLAPI void hkl_trace_enable(size_t n_records);
+
+HKLAPI size_t hkl_trace_records_get(HklTraceRecord records[], size_t n_records);
+
+HKLAPI void hkl_trace_fprintf(FILE *f) HKL_ARG_NONNULL(1);
+
 /* mode */
 
 HKLAPI const darray_string *hkl_engine_modes_names_get(const HklEngine *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
@@ -567,6 +797,9 @@ typedef enum _HklEngineAxisNamesGet
 HKLAPI const darray_string *hkl_engine_axis_names_get(const HklEngine *self,
 						      HklEngineAxisNamesGet mode) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI const darray_int *hkl_engine_axis_idx_get(const HklEngine *self,
+						 HklEngineAxisNamesGet mode) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI const darray_string *hkl_engine_parameters_names_get(const HklEngine *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
 HKLAPI const HklParameter *hkl_engine_parameter_get(const HklEngine *self, const char *name,
@@ -593,17 +826,33 @@ typedef enum _HklEngineDependencies
 
 HKLAPI unsigned int hkl_engine_dependencies_get(const HklEngine *self) HKL_ARG_NONNULL(1);
 
+HKLAPI void hkl_kappa_to_eulerians_array(const double kappa[], size_t n_kappa,
+					 double eulerians[], size_t n_eulerians,
+					 double alpha, int solution,
+					 HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 3);
+
+HKLAPI int hkl_eulerians_to_kappa_array(const double eulerians[], size_t n_eulerians,
+					double kappa[], size_t n_kappa,
+					double alpha, int solution,
+					HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 3);
+
 
 /* HklEngineList */
 
 HKLAPI void hkl_engine_list_free(HklEngineList *self) HKL_ARG_NONNULL(1);
 
+HKLAPI HklEngineList *hkl_engine_list_new_copy(const HklEngineList *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI darray_engine *hkl_engine_list_engines_get(HklEngineList *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
 HKLAPI HklGeometry *hkl_engine_list_geometry_get(HklEngineList *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
 HKLAPI int hkl_engine_list_geometry_set(HklEngineList *self, const HklGeometry *geometry) HKL_ARG_NONNULL(1, 2);
 
+HKLAPI void hkl_engine_list_collision_set(HklEngineList *self,
+					  HklGeometryPredicate is_colliding,
+					  void *data) HKL_ARG_NONNULL(1);
+
 HKLAPI int hkl_engine_list_select_solution(HklEngineList *self,
 					   const HklGeometryListItem *item) HKL_ARG_NONNULL(1);
 
@@ -618,6 +867,16 @@ HKLAPI void hkl_engine_list_init(HklEngineList *self,
 
 HKLAPI int hkl_engine_list_get(HklEngineList *self) HKL_ARG_NONNULL(1);
 
+HKLAPI int hkl_engine_list_pseudo_axis_values_get_batch(HklEngineList *self,
+							const char *names[], size_t n_names,
+							const double positions[], size_t n_positions,
+							size_t n_axes,
+							HklUnitEnum unit_type,
+							double values[], size_t n_values,
+							int valid[],
+							unsigned int n_threads,
+							GError **error) HKL_ARG_NONNULL(1, 2, 4, 8, 10) HKL_WARN_UNUSED_RESULT;
+
 HKLAPI const darray_string *hkl_engine_list_parameters_names_get(const HklEngineList *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
 HKLAPI const HklParameter *hkl_engine_list_parameter_get(const HklEngineList *self, const char *name,
@@ -655,6 +914,32 @@ HKLAPI HklGeometry *hkl_factory_create_new_geometry(const HklFactory *self) HKL_
 
 HKLAPI HklEngineList *hkl_factory_create_new_engine_list(const HklFactory *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
 
+HKLAPI HklEngineList *hkl_factory_create_new_engine_list_full(const HklFactory *self,
+							      const char *names[],
+							      size_t n_names) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+/***********/
+/* Context */
+/***********/
+
+typedef struct _HklContext HklContext;
+
+HKLAPI HklContext *hkl_context_new(const HklEngineList *engines) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklContext *hkl_context_new_from_bytes(const guint8 *data, size_t len,
+					      GError **error) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklContext *hkl_context_new_copy(const HklContext *self) HKL_ARG_NONNULL(1) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI void hkl_context_free(HklContext *self) HKL_ARG_NONNULL(1);
+
+HKLAPI guint8 *hkl_context_to_bytes(const HklContext *self, size_t *len) HKL_ARG_NONNULL(1, 2) HKL_WARN_UNUSED_RESULT;
+
+HKLAPI HklEngineList *hkl_context_engine_list_new(const HklContext *self,
+						  HklGeometry **geometry,
+						  HklDetector **detector,
+						  HklSample **sample) HKL_ARG_NONNULL(1, 2, 3, 4) HKL_WARN_UNUSED_RESULT;
+
 G_END_DECLS
 
 #endif
@@ -20,10 +20,15 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 #include <stdarg.h>
+#include <string.h>
 
 #include "hkl/hkl-matrix-private.h"
 #include "hkl/hkl-macros-private.h"
+#include "hkl/hkl-pseudoaxis-common-private.h"
 #include "hkl/hkl-pseudoaxis-private.h"
+#include "hkl/hkl-quaternion-private.h"
+#include "hkl/hkl-sample-private.h"
+#include "hkl/hkl-vector-private.h"
 #include "hkl/hkl-trajectory-private.h"
 #include "hkl/api2/hkl2.h"
 
@@ -94,6 +99,106 @@ failed:
 #undef NEW_GEOMETRY
 }
 
+/* Geometry fixed size computations, the variants with a known list of
+ * rotations are computed on the stack without an HklGeometry, the
+ * axes counts are constant so the loops are unrolled by the compiler */
+
+#define KAPPA_COS_ALPHA 0.64278760968653936 /* cos(50°) */
+#define KAPPA_SIN_ALPHA 0.76604444311897801 /* sin(50°) */
+
+static const HklVector e4ch_sample[] = {{{0, 0, 1}}, {{1, 0, 0}}, {{0, 0, 1}}};
+static const HklVector e4ch_detector[] = {{{0, 0, 1}}};
+static const HklVector e4cv_sample[] = {{{0, -1, 0}}, {{1, 0, 0}}, {{0, -1, 0}}};
+static const HklVector e4cv_detector[] = {{{0, -1, 0}}};
+static const HklVector e6c_sample[] = {{{0, 0, 1}}, {{0, -1, 0}}, {{1, 0, 0}}, {{0, -1, 0}}};
+static const HklVector e6c_detector[] = {{{0, 0, 1}}, {{0, -1, 0}}};
+static const HklVector k4cv_sample[] = {{{0, -1, 0}}, {{0, -KAPPA_COS_ALPHA, -KAPPA_SIN_ALPHA}}, {{0, -1, 0}}};
+static const HklVector k4cv_detector[] = {{{0, -1, 0}}};
+static const HklVector k6c_sample[] = {{{0, 0, 1}}, {{0, -1, 0}}, {{0, -KAPPA_COS_ALPHA, -KAPPA_SIN_ALPHA}}, {{0, -1, 0}}};
+static const HklVector k6c_detector[] = {{{0, 0, 1}}, {{0, -1, 0}}};
+
+/* the rotation of a holder, the values are in degree */
+static inline HklQuaternion fixed_holder_q(const HklVector axes[], const double values[],
+					   size_t n)
+{
+	size_t i;
+	HklQuaternion q = {{1, 0, 0, 0}};
+
+	for(i=0; i<n; ++i){
+		HklQuaternion qa;
+
+		hkl_quaternion_init_from_angle_and_axe(&qa, values[i] * HKL_DEGTORAD, &axes[i]);
+		hkl_quaternion_times_quaternion(&q, &qa);
+	}
+
+	return q;
+}
+
+/* same computation than hkl_hkl_read, the source along x */
+static inline int fixed_hkl_get(double wavelength,
+				const HklVector sample_axes[], size_t n_sample,
+				const HklVector detector_axes[], size_t n_detector,
+				const double values[], const HklSample *sample,
+				double hkl[3])
+{
+	const HklQuaternion qs = fixed_holder_q(sample_axes, values, n_sample);
+	const HklQuaternion qd = fixed_holder_q(detector_axes, &values[n_sample], n_detector);
+	const HklVector ki = {{HKL_TAU / wavelength, 0, 0}};
+	HklVector Q = ki;
+	HklVector res;
+	HklMatrix RUB;
+
+	hkl_vector_rotated_quaternion(&Q, &qd);
+	hkl_vector_minus_vector(&Q, &ki);
+
+	hkl_quaternion_to_matrix(&qs, &RUB);
+	hkl_matrix_times_matrix(&RUB, &sample->UB);
+	if(!hkl_matrix_solve(&RUB, &res, &Q))
+		return FALSE;
+	memcpy(hkl, res.data, sizeof(res.data));
+
+	return TRUE;
+}
+
+/* the hkl of a geometry, without HklGeometry for the eulerian and
+ * kappa 4 and 6 circles, the other variants use the generic path */
+int Geometry_hkl_get(struct Geometry geometry, const HklSample *sample, double hkl[3])
+{
+	int res = FALSE;
+
+#define FIXED_HKL_GET(_w, _values, _sample, _detector) do{		\
+		BUILD_ASSERT(ARRAY_SIZE(_sample) + ARRAY_SIZE(_detector) \
+			     == ARRAY_SIZE(_values->data));		\
+		res = fixed_hkl_get(*_w,				\
+				    _sample, ARRAY_SIZE(_sample),	\
+				    _detector, ARRAY_SIZE(_detector),	\
+				    _values->data, sample, hkl);	\
+	}while(0)
+
+        match(geometry){
+                of(E4ch, w, values){ FIXED_HKL_GET(w, values, e4ch_sample, e4ch_detector); }
+                of(E4cv, w, values){ FIXED_HKL_GET(w, values, e4cv_sample, e4cv_detector); }
+                of(E6c, w, values){ FIXED_HKL_GET(w, values, e6c_sample, e6c_detector); }
+                of(K4cv, w, values){ FIXED_HKL_GET(w, values, k4cv_sample, k4cv_detector); }
+                of(K6c, w, values){ FIXED_HKL_GET(w, values, k6c_sample, k6c_detector); }
+                otherwise {
+                        HklGeometry *self = newGeometry(geometry);
+
+                        if(NULL != self){
+                                HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+                                const struct HklHklRead r = hkl_hkl_read(self, detector, sample);
+
+                                memcpy(hkl, r.hkl.data, sizeof(r.hkl.data));
+                                hkl_detector_free(detector);
+                                hkl_geometry_free(self);
+                                res = TRUE;
+                        }
+                }
+	}
+	return res;
+#undef FIXED_HKL_GET
+}
+
 /* Lattice */
 
 HklLattice *newLattice(const Lattice lattice)
@@ -204,6 +309,28 @@ void Engine_save_as_dat(FILE *f, const struct Engine engine)
 	}
 }
 
+/* the names and the values of the engine pseudo axes */
+static size_t Engine_values(const struct Engine engine,
+			    const char **names, double *values)
+{
+	size_t n = 0;
+
+        match(engine){
+                of(EngineHkl, h, k, l, _){
+                        static const char *hkl[] = {"h", "k", "l"};
+                        const double v[] = {*h, *k, *l};
+
+                        n = ARRAY_SIZE(hkl);
+                        if(names)
+                                memcpy(names, hkl, sizeof(hkl));
+                        if(values)
+                                memcpy(values, v, sizeof(v));
+                }
+	}
+
+	return n;
+}
+
 HklGeometryList *Engine_solve(HklEngineList *engines, struct Engine econfig)
 {
 	HklGeometryList *geometries = NULL;
@@ -244,6 +371,15 @@ generator_def(trajectory_gen, struct Engine, struct Trajectory, tconfig)
                                 generator_yield(econfig);
                         }
                 }
+                of(TrajectoryHklList, targets, n, mode){
+                        uint i;
+                        for(i=0; i<*n; ++i){
+                                const double *hkl = &(*targets)[3 * i];
+
+                                struct Engine econfig = EngineHkl(hkl[0], hkl[1], hkl[2], *mode);
+                                generator_yield(econfig);
+                        }
+                }
 	}
 }
 
@@ -255,6 +391,9 @@ uint Trajectory_len(Trajectory tconfig)
                 of(TrajectoryHklFromTo, _, _, _, _, _, _, n, _){
                         res = *n + 1;
                 }
+                of(TrajectoryHklList, _, n, _){
+                        res = *n;
+                }
         }
 
         return res;
@@ -306,3 +445,141 @@ HklGeometryList *Trajectory_solve(struct Trajectory tconfig,
 
 	return solutions;
 }
+
+/* Table */
+
+static struct Table *Table_new(size_t n_rows,
+			       const struct Engine econfig,
+			       const darray_string *axes)
+{
+	size_t i, n_values;
+	const char *names[Engine_values(econfig, NULL, NULL)];
+	struct Table *self = g_new(struct Table, 1);
+
+	n_values = Engine_values(econfig, names, NULL);
+
+	self->n_rows = n_rows;
+	self->n_columns = n_values + darray_size(*axes);
+	self->names = g_new0(char *, self->n_columns + 1);
+	for(i=0; i<n_values; ++i)
+		self->names[i] = g_strdup(names[i]);
+	for(i=0; i<darray_size(*axes); ++i)
+		self->names[n_values + i] = g_strdup(darray_item(*axes, i));
+
+	/* the targets without solution stay at NAN */
+	self->data = g_new(double, self->n_rows * self->n_columns);
+	for(i=0; i<self->n_rows * self->n_columns; ++i)
+		self->data[i] = NAN;
+
+	return self;
+}
+
+void Table_free(struct Table *self)
+{
+	g_strfreev(self->names);
+	g_free(self->data);
+	g_free(self);
+}
+
+/* like Trajectory_solve, but the targets and the axes values of the
+ * first solution of each one are stored in the columns of a table,
+ * the axes of the targets without solution stay at NAN */
+struct Table *Trajectory_solve_table(struct Trajectory tconfig,
+				     struct Geometry gconfig,
+				     struct Sample sconfig,
+				     uint move)
+{
+	const struct Engine *econfig;
+	struct Table *self = NULL;
+	size_t i, row = 0;
+	generator_t(struct Engine) gen = trajectory_gen(tconfig);
+
+	HklGeometry *geometry = newGeometry(gconfig);
+	HklEngineList *engines = newEngines(gconfig);
+	HklSample *sample = newSample(sconfig);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	const darray_string *axes = hkl_geometry_axis_names_get(geometry);
+	size_t n_axes = darray_size(*axes);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	while((econfig = generator_next(gen)) != NULL){
+		size_t n_values = Engine_values(*econfig, NULL, NULL);
+		double values[n_values + n_axes];
+		HklGeometryList *geometries;
+
+		if(NULL == self)
+			self = Table_new(Trajectory_len(tconfig), *econfig, axes);
+
+		Engine_values(*econfig, NULL, values);
+		geometries = Engine_solve(engines, *econfig);
+		if(NULL != geometries){
+			const HklGeometryListItem *solution;
+
+			solution = hkl_geometry_list_items_first_get(geometries);
+			if(move)
+				hkl_engine_list_select_solution(engines, solution);
+
+			hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(solution),
+						     &values[n_values], n_axes,
+						     HKL_UNIT_USER);
+			for(i=0; i<n_values + n_axes; ++i)
+				self->data[i * self->n_rows + row] = values[i];
+			hkl_geometry_list_free(geometries);
+		}else
+			for(i=0; i<n_values; ++i)
+				self->data[i * self->n_rows + row] = values[i];
+		++row;
+	}
+
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_engine_list_free(engines);
+	hkl_geometry_free(geometry);
+	generator_free(gen);
+
+	return self;
+}
+
+void Table_save_as_dat(FILE *f, const struct Table *self)
+{
+	size_t i, j;
+
+	fprintf(f, "#");
+	for(j=0; j<self->n_columns; ++j)
+		fprintf(f, " %s", self->names[j]);
+	fprintf(f, "\n");
+
+	for(i=0; i<self->n_rows; ++i){
+		for(j=0; j<self->n_columns; ++j)
+			fprintf(f, j ? " %f" : "%f", self->data[j * self->n_rows + i]);
+		fprintf(f, "\n");
+	}
+}
+
+/* the numpy npy format (version 1.0), a n_rows x n_columns array of
+ * doubles written in one block, without the column names */
+int Table_save_as_npy(FILE *f, const struct Table *self)
+{
+	static const char magic[] = "\x93NUMPY\x01\x00";
+	char header[128];
+	guint16 header_len;
+	size_t len, pad, n = self->n_rows * self->n_columns;
+
+	len = snprintf(header, sizeof(header),
+		       "{'descr': '%cf8', 'fortran_order': True, 'shape': (%zu, %zu), }",
+		       G_BYTE_ORDER == G_LITTLE_ENDIAN ? '<' : '>',
+		       self->n_rows, self->n_columns);
+
+	/* the data start on a 64 bytes boundary, the header ends with '\n' */
+	pad = 64 - (sizeof(magic) - 1 + sizeof(header_len) + len + 1) % 64;
+	pad %= 64;
+	header_len = GUINT16_TO_LE(len + pad + 1);
+
+	return 1 == fwrite(magic, sizeof(magic) - 1, 1, f)
+		&& 1 == fwrite(&header_len, sizeof(header_len), 1, f)
+		&& 1 == fwrite(header, len, 1, f)
+		&& pad == fwrite("                                                                ", 1, pad, f)
+		&& 1 == fwrite("\n", 1, 1, f)
+		&& n == fwrite(self->data, sizeof(*self->data), n, f);
+}
@@ -56,6 +56,10 @@ datatype(
 
 extern HklGeometry *newGeometry(struct Geometry geometry);
 
+extern int Geometry_hkl_get(struct Geometry geometry,
+			    const HklSample *sample,
+			    double hkl[3]);
+
 /* Engines */
 
 extern HklEngineList *newEngines(struct Geometry geometry);
@@ -122,7 +126,8 @@ extern HklGeometryList *Engine_solve(HklEngineList *engines,
 
 datatype(
         Trajectory,
-        (TrajectoryHklFromTo, double, double, double, double, double, double, uint, Mode)
+        (TrajectoryHklFromTo, double, double, double, double, double, double, uint, Mode),
+        (TrajectoryHklList, const double *, uint, Mode) /* n (h, k, l) targets */
         );
 
 extern generator_declare(trajectory_gen, Engine, Trajectory, tconfig);
@@ -134,6 +139,26 @@ extern HklGeometryList *Trajectory_solve(const Trajectory tconfig,
 					 struct Sample sconfig,
 					 uint move);
 
+/* Table, a solved trajectory stored column by column */
+
+struct Table {
+	size_t n_rows;
+	size_t n_columns;
+	char **names; /* the engine pseudo axes then the geometry axes */
+	double *data; /* the column i starts at data[i * n_rows] */
+};
+
+extern struct Table *Trajectory_solve_table(const Trajectory tconfig,
+					    struct Geometry gconfig,
+					    struct Sample sconfig,
+					    uint move);
+
+extern void Table_free(struct Table *self);
+
+extern void Table_save_as_dat(FILE *f, const struct Table *self);
+
+extern int Table_save_as_npy(FILE *f, const struct Table *self);
+
 G_END_DECLS
 
 #endif /* __HKL_TAP_H__ */
@@ -261,6 +261,7 @@ static inline double hkl_axis_orthodromic_distance_get(const HklParameter *self,
 
 #define HKL_PARAMETER_OPERATIONS_AXIS_DEFAULTS				\
 	HKL_PARAMETER_OPERATIONS_DEFAULTS,				\
+		.size = sizeof(HklAxis),				\
 		.copy = hkl_axis_copy_real,				\
 		.free = hkl_axis_free_real,				\
 		.init_copy = hkl_axis_init_copy_real,			\
@@ -287,6 +288,7 @@ HklParameter *hkl_parameter_new_rotation(const char *name, HklVector const *axis
 		.parameter = { HKL_PARAMETER_DEFAULTS_ANGLE,
 			.name = name,
 			.punit = punit,
+			.factor = hkl_unit_factor(&hkl_unit_angle_rad, punit),
 			.ops = &hkl_parameter_operations_axis,
                         .type = Rotation(*axis_v),
 		},
@@ -369,6 +371,7 @@ static inline HklVector hkl_rotation_with_origin_transformation_apply_real(const
 
 #define HKL_PARAMETER_OPERATIONS_ROTATION_WITH_ORIGIN_DEFAULTS		\
 	HKL_PARAMETER_OPERATIONS_AXIS_DEFAULTS,				\
+		.size = sizeof(HklRotationWithOrigin),			\
 		.copy = hkl_rotation_with_origin_copy_real,		\
 		.free = hkl_rotation_with_origin_free_real,		\
 		.init_copy = hkl_rotation_with_origin_init_copy_real,	\
@@ -389,6 +392,7 @@ HklParameter *hkl_parameter_new_rotation_with_origin(const char *name,
 			.parameter = { HKL_PARAMETER_DEFAULTS_ANGLE,
 				.name = name,
 				.punit = punit,
+				.factor = hkl_unit_factor(&hkl_unit_angle_rad, punit),
 				.ops = &hkl_parameter_operations_rotation_with_origin,
                                 .type = RotationWithOrigin(*axis_v, *origin),
 			},
@@ -479,6 +483,7 @@ static inline HklVector hkl_translation_transformation_apply_real(const HklParam
 
 #define HKL_PARAMETER_OPERATIONS_TRANSLATION_DEFAULTS			\
 	HKL_PARAMETER_OPERATIONS_DEFAULTS,				\
+		.size = sizeof(HklTranslation),				\
 		.copy = hkl_translation_copy_real,			\
 		.free = hkl_translation_free_real,			\
 		.init_copy = hkl_translation_init_copy_real,		\
@@ -498,6 +503,7 @@ HklParameter *hkl_parameter_new_translation(const char *name, HklVector const *a
 		.parameter = { HKL_PARAMETER_DEFAULTS_LENGTH,
 			.name = name,
 			.punit = punit,
+			.factor = hkl_unit_factor(&hkl_unit_length_meter, punit),
 			.ops = &hkl_parameter_operations_translation,
                         .type = Translation(*axis_v),
 		},
@@ -73,7 +73,15 @@ HKLAPI HklVector *hkl_geometry_kf_abc_get_binding(const HklGeometry *self,
 /* HklGeometryList */
 /*******************/
 
-HKLAPI GSList* hkl_geometry_list_items(HklGeometryList *self) HKL_ARG_NONNULL(1);
+HKLAPI HklGeometryListItem **hkl_geometry_list_items(HklGeometryList *self, guint *len) HKL_ARG_NONNULL(1, 2);
+
+HKLAPI double *hkl_geometry_list_axis_values_get_binding(const HklGeometryList *self,
+							 guint *len, guint *n_axes,
+							 HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2, 3);
+
+HKLAPI GBytes *hkl_geometry_list_axis_values_get_as_bytes(const HklGeometryList *self,
+							  guint *n_axes,
+							  HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2);
 
 /*************/
 /* HklEngine */
@@ -98,6 +106,13 @@ HKLAPI const char **hkl_engine_axis_names_get_binding(const HklEngine *self,
 HKLAPI double *hkl_engine_pseudo_axis_values_get_binding(const HklEngine *self,
 							 guint *len, HklUnitEnum unit_type);
 
+HKLAPI GBytes *hkl_engine_pseudo_axis_values_set_batch_binding(HklEngine *self,
+							       GBytes *targets,
+							       HklUnitEnum unit_type,
+							       guint n_threads,
+							       GBytes **valid,
+							       GError **error) HKL_ARG_NONNULL(1, 2, 5);
+
 /***************************/
 /* HklPSeudoAxisEngineList */
 /***************************/
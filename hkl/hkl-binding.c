@@ -108,7 +108,7 @@ const char **hkl_geometry_axis_names_get_binding(const HklGeometry *self,
 /**
  * hkl_geometry_axis_values_get_binding: (rename-to hkl_geometry_axis_values_get)
  * @self: the this ptr
- * @len: (out caller-allocates): the length of the returned array
+ * @len: (out): the length of the returned array
  * @unit_type: the unit type (default or user) of the returned value
  *
  * Return value: (array length=len) (transfer container): list of axes values,
@@ -247,19 +247,76 @@ HklVector *hkl_geometry_kf_abc_get_binding(const HklGeometry *self,
 /**
  * hkl_geometry_list_items:
  * @self: the #HklGeometryList
+ * @len: (out): the number of items
  *
- * Return value: (element-type HklGeometryListItem) (transfer container): list of items,
- *               free the list with g_slist_free when done.
+ * Return value: (array length=len) (transfer none): the items of the
+ *               list, valid until the next modification of the list.
  **/
-GSList* hkl_geometry_list_items(HklGeometryList *self)
+HklGeometryListItem **hkl_geometry_list_items(HklGeometryList *self, guint *len)
 {
-	GSList *list = NULL;
-	HklGeometryListItem *item;
+	*len = self->n_items;
 
-	list_for_each(&self->items, item, list)
-		list = g_slist_append(list, item);
+	return self->n_items ? &darray_item(self->items, 0) : NULL;
+}
 
-	return list;
+/* the number of axes of the solutions of a list */
+static guint hkl_geometry_list_n_axes(const HklGeometryList *self)
+{
+	const HklGeometryListItem *item = hkl_geometry_list_items_first_get(self);
+
+	return item ? darray_size(item->geometry->axes) : 0;
+}
+
+/**
+ * hkl_geometry_list_axis_values_get_binding: (rename-to hkl_geometry_list_axis_values_get)
+ * @self: the #HklGeometryList
+ * @len: (out): the length of the returned array
+ * @n_axes: (out): the number of axes of a solution
+ * @unit_type: the unit type (default or user) of the returned values
+ *
+ * Return value: (array length=len) (transfer full): the axes values of
+ *          all the solutions, a flat n_items x n_axes array in the
+ *          order of the list, free it with g_free when done.
+ **/
+double *hkl_geometry_list_axis_values_get_binding(const HklGeometryList *self,
+						  guint *len, guint *n_axes,
+						  HklUnitEnum unit_type)
+{
+	double *values;
+
+	*n_axes = hkl_geometry_list_n_axes(self);
+	*len = self->n_items * *n_axes;
+	if(0 == *len)
+		return NULL;
+
+	values = g_new(double, *len);
+	hkl_geometry_list_axis_values_get(self, values, *len, unit_type);
+
+	return values;
+}
+
+/**
+ * hkl_geometry_list_axis_values_get_as_bytes:
+ * @self: the #HklGeometryList
+ * @n_axes: (out): the number of axes of a solution
+ * @unit_type: the unit type (default or user) of the returned values
+ *
+ * like hkl_geometry_list_axis_values_get, but the values are returned
+ * in one buffer of native doubles, which numpy.frombuffer can wrap
+ * without converting each value.
+ *
+ * Return value: (transfer full): the n_items x n_axes axes values.
+ **/
+GBytes *hkl_geometry_list_axis_values_get_as_bytes(const HklGeometryList *self,
+						   guint *n_axes,
+						   HklUnitEnum unit_type)
+{
+	guint len;
+	double *values;
+
+	values = hkl_geometry_list_axis_values_get_binding(self, &len, n_axes, unit_type);
+
+	return g_bytes_new_take(values, len * sizeof(*values));
 }
 
 /*************/
@@ -328,7 +385,7 @@ const char **hkl_engine_axis_names_get_binding(const HklEngine *self,
 /**
  * hkl_engine_parameters_values_get_binding: (rename-to hkl_engine_parameters_values_get)
  * @self: the this ptr
- * @len: (out caller-allocates): the length of the returned array
+ * @len: (out): the length of the returned array
  * @unit_type: the unit type (default or user) of the returned value
  *
  * Return value: (array length=len) (transfer container): list of parameters values,
@@ -357,7 +414,7 @@ double *hkl_engine_parameters_values_get_binding(const HklEngine *self, guint *l
 /**
  * hkl_engine_pseudo_axis_values_get_binding: (rename-to hkl_engine_pseudo_axis_values_get)
  * @self: the this ptr
- * @len: (out caller-allocates): the length of the returned array
+ * @len: (out): the length of the returned array
  * @unit_type: the unit type (default or user) of the returned value
  *
  * Return value: (array length=len) (transfer container): list of pseudo axes values,
@@ -383,6 +440,71 @@ double *hkl_engine_pseudo_axis_values_get_binding(const HklEngine *self, guint *
 	return values;
 }
 
+/**
+ * hkl_engine_pseudo_axis_values_set_batch_binding: (rename-to hkl_engine_pseudo_axis_values_set_batch)
+ * @self: the this ptr
+ * @targets: the n_targets x n_values pseudo axes values, native doubles
+ * @unit_type: the unit type (default or user) of the values
+ * @n_threads: the number of threads used to solve the targets
+ * @valid: (out) (transfer full): the n_targets flags, native ints,
+ *         TRUE if a solution was found
+ * @error: return location for a GError, or NULL
+ *
+ * binding version of hkl_engine_pseudo_axis_values_set_batch. All the
+ * buffers are native arrays, so numpy can exchange them without
+ * converting each value:
+ * GLib.Bytes.new(targets.tobytes()) and
+ * numpy.frombuffer(axes.get_data()).reshape(-1, n_axes).
+ *
+ * PyGObject releases the GIL during the call, the other python
+ * threads keep running while the targets are solved.
+ *
+ * Return value: (transfer full): the n_targets x n_axes axes values
+ *          of the closest solutions, NULL on error.
+ **/
+GBytes *hkl_engine_pseudo_axis_values_set_batch_binding(HklEngine *self,
+							GBytes *targets,
+							HklUnitEnum unit_type,
+							guint n_threads,
+							GBytes **valid,
+							GError **error)
+{
+	size_t n_values = darray_size(self->info->pseudo_axes);
+	size_t n_axes = darray_size(self->engines->geometry->axes);
+	size_t n_targets;
+	gsize size;
+	const double *values = g_bytes_get_data(targets, &size);
+	double *axes;
+	int *flags;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if(0 == n_values || size % (n_values * sizeof(*values))){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, %zd bytes of targets is not a multiple of (%zd) values\n",
+			    size, n_values);
+		return NULL;
+	}
+	n_targets = size / (n_values * sizeof(*values));
+
+	axes = g_new0(double, n_targets * n_axes);
+	flags = g_new0(int, n_targets);
+	if(n_targets > 0
+	   && !hkl_engine_pseudo_axis_values_set_batch(self, values, n_targets, n_values,
+							unit_type, axes, n_axes,
+							flags, n_threads, error)){
+		g_free(flags);
+		g_free(axes);
+		return NULL;
+	}
+
+	*valid = g_bytes_new_take(flags, n_targets * sizeof(*flags));
+
+	return g_bytes_new_take(axes, n_targets * n_axes * sizeof(*axes));
+}
+
 /**
  * hkl_engine_list_engines_get_as_gslist: (rename-to hkl_engine_list_engines_get)
  * @self: the this ptr
@@ -422,7 +544,7 @@ const char **hkl_engine_list_parameters_names_get_binding(const HklEngineList *s
 /**
  * hkl_engine_list_parameters_values_get_binding: (rename-to hkl_engine_list_parameters_values_get)
  * @self: the this ptr
- * @len: (out caller-allocates): the length of the returned array
+ * @len: (out): the length of the returned array
  * @unit_type: the unit type (default or user) of the returned value
  *
  * Return value: (array length=len) (transfer container): list of parameters values,
@@ -0,0 +1,52 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2019 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_CONTEXT_PRIVATE_H__
+#define __HKL_CONTEXT_PRIVATE_H__
+
+#include "hkl.h"                        // for HklContext, etc
+
+G_BEGIN_DECLS
+
+/* a fully configured diffractometer, all the members are owned */
+struct _HklContext
+{
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+};
+
+#define HKL_CONTEXT_ERROR hkl_context_error_quark ()
+
+static inline GQuark hkl_context_error_quark (void)
+{
+	return g_quark_from_static_string ("hkl-context-error-quark");
+}
+
+typedef enum {
+	HKL_CONTEXT_ERROR_FORMAT, /* not a context or a truncated one */
+	HKL_CONTEXT_ERROR_FACTORY, /* unknown diffractometer or engine */
+} HklContextError;
+
+G_END_DECLS
+
+#endif /* __HKL_CONTEXT_PRIVATE_H__ */
@@ -0,0 +1,674 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2019 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <string.h>                     // for memcpy, strcmp, strlen
+#include "hkl-context-private.h"
+#include "hkl-detector-private.h"       // for hkl_detector_new_copy
+#include "hkl-factory-private.h"        // for _HklFactory
+#include "hkl-geometry-private.h"       // for hkl_geometry_update, etc
+#include "hkl-lattice-private.h"        // for _HklLattice
+#include "hkl-macros-private.h"         // for IGNORE, hkl_error
+#include "hkl-parameter-private.h"      // for _HklParameter
+#include "hkl-pseudoaxis-private.h"     // for _HklEngine, _HklMode, etc
+#include "hkl-sample-private.h"         // for _HklSample
+
+/* the binary form starts with this magic and the version, all the
+ * numbers are stored in little endian */
+#define HKL_CONTEXT_MAGIC "HKLC"
+#define HKL_CONTEXT_VERSION 1
+
+static HklContext *hkl_context_new_full(HklGeometry *geometry,
+					HklDetector *detector,
+					HklSample *sample,
+					HklEngineList *engines)
+{
+	HklContext *self = g_new(HklContext, 1);
+
+	self->geometry = geometry;
+	self->detector = detector;
+	self->sample = sample;
+	self->engines = engines;
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	return self;
+}
+
+/**
+ * hkl_context_new:
+ * @engines: an #HklEngineList created by an #HklFactory and already
+ *           initialized with hkl_engine_list_init
+ *
+ * take a snapshot of a fully configured diffractometer: the geometry
+ * axes values and ranges, the detector, the sample and the engines
+ * with their modes and parameters. The clients are then created from
+ * it with hkl_context_engine_list_new instead of being configured
+ * again field by field.
+ *
+ * Returns: (transfer full): the snapshot, or NULL if @engines was not
+ *          created by an #HklFactory or is not initialized.
+ **/
+HklContext *hkl_context_new(const HklEngineList *engines)
+{
+	HklEngineList *copy;
+
+	if(!engines->geometry || !engines->detector || !engines->sample)
+		return NULL;
+
+	copy = hkl_engine_list_new_copy(engines);
+	if(!copy)
+		return NULL;
+
+	return hkl_context_new_full(hkl_geometry_new_copy(engines->geometry),
+				    hkl_detector_new_copy(engines->detector),
+				    hkl_sample_new_copy(engines->sample),
+				    copy);
+}
+
+/**
+ * hkl_context_new_copy: (skip)
+ * @self: the #HklContext to copy
+ *
+ * Returns: a copy of the snapshot
+ **/
+HklContext *hkl_context_new_copy(const HklContext *self)
+{
+	return hkl_context_new(self->engines);
+}
+
+/**
+ * hkl_context_free: (skip)
+ * @self: the #HklContext to destroy
+ **/
+void hkl_context_free(HklContext *self)
+{
+	hkl_engine_list_free(self->engines);
+	hkl_sample_free(self->sample);
+	hkl_detector_free(self->detector);
+	hkl_geometry_free(self->geometry);
+	free(self);
+}
+
+/**
+ * hkl_context_engine_list_new:
+ * @self: the this ptr
+ * @geometry: (out) (transfer full): the geometry of the new engine list
+ * @detector: (out) (transfer full): the detector of the new engine list
+ * @sample: (out) (transfer full): the sample of the new engine list
+ *
+ * clone the snapshot into a new client, the copies do not share any
+ * mutable state with @self.
+ *
+ * Returns: (transfer full): an #HklEngineList initialized with
+ *          @geometry, @detector and @sample, free them all when done.
+ **/
+HklEngineList *hkl_context_engine_list_new(const HklContext *self,
+					   HklGeometry **geometry,
+					   HklDetector **detector,
+					   HklSample **sample)
+{
+	HklEngineList *engines = hkl_engine_list_new_copy(self->engines);
+
+	*geometry = hkl_geometry_new_copy(self->geometry);
+	*detector = hkl_detector_new_copy(self->detector);
+	*sample = hkl_sample_new_copy(self->sample);
+
+	hkl_engine_list_init(engines, *geometry, *detector, *sample);
+
+	return engines;
+}
+
+/**********/
+/* writer */
+/**********/
+
+static void put_uint(GByteArray *bytes, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(bytes, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_double(GByteArray *bytes, double value)
+{
+	guint64 bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	bits = GUINT64_TO_LE(bits);
+	g_byte_array_append(bytes, (const guint8 *)&bits, sizeof(bits));
+}
+
+static void put_string(GByteArray *bytes, const char *value)
+{
+	size_t len = strlen(value);
+
+	put_uint(bytes, len);
+	g_byte_array_append(bytes, (const guint8 *)value, len);
+}
+
+/* the value, the range and the fit flag in the default unit */
+static void put_parameter(GByteArray *bytes, const HklParameter *parameter)
+{
+	double min, max;
+
+	hkl_parameter_min_max_get(parameter, &min, &max, HKL_UNIT_DEFAULT);
+
+	put_double(bytes, hkl_parameter_value_get(parameter, HKL_UNIT_DEFAULT));
+	put_double(bytes, min);
+	put_double(bytes, max);
+	put_uint(bytes, hkl_parameter_fit_get(parameter));
+}
+
+static void put_engine(GByteArray *bytes, const HklEngine *engine)
+{
+	HklMode **mode;
+
+	put_string(bytes, engine->mode->info->name);
+	put_uint(bytes, engine->continuation_order);
+	put_uint(bytes, engine->multistart);
+	put_uint(bytes, engine->multistart_n);
+	put_uint(bytes, engine->multistart_seed);
+	put_uint(bytes, engine->solutions);
+	put_uint(bytes, engine->range_n_max);
+	put_double(bytes, engine->range_max_distance);
+	put_double(bytes, engine->branch_max_jump);
+	put_uint(bytes, engine->branch_forced);
+	put_uint(bytes, engine->sort);
+
+	put_uint(bytes, darray_size(engine->modes));
+	darray_foreach(mode, engine->modes){
+		HklParameter **parameter;
+
+		put_string(bytes, (*mode)->info->name);
+		put_uint(bytes, (*mode)->initialized);
+		put_uint(bytes, darray_size((*mode)->parameters));
+		darray_foreach(parameter, (*mode)->parameters){
+			put_parameter(bytes, *parameter);
+		}
+	}
+}
+
+/**
+ * hkl_context_to_bytes:
+ * @self: the this ptr
+ * @len: (out): the length of the returned array
+ *
+ * serialize the snapshot in a compact binary form, which can be saved
+ * and restored with hkl_context_new_from_bytes. The sample is stored
+ * with its lattice and its U angles, but without its reflections.
+ *
+ * Returns: (array length=len) (transfer full): the binary form, free
+ *          it with g_free when done.
+ **/
+guint8 *hkl_context_to_bytes(const HklContext *self, size_t *len)
+{
+	GByteArray *bytes = g_byte_array_new();
+	const HklLattice *lattice = self->sample->lattice;
+	HklParameter **parameter;
+	HklEngine **engine;
+
+	g_byte_array_append(bytes, (const guint8 *)HKL_CONTEXT_MAGIC, 4);
+	put_uint(bytes, HKL_CONTEXT_VERSION);
+
+	/* geometry, the only detector type is the 0D one */
+	put_string(bytes, hkl_factory_name_get(self->engines->factory));
+	put_double(bytes, hkl_geometry_wavelength_get(self->geometry, HKL_UNIT_DEFAULT));
+	put_uint(bytes, darray_size(self->geometry->axes));
+	darray_foreach(parameter, self->geometry->axes){
+		put_string(bytes, (*parameter)->name);
+		put_parameter(bytes, *parameter);
+	}
+
+	/* sample, UB follows from the lattice and the U angles */
+	put_string(bytes, hkl_sample_name_get(self->sample));
+	put_parameter(bytes, lattice->a);
+	put_parameter(bytes, lattice->b);
+	put_parameter(bytes, lattice->c);
+	put_parameter(bytes, lattice->alpha);
+	put_parameter(bytes, lattice->beta);
+	put_parameter(bytes, lattice->gamma);
+	put_parameter(bytes, self->sample->ux);
+	put_parameter(bytes, self->sample->uy);
+	put_parameter(bytes, self->sample->uz);
+
+	/* engines */
+	put_uint(bytes, darray_size(*self->engines));
+	darray_foreach(engine, *self->engines){
+		put_string(bytes, (*engine)->info->name);
+	}
+	put_uint(bytes, darray_size(self->engines->parameters));
+	darray_foreach(parameter, self->engines->parameters){
+		put_parameter(bytes, *parameter);
+	}
+	darray_foreach(engine, *self->engines){
+		put_engine(bytes, *engine);
+	}
+
+	*len = bytes->len;
+
+	return g_byte_array_free(bytes, FALSE);
+}
+
+/**********/
+/* reader */
+/**********/
+
+struct HklContextReader
+{
+	const guint8 *data;
+	size_t len;
+	size_t pos;
+	int ok; /* FALSE once a read went past the end of the data */
+};
+
+struct HklContextParameter
+{
+	double value;
+	double min;
+	double max;
+	int fit;
+};
+
+static const guint8 *get_bytes(struct HklContextReader *self, size_t len)
+{
+	const guint8 *bytes = NULL;
+
+	if(self->ok && len <= self->len - self->pos){
+		bytes = &self->data[self->pos];
+		self->pos += len;
+	}else
+		self->ok = FALSE;
+
+	return bytes;
+}
+
+static guint32 get_uint(struct HklContextReader *self)
+{
+	guint32 value = 0;
+	const guint8 *bytes = get_bytes(self, sizeof(value));
+
+	if(bytes)
+		memcpy(&value, bytes, sizeof(value));
+
+	return GUINT32_FROM_LE(value);
+}
+
+static double get_double(struct HklContextReader *self)
+{
+	guint64 bits = 0;
+	double value;
+	const guint8 *bytes = get_bytes(self, sizeof(bits));
+
+	if(bytes)
+		memcpy(&bits, bytes, sizeof(bits));
+	bits = GUINT64_FROM_LE(bits);
+	memcpy(&value, &bits, sizeof(value));
+
+	return value;
+}
+
+/* a number of items taking at least size bytes each, so a corrupted
+ * count can not trigger a huge allocation */
+static size_t get_count(struct HklContextReader *self, size_t size)
+{
+	size_t n = get_uint(self);
+
+	if(n > (self->len - self->pos) / size){
+		self->ok = FALSE;
+		n = 0;
+	}
+
+	return n;
+}
+
+/* a newly allocated string, empty once the data are exhausted */
+static char *get_string(struct HklContextReader *self)
+{
+	size_t len = get_uint(self);
+	const guint8 *bytes = get_bytes(self, len);
+
+	return bytes ? g_strndup((const char *)bytes, len) : g_strdup("");
+}
+
+static struct HklContextParameter get_parameter(struct HklContextReader *self)
+{
+	struct HklContextParameter parameter;
+
+	parameter.value = get_double(self);
+	parameter.min = get_double(self);
+	parameter.max = get_double(self);
+	parameter.fit = get_uint(self);
+
+	return parameter;
+}
+
+static int hkl_context_format_error(GError **error, const char *what)
+{
+	g_set_error(error,
+		    HKL_CONTEXT_ERROR,
+		    HKL_CONTEXT_ERROR_FORMAT,
+		    "cannot read the context, %s\n", what);
+
+	return FALSE;
+}
+
+static int hkl_context_parameter_apply(HklParameter *self,
+				       const struct HklContextParameter *parameter,
+				       GError **error)
+{
+	if(!hkl_parameter_min_max_set(self, parameter->min, parameter->max,
+				      HKL_UNIT_DEFAULT, error)
+	   || !hkl_parameter_value_set(self, parameter->value,
+				       HKL_UNIT_DEFAULT, error))
+		return FALSE;
+	hkl_parameter_fit_set(self, parameter->fit);
+
+	return TRUE;
+}
+
+static int hkl_context_geometry_read(struct HklContextReader *reader,
+				     HklGeometry *geometry,
+				     GError **error)
+{
+	size_t i, n;
+	double wavelength = get_double(reader);
+
+	n = get_count(reader, 2 * sizeof(guint32) + 3 * sizeof(double));
+	if(n != darray_size(geometry->axes))
+		return hkl_context_format_error(error, "wrong number of axes");
+
+	for(i=0; i<n; ++i){
+		HklParameter *axis = darray_item(geometry->axes, i);
+		char *name = get_string(reader);
+		struct HklContextParameter parameter = get_parameter(reader);
+		int same = reader->ok && !strcmp(name, axis->name);
+
+		g_free(name);
+		if(!same)
+			return hkl_context_format_error(error, "wrong axis");
+		if(!hkl_context_parameter_apply(axis, &parameter, error))
+			return FALSE;
+	}
+	hkl_geometry_update(geometry);
+
+	return hkl_geometry_wavelength_set(geometry, wavelength, HKL_UNIT_DEFAULT, error);
+}
+
+static HklSample *hkl_context_sample_read(struct HklContextReader *reader,
+					  GError **error)
+{
+	static int (* const u_set[])(HklSample *, const HklParameter *, GError **) = {
+		hkl_sample_ux_set, hkl_sample_uy_set, hkl_sample_uz_set,
+	};
+	char *name = get_string(reader);
+	HklSample *sample = hkl_sample_new(name);
+	HklLattice *lattice = hkl_lattice_new_copy(hkl_sample_lattice_get(sample));
+	HklParameter *lattice_parameters[] = {
+		lattice->a, lattice->b, lattice->c,
+		lattice->alpha, lattice->beta, lattice->gamma,
+	};
+	const HklParameter *u[] = {sample->ux, sample->uy, sample->uz};
+	struct HklContextParameter parameters[ARRAY_SIZE(lattice_parameters) + ARRAY_SIZE(u)];
+	size_t i;
+	int res;
+
+	g_free(name);
+
+	for(i=0; i<ARRAY_SIZE(parameters); ++i)
+		parameters[i] = get_parameter(reader);
+
+	res = reader->ok || hkl_context_format_error(error, "truncated sample");
+	res = res && hkl_lattice_set(lattice,
+				     parameters[0].value, parameters[1].value, parameters[2].value,
+				     parameters[3].value, parameters[4].value, parameters[5].value,
+				     HKL_UNIT_DEFAULT, error);
+	for(i=0; i<ARRAY_SIZE(lattice_parameters) && res; ++i)
+		res = hkl_context_parameter_apply(lattice_parameters[i], &parameters[i], error);
+	if(res)
+		hkl_sample_lattice_set(sample, lattice);
+
+	for(i=0; i<ARRAY_SIZE(u) && res; ++i){
+		HklParameter *parameter = hkl_parameter_new_copy(u[i]);
+
+		res = hkl_context_parameter_apply(parameter,
+						  &parameters[ARRAY_SIZE(lattice_parameters) + i],
+						  error)
+			&& u_set[i](sample, parameter, error);
+		hkl_parameter_free(parameter);
+	}
+
+	hkl_lattice_free(lattice);
+	if(!res){
+		hkl_sample_free(sample);
+		sample = NULL;
+	}
+
+	return sample;
+}
+
+static HklMode *hkl_context_mode_get(const HklEngine *engine, const char *name)
+{
+	HklMode **mode;
+
+	darray_foreach(mode, engine->modes){
+		if(!strcmp((*mode)->info->name, name))
+			return *mode;
+	}
+
+	return NULL;
+}
+
+/* the initializable modes are initialized again from the restored
+ * geometry, their internal state is not stored */
+static int hkl_context_engine_read(struct HklContextReader *reader,
+				   HklEngine *engine,
+				   GError **error)
+{
+	char *current = get_string(reader);
+	unsigned int multistart, multistart_n, multistart_seed;
+	size_t range_n_max;
+	double range_max_distance, branch_max_jump;
+	size_t i, j, n;
+	int res = TRUE;
+
+	engine->continuation_order = get_uint(reader);
+	multistart = get_uint(reader);
+	multistart_n = get_uint(reader);
+	multistart_seed = get_uint(reader);
+	hkl_engine_multistart_set(engine, multistart, multistart_n, multistart_seed);
+	hkl_engine_solutions_set(engine, get_uint(reader));
+	range_n_max = get_uint(reader);
+	range_max_distance = get_double(reader);
+	hkl_engine_range_set(engine, range_n_max, range_max_distance);
+	branch_max_jump = get_double(reader);
+	hkl_engine_branch_tracking_set(engine, branch_max_jump, get_uint(reader));
+	hkl_engine_sort_set(engine, get_uint(reader));
+
+	n = get_count(reader, 3 * sizeof(guint32));
+	for(i=0; i<n && res; ++i){
+		char *name = get_string(reader);
+		int initialized = get_uint(reader);
+		size_t n_parameters = get_count(reader, sizeof(guint32) + 3 * sizeof(double));
+		HklMode *mode = hkl_context_mode_get(engine, name);
+
+		g_free(name);
+		if(!mode){
+			g_set_error(error,
+				    HKL_CONTEXT_ERROR,
+				    HKL_CONTEXT_ERROR_FACTORY,
+				    "cannot read the context, unknown mode of the \"%s\" engine\n",
+				    engine->info->name);
+			res = FALSE;
+			break;
+		}
+		if(!reader->ok || n_parameters != darray_size(mode->parameters)){
+			res = hkl_context_format_error(error, "wrong mode parameters");
+			break;
+		}
+
+		for(j=0; j<n_parameters && res; ++j){
+			struct HklContextParameter parameter = get_parameter(reader);
+
+			res = hkl_context_parameter_apply(darray_item(mode->parameters, j),
+							  &parameter, error);
+		}
+
+		if(res && initialized){
+			hkl_engine_mode_set(engine, mode);
+			IGNORE(hkl_engine_initialized_set(engine, TRUE, NULL));
+		}
+	}
+
+	res = res && (reader->ok || hkl_context_format_error(error, "truncated engine"));
+	res = res && hkl_engine_current_mode_set(engine, current, error);
+	g_free(current);
+
+	return res;
+}
+
+static HklEngineList *hkl_context_engine_list_read(struct HklContextReader *reader,
+						   const HklFactory *factory,
+						   HklGeometry *geometry,
+						   HklDetector *detector,
+						   HklSample *sample,
+						   GError **error)
+{
+	HklEngineList *engines;
+	char **names;
+	size_t i, n;
+	int res;
+
+	n = get_count(reader, sizeof(guint32));
+	names = g_new0(char *, n + 1);
+	for(i=0; i<n; ++i)
+		names[i] = get_string(reader);
+
+	engines = hkl_factory_create_new_engine_list_full(factory, (const char **)names, n);
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	/* the engines are stored in the order of the list */
+	res = darray_size(*engines) == n;
+	for(i=0; i<n && res; ++i)
+		res = !strcmp(names[i], darray_item(*engines, i)->info->name);
+	g_strfreev(names);
+	if(!res){
+		g_set_error(error,
+			    HKL_CONTEXT_ERROR,
+			    HKL_CONTEXT_ERROR_FACTORY,
+			    "cannot read the context, unknown engines for the \"%s\" diffractometer\n",
+			    factory->name);
+		goto error;
+	}
+
+	n = get_count(reader, sizeof(guint32) + 3 * sizeof(double));
+	if(!reader->ok || n != darray_size(engines->parameters)){
+		res = hkl_context_format_error(error, "wrong engine list parameters");
+		goto error;
+	}
+	for(i=0; i<n && res; ++i){
+		struct HklContextParameter parameter = get_parameter(reader);
+
+		res = hkl_context_parameter_apply(darray_item(engines->parameters, i),
+						  &parameter, error);
+	}
+
+	for(i=0; i<darray_size(*engines) && res; ++i)
+		res = hkl_context_engine_read(reader, darray_item(*engines, i), error);
+	if(!res)
+		goto error;
+
+	return engines;
+error:
+	hkl_engine_list_free(engines);
+	return NULL;
+}
+
+/**
+ * hkl_context_new_from_bytes:
+ * @data: (array length=len): the binary form of a context
+ * @len: the length of @data
+ * @error: return location for a GError, or NULL
+ *
+ * restore a snapshot saved with hkl_context_to_bytes.
+ *
+ * Returns: (transfer full): the snapshot, or NULL if @data is not a
+ *          valid context.
+ **/
+HklContext *hkl_context_new_from_bytes(const guint8 *data, size_t len,
+				       GError **error)
+{
+	struct HklContextReader reader = {data, len, 0, TRUE};
+	const guint8 *magic;
+	HklFactory *factory;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+	char *name;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	magic = get_bytes(&reader, strlen(HKL_CONTEXT_MAGIC));
+	if(!magic
+	   || memcmp(magic, HKL_CONTEXT_MAGIC, strlen(HKL_CONTEXT_MAGIC))
+	   || HKL_CONTEXT_VERSION != get_uint(&reader)){
+		hkl_context_format_error(error, "not an hkl context");
+		return NULL;
+	}
+
+	name = get_string(&reader);
+	factory = hkl_factory_get_by_name(name, NULL);
+	if(!factory){
+		g_set_error(error,
+			    HKL_CONTEXT_ERROR,
+			    HKL_CONTEXT_ERROR_FACTORY,
+			    "cannot read the context, unknown diffractometer \"%s\"\n",
+			    name);
+		g_free(name);
+		return NULL;
+	}
+	g_free(name);
+
+	geometry = hkl_factory_create_new_geometry(factory);
+	if(!hkl_context_geometry_read(&reader, geometry, error))
+		goto free_geometry;
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_context_sample_read(&reader, error);
+	if(!sample)
+		goto free_detector;
+
+	engines = hkl_context_engine_list_read(&reader, factory,
+					       geometry, detector, sample,
+					       error);
+	if(!engines)
+		goto free_sample;
+
+	return hkl_context_new_full(geometry, detector, sample, engines);
+
+free_sample:
+	hkl_sample_free(sample);
+free_detector:
+	hkl_detector_free(detector);
+free_geometry:
+	hkl_geometry_free(geometry);
+	return NULL;
+}
@@ -50,6 +50,7 @@ static int _bissector_func(const gsl_vector *x, void *params, gsl_vector *f)
 
 static const HklFunction bissector_func = {
 	.function = _bissector_func,
+	.solutions = _bissector_solutions,
 	.size = 4,
 };
 
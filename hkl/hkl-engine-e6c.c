@@ -73,6 +73,7 @@ static int _bissector_vertical_func(const gsl_vector *x, void *params, gsl_vecto
 
 static const HklFunction bissector_vertical_func = {
 	.function = _bissector_vertical_func,
+	.solutions = _bissector_solutions,
 	.size = 4,
 };
 
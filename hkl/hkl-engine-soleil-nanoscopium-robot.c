@@ -20,6 +20,7 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 #include <gsl/gsl_sys.h>                // for gsl_isnan
+#include "hkl-engine-template-private.h"  // for HKL_TEMPLATE_HOLDER, etc
 #include "hkl-factory-private.h"        // for autodata_factories_, etc
 #include "hkl-pseudoaxis-common-hkl-private.h"
 
@@ -30,6 +31,38 @@
 #define DELTA "delta"
 #define GAMMA "gamma"
 
+/**************/
+/* kinematics */
+/**************/
+
+/* the indexes of the axes in the geometry, see
+ * hkl_geometry_soleil_nanoscopium_robot_axes. The radius of the
+ * detector does not change kf. */
+enum {
+	soleil_nanoscopium_robot_rz,
+	soleil_nanoscopium_robot_rs,
+	soleil_nanoscopium_robot_rx,
+	soleil_nanoscopium_robot_r,
+	soleil_nanoscopium_robot_delta,
+	soleil_nanoscopium_robot_gamma,
+	soleil_nanoscopium_robot_N_AXES,
+};
+
+HKL_TEMPLATE_HOLDER(soleil_nanoscopium_robot, sample,
+		    ((rz, 0, 0, -1), (rs, 0, 1, 0), (rx, -1, 0, 0)))
+
+HKL_TEMPLATE_HOLDER(soleil_nanoscopium_robot, detector,
+		    ((delta, 0, -1, 0), (gamma, 0, 0, -1)))
+
+HKL_TEMPLATE_HKL_FUNCTION(soleil_nanoscopium_robot, lifting_detector_rz_func,
+			  rz, delta, gamma);
+
+HKL_TEMPLATE_HKL_FUNCTION(soleil_nanoscopium_robot, lifting_detector_rs_func,
+			  rs, delta, gamma);
+
+HKL_TEMPLATE_HKL_FUNCTION(soleil_nanoscopium_robot, lifting_detector_rx_func,
+			  rx, delta, gamma);
+
 /********/
 /* mode */
 /********/
@@ -38,7 +71,7 @@ static HklMode *lifting_detector_rz()
 {
 	static const char *axes_r[] = {RZ, RS, RX, R, DELTA, GAMMA};
 	static const char *axes_w[] = {RZ, DELTA, GAMMA};
-	static const HklFunction *functions[] = {&RUBh_minus_Q_func};
+	static const HklFunction *functions[] = {&lifting_detector_rz_func};
 	static const HklModeAutoInfo info = {
 		HKL_MODE_AUTO_INFO("lifting detector rz", axes_r, axes_w, functions),
 	};
@@ -52,7 +85,7 @@ static HklMode *lifting_detector_rs()
 {
 	static const char *axes_r[] = {RZ, RS, RX, R, DELTA, GAMMA};
 	static const char *axes_w[] = {RS, DELTA, GAMMA};
-	static const HklFunction *functions[] = {&RUBh_minus_Q_func};
+	static const HklFunction *functions[] = {&lifting_detector_rs_func};
 	static const HklModeAutoInfo info = {
 		HKL_MODE_AUTO_INFO("lifting detector rs", axes_r, axes_w, functions),
 	};
@@ -66,7 +99,7 @@ static HklMode *lifting_detector_rx()
 {
 	static const char *axes_r[] = {RZ, RS, RX, R, DELTA, GAMMA};
 	static const char *axes_w[] = {RX, DELTA, GAMMA};
-	static const HklFunction *functions[] = {&RUBh_minus_Q_func};
+	static const HklFunction *functions[] = {&lifting_detector_rx_func};
 	static const HklModeAutoInfo info = {
 		HKL_MODE_AUTO_INFO("lifting detector rx", axes_r, axes_w, functions),
 	};
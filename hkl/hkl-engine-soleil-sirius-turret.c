@@ -19,6 +19,7 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include "hkl-engine-template-private.h"  // for HKL_TEMPLATE_HOLDER, etc
 #include "hkl-factory-private.h"        // for autodata_factories_, etc
 #include "hkl-pseudoaxis-common-hkl-private.h"  // for hkl_engine_hkl_new, etc
 #include "hkl-pseudoaxis-common-q-private.h"  // for hkl_engine_q2_new, etc
@@ -32,6 +33,35 @@
 #define DELTA "delta"
 #define GAMMA "gamma"
 
+/**************/
+/* kinematics */
+/**************/
+
+/* the indexes of the axes in the geometry, see
+ * hkl_geometry_soleil_sirius_turret_axes. basepitch moves both
+ * holders. */
+enum {
+	soleil_sirius_turret_basepitch,
+	soleil_sirius_turret_thetah,
+	soleil_sirius_turret_alphay,
+	soleil_sirius_turret_alphax,
+	soleil_sirius_turret_delta,
+	soleil_sirius_turret_gamma,
+	soleil_sirius_turret_N_AXES,
+};
+
+HKL_TEMPLATE_HOLDER(soleil_sirius_turret, sample,
+		    ((basepitch, 0, 1, 0), (thetah, 0, 0, -1), (alphay, 0, 1, 0), (alphax, 1, 0, 0)))
+
+HKL_TEMPLATE_HOLDER(soleil_sirius_turret, detector,
+		    ((basepitch, 0, 1, 0), (delta, 0, 0, -1), (gamma, 0, -1, 0)))
+
+HKL_TEMPLATE_HKL_FUNCTION(soleil_sirius_turret, lifting_detector_thetah_func,
+			  thetah, delta, gamma);
+
+HKL_TEMPLATE_HKL_FUNCTION(soleil_sirius_turret, lifting_detector_basepitch_func,
+			  basepitch, delta, gamma);
+
 /************/
 /* mode hkl */
 /************/
@@ -40,7 +70,21 @@ static HklMode* lifting_detector_thetah()
 {
 	static const char *axes_r[] = {BASEPITCH, THETAH, ALPHAY, ALPHAX, DELTA, GAMMA};
 	static const char* axes_w[] = {THETAH, DELTA, GAMMA};
-	static const HklFunction *functions[] = {&RUBh_minus_Q_func};
+	static const HklFunction *functions[] = {&lifting_detector_thetah_func};
+	static const HklModeAutoInfo info = {
+		HKL_MODE_AUTO_INFO(__func__, axes_r, axes_w, functions),
+	};
+
+	return hkl_mode_auto_new(&info,
+				 &hkl_full_mode_operations,
+				 TRUE);
+}
+
+static HklMode* lifting_detector_basepitch()
+{
+	static const char *axes_r[] = {BASEPITCH, THETAH, ALPHAY, ALPHAX, DELTA, GAMMA};
+	static const char* axes_w[] = {BASEPITCH, DELTA, GAMMA};
+	static const HklFunction *functions[] = {&lifting_detector_basepitch_func};
 	static const HklModeAutoInfo info = {
 		HKL_MODE_AUTO_INFO(__func__, axes_r, axes_w, functions),
 	};
@@ -61,6 +105,8 @@ static HklEngine *hkl_engine_soleil_sirius_turret_hkl_new(HklEngineList *engines
 	hkl_engine_add_mode(self, default_mode);
 	hkl_engine_mode_set(self, default_mode);
 
+	hkl_engine_add_mode(self, lifting_detector_basepitch());
+
 	return self;
 }
 
@@ -304,7 +304,7 @@ static void hkl_geometry_list_multiply_soleil_sixs_med_2_3(HklGeometryList *self
 
 	/* For each solution already found we will generate another one */
 	/* we will set the right slit orientation for a given detector arm position */
-	geometry = item->geometry;
+	geometry = hkl_geometry_list_item_geometry_unshare(item);
 	sample_holder = darray_item(geometry->holders, 0);
 	detector_holder = darray_item(geometry->holders, 1);
 
@@ -666,16 +666,14 @@ static inline int hkl_engine_list_post_engine_set_med_2_3_v2_real(HklEngineList
 	if(eta_a_rotation == 1){
 		uint i = 0;
 		uint len = self->geometries->n_items;
-		HklGeometryListItem *item;
 
 		/*
 		 * warning this method change the self->len so we need to save it
 		 * before using the recursive perm_r calls
 		 */
-		for(i=0, item=list_top(&self->geometries->items, HklGeometryListItem, list);
-		    i<len && NULL != item;
-		    ++i, item=list_next(&self->geometries->items, item, list))
-			hkl_geometry_list_multiply_soleil_sixs_med_2_3(self->geometries, item);
+		for(i=0; i<len; ++i)
+			hkl_geometry_list_multiply_soleil_sixs_med_2_3(self->geometries,
+								       darray_item(self->geometries->items, i));
 	}
 out:
 	return res;
@@ -694,6 +692,7 @@ static HklEngineList *hkl_engine_list_new_soleil_sixs_med_2_3_v2(const HklFactor
 	static const HklEngineListOperations ops = {
 		HKL_ENGINE_LIST_OPERATIONS_DEFAULTS,
 		.post_engine_set=hkl_engine_list_post_engine_set_med_2_3_v2_real,
+		.post_engine_set_multiply=TRUE,
 	};
 	HklEngineList *self = hkl_engine_list_new_with_info(&info, &ops);
 
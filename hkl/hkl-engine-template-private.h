@@ -0,0 +1,460 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2023 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#ifndef __HKL_ENGINE_TEMPLATE_PRIVATE_H__
+#define __HKL_ENGINE_TEMPLATE_PRIVATE_H__
+
+#include <math.h>                       // for cos, sin, sqrt
+#include <gsl/gsl_matrix_double.h>      // for gsl_matrix
+#include "metalang99.h"
+#include "hkl-factory-private.h"        // for HklFactory
+#include "hkl-geometry-private.h"       // for HklGeometry, HklHolder
+#include "hkl-pseudoaxis-common-hkl-private.h"  // for HklEngineHkl, etc
+#include "hkl-sample-private.h"         // for HklSample
+
+/*
+ * Declarative geometries.
+ *
+ * A geometry with only rotation axes and the default geometry
+ * operations is described by the axes of its sample and detector
+ * holders, each axis being a tuple (name, x, y, z) with an unique
+ * lower case name:
+ *
+ *   HKL_TEMPLATE_GEOMETRY(eulerian6C,
+ *			   ((mu, 0, 0, 1), (omega, 0, -1, 0)),
+ *			   ((gamma, 0, 0, 1), (delta, 0, -1, 0)));
+ *
+ * it generates
+ *
+ * - the eulerian6C_mu, ..., eulerian6C_N_AXES indexes of the axes in
+ *   the geometry,
+ * - the hkl_geometry_eulerian6C_axes names and the
+ *   hkl_geometry_new_eulerian6C constructor expected by
+ *   REGISTER_DIFFRACTOMETER,
+ * - eulerian6C_sample_q and eulerian6C_detector_q, the holders
+ *   rotations computed from the values of all the axes with the
+ *   products of the rotations unrolled and the axes directions known
+ *   at compile time.
+ *
+ * Then the hkl modes of this geometry are described by the axes they
+ * write, see HKL_TEMPLATE_HKL_MODE.
+ */
+
+/* q = q * the rotation of angle around (x, y, z). With constant
+ * directions the null components vanish once inlined. */
+static inline void hkl_template_quaternion_rotate(HklQuaternion *q, double angle,
+						  const double x, const double y, const double z)
+{
+	const double c = cos(angle / 2.);
+	const double s = sin(angle / 2.) / sqrt(x * x + y * y + z * z);
+	const double a = q->data[0];
+	const double b = q->data[1];
+	const double d = q->data[2];
+	const double e = q->data[3];
+
+	q->data[0] = a * c;
+	q->data[1] = b * c;
+	q->data[2] = d * c;
+	q->data[3] = e * c;
+	if(x != 0){
+		q->data[0] -= b * s * x;
+		q->data[1] += a * s * x;
+		q->data[2] += e * s * x;
+		q->data[3] -= d * s * x;
+	}
+	if(y != 0){
+		q->data[0] -= d * s * y;
+		q->data[1] -= e * s * y;
+		q->data[2] += a * s * y;
+		q->data[3] += b * s * y;
+	}
+	if(z != 0){
+		q->data[0] -= e * s * z;
+		q->data[1] += d * s * z;
+		q->data[2] -= b * s * z;
+		q->data[3] += a * s * z;
+	}
+}
+
+/* the inlined hkl_vector_rotated_quaternion */
+static inline void hkl_template_vector_rotate(HklVector *v, const HklQuaternion *q)
+{
+	const double v1 = v->data[0];
+	const double v2 = v->data[1];
+	const double v3 = v->data[2];
+	const double a = q->data[0];
+	const double b = q->data[1];
+	const double c = q->data[2];
+	const double d = q->data[3];
+
+	v->data[0] = 2 * ((-c*c - d*d) * v1 + (b*c - a*d) * v2 + (a*c + b*d) * v3) + v1;
+	v->data[1] = 2 * ((a*d + b*c) * v1 + (-b*b - d*d) * v2 + (c*d - a*b) * v3) + v2;
+	v->data[2] = 2 * ((b*d - a*c) * v1 + (a*b + c*d) * v2 + (-b*b - c*c) * v3) + v3;
+}
+
+/* kf = qd (k, 0, 0) and hkl = qs UB hkl of the hkl engine, qs and qd
+ * being the sample and the detector holders rotations */
+static inline void hkl_template_hkl(const HklEngine *engine,
+				    const HklQuaternion *qs,
+				    const HklQuaternion *qd,
+				    HklVector *kf, HklVector *hkl)
+{
+	const HklEngineHkl *engine_hkl = container_of(engine, HklEngineHkl, engine);
+	const HklMatrix *UB = &engine->sample->UB;
+	const double k = HKL_TAU / engine->geometry->source.wave_length;
+	const double h = engine_hkl->h->_value;
+	const double kk = engine_hkl->k->_value;
+	const double l = engine_hkl->l->_value;
+	const double a = qd->data[0];
+	const double b = qd->data[1];
+	const double c = qd->data[2];
+	const double d = qd->data[3];
+
+	kf->data[0] = k * (a*a + b*b - c*c - d*d);
+	kf->data[1] = k * 2 * (b*c + a*d);
+	kf->data[2] = k * 2 * (b*d - a*c);
+
+	hkl->data[0] = UB->data[0][0] * h + UB->data[0][1] * kk + UB->data[0][2] * l;
+	hkl->data[1] = UB->data[1][0] * h + UB->data[1][1] * kk + UB->data[1][2] * l;
+	hkl->data[2] = UB->data[2][0] * h + UB->data[2][1] * kk + UB->data[2][2] * l;
+	hkl_template_vector_rotate(hkl, qs);
+}
+
+/* f = kf - ki - hkl, see RUBh_minus_Q */
+static inline void hkl_template_RUBh_minus_Q(const HklEngine *engine,
+					     const HklVector *kf,
+					     const HklVector *hkl,
+					     double f[])
+{
+	const HklSource *source = &engine->geometry->source;
+	const double k = HKL_TAU / source->wave_length;
+
+	f[0] = kf->data[0] - k * source->direction.data[0] - hkl->data[0];
+	f[1] = kf->data[1] - k * source->direction.data[1] - hkl->data[1];
+	f[2] = kf->data[2] - k * source->direction.data[2] - hkl->data[2];
+}
+
+/* add sign * (a x v) to the column j of J, a being the (x, y, z)
+ * direction of a rotation axis rotated by q, the product of the
+ * rotations before it in its holder. See _RUBh_minus_Q_jacobian. */
+static inline void hkl_template_jacobian_add(gsl_matrix *J, size_t j,
+					     const HklQuaternion *q,
+					     const double x, const double y, const double z,
+					     const HklVector *v, double sign)
+{
+	const double n = sqrt(x * x + y * y + z * z);
+	HklVector a = {{x / n, y / n, z / n}};
+
+	hkl_template_vector_rotate(&a, q);
+	J->data[j] += sign * (a.data[1] * v->data[2] - a.data[2] * v->data[1]);
+	J->data[J->tda + j] += sign * (a.data[2] * v->data[0] - a.data[0] * v->data[2]);
+	J->data[2 * J->tda + j] += sign * (a.data[0] * v->data[1] - a.data[1] * v->data[0]);
+}
+
+#define HKL_TEMPLATE_CALL(_macro, ...) _macro(__VA_ARGS__)
+
+#define HKL_TEMPLATE_AXIS_IDX(_geometry, _name) _geometry ## _ ## _name
+
+/* the metalang99 metafunctions applied to each (name, x, y, z) axis */
+
+#define HKL_TEMPLATE_AXIS_ENUM_(_geometry, _name, _x, _y, _z)	\
+	HKL_TEMPLATE_AXIS_IDX(_geometry, _name),
+#define HKL_TEMPLATE_AXIS_ENUM_IMPL(_geometry, _axis)			\
+	v(HKL_TEMPLATE_CALL(HKL_TEMPLATE_AXIS_ENUM_, _geometry, ML99_UNTUPLE(_axis)))
+#define HKL_TEMPLATE_AXIS_ENUM_ARITY 2
+
+#define HKL_TEMPLATE_AXIS_NAME_(_name, _x, _y, _z) #_name,
+#define HKL_TEMPLATE_AXIS_NAME_IMPL(_axis)				\
+	v(HKL_TEMPLATE_CALL(HKL_TEMPLATE_AXIS_NAME_, ML99_UNTUPLE(_axis)))
+#define HKL_TEMPLATE_AXIS_NAME_ARITY 1
+
+#define HKL_TEMPLATE_AXIS_ADD_(_name, _x, _y, _z)			\
+	hkl_holder_add_rotation(h, #_name, _x, _y, _z, &hkl_unit_angle_deg);
+#define HKL_TEMPLATE_AXIS_ADD_IMPL(_axis)				\
+	v(HKL_TEMPLATE_CALL(HKL_TEMPLATE_AXIS_ADD_, ML99_UNTUPLE(_axis)))
+#define HKL_TEMPLATE_AXIS_ADD_ARITY 1
+
+#define HKL_TEMPLATE_AXIS_ROTATE_(_geometry, _name, _x, _y, _z)		\
+	hkl_template_quaternion_rotate(&q, values[HKL_TEMPLATE_AXIS_IDX(_geometry, _name)], \
+				       _x, _y, _z);
+#define HKL_TEMPLATE_AXIS_ROTATE_IMPL(_geometry, _axis)			\
+	v(HKL_TEMPLATE_CALL(HKL_TEMPLATE_AXIS_ROTATE_, _geometry, ML99_UNTUPLE(_axis)))
+#define HKL_TEMPLATE_AXIS_ROTATE_ARITY 2
+
+#define HKL_TEMPLATE_AXIS_JACOBIAN_(_geometry, _name, _x, _y, _z)	\
+	if(columns[HKL_TEMPLATE_AXIS_IDX(_geometry, _name)])		\
+		hkl_template_jacobian_add(J, columns[HKL_TEMPLATE_AXIS_IDX(_geometry, _name)] - 1, \
+					  &q, _x, _y, _z, v, sign);	\
+	HKL_TEMPLATE_AXIS_ROTATE_(_geometry, _name, _x, _y, _z)
+#define HKL_TEMPLATE_AXIS_JACOBIAN_IMPL(_geometry, _axis)		\
+	v(HKL_TEMPLATE_CALL(HKL_TEMPLATE_AXIS_JACOBIAN_, _geometry, ML99_UNTUPLE(_axis)))
+#define HKL_TEMPLATE_AXIS_JACOBIAN_ARITY 2
+
+#define HKL_TEMPLATE_FOREACH(_f, _axes)					\
+	ML99_EVAL(ML99_variadicsForEach(v(_f), v(ML99_UNTUPLE(_axes))))
+
+#define HKL_TEMPLATE_FOREACH_GEOMETRY(_f, _geometry, _axes)		\
+	ML99_EVAL(ML99_variadicsForEach(ML99_appl(v(_f), v(_geometry)), \
+					v(ML99_UNTUPLE(_axes))))
+
+/* the rotation of the _holder of the _geometry,
+ * _geometry_holder_q(values), and the columns of its part of the
+ * jacobian, _geometry_holder_jacobian(values, columns, v, sign,
+ * J). columns[idx] is the column + 1 of the axis idx or 0 if the
+ * axis is not written. The rotation axes of the holder are
+ * ((name, x, y, z), ...), their values[] being indexed by the
+ * _geometry_name constants. */
+#define HKL_TEMPLATE_HOLDER(_geometry, _holder, _axes)			\
+	static inline HklQuaternion _geometry ## _ ## _holder ## _q(const double values[]) \
+	{								\
+		HklQuaternion q = {{1, 0, 0, 0}};			\
+		HKL_TEMPLATE_FOREACH_GEOMETRY(HKL_TEMPLATE_AXIS_ROTATE, _geometry, _axes) \
+		return q;						\
+	}								\
+									\
+	static inline void _geometry ## _ ## _holder ## _jacobian(const double values[], \
+								  const size_t columns[], \
+								  const HklVector *v, \
+								  double sign, gsl_matrix *J) \
+	{								\
+		HklQuaternion q = {{1, 0, 0, 0}};			\
+		HKL_TEMPLATE_FOREACH_GEOMETRY(HKL_TEMPLATE_AXIS_JACOBIAN, _geometry, _axes) \
+	}
+
+#define HKL_TEMPLATE_GEOMETRY(_geometry, _sample, _detector)		\
+	enum {								\
+		HKL_TEMPLATE_FOREACH_GEOMETRY(HKL_TEMPLATE_AXIS_ENUM, _geometry, _sample) \
+		HKL_TEMPLATE_FOREACH_GEOMETRY(HKL_TEMPLATE_AXIS_ENUM, _geometry, _detector) \
+		_geometry ## _N_AXES,					\
+	};								\
+									\
+	static const char* hkl_geometry_ ## _geometry ## _axes[] = {	\
+		HKL_TEMPLATE_FOREACH(HKL_TEMPLATE_AXIS_NAME, _sample)	\
+		HKL_TEMPLATE_FOREACH(HKL_TEMPLATE_AXIS_NAME, _detector) \
+	};								\
+									\
+	static HklGeometry *hkl_geometry_new_ ## _geometry(const HklFactory *factory) \
+	{								\
+		HklGeometry *self = hkl_geometry_new(factory, &hkl_geometry_operations_defaults); \
+		HklHolder *h;						\
+									\
+		h = hkl_geometry_add_holder(self);			\
+		HKL_TEMPLATE_FOREACH(HKL_TEMPLATE_AXIS_ADD, _sample)	\
+		h = hkl_geometry_add_holder(self);			\
+		HKL_TEMPLATE_FOREACH(HKL_TEMPLATE_AXIS_ADD, _detector)	\
+									\
+		return self;						\
+	}								\
+									\
+	HKL_TEMPLATE_HOLDER(_geometry, sample, _sample)			\
+	HKL_TEMPLATE_HOLDER(_geometry, detector, _detector)		\
+									\
+	struct _hkl_template_ ## _geometry ## _semicolon
+
+/*
+ * Declarative hkl functions and modes.
+ *
+ *   HKL_TEMPLATE_HKL_FUNCTION(eulerian6C, constant_omega_vertical_func,
+ *			       chi, phi, delta);
+ *
+ * generates the constant_omega_vertical_func RUBh_minus_Q HklFunction
+ * of the three written axes. The function copies the values of the
+ * axes once, writes the x values at their compile time indexes and
+ * computes RUBh_minus_Q with the unrolled holders rotations, without
+ * touching the geometry. Its analytic jacobian is unrolled the same
+ * way, the closed form solutions are the generic ones. The batch
+ * evaluation of many candidates reads the axes only once.
+ *
+ *   HKL_TEMPLATE_HKL_FUNCTION_WITH_EQUATIONS(eulerian6C, bissector_vertical_func,
+ *					      bissector_vertical_equations,
+ *					      omega, chi, phi, delta);
+ *
+ * is the same for a function with more than three written axes, the
+ * static inline void bissector_vertical_equations(const double values[],
+ * double f[]) function computing the f[3], ... additional equations
+ * from the values of the axes indexed by eulerian6C_omega, etc. The
+ * jacobian is computed by finite differences.
+ *
+ * Besides the _geometry_xxx axes indexes, they only need the
+ * _geometry_sample_q, _geometry_detector_q and the jacobians of
+ * HKL_TEMPLATE_HOLDER, so they also work with geometries written by
+ * hand (with translations or axes shared by both holders) as long as
+ * only the rotations of the holders change kf and hkl.
+ *
+ * HKL_TEMPLATE_HKL_MODE and HKL_TEMPLATE_HKL_MODE_WITH_EQUATIONS
+ * generate the _name_func function and the _name() mode constructor,
+ * reading all the axes of the geometry.
+ */
+
+#define HKL_TEMPLATE_AXIS_W_SET_IMPL(_geometry, _name, _i)		\
+	v(values[HKL_TEMPLATE_AXIS_IDX(_geometry, _name)] = x->data[_i];)
+#define HKL_TEMPLATE_AXIS_W_SET_ARITY 3
+
+#define HKL_TEMPLATE_AXIS_W_BATCH_SET_IMPL(_geometry, _name, _i)	\
+	v(values[HKL_TEMPLATE_AXIS_IDX(_geometry, _name)] = x[_i * n + k];)
+#define HKL_TEMPLATE_AXIS_W_BATCH_SET_ARITY 3
+
+#define HKL_TEMPLATE_AXIS_W_COLUMN_IMPL(_geometry, _name, _i)		\
+	v([HKL_TEMPLATE_AXIS_IDX(_geometry, _name)] = _i + 1,)
+#define HKL_TEMPLATE_AXIS_W_COLUMN_ARITY 3
+
+#define HKL_TEMPLATE_AXIS_W_NAME_IMPL(_name) v(#_name,)
+#define HKL_TEMPLATE_AXIS_W_NAME_ARITY 1
+
+#define HKL_TEMPLATE_FOREACH_W(_f, _geometry, ...)			\
+	ML99_EVAL(ML99_variadicsForEachI(ML99_appl(v(_f), v(_geometry)), \
+					 v(__VA_ARGS__)))
+
+#define HKL_TEMPLATE_NO_EQUATIONS(_values, _f) do{}while(0)
+
+/* the values of all the axes of the geometry with x written */
+#define HKL_TEMPLATE_VALUES_GET(_geometry, ...)				\
+	do{								\
+		size_t i;						\
+									\
+		for(i=0; i<_geometry ## _N_AXES; ++i)			\
+			values[i] = darray_item(engine->geometry->axes, i)->_value; \
+		HKL_TEMPLATE_FOREACH_W(HKL_TEMPLATE_AXIS_W_SET, _geometry, __VA_ARGS__) \
+	}while(0)
+
+#define HKL_TEMPLATE_FUNCTION_(_geometry, _name, _equations, ...)	\
+	static int _ ## _name(const gsl_vector *x, void *params, gsl_vector *f) \
+	{								\
+		const HklEngine *engine = params;			\
+		double values[_geometry ## _N_AXES];			\
+		HklVector kf;						\
+		HklVector hkl;						\
+									\
+		CHECK_NAN(x->data, x->size);				\
+									\
+		HKL_TEMPLATE_VALUES_GET(_geometry, __VA_ARGS__);	\
+		const HklQuaternion qs = _geometry ## _sample_q(values); \
+		const HklQuaternion qd = _geometry ## _detector_q(values); \
+		hkl_template_hkl(engine, &qs, &qd, &kf, &hkl);		\
+		hkl_template_RUBh_minus_Q(engine, &kf, &hkl, f->data);	\
+		_equations(values, f->data);				\
+									\
+		return GSL_SUCCESS;					\
+	}								\
+									\
+	static int _ ## _name ## _batch(const double x[], size_t n, void *params, double f[]) \
+	{								\
+		const HklEngine *engine = params;			\
+		double values[_geometry ## _N_AXES];			\
+		size_t i, k;						\
+									\
+		for(i=0; i<_geometry ## _N_AXES; ++i)			\
+			values[i] = darray_item(engine->geometry->axes, i)->_value; \
+									\
+		/* the NAN values propagate to f */			\
+		for(k=0; k<n; ++k){					\
+			double fk[ML99_VARIADICS_COUNT(__VA_ARGS__)];	\
+			HklVector kf;					\
+			HklVector hkl;					\
+									\
+			HKL_TEMPLATE_FOREACH_W(HKL_TEMPLATE_AXIS_W_BATCH_SET, _geometry, __VA_ARGS__) \
+			const HklQuaternion qs = _geometry ## _sample_q(values); \
+			const HklQuaternion qd = _geometry ## _detector_q(values); \
+			hkl_template_hkl(engine, &qs, &qd, &kf, &hkl);	\
+			hkl_template_RUBh_minus_Q(engine, &kf, &hkl, fk); \
+			_equations(values, fk);				\
+			for(i=0; i<ML99_VARIADICS_COUNT(__VA_ARGS__); ++i) \
+				f[i * n + k] = fk[i];			\
+		}							\
+									\
+		return GSL_SUCCESS;					\
+	}
+
+#define HKL_TEMPLATE_HKL_FUNCTION(_geometry, _name, _a, _b, _c)	\
+	HKL_TEMPLATE_FUNCTION_(_geometry, _name, HKL_TEMPLATE_NO_EQUATIONS, \
+			       _a, _b, _c)				\
+									\
+	static int _ ## _name ## _jacobian(const gsl_vector *x, void *params, gsl_matrix *J) \
+	{								\
+		static const size_t columns[_geometry ## _N_AXES] = {	\
+			HKL_TEMPLATE_FOREACH_W(HKL_TEMPLATE_AXIS_W_COLUMN, _geometry, \
+					       _a, _b, _c)		\
+		};							\
+		const HklEngine *engine = params;			\
+		double values[_geometry ## _N_AXES];			\
+		HklVector kf;						\
+		HklVector hkl;						\
+									\
+		CHECK_NAN(x->data, x->size);				\
+									\
+		HKL_TEMPLATE_VALUES_GET(_geometry, _a, _b, _c);		\
+		const HklQuaternion qs = _geometry ## _sample_q(values); \
+		const HklQuaternion qd = _geometry ## _detector_q(values); \
+		hkl_template_hkl(engine, &qs, &qd, &kf, &hkl);		\
+									\
+		/* dQ = kf - ki - R UB hkl, ki does not move */		\
+		gsl_matrix_set_zero(J);					\
+		_geometry ## _detector_jacobian(values, columns, &kf, 1, J); \
+		_geometry ## _sample_jacobian(values, columns, &hkl, -1, J); \
+									\
+		return GSL_SUCCESS;					\
+	}								\
+									\
+	static const HklFunction _name = {				\
+		.function = _ ## _name,					\
+		.jacobian = _ ## _name ## _jacobian,			\
+		.solutions = _RUBh_minus_Q_solutions,			\
+		.batch = _ ## _name ## _batch,				\
+		.size = 3,						\
+	}
+
+#define HKL_TEMPLATE_HKL_FUNCTION_WITH_EQUATIONS(_geometry, _name, _equations, ...) \
+	HKL_TEMPLATE_FUNCTION_(_geometry, _name, _equations, __VA_ARGS__) \
+									\
+	static const HklFunction _name = {				\
+		.function = _ ## _name,					\
+		.batch = _ ## _name ## _batch,				\
+		.size = ML99_VARIADICS_COUNT(__VA_ARGS__),		\
+	}
+
+#define HKL_TEMPLATE_MODE_(_geometry, _name, ...)			\
+	static HklMode *_name(void)					\
+	{								\
+		static const char *axes_w[] = {				\
+			ML99_EVAL(ML99_variadicsForEach(v(HKL_TEMPLATE_AXIS_W_NAME), \
+							v(__VA_ARGS__))) \
+		};							\
+		static const HklFunction *functions[] = {&_name ## _func}; \
+		static const HklModeAutoInfo info = {			\
+			HKL_MODE_AUTO_INFO(__func__, hkl_geometry_ ## _geometry ## _axes, \
+					   axes_w, functions),		\
+		};							\
+									\
+		return hkl_mode_auto_new(&info, &hkl_mode_operations, TRUE); \
+	}								\
+									\
+	struct _hkl_template_ ## _name ## _semicolon
+
+#define HKL_TEMPLATE_HKL_MODE(_geometry, _name, _a, _b, _c)		\
+	HKL_TEMPLATE_HKL_FUNCTION(_geometry, _name ## _func, _a, _b, _c); \
+	HKL_TEMPLATE_MODE_(_geometry, _name, _a, _b, _c)
+
+#define HKL_TEMPLATE_HKL_MODE_WITH_EQUATIONS(_geometry, _name, _equations, ...) \
+	HKL_TEMPLATE_HKL_FUNCTION_WITH_EQUATIONS(_geometry, _name ## _func, \
+						 _equations, __VA_ARGS__); \
+	HKL_TEMPLATE_MODE_(_geometry, _name, __VA_ARGS__)
+
+#endif
@@ -23,6 +23,7 @@
  *          XXXX <xxx@xxx>
  */
 #include <gsl/gsl_sys.h>                // for gsl_isnan
+#include "hkl-engine-template-private.h"  // for HKL_TEMPLATE_GEOMETRY, etc
 #include "hkl-factory-private.h"        // for autodata_factories_, etc
 #include "hkl-pseudoaxis-common-hkl-private.h"  // for hkl_mode_operations, etc
 #include "hkl-pseudoaxis-common-psi-private.h"  // for hkl_engine_psi_new, etc
@@ -59,33 +60,49 @@
 	"  + **" GAMMA "** : rotation around the :math:`\\vec{z}` direction (0, 0, 1)\n" \
 	"  + **" DELTA "** : rotation around the :math:`-\\vec{y}` direction (0, -1, 0)\n"
 
-static const char* hkl_geometry_eulerian6C_axes[] = {MU, OMEGA, CHI, PHI, GAMMA, DELTA};
-
-static HklGeometry *hkl_geometry_new_eulerian6C(const HklFactory *factory)
-{
-	HklGeometry *self = hkl_geometry_new(factory, &hkl_geometry_operations_defaults);
-	HklHolder *h;
-
-	h = hkl_geometry_add_holder(self);
-	hkl_holder_add_rotation(h, MU, 0, 0, 1, &hkl_unit_angle_deg);
-	hkl_holder_add_rotation(h, OMEGA, 0, -1, 0, &hkl_unit_angle_deg);
-	hkl_holder_add_rotation(h, CHI, 1, 0, 0, &hkl_unit_angle_deg);
-	hkl_holder_add_rotation(h, PHI, 0, -1, 0, &hkl_unit_angle_deg);
-
-	h = hkl_geometry_add_holder(self);
-	hkl_holder_add_rotation(h, GAMMA, 0, 0, 1, &hkl_unit_angle_deg);
-	hkl_holder_add_rotation(h, DELTA, 0, -1, 0, &hkl_unit_angle_deg);
-
-	return self;
-}
+/* the geometry is described declaratively: the axes of the
+ * sample holder then the axes of the detector holder, each one being
+ * (name, x, y, z) with x, y, z the direction of the rotation. This
+ * generates hkl_geometry_eulerian6C_axes, hkl_geometry_new_eulerian6C
+ * and the eulerian6C_mu, ... indexes of the axes, see
+ * hkl-engine-template-private.h */
+HKL_TEMPLATE_GEOMETRY(eulerian6C,
+		      ((mu, 0, 0, 1), (omega, 0, -1, 0), (chi, 1, 0, 0), (phi, 0, -1, 0)),
+		      ((gamma, 0, 0, 1), (delta, 0, -1, 0)));
 
 /*********/
 /* Modes */
 /*********/
 
-/* exemple of a lowlevel gsl function use to compute an hkl bissector
- * vertical mode for an E6C diffractometer */
-static int _bissector_vertical_func(const gsl_vector *x, void *params, gsl_vector *f)
+/* exemple of an hkl bissector vertical mode for an E6C
+ * diffractometer described declaratively. The hkl computation fills
+ * the f[0..2] values and a mode specific equation is requiered due to
+ * the number of axes to fit (4 in this case). It uses the values of
+ * the axes indexed with the generated eulerian6C_xxx indexes. */
+static inline void bissector_vertical_equations(const double values[], double f[])
+{
+	f[3] = values[eulerian6C_delta] - 2 * fmod(values[eulerian6C_omega], M_PI);
+}
+
+/* this generates the bissector_vertical_func HklFunction and the
+ * bissector_vertical() mode which reads all the geometry axes and
+ * writes omega, chi, phi and delta. The function is specialised for
+ * this geometry at compile time, the rotations of the holders are
+ * unrolled, so it is as fast as an hand written one. */
+HKL_TEMPLATE_HKL_MODE_WITH_EQUATIONS(eulerian6C, bissector_vertical,
+				     bissector_vertical_equations,
+				     omega, chi, phi, delta);
+
+/* here an exemple of a three axes hkl mode, the RUBh_minus_Q
+ * computation is enough, its analytic jacobian is also generated and
+ * the closed form solutions of the generic RUBh_minus_Q_func are
+ * used. So writing a generic hkl mode with only three axes is really
+ * simple */
+HKL_TEMPLATE_HKL_MODE(eulerian6C, constant_omega_vertical, chi, phi, delta);
+
+/* the same modes can be written by hand, exemple of a lowlevel gsl
+ * function use to compute an hkl bissector vertical mode */
+static int _bissector_vertical_generic_func(const gsl_vector *x, void *params, gsl_vector *f)
 {
 	const double omega = x->data[0];
 	const double tth = x->data[3];
@@ -109,14 +126,14 @@ static int _bissector_vertical_func(const gsl_vector *x, void *params, gsl_vecto
  * function. So during the HklMode configuration there is a runtime
  * check which ensure that the right number of axes are given to the
  * HklMode. */
-static const HklFunction bissector_vertical_func = {
-	.function = _bissector_vertical_func,
+static const HklFunction bissector_vertical_generic_func = {
+	.function = _bissector_vertical_generic_func,
 	.size = 4,
 };
 
 /* exemple of a mode with 4 axes. In that case you need the previously
  * defined function */
-static HklMode *bissector_vertical(void)
+static HklMode *bissector_vertical_generic(void)
 {
 	/* axes_r is the axes list requiered to compute the pseudo axes values */
 	static const char* axes_r[] = {MU, OMEGA, CHI, PHI, GAMMA, DELTA};
@@ -127,7 +144,7 @@ static HklMode *bissector_vertical(void)
 	static const char* axes_w[] = {OMEGA, CHI, PHI, DELTA};
 
 	/* here a list of functions use to solve the mode */
-	static const HklFunction *functions[] = {&bissector_vertical_func};
+	static const HklFunction *functions[] = {&bissector_vertical_generic_func};
 
 	/* here just the description of the mode: name, axes_r, axes_w, functions */
 	static const HklModeAutoInfo info = {
@@ -140,24 +157,6 @@ static HklMode *bissector_vertical(void)
 				 TRUE);
 }
 
-/* here an exemple of a three axes hkl mode, a convenience function is
- * provided to do the computation (RUBh_minus_Q_func). This funtion
- * takes only three axes. So writing a generic hkl mode with only
- * three axes is really simple */
-static HklMode *constant_omega_vertical(void)
-{
-	static const char* axes_r[] = {MU, OMEGA, CHI, PHI, GAMMA, DELTA};
-	static const char* axes_w[] = {CHI, PHI, DELTA};
-	static const HklFunction *functions[] = {&RUBh_minus_Q_func};
-	static const HklModeAutoInfo info = {
-		HKL_MODE_AUTO_INFO(__func__, axes_r, axes_w, functions),
-	};
-
-	return hkl_mode_auto_new(&info,
-				 &hkl_mode_operations,
-				 TRUE);
-}
-
 static HklMode* psi_vertical()
 {
 	static const char *axes_r[] = {MU, OMEGA, CHI, PHI, GAMMA, DELTA};
@@ -199,6 +198,7 @@ static HklEngine *hkl_engine_e6c_hkl_new(HklEngineList *engines)
 	hkl_engine_mode_set(self, default_mode);
 
 	hkl_engine_add_mode(self, constant_omega_vertical());
+	hkl_engine_add_mode(self, bissector_vertical_generic());
 
 	return self;
 }
@@ -37,15 +37,18 @@ struct _HklFactory
 	const darray_string axes;
 	HklFactoryGeometryFunction create_new_geometry;
 	HklFactoryEngineListFunction create_new_engine_list;
+	HklGeometry **geometry; /* the shared geometry copied by hkl_factory_create_new_geometry, can be NULL */
 };
 
 #define REGISTER_DIFFRACTOMETER(name_, real_name_, description_)	\
+	static HklGeometry *name_ ## _geometry;				\
 	static HklFactory name_ = {					\
 		.name = real_name_,					\
 		.description = description_,				\
 		.axes = DARRAY(hkl_geometry_ ## name_ ## _axes),	\
 		.create_new_geometry = &hkl_geometry_new_ ## name_,	\
-		.create_new_engine_list = &hkl_engine_list_new_ ## name_ \
+		.create_new_engine_list = &hkl_engine_list_new_ ## name_, \
+		.geometry = &name_ ## _geometry				\
 	};								\
 	AUTODATA(factories, &name_)
 
@@ -20,6 +20,7 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 #include "hkl-factory-private.h"        // for autodata_factories_, etc
+#include "hkl-pseudoaxis-private.h"     // for _HklEngineList
 
 HklFactory **hkl_factory_get_all(size_t *n)
 {
@@ -44,12 +45,59 @@ const char *hkl_factory_name_get(const HklFactory *self)
 	return self->name;
 }
 
+/**
+ * hkl_factory_create_new_geometry:
+ * @self: the this ptr
+ *
+ * the geometry of the factory is built once, the new ones are copies
+ * sharing its holders configuration, with their axes in one block of
+ * memory.
+ *
+ * Returns: (transfer full): the new geometry
+ **/
 HklGeometry *hkl_factory_create_new_geometry(const HklFactory *self)
 {
-	return self->create_new_geometry(self);
+	if(NULL == self->geometry)
+		return self->create_new_geometry(self);
+
+	if(g_once_init_enter(self->geometry)){
+		HklGeometry *geometry = self->create_new_geometry(self);
+
+		g_once_init_leave(self->geometry, geometry);
+	}
+
+	return hkl_geometry_new_copy(*self->geometry);
 }
 
 HklEngineList *hkl_factory_create_new_engine_list(const HklFactory *self)
 {
-	return self->create_new_engine_list(self);
+	HklEngineList *engines = self->create_new_engine_list(self);
+
+	/* keep it to create copies of the engines */
+	engines->factory = self;
+
+	return engines;
+}
+
+/**
+ * hkl_factory_create_new_engine_list_full:
+ * @self: the this ptr
+ * @names: (array length=n_names): the names of the engines to create
+ * @n_names: the number of names
+ *
+ * like hkl_factory_create_new_engine_list but only keep the named
+ * engines, the others and their modes are not kept in memory and are
+ * not computed by hkl_engine_list_get.
+ *
+ * Returns: (transfer full): the engine list
+ **/
+HklEngineList *hkl_factory_create_new_engine_list_full(const HklFactory *self,
+						       const char *names[],
+						       size_t n_names)
+{
+	HklEngineList *engines = hkl_factory_create_new_engine_list(self);
+
+	hkl_engine_list_engines_keep(engines, names, n_names);
+
+	return engines;
 }
@@ -44,6 +44,10 @@ typedef void (* HklGeometryListMultiplyFunction) (HklGeometryList *self,
 
 typedef darray(HklHolder *) darray_holder;
 
+typedef darray(HklQuaternion) darray_quaternion;
+
+typedef darray(HklVector) darray_vector;
+
 struct HklHolderConfig {
 	int gc;
 	size_t *idx;
@@ -54,6 +58,10 @@ struct _HklHolder {
 	struct HklHolderConfig *config;
 	HklGeometry *geometry;
 	HklQuaternion q;
+	HklVector t; /* with q the transformation x -> q x + t of the holder */
+	darray_quaternion qs; /* qs[i] the product of the axes [0, i] */
+	darray_vector ts; /* ts[i] the translation of the axes [0, i] */
+	size_t n_qs; /* the number of qs and ts still valid */
 };
 
 typedef struct _HklGeometryOperations HklGeometryOperations;
@@ -76,6 +84,11 @@ struct _HklGeometry
 	darray_parameter axes;
 	darray_holder holders;
 	const HklGeometryOperations *ops;
+	char *arena; /* the axes [0, n_arena) stored contiguously */
+	size_t n_arena;
+	size_t arena_size;
+	int gc; /* the HklGeometryListItem sharing this geometry */
+	unsigned long stamp; /* incremented each time the axes or the source change */
 };
 
 static inline HklHolder *hkl_geometry_sample_holder_get_real(const HklGeometry *self,
@@ -130,16 +143,29 @@ typedef enum {
 	HKL_GEOMETRY_ERROR_AXIS_SET, /* can not set the axis */
 } HklGeometryError;
 
+/* an item of the HklGeometryList being sorted */
+struct HklGeometryListSortEntry
+{
+	HklGeometryListItem *item;
+	double distance;
+	size_t idx;
+};
+
+typedef darray(struct HklGeometryListSortEntry) darray_sort_entry;
+
+typedef darray(HklGeometryListItem *) darray_geometry_list_item;
+
 struct _HklGeometryList
 {
 	HklGeometryListMultiplyFunction multiply;
-	struct list_head items;
+	darray_geometry_list_item items; /* the n_items solutions then the released items reused by the next additions */
 	size_t n_items;
+	darray_sort_entry sorting; /* the scratch memory of the sort */
 };
 
 struct _HklGeometryListItem
 {
-	struct list_node list;
+	size_t idx; /* the place of the item in its list */
 	HklGeometry *geometry;
 };
 
@@ -170,6 +196,10 @@ extern HklParameter *hkl_holder_add_translation(HklHolder *self,
 extern HklVector hkl_holder_transformation_apply(const HklHolder *self,
 						 const HklVector *v) HKL_ARG_NONNULL(1, 2);
 
+extern void hkl_holder_transformation_apply_n(const HklHolder *self,
+					      const HklVector vs[], HklVector res[],
+					      size_t n) HKL_ARG_NONNULL(1, 2, 3);
+
 /***************/
 /* HklGeometry */
 /***************/
@@ -197,6 +227,15 @@ extern double hkl_geometry_distance(const HklGeometry *self,
 extern double hkl_geometry_distance_orthodromic(const HklGeometry *self,
 						const HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
 
+extern double hkl_geometry_jump(const HklGeometry *self,
+				const HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
+
+extern double hkl_geometry_motion_time(const HklGeometry *self,
+				       const HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
+
+/* the cost of a move between two geometries */
+typedef double (* HklGeometryCost)(const HklGeometry *self, const HklGeometry *ref);
+
 extern int hkl_geometry_closest_from_geometry_with_range(HklGeometry *self,
 							 const HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
 
@@ -204,6 +243,28 @@ extern int hkl_geometry_is_valid(const HklGeometry *self) HKL_ARG_NONNULL(1);
 
 extern int hkl_geometry_is_valid_range(const HklGeometry *self) HKL_ARG_NONNULL(1);
 
+/* the ranges of the axes of a geometry, precomputed to check the
+ * axes values of many solutions at once */
+typedef struct _HklGeometryRanges HklGeometryRanges;
+
+struct _HklGeometryRanges
+{
+	size_t n_axes;
+	double *min; /* range.min - HKL_EPSILON */
+	double *max; /* range.max + HKL_EPSILON */
+	double *origin; /* range.min, the first 2π shift of the permutable axes */
+	int *permutable;
+};
+
+extern void hkl_geometry_ranges_init(HklGeometryRanges *self,
+				     const HklGeometry *geometry) HKL_ARG_NONNULL(1, 2);
+
+extern void hkl_geometry_ranges_release(HklGeometryRanges *self) HKL_ARG_NONNULL(1);
+
+extern size_t hkl_geometry_ranges_check(const HklGeometryRanges *self,
+					const double values[], size_t n_solutions,
+					int shifts, int valid[]) HKL_ARG_NONNULL(1, 5);
+
 extern HklHolder *hkl_geometry_sample_holder_get(const HklGeometry *self, const HklSample *sample) HKL_ARG_NONNULL(1, 2);
 
 extern HklHolder *hkl_geometry_detector_holder_get(const HklGeometry *self, const HklDetector *detector) HKL_ARG_NONNULL(1, 2);
@@ -212,24 +273,47 @@ extern HklHolder *hkl_geometry_detector_holder_get(const HklGeometry *self, cons
 /* HklGeometryList */
 /*******************/
 
-extern HklGeometryList *hkl_geometry_list_new(void);
-
 extern HklGeometryList *hkl_geometry_list_new_copy(const HklGeometryList *self) HKL_ARG_NONNULL(1);
 
+extern void hkl_geometry_list_set(HklGeometryList *self, const HklGeometryList *src) HKL_ARG_NONNULL(1, 2);
+
 extern void hkl_geometry_list_add(HklGeometryList *self, const HklGeometry *geometry) HKL_ARG_NONNULL(1, 2);
 
 extern void hkl_geometry_list_reset(HklGeometryList *self) HKL_ARG_NONNULL(1);
 
 extern void hkl_geometry_list_sort(HklGeometryList *self, HklGeometry *ref) HKL_ARG_NONNULL(1, 2);
 
+extern void hkl_geometry_list_sort_closest(HklGeometryList *self, HklGeometry *ref, size_t n) HKL_ARG_NONNULL(1, 2);
+
+extern void hkl_geometry_list_sort_cost(HklGeometryList *self, HklGeometry *ref,
+					HklGeometryCost cost) HKL_ARG_NONNULL(1, 2, 3);
+
+extern void hkl_geometry_list_sort_closest_cost(HklGeometryList *self, HklGeometry *ref, size_t n,
+						HklGeometryCost cost) HKL_ARG_NONNULL(1, 2, 4);
+
 extern void hkl_geometry_list_fprintf(FILE *f, const HklGeometryList *self) HKL_ARG_NONNULL(1, 2);
 
 extern void hkl_geometry_list_multiply(HklGeometryList *self) HKL_ARG_NONNULL(1);
 
 extern void hkl_geometry_list_multiply_from_range(HklGeometryList *self) HKL_ARG_NONNULL(1);
 
+extern void hkl_geometry_list_multiply_from_range_closest(HklGeometryList *self,
+							   const HklGeometry *ref,
+							   size_t n_max, double max_distance) HKL_ARG_NONNULL(1, 2);
+
 extern void hkl_geometry_list_remove_invalid(HklGeometryList *self) HKL_ARG_NONNULL(1);
 
+extern size_t hkl_geometry_list_remove_unreachable(HklGeometryList *self) HKL_ARG_NONNULL(1);
+
+extern void hkl_geometry_list_remove_jumps(HklGeometryList *self,
+					   const HklGeometry *ref, double max_jump) HKL_ARG_NONNULL(1, 2);
+
+extern void hkl_geometry_list_truncate(HklGeometryList *self, size_t n) HKL_ARG_NONNULL(1);
+
+extern size_t hkl_geometry_list_remove_if(HklGeometryList *self,
+					  HklGeometryPredicate predicate,
+					  void *data) HKL_ARG_NONNULL(1, 2);
+
 /***********************/
 /* HklGeometryListItem */
 /***********************/
@@ -238,6 +322,8 @@ extern HklGeometryListItem *hkl_geometry_list_item_new(const HklGeometry *geomet
 
 extern HklGeometryListItem *hkl_geometry_list_item_new_copy(const HklGeometryListItem *self) HKL_ARG_NONNULL(1);
 
+extern HklGeometry *hkl_geometry_list_item_geometry_unshare(HklGeometryListItem *self) HKL_ARG_NONNULL(1);
+
 extern void hkl_geometry_list_item_free(HklGeometryListItem *self) HKL_ARG_NONNULL(1);
 
 G_END_DECLS
@@ -116,7 +116,7 @@ static struct HklHolderConfig *hkl_holder_config_ref(struct HklHolderConfig *sel
 	if(!self)
 		return NULL;
 
-	self->gc++;
+	g_atomic_int_inc(&self->gc);
 
 	return self;
 }
@@ -126,7 +126,7 @@ static void hkl_holder_config_unref(struct HklHolderConfig *self)
 	if(!self)
 		return;
 
-	if(--self->gc)
+	if(!g_atomic_int_dec_and_test(&self->gc))
 		return;
 
 	free(self->idx);
@@ -145,6 +145,10 @@ static HklHolder *hkl_holder_new(HklGeometry *geometry)
 	self->config = hkl_holder_config_new();
 	self->geometry = geometry;
 	self->q = q0;
+	self->t = (HklVector){{0, 0, 0}};
+	darray_init(self->qs);
+	darray_init(self->ts);
+	self->n_qs = 0;
 
 	return self;
 }
@@ -156,6 +160,12 @@ static HklHolder *hkl_holder_new_copy(HklHolder *src, HklGeometry *geometry)
 	self->config = hkl_holder_config_ref(src->config);
 	self->geometry = geometry;
 	self->q = src->q;
+	self->t = src->t;
+	darray_init(self->qs);
+	darray_append_items(self->qs, src->qs.item, darray_size(src->qs));
+	darray_init(self->ts);
+	darray_append_items(self->ts, src->ts.item, darray_size(src->ts));
+	self->n_qs = src->n_qs;
 
 	return self;
 }
@@ -163,40 +173,62 @@ static HklHolder *hkl_holder_new_copy(HklHolder *src, HklGeometry *geometry)
 static void hkl_holder_free(HklHolder *self)
 {
 	hkl_holder_config_unref(self->config);
+	darray_free(self->qs);
+	darray_free(self->ts);
 	free(self);
 }
 
 static void hkl_holder_update(HklHolder *self)
 {
 	static HklQuaternion q0 = {{1, 0, 0, 0}};
+	static HklVector t0 = {{0, 0, 0}};
+	HklQuaternion q;
+	HklVector t;
 	size_t i;
 
-	self->q = q0;
+	/* the config is shared, an axis may have been added */
+	if(darray_size(self->qs) != self->config->len){
+		darray_resize(self->qs, self->config->len);
+		darray_resize(self->ts, self->config->len);
+		self->n_qs = 0;
+	}
+
+	/* the products before the first changed axis are still valid */
+	for(i=0; i<self->n_qs; ++i)
+		if(darray_item(self->geometry->axes, self->config->idx[i])->changed)
+			break;
+	q = i ? darray_item(self->qs, i - 1) : q0;
+	t = i ? darray_item(self->ts, i - 1) : t0;
+
 	/*
 	 * The initial meaning of hkl_holder_update was to compute the
 	 * global rotation of the holder. The first holder contained
 	 * only centered rotations. Now that we have added also
-	 * translation, we stop this computation at the first non
-	 * rotation axis
-	 *
-	 * The right think to do should be to add an
-	 * HklVector hkl_holder_apply_transformation(const Hklholder, const HklVector *vector)
-	 * for every kind of transformation (translation, rotation, etc...)
+	 * translation, each axis is the affine transformation
+	 * x -> qa x + ta, where ta is the transformation of the
+	 * origin, and the holder one is their composition.
 	 */
-	for(i=0; i<self->config->len; ++i){
+	for(; i<self->config->len; ++i){
 		const HklParameter *p;
-		const HklQuaternion *q;
+		const HklQuaternion *qa;
+		HklVector ta;
 
 		p = darray_item(self->geometry->axes, self->config->idx[i]);
-		q = hkl_parameter_quaternion_get(p);
-		if(NULL == q)
-			continue;
-		else
-			hkl_quaternion_times_quaternion(&self->q, q);
+		ta = hkl_parameter_transformation_apply(p, &t0);
+		hkl_vector_rotated_quaternion(&ta, &q);
+		hkl_vector_add_vector(&t, &ta);
+		qa = hkl_parameter_quaternion_get(p);
+		if(NULL != qa)
+			hkl_quaternion_times_quaternion(&q, qa);
+		darray_item(self->qs, i) = q;
+		darray_item(self->ts, i) = t;
 	}
+	self->n_qs = self->config->len;
+	self->q = q;
+	self->t = t;
 }
 
-static HklParameter * hkl_holder_add_axis_if_not_present(const HklHolder *self, int idx)
+static HklParameter * hkl_holder_add_axis_if_not_present(HklHolder *self, int idx)
 {
 	size_t i;
 	HklParameter *res = NULL;
@@ -206,6 +238,18 @@ static HklParameter * hkl_holder_add_axis_if_not_present(const HklHolder *self,
 		if (idx == self->config->idx[i])
 			return NULL;
 
+	/* the config is shared with the other copies of the factory
+	 * geometry, detach it before adding the axis */
+	if(g_atomic_int_get(&self->config->gc) > 1){
+		struct HklHolderConfig *config = hkl_holder_config_new();
+
+		config->len = self->config->len;
+		config->idx = malloc(sizeof(*config->idx) * (config->len + 1));
+		memcpy(config->idx, self->config->idx, sizeof(*config->idx) * config->len);
+		hkl_holder_config_unref(self->config);
+		self->config = config;
+	}
+
 	res = darray_item(self->geometry->axes, idx);
 	self->config->idx = realloc(self->config->idx, sizeof(*self->config->idx) * (self->config->len + 1));
 	self->config->idx[self->config->len++] = idx;
@@ -220,7 +264,8 @@ HklParameter *hkl_holder_add_parameter(HklHolder *self,
         HklParameter parameter = {
                 HKL_PARAMETER_DEFAULTS_LENGTH,
                 .name = name,
-                .punit = punit
+                .punit = punit,
+                .factor = hkl_unit_factor(&hkl_unit_length_meter, punit)
         };
 
 	int idx = hkl_geometry_add_axis(self->geometry, &parameter);
@@ -287,12 +332,56 @@ HklVector hkl_holder_transformation_apply(const HklHolder *self,
 	return res;
 }
 
+/**
+ * hkl_holder_transformation_apply_n: (skip)
+ * @self: the this ptr
+ * @vs: the n vectors to transform
+ * @res: the n transformed vectors, can be @vs
+ * @n: the number of vectors
+ *
+ * apply to many vectors the transformation of the holder compiled by
+ * the last hkl_geometry_update, the same as
+ * hkl_holder_transformation_apply on each of them.
+ **/
+void hkl_holder_transformation_apply_n(const HklHolder *self,
+				       const HklVector vs[], HklVector res[],
+				       size_t n)
+{
+	HklMatrix m;
+	size_t i;
+
+	hkl_quaternion_to_matrix(&self->q, &m);
+	for(i=0; i<n; ++i){
+		const HklVector v = vs[i];
+		size_t j;
+
+		for(j=0; j<3; ++j)
+			res[i].data[j] = m.data[j][0] * v.data[0]
+				+ m.data[j][1] * v.data[1]
+				+ m.data[j][2] * v.data[2]
+				+ self->t.data[j];
+	}
+}
+
 /***************/
 /* HklGeometry */
 /***************/
 
 const HklGeometryOperations hkl_geometry_operations_defaults = { HKL_GEOMETRY_OPERATIONS_DEFAULTS };
 
+/* the place of an axis in the arena of a geometry */
+#define HKL_GEOMETRY_ARENA_ALIGN 16
+
+static inline size_t hkl_geometry_arena_axis_size(const HklParameter *axis)
+{
+	return (axis->ops->size + HKL_GEOMETRY_ARENA_ALIGN - 1) & ~(size_t)(HKL_GEOMETRY_ARENA_ALIGN - 1);
+}
+
+static inline int hkl_geometry_arena_is_full(const HklGeometry *self)
+{
+	return NULL != self->arena && self->n_arena == darray_size(self->axes);
+}
+
 /**
  * hkl_geometry_new: (skip)
  *
@@ -320,6 +409,11 @@ HklGeometry *hkl_geometry_new(const HklFactory *factory,
 	hkl_source_init(&g->source, 1.54, 1, 0, 0);
 	darray_init(g->axes);
 	darray_init(g->holders);
+	g->arena = NULL;
+	g->n_arena = 0;
+	g->arena_size = 0;
+	g->gc = 1;
+	g->stamp = 0;
 
 	return g;
 }
@@ -340,10 +434,31 @@ HklGeometry *hkl_geometry_new_copy(const HklGeometry *src)
 
 	*self = *src;
 
-	/* copy the axes */
+	/* copy the axes in one block of memory, a copy of a copy is
+	 * only one memcpy */
 	darray_init(self->axes);
+	self->arena = NULL;
+	self->n_arena = 0;
+	self->arena_size = 0;
+	self->gc = 1;
 	darray_foreach(axis, src->axes){
-		darray_append(self->axes, hkl_parameter_new_copy(*axis));
+		self->arena_size += hkl_geometry_arena_axis_size(*axis);
+	}
+	if(self->arena_size){
+		size_t offset = 0;
+
+		self->arena = malloc(self->arena_size);
+		if(hkl_geometry_arena_is_full(src))
+			memcpy(self->arena, src->arena, self->arena_size);
+		darray_foreach(axis, src->axes){
+			HklParameter *dup = (HklParameter *)&self->arena[offset];
+
+			if(!hkl_geometry_arena_is_full(src))
+				memcpy(dup, *axis, (*axis)->ops->size);
+			darray_append(self->axes, dup);
+			offset += hkl_geometry_arena_axis_size(*axis);
+		}
+		self->n_arena = darray_size(self->axes);
 	}
 
 	/* copy the holders */
@@ -364,13 +479,14 @@ HklGeometry *hkl_geometry_new_copy(const HklGeometry *src)
  **/
 void hkl_geometry_free(HklGeometry *self)
 {
-	HklParameter **axis;
+	size_t i;
 	HklHolder **holder;
 
-	darray_foreach(axis, self->axes){
-		hkl_parameter_free(*axis);
-	}
+	/* the axes added after the copy are not in the arena */
+	for(i=self->n_arena; i<darray_size(self->axes); ++i)
+		hkl_parameter_free(darray_item(self->axes, i));
 	darray_free(self->axes);
+	free(self->arena);
 
 	darray_foreach(holder, self->holders){
 		hkl_holder_free(*holder);
@@ -399,9 +515,15 @@ int hkl_geometry_set(HklGeometry *self, const HklGeometry *src)
 	self->source = src->source;
 
 	/* copy the axes configuration and mark it as dirty */
-	for(i=0; i<darray_size(self->axes); ++i)
-		hkl_parameter_init_copy(darray_item(self->axes, i),
-					darray_item(src->axes, i), NULL);
+	if(hkl_geometry_arena_is_full(self) && hkl_geometry_arena_is_full(src)
+	   && self->arena_size == src->arena_size){
+		memcpy(self->arena, src->arena, self->arena_size);
+		for(i=0; i<darray_size(self->axes); ++i)
+			darray_item(self->axes, i)->changed = TRUE;
+	}else
+		for(i=0; i<darray_size(self->axes); ++i)
+			hkl_parameter_init_copy(darray_item(self->axes, i),
+						darray_item(src->axes, i), NULL);
 
 	for(i=0; i<darray_size(src->holders); ++i)
 		darray_item(self->holders, i)->q = darray_item(src->holders, i)->q;
@@ -529,6 +651,7 @@ int hkl_geometry_wavelength_set(HklGeometry *self, double wavelength,
 	 * there */
 
 	self->source.wave_length = wavelength;
+	self->stamp++;
 
 	return TRUE;
 }
@@ -584,6 +707,7 @@ void hkl_geometry_update(HklGeometry *self)
 	if (ko) {
 		HklHolder **holder;
 
+		/* each holder recomputes only from its first changed axis */
 		darray_foreach(holder, self->holders){
 			hkl_holder_update(*holder);
 		}
@@ -591,7 +715,97 @@ void hkl_geometry_update(HklGeometry *self)
 		darray_foreach(axis, self->axes){
 			(*axis)->changed = FALSE;
 		}
+		self->stamp++;
+	}
+}
+
+/**
+ * hkl_geometry_axis_idx_get:
+ * @self: the this ptr
+ * @name: the name of the axis
+ *
+ * resolve once the index of an axis, then use it with
+ * hkl_geometry_axis_get_by_idx and hkl_geometry_axis_set_by_idx
+ * instead of looking up the axis by its name at each call. The index
+ * is valid for all the geometries with the same axes.
+ *
+ * Returns: the index of the axis or -1 if there is no such axis.
+ **/
+int hkl_geometry_axis_idx_get(const HklGeometry *self, const char *name)
+{
+	return hkl_geometry_get_axis_idx_by_name(self, name);
+}
+
+/**
+ * hkl_geometry_axis_get_by_idx:
+ * @self: the this ptr
+ * @idx: the index of the axis, see hkl_geometry_axis_idx_get
+ * @error: return location for a GError, or NULL
+ *
+ * Return value: (allow-none): the parameter of the axis.
+ **/
+const HklParameter *hkl_geometry_axis_get_by_idx(const HklGeometry *self,
+						 size_t idx,
+						 GError **error)
+{
+	hkl_error (error == NULL || *error == NULL);
+
+	if(idx >= darray_size(self->axes)){
+		g_set_error(error,
+			    HKL_GEOMETRY_ERROR,
+			    HKL_GEOMETRY_ERROR_AXIS_GET,
+			    "this geometry does not contain the axis %zu",
+			    idx);
+		return NULL;
+	}
+
+	return darray_item(self->axes, idx);
+}
+
+/**
+ * hkl_geometry_axis_set_by_idx:
+ * @self: the this ptr
+ * @idx: the index of the axis, see hkl_geometry_axis_idx_get
+ * @axis: The #HklParameter to set
+ * @error: return location for a GError, or NULL
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_geometry_axis_set_by_idx(HklGeometry *self, size_t idx,
+				 const HklParameter *axis,
+				 GError **error)
+{
+	HklParameter *_axis;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if(idx >= darray_size(self->axes)){
+		g_set_error(error,
+			    HKL_GEOMETRY_ERROR,
+			    HKL_GEOMETRY_ERROR_AXIS_SET,
+			    "this geometry does not contain the axis %zu",
+			    idx);
+		return FALSE;
 	}
+
+	_axis = darray_item(self->axes, idx);
+	if(_axis == axis)
+		return TRUE;
+
+	/* the names of the copies of an axis are shared */
+	if(_axis->name != axis->name && strcmp(_axis->name, axis->name)){
+		g_set_error(error,
+			    HKL_GEOMETRY_ERROR,
+			    HKL_GEOMETRY_ERROR_AXIS_SET,
+			    "The axis to set \"%s\" is different from the parameter name \"%s\"\n",
+			    _axis->name, axis->name);
+		return FALSE;
+	}
+
+	hkl_parameter_init_copy(_axis, axis, NULL);
+	hkl_geometry_update(self);
+
+	return TRUE;
 }
 
 const char *hkl_geometry_name_get(const HklGeometry *self)
@@ -661,7 +875,7 @@ void hkl_geometry_axis_values_get(const HklGeometry *self,
 	g_return_if_fail (n_values == darray_size(self->axes));
 
 	darray_foreach(axis, self->axes){
-		values[i++] = hkl_parameter_value_get(*axis, unit_type);
+		values[i++] = (*axis)->_value * hkl_parameter_unit_factor(*axis, unit_type);
 	}
 }
 
@@ -780,6 +994,58 @@ double hkl_geometry_distance(const HklGeometry *self,
 	return distance;
 }
 
+/**
+ * hkl_geometry_jump: (skip)
+ * @self: the this ptr
+ * @ref: the #HklGeometry to compare with
+ *
+ * Returns: the largest motion of an axis between the two geometries
+ **/
+double hkl_geometry_jump(const HklGeometry *self,
+			 const HklGeometry *ref)
+{
+	size_t i;
+	double jump = 0.;
+
+	for(i=0; i<darray_size(self->axes); ++i){
+		double tmp = fabs(darray_item(ref->axes, i)->_value
+				  - darray_item(self->axes, i)->_value);
+
+		if (tmp > jump)
+			jump = tmp;
+	}
+
+	return jump;
+}
+
+/**
+ * hkl_geometry_motion_time: (skip)
+ * @self: the this ptr
+ * @ref: the #HklGeometry to move to
+ *
+ * the axes move together, each one with its velocity and acceleration
+ * limits, see hkl_parameter_motion_set.
+ *
+ * Returns: the time of the move between the two geometries, the one
+ * of the slowest axis
+ **/
+double hkl_geometry_motion_time(const HklGeometry *self,
+				const HklGeometry *ref)
+{
+	size_t i;
+	double time = 0.;
+
+	for(i=0; i<darray_size(self->axes); ++i){
+		double tmp = hkl_parameter_motion_time(darray_item(self->axes, i),
+						       darray_item(ref->axes, i)->_value);
+
+		if (tmp > time)
+			time = tmp;
+	}
+
+	return time;
+}
+
 /**
  * hkl_geometry_distance_orthodromic: (skip)
  * @self: the this ptr
@@ -801,6 +1067,127 @@ double hkl_geometry_distance_orthodromic(const HklGeometry *self,
 	return distance;
 }
 
+/**
+ * hkl_geometry_closest_get:
+ * @self: the this ptr, the current position
+ * @positions: (array length=n_positions): the n_positions x n_axes candidates axes values
+ * @n_positions: the number of candidates
+ * @n_axes: the number of axes of the geometry
+ * @unit_type: the unit type (default or user) of the positions
+ * @weights: (array length=n_weights) (nullable): the weight of each axis or NULL
+ * @n_weights: the number of weights, n_axes or 0
+ * @distance: how the axes motions are combined
+ * @orthodromic: if TRUE the rotations go the shortest way around
+ * @distances: (array length=n_distances) (nullable): the computed distances or NULL
+ * @n_distances: the size of the distances array, n_positions or 0
+ *
+ * compare all the candidates at once with the axes values of
+ * @self. Each axis motion is multiplied by its weight, for example
+ * the inverse of the motor speed in the default unit, and the motions
+ * are summed or, with #HKL_GEOMETRY_DISTANCE_MAX, the longest one is
+ * kept, which is the motion time when all the motors move together.
+ *
+ * Returns: the index of the closest candidate, or n_positions if
+ * there is none.
+ **/
+size_t hkl_geometry_closest_get(const HklGeometry *self,
+				const double positions[], size_t n_positions,
+				size_t n_axes, HklUnitEnum unit_type,
+				const double weights[], size_t n_weights,
+				HklGeometryDistance distance, int orthodromic,
+				double distances[], size_t n_distances)
+{
+	double ref[n_axes];
+	double factors[n_axes];
+	double ws[n_axes];
+	int periodic[n_axes];
+	double best = INFINITY;
+	size_t i, j, closest = n_positions;
+
+	g_return_val_if_fail(n_axes == darray_size(self->axes), n_positions);
+	g_return_val_if_fail(NULL == weights || n_weights == n_axes, n_positions);
+	g_return_val_if_fail(NULL == distances || n_distances == n_positions, n_positions);
+
+	/* hoist the virtual calls out of the candidates loop */
+	for(j=0; j<n_axes; ++j){
+		const HklParameter *axis = darray_item(self->axes, j);
+
+		ref[j] = axis->_value;
+		factors[j] = 1. / hkl_parameter_unit_factor(axis, unit_type);
+		ws[j] = NULL != weights ? weights[j] : 1.;
+		periodic[j] = orthodromic && hkl_parameter_is_permutable(axis);
+	}
+
+	for(i=0; i<n_positions; ++i){
+		const double *position = &positions[i * n_axes];
+		double d = 0.;
+
+		for(j=0; j<n_axes; ++j){
+			double dj = fabs(position[j] * factors[j] - ref[j]);
+
+			if(periodic[j]){
+				dj = fmod(dj, 2 * M_PI);
+				if(dj > M_PI)
+					dj = 2 * M_PI - dj;
+			}
+			dj *= ws[j];
+			if(HKL_GEOMETRY_DISTANCE_MAX == distance)
+				d = dj > d ? dj : d;
+			else
+				d += dj;
+		}
+		if(NULL != distances)
+			distances[i] = d;
+		if(d < best){
+			best = d;
+			closest = i;
+		}
+	}
+
+	return closest;
+}
+
+/**
+ * hkl_geometry_list_closest_get:
+ * @self: the this ptr
+ * @ref: the current position
+ * @weights: (array length=n_weights) (nullable): the weight of each axis or NULL
+ * @n_weights: the number of weights, the number of axes or 0
+ * @distance: how the axes motions are combined
+ *
+ * get the solution with the least motion from @ref, see
+ * hkl_geometry_closest_get.
+ *
+ * Returns: (nullable): the closest item or NULL if the list is empty.
+ **/
+const HklGeometryListItem *hkl_geometry_list_closest_get(const HklGeometryList *self,
+							 const HklGeometry *ref,
+							 const double weights[], size_t n_weights,
+							 HklGeometryDistance distance)
+{
+	const size_t n_axes = darray_size(ref->axes);
+	double *positions;
+	size_t i;
+
+	if(0 == self->n_items)
+		return NULL;
+
+	positions = g_new(double, self->n_items * n_axes);
+	for(i=0; i<self->n_items; ++i){
+		const HklGeometryListItem *item = darray_item(self->items, i);
+		size_t j;
+
+		for(j=0; j<n_axes; ++j)
+			positions[i * n_axes + j] = darray_item(item->geometry->axes, j)->_value;
+	}
+	i = hkl_geometry_closest_get(ref, positions, self->n_items, n_axes,
+				     HKL_UNIT_DEFAULT, weights, n_weights,
+				     distance, FALSE, NULL, 0);
+	g_free(positions);
+
+	return i < self->n_items ? darray_item(self->items, i) : NULL;
+}
+
 /**
  * hkl_geometry_is_valid: (skip)
  * @self:
@@ -842,6 +1229,102 @@ int hkl_geometry_is_valid_range(const HklGeometry *self)
 	return TRUE;
 }
 
+/**
+ * hkl_geometry_ranges_init: (skip)
+ * @self: the this ptr
+ * @geometry: the #HklGeometry with the axes ranges
+ *
+ * precompute the ranges of the axes of @geometry, to check at once
+ * the axes values of many solutions of the same diffractometer with
+ * hkl_geometry_ranges_check.
+ **/
+void hkl_geometry_ranges_init(HklGeometryRanges *self, const HklGeometry *geometry)
+{
+	HklParameter **axis;
+	size_t i = 0;
+
+	self->n_axes = darray_size(geometry->axes);
+	self->min = g_new(double, self->n_axes);
+	self->max = g_new(double, self->n_axes);
+	self->origin = g_new(double, self->n_axes);
+	self->permutable = g_new(int, self->n_axes);
+
+	darray_foreach(axis, geometry->axes){
+		self->min[i] = (*axis)->range.min - HKL_EPSILON;
+		self->max[i] = (*axis)->range.max + HKL_EPSILON;
+		self->origin[i] = (*axis)->range.min;
+		self->permutable[i] = hkl_parameter_is_permutable(*axis);
+		++i;
+	}
+}
+
+void hkl_geometry_ranges_release(HklGeometryRanges *self)
+{
+	g_free(self->permutable);
+	g_free(self->origin);
+	g_free(self->max);
+	g_free(self->min);
+}
+
+/**
+ * hkl_geometry_ranges_check: (skip)
+ * @self: the this ptr
+ * @values: the n_solutions x n_axes axes values (radian, meter)
+ * @n_solutions: the number of solutions
+ * @shifts: check the smallest 2π shift in range of the permutable axes
+ * @valid: (out caller-allocates): the validity of each solution
+ *
+ * without @shifts, a solution is valid like
+ * hkl_geometry_is_valid_range. With @shifts, it is valid if
+ * hkl_geometry_list_multiply_from_range can shift it into the ranges,
+ * the permutable axes are then checked at the smallest 2π shift above
+ * their minimum, like hkl_parameter_value_set_smallest_in_range.
+ *
+ * The values are checked axis by axis, without any call of the
+ * parameters operations nor branch in the loops over the solutions.
+ *
+ * Returns: the number of valid solutions
+ **/
+size_t hkl_geometry_ranges_check(const HklGeometryRanges *self,
+				 const double values[], size_t n_solutions,
+				 int shifts, int valid[])
+{
+	const size_t n_axes = self->n_axes;
+	size_t i, j;
+	size_t n = 0;
+
+	for(i=0; i<n_solutions; ++i)
+		valid[i] = TRUE;
+
+	for(j=0; j<n_axes; ++j){
+		const double min = self->min[j];
+		const double max = self->max[j];
+
+		if(shifts && self->permutable[j]){
+			const double origin = self->origin[j];
+
+			for(i=0; i<n_solutions; ++i){
+				double v = values[i * n_axes + j];
+
+				v = v < origin
+					? v + 2*M_PI*ceil((origin - v)/(2*M_PI))
+					: v - 2*M_PI*floor((v - origin)/(2*M_PI));
+				valid[i] &= !((v < min) | (v > max));
+			}
+		}else
+			for(i=0; i<n_solutions; ++i){
+				const double v = values[i * n_axes + j];
+
+				valid[i] &= !((v < min) | (v > max));
+			}
+	}
+
+	for(i=0; i<n_solutions; ++i)
+		n += valid[i];
+
+	return n;
+}
+
 /**
  * hkl_geometry_closest_from_geometry_with_range: (skip)
  * @self:
@@ -1013,24 +1496,247 @@ HklVector hkl_geometry_kf_abc_get(const HklGeometry *self,
         return kf_abc;
 }
 
+/* kf and optionally q = kf - ki of the pixels, in the laboratory basis */
+static void hkl_geometry_pixels_kf_compute(const HklGeometry *self,
+					   const HklDetector *detector,
+					   const double pixels[], size_t n_pixels,
+					   double kf[], double q[])
+{
+	const HklHolder *holder = hkl_geometry_detector_holder_get(self, detector);
+	const HklVector ki = hkl_geometry_ki_get(self);
+	const double k = HKL_TAU / self->source.wave_length;
+	HklMatrix m;
+	size_t i;
+	size_t j;
+
+	/* the transformation of the holder compiled by the last update */
+	hkl_quaternion_to_matrix(&holder->q, &m);
+	memcpy(kf, pixels, 3 * n_pixels * sizeof(*kf));
+	hkl_matrix_times_vector_array(&m, kf, n_pixels);
+	for(j=0; j<3; ++j)
+		for(i=0; i<n_pixels; ++i)
+			kf[j * n_pixels + i] += holder->t.data[j];
+
+	for(i=0; i<n_pixels; ++i){
+		double norm = sqrt(kf[0 * n_pixels + i] * kf[0 * n_pixels + i]
+				   + kf[1 * n_pixels + i] * kf[1 * n_pixels + i]
+				   + kf[2 * n_pixels + i] * kf[2 * n_pixels + i]);
+		double scale = norm > 0 ? k / norm : 0;
+
+		for(j=0; j<3; ++j){
+			kf[j * n_pixels + i] *= scale;
+			if(NULL != q)
+				q[j * n_pixels + i] = kf[j * n_pixels + i] - ki.data[j];
+		}
+	}
+}
+
+/**
+ * hkl_geometry_kf_array_get:
+ * @self: the self #HklGeometry
+ * @detector: the #HklDetector
+ * @pixels: (array length=n_pixels): the positions of the pixels in the detector basis
+ * @n_pixels: the size of @pixels, three times the number of pixels
+ * @kf: (array length=n_kf): the computed kf vectors
+ * @n_kf: the size of @kf, the same as @n_pixels
+ *
+ * compute the kf vectors of many pixels of a 2D detector in the
+ * laboratory basis. @pixels contains all the x coordinates first,
+ * then all the y and all the z, and @kf is filled the same way. The
+ * kf of a pixel is along the direction from the sample to the pixel
+ * moved by the detector holder, with a norm of 2π/λ.
+ *
+ * The holder transformation is computed once for all the pixels,
+ * instead of one hkl_geometry_kf_get per pixel.
+ **/
+void hkl_geometry_kf_array_get(const HklGeometry *self,
+			       const HklDetector *detector,
+			       const double pixels[], size_t n_pixels,
+			       double kf[], size_t n_kf)
+{
+	g_return_if_fail(0 == n_pixels % 3);
+	g_return_if_fail(n_kf == n_pixels);
+
+	hkl_geometry_pixels_kf_compute(self, detector, pixels, n_pixels / 3, kf, NULL);
+}
+
+/**
+ * hkl_geometry_q_array_get:
+ * @self: the self #HklGeometry
+ * @detector: the #HklDetector
+ * @pixels: (array length=n_pixels): the positions of the pixels in the detector basis
+ * @n_pixels: the size of @pixels, three times the number of pixels
+ * @q: (array length=n_q): the computed q vectors
+ * @n_q: the size of @q, the same as @n_pixels
+ *
+ * like hkl_geometry_kf_array_get, but compute the scattering vectors
+ * q = kf - ki of the pixels in the laboratory basis.
+ **/
+void hkl_geometry_q_array_get(const HklGeometry *self,
+			      const HklDetector *detector,
+			      const double pixels[], size_t n_pixels,
+			      double q[], size_t n_q)
+{
+	double *kf;
+
+	g_return_if_fail(0 == n_pixels % 3);
+	g_return_if_fail(n_q == n_pixels);
+
+	kf = g_new(double, n_pixels);
+	hkl_geometry_pixels_kf_compute(self, detector, pixels, n_pixels / 3, kf, q);
+	g_free(kf);
+}
+
+/**
+ * hkl_geometry_qper_qpar_array_get:
+ * @self: the self #HklGeometry
+ * @detector: the #HklDetector
+ * @sample: the #HklSample
+ * @surface: the normal of the sample surface in the sample holder basis
+ * @pixels: (array length=n_pixels): the positions of the pixels in the detector basis
+ * @n_pixels: the size of @pixels, three times the number of pixels
+ * @qper: (array length=n): the computed components of q perpendicular to the surface
+ * @qpar: (array length=n): the computed components of q parallel to the surface
+ * @n: the size of @qper and @qpar, the number of pixels
+ *
+ * like hkl_geometry_q_array_get, but compute the qper and qpar
+ * components of the pixels, like the "qper_qpar" engine does for
+ * one geometry. The surface normal is rotated once for all the
+ * pixels. With the sample z axis as @surface, qper and |qpar| are
+ * the ones of the binoculars QPAR_QPER sub projection.
+ **/
+void hkl_geometry_qper_qpar_array_get(const HklGeometry *self,
+				      const HklDetector *detector,
+				      const HklSample *sample,
+				      const HklVector *surface,
+				      const double pixels[], size_t n_pixels,
+				      double qper[], double qpar[], size_t n)
+{
+	const HklHolder *holder;
+	HklVector ki;
+	HklVector normal = *surface;
+	HklVector npar;
+	double *kf;
+	double *q;
+	size_t i;
+
+	g_return_if_fail(0 == n_pixels % 3);
+	g_return_if_fail(n == n_pixels / 3);
+
+	kf = g_new(double, n_pixels);
+	q = g_new(double, n_pixels);
+	hkl_geometry_pixels_kf_compute(self, detector, pixels, n, kf, q);
+
+	/* the real orientation of the surface */
+	holder = hkl_geometry_sample_holder_get(self, sample);
+	hkl_vector_rotated_quaternion(&normal, &holder->q);
+	hkl_vector_normalize(&normal);
+
+	/* npar defines the sign of qpar */
+	ki = hkl_geometry_ki_get(self);
+	npar = ki;
+	hkl_vector_vectorial_product(&npar, &normal);
+
+	for(i=0; i<n; ++i){
+		const HklVector v = {{q[i], q[n + i], q[2 * n + i]}};
+
+		hkl_vector_qper_qpar(&v, &normal, &npar, &qper[i], &qpar[i]);
+	}
+
+	g_free(q);
+	g_free(kf);
+}
+
 /*******************/
 /* HklGeometryList */
 /*******************/
 
+/* the list items share their geometries until one is modified */
+static inline HklGeometry *hkl_geometry_list_item_geometry_ref(HklGeometry *self)
+{
+	g_atomic_int_inc(&self->gc);
+
+	return self;
+}
+
+static inline void hkl_geometry_list_item_geometry_unref(HklGeometry *self)
+{
+	if (g_atomic_int_dec_and_test(&self->gc))
+		hkl_geometry_free(self);
+}
+
+/* put the item at the place i of the list */
+static inline void hkl_geometry_list_item_place(HklGeometryList *self,
+						HklGeometryListItem *item,
+						size_t i)
+{
+	darray_item(self->items, i) = item;
+	item->idx = i;
+}
+
+/* exchange the items i and j of the list */
+static inline void hkl_geometry_list_items_swap(HklGeometryList *self,
+						size_t i, size_t j)
+{
+	HklGeometryListItem *item = darray_item(self->items, i);
+
+	hkl_geometry_list_item_place(self, darray_item(self->items, j), i);
+	hkl_geometry_list_item_place(self, item, j);
+}
+
 /**
- * hkl_geometry_list_new: (skip)
+ * hkl_geometry_list_append: (skip)
+ * @self: the this ptr
+ * @geometry: the #HklGeometry of the item
  *
- * constructor
+ * add a copy of @geometry at the end of the list, the first released
+ * item is reused or a new one is allocated.
  *
- * Returns:
+ * Returns: the added item
+ **/
+static HklGeometryListItem *hkl_geometry_list_append(HklGeometryList *self,
+						     const HklGeometry *geometry)
+{
+	HklGeometryListItem *item;
+
+	if (self->n_items == darray_size(self->items)){
+		item = hkl_geometry_list_item_new(geometry);
+		darray_append(self->items, item);
+	}else{
+		item = darray_item(self->items, self->n_items);
+
+		/* a geometry still shared by a copy of the item is left to it */
+		if (1 == g_atomic_int_get(&item->geometry->gc)
+		    && item->geometry->factory == geometry->factory
+		    && item->geometry->ops == geometry->ops)
+			hkl_geometry_set(item->geometry, geometry);
+		else {
+			hkl_geometry_list_item_geometry_unref(item->geometry);
+			item->geometry = hkl_geometry_new_copy(geometry);
+		}
+	}
+	item->idx = self->n_items++;
+
+	return item;
+}
+
+/**
+ * hkl_geometry_list_new:
+ *
+ * constructor of an empty list, it can receive the solutions of
+ * hkl_engine_pseudo_axis_values_set_into.
+ *
+ * Returns: (transfer full): a new #HklGeometryList, use
+ *          hkl_geometry_list_free to release the memory once done.
  **/
 HklGeometryList *hkl_geometry_list_new(void)
 {
 	HklGeometryList *self = g_new(HklGeometryList, 1);
 
-	list_head_init(&self->items);
+	darray_init(self->items);
 	self->n_items = 0;
 	self->multiply = NULL;
+	darray_init(self->sorting);
 
 	return self;
 }
@@ -1046,22 +1752,43 @@ HklGeometryList *hkl_geometry_list_new(void)
 HklGeometryList *hkl_geometry_list_new_copy(const HklGeometryList *self)
 {
 	HklGeometryList *dup;
-	HklGeometryListItem *item;
+	size_t i;
 
 	dup = g_new(HklGeometryList, 1);
 
-	list_head_init(&dup->items);
-	/* now copy the item arrays */
-	list_for_each(&self->items, item, list){
-		list_add_tail(&dup->items,
-			      &hkl_geometry_list_item_new_copy(item)->list);
-	}
+	/* now copy the items, the released ones are not kept */
+	darray_init(dup->items);
+	darray_resize(dup->items, self->n_items);
+	for(i=0; i<self->n_items; ++i)
+		hkl_geometry_list_item_place(dup,
+					     hkl_geometry_list_item_new_copy(darray_item(self->items, i)),
+					     i);
 	dup->n_items = self->n_items;
 	dup->multiply = self->multiply;
+	darray_init(dup->sorting);
 
 	return dup;
 }
 
+/**
+ * hkl_geometry_list_set: (skip)
+ * @self: the this ptr
+ * @src: the #HklGeometryList to copy
+ *
+ * copy the items of @src into @self, the memory of the previous
+ * items of @self is reused.
+ **/
+void hkl_geometry_list_set(HklGeometryList *self, const HklGeometryList *src)
+{
+	size_t i;
+
+	hkl_geometry_list_reset(self);
+
+	for(i=0; i<src->n_items; ++i)
+		hkl_geometry_list_append(self, darray_item(src->items, i)->geometry);
+	self->multiply = src->multiply;
+}
+
 /**
  * hkl_geometry_list_free: (skip)
  * @self:
@@ -1070,7 +1797,13 @@ HklGeometryList *hkl_geometry_list_new_copy(const HklGeometryList *self)
  **/
 void hkl_geometry_list_free(HklGeometryList *self)
 {
-	hkl_geometry_list_reset(self);
+	HklGeometryListItem **item;
+
+	darray_foreach(item, self->items){
+		hkl_geometry_list_item_free(*item);
+	}
+	darray_free(self->items);
+	darray_free(self->sorting);
 	free(self);
 }
 
@@ -1088,20 +1821,15 @@ void hkl_geometry_list_free(HklGeometryList *self)
  **/
 void hkl_geometry_list_add(HklGeometryList *self, const HklGeometry *geometry)
 {
-	HklGeometryListItem *item;
+	size_t i;
 
 	/* now check if the geometry is already in the geometry list */
-	list_for_each(&self->items, item, list){
+	for(i=0; i<self->n_items; ++i)
 		if (hkl_geometry_distance_orthodromic(geometry,
-						      item->geometry) < HKL_EPSILON)
+						      darray_item(self->items, i)->geometry) < HKL_EPSILON)
 			return;
-	}
 
-        item = hkl_geometry_list_item_new(geometry);
-        if (NULL != item){
-                list_add_tail(&self->items, &item->list);
-                self->n_items += 1;
-        }
+	hkl_geometry_list_append(self, geometry);
 }
 
 /**
@@ -1127,7 +1855,7 @@ size_t hkl_geometry_list_n_items_get(const HklGeometryList *self)
  **/
 const HklGeometryListItem *hkl_geometry_list_items_first_get(const HklGeometryList *self)
 {
-	return list_top(&self->items, HklGeometryListItem, list);
+	return self->n_items ? darray_item(self->items, 0) : NULL;
 }
 
 /**
@@ -1142,7 +1870,40 @@ const HklGeometryListItem *hkl_geometry_list_items_first_get(const HklGeometryLi
 const HklGeometryListItem *hkl_geometry_list_items_next_get(const HklGeometryList *self,
 							    const HklGeometryListItem *item)
 {
-	return list_next(&self->items, item, list);
+	return item->idx + 1 < self->n_items ? darray_item(self->items, item->idx + 1) : NULL;
+}
+
+/**
+ * hkl_geometry_list_axis_values_get: (skip)
+ * @self: the this ptr
+ * @values: the n_items x n_axes buffer filled with the axes values
+ * @n_values: the size of @values
+ * @unit_type: the unit type (default or user) of the values
+ *
+ * copy the axes values of the solutions into one contiguous buffer,
+ * in the order of the list, a solution per row. Only the solutions
+ * which fit entirely in @values are copied.
+ *
+ * Returns: the number of solutions copied
+ **/
+size_t hkl_geometry_list_axis_values_get(const HklGeometryList *self,
+					 double values[], size_t n_values,
+					 HklUnitEnum unit_type)
+{
+	size_t n;
+
+	for(n=0; n<self->n_items; ++n){
+		const HklGeometryListItem *item = darray_item(self->items, n);
+		size_t n_axes = darray_size(item->geometry->axes);
+
+		if((n + 1) * n_axes > n_values)
+			break;
+		hkl_geometry_axis_values_get(item->geometry,
+					     &values[n * n_axes], n_axes,
+					     unit_type);
+	}
+
+	return n;
 }
 
 /**
@@ -1154,14 +1915,73 @@ const HklGeometryListItem *hkl_geometry_list_items_next_get(const HklGeometryLis
  **/
 void hkl_geometry_list_reset(HklGeometryList *self)
 {
-	HklGeometryListItem *item;
-	HklGeometryListItem *next;
+	/* keep the items for the next additions */
+	self->n_items = 0;
+}
 
-	list_for_each_safe(&self->items, item, next, list)
-		hkl_geometry_list_item_free(item);
+/*
+ * a before b if its distance is smaller by more than HKL_EPSILON,
+ * otherwise the last added item comes first, like the previous
+ * insertion sort.
+ */
+static inline int hkl_geometry_list_sort_entry_before(const struct HklGeometryListSortEntry *a,
+						      const struct HklGeometryListSortEntry *b)
+{
+	if (fabs(a->distance - b->distance) > HKL_EPSILON)
+		return a->distance < b->distance;
+	return a->idx > b->idx;
+}
 
-	list_head_init(&self->items);
-	self->n_items = 0;
+/* stable bottom-up merge sort of the n entries using n tmp entries */
+static void hkl_geometry_list_sort_entries(struct HklGeometryListSortEntry *entries,
+					   struct HklGeometryListSortEntry *tmp,
+					   size_t n)
+{
+	struct HklGeometryListSortEntry *src = entries;
+	struct HklGeometryListSortEntry *dst = tmp;
+	size_t width;
+
+	for(width=1; width<n; width*=2){
+		size_t lo;
+
+		for(lo=0; lo<n; lo+=2*width){
+			size_t mid = lo + width < n ? lo + width : n;
+			size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+			size_t i = lo, j = mid, k = lo;
+
+			while(i < mid && j < hi)
+				dst[k++] = hkl_geometry_list_sort_entry_before(&src[j], &src[i]) ? src[j++] : src[i++];
+			while(i < mid)
+				dst[k++] = src[i++];
+			while(j < hi)
+				dst[k++] = src[j++];
+		}
+		src = dst;
+		dst = dst == tmp ? entries : tmp;
+	}
+
+	if(src != entries)
+		memcpy(entries, src, n * sizeof(*entries));
+}
+
+/* compute the distances once for all in the scratch memory of the
+ * list, twice the number of items is reserved for the merge */
+static struct HklGeometryListSortEntry *hkl_geometry_list_sort_entries_get(HklGeometryList *self,
+									   const HklGeometry *ref,
+									   HklGeometryCost cost)
+{
+	size_t i;
+
+	darray_resize(self->sorting, 2 * self->n_items);
+	for(i=0; i<self->n_items; ++i){
+		struct HklGeometryListSortEntry *entry = &darray_item(self->sorting, i);
+
+		entry->item = darray_item(self->items, i);
+		entry->distance = cost(ref, entry->item->geometry);
+		entry->idx = i;
+	}
+
+	return &darray_item(self->sorting, 0);
 }
 
 /**
@@ -1174,39 +1994,99 @@ void hkl_geometry_list_reset(HklGeometryList *self)
  **/
 void hkl_geometry_list_sort(HklGeometryList *self, HklGeometry *ref)
 {
-	double *distances = alloca(self->n_items * sizeof(*distances));
-	size_t *idx = alloca(self->n_items * sizeof(*idx));
-	HklGeometryListItem **items = alloca(self->n_items * sizeof(*items));
-	HklGeometryListItem *item;
-	int i = 0;
-	size_t x;
-	int j, p;
-
-	/* compute the distances once for all */
-	list_for_each(&self->items, item, list){
-		distances[i] = hkl_geometry_distance(ref, item->geometry);
-		idx[i] = i;
-		items[i] = item;
-		i++;
-	}
+	hkl_geometry_list_sort_cost(self, ref, hkl_geometry_distance);
+}
 
-	/* insertion sorting */
-	for(i=1; i<self->n_items; ++i){
-		x = idx[i];
-		/* find the smallest idx p lower than i with distance[idx[p]] >= distance[x] */
-		for(p = 0; distances[idx[p]] < distances[x] && fabs(distances[idx[p]] - distances[x]) > HKL_EPSILON; p++);
+/**
+ * hkl_geometry_list_sort_cost: (skip)
+ * @self:
+ * @ref:
+ * @cost: the cost of the move from @ref to a #HklGeometry
+ *
+ * sort the #HklGeometryList like hkl_geometry_list_sort, with an
+ * other cost than the distance, hkl_geometry_motion_time for example.
+ **/
+void hkl_geometry_list_sort_cost(HklGeometryList *self, HklGeometry *ref,
+				 HklGeometryCost cost)
+{
+	struct HklGeometryListSortEntry *entries;
+	size_t i;
 
-		/* move everythings in between p and i */
-		for(j=i-1; j>=p; j--)
-			idx[j+1] = idx[j];
+	if(self->n_items < 2)
+		return;
+
+	entries = hkl_geometry_list_sort_entries_get(self, ref, cost);
+	hkl_geometry_list_sort_entries(entries, &entries[self->n_items], self->n_items);
 
-		idx[p] = x; /* insert the saved idx */
+	for(i=0; i<self->n_items; ++i)
+		hkl_geometry_list_item_place(self, entries[i].item, i);
+}
+
+/**
+ * hkl_geometry_list_sort_closest: (skip)
+ * @self:
+ * @ref:
+ * @n: the number of items to keep
+ *
+ * keep only the @n #HklGeometry of the #HklGeometryList closest to
+ * the given #HklGeometry, sorted like with hkl_geometry_list_sort.
+ * The selection costs n_items x @n comparisons, so it is faster than
+ * a full sort when @n is small.
+ **/
+void hkl_geometry_list_sort_closest(HklGeometryList *self, HklGeometry *ref, size_t n)
+{
+	hkl_geometry_list_sort_closest_cost(self, ref, n, hkl_geometry_distance);
+}
+
+/**
+ * hkl_geometry_list_sort_closest_cost: (skip)
+ * @self:
+ * @ref:
+ * @n: the number of items to keep
+ * @cost: the cost of the move from @ref to a #HklGeometry
+ *
+ * like hkl_geometry_list_sort_closest with an other cost than the
+ * distance.
+ **/
+void hkl_geometry_list_sort_closest_cost(HklGeometryList *self, HklGeometry *ref, size_t n,
+					 HklGeometryCost cost)
+{
+	struct HklGeometryListSortEntry *entries;
+	struct HklGeometryListSortEntry *best;
+	size_t n_best = 0;
+	size_t i;
+
+	if(n >= self->n_items){
+		hkl_geometry_list_sort_cost(self, ref, cost);
+		return;
 	}
 
-	list_head_init(&self->items);
+	entries = hkl_geometry_list_sort_entries_get(self, ref, cost);
+	best = &entries[self->n_items];
 
+	/* insert each entry in the sorted n best ones */
+	for(i=0; i<self->n_items; ++i){
+		size_t p = n_best;
+
+		while(p > 0 && hkl_geometry_list_sort_entry_before(&entries[i], &best[p - 1]))
+			--p;
+		if(p >= n)
+			continue;
+		if(n_best < n)
+			++n_best;
+		memmove(&best[p + 1], &best[p], (n_best - 1 - p) * sizeof(*best));
+		best[p] = entries[i];
+	}
+
+	/* the best ones first, the others go back to the released items */
+	for(i=0; i<n_best; ++i){
+		entries[best[i].idx].item = NULL;
+		hkl_geometry_list_item_place(self, best[i].item, i);
+	}
 	for(i=0; i<self->n_items; ++i)
-		list_add_tail(&self->items, &items[idx[i]]->list);
+		if(NULL != entries[i].item)
+			hkl_geometry_list_item_place(self, entries[i].item, n++);
+	self->n_items = n_best;
 }
 
 /**
@@ -1223,21 +2103,18 @@ void hkl_geometry_list_fprintf(FILE *f, const HklGeometryList *self)
 
 	fprintf(f, "multiply method: %p \n", self->multiply);
 	if(self->n_items){
-		HklGeometryListItem *item;
 		HklParameter **axis;
 
-                item = list_top(&self->items, HklGeometryListItem, list);
-                if(!item)
-                        return;
-
 		fprintf(f, "    ");
-		darray_foreach(axis, list_top(&self->items, HklGeometryListItem, list)->geometry->axes){
+		darray_foreach(axis, darray_item(self->items, 0)->geometry->axes){
 			fprintf(f, "%19s", (*axis)->name);
 		}
 
 		/* geometries */
-		list_for_each(&self->items, item, list){
-			fprintf(f, "\n%d :", i++);
+		for(i=0; i<self->n_items; ++i){
+			const HklGeometryListItem *item = darray_item(self->items, i);
+
+			fprintf(f, "\n%d :", i);
 			darray_foreach(axis, item->geometry->axes){
 				value = hkl_parameter_value_get(*axis, HKL_UNIT_DEFAULT);
 				fprintf(f, " % 18.15f %s", value, (*axis)->unit->repr);
@@ -1263,7 +2140,6 @@ void hkl_geometry_list_multiply(HklGeometryList *self)
 {
 	uint i = 0;
 	uint len = self->n_items;
-	HklGeometryListItem *item;
 
 	if(!self->multiply)
 		return;
@@ -1272,10 +2148,8 @@ void hkl_geometry_list_multiply(HklGeometryList *self)
 	 * warning this method change the self->len so we need to save it
 	 * before using the recursive perm_r calls
 	 */
-	for(i=0, item=list_top(&self->items, HklGeometryListItem, list);
-	    i<len;
-	    ++i, item=list_next(&self->items, item, list))
-		self->multiply(self, item);
+	for(i=0; i<len; ++i)
+		self->multiply(self, darray_item(self->items, i));
 }
 
 static void perm_r(HklGeometryList *self, const HklGeometry *ref,
@@ -1283,11 +2157,8 @@ static void perm_r(HklGeometryList *self, const HklGeometry *ref,
 		   const unsigned int axis_idx)
 {
 	if (axis_idx == darray_size(geometry->axes)){
-		if(hkl_geometry_distance(geometry, ref) > HKL_EPSILON){
-			list_add_tail(&self->items,
-				      &hkl_geometry_list_item_new(geometry)->list);
-			self->n_items++;
-		}
+		if(hkl_geometry_distance(geometry, ref) > HKL_EPSILON)
+			hkl_geometry_list_append(self, geometry);
 	}else{
                 HklParameter *axis = darray_item(geometry->axes, axis_idx);
 
@@ -1324,16 +2195,14 @@ void hkl_geometry_list_multiply_from_range(HklGeometryList *self)
 {
         size_t i;
         size_t len;
-        const HklGeometryListItem *item;
 	/*
 	 * warning this method change the self->len so we need to save it
 	 * before using the recursive perm_r calls
 	 */
         len =  self->n_items;
 
-	for(i=0, item=list_top(&self->items, HklGeometryListItem, list);
-	    i<len && NULL != item;
-	    ++i, item=list_next(&self->items, item, list)){
+	for(i=0; i<len; ++i){
+		const HklGeometryListItem *item = darray_item(self->items, i);
                 HklParameter **axis;
 		HklGeometry *geometry = hkl_geometry_new_copy(item->geometry);
 
@@ -1352,6 +2221,246 @@ void hkl_geometry_list_multiply_from_range(HklGeometryList *self)
 	}
 }
 
+/* a combination of the 2π shifts of the axes of an item */
+struct HklGeometryListRangeNode
+{
+	double distance; /* to the reference */
+	size_t item;
+	size_t axis; /* the first axis which can still be shifted */
+	size_t shifts; /* offset of the n_axes shifts in the shifts array */
+};
+
+typedef darray(struct HklGeometryListRangeNode) darray_range_node;
+
+static inline int hkl_geometry_list_range_node_before(const darray_range_node *heap, size_t i, size_t j)
+{
+	return darray_item(*heap, i).distance < darray_item(*heap, j).distance;
+}
+
+static inline void hkl_geometry_list_range_node_swap(darray_range_node *heap, size_t i, size_t j)
+{
+	struct HklGeometryListRangeNode tmp = darray_item(*heap, i);
+
+	darray_item(*heap, i) = darray_item(*heap, j);
+	darray_item(*heap, j) = tmp;
+}
+
+static void hkl_geometry_list_range_push(darray_range_node *heap,
+					 struct HklGeometryListRangeNode node)
+{
+	size_t i = darray_size(*heap);
+
+	darray_append(*heap, node);
+	while(i > 0 && hkl_geometry_list_range_node_before(heap, i, (i - 1) / 2)){
+		hkl_geometry_list_range_node_swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static struct HklGeometryListRangeNode hkl_geometry_list_range_pop(darray_range_node *heap)
+{
+	struct HklGeometryListRangeNode top = darray_item(*heap, 0);
+	size_t n = darray_size(*heap) - 1;
+	size_t i = 0;
+
+	darray_item(*heap, 0) = darray_item(*heap, n);
+	darray_resize(*heap, n);
+	for(;;){
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+		size_t m = i;
+
+		if(l < n && hkl_geometry_list_range_node_before(heap, l, m))
+			m = l;
+		if(r < n && hkl_geometry_list_range_node_before(heap, r, m))
+			m = r;
+		if(m == i)
+			break;
+		hkl_geometry_list_range_node_swap(heap, i, m);
+		i = m;
+	}
+
+	return top;
+}
+
+/**
+ * hkl_geometry_list_multiply_from_range_closest: (skip)
+ * @self: the this ptr
+ * @ref: the reference #HklGeometry
+ * @n_max: the maximum number of added geometries, 0 for no limit
+ * @max_distance: the maximum distance to @ref of the added geometries
+ *
+ * like hkl_geometry_list_multiply_from_range, add the 2π shifted
+ * copies of the items inside the axes ranges, but generate them
+ * lazily by increasing distance to @ref. The enumeration stops after
+ * @n_max geometries or at the first one farther than @max_distance,
+ * so the full product of the shifts of multi-turn axes is never
+ * built.
+ *
+ * The distance is a sum over the axes, so each axis keeps its shifts
+ * sorted by distance and a combination only leads to the ones with
+ * one more shift on an axis after the last shifted one. Each
+ * combination is then reached only once.
+ **/
+void hkl_geometry_list_multiply_from_range_closest(HklGeometryList *self,
+						    const HklGeometry *ref,
+						    size_t n_max, double max_distance)
+{
+	const size_t n_axes = darray_size(ref->axes);
+	const size_t n_items = self->n_items;
+	HklGeometryListItem *items[n_items];
+	HklGeometry *geometry;
+	darray(double) values = darray_new(); /* the shifted values of each axis */
+	size_t offsets[n_items * n_axes + 1];
+	darray(size_t) shifts = darray_new();
+	darray_range_node heap = darray_new();
+	size_t i, j, n_added = 0;
+
+	if(0 == n_items)
+		return;
+
+	/* sort the shifted values of each axis of each item in range */
+	memcpy(items, &darray_item(self->items, 0), n_items * sizeof(*items));
+	geometry = hkl_geometry_new_copy(items[0]->geometry);
+	for(i=0; i<n_items; ++i){
+		hkl_geometry_set(geometry, items[i]->geometry);
+		for(j=0; j<n_axes; ++j){
+			HklParameter *axis = darray_item(geometry->axes, j);
+			const double r = darray_item(ref->axes, j)->_value;
+			size_t k, first = darray_size(values);
+
+			offsets[i * n_axes + j] = first;
+			if(hkl_parameter_is_permutable(axis)){
+				double value;
+
+				hkl_parameter_value_set_smallest_in_range(axis);
+				for(value = axis->_value; value <= axis->range.max + HKL_EPSILON; value += 2 * M_PI)
+					darray_append(values, value);
+			}
+			if(first == darray_size(values))
+				darray_append(values, axis->_value);
+
+			/* insertion sort, an axis has only a few turns */
+			for(k=first+1; k<darray_size(values); ++k){
+				double v = darray_item(values, k);
+				size_t l = k;
+
+				for(; l>first && fabs(darray_item(values, l - 1) - r) > fabs(v - r); --l)
+					darray_item(values, l) = darray_item(values, l - 1);
+				darray_item(values, l) = v;
+			}
+		}
+	}
+	offsets[n_items * n_axes] = darray_size(values);
+
+	/* the closest combination of each item */
+	for(i=0; i<n_items; ++i){
+		struct HklGeometryListRangeNode node = {0, i, 0, darray_size(shifts)};
+
+		for(j=0; j<n_axes; ++j){
+			node.distance += fabs(darray_item(values, offsets[i * n_axes + j])
+					      - darray_item(ref->axes, j)->_value);
+			darray_append(shifts, 0);
+		}
+		hkl_geometry_list_range_push(&heap, node);
+	}
+
+	while(darray_size(heap) > 0 && (0 == n_max || n_added < n_max)){
+		struct HklGeometryListRangeNode node = hkl_geometry_list_range_pop(&heap);
+		const size_t *base = &darray_item(shifts, 0);
+
+		if(node.distance > max_distance)
+			break;
+
+		/* write directly the rotation values, like perm_r */
+		hkl_geometry_set(geometry, items[node.item]->geometry);
+		for(j=0; j<n_axes; ++j)
+			darray_item(geometry->axes, j)->_value =
+				darray_item(values, offsets[node.item * n_axes + j] + base[node.shifts + j]);
+		if(hkl_geometry_distance(geometry, items[node.item]->geometry) > HKL_EPSILON){
+			hkl_geometry_list_append(self, geometry);
+			n_added++;
+		}
+
+		/* the next combinations */
+		for(j=node.axis; j<n_axes; ++j){
+			const size_t o = offsets[node.item * n_axes + j];
+			const size_t n = offsets[node.item * n_axes + j + 1] - o;
+			const double r = darray_item(ref->axes, j)->_value;
+			struct HklGeometryListRangeNode next = {node.distance, node.item, j, darray_size(shifts)};
+			size_t s = darray_item(shifts, node.shifts + j);
+			size_t k;
+
+			if(s + 1 >= n)
+				continue;
+			next.distance += fabs(darray_item(values, o + s + 1) - r)
+				- fabs(darray_item(values, o + s) - r);
+			for(k=0; k<n_axes; ++k)
+				darray_append(shifts, darray_item(shifts, node.shifts + k));
+			darray_item(shifts, next.shifts + j) = s + 1;
+			hkl_geometry_list_range_push(&heap, next);
+		}
+	}
+
+	hkl_geometry_free(geometry);
+	darray_free(heap);
+	darray_free(shifts);
+	darray_free(values);
+}
+
+/* the validity of the items computed at once, hkl_geometry_list_remove_if
+ * visits them in order */
+struct HklGeometryListValid
+{
+	const int *valid;
+	size_t i;
+};
+
+static int hkl_geometry_list_is_invalid(UNUSED const HklGeometry *self, void *data)
+{
+	struct HklGeometryListValid *valid = data;
+
+	return !valid->valid[valid->i++];
+}
+
+static size_t hkl_geometry_list_remove_out_of_range(HklGeometryList *self, int shifts)
+{
+	HklGeometryRanges ranges;
+	struct HklGeometryListValid valid;
+	double *values;
+	int *flags;
+	size_t i, k = 0;
+	size_t n = 0;
+
+	if(0 == self->n_items)
+		return 0;
+
+	hkl_geometry_ranges_init(&ranges, darray_item(self->items, 0)->geometry);
+	values = g_new(double, self->n_items * ranges.n_axes);
+	flags = g_new(int, self->n_items);
+
+	/* the n_items x n_axes matrix of the axes values */
+	for(i=0; i<self->n_items; ++i){
+		HklParameter **axis;
+
+		darray_foreach(axis, darray_item(self->items, i)->geometry->axes){
+			values[k++] = (*axis)->_value;
+		}
+	}
+
+	if(hkl_geometry_ranges_check(&ranges, values, self->n_items, shifts, flags) < self->n_items){
+		valid.valid = flags;
+		valid.i = 0;
+		n = hkl_geometry_list_remove_if(self, hkl_geometry_list_is_invalid, &valid);
+	}
+
+	g_free(flags);
+	g_free(values);
+	hkl_geometry_ranges_release(&ranges);
+
+	return n;
+}
+
 /**
  * hkl_geometry_list_remove_invalid: (skip)
  * @self:
@@ -1360,14 +2469,95 @@ void hkl_geometry_list_multiply_from_range(HklGeometryList *self)
  **/
 void hkl_geometry_list_remove_invalid(HklGeometryList *self)
 {
-	HklGeometryListItem *item, *next;
+	hkl_geometry_list_remove_out_of_range(self, FALSE);
+}
 
-	list_for_each_safe(&self->items, item, next, list)
-		if(!hkl_geometry_is_valid_range(item->geometry)){
-			list_del(&item->list);
-			self->n_items--;
-			hkl_geometry_list_item_free(item);
-		}
+/**
+ * hkl_geometry_list_remove_unreachable: (skip)
+ * @self: the this ptr
+ *
+ * remove the #HklGeometry which stay invalid whatever the 2π shifts
+ * of their permutable axes, so hkl_geometry_list_multiply_from_range
+ * would not produce any valid #HklGeometry from them.
+ *
+ * Returns: the number of removed #HklGeometry
+ **/
+size_t hkl_geometry_list_remove_unreachable(HklGeometryList *self)
+{
+	return hkl_geometry_list_remove_out_of_range(self, TRUE);
+}
+
+/**
+ * hkl_geometry_list_remove_jumps: (skip)
+ * @self:
+ * @ref: the reference #HklGeometry
+ * @max_jump: the maximum motion of an axis (radian)
+ *
+ * remove the #HklGeometry with an axis moving more than @max_jump
+ * from @ref.
+ **/
+struct HklGeometryListJump
+{
+	const HklGeometry *ref;
+	double max_jump;
+};
+
+static int hkl_geometry_list_is_jump(const HklGeometry *self, void *data)
+{
+	const struct HklGeometryListJump *jump = data;
+
+	return hkl_geometry_jump(self, jump->ref) > jump->max_jump;
+}
+
+void hkl_geometry_list_remove_jumps(HklGeometryList *self,
+				    const HklGeometry *ref, double max_jump)
+{
+	struct HklGeometryListJump jump = {ref, max_jump};
+
+	hkl_geometry_list_remove_if(self, hkl_geometry_list_is_jump, &jump);
+}
+
+/**
+ * hkl_geometry_list_truncate: (skip)
+ * @self:
+ * @n: the number of items to keep
+ *
+ * keep only the first @n #HklGeometry of the #HklGeometryList
+ **/
+void hkl_geometry_list_truncate(HklGeometryList *self, size_t n)
+{
+	/* the others become released items */
+	if(n < self->n_items)
+		self->n_items = n;
+}
+
+/**
+ * hkl_geometry_list_remove_if: (skip)
+ * @self:
+ * @predicate: TRUE for the #HklGeometry to remove
+ * @data: the user data passed to @predicate
+ *
+ * remove the #HklGeometry of the #HklGeometryList for which
+ * @predicate is TRUE, in the order of the list.
+ *
+ * Returns: the number of removed #HklGeometry
+ **/
+size_t hkl_geometry_list_remove_if(HklGeometryList *self,
+				   HklGeometryPredicate predicate, void *data)
+{
+	size_t i;
+	size_t n = 0;
+
+	/* the kept items are moved in front of the n removed ones,
+	 * which become released items */
+	for(i=0; i<self->n_items; ++i)
+		if(predicate(darray_item(self->items, i)->geometry, data))
+			n++;
+		else if(n > 0)
+			hkl_geometry_list_items_swap(self, i - n, i);
+	self->n_items -= n;
+
+	return n;
 }
 
 /***********************/
@@ -1386,6 +2576,7 @@ HklGeometryListItem *hkl_geometry_list_item_new(const HklGeometry *geometry)
 {
 	HklGeometryListItem *self = g_new(HklGeometryListItem, 1);
 
+	self->idx = 0;
 	self->geometry = hkl_geometry_new_copy(geometry);
 
 	return self;
@@ -1403,7 +2594,9 @@ HklGeometryListItem *hkl_geometry_list_item_new_copy(const HklGeometryListItem *
 {
 	HklGeometryListItem *dup = g_new(HklGeometryListItem, 1);
 
-	dup->geometry = hkl_geometry_new_copy(self->geometry);
+	dup->idx = self->idx;
+	/* the geometry is copied only when one of the items modifies it */
+	dup->geometry = hkl_geometry_list_item_geometry_ref(self->geometry);
 
 	return dup;
 }
@@ -1416,10 +2609,31 @@ HklGeometryListItem *hkl_geometry_list_item_new_copy(const HklGeometryListItem *
  **/
 void hkl_geometry_list_item_free(HklGeometryListItem *self)
 {
-	hkl_geometry_free(self->geometry);
+	hkl_geometry_list_item_geometry_unref(self->geometry);
 	free(self);
 }
 
+/**
+ * hkl_geometry_list_item_geometry_unshare: (skip)
+ * @self: the this ptr
+ *
+ * get the geometry of the item for a modification, it is copied
+ * first if other items share it.
+ *
+ * Returns: the geometry owned only by this item
+ **/
+HklGeometry *hkl_geometry_list_item_geometry_unshare(HklGeometryListItem *self)
+{
+	if (g_atomic_int_get(&self->geometry->gc) > 1){
+		HklGeometry *geometry = hkl_geometry_new_copy(self->geometry);
+
+		hkl_geometry_list_item_geometry_unref(self->geometry);
+		self->geometry = geometry;
+	}
+
+	return self->geometry;
+}
+
 /**
  * hkl_geometry_list_item_geometry_get:
  * @self: the this ptr
@@ -37,6 +37,7 @@ struct _HklLattice
 	HklParameter *beta;
 	HklParameter *gamma;
 	HklParameter *volume;
+	struct HklLatticeCache *cache; /* the memoised B matrix */
 };
 
 #define HKL_LATTICE_ERROR hkl_lattice_error_quark ()
@@ -54,6 +55,8 @@ extern void hkl_lattice_lattice_set(HklLattice *self, const HklLattice *lattice)
 
 extern void hkl_lattice_randomize(HklLattice *self);
 
+extern int hkl_lattice_get_B_derivatives(const HklLattice *self, HklMatrix *B, HklMatrix *dB);
+
 extern void hkl_lattice_fprintf(FILE *f, const HklLattice *self);
 
 G_END_DECLS
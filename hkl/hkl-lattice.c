@@ -22,6 +22,7 @@
 #include <math.h>                       // for cos, sin, M_PI, atan2, sqrt
 #include <stdio.h>                      // for fprintf, FILE
 #include <stdlib.h>                     // for NULL, free
+#include <string.h>                     // for memcmp, memcpy
 #include "hkl-lattice-private.h"        // for _HklLattice
 #include "hkl-macros-private.h"         // for HKL_MALLOC
 #include "hkl-matrix-private.h"         // for _HklMatrix
@@ -32,13 +33,89 @@
 
 /* private */
 
+/* the terms of the B matrix are recomputed only when the parameters
+ * values they depend on have changed. The angles terms and the B
+ * matrix are checked separately, so a change of a length does not
+ * recompute the trigonometric functions. */
+struct HklLatticeCache
+{
+	double angles[3]; /* alpha, beta, gamma of the terms */
+	double c[3]; /* their cosinus */
+	double s[3]; /* their sinus */
+	double D; /* 0 if the angles are not a valid lattice */
+	int angles_valid;
+	double lengths[3]; /* a, b, c of B */
+	HklMatrix B;
+	int B_valid;
+};
+
+static const struct HklLatticeCache *hkl_lattice_cache_get(const HklLattice *self)
+{
+	struct HklLatticeCache *cache = self->cache;
+	const double angles[] = {
+		hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT),
+		hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT),
+		hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT),
+	};
+	const double lengths[] = {
+		hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT),
+		hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT),
+		hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT),
+	};
+
+	if (!cache->angles_valid || memcmp(cache->angles, angles, sizeof(angles))){
+		const double *c = cache->c;
+		size_t i;
+		double D;
+
+		for(i=0; i<3; ++i){
+			cache->c[i] = cos(angles[i]);
+			cache->s[i] = sin(angles[i]);
+		}
+		D = 1 - c[0]*c[0] - c[1]*c[1] - c[2]*c[2] + 2*c[0]*c[1]*c[2];
+		cache->D = D > 0. ? sqrt(D) : 0.;
+		memcpy(cache->angles, angles, sizeof(angles));
+		cache->angles_valid = TRUE;
+		cache->B_valid = FALSE;
+	}
+
+	if (cache->D > 0. && (!cache->B_valid || memcmp(cache->lengths, lengths, sizeof(lengths)))){
+		const double c_alpha = cache->c[0], c_beta = cache->c[1], c_gamma = cache->c[2];
+		const double s_alpha = cache->s[0], s_beta = cache->s[1], s_gamma = cache->s[2];
+		const double D = cache->D;
+		HklMatrix *B = &cache->B;
+		double b11, b22, tmp;
+
+		b11 = HKL_TAU / (lengths[1] * s_alpha);
+		b22 = HKL_TAU / lengths[2];
+		tmp = b22 / s_alpha;
+
+		B->data[0][0] = HKL_TAU * s_alpha / (lengths[0] * D);
+		B->data[0][1] = b11 / D * (c_alpha*c_beta - c_gamma);
+		B->data[0][2] = tmp / D * (c_gamma*c_alpha - c_beta);
+
+		B->data[1][0] = 0;
+		B->data[1][1] = b11;
+		B->data[1][2] = tmp / (s_beta*s_gamma) * (c_beta*c_gamma - c_alpha);
+
+		B->data[2][0] = 0;
+		B->data[2][1] = 0;
+		B->data[2][2] = b22;
+
+		memcpy(cache->lengths, lengths, sizeof(lengths));
+		cache->B_valid = TRUE;
+	}
+
+	return cache;
+}
+
 static double convert_to_default(const HklParameter *p, double value, HklUnitEnum unit_type)
 {
 	switch(unit_type){
 	case HKL_UNIT_DEFAULT:
 		return value;
 	case HKL_UNIT_USER:
-		return value / hkl_unit_factor(p->unit, p->punit);
+		return value / p->factor;
 	default:
 		return NAN;
 	}
@@ -202,6 +279,8 @@ HklLattice *hkl_lattice_new(double a, double b, double c,
 		self->volume = parameter;
 	}
 
+	self->cache = g_new0(struct HklLatticeCache, 1);
+
 	return self;
 
 free_gamma:
@@ -239,6 +318,8 @@ HklLattice *hkl_lattice_new_copy(const HklLattice *self)
 	copy->beta = hkl_parameter_new_copy(self->beta);
 	copy->gamma = hkl_parameter_new_copy(self->gamma);
 	copy->volume = hkl_parameter_new_copy(self->volume);
+	copy->cache = g_new(struct HklLatticeCache, 1);
+	*copy->cache = *self->cache;
 
 	return copy;
 }
@@ -272,6 +353,7 @@ void hkl_lattice_free(HklLattice *self)
 	hkl_parameter_free(self->beta);
 	hkl_parameter_free(self->gamma);
 	hkl_parameter_free(self->volume);
+	g_free(self->cache);
 	free(self);
 }
 
@@ -602,42 +684,91 @@ void hkl_lattice_get(const HklLattice *self,
  **/
 int hkl_lattice_get_B(const HklLattice *self, HklMatrix *B)
 {
-	double D;
-	double c_alpha, s_alpha;
-	double c_beta, s_beta;
-	double c_gamma, s_gamma;
-	double b11, b22, tmp;
-
-	c_alpha = cos(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
-	c_beta = cos(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
-	c_gamma = cos(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
-	D = 1 - c_alpha*c_alpha - c_beta*c_beta - c_gamma*c_gamma
-		+ 2*c_alpha*c_beta*c_gamma;
-
-	if (D > 0.)
-		D = sqrt(D);
+	const struct HklLatticeCache *cache = hkl_lattice_cache_get(self);
+
+	if (cache->D > 0.)
+		*B = cache->B;
 	else
 		return FALSE;
 
-	s_alpha = sin(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
-	s_beta  = sin(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
-	s_gamma = sin(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
-
-	b11 = HKL_TAU / (hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT) * s_alpha);
-	b22 = HKL_TAU / hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT);
-	tmp = b22 / s_alpha;
+	return TRUE;
+}
 
-	B->data[0][0] = HKL_TAU * s_alpha / (hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT) * D);
-	B->data[0][1] = b11 / D * (c_alpha*c_beta - c_gamma);
-	B->data[0][2] = tmp / D * (c_gamma*c_alpha - c_beta);
+/**
+ * hkl_lattice_get_B_derivatives: (skip)
+ * @self: the @HklLattice
+ * @B: (out): where to store the B matrix
+ * @dB: (out): the 6 derivatives of B with respect to a, b, c, alpha,
+ * beta and gamma
+ *
+ * Get the B matrix and its analytic derivatives, used by the
+ * least-squares refinement of the sample.
+ *
+ * Returns: FALSE if the lattice parameters are not valid.
+ **/
+int hkl_lattice_get_B_derivatives(const HklLattice *self, HklMatrix *B, HklMatrix *dB)
+{
+	const double a = hkl_parameter_value_get(self->a, HKL_UNIT_DEFAULT);
+	const double b = hkl_parameter_value_get(self->b, HKL_UNIT_DEFAULT);
+	const double c = hkl_parameter_value_get(self->c, HKL_UNIT_DEFAULT);
+	const struct HklLatticeCache *cache;
+	const double *cs;
+	const double *ss;
+	double D;
+	size_t k;
 
-	B->data[1][0] = 0;
-	B->data[1][1] = b11;
-	B->data[1][2] = tmp / (s_beta*s_gamma) * (c_beta*c_gamma - c_alpha);
+	if (!hkl_lattice_get_B(self, B))
+		return FALSE;
 
-	B->data[2][0] = 0;
-	B->data[2][1] = 0;
-	B->data[2][2] = b22;
+	cache = hkl_lattice_cache_get(self);
+	cs = cache->c;
+	ss = cache->s;
+	D = cache->D;
+
+	/* the lengths only scale the rows */
+	for(k=0; k<3; ++k)
+		hkl_matrix_init(&dB[k], 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	dB[0].data[0][0] = -B->data[0][0] / a;
+	dB[1].data[0][1] = -B->data[0][1] / b;
+	dB[1].data[1][1] = -B->data[1][1] / b;
+	dB[2].data[0][2] = -B->data[0][2] / c;
+	dB[2].data[1][2] = -B->data[1][2] / c;
+	dB[2].data[2][2] = -B->data[2][2] / c;
+
+	/* the angles, d(N / P) = (dN P - N dP) / P^2 for each term */
+	for(k=0; k<3; ++k){
+		double dc[3] = {0, 0, 0};
+		double ds[3] = {0, 0, 0};
+		double dD, N, dN, P, dP;
+		HklMatrix *m = &dB[3 + k];
+
+		dc[k] = -ss[k];
+		ds[k] = cs[k];
+		dD = ss[k] * (cs[k] - cs[(k + 1) % 3] * cs[(k + 2) % 3]) / D;
+
+		hkl_matrix_init(m, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+		m->data[0][0] = HKL_TAU / a * (ds[0] * D - ss[0] * dD) / (D * D);
+
+		P = ss[0] * D;
+		dP = ds[0] * D + ss[0] * dD;
+
+		N = cs[0] * cs[1] - cs[2];
+		dN = dc[0] * cs[1] + cs[0] * dc[1] - dc[2];
+		m->data[0][1] = HKL_TAU / b * (dN * P - N * dP) / (P * P);
+
+		N = cs[2] * cs[0] - cs[1];
+		dN = dc[2] * cs[0] + cs[2] * dc[0] - dc[1];
+		m->data[0][2] = HKL_TAU / c * (dN * P - N * dP) / (P * P);
+
+		m->data[1][1] = -HKL_TAU / b * ds[0] / (ss[0] * ss[0]);
+
+		P = ss[0] * ss[1] * ss[2];
+		dP = ds[0] * ss[1] * ss[2] + ss[0] * ds[1] * ss[2] + ss[0] * ss[1] * ds[2];
+		N = cs[1] * cs[2] - cs[0];
+		dN = dc[1] * cs[2] + cs[1] * dc[2] - dc[0];
+		m->data[1][2] = HKL_TAU / c * (dN * P - N * dP) / (P * P);
+	}
 
 	return TRUE;
 }
@@ -708,6 +839,7 @@ int hkl_lattice_get_1_B(const HklLattice *self, HklMatrix *B)
  **/
 int hkl_lattice_reciprocal(const HklLattice *self, HklLattice *reciprocal)
 {
+	const struct HklLatticeCache *cache = hkl_lattice_cache_get(self);
 	double c_alpha, c_beta, c_gamma;
 	double s_alpha, s_beta, s_gamma;
 	double c_beta1, c_beta2, c_beta3;
@@ -715,20 +847,16 @@ int hkl_lattice_reciprocal(const HklLattice *self, HklLattice *reciprocal)
 	double s_beta_s_gamma, s_gamma_s_alpha, s_alpha_s_beta;
 	double D;
 
-	c_alpha = cos(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
-	c_beta  = cos(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
-	c_gamma = cos(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
-	D = 1 - c_alpha*c_alpha - c_beta*c_beta - c_gamma*c_gamma
-		+ 2*c_alpha*c_beta*c_gamma;
-
-	if (D > 0.)
-		D = sqrt(D);
-	else
+	D = cache->D;
+	if (!(D > 0.))
 		return FALSE;
 
-	s_alpha = sin(hkl_parameter_value_get(self->alpha, HKL_UNIT_DEFAULT));
-	s_beta  = sin(hkl_parameter_value_get(self->beta, HKL_UNIT_DEFAULT));
-	s_gamma = sin(hkl_parameter_value_get(self->gamma, HKL_UNIT_DEFAULT));
+	c_alpha = cache->c[0];
+	c_beta  = cache->c[1];
+	c_gamma = cache->c[2];
+	s_alpha = cache->s[0];
+	s_beta  = cache->s[1];
+	s_gamma = cache->s[2];
 
 	s_beta_s_gamma  = s_beta  * s_gamma;
 	s_gamma_s_alpha = s_gamma * s_alpha;
@@ -48,7 +48,29 @@ extern void hkl_matrix_fprintf(FILE *file, const HklMatrix *self);
 extern void hkl_matrix_to_euler(const HklMatrix *self,
 				double *euler_x, double *euler_y, double *euler_z);
 
-extern void hkl_matrix_times_vector(const HklMatrix *self, HklVector *v);
+/**
+ * hkl_matrix_times_vector:
+ * @self: the #HklMatrix use to multiply the #HklVector
+ * @v: the #HklVector multiply by the #HklMatrix
+ *
+ * multiply an #HklVector by an #HklMatrix
+ **/
+static inline void hkl_matrix_times_vector(const HklMatrix *self, HklVector *v)
+{
+	HklVector tmp;
+	double *Tmp;
+	double *V = v->data;
+	double const (*M)[3] = self->data;
+
+	tmp = *v;
+	Tmp = tmp.data;
+
+	V[0] = Tmp[0]*M[0][0] + Tmp[1]*M[0][1] + Tmp[2]*M[0][2];
+	V[1] = Tmp[0]*M[1][0] + Tmp[1]*M[1][1] + Tmp[2]*M[1][2];
+	V[2] = Tmp[0]*M[2][0] + Tmp[1]*M[2][1] + Tmp[2]*M[2][2];
+}
+
+extern void hkl_matrix_times_vector_array(const HklMatrix *self, double v[], size_t n);
 
 extern void hkl_matrix_transpose(HklMatrix *self);
 
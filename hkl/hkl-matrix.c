@@ -336,25 +336,32 @@ void hkl_matrix_times_matrix(HklMatrix *self, const HklMatrix *m)
 
 
 /**
- * hkl_matrix_times_vector:
- * @self: the #HklMatrix use to multiply the #HklVector
- * @v: the #HklVector multiply by the #HklMatrix
- *
- * multiply an #HklVector by an #HklMatrix
+ * hkl_matrix_times_vector_array: (skip)
+ * @self: the #HklMatrix use to multiply the vectors
+ * @v: the vectors multiply by the #HklMatrix, all the x coordinates
+ *     first, then all the y and all the z
+ * @n: the number of vectors
+ *
+ * multiply @n vectors by the same #HklMatrix. The loop is written
+ * without branch so that the compiler can vectorise it.
  **/
-void hkl_matrix_times_vector(const HklMatrix *self, HklVector *v)
+void hkl_matrix_times_vector_array(const HklMatrix *self, double v[], size_t n)
 {
-	HklVector tmp;
-	double *Tmp;
-	double *V = v->data;
-	double const (*M)[3] = self->data;
-
-	tmp = *v;
-	Tmp = tmp.data;
-
-	V[0] = Tmp[0]*M[0][0] + Tmp[1]*M[0][1] + Tmp[2]*M[0][2];
-	V[1] = Tmp[0]*M[1][0] + Tmp[1]*M[1][1] + Tmp[2]*M[1][2];
-	V[2] = Tmp[0]*M[2][0] + Tmp[1]*M[2][1] + Tmp[2]*M[2][2];
+	double *restrict x = &v[0 * n];
+	double *restrict y = &v[1 * n];
+	double *restrict z = &v[2 * n];
+	const HklMatrix m = *self;
+	size_t i;
+
+	for(i=0; i<n; ++i){
+		double v0 = x[i];
+		double v1 = y[i];
+		double v2 = z[i];
+
+		x[i] = v0*m.data[0][0] + v1*m.data[0][1] + v2*m.data[0][2];
+		y[i] = v0*m.data[1][0] + v1*m.data[1][1] + v2*m.data[1][2];
+		z[i] = v0*m.data[2][0] + v1*m.data[2][1] + v2*m.data[2][2];
+	}
 }
 
 
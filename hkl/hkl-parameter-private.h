@@ -53,17 +53,20 @@ struct _HklParameter {
 	double _value;
 	const HklUnit *unit;
 	const HklUnit *punit;
+	double factor; /* hkl_unit_factor(unit, punit), set with the units */
 	int fit;
 	int changed;
+	double velocity; /* the motor limits, 0 for no limit */
+	double acceleration;
 	const HklParameterOperations *ops;
         HklParameterType type;
 };
 
-#define HKL_PARAMETER_DEFAULTS .name="dummy", .description="no description", .range={.min=-DBL_MAX, .max=DBL_MAX}, ._value=0, .unit=NULL, .punit=NULL, .fit=TRUE, .changed=TRUE, .ops = &hkl_parameter_operations_defaults
+#define HKL_PARAMETER_DEFAULTS .name="dummy", .description="no description", .range={.min=-DBL_MAX, .max=DBL_MAX}, ._value=0, .unit=NULL, .punit=NULL, .factor=1, .fit=TRUE, .changed=TRUE, .ops = &hkl_parameter_operations_defaults
 
 #define HKL_PARAMETER_DEFAULTS_LENGTH HKL_PARAMETER_DEFAULTS, .unit = &hkl_unit_length_meter, .punit = &hkl_unit_length_meter
 
-#define HKL_PARAMETER_DEFAULTS_ANGLE HKL_PARAMETER_DEFAULTS, .range={.min=-M_PI, .max=M_PI}, .unit = &hkl_unit_angle_rad, .punit = &hkl_unit_angle_deg
+#define HKL_PARAMETER_DEFAULTS_ANGLE HKL_PARAMETER_DEFAULTS, .range={.min=-M_PI, .max=M_PI}, .unit = &hkl_unit_angle_rad, .punit = &hkl_unit_angle_deg, .factor = HKL_RADTODEG
 
 #define HKL_PARAMETER_ERROR hkl_parameter_error_quark ()
 
@@ -83,6 +86,7 @@ typedef enum {
 /****************/
 
 struct _HklParameterOperations {
+	size_t                size; /* of the type starting with the HklParameter */
 	HklParameter *        (*copy)(const HklParameter *self);
 	void                  (*free)(HklParameter *self);
 	int                   (*init_copy)(HklParameter *self, const HklParameter *src,
@@ -106,7 +110,8 @@ struct _HklParameterOperations {
 };
 
 #define HKL_PARAMETER_OPERATIONS_DEFAULTS				\
-	.copy = hkl_parameter_copy_real,				\
+	.size = sizeof(HklParameter),					\
+		.copy = hkl_parameter_copy_real,			\
 		.free = hkl_parameter_free_real,			\
 		.init_copy = hkl_parameter_init_copy_real,		\
 		.get_value_closest = hkl_parameter_value_get_closest_real, \
@@ -150,6 +155,27 @@ static inline int hkl_parameter_init_copy_real(HklParameter *self, const HklPara
 	return TRUE;
 }
 
+/* the time of a trapezoidal move from the value to value, 0 without
+ * motion limits */
+static inline double hkl_parameter_motion_time(const HklParameter *self, double value)
+{
+	const double v = self->velocity;
+	const double a = self->acceleration;
+	const double d = fabs(value - self->_value);
+
+	if (v > 0 && a > 0){
+		/* the velocity is reached after v²/a */
+		if (d * a <= v * v)
+			return 2. * sqrt(d / a);
+		return d / v + v / a;
+	}
+	if (v > 0)
+		return d / v;
+	if (a > 0)
+		return 2. * sqrt(d / a);
+	return 0.;
+}
+
 static inline double hkl_parameter_value_get_closest_real(const HklParameter *self,
 							  UNUSED const HklParameter *ref)
 {
@@ -159,6 +185,8 @@ static inline double hkl_parameter_value_get_closest_real(const HklParameter *se
 static inline int hkl_parameter_value_set_real(HklParameter *self, double value,
 					       HklUnitEnum unit_type, GError **error)
 {
+	double old = self->_value;
+
 	hkl_error (error == NULL || *error == NULL);
 
 	if (!isfinite(value)){
@@ -175,14 +203,25 @@ static inline int hkl_parameter_value_set_real(HklParameter *self, double value,
 		self->_value = value;
 		break;
 	case HKL_UNIT_USER:
-		self->_value = value / hkl_unit_factor(self->unit, self->punit);
+		self->_value = value / self->factor;
 		break;
 	}
-	self->changed = TRUE;
+	/* the solvers write all their axes at each evaluation, the
+	 * holders are only recomputed from the axes which moved */
+	if (self->_value != old)
+		self->changed = TRUE;
 
 	return TRUE;
 }
 
+/* the factor to convert a default unit value into the unit_type one,
+ * used by the bulk getters to avoid a call per parameter */
+static inline double hkl_parameter_unit_factor(const HklParameter *self,
+					       HklUnitEnum unit_type)
+{
+	return HKL_UNIT_USER == unit_type ? self->factor : 1.;
+}
+
 static inline void hkl_parameter_value_set_smallest_in_range_real(UNUSED HklParameter *self)
 {
 	/* DOES NOTHING for a standard parameter */
@@ -214,7 +253,7 @@ static inline int hkl_parameter_is_valid_real(const HklParameter *self)
 
 static inline void hkl_parameter_fprintf_real(FILE *f, const HklParameter *self)
 {
-	double factor = hkl_unit_factor(self->unit, self->punit);
+	double factor = self->factor;
 	if (self->punit)
 		fprintf(f, "\"%s\" : %.7f %s [%.7f : %.7f] (%d)",
 			self->name,
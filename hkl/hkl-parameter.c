@@ -89,8 +89,11 @@ static int hkl_parameter_init(HklParameter *self, const char *name,
         self->_value = value;
         self->unit = unit;
         self->punit = punit;
+        self->factor = hkl_unit_factor(unit, punit);
         self->fit = fit;
         self->changed = changed;
+        self->velocity = 0.;
+        self->acceleration = 0.;
         self->ops = &hkl_parameter_operations_defaults;
         self->type = Parameter();
 
@@ -225,7 +228,7 @@ inline double hkl_parameter_value_get(const HklParameter *self,
 		return self->_value;
 		break;
 	case HKL_UNIT_USER:
-		return self->_value * hkl_unit_factor(self->unit, self->punit);
+		return self->_value * self->factor;
 		break;
 	default:
 		return NAN;
@@ -295,7 +298,7 @@ void hkl_parameter_min_max_get(const HklParameter *self, double *min, double *ma
 		*max = self->range.max;
 		break;
 	case HKL_UNIT_USER:
-		factor = hkl_unit_factor(self->unit, self->punit);
+		factor = self->factor;
 		*min = factor * self->range.min;
 		*max = factor * self->range.max;
 		break;
@@ -357,7 +360,7 @@ int hkl_parameter_min_max_set(HklParameter *self, double min, double max,
 		self->range.max = max;
 		break;
 	case HKL_UNIT_USER:
-		factor = hkl_unit_factor(self->unit, self->punit);
+		factor = self->factor;
 		self->range.min = min / factor;
 		self->range.max = max / factor;
 		break;
@@ -366,6 +369,66 @@ int hkl_parameter_min_max_set(HklParameter *self, double min, double max,
 	return TRUE;
 }
 
+/**
+ * hkl_parameter_motion_get:
+ * @self: the this ptr
+ * @velocity: (out caller-allocates): the returned maximum velocity
+ * @acceleration: (out caller-allocates): the returned maximum acceleration
+ * @unit_type: the unit type (default or user) of the returned values
+ *
+ * get the motor limits of the #HklParameter, per second and per
+ * second², 0 if there is no limit.
+ **/
+void hkl_parameter_motion_get(const HklParameter *self,
+			      double *velocity, double *acceleration,
+			      HklUnitEnum unit_type)
+{
+	double factor;
+
+	switch (unit_type){
+	case HKL_UNIT_DEFAULT:
+		*velocity = self->velocity;
+		*acceleration = self->acceleration;
+		break;
+	case HKL_UNIT_USER:
+		factor = self->factor;
+		*velocity = factor * self->velocity;
+		*acceleration = factor * self->acceleration;
+		break;
+	}
+}
+
+/**
+ * hkl_parameter_motion_set:
+ * @self: the this ptr
+ * @velocity: the maximum velocity, 0 for no limit
+ * @acceleration: the maximum acceleration, 0 for no limit
+ * @unit_type: the unit type (default or user) of the values
+ *
+ * set the motor limits of the #HklParameter used to compute the time
+ * of a move, see hkl_engine_sort_set.
+ **/
+void hkl_parameter_motion_set(HklParameter *self,
+			      double velocity, double acceleration,
+			      HklUnitEnum unit_type)
+{
+	double factor;
+
+	g_return_if_fail(velocity >= 0 && acceleration >= 0);
+
+	switch (unit_type){
+	case HKL_UNIT_DEFAULT:
+		self->velocity = velocity;
+		self->acceleration = acceleration;
+		break;
+	case HKL_UNIT_USER:
+		factor = self->factor;
+		self->velocity = velocity / factor;
+		self->acceleration = acceleration / factor;
+		break;
+	}
+}
+
 /**
  * hkl_parameter_fit_get:
  * @self: the this ptr
@@ -451,7 +514,7 @@ int hkl_parameter_is_valid_range(const HklParameter *self)
  **/
 void hkl_parameter_fprintf(FILE *f, const HklParameter *self)
 {
-	double factor = hkl_unit_factor(self->unit, self->punit);
+	double factor = self->factor;
 	if (self->punit)
 		fprintf(f, "\"%s\" : %.7f %s [%.7f : %.7f] (%d)",
 			self->name,
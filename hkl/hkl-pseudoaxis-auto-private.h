@@ -22,6 +22,7 @@
 #ifndef __HKL_PSEUDOAXIS_AUTO_H__
 #define __HKL_PSEUDOAXIS_AUTO_H__
 
+#include <gsl/gsl_matrix_double.h>      // for gsl_matrix
 #include <gsl/gsl_vector_double.h>      // for gsl_vector
 #include <stddef.h>                     // for NULL
 #include <sys/types.h>                  // for uint
@@ -47,8 +48,24 @@ struct _HklFunction
 {
 	const uint size;
 	int (* function) (const gsl_vector *x, void *params, gsl_vector *f);
+	/* optional analytic derivatives, GSL_EUNIMPL falls back on
+	 * finite differences */
+	int (* jacobian) (const gsl_vector *x, void *params, gsl_matrix *J);
+	/* optional closed form solutions, at most n rows of size
+	 * values written in x, the axes of the engine can be
+	 * modified. Without any solution the numerical solver is
+	 * used. */
+	size_t (* solutions) (HklEngine *engine, double x[], size_t n);
+	/* optional evaluation of n candidates at once, x[i * n + k]
+	 * being the axis i of the candidate k and f[j * n + k] the
+	 * value j of its function, NAN if it can not be computed. The
+	 * geometry may be modified like with function. */
+	int (* batch) (const double x[], size_t n, void *params, double f[]);
 };
 
+/* the maximum number of closed form solutions of a function */
+#define HKL_FUNCTION_SOLUTIONS_MAX 12
+
 typedef darray(const HklFunction*) darray_function;
 
 struct _HklModeAutoInfo {
@@ -58,7 +75,8 @@ struct _HklModeAutoInfo {
 
 #define HKL_MODE_OPERATIONS_AUTO_DEFAULTS	\
 	HKL_MODE_OPERATIONS_DEFAULTS,		\
-		.set = hkl_mode_auto_set_real
+		.set = hkl_mode_auto_set_real,	\
+		.velocities = hkl_mode_auto_velocities_real
 
 #define CHECK_NAN(x, len) do{				\
 		for(uint i=0; i<len; ++i)		\
@@ -86,6 +104,12 @@ extern int hkl_mode_auto_set_real(HklMode *self,
 				  HklSample *sample,
 				  GError **error);
 
+extern int hkl_mode_auto_velocities_real(HklMode *self,
+					 HklEngine *engine,
+					 const double velocities[],
+					 double axes[],
+					 GError **error);
+
 /***********************/
 /* HklModeAutoWithInit */
 /***********************/
@@ -112,6 +136,7 @@ typedef enum {
 	HKL_MODE_OPERATIONS_AUTO_DEFAULTS,				\
 		.capabilities = HKL_ENGINE_CAPABILITIES_READABLE | HKL_ENGINE_CAPABILITIES_WRITABLE | HKL_ENGINE_CAPABILITIES_INITIALIZABLE, \
 		.free = hkl_mode_auto_with_init_free_real,		\
+		.init_copy = hkl_mode_auto_with_init_init_copy_real,	\
 		.initialized_set = hkl_mode_auto_with_init_initialized_set_real
 
 static NEEDED void hkl_mode_auto_with_init_free_real(HklMode *mode)
@@ -129,6 +154,28 @@ static NEEDED void hkl_mode_auto_with_init_free_real(HklMode *mode)
 }
 
 
+static NEEDED void hkl_mode_auto_with_init_init_copy_real(HklMode *mode,
+							  const HklMode *src)
+{
+	HklModeAutoWithInit *self = container_of(mode, HklModeAutoWithInit, mode);
+	const HklModeAutoWithInit *self_src = container_of(src, HklModeAutoWithInit, mode);
+
+	hkl_mode_init_copy_real(mode, src);
+
+	if(self->geometry)
+		hkl_geometry_free(self->geometry);
+	self->geometry = self_src->geometry ? hkl_geometry_new_copy(self_src->geometry) : NULL;
+
+	if(self->detector)
+		hkl_detector_free(self->detector);
+	self->detector = self_src->detector ? hkl_detector_new_copy(self_src->detector) : NULL;
+
+	if(self->sample)
+		hkl_sample_free(self->sample);
+	self->sample = self_src->sample ? hkl_sample_new_copy(self_src->sample) : NULL;
+}
+
+
 static NEEDED int hkl_mode_auto_with_init_initialized_set_real(HklMode *mode,
 							       HklEngine *engine,
 							       HklGeometry *geometry,
@@ -21,17 +21,24 @@
  */
 #include <alloca.h>                     // for alloca
 #include <gsl/gsl_errno.h>              // for ::GSL_CONTINUE
+#include <gsl/gsl_linalg.h>             // for gsl_linalg_SV_decomp, etc
 #include <gsl/gsl_machine.h>            // for GSL_SQRT_DBL_EPSILON
 #include <gsl/gsl_matrix_double.h>      // for gsl_matrix_alloc, etc
 #include <gsl/gsl_multiroots.h>         // for gsl_multiroot_function, etc
+#include <gsl/gsl_nan.h>                // for GSL_NAN, GSL_POSINF
+#include <gsl/gsl_qrng.h>               // for gsl_qrng_sobol, etc
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
+#include <gsl/gsl_sys.h>                // for gsl_isnan
 #include <gsl/gsl_vector_double.h>      // for gsl_vector, etc
-#include <math.h>                       // for fabs, M_PI
+#include <math.h>                       // for fabs, floor, M_PI
 #include <stddef.h>                     // for size_t
-#include <stdlib.h>                     // for rand, RAND_MAX
+#include <stdint.h>                     // for uint64_t
+#include <stdlib.h>                     // for malloc, free
 #include <string.h>                     // for NULL, memset, memcpy
 #include <sys/types.h>                  // for uint
 #include "hkl-geometry-private.h"       // for hkl_geometry_update
 #include "hkl-macros-private.h"         // for HKL_MALLOC, hkl_assert, etc
+#include "hkl-matrix-private.h"         // for _HklMatrix
 #include "hkl-parameter-private.h"      // for _HklParameter
 #include "hkl-pseudoaxis-auto-private.h"  // for HklModeAutoInfo, etc
 #include "hkl-pseudoaxis-private.h"     // for _HklEngine, HklModeInfo, etc
@@ -50,16 +57,407 @@ static GQuark hkl_mode_auto_error_quark (void)
 
 typedef enum {
 	HKL_MODE_AUTO_ERROR_SET, /* can not set the engine */
+	HKL_MODE_AUTO_ERROR_VELOCITIES, /* can not compute the axes velocities */
 } HklModeAutoError;
 
 /*********************************************/
 /* methods use to solve numerical pseudoAxes */
 /*********************************************/
 
+/**
+ * @brief get the solver buffers of the engine for n axes.
+ *
+ * The buffers are allocated on the first solve and kept by the
+ * engine until the size of the mode functions changes.
+ */
+static HklEngineWorkspace *workspace_get(HklEngine *engine, size_t n)
+{
+	HklEngineWorkspace *self = &engine->workspace;
+
+	if (self->n != n) {
+		hkl_engine_workspace_release(self);
+		self->n = n;
+		self->x = gsl_vector_alloc(n);
+		self->_x = gsl_vector_alloc(n);
+		self->_f = gsl_vector_alloc(n);
+		self->J = gsl_matrix_alloc(n, n);
+	}
+
+	return self;
+}
+
+/* the largest system solved by the built-in Newton solver */
+#define HKL_MODE_AUTO_NEWTON_MAX 6
+
+/* halvings of the Newton step before giving up on a direction */
+#define HKL_MODE_AUTO_NEWTON_BACKTRACK 10
+
+/**
+ * @brief the stack resident state of the built-in Newton solver.
+ *
+ * The vectors and the matrix are gsl views on the arrays of the
+ * struct, so nothing is allocated during a solve.
+ */
+struct newton {
+	size_t n; /* 0 when the gsl solver is used */
+	int fresh; /* J was computed at x, not updated by Broyden */
+	double x[HKL_MODE_AUTO_NEWTON_MAX];
+	double f[HKL_MODE_AUTO_NEWTON_MAX];
+	double J[HKL_MODE_AUTO_NEWTON_MAX * HKL_MODE_AUTO_NEWTON_MAX];
+	gsl_vector_view x_v;
+	gsl_vector_view f_v;
+	gsl_matrix_view J_v;
+};
+
+/**
+ * @brief the multiroot solver of a mode function.
+ *
+ * The small systems are solved by a damped Newton method using the
+ * analytic derivatives of the function when available, otherwise a
+ * finite differences jacobian updated by Broyden. When Newton can not
+ * progress from a starting point, the gsl hybridsj fdfsolver (or the
+ * hybrid fsolver without derivatives) takes over from there.
+ */
+struct solver {
+	const HklFunction *function;
+	gsl_multiroot_function *f;
+	gsl_multiroot_function counted; /* f with the evaluations counted */
+	gsl_multiroot_function_fdf fdf;
+	int analytic; /* the function provides its derivatives */
+	struct newton newton;
+	gsl_multiroot_fsolver *fs;
+	gsl_multiroot_fdfsolver *fdfs;
+};
+
+static int solver_function(const gsl_vector *x, void *params, gsl_vector *f)
+{
+	struct solver *self = params;
+	HklEngine *engine = self->f->params;
+
+	engine->stats.evaluations++;
+
+	return GSL_MULTIROOT_FN_EVAL(self->f, x, f);
+}
+
+static int solver_jacobian_function(const gsl_vector *x, void *params, gsl_matrix *J)
+{
+	struct solver *self = params;
+
+	return self->function->jacobian(x, self->f->params, J);
+}
+
+static int solver_fdf_function(const gsl_vector *x, void *params,
+			       gsl_vector *f, gsl_matrix *J)
+{
+	int status = solver_function(x, params, f);
+
+	if (GSL_SUCCESS == status)
+		status = solver_jacobian_function(x, params, J);
+
+	return status;
+}
+
+static int newton_eval(struct solver *self, double x[], double f[])
+{
+	size_t n = self->f->n;
+	gsl_vector_view x_v = gsl_vector_view_array(x, n);
+	gsl_vector_view f_v = gsl_vector_view_array(f, n);
+
+	return solver_function(&x_v.vector, self, &f_v.vector);
+}
+
+/* the jacobian at x, forward differences as gsl_multiroot_fdjacobian */
+static int newton_jacobian(struct solver *self)
+{
+	struct newton *newton = &self->newton;
+	size_t n = newton->n;
+	size_t i, j;
+
+	newton->fresh = TRUE;
+
+	if (self->analytic)
+		return self->function->jacobian(&newton->x_v.vector,
+						self->f->params,
+						&newton->J_v.matrix);
+
+	for(j=0; j<n; ++j){
+		double f1[HKL_MODE_AUTO_NEWTON_MAX];
+		double xj = newton->x[j];
+		double dx = GSL_SQRT_DBL_EPSILON * fabs(xj);
+		int status;
+
+		if (dx == 0.0)
+			dx = GSL_SQRT_DBL_EPSILON;
+		newton->x[j] = xj + dx;
+		status = newton_eval(self, newton->x, f1);
+		newton->x[j] = xj;
+		if (status)
+			return status;
+		for(i=0; i<n; ++i)
+			newton->J[i * n + j] = (f1[i] - newton->f[i]) / dx;
+	}
+
+	return GSL_SUCCESS;
+}
+
+/* solve J dx = -f by a LU decomposition with partial pivoting */
+static int newton_step(const struct newton *self, double dx[])
+{
+	size_t n = self->n;
+	double A[HKL_MODE_AUTO_NEWTON_MAX * HKL_MODE_AUTO_NEWTON_MAX];
+	double norm = 0;
+	size_t i, j, k;
+
+	memcpy(A, self->J, n * n * sizeof(double));
+	for(i=0; i<n; ++i){
+		dx[i] = -self->f[i];
+		for(j=0; j<n; ++j)
+			norm = fmax(norm, fabs(A[i * n + j]));
+	}
+
+	for(k=0; k<n; ++k){
+		size_t p = k;
+
+		for(i=k+1; i<n; ++i)
+			if (fabs(A[i * n + k]) > fabs(A[p * n + k]))
+				p = i;
+		if (!(fabs(A[p * n + k]) > GSL_DBL_EPSILON * n * norm))
+			return GSL_ESING;
+		if (p != k) {
+			double tmp;
+
+			for(j=0; j<n; ++j){
+				tmp = A[k * n + j];
+				A[k * n + j] = A[p * n + j];
+				A[p * n + j] = tmp;
+			}
+			tmp = dx[k];
+			dx[k] = dx[p];
+			dx[p] = tmp;
+		}
+		for(i=k+1; i<n; ++i){
+			double l = A[i * n + k] / A[k * n + k];
+
+			for(j=k+1; j<n; ++j)
+				A[i * n + j] -= l * A[k * n + j];
+			dx[i] -= l * dx[k];
+		}
+	}
+
+	for(k=n; k-- > 0;){
+		for(j=k+1; j<n; ++j)
+			dx[k] -= A[k * n + j] * dx[j];
+		dx[k] /= A[k * n + k];
+	}
+
+	return GSL_SUCCESS;
+}
+
+static double newton_norm2(const double f[], size_t n)
+{
+	double res = 0;
+	size_t i;
+
+	for(i=0; i<n; ++i)
+		res += f[i] * f[i];
+
+	return res;
+}
+
+/**
+ * @brief one damped Newton iteration.
+ *
+ * The step is halved until the residual decreases. When a Broyden
+ * jacobian gives no decrease, it is computed again before giving up.
+ *
+ * @return GSL_SUCCESS or an error when the method can not progress.
+ */
+static int newton_iterate(struct solver *self)
+{
+	struct newton *newton = &self->newton;
+	size_t n = newton->n;
+	double x[HKL_MODE_AUTO_NEWTON_MAX];
+	double f[HKL_MODE_AUTO_NEWTON_MAX];
+	double dx[HKL_MODE_AUTO_NEWTON_MAX];
+	double phi0 = newton_norm2(newton->f, n);
+	double lambda;
+	size_t i, j, k;
+	int status;
+
+	for(;;){
+		k = HKL_MODE_AUTO_NEWTON_BACKTRACK;
+		if (GSL_SUCCESS == newton_step(newton, dx))
+			for(lambda=1, k=0; k<HKL_MODE_AUTO_NEWTON_BACKTRACK; ++k, lambda /= 2){
+				for(i=0; i<n; ++i)
+					x[i] = newton->x[i] + lambda * dx[i];
+				if (GSL_SUCCESS == newton_eval(self, x, f)
+				    && newton_norm2(f, n) < (1 - 1e-4 * lambda) * phi0)
+					break;
+			}
+		if (k < HKL_MODE_AUTO_NEWTON_BACKTRACK)
+			break;
+		if (newton->fresh)
+			return GSL_ENOPROG;
+		status = newton_jacobian(self);
+		if (status)
+			return status;
+	}
+
+	if (self->analytic) {
+		memcpy(newton->x, x, n * sizeof(double));
+		memcpy(newton->f, f, n * sizeof(double));
+		return newton_jacobian(self);
+	}
+
+	/* Broyden update J += (df - J s) s^T / s.s */
+	{
+		double s[HKL_MODE_AUTO_NEWTON_MAX];
+		double ss = 0;
+
+		for(j=0; j<n; ++j){
+			s[j] = x[j] - newton->x[j];
+			ss += s[j] * s[j];
+		}
+		if (ss > 0)
+			for(i=0; i<n; ++i){
+				double r = f[i] - newton->f[i];
+
+				for(j=0; j<n; ++j)
+					r -= newton->J[i * n + j] * s[j];
+				for(j=0; j<n; ++j)
+					newton->J[i * n + j] += r * s[j] / ss;
+			}
+		newton->fresh = FALSE;
+	}
+	memcpy(newton->x, x, n * sizeof(double));
+	memcpy(newton->f, f, n * sizeof(double));
+
+	return GSL_SUCCESS;
+}
+
+static void solver_init(struct solver *self,
+			const HklFunction *function,
+			gsl_multiroot_function *f,
+			const gsl_vector *x)
+{
+	HklEngineWorkspace *workspace = workspace_get(f->params, f->n);
+
+	self->function = function;
+	self->f = f;
+	self->counted.f = solver_function;
+	self->counted.n = f->n;
+	self->counted.params = self;
+	self->fdf.f = solver_function;
+	self->fdf.df = solver_jacobian_function;
+	self->fdf.fdf = solver_fdf_function;
+	self->fdf.n = f->n;
+	self->fdf.params = self;
+	self->fs = NULL;
+	self->fdfs = NULL;
+	self->newton.n = 0;
+
+	/* the derivatives may be unavailable for this geometry */
+	self->analytic = function->jacobian
+		&& GSL_EUNIMPL != function->jacobian(x, f->params, workspace->J);
+
+	if (f->n <= HKL_MODE_AUTO_NEWTON_MAX) {
+		self->newton.x_v = gsl_vector_view_array(self->newton.x, f->n);
+		self->newton.f_v = gsl_vector_view_array(self->newton.f, f->n);
+		self->newton.J_v = gsl_matrix_view_array(self->newton.J, f->n, f->n);
+	}
+}
+
+static int solver_gsl_set(struct solver *self, gsl_vector *x)
+{
+	HklEngineWorkspace *workspace = &((HklEngine *)self->f->params)->workspace;
+
+	if (self->analytic) {
+		if (NULL == workspace->fdfs)
+			workspace->fdfs = gsl_multiroot_fdfsolver_alloc(gsl_multiroot_fdfsolver_hybridsj,
+									self->f->n);
+		self->fdfs = workspace->fdfs;
+		return gsl_multiroot_fdfsolver_set(self->fdfs, &self->fdf, x);
+	} else {
+		if (NULL == workspace->fs)
+			workspace->fs = gsl_multiroot_fsolver_alloc(gsl_multiroot_fsolver_hybrid,
+								    self->f->n);
+		self->fs = workspace->fs;
+		return gsl_multiroot_fsolver_set(self->fs, &self->counted, x);
+	}
+}
+
+static int solver_set(struct solver *self, gsl_vector *x)
+{
+	struct newton *newton = &self->newton;
+	int status;
+
+	if (self->f->n > HKL_MODE_AUTO_NEWTON_MAX)
+		return solver_gsl_set(self, x);
+
+	newton->n = self->f->n;
+	memcpy(newton->x, x->data, newton->n * sizeof(double));
+	status = newton_eval(self, newton->x, newton->f);
+	if (GSL_SUCCESS == status)
+		status = newton_jacobian(self);
+	if (status) {
+		newton->n = 0;
+		status = solver_gsl_set(self, x);
+	}
+
+	return status;
+}
+
+static int solver_iterate(struct solver *self)
+{
+	HklEngine *engine = self->f->params;
+
+	engine->stats.iterations++;
+
+	if (self->newton.n) {
+		if (GSL_SUCCESS == newton_iterate(self))
+			return GSL_SUCCESS;
+
+		/* let the gsl solver continue from this point */
+		self->newton.n = 0;
+		solver_gsl_set(self, &self->newton.x_v.vector);
+	}
+
+	if (self->fdfs)
+		return gsl_multiroot_fdfsolver_iterate(self->fdfs);
+	else
+		return gsl_multiroot_fsolver_iterate(self->fs);
+}
+
+static gsl_vector *solver_x_get(const struct solver *self)
+{
+	if (self->newton.n)
+		return (gsl_vector *)&self->newton.x_v.vector;
+
+	return self->fdfs ? self->fdfs->x : self->fs->x;
+}
+
+static gsl_vector *solver_f_get(const struct solver *self)
+{
+	if (self->newton.n)
+		return (gsl_vector *)&self->newton.f_v.vector;
+
+	return self->fdfs ? self->fdfs->f : self->fs->f;
+}
+
+static void solver_jacobian(struct solver *self,
+			    const gsl_vector *x, const gsl_vector *f,
+			    gsl_matrix *J)
+{
+	if (self->analytic)
+		self->function->jacobian(x, self->f->params, J);
+	else
+		gsl_multiroot_fdjacobian(&self->counted, x, f, GSL_SQRT_DBL_EPSILON, J);
+}
+
 /**
  * @brief This private method find the degenerated axes.
  *
- * @param func the gsl_multiroopt_function to test
+ * @param solver the solver of the function to test
  * @param x the starting point
  * @param f the result of the function evaluation.
  *
@@ -70,17 +468,16 @@ typedef enum {
  * change is sector.
  */
 static void find_degenerated_axes(HklEngine *self,
-				  gsl_multiroot_function *func,
+				  struct solver *solver,
 				  gsl_vector const *x, gsl_vector const *f,
 				  int degenerated[])
 {
-	gsl_matrix *J;
+	gsl_matrix *J = workspace_get(self, x->size)->J;
 	size_t i, j;
 
 	memset(degenerated, 0, x->size * sizeof(int));
-	J = gsl_matrix_alloc(x->size, f->size);
 
-	gsl_multiroot_fdjacobian(func, x, f, GSL_SQRT_DBL_EPSILON, J);
+	solver_jacobian(solver, x, f, J);
 	for(j=0; j<x->size && !degenerated[j]; ++j) {
 		for(i=0; i<f->size; ++i)
 			if (fabs(gsl_matrix_get(J, i, j)) > HKL_EPSILON)
@@ -100,13 +497,471 @@ static void find_degenerated_axes(HklEngine *self,
 	}
 	fprintf(stdout, "\n");
 #endif
-	gsl_matrix_free(J);
+}
+
+/* few iterations are enough from a predicted starting point */
+#define HKL_MODE_AUTO_CONTINUATION_MAX_ITER 20
+
+/**
+ * @brief get the last solutions of a function for the current mode.
+ *
+ * @param self the current HklEngine.
+ * @param function the mode function.
+ * @param len the number of axes.
+ */
+static HklEngineContinuation *continuation_get(HklEngine *self,
+					       const HklFunction *function,
+					       size_t len)
+{
+	HklEngineContinuation *continuation;
+
+	darray_foreach(continuation, self->continuations){
+		if (continuation->mode == self->mode
+		    && continuation->function == function)
+			return continuation;
+	}
+
+	darray_append(self->continuations,
+		      ((HklEngineContinuation){
+			      .mode = self->mode,
+			      .function = function,
+			      .len = len,
+			      .n = 0,
+			      .x = malloc(3 * len * sizeof(double)),
+		      }));
+
+	return &darray_item(self->continuations,
+			    darray_size(self->continuations) - 1);
+}
+
+/**
+ * @brief extrapolate the next solution from the last ones.
+ *
+ * @param self the last solutions, at least one.
+ * @param order 0 constant, 1 linear or 2 quadratic.
+ * @param x the predicted starting point.
+ *
+ * the order is reduced when there is not enough solutions.
+ */
+static void continuation_predict(const HklEngineContinuation *self,
+				 unsigned int order, double x[])
+{
+	size_t i;
+	const double *x1 = &self->x[0];
+	const double *x2 = &self->x[self->len];
+	const double *x3 = &self->x[2 * self->len];
+
+	if (order > self->n - 1)
+		order = self->n - 1;
+
+	for(i=0; i<self->len; ++i){
+		switch(order){
+		case 0:
+			x[i] = x1[i];
+			break;
+		case 1:
+			x[i] = 2 * x1[i] - x2[i];
+			break;
+		default:
+			x[i] = 3 * x1[i] - 3 * x2[i] + x3[i];
+			break;
+		}
+	}
+}
+
+static void continuation_push(HklEngineContinuation *self, const double x[])
+{
+	size_t n = self->n < 2 ? self->n : 2;
+
+	memmove(&self->x[self->len], &self->x[0], n * self->len * sizeof(double));
+	memcpy(&self->x[0], x, self->len * sizeof(double));
+	self->n = n + 1;
+}
+
+/**
+ * @brief get the solved targets of a function for the current mode.
+ *
+ * @param self the current HklEngine.
+ * @param function the mode function.
+ * @param len the number of axes.
+ *
+ * the solved targets are forgotten when the UB matrix, the wave
+ * length or the mode parameters changed since the last solve.
+ */
+static HklEngineNeighbours *neighbours_get(HklEngine *self,
+					   const HklFunction *function,
+					   size_t len)
+{
+	const HklMatrix *UB = hkl_sample_UB_get(self->sample);
+	size_t n_context = 9 + 1 + darray_size(self->mode->parameters);
+	double *context = alloca(n_context * sizeof(*context));
+	HklEngineNeighbours *neighbours = NULL;
+	HklEngineNeighbours *item;
+	HklParameter **parameter;
+	size_t i, j, n = 0;
+
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			context[n++] = UB->data[i][j];
+	context[n++] = self->geometry->source.wave_length;
+	darray_foreach(parameter, self->mode->parameters)
+		context[n++] = (*parameter)->_value;
+
+	darray_foreach(item, self->neighbours){
+		if (item->mode == self->mode
+		    && item->function == function){
+			neighbours = item;
+			break;
+		}
+	}
+
+	if (NULL == neighbours){
+		size_t n_targets = darray_size(self->pseudo_axes);
+
+		darray_append(self->neighbours,
+			      ((HklEngineNeighbours){
+				      .mode = self->mode,
+				      .function = function,
+				      .n_targets = n_targets,
+				      .len = len,
+				      .n_context = n_context,
+				      .context = malloc(n_context * sizeof(double)),
+				      .n_max = self->neighbours_n_max,
+				      .n = 0,
+				      .last = 0,
+				      .targets = malloc(self->neighbours_n_max * n_targets * sizeof(double)),
+				      .x = malloc(self->neighbours_n_max * len * sizeof(double)),
+			      }));
+		neighbours = &darray_item(self->neighbours,
+					  darray_size(self->neighbours) - 1);
+	} else if (memcmp(neighbours->context, context, n_context * sizeof(*context)))
+		neighbours->n = 0;
+
+	memcpy(neighbours->context, context, n_context * sizeof(*context));
+
+	return neighbours;
+}
+
+/* the current pseudo axes values of the engine */
+static void neighbours_target_get(const HklEngine *self, double target[])
+{
+	HklParameter **parameter;
+	size_t i = 0;
+
+	darray_foreach(parameter, self->pseudo_axes)
+		target[i++] = (*parameter)->_value;
+}
+
+/**
+ * @brief the solution of the nearest solved target.
+ *
+ * @param self the solved targets.
+ * @param target the pseudo axes values to solve.
+ * @param last set to TRUE if the nearest is the last solved target.
+ *
+ * @return the axes values of the solution or NULL if there is no
+ * solved target yet.
+ */
+static const double *neighbours_nearest(const HklEngineNeighbours *self,
+					const double target[], int *last)
+{
+	double best = INFINITY;
+	size_t nearest = 0;
+	size_t i, k;
+
+	if (0 == self->n)
+		return NULL;
+
+	for(k=0; k<self->n; ++k){
+		const double *t = &self->targets[k * self->n_targets];
+		double d = 0;
+
+		for(i=0; i<self->n_targets; ++i)
+			d += (t[i] - target[i]) * (t[i] - target[i]);
+		/* the most recent wins the ties */
+		if (d < best || (d == best && k == self->last)){
+			best = d;
+			nearest = k;
+		}
+	}
+	*last = nearest == self->last;
+
+	return &self->x[nearest * self->len];
+}
+
+/* the oldest solved target is replaced once the ring is full */
+static void neighbours_push(HklEngineNeighbours *self,
+			    const double target[], const double x[])
+{
+	size_t k;
+
+	if (0 == self->n_max)
+		return;
+
+	k = self->n == 0 ? 0 : (self->last + 1) % self->n_max;
+	memcpy(&self->targets[k * self->n_targets], target, self->n_targets * sizeof(double));
+	memcpy(&self->x[k * self->len], x, self->len * sizeof(double));
+	self->last = k;
+	if (self->n < self->n_max)
+		self->n++;
+}
+
+/* the number of candidates evaluated in one call of a function */
+#define HKL_MODE_AUTO_BATCH 64
+
+/**
+ * @brief evaluate a function for n candidates at once.
+ *
+ * @param engine the current engine.
+ * @param function the mode function.
+ * @param f The gsl_multiroot_function of the function.
+ * @param x the candidates, x[i * n + k] the axis i of the candidate k.
+ * @param n the number of candidates.
+ * @param fx the values, fx[j * n + k] the value j of the candidate k.
+ * @param _x a gsl_vector use to evaluate one candidate (optimization)
+ * @param _f a gsl_vector use to evaluate one candidate (optimization)
+ *
+ * Without a batch method the function is called for each candidate,
+ * the values of a candidate which can not be computed are NAN.
+ */
+static void function_batch(HklEngine *engine,
+			   const HklFunction *function,
+			   gsl_multiroot_function *f,
+			   const double x[], size_t n, double fx[],
+			   gsl_vector *_x, gsl_vector *_f)
+{
+	size_t i, k;
+
+	engine->stats.evaluations += n;
+
+	if (function->batch
+	    && GSL_SUCCESS == function->batch(x, n, f->params, fx))
+		return;
+
+	for(k=0; k<n; ++k){
+		for(i=0; i<f->n; ++i)
+			_x->data[i] = x[i * n + k];
+		if (GSL_SUCCESS == f->f(_x, f->params, _f))
+			for(i=0; i<f->n; ++i)
+				fx[i * n + k] = _f->data[i];
+		else
+			for(i=0; i<f->n; ++i)
+				fx[i * n + k] = GSL_NAN;
+	}
+}
+
+/* number of iterations from each starting point */
+#define HKL_MODE_AUTO_MULTISTART_MAX_ITER 300
+
+/* number of starting points drawn and screened at once */
+#define HKL_MODE_AUTO_MULTISTART_BATCH 8
+
+/* the starting points used when the solver does not converge from
+ * the axes values */
+struct multistart
+{
+	HklEngineMultistart type;
+	size_t len;
+	size_t n;
+	size_t k; /* index of the next point */
+	uint64_t state;
+	double *shift; /* sobol, from the seed, in the engine arena */
+	gsl_qrng *qrng; /* sobol, allocated on the first point */
+	size_t m; /* grid, points per axis */
+	size_t total; /* grid, number of nodes */
+	double *queue; /* the next points, the best first, in the engine arena */
+	size_t n_queue;
+	size_t queue_k; /* index of the next queued point */
+};
+
+/* splitmix64, a small generator without global state */
+static double multistart_random(struct multistart *self)
+{
+	uint64_t z = (self->state += UINT64_C(0x9e3779b97f4a7c15));
+
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	z = z ^ (z >> 31);
+
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void multistart_init(struct multistart *self,
+			    HklEngine *engine, size_t len)
+{
+	self->type = engine->multistart;
+	self->len = len;
+	self->n = engine->multistart_n;
+	self->k = 0;
+	self->state = engine->multistart_seed;
+	self->shift = hkl_engine_arena_alloc(engine, len * sizeof(*self->shift));
+	self->qrng = NULL;
+	self->m = 1;
+	self->total = 1;
+	self->queue = hkl_engine_arena_alloc(engine, HKL_MODE_AUTO_MULTISTART_BATCH * len * sizeof(*self->queue));
+	self->n_queue = 0;
+	self->queue_k = 0;
+
+	/* the gsl sobol generator is limited to 40 dimensions */
+	if (self->type == HKL_ENGINE_MULTISTART_SOBOL && len > 40)
+		self->type = HKL_ENGINE_MULTISTART_RANDOM;
+
+	/* the smallest grid with at least n nodes */
+	if (self->type == HKL_ENGINE_MULTISTART_GRID){
+		while (pow(self->m, len) < self->n)
+			self->m++;
+		self->total = pow(self->m, len);
+	}
+}
+
+static void multistart_release(struct multistart *self)
+{
+	if (self->qrng)
+		gsl_qrng_free(self->qrng);
+}
+
+/**
+ * @brief draw the next starting point in the range of the axes.
+ *
+ * @param self the multistart state.
+ * @param engine the engine with the current axes.
+ * @param x the next starting point.
+ * @return FALSE when all the starting points were drawn.
+ */
+static int multistart_draw(struct multistart *self, const HklEngine *engine,
+			   double x[])
+{
+	size_t i;
+	HklParameter **axis;
+
+	if (self->k >= self->n)
+		return FALSE;
+
+	switch(self->type){
+	case HKL_ENGINE_MULTISTART_SOBOL:
+		if (NULL == self->qrng){
+			self->qrng = gsl_qrng_alloc(gsl_qrng_sobol, self->len);
+			for(i=0; i<self->len; ++i)
+				self->shift[i] = self->state ? multistart_random(self) : 0;
+		}
+		gsl_qrng_get(self->qrng, x);
+		for(i=0; i<self->len; ++i){
+			x[i] += self->shift[i];
+			x[i] -= floor(x[i]);
+		}
+		break;
+	case HKL_ENGINE_MULTISTART_GRID:
+	{
+		/* spread the n points on the nodes */
+		size_t node = self->k * self->total / self->n;
+
+		for(i=0; i<self->len; ++i){
+			x[i] = (node % self->m + .5) / self->m;
+			node /= self->m;
+		}
+		break;
+	}
+	default:
+		for(i=0; i<self->len; ++i)
+			x[i] = multistart_random(self);
+		break;
+	}
+	self->k++;
+
+	/* scale into the range of the axes, at most one turn around
+	 * the current position */
+	i = 0;
+	darray_foreach(axis, engine->axes){
+		double min = (*axis)->range.min;
+		double max = (*axis)->range.max;
+
+		if (max - min > 2 * M_PI){
+			if (min < (*axis)->_value - M_PI)
+				min = (*axis)->_value - M_PI;
+			if (max > min + 2 * M_PI)
+				max = min + 2 * M_PI;
+		}
+		x[i] = min + (max - min) * x[i];
+		++i;
+	}
+
+	return TRUE;
+}
+
+/**
+ * @brief the next starting point, the best of the drawn ones first.
+ *
+ * @param self the multistart state.
+ * @param engine the engine with the current axes.
+ * @param function the mode function.
+ * @param f The function to use for the computation.
+ * @param _x a gsl_vector use to screen the points (optimization)
+ * @param _f a gsl_vector use to screen the points (optimization)
+ * @param x the next starting point.
+ * @return FALSE when all the starting points were tried.
+ *
+ * The points are drawn HKL_MODE_AUTO_MULTISTART_BATCH at a time,
+ * evaluated in one batch and tried by increasing residual.
+ */
+static int multistart_next(struct multistart *self, HklEngine *engine,
+			   const HklFunction *function,
+			   gsl_multiroot_function *f,
+			   gsl_vector *_x, gsl_vector *_f,
+			   double x[])
+{
+	size_t len = self->len;
+
+	if (self->queue_k == self->n_queue){
+		double points[HKL_MODE_AUTO_MULTISTART_BATCH * len];
+		double xs[HKL_MODE_AUTO_MULTISTART_BATCH * len];
+		double fx[HKL_MODE_AUTO_MULTISTART_BATCH * len];
+		double residuals[HKL_MODE_AUTO_MULTISTART_BATCH];
+		size_t order[HKL_MODE_AUTO_MULTISTART_BATCH];
+		size_t i, k, n = 0;
+
+		while(n < HKL_MODE_AUTO_MULTISTART_BATCH
+		      && multistart_draw(self, engine, &points[n * len]))
+			++n;
+		if (0 == n)
+			return FALSE;
+
+		for(k=0; k<n; ++k)
+			for(i=0; i<len; ++i)
+				xs[i * n + k] = points[k * len + i];
+		function_batch(engine, function, f, xs, n, fx, _x, _f);
+
+		/* sort the points by residual, the NAN ones last */
+		for(k=0; k<n; ++k){
+			size_t j;
+
+			residuals[k] = 0;
+			for(i=0; i<len; ++i)
+				residuals[k] += fx[i * n + k] * fx[i * n + k];
+			if (gsl_isnan(residuals[k]))
+				residuals[k] = GSL_POSINF;
+
+			for(j=k; j>0 && residuals[order[j - 1]] > residuals[k]; --j)
+				order[j] = order[j - 1];
+			order[j] = k;
+		}
+
+		for(k=0; k<n; ++k)
+			memcpy(&self->queue[k * len], &points[order[k] * len],
+			       len * sizeof(double));
+		self->n_queue = n;
+		self->queue_k = 0;
+	}
+
+	memcpy(x, &self->queue[self->queue_k++ * len], len * sizeof(double));
+
+	return TRUE;
 }
 
 /**
  * @brief this private method try to find the first solution
  *
  * @param self the current HklPseudoAxeEngine.
+ * @param function the mode function.
  * @param f The function to use for the computation.
  *
  * If a solution was found it also check for degenerated axes.
@@ -115,24 +970,30 @@ static void find_degenerated_axes(HklEngine *self,
  * @return TRUE or FALSE.
  */
 static int find_first_geometry(HklEngine *self,
+			       const HklFunction *function,
 			       gsl_multiroot_function *f,
 			       int degenerated[])
 {
-	gsl_multiroot_fsolver_type const *T;
-	gsl_multiroot_fsolver *s;
+	struct solver s;
 	gsl_vector *x;
 	size_t len = darray_size(self->mode->info->axes_w);
 	double *x_data;
 	double *x_data0 = alloca(len * sizeof(*x_data0));
 	size_t iter = 0;
-	int status;
+	int status = GSL_CONTINUE;
 	int res = FALSE;
 	size_t i;
 	HklParameter **axis;
+	HklEngineContinuation *continuation = NULL;
+	HklEngineNeighbours *neighbours = NULL;
+	const double *nearest = NULL;
+	double *target = NULL;
+	int last = FALSE;
+	int predicted;
 
 	/* get the starting point from the geometry */
 	/* must be put in the auto_set method */
-	x = gsl_vector_alloc(len);
+	x = workspace_get(self, len)->x;
 	x_data = (double *)x->data;
 	i = 0;
 	darray_foreach(axis, self->axes){
@@ -143,62 +1004,114 @@ static int find_first_geometry(HklEngine *self,
 	memcpy(x_data0, x_data, len * sizeof(double));
 
 	/* Initialize method  */
-	T = gsl_multiroot_fsolver_hybrid;
-	s = gsl_multiroot_fsolver_alloc (T, len);
-	gsl_multiroot_fsolver_set (s, f, x);
+	solver_init(&s, function, f, x);
+
+	/* during a trajectory, first try a starting point predicted
+	 * from the last solutions. In a mesh, try the solution of the
+	 * nearest solved target when it is not the last one. */
+	if (self->continuation_order > 0)
+		continuation = continuation_get(self, function, len);
+	if (self->neighbours_n_max > 0) {
+		neighbours = neighbours_get(self, function, len);
+		target = alloca(neighbours->n_targets * sizeof(*target));
+		neighbours_target_get(self, target);
+		nearest = neighbours_nearest(neighbours, target, &last);
+	}
+	predicted = continuation && continuation->n > 0 && (NULL == nearest || last);
+	if (predicted)
+		nearest = NULL;
+	if (predicted || nearest) {
+		if (predicted)
+			continuation_predict(continuation, self->continuation_order, x_data);
+		else
+			memcpy(x_data, nearest, len * sizeof(double));
+		solver_set(&s, x);
+		do {
+			++iter;
+			if (solver_iterate(&s))
+				break;
+			status = gsl_multiroot_test_residual(solver_f_get(&s), HKL_EPSILON / 10.);
+		} while (status == GSL_CONTINUE && iter < HKL_MODE_AUTO_CONTINUATION_MAX_ITER);
+
+		if (status != GSL_SUCCESS) {
+			/* fallback on the usual search */
+			status = GSL_CONTINUE;
+			iter = 0;
+			memcpy(x_data, x_data0, len * sizeof(double));
+		} else if (nearest)
+			self->stats.neighbour_starts++;
+	}
+
+	if (status == GSL_CONTINUE) {
+		struct multistart ms;
+		size_t n_iter = 0;
+
+		multistart_init(&ms, self, len);
+		solver_set(&s, x);
 
 #ifdef DEBUG
-	fprintf(stdout, "Initial starting point: \n");
-	fprintf(stdout, "x: ");
-	for(i=0; i<len; ++i)
-		fprintf(stdout, " %.7f", s->x->data[i]);
-	fprintf(stdout, "\nf: ");
-	for(i=0; i<len; ++i)
-		fprintf(stdout, " %.7f", s->f->data[i]);
+		fprintf(stdout, "Initial starting point: \n");
+		fprintf(stdout, "x: ");
+		for(i=0; i<len; ++i)
+			fprintf(stdout, " %.7f", solver_x_get(&s)->data[i]);
+		fprintf(stdout, "\nf: ");
+		for(i=0; i<len; ++i)
+			fprintf(stdout, " %.7f", solver_f_get(&s)->data[i]);
 #endif
 
-	/* iterate to find the solution */
-	do {
-		++iter;
-		status = gsl_multiroot_fsolver_iterate(s);
+		/* iterate to find the solution */
+		do {
+			++iter;
+			++n_iter;
+			status = solver_iterate(&s);
 #ifdef DEBUG
-		fprintf(stdout, "\nstatus : %d iter : %d\n", status, iter);
+			fprintf(stdout, "\nstatus : %d iter : %d\n", status, iter);
 #endif
-		if (status || (iter % 300) == 0) {
-			/* Restart from another point. */
-			for(i=0; i<len; ++i)
-				x_data[i] = (double)rand() / RAND_MAX / 180. * M_PI;
-			gsl_multiroot_fsolver_set(s, f, x);
-			gsl_multiroot_fsolver_iterate(s);
+			if (status || n_iter == HKL_MODE_AUTO_MULTISTART_MAX_ITER) {
+				/* Restart from another point or give up. */
+				if (!multistart_next(&ms, self, function, f,
+						     self->workspace._x,
+						     self->workspace._f,
+						     x_data)){
+					status = GSL_CONTINUE;
+					break;
+				}
+				self->stats.restarts++;
+				n_iter = 0;
+				solver_set(&s, x);
+				solver_iterate(&s);
 #ifdef DEBUG
-			fprintf(stdout, "randomize the starting point: \n");
-			fprintf(stdout, "x: ");
-			for(i=0; i<len; ++i)
-				fprintf(stdout, " %.7f", s->x->data[i]);
-			fprintf(stdout, "\nf: ");
-			for(i=0; i<len; ++i)
-				fprintf(stdout, " %.7f", s->f->data[i]);
+				fprintf(stdout, "randomize the starting point: \n");
+				fprintf(stdout, "x: ");
+				for(i=0; i<len; ++i)
+					fprintf(stdout, " %.7f", solver_x_get(&s)->data[i]);
+				fprintf(stdout, "\nf: ");
+				for(i=0; i<len; ++i)
+					fprintf(stdout, " %.7f", solver_f_get(&s)->data[i]);
 #endif
-		}
-		status = gsl_multiroot_test_residual (s->f, HKL_EPSILON / 10.);
+			}
+			status = gsl_multiroot_test_residual (solver_f_get(&s), HKL_EPSILON / 10.);
 #ifdef DEBUG
-		fprintf(stdout, "\nstatus : %d iter : %d", status, iter);
-		for(i=0; i<len; ++i)
-			fprintf(stdout, " %.7f", s->f->data[i]);
-		fprintf(stdout, "\n");
+			fprintf(stdout, "\nstatus : %d iter : %d", status, iter);
+			for(i=0; i<len; ++i)
+				fprintf(stdout, " %.7f", solver_f_get(&s)->data[i]);
+			fprintf(stdout, "\n");
 #endif
 
-	} while (status == GSL_CONTINUE && iter < 2000);
+		} while (status == GSL_CONTINUE);
+
+		multistart_release(&ms);
+	}
 
 #ifdef DEBUG
 	fprintf(stdout, "\nstatus : %d iter : %d", status, iter);
 	for(i=0; i<len; ++i)
-		fprintf(stdout, " %.7f", s->f->data[i]);
+		fprintf(stdout, " %.7f", solver_f_get(&s)->data[i]);
 	fprintf(stdout, "\n");
 #endif
 
 	if (status != GSL_CONTINUE) {
-		find_degenerated_axes(self, f, s->x, s->f, degenerated);
+		find_degenerated_axes(self, &s, solver_x_get(&s), solver_f_get(&s), degenerated);
 
 #ifdef DEBUG
 		/* print the test header */
@@ -212,7 +1125,7 @@ static int find_first_geometry(HklEngine *self,
 		/* set the geometry from the gsl_vector */
 		/* in a futur version the geometry must contain a gsl_vector */
 		/* to avoid this. */
-		x_data = (double *)s->x->data;
+		x_data = (double *)solver_x_get(&s)->data;
 		i = 0;
 		darray_foreach(axis, self->axes){
 			hkl_parameter_value_set(*axis,
@@ -223,127 +1136,466 @@ static int find_first_geometry(HklEngine *self,
 		}
 
 		hkl_geometry_update(self->geometry);
+
+		if (continuation || neighbours) {
+			i = 0;
+			darray_foreach(axis, self->axes){
+				x_data0[i++] = (*axis)->_value;
+			}
+			if (continuation)
+				continuation_push(continuation, x_data0);
+			if (neighbours)
+				neighbours_push(neighbours, target, x_data0);
+		}
+
 		res = TRUE;
 	}
 
-	/* release memory */
-	gsl_vector_free(x);
-	gsl_multiroot_fsolver_free(s);
-
 	return res;
 }
 
 /**
- * @brief This private method change the sector of angles.
+ * @brief This private method change the sector of an angle.
  *
- * @param x The vector of changed angles.
- * @param x0 The vector of angles to change.
- * @param sector the sector vector operation.
- * @param n the size of all vectors.
+ * @param x0 The angle to change.
+ * @param sector the sector operation.
  *
  * 0 -> no change
  * 1 -> pi - angle
  * 2 -> pi + angle
  * 3 -> -angle
  */
-static void change_sector(double x[], double const x0[],
-			  int const sector[], size_t n)
+static double sector_value(double x0, int sector)
 {
-	size_t i;
+	switch (sector) {
+	case 1:
+		return M_PI - x0;
+	case 2:
+		return M_PI + x0;
+	case 3:
+		return -x0;
+	default:
+		return x0;
+	}
+}
 
-	for(i=0; i<n; ++i) {
-		switch (sector[i]) {
-		case 0:
-			x[i] = x0[i];
-			break;
-		case 1:
-			x[i] = M_PI - x0[i];
-			break;
-		case 2:
-			x[i] = M_PI + x0[i];
-			break;
-		case 3:
-			x[i] = -x0[i];
-			break;
+/**
+ * @brief Test if the sector of an axis can give a new valid solution.
+ *
+ * @param axis The axis.
+ * @param x0 The first solution value of this axis.
+ * @param sector the sector operation to test.
+ * @param check_range also reject the values out of the axis range.
+ *
+ * A sector equal to a previous one modulo 2pi gives the same
+ * geometries. When there is no other way to get equivalent positions
+ * than the 2pi multiples of the axes, a sector without any of those
+ * positions in the axis range is removed later anyway.
+ */
+static int sector_is_useful(const HklParameter *axis, double x0, int sector,
+			    int check_range)
+{
+	int i;
+	double value = gsl_sf_angle_restrict_symm(sector_value(x0, sector));
+
+	for(i=0; i<sector; ++i){
+		double delta = gsl_sf_angle_restrict_symm(sector_value(x0, i)) - value;
+
+		if (fabs(gsl_sf_angle_restrict_symm(delta)) < HKL_EPSILON)
+			return FALSE;
+	}
+
+	if (check_range){
+		double min = axis->range.min - HKL_EPSILON;
+		double max = axis->range.max + HKL_EPSILON;
+
+		if (hkl_parameter_is_permutable(axis)){
+			if (max - min >= 2 * M_PI)
+				return TRUE;
+			/* the smallest equivalent position above min */
+			value += 2 * M_PI * ceil((min - value) / (2 * M_PI));
 		}
+		if (value < min || value > max)
+			return FALSE;
 	}
+
+	return TRUE;
 }
 
 /**
  * @brief Test if an angle combination is compatible with q function.
  *
- * @param x The vector of angles to test.
- * @param function The gsl_multiroot_function used for the test.
- * @param f a gsl_vector use to compute the result (optimization)
+ * @param fx the values of the n candidates computed by function_batch.
+ * @param len the number of values of a candidate.
+ * @param n the number of candidates.
+ * @param k the candidate to test.
  */
-static int test_sector(gsl_vector const *x,
-		       gsl_multiroot_function *function,
-		       gsl_vector *f)
+static int test_sector(const double fx[], size_t len, size_t n, size_t k)
 {
-	int res = TRUE;
 	size_t i;
-	double *f_data = f->data;
 
+	/* also reject the NAN values */
+	for(i=0; i<len; ++i)
+		if (!(fabs(fx[i * n + k]) <= HKL_EPSILON))
+			return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * @brief test a batch of candidates and add the valid ones.
+ *
+ * @param self the current HklEngine.
+ * @param function the mode function.
+ * @param f The function for the validity test.
+ * @param candidates the n candidates one after the other.
+ * @param n the number of candidates, at most HKL_MODE_AUTO_BATCH.
+ * @param _x a gsl_vector use to compute the candidates (optimization)
+ * @param _f a gsl_vector use to compute the candidates (optimization)
+ * @param first_only stop after the first valid candidate.
+ * @return TRUE if the search must stop.
+ */
+static int add_candidates(HklEngine *self,
+			  const HklFunction *function,
+			  gsl_multiroot_function *f,
+			  const double candidates[], size_t n,
+			  gsl_vector *_x, gsl_vector *_f,
+			  int first_only)
+{
+	size_t len = function->size;
+	double x[HKL_MODE_AUTO_BATCH * len];
+	double fx[HKL_MODE_AUTO_BATCH * len];
+	size_t i, k;
+
+	/* the candidates as structure of arrays */
+	for(k=0; k<n; ++k)
+		for(i=0; i<len; ++i)
+			x[i * n + k] = candidates[k * len + i];
+
+	function_batch(self, function, f, x, n, fx, _x, _f);
+
+	for(k=0; k<n; ++k){
+		self->stats.sectors_tested++;
 #ifdef DEBUG
-	fprintf(stdout, "\n");
-	for(i=0; i<f->size; ++i)
-		fprintf(stdout, "\t%f", x->data[i]);
-	/* fprintf(stdout, "\t%f", gsl_sf_angle_restrict_symm(x->data[i]) * HKL_RADTODEG); */
-        fflush(stdout);
+		fprintf(stdout, "\n");
+		for(i=0; i<len; ++i)
+			fprintf(stdout, "\t%f", candidates[k * len + i]);
+		for(i=0; i<len; ++i)
+			fprintf(stdout, "\t%f", fx[i * n + k]);
+		fflush(stdout);
 #endif
+		if (test_sector(fx, len, n, k)){
+			self->stats.sectors_accepted++;
+			/* a colliding solution does not stop the search */
+			if (hkl_engine_add_geometry(self, &candidates[k * len])
+			    && first_only)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
 
-	function->f(x, function->params, f);
+/* the sectors are tested in parallel only with at least this number
+ * of candidates per thread, a copy of the engine list is not free */
+#define HKL_MODE_AUTO_SECTORS_PER_THREAD HKL_MODE_AUTO_BATCH
 
-	for(i=0; i<f->size; ++i)
-		if (fabs(f_data[i]) > HKL_EPSILON){
-			res = FALSE;
+/**
+ * @brief compute the function of a block of candidates.
+ *
+ * @param engine the engine which evaluates the function.
+ * @param function the mode function.
+ * @param candidates the candidates one after the other.
+ * @param fx the function values of the candidates, one after the other.
+ * @param from the first candidate of the block.
+ * @param to the candidate after the block.
+ * @param _x a gsl_vector use to compute the candidates (optimization)
+ * @param _f a gsl_vector use to compute the candidates (optimization)
+ */
+static void sectors_evaluate(HklEngine *engine,
+			     const HklFunction *function,
+			     const double candidates[], double fx[],
+			     size_t from, size_t to,
+			     gsl_vector *_x, gsl_vector *_f)
+{
+	size_t len = function->size;
+	double x[HKL_MODE_AUTO_BATCH * len];
+	double fxb[HKL_MODE_AUTO_BATCH * len];
+	gsl_multiroot_function f;
+	size_t i, k, start;
+
+	f.f = function->function;
+	f.n = len;
+	f.params = engine;
+
+	for(start=from; start<to; start+=HKL_MODE_AUTO_BATCH){
+		size_t n = to - start < HKL_MODE_AUTO_BATCH ? to - start : HKL_MODE_AUTO_BATCH;
+
+		for(k=0; k<n; ++k)
+			for(i=0; i<len; ++i)
+				x[i * n + k] = candidates[(start + k) * len + i];
+
+		function_batch(engine, function, &f, x, n, fxb, _x, _f);
+
+		for(k=0; k<n; ++k)
+			for(i=0; i<len; ++i)
+				fx[(start + k) * len + i] = fxb[i * n + k];
+	}
+}
+
+/* a thread computing a block of candidates with its own copy of the
+ * engine list */
+struct sectors_worker
+{
+	struct HklEngineBatchWorker worker;
+	const HklFunction *function;
+	const double *candidates;
+	double *fx;
+};
+
+static gpointer sectors_worker_run(gpointer data)
+{
+	struct sectors_worker *self = data;
+	gsl_vector *_x = gsl_vector_alloc(self->function->size);
+	gsl_vector *_f = gsl_vector_alloc(self->function->size);
+
+	sectors_evaluate(self->worker.engine, self->function,
+			 self->candidates, self->fx,
+			 self->worker.from, self->worker.to, _x, _f);
+
+	gsl_vector_free(_f);
+	gsl_vector_free(_x);
+
+	return NULL;
+}
+
+/**
+ * @brief test the candidates with n_threads threads.
+ *
+ * @param self the current HklEngine.
+ * @param function the mode function.
+ * @param candidates the n candidates one after the other.
+ * @param n the number of candidates.
+ * @param _x a gsl_vector use to compute the candidates (optimization)
+ * @param _f a gsl_vector use to compute the candidates (optimization)
+ * @param n_threads the number of threads, the calling one included.
+ * @param first_only stop after the first valid candidate.
+ *
+ * The candidates are split in contiguous blocks like the batches of
+ * the engine, the calling thread computes the first one. Then the
+ * valid candidates are added in their order, so the solutions are
+ * the same than the ones of add_candidates.
+ */
+static void test_sectors_threads(HklEngine *self,
+				 const HklFunction *function,
+				 const double candidates[], size_t n,
+				 gsl_vector *_x, gsl_vector *_f,
+				 unsigned int n_threads, int first_only)
+{
+	size_t len = function->size;
+	double *fx = g_new(double, n * len);
+	struct sectors_worker workers[n_threads - 1];
+	size_t n_workers = 0;
+	size_t chunk = n / n_threads;
+	size_t i, k;
+
+	for(i=1; i<n_threads; ++i){
+		struct sectors_worker *worker = &workers[n_workers];
+
+		if(!hkl_engine_batch_worker_init(&worker->worker, self)){
+			hkl_engine_batch_worker_release(&worker->worker);
 			break;
 		}
+		hkl_engine_prepare_internal(worker->worker.engine);
+		worker->function = function;
+		worker->candidates = candidates;
+		worker->fx = fx;
+		worker->worker.from = i * chunk;
+		worker->worker.to = i == n_threads - 1 ? n : (i + 1) * chunk;
+		++n_workers;
+	}
 
-#ifdef DEBUG
-	for(i=0; i<f->size; ++i)
-		if(fabs(f_data[i]) < HKL_EPSILON)
-			fprintf(stdout, "\t%f *", f_data[i]);
-		else
-			fprintf(stdout, "\t%f", f_data[i]);
+	for(i=0; i<n_workers; ++i)
+		workers[i].worker.thread = g_thread_new("hkl-sectors",
+							sectors_worker_run,
+							&workers[i]);
 
-	if(res == FALSE)
-		fprintf(stdout, "\t FAIL");
-	else
-		fprintf(stdout, "\t SUCCESS");
-#endif
+	/* without workers, compute their blocks here */
+	sectors_evaluate(self, function, candidates, fx,
+			 0, n_workers ? workers[0].worker.from : n, _x, _f);
+	if(n_workers && workers[n_workers - 1].worker.to < n)
+		sectors_evaluate(self, function, candidates, fx,
+				 workers[n_workers - 1].worker.to, n, _x, _f);
 
-	return res;
+	for(i=0; i<n_workers; ++i){
+		g_thread_join(workers[i].worker.thread);
+		self->stats.evaluations += workers[i].worker.engine->stats.evaluations;
+		hkl_engine_batch_worker_release(&workers[i].worker);
+	}
+
+	for(k=0; k<n; ++k){
+		self->stats.sectors_tested++;
+		if (test_sector(&fx[k * len], len, 1, 0)){
+			self->stats.sectors_accepted++;
+			/* a colliding solution does not stop the search */
+			if (hkl_engine_add_geometry(self, &candidates[k * len])
+			    && first_only)
+				break;
+		}
+	}
+
+	g_free(fx);
 }
 
 /**
- * @brief compute the permutation and test its validity.
+ * @brief test all the useful sectors of a first solution.
  *
- * @param axes_len number of axes
- * @param op_len number of operation per axes. (4 for now)
- * @param p The vector containing the current permutation.
- * @param axes_idx The index of the axes we are permution.
- * @param op the current operation to set.
+ * @param self the current HklEngine.
+ * @param function the mode function.
  * @param f The function for the validity test.
  * @param x0 The starting point of all geometry permutations.
+ * @param degenerated the degenerated axes keep their sector.
  * @param _x a gsl_vector use to compute the sectors (optimization)
  * @param _f a gsl_vector use during the sector test (optimization)
+ * @param check_range prune the sectors out of the axes range.
+ * @param first_only stop after the first valid permutation.
+ *
+ * The permutations are enumerated in the order of the axes, the last
+ * one changing first, and tested HKL_MODE_AUTO_BATCH at a time.
  */
-static void perm_r(size_t axes_len, size_t op_len[], int p[], size_t axes_idx,
-		   int op, gsl_multiroot_function *f, double x0[],
-		   gsl_vector *_x, gsl_vector *_f)
+static void test_sectors(HklEngine *self,
+			 const HklFunction *function,
+			 gsl_multiroot_function *f,
+			 const double x0[], const int degenerated[],
+			 gsl_vector *_x, gsl_vector *_f,
+			 int check_range, int first_only)
 {
-	size_t i;
+	size_t len = function->size;
+	int sectors[len][4];
+	size_t n_sectors[len];
+	size_t idx[len];
+	double candidates[HKL_MODE_AUTO_BATCH * len];
+	size_t i, n;
+	int done = FALSE;
+
+	/* the useful sectors of each axis */
+	for(i=0; i<len; ++i){
+		int sector;
+
+		n_sectors[i] = 0;
+		for(sector=0; sector<(degenerated[i] ? 1 : 4); ++sector)
+			if (sector_is_useful(darray_item(self->axes, i),
+					     x0[i], sector, check_range))
+				sectors[i][n_sectors[i]++] = sector;
+		if (0 == n_sectors[i])
+			return;
+		idx[i] = 0;
+	}
+
+	/* all the permutations at once, in the same order */
+	if (self->sectors_n_threads > 1){
+		size_t total = 1;
+
+		for(i=0; i<len; ++i)
+			total *= n_sectors[i];
+
+		if (total >= 2 * HKL_MODE_AUTO_SECTORS_PER_THREAD){
+			unsigned int n_threads = total / HKL_MODE_AUTO_SECTORS_PER_THREAD;
+			double *all = g_new(double, total * len);
+
+			for(n=0; n<total; ++n){
+				size_t rest = n;
+
+				for(i=len; i-- > 0;){
+					all[n * len + i] = sector_value(x0[i], sectors[i][rest % n_sectors[i]]);
+					rest /= n_sectors[i];
+				}
+			}
+			test_sectors_threads(self, function, all, total, _x, _f,
+					     n_threads < self->sectors_n_threads ? n_threads : self->sectors_n_threads,
+					     first_only);
+			g_free(all);
+			return;
+		}
+	}
+
+	while(!done){
+		n = 0;
+		while(n < HKL_MODE_AUTO_BATCH && !done){
+			for(i=0; i<len; ++i)
+				candidates[n * len + i] = sector_value(x0[i], sectors[i][idx[i]]);
+			++n;
+
+			/* the next permutation */
+			done = TRUE;
+			for(i=len; i-- > 0;){
+				if (++idx[i] < n_sectors[i]){
+					done = FALSE;
+					break;
+				}
+				idx[i] = 0;
+			}
+		}
+		if (add_candidates(self, function, f, candidates, n, _x, _f, first_only))
+			return;
+	}
+}
+
+/**
+ * @brief Add the closed form solutions of a function.
+ *
+ * @param self the current HklEngine
+ * @param function The mode function
+ * @param f The function for the validity test.
+ * @param _x a gsl_vector use to test the solutions (optimization)
+ * @param _f a gsl_vector use during the test (optimization)
+ *
+ * @return TRUE if at least one solution was added.
+ *
+ * Each solution is checked with the function. Without any valid
+ * solution, the axes are restored for the numerical solver.
+ */
+static int solve_function_closed_form(HklEngine *self,
+				      const HklFunction *function,
+				      gsl_multiroot_function *f,
+				      gsl_vector *_x, gsl_vector *_f)
+{
+	double x0[function->size];
+	double x[HKL_FUNCTION_SOLUTIONS_MAX * function->size];
+	size_t i, n;
+	int res = FALSE;
+	HklParameter **axis;
+
+	i = 0;
+	darray_foreach(axis, self->axes){
+		x0[i++] = (*axis)->_value;
+	}
+
+	n = function->solutions(self, x, HKL_FUNCTION_SOLUTIONS_MAX);
+	if (n > 0){
+		double xs[n * function->size];
+		double fx[n * function->size];
+		size_t j;
+
+		/* the solutions as structure of arrays */
+		for(i=0; i<n; ++i)
+			for(j=0; j<function->size; ++j)
+				xs[j * n + i] = x[i * function->size + j];
+		function_batch(self, function, f, xs, n, fx, _x, _f);
 
-	p[axes_idx++] = op;
-	if (axes_idx == axes_len) {
-		double *x_data = _x->data;
-		change_sector(x_data, x0, p, axes_len);
-		if (test_sector(_x, f, _f))
-			hkl_engine_add_geometry(f->params, x_data);
-	} else
-		for (i=0; i<op_len[axes_idx]; ++i)
-			perm_r(axes_len, op_len, p, axes_idx, i, f, x0, _x, _f);
+		for(i=0; i<n; ++i){
+			self->stats.sectors_tested++;
+			if (test_sector(fx, function->size, n, i)){
+				self->stats.sectors_accepted++;
+				res |= hkl_engine_add_geometry(self, &x[i * function->size]);
+			}
+		}
+	}
+
+	if (!res)
+		set_geometry_axes(self, x0);
+
+	return res;
 }
 
 /**
@@ -354,49 +1606,54 @@ static void perm_r(size_t axes_len, size_t op_len[], int p[], size_t axes_idx,
  *
  * @return TRUE or FALSE
  *
- * This method find a first solution with a numerical method from the
- * GSL library (the multi root solver hybrid). Then it multiplicates the
- * solutions from this starting point using cosinus/sinus properties.
- * It addes all valid solutions to the self->geometries.
+ * This method use the closed form solutions of the function if
+ * any. Otherwise it find a first solution with a numerical method
+ * from the GSL library (the multi root solver hybrid). Then it
+ * multiplicates the solutions from this starting point using
+ * cosinus/sinus properties.  It addes all valid solutions to the
+ * self->geometries.
  */
 static int solve_function(HklEngine *self,
 			  const HklFunction *function)
 {
 
 	size_t i;
-	int p[function->size];
 	double x0[function->size];
 	int degenerated[function->size];
-	size_t op_len[function->size];
 	int res;
-	gsl_vector *_x; /* use to compute sectors in perm_r (avoid copy) */
-	gsl_vector *_f; /* use to test sectors in perm_r (avoid copy) */
+	gsl_vector *_x; /* use to compute sectors in test_sectors (avoid copy) */
+	gsl_vector *_f; /* use to test sectors in test_sectors (avoid copy) */
 	gsl_multiroot_function f;
 	HklParameter **axis;
+	/* a geometry multiply can bring back a sector out of range */
+	int check_range = NULL == self->engines->geometries->multiply
+		&& !self->engines->ops->post_engine_set_multiply;
+	int first_only = check_range && self->solutions == HKL_ENGINE_SOLUTIONS_CLOSEST;
 
-	_x = gsl_vector_alloc(function->size);
-	_f = gsl_vector_alloc(function->size);
+	_x = workspace_get(self, function->size)->_x;
+	_f = self->workspace._f;
 
 	f.f = function->function;
 	f.n = function->size;
 	f.params = self;
 
-	res = find_first_geometry(self, &f, degenerated);
+	if (function->solutions
+	    && solve_function_closed_form(self, function, &f, _x, _f)){
+		self->stats.closed_form++;
+		return TRUE;
+	}
+
+	res = find_first_geometry(self, function, &f, degenerated);
 	if (res) {
-		memset(p, 0, sizeof(p));
 		/* use first solution as starting point for permutations */
 		i = 0;
 		darray_foreach(axis, self->axes){
-			x0[i] = (*axis)->_value;
-			op_len[i] = degenerated[i] ? 1 : 4;
-			++i;
+			x0[i++] = (*axis)->_value;
 		}
-		for (i=0; i<op_len[0]; ++i)
-			perm_r(function->size, op_len, p, 0, i, &f, x0, _x, _f);
+		test_sectors(self, function, &f, x0, degenerated, _x, _f,
+			     check_range, first_only);
 	}
 
-	gsl_vector_free(_f);
-	gsl_vector_free(_x);
 	return res;
 }
 
@@ -450,8 +1707,12 @@ int hkl_mode_auto_set_real(HklMode *self,
 		return FALSE;
 	}
 
-	darray_foreach(function, auto_info->functions)
+	darray_foreach(function, auto_info->functions){
 		ok |= solve_function(engine, *function);
+		if (engine->solutions == HKL_ENGINE_SOLUTIONS_CLOSEST
+		    && engine->engines->geometries->n_items > 0)
+			break;
+	}
 
 	if(!ok){
 		g_set_error(error,
@@ -468,6 +1729,154 @@ int hkl_mode_auto_set_real(HklMode *self,
 	return TRUE;
 }
 
+/**
+ * @brief compute the axes velocities of a solution of the mode.
+ *
+ * @param self the current HklMode.
+ * @param engine the engine, its geometry solves its pseudo axes values.
+ * @param velocities the pseudo axes velocities (default unit).
+ * @param axes the returned velocities of the engine axes (default unit).
+ * @param error return location for a GError, or NULL
+ *
+ * Along a path f(x(t), p(t)) = 0, so J dx/dt = - df/dp dp/dt, J being
+ * the Jacobian of the mode function, the one of
+ * find_degenerated_axes. df/dp dp/dt is a central difference of the
+ * function along the pseudo axes velocities. The system is solved in
+ * the least squares sense, so a degenerated axis does not move.
+ *
+ * @return FALSE if no function of the mode vanishes at the current
+ * geometry or if the Jacobian is singular along the velocities.
+ */
+int hkl_mode_auto_velocities_real(HklMode *self,
+				  HklEngine *engine,
+				  const double velocities[],
+				  double axes[],
+				  GError **error)
+{
+	HklModeAutoInfo *auto_info = container_of(self->info, HklModeAutoInfo, info);
+	const size_t len = darray_size(engine->axes);
+	const size_t n_values = darray_size(engine->pseudo_axes);
+	const HklFunction **function;
+	const HklFunction *found = NULL;
+	double x0[len], p0[n_values];
+	double fx[len], fp[len], fm[len], b[len], J[len * len];
+	double V[len * len], S[len], work[len];
+	gsl_vector_view x = gsl_vector_view_array(x0, len);
+	gsl_vector_view f_x = gsl_vector_view_array(fx, len);
+	gsl_vector_view f_p = gsl_vector_view_array(fp, len);
+	gsl_vector_view f_m = gsl_vector_view_array(fm, len);
+	gsl_vector_view b_v = gsl_vector_view_array(b, len);
+	gsl_vector_view dx = gsl_vector_view_array(axes, len);
+	gsl_matrix_view V_m = gsl_matrix_view_array(V, len, len);
+	gsl_vector_view S_v = gsl_vector_view_array(S, len);
+	gsl_vector_view work_v = gsl_vector_view_array(work, len);
+	gsl_multiroot_function f = {.n = len, .params = engine};
+	gsl_matrix *U;
+	struct solver s;
+	HklParameter **parameter;
+	double norm = 0;
+	double eps;
+	double bmax = 0;
+	size_t i, j;
+	int res = TRUE;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if (0 == len)
+		return TRUE;
+
+	i = 0;
+	darray_foreach(parameter, engine->axes){
+		x0[i++] = (*parameter)->_value;
+	}
+	i = 0;
+	darray_foreach(parameter, engine->pseudo_axes){
+		p0[i] = (*parameter)->_value;
+		norm = fmax(norm, fabs(velocities[i]));
+		++i;
+	}
+
+	memset(axes, 0, len * sizeof(double));
+	if (0 == norm)
+		return TRUE;
+
+	/* the function of the mode solved by the geometry */
+	darray_foreach(function, auto_info->functions){
+		f.f = (*function)->function;
+		if (GSL_SUCCESS == f.f(&x.vector, engine, &f_x.vector)){
+			for(i=0; i<len; ++i)
+				if (!(fabs(fx[i]) <= HKL_EPSILON))
+					break;
+			if (i == len){
+				found = *function;
+				break;
+			}
+		}
+	}
+	if (NULL == found){
+		g_set_error(error,
+			    HKL_MODE_AUTO_ERROR,
+			    HKL_MODE_AUTO_ERROR_VELOCITIES,
+			    "the geometry is not a solution of the mode \"%s\"",
+			    self->info->name);
+		res = FALSE;
+		goto out;
+	}
+
+	/* - df/dp dp/dt */
+	eps = GSL_SQRT_DBL_EPSILON / norm;
+	for(j=0; j<2; ++j){
+		i = 0;
+		darray_foreach(parameter, engine->pseudo_axes){
+			(*parameter)->_value = p0[i] + (j ? -eps : eps) * velocities[i];
+			++i;
+		}
+		f.f(&x.vector, engine, j ? &f_m.vector : &f_p.vector);
+	}
+	i = 0;
+	darray_foreach(parameter, engine->pseudo_axes){
+		(*parameter)->_value = p0[i++];
+	}
+	for(i=0; i<len; ++i){
+		b[i] = - (fp[i] - fm[i]) / (2 * eps);
+		bmax = fmax(bmax, fabs(b[i]));
+	}
+
+	/* J dx/dt = b, the small singular values are the degenerated
+	 * axes */
+	solver_init(&s, found, &f, &x.vector);
+	U = engine->workspace.J;
+	solver_jacobian(&s, &x.vector, &f_x.vector, U);
+	memcpy(J, U->data, len * len * sizeof(double));
+	gsl_linalg_SV_decomp(U, &V_m.matrix, &S_v.vector, &work_v.vector);
+	for(i=0; i<len; ++i)
+		if (S[i] <= HKL_EPSILON * S[0])
+			S[i] = 0;
+	gsl_linalg_SV_solve(U, &V_m.matrix, &S_v.vector, &b_v.vector, &dx.vector);
+
+	for(i=0; i<len; ++i){
+		double r = - b[i];
+
+		for(j=0; j<len; ++j)
+			r += J[i * len + j] * axes[j];
+		if (!(fabs(r) <= HKL_EPSILON * fmax(bmax, 1))){
+			g_set_error(error,
+				    HKL_MODE_AUTO_ERROR,
+				    HKL_MODE_AUTO_ERROR_VELOCITIES,
+				    "singular geometry, the axes of the mode \"%s\" can not follow these velocities",
+				    self->info->name);
+			memset(axes, 0, len * sizeof(double));
+			res = FALSE;
+			break;
+		}
+	}
+
+out:
+	set_geometry_axes(engine, x0);
+
+	return res;
+}
+
 HklMode *hkl_mode_auto_with_init_new(const HklModeAutoInfo *auto_info,
 				     const HklModeOperations *ops,
 				     int initialized)
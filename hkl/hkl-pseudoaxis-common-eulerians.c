@@ -124,6 +124,104 @@ void kappa_2_kappap(double komega, double kappa, double kphi, double alpha,
 
 }
 
+/**
+ * hkl_kappa_to_eulerians_array:
+ * @kappa: (array length=n_kappa): the kappa angles, all the komega
+ *         first, then all the kappa and all the kphi
+ * @n_kappa: the size of @kappa, three times the number of positions
+ * @eulerians: (array length=n_eulerians): the computed eulerian angles,
+ *             all the omega first, then all the chi and all the phi
+ * @n_eulerians: the size of @eulerians, the same as @n_kappa
+ * @alpha: the angle of the kappa axis
+ * @solution: (0/1) to select the first or second solution
+ * @unit_type: the unit type (default or user) of the angles
+ *
+ * convert many kappa positions into their eulerian angles at once,
+ * with the same closed form as the "eulerians" engine, but without
+ * going through the engine for each position. The user unit is the
+ * degree.
+ **/
+void hkl_kappa_to_eulerians_array(const double kappa[], size_t n_kappa,
+				  double eulerians[], size_t n_eulerians,
+				  double alpha, int solution,
+				  HklUnitEnum unit_type)
+{
+	const size_t n = n_kappa / 3;
+	const double factor = HKL_UNIT_USER == unit_type ? HKL_DEGTORAD : 1.;
+	size_t i;
+
+	g_return_if_fail(0 == n_kappa % 3);
+	g_return_if_fail(n_eulerians == n_kappa);
+
+	for(i=0; i<n; ++i){
+		const double angles[] = {
+			kappa[0 * n + i] * factor,
+			kappa[1 * n + i] * factor,
+			kappa[2 * n + i] * factor,
+		};
+
+		kappa_to_eulerian(angles,
+				  &eulerians[0 * n + i],
+				  &eulerians[1 * n + i],
+				  &eulerians[2 * n + i],
+				  alpha * factor, solution);
+		eulerians[0 * n + i] /= factor;
+		eulerians[1 * n + i] /= factor;
+		eulerians[2 * n + i] /= factor;
+	}
+}
+
+/**
+ * hkl_eulerians_to_kappa_array:
+ * @eulerians: (array length=n_eulerians): the eulerian angles, all the
+ *             omega first, then all the chi and all the phi
+ * @n_eulerians: the size of @eulerians, three times the number of positions
+ * @kappa: (array length=n_kappa): the computed kappa angles, all the
+ *         komega first, then all the kappa and all the kphi
+ * @n_kappa: the size of @kappa, the same as @n_eulerians
+ * @alpha: the angle of the kappa axis
+ * @solution: (0/1) to select the first or second solution
+ * @unit_type: the unit type (default or user) of the angles
+ *
+ * convert many eulerian positions into their kappa angles at once,
+ * see hkl_kappa_to_eulerians_array. The positions with |chi| >
+ * 2 * @alpha are unreachable, their kappa angles are set to NAN.
+ *
+ * Returns: TRUE if all the positions are reachable, FALSE otherwise.
+ **/
+int hkl_eulerians_to_kappa_array(const double eulerians[], size_t n_eulerians,
+				 double kappa[], size_t n_kappa,
+				 double alpha, int solution,
+				 HklUnitEnum unit_type)
+{
+	const size_t n = n_eulerians / 3;
+	const double factor = HKL_UNIT_USER == unit_type ? HKL_DEGTORAD : 1.;
+	int res = TRUE;
+	size_t i;
+
+	g_return_val_if_fail(0 == n_eulerians % 3, FALSE);
+	g_return_val_if_fail(n_kappa == n_eulerians, FALSE);
+
+	for(i=0; i<n; ++i){
+		double angles[3];
+		size_t j;
+
+		if(eulerian_to_kappa(eulerians[0 * n + i] * factor,
+				     eulerians[1 * n + i] * factor,
+				     eulerians[2 * n + i] * factor,
+				     angles, alpha * factor, solution)){
+			for(j=0; j<3; ++j)
+				kappa[j * n + i] = angles[j] / factor;
+		}else{
+			for(j=0; j<3; ++j)
+				kappa[j * n + i] = NAN;
+			res = FALSE;
+		}
+	}
+
+	return res;
+}
+
 /***********/
 /* HklMode */
 /***********/
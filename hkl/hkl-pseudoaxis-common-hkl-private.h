@@ -38,6 +38,9 @@ struct _HklEngineHkl {
 };
 
 extern int _RUBh_minus_Q_func(const gsl_vector *x, void *params, gsl_vector *f);
+extern int _RUBh_minus_Q_jacobian(const gsl_vector *x, void *params, gsl_matrix *J);
+extern size_t _RUBh_minus_Q_solutions(HklEngine *engine, double x[], size_t n);
+extern size_t _bissector_solutions(HklEngine *engine, double x[], size_t n);
 extern int _double_diffraction_func(const gsl_vector *x, void *params, gsl_vector *f);
 extern int _psi_constant_vertical_func(const gsl_vector *x, void *params, gsl_vector *f);
 extern int _emergence_fixed_func(const gsl_vector *x, void *params, gsl_vector *f);
@@ -101,6 +104,8 @@ static const HklModeOperations constant_incidence_mode_operations = {
 
 static const HklFunction RUBh_minus_Q_func = {
 	.function = _RUBh_minus_Q_func,
+	.jacobian = _RUBh_minus_Q_jacobian,
+	.solutions = _RUBh_minus_Q_solutions,
 	.size = 3,
 };
 
@@ -21,10 +21,11 @@
  *          Maria-Teresa Nunez-Pardo-de-Verra <tnunez@mail.desy.de>
  */
 #include <gsl/gsl_errno.h>              // for ::GSL_SUCCESS, etc
+#include <gsl/gsl_linalg.h>             // for gsl_linalg_LU_decomp, etc
 #include <gsl/gsl_multiroots.h>
 #include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_pos
 #include <gsl/gsl_vector_double.h>      // for gsl_vector, etc
-#include <math.h>                       // for fabs, M_PI
+#include <math.h>                       // for fabs, M_PI, NAN, etc
 #include <stddef.h>                     // for size_t
 #include <stdlib.h>                     // for free, malloc, rand, etc
 #include <string.h>                     // for NULL
@@ -32,6 +33,7 @@
 #include "hkl-axis-private.h"           // for HklAxis
 #include "hkl-detector-private.h"       // for hkl_detector_compute_kf
 #include "hkl-geometry-private.h"       // for HklHolder, _HklGeometry, etc
+#include "hkl-interval-private.h"       // for HklInterval, etc
 #include "hkl-macros-private.h"         // for hkl_assert, HKL_MALLOC, etc
 #include "hkl-matrix-private.h"         // for hkl_matrix_times_vector, etc
 #include "hkl-parameter-private.h"      // for _HklParameter, etc
@@ -105,18 +107,207 @@ static int fit_detector_function(const gsl_vector *x, void *params, gsl_vector *
 }
 
 
+/* the angle of the rotation around the unit vector a which brings w
+ * on u, both must be on the same cone around a */
+static double fit_detector_rotation_angle(const HklVector *a,
+					  const HklVector *w,
+					  const HklVector *u)
+{
+	HklVector wp = *a;
+	HklVector up = *a;
+	HklVector n;
+
+	hkl_vector_times_double(&wp, -hkl_vector_scalar_product(a, w));
+	hkl_vector_add_vector(&wp, w);
+	hkl_vector_times_double(&up, -hkl_vector_scalar_product(a, u));
+	hkl_vector_add_vector(&up, u);
+	n = wp;
+	hkl_vector_vectorial_product(&n, &up);
+
+	return atan2(hkl_vector_scalar_product(a, &n),
+		     hkl_vector_scalar_product(&wp, &up));
+}
+
+/* set the fitted axes and check that the detector is on kf0 */
+static int fit_detector_set(HklDetectorFit *fitp, const double values[])
+{
+	size_t i;
+	HklVector kf;
+
+	for(i=0; i<fitp->len; ++i)
+		if(!hkl_parameter_value_set(fitp->axes[i],
+					    gsl_sf_angle_restrict_pos(values[i]),
+					    HKL_UNIT_DEFAULT, NULL))
+			return FALSE;
+	hkl_geometry_update(fitp->geometry);
+
+	kf = hkl_geometry_kf_get(fitp->geometry, fitp->detector);
+
+	return fabs(fitp->kf0->data[0] - kf.data[0])
+		+ fabs(fitp->kf0->data[1] - kf.data[1])
+		+ fabs(fitp->kf0->data[2] - kf.data[2]) < HKL_EPSILON;
+}
+
+/*
+ * The detector holder is q = Q0 R1(x1) Q1 R2(x2) Q2 with Ri the
+ * rotations of the fitted axes and Qi the product of the other axes,
+ * and kf = q k0 with k0 = (k, 0, 0). With w = Q2 k0 and u = Q0^-1 kf,
+ *
+ * - one axis: R1(x1) w = u, so x1 is the angle between the
+ *   projections of w and u on the plan orthogonal to a1.
+ *
+ * - two axes: p = R2(x2) w is on the intersection of the sphere |p| =
+ *   |w| with the plans p.a2 = w.a2 and p.b = u.a1, where b = Q1^-1 a1,
+ *   so there are at most two solutions. The closest one of the current
+ *   position is tried first.
+ *
+ * Return FALSE if the detector holder is not made of rotations or
+ * if no solution put the detector on kf, the caller must then fit
+ * numerically.
+ */
+static int fit_detector_position_closed_form(HklDetectorFit *fitp,
+					     const HklHolder *detector_holder)
+{
+	static const HklQuaternion q0 = {{1, 0, 0, 0}};
+	HklQuaternion qs[3] = {q0, q0, q0};
+	HklVector a[2];
+	HklVector k0 = {{HKL_TAU / fitp->geometry->source.wave_length, 0, 0}};
+	HklVector w;
+	HklVector u;
+	double values[2][2];
+	double current[2];
+	size_t i;
+	size_t n = 0;
+	size_t n_solutions = 0;
+
+	if(fitp->len > 2)
+		return FALSE;
+
+	/* split the holder around the fitted axes */
+	for(i=0; i<detector_holder->config->len; ++i){
+		HklParameter *p = darray_item(fitp->geometry->axes,
+					      detector_holder->config->idx[i]);
+		const HklQuaternion *q = hkl_parameter_quaternion_get(p);
+		size_t j;
+
+		for(j=n; j<fitp->len; ++j)
+			if(p == fitp->axes[j])
+				break;
+		if(j < fitp->len){
+			const HklVector *axis_v = hkl_parameter_axis_v_get(p);
+
+			if(NULL == q || NULL == axis_v)
+				return FALSE;
+			/* keep the fitted axes in the holder order */
+			fitp->axes[j] = fitp->axes[n];
+			fitp->axes[n] = p;
+			a[n] = *axis_v;
+			hkl_vector_normalize(&a[n]);
+			n++;
+		}else if(NULL != q)
+			hkl_quaternion_times_quaternion(&qs[n], q);
+	}
+	if(n != fitp->len)
+		return FALSE;
+
+	w = k0;
+	hkl_vector_rotated_quaternion(&w, &qs[n]);
+	u = *fitp->kf0;
+	hkl_quaternion_conjugate(&qs[0]);
+	hkl_vector_rotated_quaternion(&u, &qs[0]);
+
+	for(i=0; i<fitp->len; ++i)
+		current[i] = hkl_parameter_value_get(fitp->axes[i], HKL_UNIT_DEFAULT);
+
+	if(1 == fitp->len){
+		values[0][0] = fit_detector_rotation_angle(&a[0], &w, &u);
+		n_solutions = 1;
+	}else{
+		HklVector b = a[0];
+		HklVector c;
+		HklQuaternion q1 = qs[1];
+		double d, c1, c2, alpha, beta, gamma2, norm2;
+
+		hkl_quaternion_conjugate(&q1);
+		hkl_vector_rotated_quaternion(&b, &q1);
+
+		d = hkl_vector_scalar_product(&a[1], &b);
+		if(fabs(1. - d * d) < HKL_EPSILON)
+			goto fallback;
+		c1 = hkl_vector_scalar_product(&u, &a[0]);
+		c2 = hkl_vector_scalar_product(&w, &a[1]);
+		alpha = (c2 - d * c1) / (1. - d * d);
+		beta = (c1 - d * c2) / (1. - d * d);
+		c = a[1];
+		hkl_vector_vectorial_product(&c, &b);
+		norm2 = hkl_vector_scalar_product(&c, &c);
+		gamma2 = (hkl_vector_scalar_product(&w, &w)
+			  - alpha * alpha - beta * beta - 2. * alpha * beta * d) / norm2;
+		if(gamma2 < -HKL_EPSILON)
+			goto fallback;
+		gamma2 = gamma2 > 0 ? sqrt(gamma2) : 0;
+
+		for(i=0; i<2; ++i){
+			HklVector p = a[1];
+			HklVector pb = b;
+			HklVector pc = c;
+			HklVector mp;
+
+			hkl_vector_times_double(&p, alpha);
+			hkl_vector_times_double(&pb, beta);
+			hkl_vector_times_double(&pc, i ? -gamma2 : gamma2);
+			hkl_vector_add_vector(&p, &pb);
+			hkl_vector_add_vector(&p, &pc);
+
+			mp = p;
+			hkl_vector_rotated_quaternion(&mp, &qs[1]);
+			values[i][0] = fit_detector_rotation_angle(&a[0], &mp, &u);
+			values[i][1] = fit_detector_rotation_angle(&a[1], &w, &p);
+		}
+		n_solutions = 2;
+
+		/* try the closest of the current position first */
+		if(fabs(gsl_sf_angle_restrict_symm(values[1][0] - current[0]))
+		   + fabs(gsl_sf_angle_restrict_symm(values[1][1] - current[1]))
+		   < fabs(gsl_sf_angle_restrict_symm(values[0][0] - current[0]))
+		   + fabs(gsl_sf_angle_restrict_symm(values[0][1] - current[1]))){
+			double tmp[2] = {values[0][0], values[0][1]};
+
+			values[0][0] = values[1][0];
+			values[0][1] = values[1][1];
+			values[1][0] = tmp[0];
+			values[1][1] = tmp[1];
+		}
+	}
+
+	for(i=0; i<n_solutions; ++i)
+		if(fit_detector_set(fitp, values[i]))
+			return TRUE;
+
+fallback:
+	/* restore the starting point of the numerical fit */
+	for(i=0; i<fitp->len; ++i)
+		hkl_parameter_value_set(fitp->axes[i], current[i],
+					HKL_UNIT_DEFAULT, NULL);
+	hkl_geometry_update(fitp->geometry);
+
+	return FALSE;
+}
+
+
 static int fit_detector_position(HklMode *mode,
+				 HklEngine *engine,
 				 HklGeometry *geometry,
 				 HklDetector *detector,
 				 const HklSample *sample,
 				 HklVector *kf)
 {
-	const char **axis_name;
+	const int *axis_idx;
 	HklDetectorFit params;
 	gsl_multiroot_fsolver_type const *T;
 	gsl_multiroot_fsolver *s;
 	gsl_multiroot_function f;
-	gsl_vector *x;
+	gsl_vector_view x;
 	int status;
 	int res = FALSE;
 	int iter;
@@ -132,14 +323,13 @@ static int fit_detector_position(HklMode *mode,
 	params.geometry = geometry;
 	params.detector = detector;
 	params.kf0 = kf;
-	params.axes = malloc(sizeof(*params.axes) * detector_holder->config->len);
+	params.axes = hkl_engine_arena_alloc(engine, sizeof(*params.axes) * detector_holder->config->len);
 	params.len = 0;
 	/* for each axis of the mode */
-	darray_foreach(axis_name, mode->info->axes_w){
+	darray_foreach(axis_idx, mode->axes_w_idx){
 		size_t k;
-		size_t tmp;
+		size_t tmp = *axis_idx;
 
-		tmp = hkl_geometry_get_axis_idx_by_name(params.geometry, *axis_name);
 		/* check that this axis is in the detector's holder */
 		for(k=0; k<detector_holder->config->len; ++k)
 			if(tmp == detector_holder->config->idx[k]){
@@ -160,23 +350,27 @@ static int fit_detector_position(HklMode *mode,
 
 	/* if no detector axis found ???? abort */
 	/* maybe put this at the begining of the method */
-	if (params.len > 0){
+	if (params.len > 0
+	    && fit_detector_position_closed_form(&params, detector_holder)){
+		res = TRUE;
+	}else if (params.len > 0){
 		size_t i;
 
 		/* now solve the system */
 		/* Initialize method  */
 		T = gsl_multiroot_fsolver_hybrid;
 		s = gsl_multiroot_fsolver_alloc (T, params.len);
-		x = gsl_vector_alloc(params.len);
+		x = gsl_vector_view_array(hkl_engine_arena_alloc(engine, params.len * sizeof(double)),
+					  params.len);
 
 		/* initialize x with the right values */
 		for(i=0; i<params.len; ++i)
-			x->data[i] = hkl_parameter_value_get(params.axes[i], HKL_UNIT_DEFAULT);
+			x.vector.data[i] = hkl_parameter_value_get(params.axes[i], HKL_UNIT_DEFAULT);
 
 		f.f = fit_detector_function;
 		f.n = params.len;
 		f.params = &params;
-		gsl_multiroot_fsolver_set (s, &f, x);
+		gsl_multiroot_fsolver_set (s, &f, &x.vector);
 
 		/* iterate to find the solution */
 		iter = 0;
@@ -186,8 +380,8 @@ static int fit_detector_position(HklMode *mode,
 			if (status || iter % 100 == 0) {
 				/* Restart from another point. */
 				for(i=0; i<params.len; ++i)
-					x->data[i] = (double)rand() / RAND_MAX * 180. / M_PI;
-				gsl_multiroot_fsolver_set(s, &f, x);
+					x.vector.data[i] = (double)rand() / RAND_MAX * 180. / M_PI;
+				gsl_multiroot_fsolver_set(s, &f, &x.vector);
 				gsl_multiroot_fsolver_iterate(s);
 			}
 			status = gsl_multiroot_test_residual (s->f, HKL_EPSILON);
@@ -221,10 +415,8 @@ static int fit_detector_position(HklMode *mode,
 			}
 		}
 		/* release memory */
-		gsl_vector_free(x);
 		gsl_multiroot_fsolver_free(s);
 	}
-	free(params.axes);
 
 	return res;
 }
@@ -234,18 +426,17 @@ static int fit_detector_position(HklMode *mode,
 /* which is part of the axis_names of the mode */
 /* return -1 if there is no axes of the mode in the sample part of the geometry */
 static int get_last_sample_axis_idx(HklGeometry *geometry, const HklSample *sample,
-				    const darray_string *axes)
+				    const darray_int *axes_idx)
 {
 	int last = -1;
-	const char **axis_name;
+	const int *axis_idx;
 	HklHolder *sample_holder = hkl_geometry_sample_holder_get(geometry, sample);
 
-	darray_foreach(axis_name, *axes){
+	darray_foreach(axis_idx, *axes_idx){
 		size_t i;
-		size_t idx;
+		size_t idx = *axis_idx;
 
 		/* FIXME for now the sample holder is the first one */
-		idx = hkl_geometry_get_axis_idx_by_name(geometry, *axis_name);
 		for(i=0; i<sample_holder->config->len; ++i)
 			if(idx == sample_holder->config->idx[i]){
 				last = last > (int)i ? last : (int)i;
@@ -285,6 +476,140 @@ int hkl_is_reachable(HklEngine *engine, double wavelength, GError **error)
 	return TRUE;
 }
 
+/* rotate the interval vector v around the unit vector a by an angle
+ * in t, using the Rodrigues formula
+ * v' = v cos(t) + (a x v) sin(t) + a (a.v) (1 - cos(t)) */
+static void interval_vector_rotate(HklInterval v[3], const HklVector *a,
+				   const HklInterval *t)
+{
+	HklInterval c = *t;
+	HklInterval s = *t;
+	HklInterval omc;
+	HklInterval av = {0, 0};
+	HklInterval axv[3];
+	size_t i;
+
+	hkl_interval_cos(&c);
+	hkl_interval_sin(&s);
+	omc = c;
+
+	for(i=0; i<3; ++i){
+		HklInterval tmp = v[i];
+
+		hkl_interval_times_double(&tmp, a->data[i]);
+		hkl_interval_plus_interval(&av, &tmp);
+	}
+
+	for(i=0; i<3; ++i){
+		size_t j = (i + 1) % 3;
+		size_t k = (i + 2) % 3;
+		HklInterval tmp = v[j];
+
+		axv[i] = v[k];
+		hkl_interval_times_double(&axv[i], a->data[j]);
+		hkl_interval_times_double(&tmp, a->data[k]);
+		hkl_interval_minus_interval(&axv[i], &tmp);
+	}
+
+	hkl_interval_times_double(&omc, -1);
+	hkl_interval_plus_double(&omc, 1);
+
+	for(i=0; i<3; ++i){
+		HklInterval tmp;
+
+		hkl_interval_times_interval(&v[i], &c);
+
+		tmp = axv[i];
+		hkl_interval_times_interval(&tmp, &s);
+		hkl_interval_plus_interval(&v[i], &tmp);
+
+		tmp = av;
+		hkl_interval_times_double(&tmp, a->data[i]);
+		hkl_interval_times_interval(&tmp, &omc);
+		hkl_interval_plus_interval(&v[i], &tmp);
+	}
+}
+
+/* bound the scattering angle reachable by the detector holder. The
+ * axes written by the engine span their whole range, the others stay
+ * at their current value. Then check that the 2theta of the hkl
+ * target lies into this enclosure before starting the solver. */
+static int hkl_is_reachable_by_detector(HklEngine *engine,
+					HklGeometry *geometry,
+					HklDetector *detector,
+					GError **error)
+{
+	const HklEngineHkl *engine_hkl = container_of(engine, HklEngineHkl, engine);
+	HklHolder *holder;
+	HklVector Hkl = reciprocal_plan(engine_hkl);
+	HklVector ki;
+	HklVector kf0;
+	HklInterval kf[3] = {{1, 1}, {0, 0}, {0, 0}};
+	HklInterval cos_tth = {0, 0};
+	double k = HKL_TAU / geometry->source.wave_length;
+	double cos_tth_target;
+	double cos_tth0;
+	int i;
+
+	if(darray_size(geometry->holders) <= HKL_HOLDER_DETECTOR_IDX)
+		return TRUE;
+	holder = darray_item(geometry->holders, HKL_HOLDER_DETECTOR_IDX);
+
+	hkl_geometry_update(geometry);
+	ki = hkl_geometry_ki_get(geometry);
+	kf0 = hkl_geometry_kf_get(geometry, detector);
+	hkl_vector_normalize(&ki);
+	hkl_vector_normalize(&kf0);
+	cos_tth0 = hkl_vector_scalar_product(&ki, &kf0);
+
+	/* kf = q0 q1 ... qn kf0, so rotate by the last axis first */
+	for(i=holder->config->len - 1; i>=0; --i){
+		const HklParameter *p = darray_item(geometry->axes,
+						    holder->config->idx[i]);
+		HklInterval t = {p->_value, p->_value};
+		HklParameter **axis;
+
+		if(NULL == hkl_parameter_quaternion_get(p))
+			continue;
+
+		darray_foreach(axis, engine->axes)
+			if(*axis == p){
+				t = p->range;
+				break;
+			}
+
+		interval_vector_rotate(kf, hkl_parameter_axis_v_get(p), &t);
+	}
+
+	for(i=0; i<3; ++i){
+		HklInterval tmp = kf[i];
+
+		hkl_interval_times_double(&tmp, ki.data[i]);
+		hkl_interval_plus_interval(&cos_tth, &tmp);
+	}
+
+	/* the enclosure relies on the default kf computation, give up
+	 * when it does not contain the current detector position */
+	if(cos_tth0 < cos_tth.min - HKL_EPSILON
+	   || cos_tth0 > cos_tth.max + HKL_EPSILON)
+		return TRUE;
+
+	/* |kf - ki| = |Q| with |ki| = |kf| = k */
+	hkl_matrix_times_vector(&engine->sample->UB, &Hkl);
+	cos_tth_target = 1 - hkl_vector_norm2(&Hkl) * hkl_vector_norm2(&Hkl) / (2 * k * k);
+
+	if(cos_tth_target < cos_tth.min - HKL_EPSILON
+	   || cos_tth_target > cos_tth.max + HKL_EPSILON){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_SET,
+			    "unreachable hkl, out of the detector axes range");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * _RUBh_minus_Q_func: (skip)
  * @x:
@@ -302,6 +627,465 @@ int _RUBh_minus_Q_func(const gsl_vector *x, void *params, gsl_vector *f)
 	return RUBh_minus_Q(x->data, params, f->data);
 }
 
+/* add sign * d(q v)/dtheta = sign * (a x v) to the column of each
+ * rotation axis of the holder written by the engine, a being the
+ * axis of rotation in the laboratory frame. */
+static void holder_jacobian(const HklHolder *holder, const HklEngine *engine,
+			    const HklVector *v, double sign, gsl_matrix *J)
+{
+	HklQuaternion q = {{1, 0, 0, 0}};
+	size_t i;
+
+	for(i=0; i<holder->config->len; ++i){
+		const HklParameter *p = darray_item(holder->geometry->axes,
+						    holder->config->idx[i]);
+		const HklQuaternion *qi = hkl_parameter_quaternion_get(p);
+		HklParameter **axis;
+		size_t j = 0;
+
+		if(NULL == qi)
+			continue;
+
+		darray_foreach(axis, engine->axes){
+			if(*axis == p){
+				HklVector a = *hkl_parameter_axis_v_get(p);
+				size_t k;
+
+				hkl_vector_rotated_quaternion(&a, &q);
+				hkl_vector_vectorial_product(&a, v);
+				for(k=0; k<3; ++k)
+					gsl_matrix_set(J, k, j,
+						       gsl_matrix_get(J, k, j) + sign * a.data[k]);
+			}
+			++j;
+		}
+		hkl_quaternion_times_quaternion(&q, qi);
+	}
+}
+
+/**
+ * _RUBh_minus_Q_jacobian: (skip)
+ * @x:
+ * @params:
+ * @J:
+ *
+ * The analytic derivatives of _RUBh_minus_Q_func, only for the
+ * default geometry operations.
+ *
+ * Returns:
+ **/
+int _RUBh_minus_Q_jacobian(const gsl_vector *x, void *params, gsl_matrix *J)
+{
+	HklEngine *engine = params;
+	HklEngineHkl *engine_hkl = container_of(engine, HklEngineHkl, engine);
+	const HklVector Hkl = reciprocal_plan(engine_hkl);
+
+	CHECK_NAN(x->data, x->size);
+
+	if(engine->geometry->ops != &hkl_geometry_operations_defaults)
+		return GSL_EUNIMPL;
+
+	/* update the workspace from x; */
+	set_geometry_axes(engine, x->data);
+
+	/* dQ = kf - ki - R UB hkl, ki does not move */
+	const struct HklHklWrite w = hkl_hkl_write(engine->geometry,
+						   engine->detector,
+						   engine->sample,
+						   &Hkl);
+
+	gsl_matrix_set_zero(J);
+	holder_jacobian(hkl_geometry_detector_holder_get(engine->geometry, engine->detector),
+			engine, &w.kf, 1, J);
+	holder_jacobian(hkl_geometry_sample_holder_get(engine->geometry, engine->sample),
+			engine, &w.hkl, -1, J);
+
+	return GSL_SUCCESS;
+}
+
+/*************************/
+/* closed form solutions */
+/*************************/
+
+/* the position of an axis in a holder */
+static int holder_axis_idx(const HklHolder *holder, const HklParameter *axis,
+			   size_t *idx)
+{
+	size_t i;
+
+	for(i=0; i<holder->config->len; ++i)
+		if(darray_item(holder->geometry->axes, holder->config->idx[i]) == axis){
+			*idx = i;
+			return TRUE;
+		}
+
+	return FALSE;
+}
+
+/* the rotation of the holder axes in [first, last[ */
+static HklQuaternion holder_rotation(const HklHolder *holder, size_t first, size_t last)
+{
+	HklQuaternion q = {{1, 0, 0, 0}};
+	size_t i;
+
+	for(i=first; i<last; ++i){
+		const HklQuaternion *qi = hkl_parameter_quaternion_get(darray_item(holder->geometry->axes,
+										   holder->config->idx[i]));
+		if(NULL != qi)
+			hkl_quaternion_times_quaternion(&q, qi);
+	}
+
+	return q;
+}
+
+static HklVector axis_direction(const HklParameter *axis)
+{
+	HklVector a = *hkl_parameter_axis_v_get(axis);
+
+	hkl_vector_normalize(&a);
+
+	return a;
+}
+
+static void vector_rotated_inverse(HklVector *v, const HklQuaternion *q)
+{
+	HklQuaternion qc = *q;
+
+	hkl_quaternion_conjugate(&qc);
+	hkl_vector_rotated_quaternion(v, &qc);
+}
+
+/* the solutions of a cos(t) + b sin(t) = c */
+static size_t trigonometric_solutions(double a, double b, double c, double t[2])
+{
+	double r = hypot(a, b);
+	double d;
+
+	if(r < HKL_EPSILON)
+		return 0;
+	if(fabs(c) > r){
+		if(fabs(c) - r > HKL_EPSILON)
+			return 0;
+		c = copysign(r, c);
+	}
+
+	d = acos(c / r);
+	t[0] = atan2(b, a) + d;
+	t[1] = atan2(b, a) - d;
+
+	return d < HKL_EPSILON ? 1 : 2;
+}
+
+/* the angle of the rotation around the unit axis a moving u on v */
+static int rotation_angle(const HklVector *a, const HklVector *u, const HklVector *v,
+			  double *angle)
+{
+	HklVector up = *u;
+	HklVector vp = *v;
+	HklVector n;
+
+	hkl_vector_project_on_plan(&up, a);
+	hkl_vector_project_on_plan(&vp, a);
+	if(hkl_vector_norm2(&up) < HKL_EPSILON || hkl_vector_norm2(&vp) < HKL_EPSILON)
+		return FALSE;
+
+	n = up;
+	hkl_vector_vectorial_product(&n, &vp);
+	*angle = atan2(hkl_vector_scalar_product(a, &n),
+		       hkl_vector_scalar_product(&up, &vp));
+
+	return TRUE;
+}
+
+/* the angles of R_a(t[0]) R_b(t[1]) p = q for the unit axes a and b */
+static size_t rotations_solutions(const HklVector *a, const HklVector *b,
+				  const HklVector *p, const HklVector *q,
+				  double t[2][2])
+{
+	double ab = hkl_vector_scalar_product(a, b);
+	double d = 1 - ab * ab;
+	double aq = hkl_vector_scalar_product(a, q);
+	double bp = hkl_vector_scalar_product(b, p);
+	double alpha, beta, gamma2;
+	HklVector c = *a;
+	size_t i, n = 0;
+
+	/* parallel axes */
+	if(d < HKL_EPSILON)
+		return 0;
+
+	/* z = R_b(t[1]) p = R_a(-t[0]) q = alpha a + beta b + gamma a x b */
+	alpha = (aq - ab * bp) / d;
+	beta = (bp - ab * aq) / d;
+	gamma2 = (hkl_vector_scalar_product(p, p)
+		  - alpha * alpha - beta * beta - 2 * alpha * beta * ab) / d;
+	if(gamma2 < -HKL_EPSILON)
+		return 0;
+
+	hkl_vector_vectorial_product(&c, b);
+	for(i=0; i<2; ++i){
+		double gamma = (i ? -1 : 1) * sqrt(fabs(gamma2));
+		HklVector z = *a;
+		HklVector tmp;
+
+		hkl_vector_times_double(&z, alpha);
+		tmp = *b;
+		hkl_vector_times_double(&tmp, beta);
+		hkl_vector_add_vector(&z, &tmp);
+		tmp = c;
+		hkl_vector_times_double(&tmp, gamma);
+		hkl_vector_add_vector(&z, &tmp);
+
+		if(rotation_angle(a, &z, q, &t[n][0])
+		   && rotation_angle(b, p, &z, &t[n][1]))
+			++n;
+		else
+			return 0; /* degenerated, p or q along an axis */
+
+		if(gamma2 < HKL_EPSILON)
+			break;
+	}
+
+	return n;
+}
+
+/* the values of the detector axis giving the norm of UB.hkl, the
+ * other axes being fixed */
+static size_t detector_solutions(HklEngine *engine, const HklParameter *axis,
+				 double t[2])
+{
+	HklEngineHkl *engine_hkl = container_of(engine, HklEngineHkl, engine);
+	const HklHolder *holder = hkl_geometry_detector_holder_get(engine->geometry,
+								   engine->detector);
+	HklVector hkl = reciprocal_plan(engine_hkl);
+	HklVector ki = hkl_geometry_ki_get(engine->geometry);
+	HklVector v = hkl_geometry_kf_get(engine->geometry, engine->detector);
+	HklVector a = axis_direction(axis);
+	HklVector axv;
+	HklQuaternion q;
+	double av, c;
+	size_t idx;
+
+	if(!holder_axis_idx(holder, axis, &idx))
+		return 0;
+
+	hkl_matrix_times_vector(&engine->sample->UB, &hkl);
+
+	/* kf = D_before R_a(t) D_after kf_0 and |kf - ki| = |UB.hkl| */
+	vector_rotated_inverse(&v, &holder->q);
+	q = holder_rotation(holder, idx + 1, holder->config->len);
+	hkl_vector_rotated_quaternion(&v, &q);
+	q = holder_rotation(holder, 0, idx);
+	vector_rotated_inverse(&ki, &q);
+
+	c = hkl_vector_scalar_product(&ki, &ki)
+		- hkl_vector_scalar_product(&hkl, &hkl) / 2;
+	av = hkl_vector_scalar_product(&a, &v);
+	axv = a;
+	hkl_vector_vectorial_product(&axv, &v);
+
+	return trigonometric_solutions(hkl_vector_scalar_product(&ki, &v)
+				       - av * hkl_vector_scalar_product(&ki, &a),
+				       hkl_vector_scalar_product(&ki, &axv),
+				       c - av * hkl_vector_scalar_product(&ki, &a),
+				       t);
+}
+
+/* the values of two sample axes for R.UB.hkl = Q, the other axes
+ * being fixed */
+static size_t sample_solutions(HklEngine *engine,
+			       const HklParameter *axis1, const HklParameter *axis2,
+			       double t[2][2])
+{
+	HklEngineHkl *engine_hkl = container_of(engine, HklEngineHkl, engine);
+	const HklHolder *holder = hkl_geometry_sample_holder_get(engine->geometry,
+								 engine->sample);
+	HklVector p = reciprocal_plan(engine_hkl);
+	HklVector Q = hkl_geometry_kf_get(engine->geometry, engine->detector);
+	HklVector ki = hkl_geometry_ki_get(engine->geometry);
+	HklVector a, b;
+	HklQuaternion q;
+	size_t i, j, k, n;
+	int swapped = FALSE;
+
+	if(!holder_axis_idx(holder, axis1, &i) || !holder_axis_idx(holder, axis2, &j))
+		return 0;
+
+	/* keep the holder order */
+	if(i > j){
+		const HklParameter *tmp = axis1;
+		size_t tmp_idx = i;
+
+		axis1 = axis2;
+		axis2 = tmp;
+		i = j;
+		j = tmp_idx;
+		swapped = TRUE;
+	}
+
+	hkl_matrix_times_vector(&engine->sample->UB, &p);
+	hkl_vector_minus_vector(&Q, &ki);
+
+	/* P R_a(t1) M R_b(t2) S p = Q
+	 * => R_a(t1) R_Mb(t2) M S p = P^-1 Q */
+	q = holder_rotation(holder, 0, i);
+	vector_rotated_inverse(&Q, &q);
+	q = holder_rotation(holder, j + 1, holder->config->len);
+	hkl_vector_rotated_quaternion(&p, &q);
+	q = holder_rotation(holder, i + 1, j);
+	hkl_vector_rotated_quaternion(&p, &q);
+	a = axis_direction(axis1);
+	b = axis_direction(axis2);
+	hkl_vector_rotated_quaternion(&b, &q);
+
+	n = rotations_solutions(&a, &b, &p, &Q, t);
+
+	/* back in the order of the caller */
+	if(swapped)
+		for(k=0; k<n; ++k){
+			double tmp = t[k][0];
+
+			t[k][0] = t[k][1];
+			t[k][1] = tmp;
+		}
+
+	return n;
+}
+
+static void axis_value_set(HklEngine *engine, size_t i, double value)
+{
+	hkl_parameter_value_set(darray_item(engine->axes, i), value,
+				HKL_UNIT_DEFAULT, NULL);
+	hkl_geometry_update(engine->geometry);
+}
+
+/* the axes written by the engine, the detector one and two sample
+ * ones, when the closed form solutions can be used */
+static int closed_form_axes(const HklEngine *engine, size_t *d, size_t s[2],
+			    size_t first)
+{
+	const HklHolder *sample = hkl_geometry_sample_holder_get(engine->geometry,
+								 engine->sample);
+	const HklHolder *detector = hkl_geometry_detector_holder_get(engine->geometry,
+								     engine->detector);
+	size_t i, idx, n_d = 0, n_s = 0;
+
+	if(engine->geometry->ops != &hkl_geometry_operations_defaults
+	   || sample == detector)
+		return FALSE;
+
+	for(i=first; i<darray_size(engine->axes); ++i){
+		const HklParameter *axis = darray_item(engine->axes, i);
+
+		if(NULL == hkl_parameter_quaternion_get(axis))
+			return FALSE;
+		if(holder_axis_idx(detector, axis, &idx)){
+			if(n_d++ == 0)
+				*d = i;
+		}else if(holder_axis_idx(sample, axis, &idx)){
+			if(n_s < 2)
+				s[n_s] = i;
+			n_s++;
+		}else
+			return FALSE;
+	}
+
+	return n_d == 1 && n_s == 2;
+}
+
+/**
+ * _RUBh_minus_Q_solutions: (skip)
+ * @engine:
+ * @x:
+ * @n:
+ *
+ * The closed form solutions of _RUBh_minus_Q_func when the engine
+ * writes one detector axis and two sample rotation axes.
+ *
+ * Returns: the number of solutions written in @x
+ **/
+size_t _RUBh_minus_Q_solutions(HklEngine *engine, double x[], size_t n)
+{
+	const size_t len = darray_size(engine->axes);
+	double td[2];
+	size_t d, s[2], i, j, nd, res = 0;
+
+	if(!closed_form_axes(engine, &d, s, 0))
+		return 0;
+
+	nd = detector_solutions(engine, darray_item(engine->axes, d), td);
+	for(i=0; i<nd; ++i){
+		double ts[2][2];
+		size_t ns;
+
+		axis_value_set(engine, d, td[i]);
+		ns = sample_solutions(engine,
+				      darray_item(engine->axes, s[0]),
+				      darray_item(engine->axes, s[1]),
+				      ts);
+		for(j=0; j<ns && res<n; ++j, ++res){
+			double *row = &x[res * len];
+
+			row[d] = td[i];
+			row[s[0]] = ts[j][0];
+			row[s[1]] = ts[j][1];
+		}
+	}
+
+	return res;
+}
+
+/**
+ * _bissector_solutions: (skip)
+ * @engine:
+ * @x:
+ * @n:
+ *
+ * The closed form solutions of the bissector modes, the engine
+ * writes omega, two other sample axes and tth = 2 omega.
+ *
+ * Returns: the number of solutions written in @x
+ **/
+size_t _bissector_solutions(HklEngine *engine, double x[], size_t n)
+{
+	const size_t len = darray_size(engine->axes);
+	double td[2];
+	size_t d, s[2], i, j, k, nd, res = 0;
+
+	if(len != 4 || !closed_form_axes(engine, &d, s, 1) || d != 3
+	   || !holder_axis_idx(hkl_geometry_sample_holder_get(engine->geometry, engine->sample),
+			       darray_item(engine->axes, 0), &i))
+		return 0;
+
+	nd = detector_solutions(engine, darray_item(engine->axes, d), td);
+	for(i=0; i<nd; ++i){
+		/* tth = 2 fmod(omega, pi) */
+		const double omegas[] = {td[i] / 2, td[i] / 2 + M_PI, td[i] / 2 - M_PI};
+
+		axis_value_set(engine, d, td[i]);
+		for(k=0; k<ARRAY_SIZE(omegas); ++k){
+			double ts[2][2];
+			size_t ns;
+
+			axis_value_set(engine, 0, omegas[k]);
+			ns = sample_solutions(engine,
+					      darray_item(engine->axes, s[0]),
+					      darray_item(engine->axes, s[1]),
+					      ts);
+			for(j=0; j<ns && res<n; ++j, ++res){
+				double *row = &x[res * len];
+
+				row[0] = omegas[k];
+				row[d] = td[i];
+				row[s[0]] = ts[j][0];
+				row[s[1]] = ts[j][1];
+			}
+		}
+	}
+
+	return res;
+}
+
 /**
  * RUBh_minus_Q: (skip)
  * @x:
@@ -372,6 +1156,15 @@ int hkl_mode_set_hkl_real(HklMode *self,
 	}
 	hkl_assert(error == NULL || *error == NULL);
 
+	/* a geometry multiply can bring back a solution out of range */
+	if(NULL == engine->engines->geometries->multiply
+	   && !engine->engines->ops->post_engine_set_multiply
+	   && !hkl_is_reachable_by_detector(engine, geometry, detector, error)){
+		hkl_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+	hkl_assert(error == NULL || *error == NULL);
+
 	/* compute the mode */
 	if(!hkl_mode_auto_set_real(self, engine,
 				   geometry, detector, sample,
@@ -384,10 +1177,9 @@ int hkl_mode_set_hkl_real(HklMode *self,
 
 	/* check that the mode allow to move a sample axis */
 	/* FIXME for now the sample holder is the first one */
-	last_axis = get_last_sample_axis_idx(geometry, sample, &self->info->axes_w);
+	last_axis = get_last_sample_axis_idx(geometry, sample, &self->axes_w_idx);
 	if(last_axis >= 0){
 		uint i;
-		const HklGeometryListItem *item;
 		uint len = engine->engines->geometries->n_items;
 
 		/* For each solution already found we will generate another one */
@@ -409,9 +1201,8 @@ int hkl_mode_set_hkl_real(HklMode *self,
 		/* at the end we just need to solve numerically the position of the detector */
 
 		/* we will add solution to the geometries so save its length before */
-		for(i=0, item=list_top(&engine->engines->geometries->items, HklGeometryListItem, list);
-		    i<len && NULL != item;
-		    ++i, item=list_next(&engine->engines->geometries->items, item, list)){
+		for(i=0; i<len; ++i){
+			const HklGeometryListItem *item = darray_item(engine->engines->geometries->items, i);
 			int j;
 			HklVector ki;
 			HklVector kf2;
@@ -422,9 +1213,12 @@ int hkl_mode_set_hkl_real(HklMode *self,
 			HklVector cp = {{0}};
 			HklVector op = {{0}};
 			double angle;
-			HklGeometry *geom = hkl_geometry_new_copy(item->geometry);
+			HklGeometry *geom = geometry;
 			HklHolder *sample_holder = hkl_geometry_sample_holder_get(geom, sample);
 
+			/* the engine geometry is the scratch of the new solution */
+			hkl_geometry_set(geom, item->geometry);
+
 			/* get the Q vector kf - ki */
 			ki = hkl_geometry_ki_get(geom);
 			q = hkl_geometry_kf_get(geom, detector);
@@ -456,10 +1250,8 @@ int hkl_mode_set_hkl_real(HklMode *self,
 			/* TODO parameter list for geometry */
 			if(!hkl_parameter_value_set(&axis->parameter,
 						    hkl_parameter_value_get(&axis->parameter, HKL_UNIT_DEFAULT) + angle,
-						    HKL_UNIT_DEFAULT, error)){
-				hkl_geometry_free(geom);
+						    HKL_UNIT_DEFAULT, error))
 				return FALSE;
-			}
 			hkl_geometry_update(geom);
 #ifdef DEBUG
 			fprintf(stdout, "\n- try to add a solution by rotating Q <%f, %f, %f> around the \"%s\" axis <%f, %f, %f> of %f radian",
@@ -473,11 +1265,14 @@ int hkl_mode_set_hkl_real(HklMode *self,
 			hkl_vector_add_vector(&kf2, &ki);
 
 			/* at the end we just need to solve numerically the position of the detector */
-			if(fit_detector_position(self, geom, detector, sample, &kf2))
-				hkl_geometry_list_add(engine->engines->geometries,
-						      geom);
-
-			hkl_geometry_free(geom);
+			if(fit_detector_position(self, engine, geom, detector, sample, &kf2)){
+				if(engine->engines->is_colliding
+				   && engine->engines->is_colliding(geom, engine->engines->is_colliding_data))
+					engine->stats.collisions++;
+				else
+					hkl_geometry_list_add(engine->engines->geometries,
+							      geom);
+			}
 		}
 	}
 	return TRUE;
@@ -869,3 +1664,273 @@ HklEngine *hkl_engine_hkl_new(HklEngineList *engines)
 
 	return &self->engine;
 }
+
+/**************/
+/* trajectory */
+/**************/
+
+/* number of newton iterations from the predicted point */
+#define HKL_MODE_AUTO_TRAJECTORY_MAX_ITER 10
+
+/* the function followed along the trajectory, NULL if the mode of
+ * the engine is not an auto or an hkl mode */
+static const HklFunction *trajectory_function(const HklEngine *self)
+{
+	const HklModeAutoInfo *auto_info;
+
+	if(self->mode->ops->set != hkl_mode_auto_set_real
+	   && self->mode->ops->set != hkl_mode_set_hkl_real)
+		return NULL;
+
+	auto_info = container_of(self->mode->info, HklModeAutoInfo, info);
+	if(0 == darray_size(auto_info->functions))
+		return NULL;
+
+	return darray_item(auto_info->functions, 0);
+}
+
+/*
+ * move the engine geometry from the predicted point to the solution
+ * of the function with a few newton iterations.
+ */
+static int trajectory_step(HklEngine *self, const HklFunction *function,
+			   gsl_multiroot_function *F,
+			   gsl_vector *x, gsl_vector *f, gsl_vector *dx,
+			   gsl_matrix *J, gsl_permutation *p)
+{
+	size_t iter;
+	int signum;
+
+	for(iter=0; iter<HKL_MODE_AUTO_TRAJECTORY_MAX_ITER; ++iter){
+		self->stats.evaluations++;
+		if (GSL_SUCCESS != GSL_MULTIROOT_FN_EVAL(F, x, f))
+			break;
+		if (GSL_SUCCESS == gsl_multiroot_test_residual(f, HKL_EPSILON / 10.)){
+			self->stats.iterations += iter;
+			return TRUE;
+		}
+
+		if (NULL == function->jacobian
+		    || GSL_SUCCESS != function->jacobian(x, self, J))
+			gsl_multiroot_fdjacobian(F, x, f, GSL_SQRT_DBL_EPSILON, J);
+		gsl_linalg_LU_decomp(J, p, &signum);
+		if (0 == gsl_linalg_LU_det(J, signum))
+			break;
+		gsl_linalg_LU_solve(J, p, f, dx);
+		gsl_vector_sub(x, dx);
+	}
+	self->stats.iterations += iter;
+
+	return FALSE;
+}
+
+/* solve the point from scratch and keep the closest solution */
+static int trajectory_solve(HklEngine *self)
+{
+	const HklGeometryListItem *item;
+	const HklGeometry *best = NULL;
+	double distance = INFINITY;
+
+	hkl_geometry_set(self->engines->geometry, self->geometry);
+	if(!hkl_engine_set(self, NULL))
+		return FALSE;
+
+	HKL_GEOMETRY_LIST_FOREACH(item, self->engines->geometries){
+		double tmp = hkl_geometry_distance(item->geometry, self->engines->geometry);
+
+		if(tmp < distance){
+			distance = tmp;
+			best = item->geometry;
+		}
+	}
+	if(NULL == best)
+		return FALSE;
+	hkl_geometry_set(self->geometry, best);
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_wavelength_values_set_trajectory: (skip)
+ * @self: the this ptr
+ * @values: the pseudo axes values kept during the scan
+ * @n_values: the number of pseudo axes of the engine
+ * @wavelengths: the n_wavelengths wavelengths of the energy scan
+ * @n_wavelengths: the number of points of the scan
+ * @unit_type: the unit type (default or user) of the values
+ * @axes: the n_wavelengths x n_axes axes values of the trajectory
+ * @n_axes: the number of axes of the geometry
+ * @valid: the n_wavelengths flags, TRUE if the point was solved
+ * @error: return location for a GError, or NULL
+ *
+ * Step the wavelength from the current geometry at fixed pseudo axes
+ * values. For the auto and hkl modes, each point starts from the previous
+ * ones extrapolated linearly in 1 / wavelength, the scale of Q in the
+ * laboratory frame, and is refined with a few newton iterations of
+ * the mode function. A point which does not converge, or any point
+ * of the other modes, is solved with hkl_engine_pseudo_axis_values_set
+ * and the closest solution is kept. The scan should be finely
+ * sampled. The geometry of the engine list is restored once done.
+ *
+ * Return value: FALSE if the sizes do not match the engine or if a
+ * point has no solution.
+ **/
+int hkl_engine_wavelength_values_set_trajectory(HklEngine *self,
+						const double values[], size_t n_values,
+						const double wavelengths[], size_t n_wavelengths,
+						HklUnitEnum unit_type,
+						double axes[], size_t n_axes,
+						int valid[],
+						GError **error)
+{
+	const HklFunction *function;
+	gsl_multiroot_function F = {
+		.params = self,
+	};
+	gsl_vector *x = NULL, *f = NULL, *dx = NULL;
+	gsl_matrix *J = NULL;
+	gsl_permutation *p = NULL;
+	HklParameter **axis;
+	size_t i, j;
+	int res = TRUE;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!self->mode){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "the \"%s\" engine has no mode",
+			    self->info->name);
+		return FALSE;
+	}
+
+	if(n_values != darray_size(self->info->pseudo_axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values,  darray_size(self->info->pseudo_axes));
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->engines->geometry->axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->engines->geometry->axes));
+		return FALSE;
+	}
+
+	for(i=0; i<n_values; ++i)
+		if(!hkl_parameter_value_set(darray_item(self->pseudo_axes, i),
+					    values[i], unit_type, error))
+			return FALSE;
+
+	function = trajectory_function(self);
+	if(function){
+		F.f = function->function;
+		F.n = function->size;
+		x = gsl_vector_alloc(F.n);
+		f = gsl_vector_alloc(F.n);
+		dx = gsl_vector_alloc(F.n);
+		J = gsl_matrix_alloc(F.n, F.n);
+		p = gsl_permutation_alloc(F.n);
+	}
+
+	{
+		double saved[n_axes];
+		double saved_wavelength = hkl_geometry_wavelength_get(self->engines->geometry,
+								      HKL_UNIT_DEFAULT);
+		size_t len = darray_size(self->mode->info->axes_w);
+		double x0[len];
+		double previous[2][len]; /* the last two solutions, most recent first */
+		double k[2] = {0., 0.};
+		size_t n_previous = 0;
+
+		hkl_geometry_axis_values_get(self->engines->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT);
+		hkl_engine_prepare_internal(self);
+
+		for(i=0; i<n_wavelengths; ++i){
+			double *position = &axes[i * n_axes];
+			double ki;
+
+			IGNORE(hkl_geometry_wavelength_set(self->geometry, wavelengths[i],
+							   unit_type, NULL));
+			ki = 1. / hkl_geometry_wavelength_get(self->geometry, HKL_UNIT_DEFAULT);
+
+			j = 0;
+			darray_foreach(axis, self->axes){
+				x0[j++] = (*axis)->_value;
+			}
+
+			valid[i] = FALSE;
+			if(function){
+				self->stats.solves++;
+				memcpy(x->data, x0, len * sizeof(double));
+
+				/* the tangent predictor */
+				if(2 == n_previous && k[0] != k[1])
+					for(j=0; j<len; ++j)
+						x->data[j] += (previous[0][j] - previous[1][j])
+							* (ki - k[0]) / (k[0] - k[1]);
+
+				valid[i] = trajectory_step(self, function, &F, x, f, dx, J, p);
+				if(valid[i]){
+					set_geometry_axes(self, x->data);
+					valid[i] = hkl_geometry_is_valid(self->geometry)
+						&& !(self->engines->is_colliding
+						     && self->engines->is_colliding(self->geometry,
+										    self->engines->is_colliding_data));
+				}
+				if(!valid[i])
+					set_geometry_axes(self, x0);
+			}
+			if(!valid[i])
+				valid[i] = trajectory_solve(self);
+
+			if(valid[i]){
+				hkl_geometry_axis_values_get(self->geometry,
+							     position, n_axes, unit_type);
+
+				memcpy(previous[1], previous[0], len * sizeof(double));
+				k[1] = k[0];
+				j = 0;
+				darray_foreach(axis, self->axes){
+					previous[0][j++] = (*axis)->_value;
+				}
+				k[0] = ki;
+				if(n_previous < 2)
+					n_previous++;
+			}else{
+				for(j=0; j<n_axes; ++j)
+					position[j] = NAN;
+				n_previous = 0;
+				res = FALSE;
+			}
+		}
+
+		IGNORE(hkl_geometry_axis_values_set(self->engines->geometry,
+						    saved, n_axes, HKL_UNIT_DEFAULT, NULL));
+		IGNORE(hkl_geometry_wavelength_set(self->engines->geometry,
+						   saved_wavelength, HKL_UNIT_DEFAULT, NULL));
+	}
+
+	if(function){
+		gsl_permutation_free(p);
+		gsl_matrix_free(J);
+		gsl_vector_free(dx);
+		gsl_vector_free(f);
+		gsl_vector_free(x);
+	}
+
+	if(!res)
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot compute the energy trajectory, some points have no solution\n");
+
+	return res;
+}
@@ -20,10 +20,15 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 #include <gsl/gsl_errno.h>              // for ::GSL_SUCCESS
+#include <gsl/gsl_linalg.h>             // for gsl_linalg_LU_decomp, etc
+#include <gsl/gsl_multiroots.h>         // for gsl_multiroot_fdjacobian, etc
+#include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
 #include <gsl/gsl_vector_double.h>      // for gsl_vector
 #include <gsl/gsl_sys.h>                // for gsl_isnan
+#include <math.h>                       // for INFINITY, NAN
 #include <stdio.h>                      // for fprintf, stderr
 #include <stdlib.h>                     // for NULL, exit, free
+#include <string.h>                     // for memcpy
 #include <sys/types.h>                  // for uint
 #include "hkl-detector-private.h"       // for hkl_detector_compute_kf
 #include "hkl-geometry-private.h"       // for HklHolder, _HklGeometry, etc
@@ -52,6 +57,7 @@ static GQuark hkl_mode_psi_error_quark (void)
 typedef enum {
 	HKL_MODE_PSI_ERROR_INIT, /* can not init the engine */
 	HKL_MODE_PSI_ERROR_GET, /* can not get the engine */
+	HKL_MODE_PSI_ERROR_TRAJECTORY, /* can not compute the trajectory */
 } HklModePsiError;
 
 /***********************/
@@ -132,6 +138,17 @@ int _psi_func(const gsl_vector *x, void *params, gsl_vector *f)
 	return GSL_SUCCESS;
 }
 
+static void hkl_mode_init_copy_psi_real(HklMode *self, const HklMode *src)
+{
+	HklModePsi *psi_mode = container_of(self, HklModePsi, parent);
+	const HklModePsi *psi_src = container_of(src, HklModePsi, parent);
+
+	hkl_mode_init_copy_real(self, src);
+
+	psi_mode->Q0 = psi_src->Q0;
+	psi_mode->hkl0 = psi_src->hkl0;
+}
+
 static int hkl_mode_initialized_set_psi_real(HklMode *self,
 					     HklEngine *engine,
 					     HklGeometry *geometry,
@@ -254,6 +271,7 @@ HklMode *hkl_mode_psi_new(const HklModeAutoInfo *auto_info)
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
 		.capabilities = HKL_ENGINE_CAPABILITIES_READABLE | HKL_ENGINE_CAPABILITIES_WRITABLE | HKL_ENGINE_CAPABILITIES_INITIALIZABLE,
+		.init_copy = hkl_mode_init_copy_psi_real,
 		.initialized_set = hkl_mode_initialized_set_psi_real,
 		.get = hkl_mode_get_psi_real,
 	};
@@ -309,3 +327,204 @@ HklEngine *hkl_engine_psi_new(HklEngineList *engines)
 
 	return &self->engine;
 }
+
+/**************/
+/* trajectory */
+/**************/
+
+/* number of newton iterations from the previous point */
+#define HKL_MODE_PSI_TRAJECTORY_MAX_ITER 10
+
+/* same as _psi_func but without the 2π jump of the psi residual */
+static int _psi_trajectory_func(const gsl_vector *x, void *params, gsl_vector *f)
+{
+	int res = _psi_func(x, params, f);
+
+	f->data[3] = gsl_sf_angle_restrict_symm(f->data[3]);
+
+	return res;
+}
+
+/*
+ * move the engine geometry from its current position to the given
+ * psi with a few newton iterations. The first iteration is the
+ * tangent predictor, the rotation about Q linearised at the previous
+ * point.
+ */
+static int psi_trajectory_step(HklEngine *self, gsl_multiroot_function *F,
+			       gsl_vector *x, gsl_vector *f, gsl_vector *dx,
+			       gsl_matrix *J, gsl_permutation *p)
+{
+	size_t iter;
+	int signum;
+
+	for(iter=0; iter<HKL_MODE_PSI_TRAJECTORY_MAX_ITER; ++iter){
+		_psi_trajectory_func(x, self, f);
+		if (GSL_SUCCESS == gsl_multiroot_test_residual(f, HKL_EPSILON / 10.)){
+			self->stats.iterations += iter;
+			return TRUE;
+		}
+
+		gsl_multiroot_fdjacobian(F, x, f, GSL_SQRT_DBL_EPSILON, J);
+		gsl_linalg_LU_decomp(J, p, &signum);
+		if (0 == gsl_linalg_LU_det(J, signum))
+			break;
+		gsl_linalg_LU_solve(J, p, f, dx);
+		gsl_vector_sub(x, dx);
+	}
+	self->stats.iterations += iter;
+
+	return FALSE;
+}
+
+/* solve the point from scratch and keep the closest solution */
+static int psi_trajectory_solve(HklEngine *self)
+{
+	const HklGeometryListItem *item;
+	const HklGeometry *best = NULL;
+	double distance = INFINITY;
+
+	hkl_geometry_set(self->engines->geometry, self->geometry);
+	if(!hkl_engine_set(self, NULL))
+		return FALSE;
+
+	HKL_GEOMETRY_LIST_FOREACH(item, self->engines->geometries){
+		double tmp = hkl_geometry_distance(item->geometry, self->engines->geometry);
+
+		if(tmp < distance){
+			distance = tmp;
+			best = item->geometry;
+		}
+	}
+	hkl_geometry_set(self->geometry, best);
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_psi_values_set_trajectory: (skip)
+ * @self: the psi engine
+ * @psi: the n_psi psi values of the azimuthal scan
+ * @n_psi: the number of points of the scan
+ * @unit_type: the unit type (default or user) of the values
+ * @axes: the n_psi x n_axes axes values of the trajectory
+ * @n_axes: the number of axes of the geometry
+ * @valid: the n_psi flags, TRUE if the point was solved
+ * @error: return location for a GError, or NULL
+ *
+ * Step psi from the current geometry, each point starts from the
+ * previous one and is refined with a few newton iterations instead
+ * of solving the full hkl + psi system. A point which does not
+ * converge is solved with hkl_engine_pseudo_axis_values_set and the
+ * closest solution is kept. The engine must be initialized and the
+ * scan should be finely sampled. The geometry of the engine list is
+ * restored once done.
+ *
+ * Return value: FALSE if the engine is not an initialized psi engine,
+ * if the sizes do not match or if a point has no solution.
+ **/
+int hkl_engine_psi_values_set_trajectory(HklEngine *self,
+					 const double psi[], size_t n_psi,
+					 HklUnitEnum unit_type,
+					 double axes[], size_t n_axes,
+					 int valid[],
+					 GError **error)
+{
+	HklEnginePsi *psi_engine = container_of(self, HklEnginePsi, engine);
+	gsl_multiroot_function F = {
+		.f = _psi_trajectory_func,
+		.n = psi_func.size,
+		.params = self,
+	};
+	gsl_vector *x, *f, *dx;
+	gsl_matrix *J;
+	gsl_permutation *p;
+	HklParameter **axis;
+	size_t i, j;
+	int res = TRUE;
+
+	hkl_error(error == NULL || *error == NULL);
+
+	if(!self->mode
+	   || self->mode->ops->initialized_set != hkl_mode_initialized_set_psi_real
+	   || !self->mode->initialized){
+		g_set_error(error,
+			    HKL_MODE_PSI_ERROR,
+			    HKL_MODE_PSI_ERROR_TRAJECTORY,
+			    "the \"%s\" engine is not an initialized psi engine",
+			    self->info->name);
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->engines->geometry->axes)){
+		g_set_error(error,
+			    HKL_MODE_PSI_ERROR,
+			    HKL_MODE_PSI_ERROR_TRAJECTORY,
+			    "cannot compute the psi trajectory, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->engines->geometry->axes));
+		return FALSE;
+	}
+
+	x = gsl_vector_alloc(F.n);
+	f = gsl_vector_alloc(F.n);
+	dx = gsl_vector_alloc(F.n);
+	J = gsl_matrix_alloc(F.n, F.n);
+	p = gsl_permutation_alloc(F.n);
+
+	{
+		double saved[n_axes];
+		double x0[F.n];
+
+		hkl_geometry_axis_values_get(self->engines->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT);
+		hkl_engine_prepare_internal(self);
+
+		for(i=0; i<n_psi; ++i){
+			double *values = &axes[i * n_axes];
+
+			psi_engine->psi->_value = psi[i];
+			if(HKL_UNIT_USER == unit_type)
+				psi_engine->psi->_value /= psi_engine->psi->factor;
+
+			j = 0;
+			darray_foreach(axis, self->axes){
+				x->data[j++] = (*axis)->_value;
+			}
+			memcpy(x0, x->data, F.n * sizeof(double));
+
+			self->stats.solves++;
+			valid[i] = psi_trajectory_step(self, &F, x, f, dx, J, p);
+			if(!valid[i]){
+				set_geometry_axes(self, x0);
+				valid[i] = psi_trajectory_solve(self);
+			}
+
+			if(valid[i]){
+				hkl_geometry_axis_values_get(self->geometry,
+							     values, n_axes, unit_type);
+			}else{
+				set_geometry_axes(self, x0);
+				for(j=0; j<n_axes; ++j)
+					values[j] = NAN;
+				res = FALSE;
+			}
+		}
+
+		IGNORE(hkl_geometry_axis_values_set(self->engines->geometry,
+						    saved, n_axes, HKL_UNIT_DEFAULT, NULL));
+	}
+
+	gsl_permutation_free(p);
+	gsl_matrix_free(J);
+	gsl_vector_free(dx);
+	gsl_vector_free(f);
+	gsl_vector_free(x);
+
+	if(!res)
+		g_set_error(error,
+			    HKL_MODE_PSI_ERROR,
+			    HKL_MODE_PSI_ERROR_TRAJECTORY,
+			    "cannot compute the psi trajectory, some points have no solution\n");
+
+	return res;
+}
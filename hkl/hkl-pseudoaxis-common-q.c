@@ -24,7 +24,7 @@
 #include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
 #include <gsl/gsl_sys.h>                // for gsl_isnan
 #include <gsl/gsl_vector_double.h>      // for gsl_vector
-#include <math.h>                       // for sin, atan2, signbit
+#include <math.h>                       // for sin, atan2, signbit, hypot
 #include <stdlib.h>                     // for free
 #include "hkl-detector-private.h"       // for hkl_detector_compute_kf
 #include "hkl-geometry-private.h"       // for _HklGeometry, HklHolder
@@ -53,6 +53,20 @@ double qmax(double wavelength)
 	return 2 * HKL_TAU / wavelength;
 }
 
+/* avoid the useless numerical search of an unreachable q */
+static int q_is_reachable(double q, const HklGeometry *geometry, GError **error)
+{
+	if (fabs(q) > qmax(hkl_source_get_wavelength(&geometry->source))){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_SET,
+			    "unreachable q, try to change the wavelength");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /*****/
 /* q */
 /*****/
@@ -116,6 +130,21 @@ static int get_q_real(HklMode *self,
 	return TRUE;
 }
 
+static int set_q_real(HklMode *self,
+		      HklEngine *base,
+		      HklGeometry *geometry,
+		      HklDetector *detector,
+		      HklSample *sample,
+		      GError **error)
+{
+	HklEngineQ *engine = container_of(base, HklEngineQ, engine);
+
+	if(!q_is_reachable(engine->q->_value, geometry, error))
+		return FALSE;
+
+	return hkl_mode_auto_set_real(self, base, geometry, detector, sample, error);
+}
+
 /* not declared in the constructor as it is used also in the q2 pseudo
  * axis engine */
 static const HklParameter q = {
@@ -134,6 +163,7 @@ static HklMode *mode_q(void)
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
 		.get = get_q_real,
+		.set = set_q_real,
 	};
 
 	return hkl_mode_auto_new(&info, &operations, TRUE);
@@ -244,6 +274,21 @@ static int get_q2_real(HklMode *self,
 	return TRUE;
 }
 
+static int set_q2_real(HklMode *self,
+		       HklEngine *engine,
+		       HklGeometry *geometry,
+		       HklDetector *detector,
+		       HklSample *sample,
+		       GError **error)
+{
+	HklEngineQ2 *engine_q2 = container_of(engine, HklEngineQ2, engine);
+
+	if(!q_is_reachable(engine_q2->q->_value, geometry, error))
+		return FALSE;
+
+	return hkl_mode_auto_set_real(self, engine, geometry, detector, sample, error);
+}
+
 static HklMode *mode_q2(void)
 {
 	static const char* axes[] = {GAMMA, DELTA};
@@ -254,6 +299,7 @@ static HklMode *mode_q2(void)
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
 		.get = get_q2_real,
+		.set = set_q2_real,
 	};
 
 	return hkl_mode_auto_new(&info, &operations, TRUE);
@@ -329,9 +375,6 @@ static void _qper_qpar(HklEngine *engine,
 		},
 	};
 	HklVector npar;
-	HklVector qper_v;
-	HklVector qpar_v;
-	double norm;
 
 	/* compute q = kf - ki */
 	ki = hkl_geometry_ki_get(geometry);
@@ -346,21 +389,7 @@ static void _qper_qpar(HklEngine *engine,
 	npar = ki;
 	hkl_vector_vectorial_product(&npar, &n);
 
-	/* qper */
-	qper_v = n;
-	norm = hkl_vector_scalar_product(&q, &n);
-	hkl_vector_times_double(&qper_v, norm);
-	*qper = hkl_vector_norm2(&qper_v);
-	if (signbit(norm))
-		*qper *= -1;
-
-	/* qpar */
-	qpar_v = q;
-	norm = hkl_vector_scalar_product(&q, &npar);
-	hkl_vector_minus_vector(&qpar_v, &qper_v);
-	*qpar = hkl_vector_norm2(&qpar_v);
-	if (signbit(norm))
-		*qpar *= -1;
+	hkl_vector_qper_qpar(&q, &n, &npar, qper, qpar);
 }
 
 static int _qper_qpar_func(const gsl_vector *x, void *params, gsl_vector *f)
@@ -405,6 +434,24 @@ static int get_qper_qpar_real(HklMode *self,
 	return TRUE;
 }
 
+static int set_qper_qpar_real(HklMode *self,
+			      HklEngine *engine,
+			      HklGeometry *geometry,
+			      HklDetector *detector,
+			      HklSample *sample,
+			      GError **error)
+{
+	HklEngineQperQpar *engine_qper_qpar = container_of(engine, HklEngineQperQpar, engine);
+
+	/* qper and qpar are orthogonal components of q */
+	if(!q_is_reachable(hypot(engine_qper_qpar->qper->_value,
+				 engine_qper_qpar->qpar->_value),
+			   geometry, error))
+		return FALSE;
+
+	return hkl_mode_auto_set_real(self, engine, geometry, detector, sample, error);
+}
+
 static HklMode *mode_qper_qpar(void)
 {
 	static const char* axes[] = {GAMMA, DELTA};
@@ -418,6 +465,7 @@ static HklMode *mode_qper_qpar(void)
 	static const HklModeOperations operations = {
 		HKL_MODE_OPERATIONS_AUTO_DEFAULTS,
 		.get = get_qper_qpar_real,
+		.set = set_qper_qpar_real,
 	};
 
 	HklModeQperQpar *self = g_new(HklModeQperQpar, 1);
@@ -22,6 +22,8 @@
 #ifndef __HKL_PSEUDOAXIS_PRIVATE_H__
 #define __HKL_PSEUDOAXIS_PRIVATE_H__
 
+#include <math.h>                       // for INFINITY, isinf
+#include <gsl/gsl_multiroots.h>         // for gsl_multiroot_fsolver, etc
 #include <gsl/gsl_sf_trig.h>            // for gsl_sf_angle_restrict_symm
 #include <stddef.h>                     // for size_t
 #include <stdlib.h>                     // for free
@@ -31,6 +33,7 @@
 #include "hkl-geometry-private.h"       // for hkl_geometry_update, etc
 #include "hkl-macros-private.h"         // for HKL_MALLOC
 #include "hkl-parameter-private.h"      // for hkl_parameter_list_free, etc
+#include "hkl-trace-private.h"          // for hkl_trace_add
 #include "hkl.h"                        // for HklEngine, HklMode, etc
 #include "hkl/ccan/array_size/array_size.h"
 #include "hkl/ccan/darray/darray.h"     // for darray_foreach, etc
@@ -70,6 +73,7 @@ struct _HklModeOperations
 	unsigned long capabilities;
 
 	void (* free)(HklMode *self);
+	void (* init_copy)(HklMode *self, const HklMode *src);
 	int (* initialized_get)(const HklMode *self);
 	int (* initialized_set)(HklMode *self,
 				HklEngine *engine,
@@ -90,11 +94,19 @@ struct _HklModeOperations
 		    HklDetector *detector,
 		    HklSample *sample,
 		    GError **error);
+	/* optional, the velocities of the engine axes of the current
+	 * solution for the given pseudo axes velocities */
+	int (* velocities)(HklMode *self,
+			   HklEngine *engine,
+			   const double velocities[],
+			   double axes[],
+			   GError **error);
 };
 
 
 #define HKL_MODE_OPERATIONS_DEFAULTS .capabilities=HKL_ENGINE_CAPABILITIES_READABLE | HKL_ENGINE_CAPABILITIES_WRITABLE, \
 		.free=hkl_mode_free_real,				\
+		.init_copy=hkl_mode_init_copy_real,			\
 		.initialized_get=hkl_mode_initialized_get_real,		\
 		.initialized_set=hkl_mode_initialized_set_real,		\
 		.get=hkl_mode_get_real,					\
@@ -108,6 +120,8 @@ struct _HklMode
 	darray_parameter parameters;
 	darray_string parameters_names;
 	int initialized;
+	darray_int axes_r_idx; /* the info axes_r indexes in the geometry */
+	darray_int axes_w_idx; /* the info axes_w indexes in the geometry */
 };
 
 
@@ -122,10 +136,33 @@ static inline void hkl_mode_free_real(HklMode *self)
 
 	darray_free(self->parameters_names);
 
+	darray_free(self->axes_r_idx);
+	darray_free(self->axes_w_idx);
+
 	free(self);
 }
 
 
+/* copy the parameters values and the initialized state */
+static inline void hkl_mode_init_copy_real(HklMode *self, const HklMode *src)
+{
+	size_t i;
+
+	for(i=0; i<darray_size(self->parameters); ++i)
+		hkl_parameter_init_copy(darray_item(self->parameters, i),
+					darray_item(src->parameters, i),
+					NULL);
+
+	self->initialized = src->initialized;
+}
+
+
+static inline void hkl_mode_init_copy(HklMode *self, const HklMode *src)
+{
+	self->ops->init_copy(self, src);
+}
+
+
 static inline int hkl_mode_initialized_get_real(const HklMode *self)
 {
 	return self->initialized;
@@ -189,6 +226,25 @@ static inline int hkl_mode_set_real(UNUSED HklMode *self,
 }
 
 
+/* map the mode axes names to their indexes in the geometry axes, -1
+ * if the geometry does not contain the axis. It is done once when
+ * the engine list is initialized, the geometries of the engines all
+ * share the same axes */
+static inline void hkl_mode_axes_idx_set(HklMode *self, const HklGeometry *geometry)
+{
+	const char **axis_name;
+
+	darray_resize(self->axes_r_idx, 0);
+	darray_foreach(axis_name, self->info->axes_r)
+		darray_append(self->axes_r_idx,
+			      hkl_geometry_get_axis_idx_by_name(geometry, *axis_name));
+
+	darray_resize(self->axes_w_idx, 0);
+	darray_foreach(axis_name, self->info->axes_w)
+		darray_append(self->axes_w_idx,
+			      hkl_geometry_get_axis_idx_by_name(geometry, *axis_name));
+}
+
 static inline int hkl_mode_init(HklMode *self,
 				const HklModeInfo *info,
 				const HklModeOperations *ops,
@@ -207,6 +263,8 @@ static inline int hkl_mode_init(HklMode *self,
 	/* parameters */
 	darray_init(self->parameters) ;
 	darray_init(self->parameters_names);
+	darray_init(self->axes_r_idx);
+	darray_init(self->axes_w_idx);
 	darray_foreach(parameter, self->info->parameters){
                 if(NULL == (p = hkl_parameter_new_copy(parameter)))
                         break;
@@ -259,6 +317,93 @@ struct _HklEngineInfo {
 		.pseudo_axes = DARRAY(_pseudo_axes),			\
 		.dependencies = (_dependencies)
 
+/* the last solutions of a mode function, most recent first */
+typedef struct _HklEngineContinuation HklEngineContinuation;
+
+struct _HklEngineContinuation
+{
+	const HklMode *mode; /* not owned */
+	const void *function; /* not owned, the HklFunction */
+	size_t len;
+	size_t n;
+	double *x;
+};
+
+typedef darray(HklEngineContinuation) darray_continuation;
+
+/* the first solutions of the last solved targets of a mode function,
+ * in a ring of n_max points, with the values they depend on besides
+ * the targets */
+typedef struct _HklEngineNeighbours HklEngineNeighbours;
+
+struct _HklEngineNeighbours
+{
+	const HklMode *mode; /* not owned */
+	const void *function; /* not owned, the HklFunction */
+	size_t n_targets; /* the number of pseudo axes */
+	size_t len; /* the number of axes */
+	size_t n_context;
+	double *context; /* UB, wave length and mode parameters */
+	size_t n_max;
+	size_t n;
+	size_t last; /* the most recent point */
+	double *targets; /* n_max x n_targets */
+	double *x; /* n_max x len */
+};
+
+typedef darray(HklEngineNeighbours) darray_neighbours;
+
+/* the solutions of a previous hkl_engine_pseudo_axis_values_set */
+typedef struct _HklEngineCacheEntry HklEngineCacheEntry;
+
+struct _HklEngineCacheEntry
+{
+	const HklMode *mode; /* not owned */
+	size_t len;
+	double *key; /* everything the solutions depend on */
+	HklGeometryList *solutions;
+};
+
+typedef darray(HklEngineCacheEntry) darray_cache_entry;
+
+static inline void hkl_engine_cache_entry_release(HklEngineCacheEntry *self)
+{
+	free(self->key);
+	hkl_geometry_list_free(self->solutions);
+}
+
+/* the buffers of the numerical solver, allocated for the size of the
+ * mode functions and reused by all the solves */
+typedef struct _HklEngineWorkspace HklEngineWorkspace;
+
+struct _HklEngineWorkspace
+{
+	size_t n;
+	gsl_vector *x;
+	gsl_vector *_x;
+	gsl_vector *_f;
+	gsl_matrix *J;
+	gsl_multiroot_fsolver *fs; /* allocated on the first use */
+	gsl_multiroot_fdfsolver *fdfs; /* allocated on the first use */
+};
+
+/* the scratch memory of a solve, handed out by a bump pointer and
+ * reset at the start of each hkl_engine_set. When it overflows, the
+ * extra blocks are kept until the next reset which grows the arena
+ * to the size used by the solve. */
+#define HKL_ENGINE_ARENA_ALIGN 16
+
+typedef struct _HklEngineArena HklEngineArena;
+
+struct _HklEngineArena
+{
+	char *data;
+	size_t size;
+	size_t used;
+	size_t overflow; /* the size of the blocks */
+	darray(void *) blocks;
+};
+
 struct _HklEngine
 {
 	const HklEngineInfo *info;
@@ -273,6 +418,27 @@ struct _HklEngine
 	darray_string pseudo_axis_names;
 	darray_mode modes;
 	darray_string mode_names;
+	unsigned int continuation_order; /* 0 disables the continuation */
+	darray_continuation continuations;
+	size_t neighbours_n_max; /* 0 disables the neighbours */
+	darray_neighbours neighbours;
+	HklEngineMultistart multistart;
+	unsigned int multistart_n; /* starting points tried after the axes values */
+	unsigned int multistart_seed;
+	unsigned int sectors_n_threads; /* 0 or 1 tests the sectors in the calling thread */
+	HklEngineSolutions solutions;
+	size_t range_n_max; /* 2π shifted solutions, 0 for all of them */
+	double range_max_distance;
+	double branch_max_jump; /* INFINITY disables the branch tracking */
+	int branch_forced;
+	HklEngineSort sort;
+	size_t cache_n_max; /* 0 disables the cache */
+	darray_cache_entry cache; /* most recently used first */
+	HklEngineStats stats;
+	HklEngineWorkspace workspace;
+	HklEngineArena arena;
+	int dirty; /* the pseudo axes values must be computed again */
+	unsigned long stamp; /* the geometry stamp of the pseudo axes values */
 };
 
 
@@ -287,6 +453,7 @@ struct _HklEngineListOperations
 {
 	void (* free)(HklEngineList *self);
 	int (* post_engine_set)(HklEngineList *self);
+	int post_engine_set_multiply; /* post_engine_set adds equivalent geometries */
 };
 
 #define HKL_ENGINE_LIST_OPERATIONS_DEFAULTS .free=hkl_engine_list_free_real, \
@@ -297,6 +464,7 @@ struct _HklEngineList
 	_darray(HklEngine *); /* must be the first memeber */
 	const HklEngineListInfo *info;
 	const HklEngineListOperations *ops;
+	const HklFactory *factory; /* not owned */
 	HklGeometryList *geometries;
 	HklGeometry *geometry;
 	HklDetector *detector;
@@ -304,6 +472,8 @@ struct _HklEngineList
 	darray_parameter pseudo_axes;
 	darray_parameter parameters;
 	darray_string parameters_names;
+	HklGeometryPredicate is_colliding; /* rejects the solutions, can be NULL */
+	void *is_colliding_data;
 };
 
 #define HKL_ENGINE_ERROR hkl_engine_error_quark ()
@@ -340,6 +510,96 @@ static inline void set_geometry_axes(HklEngine *engine, const double values[])
 }
 
 
+static inline void hkl_engine_continuations_clear(HklEngine *self)
+{
+	HklEngineContinuation *continuation;
+
+	darray_foreach(continuation, self->continuations){
+		free(continuation->x);
+	}
+	darray_resize(self->continuations, 0);
+}
+
+static inline void hkl_engine_neighbours_clear(HklEngine *self)
+{
+	HklEngineNeighbours *neighbours;
+
+	darray_foreach(neighbours, self->neighbours){
+		free(neighbours->context);
+		free(neighbours->targets);
+		free(neighbours->x);
+	}
+	darray_resize(self->neighbours, 0);
+}
+
+static inline void hkl_engine_workspace_release(HklEngineWorkspace *self)
+{
+	if(self->x)
+		gsl_vector_free(self->x);
+	if(self->_x)
+		gsl_vector_free(self->_x);
+	if(self->_f)
+		gsl_vector_free(self->_f);
+	if(self->J)
+		gsl_matrix_free(self->J);
+	if(self->fs)
+		gsl_multiroot_fsolver_free(self->fs);
+	if(self->fdfs)
+		gsl_multiroot_fdfsolver_free(self->fdfs);
+	*self = (HklEngineWorkspace){0};
+}
+
+/**
+ * hkl_engine_arena_alloc: (skip)
+ * @self: the engine
+ * @size: the size of the memory
+ *
+ * get scratch memory valid until the next reset of the arena, do
+ * not free it.
+ **/
+static inline void *hkl_engine_arena_alloc(HklEngine *self, size_t size)
+{
+	HklEngineArena *arena = &self->arena;
+	void *block;
+
+	size = (size + HKL_ENGINE_ARENA_ALIGN - 1) & ~(size_t)(HKL_ENGINE_ARENA_ALIGN - 1);
+	if(arena->used + size <= arena->size){
+		block = &arena->data[arena->used];
+		arena->used += size;
+	}else{
+		block = malloc(size);
+		darray_append(arena->blocks, block);
+		arena->overflow += size;
+	}
+
+	return block;
+}
+
+static inline void hkl_engine_arena_reset(HklEngine *self)
+{
+	HklEngineArena *arena = &self->arena;
+	void **block;
+
+	if(arena->overflow){
+		darray_foreach(block, arena->blocks){
+			free(*block);
+		}
+		darray_resize(arena->blocks, 0);
+		free(arena->data);
+		arena->size += arena->overflow;
+		arena->data = malloc(arena->size);
+		arena->overflow = 0;
+	}
+	arena->used = 0;
+}
+
+static inline void hkl_engine_arena_release(HklEngine *self)
+{
+	hkl_engine_arena_reset(self);
+	free(self->arena.data);
+	darray_free(self->arena.blocks);
+}
+
 static inline void hkl_engine_release(HklEngine *self)
 {
 	HklMode **mode;
@@ -363,6 +623,18 @@ static inline void hkl_engine_release(HklEngine *self)
 	darray_free(self->pseudo_axes);
 	darray_free(self->pseudo_axis_names);
 	darray_free(self->mode_names);
+
+	hkl_engine_continuations_clear(self);
+	darray_free(self->continuations);
+
+	hkl_engine_neighbours_clear(self);
+	darray_free(self->neighbours);
+
+	hkl_engine_cache_clear(self);
+	darray_free(self->cache);
+
+	hkl_engine_workspace_release(&self->workspace);
+	hkl_engine_arena_release(self);
 }
 
 
@@ -402,6 +674,27 @@ static inline void hkl_engine_init(HklEngine *self,
 	darray_init(self->pseudo_axis_names);
 	darray_init(self->modes);
 	darray_init(self->mode_names);
+	self->continuation_order = 0;
+	darray_init(self->continuations);
+	self->neighbours_n_max = 0;
+	darray_init(self->neighbours);
+	self->multistart = HKL_ENGINE_MULTISTART_SOBOL;
+	self->multistart_n = 6;
+	self->multistart_seed = 0;
+	self->sectors_n_threads = 0;
+	self->solutions = HKL_ENGINE_SOLUTIONS_ALL;
+	self->range_n_max = 0;
+	self->range_max_distance = INFINITY;
+	self->branch_max_jump = INFINITY;
+	self->branch_forced = FALSE;
+	self->sort = HKL_ENGINE_SORT_DISTANCE;
+	self->cache_n_max = 0;
+	darray_init(self->cache);
+	self->stats = (HklEngineStats){0};
+	self->workspace = (HklEngineWorkspace){0};
+	self->arena = (HklEngineArena){0};
+	self->dirty = TRUE;
+	self->stamp = 0;
 
 	darray_append(*engines, self);
 }
@@ -462,9 +755,12 @@ static inline void hkl_engine_add_mode(HklEngine *self, HklMode *mode)
  * set the geometry axes and copy it to the right geometries. We do
  * not gives the x len as it is equal to the self->axes_len.
  *
+ * The colliding geometries are rejected before being copied.
+ *
+ * Returns: TRUE if the geometry was added.
  **/
-static inline void hkl_engine_add_geometry(HklEngine *self,
-					   double const x[])
+static inline int hkl_engine_add_geometry(HklEngine *self,
+					  double const x[])
 {
 	HklParameter **axis;
 	uint i = 0;
@@ -477,7 +773,15 @@ static inline void hkl_engine_add_geometry(HklEngine *self,
 					NULL);
 	}
 
+	if(self->engines->is_colliding
+	   && self->engines->is_colliding(self->geometry, self->engines->is_colliding_data)){
+		self->stats.collisions++;
+		return FALSE;
+	}
+
 	hkl_geometry_list_add(self->engines->geometries, self->geometry);
+
+	return TRUE;
 }
 
 
@@ -486,10 +790,14 @@ static inline void hkl_engine_prepare_internal(HklEngine *self)
 	if(!self || !self->engines)
 		return;
 
-	/* set */
-	if(self->geometry)
-		hkl_geometry_free(self->geometry);
-	self->geometry = hkl_geometry_new_copy(self->engines->geometry);
+	/* set, the geometry memory is reused between the solves */
+	if(self->geometry && self->geometry->factory == self->engines->geometry->factory)
+		hkl_geometry_set(self->geometry, self->engines->geometry);
+	else{
+		if(self->geometry)
+			hkl_geometry_free(self->geometry);
+		self->geometry = hkl_geometry_new_copy(self->engines->geometry);
+	}
 
 	if(self->detector)
 		hkl_detector_free(self->detector);
@@ -499,15 +807,17 @@ static inline void hkl_engine_prepare_internal(HklEngine *self)
 		hkl_sample_free(self->sample);
 	self->sample = hkl_sample_new_copy(self->engines->sample);
 
-	/* fill the axes member from the function */
+	/* fill the axes member from the mode index map */
 	if(self->mode){
-		const char **axis_name;
+		int *idx;
+
+		if(darray_size(self->mode->axes_w_idx) != darray_size(self->mode->info->axes_w))
+			hkl_mode_axes_idx_set(self->mode, self->geometry);
+
+		darray_resize(self->axes, 0);
+		darray_foreach(idx, self->mode->axes_w_idx){
+			HklParameter *axis = *idx < 0 ? NULL : darray_item(self->geometry->axes, *idx);
 
-		darray_free(self->axes);
-		darray_init(self->axes);
-		darray_foreach(axis_name, self->mode->info->axes_w){
-			HklParameter *axis = hkl_geometry_get_axis_by_name(self->geometry,
-									   *axis_name);
 			darray_append(self->axes, axis);
 		}
 	}
@@ -565,9 +875,45 @@ static inline int hkl_engine_get(HklEngine *self, GError **error)
 	}
 	hkl_assert(error == NULL || *error == NULL);
 
+	/* the get updates the geometry, so its stamp is final */
+	self->dirty = FALSE;
+	self->stamp = self->engines->geometry->stamp;
+
 	return TRUE;
 }
 
+/**
+ * hkl_engine_get_lazy: (skip)
+ * @self: The HklEngine
+ * @error: return location for a GError, or NULL
+ *
+ * get the values of the pseudo-axes only if the engine list was
+ * invalidated or if the geometry changed since the last get.
+ *
+ * return value: TRUE if succeded or FALSE otherwise.
+ **/
+static inline int hkl_engine_get_lazy(HklEngine *self, GError **error)
+{
+	HklParameter **axis;
+
+	if(!self->dirty
+	   && self->engines && self->engines->geometry
+	   && self->stamp == self->engines->geometry->stamp){
+		int changed = FALSE;
+
+		darray_foreach(axis, self->engines->geometry->axes){
+			if((*axis)->changed){
+				changed = TRUE;
+				break;
+			}
+		}
+		if(!changed)
+			return TRUE;
+	}
+
+	return hkl_engine_get(self, error);
+}
+
 
 /**
  * hkl_engine_list_post_process_free: (skip)
@@ -593,6 +939,10 @@ static int hkl_engine_list_post_engine_set(HklEngineList *self)
  **/
 static inline int hkl_engine_set(HklEngine *self, GError **error)
 {
+	int res = FALSE;
+	gint64 t0;
+	unsigned long iterations = self->stats.iterations;
+
 	hkl_error (error == NULL || *error == NULL);
 
 	if(!self->geometry || !self->detector || !self->sample
@@ -604,6 +954,10 @@ static inline int hkl_engine_set(HklEngine *self, GError **error)
 		return FALSE;
 	}
 
+	t0 = g_get_monotonic_time();
+	self->stats.solves++;
+
+	hkl_engine_arena_reset(self);
 	hkl_engine_prepare_internal(self);
 
 	if (!self->mode->ops->set(self->mode, self,
@@ -612,25 +966,101 @@ static inline int hkl_engine_set(HklEngine *self, GError **error)
 				  self->sample,
 				  error)){
 		hkl_assert(error == NULL || *error != NULL);
-		return FALSE;
+		goto out;
 	}
 	hkl_assert(error == NULL || *error == NULL);
 
 	hkl_geometry_list_multiply(self->engines->geometries);
 	hkl_engine_list_post_engine_set(self->engines);
-	hkl_geometry_list_multiply_from_range(self->engines->geometries);
+	/* the 2π shifts of the range multiply have the same rotations,
+	 * only the other equivalent geometries remain to be checked,
+	 * and only those which can be shifted into the axes ranges */
+	if(self->engines->is_colliding
+	   && (self->engines->geometries->multiply
+	       || self->engines->ops->post_engine_set_multiply)){
+		hkl_geometry_list_remove_unreachable(self->engines->geometries);
+		self->stats.collisions += hkl_geometry_list_remove_if(self->engines->geometries,
+								      self->engines->is_colliding,
+								      self->engines->is_colliding_data);
+	}
+	if(0 == self->range_n_max && isinf(self->range_max_distance))
+		hkl_geometry_list_multiply_from_range(self->engines->geometries);
+	else
+		hkl_geometry_list_multiply_from_range_closest(self->engines->geometries,
+							       self->engines->geometry,
+							       self->range_n_max,
+							       self->range_max_distance);
 	hkl_geometry_list_remove_invalid(self->engines->geometries);
-	hkl_geometry_list_sort(self->engines->geometries, self->engines->geometry);
+	if(!isinf(self->branch_max_jump) && self->engines->geometries->n_items > 0){
+		if(self->branch_forced){
+			const HklGeometryListItem *item;
+			int on_branch = FALSE;
+
+			HKL_GEOMETRY_LIST_FOREACH(item, self->engines->geometries)
+				on_branch |= hkl_geometry_jump(item->geometry, self->engines->geometry)
+					<= self->branch_max_jump;
+			if(!on_branch)
+				self->stats.discontinuities++;
+		}else{
+			hkl_geometry_list_remove_jumps(self->engines->geometries,
+						       self->engines->geometry,
+						       self->branch_max_jump);
+			if(0 == self->engines->geometries->n_items){
+				self->stats.discontinuities++;
+				g_set_error(error,
+					    HKL_ENGINE_ERROR,
+					    HKL_ENGINE_ERROR_SET,
+					    "no solution on the branch of the current geometry, an axis would move more than %f",
+					    self->branch_max_jump);
+				goto out;
+			}
+		}
+	}
+	{
+		HklGeometryCost cost = self->sort == HKL_ENGINE_SORT_TIME
+			? hkl_geometry_motion_time : hkl_geometry_distance;
+
+		if(self->solutions == HKL_ENGINE_SOLUTIONS_CLOSEST)
+			hkl_geometry_list_sort_closest_cost(self->engines->geometries,
+							    self->engines->geometry, 1, cost);
+		else
+			hkl_geometry_list_sort_cost(self->engines->geometries,
+						    self->engines->geometry, cost);
+	}
 
 	if(self->engines->geometries->n_items == 0){
 		g_set_error(error,
 			    HKL_ENGINE_ERROR,
 			    HKL_ENGINE_ERROR_SET,
 			    "no remaining solutions");
-		return FALSE;
+		goto out;
 	}
 
-	return TRUE;
+	res = TRUE;
+out:
+	{
+		gint64 duration = g_get_monotonic_time() - t0;
+		HklTraceRecord record = {
+			.start = t0,
+			.duration = duration,
+			.engine = self->info->name,
+			.mode = self->mode->info->name,
+			.n_targets = MIN(darray_size(self->pseudo_axes), HKL_TRACE_TARGETS_MAX),
+			.iterations = self->stats.iterations - iterations,
+			.n_solutions = res ? self->engines->geometries->n_items : 0,
+			.status = res,
+		};
+
+		for(unsigned int i=0; i<record.n_targets; ++i)
+			record.targets[i] = darray_item(self->pseudo_axes, i)->_value;
+		hkl_trace_add(&record);
+
+		if(!res)
+			self->stats.failures++;
+		self->stats.time += duration / 1e6;
+	}
+
+	return res;
 }
 
 /* HklEngineList */
@@ -725,6 +1155,7 @@ static inline HklEngineList *hkl_engine_list_new_with_info(const HklEngineListIn
 	self->info = info;
 	self->ops = ops;
 
+	self->factory = NULL;
 	self->geometries = hkl_geometry_list_new();
 
 	self->geometry = NULL;
@@ -733,6 +1164,9 @@ static inline HklEngineList *hkl_engine_list_new_with_info(const HklEngineListIn
 
 	darray_init(self->pseudo_axes);
 
+	self->is_colliding = NULL;
+	self->is_colliding_data = NULL;
+
 	darray_init(self->parameters);
 	darray_init(self->parameters_names);
 	darray_foreach(parameter, info->parameters){
@@ -758,19 +1192,34 @@ static inline HklEngineList *hkl_engine_list_new(void)
 	return hkl_engine_list_new_with_info(&info, &ops);
 }
 
+extern void hkl_engine_list_engines_keep(HklEngineList *self,
+					 const char *names[], size_t n_names);
 
-/**
- * hkl_engine_list_new_copy: (skip)
- * @self:
- *
- * dummy copy constructor for the binding
- *
- * Returns: (transfer none): NULL all the time the structure is non-copyable
- **/
-static inline HklEngineList *hkl_engine_list_new_copy(UNUSED const HklEngineList *self)
+/* a thread with its own copy of the engine list of an engine, its
+ * geometry and its detector, the sample is shared */
+struct HklEngineBatchWorker
 {
-	return NULL;
-}
+	HklEngineList *engines;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklEngine *engine;
+	const struct HklEngineBatch *batch;
+	size_t from;
+	size_t to;
+	GThread *thread;
+};
+
+extern int hkl_engine_batch_worker_init(struct HklEngineBatchWorker *self,
+					const HklEngine *engine);
+
+extern void hkl_engine_batch_worker_release(struct HklEngineBatchWorker *self);
+
+/* HklEngineStats boxed type */
+
+extern HklEngineStats *hkl_engine_stats_dup(const HklEngineStats *self);
+
+extern void hkl_engine_stats_free(HklEngineStats *self);
+
 
 G_END_DECLS
 
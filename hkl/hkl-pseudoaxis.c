@@ -20,6 +20,7 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <math.h>                       // for NAN
 #include <stdio.h>                      // for fprintf, FILE
 #include <stdlib.h>                     // for free
 #include <string.h>                     // for NULL, strcmp
@@ -30,6 +31,7 @@
 #include "hkl-parameter-private.h"      // for hkl_parameter_list_fprintf, etc
 #include "hkl-pseudoaxis-private.h"     // for _HklEngine, _HklEngineList, etc
 #include "hkl-sample-private.h"
+#include "hkl-trajectory-private.h"     // for hkl_trajectory_branch_select
 #include "hkl.h"                        // for HklEngine, HklEngineList, etc
 #include "hkl/ccan/container_of/container_of.h"  // for container_of
 #include "hkl/ccan/darray/darray.h"     // for darray_foreach, darray_init, etc
@@ -142,12 +144,101 @@ int hkl_engine_pseudo_axis_values_get(HklEngine *self,
 	hkl_assert(error == NULL || *error == NULL);
 
 	for(size_t i=0; i<n_values; ++i){
-		values[i] = hkl_parameter_value_get(darray_item(self->pseudo_axes, i),
-						    unit_type);
+		const HklParameter *p = darray_item(self->pseudo_axes, i);
+
+		values[i] = p->_value * hkl_parameter_unit_factor(p, unit_type);
 	}
 	return TRUE;
 }
 
+/* the cache key, every value which changes the solutions of a set */
+static double *hkl_engine_cache_key_new(const HklEngine *self, size_t *len)
+{
+	const HklGeometry *geometry = self->engines->geometry;
+	const HklMatrix *UB = hkl_sample_UB_get(self->engines->sample);
+	HklParameter **parameter;
+	double *key;
+	size_t n;
+
+	*len = darray_size(self->pseudo_axes)
+		+ darray_size(self->mode->parameters)
+		+ 3 * darray_size(geometry->axes)
+		+ darray_size(self->engines->parameters)
+		+ 9 + 1 + 11;
+	key = malloc(*len * sizeof(*key));
+
+	n = 0;
+	darray_foreach(parameter, self->pseudo_axes)
+		key[n++] = hkl_parameter_value_get(*parameter, HKL_UNIT_DEFAULT);
+	darray_foreach(parameter, self->mode->parameters)
+		key[n++] = hkl_parameter_value_get(*parameter, HKL_UNIT_DEFAULT);
+	darray_foreach(parameter, geometry->axes){
+		key[n++] = hkl_parameter_value_get(*parameter, HKL_UNIT_DEFAULT);
+		hkl_parameter_min_max_get(*parameter, &key[n], &key[n + 1], HKL_UNIT_DEFAULT);
+		n += 2;
+	}
+	darray_foreach(parameter, self->engines->parameters)
+		key[n++] = hkl_parameter_value_get(*parameter, HKL_UNIT_DEFAULT);
+	for(size_t i=0; i<3; ++i)
+		for(size_t j=0; j<3; ++j)
+			key[n++] = UB->data[i][j];
+	key[n++] = geometry->source.wave_length;
+	key[n++] = self->continuation_order;
+	key[n++] = self->neighbours_n_max;
+	key[n++] = self->multistart;
+	key[n++] = self->multistart_n;
+	key[n++] = self->multistart_seed;
+	key[n++] = self->solutions;
+	key[n++] = self->range_n_max;
+	key[n++] = self->range_max_distance;
+	key[n++] = self->branch_max_jump;
+	key[n++] = self->branch_forced;
+	key[n++] = self->sort;
+	hkl_assert(n == *len);
+
+	return key;
+}
+
+/* the bytes of the keys are compared, so there is no false hit */
+static HklEngineCacheEntry *hkl_engine_cache_lookup(HklEngine *self,
+						    const double *key, size_t len)
+{
+	for(size_t i=0; i<darray_size(self->cache); ++i){
+		HklEngineCacheEntry entry = darray_item(self->cache, i);
+
+		if(entry.mode == self->mode
+		   && entry.len == len
+		   && !memcmp(entry.key, key, len * sizeof(*key))){
+			/* move it in front, the last one is the least used */
+			memmove(&darray_item(self->cache, 1),
+				&darray_item(self->cache, 0),
+				i * sizeof(entry));
+			darray_item(self->cache, 0) = entry;
+			return &darray_item(self->cache, 0);
+		}
+	}
+	return NULL;
+}
+
+/* take the ownership of the key */
+static void hkl_engine_cache_insert(HklEngine *self, double *key, size_t len,
+				    const HklGeometryList *solutions)
+{
+	HklEngineCacheEntry entry = {
+		.mode = self->mode,
+		.len = len,
+		.key = key,
+		.solutions = hkl_geometry_list_new_copy(solutions),
+	};
+
+	if(darray_size(self->cache) == self->cache_n_max){
+		hkl_engine_cache_entry_release(&darray_item(self->cache,
+							    self->cache_n_max - 1));
+		darray_resize(self->cache, self->cache_n_max - 1);
+	}
+	darray_prepend(self->cache, entry);
+}
+
 /**
  * hkl_engine_pseudo_axis_values_set:
  * @self: the this ptr
@@ -158,6 +249,9 @@ int hkl_engine_pseudo_axis_values_get(HklEngine *self,
  *
  * Set the engine pseudo axes values
  *
+ * When the cache is enabled (see hkl_engine_cache_set), the
+ * solutions of an already solved state are returned without solving.
+ *
  * Return value: #HklGeometryList or NULL if no solution was found,
  *               use hkl_geometry_list_free to release the memory once done.
  **/
@@ -165,12 +259,9 @@ HklGeometryList *hkl_engine_pseudo_axis_values_set(HklEngine *self,
 						   double values[], size_t n_values,
 						   HklUnitEnum unit_type, GError **error)
 {
-#if LOGGING
-	char *msg;
-	size_t msg_size;
-	FILE *stream;
-#endif
 	HklGeometryList *solutions = NULL;
+	double *key = NULL;
+	size_t len = 0;
 
 	hkl_error(error == NULL ||*error == NULL);
 
@@ -183,54 +274,97 @@ HklGeometryList *hkl_engine_pseudo_axis_values_set(HklEngine *self,
 		goto out;
 	}
 
-#if LOGGING
-	stream = open_memstream(&msg, &msg_size);
-
-	fprintf(stream, "%s(", __func__);
-	fprintf(stream, "self: %s, values: [", hkl_engine_name_get(self));
-	for(size_t i=0; i<n_values; ++i)
-		fprintf(stream, " %f", values[i]);
-	fprintf(stream, "], n_values: %d unit_type: %d, error: %p)", n_values, unit_type, error);
-
-	hkl_geometry_fprintf(stream, self->engines->geometry);
-	hkl_sample_fprintf(stream, self->engines->sample);
-	hkl_engine_fprintf(stream, self);
-#endif
 	for(size_t i=0; i<n_values; ++i){
 		if(!hkl_parameter_value_set(darray_item(self->pseudo_axes, i),
 					    values[i],
 					    unit_type, error)){
-			goto clean_stream_out;
+			goto out;
+		}
+	}
+
+	if(self->cache_n_max > 0 && self->mode){
+		const HklEngineCacheEntry *entry;
+
+		key = hkl_engine_cache_key_new(self, &len);
+		entry = hkl_engine_cache_lookup(self, key, len);
+		if(entry){
+			self->stats.cache_hits++;
+			hkl_geometry_list_set(self->engines->geometries,
+					      entry->solutions);
+			solutions = hkl_geometry_list_new_copy(entry->solutions);
+			free(key);
+			goto out;
 		}
 	}
 
 	if(!hkl_engine_set(self, error)){
-#if LOGGING
-		fflush(stream);
-		g_message(msg);
-		if(error && *error != NULL)
-			g_warning("%s", (*error)->message);
-#endif
-		goto clean_stream_out;
+		free(key);
+		goto out;
 	}
 
 	solutions = hkl_geometry_list_new_copy(self->engines->geometries);
+	if(key)
+		hkl_engine_cache_insert(self, key, len, solutions);
 
-#if LOGGING
-	hkl_geometry_list_fprintf(stream, solutions);
-	fflush(stream);
-	g_message(msg);
-#endif
-
-clean_stream_out:
-#if LOGGING
-	fclose(stream);
-	free(msg);
-#endif
 out:
 	return solutions;
 }
 
+/**
+ * hkl_engine_pseudo_axis_values_set_into:
+ * @self: the this ptr
+ * @values: (array length=n_values): the values to set
+ * @n_values: the size of the values array.
+ * @unit_type: the unit type (default or user) of the values
+ * @solutions: the #HklGeometryList which receives the solutions
+ * @error: return location for a GError, or NULL
+ *
+ * Set the engine pseudo axes values like
+ * hkl_engine_pseudo_axis_values_set, but the solutions replace the
+ * content of @solutions. The memory of the previous solutions and
+ * of the solver is reused, so a loop over many pseudo axes values
+ * does not allocate once the first solve is done.
+ *
+ * Returns: TRUE on success, FALSE if no solution was found.
+ **/
+int hkl_engine_pseudo_axis_values_set_into(HklEngine *self,
+					   double values[], size_t n_values,
+					   HklUnitEnum unit_type,
+					   HklGeometryList *solutions,
+					   GError **error)
+{
+	hkl_error(error == NULL ||*error == NULL);
+
+	hkl_geometry_list_reset(solutions);
+
+	if(n_values != darray_size(self->info->pseudo_axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values,  darray_size(self->info->pseudo_axes));
+		return FALSE;
+	}
+
+	for(size_t i=0; i<n_values; ++i){
+		if(!hkl_parameter_value_set(darray_item(self->pseudo_axes, i),
+					    values[i],
+					    unit_type, error)){
+			return FALSE;
+		}
+	}
+
+	if(!hkl_engine_set(self, error)){
+		hkl_assert(error == NULL || *error != NULL);
+		return FALSE;
+	}
+	hkl_assert(error == NULL || *error == NULL);
+
+	hkl_geometry_list_set(solutions, self->engines->geometries);
+
+	return TRUE;
+}
+
 /**
  * hkl_engine_pseudo_axis_get:
  * @self: the this ptr
@@ -252,8 +386,11 @@ const HklParameter *hkl_engine_pseudo_axis_get(const HklEngine *self,
 	hkl_error (error == NULL || *error == NULL);
 
 	darray_foreach(parameter, self->pseudo_axes)
-		if(!strcmp((*parameter)->name, name))
+		if(!strcmp((*parameter)->name, name)){
+			/* the values are cached by the engine */
+			IGNORE(hkl_engine_get_lazy((HklEngine *)self, NULL));
 			return *parameter;
+		}
 
 	g_set_error(error,
 		    HKL_ENGINE_ERROR,
@@ -369,9 +506,11 @@ void hkl_engine_parameters_values_get(const HklEngine *self,
 {
 	g_return_if_fail (n_values == darray_size(self->mode->parameters));
 
-	for(size_t i=0; i<n_values; ++i)
-		values[i] = hkl_parameter_value_get(darray_item(self->mode->parameters, i),
-						    unit_type);
+	for(size_t i=0; i<n_values; ++i){
+		const HklParameter *p = darray_item(self->mode->parameters, i);
+
+		values[i] = p->_value * hkl_parameter_unit_factor(p, unit_type);
+	}
 }
 
 /**
@@ -547,6 +686,31 @@ const darray_string *hkl_engine_axis_names_get(const HklEngine *self,
 	}
 }
 
+/**
+ * hkl_engine_axis_idx_get:
+ * @self: the this ptr
+ * @mode:
+ *
+ * like hkl_engine_axis_names_get, but return the indexes of the axes
+ * in the geometry, see hkl_geometry_axis_get_by_idx. They are
+ * computed once per mode by hkl_engine_list_init, so switching the
+ * mode does not need to match the axes names again.
+ *
+ * Returns: (type gpointer):
+ **/
+const darray_int *hkl_engine_axis_idx_get(const HklEngine *self,
+					  HklEngineAxisNamesGet mode)
+{
+	switch(mode){
+	case HKL_ENGINE_AXIS_NAMES_GET_READ:
+		return &self->mode->axes_r_idx;
+	case HKL_ENGINE_AXIS_NAMES_GET_WRITE:
+		return &self->mode->axes_w_idx;
+	default:
+		return NULL;
+	}
+}
+
 int hkl_engine_initialized_get(const HklEngine *self)
 {
 	return hkl_mode_initialized_get(self->mode);
@@ -575,6 +739,11 @@ int hkl_engine_initialized_set(HklEngine *self, int initialized, GError **error)
 		return FALSE;
 	}
 
+	/* the initialization state is not part of the cache key, nor
+	 * of the context of the neighbours */
+	hkl_engine_cache_clear(self);
+	hkl_engine_neighbours_clear(self);
+
 	return hkl_mode_initialized_set(self->mode,
 					self,
 					self->engines->geometry,
@@ -584,6 +753,1014 @@ int hkl_engine_initialized_set(HklEngine *self, int initialized, GError **error)
 					error);
 }
 
+/* the flat arrays of a batch of pseudo axes values */
+struct HklEngineBatch
+{
+	void (*run)(HklEngine *self, const struct HklEngineBatch *batch,
+		    size_t from, size_t to);
+	const double *targets; /* the pseudo axes values to set */
+	double *values; /* the pseudo axes values computed from the positions */
+	size_t n_values;
+	HklUnitEnum unit_type;
+	double *axes; /* the axes values of the solutions */
+	const double *positions; /* the axes values to compute */
+	size_t n_axes;
+	int *valid;
+	darray_double *solutions; /* all the solutions of each target */
+	const char **names; /* the engines computed together */
+	size_t n_names;
+};
+
+/* solve the targets [from, to) of a batch, keeping the closest
+ * solution of each one */
+static void hkl_engine_batch_set_run(HklEngine *self,
+				     const struct HklEngineBatch *batch,
+				     size_t from, size_t to)
+{
+	size_t i, j;
+
+	for(i=from; i<to; ++i){
+		const double *values = &batch->targets[i * batch->n_values];
+		int ok = TRUE;
+
+		for(j=0; j<batch->n_values && ok; ++j)
+			ok = hkl_parameter_value_set(darray_item(self->pseudo_axes, j),
+						     values[j],
+						     batch->unit_type, NULL);
+		if(ok)
+			ok = hkl_engine_set(self, NULL);
+		if(ok){
+			const HklGeometryListItem *item = hkl_geometry_list_items_first_get(self->engines->geometries);
+
+			hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(item),
+						     &batch->axes[i * batch->n_axes],
+						     batch->n_axes,
+						     batch->unit_type);
+		}
+		batch->valid[i] = ok;
+	}
+}
+
+/* solve the targets [from, to) of a trajectory, keeping all the
+ * solutions of each one. Each point starts from the closest solution
+ * of the previous one, the engine list geometry is modified */
+static void hkl_engine_batch_trajectory_run(HklEngine *self,
+					    const struct HklEngineBatch *batch,
+					    size_t from, size_t to)
+{
+	size_t i, j;
+
+	for(i=from; i<to; ++i){
+		const double *values = &batch->targets[i * batch->n_values];
+		int ok = TRUE;
+
+		for(j=0; j<batch->n_values && ok; ++j)
+			ok = hkl_parameter_value_set(darray_item(self->pseudo_axes, j),
+						     values[j],
+						     batch->unit_type, NULL);
+		if(ok)
+			ok = hkl_engine_set(self, NULL);
+		if(ok){
+			const HklGeometryList *geometries = self->engines->geometries;
+			const HklGeometryListItem *item;
+			darray_double *solutions = &batch->solutions[i];
+
+			darray_resize(*solutions, geometries->n_items * batch->n_axes);
+			j = 0;
+			HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+				hkl_geometry_axis_values_get(item->geometry,
+							     &darray_item(*solutions, j * batch->n_axes),
+							     batch->n_axes,
+							     HKL_UNIT_DEFAULT);
+				++j;
+			}
+
+			/* warm start */
+			item = hkl_geometry_list_items_first_get(geometries);
+			hkl_geometry_set(self->engines->geometry, item->geometry);
+		}
+		batch->valid[i] = ok;
+	}
+}
+
+/* compute the pseudo axes values of the positions [from, to) of a
+ * batch, the engine list geometry is modified */
+static void hkl_engine_batch_get_run(HklEngine *self,
+				     const struct HklEngineBatch *batch,
+				     size_t from, size_t to)
+{
+	size_t i, j;
+
+	for(i=from; i<to; ++i){
+		double *values = &batch->values[i * batch->n_values];
+		int ok;
+
+		ok = hkl_geometry_axis_values_set(self->engines->geometry,
+						  (double *)&batch->positions[i * batch->n_axes],
+						  batch->n_axes,
+						  batch->unit_type, NULL);
+		if(ok)
+			ok = hkl_engine_get(self, NULL);
+		for(j=0; j<batch->n_values; ++j)
+			values[j] = ok ? hkl_parameter_value_get(darray_item(self->pseudo_axes, j),
+								 batch->unit_type) : NAN;
+		batch->valid[i] = ok;
+	}
+}
+
+/* compute the pseudo axes values of all the named engines for the
+ * positions [from, to) of a batch. The geometry is updated once per
+ * position and shared by all the engines, the engine list geometry
+ * is modified */
+static void hkl_engine_batch_get_list_run(HklEngine *self,
+					  const struct HklEngineBatch *batch,
+					  size_t from, size_t to)
+{
+	HklEngine *engines[batch->n_names];
+	size_t i, j, k;
+
+	for(k=0; k<batch->n_names; ++k)
+		engines[k] = hkl_engine_list_engine_get_by_name(self->engines,
+								batch->names[k],
+								NULL);
+
+	for(i=from; i<to; ++i){
+		double *values = &batch->values[i * batch->n_values];
+		int ok;
+
+		ok = hkl_geometry_axis_values_set(self->engines->geometry,
+						  (double *)&batch->positions[i * batch->n_axes],
+						  batch->n_axes,
+						  batch->unit_type, NULL);
+		for(k=0; k<batch->n_names && ok; ++k)
+			ok = hkl_engine_get(engines[k], NULL);
+
+		j = 0;
+		for(k=0; k<batch->n_names; ++k){
+			HklParameter **pseudo_axis;
+
+			darray_foreach(pseudo_axis, engines[k]->pseudo_axes){
+				values[j++] = ok ? (*pseudo_axis)->_value * hkl_parameter_unit_factor(*pseudo_axis, batch->unit_type) : NAN;
+			}
+		}
+		batch->valid[i] = ok;
+	}
+}
+
+static void hkl_engine_stats_add(HklEngineStats *self, const HklEngineStats *stats)
+{
+	self->solves += stats->solves;
+	self->failures += stats->failures;
+	self->closed_form += stats->closed_form;
+	self->evaluations += stats->evaluations;
+	self->iterations += stats->iterations;
+	self->restarts += stats->restarts;
+	self->sectors_tested += stats->sectors_tested;
+	self->sectors_accepted += stats->sectors_accepted;
+	self->discontinuities += stats->discontinuities;
+	self->collisions += stats->collisions;
+	self->cache_hits += stats->cache_hits;
+	self->neighbour_starts += stats->neighbour_starts;
+	self->time += stats->time;
+}
+
+int hkl_engine_batch_worker_init(struct HklEngineBatchWorker *self,
+				 const HklEngine *engine)
+{
+	const HklEngineList *engines = engine->engines;
+
+	self->engines = hkl_engine_list_new_copy(engines);
+	self->geometry = hkl_geometry_new_copy(engines->geometry);
+	self->detector = hkl_detector_new_copy(engines->detector);
+	self->engine = NULL;
+	if(!self->engines)
+		return FALSE;
+
+	/* the sample is only read, it is shared */
+	hkl_engine_list_init(self->engines, self->geometry, self->detector, engines->sample);
+
+	self->engine = hkl_engine_list_engine_get_by_name(self->engines,
+							  hkl_engine_name_get(engine),
+							  NULL);
+
+	return NULL != self->engine;
+}
+
+void hkl_engine_batch_worker_release(struct HklEngineBatchWorker *self)
+{
+	if(self->engines)
+		hkl_engine_list_free(self->engines);
+	hkl_geometry_free(self->geometry);
+	hkl_detector_free(self->detector);
+}
+
+static gpointer hkl_engine_batch_worker_run(gpointer data)
+{
+	struct HklEngineBatchWorker *self = data;
+
+	self->batch->run(self->engine, self->batch, self->from, self->to);
+
+	return NULL;
+}
+
+/* split the n rows of a batch in contiguous blocks, each one run by
+ * a copy of the engine list in its own thread */
+static void hkl_engine_batch_dispatch(HklEngine *self,
+				      const struct HklEngineBatch *batch,
+				      size_t n, unsigned int n_threads)
+{
+	size_t i;
+
+	if(n_threads > n)
+		n_threads = n;
+
+	if(n_threads <= 1){
+		batch->run(self, batch, 0, n);
+	}else{
+		struct HklEngineBatchWorker workers[n_threads - 1];
+		size_t n_workers = 0;
+		size_t chunk = n / n_threads;
+
+		/* the calling thread runs the first block */
+		for(i=1; i<n_threads; ++i){
+			struct HklEngineBatchWorker *worker = &workers[n_workers];
+
+			if(!hkl_engine_batch_worker_init(worker, self)){
+				hkl_engine_batch_worker_release(worker);
+				break;
+			}
+			worker->batch = batch;
+			worker->from = i * chunk;
+			worker->to = i == n_threads - 1 ? n : (i + 1) * chunk;
+			++n_workers;
+		}
+
+		for(i=0; i<n_workers; ++i)
+			workers[i].thread = g_thread_new("hkl-batch",
+							 hkl_engine_batch_worker_run,
+							 &workers[i]);
+
+		/* without workers, run their blocks here */
+		batch->run(self, batch, 0, n_workers ? workers[0].from : n);
+		if(n_workers && workers[n_workers - 1].to < n)
+			batch->run(self, batch, workers[n_workers - 1].to, n);
+
+		for(i=0; i<n_workers; ++i){
+			g_thread_join(workers[i].thread);
+			hkl_engine_stats_add(&self->stats, &workers[i].engine->stats);
+			hkl_engine_batch_worker_release(&workers[i]);
+		}
+	}
+}
+
+/**
+ * hkl_engine_pseudo_axis_values_set_batch: (skip)
+ * @self: the this ptr
+ * @targets: the n_targets x n_values pseudo axes values to set
+ * @n_targets: the number of targets
+ * @n_values: the number of pseudo axes of the engine
+ * @unit_type: the unit type (default or user) of the values
+ * @axes: the n_targets x n_axes geometry axes values of the solutions
+ * @n_axes: the number of axes of the geometry
+ * @valid: the n_targets flags, TRUE if a solution was found
+ * @n_threads: the number of threads used to solve the targets
+ * @error: return location for a GError, or NULL
+ *
+ * Set the engine pseudo axes values of many targets, keeping for each
+ * one the solution closest to the current geometry. The solutions are
+ * not copied into #HklGeometryList.
+ *
+ * The targets are split in contiguous blocks solved by copies of the
+ * engine list, see hkl_engine_list_new_copy.
+ *
+ * Return value: FALSE if the sizes do not match the engine.
+ **/
+int hkl_engine_pseudo_axis_values_set_batch(HklEngine *self,
+					    const double targets[], size_t n_targets,
+					    size_t n_values,
+					    HklUnitEnum unit_type,
+					    double axes[], size_t n_axes,
+					    int valid[],
+					    unsigned int n_threads,
+					    GError **error)
+{
+	const struct HklEngineBatch batch = {
+		.run = hkl_engine_batch_set_run,
+		.targets = targets,
+		.n_values = n_values,
+		.unit_type = unit_type,
+		.axes = axes,
+		.n_axes = n_axes,
+		.valid = valid,
+	};
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values != darray_size(self->info->pseudo_axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values,  darray_size(self->info->pseudo_axes));
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->engines->geometry->axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->engines->geometry->axes));
+		return FALSE;
+	}
+
+	hkl_engine_batch_dispatch(self, &batch, n_targets, n_threads);
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_pseudo_axis_values_set_trajectory: (skip)
+ * @self: the this ptr
+ * @targets: the n_targets x n_values pseudo axes values of the path
+ * @n_targets: the number of points of the path
+ * @n_values: the number of pseudo axes of the engine
+ * @unit_type: the unit type (default or user) of the values
+ * @axes: the n_targets x n_axes axes values of the trajectory
+ * @n_axes: the number of axes of the geometry
+ * @valid: the n_targets flags, TRUE if the point was solved
+ * @n_threads: the number of threads used to solve the points
+ * @error: return location for a GError, or NULL
+ *
+ * Solve all the points of a path in pseudo axes space and select one
+ * solution per point, minimising the axes motions over the whole
+ * path, see hkl_trajectory_branch_select. @axes is the motors table
+ * of a continuous scan.
+ *
+ * The points are split in contiguous blocks, like
+ * hkl_engine_pseudo_axis_values_set_batch, and each point starts from
+ * the closest solution of the previous one of its block. The geometry
+ * of the engine list is restored once done.
+ *
+ * Return value: FALSE if the sizes do not match the engine or if a
+ * point of the path has no solution.
+ **/
+int hkl_engine_pseudo_axis_values_set_trajectory(HklEngine *self,
+						 const double targets[], size_t n_targets,
+						 size_t n_values,
+						 HklUnitEnum unit_type,
+						 double axes[], size_t n_axes,
+						 int valid[],
+						 unsigned int n_threads,
+						 GError **error)
+{
+	struct HklEngineBatch batch = {
+		.run = hkl_engine_batch_trajectory_run,
+		.targets = targets,
+		.n_values = n_values,
+		.unit_type = unit_type,
+		.n_axes = n_axes,
+		.valid = valid,
+	};
+	size_t i, j;
+	int res = TRUE;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values != darray_size(self->info->pseudo_axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values,  darray_size(self->info->pseudo_axes));
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->engines->geometry->axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot set engine pseudo axes, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->engines->geometry->axes));
+		return FALSE;
+	}
+
+	batch.solutions = g_new(darray_double, n_targets);
+	for(i=0; i<n_targets; ++i)
+		darray_init(batch.solutions[i]);
+
+	{
+		double saved[n_axes];
+
+		hkl_geometry_axis_values_get(self->engines->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT);
+		hkl_engine_batch_dispatch(self, &batch, n_targets, n_threads);
+		IGNORE(hkl_geometry_axis_values_set(self->engines->geometry,
+						    saved, n_axes, HKL_UNIT_DEFAULT, NULL));
+	}
+
+	if(!hkl_trajectory_branch_select(batch.solutions, n_targets, n_axes, axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "cannot compute the trajectory, some points have no solution\n");
+		res = FALSE;
+	}else if(HKL_UNIT_USER == unit_type){
+		HklParameter **axis;
+
+		for(i=0; i<n_targets; ++i){
+			j = 0;
+			darray_foreach(axis, self->engines->geometry->axes){
+				axes[i * n_axes + j] *= (*axis)->factor;
+				++j;
+			}
+		}
+	}
+
+	for(i=0; i<n_targets; ++i)
+		darray_free(batch.solutions[i]);
+	g_free(batch.solutions);
+
+	return res;
+}
+
+/**
+ * hkl_engine_pseudo_axis_values_set_pvt: (skip)
+ * @self: the this ptr
+ * @targets: the n_targets x n_values pseudo axes values of the path
+ * @n_targets: the number of points of the path
+ * @n_values: the number of pseudo axes of the engine
+ * @velocity: the n_values pseudo axes velocity of the scan, per second
+ * @unit_type: the unit type (default or user) of the values
+ * @axes: the n_targets x n_axes axes positions of the trajectory
+ * @velocities: the n_targets x n_axes axes velocities, per second
+ * @times: the n_targets times of the points, from the first one
+ * @n_axes: the number of axes of the geometry
+ * @valid: the n_targets flags, TRUE if the point was solved
+ * @n_threads: the number of threads used to solve the points
+ * @error: return location for a GError, or NULL
+ *
+ * Compute the position-velocity-time table of a continuous scan at
+ * constant pseudo axes @velocity along a path, for example a line in
+ * hkl space. The positions are the ones of
+ * hkl_engine_pseudo_axis_values_set_trajectory. The axes velocities
+ * are computed from the Jacobian of the current mode at each point,
+ * not by differentiating the positions, the axes not written by the
+ * mode do not move. The time of a point is the length of the path
+ * from the first point divided by the norm of @velocity.
+ *
+ * A point whose axes velocities exceed the motion limits of an axis,
+ * see hkl_parameter_motion_set, is not valid. The geometry and the
+ * pseudo axes values of the engine list are restored once done.
+ *
+ * Return value: FALSE if the sizes do not match the engine, if the
+ * mode can not compute velocities or if a point is not valid.
+ **/
+int hkl_engine_pseudo_axis_values_set_pvt(HklEngine *self,
+					  const double targets[], size_t n_targets,
+					  size_t n_values,
+					  const double velocity[],
+					  HklUnitEnum unit_type,
+					  double axes[], double velocities[],
+					  double times[],
+					  size_t n_axes,
+					  int valid[],
+					  unsigned int n_threads,
+					  GError **error)
+{
+	HklParameter **parameter;
+	size_t i, j;
+	double norm = 0;
+	int res;
+	int slow = FALSE;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(!self->mode || !self->mode->ops->velocities){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+			    "the current mode can not compute the axes velocities\n");
+		return FALSE;
+	}
+
+	if(!hkl_engine_pseudo_axis_values_set_trajectory(self,
+							 targets, n_targets,
+							 n_values, unit_type,
+							 axes, n_axes,
+							 valid, n_threads,
+							 error))
+		return FALSE;
+
+	for(j=0; j<n_values; ++j)
+		norm += velocity[j] * velocity[j];
+	norm = sqrt(norm);
+
+	for(i=0; i<n_targets; ++i){
+		double d = 0;
+
+		if(i > 0){
+			for(j=0; j<n_values; ++j){
+				double dp = targets[i * n_values + j] - targets[(i - 1) * n_values + j];
+
+				d += dp * dp;
+			}
+			d = sqrt(d);
+		}
+		times[i] = (i > 0 ? times[i - 1] : 0) + (norm > 0 ? d / norm : 0);
+	}
+
+	{
+		double saved[n_values];
+		double v[n_values];
+		size_t len;
+
+		res = TRUE;
+		j = 0;
+		darray_foreach(parameter, self->pseudo_axes){
+			saved[j] = (*parameter)->_value;
+			v[j] = velocity[j];
+			if(HKL_UNIT_USER == unit_type)
+				v[j] /= (*parameter)->factor;
+			++j;
+		}
+
+		hkl_engine_prepare_internal(self);
+		len = darray_size(self->axes);
+
+		for(i=0; res && i<n_targets; ++i){
+			double dx[len];
+			GError **e = slow ? NULL : error;
+			size_t k;
+
+			res = hkl_geometry_axis_values_set(self->geometry,
+							   &axes[i * n_axes], n_axes,
+							   unit_type, e);
+			for(j=0; res && j<n_values; ++j)
+				res = hkl_parameter_value_set(darray_item(self->pseudo_axes, j),
+							      targets[i * n_values + j],
+							      unit_type, e);
+			if(res)
+				res = self->mode->ops->velocities(self->mode, self, v, dx, e);
+			if(!res){
+				valid[i] = FALSE;
+				break;
+			}
+
+			/* the mode axes in the geometry axes order */
+			j = 0;
+			darray_foreach(parameter, self->geometry->axes){
+				double *vel = &velocities[i * n_axes + j];
+
+				*vel = 0;
+				for(k=0; k<len; ++k)
+					if(darray_item(self->axes, k) == *parameter)
+						*vel = dx[k];
+
+				if((*parameter)->velocity > 0
+				   && fabs(*vel) > (*parameter)->velocity){
+					if(!slow)
+						g_set_error(error,
+							    HKL_ENGINE_ERROR,
+							    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_SET,
+							    "the axis \"%s\" is too slow for the point %zd of the scan\n",
+							    (*parameter)->name, i);
+					valid[i] = FALSE;
+					slow = TRUE;
+				}
+
+				if(HKL_UNIT_USER == unit_type)
+					*vel *= (*parameter)->factor;
+				++j;
+			}
+		}
+
+		/* the engine geometry is a copy, only the pseudo axes
+		 * values are restored */
+		j = 0;
+		darray_foreach(parameter, self->pseudo_axes){
+			(*parameter)->_value = saved[j++];
+		}
+	}
+
+	return res && !slow;
+}
+
+/**
+ * hkl_engine_pseudo_axis_values_get_batch: (skip)
+ * @self: the this ptr
+ * @positions: the n_positions x n_axes geometry axes values
+ * @n_positions: the number of positions
+ * @n_axes: the number of axes of the geometry
+ * @unit_type: the unit type (default or user) of the values
+ * @values: the n_positions x n_values computed pseudo axes values
+ * @n_values: the number of pseudo axes of the engine
+ * @valid: the n_positions flags, TRUE if the pseudo axes were computed
+ * @n_threads: the number of threads used to compute the positions
+ * @error: return location for a GError, or NULL
+ *
+ * Compute the engine pseudo axes values of many geometry positions
+ * with the current sample and detector. The values of a position
+ * which can not be computed are NAN.
+ *
+ * The positions are split in contiguous blocks computed by copies of
+ * the engine list, see hkl_engine_list_new_copy. The geometry of the
+ * engine list is restored once done.
+ *
+ * Return value: FALSE if the sizes do not match the engine.
+ **/
+int hkl_engine_pseudo_axis_values_get_batch(HklEngine *self,
+					    const double positions[], size_t n_positions,
+					    size_t n_axes,
+					    HklUnitEnum unit_type,
+					    double values[], size_t n_values,
+					    int valid[],
+					    unsigned int n_threads,
+					    GError **error)
+{
+	const struct HklEngineBatch batch = {
+		.run = hkl_engine_batch_get_run,
+		.values = values,
+		.n_values = n_values,
+		.unit_type = unit_type,
+		.positions = positions,
+		.n_axes = n_axes,
+		.valid = valid,
+	};
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	if(n_values != darray_size(self->info->pseudo_axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_GET,
+			    "cannot get engine pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values,  darray_size(self->info->pseudo_axes));
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->engines->geometry->axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_GET,
+			    "cannot get engine pseudo axes, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->engines->geometry->axes));
+		return FALSE;
+	}
+
+	{
+		double saved[n_axes];
+
+		hkl_geometry_axis_values_get(self->engines->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT);
+
+		hkl_engine_batch_dispatch(self, &batch, n_positions, n_threads);
+
+		hkl_geometry_axis_values_set(self->engines->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT, NULL);
+		hkl_engine_get(self, NULL);
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_list_pseudo_axis_values_get_batch: (skip)
+ * @self: the this ptr
+ * @names: the names of the engines to compute
+ * @n_names: the number of engines
+ * @positions: the n_positions x n_axes geometry axes values
+ * @n_positions: the number of positions
+ * @n_axes: the number of axes of the geometry
+ * @unit_type: the unit type (default or user) of the axes and values
+ * @values: the n_positions x n_values computed pseudo axes values, the
+ *          ones of each engine following the order of @names
+ * @n_values: the number of pseudo axes of all the engines
+ * @valid: the n_positions flags, TRUE if the pseudo axes were computed
+ * @n_threads: the number of threads used to compute the positions
+ * @error: return location for a GError, or NULL
+ *
+ * like hkl_engine_pseudo_axis_values_get_batch, but compute the
+ * pseudo axes of many engines at once, for example all the read only
+ * ones (incidence, emergence, tth, q) of the recorded points of a
+ * scan. Each position is set only once, so the geometry update (ki,
+ * kf and the sample rotation) is shared by all the engines.
+ *
+ * Return value: FALSE if an engine is unknown or if the sizes do not
+ * match the engines.
+ **/
+int hkl_engine_list_pseudo_axis_values_get_batch(HklEngineList *self,
+						 const char *names[], size_t n_names,
+						 const double positions[], size_t n_positions,
+						 size_t n_axes,
+						 HklUnitEnum unit_type,
+						 double values[], size_t n_values,
+						 int valid[],
+						 unsigned int n_threads,
+						 GError **error)
+{
+	const struct HklEngineBatch batch = {
+		.run = hkl_engine_batch_get_list_run,
+		.values = values,
+		.n_values = n_values,
+		.unit_type = unit_type,
+		.positions = positions,
+		.n_axes = n_axes,
+		.valid = valid,
+		.names = names,
+		.n_names = n_names,
+	};
+	HklEngine *first = NULL;
+	size_t expected = 0;
+	size_t i;
+
+	hkl_error(error == NULL ||*error == NULL);
+
+	for(i=0; i<n_names; ++i){
+		HklEngine *engine = hkl_engine_list_engine_get_by_name(self, names[i], error);
+
+		if(NULL == engine){
+			hkl_assert(error == NULL || *error != NULL);
+			return FALSE;
+		}
+		if(NULL == first)
+			first = engine;
+		expected += darray_size(engine->info->pseudo_axes);
+	}
+
+	if(NULL == first || n_values != expected){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_GET,
+			    "cannot get engines pseudo axes, wrong number of parameter (%zd) given, (%zd) expected\n",
+			    n_values, expected);
+		return FALSE;
+	}
+
+	if(n_axes != darray_size(self->geometry->axes)){
+		g_set_error(error,
+			    HKL_ENGINE_ERROR,
+			    HKL_ENGINE_ERROR_PSEUDO_AXIS_VALUES_GET,
+			    "cannot get engines pseudo axes, wrong number of axes (%zd) given, (%zd) expected\n",
+			    n_axes,  darray_size(self->geometry->axes));
+		return FALSE;
+	}
+
+	{
+		double saved[n_axes];
+
+		hkl_geometry_axis_values_get(self->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT);
+
+		hkl_engine_batch_dispatch(first, &batch, n_positions, n_threads);
+
+		hkl_geometry_axis_values_set(self->geometry,
+					     saved, n_axes, HKL_UNIT_DEFAULT, NULL);
+		hkl_engine_list_get(self);
+	}
+
+	return TRUE;
+}
+
+/**
+ * hkl_engine_continuation_set:
+ * @self: the this ptr
+ * @order: the order of the predictor, 0 to disable the continuation
+ *
+ * for trajectory scans with close successive pseudo axes values, the
+ * numerical solver starts from a point extrapolated from the last
+ * solutions, linearly (1) or quadratically (2), with only a few
+ * iterations. If this prediction does not converge, the usual search
+ * from the current axes is done. The previous solutions are
+ * forgotten each time this method is called.
+ **/
+void hkl_engine_continuation_set(HklEngine *self, unsigned int order)
+{
+	self->continuation_order = order > 2 ? 2 : order;
+	hkl_engine_continuations_clear(self);
+}
+
+/**
+ * hkl_engine_neighbours_set:
+ * @self: the this ptr
+ * @n_max: the number of solved targets kept, 0 to disable the neighbours
+ *
+ * for 2D or 3D meshes of pseudo axes values, the nearest solved
+ * target is often not the previous one, for example at the start of
+ * each row. Keep the first solution of the @n_max last solved targets
+ * of each mode function and start the numerical solver from the
+ * solution of the nearest one, with only a few iterations. When the
+ * nearest target is the last solved one, the continuation prediction
+ * is used instead, if enabled (see hkl_engine_continuation_set).
+ *
+ * The solved targets are forgotten when the UB matrix, the wave
+ * length or the mode parameters change, and each time this method is
+ * called.
+ **/
+void hkl_engine_neighbours_set(HklEngine *self, size_t n_max)
+{
+	self->neighbours_n_max = n_max;
+	hkl_engine_neighbours_clear(self);
+}
+
+/**
+ * hkl_engine_multistart_set:
+ * @self: the this ptr
+ * @multistart: how the starting points are chosen
+ * @n_starts: the number of starting points tried after the axes values
+ * @seed: the seed of the starting points
+ *
+ * when the numerical solver does not converge from the current axes
+ * values, it restarts from at most @n_starts other points chosen in
+ * the range of the axes, from a Sobol sequence shifted by @seed, a
+ * regular grid or a pseudo random generator seeded with @seed. The
+ * points are the same for each computation, so the solutions are
+ * reproducible and do not depend on a global state. Lower
+ * @n_starts to fail faster on unreachable pseudo axes values.
+ **/
+void hkl_engine_multistart_set(HklEngine *self, HklEngineMultistart multistart,
+			       unsigned int n_starts, unsigned int seed)
+{
+	self->multistart = multistart;
+	self->multistart_n = n_starts;
+	self->multistart_seed = seed;
+}
+
+/**
+ * hkl_engine_sectors_threads_set:
+ * @self: the this ptr
+ * @n_threads: the number of threads testing the sectors, 0 or 1 for
+ * the calling thread only
+ *
+ * the equivalent solutions of the first solution of the numerical
+ * solver are tested in parallel by copies of the engine list, when
+ * there are enough of them. The solutions are added in the same
+ * order than without threads, so the result does not depend on
+ * @n_threads, only the latency of one solve. The copies made by
+ * hkl_engine_list_new_copy test their sectors in their own thread.
+ **/
+void hkl_engine_sectors_threads_set(HklEngine *self, unsigned int n_threads)
+{
+	self->sectors_n_threads = n_threads;
+}
+
+/**
+ * hkl_engine_solutions_set:
+ * @self: the this ptr
+ * @solutions: the solutions to compute
+ *
+ * with #HKL_ENGINE_SOLUTIONS_CLOSEST only the solution closest to the
+ * current geometry is returned, and when the range of the axes is
+ * enough to select the solutions, the search of the equivalent
+ * solutions stops after the first valid one.
+ **/
+void hkl_engine_solutions_set(HklEngine *self, HklEngineSolutions solutions)
+{
+	self->solutions = solutions;
+}
+
+/**
+ * hkl_engine_range_set:
+ * @self: the this ptr
+ * @n_max: the maximum number of 2π shifted solutions, 0 for no limit
+ * @max_distance: the maximum distance to the current geometry of the
+ * 2π shifted solutions, in radian
+ *
+ * the solutions are completed with their 2π shifted copies inside
+ * the range of the axes. With multi-turn axes their number grows as
+ * the product of the turns of each axis, so bound it: the copies
+ * are generated by increasing distance to the current geometry and
+ * only the @n_max closest ones nearer than @max_distance are
+ * kept. Use 0 and INFINITY to get all of them, the default.
+ **/
+void hkl_engine_range_set(HklEngine *self, size_t n_max, double max_distance)
+{
+	self->range_n_max = n_max;
+	self->range_max_distance = max_distance;
+}
+
+/**
+ * hkl_engine_branch_tracking_set:
+ * @self: the this ptr
+ * @max_jump: the maximum motion of an axis from the current geometry,
+ * in radian, INFINITY to disable the tracking
+ * @forced: TRUE to accept a solution leaving the branch
+ *
+ * keep the solutions on the branch of the current geometry, the
+ * previous point of a scan. The solutions with an axis moving more
+ * than @max_jump are removed, so the solver does not flip to an other
+ * sector. When none is left the set fails, unless @forced where all
+ * the solutions are kept. Each solve leaving the branch is counted in
+ * the discontinuities of the #HklEngineStats.
+ *
+ * Combine it with hkl_engine_continuation_set to seed the solver with
+ * the previous solutions.
+ **/
+void hkl_engine_branch_tracking_set(HklEngine *self, double max_jump, int forced)
+{
+	self->branch_max_jump = max_jump;
+	self->branch_forced = forced;
+}
+
+/**
+ * hkl_engine_sort_set:
+ * @self: the this ptr
+ * @sort: the cost used to sort the solutions
+ *
+ * with #HKL_ENGINE_SORT_TIME the solutions are sorted by the time of
+ * the move from the current geometry, using the velocity and
+ * acceleration limits of the axes (see hkl_parameter_motion_set),
+ * instead of the distance. The fastest solution comes first.
+ **/
+void hkl_engine_sort_set(HklEngine *self, HklEngineSort sort)
+{
+	self->sort = sort;
+}
+
+/**
+ * hkl_engine_cache_set:
+ * @self: the this ptr
+ * @n_max: the maximum number of cached solutions, 0 disables the cache
+ *
+ * keep the solutions of the @n_max last hkl_engine_pseudo_axis_values_set
+ * calls. A call with the same pseudo axes values, mode parameters,
+ * geometry axes values and ranges, sample UB, wave length and engine
+ * options returns a copy of the cached solutions without solving.
+ * The least recently used solutions are dropped first.
+ *
+ * The collision predicate is not part of the key, call
+ * hkl_engine_cache_clear when the collision model changes.
+ **/
+void hkl_engine_cache_set(HklEngine *self, size_t n_max)
+{
+	hkl_engine_cache_clear(self);
+	self->cache_n_max = n_max;
+}
+
+/**
+ * hkl_engine_cache_clear:
+ * @self: the this ptr
+ *
+ * drop all the cached solutions of the engine.
+ **/
+void hkl_engine_cache_clear(HklEngine *self)
+{
+	HklEngineCacheEntry *entry;
+
+	darray_foreach(entry, self->cache)
+		hkl_engine_cache_entry_release(entry);
+	darray_resize(self->cache, 0);
+}
+
+/**
+ * hkl_engine_stats_get:
+ * @self: the this ptr
+ * @stats: (out caller-allocates): the statistics of the engine
+ *
+ * get the counters of the engine since its creation or the last
+ * hkl_engine_stats_reset. The batch solve adds the counters of its
+ * threads to the engine.
+ **/
+void hkl_engine_stats_get(const HklEngine *self, HklEngineStats *stats)
+{
+	*stats = self->stats;
+}
+
+/**
+ * hkl_engine_stats_reset:
+ * @self: the this ptr
+ *
+ * reset all the counters of the engine
+ **/
+void hkl_engine_stats_reset(HklEngine *self)
+{
+	self->stats = (HklEngineStats){0};
+}
+
+/**
+ * hkl_engine_stats_dup: (skip)
+ * @self: the #HklEngineStats to copy
+ *
+ * Returns: a copy of the statistics
+ **/
+HklEngineStats *hkl_engine_stats_dup(const HklEngineStats *self)
+{
+	HklEngineStats *dup = g_new(HklEngineStats, 1);
+
+	*dup = *self;
+
+	return dup;
+}
+
+/**
+ * hkl_engine_stats_free: (skip)
+ * @self: the #HklEngineStats to release
+ **/
+void hkl_engine_stats_free(HklEngineStats *self)
+{
+	free(self);
+}
+
 /**
  * hkl_engine_dependencies_get:
  * @self: the this ptr
@@ -652,6 +1829,129 @@ void hkl_engine_list_free(HklEngineList *self)
 	self->ops->free(self);
 }
 
+/**
+ * hkl_engine_list_engines_keep: (skip)
+ * @self: the this ptr
+ * @names: the names of the engines to keep
+ * @n_names: the number of names
+ *
+ * free all the engines not named in @names and the pseudo axes which
+ * are not used anymore. The order of the remaining engines and
+ * pseudo axes is kept, so two lists created by the same factory and
+ * filtered with the same names stay index compatible.
+ **/
+void hkl_engine_list_engines_keep(HklEngineList *self,
+				  const char *names[], size_t n_names)
+{
+	size_t i, j, n;
+
+	n = 0;
+	for(i=0; i<darray_size(*self); ++i){
+		HklEngine *engine = darray_item(*self, i);
+		int keep = FALSE;
+
+		for(j=0; j<n_names && !keep; ++j)
+			keep = !strcmp(engine->info->name, names[j]);
+		if(keep)
+			darray_item(*self, n++) = engine;
+		else
+			hkl_engine_free(engine);
+	}
+	darray_resize(*self, n);
+
+	n = 0;
+	for(i=0; i<darray_size(self->pseudo_axes); ++i){
+		HklParameter *parameter = darray_item(self->pseudo_axes, i);
+		HklEngine **engine;
+		int used = FALSE;
+
+		darray_foreach(engine, *self){
+			HklParameter **pseudo_axis;
+
+			darray_foreach(pseudo_axis, (*engine)->pseudo_axes)
+				used |= *pseudo_axis == parameter;
+		}
+		if(used)
+			darray_item(self->pseudo_axes, n++) = parameter;
+		else
+			hkl_parameter_free(parameter);
+	}
+	darray_resize(self->pseudo_axes, n);
+}
+
+/**
+ * hkl_engine_list_new_copy:
+ * @self: the #HklEngineList to copy
+ *
+ * copy the engines with their current mode, the parameters, the
+ * pseudo axes, the initialized state of all the modes and the
+ * collision check, see hkl_engine_list_collision_set. The copy
+ * must be associated to its own geometry and detector with
+ * hkl_engine_list_init before solving, then it does not share any
+ * mutable state with @self and can be used from another thread.
+ * The sample is only read by the engines, so one sample can be shared
+ * by all the copies as long as nobody modifies it.
+ *
+ * Returns: the copy or NULL if @self was not created by an #HklFactory.
+ **/
+HklEngineList *hkl_engine_list_new_copy(const HklEngineList *self)
+{
+	HklEngineList *dup;
+	size_t i, j;
+
+	if(NULL == self->factory)
+		return NULL;
+
+	dup = hkl_factory_create_new_engine_list(self->factory);
+
+	/* same subset of engines */
+	if(darray_size(*dup) != darray_size(*self)){
+		const char *names[darray_size(*self)];
+
+		for(i=0; i<darray_size(*self); ++i)
+			names[i] = darray_item(*self, i)->info->name;
+		hkl_engine_list_engines_keep(dup, names, darray_size(*self));
+	}
+
+	for(i=0; i<darray_size(self->parameters); ++i)
+		hkl_parameter_init_copy(darray_item(dup->parameters, i),
+					darray_item(self->parameters, i),
+					NULL);
+
+	for(i=0; i<darray_size(self->pseudo_axes); ++i)
+		hkl_parameter_init_copy(darray_item(dup->pseudo_axes, i),
+					darray_item(self->pseudo_axes, i),
+					NULL);
+
+	for(i=0; i<darray_size(*self); ++i){
+		const HklEngine *engine = darray_item(*self, i);
+		HklEngine *copy = darray_item(*dup, i);
+
+		for(j=0; j<darray_size(engine->modes); ++j){
+			const HklMode *mode = darray_item(engine->modes, j);
+
+			hkl_mode_init_copy(darray_item(copy->modes, j), mode);
+			if(mode == engine->mode)
+				hkl_engine_mode_set(copy, darray_item(copy->modes, j));
+		}
+
+		copy->continuation_order = engine->continuation_order;
+		hkl_engine_neighbours_set(copy, engine->neighbours_n_max);
+		hkl_engine_multistart_set(copy, engine->multistart,
+					  engine->multistart_n, engine->multistart_seed);
+		hkl_engine_solutions_set(copy, engine->solutions);
+		hkl_engine_range_set(copy, engine->range_n_max, engine->range_max_distance);
+		hkl_engine_branch_tracking_set(copy, engine->branch_max_jump, engine->branch_forced);
+		hkl_engine_sort_set(copy, engine->sort);
+		hkl_engine_cache_set(copy, engine->cache_n_max);
+	}
+
+	/* the solutions of the copies are rejected like ours */
+	hkl_engine_list_collision_set(dup, self->is_colliding, self->is_colliding_data);
+
+	return dup;
+}
+
 /**
  * hkl_engine_list_engines_get: (skip)
  * @self: the this ptr
@@ -684,6 +1984,32 @@ int hkl_engine_list_geometry_set(HklEngineList *self, const HklGeometry *geometr
 	return TRUE;
 }
 
+/**
+ * hkl_engine_list_collision_set: (skip)
+ * @self: the this ptr
+ * @is_colliding: (allow-none): TRUE for the colliding geometries
+ * @data: the user data passed to @is_colliding
+ *
+ * the solutions of the engines for which @is_colliding is TRUE are
+ * rejected while they are generated, before being copied into the
+ * geometries list. With the closest solution, the search stops at
+ * the first one which does not collide. The rejected solutions are
+ * counted in the collisions of the #HklEngineStats. A NULL
+ * @is_colliding removes the check.
+ *
+ * the copies made by hkl_engine_list_new_copy keep @is_colliding and
+ * @data. The batch solves and the sectors search with more than one
+ * thread call it from several threads at once with the same @data,
+ * so it must be thread-safe.
+ **/
+void hkl_engine_list_collision_set(HklEngineList *self,
+				   HklGeometryPredicate is_colliding,
+				   void *data)
+{
+	self->is_colliding = is_colliding;
+	self->is_colliding_data = data;
+}
+
 /**
  * hkl_engine_list_select_solution:
  * @self: the this ptr
@@ -753,7 +2079,13 @@ void hkl_engine_list_init(HklEngineList *self,
 	self->sample = sample;
 
 	darray_foreach(engine, *self){
+		HklMode **mode;
+
+		darray_foreach(mode, (*engine)->modes){
+			hkl_mode_axes_idx_set(*mode, geometry);
+		}
 		hkl_engine_prepare_internal(*engine);
+		(*engine)->dirty = TRUE;
 	}
 }
 
@@ -761,22 +2093,25 @@ void hkl_engine_list_init(HklEngineList *self,
  * hkl_engine_list_get:
  * @self: the list of #HklEngine
  *
- * apply the get method to all the #HklEngine of the list
- * after this it is possible to retrive all the #HklPseudoAxis values.
+ * invalidate the #HklPseudoAxis values of all the #HklEngine of the
+ * list, for example after a change of the sample or the
+ * detector. The values of an engine are computed again when they
+ * are read, with hkl_engine_pseudo_axis_get or
+ * hkl_engine_pseudo_axis_values_get, so only the engines which are
+ * read pay for it. A change of the geometry axes or wavelength is
+ * detected without calling this method.
  *
- * Returns: HKL_SUCCESS or HKL_FAIL if one of the #HklEngine
- * get method failed.
+ * Returns: TRUE
  **/
 int hkl_engine_list_get(HklEngineList *self)
 {
 	HklEngine **engine;
-	int res = TRUE;
 
 	darray_foreach(engine, *self){
-		res &= hkl_engine_get(*engine, NULL);
+		(*engine)->dirty = TRUE;
 	}
 
-	return res;
+	return TRUE;
 }
 
 /**
@@ -22,6 +22,7 @@
 #ifndef __HKL_QUATERNION_PRIVATE_H__
 #define __HKL_QUATERNION_PRIVATE_H__
 
+#include <math.h>                       // for sqrt
 #include <stdio.h>                      // for FILE
 #include "hkl.h"                        // for G_BEGIN_DECLS, etc
 
@@ -46,12 +47,67 @@ extern int hkl_quaternion_cmp(const HklQuaternion *self, const HklQuaternion *q)
 extern void hkl_quaternion_minus_quaternion(HklQuaternion *self,
 					    const HklQuaternion *q);
 
-extern void hkl_quaternion_times_quaternion(HklQuaternion *self,
-					    const HklQuaternion *q);
-
-extern double hkl_quaternion_norm2(const HklQuaternion *self);
-
-extern void hkl_quaternion_conjugate(HklQuaternion *self);
+/**
+ * hkl_quaternion_times_quaternion:
+ * @self: the #HklQuaternion to modify
+ * @q: the #HklQuaternion to multiply by
+ *
+ * multiply two quaternions
+ **/
+static inline void hkl_quaternion_times_quaternion(HklQuaternion *self, const HklQuaternion *q)
+{
+	HklQuaternion Tmp;
+	double *Q;
+
+	Tmp = *self;
+	Q = Tmp.data;
+	if (self == q){
+		self->data[0] = Q[0]*Q[0] - Q[1]*Q[1] - Q[2]*Q[2] - Q[3]*Q[3];
+		self->data[1] = Q[0]*Q[1] + Q[1]*Q[0] + Q[2]*Q[3] - Q[3]*Q[2];
+		self->data[2] = Q[0]*Q[2] - Q[1]*Q[3] + Q[2]*Q[0] + Q[3]*Q[1];
+		self->data[3] = Q[0]*Q[3] + Q[1]*Q[2] - Q[2]*Q[1] + Q[3]*Q[0];
+	}else{
+		double const *Q1 = q->data;
+		self->data[0] = Q[0]*Q1[0] - Q[1]*Q1[1] - Q[2]*Q1[2] - Q[3]*Q1[3];
+		self->data[1] = Q[0]*Q1[1] + Q[1]*Q1[0] + Q[2]*Q1[3] - Q[3]*Q1[2];
+		self->data[2] = Q[0]*Q1[2] - Q[1]*Q1[3] + Q[2]*Q1[0] + Q[3]*Q1[1];
+		self->data[3] = Q[0]*Q1[3] + Q[1]*Q1[2] - Q[2]*Q1[1] + Q[3]*Q1[0];
+	}
+}
+
+extern void hkl_quaternion_array_times_quaternion_array(double self[],
+							const double q[],
+							size_t n);
+
+/**
+ * hkl_quaternion_norm2:
+ * @self: the quaternion use to compute the norm
+ *
+ * compute the norm2 of an #HklQuaternion
+ *
+ * Returns: the self #hklquaternion norm
+ **/
+static inline double hkl_quaternion_norm2(const HklQuaternion *self)
+{
+	double sum2 = 0;
+	unsigned int i;
+	for (i=0;i<4;i++)
+		sum2 += self->data[i] *self->data[i];
+	return sqrt(sum2);
+}
+
+/**
+ * hkl_quaternion_conjugate:
+ * @self: the #HklQuaternion to conjugate
+ *
+ * compute the conjugate of a quaternion
+ **/
+static inline void hkl_quaternion_conjugate(HklQuaternion *self)
+{
+	unsigned int i;
+	for (i=1;i<4;i++)
+		self->data[i] = -self->data[i];
+}
 
 extern void hkl_quaternion_to_matrix(const HklQuaternion *self, HklMatrix *m);
 
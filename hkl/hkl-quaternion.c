@@ -171,61 +171,42 @@ void hkl_quaternion_minus_quaternion(HklQuaternion *self, const HklQuaternion *q
 }
 
 /**
- * hkl_quaternion_times_quaternion:
- * @self: the #HklQuaternion to modify
- * @q: the #HklQuaternion to multiply by
+ * hkl_quaternion_array_times_quaternion_array: (skip)
+ * @self: the quaternions to modify, all the first components, then
+ *        all the second, the third and the fourth ones
+ * @q: the quaternions to multiply by, with the same layout
+ * @n: the number of quaternions
  *
- * multiply two quaternions
+ * multiply each quaternion of @self by the one of @q with the same
+ * index. Calling it once per axis composes @n rotation chains at a
+ * time. The loop is written without branch so that the compiler can
+ * vectorise it, @self and @q must not overlap.
  **/
-void hkl_quaternion_times_quaternion(HklQuaternion *self, const HklQuaternion *q)
+void hkl_quaternion_array_times_quaternion_array(double self[],
+						 const double q[],
+						 size_t n)
 {
-	HklQuaternion Tmp;
-	double *Q;
+	double *restrict a = &self[0 * n];
+	double *restrict b = &self[1 * n];
+	double *restrict c = &self[2 * n];
+	double *restrict d = &self[3 * n];
+	const double *restrict a1 = &q[0 * n];
+	const double *restrict b1 = &q[1 * n];
+	const double *restrict c1 = &q[2 * n];
+	const double *restrict d1 = &q[3 * n];
+	size_t i;
 
-	Tmp = *self;
-	Q = Tmp.data;
-	if (self == q){
-		self->data[0] = Q[0]*Q[0] - Q[1]*Q[1] - Q[2]*Q[2] - Q[3]*Q[3];
-		self->data[1] = Q[0]*Q[1] + Q[1]*Q[0] + Q[2]*Q[3] - Q[3]*Q[2];
-		self->data[2] = Q[0]*Q[2] - Q[1]*Q[3] + Q[2]*Q[0] + Q[3]*Q[1];
-		self->data[3] = Q[0]*Q[3] + Q[1]*Q[2] - Q[2]*Q[1] + Q[3]*Q[0];
-	}else{
-		double const *Q1 = q->data;
-		self->data[0] = Q[0]*Q1[0] - Q[1]*Q1[1] - Q[2]*Q1[2] - Q[3]*Q1[3];
-		self->data[1] = Q[0]*Q1[1] + Q[1]*Q1[0] + Q[2]*Q1[3] - Q[3]*Q1[2];
-		self->data[2] = Q[0]*Q1[2] - Q[1]*Q1[3] + Q[2]*Q1[0] + Q[3]*Q1[1];
-		self->data[3] = Q[0]*Q1[3] + Q[1]*Q1[2] - Q[2]*Q1[1] + Q[3]*Q1[0];
-	}
-}
+	for(i=0; i<n; ++i){
+		double Q0 = a[i];
+		double Q1 = b[i];
+		double Q2 = c[i];
+		double Q3 = d[i];
 
-/**
- * hkl_quaternion_norm2:
- * @self: the quaternion use to compute the norm
- *
- * compute the norm2 of an #HklQuaternion
- *
- * Returns: the self #hklquaternion norm
- **/
-double hkl_quaternion_norm2(const HklQuaternion *self)
-{
-	double sum2 = 0;
-	unsigned int i;
-	for (i=0;i<4;i++)
-		sum2 += self->data[i] *self->data[i];
-	return sqrt(sum2);
-}
-
-/**
- * hkl_quaternion_conjugate:
- * @self: the #HklQuaternion to conjugate
- *
- * compute the conjugate of a quaternion
- **/
-void hkl_quaternion_conjugate(HklQuaternion *self)
-{
-	unsigned int i;
-	for (i=1;i<4;i++)
-		self->data[i] = -self->data[i];
+		a[i] = Q0*a1[i] - Q1*b1[i] - Q2*c1[i] - Q3*d1[i];
+		b[i] = Q0*b1[i] + Q1*a1[i] + Q2*d1[i] - Q3*c1[i];
+		c[i] = Q0*c1[i] - Q1*d1[i] + Q2*a1[i] + Q3*b1[i];
+		d[i] = Q0*d1[i] + Q1*c1[i] - Q2*b1[i] + Q3*a1[i];
+	}
 }
 
 /**
@@ -22,7 +22,9 @@
 
 /* for strdup */
 #define _XOPEN_SOURCE 500
+#include <gsl/gsl_blas.h>               // for gsl_blas_dnrm2
 #include <gsl/gsl_errno.h>              // for gsl_set_error_handler, etc
+#include <gsl/gsl_multifit_nlinear.h>   // for gsl_multifit_nlinear_fdf, etc
 #include <gsl/gsl_multimin.h>           // for gsl_multimin_function, etc
 #include <gsl/gsl_nan.h>                // for GSL_NAN
 #include <gsl/gsl_vector_double.h>      // for gsl_vector_get, etc
@@ -43,11 +45,15 @@
 #include "hkl-unit-private.h"           // for hkl_unit_angle_deg, etc
 #include "hkl-vector-private.h"         // for HklVector, hkl_vector_angle, etc
 #include "hkl.h"                        // for HklSample, etc
+#include "hkl/ccan/array_size/array_size.h"  // for ARRAY_SIZE
 #include "hkl/ccan/darray/darray.h"     // for darray_foreach, darray_item
 #include "hkl/ccan/list/list.h"         // for list_head, list_add_tail, etc
 
 /* #define DEBUG */
 #define ITER_MAX 10000
+#define LM_ITER_MAX 100
+#define LM_TOL 1e-12
+#define INDEX_PEAKS_MAX 5
 
 /* private */
 static void hkl_sample_clear_all_reflections(HklSample *self)
@@ -214,30 +220,103 @@ static double set_UB_fitness(const gsl_vector *x, void *params)
 	return fitness;
 }
 
-static double mono_crystal_fitness(const gsl_vector *x, void *params)
+/*
+ * the reflections used to fit the sample, packed once before the
+ * minimization. Their hkl and _hkl do not change during a fit, so
+ * each evaluation is a loop over contiguous arrays which the
+ * compiler can vectorise, instead of a walk of the reflections list.
+ */
+struct hkl_sample_fit_t
+{
+	HklSample *sample;
+	size_t n; /* the number of reflections */
+	double *hkl; /* all the h, then all the k, then all the l */
+	double *q; /* the _hkl, same layout */
+};
+
+static void hkl_sample_fit_init(struct hkl_sample_fit_t *self, HklSample *sample)
 {
-	size_t i;
-	double fitness;
-	HklSample *sample = params;
 	HklSampleReflection *reflection;
+	size_t i = 0, j;
 
-	if (!hkl_sample_init_from_gsl_vector(sample, x))
-		return GSL_NAN;
+	self->sample = sample;
+	self->n = 0;
+	list_for_each(&sample->reflections, reflection, list)
+		if(reflection->flag)
+			self->n++;
 
-	fitness = 0.;
+	self->hkl = g_new(double, 3 * self->n);
+	self->q = g_new(double, 3 * self->n);
 	list_for_each(&sample->reflections, reflection, list){
 		if(reflection->flag){
-			HklVector UBh;
+			for(j=0; j<3; ++j){
+				self->hkl[j * self->n + i] = reflection->hkl.data[j];
+				self->q[j * self->n + i] = reflection->_hkl.data[j];
+			}
+			i++;
+		}
+	}
+}
 
-			UBh = reflection->hkl;
-			hkl_matrix_times_vector(&sample->UB, &UBh);
+static void hkl_sample_fit_release(struct hkl_sample_fit_t *self)
+{
+	g_free(self->q);
+	g_free(self->hkl);
+}
 
-			for(i=0; i<3; ++i) {
-				double tmp = UBh.data[i] - reflection->_hkl.data[i];
-				fitness += tmp * tmp;
-			}
+/* r[c * stride + offset(i)] = (M.hkl - q)[c] of the reflection i, q
+ * can be NULL for the derivatives. The residuals of the reflection i
+ * are at 3 * i, like the reflections order of the solvers. */
+static void hkl_sample_fit_residuals(const struct hkl_sample_fit_t *self,
+				     const HklMatrix *M, const double *q,
+				     double *r, size_t stride)
+{
+	const double *h = &self->hkl[0 * self->n];
+	const double *k = &self->hkl[1 * self->n];
+	const double *l = &self->hkl[2 * self->n];
+	size_t i, c;
+
+	for(c=0; c<3; ++c){
+		const double m0 = M->data[c][0];
+		const double m1 = M->data[c][1];
+		const double m2 = M->data[c][2];
+
+		for(i=0; i<self->n; ++i){
+			double v = m0 * h[i] + m1 * k[i] + m2 * l[i];
+
+			if(NULL != q)
+				v -= q[c * self->n + i];
+			r[(3 * i + c) * stride] = v;
 		}
 	}
+}
+
+static double mono_crystal_fitness(const gsl_vector *x, void *params)
+{
+	const struct hkl_sample_fit_t *fit = params;
+	HklSample *sample = fit->sample;
+	const double *h = &fit->hkl[0 * fit->n];
+	const double *k = &fit->hkl[1 * fit->n];
+	const double *l = &fit->hkl[2 * fit->n];
+	double fitness = 0.;
+	size_t i, c;
+
+	if (!hkl_sample_init_from_gsl_vector(sample, x))
+		return GSL_NAN;
+
+	for(c=0; c<3; ++c){
+		const double m0 = sample->UB.data[c][0];
+		const double m1 = sample->UB.data[c][1];
+		const double m2 = sample->UB.data[c][2];
+		const double *q = &fit->q[c * fit->n];
+
+		for(i=0; i<fit->n; ++i){
+			double tmp = m0 * h[i] + m1 * k[i] + m2 * l[i] - q[i];
+
+			fitness += tmp * tmp;
+		}
+	}
+
 	return fitness;
 }
 
@@ -715,6 +794,21 @@ void hkl_sample_del_reflection(HklSample *self,
 	self->n_reflections--;
 }
 
+/* the U which rotates the orthonormal frames of (Bh1, Bh2) onto the
+ * one of (q1, q2), the Busing and Levy method */
+static void hkl_sample_U_from_two_vectors(HklMatrix *U,
+					  const HklVector *Bh1, const HklVector *Bh2,
+					  const HklVector *q1, const HklVector *q2)
+{
+	HklMatrix Tc;
+
+	hkl_matrix_init_from_two_vector(&Tc, Bh1, Bh2);
+	hkl_matrix_transpose(&Tc);
+
+	hkl_matrix_init_from_two_vector(U, q1, q2);
+	hkl_matrix_times_matrix(U, &Tc);
+}
+
 /**
  * hkl_sample_compute_UB_busing_levy:
  * @self: the this ptr
@@ -738,7 +832,6 @@ int hkl_sample_compute_UB_busing_levy(HklSample *self,
 		HklVector h1c;
 		HklVector h2c;
 		HklMatrix B;
-		HklMatrix Tc;
 
 		/* Compute matrix Tc from r1 and r2. */
 		h1c = r1->hkl;
@@ -746,13 +839,10 @@ int hkl_sample_compute_UB_busing_levy(HklSample *self,
 		hkl_lattice_get_B(self->lattice, &B);
 		hkl_matrix_times_vector(&B, &h1c);
 		hkl_matrix_times_vector(&B, &h2c);
-		hkl_matrix_init_from_two_vector(&Tc, &h1c, &h2c);
-		hkl_matrix_transpose(&Tc);
 
 		/* compute U */
-		hkl_matrix_init_from_two_vector(&self->U,
-						&r1->_hkl, &r2->_hkl);
-		hkl_matrix_times_matrix(&self->U, &Tc);
+		hkl_sample_U_from_two_vectors(&self->U, &h1c, &h2c,
+					      &r1->_hkl, &r2->_hkl);
 		hkl_sample_compute_UxUyUz(self);
 		hkl_sample_compute_UB(self);
 	}else{
@@ -778,7 +868,745 @@ int hkl_sample_compute_UB_busing_levy(HklSample *self,
  **/
 int hkl_sample_affine(HklSample *self, GError **error)
 {
-	return minimize(self, mono_crystal_fitness, self, error);
+	struct hkl_sample_fit_t fit;
+	int res;
+
+	hkl_sample_fit_init(&fit, self);
+	res = minimize(self, mono_crystal_fitness, &fit, error);
+	hkl_sample_fit_release(&fit);
+
+	return res;
+}
+
+/*
+ * the Levenberg-Marquardt refinement, the residuals are the three
+ * components of UB.hkl - _hkl of each reflection used to fit, like in
+ * mono_crystal_fitness, and the solver parameters are the fitted ones
+ * among ux, uy, uz, a, b, c, alpha, beta and gamma.
+ */
+struct affine_lm_t
+{
+	struct hkl_sample_fit_t fit;
+	gsl_vector *all; /* the 9 parameters, the not fitted ones are kept */
+	size_t idx[9]; /* the index in all of each solver parameter */
+};
+
+static int affine_lm_sample_set(struct affine_lm_t *params, const gsl_vector *x)
+{
+	size_t i;
+
+	for(i=0; i<x->size; ++i)
+		gsl_vector_set(params->all, params->idx[i], gsl_vector_get(x, i));
+
+	return hkl_sample_init_from_gsl_vector(params->fit.sample, params->all);
+}
+
+static int affine_lm_f(const gsl_vector *x, void *data, gsl_vector *f)
+{
+	struct affine_lm_t *params = data;
+
+	if (!affine_lm_sample_set(params, x))
+		return GSL_EDOM;
+
+	hkl_sample_fit_residuals(&params->fit, &params->fit.sample->UB, params->fit.q,
+				 f->data, f->stride);
+
+	return GSL_SUCCESS;
+}
+
+static int affine_lm_df(const gsl_vector *x, void *data, gsl_matrix *J)
+{
+	struct affine_lm_t *params = data;
+	HklSample *sample = params->fit.sample;
+	HklMatrix B, dB[6], dUB[9];
+	HklMatrix Rx, Ry, Rz, dRx, dRy, dRz;
+	double angles[3];
+	size_t i, j;
+
+	if (!affine_lm_sample_set(params, x))
+		return GSL_EDOM;
+	if (!hkl_lattice_get_B_derivatives(sample->lattice, &B, dB))
+		return GSL_EDOM;
+
+	/* U = Rx(ux).Ry(uy).Rz(uz), see hkl_matrix_init_from_euler */
+	for(i=0; i<3; ++i)
+		angles[i] = gsl_vector_get(params->all, i);
+	{
+		const double A = cos(angles[0]), B_ = sin(angles[0]);
+		const double C = cos(angles[1]), D = sin(angles[1]);
+		const double E = cos(angles[2]), F = sin(angles[2]);
+
+		hkl_matrix_init(&Rx, 1, 0, 0, 0, A, -B_, 0, B_, A);
+		hkl_matrix_init(&dRx, 0, 0, 0, 0, -B_, -A, 0, A, -B_);
+		hkl_matrix_init(&Ry, C, 0, D, 0, 1, 0, -D, 0, C);
+		hkl_matrix_init(&dRy, -D, 0, C, 0, 0, 0, -C, 0, -D);
+		hkl_matrix_init(&Rz, E, -F, 0, F, E, 0, 0, 0, 1);
+		hkl_matrix_init(&dRz, -F, -E, 0, E, -F, 0, 0, 0, 0);
+	}
+	dUB[0] = dRx;
+	hkl_matrix_times_matrix(&dUB[0], &Ry);
+	hkl_matrix_times_matrix(&dUB[0], &Rz);
+	dUB[1] = Rx;
+	hkl_matrix_times_matrix(&dUB[1], &dRy);
+	hkl_matrix_times_matrix(&dUB[1], &Rz);
+	dUB[2] = Rx;
+	hkl_matrix_times_matrix(&dUB[2], &Ry);
+	hkl_matrix_times_matrix(&dUB[2], &dRz);
+	for(i=0; i<3; ++i)
+		hkl_matrix_times_matrix(&dUB[i], &B);
+	for(i=0; i<6; ++i){
+		dUB[3 + i] = sample->U;
+		hkl_matrix_times_matrix(&dUB[3 + i], &dB[i]);
+	}
+
+	/* the column j of J, rows are strided by tda */
+	for(j=0; j<x->size; ++j)
+		hkl_sample_fit_residuals(&params->fit, &dUB[params->idx[j]], NULL,
+					 &J->data[j], J->tda);
+
+	return GSL_SUCCESS;
+}
+
+/* the Levenberg-Marquardt refinement without the gsl error handler
+ * changes, which are global to all the threads */
+static int hkl_sample_affine_lm(HklSample *self,
+				double covariance[], size_t n_covariance,
+				GError **error)
+{
+	const HklParameter *parameters[] = {
+		self->ux, self->uy, self->uz,
+		self->lattice->a, self->lattice->b, self->lattice->c,
+		self->lattice->alpha, self->lattice->beta, self->lattice->gamma,
+	};
+	struct affine_lm_t params;
+	gsl_multifit_nlinear_parameters fdf_params = gsl_multifit_nlinear_default_parameters();
+	gsl_multifit_nlinear_workspace *w;
+	gsl_multifit_nlinear_fdf fdf;
+	HklSample *saved;
+	gsl_vector *x;
+	size_t i, j, n = 0, p = 0;
+	int status, info;
+	int res = TRUE;
+
+	hkl_error (error == NULL || *error == NULL);
+	g_return_val_if_fail(NULL == covariance || 81 == n_covariance, FALSE);
+
+	if (NULL != covariance)
+		for(i=0; i<n_covariance; ++i)
+			covariance[i] = 0.;
+
+	hkl_sample_fit_init(&params.fit, self);
+	n = 3 * params.fit.n;
+	for(i=0; i<ARRAY_SIZE(parameters); ++i)
+		if(parameters[i]->fit)
+			params.idx[p++] = i;
+	if (0 == p){
+		hkl_sample_fit_release(&params.fit);
+		return TRUE;
+	}
+	if (n < p){
+		hkl_sample_fit_release(&params.fit);
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "not enough reflections (%zd residuals) to fit %zd parameters",
+			    n, p);
+		return FALSE;
+	}
+
+	/* save the sample state */
+	saved = hkl_sample_new_copy(self);
+
+	params.all = gsl_vector_alloc(9);
+	hkl_sample_to_gsl_vector(self, params.all);
+	x = gsl_vector_alloc(p);
+	for(i=0; i<p; ++i)
+		gsl_vector_set(x, i, gsl_vector_get(params.all, params.idx[i]));
+
+	fdf.f = affine_lm_f;
+	fdf.df = affine_lm_df;
+	fdf.fvv = NULL;
+	fdf.n = n;
+	fdf.p = p;
+	fdf.params = &params;
+
+	fdf_params.trs = gsl_multifit_nlinear_trs_lm;
+	w = gsl_multifit_nlinear_alloc(gsl_multifit_nlinear_trust, &fdf_params, n, p);
+	status = gsl_multifit_nlinear_init(x, &fdf, w);
+	if (GSL_SUCCESS == status)
+		status = gsl_multifit_nlinear_driver(LM_ITER_MAX, LM_TOL, LM_TOL, LM_TOL,
+						     NULL, NULL, &info, w);
+
+	if (GSL_SUCCESS == status){
+		/* the last evaluation can be a rejected step */
+		IGNORE(affine_lm_sample_set(&params, gsl_multifit_nlinear_position(w)));
+
+		if (NULL != covariance){
+			gsl_matrix *covar = gsl_matrix_alloc(p, p);
+			double chi = gsl_blas_dnrm2(gsl_multifit_nlinear_residual(w));
+			double s2 = n > p ? chi * chi / (n - p) : 1.;
+
+			gsl_multifit_nlinear_covar(gsl_multifit_nlinear_jac(w), 0., covar);
+			for(i=0; i<p; ++i)
+				for(j=0; j<p; ++j)
+					covariance[params.idx[i] * 9 + params.idx[j]] = s2 * gsl_matrix_get(covar, i, j);
+			gsl_matrix_free(covar);
+		}
+	}else{
+		hkl_sample_sample_set(self, saved); /* restore the saved sample */
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "Levenberg-Marquardt refinement failed: %s",
+			    gsl_strerror(status));
+		res = FALSE;
+	}
+
+	gsl_multifit_nlinear_free(w);
+	gsl_vector_free(x);
+	gsl_vector_free(params.all);
+	hkl_sample_fit_release(&params.fit);
+	hkl_sample_free(saved);
+
+	return res;
+}
+
+/**
+ * hkl_sample_affine_levenberg_marquardt:
+ * @self: the this ptr
+ * @covariance: (array length=n_covariance) (nullable): the 9x9 covariance of ux, uy, uz, a, b, c, alpha, beta and gamma
+ * @n_covariance: the size of @covariance, 81 or 0
+ * @error: return location for a GError, or NULL
+ *
+ * affine the sample like hkl_sample_affine, with a least-squares
+ * Levenberg-Marquardt refinement of the same residuals using their
+ * analytic derivatives. It converges in a few iterations even with
+ * many reflections.
+ *
+ * The covariance of the fitted parameters is scaled by the residual
+ * variance, chi²/(n - p); the rows and columns of the not fitted
+ * parameters are 0.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_sample_affine_levenberg_marquardt(HklSample *self,
+					  double covariance[], size_t n_covariance,
+					  GError **error)
+{
+	int res;
+
+	gsl_set_error_handler_off();
+	res = hkl_sample_affine_lm(self, covariance, n_covariance, error);
+	gsl_set_error_handler (NULL);
+
+	return res;
+}
+
+/* the number of flagged reflections whose UB.hkl is within threshold
+ * of _hkl, the outliers are unflagged if unflag is TRUE. */
+static size_t hkl_sample_ransac_inliers(HklSample *self,
+					HklSampleReflection **reflections, size_t n,
+					double threshold, int unflag)
+{
+	size_t i, res = 0;
+
+	for(i=0; i<n; ++i){
+		HklVector UBh = reflections[i]->hkl;
+
+		hkl_matrix_times_vector(&self->UB, &UBh);
+		if (hkl_vector_angle(&UBh, &reflections[i]->_hkl) <= threshold)
+			res++;
+		else if (unflag)
+			reflections[i]->flag = FALSE;
+	}
+
+	return res;
+}
+
+/**
+ * hkl_sample_affine_ransac:
+ * @self: the this ptr
+ * @threshold: the maximum angle between UB.hkl and the measured q of an inlier (radian)
+ * @n_iterations: the number of random pairs of reflections to try
+ * @n_outliers: (out) (nullable): return location for the number of outliers
+ * @error: return location for a GError, or NULL
+ *
+ * affine the sample ignoring the mis-indexed reflections. Each
+ * hypothesis is the UB computed with hkl_sample_compute_UB_busing_levy
+ * from two flagged reflections. All the pairs are tried when there
+ * are less than @n_iterations of them. The U of the hypothesis with
+ * the most inliers is kept, the outliers are unflagged, and the
+ * sample is refined on the inliers with
+ * hkl_sample_affine_levenberg_marquardt.
+ *
+ * The unflagged reflections are the reported outliers; they can be
+ * flagged back once re-indexed.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_sample_affine_ransac(HklSample *self,
+			     double threshold, size_t n_iterations,
+			     size_t *n_outliers, GError **error)
+{
+	HklSampleReflection *reflection;
+	HklSampleReflection **reflections;
+	HklMatrix U = self->U;
+	size_t i, j, k, n = 0, n_pairs, best = 0;
+	int res = TRUE;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if (NULL != n_outliers)
+		*n_outliers = 0;
+
+	list_for_each(&self->reflections, reflection, list)
+		if(reflection->flag)
+			n++;
+	if (n < 2){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "not enough reflections (%zd) to compute an UB hypothesis",
+			    n);
+		return FALSE;
+	}
+
+	reflections = g_new(HklSampleReflection *, n);
+	i = 0;
+	list_for_each(&self->reflections, reflection, list)
+		if(reflection->flag)
+			reflections[i++] = reflection;
+
+	n_pairs = n * (n - 1) / 2;
+	for(k=0; k<MIN(n_pairs, n_iterations); ++k){
+		size_t n_inliers;
+
+		if (n_pairs <= n_iterations){
+			/* the k-th pair of the upper triangle */
+			for(i=0, j=k; j >= n - 1 - i; ++i)
+				j -= n - 1 - i;
+			j += i + 1;
+		}else{
+			i = g_random_int_range(0, n);
+			j = g_random_int_range(0, n - 1);
+			if (j >= i)
+				j++;
+		}
+
+		/* colinear pairs do not give an hypothesis */
+		if (!hkl_sample_compute_UB_busing_levy(self, reflections[i], reflections[j], NULL))
+			continue;
+
+		n_inliers = hkl_sample_ransac_inliers(self, reflections, n, threshold, FALSE);
+		if (n_inliers > best){
+			best = n_inliers;
+			U = self->U;
+		}
+	}
+
+	hkl_sample_U_set(self, &U, NULL);
+	if (0 == best){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "no UB hypothesis, all the reflections are colinear");
+		res = FALSE;
+	}else{
+		IGNORE(hkl_sample_ransac_inliers(self, reflections, n, threshold, TRUE));
+		if (NULL != n_outliers)
+			*n_outliers = n - best;
+
+		res = hkl_sample_affine_levenberg_marquardt(self, NULL, 0, error);
+	}
+
+	g_free(reflections);
+
+	return res;
+}
+
+/* a contiguous block of the datasets of hkl_sample_affine_series */
+struct hkl_sample_series_t
+{
+	HklSample **samples;
+	double *table;
+	int *valid;
+	size_t from;
+	size_t to;
+	GThread *thread;
+};
+
+/* the root mean square of the components of UB.hkl - _hkl */
+static double hkl_sample_fit_rms(HklSample *self)
+{
+	struct hkl_sample_fit_t fit;
+	double *r;
+	double res = 0.;
+	size_t i;
+
+	hkl_sample_fit_init(&fit, self);
+	r = g_new(double, 3 * fit.n);
+	hkl_sample_fit_residuals(&fit, &self->UB, fit.q, r, 1);
+	for(i=0; i<3 * fit.n; ++i)
+		res += r[i] * r[i];
+	if (fit.n > 0)
+		res = sqrt(res / (3 * fit.n));
+	g_free(r);
+	hkl_sample_fit_release(&fit);
+
+	return res;
+}
+
+/* start from the previous dataset values of the fitted parameters */
+static void hkl_sample_series_warm_start(HklSample *self, const double previous[])
+{
+	const HklParameter *parameters[] = {
+		self->ux, self->uy, self->uz,
+		self->lattice->a, self->lattice->b, self->lattice->c,
+		self->lattice->alpha, self->lattice->beta, self->lattice->gamma,
+	};
+	double x[9];
+	gsl_vector_view x_v = gsl_vector_view_array(x, 9);
+	size_t i;
+
+	hkl_sample_to_gsl_vector(self, &x_v.vector);
+	for(i=0; i<ARRAY_SIZE(parameters); ++i)
+		if(parameters[i]->fit)
+			x[i] = previous[i];
+	IGNORE(hkl_sample_init_from_gsl_vector(self, &x_v.vector));
+}
+
+static gpointer hkl_sample_series_run(gpointer data)
+{
+	struct hkl_sample_series_t *self = data;
+	double previous[9];
+	gsl_vector_view previous_v = gsl_vector_view_array(previous, 9);
+	int warm = FALSE;
+	size_t i, j, k;
+
+	for(i=self->from; i<self->to; ++i){
+		HklSample *sample = self->samples[i];
+		double *row = &self->table[i * HKL_SAMPLE_AFFINE_SERIES_COLUMNS];
+		double x[9];
+		gsl_vector_view x_v = gsl_vector_view_array(x, 9);
+		int res;
+
+		hkl_sample_to_gsl_vector(sample, &x_v.vector);
+		if (warm)
+			hkl_sample_series_warm_start(sample, previous);
+		res = hkl_sample_affine_lm(sample, NULL, 0, NULL);
+		if (!res && warm){
+			/* try again from its own values */
+			IGNORE(hkl_sample_init_from_gsl_vector(sample, &x_v.vector));
+			res = hkl_sample_affine_lm(sample, NULL, 0, NULL);
+		}
+
+		self->valid[i] = res;
+		warm = res;
+		if (res){
+			hkl_sample_to_gsl_vector(sample, &previous_v.vector);
+			hkl_lattice_get(sample->lattice,
+					&row[0], &row[1], &row[2],
+					&row[3], &row[4], &row[5],
+					HKL_UNIT_DEFAULT);
+			for(j=0; j<3; ++j)
+				for(k=0; k<3; ++k)
+					row[6 + 3 * j + k] = sample->U.data[j][k];
+			row[15] = hkl_sample_fit_rms(sample);
+		}else
+			for(j=0; j<HKL_SAMPLE_AFFINE_SERIES_COLUMNS; ++j)
+				row[j] = GSL_NAN;
+	}
+
+	return NULL;
+}
+
+/**
+ * hkl_sample_affine_series: (skip)
+ * @samples: (array length=n_samples): the samples of the datasets
+ * @n_samples: the number of datasets
+ * @table: the n_samples x HKL_SAMPLE_AFFINE_SERIES_COLUMNS results
+ * @n_table: the size of @table
+ * @valid: the n_samples flags, TRUE if the dataset was refined
+ * @n_threads: the number of threads used to refine the datasets
+ * @error: return location for a GError, or NULL
+ *
+ * affine each sample with its own reflections, like
+ * hkl_sample_affine_levenberg_marquardt, for a series of datasets
+ * (temperature, pressure...). A row of @table contains a, b, c,
+ * alpha, beta, gamma in default units, the U matrix row by row and
+ * the root mean square of the residuals. The rows of the datasets
+ * which can not be refined are NaN.
+ *
+ * The datasets are split in contiguous blocks refined in their own
+ * thread, and each dataset starts from the fitted parameters of the
+ * previous one in its block. When this starting point fails, it is
+ * refined again from its own values.
+ *
+ * Returns: FALSE if the size of @table does not match @n_samples.
+ **/
+int hkl_sample_affine_series(HklSample *samples[], size_t n_samples,
+			     double table[], size_t n_table,
+			     int valid[],
+			     unsigned int n_threads,
+			     GError **error)
+{
+	size_t i;
+
+	hkl_error (error == NULL || *error == NULL);
+
+	if (n_table != n_samples * HKL_SAMPLE_AFFINE_SERIES_COLUMNS){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "wrong size of the table (%zd) given, (%zd) expected",
+			    n_table, n_samples * HKL_SAMPLE_AFFINE_SERIES_COLUMNS);
+		return FALSE;
+	}
+
+	if (n_threads > n_samples)
+		n_threads = n_samples;
+	if (n_threads < 1)
+		n_threads = 1;
+
+	gsl_set_error_handler_off();
+	{
+		struct hkl_sample_series_t blocks[n_threads];
+		size_t chunk = n_samples / n_threads;
+
+		for(i=0; i<n_threads; ++i){
+			blocks[i].samples = samples;
+			blocks[i].table = table;
+			blocks[i].valid = valid;
+			blocks[i].from = i * chunk;
+			blocks[i].to = i == n_threads - 1 ? n_samples : (i + 1) * chunk;
+		}
+
+		/* the calling thread runs the first block */
+		for(i=1; i<n_threads; ++i)
+			blocks[i].thread = g_thread_new("hkl-affine",
+							hkl_sample_series_run,
+							&blocks[i]);
+		hkl_sample_series_run(&blocks[0]);
+		for(i=1; i<n_threads; ++i)
+			g_thread_join(blocks[i].thread);
+	}
+	gsl_set_error_handler (NULL);
+
+	return TRUE;
+}
+
+/* a node of the reciprocal lattice, the table is sorted by norm */
+struct hkl_sample_index_node_t
+{
+	HklVector hkl;
+	HklVector Bh;
+	double norm;
+};
+
+static int hkl_sample_index_node_cmp(const void *a, const void *b)
+{
+	const struct hkl_sample_index_node_t *n1 = a;
+	const struct hkl_sample_index_node_t *n2 = b;
+
+	return (n1->norm > n2->norm) - (n1->norm < n2->norm);
+}
+
+/* the first node of the table whose norm is not less than norm */
+static size_t hkl_sample_index_lower_bound(const struct hkl_sample_index_node_t *nodes,
+					   size_t n, double norm)
+{
+	size_t lo = 0, hi = n;
+
+	while(lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (nodes[mid].norm < norm)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* the candidates of a peak are the nodes [first, last) with the same
+ * norm, within the relative tolerance */
+struct hkl_sample_index_peak_t
+{
+	HklSampleReflection *reflection;
+	size_t first;
+	size_t last;
+};
+
+/* the node indexing the peak with the hypothesis U, or n_nodes */
+static size_t hkl_sample_index_peak_match(const struct hkl_sample_index_peak_t *peak,
+					  const struct hkl_sample_index_node_t *nodes,
+					  size_t n_nodes,
+					  const HklMatrix *U, double tolerance)
+{
+	size_t c, res = n_nodes;
+	HklVector q = peak->reflection->_hkl;
+	HklMatrix Ut = *U;
+
+	/* compare in the reciprocal frame, B.h is already computed */
+	hkl_matrix_transpose(&Ut);
+	hkl_matrix_times_vector(&Ut, &q);
+	for(c=peak->first; c<peak->last; ++c){
+		double angle = hkl_vector_angle(&nodes[c].Bh, &q);
+
+		if (angle <= tolerance){
+			tolerance = angle;
+			res = c;
+		}
+	}
+
+	return res;
+}
+
+/**
+ * hkl_sample_index:
+ * @self: the this ptr
+ * @hkl_max: the maximum absolute value of the h, k and l searched
+ * @tolerance: the angular (radian) and relative norm tolerance
+ * @n_indexed: (out) (nullable): return location for the number of indexed reflections
+ * @error: return location for a GError, or NULL
+ *
+ * compute U and the hkl of the flagged reflections from their
+ * measured geometries only, their current hkl are ignored.
+ *
+ * The reciprocal lattice nodes up to @hkl_max are tabulated once,
+ * sorted by the norm of B.hkl, so the candidates of a peak are the
+ * nodes with the norm of its q. For each pair of the first peaks,
+ * each pair of candidates with the measured angle between the two q
+ * gives an U hypothesis, and the one indexing the most peaks is kept.
+ *
+ * The peaks which were not indexed are unflagged.
+ *
+ * Returns: TRUE on success, FALSE if an error occurred
+ **/
+int hkl_sample_index(HklSample *self, unsigned int hkl_max, double tolerance,
+		     size_t *n_indexed, GError **error)
+{
+	HklSampleReflection *reflection;
+	struct hkl_sample_index_node_t *nodes;
+	struct hkl_sample_index_peak_t *peaks;
+	HklMatrix B, U;
+	int h, k, l, m = hkl_max;
+	size_t i, j, c1, c2, n = 0, n_nodes = 0, best = 0;
+
+	hkl_error (error == NULL || *error == NULL);
+	g_return_val_if_fail(hkl_max > 0, FALSE);
+
+	if (NULL != n_indexed)
+		*n_indexed = 0;
+
+	list_for_each(&self->reflections, reflection, list)
+		if(reflection->flag)
+			n++;
+	if (n < 2){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "not enough reflections (%zd) to index the sample",
+			    n);
+		return FALSE;
+	}
+
+	/* the reciprocal lattice table */
+	hkl_lattice_get_B(self->lattice, &B);
+	nodes = g_new(struct hkl_sample_index_node_t, (2 * m + 1) * (2 * m + 1) * (2 * m + 1) - 1);
+	for(h=-m; h<=m; ++h)
+		for(k=-m; k<=m; ++k)
+			for(l=-m; l<=m; ++l){
+				struct hkl_sample_index_node_t *node = &nodes[n_nodes];
+
+				if (0 == h && 0 == k && 0 == l)
+					continue;
+				node->hkl.data[0] = h;
+				node->hkl.data[1] = k;
+				node->hkl.data[2] = l;
+				node->Bh = node->hkl;
+				hkl_matrix_times_vector(&B, &node->Bh);
+				node->norm = hkl_vector_norm2(&node->Bh);
+				n_nodes++;
+			}
+	qsort(nodes, n_nodes, sizeof(*nodes), hkl_sample_index_node_cmp);
+
+	/* the candidates of each peak */
+	peaks = g_new(struct hkl_sample_index_peak_t, n);
+	i = 0;
+	list_for_each(&self->reflections, reflection, list){
+		if(reflection->flag){
+			double norm = hkl_vector_norm2(&reflection->_hkl);
+
+			peaks[i].reflection = reflection;
+			peaks[i].first = hkl_sample_index_lower_bound(nodes, n_nodes,
+								      norm * (1. - tolerance));
+			peaks[i].last = hkl_sample_index_lower_bound(nodes, n_nodes,
+								     norm * (1. + tolerance));
+			i++;
+		}
+	}
+
+	/* the U hypothesis of the pairs of the first peaks */
+	for(i=0; i<MIN(n, INDEX_PEAKS_MAX) && best < n; ++i)
+		for(j=i+1; j<MIN(n, INDEX_PEAKS_MAX) && best < n; ++j){
+			const HklVector *q1 = &peaks[i].reflection->_hkl;
+			const HklVector *q2 = &peaks[j].reflection->_hkl;
+			double angle;
+
+			if (hkl_vector_is_colinear(q1, q2))
+				continue;
+			angle = hkl_vector_angle(q1, q2);
+
+			for(c1=peaks[i].first; c1<peaks[i].last && best < n; ++c1)
+				for(c2=peaks[j].first; c2<peaks[j].last && best < n; ++c2){
+					const HklVector *Bh1 = &nodes[c1].Bh;
+					const HklVector *Bh2 = &nodes[c2].Bh;
+					HklMatrix Uh;
+					size_t p, score = 0;
+
+					if (fabs(hkl_vector_angle(Bh1, Bh2) - angle) > tolerance
+					    || hkl_vector_is_colinear(Bh1, Bh2))
+						continue;
+
+					hkl_sample_U_from_two_vectors(&Uh, Bh1, Bh2, q1, q2);
+					for(p=0; p<n; ++p)
+						if (n_nodes != hkl_sample_index_peak_match(&peaks[p], nodes, n_nodes,
+											   &Uh, tolerance))
+							score++;
+					if (score > best){
+						best = score;
+						U = Uh;
+					}
+				}
+		}
+
+	if (0 == best){
+		g_set_error(error,
+			    HKL_SAMPLE_ERROR,
+			    HKL_SAMPLE_ERROR_MINIMIZED,
+			    "no reflection of the lattice up to %d matches the measured angles",
+			    m);
+	}else{
+		hkl_sample_U_set(self, &U, NULL);
+		for(i=0; i<n; ++i){
+			size_t c = hkl_sample_index_peak_match(&peaks[i], nodes, n_nodes,
+							       &U, tolerance);
+
+			if (n_nodes != c)
+				peaks[i].reflection->hkl = nodes[c].hkl;
+			else
+				peaks[i].reflection->flag = FALSE;
+		}
+		if (NULL != n_indexed)
+			*n_indexed = best;
+	}
+
+	g_free(peaks);
+	g_free(nodes);
+
+	return 0 != best;
 }
 
 /**
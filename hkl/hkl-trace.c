@@ -0,0 +1,187 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2019, 2022 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <stdio.h>                      // for fprintf, FILE
+#include "hkl-trace-private.h"          // for HklTraceRing
+#include "hkl.h"                        // for HklTraceRecord, etc
+
+/* the ring of a thread, only its owner writes into it */
+typedef struct _HklTraceRing HklTraceRing;
+
+struct _HklTraceRing
+{
+	HklTraceRecord *records;
+	size_t capacity;
+	guint head; /* the number of records ever added, atomic */
+};
+
+/* the capacity of the rings, 0 when the trace is disabled */
+static gint trace_capacity = 0;
+
+/* all the rings, the rings of the finished threads are kept in the
+ * pool to be reused by the next threads, so the records are never
+ * lost and the number of rings is bounded by the number of
+ * concurrent threads. The lock is only taken when a thread gets its
+ * ring and by the readers, never when a record is added. */
+G_LOCK_DEFINE_STATIC(trace);
+static GPtrArray *trace_rings = NULL;
+static GPtrArray *trace_pool = NULL;
+
+static void hkl_trace_ring_release(gpointer data)
+{
+	G_LOCK(trace);
+	g_ptr_array_add(trace_pool, data);
+	G_UNLOCK(trace);
+}
+
+static GPrivate trace_ring = G_PRIVATE_INIT(hkl_trace_ring_release);
+
+static HklTraceRing *hkl_trace_ring_get(size_t capacity)
+{
+	HklTraceRing *ring = g_private_get(&trace_ring);
+
+	if(NULL != ring && ring->capacity == capacity)
+		return ring;
+
+	G_LOCK(trace);
+	if(NULL == trace_rings){
+		trace_rings = g_ptr_array_new();
+		trace_pool = g_ptr_array_new();
+	}
+	if(NULL == ring){
+		if(trace_pool->len > 0)
+			ring = g_ptr_array_remove_index_fast(trace_pool, trace_pool->len - 1);
+		else{
+			ring = g_new0(HklTraceRing, 1);
+			g_ptr_array_add(trace_rings, ring);
+		}
+	}
+	if(ring->capacity != capacity){
+		g_free(ring->records);
+		ring->records = g_new0(HklTraceRecord, capacity);
+		ring->capacity = capacity;
+		g_atomic_int_set(&ring->head, 0);
+	}
+	G_UNLOCK(trace);
+
+	g_private_set(&trace_ring, ring);
+
+	return ring;
+}
+
+/**
+ * hkl_trace_enable:
+ * @n_records: the number of records kept per thread, 0 to disable
+ *
+ * the trace keeps the last @n_records solves of each thread in a
+ * ring of compact records (engine, mode, targets, iterations, number
+ * of solutions and duration). Adding a record takes no lock, so it
+ * can stay enabled in production. Changing @n_records forgets the
+ * previous records. @n_records is clamped to G_MAXINT.
+ **/
+void hkl_trace_enable(size_t n_records)
+{
+	g_atomic_int_set(&trace_capacity, MIN(n_records, (size_t)G_MAXINT));
+}
+
+/**
+ * hkl_trace_records_get:
+ * @records: (array length=n_records) (nullable): the records to fill
+ *           or NULL
+ * @n_records: the size of @records
+ *
+ * copy the recorded solves of all the threads, the oldest first for
+ * each thread. The records added while copying may be partially
+ * written.
+ *
+ * Returns: the number of available records, it may be more than
+ * @n_records.
+ **/
+size_t hkl_trace_records_get(HklTraceRecord records[], size_t n_records)
+{
+	size_t n = 0;
+	guint i;
+
+	G_LOCK(trace);
+	for(i=0; NULL != trace_rings && i<trace_rings->len; ++i){
+		const HklTraceRing *ring = g_ptr_array_index(trace_rings, i);
+		guint head = g_atomic_int_get(&ring->head);
+		size_t len = head < ring->capacity ? head : ring->capacity;
+		size_t j;
+
+		for(j=0; j<len; ++j, ++n)
+			if(NULL != records && n < n_records)
+				records[n] = ring->records[(head - len + j) % ring->capacity];
+	}
+	G_UNLOCK(trace);
+
+	return n;
+}
+
+/**
+ * hkl_trace_fprintf:
+ * @f: the #FILE
+ *
+ * dump the recorded solves of all the threads, one per line.
+ **/
+void hkl_trace_fprintf(FILE *f)
+{
+	size_t n = hkl_trace_records_get(NULL, 0);
+	HklTraceRecord *records = g_new(HklTraceRecord, n);
+	size_t i, j;
+
+	/* the other threads may have traced meanwhile */
+	n = MIN(n, hkl_trace_records_get(records, n));
+	for(i=0; i<n; ++i){
+		const HklTraceRecord *record = &records[i];
+
+		fprintf(f, "%" G_GINT64_FORMAT " %s %s [",
+			record->start, record->engine, record->mode);
+		for(j=0; j<record->n_targets; ++j)
+			fprintf(f, " %f", record->targets[j]);
+		fprintf(f, " ] iterations: %u solutions: %u %s %" G_GINT64_FORMAT "µs\n",
+			record->iterations, record->n_solutions,
+			record->status ? "ok" : "failed", record->duration);
+	}
+	g_free(records);
+}
+
+/**
+ * hkl_trace_add: (skip)
+ * @record: the record to add
+ *
+ * add a record to the ring of the current thread if the trace is
+ * enabled.
+ **/
+void hkl_trace_add(const HklTraceRecord *record)
+{
+	size_t capacity = g_atomic_int_get(&trace_capacity);
+	HklTraceRing *ring;
+	guint head;
+
+	if(0 == capacity)
+		return;
+
+	ring = hkl_trace_ring_get(capacity);
+	head = g_atomic_int_get(&ring->head);
+	ring->records[head % ring->capacity] = *record;
+	g_atomic_int_set(&ring->head, head + 1);
+}
@@ -59,3 +59,8 @@ extern void hkl_trajectory_stats_free(HklTrajectoryStats *self);
 extern void hkl_trajectory_stats_add(HklTrajectoryStats *self, const HklGeometryList *geometries);
 
 extern void hkl_trajectory_stats_fprintf(FILE *f, const HklTrajectoryStats *self);
+
+/* branch selection */
+
+extern int hkl_trajectory_branch_select(const darray_double solutions[], size_t n_points,
+					size_t n_axes, double axes[]);
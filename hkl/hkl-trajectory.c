@@ -20,6 +20,8 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
 
+#include <math.h>                       // for fabs, INFINITY
+#include <string.h>                     // for memcpy
 #include "hkl-macros-private.h"
 #include "hkl-geometry-private.h"
 #include "hkl-trajectory-private.h"
@@ -137,3 +139,94 @@ void hkl_trajectory_stats_fprintf(FILE *f, const HklTrajectoryStats *self)
 	}
 	fprintf(f, "\n");
 }
+
+/* branch selection */
+
+static double hkl_trajectory_motion(const double *p1, const double *p2, size_t n_axes)
+{
+	size_t i;
+	double res = 0.;
+
+	for(i=0; i<n_axes; ++i)
+		res += fabs(p2[i] - p1[i]);
+
+	return res;
+}
+
+/**
+ * hkl_trajectory_branch_select: (skip)
+ * @solutions: the solutions of the n_points points, each one a table
+ *             of n_solutions x n_axes axes values
+ * @n_points: the number of points of the trajectory
+ * @n_axes: the number of axes of the geometry
+ * @axes: (out): the n_points x n_axes axes values of the selected branch
+ *
+ * select one solution per point, minimising the sum over the whole
+ * trajectory of the axes motions between consecutive points. This is
+ * a dynamic programming over the points, the cost of a solution is
+ * the one of the cheapest branch ending with it.
+ *
+ * Returns: FALSE if a point has no solution
+ **/
+int hkl_trajectory_branch_select(const darray_double solutions[], size_t n_points,
+				 size_t n_axes, double axes[])
+{
+	size_t i, s, p, n_total = 0, offset, best;
+	size_t offsets[n_points + 1];
+	double *cost;
+	size_t *parent;
+
+	for(i=0; i<n_points; ++i){
+		offsets[i] = n_total;
+		n_total += darray_size(solutions[i]) / n_axes;
+		if (offsets[i] == n_total)
+			return FALSE;
+	}
+	offsets[n_points] = n_total;
+	if (0 == n_points)
+		return TRUE;
+
+	cost = g_new(double, n_total);
+	parent = g_new(size_t, n_total);
+
+	for(s=0; s<offsets[1]; ++s)
+		cost[s] = 0.;
+	for(i=1; i<n_points; ++i){
+		const double *prev = &darray_item(solutions[i - 1], 0);
+		const double *curr = &darray_item(solutions[i], 0);
+
+		for(s=0; s<offsets[i + 1] - offsets[i]; ++s){
+			double *c = &cost[offsets[i] + s];
+
+			*c = INFINITY;
+			for(p=0; p<offsets[i] - offsets[i - 1]; ++p){
+				double tmp = cost[offsets[i - 1] + p]
+					+ hkl_trajectory_motion(&prev[p * n_axes], &curr[s * n_axes], n_axes);
+
+				if (tmp < *c){
+					*c = tmp;
+					parent[offsets[i] + s] = p;
+				}
+			}
+		}
+	}
+
+	/* backtrack from the cheapest last solution */
+	offset = offsets[n_points - 1];
+	best = 0;
+	for(s=1; s<n_total - offset; ++s)
+		if (cost[offset + s] < cost[offset + best])
+			best = s;
+	for(i=n_points; i-- > 0;){
+		memcpy(&axes[i * n_axes],
+		       &darray_item(solutions[i], best * n_axes),
+		       n_axes * sizeof(double));
+		if (i > 0)
+			best = parent[offsets[i] + best];
+	}
+
+	g_free(parent);
+	g_free(cost);
+
+	return TRUE;
+}
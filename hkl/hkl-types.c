@@ -23,6 +23,7 @@
 #include "hkl-types.h"
 #include "glib/gthread.h"               // for g_once_init_enter, etc
 #include "glibconfig.h"                 // for gsize
+#include "hkl-context-private.h"        // for hkl_context_new_copy
 #include "hkl-detector-private.h"       // for hkl_detector_new_copy
 #include "hkl-geometry-private.h"       // for hkl_geometry_list_free, etc
 #include "hkl-matrix-private.h"         // for hkl_matrix_dup
@@ -34,9 +35,11 @@
 static void *hkl_fake_ref(void *src) { return src; }
 static void hkl_fake_unref(void *src) { return; }
 
+G_DEFINE_BOXED_TYPE (HklContext, hkl_context, hkl_context_new_copy, hkl_context_free);
 G_DEFINE_BOXED_TYPE (HklDetector, hkl_detector, hkl_detector_new_copy, hkl_detector_free);
 G_DEFINE_BOXED_TYPE (HklEngine, hkl_engine, hkl_fake_ref, hkl_fake_unref);
 G_DEFINE_BOXED_TYPE (HklEngineList, hkl_engine_list, hkl_engine_list_new_copy, hkl_engine_list_free);
+G_DEFINE_BOXED_TYPE (HklEngineStats, hkl_engine_stats, hkl_engine_stats_dup, hkl_engine_stats_free);
 G_DEFINE_BOXED_TYPE (HklFactory, hkl_factory, hkl_fake_ref, hkl_fake_unref);
 G_DEFINE_BOXED_TYPE (HklGeometry, hkl_geometry, hkl_geometry_new_copy, hkl_geometry_free);
 G_DEFINE_BOXED_TYPE (HklGeometryList, hkl_geometry_list, hkl_geometry_list_new_copy, hkl_geometry_list_free);
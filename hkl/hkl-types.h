@@ -27,6 +27,9 @@
 
 G_BEGIN_DECLS
 
+#define TYPE_HKL_CONTEXT (hkl_context_get_type ())
+HKLAPI GType hkl_context_get_type (void) G_GNUC_CONST;
+
 #define TYPE_HKL_DETECTOR (hkl_detector_get_type ())
 HKLAPI GType hkl_detector_get_type (void) G_GNUC_CONST;
 
@@ -36,6 +39,9 @@ HKLAPI GType hkl_engine_get_type (void) G_GNUC_CONST;
 #define TYPE_HKL_ENGINE_LIST (hkl_engine_list_get_type ())
 HKLAPI GType hkl_engine_list_get_type (void) G_GNUC_CONST;
 
+#define TYPE_HKL_ENGINE_STATS (hkl_engine_stats_get_type ())
+HKLAPI GType hkl_engine_stats_get_type (void) G_GNUC_CONST;
+
 #define TYPE_HKL_FACTORY (hkl_factory_get_type ())
 HKLAPI GType hkl_factory_get_type (void) G_GNUC_CONST;
 
@@ -22,8 +22,10 @@
 #ifndef __HKL_VECTOR_PRIVATE_H__
 #define __HKL_VECTOR_PRIVATE_H__
 
+#include <math.h>                       // for signbit, sqrt
 #include <stdio.h>                      // for FILE
 #include "hkl.h"                        // for G_BEGIN_DECLS, etc
+#include "hkl-matrix-private.h"         // for _HklMatrix
 
 G_BEGIN_DECLS
 
@@ -38,25 +40,143 @@ extern int hkl_vector_cmp(const HklVector *self, const HklVector *vector);
 extern int hkl_vector_is_opposite(const HklVector *self,
 				  const HklVector *vector);
 
-extern void hkl_vector_add_vector(HklVector *self, const HklVector *vector);
-
-extern void hkl_vector_minus_vector(HklVector *self, const HklVector *vector);
-
-extern void hkl_vector_div_double(HklVector *self, const double d);
-
-extern void hkl_vector_times_double(HklVector *self, const double d);
-
-extern void hkl_vector_times_vector(HklVector *self, const HklVector *vector);
-
-extern void hkl_vector_times_matrix(HklVector *self, const HklMatrix *m);
-
-extern double hkl_vector_sum(const HklVector *self);
-
-extern double hkl_vector_scalar_product(const HklVector *self,
-					const HklVector *vector);
-
-extern void hkl_vector_vectorial_product(HklVector *self,
-					 const HklVector *vector);
+/**
+ * hkl_vector_add_vector: (skip)
+ * @self: the modified #HklVector
+ * @vector: the #hklvector to add
+ *
+ * add an #HklVector to another one.
+ **/
+static inline void hkl_vector_add_vector(HklVector *self, const HklVector *vector)
+{
+	unsigned int i;
+	for (i=0;i<3;i++)
+		self->data[i] += vector->data[i];
+}
+
+/**
+ * hkl_vector_minus_vector: (skip)
+ * @self: the modified #HklVector
+ * @vector: the #hklvector to substract
+ *
+ * substract an #HklVector to another one.
+ **/
+static inline void hkl_vector_minus_vector(HklVector *self, const HklVector *vector)
+{
+	unsigned int i;
+	for (i=0;i<3;i++)
+		self->data[i] -= vector->data[i];
+}
+
+/**
+ * hkl_vector_div_double: (skip)
+ * @self: the #HklVector to divide.
+ * @d: constant use to divide the #HklVector
+ *
+ * divide an #HklVector by constant.
+ **/
+static inline void hkl_vector_div_double(HklVector *self, const double d)
+{
+	unsigned int i;
+	for (i=0;i<3;i++)
+		self->data[i] /= d;
+}
+
+/**
+ * hkl_vector_times_double: (skip)
+ * @self: the #HklVector to modify
+ * @d: the multiply factor
+ *
+ * multiply an #HklVector by a constant value.
+ **/
+static inline void hkl_vector_times_double(HklVector *self, const double d)
+{
+	unsigned int i;
+	for (i=0;i<3;i++)
+		self->data[i] *= d;
+}
+
+/**
+ * hkl_vector_times_vector: (skip)
+ * @self: the #HklVector to modify
+ * @vector: the #HklVector use to modify the first one
+ *
+ * multiply an #HklVector by another one. This method multiply
+ * coordinate by coordinate.
+ **/
+static inline void hkl_vector_times_vector(HklVector *self, const HklVector *vector)
+{
+	unsigned int i;
+	for (i=0;i<3;i++)
+		self->data[i] *= vector->data[i];
+}
+
+/**
+ * hkl_vector_times_matrix: (skip)
+ * @self: the #HklVector to multiply
+ * @m: the #HklMatrix use to multiply the #HklVector
+ *
+ * multiply an #HklVector by an #HklMatrix.
+ * compute v'= M . v
+ **/
+static inline void hkl_vector_times_matrix(HklVector *self, const HklMatrix *m)
+{
+	HklVector tmp;
+	tmp = *self;
+
+	self->data[0] = tmp.data[0] *m->data[0][0] + tmp.data[1] *m->data[1][0] + tmp.data[2] *m->data[2][0];
+	self->data[1] = tmp.data[0] *m->data[0][1] + tmp.data[1] *m->data[1][1] + tmp.data[2] *m->data[2][1];
+	self->data[2] = tmp.data[0] *m->data[0][2] + tmp.data[1] *m->data[1][2] + tmp.data[2] *m->data[2][2];
+}
+
+/**
+ * hkl_vector_sum: (skip)
+ * @self: the #HklVector to sum.
+ *
+ * compute the #HklVector sum of all its elements.
+ *
+ * Returns: the sum of all elements.
+ **/
+static inline double hkl_vector_sum(const HklVector *self)
+{
+	return self->data[0] + self->data[1] + self->data[2];
+}
+
+/**
+ * hkl_vector_scalar_product: (skip)
+ * @self: the first #HklVector
+ * @vector: the second #HklVector
+ *
+ * compute the scalar product of two #HklVector
+ *
+ * Returns: the scalar product.
+ **/
+static inline double hkl_vector_scalar_product(const HklVector *self, const HklVector *vector)
+{
+	unsigned int i;
+	double scalar = 0;
+
+	for (i=0;i<3;i++)
+		scalar += self->data[i] *vector->data[i];
+	return scalar;
+}
+
+/**
+ * hkl_vector_vectorial_product: (skip)
+ * @self: the first #HklVector (modify)
+ * @vector: the second #HklVector
+ *
+ * compute the vectorial product of two vectors
+ **/
+static inline void hkl_vector_vectorial_product(HklVector *self, const HklVector *vector)
+{
+	HklVector tmp;
+
+	tmp = *self;
+	self->data[0] = tmp.data[1] * vector->data[2] - tmp.data[2] * vector->data[1];
+	self->data[1] = tmp.data[2] * vector->data[0] - tmp.data[0] * vector->data[2];
+	self->data[2] = tmp.data[0] * vector->data[1] - tmp.data[1] * vector->data[0];
+}
 
 extern double hkl_vector_angle(const HklVector *self,
 			       const HklVector *vector);
@@ -70,7 +190,20 @@ extern double hkl_vector_oriented_angle_points(const HklVector *self,
 					       const HklVector *p3,
 					       const HklVector *ref);
 
-extern double hkl_vector_norm2(const HklVector *self);
+/**
+ * hkl_vector_norm2: (skip)
+ * @self: the #hklvector use to compute the norm2
+ *
+ * compute the norm2 of an #HklVector
+ *
+ * Returns: the sqrt(|v|)
+ **/
+static inline double hkl_vector_norm2(const HklVector *self)
+{
+	return sqrt(self->data[0] * self->data[0]
+		    + self->data[1] * self->data[1]
+		    + self->data[2] * self->data[2]);
+}
 
 extern int hkl_vector_normalize(HklVector *self);
 
@@ -90,8 +223,40 @@ extern void hkl_vector_rotated_around_vector(HklVector *self,
 					     const HklVector *axe,
 					     double angle);
 
-extern void hkl_vector_rotated_quaternion(HklVector *self,
-					  const HklQuaternion *qr);
+/**
+ * hkl_vector_rotated_quaternion: (skip)
+ * @self: the #HklVector to rotate
+ * @qr: the #HklQuaternion use to rotate the vector
+ *
+ * rotate an #HklVector using an #HklQuaternion.
+ **/
+static inline void hkl_vector_rotated_quaternion(HklVector *self, const HklQuaternion *qr)
+{
+	double v1 = self->data[0];
+	double v2 = self->data[1];
+	double v3 = self->data[2];
+	double a = qr->data[0];
+	double b = qr->data[1];
+	double c = qr->data[2];
+	double d = qr->data[3];
+
+	double t2 =   a*b;
+	double t3 =   a*c;
+	double t4 =   a*d;
+	double t5 =  -b*b;
+	double t6 =   b*c;
+	double t7 =   b*d;
+	double t8 =  -c*c;
+	double t9 =   c*d;
+	double t10 = -d*d;
+
+	self->data[0] = 2*( (t8 + t10)*v1 + (t6 -  t4)*v2 + (t3 + t7)*v3 ) + v1;
+	self->data[1] = 2*( (t4 +  t6)*v1 + (t5 + t10)*v2 + (t9 - t2)*v3 ) + v2;
+	self->data[2] = 2*( (t7 -  t3)*v1 + (t2 +  t9)*v2 + (t5 + t8)*v3 ) + v3;
+}
+
+extern void hkl_vector_array_rotated_quaternion(double v[], size_t n,
+						const HklQuaternion *qr);
 
 extern void hkl_vector_rotated_around_line(HklVector *self, double angle,
 					   const HklVector *c1, const HklVector *c2);
@@ -105,6 +270,27 @@ extern void hkl_vector_project_on_plan_with_point(HklVector *self,
 						  const HklVector *normal,
 						  const HklVector *point);
 
+/*
+ * the components of q perpendicular and parallel to a surface of
+ * normalized normal n, the sign of qpar is the one of q.npar.
+ */
+static inline void hkl_vector_qper_qpar(const HklVector *q,
+					const HklVector *n,
+					const HklVector *npar,
+					double *qper, double *qpar)
+{
+	double per = q->data[0] * n->data[0] + q->data[1] * n->data[1] + q->data[2] * n->data[2];
+	double x = q->data[0] - per * n->data[0];
+	double y = q->data[1] - per * n->data[1];
+	double z = q->data[2] - per * n->data[2];
+	double sign = q->data[0] * npar->data[0] + q->data[1] * npar->data[1] + q->data[2] * npar->data[2];
+
+	*qper = per;
+	*qpar = sqrt(x * x + y * y + z * z);
+	if (signbit(sign))
+		*qpar *= -1;
+}
+
 G_END_DECLS
 
 #endif
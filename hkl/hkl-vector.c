@@ -122,144 +122,6 @@ int hkl_vector_is_opposite(const HklVector *self, const HklVector *vector)
 	return TRUE;
 }
 
-/**
- * hkl_vector_add_vector: (skip)
- * @self: the modified #HklVector
- * @vector: the #hklvector to add
- *
- * add an #HklVector to another one.
- **/
-void hkl_vector_add_vector(HklVector *self, const HklVector *vector)
-{
-	unsigned int i;
-	for (i=0;i<3;i++)
-		self->data[i] += vector->data[i];
-}
-
-/**
- * hkl_vector_minus_vector: (skip)
- * @self: the modified #HklVector
- * @vector: the #hklvector to substract
- *
- * substract an #HklVector to another one.
- **/
-void hkl_vector_minus_vector(HklVector *self, const HklVector *vector)
-{
-	unsigned int i;
-	for (i=0;i<3;i++)
-		self->data[i] -= vector->data[i];
-}
-
-/**
- * hkl_vector_div_double: (skip)
- * @self: the #HklVector to divide.
- * @d: constant use to divide the #HklVector
- *
- * divide an #HklVector by constant.
- **/
-void hkl_vector_div_double(HklVector *self, const double d)
-{
-	unsigned int i;
-	for (i=0;i<3;i++)
-		self->data[i] /= d;
-}
-
-/**
- * hkl_vector_times_double: (skip)
- * @self: the #HklVector to modify
- * @d: the multiply factor
- *
- * multiply an #HklVector by a constant value.
- **/
-void hkl_vector_times_double(HklVector *self, const double d)
-{
-	unsigned int i;
-	for (i=0;i<3;i++)
-		self->data[i] *= d;
-}
-
-/**
- * hkl_vector_times_vector: (skip)
- * @self: the #HklVector to modify
- * @vector: the #HklVector use to modify the first one
- *
- * multiply an #HklVector by another one. This method multiply
- * coordinate by coordinate.
- **/
-void hkl_vector_times_vector(HklVector *self, const HklVector *vector)
-{
-	unsigned int i;
-	for (i=0;i<3;i++)
-		self->data[i] *= vector->data[i];
-}
-
-/**
- * hkl_vector_times_matrix: (skip)
- * @self: the #HklVector to multiply
- * @m: the #HklMatrix use to multiply the #HklVector
- *
- * multiply an #HklVector by an #HklMatrix.
- * compute v'= M . v
- **/
-void hkl_vector_times_matrix(HklVector *self, const HklMatrix *m)
-{
-	HklVector tmp;
-	tmp = *self;
-
-	self->data[0] = tmp.data[0] *m->data[0][0] + tmp.data[1] *m->data[1][0] + tmp.data[2] *m->data[2][0];
-	self->data[1] = tmp.data[0] *m->data[0][1] + tmp.data[1] *m->data[1][1] + tmp.data[2] *m->data[2][1];
-	self->data[2] = tmp.data[0] *m->data[0][2] + tmp.data[1] *m->data[1][2] + tmp.data[2] *m->data[2][2];
-}
-
-/**
- * hkl_vector_sum: (skip)
- * @self: the #HklVector to sum.
- *
- * compute the #HklVector sum of all its elements.
- *
- * Returns: the sum of all elements.
- **/
-double hkl_vector_sum(const HklVector *self)
-{
-	return self->data[0] + self->data[1] + self->data[2];
-}
-
-/**
- * hkl_vector_scalar_product: (skip)
- * @self: the first #HklVector
- * @vector: the second #HklVector
- *
- * compute the scalar product of two #HklVector
- *
- * Returns: the scalar product.
- **/
-double hkl_vector_scalar_product(const HklVector *self, const HklVector *vector)
-{
-	unsigned int i;
-	double scalar = 0;
-
-	for (i=0;i<3;i++)
-		scalar += self->data[i] *vector->data[i];
-	return scalar;
-}
-
-/**
- * hkl_vector_vectorial_product: (skip)
- * @self: the first #HklVector (modify)
- * @vector: the second #HklVector
- *
- * compute the vectorial product of two vectors
- **/
-void hkl_vector_vectorial_product(HklVector *self, const HklVector *vector)
-{
-	HklVector tmp;
-
-	tmp = *self;
-	self->data[0] = tmp.data[1] * vector->data[2] - tmp.data[2] * vector->data[1];
-	self->data[1] = tmp.data[2] * vector->data[0] - tmp.data[0] * vector->data[2];
-	self->data[2] = tmp.data[0] * vector->data[1] - tmp.data[1] * vector->data[0];
-}
-
 
 /**
  * hkl_vector_angle: (skip)
@@ -483,32 +345,22 @@ void hkl_vector_rotated_around_vector(HklVector *self,
 }
 
 /**
- * hkl_vector_norm2: (skip)
- * @self: the #hklvector use to compute the norm2
- *
- * compute the norm2 of an #HklVector
- *
- * Returns: the sqrt(|v|)
- **/
-double hkl_vector_norm2(const HklVector *self)
-{
-	return sqrt(self->data[0] * self->data[0]
-		    + self->data[1] * self->data[1]
-		    + self->data[2] * self->data[2]);
-}
-
-/**
- * hkl_vector_rotated_quaternion: (skip)
- * @self: the #HklVector to rotate
- * @qr: the #HklQuaternion use to rotate the vector
- *
- * rotate an #HklVector using an #HklQuaternion.
+ * hkl_vector_array_rotated_quaternion: (skip)
+ * @v: the vectors to rotate, all the x coordinates first, then all
+ *     the y and all the z
+ * @n: the number of vectors
+ * @qr: the #HklQuaternion use to rotate the vectors
+ *
+ * rotate @n vectors using the same #HklQuaternion. The rotation terms
+ * are computed once and the loop is written without branch so that
+ * the compiler can vectorise it.
  **/
-void hkl_vector_rotated_quaternion(HklVector *self, const HklQuaternion *qr)
+void hkl_vector_array_rotated_quaternion(double v[], size_t n,
+					 const HklQuaternion *qr)
 {
-	double v1 = self->data[0];
-	double v2 = self->data[1];
-	double v3 = self->data[2];
+	double *restrict x = &v[0 * n];
+	double *restrict y = &v[1 * n];
+	double *restrict z = &v[2 * n];
 	double a = qr->data[0];
 	double b = qr->data[1];
 	double c = qr->data[2];
@@ -524,9 +376,20 @@ void hkl_vector_rotated_quaternion(HklVector *self, const HklQuaternion *qr)
 	double t9 =   c*d;
 	double t10 = -d*d;
 
-	self->data[0] = 2*( (t8 + t10)*v1 + (t6 -  t4)*v2 + (t3 + t7)*v3 ) + v1;
-	self->data[1] = 2*( (t4 +  t6)*v1 + (t5 + t10)*v2 + (t9 - t2)*v3 ) + v2;
-	self->data[2] = 2*( (t7 -  t3)*v1 + (t2 +  t9)*v2 + (t5 + t8)*v3 ) + v3;
+	double m00 = t8 + t10, m01 = t6 -  t4, m02 = t3 + t7;
+	double m10 = t4 +  t6, m11 = t5 + t10, m12 = t9 - t2;
+	double m20 = t7 -  t3, m21 = t2 +  t9, m22 = t5 + t8;
+	size_t i;
+
+	for(i=0; i<n; ++i){
+		double v1 = x[i];
+		double v2 = y[i];
+		double v3 = z[i];
+
+		x[i] = 2*( m00*v1 + m01*v2 + m02*v3 ) + v1;
+		y[i] = 2*( m10*v1 + m11*v2 + m12*v3 ) + v2;
+		z[i] = 2*( m20*v1 + m21*v2 + m22*v3 ) + v3;
+	}
 }
 
 /**
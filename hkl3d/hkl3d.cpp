@@ -22,6 +22,7 @@
  */
 
 #include <yaml.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
@@ -30,14 +31,20 @@
 #include <g3d/g3d.h>
 #include <g3d/quat.h>
 #include <g3d/matrix.h>
+#include <g3d/material.h>
+#include <g3d/model.h>
+#include <g3d/object.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "hkl3d.h"
 #include "hkl-geometry-private.h"
 
 #include "btBulletCollisionCommon.h"
+#include "BulletCollision/CollisionShapes/btShapeHull.h"
 #include "BulletCollision/Gimpact/btGImpactCollisionAlgorithm.h"
 #include "BulletCollision/Gimpact/btGImpactShape.h"
 
@@ -56,6 +63,35 @@ static float identity[] = {1, 0, 0, 0,
 	0, 0, 1 ,0,
 	0, 0, 0, 1};
 
+/*
+ * the objects attached to the same Hkl3DAxis are a rigid body, and
+ * the static objects too, so they can never collide together. These
+ * pairs are rejected by the broadphase, before any narrowphase test
+ * of their triangles. The user pointer of the bullet objects is their
+ * Hkl3DObject.
+ */
+struct Hkl3DOverlapFilter : public btOverlapFilterCallback
+{
+	virtual bool needsBroadphaseCollision(btBroadphaseProxy *proxy0,
+					      btBroadphaseProxy *proxy1) const
+	{
+		bool collides = (proxy0->m_collisionFilterGroup & proxy1->m_collisionFilterMask) != 0;
+		collides = collides && (proxy1->m_collisionFilterGroup & proxy0->m_collisionFilterMask);
+
+		if(collides){
+			const Hkl3DObject *object0 = (const Hkl3DObject *)((btCollisionObject *)proxy0->m_clientObject)->getUserPointer();
+			const Hkl3DObject *object1 = (const Hkl3DObject *)((btCollisionObject *)proxy1->m_clientObject)->getUserPointer();
+
+			if(object0 && object1 && object0->axis == object1->axis)
+				collides = false;
+		}
+
+		return collides;
+	}
+};
+
+static Hkl3DOverlapFilter overlap_filter;
+
 static void *_hkl3d_malloc(int size, const char *error)
 {
 	void *tmp;
@@ -132,6 +168,118 @@ static btCollisionShape* shape_from_trimesh(btTriangleMesh *trimesh, int movable
 	return shape;
 }
 
+/*
+ * the convex decomposition of an object. The triangles are grouped by
+ * the cell of a grid of size tolerance containing their center, and
+ * each group is replaced by its simplified convex hull. The hulls
+ * cover all the triangles, so a contact of the meshes is always a
+ * contact of the hulls, the false contacts being within about the
+ * tolerance.
+ */
+struct hkl3d_hulls_t
+{
+	btAlignedObjectArray<int> counts; /* the number of points of each hull */
+	btAlignedObjectArray<btScalar> points; /* x, y, z of all the hulls */
+};
+
+struct hkl3d_hull_face_t
+{
+	int cell[3];
+	int vertices[3];
+};
+
+struct hkl3d_hull_face_less
+{
+	bool operator()(const hkl3d_hull_face_t &a, const hkl3d_hull_face_t &b) const
+	{
+		for(int i=0; i<3; ++i)
+			if(a.cell[i] != b.cell[i])
+				return a.cell[i] < b.cell[i];
+		return false;
+	}
+};
+
+static void hkl3d_hulls_add(struct hkl3d_hulls_t *self,
+			    const btAlignedObjectArray<btVector3> &points)
+{
+	btConvexHullShape hull(&points[0].x(), points.size(), sizeof(btVector3));
+	btShapeHull simplified(&hull);
+
+	simplified.buildHull(btScalar(0));
+	self->counts.push_back(simplified.numVertices());
+	for(int i=0; i<simplified.numVertices(); ++i){
+		const btVector3 &v = simplified.getVertexPointer()[i];
+
+		self->points.push_back(v.x());
+		self->points.push_back(v.y());
+		self->points.push_back(v.z());
+	}
+}
+
+static void hkl3d_hulls_from_g3dobject(struct hkl3d_hulls_t *self,
+				       const G3DObject *object, double tolerance)
+{
+	btAlignedObjectArray<hkl3d_hull_face_t> faces;
+	btAlignedObjectArray<btVector3> points;
+	const float *vertex = object->vertex_data;
+
+	for(GSList *l = object->faces; l; l = g_slist_next(l)){
+		const G3DFace *face = (const G3DFace *)l->data;
+		hkl3d_hull_face_t f;
+
+		for(int i=0; i<3; ++i){
+			double center = 0;
+
+			f.vertices[i] = face->vertex_indices[i];
+			for(int j=0; j<3; ++j)
+				center += vertex[3 * face->vertex_indices[j] + i];
+			f.cell[i] = (int)floor(center / 3 / tolerance);
+		}
+		faces.push_back(f);
+	}
+	faces.quickSort(hkl3d_hull_face_less());
+
+	for(int i=0; i<faces.size(); ++i){
+		for(int j=0; j<3; ++j){
+			const float *v = &vertex[3 * faces[i].vertices[j]];
+
+			points.push_back(btVector3(v[0], v[1], v[2]));
+		}
+		if(i + 1 == faces.size()
+		   || hkl3d_hull_face_less()(faces[i], faces[i + 1])){
+			hkl3d_hulls_add(self, points);
+			points.clear();
+		}
+	}
+}
+
+static btCompoundShape *hkl3d_hulls_shape(const struct hkl3d_hulls_t *self)
+{
+	btCompoundShape *compound = new btCompoundShape();
+	btTransform identity;
+	int offset = 0;
+
+	identity.setIdentity();
+	for(int i=0; i<self->counts.size(); ++i){
+		btConvexHullShape *hull = new btConvexHullShape(&self->points[3 * offset],
+								self->counts[i],
+								3 * sizeof(btScalar));
+
+		hull->setMargin(btScalar(0));
+		compound->addChildShape(identity, hull);
+		offset += self->counts[i];
+	}
+
+	return compound;
+}
+
+static void hkl3d_hulls_shape_free(btCompoundShape *compound)
+{
+	for(int i=0; i<compound->getNumChildShapes(); ++i)
+		delete compound->getChildShape(i);
+	delete compound;
+}
+
 static btCollisionObject * btObject_from_shape(btCollisionShape* shape)
 {
 	btCollisionObject *btObject;
@@ -144,6 +292,17 @@ static btCollisionObject * btObject_from_shape(btCollisionShape* shape)
 	return btObject;
 }
 
+/* the static objects never move, so they sleep: bullet neither
+ * refits their AABB nor tests them against the sleeping movable
+ * ones */
+static void hkl3d_object_set_btobject(Hkl3DObject *self)
+{
+	self->btObject = btObject_from_shape(self->btShape);
+	self->btObject->setUserPointer(self);
+	if(!self->movable)
+		self->btObject->forceActivationState(ISLAND_SLEEPING);
+}
+
 
 static Hkl3DObject *hkl3d_object_new(Hkl3DModel *model, G3DObject *object, int id)
 {
@@ -167,12 +326,13 @@ static Hkl3DObject *hkl3d_object_new(Hkl3DModel *model, G3DObject *object, int i
 	self->g3d = object;
 	self->meshes = trimesh_from_g3dobject(object);
 	self->btShape = shape_from_trimesh(self->meshes, false);
-	self->btObject = btObject_from_shape(self->btShape);
+	self->hulls = NULL;
+	self->movable = false;
+	hkl3d_object_set_btobject(self);
 	self->color = new btVector3(material->r, material->g, material->b);
 	self->hide = object->hide;
 	self->added = false;
 	self->selected = false;
-	self->movable = false;
 
 	/*
 	 * if the object already contain a transformation set the Hkl3DObject
@@ -214,6 +374,11 @@ static void hkl3d_object_free(Hkl3DObject *self)
 		delete self->btObject;
 		self->btObject = NULL;
 	}
+	if(self->hulls){
+		hkl3d_hulls_shape_free(self->hulls);
+		self->hulls = NULL;
+		self->btShape = NULL;
+	}
 	if(self->btShape){
 		delete self->btShape;
 		self->btShape = NULL;
@@ -238,12 +403,25 @@ static void hkl3d_object_set_movable(Hkl3DObject *self, int movable)
 	if(self->movable != movable){
 		self->movable = movable;
 		delete self->btObject;
-		delete self->btShape;
-		self->btShape = shape_from_trimesh(self->meshes, movable);
-		self->btObject = btObject_from_shape(self->btShape);
+		/* the convex decomposition is the same for the two */
+		if(!self->hulls){
+			delete self->btShape;
+			self->btShape = shape_from_trimesh(self->meshes, movable);
+		}
+		hkl3d_object_set_btobject(self);
 	}
 }
 
+/* replace the mesh of the object by its convex decomposition */
+static void hkl3d_object_set_hulls(Hkl3DObject *self, btCompoundShape *hulls)
+{
+	delete self->btObject;
+	delete self->btShape;
+	self->hulls = hulls;
+	self->btShape = hulls;
+	hkl3d_object_set_btobject(self);
+}
+
 static void hkl3d_object_set_axis_name(Hkl3DObject *self, const char *name)
 {
 	if(!self || !name || self->axis_name == name)
@@ -373,50 +551,366 @@ void hkl3d_model_fprintf(FILE *f, const Hkl3DModel *self)
 		hkl3d_object_fprintf(f, self->objects[i]);
 }
 
+/*
+ * the model loaded through g3d and its convex decompositions are
+ * cached next to it in <filename>.hkl3d, so the next loads only read
+ * it back. This native binary file starts with a header which
+ * validates it against the model:
+ *
+ * header: HKL3D_CACHE_MAGIC, the mtime and the size of the model, the
+ *         tolerance of the hulls (0 for none) and the number of objects
+ * object: its id, name, color, hide, transformation (if any), the
+ *         triangles (vertices and indices) and the hulls
+ */
+#define HKL3D_CACHE_MAGIC "hkl3d\0\0\1"
+
+struct hkl3d_cache_header_t
+{
+	char magic[8];
+	int64_t mtime;
+	int64_t size;
+	double tolerance;
+	uint32_t n_objects;
+};
+
+/* read from a mmaped cache, failing at its end */
+struct hkl3d_cache_reader_t
+{
+	const char *p;
+	const char *end;
+};
+
+static int hkl3d_cache_read(struct hkl3d_cache_reader_t *self, void *data, size_t size)
+{
+	if((size_t)(self->end - self->p) < size)
+		return FALSE;
+	memcpy(data, self->p, size);
+	self->p += size;
+	return TRUE;
+}
+
+static void hkl3d_cache_write(FILE *f, const void *data, size_t size, int *res)
+{
+	if(*res)
+		*res = fwrite(data, 1, size, f) == size;
+}
+
+static char *hkl3d_cache_filename(const char *filename)
+{
+	return g_strconcat(filename, ".hkl3d", NULL);
+}
+
+/* an object of the cache, as a G3DObject of one material */
+static G3DObject *hkl3d_cache_read_object(struct hkl3d_cache_reader_t *reader, uint32_t *id)
+{
+	G3DObject *object = g_new0(G3DObject, 1);
+	G3DMaterial *material = g3d_material_new();
+	uint32_t name_len, hide, has_transformation, n_faces;
+	uint32_t *indices = NULL;
+	int res = TRUE;
+
+	object->materials = g_slist_append(object->materials, material);
+
+	res &= hkl3d_cache_read(reader, id, sizeof(*id));
+	res &= hkl3d_cache_read(reader, &name_len, sizeof(name_len));
+	if(res){
+		object->name = g_new0(gchar, name_len + 1);
+		res &= hkl3d_cache_read(reader, object->name, name_len);
+	}
+	res &= hkl3d_cache_read(reader, &material->r, sizeof(material->r));
+	res &= hkl3d_cache_read(reader, &material->g, sizeof(material->g));
+	res &= hkl3d_cache_read(reader, &material->b, sizeof(material->b));
+	res &= hkl3d_cache_read(reader, &material->a, sizeof(material->a));
+	res &= hkl3d_cache_read(reader, &hide, sizeof(hide));
+	object->hide = hide;
+	res &= hkl3d_cache_read(reader, &has_transformation, sizeof(has_transformation));
+	if(res && has_transformation){
+		object->transformation = g_new0(G3DTransformation, 1);
+		res &= hkl3d_cache_read(reader, object->transformation->matrix,
+					sizeof(object->transformation->matrix));
+	}
+	res &= hkl3d_cache_read(reader, &object->vertex_count, sizeof(object->vertex_count));
+	res &= hkl3d_cache_read(reader, &n_faces, sizeof(n_faces));
+	if(res){
+		object->vertex_data = g_new(G3DFloat, 3 * object->vertex_count);
+		res &= hkl3d_cache_read(reader, object->vertex_data,
+					3 * object->vertex_count * sizeof(*object->vertex_data));
+		indices = g_new(uint32_t, 3 * n_faces);
+		res &= hkl3d_cache_read(reader, indices, 3 * n_faces * sizeof(*indices));
+	}
+	for(uint32_t i=0; res && i<n_faces; ++i){
+		G3DFace *face = g_new0(G3DFace, 1);
+
+		face->vertex_count = 3;
+		face->vertex_indices = g_new(guint32, 3);
+		for(int j=0; j<3; ++j){
+			face->vertex_indices[j] = indices[3 * i + j];
+			res &= face->vertex_indices[j] < object->vertex_count;
+		}
+		face->material = material;
+		object->faces = g_slist_prepend(object->faces, face);
+	}
+	object->faces = g_slist_reverse(object->faces);
+	g_free(indices);
+
+	if(!res || !object->faces){
+		g3d_object_free(object);
+		object = NULL;
+	}
+
+	return object;
+}
+
+static int hkl3d_cache_read_hulls(struct hkl3d_cache_reader_t *reader,
+				  struct hkl3d_hulls_t *hulls)
+{
+	uint32_t n_hulls;
+	int n_points = 0;
+	int res = TRUE;
+
+	res &= hkl3d_cache_read(reader, &n_hulls, sizeof(n_hulls));
+	for(uint32_t j=0; res && j<n_hulls; ++j){
+		uint32_t count;
+
+		res &= hkl3d_cache_read(reader, &count, sizeof(count));
+		hulls->counts.push_back(count);
+		n_points += count;
+	}
+	if(res){
+		hulls->points.resize(3 * n_points);
+		if(n_points)
+			res &= hkl3d_cache_read(reader, &hulls->points[0],
+						3 * n_points * sizeof(btScalar));
+	}
+
+	return res;
+}
+
+/*
+ * load the model from its cache if it is valid, and the hulls when
+ * they have the requested tolerance. Returns NULL otherwise.
+ */
+static Hkl3DModel *hkl3d_model_new_from_cache(const char *filename, double tolerance,
+					      struct hkl3d_hulls_t **hulls)
+{
+	struct stat model_stat, cache_stat;
+	struct hkl3d_cache_header_t header;
+	struct hkl3d_cache_reader_t reader;
+	Hkl3DModel *self = NULL;
+	char *cache;
+	void *data = MAP_FAILED;
+	int fd = -1;
+	int res = TRUE;
+
+	*hulls = NULL;
+	cache = hkl3d_cache_filename(filename);
+	if(stat(filename, &model_stat) != 0 || stat(cache, &cache_stat) != 0)
+		goto out;
+	fd = open(cache, O_RDONLY);
+	if(fd < 0)
+		goto out;
+	data = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED)
+		goto out;
+	reader.p = (const char *)data;
+	reader.end = reader.p + cache_stat.st_size;
+
+	if(!hkl3d_cache_read(&reader, &header, sizeof(header))
+	   || memcmp(header.magic, HKL3D_CACHE_MAGIC, sizeof(header.magic))
+	   || header.mtime != (int64_t)model_stat.st_mtime
+	   || header.size != (int64_t)model_stat.st_size)
+		goto out;
+
+	self = hkl3d_model_new();
+	self->filename = strdup(filename);
+	self->g3d = g3d_model_new();
+	for(uint32_t i=0; res && i<header.n_objects; ++i){
+		uint32_t id;
+		G3DObject *object = hkl3d_cache_read_object(&reader, &id);
+
+		res &= object != NULL;
+		if(res){
+			self->g3d->objects = g_slist_append(self->g3d->objects, object);
+			hkl3d_model_add_object(self, hkl3d_object_new(self, object, id));
+		}
+	}
+
+	if(res && header.tolerance > 0 && header.tolerance == tolerance){
+		*hulls = new hkl3d_hulls_t[self->len];
+		for(size_t i=0; res && i<self->len; ++i)
+			res &= hkl3d_cache_read_hulls(&reader, &(*hulls)[i]);
+	}
+
+	if(!res){
+		delete [] *hulls;
+		*hulls = NULL;
+		hkl3d_model_free(self);
+		self = NULL;
+	}
+out:
+	if(data != MAP_FAILED)
+		munmap(data, cache_stat.st_size);
+	if(fd >= 0)
+		close(fd);
+	g_free(cache);
+	return self;
+}
+
+/* failing to write the cache is not an error, the next load is just slower */
+static void hkl3d_model_cache_write(const Hkl3DModel *self, double tolerance,
+				    const struct hkl3d_hulls_t *hulls)
+{
+	struct stat model_stat;
+	struct hkl3d_cache_header_t header;
+	char *cache, *tmp;
+	FILE *f;
+	int res = TRUE;
+
+	if(stat(self->filename, &model_stat) != 0)
+		return;
+
+	cache = hkl3d_cache_filename(self->filename);
+	tmp = g_strconcat(cache, ".tmp", NULL);
+	f = fopen(tmp, "wb");
+	if(!f)
+		goto out;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HKL3D_CACHE_MAGIC, sizeof(header.magic));
+	header.mtime = model_stat.st_mtime;
+	header.size = model_stat.st_size;
+	header.tolerance = hulls ? tolerance : 0;
+	header.n_objects = self->len;
+	hkl3d_cache_write(f, &header, sizeof(header), &res);
+
+	for(size_t i=0; i<self->len; ++i){
+		const Hkl3DObject *object = self->objects[i];
+		const G3DObject *g3d = object->g3d;
+		const G3DMaterial *material = ((G3DFace *)g3d->faces->data)->material;
+		uint32_t id = object->id;
+		uint32_t name_len = g3d->name ? strlen(g3d->name) : 0;
+		uint32_t hide = g3d->hide;
+		uint32_t has_transformation = g3d->transformation != NULL;
+		uint32_t n_faces = g_slist_length(g3d->faces);
+
+		hkl3d_cache_write(f, &id, sizeof(id), &res);
+		hkl3d_cache_write(f, &name_len, sizeof(name_len), &res);
+		hkl3d_cache_write(f, g3d->name, name_len, &res);
+		hkl3d_cache_write(f, &material->r, sizeof(material->r), &res);
+		hkl3d_cache_write(f, &material->g, sizeof(material->g), &res);
+		hkl3d_cache_write(f, &material->b, sizeof(material->b), &res);
+		hkl3d_cache_write(f, &material->a, sizeof(material->a), &res);
+		hkl3d_cache_write(f, &hide, sizeof(hide), &res);
+		/* the transformation of the object before hkl3d_object_new */
+		hkl3d_cache_write(f, &has_transformation, sizeof(has_transformation), &res);
+		if(has_transformation)
+			hkl3d_cache_write(f, object->transformation,
+					  sizeof(object->transformation), &res);
+		hkl3d_cache_write(f, &g3d->vertex_count, sizeof(g3d->vertex_count), &res);
+		hkl3d_cache_write(f, &n_faces, sizeof(n_faces), &res);
+		hkl3d_cache_write(f, g3d->vertex_data,
+				  3 * g3d->vertex_count * sizeof(*g3d->vertex_data), &res);
+		for(GSList *l = g3d->faces; l; l = g_slist_next(l)){
+			const G3DFace *face = (const G3DFace *)l->data;
+			uint32_t indices[] = {face->vertex_indices[0],
+					      face->vertex_indices[1],
+					      face->vertex_indices[2]};
+
+			hkl3d_cache_write(f, indices, sizeof(indices), &res);
+		}
+	}
+
+	for(size_t i=0; hulls && i<self->len; ++i){
+		uint32_t n_hulls = hulls[i].counts.size();
+
+		hkl3d_cache_write(f, &n_hulls, sizeof(n_hulls), &res);
+		for(int j=0; j<hulls[i].counts.size(); ++j){
+			uint32_t count = hulls[i].counts[j];
+
+			hkl3d_cache_write(f, &count, sizeof(count), &res);
+		}
+		if(hulls[i].points.size())
+			hkl3d_cache_write(f, &hulls[i].points[0],
+					  hulls[i].points.size() * sizeof(btScalar), &res);
+	}
+
+	res &= fclose(f) == 0;
+	if(res)
+		res = rename(tmp, cache) == 0;
+	if(!res)
+		unlink(tmp);
+out:
+	g_free(tmp);
+	g_free(cache);
+}
+
 /*
  * Initialize the bullet collision environment.
  * create the Hkl3DObjects
  * create the Hkl3DConfig
+ * replace their meshes by convex decompositions if tolerance > 0
  */
-static Hkl3DModel *hkl3d_model_new_from_file(const char *filename)
+static Hkl3DModel *hkl3d_model_new_from_file(const char *filename, double tolerance)
 {
 	G3DModel *model;
 	Hkl3DModel *self = NULL;
 	GSList *objects; /* lets iterate from the first object. */
 	G3DContext *context;
+	struct hkl3d_hulls_t *hulls;
+	int cached;
 
 	if(!filename)
 		return NULL;
 
-	/* load the model from the file */
-	context = g3d_context_new();
-	model = g3d_model_load_full(context, filename, 0);
-	g3d_context_free(context);
-	if(!model)
-		return NULL;
-	self = hkl3d_model_new();
-
-	self->filename = strdup(filename);
-	self->g3d = model;
-
-	/* create all the attached Hkl3DObjects */
-	objects = model->objects;
-	while(objects){
-		G3DObject *object;
-
-		object = (G3DObject*)objects->data;
-		if(object->vertex_count){
-			int id;
-			Hkl3DObject *hkl3dObject;
+	/* load the model from its cache or from the file */
+	self = hkl3d_model_new_from_cache(filename, tolerance, &hulls);
+	cached = self != NULL;
+	if(!cached){
+		context = g3d_context_new();
+		model = g3d_model_load_full(context, filename, 0);
+		g3d_context_free(context);
+		if(!model)
+			return NULL;
+		self = hkl3d_model_new();
+
+		self->filename = strdup(filename);
+		self->g3d = model;
+
+		/* create all the attached Hkl3DObjects */
+		objects = model->objects;
+		while(objects){
+			G3DObject *object;
+
+			object = (G3DObject*)objects->data;
+			if(object->vertex_count && object->faces){
+				int id;
+				Hkl3DObject *hkl3dObject;
+
+				id = g_slist_index(model->objects, object);
+				hkl3dObject = hkl3d_object_new(self, object, id);
+
+				/* remembers objects to avoid memory leak */
+				hkl3d_model_add_object(self, hkl3dObject);
+			}
+			objects = g_slist_next(objects);
+		}
+	}
 
-			id = g_slist_index(model->objects, object);
-			hkl3dObject = hkl3d_object_new(self, object, id);
+	if(tolerance > 0 && !hulls){
+		hulls = new hkl3d_hulls_t[self->len];
+		for(size_t i=0; i<self->len; ++i)
+			hkl3d_hulls_from_g3dobject(&hulls[i], self->objects[i]->g3d, tolerance);
+		cached = FALSE;
+	}
+	if(!cached)
+		hkl3d_model_cache_write(self, tolerance, hulls);
 
-			/* remembers objects to avoid memory leak */
-			hkl3d_model_add_object(self, hkl3dObject);
-		}
-		objects = g_slist_next(objects);
+	if(hulls){
+		for(size_t i=0; i<self->len; ++i)
+			hkl3d_object_set_hulls(self->objects[i], hkl3d_hulls_shape(&hulls[i]));
+		delete [] hulls;
 	}
+
 	return self;
 }
 
@@ -471,11 +965,85 @@ double hkl3d_stats_get_collision_ms(const Hkl3DStats *self)
 	return self->collision.tv_sec*1000. + self->collision.tv_usec/1000.;
 }
 
+/**
+ * hkl3d_stats_reset:
+ * @self: the this ptr
+ *
+ * reset the cumulated counters
+ **/
+void hkl3d_stats_reset(Hkl3DStats *self)
+{
+	struct timeval collision = self->collision;
+	struct timeval transformation = self->transformation;
+
+	memset(self, 0, sizeof(*self));
+	self->collision = collision;
+	self->transformation = transformation;
+}
+
+/* record a check of the world */
+static void hkl3d_stats_add_check(Hkl3DStats *self,
+				  const struct timeval *transformation,
+				  const struct timeval *collision,
+				  btCollisionWorld *world,
+				  btCollisionDispatcher *dispatcher)
+{
+	double us = transformation->tv_sec * 1e6 + transformation->tv_usec
+		+ collision->tv_sec * 1e6 + collision->tv_usec;
+	int bin = us >= 1 ? (int)log2(us) : 0;
+	int n = dispatcher->getNumManifolds();
+
+	self->checks++;
+	self->pairs += world->getPairCache()->getNumOverlappingPairs();
+	self->manifolds += n;
+	for(int i=0; i<n; ++i)
+		self->contacts += dispatcher->getManifoldByIndexInternal(i)->getNumContacts();
+	self->transformation_s += transformation->tv_sec + transformation->tv_usec / 1e6;
+	self->collision_s += collision->tv_sec + collision->tv_usec / 1e6;
+	self->histogram[bin < HKL3D_STATS_HISTOGRAM_LEN ? bin : HKL3D_STATS_HISTOGRAM_LEN - 1]++;
+}
+
+/**
+ * hkl3d_stats_latency_percentile:
+ * @self: the this ptr
+ * @p: the percentile in [0, 100]
+ *
+ * Returns: the upper bound of the histogram bin of the @p percentile
+ * of the check latencies in µs, 0 if there is no check.
+ **/
+double hkl3d_stats_latency_percentile(const Hkl3DStats *self, double p)
+{
+	size_t n = 0;
+
+	if(!self->checks)
+		return 0;
+
+	for(int i=0; i<HKL3D_STATS_HISTOGRAM_LEN; ++i){
+		n += self->histogram[i];
+		if(n >= p / 100 * self->checks)
+			return ldexp(1, i + 1);
+	}
+
+	return ldexp(1, HKL3D_STATS_HISTOGRAM_LEN);
+}
+
 void hkl3d_stats_fprintf(FILE *f, const Hkl3DStats *self)
 {
 	fprintf(f, "transformation : %f ms collision : %f ms \n",
 		self->transformation.tv_sec*1000. + self->transformation.tv_usec/1000.,
 		hkl3d_stats_get_collision_ms(self));
+	fprintf(f, "checks : %zu pairs : %zu manifolds : %zu contacts : %zu\n",
+		self->checks, self->pairs, self->manifolds, self->contacts);
+	fprintf(f, "cumulated transformation : %f ms collision : %f ms\n",
+		self->transformation_s * 1000, self->collision_s * 1000);
+	fprintf(f, "latency (us) p50 < %g p90 < %g p99 < %g\n",
+		hkl3d_stats_latency_percentile(self, 50),
+		hkl3d_stats_latency_percentile(self, 90),
+		hkl3d_stats_latency_percentile(self, 99));
+	fprintf(f, "histogram :");
+	for(int i=0; i<HKL3D_STATS_HISTOGRAM_LEN; ++i)
+		fprintf(f, " %zu", self->histogram[i]);
+	fprintf(f, "\n");
 }
 
 /*************/
@@ -529,7 +1097,8 @@ static void hkl3d_axis_detach_object(Hkl3DAxis *self, Hkl3DObject *object)
 	/* move all above objects of 1 position */
 	self->len--;
 	if(i < self->len)
-		memmove(object, object+1, sizeof(object) * (self->len - i));
+		memmove(&self->objects[i], &self->objects[i+1],
+			sizeof(*self->objects) * (self->len - i));
 }
 
 static void hkl3d_axis_fprintf(FILE *f, const Hkl3DAxis *self)
@@ -546,6 +1115,13 @@ static void hkl3d_axis_fprintf(FILE *f, const Hkl3DAxis *self)
 /* Hkl3DGeometry */
 /*****************/
 
+/* the objects must be moved at the next apply, whatever the axes */
+static void hkl3d_geometry_invalidate(Hkl3DGeometry *self)
+{
+	for(size_t i=0; i<darray_size(self->geometry->axes); ++i)
+		self->applied[i] = NAN;
+}
+
 static Hkl3DGeometry *hkl3d_geometry_new(HklGeometry *geometry)
 {
 	uint i;
@@ -558,6 +1134,8 @@ static Hkl3DGeometry *hkl3d_geometry_new(HklGeometry *geometry)
 
 	for(i=0; i<darray_size(geometry->axes); ++i)
 		self->axes[i] = hkl3d_axis_new();
+	self->applied = (double *)malloc(darray_size(geometry->axes) * sizeof(*self->applied));
+	hkl3d_geometry_invalidate(self);
 
 	return self;
 }
@@ -572,22 +1150,36 @@ static void hkl3d_geometry_free(Hkl3DGeometry *self)
 	for(i=0; i<darray_size(self->geometry->axes); ++i)
 		hkl3d_axis_free(self->axes[i]);
 	free(self->axes);
+	free(self->applied);
 	free(self);
 }
 
-static void hkl3d_geometry_apply_transformations(Hkl3DGeometry *self)
+/*
+ * move the objects with the axes of geometry, which must have the
+ * same axes than the bound one. Only the objects downstream of an
+ * axis which changed since the previous apply are moved. The others
+ * are put to sleep, so bullet neither refits their AABB nor tests
+ * their pairs with the other sleeping or static objects, whose
+ * manifolds are still valid.
+ */
+static void hkl3d_geometry_apply_transformations(Hkl3DGeometry *self,
+						 const HklGeometry *geometry)
 {
 	HklHolder **holder;
+	size_t i;
 
 	darray_foreach(holder, self->geometry->holders){
 		size_t j;
+		int moved = FALSE;
 		btQuaternion btQ(0, 0, 0, 1);
 
 		size_t len = (*holder)->config->len;
 		for(j=0; j<len; j++){
 			size_t k;
 			size_t idx = (*holder)->config->idx[j];
-			const HklQuaternion *q = hkl_parameter_quaternion_get(darray_item(self->geometry->axes, idx));
+			const HklParameter *axis = darray_item(geometry->axes, idx);
+			const HklQuaternion *q = hkl_parameter_quaternion_get(axis);
+			double value = hkl_parameter_value_get(axis, HKL_UNIT_DEFAULT);
 			G3DMatrix G3DM[16];
 
 			/* conversion beetween hkl -> bullet coordinates */
@@ -596,18 +1188,33 @@ static void hkl3d_geometry_apply_transformations(Hkl3DGeometry *self)
 					    q->data[2],
 					    q->data[0]);
 
+			/* the axes after a moved one move too */
+			moved |= value != self->applied[idx];
+
 			/* move each object connected to that hkl Axis. */
 			/* apply the quaternion transformation to the bullet object */
 			/* use the bullet library to compute the OpenGL matrix */
 			/* apply this matrix to the G3DObject for the visualisation */
 			for(k=0; k<self->axes[idx]->len; ++k){
-				self->axes[idx]->objects[k]->btObject->getWorldTransform().setRotation(btQ);
-				self->axes[idx]->objects[k]->btObject->getWorldTransform().getOpenGLMatrix( G3DM );
+				btCollisionObject *btObject = self->axes[idx]->objects[k]->btObject;
+
+				if(!moved){
+					btObject->forceActivationState(ISLAND_SLEEPING);
+					continue;
+				}
+				btObject->forceActivationState(ACTIVE_TAG);
+				btObject->getWorldTransform().setRotation(btQ);
+				btObject->getWorldTransform().getOpenGLMatrix( G3DM );
 				memcpy(self->axes[idx]->objects[k]->g3d->transformation->matrix,
 				       &G3DM[0], sizeof(G3DM));
 			}
 		}
 	}
+
+	/* an axis can be in more than one holder */
+	for(i=0; i<darray_size(geometry->axes); ++i)
+		self->applied[i] = hkl_parameter_value_get(darray_item(geometry->axes, i),
+							   HKL_UNIT_DEFAULT);
 }
 
 static void hkl3d_geometry_fprintf(FILE *f, const Hkl3DGeometry *self)
@@ -635,13 +1242,20 @@ static Hkl3DAxis *hkl3d_geometry_axis_get(Hkl3DGeometry *self, const char *name)
 /* HKL3D */
 /*********/
 
-static void hkl3d_apply_transformations(Hkl3D *self)
+/**
+ * hkl3d_apply_transformations:
+ * @self: the this ptr
+ *
+ * move the objects at the current position of the geometry without
+ * checking the collisions, for the display.
+ **/
+void hkl3d_apply_transformations(Hkl3D *self)
 {
 	struct timeval debut, fin;
 
 	/* set the right transformation of each objects and get numbers */
 	gettimeofday(&debut, NULL);
-	hkl3d_geometry_apply_transformations(self->geometry);
+	hkl3d_geometry_apply_transformations(self->geometry, self->geometry->geometry);
 	gettimeofday(&fin, NULL);
 	timersub(&fin, &debut, &self->stats.transformation);
 }
@@ -666,10 +1280,31 @@ void hkl3d_connect_all_axes(Hkl3D *self)
  * Returns:
  **/
 Hkl3D *hkl3d_new(const char *filename, HklGeometry *geometry)
+{
+	return hkl3d_new_full(filename, geometry, 0);
+}
+
+/**
+ * hkl3d_new_full:
+ * @filename: the config filename
+ * @geometry: the bound #HklGeometry
+ * @tolerance: the size of the convex decomposition cells, 0 to keep the meshes
+ *
+ * with a positive @tolerance the meshes of the models are replaced
+ * by convex decompositions, much faster to check but which can report
+ * contacts closer than about @tolerance. They are cached next to each
+ * model in <model>.hkl3d, with the model itself, so they are
+ * computed only once.
+ *
+ * Returns:
+ **/
+Hkl3D *hkl3d_new_full(const char *filename, HklGeometry *geometry, double tolerance)
 {
 	Hkl3D *self = NULL;
 
 	self = HKL3D_MALLOC(Hkl3D);
+	self->tolerance = tolerance;
+	g_mutex_init(&self->lock);
 
 	self->geometry = hkl3d_geometry_new(geometry);
 	self->config = hkl3d_config_new();
@@ -701,6 +1336,9 @@ Hkl3D *hkl3d_new(const char *filename, HklGeometry *geometry)
 	self->_btWorld = new btCollisionWorld(self->_btDispatcher,
 					      self->_btBroadphase,
 					      self->_btCollisionConfiguration);
+	self->_btWorld->getPairCache()->setOverlapFilterCallback(&overlap_filter);
+	/* only refit the AABB of the moved objects */
+	self->_btWorld->setForceUpdateAllAabbs(false);
 
 	self->filename = filename;
 	if (filename)
@@ -735,6 +1373,7 @@ void hkl3d_free(Hkl3D *self)
 	if (self->_btCollisionConfiguration)
 		delete self->_btCollisionConfiguration;
 	g_free(self->model); /* do not use g3d_model_free as it is juste a container for all config->model */
+	g_mutex_clear(&self->lock);
 
 	free(self);
 }
@@ -756,7 +1395,7 @@ Hkl3DModel *hkl3d_add_model_from_file(Hkl3D *self,
 	if(res < 0)
 		goto close_current;
 
-	model = hkl3d_model_new_from_file(filename);
+	model = hkl3d_model_new_from_file(filename, self->tolerance);
 	if(model){
 		/* we can not display two different models with the current g3dviewer code */
 		/* so concatenate this loaded model with the one of hkl3d */
@@ -785,24 +1424,35 @@ close_current:
 void hkl3d_connect_object_to_axis(Hkl3D *self, Hkl3DObject *object, const char *name)
 {
 	Hkl3DAxis *axis3d = hkl3d_geometry_axis_get(self->geometry, name);
+
+	/* the pairs of an object are filtered when it is added into
+	 * the world, so it is attached to its axis before. A new
+	 * bullet object is not at the position of its axis yet. */
+	hkl3d_geometry_invalidate(self->geometry);
+
 	if (!object->movable){
 		if(axis3d){ /* static -> movable */
 			self->_btWorld->removeCollisionObject(object->btObject);
 			hkl3d_object_set_movable(object, true);
+			hkl3d_axis_attach_object(axis3d, object);
 			self->_btWorld->addCollisionObject(object->btObject);
 			object->added = true;
-			hkl3d_axis_attach_object(axis3d, object);
 		}
 	}else{
 		if(!axis3d){ /* movable -> static */
 			self->_btWorld->removeCollisionObject(object->btObject);
+			hkl3d_axis_detach_object(object->axis, object);
 			hkl3d_object_set_movable(object, false);
 			self->_btWorld->addCollisionObject(object->btObject);
 			object->added = true;
 		}else{ /* movable -> movable */
 			if(strcmp(object->axis_name, name)){ /* not the same axis */
+				if(object->added)
+					self->_btWorld->removeCollisionObject(object->btObject);
 				hkl3d_axis_detach_object(object->axis, object);
 				hkl3d_axis_attach_object(axis3d, object);
+				if(object->added)
+					self->_btWorld->addCollisionObject(object->btObject);
 			}
 		}
 	}
@@ -1143,23 +1793,396 @@ int hkl3d_is_colliding(Hkl3D *self)
 	}
 	gettimeofday(&fin, NULL);
 	timersub(&fin, &debut, &self->stats.collision);
+	hkl3d_stats_add_check(&self->stats, &self->stats.transformation, &self->stats.collision,
+			      self->_btWorld, self->_btDispatcher);
 
 	numManifolds = self->_btDispatcher->getNumManifolds();
 
 	/* update Hkl3DObject collision from manifolds */
-	for(size_t i=0; i<self->config->len; i++){
-		for(size_t j=0; j<self->config->models[i]->len; j++){
+	for(size_t i=0; i<self->config->len; i++)
+		for(size_t j=0; j<self->config->models[i]->len; j++)
+			self->config->models[i]->objects[j]->is_colliding = FALSE;
+	for(int k=0; k<numManifolds; ++k){
+		btPersistentManifold *manifold = self->_btDispatcher->getManifoldByIndexInternal(k);
+
+		((Hkl3DObject *)manifold->getBody0()->getUserPointer())->is_colliding = TRUE;
+		((Hkl3DObject *)manifold->getBody1()->getUserPointer())->is_colliding = TRUE;
+	}
+
+	return numManifolds != 0;
+}
+
+/* the state of hkl3d_filter_geometry_list and hkl3d_path_is_colliding */
+struct hkl3d_filter_t
+{
+	Hkl3D *hkl3d;
+	size_t n_axes;
+	struct timeval collision;
+	struct timeval transformation;
+};
+
+/* check a geometry of the bound diffractometer, the objects stay at
+ * its position */
+static int hkl3d_check_geometry(Hkl3D *self, const HklGeometry *geometry,
+				struct timeval *transformation,
+				struct timeval *collision)
+{
+	struct timeval debut, fin;
+
+	/* only the objects of the axes which changed are moved */
+	gettimeofday(&debut, NULL);
+	hkl3d_geometry_apply_transformations(self->geometry, geometry);
+	gettimeofday(&fin, NULL);
+	timersub(&fin, &debut, transformation);
+
+	/* the first manifold is a contact, no need to look at the
+	 * colliding objects */
+	gettimeofday(&debut, NULL);
+	if(self->_btWorld){
+		self->_btWorld->performDiscreteCollisionDetection();
+		self->_btWorld->updateAabbs();
+	}
+	gettimeofday(&fin, NULL);
+	timersub(&fin, &debut, collision);
+	hkl3d_stats_add_check(&self->stats, transformation, collision,
+			      self->_btWorld, self->_btDispatcher);
+
+	return self->_btDispatcher->getNumManifolds() != 0;
+}
+
+static int hkl3d_filter_is_colliding(const HklGeometry *geometry, void *data)
+{
+	struct hkl3d_filter_t *self = (struct hkl3d_filter_t *)data;
+	struct timeval dt, dt_transformation;
+	int res;
+
+	res = hkl3d_check_geometry(self->hkl3d, geometry, &dt_transformation, &dt);
+	timeradd(&self->transformation, &dt_transformation, &self->transformation);
+	timeradd(&self->collision, &dt, &self->collision);
+
+	return res;
+}
+
+/* the check of the solutions of an engine list, the objects are moved
+ * back to the bound geometry by the next hkl3d_is_colliding */
+static int hkl3d_engine_list_is_colliding(const HklGeometry *geometry, void *data)
+{
+	Hkl3D *self = (Hkl3D *)data;
+	int res;
+
+	/* the copies of the engines check from their own thread */
+	g_mutex_lock(&self->lock);
+	res = hkl3d_check_geometry(self, geometry,
+				   &self->stats.transformation,
+				   &self->stats.collision);
+	g_mutex_unlock(&self->lock);
+
+	return res;
+}
+
+static void hkl3d_filter_init(struct hkl3d_filter_t *self, Hkl3D *hkl3d)
+{
+	self->hkl3d = hkl3d;
+	self->n_axes = darray_size(hkl3d->geometry->geometry->axes);
+	timerclear(&self->collision);
+	timerclear(&self->transformation);
+
+	/* the objects are at the positions of the bound geometry */
+	hkl3d_apply_transformations(hkl3d);
+}
+
+static void hkl3d_filter_release(struct hkl3d_filter_t *self)
+{
+	/* back to the bound geometry */
+	hkl3d_apply_transformations(self->hkl3d);
+	self->hkl3d->stats.collision = self->collision;
+	self->hkl3d->stats.transformation = self->transformation;
+}
+
+/**
+ * hkl3d_filter_geometry_list:
+ * @self: the this ptr
+ * @list: the #HklGeometryList to filter
+ *
+ * remove the colliding #HklGeometry from @list, they must come from
+ * the same diffractometer than the bound geometry. The candidates are
+ * checked in turn, only the holders with an axis which moved since
+ * the previous candidate are transformed. The bound geometry is
+ * unchanged and the objects are moved back to it at the end.
+ *
+ * Returns: the number of removed #HklGeometry
+ **/
+size_t hkl3d_filter_geometry_list(Hkl3D *self, HklGeometryList *list)
+{
+	struct hkl3d_filter_t filter;
+	size_t n;
+
+	hkl3d_filter_init(&filter, self);
+	n = hkl_geometry_list_remove_if(list, hkl3d_filter_is_colliding, &filter);
+	hkl3d_filter_release(&filter);
+
+	return n;
+}
+
+/**
+ * hkl3d_engine_list_attach:
+ * @self: the this ptr
+ * @engines: the #HklEngineList to check
+ *
+ * reject the colliding solutions of @engines while they are
+ * computed, see hkl_engine_list_collision_set. The engines must
+ * solve the same diffractometer than the bound geometry and @self
+ * must outlive them, or be detached with
+ * hkl_engine_list_collision_set(engines, NULL, NULL). The bound
+ * geometry is unchanged, but the objects stay at the last checked
+ * solution until the next hkl3d_is_colliding. The checks of the
+ * copies of @engines solving in other threads are serialized.
+ **/
+void hkl3d_engine_list_attach(Hkl3D *self, HklEngineList *engines)
+{
+	hkl_engine_list_collision_set(engines, hkl3d_engine_list_is_colliding, self);
+}
+
+/* set the geometry at the fraction t of the linear move from -> to */
+static void hkl3d_path_interpolate(HklGeometry *geometry,
+				   const double *from, const double *to,
+				   double *values, size_t n_axes,
+				   double t)
+{
+	for(size_t i=0; i<n_axes; ++i)
+		values[i] = from[i] + t * (to[i] - from[i]);
+	hkl_geometry_axis_values_set(geometry, values, n_axes, HKL_UNIT_DEFAULT, NULL);
+}
+
+/**
+ * hkl3d_path_is_colliding:
+ * @self: the this ptr
+ * @from: the #HklGeometry at the start of the move
+ * @to: the #HklGeometry at the end of the move
+ * @max_step: the maximum motion of an axis between two checks (radian)
+ * @toi: (out) (allow-none): the earliest time of impact, in [0, 1]
+ *
+ * check the move from @from to @to, all the axes moving linearly at
+ * the same time. The geometries must come from the same diffractometer
+ * than the bound one.
+ *
+ * The objects are triangle meshes and Bullet sweeps only convex
+ * shapes, so the path is sampled with at most @max_step per axis
+ * between two poses. The first colliding interval is then bisected
+ * down to @max_step / 1024 to get the time of impact. A contact
+ * thinner than @max_step can be missed, so it must be chosen from
+ * the size of the objects. The bound geometry is unchanged.
+ *
+ * Returns: TRUE if the move is colliding
+ **/
+int hkl3d_path_is_colliding(Hkl3D *self,
+			    const HklGeometry *from, const HklGeometry *to,
+			    double max_step, double *toi)
+{
+	struct hkl3d_filter_t filter;
+	HklGeometry *geometry = hkl_geometry_new_copy(from);
+	double *v_from, *v_to, *values;
+	double jump = 0;
+	size_t n_steps;
+	int res = FALSE;
+
+	hkl3d_filter_init(&filter, self);
+
+	v_from = (double *)malloc(3 * filter.n_axes * sizeof(*v_from));
+	v_to = &v_from[filter.n_axes];
+	values = &v_to[filter.n_axes];
+	hkl_geometry_axis_values_get(from, v_from, filter.n_axes, HKL_UNIT_DEFAULT);
+	hkl_geometry_axis_values_get(to, v_to, filter.n_axes, HKL_UNIT_DEFAULT);
+
+	for(size_t i=0; i<filter.n_axes; ++i)
+		jump = fmax(jump, fabs(v_to[i] - v_from[i]));
+	n_steps = max_step > 0 ? (size_t)ceil(jump / max_step) : 1;
+	if(n_steps == 0)
+		n_steps = 1;
+
+	for(size_t k=0; k<=n_steps && !res; ++k){
+		double t = (double)k / n_steps;
+
+		hkl3d_path_interpolate(geometry, v_from, v_to, values, filter.n_axes, t);
+		if(hkl3d_filter_is_colliding(geometry, &filter)){
+			res = TRUE;
+			if(toi){
+				double t_free = k > 0 ? (double)(k - 1) / n_steps : 0;
+				double t_hit = t;
+
+				/* bisect the first colliding interval */
+				for(int i=0; i<10 && k > 0; ++i){
+					double t_mid = (t_free + t_hit) / 2;
+
+					hkl3d_path_interpolate(geometry, v_from, v_to, values,
+							       filter.n_axes, t_mid);
+					if(hkl3d_filter_is_colliding(geometry, &filter))
+						t_hit = t_mid;
+					else
+						t_free = t_mid;
+				}
+				*toi = t_hit;
+			}
+		}
+	}
+
+	free(v_from);
+	hkl_geometry_free(geometry);
+	hkl3d_filter_release(&filter);
+
+	return res;
+}
+
+/**************/
+/* clearance */
+/**************/
+
+/* keep the smallest signed distance of the contact points */
+struct Hkl3DClearanceCallback : public btCollisionWorld::ContactResultCallback
+{
+	btScalar distance;
+
+	Hkl3DClearanceCallback(btScalar threshold) : distance(threshold)
+	{
+#if BT_BULLET_VERSION >= 283
+		m_closestDistanceThreshold = threshold;
+#endif
+	}
+
+	virtual btScalar addSingleResult(btManifoldPoint &cp,
+					 const btCollisionObjectWrapper *,
+					 int, int,
+					 const btCollisionObjectWrapper *,
+					 int, int)
+	{
+		if(cp.getDistance() < distance)
+			distance = cp.getDistance();
+		return 0;
+	}
+};
+
+/* the objects whose clearance is computed */
+typedef int (* Hkl3DObjectSelect)(const Hkl3DObject *object, const void *data);
+
+static int hkl3d_select_object(const Hkl3DObject *object, const void *data)
+{
+	return object == data;
+}
+
+static int hkl3d_select_axis(const Hkl3DObject *object, const void *data)
+{
+	return object->axis == data;
+}
+
+static int hkl3d_select_movable(const Hkl3DObject *object, const void *)
+{
+	return object->axis != NULL;
+}
+
+/*
+ * the smallest signed distance between the selected objects and the
+ * other objects of the world, not on their rigid body. The pairs
+ * with bounding boxes further than threshold are skipped, and the
+ * search stops at the first contact.
+ */
+static double hkl3d_clearance(Hkl3D *self, Hkl3DObjectSelect select,
+			      const void *data, double threshold)
+{
+	btScalar distance = threshold;
+
+	hkl3d_apply_transformations(self);
+
+	for(size_t i=0; i<self->config->len && distance > 0; i++){
+		for(size_t j=0; j<self->config->models[i]->len && distance > 0; j++){
 			Hkl3DObject *object = self->config->models[i]->objects[j];
-			object->is_colliding = FALSE;
-			for(int k=0; k<numManifolds; ++k){
-				btPersistentManifold *manifold = self->_btDispatcher->getManifoldByIndexInternal(k);
-				object->is_colliding |= object->btObject == manifold->getBody0();
-				object->is_colliding |= object->btObject == manifold->getBody1();
+			btVector3 min, max;
+
+			if(!object->added || !select(object, data))
+				continue;
+
+			object->btShape->getAabb(object->btObject->getWorldTransform(), min, max);
+			min -= btVector3(threshold, threshold, threshold);
+			max += btVector3(threshold, threshold, threshold);
+
+			for(size_t k=0; k<self->config->len && distance > 0; k++){
+				for(size_t l=0; l<self->config->models[k]->len && distance > 0; l++){
+					Hkl3DObject *other = self->config->models[k]->objects[l];
+					btVector3 other_min, other_max;
+
+					if(!other->added || other->axis == object->axis)
+						continue;
+
+					other->btShape->getAabb(other->btObject->getWorldTransform(),
+								other_min, other_max);
+					if(!TestAabbAgainstAabb2(min, max, other_min, other_max))
+						continue;
+
+					Hkl3DClearanceCallback callback(distance);
+					self->_btWorld->contactPairTest(object->btObject, other->btObject,
+									callback);
+					distance = callback.distance;
+				}
 			}
 		}
 	}
 
-	return numManifolds != 0;
+	return distance;
+}
+
+/**
+ * hkl3d_object_clearance:
+ * @self: the this ptr
+ * @object: the #Hkl3DObject
+ * @threshold: the largest distance of interest
+ *
+ * the signed distance between @object and the rest of the world, the
+ * objects of its rigid body excluded. A negative distance is a
+ * contact. The distances are exact with the convex decompositions of
+ * hkl3d_new_full, with the meshes only the contacts are reported.
+ *
+ * Returns: the clearance, @threshold if nothing is closer
+ **/
+double hkl3d_object_clearance(Hkl3D *self, const Hkl3DObject *object, double threshold)
+{
+	return hkl3d_clearance(self, hkl3d_select_object, object, threshold);
+}
+
+/**
+ * hkl3d_axis_clearance:
+ * @self: the this ptr
+ * @name: the name of the axis
+ * @threshold: the largest distance of interest
+ *
+ * the signed distance between the objects attached to the @name axis
+ * and the rest of the world, as hkl3d_object_clearance().
+ *
+ * Returns: the clearance, @threshold if nothing is closer or if there
+ * is no such axis
+ **/
+double hkl3d_axis_clearance(Hkl3D *self, const char *name, double threshold)
+{
+	const Hkl3DAxis *axis = hkl3d_geometry_axis_get(self->geometry, name);
+
+	if(!axis)
+		return threshold;
+
+	return hkl3d_clearance(self, hkl3d_select_axis, axis, threshold);
+}
+
+/**
+ * hkl3d_clearance_get:
+ * @self: the this ptr
+ * @threshold: the largest distance of interest
+ *
+ * the signed distance between the moving objects and the rest of the
+ * world, as hkl3d_object_clearance(). This is the one to maximize
+ * when choosing between the solutions.
+ *
+ * Returns: the clearance, @threshold if nothing is closer
+ **/
+double hkl3d_clearance_get(Hkl3D *self, double threshold)
+{
+	return hkl3d_clearance(self, hkl3d_select_movable, NULL, threshold);
 }
 
 /**
@@ -1222,3 +2245,197 @@ void hkl3d_fprintf(FILE *f, const Hkl3D *self)
 	fprintf(f, "_btThreadSupportInterface : %p\n", self->_btThreadSupportInterface);
 #endif
 }
+
+/**************/
+/* Hkl3DWorld */
+/**************/
+
+/*
+ * a collision world of its own for the current objects of an Hkl3D,
+ * to check the geometries of one thread. The shapes of the convex
+ * decompositions are shared, but the GImpact shapes lock their mesh
+ * when they are tested, so each world has its own one on top of the
+ * shared triangles.
+ */
+struct _Hkl3DWorld
+{
+	const Hkl3D *hkl3d; /* weak reference */
+	btAlignedObjectArray<btCollisionObject *> btObjects;
+	btAlignedObjectArray<btCollisionShape *> btShapes; /* owned, NULL if shared */
+	btAlignedObjectArray<int> axes; /* the axis index of each object, -1 if static */
+	btAlignedObjectArray<btQuaternion> rotations; /* of each axis */
+
+	btCollisionConfiguration *_btCollisionConfiguration;
+	btBroadphaseInterface *_btBroadphase;
+	btCollisionWorld *_btWorld;
+	btCollisionDispatcher *_btDispatcher;
+	Hkl3DStats stats;
+};
+
+/**
+ * hkl3d_world_new:
+ * @hkl3d: the #Hkl3D with the objects
+ *
+ * create a collision world with the shown objects of @hkl3d and
+ * their connections to the axes. Each thread checks its geometries
+ * with its own world, the later changes of @hkl3d are not seen and
+ * it must not be freed before the world.
+ *
+ * Returns: the new #Hkl3DWorld
+ **/
+Hkl3DWorld *hkl3d_world_new(const Hkl3D *hkl3d)
+{
+	Hkl3DWorld *self = new Hkl3DWorld();
+	const Hkl3DGeometry *geometry = hkl3d->geometry;
+	size_t n_axes = darray_size(geometry->geometry->axes);
+
+	self->hkl3d = hkl3d;
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->rotations.resize(n_axes, btQuaternion(0, 0, 0, 1));
+
+	self->_btCollisionConfiguration = new btDefaultCollisionConfiguration();
+	self->_btDispatcher = new btCollisionDispatcher(self->_btCollisionConfiguration);
+	btGImpactCollisionAlgorithm::registerAlgorithm(self->_btDispatcher);
+	self->_btBroadphase = new btAxisSweep3(btVector3(-1000, -1000, -1000),
+					       btVector3( 1000,  1000,  1000));
+	self->_btWorld = new btCollisionWorld(self->_btDispatcher,
+					      self->_btBroadphase,
+					      self->_btCollisionConfiguration);
+	self->_btWorld->getPairCache()->setOverlapFilterCallback(&overlap_filter);
+
+	for(size_t i=0; i<hkl3d->config->len; ++i){
+		for(size_t j=0; j<hkl3d->config->models[i]->len; ++j){
+			Hkl3DObject *object = hkl3d->config->models[i]->objects[j];
+			btCollisionShape *shape = NULL;
+			btCollisionObject *btObject;
+			int axis = -1;
+
+			if(!object->added)
+				continue;
+
+			for(size_t k=0; k<n_axes; ++k)
+				if(object->axis == geometry->axes[k])
+					axis = k;
+
+			if(!object->hulls)
+				shape = shape_from_trimesh(object->meshes, object->movable);
+			btObject = btObject_from_shape(shape ? shape : object->btShape);
+			/* the user pointer is used by the overlap filter */
+			btObject->setUserPointer(object);
+
+			self->btObjects.push_back(btObject);
+			self->btShapes.push_back(shape);
+			self->axes.push_back(axis);
+			self->_btWorld->addCollisionObject(btObject);
+		}
+	}
+
+	return self;
+}
+
+/**
+ * hkl3d_world_free:
+ * @self: the this ptr
+ **/
+void hkl3d_world_free(Hkl3DWorld *self)
+{
+	for(int i=0; i<self->btObjects.size(); ++i){
+		self->_btWorld->removeCollisionObject(self->btObjects[i]);
+		delete self->btObjects[i];
+		if(self->btShapes[i])
+			delete self->btShapes[i];
+	}
+
+	delete self->_btWorld;
+	delete self->_btBroadphase;
+	delete self->_btDispatcher;
+	delete self->_btCollisionConfiguration;
+	delete self;
+}
+
+/**
+ * hkl3d_world_is_colliding:
+ * @self: the this ptr
+ * @geometry: the #HklGeometry to check, with the axes of the #Hkl3D one
+ *
+ * Returns: TRUE if the objects of the world collide at @geometry
+ **/
+int hkl3d_world_is_colliding(Hkl3DWorld *self, const HklGeometry *geometry)
+{
+	HklHolder **holder;
+	struct timeval debut, fin;
+
+	gettimeofday(&debut, NULL);
+
+	/* the rotation of each axis, as in hkl3d_geometry_apply_transformations */
+	darray_foreach(holder, self->hkl3d->geometry->geometry->holders){
+		btQuaternion btQ(0, 0, 0, 1);
+
+		for(size_t j=0; j<(*holder)->config->len; j++){
+			size_t idx = (*holder)->config->idx[j];
+			const HklQuaternion *q = hkl_parameter_quaternion_get(darray_item(geometry->axes, idx));
+
+			btQ *= btQuaternion(-q->data[1],
+					    q->data[3],
+					    q->data[2],
+					    q->data[0]);
+			self->rotations[idx] = btQ;
+		}
+	}
+	for(int i=0; i<self->btObjects.size(); ++i)
+		if(self->axes[i] >= 0)
+			self->btObjects[i]->getWorldTransform().setRotation(self->rotations[self->axes[i]]);
+	gettimeofday(&fin, NULL);
+	timersub(&fin, &debut, &self->stats.transformation);
+
+	gettimeofday(&debut, NULL);
+	self->_btWorld->performDiscreteCollisionDetection();
+	self->_btWorld->updateAabbs();
+	gettimeofday(&fin, NULL);
+	timersub(&fin, &debut, &self->stats.collision);
+	hkl3d_stats_add_check(&self->stats, &self->stats.transformation, &self->stats.collision,
+			      self->_btWorld, self->_btDispatcher);
+
+	return self->_btDispatcher->getNumManifolds() != 0;
+}
+
+/**
+ * hkl3d_world_colliding_objects_get:
+ * @self: the this ptr
+ * @objects: (out caller-allocates) (array length=n): the colliding objects
+ * @n: the size of @objects
+ *
+ * the objects in contact found by the last hkl3d_world_is_colliding,
+ * two per contact. Only the first @n are copied into @objects.
+ *
+ * Returns: the number of colliding objects, it can be more than @n
+ **/
+size_t hkl3d_world_colliding_objects_get(Hkl3DWorld *self,
+					 Hkl3DObject *objects[], size_t n)
+{
+	size_t len = 0;
+
+	for(int k=0; k<self->_btDispatcher->getNumManifolds(); ++k){
+		btPersistentManifold *manifold = self->_btDispatcher->getManifoldByIndexInternal(k);
+
+		if(len < n)
+			objects[len] = (Hkl3DObject *)manifold->getBody0()->getUserPointer();
+		len++;
+		if(len < n)
+			objects[len] = (Hkl3DObject *)manifold->getBody1()->getUserPointer();
+		len++;
+	}
+
+	return len;
+}
+
+/**
+ * hkl3d_world_stats_get:
+ * @self: the this ptr
+ *
+ * Returns: the statistics of the checks of this world
+ **/
+Hkl3DStats *hkl3d_world_stats_get(Hkl3DWorld *self)
+{
+	return &self->stats;
+}
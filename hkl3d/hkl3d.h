@@ -34,6 +34,7 @@ struct btCollisionConfiguration;
 struct btBroadphaseInterface;
 struct btCollisionDispatcher;
 struct btCollisionShape;
+struct btCompoundShape;
 struct btVector3;
 struct btTriangleMesh;
 
@@ -48,19 +49,36 @@ extern "C" {
 	typedef struct _Hkl3DAxis Hkl3DAxis;
 	typedef struct _Hkl3DGeometry Hkl3DGeometry;
 	typedef struct _Hkl3D Hkl3D;
+	typedef struct _Hkl3DWorld Hkl3DWorld;
 
 	/**************/
 	/* Hkl3DStats */
 	/**************/
 
+	/* the bin i of the histogram counts the checks of [2^i, 2^(i+1)[ µs,
+	 * the first and the last ones also the faster and slower ones */
+#define HKL3D_STATS_HISTOGRAM_LEN 20
+
 	struct _Hkl3DStats
 	{
-		struct timeval collision;
-		struct timeval transformation;
+		struct timeval collision; /* of the last check */
+		struct timeval transformation; /* of the last check */
+
+		/* cumulated since the last hkl3d_stats_reset */
+		size_t checks;
+		size_t pairs; /* the broadphase overlapping pairs */
+		size_t manifolds; /* the narrowphase tests kept as manifolds */
+		size_t contacts;
+		double transformation_s;
+		double collision_s;
+		size_t histogram[HKL3D_STATS_HISTOGRAM_LEN];
 	};
 
 	extern double hkl3d_stats_get_collision_ms(const Hkl3DStats *self);
-	extern void hkl3d_stats_fprintf(FILE *f, Hkl3DStats *self);
+	HKLAPI extern void hkl3d_stats_reset(Hkl3DStats *self) HKL_ARG_NONNULL(1);
+	HKLAPI extern double hkl3d_stats_latency_percentile(const Hkl3DStats *self,
+							    double p) HKL_ARG_NONNULL(1);
+	extern void hkl3d_stats_fprintf(FILE *f, const Hkl3DStats *self);
 
 	/***************/
 	/* Hkl3DObject */
@@ -74,6 +92,7 @@ extern "C" {
 		G3DObject *g3d; /* weak reference */
 		struct btCollisionObject *btObject;
 		struct btCollisionShape *btShape;
+		struct btCompoundShape *hulls; /* the convex decomposition, NULL if none */
 		struct btTriangleMesh *meshes;
 		struct btVector3 *color;
 		int is_colliding;
@@ -132,6 +151,7 @@ extern "C" {
 	{
 		HklGeometry *geometry; /* weak reference */
 		Hkl3DAxis **axes;
+		double *applied; /* the axes values of the objects in the bullet world */
 	};
 
 	/*********/
@@ -145,6 +165,8 @@ extern "C" {
 		G3DModel *model;
 		Hkl3DStats stats;
 		Hkl3DConfig *config;
+		double tolerance; /* of the convex decomposition, 0 for the meshes */
+		GMutex lock; /* serializes the checks of the attached engines */
 
 		struct btCollisionConfiguration *_btCollisionConfiguration;
 		struct btBroadphaseInterface *_btBroadphase;
@@ -156,9 +178,26 @@ extern "C" {
 	};
 
 	HKLAPI extern Hkl3D* hkl3d_new(const char *filename, HklGeometry *geometry) HKL_ARG_NONNULL(2);
+	HKLAPI extern Hkl3D* hkl3d_new_full(const char *filename, HklGeometry *geometry,
+					    double tolerance) HKL_ARG_NONNULL(2);
 	HKLAPI extern void hkl3d_free(Hkl3D *self) HKL_ARG_NONNULL(1);
 
 	HKLAPI extern int hkl3d_is_colliding(Hkl3D *self) HKL_ARG_NONNULL(1);
+	HKLAPI extern void hkl3d_apply_transformations(Hkl3D *self) HKL_ARG_NONNULL(1);
+	HKLAPI extern size_t hkl3d_filter_geometry_list(Hkl3D *self,
+							HklGeometryList *list) HKL_ARG_NONNULL(1, 2);
+	HKLAPI extern void hkl3d_engine_list_attach(Hkl3D *self,
+						    HklEngineList *engines) HKL_ARG_NONNULL(1, 2);
+	HKLAPI extern int hkl3d_path_is_colliding(Hkl3D *self,
+						  const HklGeometry *from,
+						  const HklGeometry *to,
+						  double max_step, double *toi) HKL_ARG_NONNULL(1, 2, 3);
+	HKLAPI extern double hkl3d_object_clearance(Hkl3D *self,
+						    const Hkl3DObject *object,
+						    double threshold) HKL_ARG_NONNULL(1, 2);
+	HKLAPI extern double hkl3d_axis_clearance(Hkl3D *self, const char *name,
+						  double threshold) HKL_ARG_NONNULL(1, 2);
+	HKLAPI extern double hkl3d_clearance_get(Hkl3D *self, double threshold) HKL_ARG_NONNULL(1);
 	HKLAPI extern void hkl3d_load_config(Hkl3D *self, const char *filename) HKL_ARG_NONNULL(1, 2);
 	HKLAPI extern void hkl3d_save_config(Hkl3D *self, const char *filename) HKL_ARG_NONNULL(1, 2);
 	HKLAPI extern Hkl3DModel *hkl3d_add_model_from_file(Hkl3D *self,
@@ -183,6 +222,19 @@ extern "C" {
 
 	HKLAPI extern void hkl3d_fprintf(FILE *f, const Hkl3D *self) HKL_ARG_NONNULL(1, 2);
 
+	/**************/
+	/* Hkl3DWorld */
+	/**************/
+
+	HKLAPI extern Hkl3DWorld *hkl3d_world_new(const Hkl3D *hkl3d) HKL_ARG_NONNULL(1);
+	HKLAPI extern void hkl3d_world_free(Hkl3DWorld *self) HKL_ARG_NONNULL(1);
+	HKLAPI extern int hkl3d_world_is_colliding(Hkl3DWorld *self,
+						   const HklGeometry *geometry) HKL_ARG_NONNULL(1, 2);
+	HKLAPI extern size_t hkl3d_world_colliding_objects_get(Hkl3DWorld *self,
+							       Hkl3DObject *objects[],
+							       size_t n) HKL_ARG_NONNULL(1);
+	HKLAPI extern Hkl3DStats *hkl3d_world_stats_get(Hkl3DWorld *self) HKL_ARG_NONNULL(1);
+
 #ifdef __cplusplus
 }
 #endif
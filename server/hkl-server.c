@@ -0,0 +1,715 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+
+/* hkl-server keeps the diffractometer contexts of its clients warm
+ * and solves their batches, so a client does not build its own
+ * factory, geometry and sample and does not link libhkl.
+ *
+ * The clients send frames over TCP, all the numbers are in little
+ * endian, a string is its u32 length followed by its bytes:
+ *
+ *   request:  "HKLS" u32 type   u32 size, the payload
+ *   answer:   "HKLS" u32 status u32 size, the payload
+ *
+ * HKL_SERVER_REQUEST_LOAD
+ *   payload: a context from hkl_context_to_bytes
+ *   answer:  u64 id of the warm context, the same context is loaded once
+ *
+ * HKL_SERVER_REQUEST_SOLVE
+ *   payload: u64 id, string engine, u32 flags, u32 n_targets,
+ *            u32 n_values, n_targets x n_values f64 pseudo axes values
+ *   answer:  u32 n_axes, n_targets x n_axes f64 axes values,
+ *            n_targets u32 valid
+ *   with HKL_SERVER_SOLVE_TRAJECTORY, the targets are the points of
+ *   a path and each one starts from the solution of the previous
+ *   one, the request fails if a point has no solution.
+ *
+ * HKL_SERVER_REQUEST_FORWARD
+ *   payload: u64 id, string engine, u32 n_positions, u32 n_axes,
+ *            n_positions x n_axes f64 axes values
+ *   answer:  u32 n_values, n_positions x n_values f64 pseudo axes
+ *            values, n_positions u32 valid
+ *
+ * HKL_SERVER_REQUEST_UNLOAD
+ *   payload: u64 id
+ *   answer:  empty
+ *
+ * All the values are in user units. On error the status is
+ * HKL_SERVER_STATUS_ERROR and the payload the message string. A
+ * request has at most HKL_SERVER_MAX_BATCH targets or positions.
+ *
+ * The server listens on the loopback unless --bind says otherwise,
+ * with --port 0 the system picks the port, the address and the port
+ * are printed on the standard output once the server listens.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hkl.h"
+
+#define HKL_SERVER_MAGIC "HKLS"
+#define HKL_SERVER_MAX_PAYLOAD (256 * 1024 * 1024)
+#define HKL_SERVER_MAX_BATCH (1024 * 1024)
+
+typedef enum _HklServerRequest
+{
+	HKL_SERVER_REQUEST_LOAD = 1,
+	HKL_SERVER_REQUEST_SOLVE,
+	HKL_SERVER_REQUEST_FORWARD,
+	HKL_SERVER_REQUEST_UNLOAD,
+} HklServerRequest;
+
+typedef enum _HklServerStatus
+{
+	HKL_SERVER_STATUS_OK = 0,
+	HKL_SERVER_STATUS_ERROR,
+} HklServerStatus;
+
+#define HKL_SERVER_SOLVE_TRAJECTORY (1u << 0)
+
+/* options */
+
+static gchar *bind_address = NULL;
+static gint port = 7135;
+static gint n_connections = 0;
+static gint n_solver_threads = 1;
+static gint cache_size = 1024;
+static gint max_contexts = 64;
+
+static GOptionEntry entries[] =
+{
+	{"bind", 'b', 0, G_OPTION_ARG_STRING, &bind_address, "listen on this address (127.0.0.1)", "ADDR"},
+	{"port", 'p', 0, G_OPTION_ARG_INT, &port, "listen on this port, 0 for any (7135)", "PORT"},
+	{"connections", 'c', 0, G_OPTION_ARG_INT, &n_connections, "clients served at the same time (number of cpus)", "N"},
+	{"solver-threads", 't', 0, G_OPTION_ARG_INT, &n_solver_threads, "threads solving one batch (1)", "N"},
+	{"cache", 0, 0, G_OPTION_ARG_INT, &cache_size, "solutions cached per engine, 0 to disable (1024)", "N"},
+	{"contexts", 0, 0, G_OPTION_ARG_INT, &max_contexts, "warm contexts kept, the least recently used is dropped (64)", "N"},
+	{NULL}
+};
+
+/* warm contexts */
+
+typedef struct _HklServerContext HklServerContext;
+struct _HklServerContext
+{
+	gint ref;
+	guint64 id;
+	guint64 used; /* the server clock of its last use */
+	GMutex mutex; /* one batch at a time, the batch has its own threads */
+	HklContext *context;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineList *engines;
+};
+
+static struct
+{
+	GMutex mutex;
+	GHashTable *contexts; /* id -> HklServerContext */
+	guint64 clock;
+} server;
+
+static HklServerContext *hkl_server_context_new(HklContext *context, guint64 id)
+{
+	HklServerContext *self = g_new0(HklServerContext, 1);
+	HklEngine **engine;
+
+	self->ref = 1;
+	self->id = id;
+	g_mutex_init(&self->mutex);
+	self->context = context;
+	self->engines = hkl_context_engine_list_new(context,
+						    &self->geometry,
+						    &self->detector,
+						    &self->sample);
+
+	/* the repeated targets of the clients are not solved again */
+	darray_foreach(engine, *hkl_engine_list_engines_get(self->engines)){
+		hkl_engine_cache_set(*engine, cache_size);
+	}
+
+	return self;
+}
+
+static void hkl_server_context_unref(HklServerContext *self)
+{
+	if(!g_atomic_int_dec_and_test(&self->ref))
+		return;
+
+	hkl_engine_list_free(self->engines);
+	hkl_sample_free(self->sample);
+	hkl_detector_free(self->detector);
+	hkl_geometry_free(self->geometry);
+	hkl_context_free(self->context);
+	g_mutex_clear(&self->mutex);
+	g_free(self);
+}
+
+/* the first bytes of the sha256 of the context */
+static guint64 hkl_server_context_id(const guint8 *data, size_t len)
+{
+	guint8 digest[32];
+	gsize n = sizeof(digest);
+	guint64 id;
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	g_checksum_update(checksum, data, len);
+	g_checksum_get_digest(checksum, digest, &n);
+	g_checksum_free(checksum);
+	memcpy(&id, digest, sizeof(id));
+
+	return id;
+}
+
+/* drop the least recently used context, the batches running on it
+ * keep their reference */
+static void hkl_server_contexts_evict(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+	HklServerContext *oldest = NULL;
+
+	g_hash_table_iter_init(&iter, server.contexts);
+	while(g_hash_table_iter_next(&iter, NULL, &value)){
+		HklServerContext *ctx = value;
+
+		if(NULL == oldest || ctx->used < oldest->used)
+			oldest = ctx;
+	}
+	if(NULL != oldest)
+		g_hash_table_remove(server.contexts, &oldest->id);
+}
+
+static HklServerContext *hkl_server_contexts_load(const guint8 *data, size_t len,
+						  GError **error)
+{
+	guint64 id = hkl_server_context_id(data, len);
+	HklServerContext *self;
+
+	g_mutex_lock(&server.mutex);
+	self = g_hash_table_lookup(server.contexts, &id);
+	if(NULL == self){
+		HklContext *context;
+
+		/* built outside of the lock, the other clients keep going */
+		g_mutex_unlock(&server.mutex);
+		context = hkl_context_new_from_bytes(data, len, error);
+		if(NULL == context)
+			return NULL;
+		self = hkl_server_context_new(context, id);
+		g_mutex_lock(&server.mutex);
+
+		if(NULL == g_hash_table_lookup(server.contexts, &id)){
+			if(g_hash_table_size(server.contexts) >= (guint)MAX(1, max_contexts))
+				hkl_server_contexts_evict();
+			g_hash_table_insert(server.contexts, &self->id, self);
+		}else{
+			/* loaded by another client meanwhile */
+			hkl_server_context_unref(self);
+			self = g_hash_table_lookup(server.contexts, &id);
+		}
+	}
+	self->used = ++server.clock;
+	g_atomic_int_inc(&self->ref);
+	g_mutex_unlock(&server.mutex);
+
+	return self;
+}
+
+static HklServerContext *hkl_server_contexts_get(guint64 id)
+{
+	HklServerContext *self;
+
+	g_mutex_lock(&server.mutex);
+	self = g_hash_table_lookup(server.contexts, &id);
+	if(NULL != self){
+		self->used = ++server.clock;
+		g_atomic_int_inc(&self->ref);
+	}
+	g_mutex_unlock(&server.mutex);
+
+	return self;
+}
+
+static void hkl_server_contexts_unload(guint64 id)
+{
+	g_mutex_lock(&server.mutex);
+	g_hash_table_remove(server.contexts, &id);
+	g_mutex_unlock(&server.mutex);
+}
+
+/* payloads */
+
+struct HklServerReader
+{
+	const guint8 *data;
+	size_t len;
+	size_t pos;
+	int ok;
+};
+
+static const guint8 *get_bytes(struct HklServerReader *self, size_t len)
+{
+	const guint8 *bytes = NULL;
+
+	if(self->ok && len <= self->len - self->pos){
+		bytes = &self->data[self->pos];
+		self->pos += len;
+	}else
+		self->ok = FALSE;
+
+	return bytes;
+}
+
+static guint32 get_uint(struct HklServerReader *self)
+{
+	guint32 value = 0;
+	const guint8 *bytes = get_bytes(self, sizeof(value));
+
+	if(bytes)
+		memcpy(&value, bytes, sizeof(value));
+
+	return GUINT32_FROM_LE(value);
+}
+
+static guint64 get_uint64(struct HklServerReader *self)
+{
+	guint64 value = 0;
+	const guint8 *bytes = get_bytes(self, sizeof(value));
+
+	if(bytes)
+		memcpy(&value, bytes, sizeof(value));
+
+	return GUINT64_FROM_LE(value);
+}
+
+static char *get_string(struct HklServerReader *self)
+{
+	guint32 len = get_uint(self);
+	const guint8 *bytes = get_bytes(self, len);
+
+	return bytes ? g_strndup((const char *)bytes, len) : NULL;
+}
+
+/* n doubles, NULL if the payload is too short */
+static double *get_doubles(struct HklServerReader *self, size_t n)
+{
+	size_t i;
+	double *values;
+	const guint8 *bytes;
+
+	if(n > (self->len - self->pos) / sizeof(guint64)){
+		self->ok = FALSE;
+		return NULL;
+	}
+	bytes = get_bytes(self, n * sizeof(guint64));
+	values = g_new(double, n);
+	for(i=0; i<n; ++i){
+		guint64 v;
+
+		memcpy(&v, &bytes[i * sizeof(v)], sizeof(v));
+		v = GUINT64_FROM_LE(v);
+		memcpy(&values[i], &v, sizeof(v));
+	}
+
+	return values;
+}
+
+static void put_uint(GByteArray *bytes, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(bytes, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_uint64(GByteArray *bytes, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_byte_array_append(bytes, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_string(GByteArray *bytes, const char *value)
+{
+	size_t len = strlen(value);
+
+	put_uint(bytes, len);
+	g_byte_array_append(bytes, (const guint8 *)value, len);
+}
+
+static void put_doubles(GByteArray *bytes, const double values[], size_t n)
+{
+	size_t i;
+
+	for(i=0; i<n; ++i){
+		guint64 v;
+
+		memcpy(&v, &values[i], sizeof(v));
+		put_uint64(bytes, v);
+	}
+}
+
+/* requests */
+
+static void hkl_server_error(GError **error, const char *what)
+{
+	g_set_error(error, g_quark_from_static_string("hkl-server-error-quark"), 0, "%s", what);
+}
+
+/* the context and the engine of a SOLVE or FORWARD request */
+static HklEngine *hkl_server_engine_get(struct HklServerReader *reader,
+					HklServerContext **ctx,
+					GError **error)
+{
+	guint64 id = get_uint64(reader);
+	char *name = get_string(reader);
+	HklEngine *engine = NULL;
+
+	if(!reader->ok)
+		hkl_server_error(error, "truncated request");
+	else if(NULL == (*ctx = hkl_server_contexts_get(id)))
+		hkl_server_error(error, "unknown context, load it again");
+	else if(NULL == (engine = hkl_engine_list_engine_get_by_name((*ctx)->engines, name, error))){
+		hkl_server_context_unref(*ctx);
+		*ctx = NULL;
+	}
+	g_free(name);
+
+	return engine;
+}
+
+static int hkl_server_load(struct HklServerReader *reader, GByteArray *answer,
+			   GError **error)
+{
+	HklServerContext *ctx = hkl_server_contexts_load(reader->data, reader->len, error);
+
+	if(NULL == ctx)
+		return FALSE;
+
+	put_uint64(answer, ctx->id);
+	hkl_server_context_unref(ctx);
+
+	return TRUE;
+}
+
+static int hkl_server_solve(struct HklServerReader *reader, GByteArray *answer,
+			    GError **error)
+{
+	int res = FALSE;
+	size_t i;
+	HklServerContext *ctx = NULL;
+	HklEngine *engine = hkl_server_engine_get(reader, &ctx, error);
+	guint32 flags = get_uint(reader);
+	guint32 n_targets = get_uint(reader);
+	guint32 n_values = get_uint(reader);
+	double *targets = get_doubles(reader, (size_t)n_targets * n_values);
+
+	if(NULL != engine && (!reader->ok || 0 == n_targets))
+		hkl_server_error(error, "truncated request or no target");
+	else if(NULL != engine && n_targets > HKL_SERVER_MAX_BATCH)
+		hkl_server_error(error, "too many targets");
+	else if(NULL != engine){
+		size_t n_axes = darray_size(*hkl_geometry_axis_names_get(ctx->geometry));
+		double *axes = g_new(double, (size_t)n_targets * n_axes);
+		int *valid = g_new0(int, n_targets);
+
+		g_mutex_lock(&ctx->mutex);
+		if(flags & HKL_SERVER_SOLVE_TRAJECTORY)
+			res = hkl_engine_pseudo_axis_values_set_trajectory(engine,
+									   targets, n_targets, n_values,
+									   HKL_UNIT_USER,
+									   axes, n_axes, valid,
+									   n_solver_threads, error);
+		else
+			res = hkl_engine_pseudo_axis_values_set_batch(engine,
+								      targets, n_targets, n_values,
+								      HKL_UNIT_USER,
+								      axes, n_axes, valid,
+								      n_solver_threads, error);
+		g_mutex_unlock(&ctx->mutex);
+
+		if(res){
+			put_uint(answer, n_axes);
+			put_doubles(answer, axes, (size_t)n_targets * n_axes);
+			for(i=0; i<n_targets; ++i)
+				put_uint(answer, valid[i]);
+		}
+
+		g_free(valid);
+		g_free(axes);
+	}
+
+	g_free(targets);
+	if(NULL != ctx)
+		hkl_server_context_unref(ctx);
+
+	return res;
+}
+
+static int hkl_server_forward(struct HklServerReader *reader, GByteArray *answer,
+			      GError **error)
+{
+	int res = FALSE;
+	size_t i;
+	HklServerContext *ctx = NULL;
+	HklEngine *engine = hkl_server_engine_get(reader, &ctx, error);
+	guint32 n_positions = get_uint(reader);
+	guint32 n_axes = get_uint(reader);
+	double *positions = get_doubles(reader, (size_t)n_positions * n_axes);
+
+	if(NULL != engine && (!reader->ok || 0 == n_positions))
+		hkl_server_error(error, "truncated request or no position");
+	else if(NULL != engine && n_positions > HKL_SERVER_MAX_BATCH)
+		hkl_server_error(error, "too many positions");
+	else if(NULL != engine){
+		size_t n_values = hkl_engine_len(engine);
+		double *values = g_new(double, (size_t)n_positions * n_values);
+		int *valid = g_new0(int, n_positions);
+
+		g_mutex_lock(&ctx->mutex);
+		res = hkl_engine_pseudo_axis_values_get_batch(engine,
+							      positions, n_positions, n_axes,
+							      HKL_UNIT_USER,
+							      values, n_values, valid,
+							      n_solver_threads, error);
+		g_mutex_unlock(&ctx->mutex);
+
+		if(res){
+			put_uint(answer, n_values);
+			put_doubles(answer, values, (size_t)n_positions * n_values);
+			for(i=0; i<n_positions; ++i)
+				put_uint(answer, valid[i]);
+		}
+
+		g_free(valid);
+		g_free(values);
+	}
+
+	g_free(positions);
+	if(NULL != ctx)
+		hkl_server_context_unref(ctx);
+
+	return res;
+}
+
+static int hkl_server_unload(struct HklServerReader *reader, GByteArray *answer,
+			     GError **error)
+{
+	guint64 id = get_uint64(reader);
+
+	if(!reader->ok){
+		hkl_server_error(error, "truncated request");
+		return FALSE;
+	}
+	hkl_server_contexts_unload(id);
+
+	return TRUE;
+}
+
+/* connections */
+
+static int read_all(int fd, void *data, size_t n)
+{
+	guint8 *p = data;
+
+	while(n > 0){
+		ssize_t r = read(fd, p, n);
+
+		if(r <= 0)
+			return FALSE;
+		p += r;
+		n -= r;
+	}
+
+	return TRUE;
+}
+
+static int write_all(int fd, const void *data, size_t n)
+{
+	const guint8 *p = data;
+
+	while(n > 0){
+		ssize_t w = write(fd, p, n);
+
+		if(w <= 0)
+			return FALSE;
+		p += w;
+		n -= w;
+	}
+
+	return TRUE;
+}
+
+static int hkl_server_answer(int fd, HklServerStatus status, const GByteArray *payload)
+{
+	guint32 header[2] = {GUINT32_TO_LE(status), GUINT32_TO_LE(payload->len)};
+
+	return write_all(fd, HKL_SERVER_MAGIC, 4)
+		&& write_all(fd, header, sizeof(header))
+		&& write_all(fd, payload->data, payload->len);
+}
+
+/* serve the requests of a client until it disconnects */
+static void hkl_server_connection(gpointer data, gpointer user_data)
+{
+	int fd = GPOINTER_TO_INT(data) - 1;
+
+	for(;;){
+		char magic[4];
+		guint32 header[2];
+		guint8 *payload;
+		int res;
+		struct HklServerReader reader;
+		GByteArray *answer;
+		GError *error = NULL;
+
+		if(!read_all(fd, magic, sizeof(magic))
+		   || memcmp(magic, HKL_SERVER_MAGIC, sizeof(magic))
+		   || !read_all(fd, header, sizeof(header)))
+			break;
+		header[0] = GUINT32_FROM_LE(header[0]);
+		header[1] = GUINT32_FROM_LE(header[1]);
+		if(header[1] > HKL_SERVER_MAX_PAYLOAD)
+			break;
+
+		payload = g_malloc(header[1]);
+		if(!read_all(fd, payload, header[1])){
+			g_free(payload);
+			break;
+		}
+
+		reader.data = payload;
+		reader.len = header[1];
+		reader.pos = 0;
+		reader.ok = TRUE;
+		answer = g_byte_array_new();
+
+		switch(header[0]){
+		case HKL_SERVER_REQUEST_LOAD:
+			res = hkl_server_load(&reader, answer, &error);
+			break;
+		case HKL_SERVER_REQUEST_SOLVE:
+			res = hkl_server_solve(&reader, answer, &error);
+			break;
+		case HKL_SERVER_REQUEST_FORWARD:
+			res = hkl_server_forward(&reader, answer, &error);
+			break;
+		case HKL_SERVER_REQUEST_UNLOAD:
+			res = hkl_server_unload(&reader, answer, &error);
+			break;
+		default:
+			hkl_server_error(&error, "unknown request");
+			res = FALSE;
+		}
+
+		if(!res){
+			g_byte_array_set_size(answer, 0);
+			put_string(answer, error ? error->message : "failed");
+		}
+		if(error)
+			g_error_free(error);
+		g_free(payload);
+
+		res = hkl_server_answer(fd, res ? HKL_SERVER_STATUS_OK : HKL_SERVER_STATUS_ERROR, answer);
+		g_byte_array_free(answer, TRUE);
+		if(!res)
+			break;
+	}
+
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	int fd, one = 1;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	char address[INET_ADDRSTRLEN];
+	GError *error = NULL;
+	GOptionContext *options;
+	GThreadPool *pool;
+
+	options = g_option_context_new("- solve the batches of the hkl clients");
+	g_option_context_add_main_entries(options, entries, NULL);
+	if(!g_option_context_parse(options, &argc, &argv, &error)){
+		fprintf(stderr, "%s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(options);
+
+	if(n_connections <= 0)
+		n_connections = g_get_num_processors();
+
+	g_mutex_init(&server.mutex);
+	server.contexts = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+						(GDestroyNotify)hkl_server_context_unref);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0){
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	/* only the local clients unless asked otherwise */
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if(NULL != bind_address
+	   && 1 != inet_pton(AF_INET, bind_address, &addr.sin_addr)){
+		fprintf(stderr, "Can not parse the address %s\n", bind_address);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	   || listen(fd, 64) < 0
+	   || getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0){
+		fprintf(stderr, "Can not listen on the port %d\n", port);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	/* the clients started with --port 0 read the port here */
+	inet_ntop(AF_INET, &addr.sin_addr, address, sizeof(address));
+	fprintf(stdout, "hkl-server listening on %s:%d\n", address, ntohs(addr.sin_port));
+	fflush(stdout);
+
+	pool = g_thread_pool_new(hkl_server_connection, NULL, n_connections, FALSE, NULL);
+
+	for(;;){
+		int client = accept(fd, NULL, NULL);
+
+		if(client < 0)
+			continue;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		g_thread_pool_push(pool, GINT_TO_POINTER(client + 1), NULL);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -21,6 +21,7 @@ Copyright (C) 2012-2013, 2023 Synchrotron SOLEIL
 Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
 """
 
+import array
 import math
 import unittest
 from gi.repository import GLib
@@ -185,10 +186,26 @@ class TestAPI(unittest.TestCase):
                 for item in solutions.items():
                     self.assertTrue(type(item) is Hkl.GeometryListItem)
                     self.assertTrue(type(item.geometry_get()) is Hkl.Geometry)
+                # all the axes values at once
+                flat, n_axes = solutions.axis_values_get(Hkl.UnitEnum.USER)
+                self.assertTrue(len(flat) == len(solutions.items()) * n_axes)
+                first = solutions.items()[0].geometry_get()
+                self.assertTrue(flat[:n_axes] == first.axis_values_get(Hkl.UnitEnum.USER))
+                buffer, n_axes = solutions.axis_values_get_as_bytes(Hkl.UnitEnum.USER)
+                self.assertTrue(buffer.get_size() == len(flat) * 8)
                 values[1] += .01
             except GLib.GError as err:
                 print(values, err)
 
+        # solve many targets at once, in native buffers
+        targets = array.array('d', values * 10)
+        axes, valid = hkl.pseudo_axis_values_set_batch(GLib.Bytes.new(targets.tobytes()),
+                                                        Hkl.UnitEnum.USER, 2)
+        axes = array.array('d', axes.get_data())
+        valid = array.array('i', valid.get_data())
+        self.assertTrue(len(valid) == 10)
+        self.assertTrue(len(axes) == 10 * len(geometry.axis_names_get()))
+
         # check that all the values computed are reachable
         for engine in engines.engines_get():
             self.assertTrue(type(engine) is Hkl.Engine)
@@ -19,186 +19,496 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <time.h>
 #include <tap/basic.h>
 #include "hkl.h"
+#ifdef HKL_BENCH_BINOCULARS
+# include "hkl-binoculars.h"
+#endif
 
-static void hkl_test_bench_run_real(HklEngine *engine, HklGeometry *geometry,
-				    size_t n_values, double values[n_values],
-                                    size_t n)
+/* BEWARE THESE BENCHMARKS ARE DEALING WITH HKL INTERNALS WHICH EXPOSE
+ * A NON PUBLIC API WHICH ALLOW TO SHOOT YOURSELF IN YOUR FOOT */
+
+#include "hkl-geometry-private.h"
+
+/*
+ * usage: hkl-bench-t [n [output.json [seed]]]
+ *
+ * each benchmark is run BENCH_WARMUP times untimed, then n times. The
+ * durations are measured with the monotonic clock in ns, and the
+ * results are written as JSON, on stdout by default, so they can be
+ * tracked over the releases. The random targets only depend on the
+ * seed.
+ *
+ * When run by runtests -t, C_TAP_TIMINGS is set and the median of each
+ * benchmark is also reported as a "# timing <key> <seconds>" line, so
+ * runtests can compare it with its baseline. The JSON is then only
+ * written if an output file is given.
+ */
+
+#define BENCH_WARMUP 5
+#define BENCH_SEED 1
+
+struct bench_t
 {
-	size_t i;
-	const darray_string *modes = hkl_engine_modes_names_get(engine);
-	const char **mode;
+	size_t n;
+	size_t failures;
+	uint64_t *samples; /* ns */
+};
 
-	/* pseudo -> geometry */
-	darray_foreach(mode, *modes){
-		double min, max, mean;
-		const darray_string *parameters;
-		size_t n_params;
+struct bench_output_t
+{
+	FILE *f; /* the JSON output, NULL if none */
+	size_t n; /* the number of benchmarks already written */
+	int timings; /* report the timings to runtests */
+};
 
-		if (FALSE == hkl_engine_current_mode_set(engine, *mode, NULL))
-			continue;
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
 
-		parameters = hkl_engine_parameters_names_get(engine);
-		n_params = darray_size(*parameters);
-		if (n_params){
-			double params[n_params];
-
-			hkl_engine_parameters_values_get(engine,
-							 params, n_params,
-							 HKL_UNIT_DEFAULT);
-			values[0] = 1;
-			if(FALSE == hkl_engine_parameters_values_set(engine,
-								     params, n_params,
-								     HKL_UNIT_DEFAULT, NULL))
-				continue;
-		}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-		mean = max = 0;
-		min = 1000; /* arbitrary value always greater than the real min */
-		for(i=0; i<n; ++i){
-			struct timeval debut, fin, dt;
-			double t;
-			HklGeometryList *solutions;
-
-			if(FALSE == hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 0., 0., 0., 0., 10., 10.))
-				break;
-			gettimeofday(&debut, NULL);
-			solutions = hkl_engine_pseudo_axis_values_set(engine, values, n_values, HKL_UNIT_DEFAULT, NULL);
-			if (NULL != solutions)
-				hkl_geometry_list_free(solutions);
-			gettimeofday(&fin, NULL);
-			timersub(&fin, &debut, &dt);
-			t = dt.tv_sec * 1000. + dt.tv_usec / 1000.;
-			min = t < min ? t : min;
-			max = t > max ? t : max;
-			mean += t;
-		}
-		fprintf(stdout, "\"%s\" \"%s\" \"%s\" (%zd/%zd) iterations %f / %f / %f [min/mean/max] ms each\n",
-			hkl_geometry_name_get(geometry),
-			hkl_engine_name_get(engine),
-			*mode, n, i, min, mean/n, max);
-	}
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
 }
 
-static void hkl_test_bench_run_v(HklEngineList *engines, HklGeometry *geometry,
-				 char const *name, int n, size_t n_values, ...)
+static void bench_init(struct bench_t *self, size_t n)
 {
-	va_list ap;
-	size_t i;
-	HklEngine *engine = hkl_engine_list_engine_get_by_name(engines, name, NULL);
-	double values[n_values];
-
-	va_start(ap, n_values);
-	for(i=0; i<n_values; ++i)
-		values[i] = va_arg(ap, double);
-	va_end(ap);
+	self->n = 0;
+	self->failures = 0;
+	self->samples = g_new(uint64_t, n);
+}
 
-	hkl_test_bench_run_real(engine, geometry, n_values, values, n);
+static void bench_release(struct bench_t *self)
+{
+	g_free(self->samples);
 }
 
-static void hkl_test_bench_k6c(int n)
+static void bench_add(struct bench_t *self, uint64_t t0, int ok)
 {
-	const HklFactory *factory;
-	HklEngineList *engines;
-	HklGeometry *geom;
-	HklDetector *detector;
-	HklSample *sample;
+	self->samples[self->n++] = bench_now() - t0;
+	if(!ok)
+		self->failures++;
+}
 
-	factory = hkl_factory_get_by_name("K6C", NULL);
+static int bench_cmp(const void *a, const void *b)
+{
+	const uint64_t *t1 = a;
+	const uint64_t *t2 = b;
 
-	geom = hkl_factory_create_new_geometry(factory);
+	return (*t1 > *t2) - (*t1 < *t2);
+}
 
-	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+/* nearest-rank percentile of the sorted samples */
+static uint64_t bench_percentile(const struct bench_t *self, unsigned int p)
+{
+	size_t rank = (p * self->n + 99) / 100;
 
-	sample = hkl_sample_new("test");
+	return self->samples[rank > 0 ? rank - 1 : 0];
+}
 
-	engines = hkl_factory_create_new_engine_list(factory);
-	hkl_engine_list_init(engines, geom, detector, sample);
+/* the "# timing" line of a benchmark, the blanks are not allowed in the key */
+static void bench_timing(const struct bench_t *self, const char *name,
+			 const char *factory, const char *engine, const char *mode)
+{
+	const char *parts[] = {name, factory, engine, mode};
+	size_t i;
 
-	hkl_test_bench_run_v(engines, geom, "hkl", n, 3, 1., 0., 0.);
-	hkl_test_bench_run_v(engines, geom, "eulerians", n, 3, 0., 90*HKL_DEGTORAD, 0.);
-	hkl_test_bench_run_v(engines, geom, "psi", n, 1, 10.*HKL_DEGTORAD);
-	hkl_test_bench_run_v(engines, geom, "q2", n, 2, 1., 10.*HKL_DEGTORAD);
-	hkl_test_bench_run_v(engines, geom, "qper_qpar", n, 2, 1., 1.);
+	printf("# timing ");
+	for(i=0; i<ARRAY_SIZE(parts); ++i){
+		const char *c;
 
-	hkl_engine_list_free(engines);
-	hkl_sample_free(sample);
-	hkl_detector_free(detector);
-	hkl_geometry_free(geom);
+		if(NULL == parts[i])
+			continue;
+		if(i > 0)
+			putchar('/');
+		for(c=parts[i]; *c; ++c)
+			putchar(' ' == *c ? '_' : *c);
+	}
+	printf(" %.9g\n", bench_percentile(self, 50) / 1e9);
 }
 
-static void hkl_test_bench_eulerians(void)
+static void bench_output(struct bench_output_t *output, struct bench_t *self,
+			 const char *name, const char *factory,
+			 const char *engine, const char *mode)
 {
-	HklEngineList *engines;
-	HklEngine *engine;
-	const char **mode;
-	const darray_string *modes;
-	const HklFactory *factory;
-	HklGeometry *geometry;
-	HklDetector *detector;
-	HklSample *sample;
-
-	factory = hkl_factory_get_by_name("K6C", NULL);
+	FILE *f = output->f;
+	uint64_t sum = 0;
+	size_t i;
 
-	geometry = hkl_factory_create_new_geometry(factory);
-	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	if(0 == self->n)
+		return;
+
+	qsort(self->samples, self->n, sizeof(*self->samples), bench_cmp);
+	for(i=0; i<self->n; ++i)
+		sum += self->samples[i];
+
+	if(output->timings)
+		bench_timing(self, name, factory, engine, mode);
+	if(NULL == f)
+		return;
+
+	fprintf(f, "%s\n    {\"name\": \"%s\"", output->n ? "," : "", name);
+	if(factory)
+		fprintf(f, ", \"factory\": \"%s\"", factory);
+	if(engine)
+		fprintf(f, ", \"engine\": \"%s\"", engine);
+	if(mode)
+		fprintf(f, ", \"mode\": \"%s\"", mode);
+	fprintf(f, ", \"n\": %zu, \"failures\": %zu", self->n, self->failures);
+	fprintf(f, ", \"min_ns\": %" PRIu64 ", \"mean_ns\": %" PRIu64,
+		self->samples[0], sum / self->n);
+	fprintf(f, ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64,
+		bench_percentile(self, 50), bench_percentile(self, 90), bench_percentile(self, 99));
+	fprintf(f, ", \"max_ns\": %" PRIu64 "}", self->samples[self->n - 1]);
+
+	output->n++;
+}
 
-	sample = hkl_sample_new("test");
-	engines = hkl_factory_create_new_engine_list(factory);
-	hkl_engine_list_init(engines, geometry, detector, sample);
+/* pseudo axes get and set */
 
-	engine = hkl_engine_list_engine_get_by_name(engines, "eulerians", NULL);
-	modes = hkl_engine_modes_names_get(engine);
+static void bench_mode(struct bench_output_t *output,
+		       const HklFactory *factory, HklEngineList *engines,
+		       HklEngine *engine, const char *mode, size_t n)
+{
+	HklGeometry *geometry = hkl_engine_list_geometry_get(engines);
+	size_t n_axes = darray_size(*hkl_geometry_axis_names_get(geometry));
+	size_t n_values = hkl_engine_len(engine);
+	double *targets = g_new(double, (BENCH_WARMUP + n) * n_values);
+	double *axes = g_new(double, (BENCH_WARMUP + n) * n_axes);
+	struct bench_t get, set;
+	size_t i, n_targets = 0, tries;
+
+	/* reachable targets, the pseudo axes of random geometries */
+	for(tries=0; tries<10 * (BENCH_WARMUP + n) && n_targets < BENCH_WARMUP + n; ++tries){
+		hkl_geometry_randomize(geometry);
+		if(!hkl_engine_pseudo_axis_values_get(engine, &targets[n_targets * n_values], n_values,
+						      HKL_UNIT_DEFAULT, NULL))
+			continue;
+		hkl_geometry_axis_values_get(geometry, &axes[n_targets * n_axes], n_axes,
+					     HKL_UNIT_DEFAULT);
+		n_targets++;
+	}
 
-	darray_foreach(mode, *modes){
-		static double values[3] = {0, 90 * HKL_DEGTORAD, 0};
+	bench_init(&get, n_targets);
+	bench_init(&set, n_targets);
+	for(i=0; i<n_targets; ++i){
+		double values[n_values];
 		HklGeometryList *solutions;
+		uint64_t t0;
+		int ok;
 
-		if(FALSE == hkl_engine_current_mode_set(engine, *mode, NULL))
+		/* get at the geometry of the target */
+		if(!hkl_geometry_axis_values_set(geometry, &axes[i * n_axes], n_axes,
+						 HKL_UNIT_DEFAULT, NULL))
 			continue;
-
-		/* studdy this degenerated case */
-		solutions = hkl_engine_pseudo_axis_values_set(engine,
-							      values, ARRAY_SIZE(values),
+		t0 = bench_now();
+		ok = hkl_engine_pseudo_axis_values_get(engine, values, n_values,
+						       HKL_UNIT_DEFAULT, NULL);
+		if(i >= BENCH_WARMUP)
+			bench_add(&get, t0, ok);
+
+		/* set from the geometry of the previous target */
+		if(i > 0 && !hkl_geometry_axis_values_set(geometry, &axes[(i - 1) * n_axes], n_axes,
+							  HKL_UNIT_DEFAULT, NULL))
+			continue;
+		t0 = bench_now();
+		solutions = hkl_engine_pseudo_axis_values_set(engine, &targets[i * n_values], n_values,
 							      HKL_UNIT_DEFAULT, NULL);
-		if (solutions) {
-			const HklGeometryListItem *item;
-
-			HKL_GEOMETRY_LIST_FOREACH(item, solutions){
-				hkl_geometry_set(geometry,
-						 hkl_geometry_list_item_geometry_get(item));
-				if(FALSE == hkl_engine_pseudo_axis_values_get(engine, values, ARRAY_SIZE(values),
-									      HKL_UNIT_DEFAULT, NULL))
-					break;
-			}
+		if(i >= BENCH_WARMUP)
+			bench_add(&set, t0, NULL != solutions);
+		if(NULL != solutions)
 			hkl_geometry_list_free(solutions);
+	}
+
+	bench_output(output, &get, "hkl_engine_pseudo_axis_values_get",
+		     hkl_factory_name_get(factory), hkl_engine_name_get(engine), mode);
+	bench_output(output, &set, "hkl_engine_pseudo_axis_values_set",
+		     hkl_factory_name_get(factory), hkl_engine_name_get(engine), mode);
+
+	bench_release(&set);
+	bench_release(&get);
+	g_free(axes);
+	g_free(targets);
+}
+
+static void bench_factories(struct bench_output_t *output, size_t n)
+{
+	size_t i, n_factories;
+	HklFactory **factories = hkl_factory_get_all(&n_factories);
+
+	for(i=0; i<n_factories; ++i){
+		const HklFactory *factory = factories[i];
+		HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+		HklEngineList *engines = hkl_factory_create_new_engine_list(factory);
+		HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+		HklSample *sample = hkl_sample_new("test");
+		HklEngine **engine;
+		darray_engine *darray_engines;
+
+		hkl_engine_list_init(engines, geometry, detector, sample);
+
+		darray_engines = hkl_engine_list_engines_get(engines);
+		darray_foreach(engine, *darray_engines){
+			const darray_string *modes = hkl_engine_modes_names_get(*engine);
+			const char **mode;
+
+			darray_foreach(mode, *modes){
+				if(!hkl_engine_current_mode_set(*engine, *mode, NULL))
+					continue;
+				bench_mode(output, factory, engines, *engine, *mode, n);
+			}
 		}
+
+		hkl_engine_list_free(engines);
+		hkl_sample_free(sample);
+		hkl_detector_free(detector);
+		hkl_geometry_free(geometry);
 	}
+}
+
+/* UB fit */
 
-	hkl_engine_list_free(engines);
+static void bench_affine(struct bench_output_t *output, size_t n)
+{
+	static const struct {
+		double values[4];
+		double hkl[3];
+	} reflections[] = {
+		{{30., 0., 90., 60.}, {1, 0, 0}},
+		{{30., 90., 0., 60.}, {0, 1, 0}},
+		{{30., 0., 0., 60.}, {0, 0, 1}},
+		{{60., 60., 60., 60.}, {.625, .75, -.216506350946}},
+		{{45., 45., 45., 60.}, {.665975615037, .683012701892, .299950211252}},
+	};
+	const HklFactory *factory = hkl_factory_get_by_name("E4CV", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	HklSample *sample = hkl_sample_new("test");
+	HklLattice *lattice;
+	struct bench_t simplex, lm;
+	size_t i;
+
+	lattice = hkl_lattice_new(1.5, 1.6, 1.5,
+				  91 * HKL_DEGTORAD, 89 * HKL_DEGTORAD, 90 * HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+	for(i=0; i<ARRAY_SIZE(reflections); ++i){
+		if(!hkl_geometry_axis_values_set(geometry,
+						 (double *)reflections[i].values,
+						 ARRAY_SIZE(reflections[i].values),
+						 HKL_UNIT_USER, NULL))
+			continue;
+		hkl_sample_add_reflection(sample,
+					  hkl_sample_reflection_new(geometry, detector,
+								    reflections[i].hkl[0],
+								    reflections[i].hkl[1],
+								    reflections[i].hkl[2],
+								    NULL));
+	}
+
+	bench_init(&simplex, n);
+	bench_init(&lm, n);
+	for(i=0; i<BENCH_WARMUP + n; ++i){
+		HklSample *copy = hkl_sample_new_copy(sample);
+		uint64_t t0;
+		int ok;
+
+		t0 = bench_now();
+		ok = hkl_sample_affine(copy, NULL);
+		if(i >= BENCH_WARMUP)
+			bench_add(&simplex, t0, ok);
+		hkl_sample_free(copy);
+
+		copy = hkl_sample_new_copy(sample);
+		t0 = bench_now();
+		ok = hkl_sample_affine_levenberg_marquardt(copy, NULL, 0, NULL);
+		if(i >= BENCH_WARMUP)
+			bench_add(&lm, t0, ok);
+		hkl_sample_free(copy);
+	}
+
+	bench_output(output, &simplex, "hkl_sample_affine", "E4CV", NULL, NULL);
+	bench_output(output, &lm, "hkl_sample_affine_levenberg_marquardt", "E4CV", NULL, NULL);
+
+	bench_release(&lm);
+	bench_release(&simplex);
 	hkl_sample_free(sample);
 	hkl_detector_free(detector);
 	hkl_geometry_free(geometry);
 }
 
+/* HklGeometryList */
+
+static void bench_geometry_list(struct bench_output_t *output, size_t n)
+{
+	const HklFactory *factory = hkl_factory_get_by_name("E6C", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklGeometry *ref = hkl_factory_create_new_geometry(factory);
+	struct bench_t multiply, sort;
+	size_t i, j;
+
+	bench_init(&multiply, n);
+	bench_init(&sort, n);
+	for(i=0; i<BENCH_WARMUP + n; ++i){
+		HklGeometryList *list = hkl_geometry_list_new();
+		uint64_t t0;
+
+		for(j=0; j<10; ++j){
+			hkl_geometry_randomize(geometry);
+			hkl_geometry_list_add(list, geometry);
+		}
+
+		t0 = bench_now();
+		hkl_geometry_list_multiply_from_range(list);
+		if(i >= BENCH_WARMUP)
+			bench_add(&multiply, t0, TRUE);
+
+		hkl_geometry_randomize(ref);
+		t0 = bench_now();
+		hkl_geometry_list_sort(list, ref);
+		if(i >= BENCH_WARMUP)
+			bench_add(&sort, t0, TRUE);
+
+		hkl_geometry_list_free(list);
+	}
+
+	bench_output(output, &multiply, "hkl_geometry_list_multiply_from_range", "E6C", NULL, NULL);
+	bench_output(output, &sort, "hkl_geometry_list_sort", "E6C", NULL, NULL);
+
+	bench_release(&sort);
+	bench_release(&multiply);
+	hkl_geometry_free(ref);
+	hkl_geometry_free(geometry);
+}
+
+/* binoculars */
+
+#ifdef HKL_BENCH_BINOCULARS
+
+static void bench_binoculars(struct bench_output_t *output, size_t n)
+{
+	HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklBinocularsCube *cube = hkl_binoculars_cube_new_empty();
+	HklBinocularsSpace *space;
+	double *pixels_coordinates;
+	uint8_t *mask;
+	uint32_t *img;
+	size_t arr_size;
+	int width, height;
+	ptrdiff_t min = -0.45 / 0.05, max = 0.45 / 0.05;
+	HklBinocularsAxisLimits *lims = hkl_binoculars_axis_limits_new(&min, &max);
+	const HklBinocularsAxisLimits *limits[] = {lims, lims, lims};
+	double resolutions[] = {0.05, 0.05, 0.05};
+	struct bench_t project, add;
+	size_t i;
+
+	hkl_binoculars_detector_2d_shape_get(0, &width, &height);
+	space = hkl_binoculars_space_new(width * height, 3);
+	pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(0);
+	mask = hkl_binoculars_detector_2d_mask_get(0);
+	img = hkl_binoculars_detector_2d_fake_image_uint32(0, &arr_size);
+
+	bench_init(&project, n);
+	bench_init(&add, n);
+	for(i=0; i<BENCH_WARMUP + n; ++i){
+		size_t pixels_coordinates_dims[] = {3, height, width};
+		uint64_t t0;
+
+		hkl_geometry_randomize(geometry);
+
+		t0 = bench_now();
+		hkl_binoculars_space_qcustom_uint32_t (space,
+						       geometry,
+						       img,
+						       arr_size,
+						       1.0,
+						       pixels_coordinates,
+						       ARRAY_SIZE(pixels_coordinates_dims),
+						       pixels_coordinates_dims,
+						       resolutions,
+						       ARRAY_SIZE(resolutions),
+						       mask,
+						       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+						       limits,
+						       ARRAY_SIZE(limits),
+						       0.0,
+						       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+						       0, 0, 0,
+						       "omega",
+						       0);
+		if(i >= BENCH_WARMUP)
+			bench_add(&project, t0, TRUE);
+
+		t0 = bench_now();
+		hkl_binoculars_cube_add_space(cube, space);
+		if(i >= BENCH_WARMUP)
+			bench_add(&add, t0, TRUE);
+	}
+
+	bench_output(output, &project, "hkl_binoculars_space_qcustom_uint32_t", "ZAXIS", NULL, NULL);
+	bench_output(output, &add, "hkl_binoculars_cube_add_space", "ZAXIS", NULL, NULL);
+
+	bench_release(&add);
+	bench_release(&project);
+	free(img);
+	free(mask);
+	free(pixels_coordinates);
+	hkl_binoculars_cube_free(cube);
+	hkl_binoculars_space_free(space);
+	hkl_binoculars_axis_limits_free(lims);
+	hkl_geometry_free(geometry);
+}
+
+#endif
+
 int main(int argc, char **argv)
 {
-	int n;
+	size_t n = 10;
+	unsigned int seed = BENCH_SEED;
+	struct bench_output_t output = {stdout, 0, NULL != getenv("C_TAP_TIMINGS")};
+	int res = TRUE;
 
 	plan(1);
 
 	if (argc > 1)
 		n = atoi(argv[1]);
-	else
-		n = 10;
-
-	hkl_test_bench_k6c(n);
-	hkl_test_bench_eulerians();
+	if (argc > 2){
+		output.f = fopen(argv[2], "w");
+		res = NULL != output.f;
+	}else if (output.timings)
+		output.f = NULL;
+	if (argc > 3)
+		seed = atoi(argv[3]);
+	srand(seed);
+
+	if (res){
+		if (NULL != output.f)
+			fprintf(output.f, "{\"seed\": %u, \"warmup\": %d, \"iterations\": %zu, \"benchmarks\": [",
+				seed, BENCH_WARMUP, n);
+
+		bench_factories(&output, n);
+		bench_affine(&output, n);
+		bench_geometry_list(&output, n);
+#ifdef HKL_BENCH_BINOCULARS
+		bench_binoculars(&output, n);
+#endif
+
+		if (NULL != output.f){
+			fprintf(output.f, "\n]}\n");
+			if (stdout != output.f)
+				fclose(output.f);
+		}
+	}
 
-	ok(TRUE == TRUE, __func__);
+	ok(res, __func__);
 
 	return 0;
 }
@@ -0,0 +1,263 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hkl-binoculars.h"
+#include <tap/basic.h>
+
+#include <hkl-binoculars-private.h>
+
+/*
+ * usage: hkl-binoculars-bench-t [n_frames [output.json]]
+ *
+ * throughput of the binoculars kernels on the fake images of the
+ * detectors. The qcustom projection is swept over the detectors and
+ * the subprojections, then over the mask density and the number of
+ * threads per frame. The accumulation of the spaces into a cube and
+ * the merge of the cubes are measured too.
+ *
+ * Each measure reports the pixels per second and the bytes moved per
+ * pixel: the image, the coordinates and the mask read, plus the items
+ * written into the space for the not masked pixels.
+ */
+
+#define BENCH_RESOLUTION 0.05
+
+static const unsigned int mask_densities[] = {0, 50, 90}; /* % of masked pixels */
+static const size_t n_threads[] = {1, 2, 4};
+
+struct bench_t
+{
+	FILE *f;
+	size_t n; /* the number of measures already written */
+	size_t n_frames;
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_output(struct bench_t *self, const char *name,
+			 HklBinocularsDetectorEnum detector,
+			 int subprojection, unsigned int mask_density,
+			 size_t threads, size_t n_pixels,
+			 double bytes_per_pixel, double dt)
+{
+	fprintf(self->f, "%s\n    {\"name\": \"%s\", \"detector\": \"%s\"",
+		self->n ? "," : "", name, hkl_binoculars_detector_2d_name_get(detector));
+	if (subprojection >= 0)
+		fprintf(self->f, ", \"subprojection\": %d", subprojection);
+	fprintf(self->f, ", \"mask_density\": %u, \"n_threads\": %zu", mask_density, threads);
+	fprintf(self->f, ", \"n_frames\": %zu, \"pixels\": %zu", self->n_frames, n_pixels);
+	fprintf(self->f, ", \"pixels_per_s\": %g, \"bytes_per_pixel\": %g, \"time_s\": %g}",
+		self->n_frames * n_pixels / dt, bytes_per_pixel, dt);
+
+	self->n++;
+}
+
+/* a deterministic mask with density % of masked pixels */
+static uint8_t *bench_mask(size_t n_pixels, unsigned int density)
+{
+	uint8_t *mask = g_new(uint8_t, n_pixels);
+	size_t i;
+
+	for(i=0; i<n_pixels; ++i)
+		mask[i] = (i * 2654435761u) % 100 < density;
+
+	return mask;
+}
+
+/* project n_frames frames, the spaces are accumulated into the cube
+ * when it is not NULL */
+static double bench_qcustom(const struct bench_t *self,
+			    HklBinocularsDetectorEnum detector,
+			    HklBinocularsQCustomSubProjectionEnum subprojection,
+			    const uint8_t *mask, HklBinocularsCube *cube,
+			    double *bytes_per_pixel, double *dt_cube)
+{
+	HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklBinocularsSpace *space;
+	HklBinocularsAxisLimits *lims;
+	double *pixels_coordinates;
+	uint32_t *img;
+	size_t i, arr_size, items = 0;
+	int width, height;
+	ptrdiff_t min = -0.45 / BENCH_RESOLUTION, max = 0.45 / BENCH_RESOLUTION;
+	double resolutions[] = {BENCH_RESOLUTION, BENCH_RESOLUTION, BENCH_RESOLUTION};
+	double dt = 0;
+
+	lims = hkl_binoculars_axis_limits_new(&min, &max);
+	const HklBinocularsAxisLimits *limits[] = {lims, lims, lims};
+
+	hkl_binoculars_detector_2d_shape_get(detector, &width, &height);
+	space = hkl_binoculars_space_new(width * height, 3);
+	pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(detector);
+	img = hkl_binoculars_detector_2d_fake_image_uint32(detector, &arr_size);
+
+	*dt_cube = 0;
+	srand(1);
+	for(i=0; i<self->n_frames; ++i){
+		size_t pixels_coordinates_dims[] = {3, height, width};
+		double t0;
+
+		hkl_geometry_randomize(geometry);
+
+		t0 = bench_now();
+		hkl_binoculars_space_qcustom_uint32_t (space,
+						       geometry,
+						       img,
+						       arr_size,
+						       1.0,
+						       pixels_coordinates,
+						       ARRAY_SIZE(pixels_coordinates_dims),
+						       pixels_coordinates_dims,
+						       resolutions,
+						       ARRAY_SIZE(resolutions),
+						       mask,
+						       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+						       limits,
+						       ARRAY_SIZE(limits),
+						       0.0,
+						       subprojection,
+						       0, 0, 0,
+						       "omega",
+						       0);
+		dt += bench_now() - t0;
+		items += darray_size(space->items);
+
+		if (NULL != cube){
+			t0 = bench_now();
+			hkl_binoculars_cube_add_space(cube, space);
+			*dt_cube += bench_now() - t0;
+		}
+	}
+
+	*bytes_per_pixel = sizeof(*img) + 3 * sizeof(*pixels_coordinates)
+		+ (NULL != mask ? sizeof(*mask) : 0)
+		+ (double)items / self->n_frames / arr_size * sizeof(HklBinocularsSpacePackedItem);
+
+	free(img);
+	free(pixels_coordinates);
+	hkl_binoculars_space_free(space);
+	hkl_binoculars_axis_limits_free(lims);
+	hkl_geometry_free(geometry);
+
+	return dt;
+}
+
+static void bench_detector(struct bench_t *self, HklBinocularsDetectorEnum detector)
+{
+	HklBinocularsCube *cubes[ARRAY_SIZE(n_threads)];
+	double bytes_per_pixel, dt, dt_cube;
+	size_t i, n_pixels;
+	int width, height;
+
+	hkl_binoculars_detector_2d_shape_get(detector, &width, &height);
+	n_pixels = width * height;
+
+	/* the subprojections */
+	for(i=0; i<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++i){
+		dt = bench_qcustom(self, detector, i, NULL, NULL, &bytes_per_pixel, &dt_cube);
+		bench_output(self, "hkl_binoculars_space_qcustom_uint32_t", detector,
+			     i, 0, 1, n_pixels, bytes_per_pixel, dt);
+	}
+
+	/* the mask density */
+	for(i=0; i<ARRAY_SIZE(mask_densities); ++i){
+		uint8_t *mask = bench_mask(n_pixels, mask_densities[i]);
+
+		dt = bench_qcustom(self, detector, HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+				   mask, NULL, &bytes_per_pixel, &dt_cube);
+		bench_output(self, "hkl_binoculars_space_qcustom_uint32_t", detector,
+			     HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+			     mask_densities[i], 1, n_pixels, bytes_per_pixel, dt);
+		g_free(mask);
+	}
+
+	/* the threads per frame, and the accumulation into a cube */
+	for(i=0; i<ARRAY_SIZE(n_threads); ++i){
+		cubes[i] = hkl_binoculars_cube_new_empty();
+
+		hkl_binoculars_frame_n_threads_set(n_threads[i]);
+		dt = bench_qcustom(self, detector, HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+				   NULL, cubes[i], &bytes_per_pixel, &dt_cube);
+		bench_output(self, "hkl_binoculars_space_qcustom_uint32_t", detector,
+			     HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+			     0, n_threads[i], n_pixels, bytes_per_pixel, dt);
+		bench_output(self, "hkl_binoculars_cube_add_space", detector,
+			     -1, 0, 1, n_pixels, sizeof(HklBinocularsSpacePackedItem), dt_cube);
+	}
+	hkl_binoculars_frame_n_threads_set(1);
+
+	/* the merge of the cubes of the workers, the pixels are the ones
+	 * of all the accumulated frames and the bins do not scale with
+	 * them, so no bytes per pixel */
+	for(i=0; i<ARRAY_SIZE(n_threads); ++i){
+		HklBinocularsCube *merged;
+		double t0 = bench_now();
+
+		merged = hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(n_threads),
+							 (const HklBinocularsCube *const *)cubes,
+							 n_threads[i]);
+		dt = bench_now() - t0;
+		bench_output(self, "hkl_binoculars_cube_new_merge_n", detector,
+			     -1, 0, n_threads[i], ARRAY_SIZE(cubes) * n_pixels, 0, dt);
+		hkl_binoculars_cube_free(merged);
+	}
+
+	for(i=0; i<ARRAY_SIZE(n_threads); ++i)
+		hkl_binoculars_cube_free(cubes[i]);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_t bench = {stdout, 0, 3};
+	int n;
+
+	plan(1);
+
+	if (argc > 1)
+		bench.n_frames = atoi(argv[1]);
+	if (argc > 2)
+		bench.f = fopen(argv[2], "w");
+
+	if (NULL != bench.f){
+		fprintf(bench.f, "{\"benchmarks\": [");
+		for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n)
+			bench_detector(&bench, n);
+		fprintf(bench.f, "\n]}\n");
+		if (stdout != bench.f)
+			fclose(bench.f);
+	}
+
+	ok(NULL != bench.f, __func__);
+
+	return 0;
+}
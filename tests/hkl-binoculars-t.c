@@ -19,6 +19,11 @@
  *
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  */
+#include <arpa/inet.h>
+#include <hdf5.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "hkl-binoculars.h"
 #include <tap/basic.h>
 #include <tap/float.h>
@@ -27,6 +32,8 @@
 #include <hkl-geometry-private.h>
 #include <hkl-axis-private.h>
 #include <hkl-binoculars-private.h>
+#include <hkl-binoculars-cnpy-private.h>
+#include <hkl-binoculars-config-private.h>
 
 static void coordinates_get(void)
 {
@@ -53,6 +60,113 @@ static void coordinates_save(void)
 	ok(res == TRUE, __func__);
 }
 
+/* the cached calibrated coordinates are the computed ones, from the
+ * memory or from the cache directory */
+static void calibrated_coordinates(void)
+{
+        int res = TRUE;
+
+        for(int i=0; i<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++i){
+                int width;
+                int height;
+                size_t nbytes;
+                double *expected = hkl_binoculars_detector_2d_coordinates_get(i);
+                double *arr;
+                double *arr2;
+
+                hkl_binoculars_detector_2d_shape_get(i, &width, &height);
+                nbytes = 3 * width * height * sizeof(*expected);
+                hkl_binoculars_detector_2d_sixs_calibration(i, expected, width, height,
+                                                            width / 2, height / 2, 1.0,
+                                                            0.1, 1);
+
+                hkl_binoculars_detector_2d_coordinates_cache_dir_set("/tmp");
+                arr = hkl_binoculars_detector_2d_calibrated_coordinates_get(i, width / 2, height / 2,
+                                                                            1.0, 0.1, 1);
+                hkl_binoculars_detector_2d_coordinates_cache_dir_set(NULL);
+                arr2 = hkl_binoculars_detector_2d_calibrated_coordinates_get(i, width / 2, height / 2,
+                                                                             1.0, 0.1, 1);
+
+                res &= DIAG(NULL != arr);
+                res &= DIAG(NULL != arr2);
+                res &= DIAG(arr != arr2);
+                if(NULL != arr && NULL != arr2){
+                        res &= DIAG(0 == memcmp(expected, arr, nbytes));
+                        res &= DIAG(0 == memcmp(expected, arr2, nbytes));
+                }
+
+                free(arr2);
+                free(arr);
+                free(expected);
+        }
+	ok(res == TRUE, __func__);
+}
+
+/* the CirPad strips face the sample on its circle of curvature, the
+ * Mythen strips stay on the x = sdd plan */
+static void strip_calibration(void)
+{
+        int res = TRUE;
+        const double radius = 0.64164;
+        int width;
+        int height;
+        double *arr;
+        int i;
+
+        arr = hkl_binoculars_detector_2d_calibrated_coordinates_get(HKL_BINOCULARS_DETECTOR_CIRPAD,
+                                                                   1234, 60, radius, 0, 0);
+        hkl_binoculars_detector_2d_shape_get(HKL_BINOCULARS_DETECTOR_CIRPAD, &width, &height);
+        for(i=0; i<width * height; ++i){
+                double x = arr[i];
+                double y = arr[width * height + i];
+
+                res &= DIAG(fabs(sqrt(x * x + y * y) - radius) < 1e-9);
+        }
+        res &= DIAG(fabs(arr[60 * width + 1234] - radius) < 1e-9);
+        free(arr);
+
+        arr = hkl_binoculars_detector_2d_calibrated_coordinates_get(HKL_BINOCULARS_DETECTOR_MYTHEN,
+                                                                   640, 0, 1.0, 0, 0);
+        hkl_binoculars_detector_2d_shape_get(HKL_BINOCULARS_DETECTOR_MYTHEN, &width, &height);
+        res &= DIAG(1 == height);
+        for(i=0; i<width; ++i)
+                res &= DIAG(fabs(arr[i] - 1.0) < 1e-12);
+        free(arr);
+
+        ok(res == TRUE, __func__);
+}
+
+/* a hot pixel is masked, not a zinger */
+static void hot_pixels(void)
+{
+        int res = TRUE;
+        size_t i, f;
+        uint32_t image[100];
+        uint8_t masked[100] = {0};
+        HklBinocularsHotPixels *hot = hkl_binoculars_detector_2d_hot_pixels_new(ARRAY_SIZE(image), 5);
+
+        masked[3] = 1;
+        for(f=0; f<5; ++f){
+                for(i=0; i<ARRAY_SIZE(image); ++i)
+                        image[i] = 10 + (i + f) % 3;
+                image[3] = 1000;
+                image[42] = 1000;
+                if(2 == f)
+                        image[7] = 100000;
+                res &= DIAG(TRUE == hkl_binoculars_detector_2d_hot_pixels_add_frame_uint32(hot, image));
+        }
+        res &= DIAG(FALSE == hkl_binoculars_detector_2d_hot_pixels_add_frame_uint32(hot, image));
+
+        res &= DIAG(1 == hkl_binoculars_detector_2d_hot_pixels_mask(hot, masked, 10));
+        res &= DIAG(1 == masked[3]);
+        res &= DIAG(1 == masked[42]);
+        res &= DIAG(0 == masked[7]);
+
+        hkl_binoculars_detector_2d_hot_pixels_free(hot);
+
+        ok(res == TRUE, __func__);
+}
+
 static void mask_get(void)
 {
         int res = TRUE;
@@ -75,130 +189,3304 @@ static void mask_save(void)
                 snprintf(buffer, ARRAY_SIZE(buffer), "/tmp/mask_%d.npy", i);
                 hkl_binoculars_detector_2d_mask_save(i, buffer);
         }
-	ok(res == TRUE, __func__);
-}
+	ok(res == TRUE, __func__);
+}
+
+static void mask_mmap(void)
+{
+        int res = TRUE;
+
+        /* use the masks saved by mask_save */
+        for(int i=0; i<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++i){
+                char buffer[256];
+                int width;
+                int height;
+
+                snprintf(buffer, ARRAY_SIZE(buffer), "/tmp/mask_%d.npy", i);
+                hkl_binoculars_detector_2d_shape_get(i, &width, &height);
+
+                uint8_t *arr = hkl_binoculars_detector_2d_mask_load(i, buffer);
+                uint8_t *mapped = hkl_binoculars_detector_2d_mask_mmap(i, buffer);
+
+                res &= DIAG(NULL != arr);
+                res &= DIAG(NULL != mapped);
+                if (NULL != arr && NULL != mapped)
+                        res &= DIAG(0 == memcmp(arr, mapped, width * height));
+
+                hkl_binoculars_detector_2d_mask_munmap(mapped);
+                free(arr);
+        }
+	ok(res == TRUE, __func__);
+}
+
+static void mask_indexes(void)
+{
+        int res = TRUE;
+
+        for(int i=0; i<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++i){
+                int width;
+                int height;
+                size_t j;
+                size_t n_indexes;
+                size_t n_valid = 0;
+                size_t k = 0;
+
+                hkl_binoculars_detector_2d_shape_get(i, &width, &height);
+                size_t n_pixels = width * height;
+                uint8_t *mask = hkl_binoculars_detector_2d_mask_get(i);
+                uint32_t *indexes = hkl_binoculars_detector_2d_mask_indexes_get(mask, n_pixels, &n_indexes);
+
+                /* the not masked pixels in the pixels order */
+                for(j=0; j<n_pixels; ++j){
+                        if(0 == mask[j]){
+                                n_valid++;
+                                if(k < n_indexes)
+                                        res &= DIAG(indexes[k++] == j);
+                        }
+                }
+                res &= DIAG(n_valid == n_indexes);
+                free(indexes);
+
+                /* no mask, all the pixels */
+                indexes = hkl_binoculars_detector_2d_mask_indexes_get(NULL, n_pixels, &n_indexes);
+                res &= DIAG(n_pixels == n_indexes);
+                res &= DIAG(n_pixels - 1 == indexes[n_indexes - 1]);
+
+                /* the roi contains all the not masked pixels */
+                {
+                        size_t row0, row1, col0, col1;
+
+                        if(hkl_binoculars_detector_2d_mask_roi_get(mask, width, height,
+                                                                   &row0, &row1, &col0, &col1)){
+                                res &= DIAG(row1 <= (size_t)height);
+                                res &= DIAG(col1 <= (size_t)width);
+                                for(j=0; j<n_pixels; ++j)
+                                        if(0 == mask[j])
+                                                res &= DIAG(j / width >= row0 && j / width < row1
+                                                            && j % width >= col0 && j % width < col1);
+                        }else
+                                res &= DIAG(0 == n_valid);
+
+                        res &= DIAG(hkl_binoculars_detector_2d_mask_roi_get(NULL, width, height,
+                                                                            &row0, &row1, &col0, &col1));
+                        res &= DIAG(0 == row0 && (size_t)height == row1);
+                        res &= DIAG(0 == col0 && (size_t)width == col1);
+                }
+
+                free(indexes);
+                free(mask);
+        }
+	ok(res == TRUE, __func__);
+}
+
+/* TODO */
+/* static void mask_load(void) */
+/* { */
+/*         const char *fname = "/home/picca/tests-datas/binoculars/sixs/eiger/mask_nxs00007_20191105_15h01.npy"; */
+/*         hkl_binoculars_detector_2d_mask_load(1, fname); */
+/* } */
+
+static void angles_projection(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsCube *cube;
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                ptrdiff_t min, max;
+                HklBinocularsAxisLimits *delta_lims, *gamma_lims, *omega_lims;
+
+                min = 0 / 0.05, max = 0.4 / 0.05;
+                delta_lims = hkl_binoculars_axis_limits_new(&min, &max);
+                min = -0.4 / 0.05, max = 0.4 / 0.05;
+                gamma_lims = hkl_binoculars_axis_limits_new(&min, &max);
+                min = -0.4 / 0.05, max = 0.4 / 0.05;
+                omega_lims = hkl_binoculars_axis_limits_new(&min, &max);
+
+                const HklBinocularsAxisLimits *limits[] = {delta_lims, gamma_lims, omega_lims};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                cube = hkl_binoculars_cube_new_empty();
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+
+                for(i=0; i<3; ++i){
+                        size_t arr_size;
+                        uint32_t *img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                        size_t pixels_coordinates_dims[] = {3, height, width};
+                        double resolutions[] = {1, 1, 1};
+
+                        hkl_geometry_randomize(geometry);
+
+                        hkl_binoculars_space_angles_uint32_t (space,
+                                                              geometry,
+                                                              img,
+                                                              arr_size,
+                                                              1.0,
+                                                              pixels_coordinates,
+                                                              ARRAY_SIZE(pixels_coordinates_dims),
+                                                              pixels_coordinates_dims,
+                                                              resolutions,
+                                                              ARRAY_SIZE(resolutions),
+                                                              mask,
+                                                              limits,
+                                                              ARRAY_SIZE(limits),
+                                                              "omega");
+
+                        hkl_binoculars_cube_add_space(cube, space);
+
+                        free(img);
+                }
+
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+                hkl_binoculars_axis_limits_free(omega_lims);
+                hkl_binoculars_axis_limits_free(gamma_lims);
+                hkl_binoculars_axis_limits_free(delta_lims);
+        }
+
+        hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static int qcustom_projection_sub(HklBinocularsQCustomSubProjectionEnum subprojection)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsCube *cube;
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                ptrdiff_t min, max;
+                HklBinocularsAxisLimits *qx_lims, *qy_lims, *qz_lims;
+
+                min = -0.45 / 0.05, max = 0.45 / 0.05;
+                qx_lims = hkl_binoculars_axis_limits_new(&min, &max);
+                min = -0.45 / 0.05, max = 0.45 / 0.05;
+                qy_lims = hkl_binoculars_axis_limits_new(&min, &max);
+                min = -0.45 / 0.05, max = 0.45 / 0.05;
+                qz_lims = hkl_binoculars_axis_limits_new(&min, &max);
+
+                const HklBinocularsAxisLimits *limits[] = {qx_lims, qy_lims, qz_lims};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                cube = hkl_binoculars_cube_new_empty();
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+
+                for(i=0; i<3; ++i){
+                        size_t arr_size;
+                        uint32_t *img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                        size_t pixels_coordinates_dims[] = {3, height, width};
+                        double resolutions[] = {0.05, 0.05, 0.05};
+
+                        hkl_geometry_randomize(geometry);
+
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               limits,
+                                                               ARRAY_SIZE(limits),
+                                                               0.0,
+                                                               subprojection,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               0);
+
+                        hkl_binoculars_cube_add_space(cube, space);
+
+                        free(img);
+                }
+
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+                hkl_binoculars_axis_limits_free(qz_lims);
+                hkl_binoculars_axis_limits_free(qy_lims);
+                hkl_binoculars_axis_limits_free(qx_lims);
+        }
+
+	hkl_geometry_free(geometry);
+
+        return res;
+}
+
+
+static void qcustom_projection(void)
+{
+        int res = TRUE;
+        int i;
+
+        for(i=0; i<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++i)
+                res &= qcustom_projection_sub(i);
+
+        ok(res == TRUE, __func__);
+}
+
+/* compare the data of two cubes with the same axes, whatever their
+ * storage */
+static int cube_data_equal(const HklBinocularsCube *cube1,
+                           const HklBinocularsCube *cube2)
+{
+        int res;
+        size_t i;
+        size_t size = 1;
+        HklBinocularsCube *c1 = hkl_binoculars_cube_new_copy(cube1);
+        HklBinocularsCube *c2 = hkl_binoculars_cube_new_copy(cube2);
+
+        for(i=0; i<darray_size(c1->axes); ++i)
+                size *= axis_size(&darray_item(c1->axes, i));
+
+        res = 0 == memcmp(c1->photons, c2->photons, size * sizeof(*c1->photons));
+        res &= 0 == memcmp(c1->contributions, c2->contributions, size * sizeof(*c1->contributions));
+
+        hkl_binoculars_cube_free(c2);
+        hkl_binoculars_cube_free(c1);
+
+        return res;
+}
+
+static void cube_accumulate_qcustom(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklGeometry *geometries[3];
+
+        /* the same geometries for the two methods */
+        for(n=0; n<ARRAY_SIZE(geometries); ++n){
+                hkl_geometry_randomize(geometry);
+                geometries[n] = hkl_geometry_new_copy(geometry);
+        }
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                size_t n_outside = 0;
+                int height;
+                int width;
+                HklBinocularsCube *cube, *cube2;
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                cube = hkl_binoculars_cube_new_empty();
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                /* first the usual space -> cube method */
+                for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometries[i],
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               0.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               0);
+
+                        hkl_binoculars_cube_add_space(cube, space);
+                }
+
+                /* then directly into a cube with the right dimensions */
+                cube2 = hkl_binoculars_cube_new_empty_from_cube(cube);
+                for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                        n_outside += hkl_binoculars_cube_accumulate_qcustom_uint32_t (cube2,
+                                                                                      geometries[i],
+                                                                                      img,
+                                                                                      arr_size,
+                                                                                      1.0,
+                                                                                      pixels_coordinates,
+                                                                                      ARRAY_SIZE(pixels_coordinates_dims),
+                                                                                      pixels_coordinates_dims,
+                                                                                      resolutions,
+                                                                                      ARRAY_SIZE(resolutions),
+                                                                                      mask,
+                                                                                      HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                                                      NULL,
+                                                                                      0,
+                                                                                      0.0,
+                                                                                      HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                                                      0, 0, 0,
+                                                                                      "omega",
+                                                                                      0);
+                }
+
+                res &= DIAG(0 == n_outside);
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+
+                res &= DIAG(cube_data_equal(cube, cube2));
+
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_cube_free(cube2);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+        }
+
+        for(n=0; n<ARRAY_SIZE(geometries); ++n)
+                hkl_geometry_free(geometries[n]);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+struct cube_shared_job
+{
+        HklBinocularsCube *cube;
+        const HklGeometry *geometry;
+        const uint32_t *img;
+        size_t arr_size;
+        const double *pixels_coordinates;
+        const size_t *pixels_coordinates_dims;
+        const uint8_t *mask;
+        size_t n_outside;
+};
+
+static size_t cube_shared_accumulate(struct cube_shared_job *job)
+{
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+        return hkl_binoculars_cube_accumulate_qcustom_uint32_t (job->cube,
+                                                                job->geometry,
+                                                                job->img,
+                                                                job->arr_size,
+                                                                1.0,
+                                                                job->pixels_coordinates,
+                                                                3,
+                                                                job->pixels_coordinates_dims,
+                                                                resolutions,
+                                                                ARRAY_SIZE(resolutions),
+                                                                job->mask,
+                                                                HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                                NULL,
+                                                                0,
+                                                                0.0,
+                                                                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                                0, 0, 0,
+                                                                "omega",
+                                                                0);
+}
+
+static gpointer cube_shared_thread(gpointer data)
+{
+        struct cube_shared_job *job = data;
+
+        job->n_outside = cube_shared_accumulate(job);
+
+        return NULL;
+}
+
+static void cube_shared(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometries[4];
+        GThread *threads[ARRAY_SIZE(geometries)];
+        struct cube_shared_job jobs[ARRAY_SIZE(geometries)];
+        HklBinocularsSpace *space;
+        HklBinocularsCube *cube, *shared;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+        hkl_binoculars_detector_2d_shape_get(0, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(0);
+        mask = hkl_binoculars_detector_2d_mask_get(0);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(0, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        /* the reference cube, filled by one thread */
+        for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                geometries[i] = hkl_factory_create_new_geometry(factory);
+                hkl_geometry_randomize(geometries[i]);
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometries[i],
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        /* one shared cube filled by one thread per geometry */
+        shared = hkl_binoculars_cube_new_empty_from_cube(cube);
+        hkl_binoculars_cube_shared_set(shared, TRUE);
+        for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                jobs[i] = (struct cube_shared_job){
+                        .cube = shared,
+                        .geometry = geometries[i],
+                        .img = img,
+                        .arr_size = arr_size,
+                        .pixels_coordinates = pixels_coordinates,
+                        .pixels_coordinates_dims = pixels_coordinates_dims,
+                        .mask = mask,
+                };
+                threads[i] = g_thread_new(NULL, cube_shared_thread, &jobs[i]);
+        }
+        for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                g_thread_join(threads[i]);
+                res &= DIAG(0 == jobs[i].n_outside);
+        }
+
+        res &= DIAG(!hkl_binoculars_cube_cmp(cube, shared));
+        res &= DIAG(cube_data_equal(cube, shared));
+
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_binoculars_cube_free(shared);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        for(i=0; i<ARRAY_SIZE(geometries); ++i)
+                hkl_geometry_free(geometries[i]);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_add_space_shared(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry;
+        HklBinocularsSpace *spaces[4];
+        HklBinocularsCube *cube, *first, *shared, *overflow, *merged;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+        hkl_binoculars_detector_2d_shape_get(0, &width, &height);
+        geometry = hkl_factory_create_new_geometry(factory);
+        cube = hkl_binoculars_cube_new_empty();
+        first = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(0);
+        mask = hkl_binoculars_detector_2d_mask_get(0);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(0, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                spaces[i] = hkl_binoculars_space_new(width * height, 3);
+                hkl_geometry_randomize(geometry);
+                hkl_binoculars_space_qcustom_uint32_t (spaces[i],
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+                hkl_binoculars_cube_add_space(cube, spaces[i]);
+        }
+        res &= DIAG(hkl_binoculars_cube_bytes(cube) > 0);
+
+        /* the shared cube only covers the first space, the others
+         * fall into the overflow cube */
+        hkl_binoculars_cube_add_space(first, spaces[0]);
+        shared = hkl_binoculars_cube_new_empty_from_cube(first);
+        overflow = hkl_binoculars_cube_new_empty();
+        res &= DIAG(0 == hkl_binoculars_cube_bytes(overflow));
+        hkl_binoculars_cube_shared_set(shared, TRUE);
+        for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                hkl_binoculars_cube_add_space_shared(shared, overflow, spaces[i]);
+        hkl_binoculars_cube_shared_set(shared, FALSE);
+
+        merged = hkl_binoculars_cube_new_merge(shared, overflow);
+        res &= DIAG(!hkl_binoculars_cube_cmp(cube, merged));
+        res &= DIAG(cube_data_equal(cube, merged));
+
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_binoculars_cube_free(merged);
+        hkl_binoculars_cube_free(overflow);
+        hkl_binoculars_cube_free(shared);
+        hkl_binoculars_cube_free(first);
+        hkl_binoculars_cube_free(cube);
+        for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                hkl_binoculars_space_free(spaces[i]);
+        hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void space_n_frames(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i, j;
+                int height;
+                int width;
+                HklBinocularsCube *cube, *cube2;
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                uint32_t *sum;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+                const size_t n_frames = 3;
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                cube = hkl_binoculars_cube_new_empty();
+                cube2 = hkl_binoculars_cube_new_empty();
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                sum = malloc(arr_size * sizeof(*sum));
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(j=0; j<arr_size; ++j)
+                        sum[j] = n_frames * img[j];
+
+#define PROJECT(image_) hkl_binoculars_space_qcustom_uint32_t (space, \
+                                                               geometry, \
+                                                               image_, \
+                                                               arr_size, \
+                                                               1.0, \
+                                                               pixels_coordinates, \
+                                                               ARRAY_SIZE(pixels_coordinates_dims), \
+                                                               pixels_coordinates_dims, \
+                                                               resolutions, \
+                                                               ARRAY_SIZE(resolutions), \
+                                                               mask, \
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL, \
+                                                               NULL, \
+                                                               0, \
+                                                               0.0, \
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ, \
+                                                               0, 0, 0, \
+                                                               "omega", \
+                                                               0)
+
+                /* the frames of the same geometry one by one */
+                for(i=0; i<n_frames; ++i){
+                        PROJECT(img);
+                        hkl_binoculars_cube_add_space(cube, space);
+                }
+
+                /* then their sum at once */
+                PROJECT(sum);
+                hkl_binoculars_space_n_frames_set(space, n_frames);
+                hkl_binoculars_cube_add_space(cube2, space);
+#undef PROJECT
+
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+                res &= DIAG(cube_data_equal(cube, cube2));
+
+                free(sum);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_cube_free(cube2);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void qcustom_kf_cache(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklGeometry *other = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+        hkl_geometry_randomize(other);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                size_t n_cubes = 0;
+                int height;
+                int width;
+                HklBinocularsCube *cubes[3];
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+                /* the same frame, computed, cached and after a detector move */
+                const HklGeometry *geometries[] = {geometry, geometry, other, geometry};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(i=0; i<ARRAY_SIZE(geometries); ++i){
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometries[i],
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               0.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               1);
+                        /* skip the frame of the other detector position */
+                        if (geometries[i] != other)
+                                cubes[n_cubes++] = hkl_binoculars_cube_new_from_space(space);
+                }
+
+                for(i=1; i<ARRAY_SIZE(cubes); ++i){
+                        res &= DIAG(!hkl_binoculars_cube_cmp(cubes[0], cubes[i]));
+                        res &= DIAG(cube_data_equal(cubes[0], cubes[i]));
+                }
+
+                for(i=0; i<ARRAY_SIZE(cubes); ++i)
+                        hkl_binoculars_cube_free(cubes[i]);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_space_free(space);
+        }
+
+	hkl_geometry_free(other);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static int space_equal(const HklBinocularsSpace *s1, const HklBinocularsSpace *s2)
+{
+        size_t i;
+
+        if (darray_size(s1->items) != darray_size(s2->items))
+                return FALSE;
+        if (0 == darray_size(s1->items))
+                return TRUE;
+        for(i=0; i<ARRAY_SIZE(s1->origin); ++i)
+                if (s1->origin[i] != s2->origin[i])
+                        return FALSE;
+
+        return 0 == memcmp(&darray_item(s1->items, 0), &darray_item(s2->items, 0),
+                           darray_size(s1->items) * sizeof(darray_item(s1->items, 0)));
+}
+
+static void frame_n_threads(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        const HklBinocularsQCustomSubProjectionEnum subprojections[] = {
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_X_Y_Z,
+        };
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i, j;
+                int height;
+                int width;
+                HklBinocularsSpace *spaces[2];
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+                /* the same frame projected by one and by four threads */
+                const size_t n_threads[] = {1, 4};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        spaces[i] = hkl_binoculars_space_new(width * height, 3);
+
+                for(j=0; j<ARRAY_SIZE(subprojections); ++j){
+                        for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                                hkl_binoculars_frame_n_threads_set(n_threads[i]);
+                                hkl_binoculars_space_qcustom_uint32_t (spaces[i],
+                                                                       geometry,
+                                                                       img,
+                                                                       arr_size,
+                                                                       1.0,
+                                                                       pixels_coordinates,
+                                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                                       pixels_coordinates_dims,
+                                                                       resolutions,
+                                                                       ARRAY_SIZE(resolutions),
+                                                                       mask,
+                                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                                       NULL,
+                                                                       0,
+                                                                       0.0,
+                                                                       subprojections[j],
+                                                                       0, 0, 0,
+                                                                       "omega",
+                                                                       1);
+                        }
+                        res &= DIAG(space_equal(spaces[0], spaces[1]));
+                }
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                        hkl_binoculars_frame_n_threads_set(n_threads[i]);
+                        hkl_binoculars_space_angles_uint32_t (spaces[i],
+                                                              geometry,
+                                                              img,
+                                                              arr_size,
+                                                              1.0,
+                                                              pixels_coordinates,
+                                                              ARRAY_SIZE(pixels_coordinates_dims),
+                                                              pixels_coordinates_dims,
+                                                              resolutions,
+                                                              ARRAY_SIZE(resolutions),
+                                                              mask,
+                                                              NULL,
+                                                              0,
+                                                              "omega");
+                }
+                res &= DIAG(space_equal(spaces[0], spaces[1]));
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        hkl_binoculars_space_free(spaces[i]);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+        hkl_binoculars_frame_n_threads_set(1);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the bins of the approximated angles are the exact ones or their
+ * neighbours */
+static int space_close(const HklBinocularsSpace *s1, const HklBinocularsSpace *s2)
+{
+        size_t i, j;
+
+        if (darray_size(s1->items) != darray_size(s2->items))
+                return FALSE;
+        for(i=0; i<darray_size(s1->items); ++i){
+                const HklBinocularsSpacePackedItem *item1 = &darray_item(s1->items, i);
+                const HklBinocularsSpacePackedItem *item2 = &darray_item(s2->items, i);
+
+                if (item1->intensity != item2->intensity)
+                        return FALSE;
+                for(j=0; j<ARRAY_SIZE(s1->origin); ++j)
+                        if (labs((s1->origin[j] + item1->indexes[j]) - (s2->origin[j] + item2->indexes[j])) > 1)
+                                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void fast_trigonometry(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        const HklBinocularsQCustomSubProjectionEnum subprojections[] = {
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TTH_TIMESTAMP,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_PHI_QZ,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH_AZIMUTH,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_DELTALAB_GAMMALAB_SAMPLEAXIS,
+        };
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i, j;
+                int height;
+                int width;
+                HklBinocularsSpace *spaces[2];
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        spaces[i] = hkl_binoculars_space_new(width * height, 3);
+
+                /* the same frame projected with libm and with the approximations */
+                for(j=0; j<ARRAY_SIZE(subprojections); ++j){
+                        for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                                hkl_binoculars_fast_trigonometry_set(i);
+                                hkl_binoculars_space_qcustom_uint32_t (spaces[i],
+                                                                       geometry,
+                                                                       img,
+                                                                       arr_size,
+                                                                       1.0,
+                                                                       pixels_coordinates,
+                                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                                       pixels_coordinates_dims,
+                                                                       resolutions,
+                                                                       ARRAY_SIZE(resolutions),
+                                                                       mask,
+                                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                                       NULL,
+                                                                       0,
+                                                                       0.0,
+                                                                       subprojections[j],
+                                                                       0, 0, 0,
+                                                                       "omega",
+                                                                       1);
+                        }
+                        res &= DIAG(space_close(spaces[0], spaces[1]));
+                }
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                        hkl_binoculars_fast_trigonometry_set(i);
+                        hkl_binoculars_space_angles_uint32_t (spaces[i],
+                                                              geometry,
+                                                              img,
+                                                              arr_size,
+                                                              1.0,
+                                                              pixels_coordinates,
+                                                              ARRAY_SIZE(pixels_coordinates_dims),
+                                                              pixels_coordinates_dims,
+                                                              resolutions,
+                                                              ARRAY_SIZE(resolutions),
+                                                              mask,
+                                                              NULL,
+                                                              0,
+                                                              "omega");
+                }
+                res &= DIAG(space_close(spaces[0], spaces[1]));
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        hkl_binoculars_space_free(spaces[i]);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+        hkl_binoculars_fast_trigonometry_set(FALSE);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void image_types(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsSpace *spaces[4];
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                uint8_t *img_uint8;
+                int16_t *img_int16;
+                float *img_float;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                /* the same frame in all the pixel types */
+                img_uint8 = g_new(uint8_t, arr_size);
+                img_int16 = g_new(int16_t, arr_size);
+                img_float = g_new(float, arr_size);
+                for(i=0; i<arr_size; ++i){
+                        img[i] &= 0xff;
+                        img_uint8[i] = img[i];
+                        img_int16[i] = img[i];
+                        img_float[i] = img[i];
+                }
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        spaces[i] = hkl_binoculars_space_new(width * height, 3);
+
+#define PROJECT(space_, type_, image_)                                  \
+                hkl_binoculars_space_qcustom_ ## type_ (space_,         \
+                                                        geometry,       \
+                                                        image_,         \
+                                                        arr_size,       \
+                                                        1.0,            \
+                                                        pixels_coordinates, \
+                                                        ARRAY_SIZE(pixels_coordinates_dims), \
+                                                        pixels_coordinates_dims, \
+                                                        resolutions,    \
+                                                        ARRAY_SIZE(resolutions), \
+                                                        mask,           \
+                                                        HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL, \
+                                                        NULL,           \
+                                                        0,              \
+                                                        0.0,            \
+                                                        HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ, \
+                                                        0, 0, 0,        \
+                                                        "omega",        \
+                                                        1)
+
+                PROJECT(spaces[0], uint32_t, img);
+                PROJECT(spaces[1], uint8_t, img_uint8);
+                PROJECT(spaces[2], int16_t, img_int16);
+                PROJECT(spaces[3], float, img_float);
+#undef PROJECT
+
+                for(i=1; i<ARRAY_SIZE(spaces); ++i)
+                        res &= DIAG(space_close(spaces[0], spaces[i]));
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        hkl_binoculars_space_free(spaces[i]);
+                free(img_float);
+                free(img_int16);
+                free(img_uint8);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void corrections(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsSpace *spaces[2];
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                double *dark;
+                double *flatfield;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+                dark = g_new(double, arr_size);
+                flatfield = g_new(double, arr_size);
+                for(i=0; i<arr_size; ++i){
+                        img[i] &= 0xffff;
+                        dark[i] = 1;
+                        flatfield[i] = 2;
+                }
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        spaces[i] = hkl_binoculars_space_new(width * height, 3);
+
+                /* without then with the corrections */
+                for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                        if (1 == i)
+                                hkl_binoculars_corrections_set(arr_size, dark, flatfield, NULL);
+                        hkl_binoculars_space_qcustom_uint32_t (spaces[i],
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               0.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               0);
+                }
+                hkl_binoculars_corrections_set(0, NULL, NULL, NULL);
+
+                res &= DIAG(darray_size(spaces[0]->items) == darray_size(spaces[1]->items));
+                for(i=0; i<darray_size(spaces[0]->items) && TRUE == res; ++i){
+                        const HklBinocularsSpacePackedItem *item0 = &darray_item(spaces[0]->items, i);
+                        const HklBinocularsSpacePackedItem *item1 = &darray_item(spaces[1]->items, i);
+
+                        res &= DIAG(item1->intensity == (item0->intensity - 1) / 2);
+                        res &= DIAG(item1->weight == 0.5f);
+                }
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        hkl_binoculars_space_free(spaces[i]);
+                free(flatfield);
+                free(dark);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void pixel_splitting(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsSpace *spaces[2];
+                double sums[2] = {0, 0};
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+                for(i=0; i<arr_size; ++i)
+                        img[i] &= 0xff;
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        spaces[i] = hkl_binoculars_space_new(width * height, 3);
+
+                /* without splitting then with 2 x 2 sub-pixels */
+                for(i=0; i<ARRAY_SIZE(spaces); ++i){
+                        HklBinocularsSpacePackedItem *item;
+
+                        hkl_binoculars_pixel_splitting_set(1 + i);
+                        hkl_binoculars_space_qcustom_uint32_t (spaces[i],
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               0.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               0);
+                        darray_foreach(item, spaces[i]->items){
+                                sums[i] += item->intensity;
+                        }
+                }
+                hkl_binoculars_pixel_splitting_set(1);
+
+                /* each sub-pixel carries the counts of its pixel */
+                res &= DIAG(4 * darray_size(spaces[0]->items) == darray_size(spaces[1]->items));
+                res &= DIAG(4 * sums[0] == sums[1]);
+
+                for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                        hkl_binoculars_space_free(spaces[i]);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the frames projected from a plan are the ones projected with all
+ * the parameters at each frame */
+static void qcustom_plan(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                int sub;
+                int height;
+                int width;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(sub=0; sub<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++sub){
+                        HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+                        HklBinocularsSpace *space_plan = hkl_binoculars_space_new(width * height, 3);
+                        HklBinocularsQCustomPlan *plan;
+
+                        plan = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               sub,
+                                                               0.1, 0.2, 0.3,
+                                                               "omega",
+                                                               1);
+
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               10.0,
+                                                               sub,
+                                                               0.1, 0.2, 0.3,
+                                                               "omega",
+                                                               1);
+                        hkl_binoculars_space_qcustom_plan_uint32_t(space_plan, plan,
+                                                                   geometry, img,
+                                                                   1.0, 10.0);
+
+                        res &= DIAG(space_equal(space, space_plan));
+
+                        hkl_binoculars_qcustom_plan_free(plan);
+                        hkl_binoculars_space_free(space_plan);
+                        hkl_binoculars_space_free(space);
+                }
+
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the expressions are compiled with their constants folded, and the
+ * expressions subprojection of the qx, qy, timestamp variables
+ * projects like qx_qy_timestamp */
+static void qcustom_expressions(void)
+{
+        size_t n;
+        int res = TRUE;
+        char *error = NULL;
+        HklBinocularsExpression *expression;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        const char *wrongs[] = {"", "qx +", "foo", "sqrt(qx, qy)", "(qx", "qx qy"};
+
+        for(n=0; n<ARRAY_SIZE(wrongs); ++n){
+                expression = hkl_binoculars_expression_new("wrong", wrongs[n], &error);
+                res &= DIAG(NULL == expression);
+                res &= DIAG(NULL != error);
+                g_free(error);
+                error = NULL;
+        }
+
+        {
+                double value;
+                const double *variables[HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES] = {NULL};
+
+                expression = hkl_binoculars_expression_new("k", "-2^2 + atan2(1, 1) * 4 / pi + deg(pi)", NULL);
+                res &= DIAG(NULL != expression);
+                res &= DIAG(0 == hkl_binoculars_expression_variables_get(expression));
+                hkl_binoculars_expression_eval(expression, variables, 1, &value);
+                res &= DIAG(fabs(value - 177) < 1e-12);
+                hkl_binoculars_expression_free(expression);
+        }
+
+        {
+                double qx[] = {3, -3, 0};
+                double qy[] = {4, 4, 0};
+                double values[ARRAY_SIZE(qx)];
+                const double *variables[HKL_BINOCULARS_EXPRESSION_NUM_VARIABLES] = {NULL};
+
+                variables[HKL_BINOCULARS_EXPRESSION_VARIABLE_QX] = qx;
+                variables[HKL_BINOCULARS_EXPRESSION_VARIABLE_QY] = qy;
+                expression = hkl_binoculars_expression_new("qpar", "sqrt(qx^2 + qy ^ 2) + 2 * 0", NULL);
+                res &= DIAG(NULL != expression);
+                hkl_binoculars_expression_eval(expression, variables, ARRAY_SIZE(qx), values);
+                res &= DIAG(fabs(values[0] - 5) < 1e-12);
+                res &= DIAG(fabs(values[1] - 5) < 1e-12);
+                res &= DIAG(fabs(values[2]) < 1e-12);
+                hkl_binoculars_expression_free(expression);
+        }
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                int height;
+                int width;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t i;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+                HklBinocularsExpression *expressions[] = {
+                        hkl_binoculars_expression_new("qx", "qx", NULL),
+                        hkl_binoculars_expression_new("qy", "+qy", NULL),
+                        hkl_binoculars_expression_new("t", "(2 * timestamp) / 2", NULL),
+                };
+                HklBinocularsSpace *space;
+                HklBinocularsSpace *space_expressions;
+                HklBinocularsQCustomPlan *plan;
+                HklBinocularsQCustomPlan *plan_expressions;
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                space = hkl_binoculars_space_new(width * height, 3);
+                space_expressions = hkl_binoculars_space_new(width * height, 3);
+
+                plan = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_TIMESTAMP,
+                                                       0.1, 0.2, 0.3,
+                                                       "omega",
+                                                       1);
+                plan_expressions = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                                   ARRAY_SIZE(pixels_coordinates_dims),
+                                                                   pixels_coordinates_dims,
+                                                                   resolutions,
+                                                                   ARRAY_SIZE(resolutions),
+                                                                   mask,
+                                                                   HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                                   NULL,
+                                                                   0,
+                                                                   HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_EXPRESSIONS,
+                                                                   0.1, 0.2, 0.3,
+                                                                   "omega",
+                                                                   1);
+                hkl_binoculars_qcustom_plan_expressions_set(plan_expressions,
+                                                            (const HklBinocularsExpression *const *)expressions,
+                                                            ARRAY_SIZE(expressions));
+                res &= DIAG(ARRAY_SIZE(expressions) == hkl_binoculars_qcustom_plan_n_axes(plan_expressions));
+
+                hkl_binoculars_space_qcustom_plan_uint32_t(space, plan,
+                                                           geometry, img,
+                                                           1.0, 10.0);
+                hkl_binoculars_space_qcustom_plan_uint32_t(space_expressions, plan_expressions,
+                                                           geometry, img,
+                                                           1.0, 10.0);
+
+                res &= DIAG(darray_size(space->items) > 0);
+                res &= DIAG(space_equal(space, space_expressions));
+                res &= DIAG(0 == strcmp("t", darray_item(space_expressions->axes, 2).name));
+
+                hkl_binoculars_qcustom_plan_free(plan_expressions);
+                hkl_binoculars_qcustom_plan_free(plan);
+                hkl_binoculars_space_free(space_expressions);
+                hkl_binoculars_space_free(space);
+                for(i=0; i<ARRAY_SIZE(expressions); ++i)
+                        hkl_binoculars_expression_free(expressions[i]);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the frames of a static geometry accumulated through a lut give the
+ * same cube than the plan, but the photons rounded per bin */
+static void qcustom_lut(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklGeometry *moved = hkl_factory_create_new_geometry(factory);
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        double timestamps[] = {10.0, 10.0, 11.0};
+        HklBinocularsQCustomSubProjectionEnum subs[] = {
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TTH_TIMESTAMP,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_Q_TIMESTAMP,
+                HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_TTH_AZIMUTH,
+        };
+
+        hkl_geometry_randomize(geometry);
+        hkl_geometry_randomize(moved);
+        hkl_binoculars_detector_2d_shape_get(0, &width, &height);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(0);
+        mask = hkl_binoculars_detector_2d_mask_get(0);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(0, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        hkl_binoculars_cube_weighted_set(TRUE);
+        for(i=0; i<ARRAY_SIZE(subs); ++i){
+                size_t j;
+                size_t n_outside = 0;
+                size_t size = 1;
+                HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+                HklBinocularsCube *cube = hkl_binoculars_cube_new_empty();
+                HklBinocularsCube *cube_lut, *c1, *c2;
+                HklBinocularsQCustomPlan *plan;
+                HklBinocularsQCustomLut *lut;
+
+                plan = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       subs[i],
+                                                       0.1, 0.2, 0.3,
+                                                       "omega",
+                                                       1);
+                lut = hkl_binoculars_qcustom_lut_new(plan, geometry);
+                res &= DIAG(NULL != lut);
+                res &= DIAG(hkl_binoculars_qcustom_lut_match(lut, geometry));
+                res &= DIAG(!hkl_binoculars_qcustom_lut_match(lut, moved));
+
+                for(j=0; j<ARRAY_SIZE(timestamps); ++j){
+                        hkl_binoculars_space_qcustom_plan_uint32_t(space, plan,
+                                                                   geometry, img,
+                                                                   2.0, timestamps[j]);
+                        hkl_binoculars_cube_add_space(cube, space);
+                }
+
+                cube_lut = hkl_binoculars_cube_new_empty_from_cube(cube);
+                for(j=0; j<ARRAY_SIZE(timestamps); ++j)
+                        n_outside += hkl_binoculars_cube_accumulate_qcustom_lut_uint32_t(cube_lut, lut, img,
+                                                                                        2.0, timestamps[j]);
+                res &= DIAG(0 == n_outside);
+
+                c1 = hkl_binoculars_cube_new_copy(cube);
+                c2 = hkl_binoculars_cube_new_copy(cube_lut);
+                for(j=0; j<darray_size(c1->axes); ++j)
+                        size *= axis_size(&darray_item(c1->axes, j));
+                res &= DIAG(0 == memcmp(c1->contributions, c2->contributions, size * sizeof(*c1->contributions)));
+                for(j=0; j<size; ++j){
+                        res &= DIAG(fabs(c1->intensities[j] - c2->intensities[j]) <= 1e-5 * fabs(c1->intensities[j]) + 1e-6);
+                        res &= DIAG(fabs(c1->variances[j] - c2->variances[j]) <= 1e-5 * fabs(c1->variances[j]) + 1e-6);
+                        res &= DIAG(fabs((double)c1->photons[j] - c2->photons[j]) <= c1->contributions[j]);
+                }
+
+                hkl_binoculars_cube_free(c2);
+                hkl_binoculars_cube_free(c1);
+                hkl_binoculars_cube_free(cube_lut);
+                hkl_binoculars_qcustom_lut_free(lut);
+                hkl_binoculars_qcustom_plan_free(plan);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+        }
+        hkl_binoculars_cube_weighted_set(FALSE);
+
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_geometry_free(moved);
+        hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the cube sized from the bounds of a grid of the detector pixels
+ * contains the cube of all the projected pixels */
+static void cube_bounds(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                int sub;
+                int height;
+                int width;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(sub=0; sub<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++sub){
+                        size_t i;
+                        HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+                        HklBinocularsQCustomPlan *plan;
+                        HklBinocularsBounds *bounds;
+                        HklBinocularsCube *cube;
+                        HklBinocularsCube *cube_bounds;
+
+                        plan = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               sub,
+                                                               0.1, 0.2, 0.3,
+                                                               "omega",
+                                                               0);
+                        bounds = hkl_binoculars_bounds_new_qcustom(plan);
+
+                        hkl_binoculars_space_qcustom_plan_uint32_t(space, plan,
+                                                                   geometry, img,
+                                                                   1.0, 10.0);
+                        hkl_binoculars_bounds_add_qcustom(bounds, geometry, 10.0);
+
+                        cube = hkl_binoculars_cube_new_from_space(space);
+                        cube_bounds = hkl_binoculars_cube_new_from_bounds(bounds);
+
+                        res &= DIAG(darray_size(cube->axes) == darray_size(cube_bounds->axes));
+                        for(i=0; i<darray_size(cube->axes); ++i){
+                                res &= DIAG(darray_item(cube_bounds->axes, i).imin <= darray_item(cube->axes, i).imin);
+                                res &= DIAG(darray_item(cube_bounds->axes, i).imax >= darray_item(cube->axes, i).imax);
+                        }
+
+                        hkl_binoculars_cube_free(cube_bounds);
+                        hkl_binoculars_cube_free(cube);
+                        hkl_binoculars_bounds_free(bounds);
+                        hkl_binoculars_qcustom_plan_free(plan);
+                        hkl_binoculars_space_free(space);
+                }
+
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the resolutions suggested by the footprint of the pixels are
+ * positive and the cube fits in the suggested memory */
+static void footprint_suggest(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                int sub;
+                int height;
+                int width;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(sub=0; sub<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++sub){
+                        size_t i;
+                        uint64_t n_bins;
+                        uint64_t n_bytes;
+                        double suggested[3];
+                        HklBinocularsQCustomPlan *plan;
+                        HklBinocularsFootprint *footprint;
+
+                        plan = hkl_binoculars_qcustom_plan_new(pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               sub,
+                                                               0.1, 0.2, 0.3,
+                                                               "omega",
+                                                               0);
+                        footprint = hkl_binoculars_footprint_new_qcustom(plan);
+
+                        /* nothing to suggest without frame */
+                        res &= DIAG(FALSE == hkl_binoculars_footprint_suggest(footprint,
+                                                                              suggested, ARRAY_SIZE(suggested),
+                                                                              &n_bins, &n_bytes));
+
+                        hkl_binoculars_footprint_add_qcustom(footprint, geometry, 10.0);
+                        res &= DIAG(TRUE == hkl_binoculars_footprint_suggest(footprint,
+                                                                             suggested, ARRAY_SIZE(suggested),
+                                                                             &n_bins, &n_bytes));
+                        for(i=0; i<ARRAY_SIZE(suggested); ++i)
+                                res &= DIAG(suggested[i] > 0);
+                        res &= DIAG(n_bins > 0);
+                        res &= DIAG(n_bytes >= 2 * sizeof(uint32_t) * n_bins);
+
+                        hkl_binoculars_footprint_free(footprint);
+                        hkl_binoculars_qcustom_plan_free(plan);
+                }
+
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the frame statistics computed by the projection are the ones of
+ * the not masked pixels, whatever the number of threads */
+static void frame_stats(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        hkl_geometry_randomize(geometry);
+        hkl_binoculars_frame_stats_set(TRUE);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i, t;
+                int height;
+                int width;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+                double sum = 0;
+                double max = 0;
+                size_t n_pixels = 0;
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                for(i=0; i<arr_size; ++i)
+                        if(!mask[i]){
+                                sum += img[i];
+                                if(img[i] > max)
+                                        max = img[i];
+                                n_pixels++;
+                        }
+
+                for(t=1; t<=4; t*=4){
+                        double s, m;
+                        size_t n_in_limits;
+                        HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+
+                        hkl_binoculars_frame_n_threads_set(t);
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               10.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0.0, 0.0, 0.0,
+                                                               "omega",
+                                                               0);
+                        hkl_binoculars_space_frame_stats_get(space, &s, &m, &n_in_limits);
+
+                        res &= DIAG(s == sum);
+                        res &= DIAG(m == max);
+                        res &= DIAG(n_in_limits == n_pixels);
+
+                        hkl_binoculars_space_free(space);
+                }
+
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+        }
+
+        hkl_binoculars_frame_n_threads_set(1);
+        hkl_binoculars_frame_stats_set(FALSE);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_weighted(void)
+{
+        size_t i, n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsDetectorEnum detector = 0;
+        int height;
+        int width;
+        HklBinocularsSpace *space;
+        HklBinocularsCube *cube;
+        HklBinocularsCube *merged;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        const double weight = 0.3;
+
+        hkl_geometry_randomize(geometry);
+
+        hkl_binoculars_detector_2d_shape_get(detector, &width, &height);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(detector);
+        mask = hkl_binoculars_detector_2d_mask_get(detector);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(detector, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+        space = hkl_binoculars_space_new(width * height, 3);
+
+        hkl_binoculars_space_qcustom_uint32_t (space,
+                                               geometry,
+                                               img,
+                                               arr_size,
+                                               weight,
+                                               pixels_coordinates,
+                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                               pixels_coordinates_dims,
+                                               resolutions,
+                                               ARRAY_SIZE(resolutions),
+                                               mask,
+                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                               NULL,
+                                               0,
+                                               0.0,
+                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                               0, 0, 0,
+                                               "omega",
+                                               0);
+
+        hkl_binoculars_cube_weighted_set(TRUE);
+        cube = hkl_binoculars_cube_new_from_space(space);
+        hkl_binoculars_cube_weighted_set(FALSE);
+
+        /* the double sums are the exact ones, the photons are rounded
+         * per pixel */
+        res &= DIAG(NULL != cube->intensities);
+        res &= DIAG(NULL != cube->variances);
+        n = 1;
+        for(i=0; i<darray_size(cube->storage); ++i)
+                n *= axis_size(&darray_item(cube->storage, i));
+        for(i=0; i<n; ++i){
+                res &= DIAG(fabs(cube->variances[i] - weight * cube->intensities[i]) <= 1e-6 * cube->intensities[i]);
+                res &= DIAG(fabs(cube->photons[i] - cube->intensities[i]) <= 0.5 * cube->contributions[i] + 1e-6);
+        }
+
+        /* the merge of a weighted cube keeps the channels */
+        const HklBinocularsCube *cubes[] = {cube, cube};
+        merged = hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(cubes), cubes, 1);
+        res &= DIAG(NULL != merged->intensities);
+        for(i=0; i<n; ++i)
+                res &= DIAG(merged->intensities[i] == 2 * cube->intensities[i]);
+
+        hkl_binoculars_cube_free(merged);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the cube of a space scattered in the order of the bins is the one
+ * scattered in the order of the pixels */
+static void cube_sorted_scatter(void)
+{
+        size_t i, n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsDetectorEnum detector = 0;
+        int height;
+        int width;
+        HklBinocularsSpace *space;
+        HklBinocularsCube *cube;
+        HklBinocularsCube *sorted;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+        hkl_geometry_randomize(geometry);
+
+        hkl_binoculars_detector_2d_shape_get(detector, &width, &height);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(detector);
+        mask = hkl_binoculars_detector_2d_mask_get(detector);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(detector, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+        space = hkl_binoculars_space_new(width * height, 3);
+
+        hkl_binoculars_space_qcustom_uint32_t (space,
+                                               geometry,
+                                               img,
+                                               arr_size,
+                                               0.3,
+                                               pixels_coordinates,
+                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                               pixels_coordinates_dims,
+                                               resolutions,
+                                               ARRAY_SIZE(resolutions),
+                                               mask,
+                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                               NULL,
+                                               0,
+                                               0.0,
+                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                               0, 0, 0,
+                                               "omega",
+                                               0);
+
+        hkl_binoculars_cube_weighted_set(TRUE);
+        cube = hkl_binoculars_cube_new_from_space(space);
+        hkl_binoculars_cube_sorted_scatter_set(TRUE);
+        sorted = hkl_binoculars_cube_new_from_space(space);
+        hkl_binoculars_cube_sorted_scatter_set(FALSE);
+        hkl_binoculars_cube_weighted_set(FALSE);
+
+        /* only the order of the double sums differs */
+        res &= DIAG(cube_data_equal(cube, sorted));
+        n = 1;
+        for(i=0; i<darray_size(cube->storage); ++i)
+                n *= axis_size(&darray_item(cube->storage, i));
+        for(i=0; i<n; ++i){
+                res &= DIAG(fabs(sorted->intensities[i] - cube->intensities[i]) <= 1e-9 * cube->intensities[i]);
+                res &= DIAG(fabs(sorted->variances[i] - cube->variances[i]) <= 1e-9 * cube->variances[i]);
+        }
+
+        hkl_binoculars_cube_free(sorted);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the cubes accumulated with interleaved bins or narrow counters are
+ * the planar one */
+static void cube_interleaved(void)
+{
+        size_t i;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsDetectorEnum detector = 0;
+        int height;
+        int width;
+        HklBinocularsCube *cube = hkl_binoculars_cube_new_empty();
+        HklBinocularsCube *interleaved = hkl_binoculars_cube_new_empty();
+        HklBinocularsCube *narrow = hkl_binoculars_cube_new_empty();
+        HklBinocularsCube *merged;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+        hkl_binoculars_detector_2d_shape_get(detector, &width, &height);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(detector);
+        mask = hkl_binoculars_detector_2d_mask_get(detector);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(detector, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        /* the cubes grow with the frames */
+        for(i=0; i<3; ++i){
+                HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+
+                hkl_geometry_randomize(geometry);
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+                hkl_binoculars_cube_interleaved_set(TRUE);
+                hkl_binoculars_cube_add_space(interleaved, space);
+                hkl_binoculars_cube_interleaved_set(FALSE);
+                hkl_binoculars_cube_narrow_counters_set(TRUE);
+                hkl_binoculars_cube_add_space(narrow, space);
+                hkl_binoculars_cube_narrow_counters_set(FALSE);
+
+                hkl_binoculars_space_free(space);
+        }
+
+        res &= DIAG(NULL != interleaved->bins);
+        res &= DIAG(NULL == interleaved->photons);
+        res &= DIAG(NULL != narrow->narrow);
+        res &= DIAG(NULL == narrow->photons);
+
+        /* the merge reads the planar arrays */
+        const HklBinocularsCube *cubes[] = {interleaved};
+        merged = hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(cubes), cubes, 1);
+        res &= DIAG(NULL == interleaved->bins);
+        res &= DIAG(cube_data_equal(cube, interleaved));
+        res &= DIAG(cube_data_equal(cube, merged));
+
+        /* the random counts of the fake images overflow the narrow
+         * counters, so their tiles are promoted */
+        hkl_binoculars_cube_planar(narrow);
+        res &= DIAG(NULL == narrow->narrow);
+        res &= DIAG(cube_data_equal(cube, narrow));
+
+        hkl_binoculars_cube_free(merged);
+        hkl_binoculars_cube_free(narrow);
+        hkl_binoculars_cube_free(interleaved);
+        hkl_binoculars_cube_free(cube);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_merge_n(void)
+{
+        size_t n;
+        int res = TRUE;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+
+        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+                size_t i;
+                int height;
+                int width;
+                HklBinocularsCube *cube, *merged;
+                HklBinocularsCube *cubes[4];
+                HklBinocularsSpace *space;
+                double *pixels_coordinates;
+                uint8_t *mask;
+                size_t arr_size;
+                uint32_t *img;
+                size_t pixels_coordinates_dims[3];
+                double resolutions[] = {0.05, 0.05, 0.05};
+
+                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+                space = hkl_binoculars_space_new(width * height, 3);
+                cube = hkl_binoculars_cube_new_empty();
+                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+                mask = hkl_binoculars_detector_2d_mask_get(n);
+                img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+                pixels_coordinates_dims[0] = 3;
+                pixels_coordinates_dims[1] = height;
+                pixels_coordinates_dims[2] = width;
+
+                /* one cube per geometry, (and an empty one) */
+                cubes[ARRAY_SIZE(cubes) - 1] = hkl_binoculars_cube_new_empty();
+                for(i=0; i<ARRAY_SIZE(cubes) - 1; ++i){
+                        hkl_geometry_randomize(geometry);
+
+                        hkl_binoculars_space_qcustom_uint32_t (space,
+                                                               geometry,
+                                                               img,
+                                                               arr_size,
+                                                               1.0,
+                                                               pixels_coordinates,
+                                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                                               pixels_coordinates_dims,
+                                                               resolutions,
+                                                               ARRAY_SIZE(resolutions),
+                                                               mask,
+                                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                               NULL,
+                                                               0,
+                                                               0.0,
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                               0, 0, 0,
+                                                               "omega",
+                                                               0);
+
+                        cubes[i] = hkl_binoculars_cube_new_from_space(space);
+                        hkl_binoculars_cube_add_space(cube, space);
+                }
+
+                merged = hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(cubes),
+                                                         (const HklBinocularsCube *const *)cubes,
+                                                         4);
+
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, merged));
+
+                res &= DIAG(cube_data_equal(cube, merged));
+
+                for(i=0; i<ARRAY_SIZE(cubes); ++i)
+                        hkl_binoculars_cube_free(cubes[i]);
+                hkl_binoculars_cube_free(merged);
+                free(img);
+                free(mask);
+                free(pixels_coordinates);
+                hkl_binoculars_cube_free(cube);
+                hkl_binoculars_space_free(space);
+        }
+
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_alloc(void)
+{
+        size_t i;
+        size_t n;
+        int res = TRUE;
+        int height;
+        int width;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCube *cube;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        size_t arr_size;
+        uint32_t *img;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.01, 0.01, 0.01};
+
+        hkl_binoculars_detector_2d_shape_get(0, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(0);
+        mask = hkl_binoculars_detector_2d_mask_get(0);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(0, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        hkl_geometry_randomize(geometry);
+        hkl_binoculars_space_qcustom_uint32_t (space,
+                                               geometry,
+                                               img,
+                                               arr_size,
+                                               1.0,
+                                               pixels_coordinates,
+                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                               pixels_coordinates_dims,
+                                               resolutions,
+                                               ARRAY_SIZE(resolutions),
+                                               mask,
+                                               HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                               NULL,
+                                               0,
+                                               0.0,
+                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                               0, 0, 0,
+                                               "omega",
+                                               0);
+
+        hkl_binoculars_cube_weighted_set(TRUE);
+        cube = hkl_binoculars_cube_new_from_space(space);
+        n = 1;
+        for(i=0; i<darray_size(cube->storage); ++i)
+                n *= axis_size(&darray_item(cube->storage, i));
+
+        /* whatever the policy the cubes are the same, the big ones are
+         * mapped */
+        for(i=HKL_BINOCULARS_CUBE_ALLOC_DEFAULT; i<HKL_BINOCULARS_CUBE_ALLOC_NUM_ALLOCS; ++i){
+                HklBinocularsCube *cube2, *merged;
+
+                hkl_binoculars_cube_alloc_set(i);
+                cube2 = hkl_binoculars_cube_new_from_space(space);
+                const HklBinocularsCube *cubes[] = {cube2, cube2};
+                merged = hkl_binoculars_cube_new_merge_n(ARRAY_SIZE(cubes), cubes, 2);
+
+                res &= DIAG((HKL_BINOCULARS_CUBE_ALLOC_DEFAULT == i) == (0 == cube2->mapped)
+                            || n * sizeof(*cube2->photons) < (2 << 20));
+                res &= DIAG(cube_data_equal(cube, cube2));
+                res &= DIAG(0 == memcmp(cube->intensities, cube2->intensities, n * sizeof(*cube->intensities)));
+                res &= DIAG(merged->intensities[n / 2] == 2 * cube->intensities[n / 2]);
+
+                hkl_binoculars_cube_free(merged);
+                hkl_binoculars_cube_free(cube2);
+        }
+        hkl_binoculars_cube_alloc_set(HKL_BINOCULARS_CUBE_ALLOC_DEFAULT);
+        hkl_binoculars_cube_weighted_set(FALSE);
+
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static unsigned long cube_sum(const HklBinocularsCube *cube, const unsigned int *arr)
+{
+        size_t i;
+        size_t size = 1;
+        unsigned long sum = 0;
+
+        for(i=0; i<darray_size(cube->axes); ++i)
+                size *= axis_size(&darray_item(cube->axes, i));
+        for(i=0; i<size; ++i)
+                sum += arr[i];
+
+        return sum;
+}
+
+static void cube_save_hdf5(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t n_ranges;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        char buffer[256];
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsFramesRange ranges[] = {{"/tmp/scan_1.nxs", 0, 2}};
+        HklBinocularsFramesRange *loaded;
+        HklBinocularsCube *cube, *cube2, *cropped, *compact;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<3; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        /* the crop keeps all the contributions */
+        compact = hkl_binoculars_cube_new_copy(cube);
+        cropped = hkl_binoculars_cube_new_crop(cube);
+        res &= DIAG(cube_sum(compact, compact->photons) == cube_sum(cropped, cropped->photons));
+        res &= DIAG(cube_sum(compact, compact->contributions) == cube_sum(cropped, cropped->contributions));
+        for(i=0; i<darray_size(cube->axes); ++i){
+                res &= DIAG(darray_item(cropped->axes, i).imin >= darray_item(cube->axes, i).imin);
+                res &= DIAG(darray_item(cropped->axes, i).imax <= darray_item(cube->axes, i).imax);
+        }
+
+        /* all the filters, the plugins ones fallback to deflate, with
+         * and without the crop, are reloaded with the same bins */
+        for(i=0; i<2 * HKL_BINOCULARS_HDF5_FILTER_NUM_FILTERS; ++i){
+                int crop = i % 2;
+                const HklBinocularsCube *expected = crop ? cropped : compact;
+
+                snprintf(buffer, ARRAY_SIZE(buffer), "/tmp/cube_%zu.h5", i);
+                res &= DIAG(hkl_binoculars_cube_save_hdf5_with_options(buffer, "config", cube,
+                                                                       i / 2, 1, crop,
+                                                                       ranges, ARRAY_SIZE(ranges)));
+
+                cube2 = hkl_binoculars_cube_new_from_hdf5(buffer, "config",
+                                                          &loaded, &n_ranges);
+                res &= DIAG(NULL != cube2);
+                if(NULL != cube2){
+                        res &= DIAG(!hkl_binoculars_cube_cmp(expected, cube2));
+                        res &= DIAG(cube_data_equal(expected, cube2));
+                        hkl_binoculars_frames_ranges_free(loaded, n_ranges);
+                        hkl_binoculars_cube_free(cube2);
+                }
+                unlink(buffer);
+        }
+
+        /* the default contiguous layout */
+        hkl_binoculars_cube_save_hdf5_with_frames("/tmp/cube.h5", "config", cube,
+                                                  ranges, ARRAY_SIZE(ranges));
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cube.h5", "config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL != cube2);
+        if(NULL != cube2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+                res &= DIAG(cube_data_equal(cube, cube2));
+                hkl_binoculars_frames_ranges_free(loaded, n_ranges);
+                hkl_binoculars_cube_free(cube2);
+        }
+        unlink("/tmp/cube.h5");
+
+        hkl_binoculars_cube_free(cropped);
+        hkl_binoculars_cube_free(compact);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_hdf5_frames(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t n_ranges;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsFramesRange ranges[] = {{"/tmp/scan_1.nxs", 0, 1},
+                                             {"/tmp/scan_2.nxs", 3, 3}};
+        HklBinocularsFramesRange *loaded;
+        HklBinocularsCube *cube, *cube2;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<3; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        hkl_binoculars_cube_save_hdf5_with_frames("/tmp/cube_frames.h5", "config", cube,
+                                                  ranges, ARRAY_SIZE(ranges));
+
+        /* same config, the cube and the projected frames are restored */
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cube_frames.h5", "config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL != cube2);
+        if(NULL != cube2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+                res &= DIAG(cube_data_equal(cube, cube2));
+                res &= DIAG(ARRAY_SIZE(ranges) == n_ranges);
+                for(i=0; i<n_ranges && i<ARRAY_SIZE(ranges); ++i){
+                        res &= DIAG(0 == strcmp(ranges[i].filename, loaded[i].filename));
+                        res &= DIAG(ranges[i].first == loaded[i].first);
+                        res &= DIAG(ranges[i].last == loaded[i].last);
+                }
+                hkl_binoculars_frames_ranges_free(loaded, n_ranges);
+                hkl_binoculars_cube_free(cube2);
+        }
+
+        /* another config, nothing to resume */
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cube_frames.h5", "another config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL == cube2);
+        res &= DIAG(0 == n_ranges);
+
+        /* a cube saved without frames can not be resumed */
+        hkl_binoculars_cube_save_hdf5("/tmp/cube_frames.h5", "config", cube);
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cube_frames.h5", "config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL == cube2);
+
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_slice_rebin(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        ptrdiff_t imin[3];
+        ptrdiff_t imax[3];
+        size_t factors[] = {2, 3, 1};
+        HklBinocularsCubeSums sums, sums2;
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCube *cube, *slice, *slice2, *rebin, *rebin2;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<3; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        /* the whole cube */
+        for(i=0; i<3; ++i){
+                imin[i] = darray_item(cube->axes, i).imin - 1;
+                imax[i] = darray_item(cube->axes, i).imax + 1;
+        }
+        slice = hkl_binoculars_cube_new_slice(cube, imin, imax);
+        hkl_binoculars_cube_roi_sums(cube, imin, imax, &sums);
+        res &= DIAG(!hkl_binoculars_cube_cmp(cube, slice));
+        res &= DIAG(cube_data_equal(cube, slice));
+        res &= DIAG(sums.photons == cube_sum(slice, slice->photons));
+        res &= DIAG(sums.contributions == cube_sum(slice, slice->contributions));
+        hkl_binoculars_cube_free(slice);
+
+        /* the rebin keeps all the contributions */
+        rebin = hkl_binoculars_cube_new_rebin(cube, factors);
+        hkl_binoculars_cube_roi_sums(rebin, imin, imax, &sums2);
+        res &= DIAG(sums.photons == sums2.photons);
+        res &= DIAG(sums.contributions == sums2.contributions);
+        for(i=0; i<3; ++i)
+                res &= DIAG(darray_item(rebin->axes, i).resolution == resolutions[i] * factors[i]);
+
+        /* a slice of the middle of the first axis */
+        imin[0] = imax[0] = (darray_item(cube->axes, 0).imin + darray_item(cube->axes, 0).imax) / 2;
+        slice = hkl_binoculars_cube_new_slice(cube, imin, imax);
+        hkl_binoculars_cube_roi_sums(cube, imin, imax, &sums);
+        res &= DIAG(1 == axis_size(&darray_item(slice->axes, 0)));
+        res &= DIAG(sums.photons == cube_sum(slice, slice->photons));
+        res &= DIAG(sums.contributions == cube_sum(slice, slice->contributions));
+
+        /* the same from the saved cube, all its axes are saved */
+        hkl_binoculars_cube_save_hdf5("/tmp/cube_slice.h5", "config", cube);
+        slice2 = hkl_binoculars_cube_new_slice_from_hdf5("/tmp/cube_slice.h5", 3, imin, imax);
+        res &= DIAG(NULL != slice2);
+        if(NULL != slice2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(slice, slice2));
+                res &= DIAG(cube_data_equal(slice, slice2));
+                hkl_binoculars_cube_free(slice2);
+        }
+        res &= DIAG(hkl_binoculars_cube_roi_sums_from_hdf5("/tmp/cube_slice.h5", 3, imin, imax, &sums2));
+        res &= DIAG(sums.photons == sums2.photons);
+        res &= DIAG(sums.contributions == sums2.contributions);
+        rebin2 = hkl_binoculars_cube_new_rebin_from_hdf5("/tmp/cube_slice.h5", 3, factors);
+        res &= DIAG(NULL != rebin2);
+        if(NULL != rebin2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(rebin, rebin2));
+                res &= DIAG(cube_data_equal(rebin, rebin2));
+                hkl_binoculars_cube_free(rebin2);
+        }
+        res &= DIAG(NULL == hkl_binoculars_cube_new_slice_from_hdf5("/tmp/cube_slice.h5", 2, imin, imax));
+
+        hkl_binoculars_cube_free(rebin);
+        hkl_binoculars_cube_free(slice);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_peaks(void)
+{
+        size_t i, j;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        ptrdiff_t imin[3];
+        ptrdiff_t imax[3];
+        size_t n_peaks, n_peaks2;
+        uint64_t photons = 0;
+        uint64_t contributions = 0;
+        HklBinocularsCubeSums sums;
+        HklBinocularsCubePeak *peaks, *peaks2;
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCube *cube;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        /* no peak in an empty cube */
+        res &= DIAG(NULL == hkl_binoculars_cube_peaks(cube, 0, 0, &n_peaks));
+        res &= DIAG(0 == n_peaks);
+
+        for(i=0; i<3; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        /* with a null threshold the peaks contain all the bins with
+         * contributions, whatever the number of threads */
+        peaks = hkl_binoculars_cube_peaks(cube, 0, 1, &n_peaks);
+        peaks2 = hkl_binoculars_cube_peaks(cube, 0, 4, &n_peaks2);
+        res &= DIAG(NULL != peaks);
+        res &= DIAG(n_peaks == n_peaks2);
+        for(i=0; i<n_peaks && i<n_peaks2; ++i){
+                photons += peaks[i].sums.photons;
+                contributions += peaks[i].sums.contributions;
+
+                res &= DIAG(peaks[i].n_bins == peaks2[i].n_bins);
+                res &= DIAG(peaks[i].sums.photons == peaks2[i].sums.photons);
+                for(j=0; j<3; ++j){
+                        const HklBinocularsAxis *axis = &darray_item(cube->axes, j);
+
+                        res &= DIAG(peaks[i].imin[j] == peaks2[i].imin[j]);
+                        res &= DIAG(peaks[i].imax[j] == peaks2[i].imax[j]);
+                        res &= DIAG(fabs(peaks[i].centroid[j] - peaks2[i].centroid[j]) < 1e-9);
+                        res &= DIAG(peaks[i].imin[j] >= axis->imin);
+                        res &= DIAG(peaks[i].imax[j] <= axis->imax);
+                        res &= DIAG(peaks[i].centroid[j] >= (peaks[i].imin[j] - 0.5) * axis->resolution);
+                        res &= DIAG(peaks[i].centroid[j] <= (peaks[i].imax[j] + 0.5) * axis->resolution);
+                }
+        }
+        for(i=0; i<3; ++i){
+                imin[i] = darray_item(cube->axes, i).imin;
+                imax[i] = darray_item(cube->axes, i).imax;
+        }
+        hkl_binoculars_cube_roi_sums(cube, imin, imax, &sums);
+        res &= DIAG(photons == sums.photons);
+        res &= DIAG(contributions == sums.contributions);
+        free(peaks2);
+        free(peaks);
+
+        /* no bin is above an huge threshold */
+        res &= DIAG(NULL == hkl_binoculars_cube_peaks(cube, 1e9, 0, &n_peaks));
+        res &= DIAG(0 == n_peaks);
+
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void cube_save_zarr(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCube *cubes[2];
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<ARRAY_SIZE(cubes); ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                cubes[i] = hkl_binoculars_cube_new_from_space(space);
+        }
+
+        /* the parts are written independently, in any order */
+        res &= DIAG(hkl_binoculars_cubes_save_zarr("/tmp/cube.zarr", "config",
+                                                   ARRAY_SIZE(cubes),
+                                                   (const HklBinocularsCube *const *)cubes,
+                                                   2, 1, 2));
+        res &= DIAG(hkl_binoculars_cubes_save_zarr("/tmp/cube.zarr", "config",
+                                                   ARRAY_SIZE(cubes),
+                                                   (const HklBinocularsCube *const *)cubes,
+                                                   0, 0, 2));
+        res &= DIAG(g_file_test("/tmp/cube.zarr/zarr.json", G_FILE_TEST_IS_REGULAR));
+        res &= DIAG(g_file_test("/tmp/cube.zarr/counts/zarr.json", G_FILE_TEST_IS_REGULAR));
+        res &= DIAG(g_file_test("/tmp/cube.zarr/contributions/zarr.json", G_FILE_TEST_IS_REGULAR));
+        res &= DIAG(g_file_test("/tmp/cube.zarr/counts/c/0/0/0", G_FILE_TEST_IS_REGULAR));
+        res &= DIAG(g_file_test("/tmp/cube.zarr/contributions/c/0/0/0", G_FILE_TEST_IS_REGULAR));
+
+        /* there is no third part of two */
+        res &= DIAG(FALSE == hkl_binoculars_cubes_save_zarr("/tmp/cube.zarr", "config",
+                                                            ARRAY_SIZE(cubes),
+                                                            (const HklBinocularsCube *const *)cubes,
+                                                            0, 2, 2));
+
+        for(i=0; i<ARRAY_SIZE(cubes); ++i)
+                hkl_binoculars_cube_free(cubes[i]);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the sum of a uint32 dataset of a saved cube */
+static unsigned long dataset_sum(const char *fn, const char *name)
+{
+        size_t i;
+        unsigned long sum = 0;
+        hid_t file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+        hid_t dataset_id;
+        hid_t dataspace_id;
+        hssize_t n;
+        uint32_t *counts;
+
+        dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+        dataspace_id = H5Dget_space(dataset_id);
+        n = H5Sget_simple_extent_npoints(dataspace_id);
+        counts = malloc(n * sizeof(*counts));
+        H5Dread(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, counts);
+        for(i=0; i<(size_t)n; ++i)
+                sum += counts[i];
+
+        free(counts);
+        H5Sclose(dataspace_id);
+        H5Dclose(dataset_id);
+        H5Fclose(file_id);
+
+        return sum;
+}
+
+/* the sum of the counts of a level of the pyramid of a saved cube */
+static unsigned long pyramid_level_sum(const char *fn, size_t level)
+{
+        char name[64];
+
+        snprintf(name, ARRAY_SIZE(name), "binoculars/pyramid/level_%ld/counts", level);
+
+        return dataset_sum(fn, name);
+}
+
+/* check the normalised difference of a cube saved with
+ * hkl_binoculars_cube_normalised_difference_save_hdf5, only the bins
+ * with contributions are not NaN */
+static int difference_check(const char *fn, const HklBinocularsCube *cube, int zero)
+{
+        size_t i;
+        int res = TRUE;
+        hid_t file_id = H5Fopen(fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+        hid_t dataset_id = H5Dopen(file_id, "binoculars/difference", H5P_DEFAULT);
+        hid_t dataspace_id = H5Dget_space(dataset_id);
+        hssize_t n = H5Sget_simple_extent_npoints(dataspace_id);
+        double *values = malloc(n * sizeof(*values));
+
+        H5Dread(dataset_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values);
+        for(i=0; i<(size_t)n; ++i){
+                if(0 == cube->contributions[i])
+                        res &= isnan(values[i]);
+                else if(zero)
+                        res &= fabs(values[i]) < 1e-12;
+                else
+                        res &= values[i] >= 0;
+        }
+
+        free(values);
+        H5Sclose(dataspace_id);
+        H5Dclose(dataset_id);
+        H5Fclose(file_id);
+
+        return res;
+}
+
+static void cubes_save_hdf5(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t n_ranges;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsFramesRange ranges[] = {{"/tmp/scan_1.nxs", 0, 1},
+                                             {"/tmp/scan_2.nxs", 3, 3}};
+        HklBinocularsFramesRange *loaded;
+        HklBinocularsCube *cube, *cube2, *compact;
+        HklBinocularsCube *cubes[4];
+        char merge_fns[ARRAY_SIZE(cubes)][64];
+        const char *pmerge_fns[ARRAY_SIZE(cubes)];
+        ptrdiff_t imin[] = {PTRDIFF_MIN, PTRDIFF_MIN, PTRDIFF_MIN};
+        ptrdiff_t imax[] = {PTRDIFF_MAX, PTRDIFF_MAX, PTRDIFF_MAX};
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        /* one cube per geometry, (and an empty one) */
+        cubes[ARRAY_SIZE(cubes) - 1] = hkl_binoculars_cube_new_empty();
+        for(i=0; i<ARRAY_SIZE(cubes) - 1; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                cubes[i] = hkl_binoculars_cube_new_from_space(space);
+                hkl_binoculars_cube_add_space(cube, space);
+        }
+
+        /* merged while saved, same as the merge of the cubes */
+        hkl_binoculars_cubes_save_hdf5_with_frames("/tmp/cubes_frames.h5", "config",
+                                                   ARRAY_SIZE(cubes),
+                                                   (const HklBinocularsCube *const *)cubes,
+                                                   4,
+                                                   ranges, ARRAY_SIZE(ranges));
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cubes_frames.h5", "config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL != cube2);
+        if(NULL != cube2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+                res &= DIAG(cube_data_equal(cube, cube2));
+                res &= DIAG(ARRAY_SIZE(ranges) == n_ranges);
+                hkl_binoculars_frames_ranges_free(loaded, n_ranges);
+                hkl_binoculars_cube_free(cube2);
+        }
+
+        /* without frames */
+        hkl_binoculars_cubes_save_hdf5_with_frames("/tmp/cubes_frames.h5", "config",
+                                                   ARRAY_SIZE(cubes),
+                                                   (const HklBinocularsCube *const *)cubes,
+                                                   0, NULL, 0);
+        cube2 = hkl_binoculars_cube_new_from_hdf5("/tmp/cubes_frames.h5", "config",
+                                                  &loaded, &n_ranges);
+        res &= DIAG(NULL == cube2);
+
+        /* the saved cubes merged one slab at a time, same as the
+         * merge of the cubes, the empty one is skipped */
+        for(i=0; i<ARRAY_SIZE(cubes); ++i){
+                snprintf(merge_fns[i], sizeof(merge_fns[i]), "/tmp/cubes_merge_%zu.h5", i);
+                hkl_binoculars_cube_save_hdf5(merge_fns[i], "config", cubes[i]);
+                pmerge_fns[i] = merge_fns[i];
+        }
+        res &= DIAG(hkl_binoculars_cubes_merge_hdf5("/tmp/cubes_merged.h5",
+                                                    ARRAY_SIZE(pmerge_fns), pmerge_fns, 4));
+        cube2 = hkl_binoculars_cube_new_slice_from_hdf5("/tmp/cubes_merged.h5", 3, imin, imax);
+        res &= DIAG(NULL != cube2);
+        if(NULL != cube2){
+                res &= DIAG(!hkl_binoculars_cube_cmp(cube, cube2));
+                res &= DIAG(cube_data_equal(cube, cube2));
+                hkl_binoculars_cube_free(cube2);
+        }
+        pmerge_fns[0] = "/tmp/no_such_cube.h5";
+        res &= DIAG(FALSE == hkl_binoculars_cubes_merge_hdf5("/tmp/cubes_merged.h5",
+                                                             ARRAY_SIZE(pmerge_fns), pmerge_fns, 0));
+
+        /* the levels of the pyramid keep all the counts */
+        compact = hkl_binoculars_cube_new_copy(cube);
+        hkl_binoculars_hdf5_pyramid_set(2);
+        hkl_binoculars_cube_save_hdf5("/tmp/cube_pyramid.h5", "config", cube);
+        hkl_binoculars_cubes_save_hdf5_with_frames("/tmp/cubes_pyramid.h5", "config",
+                                                   ARRAY_SIZE(cubes),
+                                                   (const HklBinocularsCube *const *)cubes,
+                                                   4, NULL, 0);
+        hkl_binoculars_hdf5_pyramid_set(0);
+        for(i=1; i<=2; ++i){
+                res &= DIAG(cube_sum(compact, compact->photons) == pyramid_level_sum("/tmp/cube_pyramid.h5", i));
+                res &= DIAG(cube_sum(compact, compact->photons) == pyramid_level_sum("/tmp/cubes_pyramid.h5", i));
+        }
+
+        /* a cube minus itself is zero where it has contributions */
+        hkl_binoculars_cube_normalised_difference_save_hdf5("/tmp/cube_difference.h5", "config",
+                                                            cube, compact, 1.0, 4);
+        res &= DIAG(difference_check("/tmp/cube_difference.h5", compact, TRUE));
+        hkl_binoculars_cube_normalised_difference_save_hdf5("/tmp/cube_difference.h5", "config",
+                                                            cube, NULL, 1.0, 0);
+        res &= DIAG(difference_check("/tmp/cube_difference.h5", compact, FALSE));
+        hkl_binoculars_cube_free(compact);
+
+        for(i=0; i<ARRAY_SIZE(cubes); ++i)
+                hkl_binoculars_cube_free(cubes[i]);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+/* the slabs written by a time window contain all the counts of the
+ * cube of the same spaces */
+/* the binoculars-hkl config of a two frames scan of dir */
+static char *process_config_new(const char *dir, const char *destination,
+                                HklBinocularsDetectorEnum n, int width, int height)
+{
+        return g_strdup_printf("[dispatcher]\n"
+                               "ncores = 2\n"
+                               "destination = %s\n"
+                               "overwrite = true\n"
+                               "[input]\n"
+                               "nexusdir = %s\n"
+                               "inputrange = 1\n"
+                               "detector = %s\n"
+                               "centralpixel = %d, %d\n"
+                               "sdd = 1.0\n"
+                               "wavelength = 1.54\n"
+                               "geometry = ZAXIS\n"
+                               "image_path = images\n"
+                               "axes = delta:delta\n"
+                               "[projection]\n"
+                               "type = qcustom\n"
+                               "subprojection = qx_qy_qz\n"
+                               "resolution = 0.05\n",
+                               destination, dir,
+                               hkl_binoculars_detector_2d_name_get(n),
+                               width / 2, height / 2);
+}
+
+static void process_config(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t n_ranges;
+        unsigned long sum = 0;
+        double deltas[] = {10.0, 20.0};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        char *dir = g_dir_make_tmp("binoculars-process-XXXXXX", NULL);
+        char *input = g_build_filename(dir, "scan_00001.h5", NULL);
+        char *config_fn = g_build_filename(dir, "config.ini", NULL);
+        char *destination = g_build_filename(dir, "qx_qy_qz_1-1.h5", NULL);
+        char *missing = g_build_filename(dir, "missing", "qx_qy_qz_1-1.h5", NULL);
+        char *config;
+        uint32_t *img;
+        uint32_t *images;
+        HklBinocularsFramesRange *loaded;
+        HklBinocularsCube *cube;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        images = g_new(uint32_t, ARRAY_SIZE(deltas) * arr_size);
+        for(i=0; i<ARRAY_SIZE(deltas); ++i)
+                memcpy(&images[i * arr_size], img, arr_size * sizeof(*img));
+        for(i=0; i<arr_size; ++i)
+                sum += img[i];
+
+        /* a scan of two frames at two delta positions */
+        {
+                hsize_t dims[] = {ARRAY_SIZE(deltas), height, width};
+                hsize_t n_deltas[] = {ARRAY_SIZE(deltas)};
+                hid_t file_id = H5Fcreate(input, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+                hid_t space_id = H5Screate_simple(ARRAY_SIZE(dims), dims, NULL);
+                hid_t dataset_id = H5Dcreate(file_id, "images", H5T_NATIVE_UINT32, space_id,
+                                             H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+                res &= DIAG(H5Dwrite(dataset_id, H5T_NATIVE_UINT32,
+                                     H5S_ALL, H5S_ALL, H5P_DEFAULT, images) >= 0);
+                H5Dclose(dataset_id);
+                H5Sclose(space_id);
+
+                space_id = H5Screate_simple(ARRAY_SIZE(n_deltas), n_deltas, NULL);
+                dataset_id = H5Dcreate(file_id, "delta", H5T_NATIVE_DOUBLE, space_id,
+                                       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                res &= DIAG(H5Dwrite(dataset_id, H5T_NATIVE_DOUBLE,
+                                     H5S_ALL, H5S_ALL, H5P_DEFAULT, deltas) >= 0);
+                H5Dclose(dataset_id);
+                H5Sclose(space_id);
+                H5Fclose(file_id);
+        }
+
+        /* every pixel of the two frames is projected into the saved
+         * cube, with the single resolution used for all the axes */
+        config = process_config_new(dir, destination, n, width, height);
+        res &= DIAG(g_file_set_contents(config_fn, config, -1, NULL));
+        res &= DIAG(0 == hkl_binoculars_process(config_fn, NULL, 0));
+
+        cube = hkl_binoculars_cube_new_from_hdf5(destination, config, &loaded, &n_ranges);
+        res &= DIAG(NULL != cube);
+        if(NULL != cube){
+                res &= DIAG(3 == darray_size(cube->axes));
+                for(i=0; i<darray_size(cube->axes); ++i)
+                        res &= DIAG(0.05 == darray_item(cube->axes, i).resolution);
+                res &= DIAG(ARRAY_SIZE(deltas) * sum == cube_sum(cube, cube->photons));
+                res &= DIAG(ARRAY_SIZE(deltas) * arr_size == cube_sum(cube, cube->contributions));
+                res &= DIAG(1 == n_ranges);
+                if(1 == n_ranges){
+                        res &= DIAG(0 == strcmp(input, loaded[0].filename));
+                        res &= DIAG(0 == loaded[0].first);
+                        res &= DIAG((int64_t)ARRAY_SIZE(deltas) - 1 == loaded[0].last);
+                }
+                hkl_binoculars_frames_ranges_free(loaded, n_ranges);
+                hkl_binoculars_cube_free(cube);
+        }
+        unlink(destination);
+        g_free(config);
 
-/* TODO */
-/* static void mask_load(void) */
-/* { */
-/*         const char *fname = "/home/picca/tests-datas/binoculars/sixs/eiger/mask_nxs00007_20191105_15h01.npy"; */
-/*         hkl_binoculars_detector_2d_mask_load(1, fname); */
-/* } */
+        /* a cube which can not be saved fails the process */
+        config = process_config_new(dir, missing, n, width, height);
+        res &= DIAG(g_file_set_contents(config_fn, config, -1, NULL));
+        res &= DIAG(0 != hkl_binoculars_process(config_fn, NULL, 0));
+        g_free(config);
 
-static void angles_projection(void)
-{
-        size_t n;
-        int res = TRUE;
-        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
-        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        unlink(config_fn);
+        unlink(input);
+        rmdir(dir);
 
-        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
-                size_t i;
-                int height;
-                int width;
-                HklBinocularsCube *cube;
-                HklBinocularsSpace *space;
-                double *pixels_coordinates;
-                uint8_t *mask;
-                ptrdiff_t min, max;
-                HklBinocularsAxisLimits *delta_lims, *gamma_lims, *omega_lims;
+        g_free(missing);
+        g_free(destination);
+        g_free(config_fn);
+        g_free(input);
+        g_free(dir);
+        g_free(images);
+        free(img);
 
-                min = 0 / 0.05, max = 0.4 / 0.05;
-                delta_lims = hkl_binoculars_axis_limits_new(&min, &max);
-                min = -0.4 / 0.05, max = 0.4 / 0.05;
-                gamma_lims = hkl_binoculars_axis_limits_new(&min, &max);
-                min = -0.4 / 0.05, max = 0.4 / 0.05;
-                omega_lims = hkl_binoculars_axis_limits_new(&min, &max);
+        ok(res == TRUE, __func__);
+}
 
-                const HklBinocularsAxisLimits *limits[] = {delta_lims, gamma_lims, omega_lims};
+/* the answer of the metrics exporter to GET path */
+static char *metrics_get(int port, const char *path)
+{
+        ssize_t n;
+        char buffer[4096];
+        struct sockaddr_in addr;
+        GString *answer = g_string_new(NULL);
+        char *request = g_strdup_printf("GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", path);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
 
-                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
-                space = hkl_binoculars_space_new(width * height, 3);
-                cube = hkl_binoculars_cube_new_empty();
-                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
-                mask = hkl_binoculars_detector_2d_mask_get(n);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if(fd >= 0 && 0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))
+           && (ssize_t)strlen(request) == write(fd, request, strlen(request)))
+                /* the exporter closes the connection after its answer */
+                while((n = read(fd, buffer, sizeof(buffer))) > 0)
+                        g_string_append_len(answer, buffer, n);
+        if(fd >= 0)
+                close(fd);
+        g_free(request);
 
-                for(i=0; i<3; ++i){
-                        size_t arr_size;
-                        uint32_t *img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
-                        size_t pixels_coordinates_dims[] = {3, height, width};
-                        double resolutions[] = {1, 1, 1};
+        return g_string_free(answer, FALSE);
+}
 
-                        hkl_geometry_randomize(geometry);
+static void metrics_serve(void)
+{
+        int res = TRUE;
+        size_t len = 0;
+        char *answer;
+        const char *body;
+        int port = hkl_binoculars_metrics_serve(NULL, 0);
 
-                        hkl_binoculars_space_angles_uint32_t (space,
-                                                              geometry,
-                                                              img,
-                                                              arr_size,
-                                                              1.0,
-                                                              pixels_coordinates,
-                                                              ARRAY_SIZE(pixels_coordinates_dims),
-                                                              pixels_coordinates_dims,
-                                                              resolutions,
-                                                              ARRAY_SIZE(resolutions),
-                                                              mask,
-                                                              limits,
-                                                              ARRAY_SIZE(limits),
-                                                              "omega");
+        res &= DIAG(port > 0);
+        res &= DIAG(port == hkl_binoculars_metrics_serve(NULL, 0));
 
-                        hkl_binoculars_cube_add_space(cube, space);
+        hkl_binoculars_metrics_stage_observe(HKL_BINOCULARS_METRICS_STAGE_PROJECT, 2e-3);
+        hkl_binoculars_metrics_stage_observe(HKL_BINOCULARS_METRICS_STAGE_PROJECT, 2e-3);
+        hkl_binoculars_metrics_stage_observe(HKL_BINOCULARS_METRICS_STAGE_PROJECT, 20);
+        hkl_binoculars_metrics_queue_depth_set(3);
 
-                        free(img);
-                }
+        answer = metrics_get(port, "/metrics");
+        body = strstr(answer, "\r\n\r\n");
+        res &= DIAG(g_str_has_prefix(answer, "HTTP/1.1 200 OK\r\n"));
+        res &= DIAG(NULL != strstr(answer, "\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"));
+        res &= DIAG(NULL != body);
+        if(NULL != body){
+                const char *length = strstr(answer, "\r\nContent-Length: ");
 
-                free(mask);
-                free(pixels_coordinates);
-                hkl_binoculars_cube_free(cube);
-                hkl_binoculars_space_free(space);
-                hkl_binoculars_axis_limits_free(omega_lims);
-                hkl_binoculars_axis_limits_free(gamma_lims);
-                hkl_binoculars_axis_limits_free(delta_lims);
+                body += 4;
+                res &= DIAG(NULL != length && 1 == sscanf(length, "\r\nContent-Length: %zu", &len));
+                res &= DIAG(strlen(body) == len);
+
+                res &= DIAG(g_str_has_prefix(body, "# TYPE binoculars_frames counter\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_frames_total 3\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_queue_depth 3\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_cube_bytes 0\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_bucket{stage=\"project\",le=\"0.001\"} 0\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_bucket{stage=\"project\",le=\"0.005\"} 2\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_bucket{stage=\"project\",le=\"10\"} 2\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_bucket{stage=\"project\",le=\"+Inf\"} 3\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_count{stage=\"project\"} 3\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_sum{stage=\"project\"} 20.004\n"));
+                res &= DIAG(NULL != strstr(body, "\nbinoculars_stage_seconds_count{stage=\"read\"} 0\n"));
+                res &= DIAG(g_str_has_suffix(body, "\n# EOF\n"));
         }
+        g_free(answer);
 
-        hkl_geometry_free(geometry);
+        /* only /metrics is served */
+        answer = metrics_get(port, "/");
+        res &= DIAG(g_str_has_prefix(answer, "HTTP/1.1 404 Not Found\r\n"));
+        g_free(answer);
+
+        hkl_binoculars_metrics_stop();
+        hkl_binoculars_metrics_queue_depth_set(0);
 
         ok(res == TRUE, __func__);
 }
 
-static int qcustom_projection_sub(HklBinocularsQCustomSubProjectionEnum subprojection)
+static void cube_window(void)
 {
-        size_t n;
+        size_t i;
         int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t pixels_coordinates_dims[3];
+        unsigned long sum = 0;
+        double resolutions[] = {0.05, 0.05, 1.0};
+        double timestamps[] = {0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 0.0};
+        size_t n_saved[] = {0, 0, 1, 1, 2, 2, 3};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
         HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
         HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCubeWindow *window;
+        HklBinocularsCube *cube, *compact;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
 
-        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
-                size_t i;
-                int height;
-                int width;
-                HklBinocularsCube *cube;
-                HklBinocularsSpace *space;
-                double *pixels_coordinates;
-                uint8_t *mask;
-                ptrdiff_t min, max;
-                HklBinocularsAxisLimits *qx_lims, *qy_lims, *qz_lims;
-
-                min = -0.45 / 0.05, max = 0.45 / 0.05;
-                qx_lims = hkl_binoculars_axis_limits_new(&min, &max);
-                min = -0.45 / 0.05, max = 0.45 / 0.05;
-                qy_lims = hkl_binoculars_axis_limits_new(&min, &max);
-                min = -0.45 / 0.05, max = 0.45 / 0.05;
-                qz_lims = hkl_binoculars_axis_limits_new(&min, &max);
-
-                const HklBinocularsAxisLimits *limits[] = {qx_lims, qy_lims, qz_lims};
-
-                hkl_binoculars_detector_2d_shape_get(n, &width, &height);
-                space = hkl_binoculars_space_new(width * height, 3);
-                cube = hkl_binoculars_cube_new_empty();
-                pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
-                mask = hkl_binoculars_detector_2d_mask_get(n);
-
-                for(i=0; i<3; ++i){
-                        size_t arr_size;
-                        uint32_t *img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
-                        size_t pixels_coordinates_dims[] = {3, height, width};
-                        double resolutions[] = {0.05, 0.05, 0.05};
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
 
+        /* slabs of two seconds, only one in memory, the last frame
+         * is late */
+        window = hkl_binoculars_cube_window_new("/tmp/cube_window.h5", "config", 2, 1);
+        res &= DIAG(NULL != window);
+        if(NULL != window){
+                for(i=0; i<ARRAY_SIZE(timestamps); ++i){
                         hkl_geometry_randomize(geometry);
 
                         hkl_binoculars_space_qcustom_uint32_t (space,
@@ -213,41 +3501,318 @@ static int qcustom_projection_sub(HklBinocularsQCustomSubProjectionEnum subproje
                                                                ARRAY_SIZE(resolutions),
                                                                mask,
                                                                HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
-                                                               limits,
-                                                               ARRAY_SIZE(limits),
-                                                               0.0,
-                                                               subprojection,
+                                                               NULL,
+                                                               0,
+                                                               timestamps[i],
+                                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QPAR_QPER_TIMESTAMP,
                                                                0, 0, 0,
                                                                "omega",
                                                                0);
 
                         hkl_binoculars_cube_add_space(cube, space);
+                        hkl_binoculars_cube_window_add_space(window, space);
+                        res &= DIAG(n_saved[i] == hkl_binoculars_cube_window_n_saved(window));
+                }
+                hkl_binoculars_cube_window_free(window);
 
-                        free(img);
+                for(i=0; i<4; ++i){
+                        char name[64];
+
+                        snprintf(name, ARRAY_SIZE(name), "binoculars/slabs/slab_%ld/counts", i);
+                        sum += dataset_sum("/tmp/cube_window.h5", name);
                 }
+                compact = hkl_binoculars_cube_new_copy(cube);
+                res &= DIAG(cube_sum(compact, compact->photons) == sum);
+                hkl_binoculars_cube_free(compact);
+        }
 
-                free(mask);
-                free(pixels_coordinates);
-                hkl_binoculars_cube_free(cube);
-                hkl_binoculars_space_free(space);
-                hkl_binoculars_axis_limits_free(qz_lims);
-                hkl_binoculars_axis_limits_free(qy_lims);
-                hkl_binoculars_axis_limits_free(qx_lims);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
+static void hdf5_read_frame_direct(void)
+{
+        size_t i, j;
+        int res = TRUE;
+        hsize_t dims[] = {3, 16, 24};
+        hsize_t chunk[] = {1, 16, 24};
+        uint32_t data[3 * 16 * 24];
+        uint32_t frame[16 * 24];
+
+        for(i=0; i<ARRAY_SIZE(data); ++i)
+                data[i] = i * 7919;
+
+        /* raw and deflate chunks, the deflate one is read only when
+         * built with zlib */
+        for(j=0; j<2; ++j){
+                hid_t file_id = H5Fcreate("/tmp/frames.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+                hid_t dataspace_id = H5Screate_simple(ARRAY_SIZE(dims), dims, NULL);
+                hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+                hid_t dataset_id;
+
+                H5Pset_chunk(dcpl, ARRAY_SIZE(chunk), chunk);
+                if(1 == j){
+                        H5Pset_shuffle(dcpl);
+                        H5Pset_deflate(dcpl, 1);
+                }
+                dataset_id = H5Dcreate(file_id, "frames", H5T_NATIVE_UINT32, dataspace_id,
+                                       H5P_DEFAULT, dcpl, H5P_DEFAULT);
+                H5Dwrite(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+
+                /* disabled by default */
+                res &= DIAG(hkl_binoculars_hdf5_read_frame_direct(dataset_id, 0, frame, sizeof(frame)) < 0);
+
+                hkl_binoculars_hdf5_direct_chunk_read_set(TRUE);
+                for(i=0; i<dims[0]; ++i){
+                        if(0 == hkl_binoculars_hdf5_read_frame_direct(dataset_id, i, frame, sizeof(frame)))
+                                res &= DIAG(0 == memcmp(frame, &data[i * ARRAY_SIZE(frame)], sizeof(frame)));
+                        else
+                                res &= DIAG(1 == j);
+                }
+                /* out of the dataset or wrong buffer size */
+                res &= DIAG(hkl_binoculars_hdf5_read_frame_direct(dataset_id, dims[0], frame, sizeof(frame)) < 0);
+                res &= DIAG(hkl_binoculars_hdf5_read_frame_direct(dataset_id, 0, frame, sizeof(frame) / 2) < 0);
+                hkl_binoculars_hdf5_direct_chunk_read_set(FALSE);
+
+                H5Dclose(dataset_id);
+                H5Pclose(dcpl);
+                H5Sclose(dataspace_id);
+                H5Fclose(file_id);
+        }
+
+        ok(res == TRUE, __func__);
+}
+
+static void sparse_cube(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        size_t pixels_coordinates_dims[3];
+        double resolutions[] = {0.05, 0.05, 0.05};
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsCube *cube, *dense, *dense2, *dense3;
+        HklBinocularsSparseCube *sparse, *sparse2;
+        HklBinocularsSpace *space;
+        double *pixels_coordinates;
+        uint8_t *mask;
+        uint32_t *img;
+
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+        space = hkl_binoculars_space_new(width * height, 3);
+        cube = hkl_binoculars_cube_new_empty();
+        sparse = hkl_binoculars_sparse_cube_new_empty();
+        pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        mask = hkl_binoculars_detector_2d_mask_get(n);
+        img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        pixels_coordinates_dims[0] = 3;
+        pixels_coordinates_dims[1] = height;
+        pixels_coordinates_dims[2] = width;
+
+        for(i=0; i<3; ++i){
+                hkl_geometry_randomize(geometry);
+
+                hkl_binoculars_space_qcustom_uint32_t (space,
+                                                       geometry,
+                                                       img,
+                                                       arr_size,
+                                                       1.0,
+                                                       pixels_coordinates,
+                                                       ARRAY_SIZE(pixels_coordinates_dims),
+                                                       pixels_coordinates_dims,
+                                                       resolutions,
+                                                       ARRAY_SIZE(resolutions),
+                                                       mask,
+                                                       HKL_BINOCULARS_SURFACE_ORIENTATION_VERTICAL,
+                                                       NULL,
+                                                       0,
+                                                       0.0,
+                                                       HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                                       0, 0, 0,
+                                                       "omega",
+                                                       0);
+
+                hkl_binoculars_cube_add_space(cube, space);
+                hkl_binoculars_sparse_cube_add_space(sparse, space);
+        }
+
+        /* the sparse cube contains the same data than the dense one */
+        dense = hkl_binoculars_cube_new_from_sparse_cube(sparse);
+        res &= DIAG(!hkl_binoculars_cube_cmp(cube, dense));
+        res &= DIAG(cube_data_equal(cube, dense));
+
+        /* round trip */
+        sparse2 = hkl_binoculars_sparse_cube_new_from_cube(cube);
+        res &= DIAG(hkl_binoculars_sparse_cube_n_bins(sparse) == hkl_binoculars_sparse_cube_n_bins(sparse2));
+        dense2 = hkl_binoculars_cube_new_from_sparse_cube(sparse2);
+        res &= DIAG(!hkl_binoculars_cube_cmp(cube, dense2));
+        res &= DIAG(cube_data_equal(cube, dense2));
+
+        hkl_binoculars_sparse_cube_save_hdf5("/tmp/sparse_cube.h5", "config", sparse);
+        hkl_binoculars_sparse_cube_save_npy("/tmp/sparse_cube", sparse);
+        hkl_binoculars_sparse_cube_save_npz("/tmp/sparse_cube.npz", sparse, TRUE);
+        hkl_binoculars_sparse_cube_save_npz("/tmp/sparse_cube_stored.npz", sparse, FALSE);
+
+        /* the saved sparse hdf5 converted back to the dense layout */
+        dense3 = hkl_binoculars_cube_new_from_sparse_hdf5("/tmp/sparse_cube.h5");
+        res &= DIAG(NULL != dense3);
+        if(NULL != dense3){
+                res &= DIAG(!hkl_binoculars_cube_cmp(dense, dense3));
+                res &= DIAG(cube_data_equal(dense, dense3));
+                hkl_binoculars_cube_free(dense3);
+        }
+
+        /* the same for the npy files, which have no axes */
+        {
+                size_t n_columns;
+                int64_t *expected;
+                int64_t *indexes;
+                uint32_t *counts;
+                uint32_t *contributions;
+                darray_int shape = darray_new();
+
+                n_columns = hkl_binoculars_sparse_cube_dense_indexes(sparse, &expected);
+                free(expected);
+
+                darray_append(shape, hkl_binoculars_sparse_cube_n_bins(sparse));
+                counts = npy_load("/tmp/sparse_cube_counts.npy", HklBinocularsNpyUInt32(), &shape);
+                contributions = npy_load("/tmp/sparse_cube_contributions.npy", HklBinocularsNpyUInt32(), &shape);
+                darray_append(shape, n_columns);
+                indexes = npy_load("/tmp/sparse_cube_indexes.npy", HklBinocularsNpyInt64(), &shape);
+                res &= DIAG(NULL != counts);
+                res &= DIAG(NULL != contributions);
+                res &= DIAG(NULL != indexes);
+                if(NULL != counts && NULL != contributions && NULL != indexes){
+                        dense3 = hkl_binoculars_cube_new_from_sparse_arrays(&sparse->axes,
+                                                                            hkl_binoculars_sparse_cube_n_bins(sparse),
+                                                                            n_columns,
+                                                                            indexes, counts, contributions);
+                        res &= DIAG(NULL != dense3);
+                        if(NULL != dense3){
+                                res &= DIAG(!hkl_binoculars_cube_cmp(dense, dense3));
+                                res &= DIAG(cube_data_equal(dense, dense3));
+                                hkl_binoculars_cube_free(dense3);
+                        }
+                }
+                free(indexes);
+                free(contributions);
+                free(counts);
+                darray_free(shape);
+        }
+
+        /* the streamed arrays, the stored npz members are mapped in
+         * place and aligned */
+        {
+                uint32_t *counts;
+                uint32_t *contributions;
+                darray_int shape = darray_new();
+
+                darray_append(shape, hkl_binoculars_sparse_cube_n_bins(sparse));
+                counts = npy_mmap("/tmp/sparse_cube_counts.npy", HklBinocularsNpyUInt32(), &shape);
+                contributions = npz_mmap("/tmp/sparse_cube_stored.npz", "contributions",
+                                         HklBinocularsNpyUInt32(), &shape);
+                res &= DIAG(NULL != counts);
+                res &= DIAG(NULL != contributions);
+                if(NULL != counts && NULL != contributions){
+                        res &= DIAG(0 == (uintptr_t)contributions % 64);
+                        for(i=0; i<darray_size(sparse->bins); ++i){
+                                res &= DIAG(counts[i] == darray_item(sparse->bins, i).photons);
+                                res &= DIAG(contributions[i] == darray_item(sparse->bins, i).contributions);
+                        }
+                }
+                res &= DIAG(NULL == npz_mmap("/tmp/sparse_cube_stored.npz", "missing",
+                                             HklBinocularsNpyUInt32(), &shape));
+                npy_munmap(contributions);
+                npy_munmap(counts);
+                darray_free(shape);
         }
 
+        hkl_binoculars_cube_free(dense2);
+        hkl_binoculars_sparse_cube_free(sparse2);
+        hkl_binoculars_cube_free(dense);
+        hkl_binoculars_sparse_cube_free(sparse);
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
 	hkl_geometry_free(geometry);
 
-        return res;
+        ok(res == TRUE, __func__);
 }
 
+/* a version 1.0 npy file of one element of the descr type */
+static void npy_descr_save(const char *fn, const char *descr)
+{
+        char header[118];
+        uint16_t len = sizeof(header);
+        uint64_t data = 0;
+        FILE *fp = fopen(fn, "wb");
 
-static void qcustom_projection(void)
+        if(NULL == fp)
+                return;
+
+        /* the preamble and the header are 128 bytes long */
+        memset(header, ' ', sizeof(header));
+        snprintf(header, sizeof(header),
+                 "{'descr': '%s', 'fortran_order': False, 'shape': (1,), }", descr);
+        header[strlen(header)] = ' ';
+        header[sizeof(header) - 1] = '\n';
+
+        fwrite("\x93NUMPY\x01\x00", 1, 8, fp);
+        fwrite(&len, sizeof(len), 1, fp);
+        fwrite(header, 1, sizeof(header), fp);
+        fwrite(&data, sizeof(data), 1, fp);
+        fclose(fp);
+}
+
+static void npy_descr(void)
 {
+        size_t i;
         int res = TRUE;
-        int i;
+        darray_int shape = darray_new();
+        struct {
+                const char *descr;
+                HklBinocularsNpyDataType type;
+                int expected;
+        } descrs[] = {
+                {"|b1", HklBinocularsNpyBool(), TRUE},
+                {"<f8", HklBinocularsNpyDouble(), TRUE},
+                {"<u4", HklBinocularsNpyUInt32(), TRUE},
+                {"<i8", HklBinocularsNpyInt64(), TRUE},
+                /* the big endian arrays are not read */
+                {">f8", HklBinocularsNpyDouble(), FALSE},
+                {">u4", HklBinocularsNpyUInt32(), FALSE},
+                /* the same kind with another size */
+                {"<f4", HklBinocularsNpyDouble(), FALSE},
+                {"<u8", HklBinocularsNpyUInt32(), FALSE},
+                {"<i4", HklBinocularsNpyInt64(), FALSE},
+                /* unknown types */
+                {"<c16", HklBinocularsNpyDouble(), FALSE},
+                {"|S8", HklBinocularsNpyInt64(), FALSE},
+        };
 
-        for(i=0; i<HKL_BINOCULARS_QCUSTOM_NUM_SUBPROJECTIONS; ++i)
-                res &= qcustom_projection_sub(i);
+        darray_append(shape, 1);
+        for(i=0; i<ARRAY_SIZE(descrs); ++i){
+                void *arr;
+
+                npy_descr_save("/tmp/descr.npy", descrs[i].descr);
+                arr = npy_load("/tmp/descr.npy", descrs[i].type, &shape);
+                res &= DIAG(descrs[i].expected == (NULL != arr));
+                free(arr);
+        }
+        unlink("/tmp/descr.npy");
+        darray_free(shape);
 
         ok(res == TRUE, __func__);
 }
@@ -410,6 +3975,183 @@ static void qxqyqz_projection(void)
 }
 
 
+/* the reals of the pixels kernels of hkl-binoculars.c */
+#ifdef HKL_BINOCULARS_DOUBLE
+typedef double Real;
+# define REAL_SQRT sqrt
+#else
+typedef float Real;
+# define REAL_SQRT sqrtf
+#endif
+
+/* the bins of the qx_qy_qz subprojection computed pixel by pixel
+ * with a plain loop, the target_clones kernels (pixels_kf_compute
+ * and pixels_q_compute) must give the same bins whatever the cpu. */
+static void qxqyqz_reference(const HklGeometry *geometry,
+                             const double *pixels_coordinates, size_t n_pixels,
+                             const double *resolutions, ptrdiff_t *indexes)
+{
+        size_t i;
+        HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+        HklSample *sample = hkl_sample_new("test");
+        HklVector ki_v = hkl_geometry_ki_get(geometry);
+        CGLM_ALIGN_MAT vec3s ki = {{ki_v.data[0], ki_v.data[1], ki_v.data[2]}};
+        CGLM_ALIGN_MAT mat4s d = hkl_binoculars_holder_transformation_get(hkl_geometry_detector_holder_get(geometry, detector));
+        CGLM_ALIGN_MAT mat4s s = hkl_binoculars_holder_inverse_transformation_get(hkl_geometry_sample_holder_get(geometry, sample));
+        float k = glms_vec3_norm(ki);
+
+        for(i=0; i<n_pixels; ++i){
+                Real vx = pixels_coordinates[0 * n_pixels + i];
+                Real vy = pixels_coordinates[1 * n_pixels + i];
+                Real vz = pixels_coordinates[2 * n_pixels + i];
+                Real lx = d.raw[0][0] * vx + d.raw[1][0] * vy + d.raw[2][0] * vz + d.raw[3][0];
+                Real ly = d.raw[0][1] * vx + d.raw[1][1] * vy + d.raw[2][1] * vz + d.raw[3][1];
+                Real lz = d.raw[0][2] * vx + d.raw[1][2] * vy + d.raw[2][2] * vz + d.raw[3][2];
+                Real norm = REAL_SQRT(lx * lx + ly * ly + lz * lz);
+                Real scale = norm == 0 ? 0 : k / norm;
+                Real qx = lx * scale - ki.raw[0];
+                Real qy = ly * scale - ki.raw[1];
+                Real qz = lz * scale - ki.raw[2];
+                CGLM_ALIGN_MAT vec3s q = {{s.raw[0][0] * qx + s.raw[1][0] * qy + s.raw[2][0] * qz,
+                                           s.raw[0][1] * qx + s.raw[1][1] * qy + s.raw[2][1] * qz,
+                                           s.raw[0][2] * qx + s.raw[1][2] * qy + s.raw[2][2] * qz}};
+
+                indexes[3 * i + 0] = rint(q.raw[0] / resolutions[0]);
+                indexes[3 * i + 1] = rint(q.raw[1] / resolutions[1]);
+                indexes[3 * i + 2] = rint(q.raw[2] / resolutions[2]);
+        }
+
+        hkl_sample_free(sample);
+        hkl_detector_free(detector);
+}
+
+static void qxqyqz_kernels(void)
+{
+        size_t i, j;
+        int res = TRUE;
+        int width = 37; /* not a multiple of the vectors nor of the blocks */
+        int height = 29;
+        size_t n_pixels = width * height;
+        size_t pixels_coordinates_dims[] = {3, height, width};
+        double resolutions[] = {0.01, 0.01, 0.01};
+        double axes[] = {1, 20, 30, 5}; /* mu, omega, delta, gamma */
+        double *pixels_coordinates = malloc(3 * n_pixels * sizeof(*pixels_coordinates));
+        uint32_t *img = malloc(n_pixels * sizeof(*img));
+        ptrdiff_t *indexes = malloc(3 * n_pixels * sizeof(*indexes));
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklBinocularsSpace *space = hkl_binoculars_space_new(n_pixels, 3);
+        HklBinocularsCube *cube = hkl_binoculars_cube_new_empty();
+        HklBinocularsCube *expected;
+
+        /* a fixed synthetic frame, the first pixel is at the origin
+         * of the detector to check the kf of a zero norm pixel */
+        for(i=0; i<n_pixels; ++i){
+                pixels_coordinates[0 * n_pixels + i] = 0 == i ? 0 : 1;
+                pixels_coordinates[1 * n_pixels + i] = 0 == i ? 0 : ((ptrdiff_t)(i % width) - width / 2) * 1e-3;
+                pixels_coordinates[2 * n_pixels + i] = 0 == i ? 0 : ((ptrdiff_t)(i / width) - height / 2) * 1e-3;
+                img[i] = 1 + i % 7;
+        }
+
+        res &= DIAG(hkl_geometry_axis_values_set(geometry, axes, ARRAY_SIZE(axes), HKL_UNIT_USER, NULL));
+        hkl_geometry_update(geometry);
+
+        hkl_binoculars_space_qcustom_uint32_t (space,
+                                               geometry,
+                                               img,
+                                               n_pixels,
+                                               1.0,
+                                               pixels_coordinates,
+                                               ARRAY_SIZE(pixels_coordinates_dims),
+                                               pixels_coordinates_dims,
+                                               resolutions,
+                                               ARRAY_SIZE(resolutions),
+                                               NULL,
+                                               HKL_BINOCULARS_SURFACE_ORIENTATION_HORIZONTAL,
+                                               NULL,
+                                               0,
+                                               0.0,
+                                               HKL_BINOCULARS_QCUSTOM_SUB_PROJECTION_QX_QY_QZ,
+                                               0, 0, 0,
+                                               NULL,
+                                               0);
+        hkl_binoculars_cube_add_space(cube, space);
+
+        /* the same bounds */
+        qxqyqz_reference(geometry, pixels_coordinates, n_pixels, resolutions, indexes);
+        res &= DIAG(3 == darray_size(cube->axes));
+        for(j=0; j<darray_size(cube->axes) && res; ++j){
+                ptrdiff_t imin = PTRDIFF_MAX;
+                ptrdiff_t imax = PTRDIFF_MIN;
+
+                for(i=0; i<n_pixels; ++i){
+                        imin = MIN(imin, indexes[3 * i + j]);
+                        imax = MAX(imax, indexes[3 * i + j]);
+                }
+                res &= DIAG(imin == darray_item(cube->axes, j).imin);
+                res &= DIAG(imax == darray_item(cube->axes, j).imax);
+        }
+
+        /* the same photons and contributions bin by bin */
+        if(res){
+                size_t len1 = axis_size(&darray_item(cube->axes, 1));
+                size_t len2 = axis_size(&darray_item(cube->axes, 2));
+
+                expected = hkl_binoculars_cube_new_from_axes(&cube->axes);
+                for(i=0; i<n_pixels; ++i){
+                        size_t w = ((indexes[3 * i + 0] - darray_item(cube->axes, 0).imin) * len1
+                                    + (indexes[3 * i + 1] - darray_item(cube->axes, 1).imin)) * len2
+                                + (indexes[3 * i + 2] - darray_item(cube->axes, 2).imin);
+
+                        expected->photons[w] += img[i];
+                        expected->contributions[w] += 1;
+                }
+                res &= DIAG(cube_data_equal(cube, expected));
+                res &= DIAG(n_pixels == cube_sum(cube, cube->contributions));
+                hkl_binoculars_cube_free(expected);
+        }
+
+        hkl_binoculars_cube_free(cube);
+        hkl_binoculars_space_free(space);
+        hkl_geometry_free(geometry);
+        free(indexes);
+        free(img);
+        free(pixels_coordinates);
+
+        ok(res == TRUE, __func__);
+}
+
+static void holder_inverse_transformation(void)
+{
+        int res = TRUE;
+        size_t i, n;
+        HklFactory **factories = hkl_factory_get_all(&n);
+
+        for(i=0; i<n; ++i){
+                HklHolder **holder;
+                HklGeometry *geometry = hkl_factory_create_new_geometry(factories[i]);
+
+                hkl_geometry_randomize(geometry);
+                hkl_geometry_update(geometry);
+
+                /* the analytic inverse of each holder transformation */
+                darray_foreach(holder, geometry->holders){
+                        size_t j, k;
+                        double epsilon = 1e-5 * (1 + hkl_vector_norm2(&(*holder)->t));
+                        CGLM_ALIGN_MAT mat4s m = glms_mat4_mul(hkl_binoculars_holder_transformation_get(*holder),
+                                                               hkl_binoculars_holder_inverse_transformation_get(*holder));
+
+                        for(j=0; j<4; ++j)
+                                for(k=0; k<4; ++k)
+                                        res &= DIAG(fabs(m.raw[j][k] - (j == k ? 1 : 0)) < epsilon);
+                }
+
+                hkl_geometry_free(geometry);
+        }
+
+        ok(res == TRUE, __func__);
+}
+
 static void hkl_projection(void)
 {
         size_t n;
@@ -437,26 +4179,26 @@ static void hkl_projection(void)
                                     {10, 10, 10, 10},
                                     {30, 30, 30, 30}};
 
-        /* the expected result for the three axes of the 1st detector */
-        static ptrdiff_t imin[HKL_BINOCULARS_DETECTOR_NUM_DETECTORS][3] = {{-14, -2, 0},
-                                                                           {-14, -2, 0},
-                                                                           {-14, -2, 0},
-                                                                           {-14, -2, -2},
-                                                                           {-13, 0, 0},
-                                                                           {-13, 0, 0},
-                                                                           {-13, -1, 0},
-                                                                           {-13, -1, 0}};
-
-        static ptrdiff_t imax[HKL_BINOCULARS_DETECTOR_NUM_DETECTORS][3] = {{1, 34, 15},
-                                                                           {1, 34, 19},
-                                                                           {1, 34, 14},
-                                                                           {1, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15}};
+        /* the expected result for the three axes of the 2D detectors */
+        static ptrdiff_t imin[][3] = {{-14, -2, 0},
+                                      {-14, -2, 0},
+                                      {-14, -2, 0},
+                                      {-14, -2, -2},
+                                      {-13, 0, 0},
+                                      {-13, 0, 0},
+                                      {-13, -1, 0},
+                                      {-13, -1, 0}};
 
-        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+        static ptrdiff_t imax[ARRAY_SIZE(imin)][3] = {{1, 34, 15},
+                                                      {1, 34, 19},
+                                                      {1, 34, 14},
+                                                      {1, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15}};
+
+        for(n=0; n<ARRAY_SIZE(imin); ++n){
                 size_t i;
                 int height;
                 int width;
@@ -530,6 +4272,104 @@ static void hkl_projection(void)
         ok(res == TRUE, __func__);
 }
 
+/* each domain of the multi domains hkl projection gives the space of
+ * its own hkl projection */
+static void hkl_domains_projection(void)
+{
+        size_t i;
+        int res = TRUE;
+        int height;
+        int width;
+        size_t arr_size;
+        HklFactory *factory = hkl_factory_get_by_name("ZAXIS", NULL);
+        HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+        HklSample *sample = hkl_sample_new("domain");
+        HklSample *twin;
+        HklParameter *ux;
+	HklLattice *lattice = hkl_lattice_new(2.556, 2.556, 2.556,
+                                              90 * HKL_DEGTORAD,
+                                              90 * HKL_DEGTORAD,
+                                              120 * HKL_DEGTORAD,
+                                              NULL);
+        HklBinocularsDetectorEnum n = HKL_BINOCULARS_DETECTOR_IMXPAD_S140;
+        double resolutions[] = {0.05, 0.05, 0.05};
+
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+        twin = hkl_sample_new_copy(sample);
+        ux = hkl_parameter_new_copy(hkl_sample_ux_get(twin));
+        res &= DIAG(hkl_parameter_value_set(ux, 60, HKL_UNIT_USER, NULL));
+        res &= DIAG(hkl_sample_ux_set(twin, ux, NULL));
+        hkl_parameter_free(ux);
+
+        const HklSample *samples[] = {sample, twin};
+
+        hkl_geometry_randomize(geometry);
+        hkl_binoculars_detector_2d_shape_get(n, &width, &height);
+
+        double *pixels_coordinates = hkl_binoculars_detector_2d_coordinates_get(n);
+        uint8_t *mask = hkl_binoculars_detector_2d_mask_get(n);
+        uint32_t *img = hkl_binoculars_detector_2d_fake_image_uint32(n, &arr_size);
+        size_t pixels_coordinates_dims[] = {3, height, width};
+        HklBinocularsSpace *space = hkl_binoculars_space_new(width * height, 3);
+        HklBinocularsSpace *spaces[] = {hkl_binoculars_space_new(width * height, 3),
+                                        hkl_binoculars_space_new(width * height, 3)};
+
+        hkl_binoculars_detector_2d_sixs_calibration(n, pixels_coordinates, width, height,
+                                                    100, 100, 1,
+                                                    0, 0);
+
+        hkl_binoculars_spaces_hkl_uint32_t (spaces,
+                                            geometry,
+                                            samples,
+                                            ARRAY_SIZE(samples),
+                                            img,
+                                            arr_size,
+                                            1.0,
+                                            pixels_coordinates,
+                                            ARRAY_SIZE(pixels_coordinates_dims),
+                                            pixels_coordinates_dims,
+                                            resolutions,
+                                            ARRAY_SIZE(resolutions),
+                                            mask,
+                                            NULL,
+                                            0,
+                                            1);
+
+        for(i=0; i<ARRAY_SIZE(samples); ++i){
+                hkl_binoculars_space_hkl_uint32_t (space,
+                                                   geometry,
+                                                   samples[i],
+                                                   img,
+                                                   arr_size,
+                                                   1.0,
+                                                   pixels_coordinates,
+                                                   ARRAY_SIZE(pixels_coordinates_dims),
+                                                   pixels_coordinates_dims,
+                                                   resolutions,
+                                                   ARRAY_SIZE(resolutions),
+                                                   mask,
+                                                   NULL,
+                                                   0,
+                                                   1);
+                res &= DIAG(space_equal(space, spaces[i]));
+        }
+        res &= DIAG(FALSE == space_equal(spaces[0], spaces[1]));
+
+        for(i=0; i<ARRAY_SIZE(spaces); ++i)
+                hkl_binoculars_space_free(spaces[i]);
+        hkl_binoculars_space_free(space);
+        free(img);
+        free(mask);
+        free(pixels_coordinates);
+        hkl_sample_free(twin);
+        hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+
+        ok(res == TRUE, __func__);
+}
+
 static void test_projection(void)
 {
         size_t n;
@@ -557,26 +4397,26 @@ static void test_projection(void)
                                     {10, 10, 10, 10},
                                     {30, 30, 30, 30}};
 
-        /* the expected result for the three axes of the 1st detector */
-        static ptrdiff_t imin[HKL_BINOCULARS_DETECTOR_NUM_DETECTORS][3] = {{-14, -2, 0},
-                                                                           {-14, -2, 0},
-                                                                           {-14, -2, 0},
-                                                                           {-14, -2, -2},
-                                                                           {-13, 0, 0},
-                                                                           {-13, 0, 0},
-                                                                           {-13, -1, 0},
-                                                                           {-13, -1, 0}};
-
-        static ptrdiff_t imax[HKL_BINOCULARS_DETECTOR_NUM_DETECTORS][3] = {{1, 34, 15},
-                                                                           {1, 34, 19},
-                                                                           {1, 34, 14},
-                                                                           {1, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15},
-                                                                           {0, 33, 15}};
+        /* the expected result for the three axes of the 2D detectors */
+        static ptrdiff_t imin[][3] = {{-14, -2, 0},
+                                      {-14, -2, 0},
+                                      {-14, -2, 0},
+                                      {-14, -2, -2},
+                                      {-13, 0, 0},
+                                      {-13, 0, 0},
+                                      {-13, -1, 0},
+                                      {-13, -1, 0}};
 
-        for(n=0; n<HKL_BINOCULARS_DETECTOR_NUM_DETECTORS; ++n){
+        static ptrdiff_t imax[ARRAY_SIZE(imin)][3] = {{1, 34, 15},
+                                                      {1, 34, 19},
+                                                      {1, 34, 14},
+                                                      {1, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15},
+                                                      {0, 33, 15}};
+
+        for(n=0; n<ARRAY_SIZE(imin); ++n){
                 size_t i;
                 int height;
                 int width;
@@ -681,17 +4521,58 @@ static void test_projection(void)
 
 int main(void)
 {
-	plan(10);
+	plan(51);
 
 	coordinates_get();
         coordinates_save();
+        calibrated_coordinates();
+        strip_calibration();
 	mask_get();
+        hot_pixels();
         mask_save();
+        mask_mmap();
+        mask_indexes();
         angles_projection();
         qcustom_projection();
+        cube_accumulate_qcustom();
+        cube_shared();
+        cube_add_space_shared();
+        space_n_frames();
+        cube_merge_n();
+        cube_weighted();
+        cube_sorted_scatter();
+        cube_interleaved();
+        cube_alloc();
+        qcustom_kf_cache();
+        frame_n_threads();
+        fast_trigonometry();
+        image_types();
+        corrections();
+        pixel_splitting();
+        qcustom_plan();
+        qcustom_expressions();
+        qcustom_lut();
+        cube_bounds();
+        footprint_suggest();
+        frame_stats();
+        cube_save_hdf5();
+        cube_hdf5_frames();
+        cube_slice_rebin();
+        cube_peaks();
+        cube_save_zarr();
+        cubes_save_hdf5();
+        process_config();
+        metrics_serve();
+        cube_window();
+        hdf5_read_frame_direct();
+        sparse_cube();
+        npy_descr();
         qparqper_projection();
         qxqyqz_projection();
+        qxqyqz_kernels();
+        holder_inverse_transformation();
         hkl_projection();
+        hkl_domains_projection();
         test_projection();
 
 	return 0;
@@ -63,6 +63,7 @@ static void get_axis(void)
 	HklHolder *holder = NULL;
 	const HklParameter *axis0;
 	GError *error;
+	int idx;
 
 	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
 
@@ -114,6 +115,23 @@ static void get_axis(void)
 	res &= DIAG(error != NULL);
 	g_clear_error(&error);
 
+	/* by index */
+	idx = hkl_geometry_axis_idx_get(g, "A");
+	res &= DIAG(idx >= 0);
+	res &= DIAG(-1 == hkl_geometry_axis_idx_get(g, "DONOTEXIST"));
+	res &= DIAG(axis0 == hkl_geometry_axis_get_by_idx(g, idx, NULL));
+	res &= DIAG(NULL == hkl_geometry_axis_get_by_idx(g, 100, &error));
+	res &= DIAG(error != NULL);
+	g_clear_error(&error);
+
+	res &= DIAG(TRUE == hkl_geometry_axis_set_by_idx(g, idx, axis0, NULL));
+	res &= DIAG(FALSE == hkl_geometry_axis_set_by_idx(g, hkl_geometry_axis_idx_get(g, "B"), axis0, &error));
+	res &= DIAG(error != NULL);
+	g_clear_error(&error);
+	res &= DIAG(FALSE == hkl_geometry_axis_set_by_idx(g, 100, axis0, &error));
+	res &= DIAG(error != NULL);
+	g_clear_error(&error);
+
 	ok(res, __func__);
 
 	hkl_geometry_free(g);
@@ -155,6 +173,125 @@ static void update(void)
 	hkl_geometry_free(g);
 }
 
+static void update_incremental(void)
+{
+	int res = TRUE;
+	size_t i, n;
+	HklFactory **factories;
+
+	factories = hkl_factory_get_all(&n);
+	for(i=0; i<n && TRUE == res; i++){
+		HklGeometry *geometry;
+		HklParameter **axis;
+
+		geometry = hkl_factory_create_new_geometry(factories[i]);
+		hkl_geometry_randomize(geometry);
+
+		/* change one axis at a time, the holders are only
+		 * recomputed from this axis */
+		darray_foreach(axis, geometry->axes){
+			HklGeometry *ref = hkl_factory_create_new_geometry(factories[i]);
+			size_t n_axes = darray_size(geometry->axes);
+			double values[n_axes];
+			size_t j;
+
+			res &= DIAG(hkl_parameter_value_set(*axis, (*axis)->_value + 0.1,
+							    HKL_UNIT_DEFAULT, NULL));
+			hkl_geometry_update(geometry);
+
+			/* the reference is computed from scratch */
+			hkl_geometry_axis_values_get(geometry, values, n_axes, HKL_UNIT_DEFAULT);
+			res &= DIAG(hkl_geometry_axis_values_set(ref, values, n_axes,
+								 HKL_UNIT_DEFAULT, NULL));
+			for(j=0; j<darray_size(geometry->holders); ++j)
+				res &= DIAG(TRUE == hkl_quaternion_cmp(&darray_item(ref->holders, j)->q,
+								       &darray_item(geometry->holders, j)->q));
+
+			hkl_geometry_free(ref);
+		}
+
+		hkl_geometry_free(geometry);
+	}
+
+	ok(res, __func__);
+}
+
+static void update_unchanged(void)
+{
+	int res = TRUE;
+	size_t i, n;
+	HklFactory **factories;
+
+	factories = hkl_factory_get_all(&n);
+	for(i=0; i<n && TRUE == res; i++){
+		HklGeometry *geometry;
+		HklParameter **axis;
+
+		geometry = hkl_factory_create_new_geometry(factories[i]);
+		hkl_geometry_randomize(geometry);
+		hkl_geometry_update(geometry);
+
+		/* writing back the same values (like the solvers for
+		 * the axes which do not move) does not invalidate the
+		 * holders */
+		darray_foreach(axis, geometry->axes){
+			res &= DIAG(hkl_parameter_value_set(*axis, (*axis)->_value,
+							    HKL_UNIT_DEFAULT, NULL));
+			res &= DIAG(FALSE == (*axis)->changed);
+		}
+
+		hkl_geometry_free(geometry);
+	}
+
+	ok(res, __func__);
+}
+
+static void transformation_apply_n(void)
+{
+	int res = TRUE;
+	HklGeometry *g;
+	HklHolder *holder;
+	HklHolder **h;
+	const HklVector vs[] = {{{0, 0, 0}}, {{1, 0, 0}}, {{1, -2, 3}}};
+	HklVector ts[ARRAY_SIZE(vs)];
+	size_t i;
+
+	/* the composition of all kinds of axes */
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_translation(holder, "T", 0., 1., 0., &hkl_unit_length_mm);
+	hkl_holder_add_rotation_with_origin(holder, "B", 0., 0., 1., 1., 2., 3., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "C", 0., 1., 0., &hkl_unit_angle_deg);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_translation(holder, "U", 1., 1., 0., &hkl_unit_length_mm);
+
+	for(i=0; i<3; ++i){
+		size_t j;
+
+		/* a new random position, then only the last holder axes */
+		if(i < 2)
+			hkl_geometry_randomize(g);
+		else
+			res &= DIAG(hkl_parameter_value_set(darray_item(g->axes, 3),
+							    0.5, HKL_UNIT_DEFAULT, NULL));
+		hkl_geometry_update(g);
+
+		darray_foreach(h, g->holders){
+			hkl_holder_transformation_apply_n(*h, vs, ts, ARRAY_SIZE(vs));
+			for(j=0; j<ARRAY_SIZE(vs); ++j){
+				HklVector v = hkl_holder_transformation_apply(*h, &vs[j]);
+
+				res &= DIAG(FALSE == hkl_vector_cmp(&v, &ts[j]));
+			}
+		}
+	}
+
+	ok(res, __func__);
+
+	hkl_geometry_free(g);
+}
+
 static void set(void)
 {
 	HklGeometry *g;
@@ -187,6 +324,91 @@ static void set(void)
 	hkl_geometry_free(g);
 }
 
+static void copy(void)
+{
+	int res = TRUE;
+	size_t i, n;
+	HklFactory **factories;
+
+	factories = hkl_factory_get_all(&n);
+	for(i=0; i<n && TRUE == res; i++){
+		HklGeometry *g;
+		HklGeometry *g1;
+		HklGeometry *g2;
+		HklHolder *holder;
+		size_t j;
+
+		g = hkl_factory_create_new_geometry(factories[i]);
+		hkl_geometry_randomize(g);
+
+		/* the copy of a copy is done in one block */
+		g1 = hkl_geometry_new_copy(g);
+		g2 = hkl_geometry_new_copy(g1);
+		res &= DIAG(darray_size(g->axes) == darray_size(g2->axes));
+		for(j=0; j<darray_size(g->axes); ++j){
+			const HklParameter *axis = darray_item(g->axes, j);
+			const HklParameter *axis2 = darray_item(g2->axes, j);
+
+			res &= DIAG(axis != axis2);
+			res &= DIAG(!strcmp(axis->name, axis2->name));
+			res &= DIAG(axis->_value == axis2->_value);
+			res &= DIAG(axis->ops == axis2->ops);
+		}
+		res &= DIAG(0. == hkl_geometry_distance(g, g2));
+
+		/* the axes added to a copy are released with it */
+		holder = hkl_geometry_add_holder(g2);
+		hkl_holder_add_rotation(holder, "copy", 1., 0., 0., &hkl_unit_angle_deg);
+		res &= DIAG(darray_size(g->axes) + 1 == darray_size(g2->axes));
+		res &= DIAG(hkl_geometry_set(g1, g));
+
+		hkl_geometry_free(g2);
+		hkl_geometry_free(g1);
+		hkl_geometry_free(g);
+	}
+
+	ok(res, __func__);
+}
+
+static void factory_shared(void)
+{
+	int res = TRUE;
+	size_t i, n;
+	HklFactory **factories;
+
+	factories = hkl_factory_get_all(&n);
+	for(i=0; i<n && TRUE == res; i++){
+		HklGeometry *g1;
+		HklGeometry *g2;
+		HklHolder *h1;
+		HklHolder *h2;
+		size_t len;
+
+		g1 = hkl_factory_create_new_geometry(factories[i]);
+		g2 = hkl_factory_create_new_geometry(factories[i]);
+
+		/* the holders configuration is shared between the geometries */
+		h1 = darray_item(g1->holders, HKL_HOLDER_SAMPLE_IDX);
+		h2 = darray_item(g2->holders, HKL_HOLDER_SAMPLE_IDX);
+		res &= DIAG(h1->config == h2->config);
+		res &= DIAG(0. == hkl_geometry_distance(g1, g2));
+
+		/* but an axis added to one of them is only in its holder */
+		len = h2->config->len;
+		hkl_holder_add_rotation(h1, "shared", 1., 0., 0., &hkl_unit_angle_deg);
+		res &= DIAG(h1->config != h2->config);
+		res &= DIAG(len + 1 == h1->config->len);
+		res &= DIAG(len == h2->config->len);
+		hkl_geometry_randomize(g2);
+		hkl_geometry_update(g2);
+
+		hkl_geometry_free(g2);
+		hkl_geometry_free(g1);
+	}
+
+	ok(res, __func__);
+}
+
 static void axis_values_get_set(void)
 {
 	unsigned int i;
@@ -256,6 +478,147 @@ static void distance(void)
 	hkl_geometry_free(g2);
 }
 
+static void closest(void)
+{
+	int res = TRUE;
+	HklGeometry *g;
+	HklGeometryList *list;
+	HklHolder *holder;
+	const HklGeometryListItem *item;
+	double distances[3];
+	size_t i;
+	const double positions[] = {30., 0., 0., 0.,
+				    10., 10., 10., 0.,
+				    350., 0., 0., 0.};
+	const double weights[] = {1., 10., 10., 1.};
+
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "B", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "C", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_translation(holder, "T", 1., 0., 0., &hkl_unit_length_mm);
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL, 0., 0., 0., 0.));
+
+	res &= DIAG(0 == hkl_geometry_closest_get(g, positions, 3, 4, HKL_UNIT_USER,
+						  NULL, 0, HKL_GEOMETRY_DISTANCE_SUM, FALSE,
+						  distances, 3));
+	res &= DIAG(fabs(distances[0] - 30. * HKL_DEGTORAD) < HKL_EPSILON);
+	res &= DIAG(fabs(distances[1] - 30. * HKL_DEGTORAD) < HKL_EPSILON);
+	res &= DIAG(fabs(distances[2] - 350. * HKL_DEGTORAD) < HKL_EPSILON);
+
+	/* the shortest way around */
+	res &= DIAG(2 == hkl_geometry_closest_get(g, positions, 3, 4, HKL_UNIT_USER,
+						  NULL, 0, HKL_GEOMETRY_DISTANCE_SUM, TRUE,
+						  distances, 3));
+	res &= DIAG(fabs(distances[2] - 10. * HKL_DEGTORAD) < HKL_EPSILON);
+
+	/* the motors move together */
+	res &= DIAG(1 == hkl_geometry_closest_get(g, positions, 3, 4, HKL_UNIT_USER,
+						  NULL, 0, HKL_GEOMETRY_DISTANCE_MAX, FALSE,
+						  NULL, 0));
+
+	/* slow B and C motors */
+	res &= DIAG(0 == hkl_geometry_closest_get(g, positions, 3, 4, HKL_UNIT_USER,
+						  weights, 4, HKL_GEOMETRY_DISTANCE_MAX, FALSE,
+						  NULL, 0));
+
+	res &= DIAG(3 == hkl_geometry_closest_get(g, positions, 0, 4, HKL_UNIT_USER,
+						  NULL, 0, HKL_GEOMETRY_DISTANCE_SUM, FALSE,
+						  NULL, 0));
+
+	/* the same with a list */
+	list = hkl_geometry_list_new();
+	res &= DIAG(NULL == hkl_geometry_list_closest_get(list, g, NULL, 0, HKL_GEOMETRY_DISTANCE_SUM));
+	for(i=0; i<3; ++i){
+		HklGeometry *candidate = hkl_geometry_new_copy(g);
+
+		res &= DIAG(hkl_geometry_axis_values_set(candidate, (double *)&positions[i * 4], 4,
+							 HKL_UNIT_USER, NULL));
+		hkl_geometry_list_add(list, candidate);
+		hkl_geometry_free(candidate);
+	}
+	item = hkl_geometry_list_closest_get(list, g, NULL, 0, HKL_GEOMETRY_DISTANCE_MAX);
+	res &= DIAG(NULL != item);
+	res &= DIAG(item == hkl_geometry_list_items_next_get(list, hkl_geometry_list_items_first_get(list)));
+
+	ok(res, __func__);
+
+	hkl_geometry_free(g);
+	hkl_geometry_list_free(list);
+}
+
+static void kf_array(void)
+{
+	int res = TRUE;
+	HklFactory *factory = hkl_factory_get_by_name("K6C", NULL);
+	HklGeometry *g = hkl_factory_create_new_geometry(factory);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	/* two pixels along the 0D detector direction, x then y then z */
+	const double pixels[] = {1., 2.,
+				 0., 0.,
+				 0., 0.};
+	double kf[ARRAY_SIZE(pixels)];
+	double q[ARRAY_SIZE(pixels)];
+	HklVector kf0, ki;
+	size_t i, j;
+
+	hkl_geometry_randomize(g);
+	kf0 = hkl_geometry_kf_get(g, detector);
+	ki = hkl_geometry_ki_get(g);
+
+	hkl_geometry_kf_array_get(g, detector, pixels, ARRAY_SIZE(pixels), kf, ARRAY_SIZE(kf));
+	hkl_geometry_q_array_get(g, detector, pixels, ARRAY_SIZE(pixels), q, ARRAY_SIZE(q));
+	for(i=0; i<2; ++i)
+		for(j=0; j<3; ++j){
+			res &= DIAG(fabs(kf[j * 2 + i] - kf0.data[j]) < HKL_EPSILON);
+			res &= DIAG(fabs(q[j * 2 + i] - kf0.data[j] + ki.data[j]) < HKL_EPSILON);
+		}
+
+	ok(res, __func__);
+
+	hkl_detector_free(detector);
+	hkl_geometry_free(g);
+}
+
+static void qper_qpar_array(void)
+{
+	int res = TRUE;
+	HklFactory *factory = hkl_factory_get_by_name("K6C", NULL);
+	HklGeometry *g = hkl_factory_create_new_geometry(factory);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	HklSample *sample = hkl_sample_new("test");
+	const double pixels[] = {1., 2.,
+				 0., 0.,
+				 0., 0.};
+	const HklVector surface = {{0, 0, 1}};
+	double qper[ARRAY_SIZE(pixels) / 3];
+	double qpar[ARRAY_SIZE(pixels) / 3];
+	HklVector ki, q, n = surface;
+	size_t i;
+
+	hkl_geometry_randomize(g);
+	ki = hkl_geometry_ki_get(g);
+	q = hkl_geometry_kf_get(g, detector);
+	hkl_vector_minus_vector(&q, &ki);
+	hkl_vector_rotated_quaternion(&n, &hkl_geometry_sample_holder_get(g, sample)->q);
+
+	hkl_geometry_qper_qpar_array_get(g, detector, sample, &surface,
+					 pixels, ARRAY_SIZE(pixels),
+					 qper, qpar, ARRAY_SIZE(qper));
+	for(i=0; i<ARRAY_SIZE(qper); ++i){
+		res &= DIAG(fabs(qper[i] - hkl_vector_scalar_product(&q, &n)) < HKL_EPSILON);
+		res &= DIAG(fabs(qper[i] * qper[i] + qpar[i] * qpar[i]
+				 - hkl_vector_scalar_product(&q, &q)) < HKL_EPSILON);
+	}
+
+	ok(res, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(g);
+}
+
 static void is_valid(void)
 {
 	int res = TRUE;
@@ -377,10 +740,185 @@ static void list(void)
 			  HKL_EPSILON, __func__);
 	}
 
+	/* all the axes values in one buffer, a solution per row */
+	{
+		double buffer[3 * 4];
+
+		res &= DIAG(3 == hkl_geometry_list_axis_values_get(list, buffer, ARRAY_SIZE(buffer),
+								     HKL_UNIT_DEFAULT));
+		for(i=0; i<3; ++i)
+			res &= DIAG(fabs(values[i] - buffer[i * 4]) < HKL_EPSILON);
+
+		/* only the complete solutions */
+		res &= DIAG(1 == hkl_geometry_list_axis_values_get(list, buffer, 7,
+								     HKL_UNIT_DEFAULT));
+	}
+
+	ok(res, __func__);
+
+	hkl_geometry_free(g);
+	hkl_geometry_list_free(list);
+}
+
+static void list_copy(void)
+{
+	int i = 0;
+	int res = TRUE;
+	HklGeometry *g;
+	HklGeometry *geometry;
+	HklGeometryList *list;
+	HklGeometryList *copy;
+	HklGeometryListItem *item;
+	const HklGeometryListItem *item_copy;
+	HklHolder *holder;
+	static double values[] = {0. * HKL_DEGTORAD, 10 * HKL_DEGTORAD, 30 * HKL_DEGTORAD};
+
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+
+	list = hkl_geometry_list_new();
+	for(i=0; i<ARRAY_SIZE(values); ++i){
+		res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL, values[i]));
+		hkl_geometry_list_add(list, g);
+	}
+
+	/* the copy shares the geometries */
+	copy = hkl_geometry_list_new_copy(list);
+	for(i=0; i<list->n_items; ++i)
+		res &= DIAG(darray_item(list->items, i)->geometry
+			    == darray_item(copy->items, i)->geometry);
+
+	/* a modification copies the geometry first */
+	item = darray_item(list->items, 0);
+	geometry = hkl_geometry_list_item_geometry_unshare(item);
+	item_copy = hkl_geometry_list_items_first_get(copy);
+	res &= DIAG(geometry != item_copy->geometry);
+	res &= DIAG(geometry == hkl_geometry_list_item_geometry_unshare(item));
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_DEFAULT, NULL, values[2]));
+
+	/* the copy outlives the list */
+	hkl_geometry_list_free(list);
+	i = 0;
+	HKL_GEOMETRY_LIST_FOREACH(item_copy, copy){
+		res &= DIAG(values[i++] == hkl_parameter_value_get(darray_item(item_copy->geometry->axes, 0),
+								   HKL_UNIT_DEFAULT));
+	}
+
 	ok(res, __func__);
 
 	hkl_geometry_free(g);
+	hkl_geometry_list_free(copy);
+}
+
+static void list_sort(void)
+{
+	size_t i;
+	int res = TRUE;
+	HklGeometry *g;
+	HklGeometry *ref;
+	HklGeometryList *list;
+	HklGeometryList *closest;
+	const HklGeometryListItem *item;
+	const HklGeometryListItem *item_closest;
+	HklHolder *holder;
+	double last = 0;
+
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "B", 0., 1., 0., &hkl_unit_angle_deg);
+	ref = hkl_geometry_new_copy(g);
+
+	list = hkl_geometry_list_new();
+	for(i=0; i<300; ++i){
+		hkl_geometry_randomize(g);
+		hkl_geometry_list_add(list, g);
+	}
+	closest = hkl_geometry_list_new_copy(list);
+
+	/* sorted by increasing distance */
+	hkl_geometry_list_sort(list, ref);
+	res &= DIAG(300 == hkl_geometry_list_n_items_get(list));
+	HKL_GEOMETRY_LIST_FOREACH(item, list){
+		double distance = hkl_geometry_distance(ref, item->geometry);
+
+		res &= DIAG(distance >= last - HKL_EPSILON);
+		last = distance;
+	}
+
+	/* the closest are the first of the sorted list */
+	hkl_geometry_list_sort_closest(closest, ref, 5);
+	res &= DIAG(5 == hkl_geometry_list_n_items_get(closest));
+	item = hkl_geometry_list_items_first_get(list);
+	HKL_GEOMETRY_LIST_FOREACH(item_closest, closest){
+		res &= DIAG(item->geometry == item_closest->geometry);
+		item = hkl_geometry_list_items_next_get(list, item);
+	}
+
+	ok(res, __func__);
+
+	hkl_geometry_free(ref);
+	hkl_geometry_free(g);
+	hkl_geometry_list_free(closest);
+	hkl_geometry_list_free(list);
+}
+
+static void list_sort_time(void)
+{
+	int res = TRUE;
+	double v, a;
+	HklGeometry *g1, *g2;
+	HklGeometry *ref;
+	HklGeometryList *list;
+	HklHolder *holder;
+	HklParameter *axisA, *axisB;
+
+	ref = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(ref);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "B", 0., 1., 0., &hkl_unit_angle_deg);
+	axisA = hkl_geometry_get_axis_by_name(ref, "A");
+	axisB = hkl_geometry_get_axis_by_name(ref, "B");
+
+	/* no limit, no time */
+	g1 = hkl_geometry_new_copy(ref);
+	res &= DIAG(hkl_geometry_set_values_v(g1, HKL_UNIT_DEFAULT, NULL, 4., 0.));
+	res &= DIAG(0. == hkl_geometry_motion_time(ref, g1));
+
+	/* the trapezoidal and the triangular moves */
+	hkl_parameter_motion_set(axisA, 1., 1., HKL_UNIT_DEFAULT);
+	res &= DIAG(fabs(5. - hkl_geometry_motion_time(ref, g1)) < HKL_EPSILON);
+	res &= DIAG(hkl_geometry_set_values_v(g1, HKL_UNIT_DEFAULT, NULL, .25, 0.));
+	res &= DIAG(fabs(1. - hkl_geometry_motion_time(ref, g1)) < HKL_EPSILON);
+
+	hkl_parameter_motion_get(axisA, &v, &a, HKL_UNIT_USER);
+	res &= DIAG(fabs(v - 180. / M_PI) < HKL_EPSILON);
+	res &= DIAG(fabs(a - 180. / M_PI) < HKL_EPSILON);
+
+	/* A is ten times slower than B */
+	hkl_parameter_motion_set(axisA, 1., 0., HKL_UNIT_USER);
+	hkl_parameter_motion_set(axisB, 10., 0., HKL_UNIT_USER);
+	res &= DIAG(hkl_geometry_set_values_v(g1, HKL_UNIT_USER, NULL, 10., 0.));
+	g2 = hkl_geometry_new_copy(ref);
+	res &= DIAG(hkl_geometry_set_values_v(g2, HKL_UNIT_USER, NULL, 0., 90.));
+
+	list = hkl_geometry_list_new();
+	hkl_geometry_list_add(list, g1);
+	hkl_geometry_list_add(list, g2);
+
+	/* the closest is not the fastest */
+	hkl_geometry_list_sort(list, ref);
+	res &= DIAG(hkl_geometry_distance(g1, hkl_geometry_list_items_first_get(list)->geometry) < HKL_EPSILON);
+	hkl_geometry_list_sort_cost(list, ref, hkl_geometry_motion_time);
+	res &= DIAG(hkl_geometry_distance(g2, hkl_geometry_list_items_first_get(list)->geometry) < HKL_EPSILON);
+
+	ok(res, __func__);
+
 	hkl_geometry_list_free(list);
+	hkl_geometry_free(g2);
+	hkl_geometry_free(g1);
+	hkl_geometry_free(ref);
 }
 
 static void  list_multiply_from_range(void)
@@ -424,6 +962,70 @@ static void  list_multiply_from_range(void)
 	hkl_geometry_list_free(list);
 }
 
+static void  list_multiply_from_range_closest(void)
+{
+	int res = TRUE;
+	HklGeometry *g;
+	HklGeometryList *list;
+	HklHolder *holder;
+	const HklGeometryListItem *item;
+	HklParameter *axisA, *axisB, *axisC, *axisT;
+
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "B", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "C", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_translation(holder, "T", 1., 0., 0., &hkl_unit_length_mm);
+
+	axisA = hkl_geometry_get_axis_by_name(g, "A");
+	axisB = hkl_geometry_get_axis_by_name(g, "B");
+	axisC = hkl_geometry_get_axis_by_name(g, "C");
+	axisT = hkl_geometry_get_axis_by_name(g, "T");
+
+	res &= DIAG(hkl_parameter_min_max_set(axisA, -190, 190, HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(axisB, -190, 190, HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(axisC, -190, 190, HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(axisT, -190, 190., HKL_UNIT_USER, NULL));
+
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL,
+					      185. * HKL_DEGTORAD, -185. * HKL_DEGTORAD, 190. * HKL_DEGTORAD, 100.));
+
+	/* no bound, the same solutions than without the reference */
+	list = hkl_geometry_list_new();
+	hkl_geometry_list_add(list, g);
+	hkl_geometry_list_multiply_from_range_closest(list, g, 0, INFINITY);
+	res &= DIAG(8 == hkl_geometry_list_n_items_get(list));
+
+	/* the 3 closest one, one axis shifted of 2π */
+	hkl_geometry_list_reset(list);
+	hkl_geometry_list_add(list, g);
+	hkl_geometry_list_multiply_from_range_closest(list, g, 3, INFINITY);
+	res &= DIAG(4 == hkl_geometry_list_n_items_get(list));
+	item = hkl_geometry_list_items_first_get(list);
+	while((item = hkl_geometry_list_items_next_get(list, item)) != NULL)
+		res &= DIAG(fabs(hkl_geometry_distance(g, item->geometry) - 2 * M_PI) < HKL_EPSILON);
+
+	/* the same with a maximum distance */
+	hkl_geometry_list_reset(list);
+	hkl_geometry_list_add(list, g);
+	hkl_geometry_list_multiply_from_range_closest(list, g, 0, 3 * M_PI);
+	res &= DIAG(4 == hkl_geometry_list_n_items_get(list));
+
+	/* the farthest one comes last */
+	hkl_geometry_list_reset(list);
+	hkl_geometry_list_add(list, g);
+	hkl_geometry_list_multiply_from_range_closest(list, g, 7, INFINITY);
+	res &= DIAG(8 == hkl_geometry_list_n_items_get(list));
+	res &= DIAG(fabs(hkl_geometry_distance(g, darray_item(list->items, list->n_items - 1)->geometry)
+			 - 6 * M_PI) < HKL_EPSILON);
+
+	ok(res, __func__);
+
+	hkl_geometry_free(g);
+	hkl_geometry_list_free(list);
+}
+
 static void  list_remove_invalid(void)
 {
 	int res = TRUE;
@@ -482,23 +1084,105 @@ static void  list_remove_invalid(void)
 	hkl_geometry_list_free(list);
 }
 
+static void list_remove_unreachable(void)
+{
+	int res = TRUE;
+	HklGeometry *g;
+	HklGeometryList *list;
+	HklGeometryRanges ranges;
+	HklHolder *holder;
+	const HklGeometryListItem *item;
+	double values[4 * 3];
+	int valid[4];
+	size_t i, n = 0;
+
+	g = hkl_geometry_new(NULL, &hkl_geometry_operations_defaults);
+	holder = hkl_geometry_add_holder(g);
+	hkl_holder_add_rotation(holder, "A", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_rotation(holder, "B", 1., 0., 0., &hkl_unit_angle_deg);
+	hkl_holder_add_translation(holder, "T", 1., 0., 0., &hkl_unit_length_mm);
+
+	res &= DIAG(hkl_parameter_min_max_set(hkl_geometry_get_axis_by_name(g, "A"),
+					      -100, 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(hkl_geometry_get_axis_by_name(g, "B"),
+					      -100, 180., HKL_UNIT_USER, NULL));
+	res &= DIAG(hkl_parameter_min_max_set(hkl_geometry_get_axis_by_name(g, "T"),
+					      0.0, 179., HKL_UNIT_USER, NULL));
+
+	list = hkl_geometry_list_new();
+
+	/* out of range but reachable with a 2π shift */
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL,
+					      530. * HKL_DEGTORAD, -190. * HKL_DEGTORAD, 0.1));
+	hkl_geometry_list_add(list, g);
+	/* in range */
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL,
+					      10. * HKL_DEGTORAD, 20. * HKL_DEGTORAD, 0.1));
+	hkl_geometry_list_add(list, g);
+	/* no 2π shift of A in [-100, 180] */
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL,
+					      200. * HKL_DEGTORAD, 0., 0.1));
+	hkl_geometry_list_add(list, g);
+	/* a translation is never shifted */
+	res &= DIAG(hkl_geometry_set_values_v(g, HKL_UNIT_DEFAULT, NULL,
+					      0., 0., -0.1));
+	hkl_geometry_list_add(list, g);
+
+	/* without the shifts, the same validity than one geometry at a time */
+	HKL_GEOMETRY_LIST_FOREACH(item, list){
+		hkl_geometry_axis_values_get(item->geometry, &values[n], 3, HKL_UNIT_DEFAULT);
+		n += 3;
+	}
+	hkl_geometry_ranges_init(&ranges, g);
+	res &= DIAG(1 == hkl_geometry_ranges_check(&ranges, values, 4, FALSE, valid));
+	i = 0;
+	HKL_GEOMETRY_LIST_FOREACH(item, list)
+		res &= DIAG(valid[i++] == hkl_geometry_is_valid_range(item->geometry));
+	res &= DIAG(2 == hkl_geometry_ranges_check(&ranges, values, 4, TRUE, valid));
+	hkl_geometry_ranges_release(&ranges);
+
+	res &= DIAG(2 == hkl_geometry_list_remove_unreachable(list));
+	res &= DIAG(2 == hkl_geometry_list_n_items_get(list));
+	hkl_geometry_list_multiply_from_range(list);
+	hkl_geometry_list_remove_invalid(list);
+	res &= DIAG(2 == hkl_geometry_list_n_items_get(list));
+
+	ok(res, __func__);
+
+	hkl_geometry_free(g);
+	hkl_geometry_list_free(list);
+}
+
 int main(void)
 {
-	plan(48);
+	plan(61);
 
 	add_holder();
 	get_axis();
 	update();
+	update_incremental();
+	update_unchanged();
+	transformation_apply_n();
 	set();
+	copy();
+	factory_shared();
 	axis_values_get_set();
 	distance();
+	closest();
+	kf_array();
+	qper_qpar_array();
 	is_valid();
 	wavelength();
 	xxx_rotation_get();
 
 	list();
+	list_copy();
+	list_sort();
+	list_sort_time();
 	list_multiply_from_range();
+	list_multiply_from_range_closest();
 	list_remove_invalid();
+	list_remove_unreachable();
 
 	return 0;
 }
@@ -357,9 +357,60 @@ static void get_1_B(void)
 	hkl_matrix_free(I_ref);
 }
 
+static void get_B_memoised(void)
+{
+	int res = TRUE;
+	HklLattice *lattice;
+	HklLattice *ref;
+	HklLattice *copy;
+	HklMatrix *B = hkl_matrix_new();
+	HklMatrix *B_ref = hkl_matrix_new();
+
+	lattice = hkl_lattice_new(1.54, 1.54, 1.54,
+				  90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD,
+				  NULL);
+	res &= DIAG(hkl_lattice_get_B(lattice, B));
+
+	/* the B matrix follows the angles */
+	res &= DIAG(hkl_lattice_set(lattice, 1.54, 1.54, 1.54,
+				    80 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 100 * HKL_DEGTORAD,
+				    HKL_UNIT_DEFAULT, NULL));
+	ref = hkl_lattice_new(1.54, 1.54, 1.54,
+			      80 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 100 * HKL_DEGTORAD,
+			      NULL);
+	res &= DIAG(hkl_lattice_get_B(lattice, B));
+	res &= DIAG(hkl_lattice_get_B(ref, B_ref));
+	res &= DIAG(hkl_matrix_cmp(B_ref, B));
+	hkl_lattice_free(ref);
+
+	/* and only one length */
+	res &= DIAG(hkl_lattice_set(lattice, 2., 1.54, 1.54,
+				    80 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 100 * HKL_DEGTORAD,
+				    HKL_UNIT_DEFAULT, NULL));
+	ref = hkl_lattice_new(2., 1.54, 1.54,
+			      80 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 100 * HKL_DEGTORAD,
+			      NULL);
+	res &= DIAG(hkl_lattice_get_B(lattice, B));
+	res &= DIAG(hkl_lattice_get_B(ref, B_ref));
+	res &= DIAG(hkl_matrix_cmp(B_ref, B));
+
+	/* a copy keeps the memoised matrix of its parameters */
+	copy = hkl_lattice_new_copy(lattice);
+	res &= DIAG(hkl_lattice_get_B(copy, B));
+	res &= DIAG(hkl_matrix_cmp(B_ref, B));
+
+	ok(res, __func__);
+
+	hkl_lattice_free(copy);
+	hkl_lattice_free(ref);
+	hkl_lattice_free(lattice);
+	hkl_matrix_free(B_ref);
+	hkl_matrix_free(B);
+}
+
 int main(void)
 {
-	plan(147);
+	plan(148);
 
 	new();
 	new_copy();
@@ -368,6 +419,7 @@ int main(void)
 	volume();
 	get_B();
 	get_1_B();
+	get_B_memoised();
 
 	return 0;
 }
@@ -117,6 +117,27 @@ static void times_vector(void)
 	ok(0 == hkl_vector_cmp(&v_ref, &v), __func__);
 }
 
+static void times_vector_array(void)
+{
+	HklMatrix m = {{{ 1.0, 3.0,-2.0},
+			{10.0, 5.0, 5.0},
+			{-3.0, 2.0, 0.0}}
+	};
+	double v[] = {1, -1,
+		      2, .5,
+		      3, 2};
+	HklVector v1_ref = {{1, 35, 1}};
+	HklVector v2_ref = {{-3.5, 2.5, 4}};
+	HklVector v1;
+	HklVector v2;
+
+	hkl_matrix_times_vector_array(&m, v, 2);
+	hkl_vector_init(&v1, v[0], v[2], v[4]);
+	hkl_vector_init(&v2, v[1], v[3], v[5]);
+	ok(0 == hkl_vector_cmp(&v1_ref, &v1)
+	   && 0 == hkl_vector_cmp(&v2_ref, &v2), __func__);
+}
+
 static void times_matrix(void)
 {
 	HklMatrix m_ref = {{{37., 14., 13.},
@@ -151,7 +172,7 @@ static void transpose(void)
 
 int main(void)
 {
-	plan(18);
+	plan(19);
 
 	init();
 	cmp();
@@ -160,6 +181,7 @@ int main(void)
 	init_from_euler();
 	init_from_two_vector();
 	times_vector();
+	times_vector_array();
 	times_matrix();
 	transpose();
 
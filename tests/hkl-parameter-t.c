@@ -79,6 +79,7 @@ static void new(void)
 	res &= DIAG(TRUE == p->changed);
 	res &= DIAG(&hkl_unit_angle_rad == p->unit);
 	res &= DIAG(&hkl_unit_angle_deg == p->punit);
+	res &= DIAG(fabs(HKL_RADTODEG - p->factor) < HKL_EPSILON);
 
 	hkl_parameter_free(p);
 
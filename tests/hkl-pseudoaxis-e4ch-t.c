@@ -20,6 +20,7 @@
  * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
  *          Jens Krüger <jens.krueger@frm.tum.de>
  */
+#include <string.h>
 #include "hkl.h"
 #include <tap/basic.h>
 #include <tap/hkl-tap.h>
@@ -394,9 +395,84 @@ static void petra3_p01(void)
 	ok(res == TRUE, __func__);
 }
 
+static void fixed_geometry(void)
+{
+	int res = TRUE;
+	size_t i, j;
+	struct Sample cu = CU;
+	HklSample *sample = newSample(cu);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	Geometry gconfigs[] = {
+		E4ch(1.54, VALUES(30., 10., 20., 60.)),
+		E6c(1.54, VALUES(5., 30., 10., 20., 3., 60.)),
+		K6c(1.54, VALUES(5., 30., 10., 20., 3., 60.)),
+		SoleilSixsMed2_3(1.54, VALUES(1., 2., 3., 4., 5., 6.)),
+	};
+
+	/* same hkl than the generic engine */
+	for(i=0; i<ARRAY_SIZE(gconfigs); ++i){
+		double fixed[3];
+		double generic[3];
+		HklGeometry *geometry = newGeometry(gconfigs[i]);
+		HklEngineList *engines = newEngines(gconfigs[i]);
+		HklEngine *engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+		hkl_engine_list_init(engines, geometry, detector, sample);
+		res &= DIAG(hkl_engine_pseudo_axis_values_get(engine, generic, ARRAY_SIZE(generic),
+							      HKL_UNIT_DEFAULT, NULL));
+		res &= DIAG(Geometry_hkl_get(gconfigs[i], sample, fixed));
+		for(j=0; j<ARRAY_SIZE(fixed); ++j)
+			res &= DIAG(fabs(fixed[j] - generic[j]) < HKL_EPSILON);
+
+		hkl_engine_list_free(engines);
+		hkl_geometry_free(geometry);
+	}
+
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+
+	ok(res == TRUE, __func__);
+}
+
+static void trajectory_table(void)
+{
+	int res = TRUE;
+	struct Table *table;
+	FILE *f;
+	static const double targets[] = {0, 0, 4,
+					 1, 1, 4};
+	Geometry gconfig = E4ch(4.3687, VALUES(0., 0., 6., 0.));
+	struct Trajectory tconfig = TrajectoryHklList(targets, 2, ModeHklE4CHConstantPhi());
+	struct Sample sample = {
+		.name = "Sample",
+		.lattice = Tetragonal(5.4, 11.9),
+		.ux = -90 * HKL_DEGTORAD,
+		.uy = 9 * HKL_DEGTORAD,
+		.uz = -45 * HKL_DEGTORAD,
+	};
+
+	table = Trajectory_solve_table(tconfig, gconfig, sample, TRUE);
+	res &= DIAG(NULL != table);
+	res &= DIAG(2 == table->n_rows);
+	res &= DIAG(3 + 4 == table->n_columns);
+	res &= DIAG(!strcmp("h", table->names[0]));
+	/* the l column */
+	res &= DIAG(4 == table->data[2 * table->n_rows + 1]);
+
+	/* the npy data start on a 64 bytes boundary */
+	f = tmpfile();
+	res &= DIAG(Table_save_as_npy(f, table));
+	res &= DIAG(0 == (ftell(f) - table->n_rows * table->n_columns * sizeof(double)) % 64);
+	fclose(f);
+
+	Table_free(table);
+
+	ok(res == TRUE, __func__);
+}
+
 int main(void)
 {
-	plan(7);
+	plan(9);
 
 	getter();
 	degenerated();
@@ -405,6 +481,8 @@ int main(void)
 	q();
 	hkl_psi_constant_horizontal();
 	petra3_p01();
+	trajectory_table();
+	fixed_geometry();
 
 	return 0;
 }
@@ -44,6 +44,18 @@ static void getter(void)
 
 	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
 
+	/* the axes indexes of the mode match their names */
+	{
+		const darray_string *names = hkl_engine_axis_names_get(engine, HKL_ENGINE_AXIS_NAMES_GET_WRITE);
+		const darray_int *idx = hkl_engine_axis_idx_get(engine, HKL_ENGINE_AXIS_NAMES_GET_WRITE);
+		size_t i;
+
+		res &= DIAG(darray_size(*names) == darray_size(*idx));
+		for(i=0; i<darray_size(*idx); ++i)
+			res &= DIAG(hkl_geometry_axis_idx_get(geometry, darray_item(*names, i))
+				    == darray_item(*idx, i));
+	}
+
 	/* geometry -> pseudo */
 	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
 	res &= DIAG(check_pseudoaxes_v(engine, 0., 0., 1.));
@@ -252,6 +264,130 @@ static void psi_setter(void)
 	hkl_geometry_free(geometry);
 }
 
+static void psi_trajectory(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 0, 0};
+	double psi[41];
+	double axes[ARRAY_SIZE(psi) * 4];
+	int valid[ARRAY_SIZE(psi)];
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "psi", NULL);
+
+	/* the engine must be initialized */
+	res &= DIAG(!hkl_engine_psi_values_set_trajectory(engine, psi, ARRAY_SIZE(psi),
+							  HKL_UNIT_DEFAULT,
+							  axes, 4, valid, NULL));
+
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl, ARRAY_SIZE(hkl), HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+
+	for(size_t i=0; i<ARRAY_SIZE(psi); ++i)
+		psi[i] = (-20. + i) * HKL_DEGTORAD;
+
+	res &= DIAG(hkl_engine_psi_values_set_trajectory(engine, psi, ARRAY_SIZE(psi),
+							 HKL_UNIT_DEFAULT,
+							 axes, 4, valid, NULL));
+	for(size_t i=0; i<ARRAY_SIZE(psi); ++i){
+		res &= DIAG(valid[i]);
+		res &= DIAG(hkl_geometry_axis_values_set(geometry, &axes[i * 4], 4,
+							 HKL_UNIT_DEFAULT, NULL));
+		res &= DIAG(check_pseudoaxes_v(engine, psi[i]));
+	}
+
+	ok(res == TRUE, "psi trajectory");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void energy_trajectory(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {0, 0, 1};
+	double wavelengths[21];
+	double axes[ARRAY_SIZE(wavelengths) * 4];
+	int valid[ARRAY_SIZE(wavelengths)];
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	for(size_t i=0; i<ARRAY_SIZE(wavelengths); ++i)
+		wavelengths[i] = 1.54 - 0.01 * i;
+
+	/* wrong sizes */
+	res &= DIAG(!hkl_engine_wavelength_values_set_trajectory(engine, hkl, 2,
+								 wavelengths, ARRAY_SIZE(wavelengths),
+								 HKL_UNIT_DEFAULT,
+								 axes, 4, valid, NULL));
+	res &= DIAG(!hkl_engine_wavelength_values_set_trajectory(engine, hkl, ARRAY_SIZE(hkl),
+								 wavelengths, ARRAY_SIZE(wavelengths),
+								 HKL_UNIT_DEFAULT,
+								 axes, 3, valid, NULL));
+
+	for(size_t m=0; m<2; ++m){
+		static const char *modes[] = {"bissector", "constant_omega"};
+
+		res &= DIAG(hkl_engine_current_mode_set(engine, modes[m], NULL));
+		res &= DIAG(hkl_engine_wavelength_values_set_trajectory(engine, hkl, ARRAY_SIZE(hkl),
+									wavelengths, ARRAY_SIZE(wavelengths),
+									HKL_UNIT_DEFAULT,
+									axes, 4, valid, NULL));
+		/* the geometry is restored */
+		res &= DIAG(1.54 == hkl_geometry_wavelength_get(geometry, HKL_UNIT_DEFAULT));
+
+		for(size_t i=0; i<ARRAY_SIZE(wavelengths); ++i){
+			res &= DIAG(valid[i]);
+			res &= DIAG(hkl_geometry_wavelength_set(geometry, wavelengths[i],
+								HKL_UNIT_DEFAULT, NULL));
+			res &= DIAG(hkl_geometry_axis_values_set(geometry, &axes[i * 4], 4,
+								 HKL_UNIT_DEFAULT, NULL));
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+		}
+		res &= DIAG(hkl_geometry_wavelength_set(geometry, 1.54,
+							HKL_UNIT_DEFAULT, NULL));
+		res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	}
+
+	ok(res == TRUE, "energy trajectory");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 static void q(void)
 {
 	int res = TRUE;
@@ -309,17 +445,16 @@ static void q(void)
 	hkl_geometry_free(geometry);
 }
 
-static void hkl_psi_constant_vertical(void)
+static void continuation(void)
 {
 	int res = TRUE;
 	HklEngineList *engines;
 	HklEngine *engine;
+	const darray_string *modes;
+	const char **mode;
 	HklGeometry *geometry;
-	HklGeometryList *geometries;
 	HklDetector *detector;
 	HklSample *sample;
-	static double hkl[] = {1, 0, 1};
-	static double hkl2[] = {1, 1, 0};
 	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
         struct Sample cu = CU;
 
@@ -332,27 +467,1252 @@ static void hkl_psi_constant_vertical(void)
 	hkl_engine_list_init(engines, geometry, detector, sample);
 
 	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	modes = hkl_engine_modes_names_get(engine);
 
-	res &= DIAG(hkl_engine_current_mode_set(engine, "psi_constant", NULL));
+	/* a trajectory solved from the predicted starting points */
+	hkl_engine_continuation_set(engine, 2);
+	darray_foreach(mode, *modes){
+		double h;
 
-	/* the init part */
-	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl2, ARRAY_SIZE(hkl2), HKL_UNIT_DEFAULT, NULL));
-	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+		res &= DIAG(hkl_engine_current_mode_set(engine, *mode, NULL));
+		for(h=0.; h<=1.; h += 0.05){
+			double values[] = {h, 0, 1};
+			HklGeometryList *geometries;
 
-	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
-						       HKL_UNIT_DEFAULT, NULL);
-	if(geometries){
-		const HklGeometryListItem *item;
+			geometries = hkl_engine_pseudo_axis_values_set(engine, values, ARRAY_SIZE(values),
+								       HKL_UNIT_DEFAULT, NULL);
+			if(geometries){
+				const HklGeometryListItem *item;
 
-		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
-			hkl_geometry_set(geometry,
-					 hkl_geometry_list_item_geometry_get(item));
-			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+				HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+					hkl_geometry_set(geometry,
+							 hkl_geometry_list_item_geometry_get(item));
+					res &= DIAG(check_pseudoaxes(engine, values, ARRAY_SIZE(values)));
+				}
+				hkl_geometry_list_free(geometries);
+			}
 		}
-		hkl_geometry_list_free(geometries);
 	}
+	hkl_engine_continuation_set(engine, 0);
 
-	ok(res == TRUE, "psi constant vertical");
+	ok(res == TRUE, "continuation");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void batch(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double targets[11 * 3];
+	double axes[11 * 4];
+	int valid[11];
+	unsigned int n_threads;
+	size_t i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		targets[3 * i] = 0.1 * i;
+		targets[3 * i + 1] = 0;
+		targets[3 * i + 2] = 1;
+	}
+
+	/* wrong sizes */
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 2,
+								     HKL_UNIT_DEFAULT,
+								     axes, 4, valid, 1, NULL));
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 3,
+								     HKL_UNIT_DEFAULT,
+								     axes, 3, valid, 1, NULL));
+
+	/* solved by the calling thread then by copies of the engine */
+	for(n_threads=1; n_threads<=3; n_threads+=2){
+		res &= DIAG(hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 3,
+								    HKL_UNIT_DEFAULT,
+								    axes, 4, valid, n_threads, NULL));
+		for(i=0; i<ARRAY_SIZE(valid); ++i){
+			res &= DIAG(valid[i]);
+			if(valid[i]){
+				HklGeometry *solution = hkl_geometry_new_copy(geometry);
+
+				res &= DIAG(hkl_geometry_axis_values_set(solution, &axes[4 * i], 4,
+									 HKL_UNIT_DEFAULT, NULL));
+				hkl_engine_list_geometry_set(engines, solution);
+				res &= DIAG(check_pseudoaxes(engine, &targets[3 * i], 3));
+				hkl_geometry_free(solution);
+			}
+		}
+	}
+
+	ok(res == TRUE, "batch");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void batch_get(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double targets[11 * 3];
+	double values[11 * 3];
+	double axes[11 * 4];
+	double axes0[4];
+	double axes1[4];
+	int valid[11];
+	unsigned int n_threads;
+	size_t i, j;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		targets[3 * i] = 0.1 * i;
+		targets[3 * i + 1] = 0;
+		targets[3 * i + 2] = 1;
+	}
+	res &= DIAG(hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 3,
+							    HKL_UNIT_DEFAULT,
+							    axes, 4, valid, 1, NULL));
+
+	/* wrong sizes */
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_get_batch(engine, axes, ARRAY_SIZE(valid), 3,
+								     HKL_UNIT_DEFAULT,
+								     values, 3, valid, 1, NULL));
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_get_batch(engine, axes, ARRAY_SIZE(valid), 4,
+								     HKL_UNIT_DEFAULT,
+								     values, 2, valid, 1, NULL));
+
+	/* the forward mapping of the solutions gives back the targets */
+	hkl_geometry_axis_values_get(hkl_engine_list_geometry_get(engines), axes0, 4, HKL_UNIT_DEFAULT);
+	for(n_threads=1; n_threads<=3; n_threads+=2){
+		res &= DIAG(hkl_engine_pseudo_axis_values_get_batch(engine, axes, ARRAY_SIZE(valid), 4,
+								    HKL_UNIT_DEFAULT,
+								    values, 3, valid, n_threads, NULL));
+		for(i=0; i<ARRAY_SIZE(valid); ++i){
+			res &= DIAG(valid[i]);
+			for(j=0; j<3; ++j)
+				res &= DIAG(fabs(values[3 * i + j] - targets[3 * i + j]) < HKL_EPSILON);
+		}
+	}
+
+	/* the geometry of the engine list is restored */
+	hkl_geometry_axis_values_get(hkl_engine_list_geometry_get(engines), axes1, 4, HKL_UNIT_DEFAULT);
+	for(j=0; j<4; ++j)
+		res &= DIAG(axes0[j] == axes1[j]);
+
+	/* many engines at once give the same values than one by one */
+	{
+		const char *names[] = {"q", "incidence", "emergence"};
+		double all[11 * 5];
+		double one[11 * 2];
+		size_t offset = 0;
+		size_t k;
+
+		res &= DIAG(FALSE == hkl_engine_list_pseudo_axis_values_get_batch(engines, names, ARRAY_SIZE(names),
+										  axes, ARRAY_SIZE(valid), 4,
+										  HKL_UNIT_DEFAULT,
+										  all, 4, valid, 1, NULL));
+		res &= DIAG(hkl_engine_list_pseudo_axis_values_get_batch(engines, names, ARRAY_SIZE(names),
+									 axes, ARRAY_SIZE(valid), 4,
+									 HKL_UNIT_DEFAULT,
+									 all, 5, valid, 2, NULL));
+		for(k=0; k<ARRAY_SIZE(names); ++k){
+			HklEngine *e = hkl_engine_list_engine_get_by_name(engines, names[k], NULL);
+			size_t n = darray_size(*hkl_engine_pseudo_axis_names_get(e));
+
+			res &= DIAG(hkl_engine_pseudo_axis_values_get_batch(e, axes, ARRAY_SIZE(valid), 4,
+									    HKL_UNIT_DEFAULT,
+									    one, n, valid, 1, NULL));
+			for(i=0; i<ARRAY_SIZE(valid); ++i)
+				for(j=0; j<n; ++j)
+					res &= DIAG(fabs(all[5 * i + offset + j] - one[n * i + j]) < HKL_EPSILON);
+			offset += n;
+		}
+	}
+
+	ok(res == TRUE, "batch get");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void trajectory(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double targets[11 * 3];
+	double axes[11 * 4];
+	double batch[11 * 4];
+	int valid[11];
+	unsigned int n_threads;
+	size_t i, j;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		targets[3 * i] = 0.1 * i;
+		targets[3 * i + 1] = 0;
+		targets[3 * i + 2] = 1;
+	}
+
+	/* wrong sizes */
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_set_trajectory(engine, targets, ARRAY_SIZE(valid), 2,
+									  HKL_UNIT_DEFAULT,
+									  axes, 4, valid, 1, NULL));
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_set_trajectory(engine, targets, ARRAY_SIZE(valid), 3,
+									  HKL_UNIT_DEFAULT,
+									  axes, 3, valid, 1, NULL));
+
+	res &= DIAG(hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 3,
+							    HKL_UNIT_DEFAULT,
+							    batch, 4, valid, 1, NULL));
+
+	for(n_threads=1; n_threads<=3; n_threads+=2){
+		double motion = 0.;
+		double motion_batch = 0.;
+
+		res &= DIAG(hkl_engine_pseudo_axis_values_set_trajectory(engine, targets, ARRAY_SIZE(valid), 3,
+									 HKL_UNIT_DEFAULT,
+									 axes, 4, valid, n_threads, NULL));
+		for(i=0; i<ARRAY_SIZE(valid); ++i){
+			HklGeometry *solution = hkl_geometry_new_copy(geometry);
+
+			res &= DIAG(valid[i]);
+			res &= DIAG(hkl_geometry_axis_values_set(solution, &axes[4 * i], 4,
+								 HKL_UNIT_DEFAULT, NULL));
+			hkl_engine_list_geometry_set(engines, solution);
+			res &= DIAG(check_pseudoaxes(engine, &targets[3 * i], 3));
+			hkl_geometry_free(solution);
+
+			if (i > 0)
+				for(j=0; j<4; ++j){
+					motion += fabs(axes[4 * i + j] - axes[4 * (i - 1) + j]);
+					motion_batch += fabs(batch[4 * i + j] - batch[4 * (i - 1) + j]);
+				}
+		}
+		hkl_engine_list_geometry_set(engines, geometry);
+
+		/* the selected branch moves less than the closest solutions */
+		res &= DIAG(motion <= motion_batch + HKL_EPSILON);
+	}
+
+	ok(res == TRUE, "trajectory");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void pvt(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklParameter *omega;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double targets[11 * 3];
+	double velocity[] = {0.1, 0, 0};
+	double axes[11 * 4];
+	double velocities[11 * 4];
+	double times[11];
+	int valid[11];
+	size_t i, j;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		targets[3 * i] = 0.1 * i;
+		targets[3 * i + 1] = 0;
+		targets[3 * i + 2] = 1;
+	}
+
+	res &= DIAG(hkl_engine_pseudo_axis_values_set_pvt(engine, targets, ARRAY_SIZE(valid), 3,
+							  velocity, HKL_UNIT_DEFAULT,
+							  axes, velocities, times, 4,
+							  valid, 1, NULL));
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		res &= DIAG(valid[i]);
+		res &= DIAG(fabs(times[i] - i) < HKL_EPSILON);
+	}
+
+	/* the velocities follow the positions of the trajectory */
+	for(i=1; i<ARRAY_SIZE(valid) - 1; ++i)
+		for(j=0; j<4; ++j){
+			double v = (axes[4 * (i + 1) + j] - axes[4 * (i - 1) + j])
+				/ (times[i + 1] - times[i - 1]);
+
+			res &= DIAG(fabs(velocities[4 * i + j] - v) < 1e-2 * fmax(1, fabs(v)));
+		}
+
+	/* a too slow omega */
+	omega = hkl_parameter_new_copy(hkl_geometry_axis_get(geometry, "omega", NULL));
+	hkl_parameter_motion_set(omega, 1e-6, 0, HKL_UNIT_DEFAULT);
+	res &= DIAG(hkl_geometry_axis_set(geometry, "omega", omega, NULL));
+	hkl_engine_list_geometry_set(engines, geometry);
+	res &= DIAG(FALSE == hkl_engine_pseudo_axis_values_set_pvt(engine, targets, ARRAY_SIZE(valid), 3,
+								   velocity, HKL_UNIT_DEFAULT,
+								   axes, velocities, times, 4,
+								   valid, 1, NULL));
+	res &= DIAG(FALSE == valid[ARRAY_SIZE(valid) - 1]);
+	hkl_parameter_free(omega);
+
+	ok(res == TRUE, "pvt");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+/* the pseudo axes read with hkl_engine_pseudo_axis_get follow the geometry */
+static int lazy_get_check(HklEngine *engine)
+{
+	static const char *names[] = {"h", "k", "l"};
+	double values[ARRAY_SIZE(names)];
+	size_t i;
+	int res = TRUE;
+
+	for(i=0; i<ARRAY_SIZE(names); ++i){
+		const HklParameter *p = hkl_engine_pseudo_axis_get(engine, names[i], NULL);
+
+		values[i] = hkl_parameter_value_get(p, HKL_UNIT_DEFAULT);
+	}
+
+	res &= DIAG(check_pseudoaxes(engine, values, ARRAY_SIZE(values)));
+
+	return res;
+}
+
+static void lazy_get(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklLattice *lattice;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double axes[] = {20 * HKL_DEGTORAD, 10 * HKL_DEGTORAD, 5 * HKL_DEGTORAD, 40 * HKL_DEGTORAD};
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	res &= DIAG(lazy_get_check(engine));
+
+	/* the axes of the geometry of the list change */
+	res &= DIAG(hkl_geometry_axis_values_set(hkl_engine_list_geometry_get(engines),
+						 axes, ARRAY_SIZE(axes),
+						 HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(lazy_get_check(engine));
+
+	/* the wavelength changes */
+	res &= DIAG(hkl_geometry_wavelength_set(hkl_engine_list_geometry_get(engines),
+						1., HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(lazy_get_check(engine));
+
+	/* the sample changes, the engines are invalidated */
+	lattice = hkl_lattice_new(2 * 3.61, 2 * 3.61, 2 * 3.61,
+				  90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD, 90 * HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	res &= DIAG(hkl_engine_list_get(engines));
+	res &= DIAG(lazy_get_check(engine));
+	hkl_lattice_free(lattice);
+
+	ok(res == TRUE, __func__);
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void engine_list_copy(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngineList *copy;
+	HklEngine *engine;
+	HklEngine *engine_copy;
+	HklGeometry *geometry;
+	HklGeometry *geometry_copy;
+	HklGeometryList *geometries;
+	HklGeometryList *geometries_copy;
+	HklDetector *detector;
+	HklDetector *detector_copy;
+	HklSample *sample;
+	static double hkl[] = {1, 0, 0};
+	static double target[] = {0, 1, 1};
+	double psi = 10 * HKL_DEGTORAD;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_omega", NULL));
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "psi", NULL);
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl, ARRAY_SIZE(hkl), HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+
+	/* the copy shares only the sample */
+	copy = hkl_engine_list_new_copy(engines);
+	res &= DIAG(NULL != copy);
+	geometry_copy = hkl_geometry_new_copy(geometry);
+	detector_copy = hkl_detector_new_copy(detector);
+	hkl_engine_list_init(copy, geometry_copy, detector_copy, sample);
+
+	/* same current mode */
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	engine_copy = hkl_engine_list_engine_get_by_name(copy, "hkl", NULL);
+	res &= DIAG(!strcmp(hkl_engine_current_mode_get(engine),
+			    hkl_engine_current_mode_get(engine_copy)));
+
+	/* same solutions */
+	geometries = hkl_engine_pseudo_axis_values_set(engine, target, ARRAY_SIZE(target),
+						       HKL_UNIT_DEFAULT, NULL);
+	geometries_copy = hkl_engine_pseudo_axis_values_set(engine_copy, target, ARRAY_SIZE(target),
+							    HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	res &= DIAG(NULL != geometries_copy);
+	if(geometries && geometries_copy){
+		double axes[4];
+		double axes_copy[4];
+		size_t i;
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries)
+			    == hkl_geometry_list_n_items_get(geometries_copy));
+		hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)),
+					     axes, ARRAY_SIZE(axes), HKL_UNIT_DEFAULT);
+		hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries_copy)),
+					     axes_copy, ARRAY_SIZE(axes_copy), HKL_UNIT_DEFAULT);
+		for(i=0; i<ARRAY_SIZE(axes); ++i)
+			res &= DIAG(axes[i] == axes_copy[i]);
+	}
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	if(geometries_copy)
+		hkl_geometry_list_free(geometries_copy);
+
+	/* the psi reference is copied with the initialized state */
+	engine_copy = hkl_engine_list_engine_get_by_name(copy, "psi", NULL);
+	res &= DIAG(hkl_engine_initialized_get(engine_copy));
+	geometries_copy = hkl_engine_pseudo_axis_values_set(engine_copy, &psi, 1,
+							    HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries_copy);
+	if(geometries_copy){
+		hkl_geometry_set(geometry_copy,
+				 hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries_copy)));
+		res &= DIAG(check_pseudoaxes_v(engine_copy, psi));
+		hkl_geometry_list_free(geometries_copy);
+	}
+
+	ok(res == TRUE, "engine list copy");
+
+	hkl_engine_list_free(copy);
+	hkl_detector_free(detector_copy);
+	hkl_geometry_free(geometry_copy);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void multistart(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 1, 0};
+	double q = 10;
+	HklEngineMultistart ms;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* the same solutions from the same starting geometry */
+	for(ms=HKL_ENGINE_MULTISTART_SOBOL; ms<=HKL_ENGINE_MULTISTART_RANDOM; ++ms){
+		double axes[2][4];
+		size_t i;
+
+		hkl_engine_multistart_set(engine, ms, 4, 42);
+		for(i=0; i<ARRAY_SIZE(axes); ++i){
+			HklGeometry *start = newGeometry(gconf);
+
+			hkl_engine_list_geometry_set(engines, start);
+			hkl_geometry_free(start);
+
+			geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+								       HKL_UNIT_DEFAULT, NULL);
+			res &= DIAG(NULL != geometries);
+			if(geometries){
+				hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(geometries)),
+							     axes[i], ARRAY_SIZE(axes[i]), HKL_UNIT_DEFAULT);
+				hkl_geometry_list_free(geometries);
+			}
+		}
+		for(i=0; i<ARRAY_SIZE(axes[0]); ++i)
+			res &= DIAG(axes[0][i] == axes[1][i]);
+	}
+
+	/* an unreachable q fails without any numerical search */
+	engine = hkl_engine_list_engine_get_by_name(engines, "q", NULL);
+	geometries = hkl_engine_pseudo_axis_values_set(engine, &q, 1,
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL == geometries);
+
+	ok(res == TRUE, "multistart");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void closed_form(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 1, 0};
+	static const char *modes[] = {"bissector", "constant_omega", "constant_chi", "constant_phi"};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+	/* only the axes written by each mode are changed */
+	Geometry gconfs[] = {
+		E4cv(1.54, VALUES(-10., 40., 120., 20.)),
+		E4cv(1.54, VALUES(30., 40., 120., 20.)),
+		E4cv(1.54, VALUES(-10., 0., 120., 20.)),
+		E4cv(1.54, VALUES(-10., 40., 0., 20.)),
+	};
+        struct Sample cu = CU;
+	size_t i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* the same solutions whatever the starting geometry */
+	for(i=0; i<ARRAY_SIZE(modes); ++i){
+		HklGeometryList *geometries;
+		HklGeometryList *geometries2;
+		HklGeometry *start;
+
+		res &= DIAG(hkl_engine_current_mode_set(engine, modes[i], NULL));
+
+		start = newGeometry(gconf);
+		hkl_engine_list_geometry_set(engines, start);
+		hkl_geometry_free(start);
+		geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							       HKL_UNIT_DEFAULT, NULL);
+
+		start = newGeometry(gconfs[i]);
+		hkl_engine_list_geometry_set(engines, start);
+		hkl_geometry_free(start);
+		geometries2 = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+								HKL_UNIT_DEFAULT, NULL);
+
+		res &= DIAG(NULL != geometries);
+		res &= DIAG(NULL != geometries2);
+		if(geometries && geometries2){
+			const HklGeometryListItem *item;
+
+			res &= DIAG(hkl_geometry_list_n_items_get(geometries)
+				    == hkl_geometry_list_n_items_get(geometries2));
+			HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+				hkl_geometry_set(geometry,
+						 hkl_geometry_list_item_geometry_get(item));
+				res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+			}
+		}
+		if(geometries)
+			hkl_geometry_list_free(geometries);
+		if(geometries2)
+			hkl_geometry_list_free(geometries2);
+	}
+
+	ok(res == TRUE, "closed form");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void stats(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineStats stats;
+	static double hkl[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* a new engine starts with no statistics */
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(0 == stats.solves);
+	res &= DIAG(0 == stats.evaluations);
+
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_omega", NULL));
+	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(1 == stats.solves);
+	res &= DIAG(0 == stats.failures);
+	res &= DIAG(stats.evaluations > 0);
+	res &= DIAG(stats.sectors_tested >= stats.sectors_accepted);
+	res &= DIAG(stats.sectors_accepted > 0);
+	res &= DIAG(stats.time >= 0);
+
+	hkl_engine_stats_reset(engine);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(0 == stats.solves);
+	res &= DIAG(0 == stats.evaluations);
+	res &= DIAG(0 == stats.sectors_accepted);
+	res &= DIAG(0 == stats.time);
+
+	ok(res == TRUE, "stats");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void trace(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	HklTraceRecord records[2];
+	static double hkl[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+
+	/* nothing is recorded while the trace is disabled */
+	res &= DIAG(0 == hkl_trace_records_get(records, ARRAY_SIZE(records)));
+
+	hkl_trace_enable(ARRAY_SIZE(records));
+	for(int i=0; i<3; ++i){
+		hkl[0] = 1 + i;
+		geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							       HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != geometries);
+		if(geometries)
+			hkl_geometry_list_free(geometries);
+	}
+
+	/* only the last solves are kept, the oldest first */
+	res &= DIAG(2 == hkl_trace_records_get(records, ARRAY_SIZE(records)));
+	res &= DIAG(!strcmp("hkl", records[0].engine));
+	res &= DIAG(!strcmp("bissector", records[0].mode));
+	res &= DIAG(3 == records[0].n_targets);
+	res &= DIAG(fabs(2 - records[0].targets[0]) < HKL_EPSILON);
+	res &= DIAG(fabs(3 - records[1].targets[0]) < HKL_EPSILON);
+	res &= DIAG(records[1].start >= records[0].start);
+	res &= DIAG(TRUE == records[1].status);
+	res &= DIAG(records[1].n_solutions > 0);
+
+	hkl_trace_enable(0);
+
+	ok(res == TRUE, "trace");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void branch_tracking(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineStats stats;
+	double hkl[3];
+	static double far[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+	hkl_engine_branch_tracking_set(engine, 10 * HKL_DEGTORAD, FALSE);
+
+	/* a small step stays on the branch */
+	res &= DIAG(hkl_engine_pseudo_axis_values_get(engine, hkl, ARRAY_SIZE(hkl),
+						      HKL_UNIT_DEFAULT, NULL));
+	hkl[2] += 0.01;
+	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(0 == stats.discontinuities);
+
+	/* a jump is rejected */
+	geometries = hkl_engine_pseudo_axis_values_set(engine, far, ARRAY_SIZE(far),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL == geometries);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(1 == stats.discontinuities);
+
+	/* unless forced */
+	hkl_engine_branch_tracking_set(engine, 10 * HKL_DEGTORAD, TRUE);
+	geometries = hkl_engine_pseudo_axis_values_set(engine, far, ARRAY_SIZE(far),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(2 == stats.discontinuities);
+
+	ok(res == TRUE, "branch tracking");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void cache(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	HklEngineStats stats;
+	size_t n_items = 0;
+	static double hkl[] = {1, 1, 0};
+	double values[] = {30, 0, 0, 60};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	int i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_omega", NULL));
+	hkl_engine_cache_set(engine, 2);
+
+	/* the second set of the same state is not solved */
+	for(i=0; i<2; ++i){
+		geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							       HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != geometries);
+		if(geometries){
+			if(i == 0)
+				n_items = hkl_geometry_list_n_items_get(geometries);
+			else
+				res &= DIAG(n_items == hkl_geometry_list_n_items_get(geometries));
+			hkl_geometry_list_free(geometries);
+		}
+	}
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(1 == stats.solves);
+	res &= DIAG(1 == stats.cache_hits);
+
+	/* a moved geometry is another state */
+	values[0] = 31;
+	res &= DIAG(hkl_geometry_axis_values_set(geometry, values, ARRAY_SIZE(values),
+						 HKL_UNIT_USER, NULL));
+	hkl_engine_list_geometry_set(engines, geometry);
+	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(2 == stats.solves);
+	res &= DIAG(1 == stats.cache_hits);
+
+	/* a cleared cache solves again */
+	hkl_engine_cache_clear(engine);
+	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(3 == stats.solves);
+	res &= DIAG(1 == stats.cache_hits);
+
+	ok(res == TRUE, "cache");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void set_into(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *solutions;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkls[][3] = {{1, 0, 0}, {1, 1, 0}, {0, 1, 1}, {10, 0, 0}, {0, 0, 1}};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	size_t i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_omega", NULL));
+
+	/* the same list receives all the solutions */
+	solutions = hkl_geometry_list_new();
+	for(i=0; i<ARRAY_SIZE(hkls); ++i){
+		HklGeometryList *geometries;
+		int ok;
+
+		geometries = hkl_engine_pseudo_axis_values_set(engine, hkls[i], ARRAY_SIZE(hkls[i]),
+							       HKL_UNIT_DEFAULT, NULL);
+		ok = hkl_engine_pseudo_axis_values_set_into(engine, hkls[i], ARRAY_SIZE(hkls[i]),
+							    HKL_UNIT_DEFAULT, solutions, NULL);
+		res &= DIAG(ok == (NULL != geometries));
+		if(geometries){
+			const HklGeometryListItem *item;
+
+			res &= DIAG(hkl_geometry_list_n_items_get(geometries)
+				    == hkl_geometry_list_n_items_get(solutions));
+			HKL_GEOMETRY_LIST_FOREACH(item, solutions){
+				hkl_geometry_set(geometry,
+						 hkl_geometry_list_item_geometry_get(item));
+				res &= DIAG(check_pseudoaxes(engine, hkls[i], ARRAY_SIZE(hkls[i])));
+			}
+			hkl_geometry_list_free(geometries);
+		}else
+			res &= DIAG(0 == hkl_geometry_list_n_items_get(solutions));
+	}
+	hkl_geometry_list_free(solutions);
+
+	ok(res == TRUE, "set into");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void hkl_psi_constant_vertical(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 0, 1};
+	static double hkl2[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	res &= DIAG(hkl_engine_current_mode_set(engine, "psi_constant", NULL));
+
+	/* the init part */
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl2, ARRAY_SIZE(hkl2), HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+
+	geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	if(geometries){
+		const HklGeometryListItem *item;
+
+		HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+			hkl_geometry_set(geometry,
+					 hkl_geometry_list_item_geometry_get(item));
+			res &= DIAG(check_pseudoaxes(engine, hkl, ARRAY_SIZE(hkl)));
+		}
+		hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, "psi constant vertical");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+/* the sectors tested by several threads give the same solutions in
+ * the same order */
+static void sectors_threads(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries[2];
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 0, 1};
+	static double hkl2[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	size_t i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* the initialized state of the mode is copied in the threads */
+	res &= DIAG(hkl_engine_current_mode_set(engine, "psi_constant", NULL));
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl2, ARRAY_SIZE(hkl2), HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+
+	for(i=0; i<ARRAY_SIZE(geometries); ++i){
+		hkl_engine_sectors_threads_set(engine, i * 4);
+		hkl_engine_list_geometry_set(engines, geometry);
+		geometries[i] = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+								  HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL != geometries[i]);
+	}
+
+	if(geometries[0] && geometries[1]){
+		const HklGeometryListItem *item0 = hkl_geometry_list_items_first_get(geometries[0]);
+		const HklGeometryListItem *item1 = hkl_geometry_list_items_first_get(geometries[1]);
+
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries[0])
+			    == hkl_geometry_list_n_items_get(geometries[1]));
+		while(item0 && item1){
+			double axes[2][4];
+
+			hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(item0),
+						     axes[0], ARRAY_SIZE(axes[0]), HKL_UNIT_DEFAULT);
+			hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(item1),
+						     axes[1], ARRAY_SIZE(axes[1]), HKL_UNIT_DEFAULT);
+			for(i=0; i<ARRAY_SIZE(axes[0]); ++i)
+				res &= DIAG(axes[0][i] == axes[1][i]);
+
+			item0 = hkl_geometry_list_items_next_get(geometries[0], item0);
+			item1 = hkl_geometry_list_items_next_get(geometries[1], item1);
+		}
+	}
+
+	for(i=0; i<ARRAY_SIZE(geometries); ++i)
+		if(geometries[i])
+			hkl_geometry_list_free(geometries[i]);
+
+	ok(res == TRUE, __func__);
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+/* every solution collides, also in the copies of the threads */
+static int always_colliding(UNUSED const HklGeometry *geometry, UNUSED void *data)
+{
+	return TRUE;
+}
+
+static void collision_threads(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *geometries;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 0, 1};
+	static double hkl2[] = {1, 1, 0};
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	double targets[11 * 3];
+	double axes[11 * 4];
+	int valid[11];
+	unsigned int n_threads;
+	size_t i;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	hkl_engine_list_collision_set(engines, always_colliding, NULL);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* batch */
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector", NULL));
+	for(i=0; i<ARRAY_SIZE(valid); ++i){
+		targets[3 * i] = 0.1 * i;
+		targets[3 * i + 1] = 0;
+		targets[3 * i + 2] = 1;
+	}
+	for(n_threads=1; n_threads<=3; n_threads+=2){
+		res &= DIAG(hkl_engine_pseudo_axis_values_set_batch(engine, targets, ARRAY_SIZE(valid), 3,
+								    HKL_UNIT_DEFAULT,
+								    axes, 4, valid, n_threads, NULL));
+		for(i=0; i<ARRAY_SIZE(valid); ++i)
+			res &= DIAG(!valid[i]);
+	}
+
+	/* sectors */
+	res &= DIAG(hkl_engine_current_mode_set(engine, "psi_constant", NULL));
+	res &= DIAG(hkl_engine_parameters_values_set(engine, hkl2, ARRAY_SIZE(hkl2), HKL_UNIT_DEFAULT, NULL));
+	res &= DIAG(hkl_engine_initialized_set(engine, TRUE, NULL));
+	for(n_threads=0; n_threads<=4; n_threads+=4){
+		hkl_engine_sectors_threads_set(engine, n_threads);
+		hkl_engine_list_geometry_set(engines, geometry);
+		geometries = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+							       HKL_UNIT_DEFAULT, NULL);
+		res &= DIAG(NULL == geometries);
+		if(geometries)
+			hkl_geometry_list_free(geometries);
+	}
+
+	ok(res == TRUE, __func__);
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+/* in a mesh, the first point of a row starts from the solution of
+ * the first point of the previous row */
+static void neighbours(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklEngineStats stats;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	Geometry gconf = E4cv(1.54, VALUES(30., 0., 0., 60.));
+        struct Sample cu = CU;
+	size_t h, k;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	res &= DIAG(hkl_engine_current_mode_set(engine, "constant_omega", NULL));
+	hkl_engine_neighbours_set(engine, 64);
+	for(k=0; k<3; ++k)
+		for(h=0; h<3; ++h){
+			double values[] = {0.8 + 0.1 * h, 0.1 * k, 1};
+			HklGeometryList *geometries;
+
+			geometries = hkl_engine_pseudo_axis_values_set(engine, values, ARRAY_SIZE(values),
+								       HKL_UNIT_DEFAULT, NULL);
+			res &= DIAG(NULL != geometries);
+			if(geometries){
+				const HklGeometryListItem *item;
+
+				HKL_GEOMETRY_LIST_FOREACH(item, geometries){
+					hkl_geometry_set(geometry,
+							 hkl_geometry_list_item_geometry_get(item));
+					res &= DIAG(check_pseudoaxes(engine, values, ARRAY_SIZE(values)));
+				}
+				hkl_geometry_list_free(geometries);
+			}
+		}
+
+	hkl_engine_stats_get(engine, &stats);
+	res &= DIAG(stats.neighbour_starts > 0);
+	hkl_engine_neighbours_set(engine, 0);
+
+	ok(res == TRUE, __func__);
 
 	hkl_engine_list_free(engines);
 	hkl_detector_free(detector);
@@ -362,14 +1722,33 @@ static void hkl_psi_constant_vertical(void)
 
 int main(void)
 {
-	plan(6);
+	plan(25);
 
 	getter();
 	degenerated();
 	psi_getter();
 	psi_setter();
+	psi_trajectory();
+	energy_trajectory();
 	q();
 	hkl_psi_constant_vertical();
+	continuation();
+	batch();
+	batch_get();
+	trajectory();
+	pvt();
+	lazy_get();
+	engine_list_copy();
+	multistart();
+	sectors_threads();
+	collision_threads();
+	neighbours();
+	closed_form();
+	stats();
+	trace();
+	set_into();
+	branch_tracking();
+	cache();
 
 	return 0;
 }
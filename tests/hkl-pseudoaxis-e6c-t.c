@@ -25,6 +25,12 @@
 
 #include "hkl-axis-private.h" /* temporary */
 
+#include <gsl/gsl_multiroots.h>
+
+/* from hkl-pseudoaxis-common-hkl-private.h which clashes with tap ARRAY_SIZE */
+extern int _RUBh_minus_Q_func(const gsl_vector *x, void *params, gsl_vector *f);
+extern int _RUBh_minus_Q_jacobian(const gsl_vector *x, void *params, gsl_matrix *J);
+
 #define CHECK_AXIS_VALUE(geometry, axis, value) fabs((value) - hkl_parameter_value_get(hkl_geometry_axis_get(geometry, axis, NULL), HKL_UNIT_DEFAULT)) < HKL_EPSILON
 
 
@@ -227,6 +233,129 @@ static void q2(void)
 	hkl_geometry_free(geometry);
 }
 
+static void jacobian(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	HklGeometryList *geometries;
+	Geometry gconf = E6c(1.54, VALUES(0., 30., 0., 0., 0., 60.));
+        struct Sample cu = CU;
+	gsl_multiroot_function f = {_RUBh_minus_Q_func, 3, NULL};
+	gsl_vector *x;
+	gsl_vector *fx;
+	gsl_matrix *J;
+	gsl_matrix *Jfd;
+	size_t i, j;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	f.params = engine;
+
+	/* mu moves both the sample and the detector */
+	res &= DIAG(hkl_engine_current_mode_set(engine, "lifting_detector_mu", NULL));
+	geometries = hkl_engine_set_values_v(engine, 0., 1., 1.);
+	res &= DIAG(NULL != geometries);
+	if(geometries)
+		hkl_geometry_list_free(geometries);
+
+	/* compare with the finite differences out of a solution */
+	x = gsl_vector_alloc(3);
+	fx = gsl_vector_alloc(3);
+	J = gsl_matrix_alloc(3, 3);
+	Jfd = gsl_matrix_alloc(3, 3);
+
+	gsl_vector_set(x, 0, 10. * HKL_DEGTORAD);
+	gsl_vector_set(x, 1, 20. * HKL_DEGTORAD);
+	gsl_vector_set(x, 2, 50. * HKL_DEGTORAD);
+
+	res &= DIAG(GSL_SUCCESS == _RUBh_minus_Q_func(x, engine, fx));
+	res &= DIAG(GSL_SUCCESS == gsl_multiroot_fdjacobian(&f, x, fx, GSL_SQRT_DBL_EPSILON, Jfd));
+	res &= DIAG(GSL_SUCCESS == _RUBh_minus_Q_jacobian(x, engine, J));
+	for(i=0; i<3; ++i)
+		for(j=0; j<3; ++j)
+			res &= DIAG(fabs(gsl_matrix_get(J, i, j) - gsl_matrix_get(Jfd, i, j)) < 1e-5);
+
+	ok(res == TRUE, "jacobian");
+
+	gsl_matrix_free(Jfd);
+	gsl_matrix_free(J);
+	gsl_vector_free(fx);
+	gsl_vector_free(x);
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+static void closest(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklGeometryList *all;
+	HklGeometryList *closest;
+	HklDetector *detector;
+	HklSample *sample;
+	static double hkl[] = {1, 1, 0};
+	Geometry gconf = E6c(1.54, VALUES(0., 30., 0., 0., 0., 60.));
+        struct Sample cu = CU;
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(engine, "bissector_vertical", NULL));
+
+	all = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						HKL_UNIT_DEFAULT, NULL);
+	hkl_engine_solutions_set(engine, HKL_ENGINE_SOLUTIONS_CLOSEST);
+	closest = hkl_engine_pseudo_axis_values_set(engine, hkl, ARRAY_SIZE(hkl),
+						    HKL_UNIT_DEFAULT, NULL);
+	res &= DIAG(NULL != all);
+	res &= DIAG(NULL != closest);
+	if(all && closest){
+		double axes[6];
+		double axes_closest[6];
+		size_t i;
+
+		res &= DIAG(1 == hkl_geometry_list_n_items_get(closest));
+		hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(all)),
+					     axes, ARRAY_SIZE(axes), HKL_UNIT_DEFAULT);
+		hkl_geometry_axis_values_get(hkl_geometry_list_item_geometry_get(hkl_geometry_list_items_first_get(closest)),
+					     axes_closest, ARRAY_SIZE(axes_closest), HKL_UNIT_DEFAULT);
+		for(i=0; i<ARRAY_SIZE(axes); ++i)
+			res &= DIAG(fabs(axes[i] - axes_closest[i]) < HKL_EPSILON);
+	}
+	if(all)
+		hkl_geometry_list_free(all);
+	if(closest)
+		hkl_geometry_list_free(closest);
+
+	ok(res == TRUE, "closest");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 static void petra3(void)
 {
 	static double hkl_v[] = {1, 1, 0};
@@ -482,11 +611,13 @@ static void petra3_2(void)
 
 int main(void)
 {
-	plan(5);
+	plan(7);
 
 	getter();
 	degenerated();
 	q2();
+	jacobian();
+	closest();
 	petra3();
 	petra3_2();
 
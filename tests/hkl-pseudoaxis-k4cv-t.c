@@ -155,6 +155,29 @@ static void eulerians(void)
 		}
 	}
 
+	/* the batch conversion round trip, the last position is unreachable */
+	{
+		const double eulers[] = {0., 10., -30., 40.,
+					 90., 20., -60., 120.,
+					 0., 30., 45., 10.};
+		double kappas[ARRAY_SIZE(eulers)];
+		double back[ARRAY_SIZE(eulers)];
+		size_t i;
+
+		res &= DIAG(FALSE == hkl_eulerians_to_kappa_array(eulers, ARRAY_SIZE(eulers),
+								  kappas, ARRAY_SIZE(kappas),
+								  50., 1, HKL_UNIT_USER));
+		res &= DIAG(isnan(kappas[3]) && isnan(kappas[7]) && isnan(kappas[11]));
+		hkl_kappa_to_eulerians_array(kappas, ARRAY_SIZE(kappas),
+					     back, ARRAY_SIZE(back),
+					     50., 1, HKL_UNIT_USER);
+		for(i=0; i<3; ++i){
+			res &= DIAG(fabs(eulers[0 + i] - back[0 + i]) < HKL_EPSILON);
+			res &= DIAG(fabs(eulers[4 + i] - back[4 + i]) < HKL_EPSILON);
+			res &= DIAG(fabs(eulers[8 + i] - back[8 + i]) < HKL_EPSILON);
+		}
+	}
+
 	ok(res == TRUE, "eulerians");
 
 	hkl_engine_list_free(engines);
@@ -77,11 +77,51 @@ static void solution(void)
 	ok(res == TRUE, "solution");
 }
 
+static void jacobian(void)
+{
+	int res = TRUE;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	const darray_string *modes;
+	const char **mode;
+	static const double x[] = {10. * HKL_DEGTORAD, 20. * HKL_DEGTORAD, 50. * HKL_DEGTORAD};
+	struct Sample cu = CU;
+	Geometry gconf = SoleilNanoscopiumRobot(0.842, VALUES(5., 15., 25., 0., 30., 40.));
+
+	geometry = newGeometry(gconf);
+	engines = newEngines(gconf);
+	sample = newSample(cu);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* compare with the finite differences in each mode */
+	modes = hkl_engine_modes_names_get(engine);
+	darray_foreach(mode, *modes){
+		res &= DIAG(hkl_engine_current_mode_set(engine, *mode, NULL));
+		res &= DIAG(check_jacobian(engine, x, ARRAY_SIZE(x)));
+	}
+
+	ok(res == TRUE, "jacobian");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
 int main(void)
 {
-	plan(1);
+	plan(2);
 
 	solution();
+	jacobian();
 
 	return 0;
 }
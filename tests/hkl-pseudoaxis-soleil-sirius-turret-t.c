@@ -0,0 +1,79 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2021 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/hkl-tap.h>
+
+static void jacobian(void)
+{
+	int res = TRUE;
+	HklFactory *factory;
+	HklEngineList *engines;
+	HklEngine *engine;
+	HklGeometry *geometry;
+	HklDetector *detector;
+	HklSample *sample;
+	const darray_string *modes;
+	const char **mode;
+	/* basepitch (mrad), thetah, alphay, alphax, delta, gamma */
+	double values[] = {20., 5., 15., 25., 30., 40.};
+	static const double x[] = {10. * HKL_DEGTORAD, 20. * HKL_DEGTORAD, 50. * HKL_DEGTORAD};
+	struct Sample cu = CU;
+
+	factory = hkl_factory_get_by_name("SOLEIL SIRIUS TURRET", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+	engines = hkl_factory_create_new_engine_list(factory);
+	sample = newSample(cu);
+
+	res &= DIAG(hkl_geometry_axis_values_set(geometry, values, ARRAY_SIZE(values),
+						 HKL_UNIT_USER, NULL));
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	/* compare with the finite differences in each mode, basepitch
+	 * moves both holders in lifting_detector_basepitch */
+	modes = hkl_engine_modes_names_get(engine);
+	darray_foreach(mode, *modes){
+		res &= DIAG(hkl_engine_current_mode_set(engine, *mode, NULL));
+		res &= DIAG(check_jacobian(engine, x, ARRAY_SIZE(x)));
+	}
+
+	ok(res == TRUE, "jacobian");
+
+	hkl_engine_list_free(engines);
+	hkl_detector_free(detector);
+	hkl_sample_free(sample);
+	hkl_geometry_free(geometry);
+}
+
+int main(void)
+{
+	plan(1);
+
+	jacobian();
+
+	return 0;
+}
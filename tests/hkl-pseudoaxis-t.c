@@ -103,6 +103,92 @@ static void factories(void)
 	ok(res == TRUE, "factories");
 }
 
+static void factories_full(void)
+{
+	int res = TRUE;
+	const char *names[] = {"psi", "hkl"};
+	HklEngineList *engines;
+	HklEngineList *copy;
+	HklFactory *factory = hkl_factory_get_by_name("K6C", NULL);
+
+	engines = hkl_factory_create_new_engine_list_full(factory, names, ARRAY_SIZE(names));
+	res &= DIAG(2 == darray_size(*hkl_engine_list_engines_get(engines)));
+	res &= DIAG(NULL != hkl_engine_list_engine_get_by_name(engines, "hkl", NULL));
+	res &= DIAG(NULL == hkl_engine_list_engine_get_by_name(engines, "q2", NULL));
+
+	/* the copies keep the same engines */
+	copy = hkl_engine_list_new_copy(engines);
+	res &= DIAG(2 == darray_size(*hkl_engine_list_engines_get(copy)));
+	res &= DIAG(NULL != hkl_engine_list_engine_get_by_name(copy, "psi", NULL));
+
+	hkl_engine_list_free(copy);
+	hkl_engine_list_free(engines);
+
+	ok(res == TRUE, __func__);
+}
+
+static void context(void)
+{
+	int res = TRUE;
+	HklFactory *factory = hkl_factory_get_by_name("K6C", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	HklSample *sample = hkl_sample_new("test");
+	HklEngineList *engines = hkl_factory_create_new_engine_list(factory);
+	HklEngine *hkl;
+	HklContext *context;
+	HklContext *restored;
+	HklEngineList *clone;
+	HklGeometry *clone_geometry;
+	HklDetector *clone_detector;
+	HklSample *clone_sample;
+	guint8 *bytes;
+	size_t len, i;
+	double values[6] = {0, 30, 0, 0, 0, 60};
+	double clone_values[6];
+
+	res &= DIAG(hkl_geometry_axis_values_set(geometry, values, ARRAY_SIZE(values),
+						 HKL_UNIT_USER, NULL));
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	hkl = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+	res &= DIAG(hkl_engine_current_mode_set(hkl, "constant_phi_vertical", NULL));
+
+	/* the binary form round trip */
+	context = hkl_context_new(engines);
+	res &= DIAG(NULL != context);
+	bytes = hkl_context_to_bytes(context, &len);
+	restored = hkl_context_new_from_bytes(bytes, len, NULL);
+	res &= DIAG(NULL != restored);
+
+	/* the clients created from the restored snapshot */
+	clone = hkl_context_engine_list_new(restored, &clone_geometry,
+					    &clone_detector, &clone_sample);
+	hkl = hkl_engine_list_engine_get_by_name(clone, "hkl", NULL);
+	res &= DIAG(!strcmp("constant_phi_vertical", hkl_engine_current_mode_get(hkl)));
+	res &= DIAG(!strcmp("test", hkl_sample_name_get(clone_sample)));
+	hkl_geometry_axis_values_get(clone_geometry, clone_values, ARRAY_SIZE(clone_values),
+				     HKL_UNIT_USER);
+	for(i=0; i<ARRAY_SIZE(values); ++i)
+		res &= DIAG(fabs(values[i] - clone_values[i]) < HKL_EPSILON);
+
+	/* a truncated one is rejected */
+	res &= DIAG(NULL == hkl_context_new_from_bytes(bytes, len - 1, NULL));
+
+	hkl_engine_list_free(clone);
+	hkl_sample_free(clone_sample);
+	hkl_detector_free(clone_detector);
+	hkl_geometry_free(clone_geometry);
+	hkl_context_free(restored);
+	g_free(bytes);
+	hkl_context_free(context);
+	hkl_engine_list_free(engines);
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+
+	ok(res == TRUE, __func__);
+}
+
 static void parameters(void)
 {
 	int res = TRUE;
@@ -591,7 +677,7 @@ int main(int argc, char** argv)
 {
 	double n;
 
-	plan(11);
+	plan(13);
 
 	if (argc > 1)
 		n = atoi(argv[1]);
@@ -599,6 +685,8 @@ int main(int argc, char** argv)
 		n = 10;
 
 	factories();
+	factories_full();
+	context();
 	parameters();
 	get();
 	set(n);
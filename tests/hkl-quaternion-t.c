@@ -85,6 +85,33 @@ static void times_quaternion(void)
 	ok(TRUE == hkl_quaternion_cmp(&q_ref, &q), __func__);
 }
 
+static void array_times_quaternion_array(void)
+{
+	HklQuaternion q1 = {{1., 2., 3., 4.}};
+	HklQuaternion q2 = {{.5, -1., 2., .25}};
+	double self[] = {1., .5,
+			 2., -1.,
+			 3., 2.,
+			 4., .25};
+	double q[] = {.5, 1.,
+		      -1., 2.,
+		      2., 3.,
+		      .25, 4.};
+	HklQuaternion q12 = q1;
+	HklQuaternion q21 = q2;
+	HklQuaternion res1;
+	HklQuaternion res2;
+
+	hkl_quaternion_times_quaternion(&q12, &q2);
+	hkl_quaternion_times_quaternion(&q21, &q1);
+	hkl_quaternion_array_times_quaternion_array(self, q, 2);
+
+	res1 = (HklQuaternion){{self[0], self[2], self[4], self[6]}};
+	res2 = (HklQuaternion){{self[1], self[3], self[5], self[7]}};
+	ok(TRUE == hkl_quaternion_cmp(&q12, &res1)
+	   && TRUE == hkl_quaternion_cmp(&q21, &res2), __func__);
+}
+
 static void norm2(void)
 {
 	HklQuaternion q = {{1., 2., 3., 4.}};
@@ -149,13 +176,14 @@ static void to_angle_and_axe(void)
 
 int main(void)
 {
-	plan(375);
+	plan(376);
 
 	assignment();
 	cmp();
 	init_from_vector();
 	init_from_angle_and_axe();
 	times_quaternion();
+	array_times_quaternion_array();
 	norm2();
 	conjugate();
 	to_matrix();
@@ -364,6 +364,324 @@ static void affine(void)
 	hkl_matrix_free(m_ref);
 }
 
+static void affine_levenberg_marquardt(void)
+{
+	int res = TRUE;
+	GError *error = NULL;
+	double a, b, c, alpha, beta, gamma;
+	double covariance[81];
+	size_t i;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklSampleReflection *ref;
+	HklMatrix *m_ref = hkl_matrix_new_full(1., 0., 0.,
+					       0., 1., 0.,
+					       0., 0., 1.);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+	lattice = hkl_lattice_new(1.5, 1.6, 1.5,
+				  91 * HKL_DEGTORAD,
+				  89 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	/* not enough reflections */
+	res &= DIAG(FALSE == hkl_sample_affine_levenberg_marquardt(sample, NULL, 0, &error));
+	res &= DIAG(NULL != error);
+	g_clear_error(&error);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 60., 60., 60., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .625, .75, -.216506350946, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 45., 45., 45., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .665975615037, .683012701892, .299950211252, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_sample_affine_levenberg_marquardt(sample, covariance, ARRAY_SIZE(covariance), &error));
+	res &= DIAG(NULL == error);
+
+	hkl_lattice_get(hkl_sample_lattice_get(sample),
+			&a, &b, &c, &alpha, &beta, &gamma, HKL_UNIT_DEFAULT);
+
+	res &= DIAG(hkl_matrix_cmp(m_ref, hkl_sample_U_get(sample)));
+	res &= DIAG(fabs(1.54 - a) < HKL_EPSILON);
+	res &= DIAG(fabs(1.54 - b) < HKL_EPSILON);
+	res &= DIAG(fabs(1.54 - c) < HKL_EPSILON);
+	res &= DIAG(fabs(90 * HKL_DEGTORAD - alpha) < HKL_EPSILON);
+	res &= DIAG(fabs(90 * HKL_DEGTORAD - beta) < HKL_EPSILON);
+	res &= DIAG(fabs(90 * HKL_DEGTORAD - gamma) < HKL_EPSILON);
+
+	/* the reflections are exact, so is the fit */
+	for(i=0; i<9; ++i)
+		res &= DIAG(covariance[i * 9 + i] >= 0. && covariance[i * 9 + i] < HKL_EPSILON);
+
+	ok(res, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_ref);
+}
+
+static void affine_ransac(void)
+{
+	int res = TRUE;
+	GError *error = NULL;
+	size_t n_outliers;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklSampleReflection *ref, *outlier;
+	HklMatrix *m_ref = hkl_matrix_new_full(1., 0., 0.,
+					       0., 1., 0.,
+					       0., 0., 1.);
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+	lattice = hkl_lattice_new(1.54, 1.54, 1.54,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	/* one reflection is not enough */
+	res &= DIAG(FALSE == hkl_sample_affine_ransac(sample, HKL_DEGTORAD, 100, &n_outliers, &error));
+	res &= DIAG(NULL != error);
+	g_clear_error(&error);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 60., 60., 60., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .625, .75, -.216506350946, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	/* the (1, 0, 0) reflection indexed as (0, 0, 1) */
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	outlier = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(sample, outlier);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 45., 45., 45., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .665975615037, .683012701892, .299950211252, NULL);
+	hkl_sample_add_reflection(sample, ref);
+
+	res &= DIAG(hkl_sample_affine_ransac(sample, HKL_DEGTORAD, 100, &n_outliers, &error));
+	res &= DIAG(NULL == error);
+	res &= DIAG(1 == n_outliers);
+	res &= DIAG(FALSE == hkl_sample_reflection_flag_get(outlier));
+	res &= DIAG(TRUE == hkl_sample_reflection_flag_get(ref));
+	res &= DIAG(hkl_matrix_cmp(m_ref, hkl_sample_U_get(sample)));
+
+	ok(res, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+	hkl_matrix_free(m_ref);
+}
+
+static void affine_series(void)
+{
+	int res = TRUE;
+	GError *error = NULL;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *samples[3];
+	HklLattice *lattice;
+	HklSampleReflection *ref;
+	double table[ARRAY_SIZE(samples) * HKL_SAMPLE_AFFINE_SERIES_COLUMNS];
+	int valid[ARRAY_SIZE(samples)];
+	size_t i, j;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	samples[0] = hkl_sample_new("test");
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 1, 0, 0, NULL);
+	hkl_sample_add_reflection(samples[0], ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 1, 0, NULL);
+	hkl_sample_add_reflection(samples[0], ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, 0, 0, 1, NULL);
+	hkl_sample_add_reflection(samples[0], ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 60., 60., 60., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .625, .75, -.216506350946, NULL);
+	hkl_sample_add_reflection(samples[0], ref);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 45., 45., 45., 60.));
+	ref = hkl_sample_reflection_new(geometry, detector, .665975615037, .683012701892, .299950211252, NULL);
+	hkl_sample_add_reflection(samples[0], ref);
+
+	/* the same dataset with different starting lattices */
+	for(i=1; i<ARRAY_SIZE(samples); ++i){
+		samples[i] = hkl_sample_new_copy(samples[0]);
+		lattice = hkl_lattice_new(1.5 + .02 * i, 1.6, 1.5,
+					  91 * HKL_DEGTORAD,
+					  89 * HKL_DEGTORAD,
+					  90 * HKL_DEGTORAD,
+					  NULL);
+		hkl_sample_lattice_set(samples[i], lattice);
+		hkl_lattice_free(lattice);
+	}
+
+	/* wrong table size */
+	res &= DIAG(FALSE == hkl_sample_affine_series(samples, ARRAY_SIZE(samples),
+						      table, ARRAY_SIZE(table) - 1,
+						      valid, 2, &error));
+	res &= DIAG(NULL != error);
+	g_clear_error(&error);
+
+	res &= DIAG(hkl_sample_affine_series(samples, ARRAY_SIZE(samples),
+					     table, ARRAY_SIZE(table),
+					     valid, 2, &error));
+	res &= DIAG(NULL == error);
+
+	for(i=0; i<ARRAY_SIZE(samples); ++i){
+		const double *row = &table[i * HKL_SAMPLE_AFFINE_SERIES_COLUMNS];
+
+		res &= DIAG(TRUE == valid[i]);
+		for(j=0; j<3; ++j){
+			res &= DIAG(fabs(1.54 - row[j]) < HKL_EPSILON);
+			res &= DIAG(fabs(90 * HKL_DEGTORAD - row[3 + j]) < HKL_EPSILON);
+		}
+		/* U is the identity */
+		for(j=0; j<9; ++j)
+			res &= DIAG(fabs((j % 4 ? 0. : 1.) - row[6 + j]) < HKL_EPSILON);
+		res &= DIAG(row[15] < HKL_EPSILON);
+	}
+
+	ok(res, __func__);
+
+	for(i=0; i<ARRAY_SIZE(samples); ++i)
+		hkl_sample_free(samples[i]);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+}
+
+static void index_peaks(void)
+{
+	int res = TRUE;
+	GError *error = NULL;
+	size_t n_indexed;
+	double h, k, l;
+	const HklFactory *factory;
+	HklDetector *detector;
+	HklGeometry *geometry;
+	HklSample *sample;
+	HklLattice *lattice;
+	HklSampleReflection *r0, *r1, *r2, *r3;
+
+	factory = hkl_factory_get_by_name("E4CV", NULL);
+	geometry = hkl_factory_create_new_geometry(factory);
+
+	detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+
+	sample = hkl_sample_new("test");
+	lattice = hkl_lattice_new(1.54, 1.54, 1.54,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  90 * HKL_DEGTORAD,
+				  NULL);
+	hkl_sample_lattice_set(sample, lattice);
+	hkl_lattice_free(lattice);
+
+	/* the hkl are wrong on purpose, only the geometries are used */
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 90., 60.));
+	r0 = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+	hkl_sample_add_reflection(sample, r0);
+
+	/* one reflection is not enough */
+	res &= DIAG(FALSE == hkl_sample_index(sample, 2, HKL_DEGTORAD, &n_indexed, &error));
+	res &= DIAG(NULL != error);
+	g_clear_error(&error);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 90., 0., 60.));
+	r1 = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+	hkl_sample_add_reflection(sample, r1);
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 30., 0., 0., 60.));
+	r2 = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+	hkl_sample_add_reflection(sample, r2);
+
+	/* not a node of the lattice */
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL, 60., 60., 60., 60.));
+	r3 = hkl_sample_reflection_new(geometry, detector, 1, 1, 1, NULL);
+	hkl_sample_add_reflection(sample, r3);
+
+	res &= DIAG(hkl_sample_index(sample, 2, HKL_DEGTORAD, &n_indexed, &error));
+	res &= DIAG(NULL == error);
+	res &= DIAG(3 == n_indexed);
+	res &= DIAG(TRUE == hkl_sample_reflection_flag_get(r0));
+	res &= DIAG(TRUE == hkl_sample_reflection_flag_get(r1));
+	res &= DIAG(TRUE == hkl_sample_reflection_flag_get(r2));
+	res &= DIAG(FALSE == hkl_sample_reflection_flag_get(r3));
+
+	/* the three axes of the cubic lattice */
+	hkl_sample_reflection_hkl_get(r0, &h, &k, &l);
+	res &= DIAG(fabs(1. - (fabs(h) + fabs(k) + fabs(l))) < HKL_EPSILON);
+	res &= DIAG(fabs(hkl_sample_get_reflection_measured_angle(sample, r0, r1)
+			 - hkl_sample_get_reflection_theoretical_angle(sample, r0, r1)) < HKL_EPSILON);
+	res &= DIAG(fabs(hkl_sample_get_reflection_measured_angle(sample, r0, r2)
+			 - hkl_sample_get_reflection_theoretical_angle(sample, r0, r2)) < HKL_EPSILON);
+	res &= DIAG(fabs(hkl_sample_get_reflection_measured_angle(sample, r1, r2)
+			 - hkl_sample_get_reflection_theoretical_angle(sample, r1, r2)) < HKL_EPSILON);
+
+	ok(res, __func__);
+
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+}
+
 static void get_reflections_xxx_angle(void)
 {
 	HklDetector *detector;
@@ -497,7 +815,7 @@ static void reflection_set_geometry(void)
 
 int main(void)
 {
-	plan(114);
+	plan(118);
 
 	new();
 	add_reflection();
@@ -507,6 +825,10 @@ int main(void)
 	set_UB();
 	compute_UB_busing_levy();
 	affine();
+	affine_levenberg_marquardt();
+	affine_ransac();
+	affine_series();
+	index_peaks();
 	get_reflections_xxx_angle();
 
 	reflection_set_geometry();
@@ -0,0 +1,406 @@
+/* This file is part of the hkl library.
+ *
+ * The hkl library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The hkl library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the hkl library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) 2003-2024 Synchrotron SOLEIL
+ *                         L'Orme des Merisiers Saint-Aubin
+ *                         BP 48 91192 GIF-sur-YVETTE CEDEX
+ *
+ * Authors: Picca Frédéric-Emmanuel <picca@synchrotron-soleil.fr>
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "hkl.h"
+#include <tap/basic.h>
+#include <tap/hkl-tap.h>
+
+/* the framing of server/hkl-server.c */
+#define MAGIC "HKLS"
+#define REQUEST_LOAD 1
+#define REQUEST_SOLVE 2
+#define REQUEST_FORWARD 3
+#define REQUEST_UNLOAD 4
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+
+struct Server
+{
+	pid_t pid;
+	int port;
+};
+
+/* start the server on a port picked by the system */
+static int server_start(struct Server *self)
+{
+	int fds[2];
+	FILE *out;
+	int res;
+
+	if(pipe(fds) < 0)
+		return FALSE;
+
+	self->pid = fork();
+	if(0 == self->pid){
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execl(HKL_SERVER, HKL_SERVER, "--port", "0", "--connections", "2", NULL);
+		_exit(EXIT_FAILURE);
+	}
+	close(fds[1]);
+
+	out = fdopen(fds[0], "r");
+	res = self->pid > 0
+		&& 1 == fscanf(out, "hkl-server listening on 127.0.0.1:%d", &self->port);
+	fclose(out);
+
+	return res;
+}
+
+static void server_stop(struct Server *self)
+{
+	if(self->pid > 0){
+		kill(self->pid, SIGTERM);
+		waitpid(self->pid, NULL, 0);
+	}
+}
+
+static int server_connect(const struct Server *self)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(self->port);
+	if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static int read_all(int fd, void *data, size_t n)
+{
+	guint8 *p = data;
+
+	while(n > 0){
+		ssize_t r = read(fd, p, n);
+
+		if(r <= 0)
+			return FALSE;
+		p += r;
+		n -= r;
+	}
+
+	return TRUE;
+}
+
+static int write_all(int fd, const void *data, size_t n)
+{
+	const guint8 *p = data;
+
+	while(n > 0){
+		ssize_t w = write(fd, p, n);
+
+		if(w <= 0)
+			return FALSE;
+		p += w;
+		n -= w;
+	}
+
+	return TRUE;
+}
+
+static void put_uint(GByteArray *bytes, guint32 value)
+{
+	value = GUINT32_TO_LE(value);
+	g_byte_array_append(bytes, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_uint64(GByteArray *bytes, guint64 value)
+{
+	value = GUINT64_TO_LE(value);
+	g_byte_array_append(bytes, (const guint8 *)&value, sizeof(value));
+}
+
+static void put_string(GByteArray *bytes, const char *value)
+{
+	put_uint(bytes, strlen(value));
+	g_byte_array_append(bytes, (const guint8 *)value, strlen(value));
+}
+
+static void put_doubles(GByteArray *bytes, const double values[], size_t n)
+{
+	size_t i;
+
+	for(i=0; i<n; ++i){
+		guint64 v;
+
+		memcpy(&v, &values[i], sizeof(v));
+		put_uint64(bytes, v);
+	}
+}
+
+static guint32 get_uint(const GByteArray *bytes, size_t *pos)
+{
+	guint32 value = 0;
+
+	if(*pos + sizeof(value) <= bytes->len)
+		memcpy(&value, &bytes->data[*pos], sizeof(value));
+	*pos += sizeof(value);
+
+	return GUINT32_FROM_LE(value);
+}
+
+static guint64 get_uint64(const GByteArray *bytes, size_t *pos)
+{
+	guint64 value = 0;
+
+	if(*pos + sizeof(value) <= bytes->len)
+		memcpy(&value, &bytes->data[*pos], sizeof(value));
+	*pos += sizeof(value);
+
+	return GUINT64_FROM_LE(value);
+}
+
+static double get_double(const GByteArray *bytes, size_t *pos)
+{
+	guint64 v = get_uint64(bytes, pos);
+	double value;
+
+	memcpy(&value, &v, sizeof(value));
+
+	return value;
+}
+
+/* one request, the status of the answer or -1 if the server hung up */
+static int request(int fd, guint32 type, const GByteArray *payload, GByteArray *answer)
+{
+	guint32 header[2] = {GUINT32_TO_LE(type), GUINT32_TO_LE(payload->len)};
+	char magic[4];
+
+	if(!write_all(fd, MAGIC, 4)
+	   || !write_all(fd, header, sizeof(header))
+	   || !write_all(fd, payload->data, payload->len)
+	   || !read_all(fd, magic, sizeof(magic))
+	   || memcmp(magic, MAGIC, sizeof(magic))
+	   || !read_all(fd, header, sizeof(header)))
+		return -1;
+
+	g_byte_array_set_size(answer, GUINT32_FROM_LE(header[1]));
+	if(!read_all(fd, answer->data, answer->len))
+		return -1;
+
+	return GUINT32_FROM_LE(header[0]);
+}
+
+/* the error message of an answer */
+static int is_error(const GByteArray *answer, const char *message)
+{
+	size_t pos = 0;
+	guint32 len = get_uint(answer, &pos);
+
+	return len == strlen(message)
+		&& pos + len == answer->len
+		&& !memcmp(&answer->data[pos], message, len);
+}
+
+static guint8 *context_bytes(size_t *len)
+{
+	HklFactory *factory = hkl_factory_get_by_name("E4CV", NULL);
+	HklGeometry *geometry = hkl_factory_create_new_geometry(factory);
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	HklSample *sample = hkl_sample_new("test");
+	HklEngineList *engines = hkl_factory_create_new_engine_list(factory);
+	HklContext *context;
+	guint8 *bytes;
+
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	context = hkl_context_new(engines);
+	bytes = hkl_context_to_bytes(context, len);
+
+	hkl_context_free(context);
+	hkl_engine_list_free(engines);
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+	hkl_geometry_free(geometry);
+
+	return bytes;
+}
+
+static void forward_payload(GByteArray *payload, guint64 id,
+			    const double positions[], guint32 n_positions, guint32 n_axes)
+{
+	g_byte_array_set_size(payload, 0);
+	put_uint64(payload, id);
+	put_string(payload, "hkl");
+	put_uint(payload, n_positions);
+	put_uint(payload, n_axes);
+	put_doubles(payload, positions, (size_t)n_positions * n_axes);
+}
+
+static void requests(void)
+{
+	int res = TRUE;
+	int fd;
+	size_t i, pos, len;
+	guint8 *bytes;
+	guint64 id = 0;
+	struct Server server = {0};
+	GByteArray *payload = g_byte_array_new();
+	GByteArray *answer = g_byte_array_new();
+	double positions[] = {30, 0, 0, 60}; /* omega, chi, phi, tth */
+	double hkl[3] = {0};
+	double axes[4] = {0};
+
+	res &= DIAG(server_start(&server));
+	fd = server_connect(&server);
+	res &= DIAG(fd >= 0);
+
+	/* LOAD, the same context twice is the same warm context */
+	bytes = context_bytes(&len);
+	g_byte_array_append(payload, bytes, len);
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_LOAD, payload, answer));
+	pos = 0;
+	id = get_uint64(answer, &pos);
+	res &= DIAG(sizeof(id) == answer->len);
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_LOAD, payload, answer));
+	pos = 0;
+	res &= DIAG(id == get_uint64(answer, &pos));
+
+	/* a broken context is rejected */
+	g_byte_array_set_size(payload, len - 1);
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_LOAD, payload, answer));
+	g_free(bytes);
+
+	/* FORWARD */
+	forward_payload(payload, id, positions, 1, ARRAY_SIZE(positions));
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_FORWARD, payload, answer));
+	pos = 0;
+	res &= DIAG(ARRAY_SIZE(hkl) == get_uint(answer, &pos));
+	for(i=0; i<ARRAY_SIZE(hkl); ++i)
+		hkl[i] = get_double(answer, &pos);
+	res &= DIAG(0 != get_uint(answer, &pos));
+	res &= DIAG(pos == answer->len);
+
+	/* SOLVE, the solution is forwarded back to the same hkl */
+	g_byte_array_set_size(payload, 0);
+	put_uint64(payload, id);
+	put_string(payload, "hkl");
+	put_uint(payload, 0);
+	put_uint(payload, 1);
+	put_uint(payload, ARRAY_SIZE(hkl));
+	put_doubles(payload, hkl, ARRAY_SIZE(hkl));
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_SOLVE, payload, answer));
+	pos = 0;
+	res &= DIAG(ARRAY_SIZE(axes) == get_uint(answer, &pos));
+	for(i=0; i<ARRAY_SIZE(axes); ++i)
+		axes[i] = get_double(answer, &pos);
+	res &= DIAG(0 != get_uint(answer, &pos));
+	res &= DIAG(pos == answer->len);
+
+	forward_payload(payload, id, axes, 1, ARRAY_SIZE(axes));
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_FORWARD, payload, answer));
+	pos = 0;
+	res &= DIAG(ARRAY_SIZE(hkl) == get_uint(answer, &pos));
+	for(i=0; i<ARRAY_SIZE(hkl); ++i)
+		res &= DIAG(fabs(hkl[i] - get_double(answer, &pos)) < HKL_EPSILON);
+
+	/* the batches are capped whatever the payload size */
+	g_byte_array_set_size(payload, 0);
+	put_uint64(payload, id);
+	put_string(payload, "hkl");
+	put_uint(payload, 0);
+	put_uint(payload, G_MAXUINT32);
+	put_uint(payload, 0);
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_SOLVE, payload, answer));
+	res &= DIAG(is_error(answer, "too many targets"));
+
+	forward_payload(payload, id, NULL, G_MAXUINT32, 0);
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_FORWARD, payload, answer));
+	res &= DIAG(is_error(answer, "too many positions"));
+
+	/* a truncated payload */
+	forward_payload(payload, id, positions, 1, ARRAY_SIZE(positions));
+	g_byte_array_set_size(payload, payload->len - 1);
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_FORWARD, payload, answer));
+	res &= DIAG(is_error(answer, "truncated request or no position"));
+
+	/* an unknown request */
+	res &= DIAG(STATUS_ERROR == request(fd, 42, payload, answer));
+	res &= DIAG(is_error(answer, "unknown request"));
+
+	/* an unknown id */
+	forward_payload(payload, id + 1, positions, 1, ARRAY_SIZE(positions));
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_FORWARD, payload, answer));
+	res &= DIAG(is_error(answer, "unknown context, load it again"));
+
+	/* UNLOAD, then the id is unknown */
+	g_byte_array_set_size(payload, 0);
+	put_uint64(payload, id);
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_UNLOAD, payload, answer));
+	res &= DIAG(0 == answer->len);
+	forward_payload(payload, id, positions, 1, ARRAY_SIZE(positions));
+	res &= DIAG(STATUS_ERROR == request(fd, REQUEST_FORWARD, payload, answer));
+	res &= DIAG(is_error(answer, "unknown context, load it again"));
+
+	/* a truncated frame, the server hangs up without answering */
+	if(fd >= 0){
+		guint32 header[2] = {GUINT32_TO_LE(REQUEST_UNLOAD), GUINT32_TO_LE(sizeof(id))};
+		char byte;
+
+		res &= DIAG(write_all(fd, MAGIC, 4));
+		res &= DIAG(write_all(fd, header, sizeof(header)));
+		res &= DIAG(write_all(fd, &id, sizeof(id) / 2));
+		shutdown(fd, SHUT_WR);
+		res &= DIAG(0 == read(fd, &byte, 1));
+		close(fd);
+	}
+
+	/* the server still serves the other clients */
+	fd = server_connect(&server);
+	res &= DIAG(fd >= 0);
+	g_byte_array_set_size(payload, 0);
+	put_uint64(payload, id);
+	res &= DIAG(STATUS_OK == request(fd, REQUEST_UNLOAD, payload, answer));
+	if(fd >= 0)
+		close(fd);
+
+	server_stop(&server);
+	g_byte_array_free(answer, TRUE);
+	g_byte_array_free(payload, TRUE);
+
+	ok(res == TRUE, __func__);
+}
+
+int main(void)
+{
+	/* the server hanging up is checked, not fatal */
+	signal(SIGPIPE, SIG_IGN);
+
+	plan(1);
+
+	requests();
+
+	return 0;
+}
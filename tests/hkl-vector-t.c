@@ -24,6 +24,7 @@
 #include <tap/float.h>
 
 #include "hkl-vector-private.h" /* use to test also the private API */
+#include "hkl-quaternion-private.h"
 
 static void init(void)
 {
@@ -186,6 +187,29 @@ static void rotated_around_line(void)
 	ok(0 == hkl_vector_cmp(&y_ref, &x), __func__);
 }
 
+static void array_rotated_quaternion(void)
+{
+	HklVector axe = {{1., -1., .5}};
+	HklVector v1 = {{1., 2., 3.}};
+	HklVector v2 = {{-1., 0., .5}};
+	double v[] = {1., -1.,
+		      2., 0.,
+		      3., .5};
+	HklVector res1;
+	HklVector res2;
+	HklQuaternion q;
+
+	hkl_quaternion_init_from_angle_and_axe(&q, 30. * HKL_DEGTORAD, &axe);
+	hkl_vector_rotated_quaternion(&v1, &q);
+	hkl_vector_rotated_quaternion(&v2, &q);
+	hkl_vector_array_rotated_quaternion(v, 2, &q);
+
+	hkl_vector_init(&res1, v[0], v[2], v[4]);
+	hkl_vector_init(&res2, v[1], v[3], v[5]);
+	ok(0 == hkl_vector_cmp(&v1, &res1)
+	   && 0 == hkl_vector_cmp(&v2, &res2), __func__);
+}
+
 static void times_matrix(void)
 {
 	HklMatrix *m = hkl_matrix_new_full(1.0, 3.0,-2.0,
@@ -225,7 +249,7 @@ static void project_on_plan(void)
 
 int main(void)
 {
-	plan(32);
+	plan(33);
 
 	init();
 	cmp();
@@ -239,6 +263,7 @@ int main(void)
 	oriented_angle_points();
 	rotated_around_vector();
 	rotated_around_line();
+	array_rotated_quaternion();
 	times_matrix();
 	project_on_plan();
 
@@ -26,6 +26,8 @@
 #include "tap/basic.h"
 #include "tap/hkl-tap.h"
 
+#include "hkl-geometry-private.h"
+
 #define MODEL_FILENAME "data/diffabs.yaml"
 
 static void check_model_validity(Hkl3D *hkl3d)
@@ -140,6 +142,217 @@ static void check_no_collision(Hkl3D *hkl3d)
 	ok(res == TRUE, "no-collision");
 }
 
+/* only the colliding candidates are removed and the bound geometry is kept */
+static void check_filter_geometry_list(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+	size_t i;
+	HklGeometry *geometry = hkl_geometry_new_copy(hkl3d->geometry->geometry);
+	HklGeometryList *list = hkl_geometry_list_new();
+	double values[][6] = {{0., 0., 0., 0., 0., 0.},
+			      {23, 0., 0., 0., 0., 0.},
+			      {0., 10., 0., 0., 0., 0.},
+			      {0., 10., 20., 0., 0., 0.},
+			      {23, 10., 0., 0., 0., 0.}};
+
+	res &= DIAG(hkl_geometry_set_values_v(hkl3d->geometry->geometry,
+					      HKL_UNIT_USER, NULL,
+					      0., 0., 0., 0., 0., 0.));
+	for(i=0; i<ARRAY_SIZE(values); ++i){
+		res &= DIAG(hkl_geometry_axis_values_set(geometry,
+							 values[i], ARRAY_SIZE(values[i]),
+							 HKL_UNIT_USER, NULL));
+		hkl_geometry_list_add(list, geometry);
+	}
+
+	res &= DIAG(2 == hkl3d_filter_geometry_list(hkl3d, list));
+	res &= DIAG(3 == hkl_geometry_list_n_items_get(list));
+	res &= DIAG(hkl3d_is_colliding(hkl3d) == FALSE);
+
+	ok(res == TRUE, __func__);
+
+	hkl_geometry_list_free(list);
+	hkl_geometry_free(geometry);
+}
+
+/* the move of mu towards delta collides before its end */
+static void check_path_is_colliding(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+	double toi = -1;
+	HklGeometry *from = hkl_geometry_new_copy(hkl3d->geometry->geometry);
+	HklGeometry *to = hkl_geometry_new_copy(hkl3d->geometry->geometry);
+
+	res &= DIAG(hkl_geometry_set_values_v(from, HKL_UNIT_USER, NULL,
+					      0., 0., 0., 0., 0., 0.));
+	res &= DIAG(hkl_geometry_set_values_v(to, HKL_UNIT_USER, NULL,
+					      0., 90., 0., 0., 0., 0.));
+	res &= DIAG(hkl3d_path_is_colliding(hkl3d, from, to, 1 * HKL_DEGTORAD, &toi) == FALSE);
+
+	res &= DIAG(hkl_geometry_set_values_v(to, HKL_UNIT_USER, NULL,
+					      23., 0., 0., 0., 0., 0.));
+	res &= DIAG(hkl3d_path_is_colliding(hkl3d, from, to, 1 * HKL_DEGTORAD, &toi) == TRUE);
+	res &= DIAG(toi > 0 && toi <= 1);
+
+	/* the reverse move is colliding from its start */
+	res &= DIAG(hkl3d_path_is_colliding(hkl3d, to, from, 1 * HKL_DEGTORAD, &toi) == TRUE);
+	res &= DIAG(toi == 0);
+
+	ok(res == TRUE, __func__);
+
+	hkl_geometry_free(to);
+	hkl_geometry_free(from);
+}
+
+/* the clearance is positive without a contact and not with */
+static void check_clearance(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+
+	res &= DIAG(hkl_geometry_set_values_v(hkl3d->geometry->geometry,
+					      HKL_UNIT_USER, NULL,
+					      0., 0., 0., 0., 0., 0.));
+	res &= DIAG(hkl3d_clearance_get(hkl3d, 1.) > 0);
+	res &= DIAG(hkl3d_axis_clearance(hkl3d, "mu", 1.) > 0);
+	res &= DIAG(hkl3d_axis_clearance(hkl3d, "foo", 1.) == 1.);
+
+	res &= DIAG(hkl_geometry_set_values_v(hkl3d->geometry->geometry,
+					      HKL_UNIT_USER, NULL,
+					      23., 0., 0., 0., 0., 0.));
+	res &= DIAG(hkl3d_clearance_get(hkl3d, 1.) <= 0);
+	res &= DIAG(hkl3d_axis_clearance(hkl3d, "mu", 1.) <= 0);
+
+	ok(res == TRUE, __func__);
+}
+
+/* each thread checks the same moves with its own world */
+struct check_world_t
+{
+	Hkl3DWorld *world;
+	HklGeometry *geometry;
+	int res;
+};
+
+static gpointer check_world_thread(gpointer data)
+{
+	struct check_world_t *self = (struct check_world_t *)data;
+	double i;
+
+	self->res = TRUE;
+	for(i=0; i<=360; i=i+10){
+		double values[] = {0., i, 0., 0., 0., 0.};
+
+		self->res &= DIAG(hkl_geometry_axis_values_set(self->geometry,
+							       values, ARRAY_SIZE(values),
+							       HKL_UNIT_USER, NULL));
+		self->res &= DIAG(hkl3d_world_is_colliding(self->world, self->geometry) == FALSE);
+	}
+	self->res &= DIAG(hkl_geometry_set_values_v(self->geometry, HKL_UNIT_USER, NULL,
+						    23., 0., 0., 0., 0., 0.));
+	self->res &= DIAG(hkl3d_world_is_colliding(self->world, self->geometry) == TRUE);
+
+	/* 37 + 1 checks */
+	self->res &= DIAG(hkl3d_world_stats_get(self->world)->checks == 38);
+	self->res &= DIAG(hkl3d_world_stats_get(self->world)->manifolds > 0);
+	self->res &= DIAG(hkl3d_stats_latency_percentile(hkl3d_world_stats_get(self->world), 100) > 0);
+
+	return NULL;
+}
+
+static void check_world(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+	size_t i;
+	struct check_world_t checks[2];
+	GThread *threads[ARRAY_SIZE(checks)];
+
+	for(i=0; i<ARRAY_SIZE(checks); ++i){
+		checks[i].world = hkl3d_world_new(hkl3d);
+		checks[i].geometry = hkl_geometry_new_copy(hkl3d->geometry->geometry);
+		threads[i] = g_thread_new(NULL, check_world_thread, &checks[i]);
+	}
+	for(i=0; i<ARRAY_SIZE(checks); ++i){
+		g_thread_join(threads[i]);
+		res &= checks[i].res;
+		hkl_geometry_free(checks[i].geometry);
+		hkl3d_world_free(checks[i].world);
+	}
+
+	ok(res == TRUE, __func__);
+}
+
+/* moving the axes one by one gives the collisions of a full move */
+static void check_dirty_axes(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+	size_t i;
+	Hkl3DWorld *world = hkl3d_world_new(hkl3d);
+	HklGeometry *geometry = hkl3d->geometry->geometry;
+	const double steps[][2] = {{0, 23}, {5, 30}, {1, 90}, {0, 0}, {5, 0}, {1, 0}};
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+					      0., 0., 0., 0., 0., 0.));
+	for(i=0; i<ARRAY_SIZE(steps); ++i){
+		double values[6];
+
+		hkl_geometry_axis_values_get(geometry, values, ARRAY_SIZE(values),
+					     HKL_UNIT_USER);
+		values[(size_t)steps[i][0]] = steps[i][1];
+		res &= DIAG(hkl_geometry_axis_values_set(geometry,
+							 values, ARRAY_SIZE(values),
+							 HKL_UNIT_USER, NULL));
+		res &= DIAG(hkl3d_is_colliding(hkl3d) == hkl3d_world_is_colliding(world, geometry));
+	}
+	hkl3d_world_free(world);
+
+	ok(res == TRUE, __func__);
+}
+
+/* the engines only return the solutions which do not collide */
+static void check_engine_list(Hkl3D *hkl3d)
+{
+	int res = TRUE;
+	HklGeometry *geometry = hkl3d->geometry->geometry;
+	HklEngineList *engines = hkl_factory_create_new_engine_list(hkl_factory_get_by_name("K6C", NULL));
+	HklDetector *detector = hkl_detector_factory_new(HKL_DETECTOR_TYPE_0D);
+	HklSample *sample = hkl_sample_new("test");
+	HklEngine *engine;
+	HklGeometryList *geometries;
+	double hkl[] = {0, 0, 1};
+	size_t n = 0;
+
+	res &= DIAG(hkl_geometry_set_values_v(geometry, HKL_UNIT_USER, NULL,
+					      0., 0., 0., 0., 0., 0.));
+	hkl_engine_list_init(engines, geometry, detector, sample);
+	hkl3d_engine_list_attach(hkl3d, engines);
+	engine = hkl_engine_list_engine_get_by_name(engines, "hkl", NULL);
+
+	geometries = hkl_engine_pseudo_axis_values_set(engine,
+						       hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	if(geometries){
+		n = hkl_geometry_list_n_items_get(geometries);
+		res &= DIAG(0 == hkl3d_filter_geometry_list(hkl3d, geometries));
+		hkl_geometry_list_free(geometries);
+	}
+
+	/* without the check, the colliding solutions come back */
+	hkl_engine_list_collision_set(engines, NULL, NULL);
+	geometries = hkl_engine_pseudo_axis_values_set(engine,
+						       hkl, ARRAY_SIZE(hkl),
+						       HKL_UNIT_DEFAULT, NULL);
+	if(geometries){
+		res &= DIAG(hkl_geometry_list_n_items_get(geometries) >= n);
+		hkl_geometry_list_free(geometries);
+	}
+
+	hkl_engine_list_free(engines);
+	hkl_sample_free(sample);
+	hkl_detector_free(detector);
+
+	ok(res == TRUE, __func__);
+}
+
 int main(void)
 {
 	char* filename;
@@ -154,12 +367,25 @@ int main(void)
 	filename  = test_file_path(MODEL_FILENAME);
 	hkl3d = hkl3d_new(filename, geometry);
 
-	plan(3);
+	plan(11);
 	check_model_validity(hkl3d);
 	check_collision(hkl3d);
 	check_no_collision(hkl3d);
+	check_filter_geometry_list(hkl3d);
+	check_path_is_colliding(hkl3d);
+	check_clearance(hkl3d);
+	check_world(hkl3d);
+	check_dirty_axes(hkl3d);
+	check_engine_list(hkl3d);
 	/* TODO add/remove object*/
 
+	hkl3d_free(hkl3d);
+
+	/* the second time the models come from their cache, when it
+	 * could be written */
+	hkl3d = hkl3d_new(filename, geometry);
+	check_model_validity(hkl3d);
+	check_collision(hkl3d);
 	hkl3d_free(hkl3d);
 	test_file_path_free(filename);
 	hkl_geometry_free(geometry);
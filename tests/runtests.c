@@ -38,6 +38,9 @@
  *      runtests [-hv] [-b <build-dir>] [-s <source-dir>] <test> [<test> ...]
  *      runtests -o [-h] [-b <build-dir>] [-s <source-dir>] <test>
  *
+ * The -t <baseline> [-T <percent>] [-u] options can be added to the two first
+ * forms.
+ *
  * In the first case, expects a list of executables located in the given file,
  * one line per executable, possibly followed by a space-separated list of
  * options.  For each one, runs it as part of a test suite, reporting results.
@@ -89,6 +92,19 @@
  * If the -v option is given, or the C_TAP_VERBOSE environment variable is set,
  * display the full output of each test as it runs rather than showing a
  * summary of the results of each test.
+ *
+ * If the -t option is given, the wall time of each test and the timings it
+ * reports are compared with the ones of the <baseline> file.  A test reports
+ * a timing, in seconds, with an output line in the following format:
+ *
+ *      # timing <key> <seconds>
+ *
+ * C_TAP_TIMINGS is set in the environment of the tests, so they can report
+ * their timings only when requested.  A timing slower than its baseline by
+ * more than the -T percentage (20% by default) is a regression and makes the
+ * run fail.  Wall times shorter than TIMING_WALL_MIN in the baseline are too
+ * noisy and are not compared.  The baseline file is written when it does not
+ * exist yet, or when the -u option is given.
  */
 
 /* Required for fdopen(), getopt(), and putenv(). */
@@ -155,6 +171,12 @@
 #    define C_TAP_BUILD NULL
 #endif
 
+/* Default regression threshold of the timings, in percent. */
+#define TIMING_THRESHOLD 20.0
+
+/* Wall times shorter than this in the baseline are not compared, in s. */
+#define TIMING_WALL_MIN 0.1
+
 /* Test status codes. */
 enum test_status {
 	TEST_FAIL,
@@ -183,6 +205,20 @@ enum plan_status {
 #define CHILDERR_STDIN  102 /* Couldn't open stdin file. */
 #define CHILDERR_STDERR 103 /* Couldn't open stderr file. */
 
+/* Structure to hold a timing, in seconds, and its key. */
+struct timing {
+	char *key;
+	double seconds;
+	unsigned int wall; /* Whether it is the wall time of a test. */
+};
+
+/* Structure to hold a growable table of timings. */
+struct timings {
+	struct timing *timings;
+	size_t count;
+	size_t allocated;
+};
+
 /* Structure to hold data for a set of tests. */
 struct testset {
 	char *file;                /* The file name of the test. */
@@ -201,6 +237,8 @@ struct testset {
 	int status;                /* The exit status of the test. */
 	unsigned int all_skipped;  /* Whether all tests were skipped. */
 	char *reason;              /* Why all tests were skipped. */
+	double wall;               /* The wall time of the test in seconds. */
+	struct timings timings;    /* The timings reported by the test. */
 };
 
 /* Structure to hold a linked list of test sets. */
@@ -215,12 +253,15 @@ struct testlist {
  * split into variables to satisfy the pedantic ISO C90 limit on strings.
  */
 static const char usage_message[] = "\
-Usage: %s [-hv] [-b <build-dir>] [-s <source-dir>] <test> ...\n\
-       %s [-hv] [-b <build-dir>] [-s <source-dir>] -l <test-list>\n\
+Usage: %s [-huv] [-b <build-dir>] [-s <source-dir>] [-t <baseline>] <test> ...\n\
+       %s [-huv] [-b <build-dir>] [-s <source-dir>] [-t <baseline>] -l <test-list>\n\
        %s -o [-h] [-b <build-dir>] [-s <source-dir>] <test>\n\
 \n\
 Options:\n\
     -b <build-dir>      Set the build directory to <build-dir>\n\
+    -t <baseline>       Compare the timings with the <baseline> file\n\
+    -T <percent>        Set the timings regression threshold (default 20)\n\
+    -u                  Update the <baseline> file with the timings\n\
 %s";
 static const char usage_extra[] = "\
     -l <list>           Take the list of tests to run from <test-list>\n\
@@ -240,6 +281,11 @@ static const char banner[] = "\n\
 Running all tests listed in %s.  If any tests fail, run the failing\n\
 test program with runtests -o to see more details.\n\n";
 
+/* Header for reports of timing regressions. */
+static const char timings_header[] = "\n\
+Timing regression                                  Baseline    Current  Change\n\
+------------------------------------------------ ---------- ---------- -------";
+
 /* Header for reports of failed tests. */
 static const char header[] = "\n\
 Failed Set                 Fail/Total (%) Skip Stat  Failing Tests\n\
@@ -572,6 +618,162 @@ skip_non_whitespace(const char *p)
 }
 
 
+/*
+ * Add a timing to a table of timings.  The key is the concatenation of the
+ * prefix, if not NULL, and of the first length characters of name.
+ */
+static void
+timings_add(struct timings *timings, const char *prefix, const char *name,
+            size_t length, double seconds, unsigned int wall)
+{
+	struct timing *timing;
+	char *key;
+
+	if (timings->count == timings->allocated) {
+		timings->allocated = timings->allocated ? timings->allocated * 2 : 32;
+		timings->timings = xreallocarray(timings->timings, timings->allocated,
+		                                 struct timing);
+	}
+	key = xstrndup(name, length);
+	if (prefix != NULL) {
+		char *full = concat(prefix, ":", key, (const char *) 0);
+
+		free(key);
+		key = full;
+	}
+	timing = &timings->timings[timings->count++];
+	timing->key = key;
+	timing->seconds = seconds;
+	timing->wall = wall;
+}
+
+
+/*
+ * Find the timing with the given key in a table of timings.  Returns NULL if
+ * there is none.
+ */
+static const struct timing *
+timings_find(const struct timings *timings, const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < timings->count; i++)
+		if (strcmp(timings->timings[i].key, key) == 0)
+			return &timings->timings[i];
+	return NULL;
+}
+
+
+/* Free the content of a table of timings. */
+static void
+timings_free(struct timings *timings)
+{
+	size_t i;
+
+	for (i = 0; i < timings->count; i++)
+		free(timings->timings[i].key);
+	free(timings->timings);
+	timings->timings = NULL;
+	timings->count = 0;
+	timings->allocated = 0;
+}
+
+
+/*
+ * Read a baseline file of timings, one "<key> <seconds> [wall]" per line.
+ * Lines starting with # are comments.  Returns false if the file does not
+ * exist, other errors are fatal.
+ */
+static int
+timings_read(struct timings *timings, const char *filename)
+{
+	FILE *file;
+	char buffer[BUFSIZ];
+	const char *start, *end;
+	char *rest;
+	double seconds;
+	unsigned int line = 0;
+
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		if (errno == ENOENT)
+			return 0;
+		sysdie("can't open %s", filename);
+	}
+	while (fgets(buffer, sizeof(buffer), file)) {
+		line++;
+		start = skip_whitespace(buffer);
+		if (*start == '#' || *start == '\0')
+			continue;
+		end = skip_non_whitespace(start);
+		errno = 0;
+		seconds = strtod(end, &rest);
+		if (errno != 0 || rest == end)
+			die("invalid timing in %s on line %u", filename, line);
+		rest = (char *) skip_whitespace(rest);
+		timings_add(timings, NULL, start, end - start, seconds,
+		            strncmp(rest, "wall", 4) == 0);
+	}
+	if (ferror(file))
+		sysdie("can't read %s", filename);
+	fclose(file);
+	return 1;
+}
+
+
+/* Write a table of timings into a baseline file.  Errors are fatal. */
+static void
+timings_write(const struct timings *timings, const char *filename)
+{
+	FILE *file;
+	size_t i;
+
+	file = fopen(filename, "w");
+	if (file == NULL)
+		sysdie("can't open %s", filename);
+	fputs("# runtests timings baseline: <key> <seconds> [wall]\n", file);
+	for (i = 0; i < timings->count; i++)
+		fprintf(file, "%s %.9g%s\n", timings->timings[i].key,
+		        timings->timings[i].seconds,
+		        timings->timings[i].wall ? " wall" : "");
+	if (fclose(file) != 0)
+		sysdie("can't write %s", filename);
+}
+
+
+/*
+ * Compare the timings with the ones of a baseline and report the ones which
+ * are slower by more than threshold percent.  Timings without a baseline are
+ * not compared.  Returns the number of regressions.
+ */
+static unsigned long
+timings_compare(const struct timings *timings, const struct timings *baseline,
+                double threshold)
+{
+	const struct timing *current, *base;
+	unsigned long regressions = 0;
+	size_t i;
+
+	for (i = 0; i < timings->count; i++) {
+		current = &timings->timings[i];
+		base = timings_find(baseline, current->key);
+		if (base == NULL || base->seconds <= 0)
+			continue;
+		if (current->wall && base->seconds < TIMING_WALL_MIN)
+			continue;
+		if (current->seconds <= base->seconds * (1 + threshold / 100))
+			continue;
+		if (regressions == 0)
+			puts(timings_header);
+		printf("%-48.48s %10.4g %10.4g %+6.1f%%\n", current->key,
+		       base->seconds, current->seconds,
+		       (current->seconds / base->seconds - 1) * 100);
+		regressions++;
+	}
+	return regressions;
+}
+
+
 /*
  * Start a program, connecting its stdout to a pipe on our end and its stderr
  * to /dev/null, and storing the file descriptor to read from in the two
@@ -836,9 +1038,25 @@ test_checkline(const char *line, struct testset *ts, enum test_verbose verbose)
 	if (line[strlen(line) - 1] != '\n')
 		return;
 
-	/* If the line begins with a hash mark, ignore it. */
-	if (line[0] == '#')
+	/*
+	 * If the line begins with a hash mark, ignore it, unless it reports a
+	 * timing.
+	 */
+	if (line[0] == '#') {
+		if (strncmp(line, "# timing ", strlen("# timing ")) == 0) {
+			const char *key, *key_end;
+			double seconds;
+
+			key = skip_whitespace(line + strlen("# timing "));
+			key_end = skip_non_whitespace(key);
+			errno = 0;
+			seconds = strtod(key_end, &end);
+			if (key_end != key && end != key_end && errno == 0)
+				timings_add(&ts->timings, ts->file, key, key_end - key,
+				            seconds, 0);
+		}
 		return;
+	}
 
 	/* If we haven't yet seen a plan, look for one. */
 	if (ts->plan == PLAN_INIT && isdigit((unsigned char) (*line))) {
@@ -1514,6 +1732,7 @@ free_testset(struct testset *ts)
 	free(ts->command);
 	free(ts->results);
 	free(ts->reason);
+	timings_free(&ts->timings);
 	free(ts);
 }
 
@@ -1522,17 +1741,19 @@ free_testset(struct testset *ts)
  * Run a batch of tests.  Takes two additional parameters: the root of the
  * source directory and the root of the build directory.  Test programs will
  * be first searched for in the current directory, then the build directory,
- * then the source directory.  Returns true iff all tests passed, and always
- * frees the test list that's passed in.
+ * then the source directory.  The wall time of each test and the timings it
+ * reports are stored into timings if it is not NULL.  Returns true iff all
+ * tests passed, and always frees the test list that's passed in.
  */
 static int
-test_batch(struct testlist *tests, enum test_verbose verbose)
+test_batch(struct testlist *tests, enum test_verbose verbose,
+           struct timings *timings)
 {
 	size_t length, i;
 	size_t longest = 0;
 	unsigned int count = 0;
 	struct testset *ts;
-	struct timeval start, end;
+	struct timeval start, end, test_start_time, test_end_time;
 	struct rusage stats;
 	struct testlist *failhead = NULL;
 	struct testlist *failtail = NULL;
@@ -1577,11 +1798,24 @@ test_batch(struct testlist *tests, enum test_verbose verbose)
 			fflush(stdout);
 
 		/* Run the test. */
+		gettimeofday(&test_start_time, NULL);
 		succeeded = test_run(ts, verbose);
+		gettimeofday(&test_end_time, NULL);
+		ts->wall = tv_diff(&test_end_time, &test_start_time);
 		fflush(stdout);
 		if (verbose)
 			putchar('\n');
 
+		/* Record the timings. */
+		if (timings != NULL) {
+			timings_add(timings, NULL, ts->file, strlen(ts->file), ts->wall,
+			            1);
+			for (i = 0; i < ts->timings.count; i++)
+				timings_add(timings, NULL, ts->timings.timings[i].key,
+				            strlen(ts->timings.timings[i].key),
+				            ts->timings.timings[i].seconds, 0);
+		}
+
 		/* Record cumulative statistics. */
 		aborted += ts->aborted;
 		total += ts->count + ts->all_skipped;
@@ -1692,10 +1926,16 @@ main(int argc, char *argv[])
 	const char *list = NULL;
 	const char *source = C_TAP_SOURCE;
 	const char *build = C_TAP_BUILD;
+	const char *baseline_file = NULL;
+	double threshold = TIMING_THRESHOLD;
+	int update = 0;
+	char *end;
 	struct testlist *tests;
+	struct timings timings = {NULL, 0, 0};
+	struct timings baseline = {NULL, 0, 0};
 
 	program = argv[0];
-	while ((option = getopt(argc, argv, "b:hl:os:v")) != EOF) {
+	while ((option = getopt(argc, argv, "b:hl:os:t:T:uv")) != EOF) {
 		switch (option) {
 		case 'b':
 			build = optarg;
@@ -1712,6 +1952,18 @@ main(int argc, char *argv[])
 		case 's':
 			source = optarg;
 			break;
+		case 't':
+			baseline_file = optarg;
+			break;
+		case 'T':
+			errno = 0;
+			threshold = strtod(optarg, &end);
+			if (errno != 0 || *end != '\0' || threshold < 0)
+				die("invalid timings threshold %s", optarg);
+			break;
+		case 'u':
+			update = 1;
+			break;
 		case 'v':
 			verbose = VERBOSE;
 			break;
@@ -1755,6 +2007,11 @@ main(int argc, char *argv[])
 			sysdie("cannot set BUILD in the environment");
 	}
 
+	/* Let the tests know that their timings are expected. */
+	if (baseline_file != NULL && !single)
+		if (putenv((char *) "C_TAP_TIMINGS=1") != 0)
+			sysdie("cannot set C_TAP_TIMINGS in the environment");
+
 	/* Run the tests as instructed. */
 	if (single)
 		test_single(argv[0], source, build);
@@ -1766,10 +2023,37 @@ main(int argc, char *argv[])
 			shortlist++;
 		printf(banner, shortlist);
 		tests = read_test_list(list, source, build);
-		status = test_batch(tests, verbose) ? 0 : 1;
+		status = test_batch(tests, verbose,
+		                    baseline_file != NULL ? &timings : NULL) ? 0 : 1;
 	} else {
 		tests = build_test_list(argv, argc, source, build);
-		status = test_batch(tests, verbose) ? 0 : 1;
+		status = test_batch(tests, verbose,
+		                    baseline_file != NULL ? &timings : NULL) ? 0 : 1;
+	}
+
+	/*
+	 * Compare the timings with the baseline, or write it if there is none
+	 * yet or if an update was requested.
+	 */
+	if (baseline_file != NULL) {
+		unsigned long regressions = 0;
+
+		if (!update && timings_read(&baseline, baseline_file)) {
+			regressions = timings_compare(&timings, &baseline, threshold);
+			if (regressions != 0) {
+				printf("\n%lu timing regression%s above %.1f%% of %s.\n",
+				       regressions, regressions == 1 ? "" : "s", threshold,
+				       baseline_file);
+				status = 1;
+			} else
+				printf("No timing regression above %.1f%% of %s.\n",
+				       threshold, baseline_file);
+		} else {
+			timings_write(&timings, baseline_file);
+			printf("Timings written to %s.\n", baseline_file);
+		}
+		timings_free(&baseline);
+		timings_free(&timings);
 	}
 
 	/* For valgrind cleanliness, free all our memory. */
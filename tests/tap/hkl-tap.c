@@ -26,6 +26,9 @@
 #include "hkl/hkl-matrix-private.h"
 #include "hkl/hkl-macros-private.h"
 #include "hkl/hkl-pseudoaxis-private.h"
+#include "hkl/hkl-pseudoaxis-auto-private.h"
+#include "hkl/ccan/container_of/container_of.h"
+#include <gsl/gsl_multiroots.h>
 
 void is_quaternion(const HklQuaternion *wanted, const HklQuaternion *seen, const char *format, ...)
 {
@@ -104,6 +107,54 @@ int check_pseudoaxes(HklEngine *engine,
 	return res;
 }
 
+/**
+ * check_jacobian: (skip)
+ * @engine: the engine, its current mode must be an auto mode
+ * @x: the values of the written axes (radian)
+ * @n: the number of written axes
+ *
+ * compare the analytic jacobian of each function of the current mode
+ * with the finite differences computed by gsl.
+ **/
+int check_jacobian(HklEngine *engine, const double x[], size_t n)
+{
+	int res = TRUE;
+	const HklModeAutoInfo *info = container_of(engine->mode->info, HklModeAutoInfo, info);
+	const HklFunction **function;
+	gsl_vector_const_view xv = gsl_vector_const_view_array(x, n);
+
+	darray_foreach(function, info->functions){
+		gsl_multiroot_function f = {(*function)->function, (*function)->size, engine};
+		gsl_vector *fx = gsl_vector_alloc((*function)->size);
+		gsl_matrix *J = gsl_matrix_alloc((*function)->size, n);
+		gsl_matrix *Jfd = gsl_matrix_alloc((*function)->size, n);
+		size_t i, j;
+
+		res &= NULL != (*function)->jacobian;
+		if(res){
+			res &= GSL_SUCCESS == (*function)->function(&xv.vector, engine, fx);
+			res &= GSL_SUCCESS == gsl_multiroot_fdjacobian(&f, &xv.vector, fx,
+								       GSL_SQRT_DBL_EPSILON, Jfd);
+			res &= GSL_SUCCESS == (*function)->jacobian(&xv.vector, engine, J);
+			for(i=0; i<J->size1; ++i)
+				for(j=0; j<J->size2; ++j)
+					if(fabs(gsl_matrix_get(J, i, j) - gsl_matrix_get(Jfd, i, j)) > 1e-5){
+						fprintf(stderr, "J[%zu][%zu]: %f, finite differences: %f\n",
+							i, j,
+							gsl_matrix_get(J, i, j),
+							gsl_matrix_get(Jfd, i, j));
+						res = FALSE;
+					}
+		}
+
+		gsl_matrix_free(Jfd);
+		gsl_matrix_free(J);
+		gsl_vector_free(fx);
+	}
+
+	return res;
+}
+
 /**
  * hkl_engine_set_values_v: (skip)
  * @self: the Engine
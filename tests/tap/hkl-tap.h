@@ -49,6 +49,8 @@ extern int check_pseudoaxes_v(HklEngine *engine, ...);
 extern int check_pseudoaxes(HklEngine *engine,
 			    double expected[], uint len);
 
+extern int check_jacobian(HklEngine *engine, const double x[], size_t n);
+
 extern  void hkl_tap_engine_pseudo_axes_randomize(HklEngine *self,
 						  double values[], size_t n_values,
 						  HklUnitEnum unit_type) HKL_ARG_NONNULL(1, 2);